@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# 回归检查。建议先运行 reconfig_release_cxx11.sh，在发布构建上比较。
+#   ./run_bench.sh [<poseidon-bench 的其他参数>...]  与基准比较，有退化时以 2 退出。
+#   ./run_bench.sh -u [<poseidon-bench 的其他参数>...]  重新测量并覆盖基准。
+
+etc=`pwd`'/etc'
+baseline=`pwd`'/var/poseidon/bench_baseline.jsonl'
+
+make bench || exit 1
+
+if [ "$1" == "-u" ]; then
+	shift
+	./libtool --mode=execute ./bin/poseidon-bench -o "$baseline" "$@" $etc/poseidon
+elif [ -f "$baseline" ]; then
+	./libtool --mode=execute ./bin/poseidon-bench -b "$baseline" --text "$@" $etc/poseidon
+else
+	echo "Baseline '$baseline' does not exist. Run '$0 -u' to create it." >&2
+	exit 1
+fi
@@ -8,6 +8,7 @@
 #include "log.hpp"
 #include "profiler.hpp"
 #include "singletons/job_dispatcher.hpp"
+#include "pooled_allocator.hpp"
 
 namespace Poseidon {
 
@@ -54,10 +55,10 @@ namespace {
 }
 
 void enqueue_async_categorized_job(boost::weak_ptr<const void> category, const boost::shared_ptr<Promise> &promise, boost::function<void ()> procedure, boost::shared_ptr<const bool> withdrawn){
-	JobDispatcher::enqueue(boost::make_shared<AsyncJob>(STD_MOVE(category), promise, STD_MOVE_IDN(procedure)), STD_MOVE(withdrawn));
+	JobDispatcher::enqueue(boost::allocate_shared<AsyncJob>(PooledAllocator<AsyncJob>(), STD_MOVE(category), promise, STD_MOVE_IDN(procedure)), STD_MOVE(withdrawn));
 }
 void enqueue_async_job(const boost::shared_ptr<Promise> &promise, boost::function<void ()> procedure, boost::shared_ptr<const bool> withdrawn){
-	JobDispatcher::enqueue(boost::make_shared<AsyncJob>(boost::weak_ptr<const void>(), promise, STD_MOVE_IDN(procedure)), STD_MOVE(withdrawn));
+	JobDispatcher::enqueue(boost::allocate_shared<AsyncJob>(PooledAllocator<AsyncJob>(), boost::weak_ptr<const void>(), promise, STD_MOVE_IDN(procedure)), STD_MOVE(withdrawn));
 }
 
 }
@@ -5,6 +5,9 @@
 #include "base64.hpp"
 #include "profiler.hpp"
 #include "exception.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
@@ -42,6 +45,302 @@ namespace {
 	int from_base64_digit(unsigned char ch){
 		return BASE64_REV_TABLE[ch & 0xFF];
 	}
+
+
+	// 以下函数只处理完整的三元组（编码）或者四元组（解码），返回已经处理的输入字节数，不会越界读写。
+	// 解码时遇到包含其他字符（包括空白和填充字符）的四元组就停止，剩下的部分由调用者逐个字符处理。
+
+	std::size_t encode_blocks_generic(unsigned char *str, const unsigned char *data, std::size_t size) NOEXCEPT {
+		std::size_t read = 0;
+		unsigned char *write = str;
+		while(size - read >= 3){
+			const unsigned long seq = (static_cast<unsigned long>(data[read]) << 16) | (static_cast<unsigned long>(data[read + 1]) << 8) | data[read + 2];
+			write[0] = to_base64_digit(seq >> 18);
+			write[1] = to_base64_digit(seq >> 12);
+			write[2] = to_base64_digit(seq >>  6);
+			write[3] = to_base64_digit(seq >>  0);
+			read += 3;
+			write += 4;
+		}
+		return read;
+	}
+	std::size_t decode_blocks_generic(unsigned char *data, const unsigned char *str, std::size_t len) NOEXCEPT {
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(len - read >= 4){
+			const int d0 = from_base64_digit(str[read]);
+			const int d1 = from_base64_digit(str[read + 1]);
+			const int d2 = from_base64_digit(str[read + 2]);
+			const int d3 = from_base64_digit(str[read + 3]);
+			if((d0 | d1 | d2 | d3) < 0){
+				break;
+			}
+			const unsigned long seq = (static_cast<unsigned long>(d0) << 18) | (static_cast<unsigned long>(d1) << 12) | (static_cast<unsigned long>(d2) << 6) | static_cast<unsigned long>(d3);
+			write[0] = static_cast<unsigned char>(seq >> 16);
+			write[1] = static_cast<unsigned char>(seq >>  8);
+			write[2] = static_cast<unsigned char>(seq >>  0);
+			read += 4;
+			write += 3;
+		}
+		return read;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	// 向量化的算法来自 Wojciech Muła 和 Daniel Lemire 的 "Faster Base64 Encoding and Decoding Using AVX2 Instructions"。
+	// 编码时每 16 字节的向量中取 12 字节，把每 3 字节拆成 4 个 6 位的索引，然后按照索引所在的区间加上不同的偏移量得到字符。
+	// 解码时先按照字符所在的区间减去偏移量，任何一个字符不在字母表中就放弃这个向量，然后把每 4 个 6 位的值合并成 3 字节。
+
+	__attribute__((__target__("ssse3")))
+	std::size_t encode_blocks_ssse3(unsigned char *str, const unsigned char *data, std::size_t size) NOEXCEPT {
+		const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+		const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		                                      '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		std::size_t read = 0;
+		unsigned char *write = str;
+		// 每次读取 16 字节，只使用其中的 12 字节。
+		while(size - read >= 16){
+			const __m128i in = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + read)), shuffle);
+			const __m128i hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+			const __m128i lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+			const __m128i indices = _mm_or_si128(hi, lo);
+			// 0..25 -> 13，26..51 -> 0，52..61 -> 1..10，62 -> 11，63 -> 12。
+			__m128i ranges = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+			ranges = _mm_or_si128(ranges, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(write), _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, ranges)));
+			read += 12;
+			write += 16;
+		}
+		return read + encode_blocks_generic(write, data + read, size - read);
+	}
+	__attribute__((__target__("ssse3")))
+	std::size_t decode_blocks_ssse3(unsigned char *data, const unsigned char *str, std::size_t len) NOEXCEPT {
+		const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(len - read >= 16){
+			const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + read));
+			// 大于 0x7F 的字节是负数，不会落在任何一个区间中。
+			const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+			const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+			const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+			const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+			const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+			const __m128i valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), digit), _mm_or_si128(plus, slash));
+			if(_mm_movemask_epi8(valid) != 0xFFFF){
+				break;
+			}
+			__m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+			shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+			shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+			shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+			shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+			const __m128i values = _mm_add_epi8(in, shift);
+			// 每 2 个 6 位合并成 12 位，每 2 个 12 位合并成 24 位，然后按照大端序取出每个 32 位整数的低 3 字节。
+			const __m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+			const __m128i out = _mm_shuffle_epi8(merged, shuffle);
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(write), out);
+			const int last = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+			std::memcpy(write + 8, &last, 4);
+			read += 16;
+			write += 12;
+		}
+		return read + decode_blocks_generic(write, str + read, len - read);
+	}
+
+	__attribute__((__target__("avx2")))
+	std::size_t encode_blocks_avx2(unsigned char *str, const unsigned char *data, std::size_t size) NOEXCEPT {
+		const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		                                         1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+		const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		                                         'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		                                         '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		std::size_t read = 0;
+		unsigned char *write = str;
+		// 两个 128 位的通道分别从 read 和 read + 12 读取 16 字节，各使用其中的 12 字节。
+		while(size - read >= 28){
+			const __m128i in_lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + read));
+			const __m128i in_hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + read + 12));
+			const __m256i in = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(in_lo), in_hi, 1), shuffle);
+			const __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+			const __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+			const __m256i indices = _mm256_or_si256(hi, lo);
+			__m256i ranges = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+			ranges = _mm256_or_si256(ranges, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices), _mm256_set1_epi8(13)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(write), _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, ranges)));
+			read += 24;
+			write += 32;
+		}
+		return read + encode_blocks_ssse3(write, data + read, size - read);
+	}
+	__attribute__((__target__("avx2")))
+	std::size_t decode_blocks_avx2(unsigned char *data, const unsigned char *str, std::size_t len) NOEXCEPT {
+		const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		                                         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(len - read >= 32){
+			const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + read));
+			const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+			const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+			const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+			const __m256i plus = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+			const __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+			const __m256i valid = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(upper, lower), digit), _mm256_or_si256(plus, slash));
+			if(_mm256_movemask_epi8(valid) != -1){
+				break;
+			}
+			__m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+			shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+			shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+			shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+			shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+			const __m256i values = _mm256_add_epi8(in, shift);
+			const __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+			const __m256i out = _mm256_shuffle_epi8(merged, shuffle);
+			// 每个通道的低 12 字节有效。
+			const __m128i out_lo = _mm256_castsi256_si128(out);
+			const __m128i out_hi = _mm256_extracti128_si256(out, 1);
+			int last;
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(write), out_lo);
+			last = _mm_cvtsi128_si32(_mm_srli_si128(out_lo, 8));
+			std::memcpy(write + 8, &last, 4);
+			_mm_storel_epi64(reinterpret_cast<__m128i *>(write + 12), out_hi);
+			last = _mm_cvtsi128_si32(_mm_srli_si128(out_hi, 8));
+			std::memcpy(write + 20, &last, 4);
+			read += 32;
+			write += 24;
+		}
+		return read + decode_blocks_ssse3(write, str + read, len - read);
+	}
+#endif
+
+	typedef std::size_t (*BlockProc)(unsigned char *dst, const unsigned char *src, std::size_t size);
+
+	struct BlockProcs {
+		BlockProc encode;
+		BlockProc decode;
+	};
+
+	BlockProcs choose_block_procs() NOEXCEPT {
+		BlockProcs procs = { &encode_blocks_generic, &decode_blocks_generic };
+#if defined(__x86_64__) || defined(__i386__)
+		// __builtin_cpu_supports() 同时检查操作系统是否保存 YMM 寄存器。
+		if(__builtin_cpu_supports("avx2")){
+			procs.encode = &encode_blocks_avx2;
+			procs.decode = &decode_blocks_avx2;
+		} else if(__builtin_cpu_supports("ssse3")){
+			procs.encode = &encode_blocks_ssse3;
+			procs.decode = &decode_blocks_ssse3;
+		}
+#endif
+		return procs;
+	}
+
+	const BlockProcs &get_block_procs(){
+		static const BlockProcs s_procs = choose_block_procs();
+		return s_procs;
+	}
+
+	// seq 的含义与 Base64Encoder::m_seq 相同。返回输出的结尾。
+	unsigned char *encode(unsigned long &seq, unsigned char *str, const unsigned char *data, std::size_t size){
+		std::size_t read = 0;
+		unsigned char *write = str;
+		// 先补全上次剩下的不完整的三元组。
+		while((seq != 1) && (read < size)){
+			seq = (seq << 8) + data[read++];
+			if(seq >= (1ul << 24)){
+				*(write++) = to_base64_digit(seq >> 18);
+				*(write++) = to_base64_digit(seq >> 12);
+				*(write++) = to_base64_digit(seq >>  6);
+				*(write++) = to_base64_digit(seq >>  0);
+				seq = 1;
+			}
+		}
+		const std::size_t n = (*(get_block_procs().encode))(write, data + read, size - read);
+		read += n;
+		write += n / 3 * 4;
+		while(read < size){
+			seq = (seq << 8) + data[read++];
+		}
+		return write;
+	}
+	unsigned char *encode_finish(unsigned long seq, unsigned char *str){
+		unsigned char *write = str;
+		if(seq >= (1ul << 16)){
+			*(write++) = to_base64_digit(seq >> 10);
+			*(write++) = to_base64_digit(seq >>  4);
+			*(write++) = to_base64_digit(seq <<  2);
+			*(write++) = '=';
+		} else if(seq >= (1ul << 8)){
+			*(write++) = to_base64_digit(seq >>  2);
+			*(write++) = to_base64_digit(seq <<  4);
+			*(write++) = '=';
+			*(write++) = '=';
+		}
+		return write;
+	}
+
+	// seq 的含义与 Base64Decoder::m_seq 相同。返回输出的结尾。
+	unsigned char *decode(unsigned long &seq, unsigned char *data, const unsigned char *str, std::size_t len){
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(read < len){
+			if(seq == 1){
+				const std::size_t n = (*(get_block_procs().decode))(write, str + read, len - read);
+				read += n;
+				write += n / 4 * 3;
+				if(read == len){
+					break;
+				}
+			}
+			const unsigned char ch = str[read++];
+			if((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n')){
+				continue;
+			}
+			unsigned long next = seq << 6;
+			if(ch == '='){
+				unsigned long n_add = 0;
+				if((next >= (1ul << 24)) && ((next >> 24) <= 2)){
+					n_add = 1ul << 24;
+				} else if((next >= (1ul << 18)) && ((next >> 18) <= 1)){
+					n_add = 1ul << 18;
+				}
+				DEBUG_THROW_UNLESS(n_add != 0, Exception, sslit("Invalid base64 padding character encountered"));
+				next += n_add;
+			} else {
+				const int digit = from_base64_digit(ch);
+				DEBUG_THROW_UNLESS(digit >= 0, Exception, sslit("Invalid base64 character encountered"));
+				next += static_cast<unsigned>(digit);
+			}
+			if(next >= (1ul << 24)){
+				const unsigned long n = 4 - (next >> 24);
+				switch(n){
+				case 1:
+					*(write++) = static_cast<unsigned char>(next >> 16);
+					break;
+				case 2:
+					*(write++) = static_cast<unsigned char>(next >> 16);
+					*(write++) = static_cast<unsigned char>(next >>  8);
+					break;
+				case 3:
+					*(write++) = static_cast<unsigned char>(next >> 16);
+					*(write++) = static_cast<unsigned char>(next >>  8);
+					*(write++) = static_cast<unsigned char>(next >>  0);
+					break;
+				default:
+					DEBUG_THROW(Exception, sslit("Invalid base64 data"));
+				}
+				seq = 1;
+			} else {
+				seq = next;
+			}
+		}
+		return write;
+	}
+
+	// 流式接口每次最多处理这么多输入，输出先写到栈上的缓冲区中。
+	CONSTEXPR const std::size_t STREAMING_STEP = 3072;
 }
 
 Base64Encoder::Base64Encoder()
@@ -56,19 +355,13 @@ void Base64Encoder::clear(){
 void Base64Encoder::put(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	for(std::size_t i = 0; i < size; ++i){
-		const unsigned char ch = static_cast<const unsigned char *>(data)[i];
-		unsigned long seq = m_seq << 8;
-		seq += static_cast<unsigned>(ch);
-		if(seq >= (1ul << 24)){
-			m_buffer.put(to_base64_digit(seq >> 18));
-			m_buffer.put(to_base64_digit(seq >> 12));
-			m_buffer.put(to_base64_digit(seq >>  6));
-			m_buffer.put(to_base64_digit(seq >>  0));
-			m_seq = 1;
-		} else {
-			m_seq = seq;
-		}
+	unsigned char temp[STREAMING_STEP / 3 * 4 + 4];
+	std::size_t read = 0;
+	while(read < size){
+		const std::size_t n = std::min(size - read, STREAMING_STEP);
+		const unsigned char *const end = encode(m_seq, temp, static_cast<const unsigned char *>(data) + read, n);
+		m_buffer.put(temp, static_cast<std::size_t>(end - temp));
+		read += n;
 	}
 }
 void Base64Encoder::put(const StreamBuffer &buffer){
@@ -84,18 +377,9 @@ void Base64Encoder::put(const StreamBuffer &buffer){
 StreamBuffer Base64Encoder::finalize(){
 	PROFILE_ME;
 
-	const AUTO(seq, m_seq);
-	if(seq >= (1ul << 16)){
-		m_buffer.put(to_base64_digit(seq >> 10));
-		m_buffer.put(to_base64_digit(seq >>  4));
-		m_buffer.put(to_base64_digit(seq <<  2));
-		m_buffer.put('=');
-	} else if(seq >= (1ul << 8)){
-		m_buffer.put(to_base64_digit(seq >>  2));
-		m_buffer.put(to_base64_digit(seq <<  4));
-		m_buffer.put('=');
-		m_buffer.put('=');
-	}
+	unsigned char temp[4];
+	const unsigned char *const end = encode_finish(m_seq, temp);
+	m_buffer.put(temp, static_cast<std::size_t>(end - temp));
 
 	AUTO(ret, STD_MOVE_IDN(m_buffer));
 	clear();
@@ -114,48 +398,13 @@ void Base64Decoder::clear(){
 void Base64Decoder::put(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	for(std::size_t i = 0; i < size; ++i){
-		const unsigned char ch = static_cast<const unsigned char *>(data)[i];
-		if((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n')){
-			continue;
-		}
-		unsigned long seq = m_seq << 6;
-		if(ch == '='){
-			unsigned long n_add = 0;
-			if((seq >= (1ul << 24)) && ((seq >> 24) <= 2)){
-				n_add = 1ul << 24;
-			} else if((seq >= (1ul << 18)) && ((seq >> 18) <= 1)){
-				n_add = 1ul << 18;
-			}
-			DEBUG_THROW_UNLESS(n_add != 0, Exception, sslit("Invalid base64 padding character encountered"));
-			seq += n_add;
-		} else {
-			const int digit = from_base64_digit(ch);
-			DEBUG_THROW_UNLESS(digit >= 0, Exception, sslit("Invalid base64 character encountered"));
-			seq += static_cast<unsigned>(digit);
-		}
-		if(seq >= (1ul << 24)){
-			const unsigned long n = 4 - (seq >> 24);
-			switch(n){
-			case 1:
-				m_buffer.put((seq >> 16) & 0xFF);
-				break;
-			case 2:
-				m_buffer.put((seq >> 16) & 0xFF);
-				m_buffer.put((seq >>  8) & 0xFF);
-				break;
-			case 3:
-				m_buffer.put((seq >> 16) & 0xFF);
-				m_buffer.put((seq >>  8) & 0xFF);
-				m_buffer.put((seq >>  0) & 0xFF);
-				break;
-			default:
-				DEBUG_THROW(Exception, sslit("Invalid base64 data"));
-			}
-			m_seq = 1;
-		} else {
-			m_seq = seq;
-		}
+	unsigned char temp[STREAMING_STEP / 4 * 3 + 3];
+	std::size_t read = 0;
+	while(read < size){
+		const std::size_t n = std::min(size - read, STREAMING_STEP);
+		const unsigned char *const end = decode(m_seq, temp, static_cast<const unsigned char *>(data) + read, n);
+		m_buffer.put(temp, static_cast<std::size_t>(end - temp));
+		read += n;
 	}
 }
 void Base64Decoder::put(const StreamBuffer &buffer){
@@ -177,48 +426,57 @@ StreamBuffer Base64Decoder::finalize(){
 	return ret;
 }
 
+std::size_t base64_encode_to(char *str, const void *data, std::size_t size){
+	unsigned long seq = 1;
+	unsigned char *const begin = reinterpret_cast<unsigned char *>(str);
+	unsigned char *end = encode(seq, begin, static_cast<const unsigned char *>(data), size);
+	end = encode_finish(seq, end);
+	return static_cast<std::size_t>(end - begin);
+}
+std::size_t base64_decode_to(void *data, const char *str, std::size_t len){
+	unsigned long seq = 1;
+	unsigned char *const begin = static_cast<unsigned char *>(data);
+	const unsigned char *const end = decode(seq, begin, reinterpret_cast<const unsigned char *>(str), len);
+	DEBUG_THROW_UNLESS(seq == 1, Exception, sslit("Incomplete base64 data"));
+	return static_cast<std::size_t>(end - begin);
+}
+
 std::string base64_encode(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	Base64Encoder enc;
-	enc.put(data, size);
-	return enc.get_buffer().dump_string();
+	std::string str;
+	if(size != 0){
+		str.resize(get_base64_encoded_size(size));
+		str.resize(base64_encode_to(&str[0], data, size));
+	}
+	return str;
 }
 std::string base64_encode(const char *str){
-	PROFILE_ME;
-
-	Base64Encoder enc;
-	enc.put(str);
-	return enc.get_buffer().dump_string();
+	return base64_encode(str, std::strlen(str));
 }
 std::string base64_encode(const std::string &str){
-	PROFILE_ME;
-
-	Base64Encoder enc;
-	enc.put(str);
-	return enc.get_buffer().dump_string();
+	return base64_encode(str.data(), str.size());
 }
 
 std::string base64_decode(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	Base64Decoder dec;
-	dec.put(data, size);
-	return dec.get_buffer().dump_string();
+	// 和以前一样，不完整的四元组被丢弃。
+	std::string str;
+	if(size != 0){
+		str.resize(get_base64_decoded_size_max(size));
+		unsigned long seq = 1;
+		unsigned char *const begin = reinterpret_cast<unsigned char *>(&str[0]);
+		const unsigned char *const end = decode(seq, begin, static_cast<const unsigned char *>(data), size);
+		str.resize(static_cast<std::size_t>(end - begin));
+	}
+	return str;
 }
 std::string base64_decode(const char *str){
-	PROFILE_ME;
-
-	Base64Decoder dec;
-	dec.put(str);
-	return dec.get_buffer().dump_string();
+	return base64_decode(str, std::strlen(str));
 }
 std::string base64_decode(const std::string &str){
-	PROFILE_ME;
-
-	Base64Decoder dec;
-	dec.put(str);
-	return dec.get_buffer().dump_string();
+	return base64_decode(str.data(), str.size());
 }
 
 }
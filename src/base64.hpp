@@ -82,6 +82,19 @@ public:
 	StreamBuffer finalize();
 };
 
+// 以下两个函数直接写入调用者提供的缓冲区，不分配内存。x86 上根据 CPU 使用 SSSE3 或者 AVX2 指令。
+// 编码时 str 至少要有 get_base64_encoded_size(size) 字节，返回值总是等于这个值。
+inline std::size_t get_base64_encoded_size(std::size_t size){
+	return (size + 2) / 3 * 4;
+}
+extern std::size_t base64_encode_to(char *str, const void *data, std::size_t size);
+// 解码时 data 至少要有 get_base64_decoded_size_max(len) 字节，返回实际写入的字节数。
+// 允许空白字符。数据无效或者不完整时抛出异常。
+inline std::size_t get_base64_decoded_size_max(std::size_t len){
+	return (len + 3) / 4 * 3;
+}
+extern std::size_t base64_decode_to(void *data, const char *str, std::size_t len);
+
 extern std::string base64_encode(const void *data, std::size_t size);
 extern std::string base64_encode(const char *str);
 extern std::string base64_encode(const std::string &str);
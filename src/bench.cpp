@@ -0,0 +1,1238 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 基准测试。
+// 用法：poseidon-bench [-f <过滤>] [-t <毫秒>] [-r <次数>] [-o <输出文件>] [-b <基准文件>] [--threshold <百分比>] [--p99-threshold <百分比>] [--text] [<运行目录>]
+//   -f  只运行名称中包含这个字符串的测试，可以指定多次。
+//   -t  每次测量至少持续的毫秒数，默认为 200。
+//   -r  每个测试重复测量的次数，默认为 5，结果取中位数。
+//   -o  结果写到这个文件中，默认为标准输出。日志仍然按照 main.conf 输出。
+//   -b  与之前某次运行输出的 JSON Lines 文件比较，超出阈值的测试被标记为退化，此时进程以 2 退出。
+//   --threshold      ns_per_op（即吞吐量）允许变差的百分比，默认为 10。
+//   --p99-threshold  ns_per_op_p99 允许变差的百分比，默认为 25。
+//   运行目录与 poseidon 相同，默认为 /usr/etc/poseidon，定时器、任务和回环的测试使用其中 main.conf 的配置。
+// 默认每行输出一个 JSON 对象（JSON Lines）：第一行的 type 为 environment，描述编译器和配置；
+// 此后每个测试一行，type 为 result，包含 name、iterations、ns_per_op（中位数）、ns_per_op_min、ns_per_op_max，
+// 处理字节流的测试还有 bytes_per_op 和 mb_per_s，回环测试还有 ns_per_op_p99（所有重复测量中每次往返的第 99 百分位）。
+// 不同版本之间按照 name 比较即可。指定了 -b 时，每个结果中还有 baseline_ns_per_op、change 和 regressed，
+// 最后一行的 type 为 comparison，汇总比较过的和退化的测试。
+// 任务的测试在主线程中调度，job_thread_count 不为 0 时结果包含线程之间唤醒的延迟。
+// 回环测试（loopback/*）在本进程中启动 CBPP、HTTP 和 WebSocket 的服务端，通过 127.0.0.1 往返，用于发现网络路径上的退化。
+
+#include "precompiled.hpp"
+#include "singletons/main_config.hpp"
+#include "singletons/timer_daemon.hpp"
+#include "singletons/job_dispatcher.hpp"
+#include "singletons/event_dispatcher.hpp"
+#include "singletons/epoll_daemon.hpp"
+#include "cbpp/message_base.hpp"
+#include "cbpp/session.hpp"
+#include "cbpp/writer.hpp"
+#include "http/server_reader.hpp"
+#include "http/session.hpp"
+#include "http/upgraded_session_base.hpp"
+#include "websocket/reader.hpp"
+#include "websocket/writer.hpp"
+#include "websocket/opcodes.hpp"
+#include "websocket/session.hpp"
+#include "websocket/handshake.hpp"
+#include "tcp_server_base.hpp"
+#include "sock_addr.hpp"
+#include "ip_port.hpp"
+#include "raii.hpp"
+#include "thread.hpp"
+#include "system_exception.hpp"
+#include "stream_buffer.hpp"
+#include "buffer_streams.hpp"
+#include "job_base.hpp"
+#include "event_base.hpp"
+#include "json.hpp"
+#include "json_parser.hpp"
+#include "json_writer.hpp"
+#include "optional_map.hpp"
+#include "multi_index_map.hpp"
+#include "shared_nts.hpp"
+#include "md5.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
+#include "crc32.hpp"
+#include "zlib.hpp"
+#include "base64.hpp"
+#include "hex.hpp"
+#include "random.hpp"
+#include "uuid.hpp"
+#include "log.hpp"
+#include "time.hpp"
+#include "atomic.hpp"
+#include "exception.hpp"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sched.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MESSAGE_NAME        BenchMessage
+#define MESSAGE_ID          0x7FFF
+#define MESSAGE_FIELDS      \
+	FIELD_VUINT(id)	\
+	FIELD_VINT(delta)	\
+	FIELD_STRING(name)	\
+	FIELD_BLOB(payload)	\
+	FIELD_ARRAY(items,	\
+		FIELD_VUINT(key)	\
+		FIELD_STRING(value)	\
+	)
+#define CBPP_MESSAGE_EMIT_EXTERNAL_DEFINITIONS
+#include "cbpp/message_generator.hpp"
+
+using namespace Poseidon;
+
+namespace {
+	// 阻止编译器把计算结果当作无用的值删除。
+	template<typename T>
+	inline void keep(const T &value){
+		__asm__ __volatile__("" : : "r"(&value) : "memory");
+	}
+
+	// StreamBuffer。
+
+	void bench_stream_buffer_put_get_16(boost::uint64_t count){
+		StreamBuffer buffer;
+		char data[16] = { };
+		for(boost::uint64_t i = 0; i < count; ++i){
+			buffer.put(data, sizeof(data));
+			buffer.get(data, sizeof(data));
+		}
+		keep(data);
+	}
+	void bench_stream_buffer_put_get_4k(boost::uint64_t count){
+		StreamBuffer buffer;
+		static char data[4096];
+		for(boost::uint64_t i = 0; i < count; ++i){
+			buffer.put(data, sizeof(data));
+			buffer.get(data, sizeof(data));
+		}
+		keep(data);
+	}
+	void bench_stream_buffer_splice_cut_off(boost::uint64_t count){
+		StreamBuffer src, dst;
+		src.put('x', 65536);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			if(src.empty()){
+				src.swap(dst);
+			}
+			StreamBuffer chunk = src.cut_off(4096);
+			dst.splice(chunk);
+		}
+		keep(dst);
+	}
+
+	// CBPP。
+
+	const BenchMessage &get_sample_message(){
+		static BenchMessage s_message;
+		if(s_message.items.empty()){
+			s_message.id = 123456789;
+			s_message.delta = -42;
+			s_message.name = "The quick brown fox jumps over the lazy dog.";
+			s_message.payload.assign(256, 0xA5);
+			s_message.items.resize(8);
+			for(std::size_t i = 0; i < s_message.items.size(); ++i){
+				s_message.items.at(i).key = i * 1000;
+				s_message.items.at(i).value = "item value";
+			}
+		}
+		return s_message;
+	}
+	const StreamBuffer &get_sample_message_data(){
+		static StreamBuffer s_data;
+		if(s_data.empty()){
+			get_sample_message().serialize(s_data);
+		}
+		return s_data;
+	}
+
+	void bench_cbpp_serialize(boost::uint64_t count){
+		const AUTO_REF(message, get_sample_message());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			StreamBuffer buffer;
+			message.serialize(buffer);
+			keep(buffer);
+		}
+	}
+	void bench_cbpp_deserialize(boost::uint64_t count){
+		const AUTO_REF(data, get_sample_message_data());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const BenchMessage message(data);
+			keep(message);
+		}
+	}
+
+	// HTTP。
+
+	class NullServerReader : public Http::ServerReader {
+	protected:
+		void on_request_headers(Http::RequestHeaders request_headers, boost::uint64_t content_length) OVERRIDE {
+			keep(request_headers);
+			keep(content_length);
+		}
+		void on_request_entity(boost::uint64_t entity_offset, StreamBuffer entity) OVERRIDE {
+			keep(entity_offset);
+			keep(entity);
+		}
+		bool on_request_end(boost::uint64_t content_length, OptionalMap headers) OVERRIDE {
+			keep(content_length);
+			keep(headers);
+			return true;
+		}
+	};
+
+	const char SAMPLE_REQUEST[] =
+		"GET /api/v1/items?category=books&page=3&sort=price HTTP/1.1\r\n"
+		"Host: www.example.com\r\n"
+		"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:60.0) Gecko/20100101 Firefox/60.0\r\n"
+		"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+		"Accept-Language: en-US,en;q=0.5\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+		"Connection: keep-alive\r\n"
+		"\r\n";
+
+	void bench_http_server_reader(boost::uint64_t count){
+		NullServerReader reader;
+		const StreamBuffer request(SAMPLE_REQUEST);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			reader.put_encoded_data(request);
+		}
+	}
+
+	// 驻留的字符串。
+
+	const char *const SAMPLE_KEYS[] = {
+		"user_id", "nickname", "avatar_url", "level", "experience", "gold",
+		"created_time", "last_login_time", "last_login_ip", "banned_until", "guild_id", "vip_level",
+	};
+
+	template<bool InternedT>
+	void bench_shared_nts_map_lookup(boost::uint64_t count){
+		OptionalMap map;
+		boost::container::vector<SharedNts> keys;
+		for(std::size_t i = 0; i < COUNT_OF(SAMPLE_KEYS); ++i){
+			const AUTO(key, InternedT ? SharedNts::intern(SAMPLE_KEYS[i]) : SharedNts(SAMPLE_KEYS[i]));
+			map.append(key, std::string());
+			// 查找用的键是另外一份。
+			keys.push_back(InternedT ? SharedNts::intern(SAMPLE_KEYS[i]) : SharedNts(SAMPLE_KEYS[i]));
+		}
+		for(boost::uint64_t i = 0; i < count; ++i){
+			for(AUTO(it, keys.begin()); it != keys.end(); ++it){
+				keep(map.get(*it));
+			}
+		}
+	}
+
+	// 多索引容器。
+
+	struct IndexedItem {
+		boost::uint64_t id;
+		std::string name;
+	};
+
+	MULTI_INDEX_MAP(OrderedItemMap, IndexedItem,
+		UNIQUE_MEMBER_INDEX(id)
+	);
+	MULTI_INDEX_MAP(HashedItemMap, IndexedItem,
+		MULTI_MEMBER_INDEX(name)
+		UNIQUE_HASHED_MEMBER_INDEX(id)
+	);
+
+	template<typename MapT>
+	struct IndexedSample {
+		MapT map;
+		boost::container::vector<boost::uint64_t> keys;
+	};
+
+	// 样本只构造一次，不计入测量的时间。查找的顺序是打乱的，避免按照插入顺序访问时缓存命中率偏高。
+	template<typename MapT, std::size_t SizeT>
+	const IndexedSample<MapT> &get_indexed_sample(){
+		static IndexedSample<MapT> s_sample;
+		if(s_sample.keys.empty()){
+			s_sample.keys.reserve(SizeT);
+			while(s_sample.keys.size() < SizeT){
+				IndexedItem item = { random_uint64(), std::string() };
+				if(s_sample.map.insert(item).second){
+					s_sample.keys.push_back(item.id);
+				}
+			}
+			for(std::size_t i = s_sample.keys.size(); i > 1; --i){
+				std::swap(s_sample.keys.at(i - 1), s_sample.keys.at(random_uint32() % i));
+			}
+		}
+		return s_sample;
+	}
+
+	template<typename MapT, unsigned IndexIdT, std::size_t SizeT>
+	void bench_multi_index_find(boost::uint64_t count){
+		const AUTO_REF(sample, (get_indexed_sample<MapT, SizeT>()));
+		std::size_t index = 0;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			keep(sample.map.template find<IndexIdT>(sample.keys[index]));
+			if(++index == sample.keys.size()){
+				index = 0;
+			}
+		}
+	}
+
+	// WebSocket。
+
+	class NullReader : public WebSocket::Reader {
+	public:
+		NullReader()
+			: WebSocket::Reader(true)
+		{ }
+
+	protected:
+		void on_data_message_header(WebSocket::OpCode opcode) OVERRIDE {
+			keep(opcode);
+		}
+		void on_data_message_payload(boost::uint64_t whole_offset, StreamBuffer payload) OVERRIDE {
+			keep(whole_offset);
+			keep(payload);
+		}
+		bool on_data_message_end(boost::uint64_t whole_size) OVERRIDE {
+			keep(whole_size);
+			return true;
+		}
+		bool on_control_message(WebSocket::OpCode opcode, StreamBuffer payload) OVERRIDE {
+			keep(opcode);
+			keep(payload);
+			return true;
+		}
+	};
+
+	void bench_websocket_encode_masked_1k(boost::uint64_t count){
+		StreamBuffer payload;
+		payload.put(0x5A, 1024);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			StreamBuffer frame(payload);
+			WebSocket::Writer::encode_frame(frame, WebSocket::OP_DATA_BINARY, true);
+			keep(frame);
+		}
+	}
+	void bench_websocket_decode_masked_1k(boost::uint64_t count){
+		StreamBuffer frame;
+		frame.put(0x5A, 1024);
+		WebSocket::Writer::encode_frame(frame, WebSocket::OP_DATA_BINARY, true);
+		NullReader reader;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			reader.put_encoded_data(frame);
+		}
+	}
+
+	// JSON。
+
+	const std::string &get_sample_json(){
+		static std::string s_json;
+		if(s_json.empty()){
+			JsonArray items;
+			for(unsigned i = 0; i < 16; ++i){
+				JsonObject item;
+				item.set(sslit("id"), i);
+				item.set(sslit("name"), "item \"quoted\" name");
+				item.set(sslit("price"), i * 1.25);
+				item.set(sslit("available"), (i % 2) != 0);
+				items.push_back(item);
+			}
+			JsonObject root;
+			root.set(sslit("status"), "ok");
+			root.set(sslit("total"), 16);
+			root.set(sslit("items"), items);
+			s_json = root.dump();
+		}
+		return s_json;
+	}
+
+	void bench_json_parse(boost::uint64_t count){
+		const StreamBuffer data(get_sample_json());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			Buffer_istream is(data);
+			JsonObject root;
+			root.parse(is);
+			keep(root);
+		}
+	}
+	void bench_json_parse_span(boost::uint64_t count){
+		const AUTO_REF(data, get_sample_json());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			JsonObject root;
+			root.parse(data.data(), data.size());
+			keep(root);
+		}
+	}
+	void bench_json_parse_document(boost::uint64_t count){
+		const AUTO_REF(data, get_sample_json());
+		JsonParser parser;
+		JsonDocument doc;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			doc.parse(parser, data.data(), data.size());
+			keep(doc);
+		}
+	}
+	void bench_json_dump(boost::uint64_t count){
+		const StreamBuffer data(get_sample_json());
+		Buffer_istream is(data);
+		JsonObject root;
+		root.parse(is);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const AUTO(str, root.dump());
+			keep(str);
+		}
+	}
+
+	// 与 get_sample_json() 相同的内容，不构造 JsonObject。
+	void bench_json_write(boost::uint64_t count){
+		StreamBuffer buffer;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			JsonWriter writer(buffer);
+			writer.begin_object();
+			writer.key("items").begin_array();
+			for(unsigned j = 0; j < 16; ++j){
+				writer.begin_object();
+				writer.key("available").value((j % 2) != 0);
+				writer.key("id").value(j);
+				writer.key("name").value("item \"quoted\" name");
+				writer.key("price").value(j * 1.25);
+				writer.end_object();
+			}
+			writer.end_array();
+			writer.key("status").value("ok");
+			writer.key("total").value(16);
+			writer.end_object();
+			keep(buffer);
+			buffer.clear();
+		}
+	}
+
+	// 定时器。
+
+	volatile boost::uint64_t g_timers_fired = 0;
+
+	void null_timer_proc(const boost::shared_ptr<Timer> &, boost::uint64_t, boost::uint64_t){
+		//
+	}
+	void counting_timer_proc(const boost::shared_ptr<Timer> &, boost::uint64_t, boost::uint64_t){
+		atomic_add(g_timers_fired, 1, ATOMIC_RELAXED);
+	}
+
+	// 注册一个一小时之后到期的定时器，然后立即销毁。
+	void bench_timer_insert_cancel(boost::uint64_t count){
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const AUTO(timer, TimerDaemon::register_low_level_timer(3600000, 0, &null_timer_proc));
+			keep(timer);
+		}
+	}
+	// 注册立即到期的定时器，等待定时器线程全部触发。
+	void bench_timer_fire(boost::uint64_t count){
+		atomic_store(g_timers_fired, 0, ATOMIC_RELAXED);
+		boost::container::vector<boost::shared_ptr<Timer> > timers;
+		timers.reserve(count);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			timers.push_back(TimerDaemon::register_low_level_timer(0, 0, &counting_timer_proc));
+		}
+		while(atomic_load(g_timers_fired, ATOMIC_RELAXED) < count){
+			::sched_yield();
+		}
+	}
+
+	// 任务。
+
+	volatile bool g_jobs_running = false;
+
+	class BenchJob : public JobBase {
+	private:
+		const boost::weak_ptr<const void> m_category;
+		const boost::uint64_t m_yields;
+		const bool m_last;
+
+	public:
+		BenchJob(const boost::weak_ptr<const void> &category, boost::uint64_t yields, bool last)
+			: m_category(category), m_yields(yields), m_last(last)
+		{ }
+
+	public:
+		boost::weak_ptr<const void> get_category() const OVERRIDE {
+			return m_category;
+		}
+		bool is_yieldable() const OVERRIDE {
+			return m_yields != 0;
+		}
+		void perform() OVERRIDE {
+			for(boost::uint64_t i = 0; i < m_yields; ++i){
+				JobDispatcher::yield(VAL_INIT, false);
+			}
+			if(m_last){
+				atomic_store(g_jobs_running, false, ATOMIC_RELEASE);
+			}
+		}
+	};
+
+	// 同一个类别中的任务按顺序执行，最后一个任务结束时退出调度循环。
+	void run_jobs(boost::container::vector<boost::shared_ptr<JobBase> > &jobs){
+		atomic_store(g_jobs_running, true, ATOMIC_RELEASE);
+		for(AUTO(it, jobs.begin()); it != jobs.end(); ++it){
+			DEBUG_THROW_UNLESS(JobDispatcher::enqueue(STD_MOVE(*it), VAL_INIT), Exception, sslit("Job queue is full"));
+		}
+		jobs.clear();
+		JobDispatcher::do_modal(g_jobs_running);
+	}
+
+	// 投递并执行不让出的任务。
+	void bench_job_enqueue_run(boost::uint64_t count){
+		const AUTO(category, boost::make_shared<int>());
+		boost::container::vector<boost::shared_ptr<JobBase> > jobs;
+		jobs.reserve(count);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			jobs.push_back(boost::make_shared<BenchJob>(category, 0, i + 1 == count));
+		}
+		run_jobs(jobs);
+	}
+	// 一个任务在没有 Promise 的情况下让出 count 次，每次都是一对 fiber 的切换。
+	void bench_job_yield(boost::uint64_t count){
+		const AUTO(category, boost::make_shared<int>());
+		boost::container::vector<boost::shared_ptr<JobBase> > jobs;
+		jobs.push_back(boost::make_shared<BenchJob>(category, count, true));
+		run_jobs(jobs);
+	}
+
+	// 事件。
+
+	class BenchEvent : public EventBase {
+	};
+
+	void count_bench_event(boost::uint64_t &handled, const boost::shared_ptr<BenchEvent> &){
+		++handled;
+	}
+	void bench_event_sync_raise(boost::uint64_t count){
+		boost::uint64_t handled = 0;
+		const AUTO(listener, EventDispatcher::register_listener<BenchEvent>(boost::bind(&count_bench_event, boost::ref(handled), _1)));
+		const AUTO(event, boost::make_shared<BenchEvent>());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			sync_raise_event(event);
+		}
+		keep(handled);
+	}
+
+	// 散列。
+
+	template<typename OstreamT>
+	void bench_hash_4k(boost::uint64_t count){
+		static char data[4096];
+		OstreamT os;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			os.write(data, sizeof(data));
+			const AUTO(digest, os.finalize());
+			keep(digest);
+		}
+	}
+
+	// 编码器。解码的输入是 4096 字节编码之后的结果。
+
+	template<typename EncoderT>
+	void bench_encode_4k(boost::uint64_t count){
+		static char data[4096];
+		EncoderT enc;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			enc.put(data, sizeof(data));
+			const AUTO(result, enc.finalize());
+			keep(result);
+		}
+	}
+
+	template<typename EncoderT, typename DecoderT>
+	void bench_decode_4k(boost::uint64_t count){
+		EncoderT enc;
+		enc.put(std::string(4096, 'Z'));
+		const AUTO(str, enc.finalize().dump_string());
+		DecoderT dec;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			dec.put(str);
+			const AUTO(result, dec.finalize());
+			keep(result);
+		}
+	}
+
+	// 压缩。每次都构造新的压缩器，与 HTTP 和 WebSocket 逐条消息压缩的用法相同。
+
+	const StreamBuffer &get_compression_sample(){
+		static StreamBuffer s_sample;
+		if(s_sample.empty()){
+			while(s_sample.size() < 1024){
+				s_sample.put("{\"user_id\":12345,\"nickname\":\"poseidon\",\"level\":42,\"guild_id\":678},");
+			}
+			s_sample.discard(s_sample.size() - 1024);
+		}
+		return s_sample;
+	}
+
+	void bench_deflator_1k(boost::uint64_t count){
+		const AUTO_REF(sample, get_compression_sample());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			Deflator deflator(true, 6);
+			deflator.put(sample);
+			const AUTO(result, deflator.finalize());
+			keep(result);
+		}
+	}
+
+	void bench_deflate_buffer_1k(boost::uint64_t count){
+		const AUTO_REF(sample, get_compression_sample());
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const AUTO(result, deflate_buffer(sample, true, 6));
+			keep(result);
+		}
+	}
+
+	// 随机数。
+
+	void bench_random_uint64(boost::uint64_t count){
+		boost::uint64_t sum = 0;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			sum += random_uint64();
+		}
+		keep(sum);
+	}
+
+	void bench_random_fill_4k(boost::uint64_t count){
+		static char data[4096];
+		for(boost::uint64_t i = 0; i < count; ++i){
+			random_fill(data, sizeof(data));
+			keep(data);
+		}
+	}
+
+	void bench_uuid_random(boost::uint64_t count){
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const AUTO(uuid, Uuid::random());
+			keep(uuid);
+		}
+	}
+
+	template<boost::uint64_t (*ClockT)()>
+	void bench_clock(boost::uint64_t count){
+		boost::uint64_t sum = 0;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			sum += (*ClockT)();
+		}
+		keep(sum);
+	}
+
+	// 回环测试。服务端运行在本进程的 epoll 线程中，任务由主线程调度；客户端在另一个线程中使用阻塞的套接字，
+	// 每次操作是一次完整的往返，因此结果包含 poll_read_and_process()、任务调度和 poll_write() 的开销。
+
+	// 每次往返的纳秒数，由回环测试追加，用于计算 p99。
+	boost::container::vector<double> g_op_latencies;
+
+	class LoopbackClient : NONCOPYABLE {
+	private:
+		UniqueFile m_socket;
+		std::string m_received;
+
+	public:
+		explicit LoopbackClient(const IpPort &server){
+			const SockAddr sock_addr(IpPort("127.0.0.1", server.port()));
+			DEBUG_THROW_UNLESS(m_socket.reset(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)), SystemException);
+			if(::connect(m_socket.get(), static_cast<const ::sockaddr *>(sock_addr.data()), static_cast<unsigned>(sock_addr.size())) != 0){
+				DEBUG_THROW(SystemException);
+			}
+			const int no_delay = 1;
+			DEBUG_THROW_UNLESS(::setsockopt(m_socket.get(), IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)) == 0, SystemException);
+			// 服务端没有响应时不要永远等待下去。
+			::timeval timeout = { 10, 0 };
+			DEBUG_THROW_UNLESS(::setsockopt(m_socket.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0, SystemException);
+		}
+
+	private:
+		void receive_more(){
+			char temp[16384];
+			const ::ssize_t result = ::recv(m_socket.get(), temp, sizeof(temp), 0);
+			if(result < 0){
+				DEBUG_THROW(SystemException);
+			}
+			DEBUG_THROW_UNLESS(result != 0, Exception, sslit("Loopback connection closed by server"));
+			m_received.append(temp, static_cast<std::size_t>(result));
+		}
+
+	public:
+		void send(const std::string &data){
+			std::size_t offset = 0;
+			while(offset < data.size()){
+				const ::ssize_t result = ::send(m_socket.get(), data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+				if(result < 0){
+					DEBUG_THROW(SystemException);
+				}
+				offset += static_cast<std::size_t>(result);
+			}
+		}
+		// 读取并丢弃 size 字节。
+		void skip(std::size_t size){
+			while(m_received.size() < size){
+				receive_more();
+			}
+			m_received.erase(0, size);
+		}
+		// 读取到 delim 为止（包含 delim），结果存入 line。
+		void read_until(std::string &line, const char *delim){
+			std::size_t pos;
+			while((pos = m_received.find(delim)) == std::string::npos){
+				receive_more();
+			}
+			pos += std::strlen(delim);
+			line.assign(m_received, 0, pos);
+			m_received.erase(0, pos);
+		}
+	};
+
+	class EchoCbppSession : public Cbpp::Session {
+	public:
+		explicit EchoCbppSession(Move<UniqueFile> socket)
+			: Cbpp::Session(STD_MOVE(socket))
+		{ }
+
+	protected:
+		void on_sync_data_message(boost::uint16_t message_id, StreamBuffer payload) OVERRIDE {
+			send(message_id, STD_MOVE(payload));
+		}
+	};
+
+	class EchoWebSocketSession : public WebSocket::Session {
+	public:
+		explicit EchoWebSocketSession(const boost::shared_ptr<Http::LowLevelSession> &parent)
+			: WebSocket::Session(parent)
+		{ }
+
+	protected:
+		void on_sync_data_message(WebSocket::OpCode opcode, StreamBuffer payload) OVERRIDE {
+			send(opcode, STD_MOVE(payload));
+		}
+	};
+
+	// 普通请求返回一个很短的响应，WebSocket 握手请求升级为 EchoWebSocketSession。
+	class LoopbackHttpSession : public Http::Session {
+	public:
+		explicit LoopbackHttpSession(Move<UniqueFile> socket)
+			: Http::Session(STD_MOVE(socket))
+		{ }
+
+	protected:
+		boost::shared_ptr<Http::UpgradedSessionBase> on_low_level_request_end(boost::uint64_t content_length, OptionalMap headers) OVERRIDE {
+			const AUTO_REF(request_headers, get_low_level_request_headers());
+			if(::strcasecmp(request_headers.headers.get("Upgrade").c_str(), "websocket") != 0){
+				return Http::Session::on_low_level_request_end(content_length, STD_MOVE(headers));
+			}
+			AUTO(response_headers, WebSocket::make_handshake_response(request_headers));
+			const bool accepted = (response_headers.status_code == Http::ST_SWITCHING_PROTOCOLS);
+			send(STD_MOVE(response_headers));
+			if(!accepted){
+				shutdown_read();
+				shutdown_write();
+				return VAL_INIT;
+			}
+			return boost::make_shared<EchoWebSocketSession>(virtual_shared_from_this<Http::LowLevelSession>());
+		}
+		void on_sync_request(Http::RequestHeaders request_headers, StreamBuffer entity) OVERRIDE {
+			keep(request_headers);
+			keep(entity);
+			send(Http::ST_OK, OptionalMap(), StreamBuffer("Hello, world!\n"));
+		}
+	};
+
+	template<typename SessionT>
+	class LoopbackServer : public TcpServerBase {
+	public:
+		LoopbackServer()
+			: TcpServerBase(SockAddr(IpPort("127.0.0.1", 0)))
+		{ }
+
+	protected:
+		boost::shared_ptr<TcpSessionBase> on_client_connect(Move<UniqueFile> client) OVERRIDE {
+			return boost::make_shared<SessionT>(STD_MOVE(client));
+		}
+	};
+
+	// 每种服务端只创建一个，直到进程退出。
+	template<typename SessionT>
+	const IpPort &get_loopback_server(){
+		static boost::shared_ptr<LoopbackServer<SessionT> > s_server;
+		if(!s_server){
+			s_server = boost::make_shared<LoopbackServer<SessionT> >();
+			EpollDaemon::add_socket(s_server, false);
+		}
+		return s_server->get_local_info();
+	}
+
+	void cbpp_echo_client_proc(const IpPort &server, boost::uint64_t count){
+		class FrameEncoder : public Cbpp::Writer {
+		public:
+			std::string encoded;
+
+		protected:
+			long on_encoded_data_avail(StreamBuffer data) OVERRIDE {
+				encoded += data.dump_string();
+				return true;
+			}
+		} encoder;
+		encoder.put_data_message(BenchMessage::ID, get_sample_message_data());
+
+		LoopbackClient client(server);
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const double begin = get_hi_res_mono_clock();
+			client.send(encoder.encoded);
+			client.skip(encoder.encoded.size());
+			g_op_latencies.push_back((get_hi_res_mono_clock() - begin) * 1.0e6);
+		}
+	}
+
+	void http_keep_alive_client_proc(const IpPort &server, boost::uint64_t count){
+		const std::string request = "GET /bench HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+		LoopbackClient client(server);
+		std::string response_head;
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const double begin = get_hi_res_mono_clock();
+			client.send(request);
+			client.read_until(response_head, "\r\n\r\n");
+			const AUTO(pos, response_head.find("Content-Length:"));
+			DEBUG_THROW_UNLESS(pos != std::string::npos, Exception, sslit("No Content-Length in loopback response"));
+			client.skip(static_cast<std::size_t>(std::strtoull(response_head.c_str() + pos + 15, NULLPTR, 10)));
+			g_op_latencies.push_back((get_hi_res_mono_clock() - begin) * 1.0e6);
+		}
+	}
+
+	void websocket_echo_client_proc(const IpPort &server, boost::uint64_t count){
+		StreamBuffer payload;
+		payload.put(0x5A, 64);
+		StreamBuffer frame(payload);
+		WebSocket::Writer::encode_frame(frame, WebSocket::OP_DATA_BINARY, true);
+		const std::string request = frame.dump_string();
+		// 服务端发送的帧没有掩码。
+		frame = payload;
+		WebSocket::Writer::encode_frame(frame, WebSocket::OP_DATA_BINARY, false);
+		const std::size_t response_size = frame.size();
+
+		LoopbackClient client(server);
+		client.send(
+			"GET /bench HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+			"Sec-WebSocket-Version: 13\r\n"
+			"\r\n");
+		std::string response_head;
+		client.read_until(response_head, "\r\n\r\n");
+		DEBUG_THROW_UNLESS(response_head.compare(0, 12, "HTTP/1.1 101") == 0, Exception, sslit("Loopback WebSocket handshake failed"));
+		for(boost::uint64_t i = 0; i < count; ++i){
+			const double begin = get_hi_res_mono_clock();
+			client.send(request);
+			client.skip(response_size);
+			g_op_latencies.push_back((get_hi_res_mono_clock() - begin) * 1.0e6);
+		}
+	}
+
+	void loopback_thread_proc(void (*client_proc)(const IpPort &, boost::uint64_t), const IpPort &server, boost::uint64_t count, std::string &error){
+		try {
+			(*client_proc)(server, count);
+		} catch(std::exception &e){
+			error = e.what();
+		}
+		// 由主线程中的调度循环执行，使 do_modal() 返回。
+		const AUTO(category, boost::make_shared<int>());
+		JobDispatcher::enqueue(boost::make_shared<BenchJob>(category, 0, true), VAL_INIT);
+	}
+
+	template<typename SessionT, void (*ClientProcT)(const IpPort &, boost::uint64_t)>
+	void bench_loopback(boost::uint64_t count){
+		const AUTO_REF(server, get_loopback_server<SessionT>());
+		std::string error;
+		atomic_store(g_jobs_running, true, ATOMIC_RELEASE);
+		Thread thread(boost::bind(&loopback_thread_proc, ClientProcT, boost::cref(server), count, boost::ref(error)), sslit("  LB"), sslit("Loopback"));
+		JobDispatcher::do_modal(g_jobs_running);
+		thread.join();
+		DEBUG_THROW_UNLESS(error.empty(), Exception, SharedNts(error));
+	}
+
+	struct Benchmark {
+		const char *name;
+		std::size_t bytes_per_op; // 为 0 则不输出吞吐量。
+		void (*proc)(boost::uint64_t count);
+	};
+
+	const Benchmark BENCHMARKS[] = {
+		{ "stream_buffer/put_get_16",       16,                         &bench_stream_buffer_put_get_16     },
+		{ "stream_buffer/put_get_4k",       4096,                       &bench_stream_buffer_put_get_4k     },
+		{ "stream_buffer/splice_cut_off_4k", 4096,                      &bench_stream_buffer_splice_cut_off },
+		{ "cbpp/serialize",                 0,                          &bench_cbpp_serialize               },
+		{ "cbpp/deserialize",               0,                          &bench_cbpp_deserialize             },
+		{ "http/server_reader_get",         sizeof(SAMPLE_REQUEST) - 1, &bench_http_server_reader           },
+		{ "shared_nts/map_lookup_copied",   0,                          &bench_shared_nts_map_lookup<false> },
+		{ "shared_nts/map_lookup_interned", 0,                          &bench_shared_nts_map_lookup<true>  },
+		{ "multi_index/ordered_find_64",    0,                          &bench_multi_index_find<OrderedItemMap, 0, 64>     },
+		{ "multi_index/hashed_find_64",     0,                          &bench_multi_index_find<HashedItemMap, 1, 64>      },
+		{ "multi_index/ordered_find_64k",   0,                          &bench_multi_index_find<OrderedItemMap, 0, 65536>  },
+		{ "multi_index/hashed_find_64k",    0,                          &bench_multi_index_find<HashedItemMap, 1, 65536>   },
+		{ "websocket/encode_masked_1k",     1024,                       &bench_websocket_encode_masked_1k   },
+		{ "websocket/decode_masked_1k",     1024,                       &bench_websocket_decode_masked_1k   },
+		{ "json/parse",                     0,                          &bench_json_parse                   },
+		{ "json/parse_span",                0,                          &bench_json_parse_span              },
+		{ "json/parse_document",            0,                          &bench_json_parse_document          },
+		{ "json/dump",                      0,                          &bench_json_dump                    },
+		{ "json/write",                     0,                          &bench_json_write                   },
+		{ "timer/insert_cancel",            0,                          &bench_timer_insert_cancel          },
+		{ "timer/fire",                     0,                          &bench_timer_fire                   },
+		{ "job/enqueue_run",                0,                          &bench_job_enqueue_run              },
+		{ "job/yield",                      0,                          &bench_job_yield                    },
+		{ "event/sync_raise",               0,                          &bench_event_sync_raise             },
+		{ "hash/md5_4k",                    4096,                       &bench_hash_4k<Md5_ostream>         },
+		{ "hash/sha1_4k",                   4096,                       &bench_hash_4k<Sha1_ostream>        },
+		{ "hash/sha256_4k",                 4096,                       &bench_hash_4k<Sha256_ostream>      },
+		{ "hash/crc32_4k",                  4096,                       &bench_hash_4k<Crc32_ostream>       },
+		{ "zlib/deflator_1k",               1024,                       &bench_deflator_1k                  },
+		{ "zlib/deflate_buffer_1k",         1024,                       &bench_deflate_buffer_1k            },
+		{ "random/uint64",                  0,                          &bench_random_uint64                },
+		{ "random/fill_4k",                 4096,                       &bench_random_fill_4k               },
+		{ "time/fast_mono_clock",           0,                          &bench_clock<get_fast_mono_clock>   },
+		{ "time/coarse_mono_clock",         0,                          &bench_clock<get_coarse_mono_clock> },
+		{ "uuid/random",                    0,                          &bench_uuid_random                  },
+		{ "codec/base64_encode_4k",         4096,                       &bench_encode_4k<Base64Encoder>     },
+		{ "codec/base64_decode_4k",         4096,                       &bench_decode_4k<Base64Encoder, Base64Decoder> },
+		{ "codec/hex_encode_4k",            4096,                       &bench_encode_4k<HexEncoder>        },
+		{ "codec/hex_decode_4k",            4096,                       &bench_decode_4k<HexEncoder, HexDecoder> },
+		{ "loopback/cbpp_echo",             0,                          &bench_loopback<EchoCbppSession, cbpp_echo_client_proc>            },
+		{ "loopback/http_keep_alive",       0,                          &bench_loopback<LoopbackHttpSession, http_keep_alive_client_proc>  },
+		{ "loopback/websocket_echo",        0,                          &bench_loopback<LoopbackHttpSession, websocket_echo_client_proc>   },
+	};
+
+	// 返回毫秒数。
+	double measure(const Benchmark &bench, boost::uint64_t count){
+		const double begin = get_hi_res_mono_clock();
+		(*bench.proc)(count);
+		return get_hi_res_mono_clock() - begin;
+	}
+
+	struct Result {
+		boost::uint64_t iterations;
+		double ns_per_op_median;
+		double ns_per_op_min;
+		double ns_per_op_max;
+		double ns_per_op_p99; // 为 0 则没有测量每次操作的耗时。
+	};
+
+	// 把次数加倍直到一次测量至少持续 min_time 毫秒，然后以这个次数重复测量。
+	void run_benchmark(Result &result, const Benchmark &bench, double min_time, unsigned repetitions){
+		boost::uint64_t count = 1;
+		double elapsed;
+		for(;;){
+			elapsed = measure(bench, count);
+			if((elapsed >= min_time) || (count >= ((boost::uint64_t)1 << 40))){
+				break;
+			}
+			// 按照已经测得的速度估计，最多一次放大 10 倍。
+			const double ratio = (elapsed > 0) ? (min_time * 1.2 / elapsed) : 10.0;
+			count = static_cast<boost::uint64_t>(static_cast<double>(count) * std::min(std::max(ratio, 2.0), 10.0));
+		}
+		// 校准过程中只保留最后一次测量的每次操作的耗时。
+		boost::container::vector<double> samples;
+		samples.push_back(elapsed);
+		if(g_op_latencies.size() > count){
+			g_op_latencies.erase(g_op_latencies.begin(), g_op_latencies.end() - static_cast<std::ptrdiff_t>(count));
+		}
+		while(samples.size() < repetitions){
+			samples.push_back(measure(bench, count));
+		}
+		std::sort(samples.begin(), samples.end());
+		const double scale = 1.0e6 / static_cast<double>(count);
+		result.iterations = count;
+		result.ns_per_op_median = samples.at(samples.size() / 2) * scale;
+		result.ns_per_op_min = samples.front() * scale;
+		result.ns_per_op_max = samples.back() * scale;
+		result.ns_per_op_p99 = 0;
+		if(!g_op_latencies.empty()){
+			const AUTO(nth, g_op_latencies.begin() + static_cast<std::ptrdiff_t>(g_op_latencies.size() * 99 / 100));
+			std::nth_element(g_op_latencies.begin(), nth, g_op_latencies.end());
+			result.ns_per_op_p99 = *nth;
+			g_op_latencies.clear();
+		}
+	}
+
+	// 之前某次运行的结果，按照 name 索引。
+	struct BaselineEntry {
+		double ns_per_op;
+		double ns_per_op_p99;
+	};
+
+	typedef std::map<std::string, BaselineEntry> Baseline;
+
+	void load_baseline(Baseline &baseline, const char *path){
+		std::ifstream file(path);
+		DEBUG_THROW_UNLESS(file, Exception, sslit("Could not open baseline file"));
+		JsonDocument doc;
+		std::string line;
+		while(std::getline(file, line)){
+			if(line.empty()){
+				continue;
+			}
+			DEBUG_THROW_UNLESS(doc.parse(line.data(), line.size()), Exception, sslit("Invalid JSON in baseline file"));
+			const AUTO(root, doc.get_root());
+			if(root.get("type").get_string() != "result"){
+				continue;
+			}
+			BaselineEntry entry;
+			entry.ns_per_op = root.get("ns_per_op").get_number();
+			entry.ns_per_op_p99 = root.get("ns_per_op_p99").get_number();
+			baseline[root.get("name").get_string()] = entry;
+		}
+	}
+
+	// 与基准比较的结果。变化量是相对于基准的比例，正数表示变慢。
+	struct Comparison {
+		bool compared;
+		BaselineEntry baseline;
+		double change;
+		double p99_change;
+		bool regressed;
+	};
+
+	void compare_result(Comparison &comparison, const Baseline &baseline, const Benchmark &bench, const Result &result, double threshold, double p99_threshold){
+		comparison.compared = false;
+		comparison.change = 0;
+		comparison.p99_change = 0;
+		comparison.regressed = false;
+		const AUTO(it, baseline.find(bench.name));
+		if((it == baseline.end()) || !(it->second.ns_per_op > 0)){
+			return;
+		}
+		comparison.compared = true;
+		comparison.baseline = it->second;
+		comparison.change = result.ns_per_op_median / it->second.ns_per_op - 1;
+		if(comparison.change * 100 > threshold){
+			comparison.regressed = true;
+		}
+		if((result.ns_per_op_p99 > 0) && (it->second.ns_per_op_p99 > 0)){
+			comparison.p99_change = result.ns_per_op_p99 / it->second.ns_per_op_p99 - 1;
+			if(comparison.p99_change * 100 > p99_threshold){
+				comparison.regressed = true;
+			}
+		}
+	}
+
+	void print_environment(std::ostream &os, bool text, double min_time, unsigned repetitions){
+		if(text){
+			os <<"# poseidon-bench: compiler = " <<__VERSION__ <<", min_time = " <<min_time <<" ms, repetitions = " <<repetitions <<std::endl;
+			return;
+		}
+		JsonObject env;
+		env.set(sslit("type"), "environment");
+		env.set(sslit("compiler"), __VERSION__);
+#ifdef NDEBUG
+		env.set(sslit("ndebug"), true);
+#else
+		env.set(sslit("ndebug"), false);
+#endif
+		env.set(sslit("time"), static_cast<double>(get_utc_time()));
+		env.set(sslit("min_time"), min_time);
+		env.set(sslit("repetitions"), repetitions);
+		env.set(sslit("timer_queue"), MainConfig::get<std::string>("timer_queue", "wheel"));
+		env.set(sslit("job_thread_count"), MainConfig::get<std::size_t>("job_thread_count", 0));
+		os <<env <<std::endl;
+	}
+	void print_result(std::ostream &os, bool text, const Benchmark &bench, const Result &result, const Comparison &comparison){
+		const double mb_per_s = static_cast<double>(bench.bytes_per_op) / result.ns_per_op_median * 1.0e9 / 1048576.0;
+		if(text){
+			os <<std::left <<std::setw(36) <<bench.name <<std::right
+			   <<std::setw(14) <<std::fixed <<std::setprecision(1) <<result.ns_per_op_median <<" ns/op"
+			   <<std::setw(14) <<result.iterations <<" iterations";
+			if(bench.bytes_per_op != 0){
+				os <<std::setw(12) <<mb_per_s <<" MiB/s";
+			}
+			if(result.ns_per_op_p99 > 0){
+				os <<std::setw(14) <<result.ns_per_op_p99 <<" ns p99";
+			}
+			if(comparison.compared){
+				os <<std::setw(10) <<std::showpos <<comparison.change * 100 <<std::noshowpos <<"%";
+				if(comparison.regressed){
+					os <<" REGRESSED";
+				}
+			}
+			os <<std::endl;
+			return;
+		}
+		JsonObject obj;
+		obj.set(sslit("type"), "result");
+		obj.set(sslit("name"), bench.name);
+		obj.set(sslit("iterations"), result.iterations);
+		obj.set(sslit("ns_per_op"), result.ns_per_op_median);
+		obj.set(sslit("ns_per_op_min"), result.ns_per_op_min);
+		obj.set(sslit("ns_per_op_max"), result.ns_per_op_max);
+		if(bench.bytes_per_op != 0){
+			obj.set(sslit("bytes_per_op"), bench.bytes_per_op);
+			obj.set(sslit("mb_per_s"), mb_per_s);
+		}
+		if(result.ns_per_op_p99 > 0){
+			obj.set(sslit("ns_per_op_p99"), result.ns_per_op_p99);
+		}
+		if(comparison.compared){
+			obj.set(sslit("baseline_ns_per_op"), comparison.baseline.ns_per_op);
+			obj.set(sslit("change"), comparison.change);
+			if(comparison.p99_change != 0){
+				obj.set(sslit("baseline_ns_per_op_p99"), comparison.baseline.ns_per_op_p99);
+				obj.set(sslit("p99_change"), comparison.p99_change);
+			}
+			obj.set(sslit("regressed"), comparison.regressed);
+		}
+		os <<obj <<std::endl;
+	}
+	void print_comparison(std::ostream &os, bool text, std::size_t compared, const boost::container::vector<const char *> &regressions){
+		if(text){
+			os <<"# " <<compared <<" benchmark(s) compared with baseline, " <<regressions.size() <<" regressed" <<std::endl;
+			return;
+		}
+		JsonArray names;
+		for(AUTO(it, regressions.begin()); it != regressions.end(); ++it){
+			names.push_back(*it);
+		}
+		JsonObject obj;
+		obj.set(sslit("type"), "comparison");
+		obj.set(sslit("compared"), compared);
+		obj.set(sslit("regressed"), regressions.size());
+		obj.set(sslit("regressions"), STD_MOVE(names));
+		os <<obj <<std::endl;
+	}
+
+	bool matches_filters(const char *name, const boost::container::vector<const char *> &filters){
+		if(filters.empty()){
+			return true;
+		}
+		for(AUTO(it, filters.begin()); it != filters.end(); ++it){
+			if(std::strstr(name, *it)){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template<typename T>
+	struct RaiiSingletonRunner : NONCOPYABLE {
+		RaiiSingletonRunner(){
+			T::start();
+		}
+		~RaiiSingletonRunner(){
+			T::stop();
+		}
+	};
+
+#define START(x_)   const RaiiSingletonRunner<x_> UNIQUE_ID
+
+	void print_usage(const char *self){
+		std::cerr <<"Usage: " <<self <<" [-f <filter>]... [-t <min_time_ms>] [-r <repetitions>] [-o <output>]"
+		          <<" [-b <baseline>] [--threshold <percent>] [--p99-threshold <percent>] [--text] [<run_path>]" <<std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+try {
+	Logger::set_thread_tag("B   "); // Benchmark
+
+	boost::container::vector<const char *> filters;
+	double min_time = 200;
+	unsigned repetitions = 5;
+	const char *output = NULLPTR;
+	const char *baseline_path = NULLPTR;
+	double threshold = 10;
+	double p99_threshold = 25;
+	bool text = false;
+	const char *run_path = "/usr/etc/poseidon";
+	for(int i = 1; i < argc; ++i){
+		const char *const arg = argv[i];
+		if(std::strcmp(arg, "--text") == 0){
+			text = true;
+		} else if((std::strcmp(arg, "-f") == 0) && (i + 1 < argc)){
+			filters.push_back(argv[++i]);
+		} else if((std::strcmp(arg, "-t") == 0) && (i + 1 < argc)){
+			min_time = std::max(std::strtod(argv[++i], NULLPTR), 1.0);
+		} else if((std::strcmp(arg, "-r") == 0) && (i + 1 < argc)){
+			repetitions = static_cast<unsigned>(std::max(std::strtol(argv[++i], NULLPTR, 10), 1L));
+		} else if((std::strcmp(arg, "-o") == 0) && (i + 1 < argc)){
+			output = argv[++i];
+		} else if((std::strcmp(arg, "-b") == 0) && (i + 1 < argc)){
+			baseline_path = argv[++i];
+		} else if((std::strcmp(arg, "--threshold") == 0) && (i + 1 < argc)){
+			threshold = std::max(std::strtod(argv[++i], NULLPTR), 0.0);
+		} else if((std::strcmp(arg, "--p99-threshold") == 0) && (i + 1 < argc)){
+			p99_threshold = std::max(std::strtod(argv[++i], NULLPTR), 0.0);
+		} else if(arg[0] == '-'){
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			run_path = arg;
+		}
+	}
+
+	// 设置运行目录会改变当前工作目录，所以先打开输出文件和基准文件。
+	Baseline baseline;
+	if(baseline_path){
+		load_baseline(baseline, baseline_path);
+	}
+	std::ofstream file;
+	if(output){
+		file.open(output, std::ios::out | std::ios::trunc);
+		DEBUG_THROW_UNLESS(file, Exception, sslit("Could not open output file"));
+	}
+	std::ostream &os = output ? static_cast<std::ostream &>(file) : std::cout;
+
+	MainConfig::set_run_path(run_path);
+	MainConfig::reload();
+
+	START(JobDispatcher);
+	START(TimerDaemon);
+	START(EpollDaemon);
+
+	print_environment(os, text, min_time, repetitions);
+	std::size_t compared = 0;
+	boost::container::vector<const char *> regressions;
+	for(std::size_t i = 0; i < COUNT_OF(BENCHMARKS); ++i){
+		const AUTO_REF(bench, BENCHMARKS[i]);
+		if(!matches_filters(bench.name, filters)){
+			continue;
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Running benchmark: ", bench.name);
+		Result result;
+		run_benchmark(result, bench, min_time, repetitions);
+		Comparison comparison;
+		compare_result(comparison, baseline, bench, result, threshold, p99_threshold);
+		print_result(os, text, bench, result, comparison);
+		if(comparison.compared){
+			++compared;
+		}
+		if(comparison.regressed){
+			LOG_POSEIDON_WARNING("Benchmark regressed: ", bench.name, ", change = ", comparison.change, ", p99_change = ", comparison.p99_change);
+			regressions.push_back(bench.name);
+		}
+	}
+	if(baseline_path){
+		print_comparison(os, text, compared, regressions);
+		if(!regressions.empty()){
+			return 2;
+		}
+	}
+	return EXIT_SUCCESS;
+} catch(std::exception &e){
+	LOG_POSEIDON_FATAL("std::exception thrown in main(): what = ", e.what());
+	return EXIT_FAILURE;
+} catch(...){
+	LOG_POSEIDON_FATAL("Unknown exception thrown in main().");
+	return EXIT_FAILURE;
+}
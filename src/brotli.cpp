@@ -0,0 +1,149 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "brotli.hpp"
+#include "profiler.hpp"
+#include "exception.hpp"
+
+namespace Poseidon {
+
+namespace {
+	::BrotliEncoderState *create_encoder(int level){
+		const AUTO(state, ::BrotliEncoderCreateInstance(NULLPTR, NULLPTR, NULLPTR));
+		DEBUG_THROW_UNLESS(state, Exception, sslit("::BrotliEncoderCreateInstance()"));
+		::BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, static_cast<boost::uint32_t>(level));
+		return state;
+	}
+	::BrotliDecoderState *create_decoder(){
+		const AUTO(state, ::BrotliDecoderCreateInstance(NULLPTR, NULLPTR, NULLPTR));
+		DEBUG_THROW_UNLESS(state, Exception, sslit("::BrotliDecoderCreateInstance()"));
+		return state;
+	}
+
+	// 处理所有输入，并且在 op 不是 BROTLI_OPERATION_PROCESS 时取出所有输出。
+	void encode(StreamBuffer &buffer, ::BrotliEncoderState *state, ::BrotliEncoderOperation op, const void *data, std::size_t size){
+		const ::uint8_t *next_in = static_cast<const ::uint8_t *>(data);
+		std::size_t avail_in = size;
+		for(;;){
+			unsigned char temp[4096];
+			::uint8_t *next_out = temp;
+			std::size_t avail_out = sizeof(temp);
+			DEBUG_THROW_UNLESS(::BrotliEncoderCompressStream(state, op, &avail_in, &next_in, &avail_out, &next_out, NULLPTR), Exception, sslit("::BrotliEncoderCompressStream()"));
+			buffer.put(temp, static_cast<std::size_t>(next_out - temp));
+			if((avail_in == 0) && !::BrotliEncoderHasMoreOutput(state)){
+				if(op != BROTLI_OPERATION_FINISH){
+					break;
+				}
+				if(::BrotliEncoderIsFinished(state)){
+					break;
+				}
+			}
+		}
+	}
+}
+
+BrotliCompressor::BrotliCompressor(int level)
+	: m_level(level), m_state(create_encoder(level))
+{ }
+BrotliCompressor::~BrotliCompressor(){
+	::BrotliEncoderDestroyInstance(m_state);
+}
+
+void BrotliCompressor::clear(){
+	PROFILE_ME;
+
+	// Brotli 的编码器无法重置，只能重新创建。
+	const AUTO(state, create_encoder(m_level));
+	::BrotliEncoderDestroyInstance(m_state);
+	m_state = state;
+	m_buffer.clear();
+}
+void BrotliCompressor::put(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	encode(m_buffer, m_state, BROTLI_OPERATION_PROCESS, data, size);
+}
+void BrotliCompressor::put(const StreamBuffer &buffer){
+	PROFILE_ME;
+
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		put(data, size);
+	}
+}
+void BrotliCompressor::flush(){
+	PROFILE_ME;
+
+	encode(m_buffer, m_state, BROTLI_OPERATION_FLUSH, NULLPTR, 0);
+}
+StreamBuffer BrotliCompressor::finalize(){
+	PROFILE_ME;
+
+	encode(m_buffer, m_state, BROTLI_OPERATION_FINISH, NULLPTR, 0);
+	StreamBuffer ret;
+	ret.swap(m_buffer);
+	clear();
+	return ret;
+}
+
+BrotliDecompressor::BrotliDecompressor()
+	: m_state(create_decoder())
+{ }
+BrotliDecompressor::~BrotliDecompressor(){
+	::BrotliDecoderDestroyInstance(m_state);
+}
+
+void BrotliDecompressor::clear(){
+	PROFILE_ME;
+
+	const AUTO(state, create_decoder());
+	::BrotliDecoderDestroyInstance(m_state);
+	m_state = state;
+	m_buffer.clear();
+}
+void BrotliDecompressor::put(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	const ::uint8_t *next_in = static_cast<const ::uint8_t *>(data);
+	std::size_t avail_in = size;
+	for(;;){
+		unsigned char temp[4096];
+		::uint8_t *next_out = temp;
+		std::size_t avail_out = sizeof(temp);
+		const AUTO(result, ::BrotliDecoderDecompressStream(m_state, &avail_in, &next_in, &avail_out, &next_out, NULLPTR));
+		DEBUG_THROW_UNLESS(result != BROTLI_DECODER_RESULT_ERROR, Exception, sslit("::BrotliDecoderDecompressStream()"));
+		m_buffer.put(temp, static_cast<std::size_t>(next_out - temp));
+		if(result != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT){
+			break;
+		}
+	}
+}
+void BrotliDecompressor::put(const StreamBuffer &buffer){
+	PROFILE_ME;
+
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		put(data, size);
+	}
+}
+void BrotliDecompressor::flush(){
+	PROFILE_ME;
+
+	// put() 总是取出所有能够解码的数据。
+}
+StreamBuffer BrotliDecompressor::finalize(){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(::BrotliDecoderIsFinished(m_state), Exception, sslit("Brotli stream is truncated"));
+	StreamBuffer ret;
+	ret.swap(m_buffer);
+	clear();
+	return ret;
+}
+
+}
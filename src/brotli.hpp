@@ -0,0 +1,94 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_BROTLI_HPP_
+#define POSEIDON_BROTLI_HPP_
+
+#include "cxx_util.hpp"
+#include "stream_buffer.hpp"
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <brotli/encode.h>
+#include <brotli/decode.h>
+
+namespace Poseidon {
+
+// 接口与 Deflator 和 Inflator 相同。level 的范围是 0 到 11。
+// flush() 之后缓冲区中的数据可以被单独解压，适合配合分块传输逐块发送。
+class BrotliCompressor : NONCOPYABLE {
+private:
+	const int m_level;
+	::BrotliEncoderState *m_state;
+	StreamBuffer m_buffer;
+
+public:
+	explicit BrotliCompressor(int level = 6);
+	~BrotliCompressor();
+
+public:
+	const StreamBuffer &get_buffer() const {
+		return m_buffer;
+	}
+	StreamBuffer &get_buffer(){
+		return m_buffer;
+	}
+
+	void clear();
+	void put(const void *data, std::size_t size);
+	void put(char ch){
+		put(&ch, 1);
+	}
+	void put(int ch){
+		put(static_cast<char>(ch));
+	}
+	void put(const char *str){
+		put(str, std::strlen(str));
+	}
+	void put(const std::string &str){
+		put(str.data(), str.size());
+	}
+	void put(const StreamBuffer &buffer);
+	void flush();
+	StreamBuffer finalize();
+};
+
+class BrotliDecompressor : NONCOPYABLE {
+private:
+	::BrotliDecoderState *m_state;
+	StreamBuffer m_buffer;
+
+public:
+	BrotliDecompressor();
+	~BrotliDecompressor();
+
+public:
+	const StreamBuffer &get_buffer() const {
+		return m_buffer;
+	}
+	StreamBuffer &get_buffer(){
+		return m_buffer;
+	}
+
+	void clear();
+	void put(const void *data, std::size_t size);
+	void put(char ch){
+		put(&ch, 1);
+	}
+	void put(int ch){
+		put(static_cast<char>(ch));
+	}
+	void put(const char *str){
+		put(str, std::strlen(str));
+	}
+	void put(const std::string &str){
+		put(str.data(), str.size());
+	}
+	void put(const StreamBuffer &buffer);
+	void flush();
+	StreamBuffer finalize();
+};
+
+}
+
+#endif
@@ -8,16 +8,30 @@ namespace Poseidon {
 
 Buffer_streambuf::~Buffer_streambuf(){ }
 
-int Buffer_streambuf::sync(){
-	if(gptr()){
-		m_buffer.discard(static_cast<std::size_t>(gptr() - eback()));
-		setg(NULLPTR, NULLPTR, NULLPTR);
+void Buffer_streambuf::flush_get_area() NOEXCEPT {
+	if(!gptr()){
+		return;
+	}
+	m_buffer.discard(static_cast<std::size_t>(gptr() - eback()));
+	setg(NULLPTR, NULLPTR, NULLPTR);
+}
+void Buffer_streambuf::flush_put_area() NOEXCEPT {
+	if(!pbase()){
+		return;
 	}
+	m_buffer.commit_tail(static_cast<std::size_t>(pptr() - pbase()));
+	setp(NULLPTR, NULLPTR);
+}
+
+int Buffer_streambuf::sync(){
+	flush_get_area();
+	flush_put_area();
 	return std::streambuf::sync();
 }
 
 std::streamsize Buffer_streambuf::showmanyc(){
 	if(m_which & std::ios_base::in){
+		flush_put_area();
 		std::streamsize n_avail = static_cast<std::streamsize>(m_buffer.size());
 		if(gptr()){
 			n_avail -= gptr() - eback();
@@ -40,12 +54,19 @@ std::streamsize Buffer_streambuf::xsgetn(Buffer_streambuf::char_type *s, std::st
 Buffer_streambuf::int_type Buffer_streambuf::underflow(){
 	if(m_which & std::ios_base::in){
 		sync();
-		std::streamsize n_peeked = static_cast<std::streamsize>(m_buffer.peek(m_get_area.begin(), m_get_area.size()));
-		if(n_peeked == 0){
-			return traits_type::eof();
+		// 读取区只用于读取，pbackfail() 也不会写入其中，因此可以指向共享的数据块。
+		StreamBuffer::EnumerationCookie cookie;
+		const void *data;
+		std::size_t size;
+		while(m_buffer.enumerate_chunk(&data, &size, cookie)){
+			if(size == 0){
+				continue;
+			}
+			const AUTO(begin, static_cast<char *>(const_cast<void *>(data)));
+			setg(begin, begin, begin + size);
+			return traits_type::to_int_type(*gptr());
 		}
-		setg(m_get_area.begin(), m_get_area.begin(), m_get_area.begin() + n_peeked);
-		return traits_type::to_int_type(*gptr());
+		return traits_type::eof();
 	} else {
 		return traits_type::eof();
 	}
@@ -66,7 +87,14 @@ Buffer_streambuf::int_type Buffer_streambuf::pbackfail(Buffer_streambuf::int_typ
 
 std::streamsize Buffer_streambuf::xsputn(const Buffer_streambuf::char_type *s, std::streamsize n){
 	if(m_which & std::ios_base::out){
+		flush_get_area();
 		std::streamsize n_put = std::min<std::streamsize>(n, PTRDIFF_MAX);
+		if(pbase() && (epptr() - pptr() >= n_put)){
+			std::memcpy(pptr(), s, static_cast<std::size_t>(n_put));
+			pbump(static_cast<int>(n_put));
+			return n_put;
+		}
+		flush_put_area();
 		m_buffer.put(s, static_cast<std::size_t>(n_put));
 		return n_put;
 	} else {
@@ -78,7 +106,15 @@ Buffer_streambuf::int_type Buffer_streambuf::overflow(Buffer_streambuf::int_type
 		if(traits_type::eq_int_type(c, traits_type::eof())){
 			return traits_type::not_eof(c);
 		}
-		m_buffer.put(traits_type::to_char_type(c));
+		flush_get_area();
+		flush_put_area();
+		// 把末尾数据块剩余的空间整个作为写入区，之后的格式化输出直接写入其中。
+		std::size_t avail;
+		const AUTO(begin, static_cast<char *>(m_buffer.reserve_tail(1, avail)));
+		avail = std::min<std::size_t>(avail, INT_MAX);
+		setp(begin, begin + avail);
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
 		return c;
 	} else {
 		return traits_type::eof();
@@ -8,16 +8,16 @@
 #include <streambuf>
 #include <istream>
 #include <ostream>
-#include <boost/array.hpp>
 #include "stream_buffer.hpp"
 
 namespace Poseidon {
 
+// 读取区直接指向 m_buffer 开头的数据块，写入区直接指向 m_buffer 末尾预留的空间。
+// 任何直接访问 m_buffer 的操作都必须先调用 sync()。
 class Buffer_streambuf : public std::streambuf {
 private:
 	StreamBuffer m_buffer;
 	std::ios_base::openmode m_which;
-	boost::array<char, 32> m_get_area;
 
 public:
 	explicit Buffer_streambuf(std::ios_base::openmode which = std::ios_base::in | std::ios_base::out)
@@ -42,6 +42,10 @@ public:
 #endif
 	~Buffer_streambuf() OVERRIDE;
 
+private:
+	void flush_get_area() NOEXCEPT;
+	void flush_put_area() NOEXCEPT;
+
 protected:
 	int sync() OVERRIDE;
 
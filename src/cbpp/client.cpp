@@ -9,6 +9,7 @@
 #include "../job_base.hpp"
 #include "../profiler.hpp"
 #include "../time.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 namespace Cbpp {
@@ -17,16 +18,24 @@ class Client::SyncJobBase : public JobBase {
 private:
 	const SocketBase::DelayedShutdownGuard m_guard;
 	const boost::weak_ptr<Client> m_weak_client;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
 
 protected:
 	explicit SyncJobBase(const boost::shared_ptr<Client> &client)
-		: m_guard(client), m_weak_client(client)
+		: m_guard(client), m_weak_client(client), m_priority(client->get_job_priority()), m_thread_hint(client->get_epoll_thread_index())
 	{ }
 
 private:
 	boost::weak_ptr<const void> get_category() const FINAL {
 		return m_weak_client;
 	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
+	}
 	void perform() FINAL {
 		PROFILE_ME;
 
@@ -74,6 +83,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
 		PROFILE_ME;
 
@@ -122,6 +134,9 @@ protected:
 Client::Client(const SockAddr &addr, bool use_ssl, bool verify_peer)
 	: LowLevelClient(addr, use_ssl, verify_peer)
 { }
+Client::Client(const boost::container::vector<SockAddr> &addrs, bool use_ssl, bool verify_peer)
+	: LowLevelClient(addrs, use_ssl, verify_peer)
+{ }
 Client::~Client(){ }
 
 void Client::on_connect(){
@@ -130,14 +145,14 @@ void Client::on_connect(){
 	LowLevelClient::on_connect();
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ConnectJob>(virtual_shared_from_this<Client>()),
+		boost::allocate_shared<ConnectJob>(PooledAllocator<ConnectJob>(), virtual_shared_from_this<Client>()),
 		VAL_INIT);
 }
 void Client::on_read_hup(){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ReadHupJob>(virtual_shared_from_this<Client>()),
+		boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Client>()),
 		VAL_INIT);
 
 	LowLevelClient::on_read_hup();
@@ -164,7 +179,7 @@ bool Client::on_low_level_data_message_end(boost::uint64_t payload_size){
 	(void)payload_size;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<DataMessageJob>(virtual_shared_from_this<Client>(), m_message_id, STD_MOVE(m_payload)),
+		boost::allocate_shared<DataMessageJob>(PooledAllocator<DataMessageJob>(), virtual_shared_from_this<Client>(), m_message_id, STD_MOVE(m_payload)),
 		VAL_INIT);
 
 	return true;
@@ -174,7 +189,7 @@ bool Client::on_low_level_control_message(StatusCode status_code, StreamBuffer p
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ControlMessageJob>(virtual_shared_from_this<Client>(), status_code, STD_MOVE(param)),
+		boost::allocate_shared<ControlMessageJob>(PooledAllocator<ControlMessageJob>(), virtual_shared_from_this<Client>(), status_code, STD_MOVE(param)),
 		VAL_INIT);
 
 	return true;
@@ -23,6 +23,7 @@ private:
 
 public:
 	explicit Client(const SockAddr &addr, bool use_ssl = false, bool verify_peer = true);
+	explicit Client(const boost::container::vector<SockAddr> &addrs, bool use_ssl = false, bool verify_peer = true);
 	~Client();
 
 protected:
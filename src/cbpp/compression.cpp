@@ -0,0 +1,171 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "compression.hpp"
+#include "reader.hpp"
+#include "writer.hpp"
+#include "status_codes.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include "../endian.hpp"
+#include "../mutex.hpp"
+#include "../zstd.hpp"
+#include "../singletons/main_config.hpp"
+#include "../singletons/filesystem_daemon.hpp"
+#include <boost/container/vector.hpp>
+#include <zlib.h>
+
+namespace Poseidon {
+namespace Cbpp {
+
+namespace {
+	CONSTEXPR const std::size_t s_max_pooled_contexts = 16;
+
+	struct Settings {
+		bool enabled;
+		int level;
+		boost::uint64_t threshold;
+		std::string dictionary;
+		boost::uint32_t dictionary_id;
+	};
+
+	Mutex g_settings_mutex;
+	boost::shared_ptr<const Settings> g_settings;
+
+	// 配置项在第一次使用时读取，之后不会改变，这样同一个进程中的所有连接使用相同的字典。
+	boost::shared_ptr<const Settings> get_settings(){
+		const Mutex::UniqueLock lock(g_settings_mutex);
+		if(g_settings){
+			return g_settings;
+		}
+		const AUTO(settings, boost::make_shared<Settings>());
+		settings->enabled = MainConfig::get<bool>("cbpp_compression_enabled", false);
+		settings->level = std::min(std::max(MainConfig::get<int>("cbpp_compression_level", 3), 1), 22);
+		settings->threshold = MainConfig::get<boost::uint64_t>("cbpp_compression_threshold", 4096);
+		settings->dictionary_id = 0;
+		const AUTO(dictionary_path, MainConfig::get<std::string>("cbpp_compression_dictionary"));
+		if(!dictionary_path.empty()){
+			LOG_POSEIDON_INFO("Loading CBPP compression dictionary: ", dictionary_path);
+			settings->dictionary = FileSystemDaemon::load(dictionary_path).data.dump_string();
+			settings->dictionary_id = ::ZSTD_getDictID_fromDict(settings->dictionary.data(), settings->dictionary.size());
+			if(settings->dictionary_id == 0){
+				// 没有 zstd 字典头的原始内容字典，用 CRC-32 代替。
+				const AUTO(data, reinterpret_cast<const unsigned char *>(settings->dictionary.data()));
+				settings->dictionary_id = static_cast<boost::uint32_t>(::crc32(0, data, static_cast<unsigned>(settings->dictionary.size())) | 1u);
+			}
+		}
+		g_settings = settings;
+		return settings;
+	}
+
+	Mutex g_pool_mutex;
+	boost::container::vector<boost::shared_ptr<ZstdCompressor> > g_compressor_pool;
+	boost::container::vector<boost::shared_ptr<ZstdDecompressor> > g_decompressor_pool;
+
+	boost::shared_ptr<ZstdCompressor> acquire_compressor(const Settings &settings){
+		{
+			const Mutex::UniqueLock lock(g_pool_mutex);
+			if(!g_compressor_pool.empty()){
+				AUTO(compressor, STD_MOVE_IDN(g_compressor_pool.back()));
+				g_compressor_pool.pop_back();
+				return compressor;
+			}
+		}
+		AUTO(compressor, boost::make_shared<ZstdCompressor>(settings.level));
+		if(!settings.dictionary.empty()){
+			compressor->load_dictionary(settings.dictionary.data(), settings.dictionary.size());
+		}
+		return compressor;
+	}
+	void release_compressor(boost::shared_ptr<ZstdCompressor> compressor){
+		compressor->clear();
+		const Mutex::UniqueLock lock(g_pool_mutex);
+		if(g_compressor_pool.size() >= s_max_pooled_contexts){
+			return;
+		}
+		g_compressor_pool.push_back(STD_MOVE(compressor));
+	}
+}
+
+void announce_compression(Reader &reader, Writer &writer){
+	PROFILE_ME;
+
+	if(reader.is_decompression_enabled()){
+		return;
+	}
+	const AUTO(settings, get_settings());
+	if(!settings->enabled){
+		return;
+	}
+	reader.enable_decompression();
+
+	StreamBuffer param;
+	boost::uint32_t temp32;
+	store_be(temp32, settings->dictionary_id);
+	param.put(&temp32, 4);
+	writer.put_control_message(ST_COMPRESSION, STD_MOVE(param));
+}
+void accept_compression(Reader &reader, Writer &writer, const StreamBuffer &param){
+	PROFILE_ME;
+
+	announce_compression(reader, writer);
+
+	const AUTO(settings, get_settings());
+	if(!settings->enabled){
+		LOG_POSEIDON_DEBUG("CBPP compression is disabled. Peer announcement ignored.");
+		return;
+	}
+	boost::uint32_t temp32;
+	if(param.peek(&temp32, 4) < 4){
+		LOG_POSEIDON_WARNING("Invalid CBPP compression announcement: param = ", param);
+		return;
+	}
+	const boost::uint32_t dictionary_id = load_be(temp32);
+	if(dictionary_id != settings->dictionary_id){
+		LOG_POSEIDON_WARNING("CBPP compression dictionary mismatch: local = ", settings->dictionary_id, ", remote = ", dictionary_id);
+		return;
+	}
+	writer.enable_compression(settings->threshold);
+}
+
+bool compress_message_payload(StreamBuffer &compressed, const StreamBuffer &payload){
+	PROFILE_ME;
+
+	const AUTO(settings, get_settings());
+	AUTO(compressor, acquire_compressor(*settings));
+	compressor->put(payload);
+	StreamBuffer data = compressor->finalize();
+	compressed.splice(data);
+	release_compressor(STD_MOVE(compressor));
+	return compressed.size() < payload.size();
+}
+boost::shared_ptr<ZstdDecompressor> acquire_message_decompressor(){
+	PROFILE_ME;
+
+	{
+		const Mutex::UniqueLock lock(g_pool_mutex);
+		if(!g_decompressor_pool.empty()){
+			AUTO(decompressor, STD_MOVE_IDN(g_decompressor_pool.back()));
+			g_decompressor_pool.pop_back();
+			return decompressor;
+		}
+	}
+	const AUTO(settings, get_settings());
+	AUTO(decompressor, boost::make_shared<ZstdDecompressor>());
+	if(!settings->dictionary.empty()){
+		decompressor->load_dictionary(settings->dictionary.data(), settings->dictionary.size());
+	}
+	return decompressor;
+}
+void release_message_decompressor(boost::shared_ptr<ZstdDecompressor> decompressor){
+	decompressor->clear();
+	const Mutex::UniqueLock lock(g_pool_mutex);
+	if(g_decompressor_pool.size() >= s_max_pooled_contexts){
+		return;
+	}
+	g_decompressor_pool.push_back(STD_MOVE(decompressor));
+}
+
+}
+}
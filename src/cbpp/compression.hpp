@@ -0,0 +1,39 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_CBPP_COMPRESSION_HPP_
+#define POSEIDON_CBPP_COMPRESSION_HPP_
+
+#include "../stream_buffer.hpp"
+#include "../fwd.hpp"
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+namespace Cbpp {
+
+class Reader;
+class Writer;
+
+// 压缩扩展：
+// 一方发送 ST_COMPRESSION 控制消息声明自己能够解压，参数是 4 字节大端序的字典 ID，不使用字典时为 0。
+// 收到声明的一方如果也启用了压缩，则回复自己的声明；字典 ID 相同时，其后不短于 cbpp_compression_threshold 字节的数据消息以 zstd 压缩。
+// 压缩的消息以 0xFFFE 作为长度，其后依次是 8 字节的压缩后的长度、8 字节的原始长度和 2 字节的消息 ID，然后是压缩后的数据。
+// 原始长度恰好为 0xFFFE 字节的消息总是使用 8 字节的长度，因此协商之后不会有歧义。控制消息从不压缩。
+// 客户端在连接后主动声明，服务端只回复，因此没有启用压缩的旧客户端不会收到无法识别的控制消息。
+
+// 如果 cbpp_compression_enabled 为 1 并且 reader 还不能解压，则允许 reader 解压，并通过 writer 发送 ST_COMPRESSION。
+extern void announce_compression(Reader &reader, Writer &writer);
+// 处理对方发来的 ST_COMPRESSION：先回复自己的声明（如果需要），字典 ID 相同时允许 writer 压缩。
+extern void accept_compression(Reader &reader, Writer &writer, const StreamBuffer &param);
+
+// 压缩 payload 的全部数据并把结果追加到 compressed 中。没有变小时返回 false，此时 compressed 的内容不确定。
+extern bool compress_message_payload(StreamBuffer &compressed, const StreamBuffer &payload);
+// 解压器在池中复用，已经加载了 cbpp_compression_dictionary 指定的字典。
+extern boost::shared_ptr<ZstdDecompressor> acquire_message_decompressor();
+extern void release_message_decompressor(boost::shared_ptr<ZstdDecompressor> decompressor);
+
+}
+}
+
+#endif
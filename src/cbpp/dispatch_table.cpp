@@ -0,0 +1,201 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "dispatch_table.hpp"
+#include "session.hpp"
+#include "exception.hpp"
+#include "message_base.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include "../atomic.hpp"
+#include "../time.hpp"
+
+namespace Poseidon {
+namespace Cbpp {
+
+struct DispatchTable::Entry {
+	RawHandler raw_handler;
+	Decoder decoder;
+	MessageHandler message_handler;
+
+	mutable volatile boost::uint64_t count;
+	mutable volatile boost::uint64_t exceptions;
+	mutable volatile boost::uint64_t total_us;
+	mutable volatile boost::uint64_t max_us;
+
+	Entry()
+		: raw_handler(), decoder(), message_handler(), count(0), exceptions(0), total_us(0), max_us(0)
+	{ }
+
+	bool is_registered() const NOEXCEPT {
+		return raw_handler || message_handler;
+	}
+
+	static boost::uint64_t elapsed_us(double begin) NOEXCEPT {
+		const double delta = get_hi_res_mono_clock() - begin;
+		return static_cast<boost::uint64_t>(std::max(delta, 0.0) * 1000);
+	}
+	void add_decoding_time(double begin) const NOEXCEPT {
+		atomic_add(total_us, elapsed_us(begin), ATOMIC_RELAXED);
+	}
+	void update(double begin, bool succeeded) const NOEXCEPT {
+		const AUTO(us, elapsed_us(begin));
+		atomic_add(count, 1, ATOMIC_RELAXED);
+		if(!succeeded){
+			atomic_add(exceptions, 1, ATOMIC_RELAXED);
+		}
+		atomic_add(total_us, us, ATOMIC_RELAXED);
+		boost::uint64_t old = atomic_load(max_us, ATOMIC_RELAXED);
+		while((old < us) && !atomic_compare_exchange(max_us, old, us, ATOMIC_RELAXED, ATOMIC_RELAXED)){
+			// 重试。
+		}
+	}
+};
+
+DispatchTable::DispatchTable(){ }
+DispatchTable::~DispatchTable(){ }
+
+DispatchTable::Entry *DispatchTable::get_entry(boost::uint16_t message_id) const NOEXCEPT {
+	const AUTO_REF(page, m_pages[message_id >> 8]);
+	if(!page){
+		return NULLPTR;
+	}
+	const AUTO(entry, &page[message_id & 0xFF]);
+	if(!entry->is_registered()){
+		return NULLPTR;
+	}
+	return entry;
+}
+DispatchTable::Entry &DispatchTable::require_entry(boost::uint16_t message_id){
+	AUTO_REF(page, m_pages[message_id >> 8]);
+	if(!page){
+		page.reset(new Entry[256]);
+	}
+	AUTO_REF(entry, page[message_id & 0xFF]);
+	if(entry.is_registered()){
+		LOG_POSEIDON_ERROR("Duplicate CBPP message handler: message_id = ", message_id);
+		DEBUG_THROW(Exception, ST_INTERNAL_ERROR, sslit("Duplicate CBPP message handler"));
+	}
+	return entry;
+}
+
+void DispatchTable::register_raw_handler(boost::uint16_t message_id, RawHandler handler){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(handler, Exception, ST_INTERNAL_ERROR, sslit("Null handler"));
+	AUTO_REF(entry, require_entry(message_id));
+	entry.raw_handler.swap(handler);
+}
+void DispatchTable::register_message_handler(boost::uint16_t message_id, Decoder decoder, MessageHandler handler){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(decoder && handler, Exception, ST_INTERNAL_ERROR, sslit("Null handler"));
+	AUTO_REF(entry, require_entry(message_id));
+	entry.decoder.swap(decoder);
+	entry.message_handler.swap(handler);
+}
+
+bool DispatchTable::is_registered(boost::uint16_t message_id) const {
+	return !!get_entry(message_id);
+}
+bool DispatchTable::dispatch(const boost::shared_ptr<Session> &session, boost::uint16_t message_id, StreamBuffer payload) const {
+	PROFILE_ME;
+
+	const AUTO(entry, get_entry(message_id));
+	if(!entry){
+		return false;
+	}
+	const double begin = get_hi_res_mono_clock();
+	try {
+		if(entry->raw_handler){
+			entry->raw_handler(session, STD_MOVE(payload));
+		} else {
+			const AUTO(msg, entry->decoder(STD_MOVE(payload)));
+			entry->message_handler(session, *msg);
+		}
+	} catch(...){
+		entry->update(begin, false);
+		throw;
+	}
+	entry->update(begin, true);
+	return true;
+}
+
+boost::shared_ptr<const MessageBase> DispatchTable::decode(boost::uint16_t message_id, StreamBuffer &payload) const {
+	PROFILE_ME;
+
+	const AUTO(entry, get_entry(message_id));
+	if(!entry || !entry->decoder){
+		return VAL_INIT;
+	}
+	const double begin = get_hi_res_mono_clock();
+	boost::shared_ptr<const MessageBase> msg;
+	try {
+		msg = entry->decoder(STD_MOVE(payload));
+	} catch(...){
+		entry->update(begin, false);
+		throw;
+	}
+	entry->add_decoding_time(begin);
+	return msg;
+}
+bool DispatchTable::dispatch_decoded(const boost::shared_ptr<Session> &session, boost::uint16_t message_id, const MessageBase &msg) const {
+	PROFILE_ME;
+
+	const AUTO(entry, get_entry(message_id));
+	if(!entry || !entry->message_handler){
+		return false;
+	}
+	const double begin = get_hi_res_mono_clock();
+	try {
+		entry->message_handler(session, msg);
+	} catch(...){
+		entry->update(begin, false);
+		throw;
+	}
+	entry->update(begin, true);
+	return true;
+}
+
+void DispatchTable::get_statistics(boost::container::vector<DispatchStatistics> &ret) const {
+	PROFILE_ME;
+
+	for(unsigned hi = 0; hi < 256; ++hi){
+		const AUTO_REF(page, m_pages[hi]);
+		if(!page){
+			continue;
+		}
+		for(unsigned lo = 0; lo < 256; ++lo){
+			const AUTO_REF(entry, page[lo]);
+			if(!entry.is_registered()){
+				continue;
+			}
+			DispatchStatistics stats;
+			stats.message_id = static_cast<boost::uint16_t>((hi << 8) | lo);
+			stats.count = atomic_load(entry.count, ATOMIC_RELAXED);
+			stats.exceptions = atomic_load(entry.exceptions, ATOMIC_RELAXED);
+			stats.total_us = atomic_load(entry.total_us, ATOMIC_RELAXED);
+			stats.max_us = atomic_load(entry.max_us, ATOMIC_RELAXED);
+			ret.push_back(stats);
+		}
+	}
+}
+void DispatchTable::clear_statistics() const NOEXCEPT {
+	for(unsigned hi = 0; hi < 256; ++hi){
+		const AUTO_REF(page, m_pages[hi]);
+		if(!page){
+			continue;
+		}
+		for(unsigned lo = 0; lo < 256; ++lo){
+			const AUTO_REF(entry, page[lo]);
+			atomic_store(entry.count, 0, ATOMIC_RELAXED);
+			atomic_store(entry.exceptions, 0, ATOMIC_RELAXED);
+			atomic_store(entry.total_us, 0, ATOMIC_RELAXED);
+			atomic_store(entry.max_us, 0, ATOMIC_RELAXED);
+		}
+	}
+}
+
+}
+}
@@ -0,0 +1,91 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_CBPP_DISPATCH_TABLE_HPP_
+#define POSEIDON_CBPP_DISPATCH_TABLE_HPP_
+
+#include "../cxx_util.hpp"
+#include "../stream_buffer.hpp"
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/container/vector.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+namespace Cbpp {
+
+class Session;
+class MessageBase;
+
+struct DispatchStatistics {
+	boost::uint16_t message_id;
+	boost::uint64_t count;
+	boost::uint64_t exceptions;
+	// 处理函数的耗时，单位是微秒，包含反序列化（不论是否在网络线程中进行）。
+	boost::uint64_t total_us;
+	boost::uint64_t max_us;
+};
+
+// 按照消息 ID 把数据消息分派给处理函数，消息 ID 的高 8 位和低 8 位分别索引两级数组，分派时不加锁。
+// 处理函数必须在分派开始之前全部注册（通常在模块加载时），之后只通过 const 引用使用。
+class DispatchTable : NONCOPYABLE {
+public:
+	typedef boost::function<void (const boost::shared_ptr<Session> &session, StreamBuffer payload)> RawHandler;
+	typedef boost::function<boost::shared_ptr<const MessageBase> (StreamBuffer payload)> Decoder;
+	typedef boost::function<void (const boost::shared_ptr<Session> &session, const MessageBase &msg)> MessageHandler;
+
+private:
+	struct Entry;
+
+	boost::scoped_array<Entry> m_pages[256];
+
+public:
+	DispatchTable();
+	~DispatchTable();
+
+private:
+	Entry *get_entry(boost::uint16_t message_id) const NOEXCEPT;
+	Entry &require_entry(boost::uint16_t message_id);
+
+public:
+	// 每个消息 ID 只能注册一次。
+	void register_raw_handler(boost::uint16_t message_id, RawHandler handler);
+	// decoder 可能在网络线程中调用，参见 decode()。
+	void register_message_handler(boost::uint16_t message_id, Decoder decoder, MessageHandler handler);
+
+	// MessageT 是 message_generator.hpp 生成的消息类，按照 MessageT::ID 注册，收到的数据自动反序列化。
+	template<typename MessageT>
+	void register_handler(boost::function<void (const boost::shared_ptr<Session> &session, const MessageT &msg)> handler){
+		struct Helper {
+			static boost::shared_ptr<const MessageBase> deserialize(StreamBuffer payload){
+				return boost::make_shared<MessageT>(STD_MOVE(payload));
+			}
+			static void fwd(boost::function<void (const boost::shared_ptr<Session> &, const MessageT &)> &handler, const boost::shared_ptr<Session> &session, const MessageBase &msg){
+				handler(session, static_cast<const MessageT &>(msg));
+			}
+		};
+		register_message_handler(MessageT::ID, &Helper::deserialize, boost::bind(&Helper::fwd, STD_MOVE_IDN(handler), _1, _2));
+	}
+
+	bool is_registered(boost::uint16_t message_id) const;
+	// 没有注册处理函数时返回 false。处理函数抛出的异常被原样抛出。
+	bool dispatch(const boost::shared_ptr<Session> &session, boost::uint16_t message_id, StreamBuffer payload) const;
+
+	// 使用 register_handler() 或 register_message_handler() 注册的消息可以在任意线程中预先反序列化，
+	// 然后通过 dispatch_decoded() 分派，这样任务线程中只执行处理函数。
+	// 没有注册 decoder 时返回空指针并且不修改 payload。反序列化失败时抛出异常。
+	boost::shared_ptr<const MessageBase> decode(boost::uint16_t message_id, StreamBuffer &payload) const;
+	bool dispatch_decoded(const boost::shared_ptr<Session> &session, boost::uint16_t message_id, const MessageBase &msg) const;
+
+	// 只返回注册过的消息 ID，按照 ID 排序。
+	void get_statistics(boost::container::vector<DispatchStatistics> &ret) const;
+	void clear_statistics() const NOEXCEPT;
+};
+
+}
+}
+
+#endif
@@ -15,6 +15,7 @@ class Writer;
 
 class Session;
 class Client;
+class DispatchTable;
 
 }
 }
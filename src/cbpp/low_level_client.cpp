@@ -4,6 +4,7 @@
 #include "../precompiled.hpp"
 #include "low_level_client.hpp"
 #include "exception.hpp"
+#include "compression.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 
@@ -13,12 +14,15 @@ namespace Cbpp {
 LowLevelClient::LowLevelClient(const SockAddr &addr, bool use_ssl, bool verify_peer)
 	: TcpClientBase(addr, use_ssl, verify_peer), Reader(), Writer()
 { }
+LowLevelClient::LowLevelClient(const boost::container::vector<SockAddr> &addrs, bool use_ssl, bool verify_peer)
+	: TcpClientBase(addrs, use_ssl, verify_peer), Reader(), Writer()
+{ }
 LowLevelClient::~LowLevelClient(){ }
 
 void LowLevelClient::on_connect(){
 	PROFILE_ME;
 
-	//
+	announce_compression(*this, *this);
 }
 void LowLevelClient::on_read_hup(){
 	PROFILE_ME;
@@ -55,6 +59,11 @@ bool LowLevelClient::on_data_message_end(boost::uint64_t payload_size){
 bool LowLevelClient::on_control_message(StatusCode status_code, StreamBuffer param){
 	PROFILE_ME;
 
+	if(status_code == ST_COMPRESSION){
+		// 压缩扩展在这里协商，不交给上层。
+		accept_compression(*this, *this, param);
+		return true;
+	}
 	return on_low_level_control_message(status_code, STD_MOVE(param));
 }
 
@@ -16,6 +16,7 @@ namespace Cbpp {
 class LowLevelClient : public TcpClientBase, protected Reader, protected Writer {
 public:
 	explicit LowLevelClient(const SockAddr &addr, bool use_ssl = false, bool verify_peer = true);
+	explicit LowLevelClient(const boost::container::vector<SockAddr> &addrs, bool use_ssl = false, bool verify_peer = true);
 	~LowLevelClient();
 
 protected:
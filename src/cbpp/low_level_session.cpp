@@ -4,18 +4,80 @@
 #include "../precompiled.hpp"
 #include "low_level_session.hpp"
 #include "exception.hpp"
+#include "compression.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../time.hpp"
+#include "../singletons/main_config.hpp"
+#include "../singletons/timer_daemon.hpp"
 
 namespace Poseidon {
 namespace Cbpp {
 
+namespace {
+	ConfigValue<boost::uint64_t> g_coalescing_delay("cbpp_coalescing_delay", 0);
+
+	class FrameEncoder : public Writer {
+	private:
+		StreamBuffer m_encoded;
+
+	protected:
+		long on_encoded_data_avail(StreamBuffer encoded) OVERRIDE {
+			m_encoded.splice(encoded);
+			return true;
+		}
+
+	public:
+		StreamBuffer &get_encoded(){
+			return m_encoded;
+		}
+	};
+
+	// 合并的数据达到这个大小时立即发送，不再等待。
+	CONSTEXPR const std::size_t s_max_coalesced_size = 65536;
+}
+
+void LowLevelSession::flush_timer_proc(const boost::weak_ptr<LowLevelSession> &weak){
+	PROFILE_ME;
+
+	const AUTO(session, weak.lock());
+	if(!session){
+		return;
+	}
+	const Mutex::UniqueLock lock(session->m_cork_mutex);
+	session->m_flush_timer.reset();
+	if(session->m_cork_count != 0){
+		// 由 uncork() 发送。
+		return;
+	}
+	session->flush_corked();
+}
+
 LowLevelSession::LowLevelSession(Move<UniqueFile> socket)
 	: TcpSessionBase(STD_MOVE(socket)), Reader(), Writer()
+	, m_cork_count(0), m_coalescing_delay(g_coalescing_delay.get())
 { }
 LowLevelSession::~LowLevelSession(){ }
 
+bool LowLevelSession::flush_corked() NOEXCEPT
+try {
+	if(m_corked.empty()){
+		return true;
+	}
+	// 在持有 m_cork_mutex 的情况下发送，这样其他线程的消息不会插到前面。
+	StreamBuffer data;
+	data.swap(m_corked);
+	return TcpSessionBase::send(STD_MOVE(data));
+} catch(std::exception &e){
+	LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+	force_shutdown();
+	return false;
+} catch(...){
+	LOG_POSEIDON_ERROR("Unknown exception thrown.");
+	force_shutdown();
+	return false;
+}
+
 void LowLevelSession::on_connect(){
 	PROFILE_ME;
 
@@ -50,24 +112,47 @@ void LowLevelSession::on_data_message_payload(boost::uint64_t payload_offset, St
 bool LowLevelSession::on_data_message_end(boost::uint64_t payload_size){
 	PROFILE_ME;
 
+	account_message_read();
 	return on_low_level_data_message_end(payload_size);
 }
 
 bool LowLevelSession::on_control_message(StatusCode status_code, StreamBuffer param){
 	PROFILE_ME;
 
+	if(status_code == ST_COMPRESSION){
+		// 压缩扩展在这里协商，不交给上层。
+		accept_compression(*this, *this, param);
+		return true;
+	}
 	return on_low_level_control_message(status_code, STD_MOVE(param));
 }
 
 long LowLevelSession::on_encoded_data_avail(StreamBuffer encoded){
 	PROFILE_ME;
 
-	return TcpSessionBase::send(STD_MOVE(encoded));
+	Mutex::UniqueLock lock(m_cork_mutex);
+	if((m_cork_count == 0) && (m_coalescing_delay == 0) && m_corked.empty()){
+		lock.unlock();
+		return TcpSessionBase::send(STD_MOVE(encoded));
+	}
+	m_corked.splice(encoded);
+	if(m_cork_count != 0){
+		return true;
+	}
+	if((m_coalescing_delay == 0) || (m_corked.size() >= s_max_coalesced_size)){
+		return flush_corked();
+	}
+	if(!m_flush_timer){
+		m_flush_timer = TimerDaemon::register_low_level_timer(m_coalescing_delay, 0,
+			boost::bind(&flush_timer_proc, virtual_weak_from_this<LowLevelSession>()));
+	}
+	return true;
 }
 
 bool LowLevelSession::send(boost::uint16_t message_id, StreamBuffer payload){
 	PROFILE_ME;
 
+	account_message_written();
 	return Writer::put_data_message(message_id, STD_MOVE(payload));
 }
 bool LowLevelSession::send_status(StatusCode status_code, StreamBuffer param){
@@ -75,6 +160,16 @@ bool LowLevelSession::send_status(StatusCode status_code, StreamBuffer param){
 
 	return Writer::put_control_message(status_code, STD_MOVE(param));
 }
+std::size_t LowLevelSession::broadcast(const boost::container::vector<boost::shared_ptr<TcpSessionBase> > &sessions, boost::uint16_t message_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	FrameEncoder encoder;
+	encoder.put_data_message(message_id, STD_MOVE(payload));
+	const AUTO(shared, boost::make_shared<StreamBuffer>());
+	shared->swap(encoder.get_encoded());
+	return TcpSessionBase::broadcast(sessions, shared);
+}
+
 bool LowLevelSession::shutdown(StatusCode status_code, const char *param) NOEXCEPT
 try {
 	PROFILE_ME;
@@ -83,6 +178,7 @@ try {
 		return false;
 	}
 	Writer::put_control_message(status_code, StreamBuffer(param));
+	flush();
 	shutdown_read();
 	return shutdown_write();
 } catch(std::exception &e){
@@ -95,5 +191,37 @@ try {
 	return false;
 }
 
+void LowLevelSession::cork(){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_cork_mutex);
+	++m_cork_count;
+}
+bool LowLevelSession::uncork(){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_cork_mutex);
+	DEBUG_THROW_ASSERT(m_cork_count != 0);
+	if(--m_cork_count != 0){
+		return true;
+	}
+	return flush_corked();
+}
+bool LowLevelSession::flush(){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_cork_mutex);
+	return flush_corked();
+}
+
+boost::uint64_t LowLevelSession::get_coalescing_delay() const {
+	const Mutex::UniqueLock lock(m_cork_mutex);
+	return m_coalescing_delay;
+}
+void LowLevelSession::set_coalescing_delay(boost::uint64_t coalescing_delay){
+	const Mutex::UniqueLock lock(m_cork_mutex);
+	m_coalescing_delay = coalescing_delay;
+}
+
 }
 }
@@ -5,6 +5,8 @@
 #define POSEIDON_CBPP_LOW_LEVEL_SESSION_HPP_
 
 #include "../tcp_session_base.hpp"
+#include "../mutex.hpp"
+#include "../fwd.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
 #include "status_codes.hpp"
@@ -13,10 +15,41 @@ namespace Poseidon {
 namespace Cbpp {
 
 class LowLevelSession : public TcpSessionBase, protected Reader, protected Writer {
+public:
+	// 在其生存期内发送的消息被合并起来，析构时一次性发送。可以嵌套。
+	class CorkGuard : NONCOPYABLE {
+	private:
+		LowLevelSession &m_session;
+
+	public:
+		explicit CorkGuard(LowLevelSession &session)
+			: m_session(session)
+		{
+			m_session.cork();
+		}
+		~CorkGuard(){
+			m_session.uncork();
+		}
+	};
+
+private:
+	static void flush_timer_proc(const boost::weak_ptr<LowLevelSession> &weak);
+
+private:
+	mutable Mutex m_cork_mutex;
+	unsigned m_cork_count;
+	boost::uint64_t m_coalescing_delay;
+	StreamBuffer m_corked;
+	boost::shared_ptr<Timer> m_flush_timer;
+
 public:
 	explicit LowLevelSession(Move<UniqueFile> socket);
 	~LowLevelSession();
 
+private:
+	// 调用时须持有 m_cork_mutex。
+	bool flush_corked() NOEXCEPT;
+
 protected:
 	// TcpSessionBase
 	void on_connect() OVERRIDE;
@@ -45,6 +78,20 @@ public:
 	virtual bool send(boost::uint16_t message_id, StreamBuffer payload);
 	virtual bool send_status(StatusCode status_code, StreamBuffer param);
 	virtual bool shutdown(StatusCode status_code, const char *param = "") NOEXCEPT;
+
+	// cork() 之后编码的消息被追加到同一个缓冲区中，最后一次 uncork() 时作为一整块数据发送，只加一次锁、只唤醒一次 epoll。
+	void cork();
+	bool uncork();
+	// 立即发送合并起来的消息，不论是否处于 cork() 状态。
+	bool flush();
+
+	// 不为零时，没有 cork() 的消息也会被合并，在第一条消息之后至多等待这么多毫秒发送，类似于 Nagle 算法。
+	// 缺省值取自 cbpp_coalescing_delay。
+	boost::uint64_t get_coalescing_delay() const;
+	void set_coalescing_delay(boost::uint64_t coalescing_delay);
+
+	// 只编码一次，所有会话共享编码后的数据。返回成功排队的会话数。
+	static std::size_t broadcast(const boost::container::vector<boost::shared_ptr<TcpSessionBase> > &sessions, boost::uint16_t message_id, StreamBuffer payload);
 };
 
 }
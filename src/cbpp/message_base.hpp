@@ -66,16 +66,82 @@
 namespace Poseidon {
 namespace Cbpp {
 
+// 指向其他对象所持有的一段数据，在该对象的生存期内有效。
+class ByteSpan {
+private:
+	const unsigned char *m_data;
+	std::size_t m_size;
+
+public:
+	ByteSpan(const void *data, std::size_t size)
+		: m_data(static_cast<const unsigned char *>(data)), m_size(size)
+	{ }
+
+public:
+	const unsigned char *data() const {
+		return m_data;
+	}
+	std::size_t size() const {
+		return m_size;
+	}
+	bool empty() const {
+		return m_size == 0;
+	}
+	const unsigned char *begin() const {
+		return m_data;
+	}
+	const unsigned char *end() const {
+		return m_data + m_size;
+	}
+
+	std::string to_string() const {
+		return std::string(reinterpret_cast<const char *>(m_data), m_size);
+	}
+	StreamBuffer to_buffer() const {
+		return StreamBuffer(m_data, m_size);
+	}
+};
+
 class MessageBase {
 public:
 	virtual ~MessageBase();
 
 public:
 	virtual boost::uint64_t get_id() const = 0;
+	// 返回 serialize() 将要追加的字节数。
+	virtual std::size_t get_serialized_size() const = 0;
 	virtual void serialize(StreamBuffer &buffer) const = 0;
 	virtual void deserialize(StreamBuffer &buffer) = 0;
 	virtual void dump_debug(std::ostream &os) const = 0;
 
+protected:
+	// 从 buffer 的开头解码一个数并丢弃其所占的字节。数据不足时返回 false，buffer 不变。
+	// 数据连续时在原处解码，否则复制到临时的缓冲区中。
+	static bool shift_vuint64(boost::uint64_t &val, StreamBuffer &buffer){
+		unsigned char temp[9];
+		const unsigned char *begin = static_cast<const unsigned char *>(buffer.peek_contiguous(sizeof(temp)));
+		std::size_t avail = sizeof(temp);
+		if(!begin){
+			avail = buffer.peek(temp, sizeof(temp));
+			begin = temp;
+		}
+		const unsigned char *read = begin;
+		if(!vuint64_from_binary(val, read, avail)){
+			return false;
+		}
+		buffer.discard(static_cast<std::size_t>(read - begin));
+		return true;
+	}
+	static bool shift_vint64(boost::int64_t &val, StreamBuffer &buffer){
+		boost::uint64_t encoded;
+		if(!shift_vuint64(encoded, buffer)){
+			return false;
+		}
+		encoded = (encoded >> 1) ^ -(encoded & 1);
+		val = static_cast<boost::int64_t>(encoded);
+		return true;
+	}
+
 public:
 	operator StreamBuffer() const {
 		StreamBuffer buffer;
@@ -56,9 +56,140 @@ public:
 
 public:
 	boost::uint64_t get_id() const OVERRIDE;
+	::std::size_t get_serialized_size() const OVERRIDE;
 	void serialize(::Poseidon::StreamBuffer &buffer_) const OVERRIDE;
 	void deserialize(::Poseidon::StreamBuffer &buffer_) OVERRIDE;
 	void dump_debug(::std::ostream &os_) const OVERRIDE;
+
+private:
+	// 如果 list_sizes_ 不为空，按照先序依次记录 FIELD_LIST 中每个元素的长度，供 serialize() 使用。
+	::std::size_t calculate_serialized_size_(::boost::container::vector< ::std::size_t> *list_sizes_) const;
+
+public:
+	class View;
+};
+
+// 不解析整个消息，只在构造时校验一次并记录顶层字段的位置，字段在访问时才解码。
+// FIELD_STRING、FIELD_BLOB、FIELD_FIXED 和 FIELD_FLEXIBLE 以 ByteSpan 的形式返回，指向视图所持有的数据，不复制。
+// FIELD_ARRAY 和 FIELD_LIST 只能取得其编码之后的原始数据，如果需要其中的元素，应当构造完整的消息。
+// 每个字段的原始数据都可以通过 get_raw_<字段名>() 取得，用于原样转发。
+class MESSAGE_NAME::View : NONCOPYABLE {
+private:
+
+#undef FIELD_VINT
+#undef FIELD_VUINT
+#undef FIELD_FIXED
+#undef FIELD_STRING
+#undef FIELD_BLOB
+#undef FIELD_FLEXIBLE
+#undef FIELD_ARRAY
+#undef FIELD_LIST
+
+#define FIELD_VINT(id_)           FIDX_##id_,
+#define FIELD_VUINT(id_)          FIDX_##id_,
+#define FIELD_FIXED(id_, n_)      FIDX_##id_,
+#define FIELD_STRING(id_)         FIDX_##id_,
+#define FIELD_BLOB(id_)           FIDX_##id_,
+#define FIELD_FLEXIBLE(id_)       FIDX_##id_,
+#define FIELD_ARRAY(id_, ...)     FIDX_##id_,
+#define FIELD_LIST(id_, ...)      FIDX_##id_,
+
+	enum {
+		MESSAGE_FIELDS
+		FIELD_COUNT_
+	};
+
+private:
+	::Poseidon::StreamBuffer m_buffer;
+	const unsigned char *m_data;
+	::std::size_t m_size;
+	// 最后一个元素是数据的长度。
+	::std::size_t m_offsets[FIELD_COUNT_ + 1];
+
+public:
+	explicit View(::Poseidon::StreamBuffer buffer_);
+
+private:
+	const unsigned char *get_field_begin_(::std::size_t index_) const {
+		return m_data + m_offsets[index_];
+	}
+	::std::size_t get_field_avail_(::std::size_t index_) const {
+		return m_size - m_offsets[index_];
+	}
+	::Poseidon::Cbpp::ByteSpan get_field_raw_(::std::size_t index_) const {
+		return ::Poseidon::Cbpp::ByteSpan(get_field_begin_(index_), m_offsets[index_ + 1] - m_offsets[index_]);
+	}
+	// 构造时已经校验过了，这里不会失败。
+	::boost::uint64_t get_field_vuint_(::std::size_t index_, const unsigned char *&rptr_) const {
+		::boost::uint64_t val_ = 0;
+		rptr_ = get_field_begin_(index_);
+		::Poseidon::vuint64_from_binary(val_, rptr_, get_field_avail_(index_));
+		return val_;
+	}
+
+public:
+	const ::Poseidon::StreamBuffer &get_buffer() const {
+		return m_buffer;
+	}
+
+#undef FIELD_VINT
+#undef FIELD_VUINT
+#undef FIELD_FIXED
+#undef FIELD_STRING
+#undef FIELD_BLOB
+#undef FIELD_FLEXIBLE
+#undef FIELD_ARRAY
+#undef FIELD_LIST
+
+#define FIELD_VINT(id_)           ::boost::int64_t get_##id_() const {	\
+                                    ::boost::int64_t val_ = 0;	\
+                                    const unsigned char *rptr_ = get_field_begin_(FIDX_##id_);	\
+                                    ::Poseidon::vint64_from_binary(val_, rptr_, get_field_avail_(FIDX_##id_));	\
+                                    return val_;	\
+                                  }	\
+                                  ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+#define FIELD_VUINT(id_)          ::boost::uint64_t get_##id_() const {	\
+                                    const unsigned char *rptr_;	\
+                                    return get_field_vuint_(FIDX_##id_, rptr_);	\
+                                  }	\
+                                  ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+#define FIELD_FIXED(id_, n_)      ::Poseidon::Cbpp::ByteSpan get_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }	\
+                                  ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+#define FIELD_STRING(id_)         ::Poseidon::Cbpp::ByteSpan get_##id_() const {	\
+                                    const unsigned char *rptr_;	\
+                                    const ::std::size_t size_ = static_cast< ::std::size_t>(get_field_vuint_(FIDX_##id_, rptr_));	\
+                                    return ::Poseidon::Cbpp::ByteSpan(rptr_, size_);	\
+                                  }	\
+                                  ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+#define FIELD_BLOB(id_)           FIELD_STRING(id_)
+#define FIELD_FLEXIBLE(id_)       ::Poseidon::Cbpp::ByteSpan get_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }	\
+                                  ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+#define FIELD_ARRAY(id_, ...)     ::boost::uint64_t get_##id_##_size() const {	\
+                                    const unsigned char *rptr_;	\
+                                    return get_field_vuint_(FIDX_##id_, rptr_);	\
+                                  }	\
+                                  ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+#define FIELD_LIST(id_, ...)      ::Poseidon::Cbpp::ByteSpan get_raw_##id_() const {	\
+                                    return get_field_raw_(FIDX_##id_);	\
+                                  }
+
+	MESSAGE_FIELDS
 };
 
 #ifdef CBPP_MESSAGE_EMIT_EXTERNAL_DEFINITIONS
@@ -100,10 +231,209 @@ MESSAGE_NAME::MESSAGE_NAME(::Poseidon::StreamBuffer buffer_)
 
 MESSAGE_NAME::~MESSAGE_NAME(){ }
 
+MESSAGE_NAME::View::View(::Poseidon::StreamBuffer buffer_)
+	: m_buffer(STD_MOVE(buffer_))
+{
+	// 消息通常位于一个数据块中，此时不复制。
+	m_data = static_cast<const unsigned char *>(m_buffer.peek_contiguous(m_buffer.size()));
+	if(!m_data){
+		m_data = static_cast<const unsigned char *>(m_buffer.squash());
+	}
+	m_size = m_buffer.size();
+
+	// 只记录顶层字段的位置，嵌套的字段中 record_ 为空指针。
+	::std::size_t *record_ = m_offsets;
+	const unsigned char *rptr_ = m_data;
+	const unsigned char *const rend_ = m_data + m_size;
+
+#undef FIELD_VINT
+#undef FIELD_VUINT
+#undef FIELD_FIXED
+#undef FIELD_STRING
+#undef FIELD_BLOB
+#undef FIELD_FLEXIBLE
+#undef FIELD_ARRAY
+#undef FIELD_LIST
+
+#define FIELD_VINT(id_)           {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    ::boost::int64_t val_;	\
+                                    if(!::Poseidon::vint64_from_binary(val_, rptr_, static_cast< ::std::size_t>(rend_ - rptr_))){	\
+                                      THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                    }	\
+                                  }
+#define FIELD_VUINT(id_)          {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    ::boost::uint64_t val_;	\
+                                    if(!::Poseidon::vuint64_from_binary(val_, rptr_, static_cast< ::std::size_t>(rend_ - rptr_))){	\
+                                      THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                    }	\
+                                  }
+#define FIELD_FIXED(id_, n_)      {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    if(static_cast< ::std::size_t>(rend_ - rptr_) < n_){	\
+                                      THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                    }	\
+                                    rptr_ += n_;	\
+                                  }
+#define FIELD_STRING(id_)         {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    ::boost::uint64_t nreq_;	\
+                                    if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, static_cast< ::std::size_t>(rend_ - rptr_))){	\
+                                      THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                    }	\
+                                    if(nreq_ > static_cast< ::std::size_t>(rend_ - rptr_)){	\
+                                      THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                    }	\
+                                    rptr_ += nreq_;	\
+                                  }
+#define FIELD_BLOB(id_)           FIELD_STRING(id_)
+#define FIELD_FLEXIBLE(id_)       {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    rptr_ = rend_;	\
+                                  }
+#define FIELD_ARRAY(id_, ...)     {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    ::boost::uint64_t nreq_;	\
+                                    if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, static_cast< ::std::size_t>(rend_ - rptr_))){	\
+                                      THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                    }	\
+                                    ::std::size_t *record_ = NULLPTR;	\
+                                    for(::boost::uint64_t ncur_ = 0; ncur_ < nreq_; ++ncur_){	\
+                                      const unsigned char *const elem_begin_ = rptr_;	\
+                                      __VA_ARGS__	\
+                                      if(rptr_ == elem_begin_){	\
+                                        /* 元素不占用任何字节，其余的元素也一样。 */	\
+                                        break;	\
+                                      }	\
+                                    }	\
+                                    (void)record_;	\
+                                  }
+#define FIELD_LIST(id_, ...)      {	\
+                                    if(record_){	\
+                                      *(record_++) = static_cast< ::std::size_t>(rptr_ - m_data);	\
+                                    }	\
+                                    ::std::size_t *record_ = NULLPTR;	\
+                                    for(;;){	\
+                                      ::boost::uint64_t nreq_;	\
+                                      if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, static_cast< ::std::size_t>(rend_ - rptr_))){	\
+                                        THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                      }	\
+                                      if(nreq_ == 0){	\
+                                        break;	\
+                                      }	\
+                                      if(nreq_ > static_cast< ::std::size_t>(rend_ - rptr_)){	\
+                                        THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
+                                      }	\
+                                      const unsigned char *const elem_end_ = rptr_ + nreq_;	\
+                                      {	\
+                                        const unsigned char *const rend_ = elem_end_;	\
+                                        __VA_ARGS__	\
+                                      }	\
+                                      rptr_ = elem_end_;	\
+                                    }	\
+                                    (void)record_;	\
+                                  }
+
+	MESSAGE_FIELDS
+	if(rptr_ != rend_){
+		THROW_JUNK_AFTER_PACKET_(MESSAGE_NAME);
+	}
+	*record_ = m_size;
+}
+
 boost::uint64_t MESSAGE_NAME::get_id() const {
 	return ID;
 }
+::std::size_t MESSAGE_NAME::get_serialized_size() const {
+	return calculate_serialized_size_(NULLPTR);
+}
+::std::size_t MESSAGE_NAME::calculate_serialized_size_(::boost::container::vector< ::std::size_t> *list_sizes_) const {
+	const AUTO(cur_, this);
+	::std::size_t size_ = 0;
+
+#undef FIELD_VINT
+#undef FIELD_VUINT
+#undef FIELD_FIXED
+#undef FIELD_STRING
+#undef FIELD_BLOB
+#undef FIELD_FLEXIBLE
+#undef FIELD_ARRAY
+#undef FIELD_LIST
+
+#define FIELD_VINT(id_)           {	\
+                                    size_ += ::Poseidon::get_vint64_size(cur_->id_);	\
+                                  }
+#define FIELD_VUINT(id_)          {	\
+                                    size_ += ::Poseidon::get_vuint64_size(cur_->id_);	\
+                                  }
+#define FIELD_FIXED(id_, n_)      {	\
+                                    size_ += cur_->id_.size();	\
+                                  }
+#define FIELD_STRING(id_)         {	\
+                                    size_ += ::Poseidon::get_vuint64_size(cur_->id_.size()) + cur_->id_.size();	\
+                                  }
+#define FIELD_BLOB(id_)           {	\
+                                    size_ += ::Poseidon::get_vuint64_size(cur_->id_.size()) + cur_->id_.size();	\
+                                  }
+#define FIELD_FLEXIBLE(id_)       {	\
+                                    size_ += cur_->id_.size();	\
+                                  }
+#define FIELD_ARRAY(id_, ...)     {	\
+                                    size_ += ::Poseidon::get_vuint64_size(cur_->id_.size());	\
+                                    for(AUTO(it_, cur_->id_.begin()); it_ != cur_->id_.end(); ++it_){	\
+                                      const AUTO(cur_, &*it_);	\
+                                      __VA_ARGS__	\
+                                    }	\
+                                  }
+#define FIELD_LIST(id_, ...)      {	\
+                                    for(AUTO(it_, cur_->id_.begin()); it_ != cur_->id_.end(); ++it_){	\
+                                      ::std::size_t index_ = 0;	\
+                                      if(list_sizes_){	\
+                                        index_ = list_sizes_->size();	\
+                                        list_sizes_->push_back(0);	\
+                                      }	\
+                                      ::std::size_t chunk_size_ = 0;	\
+                                      {	\
+                                        const AUTO(cur_, &*it_);	\
+                                        AUTO_REF(size_, chunk_size_);	\
+                                        __VA_ARGS__	\
+                                      }	\
+                                      if(list_sizes_){	\
+                                        list_sizes_->at(index_) = chunk_size_;	\
+                                      }	\
+                                      size_ += ::Poseidon::get_vuint64_size(chunk_size_) + chunk_size_;	\
+                                    }	\
+                                    size_ += 1;	\
+                                  }
+
+	MESSAGE_FIELDS
+	(void)list_sizes_;
+	return size_;
+}
 void MESSAGE_NAME::serialize(::Poseidon::StreamBuffer &buffer_) const {
+	// 先计算长度，然后一次性预留空间并直接写入。只有 FIELD_FLEXIBLE 是整块追加的，这样较大的数据块可以共享而不必复制。
+	::boost::container::vector< ::std::size_t> list_sizes_;
+	::std::size_t size_remaining_ = calculate_serialized_size_(&list_sizes_);
+	::std::size_t list_index_ = 0;
+	unsigned char *wbegin_ = NULLPTR;
+	if(size_remaining_ != 0){
+		wbegin_ = static_cast<unsigned char *>(buffer_.reserve_tail(size_remaining_));
+	}
+	unsigned char *wptr_ = wbegin_;
+
 	const AUTO(cur_, this);
 	AUTO_REF(buf_, buffer_);
 
@@ -117,42 +447,38 @@ void MESSAGE_NAME::serialize(::Poseidon::StreamBuffer &buffer_) const {
 #undef FIELD_LIST
 
 #define FIELD_VINT(id_)           {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *wptr_ = temp_;	\
                                     ::Poseidon::vint64_to_binary(cur_->id_, wptr_);	\
-                                    buf_.put(temp_, static_cast< ::std::size_t>(wptr_ - temp_));	\
                                   }
 #define FIELD_VUINT(id_)          {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *wptr_ = temp_;	\
                                     ::Poseidon::vuint64_to_binary(cur_->id_, wptr_);	\
-                                    buf_.put(temp_, static_cast< ::std::size_t>(wptr_ - temp_));	\
                                   }
 #define FIELD_FIXED(id_, n_)      {	\
-                                    buf_.put(cur_->id_.data(), cur_->id_.size());	\
+                                    ::std::memcpy(wptr_, cur_->id_.data(), cur_->id_.size());	\
+                                    wptr_ += cur_->id_.size();	\
                                   }
 #define FIELD_STRING(id_)         {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *wptr_ = temp_;	\
                                     ::Poseidon::vuint64_to_binary(cur_->id_.size(), wptr_);	\
-                                    buf_.put(temp_, static_cast< ::std::size_t>(wptr_ - temp_));	\
-                                    buf_.put(cur_->id_);	\
+                                    ::std::memcpy(wptr_, cur_->id_.data(), cur_->id_.size());	\
+                                    wptr_ += cur_->id_.size();	\
                                   }
 #define FIELD_BLOB(id_)           {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *wptr_ = temp_;	\
                                     ::Poseidon::vuint64_to_binary(cur_->id_.size(), wptr_);	\
-                                    buf_.put(temp_, static_cast< ::std::size_t>(wptr_ - temp_));	\
-                                    buf_.put(cur_->id_);	\
+                                    ::std::memcpy(wptr_, cur_->id_.data(), cur_->id_.size());	\
+                                    wptr_ += cur_->id_.size();	\
                                   }
 #define FIELD_FLEXIBLE(id_)       {	\
+                                    const AUTO(written_, static_cast< ::std::size_t>(wptr_ - wbegin_));	\
+                                    buf_.commit_tail(written_);	\
                                     buf_.put(cur_->id_);	\
+                                    size_remaining_ -= written_ + cur_->id_.size();	\
+                                    wbegin_ = NULLPTR;	\
+                                    if(size_remaining_ != 0){	\
+                                      wbegin_ = static_cast<unsigned char *>(buf_.reserve_tail(size_remaining_));	\
+                                    }	\
+                                    wptr_ = wbegin_;	\
                                   }
 #define FIELD_ARRAY(id_, ...)     {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *wptr_ = temp_;	\
                                     ::Poseidon::vuint64_to_binary(cur_->id_.size(), wptr_);	\
-                                    buf_.put(temp_, static_cast< ::std::size_t>(wptr_ - temp_));	\
                                     for(AUTO(it_, cur_->id_.begin()); it_ != cur_->id_.end(); ++it_){	\
                                       const AUTO(cur_, &*it_);	\
                                       __VA_ARGS__	\
@@ -160,22 +486,18 @@ void MESSAGE_NAME::serialize(::Poseidon::StreamBuffer &buffer_) const {
                                   }
 #define FIELD_LIST(id_, ...)      {	\
                                     for(AUTO(it_, cur_->id_.begin()); it_ != cur_->id_.end(); ++it_){	\
-                                      ::Poseidon::StreamBuffer chunk_buf_;	\
+                                      ::Poseidon::vuint64_to_binary(list_sizes_.at(list_index_++), wptr_);	\
                                       {	\
                                         const AUTO(cur_, &*it_);	\
-                                        AUTO_REF(buf_, chunk_buf_);	\
                                         __VA_ARGS__	\
                                       }	\
-                                      unsigned char temp_[16];	\
-                                      unsigned char *wptr_ = temp_;	\
-                                      ::Poseidon::vuint64_to_binary(chunk_buf_.size(), wptr_);	\
-                                      buf_.put(temp_, static_cast< ::std::size_t>(wptr_ - temp_));	\
-                                      buf_.splice(chunk_buf_);	\
                                     }	\
-                                    buf_.put(0);	\
+                                    *(wptr_++) = 0;	\
                                   }
 
 	MESSAGE_FIELDS
+	buf_.commit_tail(static_cast< ::std::size_t>(wptr_ - wbegin_));
+	(void)list_index_;
 }
 void MESSAGE_NAME::deserialize(::Poseidon::StreamBuffer &buffer_){
 	const AUTO(cur_, this);
@@ -191,22 +513,14 @@ void MESSAGE_NAME::deserialize(::Poseidon::StreamBuffer &buffer_){
 #undef FIELD_LIST
 
 #define FIELD_VINT(id_)           {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *rptr_ = temp_;	\
-                                    const ::std::size_t nmax_ = buf_.peek(temp_, sizeof(temp_));	\
-                                    if(!::Poseidon::vint64_from_binary(cur_->id_, rptr_, nmax_)){	\
+                                    if(!shift_vint64(cur_->id_, buf_)){	\
                                       THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
                                     }	\
-                                    buf_.discard(static_cast< ::std::size_t>(rptr_ - temp_));	\
                                   }
 #define FIELD_VUINT(id_)          {	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *rptr_ = temp_;	\
-                                    const ::std::size_t nmax_ = buf_.peek(temp_, sizeof(temp_));	\
-                                    if(!::Poseidon::vuint64_from_binary(cur_->id_, rptr_, nmax_)){	\
+                                    if(!shift_vuint64(cur_->id_, buf_)){	\
                                       THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
                                     }	\
-                                    buf_.discard(static_cast< ::std::size_t>(rptr_ - temp_));	\
                                   }
 #define FIELD_FIXED(id_, n_)      {	\
                                     ::boost::uint64_t nreq_ = cur_->id_.size();	\
@@ -217,13 +531,9 @@ void MESSAGE_NAME::deserialize(::Poseidon::StreamBuffer &buffer_){
                                   }
 #define FIELD_STRING(id_)         {	\
                                     ::boost::uint64_t nreq_;	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *rptr_ = temp_;	\
-                                    const ::std::size_t nmax_ = buf_.peek(temp_, sizeof(temp_));	\
-                                    if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, nmax_)){	\
+                                    if(!shift_vuint64(nreq_, buf_)){	\
                                       THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
                                     }	\
-                                    buf_.discard(static_cast< ::std::size_t>(rptr_ - temp_));	\
                                     if(nreq_ > SIZE_MAX){	\
                                       THROW_LENGTH_ERROR_(MESSAGE_NAME, id_);	\
                                     }	\
@@ -235,13 +545,9 @@ void MESSAGE_NAME::deserialize(::Poseidon::StreamBuffer &buffer_){
                                   }
 #define FIELD_BLOB(id_)           {	\
                                     ::boost::uint64_t nreq_;	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *rptr_ = temp_;	\
-                                    const ::std::size_t nmax_ = buf_.peek(temp_, sizeof(temp_));	\
-                                    if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, nmax_)){	\
+                                    if(!shift_vuint64(nreq_, buf_)){	\
                                       THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
                                     }	\
-                                    buf_.discard(static_cast< ::std::size_t>(rptr_ - temp_));	\
                                     if(nreq_ > SIZE_MAX){	\
                                       THROW_LENGTH_ERROR_(MESSAGE_NAME, id_);	\
                                     }	\
@@ -258,13 +564,9 @@ void MESSAGE_NAME::deserialize(::Poseidon::StreamBuffer &buffer_){
 #define FIELD_ARRAY(id_, ...)     {	\
                                     cur_->id_.clear();	\
                                     ::boost::uint64_t nreq_;	\
-                                    unsigned char temp_[16];	\
-                                    unsigned char *rptr_ = temp_;	\
-                                    const ::std::size_t nmax_ = buf_.peek(temp_, sizeof(temp_));	\
-                                    if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, nmax_)){	\
+                                    if(!shift_vuint64(nreq_, buf_)){	\
                                       THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
                                     }	\
-                                    buf_.discard(static_cast< ::std::size_t>(rptr_ - temp_));	\
                                     if(nreq_ > SIZE_MAX){	\
                                       THROW_LENGTH_ERROR_(MESSAGE_NAME, id_);	\
                                     }	\
@@ -279,13 +581,9 @@ void MESSAGE_NAME::deserialize(::Poseidon::StreamBuffer &buffer_){
                                     cur_->id_.clear();	\
                                     for(;;){	\
                                       ::boost::uint64_t nreq_;	\
-                                      unsigned char temp_[16];	\
-                                      unsigned char *rptr_ = temp_;	\
-                                      const ::std::size_t nmax_ = buf_.peek(temp_, sizeof(temp_));	\
-                                      if(!::Poseidon::vuint64_from_binary(nreq_, rptr_, nmax_)){	\
+                                      if(!shift_vuint64(nreq_, buf_)){	\
                                         THROW_END_OF_STREAM_(MESSAGE_NAME, id_);	\
                                       }	\
-                                      buf_.discard(static_cast< ::std::size_t>(rptr_ - temp_));	\
                                       if(nreq_ == 0){	\
                                         break;	\
                                       }	\
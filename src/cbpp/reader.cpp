@@ -5,15 +5,18 @@
 #include "reader.hpp"
 #include "status_codes.hpp"
 #include "exception.hpp"
+#include "compression.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../endian.hpp"
+#include "../zstd.hpp"
 
 namespace Poseidon {
 namespace Cbpp {
 
 Reader::Reader()
 	: m_size_expecting(2), m_state(S_PAYLOAD_SIZE)
+	, m_decompression_enabled(false), m_compressed(false)
 { }
 Reader::~Reader(){
 	if(m_state != S_PAYLOAD_SIZE){
@@ -40,12 +43,51 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 			// m_payload_size = 0;
 			m_message_id = 0;
 			m_payload_offset = 0;
+			m_compressed = false;
+
+			{
+				// 如果整个头部都已经收到，就一次解析完毕，避免逐个状态地读取。
+				StreamBuffer::ReadCursor cursor(m_queue);
+				bool complete = cursor.get_be(temp16);
+				temp64 = temp16;
+				if(complete && (temp16 == 0xFFFE) && m_decompression_enabled){
+					// 压缩的消息逐个状态地读取。
+					complete = false;
+				}
+				if(complete && (temp16 == 0xFFFF)){
+					complete = cursor.get_be(temp64);
+				}
+				if(complete && cursor.get_be(temp16)){
+					m_queue.discard(cursor.get_offset());
+					m_payload_size = temp64;
+					m_message_id = temp16;
+
+					if((m_message_id != 0) && (m_queue.size() >= m_payload_size)){
+						// 整个数据消息都已经收到，不经过中间状态，载荷通过一次回调交出。cut_off() 共享原有的数据块，不复制。
+						on_data_message_header(m_message_id, m_payload_size);
+						on_data_message_payload(0, m_queue.cut_off(m_payload_size));
+						m_payload_offset = m_payload_size;
+						has_next_request = on_data_message_end(m_payload_offset);
+
+						m_size_expecting = 2;
+						// m_state = S_PAYLOAD_SIZE;
+						break;
+					}
+
+					m_size_expecting = 0;
+					m_state = S_HEADER_END;
+					break;
+				}
+			}
 
 			m_queue.get(&temp16, 2);
 			m_payload_size = load_be(temp16);
 			if(m_payload_size == 0xFFFF){
 				m_size_expecting = 8;
 				m_state = S_EX_PAYLOAD_SIZE;
+			} else if((m_payload_size == 0xFFFE) && m_decompression_enabled){
+				m_size_expecting = 16;
+				m_state = S_COMPRESSED_SIZE;
 			} else {
 				m_size_expecting = 2;
 				m_state = S_MESSAGE_ID;
@@ -60,11 +102,36 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 			m_state = S_MESSAGE_ID;
 			break;
 
+		case S_COMPRESSED_SIZE:
+			m_queue.get(&temp64, 8);
+			m_payload_size = load_be(temp64);
+			m_queue.get(&temp64, 8);
+			m_original_size = load_be(temp64);
+			m_original_offset = 0;
+			m_compressed = true;
+
+			m_size_expecting = 2;
+			m_state = S_MESSAGE_ID;
+			break;
+
 		case S_MESSAGE_ID:
 			m_queue.get(&temp16, 2);
 			m_message_id = load_be(temp16);
 
-			if(m_message_id != 0){
+			m_size_expecting = 0;
+			m_state = S_HEADER_END;
+			break;
+
+		case S_HEADER_END:
+			if(m_compressed){
+				DEBUG_THROW_UNLESS(m_message_id != 0, Exception, ST_BAD_REQUEST, sslit("Control messages must not be compressed"));
+				on_data_message_header(m_message_id, m_original_size);
+				m_decompressor = acquire_message_decompressor();
+				m_decompressor->set_output_limit(m_original_size);
+
+				m_size_expecting = std::min<boost::uint64_t>(m_payload_size, 4096);
+				m_state = S_COMPRESSED_DATA;
+			} else if(m_message_id != 0){
 				on_data_message_header(m_message_id, m_payload_size);
 
 				m_size_expecting = std::min<boost::uint64_t>(m_payload_size, 4096);
@@ -91,6 +158,45 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 			}
 			break;
 
+		case S_COMPRESSED_DATA:
+			temp64 = std::min<boost::uint64_t>(m_queue.size(), m_payload_size - m_payload_offset);
+			// 解压出来的数据不能超过声明的原始长度，上层在 on_data_message_header() 中检查原始长度，以防止压缩炸弹。
+			try {
+				m_decompressor->put(m_queue.cut_off(temp64));
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("Failed to decompress CBPP message: ", e.what());
+				DEBUG_THROW(Exception, ST_DATA_CORRUPTED, sslit("Failed to decompress message"));
+			}
+			m_payload_offset += temp64;
+
+			if(!m_decompressor->get_buffer().empty()){
+				StreamBuffer original;
+				original.swap(m_decompressor->get_buffer());
+				temp64 = m_original_offset;
+				m_original_offset += original.size();
+				on_data_message_payload(temp64, STD_MOVE(original));
+			}
+
+			if(m_payload_offset < m_payload_size){
+				m_size_expecting = std::min<boost::uint64_t>(m_payload_size - m_payload_offset, 4096);
+				// m_state = S_COMPRESSED_DATA;
+			} else {
+				try {
+					m_decompressor->finalize();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("Failed to decompress CBPP message: ", e.what());
+					DEBUG_THROW(Exception, ST_DATA_CORRUPTED, sslit("Compressed message is truncated"));
+				}
+				DEBUG_THROW_UNLESS(m_original_offset == m_original_size, Exception, ST_DATA_CORRUPTED, sslit("Decompressed data is shorter than the original size"));
+				release_message_decompressor(STD_MOVE(m_decompressor));
+				m_decompressor.reset();
+				has_next_request = on_data_message_end(m_original_size);
+
+				m_size_expecting = 2;
+				m_state = S_PAYLOAD_SIZE;
+			}
+			break;
+
 		case S_CONTROL_PAYLOAD:
 			{
 				StreamBuffer payload = m_queue.cut_off(m_payload_size);
@@ -109,5 +215,9 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 	return has_next_request;
 }
 
+void Reader::enable_decompression(){
+	m_decompression_enabled = true;
+}
+
 }
 }
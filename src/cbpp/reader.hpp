@@ -6,7 +6,9 @@
 
 #include <string>
 #include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
 #include "../stream_buffer.hpp"
+#include "../fwd.hpp"
 #include "status_codes.hpp"
 
 namespace Poseidon {
@@ -18,8 +20,11 @@ private:
 		S_PAYLOAD_SIZE      = 0,
 		S_EX_PAYLOAD_SIZE   = 1,
 		S_MESSAGE_ID        = 2,
-		S_DATA_PAYLOAD      = 3,
-		S_CONTROL_PAYLOAD   = 4,
+		S_HEADER_END        = 3,
+		S_DATA_PAYLOAD      = 4,
+		S_CONTROL_PAYLOAD   = 5,
+		S_COMPRESSED_SIZE   = 6,
+		S_COMPRESSED_DATA   = 7,
 	};
 
 private:
@@ -32,6 +37,12 @@ private:
 	boost::uint16_t m_message_id;
 	boost::uint64_t m_payload_offset;
 
+	bool m_decompression_enabled;
+	bool m_compressed;
+	boost::uint64_t m_original_size;
+	boost::uint64_t m_original_offset;
+	boost::shared_ptr<ZstdDecompressor> m_decompressor;
+
 public:
 	Reader();
 	virtual ~Reader();
@@ -57,6 +68,13 @@ public:
 	}
 
 	bool put_encoded_data(StreamBuffer encoded);
+
+	// 此后长度为 0xFFFE 的消息被视为压缩的消息，参见 compression.hpp。必须在向对方声明之前调用。
+	// 回调收到的总是解压之后的数据，payload_size 是原始长度。
+	void enable_decompression();
+	bool is_decompression_enabled() const {
+		return m_decompression_enabled;
+	}
 };
 
 }
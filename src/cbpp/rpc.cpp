@@ -0,0 +1,75 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "rpc.hpp"
+#include "exception.hpp"
+#include "../profiler.hpp"
+#include "../vint64.hpp"
+
+namespace Poseidon {
+namespace Cbpp {
+
+namespace {
+	void put_vuint64(StreamBuffer &buffer, boost::uint64_t val){
+		unsigned char temp[9];
+		unsigned char *write = temp;
+		vuint64_to_binary(val, write);
+		buffer.put(temp, static_cast<std::size_t>(write - temp));
+	}
+	void put_vint64(StreamBuffer &buffer, boost::int64_t val){
+		unsigned char temp[9];
+		unsigned char *write = temp;
+		vint64_to_binary(val, write);
+		buffer.put(temp, static_cast<std::size_t>(write - temp));
+	}
+}
+
+StreamBuffer encode_rpc_request(boost::uint64_t serial, boost::uint16_t message_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	StreamBuffer buffer;
+	put_vuint64(buffer, serial);
+	put_vuint64(buffer, message_id);
+	buffer.splice(payload);
+	return buffer;
+}
+void decode_rpc_request(boost::uint64_t &serial, boost::uint16_t &message_id, StreamBuffer &payload){
+	PROFILE_ME;
+
+	StreamBuffer::ReadCursor cursor(payload);
+	boost::uint64_t temp64;
+	DEBUG_THROW_UNLESS(cursor.get_vuint64(serial), Exception, ST_END_OF_STREAM, sslit("rpc_request.serial"));
+	DEBUG_THROW_UNLESS(cursor.get_vuint64(temp64), Exception, ST_END_OF_STREAM, sslit("rpc_request.message_id"));
+	DEBUG_THROW_UNLESS(temp64 <= 0xFFFF, Exception, ST_BAD_REQUEST, sslit("rpc_request.message_id"));
+	message_id = static_cast<boost::uint16_t>(temp64);
+	payload.discard(cursor.get_offset());
+}
+
+StreamBuffer encode_rpc_response(boost::uint64_t serial, StatusCode status_code, boost::uint16_t message_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	StreamBuffer buffer;
+	put_vuint64(buffer, serial);
+	put_vint64(buffer, status_code);
+	put_vuint64(buffer, message_id);
+	buffer.splice(payload);
+	return buffer;
+}
+void decode_rpc_response(boost::uint64_t &serial, StatusCode &status_code, boost::uint16_t &message_id, StreamBuffer &payload){
+	PROFILE_ME;
+
+	StreamBuffer::ReadCursor cursor(payload);
+	boost::int64_t temp64s;
+	boost::uint64_t temp64;
+	DEBUG_THROW_UNLESS(cursor.get_vuint64(serial), Exception, ST_END_OF_STREAM, sslit("rpc_response.serial"));
+	DEBUG_THROW_UNLESS(cursor.get_vint64(temp64s), Exception, ST_END_OF_STREAM, sslit("rpc_response.status_code"));
+	DEBUG_THROW_UNLESS(cursor.get_vuint64(temp64), Exception, ST_END_OF_STREAM, sslit("rpc_response.message_id"));
+	DEBUG_THROW_UNLESS(temp64 <= 0xFFFF, Exception, ST_BAD_REQUEST, sslit("rpc_response.message_id"));
+	status_code = static_cast<StatusCode>(temp64s);
+	message_id = static_cast<boost::uint16_t>(temp64);
+	payload.discard(cursor.get_offset());
+}
+
+}
+}
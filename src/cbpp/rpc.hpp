@@ -0,0 +1,38 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_CBPP_RPC_HPP_
+#define POSEIDON_CBPP_RPC_HPP_
+
+#include "../stream_buffer.hpp"
+#include "status_codes.hpp"
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+namespace Cbpp {
+
+// 服务之间的 RPC 使用两个保留的消息 ID 传输，应用程序不得使用这两个 ID。
+// 请求的载荷依次是 vuint64 的序号、vuint64 的消息 ID 和被调用的消息的载荷；
+// 响应的载荷依次是 vuint64 的序号、vint64 的状态码、vuint64 的消息 ID 和响应的载荷，状态码不为 ST_OK 时载荷是错误描述。
+// 序号由调用方分配，在同一个连接上不重复，响应可以按照任意顺序返回，因此一个连接上可以同时有多个请求。
+enum {
+	RPC_REQUEST_ID  = 0xFFFE,
+	RPC_RESPONSE_ID = 0xFFFF,
+};
+
+struct RpcResponse {
+	boost::uint16_t message_id;
+	StreamBuffer payload;
+};
+
+extern StreamBuffer encode_rpc_request(boost::uint64_t serial, boost::uint16_t message_id, StreamBuffer payload);
+// 数据不完整时抛出 ST_END_OF_STREAM。解码之后 payload 中只剩下被调用的消息的载荷。
+extern void decode_rpc_request(boost::uint64_t &serial, boost::uint16_t &message_id, StreamBuffer &payload);
+
+extern StreamBuffer encode_rpc_response(boost::uint64_t serial, StatusCode status_code, boost::uint16_t message_id, StreamBuffer payload);
+extern void decode_rpc_response(boost::uint64_t &serial, StatusCode &status_code, boost::uint16_t &message_id, StreamBuffer &payload);
+
+}
+}
+
+#endif
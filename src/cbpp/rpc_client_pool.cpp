@@ -0,0 +1,505 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "rpc_client_pool.hpp"
+#include "low_level_client.hpp"
+#include "message_base.hpp"
+#include "exception.hpp"
+#include "../singletons/main_config.hpp"
+#include "../singletons/epoll_daemon.hpp"
+#include "../singletons/workhorse_camp.hpp"
+#include "../singletons/timer_daemon.hpp"
+#include "../atomic.hpp"
+#include "../checked_arithmetic.hpp"
+#include "../time.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+
+namespace Poseidon {
+
+template class PromiseContainer<Cbpp::RpcResponse>;
+
+namespace Cbpp {
+
+namespace {
+	std::string make_origin_key(const std::string &host, boost::uint16_t port, bool use_ssl){
+		std::string key;
+		key.reserve(host.size() + 16);
+		key += host;
+		key += ':';
+		key += boost::lexical_cast<std::string>(port);
+		if(use_ssl){
+			key += "/ssl";
+		}
+		return key;
+	}
+
+	STD_EXCEPTION_PTR make_rpc_exception(StatusCode status_code, const char *what){
+		return STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, status_code, SharedNts(what)));
+	}
+}
+
+struct RpcClientPool::Request {
+	boost::uint64_t serial;
+	boost::uint16_t message_id;
+	StreamBuffer payload;
+	boost::shared_ptr<PromiseContainer<RpcResponse> > promise;
+	boost::uint64_t deadline;
+};
+
+class RpcClientPool::PooledClient : public LowLevelClient {
+	friend RpcClientPool;
+
+private:
+	const boost::weak_ptr<RpcClientPool> m_weak_pool;
+
+	// 以下成员由 RpcClientPool::m_mutex 保护。
+	std::string m_key;
+	boost::container::map<boost::uint64_t, boost::shared_ptr<Request> > m_in_flight; // 已经发出，正在等待响应的请求，按照序号排列。
+
+	// 以下成员只在 epoll 线程中访问。
+	boost::uint16_t m_message_id;
+	StreamBuffer m_payload;
+
+public:
+	PooledClient(const SockAddr &addr, bool use_ssl, bool verify_peer, const boost::weak_ptr<RpcClientPool> &weak_pool)
+		: LowLevelClient(addr, use_ssl, verify_peer)
+		, m_weak_pool(weak_pool), m_message_id(0)
+	{ }
+
+protected:
+	// TcpClientBase
+	void on_read_hup() OVERRIDE {
+		PROFILE_ME;
+
+		LowLevelClient::on_read_hup();
+
+		shutdown_write();
+	}
+	void on_close(int err_code) OVERRIDE {
+		PROFILE_ME;
+
+		LowLevelClient::on_close(err_code);
+
+		const AUTO(pool, m_weak_pool.lock());
+		if(pool){
+			pool->on_client_close(virtual_shared_from_this<PooledClient>(), err_code);
+		}
+	}
+
+	// LowLevelClient
+	void on_low_level_data_message_header(boost::uint16_t message_id, boost::uint64_t payload_size) OVERRIDE {
+		PROFILE_ME;
+
+		(void)payload_size;
+
+		m_message_id = message_id;
+		m_payload.clear();
+	}
+	void on_low_level_data_message_payload(boost::uint64_t payload_offset, StreamBuffer payload) OVERRIDE {
+		PROFILE_ME;
+
+		(void)payload_offset;
+
+		m_payload.splice(payload);
+	}
+	bool on_low_level_data_message_end(boost::uint64_t payload_size) OVERRIDE {
+		PROFILE_ME;
+
+		(void)payload_size;
+
+		if(m_message_id != RPC_RESPONSE_ID){
+			LOG_POSEIDON_WARNING("Unexpected CBPP message from RPC server: remote = ", get_remote_info(), ", message_id = ", m_message_id);
+			m_payload.clear();
+			return true;
+		}
+		const AUTO(pool, m_weak_pool.lock());
+		if(!pool){
+			force_shutdown();
+			return false;
+		}
+		pool->on_client_response(virtual_shared_from_this<PooledClient>(), STD_MOVE(m_payload));
+		m_payload.clear();
+		return true;
+	}
+
+	bool on_low_level_control_message(StatusCode status_code, StreamBuffer param) OVERRIDE {
+		PROFILE_ME;
+
+		if(status_code < 0){
+			LOG_POSEIDON_WARNING("Received negative status code from ", get_remote_info(), ": status_code = ", status_code);
+			shutdown(ST_SHUTDOWN, static_cast<char *>(param.squash()));
+			return false;
+		}
+		switch(status_code){
+		case ST_SHUTDOWN:
+			LOG_POSEIDON_INFO("Received SHUTDOWN frame from ", get_remote_info());
+			shutdown(ST_SHUTDOWN, static_cast<char *>(param.squash()));
+			return false;
+		case ST_PING:
+			send_control(ST_PONG, STD_MOVE(param));
+			return true;
+		case ST_PONG:
+			return true;
+		default:
+			DEBUG_THROW(Exception, ST_UNKNOWN_CONTROL_CODE, sslit("Unknown control code"));
+		}
+	}
+};
+
+void RpcClientPool::connect_proc(const boost::weak_ptr<RpcClientPool> &weak_pool, const std::string &key, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	const AUTO(pool, weak_pool.lock());
+	if(!pool){
+		request->promise->set_exception(make_rpc_exception(ST_GONE_AWAY, "CBPP RPC client pool has been destroyed"), false);
+		return;
+	}
+
+	Mutex::UniqueLock lock(pool->m_mutex);
+	AUTO_REF(origin, pool->m_origins[key]);
+	const std::string host = origin.host;
+	const boost::uint16_t port = origin.port;
+	const bool use_ssl = origin.use_ssl;
+	lock.unlock();
+
+	boost::shared_ptr<PooledClient> client;
+	try {
+		client = boost::dynamic_pointer_cast<PooledClient>(pool->m_tcp_pool.acquire(host, port, use_ssl));
+		DEBUG_THROW_ASSERT(client);
+	} catch(...){
+		LOG_POSEIDON_WARNING("Failed to acquire CBPP RPC client: key = ", key);
+		boost::container::vector<boost::shared_ptr<Request> > requests_to_fail;
+		lock.lock();
+		AUTO_REF(failed_origin, pool->m_origins[key]);
+		--failed_origin.connecting;
+		// 连接数达到了上限时，把请求追加到已有的连接上。
+		if(!pool->unlocked_dispatch(failed_origin, request, true)){
+			requests_to_fail.push_back(request);
+		}
+		if(failed_origin.connecting == 0){
+			while(!failed_origin.pending.empty()){
+				if(!pool->unlocked_dispatch(failed_origin, failed_origin.pending.front(), true)){
+					requests_to_fail.push_back(failed_origin.pending.front());
+				}
+				failed_origin.pending.pop_front();
+			}
+		}
+		lock.unlock();
+		for(AUTO(it, requests_to_fail.begin()); it != requests_to_fail.end(); ++it){
+			(*it)->promise->set_exception(STD_CURRENT_EXCEPTION(), false);
+		}
+		return;
+	}
+
+	boost::shared_ptr<Request> next_request;
+	lock.lock();
+	AUTO_REF(new_origin, pool->m_origins[key]);
+	--new_origin.connecting;
+	client->m_key = key;
+	new_origin.active.push_back(client);
+	pool->unlocked_send(client, request);
+	while(!new_origin.pending.empty() && pool->unlocked_dispatch(new_origin, new_origin.pending.front(), false)){
+		new_origin.pending.pop_front();
+	}
+	if(!new_origin.pending.empty() && (new_origin.connecting == 0)){
+		// 新的连接也满了，为剩下的请求再建立一个。
+		next_request = new_origin.pending.front();
+		new_origin.pending.pop_front();
+		++new_origin.connecting;
+	}
+	lock.unlock();
+
+	if(next_request){
+		pool->start_connecting(key, next_request);
+	}
+}
+void RpcClientPool::timer_proc(const boost::weak_ptr<RpcClientPool> &weak_pool, boost::uint64_t now){
+	PROFILE_ME;
+
+	const AUTO(pool, weak_pool.lock());
+	if(!pool){
+		return;
+	}
+
+	boost::container::vector<boost::shared_ptr<Request> > requests_to_fail;
+	{
+		const Mutex::UniqueLock lock(pool->m_mutex);
+		for(AUTO(it, pool->m_origins.begin()); it != pool->m_origins.end(); ++it){
+			AUTO_REF(origin, it->second);
+			for(AUTO(cit, origin.active.begin()); cit != origin.active.end(); ++cit){
+				AUTO_REF(in_flight, (*cit)->m_in_flight);
+				AUTO(rit, in_flight.begin());
+				while(rit != in_flight.end()){
+					if(now < rit->second->deadline){
+						++rit;
+						continue;
+					}
+					// 之后收到的响应会因为找不到序号而被忽略。
+					requests_to_fail.push_back(rit->second);
+					rit = in_flight.erase(rit);
+				}
+			}
+			AUTO(pit, origin.pending.begin());
+			while(pit != origin.pending.end()){
+				if(now < (*pit)->deadline){
+					++pit;
+					continue;
+				}
+				requests_to_fail.push_back(*pit);
+				pit = origin.pending.erase(pit);
+			}
+		}
+	}
+	if(!requests_to_fail.empty()){
+		LOG_POSEIDON_WARNING("CBPP RPC requests timed out: count = ", requests_to_fail.size());
+	}
+	for(AUTO(it, requests_to_fail.begin()); it != requests_to_fail.end(); ++it){
+		(*it)->promise->set_exception(make_rpc_exception(ST_TIMED_OUT, "CBPP RPC request timed out"), false);
+	}
+}
+
+RpcClientPool::RpcClientPool(bool verify_peer)
+	: m_verify_peer(verify_peer)
+	, m_max_in_flight(std::max<std::size_t>(MainConfig::get<std::size_t>("cbpp_rpc_max_in_flight", 64), 1))
+	, m_timeout(MainConfig::get<boost::uint64_t>("cbpp_rpc_timeout", 30000))
+	, m_tcp_pool(boost::bind(&RpcClientPool::create_client, this, _1, _2))
+	, m_serial(0)
+{
+	LOG_POSEIDON_DEBUG("Cbpp::RpcClientPool: max_in_flight = ", m_max_in_flight, ", timeout = ", m_timeout);
+}
+RpcClientPool::~RpcClientPool(){
+	boost::container::vector<boost::shared_ptr<Request> > requests;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+			AUTO_REF(origin, it->second);
+			for(AUTO(cit, origin.active.begin()); cit != origin.active.end(); ++cit){
+				AUTO_REF(client, *cit);
+				for(AUTO(rit, client->m_in_flight.begin()); rit != client->m_in_flight.end(); ++rit){
+					requests.push_back(rit->second);
+				}
+				client->m_in_flight.clear();
+				client->force_shutdown();
+			}
+			origin.active.clear();
+			requests.insert(requests.end(), origin.pending.begin(), origin.pending.end());
+			origin.pending.clear();
+		}
+	}
+	for(AUTO(it, requests.begin()); it != requests.end(); ++it){
+		(*it)->promise->set_exception(make_rpc_exception(ST_GONE_AWAY, "CBPP RPC client pool has been destroyed"), false);
+	}
+}
+
+boost::shared_ptr<TcpClientBase> RpcClientPool::create_client(const SockAddr &sock_addr, bool use_ssl){
+	PROFILE_ME;
+
+	// 由 connect_proc() 通过 TcpClientPool::acquire() 调用，此时 this 一定由 shared_ptr 持有。
+	AUTO(client, boost::make_shared<PooledClient>(sock_addr, use_ssl, m_verify_peer, virtual_weak_from_this<RpcClientPool>()));
+	EpollDaemon::add_socket(client, true);
+	return client;
+}
+
+bool RpcClientPool::unlocked_dispatch(Origin &origin, const boost::shared_ptr<Request> &request, bool ignore_limit){
+	PROFILE_ME;
+
+	boost::shared_ptr<PooledClient> best;
+	for(AUTO(it, origin.active.begin()); it != origin.active.end(); ++it){
+		AUTO_REF(client, *it);
+		if(client->has_been_shutdown_write()){
+			continue;
+		}
+		const std::size_t count = client->m_in_flight.size();
+		if(!ignore_limit && (count >= m_max_in_flight)){
+			continue;
+		}
+		if(!best || (count < best->m_in_flight.size())){
+			best = client;
+		}
+	}
+	if(!best){
+		return false;
+	}
+	unlocked_send(best, request);
+	return true;
+}
+void RpcClientPool::unlocked_send(const boost::shared_ptr<PooledClient> &client, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	client->m_in_flight[request->serial] = request;
+	if(!client->send(RPC_REQUEST_ID, encode_rpc_request(request->serial, request->message_id, request->payload))){
+		// 连接已经关闭，on_client_close() 会处理这个请求。
+		LOG_POSEIDON_DEBUG("Failed to send CBPP RPC request: remote = ", client->get_remote_info());
+	}
+}
+void RpcClientPool::unlocked_deactivate(Origin &origin, const boost::shared_ptr<PooledClient> &client){
+	PROFILE_ME;
+
+	const AUTO(it, std::find(origin.active.begin(), origin.active.end(), client));
+	if(it != origin.active.end()){
+		origin.active.erase(it);
+	}
+}
+
+void RpcClientPool::start_connecting(const std::string &key, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	// DNS 解析和建立连接都是阻塞的，所以交给工作者线程。
+	WorkhorseCamp::enqueue_isolated(boost::make_shared<Promise>(),
+		boost::bind(&RpcClientPool::connect_proc, virtual_weak_from_this<RpcClientPool>(), key, request));
+}
+
+void RpcClientPool::on_client_response(const boost::shared_ptr<PooledClient> &client, StreamBuffer payload){
+	PROFILE_ME;
+
+	boost::uint64_t serial;
+	StatusCode status_code;
+	boost::uint16_t message_id;
+	decode_rpc_response(serial, status_code, message_id, payload);
+
+	boost::shared_ptr<Request> request;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		const AUTO(it, client->m_in_flight.find(serial));
+		if(it == client->m_in_flight.end()){
+			// 请求已经超时。
+			LOG_POSEIDON_DEBUG("Discarding CBPP RPC response: remote = ", client->get_remote_info(), ", serial = ", serial);
+			return;
+		}
+		request = it->second;
+		client->m_in_flight.erase(it);
+	}
+	if(status_code != ST_OK){
+		request->promise->set_exception(make_rpc_exception(status_code, static_cast<char *>(payload.squash())), false);
+		return;
+	}
+	RpcResponse response;
+	response.message_id = message_id;
+	response.payload.swap(payload);
+	request->promise->set_success(STD_MOVE(response), false);
+}
+void RpcClientPool::on_client_close(const boost::shared_ptr<PooledClient> &client, int err_code){
+	PROFILE_ME;
+
+	boost::container::vector<boost::shared_ptr<Request> > requests_to_fail;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		const AUTO(it, m_origins.find(client->m_key));
+		if(it == m_origins.end()){
+			return;
+		}
+		AUTO_REF(origin, it->second);
+		unlocked_deactivate(origin, client);
+		// 请求可能已经被处理，所以不能重新发送。
+		for(AUTO(rit, client->m_in_flight.begin()); rit != client->m_in_flight.end(); ++rit){
+			requests_to_fail.push_back(rit->second);
+		}
+		client->m_in_flight.clear();
+	}
+	if(!requests_to_fail.empty()){
+		LOG_POSEIDON_DEBUG("CBPP RPC client closed with requests pending: remote = ", client->get_remote_info(), ", err_code = ", err_code,
+			", requests_to_fail = ", requests_to_fail.size());
+	}
+	for(AUTO(it, requests_to_fail.begin()); it != requests_to_fail.end(); ++it){
+		(*it)->promise->set_exception(make_rpc_exception(ST_GONE_AWAY, "Connection closed before the response was received"), false);
+	}
+}
+
+boost::shared_ptr<const PromiseContainer<RpcResponse> > RpcClientPool::enqueue_for_calling(const std::string &host, boost::uint16_t port, bool use_ssl,
+	boost::uint16_t message_id, StreamBuffer payload)
+{
+	PROFILE_ME;
+
+	const AUTO(request, boost::make_shared<Request>());
+	request->serial = atomic_add(m_serial, 1, ATOMIC_RELAXED);
+	request->message_id = message_id;
+	request->payload = STD_MOVE(payload);
+	request->promise = boost::make_shared<PromiseContainer<RpcResponse> >();
+	request->deadline = saturated_add(get_fast_mono_clock(), m_timeout);
+
+	const AUTO(key, make_origin_key(host, port, use_ssl));
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		if(!m_timer && (m_timeout != 0)){
+			m_timer = TimerDaemon::register_low_level_timer(1000, 1000, boost::bind(&timer_proc, virtual_weak_from_this<RpcClientPool>(), _2));
+		}
+		AUTO_REF(origin, m_origins[key]);
+		origin.host = host;
+		origin.port = port;
+		origin.use_ssl = use_ssl;
+		if(unlocked_dispatch(origin, request, false)){
+			return request->promise;
+		}
+		if(origin.connecting != 0){
+			// 等待正在建立的连接。
+			origin.pending.push_back(request);
+			return request->promise;
+		}
+		++origin.connecting;
+	}
+	start_connecting(key, request);
+	return request->promise;
+}
+boost::shared_ptr<const PromiseContainer<RpcResponse> > RpcClientPool::enqueue_for_calling(const std::string &host, boost::uint16_t port, bool use_ssl,
+	const MessageBase &msg)
+{
+	PROFILE_ME;
+
+	return enqueue_for_calling(host, port, use_ssl, boost::numeric_cast<boost::uint16_t>(msg.get_id()), msg);
+}
+
+void RpcClientPool::clear() NOEXCEPT {
+	boost::container::vector<boost::shared_ptr<PooledClient> > clients;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+			AUTO_REF(active, it->second.active);
+			AUTO(cit, active.begin());
+			while(cit != active.end()){
+				if(!(*cit)->m_in_flight.empty()){
+					++cit;
+					continue;
+				}
+				clients.push_back(*cit);
+				cit = active.erase(cit);
+			}
+		}
+	}
+	for(AUTO(it, clients.begin()); it != clients.end(); ++it){
+		(*it)->shutdown(ST_SHUTDOWN);
+	}
+	m_tcp_pool.clear();
+}
+
+std::size_t RpcClientPool::get_active_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+		count += it->second.active.size();
+	}
+	return count;
+}
+std::size_t RpcClientPool::get_in_flight_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+		const AUTO_REF(active, it->second.active);
+		for(AUTO(cit, active.begin()); cit != active.end(); ++cit){
+			count += (*cit)->m_in_flight.size();
+		}
+	}
+	return count;
+}
+std::size_t RpcClientPool::get_pending_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+		count += it->second.pending.size();
+	}
+	return count;
+}
+
+}
+}
@@ -0,0 +1,110 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_CBPP_RPC_CLIENT_POOL_HPP_
+#define POSEIDON_CBPP_RPC_CLIENT_POOL_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include "../virtual_shared_from_this.hpp"
+#include "../tcp_client_pool.hpp"
+#include "../promise.hpp"
+#include "../mutex.hpp"
+#include "../stream_buffer.hpp"
+#include "rpc.hpp"
+#include <string>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/map.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+class Timer;
+
+namespace Cbpp {
+
+class MessageBase;
+
+// 在 TcpClientPool 之上按照 host:port 复用 CBPP 连接，以 rpc.hpp 中的格式调用其他服务的 Session::on_sync_rpc_request()。
+// 每个请求带有序号，响应可以乱序返回，因此同一个连接上可以同时有多个请求，不会被前面较慢的请求阻塞。
+// 请求发送到正在等待的请求最少的连接上，所有连接都达到 cbpp_rpc_max_in_flight 个请求时才建立新的连接。
+// 结果通过 PromiseContainer 返回；对方返回错误时以 Cbpp::Exception 结束，超过 cbpp_rpc_timeout 毫秒没有响应时以 ST_TIMED_OUT 结束。
+// 必须使用 boost::make_shared() 创建。
+class RpcClientPool : NONCOPYABLE, public virtual VirtualSharedFromThis {
+private:
+	class PooledClient;
+	struct Request;
+
+	struct Origin {
+		std::string host;
+		boost::uint16_t port;
+		bool use_ssl;
+		// 已经从 TcpClientPool 取出的连接，连接断开之前一直保留。
+		boost::container::vector<boost::shared_ptr<PooledClient> > active;
+		// 正在建立的连接数，以及等待这些连接的请求。
+		std::size_t connecting;
+		std::deque<boost::shared_ptr<Request> > pending;
+
+		Origin()
+			: host(), port(0), use_ssl(false), active(), connecting(0), pending()
+		{ }
+	};
+
+private:
+	static void connect_proc(const boost::weak_ptr<RpcClientPool> &weak_pool, const std::string &key, const boost::shared_ptr<Request> &request);
+	static void timer_proc(const boost::weak_ptr<RpcClientPool> &weak_pool, boost::uint64_t now);
+
+private:
+	const bool m_verify_peer;
+	const std::size_t m_max_in_flight;
+	const boost::uint64_t m_timeout;
+	TcpClientPool m_tcp_pool;
+
+	volatile boost::uint64_t m_serial;
+
+	mutable Mutex m_mutex;
+	boost::container::map<std::string, Origin> m_origins;
+	boost::shared_ptr<Timer> m_timer;
+
+public:
+	explicit RpcClientPool(bool verify_peer = true);
+	~RpcClientPool();
+
+private:
+	boost::shared_ptr<TcpClientBase> create_client(const SockAddr &sock_addr, bool use_ssl);
+
+	// 以下函数都需要在持有 m_mutex 时调用。
+	// ignore_limit 为 true 时即使所有连接都达到了上限也使用其中请求最少的一个。
+	bool unlocked_dispatch(Origin &origin, const boost::shared_ptr<Request> &request, bool ignore_limit);
+	void unlocked_send(const boost::shared_ptr<PooledClient> &client, const boost::shared_ptr<Request> &request);
+	void unlocked_deactivate(Origin &origin, const boost::shared_ptr<PooledClient> &client);
+
+	void start_connecting(const std::string &key, const boost::shared_ptr<Request> &request);
+
+	// 以下函数由 PooledClient 在 epoll 线程中调用。
+	void on_client_response(const boost::shared_ptr<PooledClient> &client, StreamBuffer payload);
+	void on_client_close(const boost::shared_ptr<PooledClient> &client, int err_code);
+
+public:
+	boost::shared_ptr<const PromiseContainer<RpcResponse> > enqueue_for_calling(const std::string &host, boost::uint16_t port, bool use_ssl,
+		boost::uint16_t message_id, StreamBuffer payload);
+	boost::shared_ptr<const PromiseContainer<RpcResponse> > enqueue_for_calling(const std::string &host, boost::uint16_t port, bool use_ssl,
+		const MessageBase &msg);
+
+	// 关闭所有没有请求的连接，有请求的连接不受影响。
+	void clear() NOEXCEPT;
+
+	std::size_t get_active_count() const;
+	std::size_t get_in_flight_count() const;
+	std::size_t get_pending_count() const;
+};
+
+}
+
+extern template class PromiseContainer<Cbpp::RpcResponse>;
+
+}
+
+#endif
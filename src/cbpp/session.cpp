@@ -4,6 +4,9 @@
 #include "../precompiled.hpp"
 #include "session.hpp"
 #include "exception.hpp"
+#include "dispatch_table.hpp"
+#include "rpc.hpp"
+#include "message_base.hpp"
 #include "../singletons/main_config.hpp"
 #include "../singletons/job_dispatcher.hpp"
 #include "../log.hpp"
@@ -11,24 +14,40 @@
 #include "../job_base.hpp"
 #include "../time.hpp"
 #include "../atomic.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 namespace Cbpp {
 
+namespace {
+	ConfigValue<bool> g_cork_jobs("cbpp_cork_jobs", false);
+	ConfigValue<boost::uint64_t> g_keep_alive_timeout("cbpp_keep_alive_timeout", 30000);
+	ConfigValue<boost::uint64_t> g_max_request_length("cbpp_max_request_length", 16384);
+	ConfigValue<bool> g_early_decoding("cbpp_early_decoding", false);
+}
+
 class Session::SyncJobBase : public JobBase {
 private:
 	const SocketBase::DelayedShutdownGuard m_guard;
 	const boost::weak_ptr<Session> m_weak_session;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
 
 protected:
 	explicit SyncJobBase(const boost::shared_ptr<Session> &session)
-		: m_guard(session), m_weak_session(session)
+		: m_guard(session), m_weak_session(session), m_priority(session->get_job_priority()), m_thread_hint(session->get_epoll_thread_index())
 	{ }
 
 private:
 	boost::weak_ptr<const void> get_category() const FINAL {
 		return m_weak_session;
 	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
+	}
 	void perform() FINAL {
 		PROFILE_ME;
 
@@ -37,6 +56,11 @@ private:
 			return;
 		}
 
+		// 同一个任务中发送的消息合并起来，在任务结束时一次性发送。
+		const bool corked = g_cork_jobs.get();
+		if(corked){
+			session->cork();
+		}
 		try {
 			really_perform(session);
 		} catch(Exception &e){
@@ -49,6 +73,9 @@ private:
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown.");
 			session->force_shutdown();
 		}
+		if(corked){
+			session->uncork();
+		}
 	}
 
 protected:
@@ -62,6 +89,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
@@ -76,6 +106,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
@@ -90,21 +123,46 @@ class Session::DataMessageJob : public Session::SyncJobBase {
 private:
 	boost::uint16_t m_message_id;
 	StreamBuffer m_payload;
+	boost::shared_ptr<const MessageBase> m_message;
 
 public:
 	DataMessageJob(const boost::shared_ptr<Session> &session, boost::uint16_t message_id, StreamBuffer payload)
 		: SyncJobBase(session)
 		, m_message_id(message_id), m_payload(STD_MOVE(payload))
 	{ }
+	DataMessageJob(const boost::shared_ptr<Session> &session, boost::uint16_t message_id, boost::shared_ptr<const MessageBase> message)
+		: SyncJobBase(session)
+		, m_message_id(message_id), m_payload(), m_message(STD_MOVE(message))
+	{ }
 
 protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
-		LOG_POSEIDON_DEBUG("Dispatching message: message_id = ", m_message_id, ", payload_len = ", m_payload.size());
-		session->on_sync_data_message(m_message_id, STD_MOVE(m_payload));
+		if(m_message){
+			LOG_POSEIDON_DEBUG("Dispatching decoded message: message_id = ", m_message_id);
+			session->on_sync_decoded_message(m_message_id, *m_message);
+		} else if(m_message_id == RPC_REQUEST_ID){
+			boost::uint64_t serial;
+			boost::uint16_t message_id;
+			decode_rpc_request(serial, message_id, m_payload);
+			LOG_POSEIDON_DEBUG("Dispatching RPC request: serial = ", serial, ", message_id = ", message_id, ", payload_len = ", m_payload.size());
+			try {
+				session->on_sync_rpc_request(serial, message_id, STD_MOVE(m_payload));
+			} catch(Exception &e){
+				// 处理函数抛出的 Cbpp::Exception 作为错误响应返回给调用方，不关闭连接。
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Cbpp::Exception thrown from RPC handler: status_code = ", e.get_status_code(), ", what = ", e.what());
+				session->send_rpc_error(serial, e.get_status_code(), e.what());
+			}
+		} else {
+			LOG_POSEIDON_DEBUG("Dispatching message: message_id = ", m_message_id, ", payload_len = ", m_payload.size());
+			session->on_sync_data_message(m_message_id, STD_MOVE(m_payload));
+		}
 
-		const AUTO(keep_alive_timeout, MainConfig::get<boost::uint64_t>("cbpp_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
 		session->set_timeout(keep_alive_timeout);
 	}
 };
@@ -121,21 +179,25 @@ public:
 	{ }
 
 protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
 		LOG_POSEIDON_DEBUG("Dispatching control message: status_code = ", m_status_code, ", param = ", m_param);
 		session->on_sync_control_message(m_status_code, STD_MOVE(m_param));
 
-		const AUTO(keep_alive_timeout, MainConfig::get<boost::uint64_t>("cbpp_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
 		session->set_timeout(keep_alive_timeout);
 	}
 };
 
 Session::Session(Move<UniqueFile> socket)
 	: LowLevelSession(STD_MOVE(socket))
-	, m_max_request_length(MainConfig::get<boost::uint64_t>("cbpp_max_request_length", 16384))
+	, m_max_request_length(g_max_request_length.get())
 	, m_size_total(0), m_message_id(0), m_payload()
+	, m_early_decoding(g_early_decoding.get())
 { }
 Session::~Session(){ }
 
@@ -143,7 +205,7 @@ void Session::on_read_hup(){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ReadHupJob>(virtual_shared_from_this<Session>()),
+		boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Session>()),
 		VAL_INIT);
 
 	LowLevelSession::on_read_hup();
@@ -152,7 +214,7 @@ void Session::on_shutdown_timer(boost::uint64_t now){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<PingJob>(virtual_shared_from_this<Session>()),
+		boost::allocate_shared<PingJob>(PooledAllocator<PingJob>(), virtual_shared_from_this<Session>()),
 		VAL_INIT);
 
 	LowLevelSession::on_shutdown_timer(now);
@@ -161,7 +223,8 @@ void Session::on_shutdown_timer(boost::uint64_t now){
 void Session::on_low_level_data_message_header(boost::uint16_t message_id, boost::uint64_t payload_size){
 	PROFILE_ME;
 
-	(void)payload_size;
+	// 压缩的消息在这里给出原始长度，必须在解压之前检查。
+	DEBUG_THROW_UNLESS(payload_size <= get_max_request_length(), Exception, ST_REQUEST_TOO_LARGE);
 
 	m_size_total = 0;
 	m_message_id = message_id;
@@ -181,9 +244,31 @@ bool Session::on_low_level_data_message_end(boost::uint64_t payload_size){
 
 	(void)payload_size;
 
-	JobDispatcher::enqueue(
-		boost::make_shared<DataMessageJob>(virtual_shared_from_this<Session>(), m_message_id, STD_MOVE(m_payload)),
-		VAL_INIT);
+	// m_message_id 来自 16 位的消息头，这里检查范围之后再转换。
+	const AUTO(message_id, boost::numeric_cast<boost::uint16_t>(m_message_id));
+	boost::shared_ptr<const MessageBase> message;
+	if(m_early_decoding && m_dispatch_table){
+		// 在网络线程中反序列化，任务线程中只执行处理函数。
+		try {
+			message = m_dispatch_table->decode(message_id, m_payload);
+		} catch(Exception &e){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Cbpp::Exception thrown: status_code = ", e.get_status_code(), ", what = ", e.what());
+			shutdown(e.get_status_code(), e.what());
+			return false;
+		}
+	}
+	boost::shared_ptr<DataMessageJob> job;
+	if(message){
+		job = boost::allocate_shared<DataMessageJob>(PooledAllocator<DataMessageJob>(), virtual_shared_from_this<Session>(), message_id, STD_MOVE(message));
+	} else {
+		job = boost::allocate_shared<DataMessageJob>(PooledAllocator<DataMessageJob>(), virtual_shared_from_this<Session>(), message_id, STD_MOVE(m_payload));
+	}
+	const bool queued = JobDispatcher::enqueue(STD_MOVE_IDN(job), VAL_INIT);
+	if(!queued){
+		// 任务队列已满。
+		shutdown(ST_GONE_AWAY, "Server is busy");
+		return false;
+	}
 
 	return true;
 }
@@ -191,13 +276,43 @@ bool Session::on_low_level_data_message_end(boost::uint64_t payload_size){
 bool Session::on_low_level_control_message(StatusCode status_code, StreamBuffer param){
 	PROFILE_ME;
 
-	JobDispatcher::enqueue(
-		boost::make_shared<ControlMessageJob>(virtual_shared_from_this<Session>(), status_code, STD_MOVE(param)),
+	const bool queued = JobDispatcher::enqueue(
+		boost::allocate_shared<ControlMessageJob>(PooledAllocator<ControlMessageJob>(), virtual_shared_from_this<Session>(), status_code, STD_MOVE(param)),
 		VAL_INIT);
+	if(!queued){
+		shutdown(ST_GONE_AWAY, "Server is busy");
+		return false;
+	}
 
 	return true;
 }
 
+void Session::on_sync_data_message(boost::uint16_t message_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(m_dispatch_table && m_dispatch_table->dispatch(virtual_shared_from_this<Session>(), message_id, STD_MOVE(payload))){
+		return;
+	}
+	LOG_POSEIDON_WARNING("No handler for CBPP message: message_id = ", message_id, ", remote = ", get_remote_info());
+	DEBUG_THROW(Exception, ST_NOT_FOUND, sslit("Unknown message"));
+}
+void Session::on_sync_decoded_message(boost::uint16_t message_id, const MessageBase &msg){
+	PROFILE_ME;
+
+	if(m_dispatch_table && m_dispatch_table->dispatch_decoded(virtual_shared_from_this<Session>(), message_id, msg)){
+		return;
+	}
+	LOG_POSEIDON_WARNING("No handler for CBPP message: message_id = ", message_id, ", remote = ", get_remote_info());
+	DEBUG_THROW(Exception, ST_NOT_FOUND, sslit("Unknown message"));
+}
+void Session::on_sync_rpc_request(boost::uint64_t serial, boost::uint16_t message_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	(void)payload;
+
+	LOG_POSEIDON_WARNING("No handler for CBPP RPC request: message_id = ", message_id, ", remote = ", get_remote_info());
+	send_rpc_error(serial, ST_NOT_FOUND, "Unknown message");
+}
 void Session::on_sync_control_message(StatusCode status_code, StreamBuffer param){
 	PROFILE_ME;
 	LOG_POSEIDON_DEBUG("Recevied control message from ", get_remote_info(), ", status_code = ", status_code, ", param = ", param);
@@ -224,6 +339,23 @@ void Session::on_sync_control_message(StatusCode status_code, StreamBuffer param
 	}
 }
 
+bool Session::send_rpc_response(boost::uint64_t serial, boost::uint16_t message_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	return send(RPC_RESPONSE_ID, encode_rpc_response(serial, ST_OK, message_id, STD_MOVE(payload)));
+}
+bool Session::send_rpc_response(boost::uint64_t serial, const MessageBase &msg){
+	PROFILE_ME;
+
+	return send_rpc_response(serial, boost::numeric_cast<boost::uint16_t>(msg.get_id()), msg);
+}
+bool Session::send_rpc_error(boost::uint64_t serial, StatusCode status_code, const char *what){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(status_code != ST_OK, Exception, ST_INTERNAL_ERROR, sslit("An RPC error must not have ST_OK as its status code"));
+	return send(RPC_RESPONSE_ID, encode_rpc_response(serial, status_code, 0, StreamBuffer(what)));
+}
+
 boost::uint64_t Session::get_max_request_length() const {
 	return atomic_load(m_max_request_length, ATOMIC_CONSUME);
 }
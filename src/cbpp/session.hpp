@@ -5,6 +5,7 @@
 #define POSEIDON_CBPP_SESSION_HPP_
 
 #include "low_level_session.hpp"
+#include "fwd.hpp"
 
 namespace Poseidon {
 namespace Cbpp {
@@ -23,6 +24,9 @@ private:
 	unsigned m_message_id;
 	StreamBuffer m_payload;
 
+	boost::shared_ptr<const DispatchTable> m_dispatch_table;
+	bool m_early_decoding;
+
 public:
 	explicit Session(Move<UniqueFile> socket);
 	~Session();
@@ -50,12 +54,37 @@ protected:
 	bool on_low_level_control_message(StatusCode status_code, StreamBuffer param) OVERRIDE;
 
 	// 可覆写。
-	virtual void on_sync_data_message(boost::uint16_t message_id, StreamBuffer payload) = 0;
+	// 默认按照 set_dispatch_table() 设定的分派表分派，没有对应的处理函数时以 ST_NOT_FOUND 关闭连接。
+	virtual void on_sync_data_message(boost::uint16_t message_id, StreamBuffer payload);
+	// 启用 early decoding 时，分派表能够反序列化的消息在网络线程中反序列化，然后交给这个函数，不经过 on_sync_data_message()。
+	virtual void on_sync_decoded_message(boost::uint16_t message_id, const MessageBase &msg);
 	virtual void on_sync_control_message(StatusCode status_code, StreamBuffer param);
+	// 收到 RPC 请求（参见 rpc.hpp）时调用，应当使用 send_rpc_response() 或者 send_rpc_error() 以相同的 serial 响应，可以在任务挂起之后再响应。
+	// 抛出的 Cbpp::Exception 作为错误响应返回给调用方。默认以 ST_NOT_FOUND 响应。
+	virtual void on_sync_rpc_request(boost::uint64_t serial, boost::uint16_t message_id, StreamBuffer payload);
 
 public:
 	boost::uint64_t get_max_request_length() const;
 	void set_max_request_length(boost::uint64_t max_request_length);
+
+	bool send_rpc_response(boost::uint64_t serial, boost::uint16_t message_id, StreamBuffer payload);
+	bool send_rpc_response(boost::uint64_t serial, const MessageBase &msg);
+	bool send_rpc_error(boost::uint64_t serial, StatusCode status_code, const char *what = "");
+
+	// 必须在开始处理消息之前（通常在构造函数中）设定，可以由多个会话共享。
+	const boost::shared_ptr<const DispatchTable> &get_dispatch_table() const {
+		return m_dispatch_table;
+	}
+	void set_dispatch_table(boost::shared_ptr<const DispatchTable> dispatch_table){
+		m_dispatch_table.swap(dispatch_table);
+	}
+	// 缺省值取自 cbpp_early_decoding。同样必须在开始处理消息之前设定。
+	bool is_early_decoding_enabled() const {
+		return m_early_decoding;
+	}
+	void set_early_decoding_enabled(bool early_decoding){
+		m_early_decoding = early_decoding;
+	}
 };
 
 }
@@ -11,6 +11,7 @@ typedef long StatusCode;
 
 namespace StatusCodes {
 	enum {
+		ST_COMPRESSION             =    4,
 		ST_SHUTDOWN                =    3,
 		ST_PONG                    =    2,
 		ST_PING                    =    1,
@@ -30,6 +31,7 @@ namespace StatusCodes {
 		ST_GONE_AWAY               =  -12,
 		ST_INVALID_ARGUMENT        =  -13,
 		ST_UNSUPPORTED             =  -14,
+		ST_TIMED_OUT               =  -15,
 	};
 }
 
@@ -3,14 +3,18 @@
 
 #include "../precompiled.hpp"
 #include "writer.hpp"
+#include "compression.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../endian.hpp"
+#include "../atomic.hpp"
 
 namespace Poseidon {
 namespace Cbpp {
 
-Writer::Writer(){ }
+Writer::Writer()
+	: m_compression_threshold(static_cast<boost::uint64_t>(-1))
+{ }
 Writer::~Writer(){ }
 
 long Writer::put_data_message(boost::uint16_t message_id, StreamBuffer payload){
@@ -19,7 +23,23 @@ long Writer::put_data_message(boost::uint16_t message_id, StreamBuffer payload){
 	StreamBuffer frame;
 	boost::uint16_t temp16;
 	boost::uint64_t temp64;
-	if(payload.size() < 0xFFFF){
+	if((message_id != 0) && (payload.size() >= atomic_load(m_compression_threshold, ATOMIC_CONSUME))){
+		StreamBuffer compressed;
+		if(compress_message_payload(compressed, payload)){
+			store_be(temp16, 0xFFFE);
+			frame.put(&temp16, 2);
+			store_be(temp64, compressed.size());
+			frame.put(&temp64, 8);
+			store_be(temp64, payload.size());
+			frame.put(&temp64, 8);
+			store_be(temp16, message_id);
+			frame.put(&temp16, 2);
+			frame.splice(compressed);
+			return on_encoded_data_avail(STD_MOVE(frame));
+		}
+	}
+	// 0xFFFE 在协商压缩之后表示压缩的消息，因此这个长度总是使用 8 字节的形式。
+	if(payload.size() < 0xFFFE){
 		store_be(temp16, static_cast<boost::uint16_t>(payload.size()));
 		frame.put(&temp16, 2);
 	} else {
@@ -44,5 +64,12 @@ long Writer::put_control_message(StatusCode status_code, StreamBuffer param){
 	return put_data_message(0, STD_MOVE(payload));
 }
 
+void Writer::enable_compression(boost::uint64_t threshold){
+	atomic_store(m_compression_threshold, threshold, ATOMIC_RELEASE);
+}
+bool Writer::is_compression_enabled() const {
+	return atomic_load(m_compression_threshold, ATOMIC_CONSUME) != static_cast<boost::uint64_t>(-1);
+}
+
 }
 }
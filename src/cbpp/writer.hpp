@@ -13,6 +13,9 @@ namespace Poseidon {
 namespace Cbpp {
 
 class Writer {
+private:
+	volatile boost::uint64_t m_compression_threshold;
+
 public:
 	Writer();
 	virtual ~Writer();
@@ -23,6 +26,10 @@ protected:
 public:
 	long put_data_message(boost::uint16_t message_id, StreamBuffer payload);
 	long put_control_message(StatusCode status_code, StreamBuffer param);
+
+	// 此后不短于 threshold 字节的数据消息以 zstd 压缩发送，参见 compression.hpp。只能在对方声明能够解压之后调用。
+	void enable_compression(boost::uint64_t threshold);
+	bool is_compression_enabled() const;
 };
 
 }
@@ -0,0 +1,267 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_COROUTINE_HPP_
+#define POSEIDON_COROUTINE_HPP_
+
+#include "cxx_ver.hpp"
+
+// 框架本身按 C++98 或 C++11 编译，这里的内容全部在头文件中，只有以 C++20 编译的模块才能使用。
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902l)
+#  define POSEIDON_HAS_COROUTINE   1
+#endif
+
+#ifdef POSEIDON_HAS_COROUTINE
+
+#include "cxx_util.hpp"
+#include "job_base.hpp"
+#include "promise.hpp"
+#include "log.hpp"
+#include "exception.hpp"
+#include <coroutine>
+#include <exception>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+namespace Poseidon {
+
+// 用法：
+//   Coroutine load_user(boost::shared_ptr<User> user){
+//     co_await async_wait(MySqlDaemon::enqueue_for_loading(user, query));
+//     ...
+//   }
+// 与 JobDispatcher::yield() 不同，协程挂起时只保留几百字节的协程帧，不占用 fiber 的栈。
+// 挂起期间同一类别的其他任务可以继续执行，恢复时作为同一类别的新任务排队，并且不受 job_timeout 限制。
+class Coroutine : NONCOPYABLE {
+public:
+	class promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+
+private:
+	class FinalAwaiter {
+	public:
+		bool await_ready() const NOEXCEPT {
+			return false;
+		}
+		std::coroutine_handle<> await_suspend(Handle handle) const NOEXCEPT {
+			const AUTO(continuation, handle.promise().m_continuation);
+			if(continuation){
+				return continuation;
+			}
+			if(handle.promise().m_detached){
+				// 没有人等待这个协程，只能在这里销毁它。
+				if(handle.promise().m_except){
+					try {
+						std::rethrow_exception(handle.promise().m_except);
+					} catch(std::exception &e){
+						LOG_POSEIDON_WARNING("std::exception thrown from coroutine: what = ", e.what());
+					} catch(...){
+						LOG_POSEIDON_WARNING("Unknown exception thrown from coroutine");
+					}
+				}
+				handle.destroy();
+			}
+			return std::noop_coroutine();
+		}
+		void await_resume() const NOEXCEPT {
+		}
+	};
+
+public:
+	class promise_type {
+		friend Coroutine;
+
+	private:
+		boost::weak_ptr<const void> m_category;
+		boost::shared_ptr<const void> m_owner;
+		std::coroutine_handle<> m_continuation;
+		std::exception_ptr m_except;
+		bool m_detached;
+
+	public:
+		promise_type()
+			: m_category(), m_owner(), m_continuation(), m_except(), m_detached(false)
+		{ }
+
+	public:
+		const boost::weak_ptr<const void> &get_category() const NOEXCEPT {
+			return m_category;
+		}
+
+		Coroutine get_return_object() NOEXCEPT {
+			return Coroutine(Handle::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() const NOEXCEPT {
+			return std::suspend_always();
+		}
+		FinalAwaiter final_suspend() const NOEXCEPT {
+			return FinalAwaiter();
+		}
+		void return_void() const NOEXCEPT {
+		}
+		void unhandled_exception() NOEXCEPT {
+			m_except = std::current_exception();
+		}
+	};
+
+private:
+	Handle m_handle;
+
+private:
+	explicit Coroutine(Handle handle) NOEXCEPT
+		: m_handle(handle)
+	{ }
+
+public:
+	Coroutine(Coroutine &&rhs) NOEXCEPT
+		: m_handle(rhs.m_handle)
+	{
+		rhs.m_handle = NULLPTR;
+	}
+	Coroutine &operator=(Coroutine &&rhs) NOEXCEPT {
+		Coroutine(STD_MOVE(rhs)).swap(*this);
+		return *this;
+	}
+	~Coroutine(){
+		if(m_handle){
+			m_handle.destroy();
+		}
+	}
+
+public:
+	// 在当前线程中开始执行，协程结束时自动销毁。协程中抛出的异常只会被记录下来。
+	// 如果协程是某个对象的成员函数，owner 应当指向该对象，以保证挂起期间它不被销毁。
+	void start_detached(boost::weak_ptr<const void> category, boost::shared_ptr<const void> owner = boost::shared_ptr<const void>()){
+		DEBUG_THROW_ASSERT(m_handle);
+		const AUTO(handle, m_handle);
+		m_handle = NULLPTR;
+		handle.promise().m_category = STD_MOVE(category);
+		handle.promise().m_owner = STD_MOVE(owner);
+		handle.promise().m_detached = true;
+		handle.resume();
+	}
+
+	// 在一个协程中 co_await 另一个协程，后者继承前者的类别。
+	bool await_ready() const NOEXCEPT {
+		return !m_handle || m_handle.done();
+	}
+	template<typename PromiseT>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<PromiseT> caller) NOEXCEPT {
+		m_handle.promise().m_category = caller.promise().get_category();
+		m_handle.promise().m_continuation = caller;
+		return m_handle;
+	}
+	void await_resume() const {
+		if(m_handle && m_handle.promise().m_except){
+			std::rethrow_exception(m_handle.promise().m_except);
+		}
+	}
+
+	void swap(Coroutine &rhs) NOEXCEPT {
+		using std::swap;
+		swap(m_handle, rhs.m_handle);
+	}
+};
+
+inline void swap(Coroutine &lhs, Coroutine &rhs) NOEXCEPT {
+	lhs.swap(rhs);
+}
+
+namespace Impl_Coroutine {
+	class ResumeJob : public JobBase {
+	private:
+		const boost::weak_ptr<const void> m_category;
+		const std::coroutine_handle<> m_handle;
+
+	public:
+		ResumeJob(boost::weak_ptr<const void> category, std::coroutine_handle<> handle)
+			: m_category(STD_MOVE(category)), m_handle(handle)
+		{ }
+
+	protected:
+		boost::weak_ptr<const void> get_category() const OVERRIDE {
+			return m_category;
+		}
+		bool is_yieldable() const OVERRIDE {
+			return false;
+		}
+		void perform() OVERRIDE {
+			m_handle.resume();
+		}
+	};
+
+	inline void enqueue_resume(const boost::weak_ptr<const void> &category, std::coroutine_handle<> handle){
+		enqueue(boost::make_shared<ResumeJob>(category, handle));
+	}
+
+	class PromiseAwaiter {
+	protected:
+		const boost::shared_ptr<const Promise> m_promise;
+
+	public:
+		explicit PromiseAwaiter(boost::shared_ptr<const Promise> promise)
+			: m_promise(STD_MOVE(promise))
+		{
+			DEBUG_THROW_ASSERT(m_promise);
+		}
+
+	public:
+		bool await_ready() const NOEXCEPT {
+			return m_promise->is_satisfied();
+		}
+		template<typename PromiseT>
+		void await_suspend(std::coroutine_handle<PromiseT> caller) const {
+			// add_waiter() 返回之前协程就可能在其他线程中恢复并销毁这个 awaiter，因此先复制一份。
+			const AUTO(promise, m_promise);
+			const AUTO(category, caller.promise().get_category());
+			promise->add_waiter([=]{ enqueue_resume(category, caller); });
+		}
+		void await_resume() const {
+			m_promise->check_and_rethrow();
+		}
+	};
+
+	template<typename ResultT>
+	class PromiseContainerAwaiter : public PromiseAwaiter {
+	public:
+		explicit PromiseContainerAwaiter(const boost::shared_ptr<const PromiseContainer<ResultT> > &promise)
+			: PromiseAwaiter(promise)
+		{ }
+
+	public:
+		ResultT await_resume() const {
+			return STD_MOVE(static_cast<const PromiseContainer<ResultT> &>(*m_promise).get());
+		}
+	};
+}
+
+// 对应 wait()，MySqlDaemon、MongoDbDaemon、DnsDaemon 和 FileSystemDaemon 返回的 Promise 都可以使用。
+inline Impl_Coroutine::PromiseAwaiter async_wait(boost::shared_ptr<const Promise> promise){
+	return Impl_Coroutine::PromiseAwaiter(STD_MOVE(promise));
+}
+template<typename ResultT>
+inline Impl_Coroutine::PromiseContainerAwaiter<ResultT> async_wait(const boost::shared_ptr<const PromiseContainer<ResultT> > &promise){
+	return Impl_Coroutine::PromiseContainerAwaiter<ResultT>(promise);
+}
+
+// 以协程实现的任务。协程不会让出 fiber，因此任务本身不需要栈。
+// 协程挂起期间任务对象由协程帧持有，因此必须由 boost::shared_ptr 管理。
+class CoroutineJobBase : public JobBase, public boost::enable_shared_from_this<CoroutineJobBase> {
+protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
+	void perform() OVERRIDE {
+		really_perform().start_detached(get_category(), shared_from_this());
+	}
+
+	virtual Coroutine really_perform() = 0;
+};
+
+}
+
+#endif
+
+#endif
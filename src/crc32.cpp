@@ -3,6 +3,15 @@
 
 #include "precompiled.hpp"
 #include "crc32.hpp"
+#include "stream_buffer.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+#  include <arm_acle.h>
+#endif
 
 namespace Poseidon {
 
@@ -43,6 +52,167 @@ namespace {
 		0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
 		0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
 	};
+
+	// 以下函数都直接处理寄存器的值，即没有取反的 CRC。
+
+	boost::uint32_t update_bytewise(boost::uint32_t reg, const unsigned char *data, std::size_t size) NOEXCEPT {
+		for(std::size_t i = 0; i < size; ++i){
+			reg = CRC32_TABLE[(reg ^ data[i]) & 0xFF] ^ (reg >> 8);
+		}
+		return reg;
+	}
+
+	// SLICING_TABLES[k][i] 是字节 i 之后再跟随 k 个零字节的 CRC。
+	struct SlicingTables {
+		boost::uint32_t tables[8][256];
+
+		SlicingTables(){
+			std::memcpy(tables[0], CRC32_TABLE, sizeof(CRC32_TABLE));
+			for(unsigned k = 1; k < 8; ++k){
+				for(unsigned i = 0; i < 256; ++i){
+					const boost::uint32_t prev = tables[k - 1][i];
+					tables[k][i] = CRC32_TABLE[prev & 0xFF] ^ (prev >> 8);
+				}
+			}
+		}
+	};
+
+	const SlicingTables &get_slicing_tables(){
+		static const SlicingTables s_tables;
+		return s_tables;
+	}
+
+	boost::uint32_t update_slicing_by_8(boost::uint32_t reg, const unsigned char *data, std::size_t size) NOEXCEPT {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		const AUTO_REF(t, get_slicing_tables().tables);
+		const unsigned char *pos = data;
+		const unsigned char *const end = data + size;
+		while(end - pos >= 8){
+			boost::uint32_t lo, hi;
+			std::memcpy(&lo, pos, 4);
+			std::memcpy(&hi, pos + 4, 4);
+			lo ^= reg;
+			reg = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+				^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+			pos += 8;
+		}
+		return update_bytewise(reg, pos, static_cast<std::size_t>(end - pos));
+#else
+		return update_bytewise(reg, data, size);
+#endif
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	// 按照 Intel 的白皮书 "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"，
+	// 每次并行折叠 64 字节，最后用 Barrett 归约得到 32 位的结果。常数与 Linux 内核的 crc32-pclmul 相同。
+	// size 必须是 16 的倍数并且不小于 64。
+	__attribute__((__target__("pclmul,sse4.1")))
+	boost::uint32_t update_pclmul_blocks(boost::uint32_t reg, const unsigned char *data, std::size_t size) NOEXCEPT {
+		const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+		const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+		const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+		const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+		const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+		__m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x00));
+		__m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x10));
+		__m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x20));
+		__m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x30));
+		x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(reg)));
+		data += 64;
+		size -= 64;
+
+		while(size >= 64){
+			const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+			const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+			const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+			const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+			x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+			x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+			x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+			x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+			x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x00)));
+			x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x10)));
+			x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x20)));
+			x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0x30)));
+			data += 64;
+			size -= 64;
+		}
+
+		// 折叠为 128 位。
+		__m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+		while(size >= 16){
+			x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+			x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data))), x5);
+			data += 16;
+			size -= 16;
+		}
+
+		// 折叠为 64 位。
+		x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+		x2 = _mm_srli_si128(x1, 4);
+		x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00), x2);
+
+		// Barrett 归约为 32 位。
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+		x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+		x1 = _mm_xor_si128(x1, x2);
+		return static_cast<boost::uint32_t>(_mm_extract_epi32(x1, 1));
+	}
+	boost::uint32_t update_pclmul(boost::uint32_t reg, const unsigned char *data, std::size_t size) NOEXCEPT {
+		if(size >= 64){
+			const std::size_t blocks = size & ~static_cast<std::size_t>(15);
+			reg = update_pclmul_blocks(reg, data, blocks);
+			data += blocks;
+			size -= blocks;
+		}
+		return update_slicing_by_8(reg, data, size);
+	}
+#elif defined(__aarch64__)
+	__attribute__((__target__("+crc")))
+	boost::uint32_t update_armv8(boost::uint32_t reg, const unsigned char *data, std::size_t size) NOEXCEPT {
+		const unsigned char *pos = data;
+		const unsigned char *const end = data + size;
+		while(end - pos >= 8){
+			boost::uint64_t word;
+			std::memcpy(&word, pos, 8);
+			reg = __crc32d(reg, word);
+			pos += 8;
+		}
+		while(pos != end){
+			reg = __crc32b(reg, *pos);
+			++pos;
+		}
+		return reg;
+	}
+#endif
+
+	typedef boost::uint32_t (*UpdateProc)(boost::uint32_t reg, const unsigned char *data, std::size_t size);
+
+	UpdateProc choose_update_proc() NOEXCEPT {
+#if defined(__x86_64__) || defined(__i386__)
+		unsigned eax, ebx, ecx, edx;
+		if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)){
+			return &update_pclmul;
+		}
+#elif defined(__aarch64__)
+		if(::getauxval(AT_HWCAP) & HWCAP_CRC32){
+			return &update_armv8;
+		}
+#endif
+		return &update_slicing_by_8;
+	}
+
+	boost::uint32_t update(boost::uint32_t reg, const void *data, std::size_t size){
+		static const UpdateProc s_proc = choose_update_proc();
+		return (*s_proc)(reg, static_cast<const unsigned char *>(data), size);
+	}
 }
 
 Crc32_streambuf::Crc32_streambuf()
@@ -61,6 +231,13 @@ Crc32_streambuf::int_type Crc32_streambuf::overflow(Crc32_streambuf::int_type c)
 	m_reg = CRC32_TABLE[(m_reg ^ (unsigned)c) & 0xFF] ^ (m_reg >> 8);
 	return c;
 }
+std::streamsize Crc32_streambuf::xsputn(const char *s, std::streamsize n){
+	if(n <= 0){
+		return 0;
+	}
+	m_reg = update(m_reg, s, static_cast<std::size_t>(n));
+	return n;
+}
 
 Crc32 Crc32_streambuf::finalize(){
 	Crc32 crc32;
@@ -71,4 +248,18 @@ Crc32 Crc32_streambuf::finalize(){
 
 Crc32_ostream::~Crc32_ostream(){ }
 
+Crc32 crc32_hash(const void *data, std::size_t size){
+	return ~update(CRC32_REG_INIT, data, size);
+}
+Crc32 crc32_hash(const StreamBuffer &buffer){
+	boost::uint32_t reg = CRC32_REG_INIT;
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		reg = update(reg, data, size);
+	}
+	return ~reg;
+}
+
 }
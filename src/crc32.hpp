@@ -13,6 +13,8 @@
 
 namespace Poseidon {
 
+class StreamBuffer;
+
 typedef boost::uint32_t Crc32;
 
 class Crc32_streambuf : public std::streambuf {
@@ -29,6 +31,7 @@ public:
 
 protected:
 	int_type overflow(int_type c = traits_type::eof()) OVERRIDE;
+	std::streamsize xsputn(const char *s, std::streamsize n) OVERRIDE;
 
 public:
 	void reset() NOEXCEPT;
@@ -58,6 +61,11 @@ public:
 	}
 };
 
+// 与 zlib 的 crc32() 相同（IEEE 802.3 多项式）。
+// 按照 CPU 在运行时选择实现：x86 上使用 PCLMULQDQ，ARMv8 上使用 CRC32 指令，其他情况下使用 slicing-by-8 查表。
+extern Crc32 crc32_hash(const void *data, std::size_t size);
+extern Crc32 crc32_hash(const StreamBuffer &buffer);
+
 }
 
 #endif
@@ -0,0 +1,381 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "csv_table.hpp"
+#include "sha256.hpp"
+#include "raii.hpp"
+#include "exception.hpp"
+#include "system_exception.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace Poseidon {
+
+namespace {
+	CONSTEXPR const boost::uint64_t CACHE_MAGIC = 0x3154565343534F50; // "POSCSVT1"
+
+	// 缓存文件依次是文件头、按列存储的单元格和单元格的内容。缓存只在本机使用，所有字段都是本机字节序，
+	// 字节序不同时魔数不匹配，缓存被视为无效。
+	struct CacheHeader {
+		boost::uint64_t magic;
+		boost::uint64_t source_size;
+		boost::int64_t source_mtime_sec;
+		boost::int64_t source_mtime_nsec;
+		Sha256 source_hash;
+		boost::uint64_t column_count;
+		boost::uint64_t row_count; // 包括表头。
+		boost::uint64_t pool_size;
+	};
+
+	class Mapping : NONCOPYABLE {
+	private:
+		void *m_base;
+		std::size_t m_size;
+
+	public:
+		Mapping()
+			: m_base(NULLPTR), m_size(0)
+		{ }
+		~Mapping(){
+			if(m_base){
+				::munmap(m_base, m_size);
+			}
+		}
+
+	public:
+		void *get() const {
+			return m_base;
+		}
+		std::size_t size() const {
+			return m_size;
+		}
+		// 写入的内容不会影响文件。
+		bool map(int fd, std::size_t size, bool writeable){
+			const AUTO(base, ::mmap(NULLPTR, size, writeable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_PRIVATE, fd, 0));
+			if(base == MAP_FAILED){
+				return false;
+			}
+			m_base = base;
+			m_size = size;
+			return true;
+		}
+		void release(void *&base, std::size_t &size){
+			base = m_base;
+			size = m_size;
+			m_base = NULLPTR;
+			m_size = 0;
+		}
+	};
+
+	// 查找第一个逗号或者换行。
+	char *find_delimiter(char *begin, char *end){
+#ifdef __SSE2__
+		const __m128i comma = _mm_set1_epi8(',');
+		const __m128i lf = _mm_set1_epi8('\n');
+		while(end - begin >= 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, lf))));
+			if(mask != 0){
+				return begin + __builtin_ctz(mask);
+			}
+			begin += 16;
+		}
+#endif
+		while((begin != end) && (*begin != ',') && (*begin != '\n')){
+			++begin;
+		}
+		return begin;
+	}
+
+	bool write_all(int fd, const void *data, std::size_t size){
+		std::size_t total = 0;
+		while(total < size){
+			const ::ssize_t written = ::write(fd, static_cast<const char *>(data) + total, size - total);
+			if(written < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				return false;
+			}
+			total += static_cast<std::size_t>(written);
+		}
+		return true;
+	}
+}
+
+struct CsvTable::Source {
+	UniqueFile file;
+	boost::uint64_t size;
+	boost::int64_t mtime_sec;
+	boost::int64_t mtime_nsec;
+	Sha256 hash;
+};
+
+CsvTable::CsvTable(const std::string &path, const std::string &cache_path)
+	: m_base(NULLPTR), m_mapped(0), m_pool(NULLPTR), m_cells(NULLPTR), m_cell_storage(), m_column_count(0), m_row_count(0)
+{
+	PROFILE_ME;
+
+	Source source;
+	if(!source.file.reset(::open(path.c_str(), O_RDONLY | O_CLOEXEC))){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to open CSV file: path = ", path, ", err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	struct ::stat stat_buf;
+	DEBUG_THROW_UNLESS(::fstat(source.file.get(), &stat_buf) == 0, SystemException);
+	// 单元格的偏移和长度都是 32 位的。
+	DEBUG_THROW_UNLESS(static_cast<boost::uint64_t>(stat_buf.st_size) <= UINT32_MAX, Exception, sslit("CSV file is too large"));
+	source.size = static_cast<boost::uint64_t>(stat_buf.st_size);
+	source.mtime_sec = stat_buf.st_mtim.tv_sec;
+	source.mtime_nsec = stat_buf.st_mtim.tv_nsec;
+	source.hash.fill(0);
+
+	if(!cache_path.empty() && load_cache(cache_path, source)){
+		LOG_POSEIDON_DEBUG("Loaded CSV table from cache: path = ", path, ", cache_path = ", cache_path, ", columns = ", m_column_count, ", rows = ", m_row_count);
+		return;
+	}
+	if(source.size == 0){
+		return;
+	}
+	Mapping mapping;
+	if(!mapping.map(source.file.get(), static_cast<std::size_t>(source.size), true)){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to map CSV file: path = ", path, ", err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	if(!cache_path.empty()){
+		// 解析是原地进行的，必须在此之前计算。
+		source.hash = sha256_hash(mapping.get(), mapping.size());
+	}
+	parse(static_cast<char *>(mapping.get()), mapping.size());
+	mapping.release(m_base, m_mapped);
+	LOG_POSEIDON_DEBUG("Parsed CSV table: path = ", path, ", columns = ", m_column_count, ", rows = ", m_row_count);
+
+	if(!cache_path.empty()){
+		save_cache(cache_path, source);
+	}
+}
+CsvTable::~CsvTable(){
+	if(m_base){
+		::munmap(m_base, m_mapped);
+	}
+}
+
+bool CsvTable::load_cache(const std::string &cache_path, const Source &source){
+	PROFILE_ME;
+
+	UniqueFile file;
+	if(!file.reset(::open(cache_path.c_str(), O_RDONLY | O_CLOEXEC))){
+		LOG_POSEIDON_DEBUG("CSV cache not found: cache_path = ", cache_path);
+		return false;
+	}
+	struct ::stat stat_buf;
+	if((::fstat(file.get(), &stat_buf) != 0) || (static_cast<boost::uint64_t>(stat_buf.st_size) < sizeof(CacheHeader))){
+		LOG_POSEIDON_WARNING("Invalid CSV cache: cache_path = ", cache_path);
+		return false;
+	}
+	const AUTO(file_size, static_cast<boost::uint64_t>(stat_buf.st_size));
+	Mapping mapping;
+	if((file_size > static_cast<std::size_t>(-1)) || !mapping.map(file.get(), static_cast<std::size_t>(file_size), false)){
+		LOG_POSEIDON_WARNING("Failed to map CSV cache: cache_path = ", cache_path);
+		return false;
+	}
+	const AUTO(header, static_cast<const CacheHeader *>(mapping.get()));
+	if((header->magic != CACHE_MAGIC) || (header->source_size != source.size) || (header->pool_size != source.size) || (header->column_count > UINT32_MAX) || (header->row_count > UINT32_MAX)){
+		LOG_POSEIDON_INFO("CSV cache does not match: cache_path = ", cache_path);
+		return false;
+	}
+	const AUTO(cell_count, header->column_count * header->row_count);
+	if((cell_count > file_size / sizeof(Cell)) || (file_size != sizeof(CacheHeader) + cell_count * sizeof(Cell) + header->pool_size)){
+		LOG_POSEIDON_WARNING("CSV cache is truncated: cache_path = ", cache_path);
+		return false;
+	}
+	if((header->source_mtime_sec != source.mtime_sec) || (header->source_mtime_nsec != source.mtime_nsec)){
+		// 文件被修改过，但是内容可能没有变化，例如重新检出的文件。
+		Mapping source_mapping;
+		if((source.size != 0) && !source_mapping.map(source.file.get(), static_cast<std::size_t>(source.size), false)){
+			return false;
+		}
+		if(sha256_hash(source_mapping.get(), source_mapping.size()) != header->source_hash){
+			LOG_POSEIDON_INFO("CSV file has been modified: cache_path = ", cache_path);
+			return false;
+		}
+	}
+	const AUTO(cells, reinterpret_cast<const Cell *>(header + 1));
+	for(boost::uint64_t i = 0; i < cell_count; ++i){
+		if(static_cast<boost::uint64_t>(cells[i].offset) + cells[i].length > header->pool_size){
+			LOG_POSEIDON_WARNING("CSV cache is corrupted: cache_path = ", cache_path);
+			return false;
+		}
+	}
+	m_cells = cells;
+	m_pool = reinterpret_cast<const char *>(cells + cell_count);
+	m_column_count = static_cast<std::size_t>(header->column_count);
+	m_row_count = (header->row_count == 0) ? 0 : static_cast<std::size_t>(header->row_count - 1);
+	mapping.release(m_base, m_mapped);
+	return true;
+}
+void CsvTable::parse(char *data, std::size_t size){
+	PROFILE_ME;
+
+	// 先按行存储，最后再转置。
+	boost::container::vector<Cell> cells;
+	boost::container::vector<Cell> line;
+	std::size_t column_count = 0;
+	std::size_t row_count = 0;
+	std::size_t line_number = 0;
+	char *const end = data + size;
+	char *read = data;
+	while(read != end){
+		++line_number;
+		line.clear();
+		for(;;){
+			// 解码之后的内容不会比原文长，因此原地写入。
+			char *const begin = read;
+			char *write = read;
+			if(*read == '\"'){
+				++read;
+				for(;;){
+					const AUTO(quote, static_cast<char *>(std::memchr(read, '\"', static_cast<std::size_t>(end - read))));
+					char *const stop = quote ? quote : end;
+					std::memmove(write, read, static_cast<std::size_t>(stop - read));
+					write += stop - read;
+					read = stop;
+					if(read == end){
+						break;
+					}
+					++read;
+					if((read == end) || (*read != '\"')){
+						break;
+					}
+					*(write++) = '\"';
+					++read;
+				}
+			}
+			// 没有引号的字段，或者右引号之后的部分，到逗号或者换行为止。
+			char *const delim = find_delimiter(read, end);
+			if(write != read){
+				std::memmove(write, read, static_cast<std::size_t>(delim - read));
+			}
+			write += delim - read;
+			read = delim;
+			bool eol = true;
+			if(read != end){
+				eol = (*read == '\n');
+				++read;
+			}
+			if(eol && (write != begin) && (write[-1] == '\r')){
+				--write;
+			}
+			char *field = begin;
+			while((field != write) && ((*field == ' ') || (*field == '\t'))){
+				++field;
+			}
+			while((write != field) && ((write[-1] == ' ') || (write[-1] == '\t'))){
+				--write;
+			}
+			const Cell cell = { static_cast<boost::uint32_t>(field - data), static_cast<boost::uint32_t>(write - field) };
+			line.push_back(cell);
+			if(eol){
+				break;
+			}
+		}
+		if((line.size() == 1) && (line.front().length == 0)){
+			LOG_POSEIDON_WARNING("Ignoring empty line ", line_number);
+			continue;
+		}
+		if(column_count == 0){
+			for(std::size_t i = 0; i < line.size(); ++i){
+				for(std::size_t j = 0; j < i; ++j){
+					if((line.at(j).length == line.at(i).length) && (std::memcmp(data + line.at(j).offset, data + line.at(i).offset, line.at(i).length) == 0)){
+						LOG_POSEIDON_WARNING("Duplicate CSV header on line ", line_number, ": ", std::string(data + line.at(i).offset, line.at(i).length));
+						DEBUG_THROW(Exception, sslit("Duplicate CSV header"));
+					}
+				}
+			}
+			column_count = line.size();
+		} else if(line.size() != column_count){
+			LOG_POSEIDON_WARNING("Inconsistent CSV column count on line ", line_number, ": got ", line.size(), ", expecting ", column_count);
+			DEBUG_THROW(Exception, sslit("Inconsistent CSV column count"));
+		}
+		cells.insert(cells.end(), line.begin(), line.end());
+		++row_count;
+	}
+
+	m_cell_storage.resize(cells.size());
+	for(std::size_t r = 0; r < row_count; ++r){
+		for(std::size_t c = 0; c < column_count; ++c){
+			m_cell_storage[c * row_count + r] = cells[r * column_count + c];
+		}
+	}
+	m_pool = data;
+	m_cells = m_cell_storage.data();
+	m_column_count = column_count;
+	m_row_count = (row_count == 0) ? 0 : (row_count - 1);
+}
+void CsvTable::save_cache(const std::string &cache_path, const Source &source) const
+try {
+	PROFILE_ME;
+
+	CacheHeader header;
+	header.magic = CACHE_MAGIC;
+	header.source_size = source.size;
+	header.source_mtime_sec = source.mtime_sec;
+	header.source_mtime_nsec = source.mtime_nsec;
+	header.source_hash = source.hash;
+	header.column_count = m_column_count;
+	header.row_count = (m_column_count == 0) ? 0 : (m_row_count + 1);
+	header.pool_size = source.size;
+
+	// 先写入临时文件再重命名，这样其他进程不会读到写了一半的缓存。
+	const AUTO(tmp_path, cache_path + ".tmp");
+	UniqueFile file;
+	if(!file.reset(::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))){
+		const int err_code = errno;
+		LOG_POSEIDON_WARNING("Failed to create CSV cache: tmp_path = ", tmp_path, ", err_code = ", err_code);
+		return;
+	}
+	const bool succeeded = write_all(file.get(), &header, sizeof(header))
+		&& write_all(file.get(), m_cells, static_cast<std::size_t>(header.column_count * header.row_count) * sizeof(Cell))
+		&& write_all(file.get(), m_pool, static_cast<std::size_t>(header.pool_size));
+	file.reset();
+	if(!succeeded || (::rename(tmp_path.c_str(), cache_path.c_str()) != 0)){
+		const int err_code = errno;
+		LOG_POSEIDON_WARNING("Failed to write CSV cache: cache_path = ", cache_path, ", err_code = ", err_code);
+		::unlink(tmp_path.c_str());
+		return;
+	}
+	LOG_POSEIDON_DEBUG("Wrote CSV cache: cache_path = ", cache_path);
+} catch(std::exception &e){
+	LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+}
+
+std::string CsvTable::get_column_name(std::size_t column) const {
+	if(column >= m_column_count){
+		return std::string();
+	}
+	const Cell &cell = m_cells[column * (m_row_count + 1)];
+	return std::string(m_pool + cell.offset, cell.length);
+}
+std::size_t CsvTable::find_column(const char *name) const {
+	const std::size_t len = std::strlen(name);
+	for(std::size_t column = 0; column < m_column_count; ++column){
+		const Cell &cell = m_cells[column * (m_row_count + 1)];
+		if((cell.length == len) && (std::memcmp(m_pool + cell.offset, name, len) == 0)){
+			return column;
+		}
+	}
+	return NPOS;
+}
+
+}
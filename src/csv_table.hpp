@@ -0,0 +1,120 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_CSV_TABLE_HPP_
+#define POSEIDON_CSV_TABLE_HPP_
+
+#include "cxx_ver.hpp"
+#include "cxx_util.hpp"
+#include <string>
+#include <cstddef>
+#include <boost/container/vector.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+// 只读的按列存储的 CSV 表格，用于启动时加载的大型数据表。
+// 文件被映射到内存中原地解析，每个单元格只是映射区域中的偏移和长度，不为单元格分配内存。
+// 格式与 CsvDocument 相同：第一行是表头，字段两端的空格和制表符被去掉，
+// 以双引号开头的字段中的逗号和换行是字段的一部分，两个双引号表示一个双引号。
+// 指定了缓存文件时，解析的结果保存于其中，下次加载时如果 CSV 文件没有改变就直接映射缓存，不再解析。
+class CsvTable : NONCOPYABLE {
+public:
+	enum {
+		NPOS = static_cast<std::size_t>(-1),
+	};
+
+	struct Cell {
+		boost::uint32_t offset;
+		boost::uint32_t length;
+	};
+
+private:
+	void *m_base;
+	std::size_t m_mapped;
+	// 单元格的内容都位于 m_pool 中，但是不以零结尾。
+	const char *m_pool;
+	// 按列存储，每列的第一个单元格是表头。从缓存加载时指向映射区域，否则指向 m_cell_storage。
+	const Cell *m_cells;
+	boost::container::vector<Cell> m_cell_storage;
+	std::size_t m_column_count;
+	std::size_t m_row_count;
+
+public:
+	// cache_path 为空时不使用缓存。缓存文件无效或者无法写入时只记录日志，不会抛出异常。
+	explicit CsvTable(const std::string &path, const std::string &cache_path = std::string());
+	~CsvTable();
+
+private:
+	struct Source;
+
+	bool load_cache(const std::string &cache_path, const Source &source);
+	void parse(char *data, std::size_t size);
+	void save_cache(const std::string &cache_path, const Source &source) const;
+
+public:
+	std::size_t get_column_count() const {
+		return m_column_count;
+	}
+	// 不包括表头。
+	std::size_t size() const {
+		return m_row_count;
+	}
+	bool empty() const {
+		return m_row_count == 0;
+	}
+
+	std::string get_column_name(std::size_t column) const;
+	// 找不到时返回 NPOS。
+	std::size_t find_column(const char *name) const;
+
+	// 下标越界时返回 false。
+	bool get_raw(const char *&data, std::size_t &size, std::size_t row, std::size_t column) const {
+		if((row >= m_row_count) || (column >= m_column_count)){
+			return false;
+		}
+		const Cell &cell = m_cells[column * (m_row_count + 1) + 1 + row];
+		data = m_pool + cell.offset;
+		size = cell.length;
+		return true;
+	}
+	// 下标越界时返回空字符串。
+	std::string get(std::size_t row, std::size_t column) const {
+		const char *data;
+		std::size_t size;
+		if(!get_raw(data, size, row, column)){
+			return std::string();
+		}
+		return std::string(data, size);
+	}
+	std::string get(std::size_t row, const char *column) const {
+		return get(row, find_column(column));
+	}
+
+	// 单元格为空或者下标越界时返回 false，格式错误时抛出 boost::bad_lexical_cast。
+	template<typename T>
+	bool get(T &val, std::size_t row, std::size_t column) const {
+		const char *data;
+		std::size_t size;
+		if(!get_raw(data, size, row, column) || (size == 0)){
+			return false;
+		}
+		val = boost::lexical_cast<T>(data, size);
+		return true;
+	}
+	template<typename T>
+	T get(std::size_t row, std::size_t column) const {
+		T val = VAL_INIT;
+		get<T>(val, row, column);
+		return val;
+	}
+	template<typename T>
+	T get(std::size_t row, const char *column) const {
+		return get<T>(row, find_column(column));
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,207 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "file_watcher.hpp"
+#include <unistd.h>
+#include "singletons/timer_daemon.hpp"
+#include "log.hpp"
+#include "system_exception.hpp"
+#include "profiler.hpp"
+#include "time.hpp"
+#include "checked_arithmetic.hpp"
+
+namespace Poseidon {
+
+namespace {
+#ifdef POSEIDON_CXX11
+	UniqueFile
+#else
+	Move<UniqueFile>
+#endif
+		create_inotify_fd()
+	{
+#ifdef POSEIDON_CXX11
+		UniqueFile inotify;
+#else
+		static __thread UniqueFile inotify;
+#endif
+		DEBUG_THROW_UNLESS(inotify.reset(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), SystemException);
+		return STD_MOVE(inotify);
+	}
+}
+
+FileWatcher::FileWatcher(boost::uint64_t debounce)
+	: SocketBase(create_inotify_fd())
+	, m_debounce(debounce)
+	, m_timer_armed(false)
+{
+	LOG_POSEIDON_DEBUG("Created file watcher: debounce = ", m_debounce);
+}
+FileWatcher::~FileWatcher(){
+	LOG_POSEIDON_DEBUG("Destroyed file watcher: watch_count = ", m_watches.size());
+}
+
+void FileWatcher::timer_proc(const boost::weak_ptr<FileWatcher> &weak, boost::uint64_t now){
+	PROFILE_ME;
+
+	const AUTO(watcher, weak.lock());
+	if(!watcher){
+		return;
+	}
+	watcher->flush_pending(now);
+}
+
+void FileWatcher::report_change(const std::string &path, boost::uint32_t mask, boost::uint64_t now){
+	PROFILE_ME;
+
+	if(m_debounce == 0){
+		on_change(path, mask);
+		return;
+	}
+	const Mutex::UniqueLock lock(m_mutex);
+	AUTO_REF(pending, m_pending[path]);
+	pending.mask |= mask;
+	pending.due_time = saturated_add(now, m_debounce);
+	if(m_timer_armed){
+		// 定时器触发时会按照最早的到期时间重新设置。
+		return;
+	}
+	if(!m_timer){
+		m_timer = TimerDaemon::register_low_level_timer(m_debounce, 0, boost::bind(&timer_proc, virtual_weak_from_this<FileWatcher>(), _2));
+	} else {
+		TimerDaemon::set_time(m_timer, m_debounce, 0);
+	}
+	m_timer_armed = true;
+}
+void FileWatcher::flush_pending(boost::uint64_t now){
+	PROFILE_ME;
+
+	boost::container::vector<std::pair<std::string, boost::uint32_t> > changes;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		boost::uint64_t next_due_time = UINT64_MAX;
+		AUTO(it, m_pending.begin());
+		while(it != m_pending.end()){
+			if(now < it->second.due_time){
+				next_due_time = std::min(next_due_time, it->second.due_time);
+				++it;
+				continue;
+			}
+			changes.emplace_back(it->first, it->second.mask);
+			it = m_pending.erase(it);
+		}
+		if(next_due_time == UINT64_MAX){
+			m_timer_armed = false;
+		} else {
+			TimerDaemon::set_absolute_time(m_timer, next_due_time, 0);
+		}
+	}
+	for(AUTO(it, changes.begin()); it != changes.end(); ++it){
+		try {
+			on_change(it->first, it->second);
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		} catch(...){
+			LOG_POSEIDON_ERROR("Unknown exception thrown.");
+		}
+	}
+}
+
+int FileWatcher::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable){
+	PROFILE_ME;
+
+	(void)hint_buffer;
+	(void)hint_capacity;
+	(void)readable;
+
+	for(;;){
+		// 每次至少能容纳一个名字最长的事件。
+		union {
+			::inotify_event event;
+			char bytes[16 * (sizeof(::inotify_event) + NAME_MAX + 1)];
+		} buffer;
+		const ::ssize_t result = ::read(get_fd(), buffer.bytes, sizeof(buffer.bytes));
+		if(result < 0){
+			return errno;
+		}
+		if(result == 0){
+			return EWOULDBLOCK;
+		}
+		const AUTO(now, get_fast_mono_clock());
+		std::size_t offset = 0;
+		while(offset < static_cast<std::size_t>(result)){
+			::inotify_event event;
+			std::memcpy(&event, buffer.bytes + offset, sizeof(event));
+			const char *const name = buffer.bytes + offset + sizeof(event);
+			offset += sizeof(event) + event.len;
+
+			std::string path;
+			if(event.mask & IN_Q_OVERFLOW){
+				LOG_POSEIDON_WARNING("inotify event queue overflowed. Some changes might have been lost.");
+			} else {
+				const Mutex::UniqueLock lock(m_mutex);
+				const AUTO(it, m_watches.find(event.wd));
+				if(it == m_watches.end()){
+					continue;
+				}
+				if(event.mask & IN_IGNORED){
+					// 被监视的文件已经被删除，或者调用了 remove_watch()。
+					m_watches.erase(it);
+					continue;
+				}
+				path = it->second;
+				if(event.len != 0){
+					path += '/';
+					path += name;
+				}
+			}
+			LOG_POSEIDON_TRACE("File changed: path = ", path, ", mask = ", std::hex, event.mask);
+			try {
+				report_change(path, event.mask, now);
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			} catch(...){
+				LOG_POSEIDON_ERROR("Unknown exception thrown.");
+			}
+		}
+	}
+}
+
+void FileWatcher::on_change(const std::string &path, boost::uint32_t mask){
+	PROFILE_ME;
+
+	async_raise_event(boost::make_shared<FileChangedEvent>(path, mask));
+}
+
+int FileWatcher::add_watch(const std::string &path, boost::uint32_t mask){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const int wd = ::inotify_add_watch(get_fd(), path.c_str(), mask);
+	if(wd < 0){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to watch file: path = ", path, ", err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	// 同一个路径再次添加时返回相同的描述符。
+	m_watches[wd] = path;
+	LOG_POSEIDON_DEBUG("Watching file: path = ", path, ", wd = ", wd);
+	return wd;
+}
+bool FileWatcher::remove_watch(int wd){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const AUTO(it, m_watches.find(wd));
+	if(it == m_watches.end()){
+		return false;
+	}
+	::inotify_rm_watch(get_fd(), wd);
+	m_watches.erase(it);
+	return true;
+}
+
+FileChangedEvent::~FileChangedEvent(){ }
+
+}
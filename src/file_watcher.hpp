@@ -0,0 +1,87 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_FILE_WATCHER_HPP_
+#define POSEIDON_FILE_WATCHER_HPP_
+
+#include "socket_base.hpp"
+#include "event_base.hpp"
+#include <string>
+#include <boost/container/map.hpp>
+#include <boost/container/flat_map.hpp>
+#include <boost/cstdint.hpp>
+#include <sys/inotify.h>
+
+namespace Poseidon {
+
+class Timer;
+
+// 使用 inotify 监视文件和目录的变化。创建之后使用 EpollDaemon::add_socket() 添加到 epoll 中。
+class FileWatcher : public SocketBase {
+public:
+	enum {
+		MASK_DEFAULT = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF,
+	};
+
+private:
+	struct PendingChange {
+		boost::uint32_t mask;
+		boost::uint64_t due_time;
+	};
+
+private:
+	const boost::uint64_t m_debounce;
+
+	mutable Mutex m_mutex;
+	boost::container::flat_map<int, std::string> m_watches;
+	boost::container::map<std::string, PendingChange> m_pending;
+	boost::shared_ptr<Timer> m_timer;
+	bool m_timer_armed;
+
+public:
+	// debounce 非零时，同一路径上的连续变化被合并，在最后一次变化之后 debounce 毫秒才报告一次。
+	explicit FileWatcher(boost::uint64_t debounce = 0);
+	~FileWatcher();
+
+private:
+	static void timer_proc(const boost::weak_ptr<FileWatcher> &weak, boost::uint64_t now);
+
+	void report_change(const std::string &path, boost::uint32_t mask, boost::uint64_t now);
+	void flush_pending(boost::uint64_t now);
+
+protected:
+	int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable) OVERRIDE;
+
+	// 在 epoll 线程或者定时器线程中调用。默认实现异步触发 FileChangedEvent。
+	// 事件队列溢出时 path 为空，mask 包含 IN_Q_OVERFLOW，此时应当重新加载所有被监视的文件。
+	virtual void on_change(const std::string &path, boost::uint32_t mask);
+
+public:
+	// 返回的描述符用于 remove_watch()。监视目录时报告的路径是目录中发生变化的文件。
+	int add_watch(const std::string &path, boost::uint32_t mask = MASK_DEFAULT);
+	bool remove_watch(int wd);
+};
+
+class FileChangedEvent : public EventBase {
+private:
+	const std::string m_path;
+	const boost::uint32_t m_mask;
+
+public:
+	FileChangedEvent(std::string path, boost::uint32_t mask)
+		: m_path(STD_MOVE(path)), m_mask(mask)
+	{ }
+	~FileChangedEvent();
+
+public:
+	const std::string &get_path() const {
+		return m_path;
+	}
+	boost::uint32_t get_mask() const {
+		return m_mask;
+	}
+};
+
+}
+
+#endif
@@ -43,6 +43,9 @@ class CsvParser;
 class JsonObject;
 class JsonArray;
 class JsonElement;
+class JsonSaxHandler;
+class JsonParser;
+class JsonDocument;
 
 class JobBase;
 class EventBase;
@@ -57,6 +60,8 @@ class TcpSessionBase;
 class TcpClientBase;
 class TcpServerBase;
 class UdpServerBase;
+class RudpServerBase;
+class RudpSessionBase;
 
 class SystemSession;
 
@@ -67,6 +72,10 @@ class Base64Decoder;
 
 class Deflator;
 class Inflator;
+class BrotliCompressor;
+class BrotliDecompressor;
+class ZstdCompressor;
+class ZstdDecompressor;
 
 class EventListener;
 class Timer;
@@ -0,0 +1,231 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "heap_allocator.hpp"
+#include "checked_arithmetic.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include <malloc.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+
+namespace Poseidon {
+
+namespace {
+	typedef int (*JemallocCtl)(const char *name, void *oldp, std::size_t *oldlenp, void *newp, std::size_t newlen);
+	typedef void (*JemallocStatsPrint)(void (*write_cb)(void *, const char *), void *opaque, const char *opts);
+	typedef int (*TcmallocGetProperty)(const char *name, std::size_t *value);
+	typedef void (*TcmallocGetStats)(char *buffer, int buffer_length);
+	typedef void (*TcmallocRelease)();
+
+	// 在 jemalloc 中等于 MALLCTL_ARENAS_ALL。
+	CONSTEXPR const unsigned JEMALLOC_ARENAS_ALL = 4096;
+
+	struct AllocatorSymbols {
+		HeapAllocatorKind kind;
+		JemallocCtl je_ctl;
+		JemallocStatsPrint je_stats_print;
+		TcmallocGetProperty tc_get_property;
+		TcmallocGetStats tc_get_stats;
+		TcmallocRelease tc_release;
+	};
+
+	::pthread_once_t g_symbols_once = PTHREAD_ONCE_INIT;
+	AllocatorSymbols g_symbols;
+
+	template<typename FunctionT>
+	FunctionT find_symbol(const char *name) NOEXCEPT {
+		// dlsym() 返回 void *，ISO C++ 不允许直接转换成函数指针。
+		const AUTO(ptr, ::dlsym(RTLD_DEFAULT, name));
+		FunctionT func;
+		std::memcpy(&func, &ptr, sizeof(func));
+		return func;
+	}
+
+	void resolve_symbols() NOEXCEPT {
+		g_symbols.kind = HAK_GLIBC;
+		g_symbols.je_ctl = find_symbol<JemallocCtl>("mallctl");
+		g_symbols.je_stats_print = find_symbol<JemallocStatsPrint>("malloc_stats_print");
+		g_symbols.tc_get_property = find_symbol<TcmallocGetProperty>("MallocExtension_GetNumericProperty");
+		g_symbols.tc_get_stats = find_symbol<TcmallocGetStats>("MallocExtension_GetStats");
+		g_symbols.tc_release = find_symbol<TcmallocRelease>("MallocExtension_ReleaseFreeMemory");
+		if(g_symbols.je_ctl && g_symbols.je_stats_print){
+			g_symbols.kind = HAK_JEMALLOC;
+		} else if(g_symbols.tc_get_property && g_symbols.tc_get_stats && g_symbols.tc_release){
+			g_symbols.kind = HAK_TCMALLOC;
+		}
+	}
+	const AllocatorSymbols &get_symbols() NOEXCEPT {
+		::pthread_once(&g_symbols_once, &resolve_symbols);
+		return g_symbols;
+	}
+
+	template<typename T>
+	T jemalloc_read(const AllocatorSymbols &symbols, const char *name) NOEXCEPT {
+		T value = T();
+		std::size_t size = sizeof(value);
+		if(symbols.je_ctl(name, &value, &size, NULLPTR, 0) != 0){
+			LOG_POSEIDON_DEBUG("mallctl() failed: name = ", name);
+			return T();
+		}
+		return value;
+	}
+	boost::uint64_t tcmalloc_read(const AllocatorSymbols &symbols, const char *name) NOEXCEPT {
+		std::size_t value = 0;
+		if(!symbols.tc_get_property(name, &value)){
+			LOG_POSEIDON_DEBUG("MallocExtension_GetNumericProperty() failed: name = ", name);
+			return 0;
+		}
+		return value;
+	}
+
+	void append_to_string(void *opaque, const char *str){
+		static_cast<std::string *>(opaque)->append(str);
+	}
+	std::string get_glibc_report(){
+		std::string report;
+		char *data = NULLPTR;
+		std::size_t size = 0;
+		const AUTO(stream, ::open_memstream(&data, &size));
+		if(!stream){
+			const int err_code = errno;
+			LOG_POSEIDON_ERROR("open_memstream() failed: err_code = ", err_code);
+			return report;
+		}
+		::malloc_info(0, stream);
+		::fclose(stream);
+		try {
+			report.assign(data, size);
+		} catch(...){
+			::free(data);
+			throw;
+		}
+		::free(data);
+		return report;
+	}
+	std::size_t count_glibc_arenas(const std::string &report){
+		// malloc_info() 为每个 arena 输出一个 <heap nr="N"> 元素。
+		std::size_t count = 0;
+		for(AUTO(pos, report.find("<heap nr=")); pos != std::string::npos; pos = report.find("<heap nr=", pos + 1)){
+			++count;
+		}
+		return count;
+	}
+
+	boost::uint64_t get_resident_bytes() NOEXCEPT {
+		const AUTO(file, ::fopen("/proc/self/statm", "r"));
+		if(!file){
+			return 0;
+		}
+		unsigned long long total, resident;
+		const int fields = ::fscanf(file, "%llu%llu", &total, &resident);
+		::fclose(file);
+		if(fields != 2){
+			return 0;
+		}
+		return resident * static_cast<unsigned long>(::sysconf(_SC_PAGESIZE));
+	}
+}
+
+HeapAllocatorKind get_heap_allocator_kind() NOEXCEPT {
+	return get_symbols().kind;
+}
+const char *get_heap_allocator_name(HeapAllocatorKind kind) NOEXCEPT {
+	switch(kind){
+	case HAK_JEMALLOC:
+		return "jemalloc";
+	case HAK_TCMALLOC:
+		return "tcmalloc";
+	default:
+		return "glibc";
+	}
+}
+
+void get_heap_statistics(HeapStatistics &stats){
+	PROFILE_ME;
+
+	const AUTO_REF(symbols, get_symbols());
+	stats.kind = symbols.kind;
+	switch(symbols.kind){
+	case HAK_JEMALLOC: {
+		// 统计数据只在 epoch 变化时刷新。
+		boost::uint64_t epoch = 1;
+		std::size_t size = sizeof(epoch);
+		symbols.je_ctl("epoch", &epoch, &size, &epoch, size);
+		stats.allocated_bytes = jemalloc_read<std::size_t>(symbols, "stats.allocated");
+		stats.mapped_bytes = jemalloc_read<std::size_t>(symbols, "stats.mapped");
+		stats.free_bytes = saturated_sub(stats.mapped_bytes, stats.allocated_bytes);
+		stats.arena_count = jemalloc_read<unsigned>(symbols, "arenas.narenas");
+		break; }
+	case HAK_TCMALLOC: {
+		stats.allocated_bytes = tcmalloc_read(symbols, "generic.current_allocated_bytes");
+		stats.mapped_bytes = saturated_sub(tcmalloc_read(symbols, "generic.heap_size"), tcmalloc_read(symbols, "tcmalloc.pageheap_unmapped_bytes"));
+		stats.free_bytes = saturated_sub(stats.mapped_bytes, stats.allocated_bytes);
+		stats.arena_count = 0;
+		break; }
+	default: {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+		const AUTO(info, ::mallinfo2());
+#else
+		const AUTO(info, ::mallinfo());
+#endif
+		// arena 为 brk() 和各个 arena 中的堆的大小，hblkhd 为直接用 mmap() 分配的块的大小。
+		stats.allocated_bytes = static_cast<boost::uint64_t>(info.uordblks) + static_cast<boost::uint64_t>(info.hblkhd);
+		stats.free_bytes = static_cast<boost::uint64_t>(info.fordblks);
+		stats.mapped_bytes = static_cast<boost::uint64_t>(info.arena) + static_cast<boost::uint64_t>(info.hblkhd);
+		stats.arena_count = count_glibc_arenas(get_glibc_report());
+		break; }
+	}
+}
+std::string get_heap_report(){
+	PROFILE_ME;
+
+	const AUTO_REF(symbols, get_symbols());
+	std::string report;
+	switch(symbols.kind){
+	case HAK_JEMALLOC:
+		// J = JSON 格式。
+		symbols.je_stats_print(&append_to_string, &report, "J");
+		break;
+	case HAK_TCMALLOC:
+		report.resize(65536);
+		symbols.tc_get_stats(&report[0], static_cast<int>(report.size()));
+		report.resize(std::strlen(report.c_str()));
+		break;
+	default:
+		report = get_glibc_report();
+		break;
+	}
+	return report;
+}
+
+boost::uint64_t trim_heap(){
+	PROFILE_ME;
+
+	const AUTO_REF(symbols, get_symbols());
+	const AUTO(resident_before, get_resident_bytes());
+	switch(symbols.kind){
+	case HAK_JEMALLOC: {
+		char name[64];
+		std::sprintf(name, "arena.%u.purge", JEMALLOC_ARENAS_ALL);
+		if(symbols.je_ctl(name, NULLPTR, NULLPTR, NULLPTR, 0) != 0){
+			LOG_POSEIDON_WARNING("mallctl() failed: name = ", name);
+		}
+		break; }
+	case HAK_TCMALLOC:
+		symbols.tc_release();
+		break;
+	default:
+		::malloc_trim(0);
+		break;
+	}
+	const AUTO(resident_after, get_resident_bytes());
+	const AUTO(released, saturated_sub(resident_before, resident_after));
+	LOG_POSEIDON_DEBUG("Trimmed heap: allocator = ", get_heap_allocator_name(symbols.kind), ", released = ", released);
+	return released;
+}
+
+}
@@ -0,0 +1,47 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HEAP_ALLOCATOR_HPP_
+#define POSEIDON_HEAP_ALLOCATOR_HPP_
+
+#include "cxx_ver.hpp"
+#include <string>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+// 进程实际使用的 malloc 实现。jemalloc 和 tcmalloc 通过符号在运行时识别，
+// 因此无论是用 configure --with-malloc 链接的还是用 LD_PRELOAD 加载的都可以识别。
+enum HeapAllocatorKind {
+	HAK_GLIBC     = 0,
+	HAK_JEMALLOC  = 1,
+	HAK_TCMALLOC  = 2,
+};
+
+struct HeapStatistics {
+	HeapAllocatorKind kind;
+	// 应用程序正在使用的字节数。
+	boost::uint64_t allocated_bytes;
+	// 分配器持有但是没有被使用的字节数，即碎片和缓存。
+	boost::uint64_t free_bytes;
+	// 分配器从系统映射的字节数。
+	boost::uint64_t mapped_bytes;
+	// 分配器中的 arena 数。tcmalloc 没有 arena，总是为零。
+	std::size_t arena_count;
+};
+
+extern HeapAllocatorKind get_heap_allocator_kind() NOEXCEPT;
+extern const char *get_heap_allocator_name(HeapAllocatorKind kind) NOEXCEPT;
+
+extern void get_heap_statistics(HeapStatistics &stats);
+// 分配器自己的文本报告：glibc 为 malloc_info() 的 XML，jemalloc 为 malloc_stats_print()，tcmalloc 为 MallocExtension::GetStats()。
+extern std::string get_heap_report();
+
+// 把空闲的内存还给系统：glibc 为 malloc_trim(0)，jemalloc 为清理所有 arena，tcmalloc 为 ReleaseFreeMemory()。
+// 返回调用前后进程常驻内存（/proc/self/statm）减少的字节数。
+extern boost::uint64_t trim_heap();
+
+}
+
+#endif
@@ -5,6 +5,9 @@
 #include "hex.hpp"
 #include "profiler.hpp"
 #include "exception.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
@@ -17,13 +20,229 @@ namespace {
 	unsigned char to_hex_digit(unsigned byte, bool upper_case){
 		return HEX_TABLE[(byte & 0x0F) + upper_case * sizeof(HEX_TABLE) / 2];
 	}
+
+	CONSTEXPR const signed char HEX_REV_TABLE[256] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+		-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	};
+
 	int from_hex_digit(unsigned char ch){
-		const AUTO(p, static_cast<const unsigned char *>(std::memchr(HEX_TABLE, ch, sizeof(HEX_TABLE))));
-		if(!p){
-			return -1;
+		return HEX_REV_TABLE[ch & 0xFF];
+	}
+
+	// 以下函数返回已经处理的输入字节数，不会越界读写。
+	// 解码时遇到包含其他字符（包括空白字符）的字符对就停止，剩下的部分由调用者逐个字符处理。
+
+	std::size_t encode_blocks_generic(unsigned char *str, const unsigned char *data, std::size_t size, bool upper_case) NOEXCEPT {
+		unsigned char *write = str;
+		for(std::size_t i = 0; i < size; ++i){
+			const unsigned ch = data[i];
+			write[0] = to_hex_digit(ch >> 4, upper_case);
+			write[1] = to_hex_digit(ch >> 0, upper_case);
+			write += 2;
+		}
+		return size;
+	}
+	std::size_t decode_blocks_generic(unsigned char *data, const unsigned char *str, std::size_t len) NOEXCEPT {
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(len - read >= 2){
+			const int hi = from_hex_digit(str[read]);
+			const int lo = from_hex_digit(str[read + 1]);
+			if((hi | lo) < 0){
+				break;
+			}
+			*(write++) = static_cast<unsigned char>((hi << 4) | lo);
+			read += 2;
+		}
+		return read;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	// 编码时把每个字节的高低半字节分别查表，然后交错排列。
+	// 解码时 '0'..'9' 减去 '0'，字母转换为小写之后减去 'a' 再加上 10，任何一个字符不满足就放弃这个向量，
+	// 然后用 PMADDUBSW 把相邻的两个值合并成一个字节。
+
+	__attribute__((__target__("ssse3")))
+	std::size_t encode_blocks_ssse3(unsigned char *str, const unsigned char *data, std::size_t size, bool upper_case) NOEXCEPT {
+		const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(HEX_TABLE + upper_case * sizeof(HEX_TABLE) / 2));
+		std::size_t read = 0;
+		unsigned char *write = str;
+		while(size - read >= 16){
+			const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + read));
+			const __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(in, 4), _mm_set1_epi8(0x0F)));
+			const __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(in, _mm_set1_epi8(0x0F)));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(write), _mm_unpacklo_epi8(hi, lo));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(write + 16), _mm_unpackhi_epi8(hi, lo));
+			read += 16;
+			write += 32;
+		}
+		return read + encode_blocks_generic(write, data + read, size - read, upper_case);
+	}
+	__attribute__((__target__("ssse3")))
+	bool decode_vector_ssse3(__m128i &values, __m128i in) NOEXCEPT {
+		const __m128i digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+		const __m128i digit_valid = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+		const __m128i alpha = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		const __m128i alpha_valid = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+		if(_mm_movemask_epi8(_mm_or_si128(digit_valid, alpha_valid)) != 0xFFFF){
+			return false;
+		}
+		values = _mm_or_si128(_mm_and_si128(digit_valid, digit), _mm_and_si128(alpha_valid, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+		return true;
+	}
+	__attribute__((__target__("ssse3")))
+	std::size_t decode_blocks_ssse3(unsigned char *data, const unsigned char *str, std::size_t len) NOEXCEPT {
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(len - read >= 32){
+			__m128i v0, v1;
+			if(!decode_vector_ssse3(v0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + read)))){
+				break;
+			}
+			if(!decode_vector_ssse3(v1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + read + 16)))){
+				break;
+			}
+			const __m128i weights = _mm_set1_epi16(0x0110);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(write), _mm_packus_epi16(_mm_maddubs_epi16(v0, weights), _mm_maddubs_epi16(v1, weights)));
+			read += 32;
+			write += 16;
+		}
+		return read + decode_blocks_generic(write, str + read, len - read);
+	}
+
+	__attribute__((__target__("avx2")))
+	std::size_t encode_blocks_avx2(unsigned char *str, const unsigned char *data, std::size_t size, bool upper_case) NOEXCEPT {
+		const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(HEX_TABLE + upper_case * sizeof(HEX_TABLE) / 2)));
+		std::size_t read = 0;
+		unsigned char *write = str;
+		while(size - read >= 32){
+			const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + read));
+			const __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(in, 4), _mm256_set1_epi8(0x0F)));
+			const __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(in, _mm256_set1_epi8(0x0F)));
+			// 交错排列是在每个 128 位的通道之内进行的。
+			const __m256i first = _mm256_unpacklo_epi8(hi, lo);
+			const __m256i second = _mm256_unpackhi_epi8(hi, lo);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(write), _mm256_permute2x128_si256(first, second, 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(write + 32), _mm256_permute2x128_si256(first, second, 0x31));
+			read += 32;
+			write += 64;
+		}
+		return read + encode_blocks_ssse3(write, data + read, size - read, upper_case);
+	}
+	__attribute__((__target__("avx2")))
+	bool decode_vector_avx2(__m256i &values, __m256i in) NOEXCEPT {
+		const __m256i digit = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+		const __m256i digit_valid = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+		const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(in, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+		const __m256i alpha_valid = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+		if(_mm256_movemask_epi8(_mm256_or_si256(digit_valid, alpha_valid)) != -1){
+			return false;
+		}
+		values = _mm256_or_si256(_mm256_and_si256(digit_valid, digit), _mm256_and_si256(alpha_valid, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+		return true;
+	}
+	__attribute__((__target__("avx2")))
+	std::size_t decode_blocks_avx2(unsigned char *data, const unsigned char *str, std::size_t len) NOEXCEPT {
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(len - read >= 64){
+			__m256i v0, v1;
+			if(!decode_vector_avx2(v0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + read)))){
+				break;
+			}
+			if(!decode_vector_avx2(v1, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + read + 32)))){
+				break;
+			}
+			const __m256i weights = _mm256_set1_epi16(0x0110);
+			// 打包也是在每个 128 位的通道之内进行的，需要重新排列 64 位的部分。
+			const __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(v0, weights), _mm256_maddubs_epi16(v1, weights));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(write), _mm256_permute4x64_epi64(packed, 0xD8));
+			read += 64;
+			write += 32;
+		}
+		return read + decode_blocks_ssse3(write, str + read, len - read);
+	}
+#endif
+
+	typedef std::size_t (*EncodeProc)(unsigned char *str, const unsigned char *data, std::size_t size, bool upper_case);
+	typedef std::size_t (*DecodeProc)(unsigned char *data, const unsigned char *str, std::size_t len);
+
+	struct BlockProcs {
+		EncodeProc encode;
+		DecodeProc decode;
+	};
+
+	BlockProcs choose_block_procs() NOEXCEPT {
+		BlockProcs procs = { &encode_blocks_generic, &decode_blocks_generic };
+#if defined(__x86_64__) || defined(__i386__)
+		if(__builtin_cpu_supports("avx2")){
+			procs.encode = &encode_blocks_avx2;
+			procs.decode = &decode_blocks_avx2;
+		} else if(__builtin_cpu_supports("ssse3")){
+			procs.encode = &encode_blocks_ssse3;
+			procs.decode = &decode_blocks_ssse3;
 		}
-		return (p - HEX_TABLE) & 0x0F;
+#endif
+		return procs;
+	}
+
+	const BlockProcs &get_block_procs(){
+		static const BlockProcs s_procs = choose_block_procs();
+		return s_procs;
+	}
+
+	unsigned char *encode(unsigned char *str, const unsigned char *data, std::size_t size, bool upper_case){
+		const std::size_t n = (*(get_block_procs().encode))(str, data, size, upper_case);
+		return str + n * 2;
 	}
+
+	// seq 的含义与 HexDecoder::m_seq 相同。返回输出的结尾。
+	unsigned char *decode(unsigned &seq, unsigned char *data, const unsigned char *str, std::size_t len){
+		std::size_t read = 0;
+		unsigned char *write = data;
+		while(read < len){
+			if(seq == 1){
+				const std::size_t n = (*(get_block_procs().decode))(write, str + read, len - read);
+				read += n;
+				write += n / 2;
+				if(read == len){
+					break;
+				}
+			}
+			const unsigned char ch = str[read++];
+			if((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n')){
+				continue;
+			}
+			const int digit = from_hex_digit(ch);
+			DEBUG_THROW_UNLESS(digit >= 0, Exception, sslit("Invalid hex character encountered"));
+			const unsigned next = (seq << 4) + static_cast<unsigned>(digit);
+			if(next >= 0x0100){
+				*(write++) = static_cast<unsigned char>(next);
+				seq = 1;
+			} else {
+				seq = next;
+			}
+		}
+		return write;
+	}
+
+	// 流式接口每次最多处理这么多输入，输出先写到栈上的缓冲区中。
+	CONSTEXPR const std::size_t STREAMING_STEP = 2048;
 }
 
 HexEncoder::HexEncoder(bool upper_case)
@@ -37,10 +256,13 @@ void HexEncoder::clear(){
 void HexEncoder::put(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	for(std::size_t i = 0; i < size; ++i){
-		const unsigned ch = static_cast<const unsigned char *>(data)[i];
-		m_buffer.put(to_hex_digit(ch >> 4, m_upper_case));
-		m_buffer.put(to_hex_digit(ch >> 0, m_upper_case));
+	unsigned char temp[STREAMING_STEP * 2];
+	std::size_t read = 0;
+	while(read < size){
+		const std::size_t n = std::min(size - read, STREAMING_STEP);
+		const unsigned char *const end = encode(temp, static_cast<const unsigned char *>(data) + read, n, m_upper_case);
+		m_buffer.put(temp, static_cast<std::size_t>(end - temp));
+		read += n;
 	}
 }
 void HexEncoder::put(const StreamBuffer &buffer){
@@ -73,21 +295,13 @@ void HexDecoder::clear(){
 void HexDecoder::put(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	for(std::size_t i = 0; i < size; ++i){
-		const unsigned char ch = static_cast<const unsigned char *>(data)[i];
-		if((ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n')){
-			continue;
-		}
-		const int digit = from_hex_digit(ch);
-		DEBUG_THROW_UNLESS(digit >= 0, Exception, sslit("Invalid hex character encountered"));
-		unsigned seq = m_seq << 4;
-		seq += static_cast<unsigned>(digit);
-		if(seq >= 0x0100){
-			m_buffer.put(seq & 0xFF);
-			m_seq = 1;
-		} else {
-			m_seq = seq;
-		}
+	unsigned char temp[STREAMING_STEP / 2 + 1];
+	std::size_t read = 0;
+	while(read < size){
+		const std::size_t n = std::min(size - read, STREAMING_STEP);
+		const unsigned char *const end = decode(m_seq, temp, static_cast<const unsigned char *>(data) + read, n);
+		m_buffer.put(temp, static_cast<std::size_t>(end - temp));
+		read += n;
 	}
 }
 void HexDecoder::put(const StreamBuffer &buffer){
@@ -109,48 +323,55 @@ StreamBuffer HexDecoder::finalize(){
 	return ret;
 }
 
+std::size_t hex_encode_to(char *str, const void *data, std::size_t size, bool upper_case){
+	unsigned char *const begin = reinterpret_cast<unsigned char *>(str);
+	const unsigned char *const end = encode(begin, static_cast<const unsigned char *>(data), size, upper_case);
+	return static_cast<std::size_t>(end - begin);
+}
+std::size_t hex_decode_to(void *data, const char *str, std::size_t len){
+	unsigned seq = 1;
+	unsigned char *const begin = static_cast<unsigned char *>(data);
+	const unsigned char *const end = decode(seq, begin, reinterpret_cast<const unsigned char *>(str), len);
+	DEBUG_THROW_UNLESS(seq == 1, Exception, sslit("Incomplete hex data"));
+	return static_cast<std::size_t>(end - begin);
+}
+
 std::string hex_encode(const void *data, std::size_t size, bool upper_case){
 	PROFILE_ME;
 
-	HexEncoder enc(upper_case);
-	enc.put(data, size);
-	return enc.get_buffer().dump_string();
+	std::string str;
+	if(size != 0){
+		str.resize(get_hex_encoded_size(size));
+		hex_encode_to(&str[0], data, size, upper_case);
+	}
+	return str;
 }
 std::string hex_encode(const char *str, bool upper_case){
-	PROFILE_ME;
-
-	HexEncoder enc(upper_case);
-	enc.put(str);
-	return enc.get_buffer().dump_string();
+	return hex_encode(str, std::strlen(str), upper_case);
 }
 std::string hex_encode(const std::string &str, bool upper_case){
-	PROFILE_ME;
-
-	HexEncoder enc(upper_case);
-	enc.put(str);
-	return enc.get_buffer().dump_string();
+	return hex_encode(str.data(), str.size(), upper_case);
 }
 
 std::string hex_decode(const void *data, std::size_t size){
 	PROFILE_ME;
 
-	HexDecoder dec;
-	dec.put(data, size);
-	return dec.get_buffer().dump_string();
+	// 和以前一样，落单的半个字节被丢弃。
+	std::string str;
+	if(size != 0){
+		str.resize(get_hex_decoded_size_max(size));
+		unsigned seq = 1;
+		unsigned char *const begin = reinterpret_cast<unsigned char *>(&str[0]);
+		const unsigned char *const end = decode(seq, begin, static_cast<const unsigned char *>(data), size);
+		str.resize(static_cast<std::size_t>(end - begin));
+	}
+	return str;
 }
 std::string hex_decode(const char *str){
-	PROFILE_ME;
-
-	HexDecoder dec;
-	dec.put(str);
-	return dec.get_buffer().dump_string();
+	return hex_decode(str, std::strlen(str));
 }
 std::string hex_decode(const std::string &str){
-	PROFILE_ME;
-
-	HexDecoder dec;
-	dec.put(str);
-	return dec.get_buffer().dump_string();
+	return hex_decode(str.data(), str.size());
 }
 
 }
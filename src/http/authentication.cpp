@@ -19,60 +19,132 @@
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	void finalize_as_hex(char *str, Md5_ostream &md5_os){
+		static CONSTEXPR const char HEX_TABLE[] = "0123456789abcdef";
+		const AUTO(md5, md5_os.finalize());
+		char *write = str;
+		for(unsigned i = 0; i < 16; ++i){
+			*(write++) = HEX_TABLE[md5[i] / 16];
+			*(write++) = HEX_TABLE[md5[i] % 16];
+		}
+		*write = 0;
+	}
+}
+
 class AuthenticationContext : NONCOPYABLE {
+public:
+	struct User {
+		std::string username;
+		std::string password;
+		char ha1[33]; // MD5(username:realm:password)，在创建上下文时计算。
+	};
+
 private:
-	struct PasswordComparator {
-		bool operator()(const std::string &lhs, const char *rhs) const {
-			return ::strcasecmp(lhs.c_str(), rhs);
+	struct UserComparator {
+		bool operator()(const User &lhs, const char *rhs) const {
+			return ::strcasecmp(lhs.username.c_str(), rhs) < 0;
 		}
-		bool operator()(const char *lhs, const std::string &rhs) const {
-			return ::strcasecmp(lhs, rhs.c_str());
+		bool operator()(const char *lhs, const User &rhs) const {
+			return ::strcasecmp(lhs, rhs.username.c_str()) < 0;
 		}
 	};
 
 private:
 	const std::string m_realm;
+	const boost::uint64_t m_nonce_expiry_time;
+	const boost::uint64_t m_cache_expiry_time;
 
-	boost::container::vector<std::string> m_passwords;
+	boost::container::vector<User> m_users;
 
 public:
-	explicit AuthenticationContext(std::string realm)
-		: m_realm(STD_MOVE(realm))
+	AuthenticationContext(std::string realm, boost::uint64_t nonce_expiry_time, boost::uint64_t cache_expiry_time)
+		: m_realm(STD_MOVE(realm)), m_nonce_expiry_time(nonce_expiry_time), m_cache_expiry_time(cache_expiry_time)
 	{ }
 
 public:
 	const std::string &get_realm() const {
 		return m_realm;
 	}
+	boost::uint64_t get_nonce_expiry_time() const {
+		return m_nonce_expiry_time;
+	}
+	boost::uint64_t get_cache_expiry_time() const {
+		return m_cache_expiry_time;
+	}
 
-	std::pair<const char *, const char *> get_password(const char *username) const {
-		const AUTO(range, std::equal_range(m_passwords.begin(), m_passwords.end(), username, PasswordComparator()));
+	const User *get_user(const char *username) const {
+		const AUTO(range, std::equal_range(m_users.begin(), m_users.end(), username, UserComparator()));
 		if(range.first == range.second){
-			return VAL_INIT;
+			return NULLPTR;
 		}
-		return std::make_pair(range.first->c_str(), range.first->c_str() + std::strlen(username) + 1);
-	}
-	void set_password(const char *username, const char *password){
-		std::string str;
-		str += username;
-		str += '\0';
-		str += password;
-		const AUTO(range, std::equal_range(m_passwords.begin(), m_passwords.end(), username, PasswordComparator()));
+		return &*range.first;
+	}
+	void set_user(const char *username, const char *password){
+		User user;
+		user.username = username;
+		user.password = password;
+		Md5_ostream md5_os;
+		md5_os <<username <<':' <<m_realm <<':' <<password;
+		finalize_as_hex(user.ha1, md5_os);
+		const AUTO(range, std::equal_range(m_users.begin(), m_users.end(), username, UserComparator()));
 		if(range.first == range.second){
-			m_passwords.insert(range.first, STD_MOVE(str));
+			m_users.insert(range.first, STD_MOVE(user));
 		} else {
-			range.first->swap(str);
+			*range.first = STD_MOVE(user);
 		}
 	}
 };
 
+const char *AuthenticationCache::get(const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, Verb verb, const std::string &header_value) const {
+	PROFILE_ME;
+
+	if(!m_username || (m_context != context) || (m_is_proxy != is_proxy) || (m_header_value != header_value)){
+		return NULLPTR;
+	}
+	if((m_verb != V_INVALID_VERB) && (m_verb != verb)){
+		return NULLPTR;
+	}
+	if(get_fast_mono_clock() >= m_expiry_time){
+		return NULLPTR;
+	}
+	return m_username;
+}
+void AuthenticationCache::set(const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, Verb verb, const std::string &header_value, const char *username, boost::uint64_t valid_until){
+	PROFILE_ME;
+
+	const AUTO(cache_expiry_time, context ? context->get_cache_expiry_time() : 0);
+	if(cache_expiry_time == 0){
+		clear();
+		return;
+	}
+	AUTO(expiry_time, saturated_add(get_fast_mono_clock(), cache_expiry_time));
+	if((valid_until != 0) && (valid_until < expiry_time)){
+		expiry_time = valid_until;
+	}
+	m_context = context;
+	m_is_proxy = is_proxy;
+	m_verb = verb;
+	m_header_value = header_value;
+	m_username = username;
+	m_expiry_time = expiry_time;
+}
+void AuthenticationCache::clear() NOEXCEPT {
+	m_context.reset();
+	m_header_value.clear();
+	m_username = NULLPTR;
+	m_expiry_time = 0;
+}
+
 boost::shared_ptr<const AuthenticationContext> create_authentication_context(
 	const std::string &realm, const boost::container::vector<std::string> &basic_user_pass)
 {
 	PROFILE_ME;
 	DEBUG_THROW_UNLESS(!basic_user_pass.empty(), BasicException, sslit("No username:password provided"));
 
-	AUTO(context, boost::make_shared<AuthenticationContext>(realm));
+	const AUTO(nonce_expiry_time, MainConfig::get<boost::uint64_t>("http_digest_nonce_expiry_time", 60000));
+	const AUTO(cache_expiry_time, MainConfig::get<boost::uint64_t>("http_auth_cache_expiry_time", 60000));
+	AUTO(context, boost::make_shared<AuthenticationContext>(realm, nonce_expiry_time, cache_expiry_time));
 	std::string str;
 	for(AUTO(it, basic_user_pass.begin()); it != basic_user_pass.end(); ++it){
 		str = *it;
@@ -81,9 +153,8 @@ boost::shared_ptr<const AuthenticationContext> create_authentication_context(
 		pos = str.find(':');
 		DEBUG_THROW_UNLESS(pos != std::string::npos, BasicException, sslit("Colon delimiter not found"));
 		str.at(pos) = 0;
-		const AUTO(old_password, context->get_password(str.c_str()).second);
-		DEBUG_THROW_UNLESS(!old_password, BasicException, sslit("Duplicate username"));
-		context->set_password(str.c_str(), str.c_str() + pos + 1);
+		DEBUG_THROW_UNLESS(!context->get_user(str.c_str()), BasicException, sslit("Duplicate username"));
+		context->set_user(str.c_str(), str.c_str() + pos + 1);
 	}
 	return STD_MOVE_IDN(context);
 }
@@ -196,17 +267,17 @@ std::pair<AuthenticationResult, const char *> check_authentication_basic(
 	}
 	auth_str.at(colon_pos) = 0;
 
-	const AUTO(pair, context->get_password(auth_str.c_str()));
-	if(!pair.second){
+	const AUTO(user, context->get_user(auth_str.c_str()));
+	if(!user){
 		LOG_POSEIDON_DEBUG("User not found: ", auth_str);
 		return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
 	}
-	if(::strcmp(auth_str.c_str() + colon_pos + 1, pair.second) != 0){
+	if(::strcmp(auth_str.c_str() + colon_pos + 1, user->password.c_str()) != 0){
 		LOG_POSEIDON_DEBUG("Password incorrect: ", auth_str);
 		return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
 	}
-	LOG_POSEIDON_INFO("HTTP authentication succeeded (using password via the Basic scheme): ", pair.first);
-	return std::make_pair(AUTH_SUCCEEDED, pair.first);
+	LOG_POSEIDON_INFO("HTTP authentication succeeded (using password via the Basic scheme): ", user->username);
+	return std::make_pair(AUTH_SUCCEEDED, user->username.c_str());
 }
 __attribute__((__noreturn__)) void throw_authentication_failure_basic(
 	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, AuthenticationResult result)
@@ -225,7 +296,7 @@ namespace {
 
 	struct Nonce {
 		boost::uint32_t server_id; // g_server_id
-		boost::uint32_t reserved;
+		boost::uint32_t salt;      // 使每个 nonce 都不相同。
 		boost::uint64_t timestamp; // get_utc_time()
 	};
 	BOOST_STATIC_ASSERT(sizeof(Nonce) == 16);
@@ -233,7 +304,7 @@ namespace {
 	void create_nonce(Nonce *nonce){
 		nonce->server_id = g_server_id;
 		nonce->timestamp = get_utc_time();
-		nonce->reserved  = 0;
+		nonce->salt      = secure_random_uint32();
 	}
 	void encrypt_nonce(char *str, const Nonce *nonce, const char *key){
 		Md5_ostream md5_os;
@@ -280,16 +351,10 @@ namespace {
 		return true;
 	}
 
-	void finalize_as_hex(char *str, Md5_ostream &md5_os){
-		static CONSTEXPR const char HEX_TABLE[] = "0123456789abcdef";
-		const AUTO(md5, md5_os.finalize());
-		char *write = str;
-		for(unsigned i = 0; i < 16; ++i){
-			*(write++) = HEX_TABLE[md5[i] / 16];
-			*(write++) = HEX_TABLE[md5[i] % 16];
-		}
-		*write = 0;
-	}
+	// 认证成功时 valid_until 为 nonce 过期的 get_fast_mono_clock() 时间。
+	std::pair<AuthenticationResult, const char *> do_check_authentication_digest(
+		const boost::shared_ptr<const AuthenticationContext> &context, const IpPort &remote_info, Verb verb, const std::string &header_value,
+		boost::uint64_t &valid_until);
 }
 
 // Digest
@@ -298,150 +363,168 @@ std::pair<AuthenticationResult, const char *> check_authentication_digest(
 {
 	PROFILE_ME;
 
-	if(!context){
-		LOG_POSEIDON_INFO("HTTP authentication succeeded (assuming anonymous).");
-		return std::make_pair(AUTH_SUCCEEDED, NULLPTR);
-	}
-	if(header_value.empty()){
-		return std::make_pair(AUTH_HEADER_NOT_SET, NULLPTR);
-	}
-	if(::strncasecmp(header_value.c_str(), "Digest ", 7) != 0){
-		LOG_POSEIDON_WARNING("HTTP authentication scheme not supported: ", header_value);
-		return std::make_pair(AUTH_SCHEME_NOT_SUPPORTED, NULLPTR);
-	}
+	boost::uint64_t valid_until;
+	return do_check_authentication_digest(context, remote_info, verb, header_value, valid_until);
+}
+
+namespace {
+	std::pair<AuthenticationResult, const char *> do_check_authentication_digest(
+		const boost::shared_ptr<const AuthenticationContext> &context, const IpPort &remote_info, Verb verb, const std::string &header_value,
+		boost::uint64_t &valid_until)
+	{
+		PROFILE_ME;
 
-	OptionalMap params;
-	Buffer_istream bis;
-	bis.set_buffer(StreamBuffer(header_value.c_str() + 7));
-	std::string seg;
-	for(;;){
-		seg.clear();
-		bool quoted = false;
-		bool escaped = false;
-		char ch;
-		while(bis.get(ch)){
-			if(quoted){
-				if(escaped){
+		if(!context){
+			LOG_POSEIDON_INFO("HTTP authentication succeeded (assuming anonymous).");
+			return std::make_pair(AUTH_SUCCEEDED, NULLPTR);
+		}
+		if(header_value.empty()){
+			return std::make_pair(AUTH_HEADER_NOT_SET, NULLPTR);
+		}
+		if(::strncasecmp(header_value.c_str(), "Digest ", 7) != 0){
+			LOG_POSEIDON_WARNING("HTTP authentication scheme not supported: ", header_value);
+			return std::make_pair(AUTH_SCHEME_NOT_SUPPORTED, NULLPTR);
+		}
+
+		OptionalMap params;
+		Buffer_istream bis;
+		bis.set_buffer(StreamBuffer(header_value.c_str() + 7));
+		std::string seg;
+		for(;;){
+			seg.clear();
+			bool quoted = false;
+			bool escaped = false;
+			char ch;
+			while(bis.get(ch)){
+				if(quoted){
+					if(escaped){
+						seg += ch;
+						escaped = false;
+						continue;
+					}
+					if(ch == '\\'){
+						escaped = true;
+						continue;
+					}
+					if(ch == '\"'){
+						quoted = false;
+						continue;
+					}
 					seg += ch;
-					escaped = false;
-					continue;
-				}
-				if(ch == '\\'){
-					escaped = true;
 					continue;
 				}
 				if(ch == '\"'){
-					quoted = false;
+					quoted = true;
 					continue;
 				}
+				if(ch == ','){
+					break;
+				}
 				seg += ch;
-				continue;
 			}
-			if(ch == '\"'){
-				quoted = true;
+			if(seg.empty()){
+				break;
+			}
+			LOG_POSEIDON_TRACE("> Parsing: ", seg);
+
+			std::size_t key_begin = seg.find_first_not_of(" \t");
+			if(key_begin == std::string::npos){
 				continue;
 			}
-			if(ch == ','){
-				break;
+			std::size_t equ = seg.find('=', key_begin);
+			if(equ == std::string::npos){
+				LOG_POSEIDON_WARNING("Invalid HTTP Digest authentication header, equals sign not found: ", seg);
+				return std::make_pair(AUTH_HEADER_FORMAT_ERROR, NULLPTR);
 			}
-			seg += ch;
-		}
-		if(seg.empty()){
-			break;
+			std::size_t key_end = seg.find_last_not_of(" \t", equ - 1);
+			if((key_end == std::string::npos) || (key_begin > key_end)){
+				LOG_POSEIDON_WARNING("Invalid HTTP Digest authentication header, no key specified: ", seg);
+				return std::make_pair(AUTH_HEADER_FORMAT_ERROR, NULLPTR);
+			}
+			++key_end;
+			SharedNts key(seg.data() + key_begin, static_cast<std::size_t>(key_end - key_begin));
+			if(equ == std::string::npos){
+				seg.clear();
+			} else {
+				seg.erase(0, equ + 1);
+			}
+			std::string value(trim(STD_MOVE(seg)));
+			LOG_POSEIDON_DEBUG("> Digest parameter: ", key, " = ", value);
+			params.append(STD_MOVE(key), STD_MOVE(value));
 		}
-		LOG_POSEIDON_TRACE("> Parsing: ", seg);
 
-		std::size_t key_begin = seg.find_first_not_of(" \t");
-		if(key_begin == std::string::npos){
-			continue;
-		}
-		std::size_t equ = seg.find('=', key_begin);
-		if(equ == std::string::npos){
-			LOG_POSEIDON_WARNING("Invalid HTTP Digest authentication header, equals sign not found: ", seg);
+		const AUTO_REF(response_str, params.get("response"));
+		if(response_str.empty()){
+			LOG_POSEIDON_DEBUG("No digest response set?");
 			return std::make_pair(AUTH_HEADER_FORMAT_ERROR, NULLPTR);
 		}
-		std::size_t key_end = seg.find_last_not_of(" \t", equ - 1);
-		if((key_end == std::string::npos) || (key_begin > key_end)){
-			LOG_POSEIDON_WARNING("Invalid HTTP Digest authentication header, no key specified: ", seg);
+		const AUTO_REF(algorithm_str, params.get("algorithm"));
+		if(!algorithm_str.empty() && (::strcasecmp(algorithm_str.c_str(), "md5") != 0)){
+			LOG_POSEIDON_DEBUG("Unsupported algorithm: ", algorithm_str);
+			return std::make_pair(AUTH_ALGORITHM_NOT_SUPPORTED, NULLPTR);
+		}
+		const AUTO_REF(qop_str, params.get("qop"));
+		if(!qop_str.empty() && (::strcasecmp(qop_str.c_str(), "auth") != 0)){
+			LOG_POSEIDON_DEBUG("Unsupported QoP: ", qop_str);
+			return std::make_pair(AUTH_QOP_NOT_SUPPORTED, NULLPTR);
+		}
+
+		Nonce nonce[1];
+		const AUTO_REF(nonce_str, params.get("nonce"));
+		if(!decrypt_nonce(nonce, nonce_str.c_str(), remote_info.ip())){
+			LOG_POSEIDON_DEBUG("Failed to decrypt nonce: ", nonce_str);
 			return std::make_pair(AUTH_HEADER_FORMAT_ERROR, NULLPTR);
 		}
-		++key_end;
-		SharedNts key(seg.data() + key_begin, static_cast<std::size_t>(key_end - key_begin));
-		if(equ == std::string::npos){
-			seg.clear();
+		if(nonce->server_id != g_server_id){
+			LOG_POSEIDON_DEBUG("Server ID mismatch: ", std::hex, std::setfill('0'), std::setw(8), nonce->server_id);
+			return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
+		}
+		const AUTO(utc_now, get_utc_time());
+		const AUTO(nonce_expiry_time, context->get_nonce_expiry_time());
+		if(nonce->timestamp < saturated_sub(utc_now, nonce_expiry_time)){
+			LOG_POSEIDON_DEBUG("Nonce expired: ", nonce->timestamp);
+			return std::make_pair(AUTH_REQUEST_EXPIRED, NULLPTR);
+		}
+		const AUTO_REF(username_str, params.get("username"));
+		const AUTO(user, context->get_user(username_str.c_str()));
+		if(!user){
+			LOG_POSEIDON_DEBUG("User not found: ", username_str);
+			return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
+		}
+		const AUTO_REF(realm_str, params.get("realm"));
+		const AUTO_REF(cnonce_str, params.get("cnonce"));
+		const AUTO_REF(uri_str, params.get("uri"));
+		const AUTO_REF(nc_str, params.get("nc"));
+
+		Md5_ostream ha_md5_os, resp_md5_os;
+		char str[33];
+		// HA1 = MD5(username:realm:password)
+		if((username_str == user->username) && (realm_str == context->get_realm())){
+			std::memcpy(str, user->ha1, sizeof(str));
 		} else {
-			seg.erase(0, equ + 1);
+			ha_md5_os <<username_str <<':' <<realm_str <<':' <<user->password;
+			finalize_as_hex(str, ha_md5_os);
 		}
-		std::string value(trim(STD_MOVE(seg)));
-		LOG_POSEIDON_DEBUG("> Digest parameter: ", key, " = ", value);
-		params.append(STD_MOVE(key), STD_MOVE(value));
-	}
-
-	const AUTO_REF(response_str, params.get("response"));
-	if(response_str.empty()){
-		LOG_POSEIDON_DEBUG("No digest response set?");
-		return std::make_pair(AUTH_HEADER_FORMAT_ERROR, NULLPTR);
-	}
-	const AUTO_REF(algorithm_str, params.get("algorithm"));
-	if(!algorithm_str.empty() && (::strcasecmp(algorithm_str.c_str(), "md5") != 0)){
-		LOG_POSEIDON_DEBUG("Unsupported algorithm: ", algorithm_str);
-		return std::make_pair(AUTH_ALGORITHM_NOT_SUPPORTED, NULLPTR);
-	}
-	const AUTO_REF(qop_str, params.get("qop"));
-	if(!qop_str.empty() && (::strcasecmp(qop_str.c_str(), "auth") != 0)){
-		LOG_POSEIDON_DEBUG("Unsupported QoP: ", qop_str);
-		return std::make_pair(AUTH_QOP_NOT_SUPPORTED, NULLPTR);
-	}
-
-	Nonce nonce[1];
-	const AUTO_REF(nonce_str, params.get("nonce"));
-	if(!decrypt_nonce(nonce, nonce_str.c_str(), remote_info.ip())){
-		LOG_POSEIDON_DEBUG("Failed to decrypt nonce: ", nonce_str);
-		return std::make_pair(AUTH_HEADER_FORMAT_ERROR, NULLPTR);
-	}
-	if(nonce->server_id != g_server_id){
-		LOG_POSEIDON_DEBUG("Server ID mismatch: ", std::hex, std::setfill('0'), std::setw(8), nonce->server_id);
-		return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
-	}
-	const AUTO(nonce_expiry_time, MainConfig::get<boost::uint64_t>("http_digest_nonce_expiry_time", 60000));
-	if(nonce->timestamp < saturated_sub(get_utc_time(), nonce_expiry_time)){
-		LOG_POSEIDON_DEBUG("Nonce expired: ", nonce->timestamp);
-		return std::make_pair(AUTH_REQUEST_EXPIRED, NULLPTR);
-	}
-	const AUTO_REF(username_str, params.get("username"));
-	const AUTO(pair, context->get_password(username_str.c_str()));
-	if(!pair.second){
-		LOG_POSEIDON_DEBUG("User not found: ", username_str);
-		return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
-	}
-	const AUTO_REF(realm_str, params.get("realm"));
-	const AUTO_REF(cnonce_str, params.get("cnonce"));
-	const AUTO_REF(uri_str, params.get("uri"));
-	const AUTO_REF(nc_str, params.get("nc"));
-
-	Md5_ostream ha_md5_os, resp_md5_os;
-	char str[33];
-	// HA1 = MD5(username:realm:password)
-	ha_md5_os <<username_str <<':' <<realm_str <<':' <<pair.second;
-	finalize_as_hex(str, ha_md5_os);
-	// Put the first and the second segments: response = MD5(HA1:nonce: ...
-	resp_md5_os <<str <<':' <<nonce_str <<':';
-	// HA2 = MD5(verb:uri)
-	ha_md5_os <<get_string_from_verb(verb) <<':' <<uri_str;
-	finalize_as_hex(str, ha_md5_os);
-	// Put segments in the middle if QoP is requested: response = ... nc:cnonce:qop: ...
-	if(!qop_str.empty()){
-		resp_md5_os <<nc_str <<':' <<cnonce_str <<':' <<qop_str <<':';
-	}
-	// Put the final segment: response = ... HA2)
-	resp_md5_os <<str;
-	finalize_as_hex(str, resp_md5_os);
-	if(::strcasecmp(response_str.c_str(), str) != 0){
-		LOG_POSEIDON_DEBUG("Digest incorrect: ", response_str, ", expecting ", str);
-		return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
+		// Put the first and the second segments: response = MD5(HA1:nonce: ...
+		resp_md5_os <<str <<':' <<nonce_str <<':';
+		// HA2 = MD5(verb:uri)
+		ha_md5_os <<get_string_from_verb(verb) <<':' <<uri_str;
+		finalize_as_hex(str, ha_md5_os);
+		// Put segments in the middle if QoP is requested: response = ... nc:cnonce:qop: ...
+		if(!qop_str.empty()){
+			resp_md5_os <<nc_str <<':' <<cnonce_str <<':' <<qop_str <<':';
+		}
+		// Put the final segment: response = ... HA2)
+		resp_md5_os <<str;
+		finalize_as_hex(str, resp_md5_os);
+		if(::strcasecmp(response_str.c_str(), str) != 0){
+			LOG_POSEIDON_DEBUG("Digest incorrect: ", response_str, ", expecting ", str);
+			return std::make_pair(AUTH_PASSWORD_INCORRECT, NULLPTR);
+		}
+		valid_until = saturated_add(get_fast_mono_clock(), saturated_sub(saturated_add(nonce->timestamp, nonce_expiry_time), utc_now));
+		LOG_POSEIDON_INFO("HTTP authentication succeeded (using password via the Digest scheme): ", user->username);
+		return std::make_pair(AUTH_SUCCEEDED, user->username.c_str());
 	}
-	LOG_POSEIDON_INFO("HTTP authentication succeeded (using password via the Digest scheme): ", pair.first);
-	return std::make_pair(AUTH_SUCCEEDED, pair.first);
 }
 __attribute__((__noreturn__)) void throw_authentication_failure_digest(
 	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, const IpPort &remote_info, AuthenticationResult result)
@@ -467,5 +550,50 @@ __attribute__((__noreturn__)) void throw_authentication_failure_digest(
 	do_throw_authentication_failure(is_proxy, bos.get_buffer().dump_string());
 }
 
+std::pair<AuthenticationResult, const char *> check_authentication(
+	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, const IpPort &remote_info, const RequestHeaders &request_headers,
+	AuthenticationCache &cache)
+{
+	PROFILE_ME;
+
+	if(!context){
+		LOG_POSEIDON_INFO("HTTP authentication succeeded (assuming anonymous).");
+		return std::make_pair(AUTH_SUCCEEDED, NULLPTR);
+	}
+	const AUTO_REF(header_value, request_headers.headers.get(is_proxy ? "Proxy-Authorization" : "Authorization"));
+	const AUTO(cached_username, cache.get(context, is_proxy, request_headers.verb, header_value));
+	if(cached_username){
+		LOG_POSEIDON_DEBUG("HTTP authentication succeeded (using cached credentials): ", cached_username);
+		return std::make_pair(AUTH_SUCCEEDED, cached_username);
+	}
+	if(::strncasecmp(header_value.c_str(), "Digest ", 7) == 0){
+		// Digest 的摘要包含请求方法。
+		boost::uint64_t valid_until;
+		const AUTO(pair, do_check_authentication_digest(context, remote_info, request_headers.verb, header_value, valid_until));
+		if(pair.first == AUTH_SUCCEEDED){
+			cache.set(context, is_proxy, request_headers.verb, header_value, pair.second, valid_until);
+		}
+		return pair;
+	}
+	const AUTO(pair, check_authentication(context, is_proxy, remote_info, request_headers));
+	if(pair.first == AUTH_SUCCEEDED){
+		cache.set(context, is_proxy, V_INVALID_VERB, header_value, pair.second);
+	}
+	return pair;
+}
+const char *check_authentication_simple(
+	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, const IpPort &remote_info, const RequestHeaders &request_headers,
+	AuthenticationCache &cache)
+{
+	PROFILE_ME;
+
+	const AUTO(pair, check_authentication(context, is_proxy, remote_info, request_headers, cache));
+	if(pair.first != AUTH_SUCCEEDED){
+		DEBUG_THROW_ASSERT(context);
+		throw_authentication_failure(context, is_proxy, remote_info, pair.first);
+	}
+	return pair.second;
+}
+
 }
 }
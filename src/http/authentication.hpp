@@ -6,6 +6,7 @@
 
 #include <string>
 #include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
 #include "request_headers.hpp"
 #include "../ip_port.hpp"
 
@@ -25,6 +26,31 @@ enum AuthenticationResult {
 
 class AuthenticationContext; // 没有定义的类，当作句柄使用。
 
+// 保存在每个连接中，记录上一次认证成功的请求。
+// 同一个连接上后续的请求如果带有完全相同的认证报头（Digest 方式还要求方法相同），在过期之前直接视为成功，不再解密 nonce 或者计算摘要。
+// 过期时间为 http_auth_cache_expiry_time，Digest 方式不会超过 nonce 本身的过期时间。
+class AuthenticationCache {
+private:
+	boost::shared_ptr<const AuthenticationContext> m_context;
+	bool m_is_proxy;
+	Verb m_verb;
+	std::string m_header_value;
+	const char *m_username;
+	boost::uint64_t m_expiry_time;
+
+public:
+	AuthenticationCache()
+		: m_context(), m_is_proxy(false), m_verb(V_INVALID_VERB), m_header_value(), m_username(NULLPTR), m_expiry_time(0)
+	{ }
+
+public:
+	// 命中时返回上一次认证得到的用户名，否则返回空指针。
+	const char *get(const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, Verb verb, const std::string &header_value) const;
+	// valid_until 为 0 表示只受 http_authentication_cache_expiry_time 限制，否则为 get_fast_mono_clock() 时间。
+	void set(const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, Verb verb, const std::string &header_value, const char *username, boost::uint64_t valid_until = 0);
+	void clear() NOEXCEPT;
+};
+
 // 以下是通用接口。
 // 创建一个认证上下文，参数 basic_user_pass 应当包含一系列的 username:password 字符串且不得为空。
 extern boost::shared_ptr<const AuthenticationContext> create_authentication_context(
@@ -38,6 +64,13 @@ __attribute__((__noreturn__)) extern void throw_authentication_failure(
 // 一站式接口：如果调用 check_authentication() 并成功则正常返回，否则调用 throw_authentication_failure() 而不返回。
 extern const char *check_authentication_simple(
 	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, const IpPort &remote_info, const RequestHeaders &request_headers);
+// 同上，但是首先查找 cache，认证成功时更新 cache。
+extern std::pair<AuthenticationResult, const char *> check_authentication(
+	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, const IpPort &remote_info, const RequestHeaders &request_headers,
+	AuthenticationCache &cache);
+extern const char *check_authentication_simple(
+	const boost::shared_ptr<const AuthenticationContext> &context, bool is_proxy, const IpPort &remote_info, const RequestHeaders &request_headers,
+	AuthenticationCache &cache);
 
 // 以下是各个认证方式的独立接口。
 // Basic
@@ -6,27 +6,43 @@
 #include "exception.hpp"
 #include "status_codes.hpp"
 #include "../singletons/job_dispatcher.hpp"
+#include "../singletons/epoll_daemon.hpp"
+#include "../singletons/main_config.hpp"
 #include "../log.hpp"
 #include "../job_base.hpp"
 #include "../profiler.hpp"
+#include "../pooled_allocator.hpp"
+#include "../atomic.hpp"
 
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	ConfigValue<boost::uint64_t> g_response_stream_max_pending("http_response_stream_max_pending", 1048576);
+}
+
 class Client::SyncJobBase : public JobBase {
 private:
 	const SocketBase::DelayedShutdownGuard m_guard;
 	const boost::weak_ptr<Client> m_weak_client;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
 
 protected:
 	explicit SyncJobBase(const boost::shared_ptr<Client> &client)
-		: m_guard(client), m_weak_client(client)
+		: m_guard(client), m_weak_client(client), m_priority(client->get_job_priority()), m_thread_hint(client->get_epoll_thread_index())
 	{ }
 
 private:
 	boost::weak_ptr<const void> get_category() const FINAL {
 		return m_weak_client;
 	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
+	}
 	void perform() FINAL {
 		PROFILE_ME;
 
@@ -76,6 +92,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
 		PROFILE_ME;
 
@@ -102,18 +121,92 @@ protected:
 	}
 };
 
+class Client::StreamHeadersJob : public Client::SyncJobBase {
+private:
+	ResponseHeaders m_response_headers;
+
+public:
+	StreamHeadersJob(const boost::shared_ptr<Client> &client, ResponseHeaders response_headers)
+		: SyncJobBase(client)
+		, m_response_headers(STD_MOVE(response_headers))
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
+		PROFILE_ME;
+
+		client->on_sync_response_stream_begin(STD_MOVE(m_response_headers));
+	}
+};
+
+class Client::StreamChunkJob : public Client::SyncJobBase {
+private:
+	boost::uint64_t m_entity_offset;
+	StreamBuffer m_chunk;
+
+public:
+	StreamChunkJob(const boost::shared_ptr<Client> &client, boost::uint64_t entity_offset, StreamBuffer chunk)
+		: SyncJobBase(client)
+		, m_entity_offset(entity_offset), m_chunk(STD_MOVE(chunk))
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
+		PROFILE_ME;
+
+		const std::size_t size = m_chunk.size();
+		client->on_sync_response_stream_chunk(m_entity_offset, STD_MOVE(m_chunk));
+		client->release_stream_pending(size);
+	}
+};
+
+class Client::StreamEndJob : public Client::SyncJobBase {
+private:
+	boost::uint64_t m_content_length;
+	OptionalMap m_trailers;
+
+public:
+	StreamEndJob(const boost::shared_ptr<Client> &client, boost::uint64_t content_length, OptionalMap trailers)
+		: SyncJobBase(client)
+		, m_content_length(content_length), m_trailers(STD_MOVE(trailers))
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
+		PROFILE_ME;
+
+		client->on_sync_response_stream_end(m_content_length, STD_MOVE(m_trailers));
+	}
+};
+
 Client::Client(const SockAddr &addr, bool use_ssl, bool verify_peer)
 	: LowLevelClient(addr, use_ssl, verify_peer)
+	, m_streaming(false)
+	, m_max_stream_pending(g_response_stream_max_pending.get()), m_stream_pending(0)
+{ }
+Client::Client(const boost::container::vector<SockAddr> &addrs, bool use_ssl, bool verify_peer)
+	: LowLevelClient(addrs, use_ssl, verify_peer)
+	, m_streaming(false)
+	, m_max_stream_pending(g_response_stream_max_pending.get()), m_stream_pending(0)
 { }
 Client::~Client(){ }
 
+void Client::release_stream_pending(std::size_t size){
+	PROFILE_ME;
+
+	const AUTO(old_pending, atomic_sub(m_stream_pending, size, ATOMIC_RELAXED) + size);
+	if((old_pending >= m_max_stream_pending) && (old_pending - size < m_max_stream_pending)){
+		EpollDaemon::mark_socket_readable(this);
+	}
+}
+
 void Client::on_connect(){
 	PROFILE_ME;
 
 	LowLevelClient::on_connect();
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ConnectJob>(virtual_shared_from_this<Client>()),
+		boost::allocate_shared<ConnectJob>(PooledAllocator<ConnectJob>(), virtual_shared_from_this<Client>()),
 		VAL_INIT);
 }
 void Client::on_read_hup(){
@@ -124,7 +217,7 @@ void Client::on_read_hup(){
 	}
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ReadHupJob>(virtual_shared_from_this<Client>()),
+		boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Client>()),
 		VAL_INIT);
 
 	LowLevelClient::on_read_hup();
@@ -137,25 +230,48 @@ void Client::on_low_level_response_headers(ResponseHeaders response_headers, boo
 
 	m_response_headers = STD_MOVE(response_headers);
 	m_entity.clear();
+
+	m_streaming = is_response_streamed(m_response_headers);
+	if(m_streaming){
+		const bool queued = JobDispatcher::enqueue(
+			boost::allocate_shared<StreamHeadersJob>(PooledAllocator<StreamHeadersJob>(), virtual_shared_from_this<Client>(), STD_MOVE(m_response_headers)),
+			VAL_INIT);
+		DEBUG_THROW_UNLESS(queued, BasicException, sslit("Job queue is full"));
+	}
 }
 void Client::on_low_level_response_entity(boost::uint64_t entity_offset, StreamBuffer entity){
 	PROFILE_ME;
 
-	(void)entity_offset;
+	if(m_streaming){
+		const std::size_t size = entity.size();
+		atomic_add(m_stream_pending, size, ATOMIC_RELAXED);
+		const bool queued = JobDispatcher::enqueue(
+			boost::allocate_shared<StreamChunkJob>(PooledAllocator<StreamChunkJob>(), virtual_shared_from_this<Client>(), entity_offset, STD_MOVE(entity)),
+			VAL_INIT);
+		DEBUG_THROW_UNLESS(queued, BasicException, sslit("Job queue is full"));
+		return;
+	}
 
 	m_entity.splice(entity);
 }
 boost::shared_ptr<UpgradedSessionBase> Client::on_low_level_response_end(boost::uint64_t content_length, OptionalMap headers){
 	PROFILE_ME;
 
-	(void)content_length;
+	if(m_streaming){
+		m_streaming = false;
+		const bool queued = JobDispatcher::enqueue(
+			boost::allocate_shared<StreamEndJob>(PooledAllocator<StreamEndJob>(), virtual_shared_from_this<Client>(), content_length, STD_MOVE(headers)),
+			VAL_INIT);
+		DEBUG_THROW_UNLESS(queued, BasicException, sslit("Job queue is full"));
+		return VAL_INIT;
+	}
 
 	for(AUTO(it, headers.begin()); it != headers.end(); ++it){
 		m_response_headers.headers.append(it->first, STD_MOVE(it->second));
 	}
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ResponseJob>(virtual_shared_from_this<Client>(), STD_MOVE(m_response_headers), STD_MOVE(m_entity)),
+		boost::allocate_shared<ResponseJob>(PooledAllocator<ResponseJob>(), virtual_shared_from_this<Client>(), STD_MOVE(m_response_headers), STD_MOVE(m_entity)),
 		VAL_INIT);
 
 	return VAL_INIT;
@@ -163,5 +279,37 @@ boost::shared_ptr<UpgradedSessionBase> Client::on_low_level_response_end(boost::
 
 void Client::on_sync_connect(){ }
 
+bool Client::is_response_streamed(const ResponseHeaders &response_headers){
+	PROFILE_ME;
+
+	(void)response_headers;
+
+	return false;
+}
+void Client::on_sync_response_stream_begin(ResponseHeaders response_headers){
+	PROFILE_ME;
+
+	(void)response_headers;
+}
+void Client::on_sync_response_stream_chunk(boost::uint64_t entity_offset, StreamBuffer chunk){
+	PROFILE_ME;
+
+	(void)entity_offset;
+	(void)chunk;
+}
+void Client::on_sync_response_stream_end(boost::uint64_t content_length, OptionalMap trailers){
+	PROFILE_ME;
+
+	(void)content_length;
+	(void)trailers;
+}
+
+bool Client::is_throttled() const {
+	if(atomic_load(m_stream_pending, ATOMIC_RELAXED) >= m_max_stream_pending){
+		return true;
+	}
+	return LowLevelClient::is_throttled();
+}
+
 }
 }
@@ -15,13 +15,21 @@ private:
 	class ConnectJob;
 	class ReadHupJob;
 	class ResponseJob;
+	class StreamHeadersJob;
+	class StreamChunkJob;
+	class StreamEndJob;
 
 private:
 	ResponseHeaders m_response_headers;
 	StreamBuffer m_entity;
+	bool m_streaming;
+
+	const boost::uint64_t m_max_stream_pending;
+	volatile boost::uint64_t m_stream_pending; // 已经收到但是还没有处理的流式正文的字节数。
 
 public:
 	explicit Client(const SockAddr &addr, bool use_ssl = false, bool verify_peer = true);
+	explicit Client(const boost::container::vector<SockAddr> &addrs, bool use_ssl = false, bool verify_peer = true);
 	~Client();
 
 protected:
@@ -32,6 +40,10 @@ protected:
 		return m_entity;
 	}
 
+private:
+	void release_stream_pending(std::size_t size);
+
+protected:
 	// TcpClientBase
 	void on_connect() OVERRIDE;
 	void on_read_hup() OVERRIDE;
@@ -45,6 +57,20 @@ protected:
 	virtual void on_sync_connect();
 
 	virtual void on_sync_response(ResponseHeaders response_headers, StreamBuffer entity) = 0;
+
+	// 流式接收响应正文。在 epoll 线程中调用，返回 true 则这个响应的正文不会保存在内存中，也不会调用 on_sync_response()，
+	// 而是依次调用 on_sync_response_stream_begin()、每收到一块数据（chunked 编码时为解码之后的数据）调用一次 on_sync_response_stream_chunk()、
+	// 最后调用 on_sync_response_stream_end()，chunked 编码的追加报头通过 trailers 传入。
+	// 这些函数都在以连接为类别的任务中按顺序调用。尚未处理的数据超过 http_response_stream_max_pending 时暂停读取这个连接。
+	// 代理服务器可以在这些函数中调用 Session 的 send_chunked_header()、send_chunk() 和 send_chunked_trailer() 直接转发，
+	// on_sync_response_stream_chunk() 返回之前这块数据一直计入未处理的字节数，因此下游处理得慢时上游的读取也随之暂停。
+	virtual bool is_response_streamed(const ResponseHeaders &response_headers);
+	virtual void on_sync_response_stream_begin(ResponseHeaders response_headers);
+	virtual void on_sync_response_stream_chunk(boost::uint64_t entity_offset, StreamBuffer chunk);
+	virtual void on_sync_response_stream_end(boost::uint64_t content_length, OptionalMap trailers);
+
+public:
+	bool is_throttled() const OVERRIDE;
 };
 
 }
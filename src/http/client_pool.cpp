@@ -0,0 +1,446 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "client_pool.hpp"
+#include "low_level_client.hpp"
+#include "verbs.hpp"
+#include "../singletons/main_config.hpp"
+#include "../singletons/epoll_daemon.hpp"
+#include "../singletons/workhorse_camp.hpp"
+#include "../exception.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+
+namespace Poseidon {
+
+template class PromiseContainer<Http::ClientPool::Response>;
+
+namespace Http {
+
+namespace {
+	std::string make_origin_key(const std::string &host, boost::uint16_t port, bool use_ssl){
+		std::string key;
+		key.reserve(host.size() + 16);
+		key += host;
+		key += ':';
+		key += boost::lexical_cast<std::string>(port);
+		if(use_ssl){
+			key += "/ssl";
+		}
+		return key;
+	}
+
+	bool is_idempotent(Verb verb){
+		switch(verb){
+		case V_GET:
+		case V_HEAD:
+		case V_PUT:
+		case V_DELETE:
+		case V_OPTIONS:
+		case V_TRACE:
+			return true;
+		default:
+			return false;
+		}
+	}
+}
+
+struct ClientPool::Request {
+	RequestHeaders request_headers;
+	StreamBuffer entity;
+	boost::shared_ptr<PromiseContainer<Response> > promise;
+	bool retried;
+};
+
+class ClientPool::PooledClient : public LowLevelClient {
+	friend ClientPool;
+
+private:
+	const boost::weak_ptr<ClientPool> m_weak_pool;
+
+	// 以下成员由 ClientPool::m_mutex 保护。
+	std::string m_key;
+	std::deque<boost::shared_ptr<Request> > m_in_flight; // 已经发出，正在等待响应的请求，按照发送的顺序排列。
+
+	// 以下成员只在 epoll 线程中访问。
+	bool m_response_started;
+	ResponseHeaders m_response_headers;
+	StreamBuffer m_entity;
+
+public:
+	PooledClient(const SockAddr &addr, bool use_ssl, bool verify_peer, const boost::weak_ptr<ClientPool> &weak_pool)
+		: LowLevelClient(addr, use_ssl, verify_peer)
+		, m_weak_pool(weak_pool), m_response_started(false)
+	{ }
+
+protected:
+	// TcpClientBase
+	void on_read_hup() OVERRIDE {
+		PROFILE_ME;
+
+		LowLevelClient::on_read_hup();
+
+		shutdown_write();
+	}
+	void on_close(int err_code) OVERRIDE {
+		PROFILE_ME;
+
+		LowLevelClient::on_close(err_code);
+
+		const AUTO(pool, m_weak_pool.lock());
+		if(pool){
+			pool->on_client_close(virtual_shared_from_this<PooledClient>(), err_code);
+		}
+	}
+
+	// ClientReader
+	bool is_response_entity_omitted() const OVERRIDE {
+		const AUTO(pool, m_weak_pool.lock());
+		if(!pool){
+			return false;
+		}
+		return pool->is_head_pending(this);
+	}
+
+	// LowLevelClient
+	void on_low_level_response_headers(ResponseHeaders response_headers, boost::uint64_t content_length) OVERRIDE {
+		PROFILE_ME;
+
+		(void)content_length;
+
+		m_response_started = true;
+		m_response_headers = STD_MOVE(response_headers);
+		m_entity.clear();
+	}
+	void on_low_level_response_entity(boost::uint64_t entity_offset, StreamBuffer entity) OVERRIDE {
+		PROFILE_ME;
+
+		(void)entity_offset;
+
+		m_entity.splice(entity);
+	}
+	boost::shared_ptr<UpgradedSessionBase> on_low_level_response_end(boost::uint64_t content_length, OptionalMap headers) OVERRIDE {
+		PROFILE_ME;
+
+		(void)content_length;
+
+		for(AUTO(it, headers.begin()); it != headers.end(); ++it){
+			m_response_headers.headers.append(it->first, STD_MOVE(it->second));
+		}
+		if((m_response_headers.status_code / 100 == 1) && (m_response_headers.status_code != ST_SWITCHING_PROTOCOLS)){
+			// 100 Continue 等临时响应，继续等待最终的响应。
+			return VAL_INIT;
+		}
+		m_response_started = false;
+
+		const AUTO(pool, m_weak_pool.lock());
+		if(!pool){
+			force_shutdown();
+			return VAL_INIT;
+		}
+		Response response;
+		response.response_headers = STD_MOVE(m_response_headers);
+		response.entity.swap(m_entity);
+		pool->on_client_response(virtual_shared_from_this<PooledClient>(), STD_MOVE(response));
+		return VAL_INIT;
+	}
+};
+
+void ClientPool::connect_proc(const boost::weak_ptr<ClientPool> &weak_pool, const std::string &key, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	const AUTO(pool, weak_pool.lock());
+	if(!pool){
+		request->promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("HTTP client pool has been destroyed"))), false);
+		return;
+	}
+
+	Mutex::UniqueLock lock(pool->m_mutex);
+	AUTO_REF(origin, pool->m_origins[key]);
+	// 排队期间可能已经有连接空闲了。
+	if(pool->unlocked_dispatch(origin, request)){
+		return;
+	}
+	const std::string host = origin.host;
+	const boost::uint16_t port = origin.port;
+	const bool use_ssl = origin.use_ssl;
+	lock.unlock();
+
+	boost::shared_ptr<PooledClient> client;
+	try {
+		client = boost::dynamic_pointer_cast<PooledClient>(pool->m_tcp_pool.acquire(host, port, use_ssl));
+		DEBUG_THROW_ASSERT(client);
+	} catch(...){
+		LOG_POSEIDON_WARNING("Failed to acquire HTTP client: key = ", key);
+		lock.lock();
+		AUTO_REF(failed_origin, pool->m_origins[key]);
+		if(pool->unlocked_dispatch(failed_origin, request)){
+			return;
+		}
+		if(!failed_origin.active.empty()){
+			// 连接数达到了上限，等待已有的连接空闲。
+			failed_origin.pending.push_back(request);
+			return;
+		}
+		lock.unlock();
+		request->promise->set_exception(STD_CURRENT_EXCEPTION(), false);
+		return;
+	}
+
+	lock.lock();
+	AUTO_REF(new_origin, pool->m_origins[key]);
+	client->m_key = key;
+	new_origin.active.push_back(client);
+	pool->unlocked_send(client, request);
+	while(!new_origin.pending.empty() && pool->unlocked_dispatch(new_origin, new_origin.pending.front())){
+		new_origin.pending.pop_front();
+	}
+}
+
+ClientPool::ClientPool(bool verify_peer)
+	: m_verify_peer(verify_peer)
+	, m_pipeline_depth(std::max<std::size_t>(MainConfig::get<std::size_t>("http_client_pool_pipeline_depth", 4), 1))
+	, m_tcp_pool(boost::bind(&ClientPool::create_client, this, _1, _2))
+{
+	LOG_POSEIDON_DEBUG("Http::ClientPool: pipeline_depth = ", m_pipeline_depth);
+}
+ClientPool::~ClientPool(){
+	boost::container::vector<boost::shared_ptr<Request> > requests;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+			AUTO_REF(origin, it->second);
+			for(AUTO(cit, origin.active.begin()); cit != origin.active.end(); ++cit){
+				AUTO_REF(client, *cit);
+				requests.insert(requests.end(), client->m_in_flight.begin(), client->m_in_flight.end());
+				client->m_in_flight.clear();
+				client->force_shutdown();
+			}
+			origin.active.clear();
+			requests.insert(requests.end(), origin.pending.begin(), origin.pending.end());
+			origin.pending.clear();
+		}
+	}
+	for(AUTO(it, requests.begin()); it != requests.end(); ++it){
+		(*it)->promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("HTTP client pool has been destroyed"))), false);
+	}
+}
+
+boost::shared_ptr<TcpClientBase> ClientPool::create_client(const SockAddr &sock_addr, bool use_ssl){
+	PROFILE_ME;
+
+	// 由 connect_proc() 通过 TcpClientPool::acquire() 调用，此时 this 一定由 shared_ptr 持有。
+	AUTO(client, boost::make_shared<PooledClient>(sock_addr, use_ssl, m_verify_peer, virtual_weak_from_this<ClientPool>()));
+	EpollDaemon::add_socket(client, true);
+	return client;
+}
+
+bool ClientPool::unlocked_dispatch(Origin &origin, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	// 优先使用没有请求的连接，否则使用正在等待的请求最少的连接。
+	// 不幂等的请求只能独占一个连接，之后也不能在它后面追加其他请求。
+	const bool idempotent = is_idempotent(request->request_headers.verb);
+	boost::shared_ptr<PooledClient> best;
+	for(AUTO(it, origin.active.begin()); it != origin.active.end(); ++it){
+		AUTO_REF(client, *it);
+		if(client->has_been_shutdown_write()){
+			continue;
+		}
+		const AUTO_REF(in_flight, client->m_in_flight);
+		if(in_flight.empty()){
+			best = client;
+			break;
+		}
+		if(!idempotent || (in_flight.size() >= m_pipeline_depth) || !is_idempotent(in_flight.front()->request_headers.verb)){
+			continue;
+		}
+		if(!best || (in_flight.size() < best->m_in_flight.size())){
+			best = client;
+		}
+	}
+	if(!best){
+		return false;
+	}
+	unlocked_send(best, request);
+	return true;
+}
+void ClientPool::unlocked_send(const boost::shared_ptr<PooledClient> &client, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	client->m_in_flight.push_back(request);
+	if(!client->send(request->request_headers, request->entity)){
+		// 连接已经关闭，on_client_close() 会处理这个请求。
+		LOG_POSEIDON_DEBUG("Failed to send HTTP request: remote = ", client->get_remote_info());
+	}
+}
+void ClientPool::unlocked_deactivate(Origin &origin, const boost::shared_ptr<PooledClient> &client){
+	PROFILE_ME;
+
+	const AUTO(it, std::find(origin.active.begin(), origin.active.end(), client));
+	if(it != origin.active.end()){
+		origin.active.erase(it);
+	}
+}
+
+void ClientPool::start_connecting(const std::string &key, const boost::shared_ptr<Request> &request){
+	PROFILE_ME;
+
+	// DNS 解析和建立连接都是阻塞的，所以交给工作者线程。
+	WorkhorseCamp::enqueue_isolated(boost::make_shared<Promise>(),
+		boost::bind(&ClientPool::connect_proc, virtual_weak_from_this<ClientPool>(), key, request));
+}
+
+bool ClientPool::is_head_pending(const PooledClient *client) const {
+	const Mutex::UniqueLock lock(m_mutex);
+	if(client->m_in_flight.empty()){
+		return false;
+	}
+	return client->m_in_flight.front()->request_headers.verb == V_HEAD;
+}
+void ClientPool::on_client_response(const boost::shared_ptr<PooledClient> &client, Response response){
+	PROFILE_ME;
+
+	std::string key;
+	boost::shared_ptr<Request> request;
+	boost::container::vector<boost::shared_ptr<Request> > requests_to_resend;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		key = client->m_key;
+		if(client->m_in_flight.empty()){
+			LOG_POSEIDON_WARNING("Unexpected HTTP response: remote = ", client->get_remote_info());
+			client->force_shutdown();
+			return;
+		}
+		request = client->m_in_flight.front();
+		client->m_in_flight.pop_front();
+
+		AUTO_REF(origin, m_origins[key]);
+		if(!is_keep_alive_enabled(response.response_headers) || (response.response_headers.status_code == ST_SWITCHING_PROTOCOLS)){
+			// 服务器会关闭这个连接，不会处理之后的请求，因此它们可以安全地重新发送。
+			unlocked_deactivate(origin, client);
+			client->shutdown_write();
+			requests_to_resend.insert(requests_to_resend.end(), client->m_in_flight.begin(), client->m_in_flight.end());
+			client->m_in_flight.clear();
+		} else if(client->m_in_flight.empty()){
+			while(!origin.pending.empty() && unlocked_dispatch(origin, origin.pending.front())){
+				origin.pending.pop_front();
+			}
+			if(client->m_in_flight.empty()){
+				unlocked_deactivate(origin, client);
+				m_tcp_pool.release(client);
+			}
+		}
+	}
+	request->promise->set_success(STD_MOVE(response), false);
+
+	for(AUTO(it, requests_to_resend.begin()); it != requests_to_resend.end(); ++it){
+		start_connecting(key, *it);
+	}
+}
+void ClientPool::on_client_close(const boost::shared_ptr<PooledClient> &client, int err_code){
+	PROFILE_ME;
+
+	std::string key;
+	boost::container::vector<boost::shared_ptr<Request> > requests_to_resend, requests_to_fail;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		key = client->m_key;
+		const AUTO(it, m_origins.find(key));
+		if(it == m_origins.end()){
+			return;
+		}
+		AUTO_REF(origin, it->second);
+		unlocked_deactivate(origin, client);
+		for(std::size_t i = 0; i < client->m_in_flight.size(); ++i){
+			const AUTO_REF(request, client->m_in_flight.at(i));
+			// 已经开始接收响应的请求，以及不幂等或者已经重试过的请求不能重新发送。
+			if(((i == 0) && client->m_response_started) || !is_idempotent(request->request_headers.verb) || request->retried){
+				requests_to_fail.push_back(request);
+				continue;
+			}
+			request->retried = true;
+			requests_to_resend.push_back(request);
+		}
+		client->m_in_flight.clear();
+		if(origin.active.empty()){
+			// 没有连接会变为空闲了，重新为等待中的请求建立连接。
+			requests_to_resend.insert(requests_to_resend.end(), origin.pending.begin(), origin.pending.end());
+			origin.pending.clear();
+		}
+	}
+	if(!requests_to_fail.empty()){
+		LOG_POSEIDON_DEBUG("HTTP client closed with requests pending: remote = ", client->get_remote_info(), ", err_code = ", err_code,
+			", requests_to_fail = ", requests_to_fail.size(), ", requests_to_resend = ", requests_to_resend.size());
+	}
+	for(AUTO(it, requests_to_fail.begin()); it != requests_to_fail.end(); ++it){
+		(*it)->promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("Connection closed before the response was received"))), false);
+	}
+	for(AUTO(it, requests_to_resend.begin()); it != requests_to_resend.end(); ++it){
+		start_connecting(key, *it);
+	}
+}
+
+boost::shared_ptr<const PromiseContainer<ClientPool::Response> > ClientPool::enqueue_for_requesting(const std::string &host, boost::uint16_t port, bool use_ssl,
+	RequestHeaders request_headers, StreamBuffer entity)
+{
+	PROFILE_ME;
+
+	request_headers.version = 10001;
+	if(!request_headers.headers.has("Host")){
+		std::string host_header = host;
+		if(port != (use_ssl ? 443 : 80)){
+			host_header += ':';
+			host_header += boost::lexical_cast<std::string>(port);
+		}
+		request_headers.headers.set(sslit("Host"), STD_MOVE(host_header));
+	}
+
+	const AUTO(request, boost::make_shared<Request>());
+	request->request_headers = STD_MOVE(request_headers);
+	request->entity = STD_MOVE(entity);
+	request->promise = boost::make_shared<PromiseContainer<Response> >();
+	request->retried = false;
+
+	const AUTO(key, make_origin_key(host, port, use_ssl));
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		AUTO_REF(origin, m_origins[key]);
+		origin.host = host;
+		origin.port = port;
+		origin.use_ssl = use_ssl;
+		if(unlocked_dispatch(origin, request)){
+			return request->promise;
+		}
+	}
+	start_connecting(key, request);
+	return request->promise;
+}
+
+void ClientPool::clear() NOEXCEPT {
+	m_tcp_pool.clear();
+}
+
+std::size_t ClientPool::get_active_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+		count += it->second.active.size();
+	}
+	return count;
+}
+std::size_t ClientPool::get_idle_count() const {
+	return m_tcp_pool.get_idle_count();
+}
+std::size_t ClientPool::get_pending_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_origins.begin()); it != m_origins.end(); ++it){
+		count += it->second.pending.size();
+	}
+	return count;
+}
+
+}
+}
@@ -0,0 +1,106 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_CLIENT_POOL_HPP_
+#define POSEIDON_HTTP_CLIENT_POOL_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include "../virtual_shared_from_this.hpp"
+#include "../tcp_client_pool.hpp"
+#include "../promise.hpp"
+#include "../mutex.hpp"
+#include "../stream_buffer.hpp"
+#include "request_headers.hpp"
+#include "response_headers.hpp"
+#include <string>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/map.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+namespace Http {
+
+// 在 TcpClientPool 之上按照 host:port 复用保持连接的 HTTP/1.1 客户端，用于调用内部的 REST 服务。
+// 请求异步发出，结果通过 PromiseContainer 返回，可以在任务中使用 JobDispatcher::yield() 或者 Poseidon::wait() 等待。
+// 幂等的请求（GET、HEAD、PUT、DELETE、OPTIONS 和 TRACE）在没有空闲连接时流水线化地发送到已有的连接上，
+// 每个连接上最多 http_client_pool_pipeline_depth 个；其他请求只使用空闲的连接。
+// 连接在收到任何响应之前断开时，幂等的请求会在另一个连接上重试一次，其他请求以异常结束。
+// 必须使用 boost::make_shared() 创建。
+class ClientPool : NONCOPYABLE, public virtual VirtualSharedFromThis {
+public:
+	struct Response {
+		ResponseHeaders response_headers;
+		StreamBuffer entity;
+	};
+
+private:
+	class PooledClient;
+	struct Request;
+
+	struct Origin {
+		std::string host;
+		boost::uint16_t port;
+		bool use_ssl;
+		// 已经从 TcpClientPool 取出，有请求正在等待响应的连接。
+		boost::container::vector<boost::shared_ptr<PooledClient> > active;
+		// 连接数达到上限时等待已有的连接空闲的请求。
+		std::deque<boost::shared_ptr<Request> > pending;
+
+		Origin()
+			: host(), port(0), use_ssl(false), active(), pending()
+		{ }
+	};
+
+private:
+	static void connect_proc(const boost::weak_ptr<ClientPool> &weak_pool, const std::string &key, const boost::shared_ptr<Request> &request);
+
+private:
+	const bool m_verify_peer;
+	const std::size_t m_pipeline_depth;
+	TcpClientPool m_tcp_pool;
+
+	mutable Mutex m_mutex;
+	boost::container::map<std::string, Origin> m_origins;
+
+public:
+	explicit ClientPool(bool verify_peer = true);
+	~ClientPool();
+
+private:
+	boost::shared_ptr<TcpClientBase> create_client(const SockAddr &sock_addr, bool use_ssl);
+
+	// 以下函数都需要在持有 m_mutex 时调用。
+	bool unlocked_dispatch(Origin &origin, const boost::shared_ptr<Request> &request);
+	void unlocked_send(const boost::shared_ptr<PooledClient> &client, const boost::shared_ptr<Request> &request);
+	void unlocked_deactivate(Origin &origin, const boost::shared_ptr<PooledClient> &client);
+
+	void start_connecting(const std::string &key, const boost::shared_ptr<Request> &request);
+
+	// 以下函数由 PooledClient 在 epoll 线程中调用。
+	bool is_head_pending(const PooledClient *client) const;
+	void on_client_response(const boost::shared_ptr<PooledClient> &client, Response response);
+	void on_client_close(const boost::shared_ptr<PooledClient> &client, int err_code);
+
+public:
+	// 如果 request_headers 中没有 Host，使用 host 和 port 填充。
+	boost::shared_ptr<const PromiseContainer<Response> > enqueue_for_requesting(const std::string &host, boost::uint16_t port, bool use_ssl,
+		RequestHeaders request_headers, StreamBuffer entity = StreamBuffer());
+
+	// 关闭所有空闲的连接，正在使用的连接不受影响。
+	void clear() NOEXCEPT;
+
+	std::size_t get_active_count() const;
+	std::size_t get_idle_count() const;
+	std::size_t get_pending_count() const;
+};
+
+}
+
+extern template class PromiseContainer<Http::ClientPool::Response>;
+
+}
+
+#endif
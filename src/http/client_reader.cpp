@@ -4,6 +4,7 @@
 #include "../precompiled.hpp"
 #include "client_reader.hpp"
 #include "exception.hpp"
+#include "header_names.hpp"
 #include <sys/types.h>
 #include <unistd.h>
 #include "../log.hpp"
@@ -32,22 +33,7 @@ bool ClientReader::put_encoded_data(StreamBuffer encoded){
 		const bool expecting_new_line = (m_size_expecting == EXPECTING_NEW_LINE);
 
 		if(expecting_new_line){
-			std::ptrdiff_t lf_offset = 0;
-			StreamBuffer::EnumerationCookie cookie;
-			for(;;){
-				const void *data, *pos;
-				std::size_t size;
-				if(!m_queue.enumerate_chunk(&data, &size, cookie)){
-					lf_offset = -1;
-					break;
-				}
-				pos = std::memchr(data, '\n', size);
-				if(pos){
-					lf_offset += static_cast<const char *>(pos) - static_cast<const char *>(data);
-					break;
-				}
-				lf_offset += static_cast<std::ptrdiff_t>(size);
-			}
+			const AUTO(lf_offset, m_queue.find('\n'));
 			if(lf_offset < 0){
 				// 没找到换行符。
 				break;
@@ -118,7 +104,7 @@ bool ClientReader::put_encoded_data(StreamBuffer encoded){
 
 				AUTO(pos, line.find(':'));
 				DEBUG_THROW_UNLESS(pos != std::string::npos, BasicException, sslit("Malformed HTTP header in response headers"));
-				SharedNts key(line.data(), pos);
+				SharedNts key(make_header_name(line.data(), pos));
 				line.erase(0, pos + 1);
 				std::string value(trim(STD_MOVE(line)));
 				m_response_headers.headers.append(STD_MOVE(key), STD_MOVE(value));
@@ -127,7 +113,11 @@ bool ClientReader::put_encoded_data(StreamBuffer encoded){
 				// m_state = S_HEADERS;
 			} else {
 				const AUTO_REF(transfer_encoding, m_response_headers.headers.get("Transfer-Encoding"));
-				if(transfer_encoding.empty() || (::strcasecmp(transfer_encoding.c_str(), "identity") == 0)){
+				const unsigned status_code = m_response_headers.status_code;
+				if((status_code / 100 == 1) || (status_code == 204) || (status_code == 304) || is_response_entity_omitted()){
+					// RFC 7230 3.3.3
+					m_content_length = 0;
+				} else if(transfer_encoding.empty() || (::strcasecmp(transfer_encoding.c_str(), "identity") == 0)){
 					const AUTO_REF(content_length, m_response_headers.headers.get("Content-Length"));
 					if(content_length.empty()){
 						m_content_length = CONTENT_TILL_EOF;
@@ -225,7 +215,7 @@ bool ClientReader::put_encoded_data(StreamBuffer encoded){
 
 				AUTO(pos, line.find(':'));
 				DEBUG_THROW_UNLESS(pos != std::string::npos, BasicException, sslit("Invalid HTTP header in chunk trailer"));
-				SharedNts key(line.data(), pos);
+				SharedNts key(make_header_name(line.data(), pos));
 				line.erase(0, pos + 1);
 				std::string value(trim(STD_MOVE(line)));
 				m_chunked_trailer.append(STD_MOVE(key), STD_MOVE(value));
@@ -245,6 +235,10 @@ bool ClientReader::put_encoded_data(StreamBuffer encoded){
 	return has_next_response;
 }
 
+bool ClientReader::is_response_entity_omitted() const {
+	return false;
+}
+
 bool ClientReader::is_content_till_eof() const {
 	if(m_state < S_IDENTITY){
 		return false;
@@ -66,6 +66,9 @@ protected:
 	// 如果 on_response_headers() 的 content_length 参数为 CONTENT_CHUNKED，使用这个函数标识结束。
 	// chunked 允许追加报头。
 	virtual bool on_response_end(boost::uint64_t content_length, OptionalMap headers) = 0;
+	// 收到响应头之后调用，返回 true 表示这个响应没有正文，例如对 HEAD 请求的响应。
+	// 1xx、204 和 304 响应总是没有正文，不会调用这个函数。
+	virtual bool is_response_entity_omitted() const;
 
 public:
 	const StreamBuffer &get_queue() const {
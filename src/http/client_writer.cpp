@@ -8,11 +8,24 @@
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../string.hpp"
-#include "../buffer_streams.hpp"
+#include "../trace_context.hpp"
 
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	// 把当前的上下文传播给对端。调用者自己设置了 traceparent 时不覆盖。
+	void inject_traceparent(OptionalMap &headers){
+		const AUTO_REF(trace, get_current_trace_context());
+		if(!trace.is_valid() || headers.has("traceparent")){
+			return;
+		}
+		char str[56];
+		const std::size_t len = format_traceparent(str, trace);
+		headers.set(sslit("traceparent"), std::string(str, len));
+	}
+}
+
 ClientWriter::ClientWriter(){ }
 ClientWriter::~ClientWriter(){ }
 
@@ -26,9 +39,9 @@ long ClientWriter::put_request(RequestHeaders request_headers, StreamBuffer enti
 	data.put(request_headers.uri);
 	if(!request_headers.get_params.empty()){
 		data.put('?');
-		Buffer_ostream os;
-		url_encode_params(os, request_headers.get_params);
-		data.splice(os.get_buffer());
+		std::string query;
+		url_encode_params(query, request_headers.get_params);
+		data.put(query);
 	}
 	char temp[64];
 	const unsigned ver_major = request_headers.version / 10000, ver_minor = request_headers.version % 10000;
@@ -56,6 +69,7 @@ long ClientWriter::put_request(RequestHeaders request_headers, StreamBuffer enti
 			headers.set(sslit("Content-Length"), std::string(temp, len));
 		}
 	}
+	inject_traceparent(headers);
 
 	for(AUTO(it, headers.begin()); it != headers.end(); ++it){
 		data.put(it->first.get());
@@ -80,9 +94,9 @@ long ClientWriter::put_chunked_header(RequestHeaders request_headers){
 	data.put(request_headers.uri);
 	if(!request_headers.get_params.empty()){
 		data.put('?');
-		Buffer_ostream os;
-		url_encode_params(os, request_headers.get_params);
-		data.splice(os.get_buffer());
+		std::string query;
+		url_encode_params(query, request_headers.get_params);
+		data.put(query);
 	}
 	char temp[64];
 	const unsigned ver_major = request_headers.version / 10000, ver_minor = request_headers.version % 10000;
@@ -97,6 +111,7 @@ long ClientWriter::put_chunked_header(RequestHeaders request_headers){
 	if(transfer_encoding.empty() || (::strcasecmp(transfer_encoding.c_str(), "identity") == 0)){
 		headers.set(sslit("Transfer-Encoding"), "chunked");
 	}
+	inject_traceparent(headers);
 
 	for(AUTO(it, headers.begin()); it != headers.end(); ++it){
 		data.put(it->first.get());
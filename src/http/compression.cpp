@@ -0,0 +1,178 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "compression.hpp"
+#include "../singletons/main_config.hpp"
+#include "../zlib.hpp"
+#include "../brotli.hpp"
+#include "../zstd.hpp"
+#include "../sha256.hpp"
+#include "../mutex.hpp"
+#include "../atomic.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include <boost/container/map.hpp>
+#include <boost/container/deque.hpp>
+
+namespace Poseidon {
+namespace Http {
+
+namespace {
+	volatile boost::uint64_t g_cache_hits = 0;
+	volatile boost::uint64_t g_cache_misses = 0;
+	volatile boost::uint64_t g_cache_entries = 0;
+	volatile boost::uint64_t g_cache_bytes = 0;
+
+	typedef std::basic_string<unsigned char> CacheKey;
+
+	// 按照正文的哈希值分片以减少锁竞争。
+	class CompressionCacheShard : NONCOPYABLE {
+	private:
+		mutable Mutex m_mutex;
+		boost::container::map<CacheKey, boost::shared_ptr<const StreamBuffer> > m_map;
+		// 按插入顺序记录键，超出容量时淘汰最早的。
+		boost::container::deque<CacheKey> m_order;
+		std::size_t m_bytes;
+
+	public:
+		CompressionCacheShard()
+			: m_bytes(0)
+		{ }
+
+	public:
+		boost::shared_ptr<const StreamBuffer> find(const CacheKey &key) const {
+			const Mutex::UniqueLock lock(m_mutex);
+			const AUTO(it, m_map.find(key));
+			if(it == m_map.end()){
+				return VAL_INIT;
+			}
+			return it->second;
+		}
+		void insert(const CacheKey &key, const boost::shared_ptr<const StreamBuffer> &data, std::size_t capacity){
+			const Mutex::UniqueLock lock(m_mutex);
+			AUTO(result, m_map.emplace(key, data));
+			if(!result.second){
+				return;
+			}
+			m_order.push_back(key);
+			m_bytes += data->size();
+			atomic_add(g_cache_entries, 1, ATOMIC_RELAXED);
+			atomic_add(g_cache_bytes, data->size(), ATOMIC_RELAXED);
+			while((m_bytes > capacity) && !m_order.empty()){
+				const AUTO(it, m_map.find(m_order.front()));
+				m_order.pop_front();
+				if(it == m_map.end()){
+					continue;
+				}
+				m_bytes -= it->second->size();
+				atomic_sub(g_cache_entries, 1, ATOMIC_RELAXED);
+				atomic_sub(g_cache_bytes, it->second->size(), ATOMIC_RELAXED);
+				m_map.erase(it);
+			}
+		}
+		void clear(){
+			const Mutex::UniqueLock lock(m_mutex);
+			for(AUTO(it, m_map.begin()); it != m_map.end(); ++it){
+				atomic_sub(g_cache_entries, 1, ATOMIC_RELAXED);
+				atomic_sub(g_cache_bytes, it->second->size(), ATOMIC_RELAXED);
+			}
+			m_map.clear();
+			m_order.clear();
+			m_bytes = 0;
+		}
+	};
+
+	CONSTEXPR const std::size_t COMPRESSION_CACHE_SHARD_COUNT = 16;
+
+	CompressionCacheShard g_compression_cache[COMPRESSION_CACHE_SHARD_COUNT];
+
+	CacheKey make_cache_key(const StreamBuffer &entity, ContentEncoding encoding, int level){
+		PROFILE_ME;
+
+		const AUTO(sha256, sha256_hash(entity));
+
+		CacheKey key;
+		key.reserve(sha256.size() + 2);
+		key.append(sha256.begin(), sha256.end());
+		key.push_back(static_cast<unsigned char>(encoding));
+		key.push_back(static_cast<unsigned char>(level));
+		return key;
+	}
+
+	StreamBuffer really_compress(const StreamBuffer &entity, ContentEncoding encoding, int level){
+		PROFILE_ME;
+
+		switch(encoding){
+		case CE_BROTLI: {
+			BrotliCompressor compressor(std::min(level, 11));
+			compressor.put(entity);
+			return compressor.finalize(); }
+		case CE_ZSTD: {
+			ZstdCompressor compressor(std::max(level, 1));
+			compressor.put(entity);
+			return compressor.finalize(); }
+		default: {
+			return deflate_buffer(entity, encoding == CE_GZIP, std::min(level, 9)); }
+		}
+	}
+}
+
+ContentEncoding compress_entity(StreamBuffer &entity, ContentEncoding encoding, int level, std::size_t min_size){
+	PROFILE_ME;
+
+	if((encoding != CE_GZIP) && (encoding != CE_DEFLATE) && (encoding != CE_BROTLI) && (encoding != CE_ZSTD)){
+		return CE_IDENTITY;
+	}
+	if(min_size == (std::size_t)-1){
+		min_size = MainConfig::get<std::size_t>("http_compression_min_size", 1024);
+	}
+	if(entity.size() < min_size){
+		return CE_IDENTITY;
+	}
+	if(level < 0){
+		level = MainConfig::get<int>("http_compression_level", 6);
+	}
+	level = std::min(level, 22);
+
+	const AUTO(cache_size, MainConfig::get<std::size_t>("http_compression_cache_size", 16777216));
+	const AUTO(cache_max_entity, MainConfig::get<std::size_t>("http_compression_cache_max_entity", 1048576));
+	boost::shared_ptr<const StreamBuffer> compressed;
+	if((cache_size != 0) && (entity.size() <= cache_max_entity)){
+		const AUTO(key, make_cache_key(entity, encoding, level));
+		AUTO_REF(shard, g_compression_cache[key.at(0) % COMPRESSION_CACHE_SHARD_COUNT]);
+		compressed = shard.find(key);
+		if(compressed){
+			atomic_add(g_cache_hits, 1, ATOMIC_RELAXED);
+		} else {
+			atomic_add(g_cache_misses, 1, ATOMIC_RELAXED);
+			compressed = boost::make_shared<StreamBuffer>(really_compress(entity, encoding, level));
+			shard.insert(key, compressed, cache_size / COMPRESSION_CACHE_SHARD_COUNT + 1);
+		}
+	} else {
+		compressed = boost::make_shared<StreamBuffer>(really_compress(entity, encoding, level));
+	}
+	if(compressed->size() >= entity.size()){
+		LOG_POSEIDON_TRACE("Compression does not help: original_size = ", entity.size(), ", compressed_size = ", compressed->size());
+		return CE_IDENTITY;
+	}
+	entity = *compressed;
+	return encoding;
+}
+
+void get_compression_cache_stats(CompressionCacheStats &stats){
+	stats.hits = atomic_load(g_cache_hits, ATOMIC_RELAXED);
+	stats.misses = atomic_load(g_cache_misses, ATOMIC_RELAXED);
+	stats.entries = atomic_load(g_cache_entries, ATOMIC_RELAXED);
+	stats.bytes = atomic_load(g_cache_bytes, ATOMIC_RELAXED);
+}
+void clear_compression_cache(){
+	PROFILE_ME;
+
+	for(std::size_t i = 0; i < COMPRESSION_CACHE_SHARD_COUNT; ++i){
+		g_compression_cache[i].clear();
+	}
+}
+
+}
+}
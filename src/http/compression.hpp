@@ -0,0 +1,36 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_COMPRESSION_HPP_
+#define POSEIDON_HTTP_COMPRESSION_HPP_
+
+#include "request_headers.hpp"
+#include "../stream_buffer.hpp"
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+namespace Http {
+
+// 使用 encoding（通常是 pick_content_encoding() 的结果）压缩响应正文，返回实际使用的编码。
+// 正文短于 min_size、encoding 是 CE_IDENTITY 或者压缩之后没有变小时，entity 保持不变并返回 CE_IDENTITY。
+// level 为负数时使用 http_compression_level，min_size 为 -1 时使用 http_compression_min_size。
+// level 按照各个编码的范围截断：deflate 和 gzip 最大为 9，br 最大为 11，zstd 最大为 22。
+// 压缩的结果按照正文的 SHA-256、编码和压缩级别缓存，相同的正文不会被重复压缩。
+// 缓存的总大小不超过 http_compression_cache_size，超出时淘汰最早的；长于 http_compression_cache_max_entity 的正文不缓存。
+extern ContentEncoding compress_entity(StreamBuffer &entity, ContentEncoding encoding, int level = -1, std::size_t min_size = (std::size_t)-1);
+
+struct CompressionCacheStats {
+	boost::uint64_t hits;
+	boost::uint64_t misses;
+	boost::uint64_t entries;
+	boost::uint64_t bytes;
+};
+
+extern void get_compression_cache_stats(CompressionCacheStats &stats);
+extern void clear_compression_cache();
+
+}
+}
+
+#endif
@@ -15,6 +15,8 @@ class Exception;
 
 class AuthenticationContext;
 class Multipart;
+class MultipartReader;
+class MultipartSpooler;
 
 class ServerReader;
 class ServerWriter;
@@ -23,6 +25,8 @@ class ClientWriter;
 
 class Session;
 class Client;
+class ClientPool;
+class Router;
 class UpgradedSessionBase;
 
 }
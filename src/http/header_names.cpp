@@ -0,0 +1,87 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "header_names.hpp"
+#include "../cxx_util.hpp"
+#include <strings.h>
+
+namespace Poseidon {
+namespace Http {
+
+namespace {
+	struct WellKnownName {
+		const char *str;
+		std::size_t len;
+	};
+
+#define NAME(str_)	{ str_, sizeof(str_) - 1 }
+
+	CONSTEXPR const WellKnownName WELL_KNOWN_NAMES[] = {
+		NAME("Accept"),
+		NAME("Accept-Charset"),
+		NAME("Accept-Encoding"),
+		NAME("Accept-Language"),
+		NAME("Access-Control-Request-Headers"),
+		NAME("Access-Control-Request-Method"),
+		NAME("Authorization"),
+		NAME("Cache-Control"),
+		NAME("Connection"),
+		NAME("Content-Disposition"),
+		NAME("Content-Encoding"),
+		NAME("Content-Length"),
+		NAME("Content-Type"),
+		NAME("Cookie"),
+		NAME("Date"),
+		NAME("ETag"),
+		NAME("Expect"),
+		NAME("Expires"),
+		NAME("Host"),
+		NAME("If-Modified-Since"),
+		NAME("If-None-Match"),
+		NAME("Keep-Alive"),
+		NAME("Last-Modified"),
+		NAME("Location"),
+		NAME("Origin"),
+		NAME("Pragma"),
+		NAME("Proxy-Authenticate"),
+		NAME("Proxy-Authorization"),
+		NAME("Proxy-Connection"),
+		NAME("Range"),
+		NAME("Referer"),
+		NAME("Sec-WebSocket-Accept"),
+		NAME("Sec-WebSocket-Extensions"),
+		NAME("Sec-WebSocket-Key"),
+		NAME("Sec-WebSocket-Protocol"),
+		NAME("Sec-WebSocket-Version"),
+		NAME("Server"),
+		NAME("Set-Cookie"),
+		NAME("TE"),
+		NAME("Trailer"),
+		NAME("Transfer-Encoding"),
+		NAME("Upgrade"),
+		NAME("User-Agent"),
+		NAME("Vary"),
+		NAME("Via"),
+		NAME("WWW-Authenticate"),
+		NAME("X-Forwarded-For"),
+		NAME("X-Forwarded-Proto"),
+		NAME("X-Real-IP"),
+		NAME("X-Requested-With"),
+	};
+
+#undef NAME
+}
+
+SharedNts make_header_name(const char *str, std::size_t len){
+	for(std::size_t i = 0; i < COUNT_OF(WELL_KNOWN_NAMES); ++i){
+		const AUTO_REF(name, WELL_KNOWN_NAMES[i]);
+		if((name.len == len) && (::strncasecmp(name.str, str, len) == 0)){
+			return SharedNts::view(name.str);
+		}
+	}
+	return SharedNts::intern_existing(str, len);
+}
+
+}
+}
@@ -0,0 +1,21 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HEADER_NAMES_HPP_
+#define POSEIDON_HTTP_HEADER_NAMES_HPP_
+
+#include <cstddef>
+#include "../shared_nts.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+// 如果 [str, str + len) 不区分大小写地等于一个常用的报头名，返回指向静态字符串的 SharedNts，不分配内存，
+// 并且使用规范的大小写（例如 `content-length` 返回 `Content-Length`），这样按照规范的名字查找时不受对方大小写的影响。
+// 否则返回已经驻留的副本（参见 SharedNts::intern()），或者复制一份，保持原样。
+extern SharedNts make_header_name(const char *str, std::size_t len);
+
+}
+}
+
+#endif
@@ -0,0 +1,477 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "hpack.hpp"
+#include "exception.hpp"
+#include "../profiler.hpp"
+#include "../stream_buffer.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+namespace {
+	struct HuffmanCode {
+		boost::uint32_t code;
+		unsigned bits;
+	};
+	struct HuffmanLength {
+		unsigned bits;
+		boost::uint32_t first_code;
+		unsigned first_index;
+		unsigned count;
+	};
+	struct StaticEntry {
+		const char *name;
+		const char *value;
+	};
+
+	// RFC 7541 附录 B。这是一个范式 Huffman 编码，码字按照（长度，符号）的顺序连续分配。
+	CONSTEXPR const HuffmanCode HUFFMAN_CODES[257] = {
+		{ 0x00001FF8, 13 }, { 0x007FFFD8, 23 }, { 0x0FFFFFE2, 28 }, { 0x0FFFFFE3, 28 },
+		{ 0x0FFFFFE4, 28 }, { 0x0FFFFFE5, 28 }, { 0x0FFFFFE6, 28 }, { 0x0FFFFFE7, 28 },
+		{ 0x0FFFFFE8, 28 }, { 0x00FFFFEA, 24 }, { 0x3FFFFFFC, 30 }, { 0x0FFFFFE9, 28 },
+		{ 0x0FFFFFEA, 28 }, { 0x3FFFFFFD, 30 }, { 0x0FFFFFEB, 28 }, { 0x0FFFFFEC, 28 },
+		{ 0x0FFFFFED, 28 }, { 0x0FFFFFEE, 28 }, { 0x0FFFFFEF, 28 }, { 0x0FFFFFF0, 28 },
+		{ 0x0FFFFFF1, 28 }, { 0x0FFFFFF2, 28 }, { 0x3FFFFFFE, 30 }, { 0x0FFFFFF3, 28 },
+		{ 0x0FFFFFF4, 28 }, { 0x0FFFFFF5, 28 }, { 0x0FFFFFF6, 28 }, { 0x0FFFFFF7, 28 },
+		{ 0x0FFFFFF8, 28 }, { 0x0FFFFFF9, 28 }, { 0x0FFFFFFA, 28 }, { 0x0FFFFFFB, 28 },
+		{ 0x00000014,  6 }, { 0x000003F8, 10 }, { 0x000003F9, 10 }, { 0x00000FFA, 12 },
+		{ 0x00001FF9, 13 }, { 0x00000015,  6 }, { 0x000000F8,  8 }, { 0x000007FA, 11 },
+		{ 0x000003FA, 10 }, { 0x000003FB, 10 }, { 0x000000F9,  8 }, { 0x000007FB, 11 },
+		{ 0x000000FA,  8 }, { 0x00000016,  6 }, { 0x00000017,  6 }, { 0x00000018,  6 },
+		{ 0x00000000,  5 }, { 0x00000001,  5 }, { 0x00000002,  5 }, { 0x00000019,  6 },
+		{ 0x0000001A,  6 }, { 0x0000001B,  6 }, { 0x0000001C,  6 }, { 0x0000001D,  6 },
+		{ 0x0000001E,  6 }, { 0x0000001F,  6 }, { 0x0000005C,  7 }, { 0x000000FB,  8 },
+		{ 0x00007FFC, 15 }, { 0x00000020,  6 }, { 0x00000FFB, 12 }, { 0x000003FC, 10 },
+		{ 0x00001FFA, 13 }, { 0x00000021,  6 }, { 0x0000005D,  7 }, { 0x0000005E,  7 },
+		{ 0x0000005F,  7 }, { 0x00000060,  7 }, { 0x00000061,  7 }, { 0x00000062,  7 },
+		{ 0x00000063,  7 }, { 0x00000064,  7 }, { 0x00000065,  7 }, { 0x00000066,  7 },
+		{ 0x00000067,  7 }, { 0x00000068,  7 }, { 0x00000069,  7 }, { 0x0000006A,  7 },
+		{ 0x0000006B,  7 }, { 0x0000006C,  7 }, { 0x0000006D,  7 }, { 0x0000006E,  7 },
+		{ 0x0000006F,  7 }, { 0x00000070,  7 }, { 0x00000071,  7 }, { 0x00000072,  7 },
+		{ 0x000000FC,  8 }, { 0x00000073,  7 }, { 0x000000FD,  8 }, { 0x00001FFB, 13 },
+		{ 0x0007FFF0, 19 }, { 0x00001FFC, 13 }, { 0x00003FFC, 14 }, { 0x00000022,  6 },
+		{ 0x00007FFD, 15 }, { 0x00000003,  5 }, { 0x00000023,  6 }, { 0x00000004,  5 },
+		{ 0x00000024,  6 }, { 0x00000005,  5 }, { 0x00000025,  6 }, { 0x00000026,  6 },
+		{ 0x00000027,  6 }, { 0x00000006,  5 }, { 0x00000074,  7 }, { 0x00000075,  7 },
+		{ 0x00000028,  6 }, { 0x00000029,  6 }, { 0x0000002A,  6 }, { 0x00000007,  5 },
+		{ 0x0000002B,  6 }, { 0x00000076,  7 }, { 0x0000002C,  6 }, { 0x00000008,  5 },
+		{ 0x00000009,  5 }, { 0x0000002D,  6 }, { 0x00000077,  7 }, { 0x00000078,  7 },
+		{ 0x00000079,  7 }, { 0x0000007A,  7 }, { 0x0000007B,  7 }, { 0x00007FFE, 15 },
+		{ 0x000007FC, 11 }, { 0x00003FFD, 14 }, { 0x00001FFD, 13 }, { 0x0FFFFFFC, 28 },
+		{ 0x000FFFE6, 20 }, { 0x003FFFD2, 22 }, { 0x000FFFE7, 20 }, { 0x000FFFE8, 20 },
+		{ 0x003FFFD3, 22 }, { 0x003FFFD4, 22 }, { 0x003FFFD5, 22 }, { 0x007FFFD9, 23 },
+		{ 0x003FFFD6, 22 }, { 0x007FFFDA, 23 }, { 0x007FFFDB, 23 }, { 0x007FFFDC, 23 },
+		{ 0x007FFFDD, 23 }, { 0x007FFFDE, 23 }, { 0x00FFFFEB, 24 }, { 0x007FFFDF, 23 },
+		{ 0x00FFFFEC, 24 }, { 0x00FFFFED, 24 }, { 0x003FFFD7, 22 }, { 0x007FFFE0, 23 },
+		{ 0x00FFFFEE, 24 }, { 0x007FFFE1, 23 }, { 0x007FFFE2, 23 }, { 0x007FFFE3, 23 },
+		{ 0x007FFFE4, 23 }, { 0x001FFFDC, 21 }, { 0x003FFFD8, 22 }, { 0x007FFFE5, 23 },
+		{ 0x003FFFD9, 22 }, { 0x007FFFE6, 23 }, { 0x007FFFE7, 23 }, { 0x00FFFFEF, 24 },
+		{ 0x003FFFDA, 22 }, { 0x001FFFDD, 21 }, { 0x000FFFE9, 20 }, { 0x003FFFDB, 22 },
+		{ 0x003FFFDC, 22 }, { 0x007FFFE8, 23 }, { 0x007FFFE9, 23 }, { 0x001FFFDE, 21 },
+		{ 0x007FFFEA, 23 }, { 0x003FFFDD, 22 }, { 0x003FFFDE, 22 }, { 0x00FFFFF0, 24 },
+		{ 0x001FFFDF, 21 }, { 0x003FFFDF, 22 }, { 0x007FFFEB, 23 }, { 0x007FFFEC, 23 },
+		{ 0x001FFFE0, 21 }, { 0x001FFFE1, 21 }, { 0x003FFFE0, 22 }, { 0x001FFFE2, 21 },
+		{ 0x007FFFED, 23 }, { 0x003FFFE1, 22 }, { 0x007FFFEE, 23 }, { 0x007FFFEF, 23 },
+		{ 0x000FFFEA, 20 }, { 0x003FFFE2, 22 }, { 0x003FFFE3, 22 }, { 0x003FFFE4, 22 },
+		{ 0x007FFFF0, 23 }, { 0x003FFFE5, 22 }, { 0x003FFFE6, 22 }, { 0x007FFFF1, 23 },
+		{ 0x03FFFFE0, 26 }, { 0x03FFFFE1, 26 }, { 0x000FFFEB, 20 }, { 0x0007FFF1, 19 },
+		{ 0x003FFFE7, 22 }, { 0x007FFFF2, 23 }, { 0x003FFFE8, 22 }, { 0x01FFFFEC, 25 },
+		{ 0x03FFFFE2, 26 }, { 0x03FFFFE3, 26 }, { 0x03FFFFE4, 26 }, { 0x07FFFFDE, 27 },
+		{ 0x07FFFFDF, 27 }, { 0x03FFFFE5, 26 }, { 0x00FFFFF1, 24 }, { 0x01FFFFED, 25 },
+		{ 0x0007FFF2, 19 }, { 0x001FFFE3, 21 }, { 0x03FFFFE6, 26 }, { 0x07FFFFE0, 27 },
+		{ 0x07FFFFE1, 27 }, { 0x03FFFFE7, 26 }, { 0x07FFFFE2, 27 }, { 0x00FFFFF2, 24 },
+		{ 0x001FFFE4, 21 }, { 0x001FFFE5, 21 }, { 0x03FFFFE8, 26 }, { 0x03FFFFE9, 26 },
+		{ 0x0FFFFFFD, 28 }, { 0x07FFFFE3, 27 }, { 0x07FFFFE4, 27 }, { 0x07FFFFE5, 27 },
+		{ 0x000FFFEC, 20 }, { 0x00FFFFF3, 24 }, { 0x000FFFED, 20 }, { 0x001FFFE6, 21 },
+		{ 0x003FFFE9, 22 }, { 0x001FFFE7, 21 }, { 0x001FFFE8, 21 }, { 0x007FFFF3, 23 },
+		{ 0x003FFFEA, 22 }, { 0x003FFFEB, 22 }, { 0x01FFFFEE, 25 }, { 0x01FFFFEF, 25 },
+		{ 0x00FFFFF4, 24 }, { 0x00FFFFF5, 24 }, { 0x03FFFFEA, 26 }, { 0x007FFFF4, 23 },
+		{ 0x03FFFFEB, 26 }, { 0x07FFFFE6, 27 }, { 0x03FFFFEC, 26 }, { 0x03FFFFED, 26 },
+		{ 0x07FFFFE7, 27 }, { 0x07FFFFE8, 27 }, { 0x07FFFFE9, 27 }, { 0x07FFFFEA, 27 },
+		{ 0x07FFFFEB, 27 }, { 0x0FFFFFFE, 28 }, { 0x07FFFFEC, 27 }, { 0x07FFFFED, 27 },
+		{ 0x07FFFFEE, 27 }, { 0x07FFFFEF, 27 }, { 0x07FFFFF0, 27 }, { 0x03FFFFEE, 26 },
+		{ 0x3FFFFFFF, 30 },
+	};
+	// 按照码字从小到大排列的符号，用于解码。
+	CONSTEXPR const boost::uint16_t HUFFMAN_SYMBOLS[257] = {
+		 48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,  45,  46,  47,  51,
+		 52,  53,  54,  55,  56,  57,  61,  65,  95,  98, 100, 102, 103, 104, 108, 109,
+		110, 112, 114, 117,  58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+		 77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89, 106, 107, 113, 118,
+		119, 120, 121, 122,  38,  42,  44,  59,  88,  90,  33,  34,  40,  41,  63,  39,
+		 43, 124,  35,  62,   0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+		195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+		179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+		163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+		233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+		158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239,   9, 142,
+		144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+		200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+		212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+		  2,   3,   4,   5,   6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+		 21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220, 249,  10,  13,  22,
+		256,
+	};
+	// 每个长度的第一个码字、它在 HUFFMAN_SYMBOLS 中的下标，以及这个长度的码字个数。
+	CONSTEXPR const HuffmanLength HUFFMAN_LENGTHS[] = {
+		{  5, 0x00000000,   0,  10 },
+		{  6, 0x00000014,  10,  26 },
+		{  7, 0x0000005C,  36,  32 },
+		{  8, 0x000000F8,  68,   6 },
+		{ 10, 0x000003F8,  74,   5 },
+		{ 11, 0x000007FA,  79,   3 },
+		{ 12, 0x00000FFA,  82,   2 },
+		{ 13, 0x00001FF8,  84,   6 },
+		{ 14, 0x00003FFC,  90,   2 },
+		{ 15, 0x00007FFC,  92,   3 },
+		{ 19, 0x0007FFF0,  95,   3 },
+		{ 20, 0x000FFFE6,  98,   8 },
+		{ 21, 0x001FFFDC, 106,  13 },
+		{ 22, 0x003FFFD2, 119,  26 },
+		{ 23, 0x007FFFD8, 145,  29 },
+		{ 24, 0x00FFFFEA, 174,  12 },
+		{ 25, 0x01FFFFEC, 186,   4 },
+		{ 26, 0x03FFFFE0, 190,  15 },
+		{ 27, 0x07FFFFDE, 205,  19 },
+		{ 28, 0x0FFFFFE2, 224,  29 },
+		{ 30, 0x3FFFFFFC, 253,   4 },
+	};
+	// RFC 7541 附录 A。下标从 1 开始。
+	CONSTEXPR const StaticEntry STATIC_TABLE[61] = {
+		{ ":authority", "" },
+		{ ":method", "GET" },
+		{ ":method", "POST" },
+		{ ":path", "/" },
+		{ ":path", "/index.html" },
+		{ ":scheme", "http" },
+		{ ":scheme", "https" },
+		{ ":status", "200" },
+		{ ":status", "204" },
+		{ ":status", "206" },
+		{ ":status", "304" },
+		{ ":status", "400" },
+		{ ":status", "404" },
+		{ ":status", "500" },
+		{ "accept-charset", "" },
+		{ "accept-encoding", "gzip, deflate" },
+		{ "accept-language", "" },
+		{ "accept-ranges", "" },
+		{ "accept", "" },
+		{ "access-control-allow-origin", "" },
+		{ "age", "" },
+		{ "allow", "" },
+		{ "authorization", "" },
+		{ "cache-control", "" },
+		{ "content-disposition", "" },
+		{ "content-encoding", "" },
+		{ "content-language", "" },
+		{ "content-length", "" },
+		{ "content-location", "" },
+		{ "content-range", "" },
+		{ "content-type", "" },
+		{ "cookie", "" },
+		{ "date", "" },
+		{ "etag", "" },
+		{ "expect", "" },
+		{ "expires", "" },
+		{ "from", "" },
+		{ "host", "" },
+		{ "if-match", "" },
+		{ "if-modified-since", "" },
+		{ "if-none-match", "" },
+		{ "if-range", "" },
+		{ "if-unmodified-since", "" },
+		{ "last-modified", "" },
+		{ "link", "" },
+		{ "location", "" },
+		{ "max-forwards", "" },
+		{ "proxy-authenticate", "" },
+		{ "proxy-authorization", "" },
+		{ "range", "" },
+		{ "referer", "" },
+		{ "refresh", "" },
+		{ "retry-after", "" },
+		{ "server", "" },
+		{ "set-cookie", "" },
+		{ "strict-transport-security", "" },
+		{ "transfer-encoding", "" },
+		{ "user-agent", "" },
+		{ "vary", "" },
+		{ "via", "" },
+		{ "www-authenticate", "" },
+	};
+
+	// 每个字段额外占用的大小，见 RFC 7541 4.1。
+	CONSTEXPR const std::size_t ENTRY_OVERHEAD = 32;
+
+	std::size_t get_entry_size(const std::string &name, const std::string &value){
+		return name.size() + value.size() + ENTRY_OVERHEAD;
+	}
+
+	boost::uint64_t decode_integer(const unsigned char *&read, const unsigned char *end, unsigned prefix_bits){
+		const unsigned mask = (1u << prefix_bits) - 1;
+		DEBUG_THROW_UNLESS(read != end, Exception, ST_BAD_REQUEST);
+		boost::uint64_t value = *(read++) & mask;
+		if(value < mask){
+			return value;
+		}
+		unsigned shift = 0;
+		for(;;){
+			DEBUG_THROW_UNLESS(read != end, Exception, ST_BAD_REQUEST);
+			// 报头块中不会出现超过 32 位的整数。
+			DEBUG_THROW_UNLESS(shift <= 28, Exception, ST_BAD_REQUEST);
+			const unsigned by = *(read++);
+			value += static_cast<boost::uint64_t>(by & 0x7F) << shift;
+			if(!(by & 0x80)){
+				break;
+			}
+			shift += 7;
+		}
+		return value;
+	}
+	void encode_integer(StreamBuffer &block, unsigned first_byte, unsigned prefix_bits, boost::uint64_t value){
+		const unsigned mask = (1u << prefix_bits) - 1;
+		if(value < mask){
+			block.put(static_cast<int>(first_byte | value));
+			return;
+		}
+		block.put(static_cast<int>(first_byte | mask));
+		value -= mask;
+		while(value >= 0x80){
+			block.put(static_cast<int>((value & 0x7F) | 0x80));
+			value >>= 7;
+		}
+		block.put(static_cast<int>(value));
+	}
+
+	void huffman_decode(std::string &str, const unsigned char *data, std::size_t size){
+		boost::uint32_t code = 0;
+		unsigned bits = 0;
+		std::size_t k = 0;
+		for(std::size_t i = 0; i < size; ++i){
+			const unsigned by = data[i];
+			for(unsigned j = 8; j != 0; --j){
+				code = (code << 1) | ((by >> (j - 1)) & 1);
+				++bits;
+				while((k < COUNT_OF(HUFFMAN_LENGTHS)) && (HUFFMAN_LENGTHS[k].bits < bits)){
+					++k;
+				}
+				DEBUG_THROW_UNLESS(k < COUNT_OF(HUFFMAN_LENGTHS), Exception, ST_BAD_REQUEST);
+				const AUTO_REF(length, HUFFMAN_LENGTHS[k]);
+				if(length.bits != bits){
+					continue;
+				}
+				// 范式编码中，同一长度的码字是连续的。
+				const boost::uint32_t offset = code - length.first_code;
+				if(offset >= length.count){
+					continue;
+				}
+				const unsigned sym = HUFFMAN_SYMBOLS[length.first_index + offset];
+				DEBUG_THROW_UNLESS(sym < 256, Exception, ST_BAD_REQUEST); // 不允许出现 EOS。
+				str.push_back(static_cast<char>(sym));
+				code = 0;
+				bits = 0;
+				k = 0;
+			}
+		}
+		// 末尾的填充必须是 EOS 的前缀，即不超过 7 个 1。
+		DEBUG_THROW_UNLESS((bits < 8) && (code == (1u << bits) - 1), Exception, ST_BAD_REQUEST);
+	}
+	std::size_t get_huffman_size(const std::string &str){
+		boost::uint64_t bits = 0;
+		for(std::size_t i = 0; i < str.size(); ++i){
+			bits += HUFFMAN_CODES[static_cast<unsigned char>(str[i])].bits;
+		}
+		return static_cast<std::size_t>((bits + 7) / 8);
+	}
+	void huffman_encode(StreamBuffer &block, const std::string &str){
+		boost::uint64_t acc = 0;
+		unsigned bits = 0;
+		for(std::size_t i = 0; i < str.size(); ++i){
+			const AUTO_REF(hc, HUFFMAN_CODES[static_cast<unsigned char>(str[i])]);
+			acc = (acc << hc.bits) | hc.code;
+			bits += hc.bits;
+			while(bits >= 8){
+				bits -= 8;
+				block.put(static_cast<int>((acc >> bits) & 0xFF));
+			}
+		}
+		if(bits != 0){
+			// 用 EOS 的前缀（全 1）填充。
+			block.put(static_cast<int>(((acc << (8 - bits)) | (0xFFu >> bits)) & 0xFF));
+		}
+	}
+
+	void decode_string(std::string &str, const unsigned char *&read, const unsigned char *end){
+		DEBUG_THROW_UNLESS(read != end, Exception, ST_BAD_REQUEST);
+		const bool huffman = *read & 0x80;
+		const AUTO(len, decode_integer(read, end, 7));
+		DEBUG_THROW_UNLESS(len <= static_cast<boost::uint64_t>(end - read), Exception, ST_BAD_REQUEST);
+		str.clear();
+		if(huffman){
+			huffman_decode(str, read, static_cast<std::size_t>(len));
+		} else {
+			str.assign(reinterpret_cast<const char *>(read), static_cast<std::size_t>(len));
+		}
+		read += len;
+	}
+	void encode_string(StreamBuffer &block, const std::string &str){
+		const AUTO(huffman_size, get_huffman_size(str));
+		if(huffman_size < str.size()){
+			encode_integer(block, 0x80, 7, huffman_size);
+			huffman_encode(block, str);
+		} else {
+			encode_integer(block, 0x00, 7, str.size());
+			block.put(str);
+		}
+	}
+
+	// 返回完全匹配的下标（正数）或者只有名字匹配的下标（负数），都不匹配时返回 0。
+	int find_static(const std::string &name, const std::string &value){
+		int name_index = 0;
+		for(unsigned i = 0; i < COUNT_OF(STATIC_TABLE); ++i){
+			if(std::strcmp(STATIC_TABLE[i].name, name.c_str()) != 0){
+				continue;
+			}
+			if(std::strcmp(STATIC_TABLE[i].value, value.c_str()) == 0){
+				return static_cast<int>(i + 1);
+			}
+			if(name_index == 0){
+				name_index = -static_cast<int>(i + 1);
+			}
+		}
+		return name_index;
+	}
+}
+
+HpackDecoder::HpackDecoder(std::size_t max_table_size)
+	: m_max_table_size(max_table_size)
+	, m_table_size_limit(max_table_size), m_table_size(0)
+{ }
+HpackDecoder::~HpackDecoder(){ }
+
+void HpackDecoder::evict(std::size_t limit){
+	while(m_table_size > limit){
+		const AUTO_REF(back, m_table.back());
+		m_table_size -= get_entry_size(back.first, back.second);
+		m_table.pop_back();
+	}
+}
+void HpackDecoder::insert(const std::string &name, const std::string &value){
+	const AUTO(size, get_entry_size(name, value));
+	if(size > m_table_size_limit){
+		// 太大的字段会清空动态表，但是本身不会被加入。
+		evict(0);
+		return;
+	}
+	evict(m_table_size_limit - size);
+	m_table.push_front(std::make_pair(name, value));
+	m_table_size += size;
+}
+const std::pair<std::string, std::string> *HpackDecoder::lookup(boost::uint64_t index) const {
+	DEBUG_THROW_UNLESS(index != 0, Exception, ST_BAD_REQUEST);
+	if(index <= COUNT_OF(STATIC_TABLE)){
+		return NULLPTR;
+	}
+	index -= COUNT_OF(STATIC_TABLE) + 1;
+	DEBUG_THROW_UNLESS(index < m_table.size(), Exception, ST_BAD_REQUEST);
+	return &(m_table[static_cast<std::size_t>(index)]);
+}
+
+void HpackDecoder::decode(std::vector<std::pair<std::string, std::string> > &fields, const void *data, std::size_t size, std::size_t max_list_size){
+	PROFILE_ME;
+
+	AUTO(read, static_cast<const unsigned char *>(data));
+	const AUTO(end, read + size);
+	std::size_t list_size = 0;
+	bool fields_seen = false;
+	std::string name, value;
+	while(read != end){
+		const unsigned by = *read;
+		if((by & 0xE0) == 0x20){
+			// 动态表大小更新，只能出现在报头块的开头。
+			DEBUG_THROW_UNLESS(!fields_seen, Exception, ST_BAD_REQUEST);
+			const AUTO(limit, decode_integer(read, end, 5));
+			DEBUG_THROW_UNLESS(limit <= m_max_table_size, Exception, ST_BAD_REQUEST);
+			m_table_size_limit = static_cast<std::size_t>(limit);
+			evict(m_table_size_limit);
+			continue;
+		}
+		fields_seen = true;
+		if(by & 0x80){
+			// 索引字段。
+			const AUTO(index, decode_integer(read, end, 7));
+			const AUTO(entry, lookup(index));
+			if(entry){
+				name = entry->first;
+				value = entry->second;
+			} else {
+				name = STATIC_TABLE[index - 1].name;
+				value = STATIC_TABLE[index - 1].value;
+			}
+		} else {
+			// 字面量，可能加入索引（01），不加入索引（0000）或者永不加入索引（0001）。
+			const bool indexed = by & 0x40;
+			const AUTO(name_index, decode_integer(read, end, indexed ? 6 : 4));
+			if(name_index == 0){
+				decode_string(name, read, end);
+			} else {
+				const AUTO(entry, lookup(name_index));
+				if(entry){
+					name = entry->first;
+				} else {
+					name = STATIC_TABLE[name_index - 1].name;
+				}
+			}
+			decode_string(value, read, end);
+			if(indexed){
+				insert(name, value);
+			}
+		}
+		list_size += get_entry_size(name, value);
+		DEBUG_THROW_UNLESS(list_size <= max_list_size, Exception, ST_PAYLOAD_TOO_LARGE);
+		fields.push_back(std::make_pair(STD_MOVE(name), STD_MOVE(value)));
+	}
+}
+
+void hpack_encode_status(StreamBuffer &block, unsigned status_code){
+	PROFILE_ME;
+
+	char str[16];
+	const unsigned len = (unsigned)std::sprintf(str, "%u", status_code);
+	const AUTO(index, find_static(":status", std::string(str, len)));
+	if(index > 0){
+		encode_integer(block, 0x80, 7, static_cast<unsigned>(index));
+		return;
+	}
+	encode_integer(block, 0x00, 4, static_cast<unsigned>(-index));
+	encode_integer(block, 0x00, 7, len);
+	block.put(str, len);
+}
+void hpack_encode_field(StreamBuffer &block, const char *name, const std::string &value){
+	PROFILE_ME;
+
+	std::string lower(name);
+	for(AUTO(it, lower.begin()); it != lower.end(); ++it){
+		if((*it >= 'A') && (*it <= 'Z')){
+			*it = static_cast<char>(*it - 'A' + 'a');
+		}
+	}
+	const AUTO(index, find_static(lower, value));
+	if(index > 0){
+		encode_integer(block, 0x80, 7, static_cast<unsigned>(index));
+		return;
+	}
+	if(index < 0){
+		encode_integer(block, 0x00, 4, static_cast<unsigned>(-index));
+	} else {
+		block.put(0x00);
+		encode_string(block, lower);
+	}
+	encode_string(block, value);
+}
+
+}
+}
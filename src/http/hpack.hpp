@@ -0,0 +1,56 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HPACK_HPP_
+#define POSEIDON_HTTP_HPACK_HPP_
+
+#include "../cxx_util.hpp"
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+class StreamBuffer;
+
+namespace Http {
+
+// HPACK（RFC 7541）报头块的解码器。动态表是连接的状态，每个 HTTP/2 连接一个，并且报头块必须按照收到的顺序解码。
+// 这个类不是线程安全的。
+class HpackDecoder : NONCOPYABLE {
+private:
+	const std::size_t m_max_table_size;
+
+	std::size_t m_table_size_limit;
+	std::size_t m_table_size;
+	std::deque<std::pair<std::string, std::string> > m_table; // 最新的在前面。
+
+public:
+	// max_table_size 是我们在 SETTINGS_HEADER_TABLE_SIZE 中声明的值。
+	explicit HpackDecoder(std::size_t max_table_size = 4096);
+	~HpackDecoder();
+
+private:
+	void evict(std::size_t limit);
+	void insert(const std::string &name, const std::string &value);
+	const std::pair<std::string, std::string> *lookup(boost::uint64_t index) const;
+
+public:
+	// 解码一个完整的报头块，按顺序追加到 fields 中。
+	// 展开后的报头（按照 RFC 7540 的算法，每个字段额外计 32 字节）超过 max_list_size 或者报头块格式错误时抛出 Http::Exception。
+	void decode(std::vector<std::pair<std::string, std::string> > &fields, const void *data, std::size_t size, std::size_t max_list_size);
+};
+
+// 编码器不使用动态表，字段要么是静态表中的索引，要么是不加入索引的字面量，所以没有状态，可以在任何线程中使用。
+// 字符串在 Huffman 编码更短时使用 Huffman 编码。
+extern void hpack_encode_status(StreamBuffer &block, unsigned status_code);
+// 报头名会被转换为小写。
+extern void hpack_encode_field(StreamBuffer &block, const char *name, const std::string &value);
+
+}
+}
+
+#endif
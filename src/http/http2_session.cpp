@@ -0,0 +1,1045 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "http2_session.hpp"
+#include "session.hpp"
+#include "exception.hpp"
+#include "urlencoded.hpp"
+#include "header_names.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include "../singletons/main_config.hpp"
+#include "../singletons/job_dispatcher.hpp"
+#include "../job_base.hpp"
+#include "../pooled_allocator.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+namespace {
+	ConfigValue<std::size_t> g_request_arena_size("http_request_arena_size", 65536);
+	ConfigValue<boost::uint64_t> g_keep_alive_timeout("http_keep_alive_timeout", 5000);
+
+	CONSTEXPR const char CONNECTION_PREFACE[24] = { 'P','R','I',' ','*',' ','H','T','T','P','/','2','.','0','\r','\n','\r','\n','S','M','\r','\n','\r','\n' };
+
+	enum FrameType {
+		FT_DATA           = 0x0,
+		FT_HEADERS        = 0x1,
+		FT_PRIORITY       = 0x2,
+		FT_RST_STREAM     = 0x3,
+		FT_SETTINGS       = 0x4,
+		FT_PUSH_PROMISE   = 0x5,
+		FT_PING           = 0x6,
+		FT_GOAWAY         = 0x7,
+		FT_WINDOW_UPDATE  = 0x8,
+		FT_CONTINUATION   = 0x9,
+	};
+
+	enum {
+		FL_END_STREAM   = 0x01,
+		FL_ACK          = 0x01,
+		FL_END_HEADERS  = 0x04,
+		FL_PADDED       = 0x08,
+		FL_PRIORITY     = 0x20,
+	};
+
+	enum SettingId {
+		SETTINGS_HEADER_TABLE_SIZE       = 0x1,
+		SETTINGS_ENABLE_PUSH             = 0x2,
+		SETTINGS_MAX_CONCURRENT_STREAMS  = 0x3,
+		SETTINGS_INITIAL_WINDOW_SIZE     = 0x4,
+		SETTINGS_MAX_FRAME_SIZE          = 0x5,
+		SETTINGS_MAX_HEADER_LIST_SIZE    = 0x6,
+	};
+
+	CONSTEXPR const boost::int64_t DEFAULT_WINDOW_SIZE = 65535;
+	CONSTEXPR const boost::int64_t MAX_WINDOW_SIZE = 0x7FFFFFFF;
+	// 我们不修改 SETTINGS_MAX_FRAME_SIZE，所以对方发来的帧不会超过默认值。
+	CONSTEXPR const std::size_t DEFAULT_MAX_FRAME_SIZE = 16384;
+	CONSTEXPR const std::size_t MAX_MAX_FRAME_SIZE = 16777215;
+
+	// 在对方确认我们的 SETTINGS 之前，它按照默认的窗口发送数据，所以窗口不能比默认值小。
+	boost::uint32_t clamp_window_size(boost::uint64_t size){
+		return static_cast<boost::uint32_t>(std::min<boost::uint64_t>(std::max<boost::uint64_t>(size, DEFAULT_WINDOW_SIZE), MAX_WINDOW_SIZE));
+	}
+
+	void put_u16(StreamBuffer &buffer, unsigned value){
+		buffer.put(static_cast<int>((value >> 8) & 0xFF));
+		buffer.put(static_cast<int>(value & 0xFF));
+	}
+	void put_u32(StreamBuffer &buffer, boost::uint32_t value){
+		put_u16(buffer, value >> 16);
+		put_u16(buffer, value & 0xFFFF);
+	}
+	boost::uint32_t get_u32(StreamBuffer &buffer){
+		unsigned char bytes[4];
+		buffer.get(bytes, sizeof(bytes));
+		return (static_cast<boost::uint32_t>(bytes[0]) << 24) | (static_cast<boost::uint32_t>(bytes[1]) << 16) | (static_cast<boost::uint32_t>(bytes[2]) << 8) | bytes[3];
+	}
+	void put_frame_header(StreamBuffer &buffer, std::size_t length, unsigned type, unsigned flags, boost::uint32_t stream_id){
+		buffer.put(static_cast<int>((length >> 16) & 0xFF));
+		put_u16(buffer, static_cast<unsigned>(length & 0xFFFF));
+		buffer.put(static_cast<int>(type));
+		buffer.put(static_cast<int>(flags));
+		put_u32(buffer, stream_id & 0x7FFFFFFF);
+	}
+
+	// 去掉 DATA 或 HEADERS 帧的填充。填充长度不合法时返回 false。
+	bool strip_padding(StreamBuffer &payload, unsigned flags){
+		if(!(flags & FL_PADDED)){
+			return true;
+		}
+		const int pad_len = payload.get();
+		if((pad_len < 0) || (static_cast<std::size_t>(pad_len) > payload.size())){
+			return false;
+		}
+		StreamBuffer data = payload.cut_off(payload.size() - static_cast<std::size_t>(pad_len));
+		payload.swap(data);
+		return true;
+	}
+
+	// HTTP/2 中不允许出现逐跳的报头，见 RFC 7540 8.1.2.2。
+	bool is_connection_specific(const char *name){
+		return (::strcasecmp(name, "Connection") == 0) || (::strcasecmp(name, "Keep-Alive") == 0) || (::strcasecmp(name, "Proxy-Connection") == 0) ||
+			(::strcasecmp(name, "Transfer-Encoding") == 0) || (::strcasecmp(name, "Upgrade") == 0);
+	}
+	bool has_upper_case(const std::string &name){
+		for(AUTO(it, name.begin()); it != name.end(); ++it){
+			if((*it >= 'A') && (*it <= 'Z')){
+				return true;
+			}
+		}
+		return false;
+	}
+	void encode_headers(StreamBuffer &block, const OptionalMap &headers){
+		for(AUTO(it, headers.begin()); it != headers.end(); ++it){
+			if(is_connection_specific(it->first.get())){
+				continue;
+			}
+			hpack_encode_field(block, it->first.get(), it->second);
+		}
+	}
+
+	__thread const LowLevelSession *t_parent = 0; // XXX: NULLPTR
+	__thread Http2Session *t_http2_session = 0; // XXX: NULLPTR
+	__thread boost::uint32_t t_stream_id = 0;
+}
+
+struct Http2Session::Stream {
+	const boost::uint32_t id;
+
+	bool remote_closed;
+	RequestHeaders request_headers;
+	StreamBuffer entity;
+	boost::int64_t recv_window;
+	boost::uint64_t recv_unacked;
+
+	bool local_closed;
+	bool headers_sent;
+	boost::int64_t send_window;
+	StreamBuffer pending; // 因为流量控制而没有发出的数据。
+	bool pending_end;
+	bool has_trailers;
+	OptionalMap trailers;
+
+	Stream(boost::uint32_t id_, boost::int64_t recv_window_, boost::int64_t send_window_)
+		: id(id_)
+		, remote_closed(false), request_headers(), recv_window(recv_window_), recv_unacked(0)
+		, local_closed(false), headers_sent(false), send_window(send_window_), pending_end(false), has_trailers(false)
+	{ }
+};
+
+class Http2Session::StreamScope : NONCOPYABLE {
+private:
+	const LowLevelSession *const m_prev_parent;
+	Http2Session *const m_prev_http2_session;
+	const boost::uint32_t m_prev_stream_id;
+
+public:
+	StreamScope(const LowLevelSession *parent, Http2Session *http2_session, boost::uint32_t stream_id)
+		: m_prev_parent(t_parent), m_prev_http2_session(t_http2_session), m_prev_stream_id(t_stream_id)
+	{
+		t_parent = parent;
+		t_http2_session = http2_session;
+		t_stream_id = stream_id;
+	}
+	~StreamScope(){
+		t_parent = m_prev_parent;
+		t_http2_session = m_prev_http2_session;
+		t_stream_id = m_prev_stream_id;
+	}
+};
+
+class Http2Session::RequestJob : public JobBase {
+private:
+	const SocketBase::DelayedShutdownGuard m_guard;
+	const boost::weak_ptr<Session> m_weak_session;
+	const boost::shared_ptr<Http2Session> m_http2_session;
+	const boost::shared_ptr<Stream> m_stream;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
+
+	RequestHeaders m_request_headers;
+	StreamBuffer m_entity;
+
+public:
+	RequestJob(const boost::shared_ptr<Session> &session, const boost::shared_ptr<Http2Session> &http2_session, const boost::shared_ptr<Stream> &stream,
+		RequestHeaders request_headers, StreamBuffer entity)
+		: m_guard(session), m_weak_session(session), m_http2_session(http2_session), m_stream(stream), m_priority(session->get_job_priority()), m_thread_hint(session->get_epoll_thread_index())
+		, m_request_headers(STD_MOVE(request_headers)), m_entity(STD_MOVE(entity))
+	{ }
+
+private:
+	boost::weak_ptr<const void> get_category() const FINAL {
+		// 每个流一个类别，同一个连接上的不同请求可以并行处理。
+		return m_stream;
+	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
+	}
+	bool is_yieldable() const FINAL {
+		// StreamScope 保存在线程局部变量中，不能切换到其他任务。
+		return false;
+	}
+	bool is_rejectable() const FINAL {
+		return true;
+	}
+	void perform() FINAL {
+		PROFILE_ME;
+
+		const AUTO(session, m_weak_session.lock());
+		if(!session || session->has_been_shutdown_write()){
+			return;
+		}
+
+		const StreamScope scope(session.get(), m_http2_session.get(), m_stream->id);
+		try {
+			// 处理请求期间创建的临时缓冲区从同一块内存中分配，请求结束后一次性释放。
+			const StreamBuffer::ScratchArena arena(g_request_arena_size.get());
+			session->on_sync_request(STD_MOVE(m_request_headers), STD_MOVE(m_entity));
+
+			const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
+			session->set_timeout(keep_alive_timeout);
+		} catch(Exception &e){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Http::Exception thrown: status_code = ", e.get_status_code(), ", what = ", e.what());
+			m_http2_session->send_error(m_stream->id, e.get_status_code(), e.get_headers());
+		} catch(std::exception &e){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "std::exception thrown: what = ", e.what());
+			m_http2_session->send_error(m_stream->id, ST_INTERNAL_SERVER_ERROR, OptionalMap());
+		} catch(...){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown.");
+			m_http2_session->send_error(m_stream->id, ST_INTERNAL_SERVER_ERROR, OptionalMap());
+		}
+	}
+};
+
+Http2Session::Http2Session(const boost::shared_ptr<Session> &session)
+	: UpgradedSessionBase(session)
+	, m_weak_session(session)
+	, m_max_request_length(session->get_max_request_length())
+	, m_max_header_list_size(MainConfig::get<std::size_t>("http_max_headers_per_request", 64) * MainConfig::get<std::size_t>("http_max_header_line_length", 8192))
+	, m_max_concurrent_streams(MainConfig::get<std::size_t>("http2_max_concurrent_streams", 100))
+	, m_initial_window_size(clamp_window_size(MainConfig::get<boost::uint64_t>("http2_initial_window_size", 65535)))
+	, m_preface_received(false), m_settings_received(false), m_decoder()
+	, m_header_block_stream_id(0), m_header_block_end_stream(false)
+	, m_recv_window(m_initial_window_size), m_recv_unacked(0)
+	, m_goaway_sent(false), m_last_stream_id(0)
+	, m_send_window(DEFAULT_WINDOW_SIZE), m_peer_initial_window_size(DEFAULT_WINDOW_SIZE), m_peer_max_frame_size(DEFAULT_MAX_FRAME_SIZE)
+{ }
+Http2Session::~Http2Session(){ }
+
+Http2Session *Http2Session::get_current(const LowLevelSession *parent, boost::uint32_t &stream_id) NOEXCEPT {
+	if(!t_http2_session || (t_parent != parent)){
+		return NULLPTR;
+	}
+	stream_id = t_stream_id;
+	return t_http2_session;
+}
+
+bool Http2Session::send_frame(unsigned type, unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	StreamBuffer frame;
+	put_frame_header(frame, payload.size(), type, flags, stream_id);
+	frame.splice(payload);
+	return UpgradedSessionBase::send(STD_MOVE(frame));
+}
+bool Http2Session::send_rst_stream(boost::uint32_t stream_id, ErrorCode error_code){
+	StreamBuffer payload;
+	put_u32(payload, static_cast<boost::uint32_t>(error_code));
+	return send_frame(FT_RST_STREAM, 0, stream_id, STD_MOVE(payload));
+}
+bool Http2Session::send_window_update(boost::uint32_t stream_id, boost::uint32_t increment){
+	StreamBuffer payload;
+	put_u32(payload, increment);
+	return send_frame(FT_WINDOW_UPDATE, 0, stream_id, STD_MOVE(payload));
+}
+bool Http2Session::send_header_block(boost::uint32_t stream_id, StreamBuffer block, bool end_stream){
+	// HEADERS 和 CONTINUATION 必须连续发出，所以放在同一个缓冲区里。
+	StreamBuffer frames;
+	unsigned type = FT_HEADERS;
+	unsigned flags = end_stream ? FL_END_STREAM : 0;
+	for(;;){
+		StreamBuffer fragment = block.cut_off(std::min(block.size(), m_peer_max_frame_size));
+		if(block.empty()){
+			flags |= FL_END_HEADERS;
+		}
+		put_frame_header(frames, fragment.size(), type, flags, stream_id);
+		frames.splice(fragment);
+		if(block.empty()){
+			break;
+		}
+		type = FT_CONTINUATION;
+		flags = 0;
+	}
+	return UpgradedSessionBase::send(STD_MOVE(frames));
+}
+void Http2Session::connection_error(ErrorCode error_code, const char *reason){
+	LOG_POSEIDON_WARNING("HTTP/2 connection error: remote = ", get_remote_info(), ", error_code = ", static_cast<int>(error_code), ", reason = ", reason);
+	if(m_goaway_sent){
+		return;
+	}
+	m_goaway_sent = true;
+
+	StreamBuffer payload;
+	put_u32(payload, m_last_stream_id);
+	put_u32(payload, static_cast<boost::uint32_t>(error_code));
+	payload.put(reason);
+	send_frame(FT_GOAWAY, 0, 0, STD_MOVE(payload));
+	shutdown_read();
+	shutdown_write();
+}
+void Http2Session::reset_stream(const boost::shared_ptr<Stream> &stream, ErrorCode error_code){
+	LOG_POSEIDON_DEBUG("Resetting HTTP/2 stream: stream_id = ", stream->id, ", error_code = ", static_cast<int>(error_code));
+	send_rst_stream(stream->id, error_code);
+	stream->remote_closed = true;
+	stream->local_closed = true;
+	stream->pending.clear();
+	m_streams.erase(stream->id);
+}
+void Http2Session::close_local(const boost::shared_ptr<Stream> &stream){
+	stream->local_closed = true;
+	if(!stream->remote_closed){
+		// 请求还没有收完就已经响应了，告诉对方不必再发送（RFC 7540 8.1）。
+		send_rst_stream(stream->id, EC_NO_ERROR);
+		stream->remote_closed = true;
+	}
+	m_streams.erase(stream->id);
+}
+bool Http2Session::flush_stream(const boost::shared_ptr<Stream> &stream){
+	StreamBuffer frames;
+	bool end_sent = false;
+	while(!stream->pending.empty()){
+		const AUTO(window, std::min(m_send_window, stream->send_window));
+		if(window <= 0){
+			break;
+		}
+		const AUTO(size, static_cast<std::size_t>(std::min<boost::uint64_t>(std::min<boost::uint64_t>(static_cast<boost::uint64_t>(window), m_peer_max_frame_size), stream->pending.size())));
+		end_sent = stream->pending_end && !stream->has_trailers && (size == stream->pending.size());
+		put_frame_header(frames, size, FT_DATA, end_sent ? FL_END_STREAM : 0, stream->id);
+		StreamBuffer data = stream->pending.cut_off(size);
+		frames.splice(data);
+		m_send_window -= static_cast<boost::int64_t>(size);
+		stream->send_window -= static_cast<boost::int64_t>(size);
+	}
+	bool ret = true;
+	if(!frames.empty()){
+		ret = UpgradedSessionBase::send(STD_MOVE(frames));
+	}
+	if(!end_sent && stream->pending_end && stream->pending.empty()){
+		if(stream->has_trailers){
+			StreamBuffer block;
+			encode_headers(block, stream->trailers);
+			ret = send_header_block(stream->id, STD_MOVE(block), true) && ret;
+		} else {
+			ret = send_frame(FT_DATA, FL_END_STREAM, stream->id) && ret;
+		}
+		end_sent = true;
+	}
+	if(end_sent){
+		close_local(stream);
+	}
+	return ret;
+}
+void Http2Session::flush_all_streams(){
+	// flush_stream() 可能会从 m_streams 中删除元素。
+	std::vector<boost::shared_ptr<Stream> > streams;
+	streams.reserve(m_streams.size());
+	for(AUTO(it, m_streams.begin()); it != m_streams.end(); ++it){
+		if(!it->second->pending.empty() || it->second->pending_end){
+			streams.push_back(it->second);
+		}
+	}
+	for(AUTO(it, streams.begin()); it != streams.end(); ++it){
+		if(m_send_window <= 0){
+			break;
+		}
+		if((*it)->local_closed){
+			continue;
+		}
+		flush_stream(*it);
+	}
+}
+bool Http2Session::reject_stream(const boost::shared_ptr<Stream> &stream, StatusCode status_code){
+	AUTO(pair, make_default_response(status_code, OptionalMap()));
+	return unlocked_send_response(stream, STD_MOVE(pair.first), STD_MOVE(pair.second), false);
+}
+void Http2Session::dispatch_request(const boost::shared_ptr<Stream> &stream){
+	const AUTO(session, m_weak_session.lock());
+	if(!session){
+		reset_stream(stream, EC_CANCEL);
+		return;
+	}
+	const bool queued = JobDispatcher::enqueue(
+		boost::allocate_shared<RequestJob>(PooledAllocator<RequestJob>(), session, virtual_shared_from_this<Http2Session>(), stream, STD_MOVE(stream->request_headers), STD_MOVE(stream->entity)),
+		VAL_INIT);
+	if(!queued){
+		// 任务队列已满。
+		reject_stream(stream, ST_SERVICE_UNAVAILABLE);
+	}
+}
+
+boost::shared_ptr<Http2Session::Stream> Http2Session::unlocked_find_stream(boost::uint32_t stream_id) const {
+	const AUTO(it, m_streams.find(stream_id));
+	if((it == m_streams.end()) || it->second->local_closed){
+		return VAL_INIT;
+	}
+	return it->second;
+}
+bool Http2Session::unlocked_send_headers(const boost::shared_ptr<Stream> &stream, ResponseHeaders response_headers, bool end_stream){
+	StreamBuffer block;
+	hpack_encode_status(block, static_cast<unsigned>(response_headers.status_code));
+	encode_headers(block, response_headers.headers);
+	if(response_headers.status_code >= 200){
+		stream->headers_sent = true;
+	}
+	const bool ret = send_header_block(stream->id, STD_MOVE(block), end_stream);
+	if(end_stream){
+		close_local(stream);
+	}
+	return ret;
+}
+bool Http2Session::unlocked_send_data(const boost::shared_ptr<Stream> &stream, StreamBuffer data, bool end_stream){
+	if(!stream->headers_sent){
+		LOG_POSEIDON_WARNING("HTTP/2 response headers have not been sent: stream_id = ", stream->id);
+		return false;
+	}
+	stream->pending.splice(data);
+	if(end_stream){
+		stream->pending_end = true;
+	}
+	return flush_stream(stream);
+}
+bool Http2Session::unlocked_send_response(const boost::shared_ptr<Stream> &stream, ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length){
+	AUTO_REF(headers, response_headers.headers);
+	if(entity.empty()){
+		headers.erase("Content-Type");
+		if(set_content_length){
+			headers.set(sslit("Content-Length"), "0");
+		}
+	} else if(set_content_length){
+		char temp[64];
+		const unsigned len = (unsigned)std::sprintf(temp, "%llu", (unsigned long long)entity.size());
+		headers.set(sslit("Content-Length"), std::string(temp, len));
+	}
+	if(response_headers.status_code < 200){
+		// 1xx 响应之后还有最终的响应。
+		return unlocked_send_headers(stream, STD_MOVE(response_headers), false);
+	}
+	if(entity.empty()){
+		return unlocked_send_headers(stream, STD_MOVE(response_headers), true);
+	}
+	if(!unlocked_send_headers(stream, STD_MOVE(response_headers), false)){
+		return false;
+	}
+	return unlocked_send_data(stream, STD_MOVE(entity), true);
+}
+
+void Http2Session::on_frame(unsigned type, unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if((m_header_block_stream_id != 0) && (type != FT_CONTINUATION)){
+		connection_error(EC_PROTOCOL_ERROR, "CONTINUATION expected");
+		return;
+	}
+	if(!m_settings_received && (type != FT_SETTINGS)){
+		connection_error(EC_PROTOCOL_ERROR, "The first frame must be SETTINGS");
+		return;
+	}
+	switch(type){
+	case FT_DATA:
+		on_data_frame(flags, stream_id, STD_MOVE(payload));
+		break;
+	case FT_HEADERS:
+		on_headers_frame(flags, stream_id, STD_MOVE(payload));
+		break;
+	case FT_PRIORITY:
+		// 我们不按照优先级调度。
+		if(stream_id == 0){
+			connection_error(EC_PROTOCOL_ERROR, "PRIORITY on stream 0");
+		} else if(payload.size() != 5){
+			connection_error(EC_FRAME_SIZE_ERROR, "Invalid PRIORITY frame");
+		}
+		break;
+	case FT_RST_STREAM:
+		on_rst_stream_frame(stream_id, STD_MOVE(payload));
+		break;
+	case FT_SETTINGS:
+		on_settings_frame(flags, stream_id, STD_MOVE(payload));
+		break;
+	case FT_PUSH_PROMISE:
+		connection_error(EC_PROTOCOL_ERROR, "Clients cannot push");
+		break;
+	case FT_PING:
+		on_ping_frame(flags, stream_id, STD_MOVE(payload));
+		break;
+	case FT_GOAWAY:
+		on_goaway_frame(stream_id, STD_MOVE(payload));
+		break;
+	case FT_WINDOW_UPDATE:
+		on_window_update_frame(stream_id, STD_MOVE(payload));
+		break;
+	case FT_CONTINUATION:
+		on_continuation_frame(flags, stream_id, STD_MOVE(payload));
+		break;
+	default:
+		// 未知类型的帧必须被忽略。
+		LOG_POSEIDON_DEBUG("Ignoring unknown HTTP/2 frame: type = ", type);
+		break;
+	}
+}
+void Http2Session::on_data_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(stream_id == 0){
+		connection_error(EC_PROTOCOL_ERROR, "DATA on stream 0");
+		return;
+	}
+	// 流量控制按照整个帧计算，包括填充。
+	const AUTO(frame_size, payload.size());
+	m_recv_window -= static_cast<boost::int64_t>(frame_size);
+	if(m_recv_window < 0){
+		connection_error(EC_FLOW_CONTROL_ERROR, "Connection flow control window exceeded");
+		return;
+	}
+	m_recv_unacked += frame_size;
+	if(m_recv_unacked >= m_initial_window_size / 2){
+		send_window_update(0, static_cast<boost::uint32_t>(m_recv_unacked));
+		m_recv_window += static_cast<boost::int64_t>(m_recv_unacked);
+		m_recv_unacked = 0;
+	}
+	if(!strip_padding(payload, flags)){
+		connection_error(EC_PROTOCOL_ERROR, "Invalid padding");
+		return;
+	}
+
+	const AUTO(it, m_streams.find(stream_id));
+	if(it == m_streams.end()){
+		if(stream_id > m_last_stream_id){
+			connection_error(EC_PROTOCOL_ERROR, "DATA on idle stream");
+			return;
+		}
+		send_rst_stream(stream_id, EC_STREAM_CLOSED);
+		return;
+	}
+	const AUTO(stream, it->second);
+	if(stream->remote_closed){
+		reset_stream(stream, EC_STREAM_CLOSED);
+		return;
+	}
+	stream->recv_window -= static_cast<boost::int64_t>(frame_size);
+	if(stream->recv_window < 0){
+		reset_stream(stream, EC_FLOW_CONTROL_ERROR);
+		return;
+	}
+	if(stream->entity.size() + payload.size() > m_max_request_length){
+		reject_stream(stream, ST_PAYLOAD_TOO_LARGE);
+		return;
+	}
+	stream->entity.splice(payload);
+	if(flags & FL_END_STREAM){
+		stream->remote_closed = true;
+		dispatch_request(stream);
+		return;
+	}
+	stream->recv_unacked += frame_size;
+	if(stream->recv_unacked >= m_initial_window_size / 2){
+		send_window_update(stream_id, static_cast<boost::uint32_t>(stream->recv_unacked));
+		stream->recv_window += static_cast<boost::int64_t>(stream->recv_unacked);
+		stream->recv_unacked = 0;
+	}
+}
+void Http2Session::on_headers_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if((stream_id == 0) || !(stream_id & 1)){
+		connection_error(EC_PROTOCOL_ERROR, "Invalid stream ID for HEADERS");
+		return;
+	}
+	if(!strip_padding(payload, flags)){
+		connection_error(EC_PROTOCOL_ERROR, "Invalid padding");
+		return;
+	}
+	if(flags & FL_PRIORITY){
+		if(payload.size() < 5){
+			connection_error(EC_FRAME_SIZE_ERROR, "Invalid HEADERS frame");
+			return;
+		}
+		payload.discard(5);
+	}
+	m_header_block_stream_id = stream_id;
+	m_header_block_end_stream = flags & FL_END_STREAM;
+	m_header_block = payload.dump_string();
+	if(m_header_block.size() > m_max_header_list_size){
+		connection_error(EC_ENHANCE_YOUR_CALM, "Header block is too large");
+		return;
+	}
+	if(flags & FL_END_HEADERS){
+		on_header_block();
+	}
+}
+void Http2Session::on_continuation_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if((m_header_block_stream_id == 0) || (stream_id != m_header_block_stream_id)){
+		connection_error(EC_PROTOCOL_ERROR, "Unexpected CONTINUATION");
+		return;
+	}
+	m_header_block += payload.dump_string();
+	if(m_header_block.size() > m_max_header_list_size){
+		connection_error(EC_ENHANCE_YOUR_CALM, "Header block is too large");
+		return;
+	}
+	if(flags & FL_END_HEADERS){
+		on_header_block();
+	}
+}
+void Http2Session::on_header_block(){
+	PROFILE_ME;
+
+	const AUTO(stream_id, m_header_block_stream_id);
+	const bool end_stream = m_header_block_end_stream;
+	m_header_block_stream_id = 0;
+
+	// 即使这个流会被拒绝，报头块也必须解码，否则动态表就不同步了。
+	std::vector<std::pair<std::string, std::string> > fields;
+	try {
+		m_decoder.decode(fields, m_header_block.data(), m_header_block.size(), m_max_header_list_size);
+	} catch(std::exception &e){
+		LOG_POSEIDON_WARNING("Failed to decode HTTP/2 header block: what = ", e.what());
+		connection_error(EC_COMPRESSION_ERROR, "Failed to decode header block");
+		return;
+	}
+	m_header_block.clear();
+
+	const AUTO(it, m_streams.find(stream_id));
+	if(it != m_streams.end()){
+		// 尾部报头，必须结束这个流，并且不能有伪报头。
+		const AUTO(stream, it->second);
+		if(stream->remote_closed){
+			reset_stream(stream, EC_STREAM_CLOSED);
+			return;
+		}
+		if(!end_stream){
+			reset_stream(stream, EC_PROTOCOL_ERROR);
+			return;
+		}
+		for(AUTO(fit, fields.begin()); fit != fields.end(); ++fit){
+			if(fit->first.empty() || (fit->first[0] == ':') || has_upper_case(fit->first)){
+				reset_stream(stream, EC_PROTOCOL_ERROR);
+				return;
+			}
+			stream->request_headers.headers.append(make_header_name(fit->first.data(), fit->first.size()), STD_MOVE(fit->second));
+		}
+		stream->remote_closed = true;
+		dispatch_request(stream);
+		return;
+	}
+	if(stream_id <= m_last_stream_id){
+		connection_error(EC_STREAM_CLOSED, "HEADERS on closed stream");
+		return;
+	}
+	m_last_stream_id = stream_id;
+	if(m_streams.size() >= m_max_concurrent_streams){
+		send_rst_stream(stream_id, EC_REFUSED_STREAM);
+		return;
+	}
+	const AUTO(stream, boost::make_shared<Stream>(stream_id, m_initial_window_size, m_peer_initial_window_size));
+	m_streams.insert(std::make_pair(stream_id, stream));
+
+	AUTO_REF(request_headers, stream->request_headers);
+	request_headers.verb = V_INVALID_VERB;
+	request_headers.version = 20000;
+	bool method_seen = false, regular_seen = false, malformed = false;
+	std::string path, authority, cookie;
+	for(AUTO(fit, fields.begin()); fit != fields.end(); ++fit){
+		AUTO_REF(name, fit->first);
+		AUTO_REF(value, fit->second);
+		if(name.empty() || has_upper_case(name)){
+			malformed = true;
+			break;
+		}
+		if(name[0] == ':'){
+			// 伪报头必须在普通报头之前。
+			if(regular_seen){
+				malformed = true;
+				break;
+			}
+			if(name == ":method"){
+				request_headers.verb = get_verb_from_string(value.c_str());
+				method_seen = true;
+			} else if(name == ":path"){
+				path.swap(value);
+			} else if(name == ":authority"){
+				authority.swap(value);
+			} else if(name != ":scheme"){
+				malformed = true;
+				break;
+			}
+			continue;
+		}
+		regular_seen = true;
+		if(name == "cookie"){
+			// 分开发送的 Cookie 需要合并（RFC 7540 8.1.2.5）。
+			if(!cookie.empty()){
+				cookie += "; ";
+			}
+			cookie += value;
+			continue;
+		}
+		request_headers.headers.append(make_header_name(name.data(), name.size()), STD_MOVE(value));
+	}
+	if(malformed || !method_seen || path.empty()){
+		reset_stream(stream, EC_PROTOCOL_ERROR);
+		return;
+	}
+	if(!cookie.empty()){
+		request_headers.headers.set(sslit("Cookie"), STD_MOVE(cookie));
+	}
+	if(!authority.empty() && !request_headers.headers.has("Host")){
+		request_headers.headers.set(sslit("Host"), STD_MOVE(authority));
+	}
+	const AUTO(query_pos, path.find('?'));
+	if(query_pos != std::string::npos){
+		url_decode_params(request_headers.get_params, path.data() + query_pos + 1, path.size() - query_pos - 1);
+		path.erase(query_pos);
+	}
+	request_headers.uri.swap(path);
+
+	stream->remote_closed = end_stream;
+	if(request_headers.verb == V_INVALID_VERB){
+		reject_stream(stream, ST_NOT_IMPLEMENTED);
+		return;
+	}
+	if(end_stream){
+		dispatch_request(stream);
+		return;
+	}
+	if(::strcasecmp(request_headers.headers.get("Expect").c_str(), "100-continue") == 0){
+		ResponseHeaders response_headers;
+		response_headers.version = 20000;
+		response_headers.status_code = ST_CONTINUE;
+		unlocked_send_headers(stream, STD_MOVE(response_headers), false);
+	}
+}
+void Http2Session::on_rst_stream_frame(boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(stream_id == 0){
+		connection_error(EC_PROTOCOL_ERROR, "RST_STREAM on stream 0");
+		return;
+	}
+	if(payload.size() != 4){
+		connection_error(EC_FRAME_SIZE_ERROR, "Invalid RST_STREAM frame");
+		return;
+	}
+	if(stream_id > m_last_stream_id){
+		connection_error(EC_PROTOCOL_ERROR, "RST_STREAM on idle stream");
+		return;
+	}
+	const AUTO(error_code, get_u32(payload));
+	LOG_POSEIDON_DEBUG("HTTP/2 stream reset by peer: stream_id = ", stream_id, ", error_code = ", error_code);
+	const AUTO(it, m_streams.find(stream_id));
+	if(it == m_streams.end()){
+		return;
+	}
+	// 任务可能还在处理这个请求，之后发送的数据会被丢弃。
+	const AUTO(stream, it->second);
+	stream->remote_closed = true;
+	stream->local_closed = true;
+	stream->pending.clear();
+	m_streams.erase(it);
+}
+void Http2Session::on_settings_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(stream_id != 0){
+		connection_error(EC_PROTOCOL_ERROR, "SETTINGS on non-zero stream");
+		return;
+	}
+	if(flags & FL_ACK){
+		if(!payload.empty()){
+			connection_error(EC_FRAME_SIZE_ERROR, "Invalid SETTINGS acknowledgement");
+		}
+		return;
+	}
+	if(payload.size() % 6 != 0){
+		connection_error(EC_FRAME_SIZE_ERROR, "Invalid SETTINGS frame");
+		return;
+	}
+	m_settings_received = true;
+
+	bool window_increased = false;
+	while(!payload.empty()){
+		const unsigned id = static_cast<unsigned>(payload.get() << 8);
+		const unsigned setting = id | static_cast<unsigned>(payload.get());
+		const AUTO(value, get_u32(payload));
+		switch(setting){
+		case SETTINGS_ENABLE_PUSH:
+			if(value > 1){
+				connection_error(EC_PROTOCOL_ERROR, "Invalid SETTINGS_ENABLE_PUSH");
+				return;
+			}
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE: {
+			if(value > MAX_WINDOW_SIZE){
+				connection_error(EC_FLOW_CONTROL_ERROR, "Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+				return;
+			}
+			// 已经打开的流的窗口按照差值调整，可能变成负数。
+			const AUTO(delta, static_cast<boost::int64_t>(value) - m_peer_initial_window_size);
+			m_peer_initial_window_size = value;
+			for(AUTO(it, m_streams.begin()); it != m_streams.end(); ++it){
+				it->second->send_window += delta;
+				if(it->second->send_window > MAX_WINDOW_SIZE){
+					connection_error(EC_FLOW_CONTROL_ERROR, "Flow control window overflowed");
+					return;
+				}
+			}
+			window_increased = window_increased || (delta > 0);
+			break; }
+		case SETTINGS_MAX_FRAME_SIZE:
+			if((value < DEFAULT_MAX_FRAME_SIZE) || (value > MAX_MAX_FRAME_SIZE)){
+				connection_error(EC_PROTOCOL_ERROR, "Invalid SETTINGS_MAX_FRAME_SIZE");
+				return;
+			}
+			m_peer_max_frame_size = value;
+			break;
+		default:
+			// 编码器不使用动态表，所以 SETTINGS_HEADER_TABLE_SIZE 对我们没有影响。其他的设置也不影响我们。
+			break;
+		}
+	}
+	send_frame(FT_SETTINGS, FL_ACK, 0);
+	if(window_increased){
+		flush_all_streams();
+	}
+}
+void Http2Session::on_ping_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(stream_id != 0){
+		connection_error(EC_PROTOCOL_ERROR, "PING on non-zero stream");
+		return;
+	}
+	if(payload.size() != 8){
+		connection_error(EC_FRAME_SIZE_ERROR, "Invalid PING frame");
+		return;
+	}
+	if(flags & FL_ACK){
+		return;
+	}
+	send_frame(FT_PING, FL_ACK, 0, STD_MOVE(payload));
+}
+void Http2Session::on_goaway_frame(boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(stream_id != 0){
+		connection_error(EC_PROTOCOL_ERROR, "GOAWAY on non-zero stream");
+		return;
+	}
+	if(payload.size() < 8){
+		connection_error(EC_FRAME_SIZE_ERROR, "Invalid GOAWAY frame");
+		return;
+	}
+	// 对方不会再打开新的流，已经收到的请求照常处理。
+	const AUTO(last_stream_id, get_u32(payload) & 0x7FFFFFFF);
+	const AUTO(error_code, get_u32(payload));
+	LOG_POSEIDON_DEBUG("Received HTTP/2 GOAWAY: last_stream_id = ", last_stream_id, ", error_code = ", error_code);
+}
+void Http2Session::on_window_update_frame(boost::uint32_t stream_id, StreamBuffer payload){
+	PROFILE_ME;
+
+	if(payload.size() != 4){
+		connection_error(EC_FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE frame");
+		return;
+	}
+	const AUTO(increment, get_u32(payload) & 0x7FFFFFFF);
+	if(stream_id == 0){
+		if(increment == 0){
+			connection_error(EC_PROTOCOL_ERROR, "Zero WINDOW_UPDATE increment");
+			return;
+		}
+		m_send_window += increment;
+		if(m_send_window > MAX_WINDOW_SIZE){
+			connection_error(EC_FLOW_CONTROL_ERROR, "Flow control window overflowed");
+			return;
+		}
+		flush_all_streams();
+		return;
+	}
+	if(stream_id > m_last_stream_id){
+		connection_error(EC_PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream");
+		return;
+	}
+	const AUTO(it, m_streams.find(stream_id));
+	if(it == m_streams.end()){
+		return;
+	}
+	const AUTO(stream, it->second);
+	if(increment == 0){
+		reset_stream(stream, EC_PROTOCOL_ERROR);
+		return;
+	}
+	stream->send_window += increment;
+	if(stream->send_window > MAX_WINDOW_SIZE){
+		reset_stream(stream, EC_FLOW_CONTROL_ERROR);
+		return;
+	}
+	flush_stream(stream);
+}
+
+bool Http2Session::send_headers(boost::uint32_t stream_id, ResponseHeaders response_headers, bool end_stream){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const AUTO(stream, unlocked_find_stream(stream_id));
+	if(!stream){
+		return false;
+	}
+	return unlocked_send_headers(stream, STD_MOVE(response_headers), end_stream);
+}
+bool Http2Session::send_data(boost::uint32_t stream_id, StreamBuffer data, bool end_stream){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const AUTO(stream, unlocked_find_stream(stream_id));
+	if(!stream){
+		return false;
+	}
+	return unlocked_send_data(stream, STD_MOVE(data), end_stream);
+}
+bool Http2Session::send_trailers(boost::uint32_t stream_id, OptionalMap headers){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const AUTO(stream, unlocked_find_stream(stream_id));
+	if(!stream || !stream->headers_sent){
+		return false;
+	}
+	stream->has_trailers = !headers.empty();
+	stream->trailers = STD_MOVE(headers);
+	stream->pending_end = true;
+	return flush_stream(stream);
+}
+bool Http2Session::send_response(boost::uint32_t stream_id, ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const AUTO(stream, unlocked_find_stream(stream_id));
+	if(!stream){
+		return false;
+	}
+	return unlocked_send_response(stream, STD_MOVE(response_headers), STD_MOVE(entity), set_content_length);
+}
+bool Http2Session::send_error(boost::uint32_t stream_id, StatusCode status_code, OptionalMap headers){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const AUTO(stream, unlocked_find_stream(stream_id));
+	if(!stream){
+		return false;
+	}
+	if(stream->headers_sent){
+		reset_stream(stream, EC_INTERNAL_ERROR);
+		return false;
+	}
+	AUTO(pair, make_default_response(status_code, STD_MOVE(headers)));
+	return unlocked_send_response(stream, STD_MOVE(pair.first), STD_MOVE(pair.second), false);
+}
+
+void Http2Session::on_connect(){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	StreamBuffer payload;
+	put_u16(payload, SETTINGS_MAX_CONCURRENT_STREAMS);
+	put_u32(payload, static_cast<boost::uint32_t>(std::min<std::size_t>(m_max_concurrent_streams, 0xFFFFFFFF)));
+	put_u16(payload, SETTINGS_INITIAL_WINDOW_SIZE);
+	put_u32(payload, m_initial_window_size);
+	send_frame(FT_SETTINGS, 0, 0, STD_MOVE(payload));
+	// 连接的窗口只能通过 WINDOW_UPDATE 增大。
+	if(m_initial_window_size > DEFAULT_WINDOW_SIZE){
+		send_window_update(0, static_cast<boost::uint32_t>(m_initial_window_size - DEFAULT_WINDOW_SIZE));
+	}
+}
+void Http2Session::on_read_hup(){
+	PROFILE_ME;
+
+	// Session::on_read_hup() 会在所有请求处理完之后关闭连接。
+}
+void Http2Session::on_close(int err_code){
+	PROFILE_ME;
+
+	(void)err_code;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_streams.begin()); it != m_streams.end(); ++it){
+		it->second->local_closed = true;
+		it->second->pending.clear();
+	}
+	m_streams.clear();
+}
+void Http2Session::on_receive(StreamBuffer data){
+	PROFILE_ME;
+
+	m_queue.splice(data);
+
+	const Mutex::UniqueLock lock(m_mutex);
+	if(!m_preface_received){
+		if(m_queue.size() < sizeof(CONNECTION_PREFACE)){
+			return;
+		}
+		char preface[sizeof(CONNECTION_PREFACE)];
+		m_queue.get(preface, sizeof(preface));
+		if(std::memcmp(preface, CONNECTION_PREFACE, sizeof(preface)) != 0){
+			connection_error(EC_PROTOCOL_ERROR, "Invalid connection preface");
+			return;
+		}
+		m_preface_received = true;
+	}
+	while(!m_goaway_sent){
+		unsigned char header[9];
+		if(m_queue.peek(header, sizeof(header)) < sizeof(header)){
+			break;
+		}
+		const AUTO(length, (static_cast<std::size_t>(header[0]) << 16) | (static_cast<std::size_t>(header[1]) << 8) | header[2]);
+		if(length > DEFAULT_MAX_FRAME_SIZE){
+			connection_error(EC_FRAME_SIZE_ERROR, "Frame is too large");
+			break;
+		}
+		if(m_queue.size() < sizeof(header) + length){
+			break;
+		}
+		const unsigned type = header[3];
+		const unsigned flags = header[4];
+		const AUTO(stream_id, ((static_cast<boost::uint32_t>(header[5]) << 24) | (static_cast<boost::uint32_t>(header[6]) << 16) | (static_cast<boost::uint32_t>(header[7]) << 8) | header[8]) & 0x7FFFFFFF);
+		m_queue.discard(sizeof(header));
+		on_frame(type, flags, stream_id, m_queue.cut_off(length));
+	}
+}
+
+}
+}
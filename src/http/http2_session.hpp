@@ -0,0 +1,136 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_HTTP2_SESSION_HPP_
+#define POSEIDON_HTTP_HTTP2_SESSION_HPP_
+
+#include "upgraded_session_base.hpp"
+#include "hpack.hpp"
+#include "request_headers.hpp"
+#include "response_headers.hpp"
+#include "status_codes.hpp"
+#include "../mutex.hpp"
+#include "../stream_buffer.hpp"
+#include <map>
+#include <string>
+
+namespace Poseidon {
+namespace Http {
+
+class LowLevelSession;
+class Session;
+
+// HTTP/2（RFC 7540）。LowLevelSession 在连接开头收到客户端的连接序言之后创建它，取代 HTTP/1.x 的解析；
+// 通过 TLS 连接时由 ALPN 协商，明文连接时要求客户端事先知道服务器支持 HTTP/2。
+// 每个流上完整的请求作为一个任务交给 Session::on_sync_request()，任务的类别是这个流，所以不同的流可以并行处理。
+// 在 on_sync_request() 中调用 Session 的 send() 系列函数时，响应被写入当前的流；
+// 不在 on_sync_request() 中时无法确定流，这些函数会抛出异常。
+class Http2Session : public UpgradedSessionBase {
+	friend LowLevelSession;
+
+public:
+	enum ErrorCode {
+		EC_NO_ERROR             = 0x0,
+		EC_PROTOCOL_ERROR       = 0x1,
+		EC_INTERNAL_ERROR       = 0x2,
+		EC_FLOW_CONTROL_ERROR   = 0x3,
+		EC_SETTINGS_TIMEOUT     = 0x4,
+		EC_STREAM_CLOSED        = 0x5,
+		EC_FRAME_SIZE_ERROR     = 0x6,
+		EC_REFUSED_STREAM       = 0x7,
+		EC_CANCEL               = 0x8,
+		EC_COMPRESSION_ERROR    = 0x9,
+		EC_CONNECT_ERROR        = 0xA,
+		EC_ENHANCE_YOUR_CALM    = 0xB,
+		EC_INADEQUATE_SECURITY  = 0xC,
+		EC_HTTP_1_1_REQUIRED    = 0xD,
+	};
+
+private:
+	struct Stream;
+	class RequestJob;
+	class StreamScope;
+
+private:
+	const boost::weak_ptr<Session> m_weak_session;
+	const boost::uint64_t m_max_request_length;
+	const std::size_t m_max_header_list_size;
+	const std::size_t m_max_concurrent_streams;
+	const boost::uint32_t m_initial_window_size;
+
+	// 以下成员只在 epoll 线程中访问。
+	StreamBuffer m_queue;
+	bool m_preface_received;
+	bool m_settings_received;
+	HpackDecoder m_decoder;
+	boost::uint32_t m_header_block_stream_id; // 非零表示正在等待 CONTINUATION 帧。
+	bool m_header_block_end_stream;
+	std::string m_header_block;
+	boost::int64_t m_recv_window;
+	boost::uint64_t m_recv_unacked;
+
+	mutable Mutex m_mutex;
+	bool m_goaway_sent;
+	boost::uint32_t m_last_stream_id;
+	std::map<boost::uint32_t, boost::shared_ptr<Stream> > m_streams;
+	boost::int64_t m_send_window;
+	boost::int64_t m_peer_initial_window_size;
+	std::size_t m_peer_max_frame_size;
+
+public:
+	explicit Http2Session(const boost::shared_ptr<Session> &session);
+	~Http2Session();
+
+private:
+	// 如果当前线程正在处理 parent 上某个流的请求，返回这个 Http2Session 并通过 stream_id 返回流的编号。
+	static Http2Session *get_current(const LowLevelSession *parent, boost::uint32_t &stream_id) NOEXCEPT;
+
+	// 以下函数都需要在持有 m_mutex 时调用。
+	bool send_frame(unsigned type, unsigned flags, boost::uint32_t stream_id, StreamBuffer payload = StreamBuffer());
+	bool send_rst_stream(boost::uint32_t stream_id, ErrorCode error_code);
+	bool send_window_update(boost::uint32_t stream_id, boost::uint32_t increment);
+	bool send_header_block(boost::uint32_t stream_id, StreamBuffer block, bool end_stream);
+	void connection_error(ErrorCode error_code, const char *reason);
+	void reset_stream(const boost::shared_ptr<Stream> &stream, ErrorCode error_code);
+	void close_local(const boost::shared_ptr<Stream> &stream);
+	bool flush_stream(const boost::shared_ptr<Stream> &stream);
+	void flush_all_streams();
+	bool reject_stream(const boost::shared_ptr<Stream> &stream, StatusCode status_code);
+	void dispatch_request(const boost::shared_ptr<Stream> &stream);
+
+	boost::shared_ptr<Stream> unlocked_find_stream(boost::uint32_t stream_id) const;
+	bool unlocked_send_headers(const boost::shared_ptr<Stream> &stream, ResponseHeaders response_headers, bool end_stream);
+	bool unlocked_send_data(const boost::shared_ptr<Stream> &stream, StreamBuffer data, bool end_stream);
+	bool unlocked_send_response(const boost::shared_ptr<Stream> &stream, ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length);
+
+	void on_frame(unsigned type, unsigned flags, boost::uint32_t stream_id, StreamBuffer payload);
+	void on_data_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload);
+	void on_headers_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload);
+	void on_continuation_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload);
+	void on_header_block();
+	void on_rst_stream_frame(boost::uint32_t stream_id, StreamBuffer payload);
+	void on_settings_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload);
+	void on_ping_frame(unsigned flags, boost::uint32_t stream_id, StreamBuffer payload);
+	void on_goaway_frame(boost::uint32_t stream_id, StreamBuffer payload);
+	void on_window_update_frame(boost::uint32_t stream_id, StreamBuffer payload);
+
+	// 以下函数由 LowLevelSession 在 on_sync_request() 中调用。
+	bool send_headers(boost::uint32_t stream_id, ResponseHeaders response_headers, bool end_stream);
+	bool send_data(boost::uint32_t stream_id, StreamBuffer data, bool end_stream);
+	bool send_trailers(boost::uint32_t stream_id, OptionalMap headers);
+	bool send_response(boost::uint32_t stream_id, ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length);
+	// 如果响应头还没有发出，发送一个默认的错误响应；否则只能重置这个流。
+	bool send_error(boost::uint32_t stream_id, StatusCode status_code, OptionalMap headers);
+
+protected:
+	// UpgradedSessionBase
+	void on_connect() OVERRIDE;
+	void on_read_hup() OVERRIDE;
+	void on_close(int err_code) OVERRIDE;
+	void on_receive(StreamBuffer data) OVERRIDE;
+};
+
+}
+}
+
+#endif
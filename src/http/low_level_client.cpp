@@ -15,6 +15,9 @@ namespace Http {
 LowLevelClient::LowLevelClient(const SockAddr &addr, bool use_ssl, bool verify_peer)
 	: TcpClientBase(addr, use_ssl, verify_peer), ClientReader(), ClientWriter()
 { }
+LowLevelClient::LowLevelClient(const boost::container::vector<SockAddr> &addrs, bool use_ssl, bool verify_peer)
+	: TcpClientBase(addrs, use_ssl, verify_peer), ClientReader(), ClientWriter()
+{ }
 LowLevelClient::~LowLevelClient(){ }
 
 void LowLevelClient::on_connect(){
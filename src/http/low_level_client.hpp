@@ -27,6 +27,7 @@ private:
 
 public:
 	explicit LowLevelClient(const SockAddr &addr, bool use_ssl = false, bool verify_peer = true);
+	explicit LowLevelClient(const boost::container::vector<SockAddr> &addrs, bool use_ssl = false, bool verify_peer = true);
 	~LowLevelClient();
 
 protected:
@@ -5,19 +5,158 @@
 #include "low_level_session.hpp"
 #include "exception.hpp"
 #include "upgraded_session_base.hpp"
+#include "http2_session.hpp"
 #include "header_option.hpp"
+#include "compression.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../stream_buffer.hpp"
+#include "../atomic.hpp"
+#include "../system_exception.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
 
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	CONSTEXPR const char HTTP2_PREFACE[24] = { 'P','R','I',' ','*',' ','H','T','T','P','/','2','.','0','\r','\n','\r','\n','S','M','\r','\n','\r','\n' };
+
+	// RFC 7231 中的 IMF-fixdate，例如 Sun, 06 Nov 1994 08:49:37 GMT。
+	std::string format_http_date(::time_t t){
+		static const char s_days[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+		static const char s_months[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+		::tm tm;
+		::gmtime_r(&t, &tm);
+		char temp[64];
+		const unsigned len = (unsigned)std::sprintf(temp, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+			s_days[tm.tm_wday % 7], (unsigned)tm.tm_mday, s_months[tm.tm_mon % 12], (unsigned)tm.tm_year + 1900, (unsigned)tm.tm_hour, (unsigned)tm.tm_min, (unsigned)tm.tm_sec);
+		return std::string(temp, len);
+	}
+	bool parse_http_date(::time_t &t, const std::string &str){
+		::tm tm = { };
+		const char *const end = ::strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+		if(!end || (*end != 0)){
+			return false;
+		}
+		t = ::timegm(&tm);
+		return true;
+	}
+
+	// If-None-Match 使用弱比较，忽略 W/ 前缀。
+	bool etag_list_matches(const std::string &list, const std::string &etag){
+		std::size_t pos = 0;
+		while(pos < list.size()){
+			std::size_t end = list.find(',', pos);
+			if(end == std::string::npos){
+				end = list.size();
+			}
+			std::size_t begin = list.find_first_not_of(" \t", pos);
+			pos = end + 1;
+			if((begin == std::string::npos) || (begin >= end)){
+				continue;
+			}
+			while((end > begin) && ((list[end - 1] == ' ') || (list[end - 1] == '\t'))){
+				--end;
+			}
+			if((end - begin == 1) && (list[begin] == '*')){
+				return true;
+			}
+			if((end - begin >= 2) && (list.compare(begin, 2, "W/") == 0)){
+				begin += 2;
+			}
+			if(list.compare(begin, end - begin, etag) == 0){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	enum RangeResult {
+		RR_IGNORED,
+		RR_SATISFIABLE,
+		RR_UNSATISFIABLE,
+	};
+
+	bool parse_range_number(boost::uint64_t &num, const std::string &str, std::size_t begin, std::size_t end){
+		if(begin == end){
+			return false;
+		}
+		num = 0;
+		for(std::size_t i = begin; i < end; ++i){
+			const unsigned digit = (unsigned char)str[i] - '0';
+			if((digit > 9) || (num > ((boost::uint64_t)-1 - digit) / 10)){
+				return false;
+			}
+			num = num * 10 + digit;
+		}
+		return true;
+	}
+	// 只支持单个区间，结果是左闭右开区间 [begin, end)。
+	RangeResult parse_range(boost::uint64_t &begin, boost::uint64_t &end, const std::string &str, boost::uint64_t size){
+		if((str.size() < 6) || (::strncasecmp(str.c_str(), "bytes=", 6) != 0)){
+			return RR_IGNORED;
+		}
+		if(str.find(',', 6) != std::string::npos){
+			return RR_IGNORED;
+		}
+		const std::size_t dash = str.find('-', 6);
+		if(dash == std::string::npos){
+			return RR_IGNORED;
+		}
+		boost::uint64_t first, last;
+		if(dash == 6){
+			// 最后 n 个字节。
+			if(!parse_range_number(last, str, dash + 1, str.size())){
+				return RR_IGNORED;
+			}
+			if((last == 0) || (size == 0)){
+				return RR_UNSATISFIABLE;
+			}
+			begin = size - std::min(last, size);
+			end = size;
+			return RR_SATISFIABLE;
+		}
+		if(!parse_range_number(first, str, 6, dash)){
+			return RR_IGNORED;
+		}
+		if(dash + 1 == str.size()){
+			last = size - 1;
+		} else {
+			if(!parse_range_number(last, str, dash + 1, str.size())){
+				return RR_IGNORED;
+			}
+			if(last < first){
+				return RR_IGNORED;
+			}
+		}
+		if(first >= size){
+			return RR_UNSATISFIABLE;
+		}
+		begin = first;
+		end = std::min(last, size - 1) + 1;
+		return RR_SATISFIABLE;
+	}
+}
+
 LowLevelSession::LowLevelSession(Move<UniqueFile> socket)
 	: TcpSessionBase(STD_MOVE(socket)), ServerReader(), ServerWriter()
+	, m_preface_checked(false), m_http2(false)
 { }
 LowLevelSession::~LowLevelSession(){ }
 
+Http2Session *LowLevelSession::require_http2_stream(boost::uint32_t &stream_id) const {
+	if(!atomic_load(m_http2, ATOMIC_CONSUME)){
+		return NULLPTR;
+	}
+	const AUTO(http2_session, Http2Session::get_current(this, stream_id));
+	DEBUG_THROW_UNLESS(http2_session, BasicException, sslit("HTTP/2 responses can only be sent in on_sync_request()"));
+	return http2_session;
+}
+
 void LowLevelSession::on_connect(){
 	PROFILE_ME;
 
@@ -51,6 +190,31 @@ void LowLevelSession::on_receive(StreamBuffer data){
 		return;
 	}
 
+	if(!m_preface_checked){
+		// HTTP/2 的连接序言在 HTTP/1.x 看来是一个版本为 2.0 的 PRI 请求，必须在 ServerReader 拒绝它之前拦截下来。
+		m_preface_probe.splice(data);
+		char temp[sizeof(HTTP2_PREFACE)];
+		const AUTO(size, m_preface_probe.peek(temp, sizeof(temp)));
+		if(std::memcmp(temp, HTTP2_PREFACE, size) == 0){
+			if(size < sizeof(temp)){
+				return;
+			}
+			upgraded_session = on_low_level_http2_preface();
+		}
+		m_preface_checked = true;
+		if(upgraded_session){
+			{
+				const Mutex::UniqueLock lock(m_upgraded_session_mutex);
+				m_upgraded_session = upgraded_session;
+			}
+			atomic_store(m_http2, true, ATOMIC_RELEASE);
+			upgraded_session->on_connect();
+			upgraded_session->on_receive(STD_MOVE(m_preface_probe));
+			return;
+		}
+		data.swap(m_preface_probe);
+	}
+
 	ServerReader::put_encoded_data(STD_MOVE(data));
 
 	upgraded_session = m_upgraded_session;
@@ -90,6 +254,7 @@ void LowLevelSession::on_request_entity(boost::uint64_t entity_offset, StreamBuf
 bool LowLevelSession::on_request_end(boost::uint64_t content_length, OptionalMap headers){
 	PROFILE_ME;
 
+	account_message_read();
 	AUTO(upgraded_session, on_low_level_request_end(content_length, STD_MOVE(headers)));
 	if(upgraded_session){
 		const Mutex::UniqueLock lock(m_upgraded_session_mutex);
@@ -99,12 +264,32 @@ bool LowLevelSession::on_request_end(boost::uint64_t content_length, OptionalMap
 	return true;
 }
 
+boost::shared_ptr<UpgradedSessionBase> LowLevelSession::on_low_level_http2_preface(){
+	PROFILE_ME;
+
+	return VAL_INIT;
+}
+
 long LowLevelSession::on_encoded_data_avail(StreamBuffer encoded){
 	PROFILE_ME;
 
 	return TcpSessionBase::send(STD_MOVE(encoded));
 }
 
+long LowLevelSession::on_encoded_file_avail(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length){
+	PROFILE_ME;
+
+	return TcpSessionBase::send_file(STD_MOVE(file), offset, length);
+}
+
+bool LowLevelSession::is_throttled() const {
+	const AUTO(upgraded_session, get_upgraded_session());
+	if(upgraded_session && upgraded_session->is_read_throttled()){
+		return true;
+	}
+	return TcpSessionBase::is_throttled();
+}
+
 boost::shared_ptr<UpgradedSessionBase> LowLevelSession::get_upgraded_session() const {
 	const Mutex::UniqueLock lock(m_upgraded_session_mutex);
 	return m_upgraded_session;
@@ -113,6 +298,13 @@ boost::shared_ptr<UpgradedSessionBase> LowLevelSession::get_upgraded_session() c
 bool LowLevelSession::send(ResponseHeaders response_headers, StreamBuffer entity){
 	PROFILE_ME;
 
+	account_message_written();
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		return http2_session->send_response(stream_id, STD_MOVE(response_headers), STD_MOVE(entity), true);
+	}
+
 	return ServerWriter::put_response(STD_MOVE(response_headers), STD_MOVE(entity), true);
 }
 bool LowLevelSession::send(StatusCode status_code){
@@ -138,32 +330,212 @@ bool LowLevelSession::send(StatusCode status_code, OptionalMap headers, StreamBu
 	return send(STD_MOVE(response_headers), STD_MOVE(entity));
 }
 
+bool LowLevelSession::send_compressed(const RequestHeaders &request_headers, StatusCode status_code, OptionalMap headers, StreamBuffer entity, int level){
+	PROFILE_ME;
+
+	const AUTO(encoding, pick_content_encoding(request_headers));
+	if(encoding == CE_NOT_ACCEPTABLE){
+		return send_default(ST_NOT_ACCEPTABLE);
+	}
+	headers.set(sslit("Vary"), "Accept-Encoding");
+	switch(compress_entity(entity, encoding, level)){
+	case CE_GZIP:
+		headers.set(sslit("Content-Encoding"), "gzip");
+		break;
+	case CE_DEFLATE:
+		headers.set(sslit("Content-Encoding"), "deflate");
+		break;
+	case CE_BROTLI:
+		headers.set(sslit("Content-Encoding"), "br");
+		break;
+	case CE_ZSTD:
+		headers.set(sslit("Content-Encoding"), "zstd");
+		break;
+	default:
+		headers.erase("Content-Encoding");
+		break;
+	}
+	return send(status_code, STD_MOVE(headers), STD_MOVE(entity));
+}
+
 bool LowLevelSession::send_chunked_header(ResponseHeaders response_headers){
 	PROFILE_ME;
 
+	account_message_written();
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		response_headers.headers.erase("Content-Length");
+		return http2_session->send_headers(stream_id, STD_MOVE(response_headers), false);
+	}
+
 	return ServerWriter::put_chunked_header(STD_MOVE(response_headers));
 }
 bool LowLevelSession::send_chunk(StreamBuffer entity){
 	PROFILE_ME;
 
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		return http2_session->send_data(stream_id, STD_MOVE(entity), false);
+	}
+
 	return ServerWriter::put_chunk(STD_MOVE(entity));
 }
 bool LowLevelSession::send_chunked_trailer(OptionalMap headers){
 	PROFILE_ME;
 
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		return http2_session->send_trailers(stream_id, STD_MOVE(headers));
+	}
+
 	return ServerWriter::put_chunked_trailer(STD_MOVE(headers));
 }
 
+bool LowLevelSession::send_file(const RequestHeaders &request_headers, const std::string &path, OptionalMap headers){
+	PROFILE_ME;
+
+	UniqueFile file;
+	if(!file.reset(::open(path.c_str(), O_RDONLY | O_CLOEXEC))){
+		const int err_code = errno;
+		LOG_POSEIDON_DEBUG("Failed to open file: path = ", path, ", err_code = ", err_code);
+		DEBUG_THROW_UNLESS((err_code != ENOENT) && (err_code != ENOTDIR), Exception, ST_NOT_FOUND);
+		DEBUG_THROW_UNLESS(err_code != EACCES, Exception, ST_FORBIDDEN);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	struct ::stat stat_buf;
+	DEBUG_THROW_UNLESS(::fstat(file.get(), &stat_buf) == 0, SystemException);
+	DEBUG_THROW_UNLESS(S_ISREG(stat_buf.st_mode), Exception, ST_NOT_FOUND);
+
+	// 预先压缩的文件。
+	UniqueFile gz_file;
+	if(gz_file.reset(::open((path + ".gz").c_str(), O_RDONLY | O_CLOEXEC))){
+		struct ::stat gz_stat_buf;
+		if((::fstat(gz_file.get(), &gz_stat_buf) == 0) && S_ISREG(gz_stat_buf.st_mode) && (gz_stat_buf.st_mtime >= stat_buf.st_mtime)){
+			headers.set(sslit("Vary"), "Accept-Encoding");
+			if(pick_content_encoding(request_headers, (1u << CE_IDENTITY) | (1u << CE_GZIP)) == CE_GZIP){
+				file.swap(gz_file);
+				stat_buf = gz_stat_buf;
+				headers.set(sslit("Content-Encoding"), "gzip");
+			}
+		}
+		gz_file.reset();
+	}
+	const AUTO(file_size, static_cast<boost::uint64_t>(stat_buf.st_size));
+
+	char temp[128];
+	unsigned len = (unsigned)std::sprintf(temp, "\"%llx-%llx-%llx\"",
+		(unsigned long long)stat_buf.st_ino, (unsigned long long)file_size, (unsigned long long)stat_buf.st_mtime);
+	const std::string etag(temp, len);
+	headers.set(sslit("ETag"), etag);
+	headers.set(sslit("Last-Modified"), format_http_date(stat_buf.st_mtime));
+	headers.set(sslit("Accept-Ranges"), "bytes");
+
+	const bool head_only = (request_headers.verb == V_HEAD);
+	bool not_modified = false;
+	if((request_headers.verb == V_GET) || head_only){
+		const AUTO_REF(if_none_match, request_headers.headers.get("If-None-Match"));
+		if(!if_none_match.empty()){
+			not_modified = etag_list_matches(if_none_match, etag);
+		} else {
+			const AUTO_REF(if_modified_since, request_headers.headers.get("If-Modified-Since"));
+			::time_t since;
+			if(!if_modified_since.empty() && parse_http_date(since, if_modified_since)){
+				not_modified = (stat_buf.st_mtime <= since);
+			}
+		}
+	}
+
+	StatusCode status_code = ST_OK;
+	boost::uint64_t begin = 0, end = file_size;
+	if(!not_modified && (request_headers.verb == V_GET)){
+		const AUTO_REF(range, request_headers.headers.get("Range"));
+		const AUTO_REF(if_range, request_headers.headers.get("If-Range"));
+		// 如果 If-Range 与当前的版本不符，忽略 Range 发送整个文件。
+		if(!range.empty() && (if_range.empty() || (if_range == etag) || (if_range == headers.get("Last-Modified")))){
+			switch(parse_range(begin, end, range, file_size)){
+			case RR_SATISFIABLE:
+				status_code = ST_PARTIAL_CONTENT;
+				len = (unsigned)std::sprintf(temp, "bytes %llu-%llu/%llu", (unsigned long long)begin, (unsigned long long)(end - 1), (unsigned long long)file_size);
+				headers.set(sslit("Content-Range"), std::string(temp, len));
+				break;
+			case RR_UNSATISFIABLE:
+				len = (unsigned)std::sprintf(temp, "bytes */%llu", (unsigned long long)file_size);
+				headers.set(sslit("Content-Range"), std::string(temp, len));
+				return send_default(ST_RANGE_NOT_SATISFIABLE, STD_MOVE(headers));
+			default:
+				begin = 0;
+				end = file_size;
+				break;
+			}
+		}
+	}
+	if(not_modified){
+		status_code = ST_NOT_MODIFIED;
+	}
+
+	ResponseHeaders response_headers;
+	response_headers.version = 10001;
+	response_headers.status_code = status_code;
+	response_headers.reason = get_status_code_desc(status_code).desc_short;
+	response_headers.headers = STD_MOVE(headers);
+
+	account_message_written();
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		// HTTP/2 的 DATA 帧需要分帧，只能读入内存。
+		if(not_modified){
+			response_headers.headers.erase("Content-Type");
+			return http2_session->send_headers(stream_id, STD_MOVE(response_headers), true);
+		}
+		len = (unsigned)std::sprintf(temp, "%llu", (unsigned long long)(end - begin));
+		response_headers.headers.set(sslit("Content-Length"), std::string(temp, len));
+		if(head_only || (begin == end)){
+			return http2_session->send_headers(stream_id, STD_MOVE(response_headers), true);
+		}
+		AUTO(entity, load_file_range(file.get(), begin, end - begin));
+		if(!http2_session->send_headers(stream_id, STD_MOVE(response_headers), false)){
+			return false;
+		}
+		return http2_session->send_data(stream_id, STD_MOVE(entity), true);
+	}
+
+	if(not_modified){
+		// 304 响应没有正文，也不发送 Content-Length。
+		return ServerWriter::put_response(STD_MOVE(response_headers), StreamBuffer(), false);
+	}
+	if(head_only){
+		file.reset();
+	}
+	return ServerWriter::put_file_response(STD_MOVE(response_headers), STD_MOVE(file), begin, end - begin);
+}
+
 bool LowLevelSession::send_default(StatusCode status_code, OptionalMap headers){
 	PROFILE_ME;
 
+	account_message_written();
 	AUTO(pair, make_default_response(status_code, STD_MOVE(headers)));
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		return http2_session->send_response(stream_id, STD_MOVE(pair.first), STD_MOVE(pair.second), false);
+	}
 	return ServerWriter::put_response(pair.first, STD_MOVE(pair.second), false); // no need to adjust Content-Length.
 }
 bool LowLevelSession::send_default_and_shutdown(StatusCode status_code, const OptionalMap &headers) NOEXCEPT
 try {
 	PROFILE_ME;
 
+	account_message_written();
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		// 只结束当前的流，连接上的其他流不受影响。
+		return http2_session->send_error(stream_id, status_code, headers);
+	}
 	AUTO(pair, make_default_response(status_code, headers));
 	pair.first.headers.set(sslit("Connection"), "Close");
 	ServerWriter::put_response(pair.first, STD_MOVE(pair.second), false); // no need to adjust Content-Length.
@@ -185,6 +557,13 @@ try {
 	if(has_been_shutdown_write()){
 		return false;
 	}
+	account_message_written();
+	boost::uint32_t stream_id;
+	const AUTO(http2_session, require_http2_stream(stream_id));
+	if(http2_session){
+		// 只结束当前的流，连接上的其他流不受影响。
+		return http2_session->send_error(stream_id, status_code, STD_MOVE(headers));
+	}
 	AUTO(pair, make_default_response(status_code, STD_MOVE(headers)));
 	pair.first.headers.set(sslit("Connection"), "Close");
 	ServerWriter::put_response(pair.first, STD_MOVE(pair.second), false); // no need to adjust Content-Length.
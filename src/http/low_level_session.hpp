@@ -6,6 +6,7 @@
 
 #include "../tcp_session_base.hpp"
 #include "../mutex.hpp"
+#include "../stream_buffer.hpp"
 #include "server_reader.hpp"
 #include "server_writer.hpp"
 #include "request_headers.hpp"
@@ -16,6 +17,7 @@ namespace Poseidon {
 namespace Http {
 
 class UpgradedSessionBase;
+class Http2Session;
 class HeaderOption;
 
 class LowLevelSession : public TcpSessionBase, protected ServerReader, protected ServerWriter {
@@ -25,15 +27,29 @@ private:
 	mutable Mutex m_upgraded_session_mutex;
 	boost::shared_ptr<UpgradedSessionBase> m_upgraded_session;
 
+	// 连接开头的数据可能是 HTTP/2 的连接序言，在确定之前不交给 ServerReader。
+	bool m_preface_checked;
+	StreamBuffer m_preface_probe;
+	volatile bool m_http2;
+
 public:
 	explicit LowLevelSession(Move<UniqueFile> socket);
 	~LowLevelSession();
 
+private:
+	// 如果连接已经切换到 HTTP/2，返回当前线程正在处理的流；不在 on_sync_request() 中时抛出异常。
+	// 如果没有切换到 HTTP/2，返回空指针。
+	Http2Session *require_http2_stream(boost::uint32_t &stream_id) const;
+
 protected:
 	const boost::shared_ptr<UpgradedSessionBase> &get_low_level_upgraded_session() const {
 		// Epoll 线程读取不需要锁。
 		return m_upgraded_session;
 	}
+	// 只能在 epoll 线程中调用。没有读到一半的 HTTP/1.x 请求，也没有升级到其他协议时返回 true。
+	bool is_low_level_reading_idle() const {
+		return !m_upgraded_session && m_preface_probe.empty() && ServerReader::is_idle();
+	}
 
 	// TcpSessionBase
 	void on_connect() OVERRIDE;
@@ -51,24 +67,38 @@ protected:
 
 	// ServerWriter
 	long on_encoded_data_avail(StreamBuffer encoded) OVERRIDE;
+	long on_encoded_file_avail(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length) OVERRIDE;
 
 	// 可覆写。
 	virtual void on_low_level_request_headers(RequestHeaders request_headers, boost::uint64_t content_length) = 0;
 	virtual void on_low_level_request_entity(boost::uint64_t entity_offset, StreamBuffer entity) = 0;
 	virtual boost::shared_ptr<UpgradedSessionBase> on_low_level_request_end(boost::uint64_t content_length, OptionalMap headers) = 0;
+	// 收到 HTTP/2 的连接序言时调用。返回空指针则按照 HTTP/1.x 处理，ServerReader 会以 505 拒绝之。
+	virtual boost::shared_ptr<UpgradedSessionBase> on_low_level_http2_preface();
 
 public:
+	bool is_throttled() const OVERRIDE;
+
 	boost::shared_ptr<UpgradedSessionBase> get_upgraded_session() const;
 
 	virtual bool send(ResponseHeaders response_headers, StreamBuffer entity = StreamBuffer());
 	virtual bool send(StatusCode status_code);
 	virtual bool send(StatusCode status_code, StreamBuffer entity, const HeaderOption &content_type);
 	virtual bool send(StatusCode status_code, OptionalMap headers, StreamBuffer entity = StreamBuffer());
+	// 按照 request_headers 中的 Accept-Encoding 压缩正文之后发送，参见 compress_entity()。level 为负数时使用 http_compression_level。
+	virtual bool send_compressed(const RequestHeaders &request_headers, StatusCode status_code, OptionalMap headers, StreamBuffer entity, int level = -1);
 
 	virtual bool send_chunked_header(ResponseHeaders response_headers);
 	virtual bool send_chunk(StreamBuffer entity);
 	virtual bool send_chunked_trailer(OptionalMap headers = OptionalMap());
 
+	// 发送一个静态文件，正文由 epoll 线程使用 sendfile() 发送，不占用用户态内存（HTTP/2 连接除外）。
+	// 根据文件的 inode、大小和修改时间生成 ETag，并且按照 request_headers 处理 If-None-Match、If-Modified-Since、Range 和 If-Range，
+	// 相应地发送 304、206 或者 416 响应。Range 只支持单个区间，包含多个区间时发送整个文件。HEAD 请求只发送响应头。
+	// 如果存在不比原文件旧的 path + ".gz" 并且客户端接受 gzip，发送这个预先压缩的文件。
+	// headers 中可以指定 Content-Type 和 Cache-Control 等。文件不存在时抛出 Http::Exception(ST_NOT_FOUND)。
+	virtual bool send_file(const RequestHeaders &request_headers, const std::string &path, OptionalMap headers = OptionalMap());
+
 	virtual bool send_default(StatusCode status_code, OptionalMap headers = OptionalMap());
 	virtual bool send_default_and_shutdown(StatusCode status_code, const OptionalMap &headers = OptionalMap()) NOEXCEPT;
 	virtual bool send_default_and_shutdown(StatusCode status_code, Move<OptionalMap> headers) NOEXCEPT;
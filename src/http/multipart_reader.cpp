@@ -0,0 +1,187 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "multipart_reader.hpp"
+#include "exception.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include "../string.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+namespace {
+	// 边界之后、CR LF 之前允许的空白字符的最大长度。
+	CONSTEXPR const std::size_t s_max_padding_len = 256;
+	// 每一部分的报头的最大长度。
+	CONSTEXPR const std::size_t s_max_header_len  = 16384;
+}
+
+MultipartReader::MultipartReader(const std::string &boundary)
+	: m_delimiter("\r\n--" + boundary)
+	, m_queue("\r\n"), m_queue_begin(0), m_state(S_PREAMBLE)
+	, m_part_index(0), m_part_offset(0)
+{
+	DEBUG_THROW_UNLESS(!boundary.empty(), BasicException, sslit("Multipart boundary not set"));
+
+	const AUTO(len, m_delimiter.size());
+	for(unsigned i = 0; i < 256; ++i){
+		m_skip_table[i] = len;
+	}
+	for(std::size_t i = 0; i < len - 1; ++i){
+		m_skip_table[static_cast<unsigned char>(m_delimiter[i])] = len - 1 - i;
+	}
+}
+MultipartReader::~MultipartReader(){ }
+
+std::size_t MultipartReader::find_delimiter() const NOEXCEPT {
+	const AUTO(len, m_delimiter.size());
+	const AUTO(last, static_cast<unsigned char>(m_delimiter[len - 1]));
+	const char *const data = m_queue.data();
+	std::size_t pos = m_queue_begin;
+	while(m_queue.size() - pos >= len){
+		const AUTO(ch, static_cast<unsigned char>(data[pos + len - 1]));
+		if((ch == last) && (std::memcmp(data + pos, m_delimiter.data(), len - 1) == 0)){
+			return pos;
+		}
+		pos += m_skip_table[ch];
+	}
+	return std::string::npos;
+}
+
+void MultipartReader::put_encoded_data(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	m_queue.append(static_cast<const char *>(data), size);
+
+	const AUTO(len, m_delimiter.size());
+	bool more = true;
+	while(more){
+		const AUTO(avail, m_queue.size() - m_queue_begin);
+		switch(m_state){
+		case S_PREAMBLE:
+		case S_PART_DATA: {
+			const AUTO(pos, find_delimiter());
+			std::size_t data_len;
+			if(pos == std::string::npos){
+				// 末尾可能是不完整的分隔符，保留下来。
+				data_len = (avail < len) ? 0 : (avail - (len - 1));
+				more = false;
+			} else {
+				data_len = pos - m_queue_begin;
+			}
+			if((m_state == S_PART_DATA) && (data_len != 0)){
+				const AUTO(offset, m_part_offset);
+				m_part_offset += data_len;
+				on_part_data(offset, StreamBuffer(m_queue.data() + m_queue_begin, data_len));
+			}
+			m_queue_begin += data_len;
+			if(pos == std::string::npos){
+				break;
+			}
+			m_queue_begin += len;
+			if(m_state == S_PART_DATA){
+				on_part_end(m_part_offset);
+			}
+			m_state = S_BOUNDARY_TAIL;
+			break; }
+
+		case S_BOUNDARY_TAIL: {
+			if(avail < 2){
+				more = false;
+				break;
+			}
+			const char *const begin = m_queue.data() + m_queue_begin;
+			if((begin[0] == '-') && (begin[1] == '-')){
+				m_queue_begin += 2;
+				m_state = S_EPILOGUE;
+				on_multipart_end();
+				break;
+			}
+			const AUTO(eol, m_queue.find("\r\n", m_queue_begin));
+			if(eol == std::string::npos){
+				if(avail > s_max_padding_len){
+					LOG_POSEIDON_WARNING("Invalid multipart boundary.");
+					DEBUG_THROW(Exception, ST_BAD_REQUEST);
+				}
+				more = false;
+				break;
+			}
+			for(std::size_t i = m_queue_begin; i < eol; ++i){
+				if((m_queue[i] != ' ') && (m_queue[i] != '\t')){
+					LOG_POSEIDON_WARNING("Invalid multipart boundary.");
+					DEBUG_THROW(Exception, ST_BAD_REQUEST);
+				}
+			}
+			m_queue_begin = eol + 2;
+			m_state = S_PART_HEADERS;
+			break; }
+
+		case S_PART_HEADERS: {
+			std::size_t headers_end;
+			if(m_queue.compare(m_queue_begin, 2, "\r\n") == 0){
+				headers_end = m_queue_begin;
+			} else {
+				headers_end = m_queue.find("\r\n\r\n", m_queue_begin);
+				if(headers_end == std::string::npos){
+					if(avail > s_max_header_len){
+						LOG_POSEIDON_WARNING("Multipart headers are too long.");
+						DEBUG_THROW(Exception, ST_BAD_REQUEST);
+					}
+					more = false;
+					break;
+				}
+				headers_end += 2;
+			}
+			OptionalMap headers;
+			std::size_t line_begin = m_queue_begin;
+			while(line_begin < headers_end){
+				const AUTO(line_end, m_queue.find("\r\n", line_begin));
+				const AUTO(colon, m_queue.find(':', line_begin));
+				if((colon == std::string::npos) || (colon > line_end)){
+					LOG_POSEIDON_WARNING("Invalid multipart header.");
+					DEBUG_THROW(Exception, ST_BAD_REQUEST);
+				}
+				SharedNts key(m_queue.data() + line_begin, colon - line_begin);
+				std::string value(trim(m_queue.substr(colon + 1, line_end - colon - 1)));
+				headers.set(STD_MOVE(key), STD_MOVE(value));
+				line_begin = line_end + 2;
+			}
+			m_queue_begin = headers_end + 2;
+			m_part_offset = 0;
+			m_state = S_PART_DATA;
+			on_part_headers(m_part_index++, STD_MOVE(headers));
+			break; }
+
+		case S_EPILOGUE:
+			m_queue_begin = m_queue.size();
+			more = false;
+			break;
+		}
+	}
+	m_queue.erase(0, m_queue_begin);
+	m_queue_begin = 0;
+}
+void MultipartReader::put_encoded_data(const StreamBuffer &encoded){
+	PROFILE_ME;
+
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(encoded.enumerate_chunk(&data, &size, cookie)){
+		put_encoded_data(data, size);
+	}
+}
+
+void MultipartReader::finalize() const {
+	PROFILE_ME;
+
+	if(m_state != S_EPILOGUE){
+		LOG_POSEIDON_WARNING("Multipart entity is truncated.");
+		DEBUG_THROW(Exception, ST_BAD_REQUEST);
+	}
+}
+
+}
+}
@@ -0,0 +1,71 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_MULTIPART_READER_HPP_
+#define POSEIDON_HTTP_MULTIPART_READER_HPP_
+
+#include <string>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include "../stream_buffer.hpp"
+#include "../optional_map.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+// 增量地解析 multipart 正文，通常在 Session::on_sync_request_stream_chunk() 中把收到的数据依次传给 put_encoded_data()。
+// 与 Multipart::parse() 不同，这里不缓存整个正文，每一部分的内容在收到时就交给 on_part_data()。
+// 边界使用 Boyer-Moore-Horspool 算法查找，内部只保留不足一个边界长度的尾部数据。
+class MultipartReader {
+private:
+	enum State {
+		S_PREAMBLE          = 0,
+		S_BOUNDARY_TAIL     = 1,
+		S_PART_HEADERS      = 2,
+		S_PART_DATA         = 3,
+		S_EPILOGUE          = 4,
+	};
+
+private:
+	// 分隔符是 CR LF -- boundary，第一个边界之前的 CR LF 在构造时预先放入 m_queue。
+	const std::string m_delimiter;
+	std::size_t m_skip_table[256];
+
+	std::string m_queue;
+	std::size_t m_queue_begin;
+	State m_state;
+
+	unsigned m_part_index;
+	boost::uint64_t m_part_offset;
+
+public:
+	explicit MultipartReader(const std::string &boundary);
+	virtual ~MultipartReader();
+
+private:
+	std::size_t find_delimiter() const NOEXCEPT;
+
+protected:
+	// 每一部分依次调用 on_part_headers()，若干次 on_part_data()，以及 on_part_end()。
+	virtual void on_part_headers(unsigned index, OptionalMap headers) = 0;
+	virtual void on_part_data(boost::uint64_t offset, StreamBuffer data) = 0;
+	virtual void on_part_end(boost::uint64_t size) = 0;
+	// 收到结束边界。之后的数据被忽略。
+	virtual void on_multipart_end() = 0;
+
+public:
+	// 格式错误时抛出 Http::Exception，状态码为 400。
+	void put_encoded_data(const void *data, std::size_t size);
+	void put_encoded_data(const StreamBuffer &encoded);
+
+	bool is_finished() const {
+		return m_state == S_EPILOGUE;
+	}
+	// 如果没有收到结束边界，抛出 Http::Exception，状态码为 400。
+	void finalize() const;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,115 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "multipart_spooler.hpp"
+#include "header_option.hpp"
+#include "exception.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include "../random.hpp"
+#include "../buffer_streams.hpp"
+#include "../singletons/filesystem_daemon.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+namespace {
+	CONSTEXPR const std::size_t s_file_buffer_size = 65536;
+}
+
+MultipartSpooler::MultipartSpooler(const std::string &boundary, std::string directory, boost::uint64_t max_memory_size)
+	: MultipartReader(boundary)
+	, m_directory(STD_MOVE(directory)), m_max_memory_size(max_memory_size)
+	, m_memory_size(0)
+{ }
+MultipartSpooler::~MultipartSpooler(){
+	for(AUTO(it, m_parts.begin()); it != m_parts.end(); ++it){
+		if(it->file_path.empty()){
+			continue;
+		}
+		try {
+			FileSystemDaemon::remove(it->file_path, false);
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("Failed to remove temporary file: file_path = ", it->file_path, ", what = ", e.what());
+		}
+	}
+}
+
+void MultipartSpooler::flush_file_buffer(){
+	PROFILE_ME;
+
+	if(m_file_buffer.empty()){
+		return;
+	}
+	FileSystemDaemon::save(m_parts.back().file_path, STD_MOVE(m_file_buffer), FileSystemDaemon::OFFSET_APPEND);
+	m_file_buffer.clear();
+}
+
+bool MultipartSpooler::is_part_spooled(const OptionalMap &headers) const {
+	PROFILE_ME;
+
+	Buffer_istream is;
+	is.get_buffer().put(headers.get("Content-Disposition"));
+	HeaderOption disposition(is);
+	if(!is){
+		return false;
+	}
+	return disposition.get_options().has("filename");
+}
+
+void MultipartSpooler::on_part_headers(unsigned index, OptionalMap headers){
+	PROFILE_ME;
+
+	SpooledPart part = { STD_MOVE(headers), 0, StreamBuffer(), std::string() };
+	if(!m_directory.empty() && is_part_spooled(part.headers)){
+		char name[64];
+		std::sprintf(name, "/multipart-%016llx-%u.tmp", static_cast<unsigned long long>(random_uint64()), index);
+		part.file_path = m_directory + name;
+		// 创建一个空文件。如果文件已经存在则抛出异常，以免覆盖其他文件。
+		FileSystemDaemon::save(part.file_path, StreamBuffer(), FileSystemDaemon::OFFSET_TRUNCATE, true);
+		LOG_POSEIDON_DEBUG("Spooling multipart part to file: index = ", index, ", file_path = ", part.file_path);
+	}
+	m_parts.push_back(STD_MOVE(part));
+}
+void MultipartSpooler::on_part_data(boost::uint64_t /*offset*/, StreamBuffer data){
+	PROFILE_ME;
+
+	AUTO_REF(part, m_parts.back());
+	part.size += data.size();
+	if(part.file_path.empty()){
+		m_memory_size += data.size();
+		if(m_memory_size > m_max_memory_size){
+			LOG_POSEIDON_WARNING("Multipart entity is too large to be held in memory: max_memory_size = ", m_max_memory_size);
+			DEBUG_THROW(Exception, ST_PAYLOAD_TOO_LARGE);
+		}
+		part.entity.splice(data);
+		return;
+	}
+	m_file_buffer.splice(data);
+	if(m_file_buffer.size() >= s_file_buffer_size){
+		flush_file_buffer();
+	}
+}
+void MultipartSpooler::on_part_end(boost::uint64_t /*size*/){
+	PROFILE_ME;
+
+	if(!m_parts.back().file_path.empty()){
+		flush_file_buffer();
+	}
+}
+void MultipartSpooler::on_multipart_end(){
+	PROFILE_ME;
+}
+
+MultipartSpooler::base_container MultipartSpooler::release_parts(){
+	PROFILE_ME;
+
+	base_container parts;
+	parts.swap(m_parts);
+	m_memory_size = 0;
+	return parts;
+}
+
+}
+}
@@ -0,0 +1,69 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_MULTIPART_SPOOLER_HPP_
+#define POSEIDON_HTTP_MULTIPART_SPOOLER_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include "multipart_reader.hpp"
+#include <string>
+#include <boost/container/deque.hpp>
+
+namespace Poseidon {
+namespace Http {
+
+struct SpooledPart {
+	OptionalMap headers;
+	boost::uint64_t size;
+	// 保存在内存中的部分的内容。保存到文件时为空。
+	StreamBuffer entity;
+	// 保存到文件时为文件路径，否则为空。
+	std::string file_path;
+};
+
+// 一个 MultipartReader 的实现，把上传的文件写入 directory 中的临时文件，其他部分保存在内存中。
+// 文件通过 FileSystemDaemon 的同步接口写入，数据在内存中积累到 64 KiB 之后写一次。
+// 保存在内存中的部分的总大小超过 max_memory_size 时抛出 Http::Exception，状态码为 413。
+// 析构时删除所有临时文件，除非已经调用 release_parts() 取走。
+class MultipartSpooler : NONCOPYABLE, public MultipartReader {
+public:
+	typedef boost::container::deque<SpooledPart> base_container;
+
+private:
+	const std::string m_directory;
+	const boost::uint64_t m_max_memory_size;
+
+	boost::uint64_t m_memory_size;
+	StreamBuffer m_file_buffer;
+	base_container m_parts;
+
+public:
+	MultipartSpooler(const std::string &boundary, std::string directory, boost::uint64_t max_memory_size);
+	~MultipartSpooler() OVERRIDE;
+
+private:
+	void flush_file_buffer();
+
+protected:
+	// 决定一个部分是否保存到文件。默认情况下 Content-Disposition 中带有 filename 的部分保存到文件。
+	// directory 为空时这个函数不会被调用，所有部分都保存在内存中。
+	virtual bool is_part_spooled(const OptionalMap &headers) const;
+
+	void on_part_headers(unsigned index, OptionalMap headers) OVERRIDE;
+	void on_part_data(boost::uint64_t offset, StreamBuffer data) OVERRIDE;
+	void on_part_end(boost::uint64_t size) OVERRIDE;
+	void on_multipart_end() OVERRIDE;
+
+public:
+	const base_container &get_parts() const {
+		return m_parts;
+	}
+	// 取走所有的部分，此后临时文件由调用者负责删除或者重命名。
+	base_container release_parts();
+};
+
+}
+}
+
+#endif
@@ -32,7 +32,7 @@ bool is_keep_alive_enabled(const RequestHeaders &request_headers){
 	return result == R_ON;
 }
 
-ContentEncoding pick_content_encoding(const RequestHeaders &request_headers){
+ContentEncoding pick_content_encoding(const RequestHeaders &request_headers, unsigned available){
 	const AUTO_REF(accept_encoding, request_headers.headers.get("Accept-Encoding"));
 	if(accept_encoding.empty()){
 		return CE_IDENTITY;
@@ -59,6 +59,10 @@ ContentEncoding pick_content_encoding(const RequestHeaders &request_headers){
 					encodings.at(CE_DEFLATE) = q;
 				} else if(::strcasecmp(opt.get_base().c_str(), "gzip") == 0){
 					encodings.at(CE_GZIP) = q;
+				} else if(::strcasecmp(opt.get_base().c_str(), "br") == 0){
+					encodings.at(CE_BROTLI) = q;
+				} else if(::strcasecmp(opt.get_base().c_str(), "zstd") == 0){
+					encodings.at(CE_ZSTD) = q;
 				} else if(::strcasecmp(opt.get_base().c_str(), "*") == 0){
 					for(std::size_t i = 0; i < encodings.size(); ++i){
 						if(encodings[i] < 0){
@@ -80,10 +84,21 @@ ContentEncoding pick_content_encoding(const RequestHeaders &request_headers){
 	if(identity_q < 0){
 		identity_q = 0.000001;
 	}
-	if(encodings.at(CE_GZIP) > identity_q){
-		return CE_GZIP;
-	} else if(encodings.at(CE_DEFLATE) > identity_q){
-		return CE_DEFLATE;
+	static CONSTEXPR const ContentEncoding s_preferred[] = { CE_BROTLI, CE_ZSTD, CE_GZIP, CE_DEFLATE };
+	ContentEncoding best = CE_IDENTITY;
+	double best_q = identity_q;
+	for(std::size_t i = 0; i < COUNT_OF(s_preferred); ++i){
+		const AUTO(encoding, s_preferred[i]);
+		if(((available >> encoding) & 1) == 0){
+			continue;
+		}
+		if(encodings.at(encoding) > best_q){
+			best = encoding;
+			best_q = encodings.at(encoding);
+		}
+	}
+	if(best != CE_IDENTITY){
+		return best;
 	} else if(identity_q > 0){
 		return CE_IDENTITY;
 	}
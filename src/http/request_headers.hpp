@@ -35,10 +35,14 @@ enum ContentEncoding {
 	CE_IDENTITY        =  0,
 	CE_DEFLATE         =  1,
 	CE_GZIP            =  2,
+	CE_BROTLI          =  3,
+	CE_ZSTD            =  4,
 	CE_NOT_ACCEPTABLE  = 15,
 };
 
-extern ContentEncoding pick_content_encoding(const RequestHeaders &request_headers);
+// available 的第 n 位表示编码 n 是否可用，只在可用的编码中选择。
+// q 值相同时按照 br、zstd、gzip、deflate 的顺序选择。
+extern ContentEncoding pick_content_encoding(const RequestHeaders &request_headers, unsigned available = (unsigned)-1);
 
 }
 }
@@ -0,0 +1,320 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "router.hpp"
+#include "session.hpp"
+#include "exception.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+
+namespace Poseidon {
+namespace Http {
+
+struct Router::Node {
+	std::string label; // 静态文本。根节点和 :name、*name 节点为空。
+	boost::container::vector<boost::shared_ptr<Node> > children; // 静态的子节点，它们的 label 的首字符互不相同。
+	SharedNts param_name;
+	boost::shared_ptr<Node> param_child;
+	SharedNts wildcard_name;
+	boost::shared_ptr<Node> wildcard_child;
+	boost::container::vector<std::pair<Verb, boost::shared_ptr<const Handler> > > handlers;
+};
+
+namespace {
+	struct Token {
+		char kind; // 0 表示静态文本，':' 或者 '*' 表示参数。
+		std::string text;
+	};
+
+	void parse_pattern(boost::container::vector<Token> &tokens, const std::string &pattern){
+		PROFILE_ME;
+
+		DEBUG_THROW_UNLESS(!pattern.empty() && (pattern[0] == '/'), BasicException, sslit("Route pattern must begin with a slash"));
+		Token token = { 0, std::string() };
+		std::size_t pos = 0;
+		while(pos < pattern.size()){
+			const char ch = pattern[pos];
+			if(((ch != ':') && (ch != '*')) || (pattern[pos - 1] != '/')){
+				token.text += ch;
+				++pos;
+				continue;
+			}
+			std::size_t end = pattern.find('/', pos);
+			if(end == std::string::npos){
+				end = pattern.size();
+			}
+			DEBUG_THROW_UNLESS(end - pos > 1, BasicException, sslit("Route parameter name must not be empty"));
+			DEBUG_THROW_UNLESS((ch != '*') || (end == pattern.size()), BasicException, sslit("Wildcard must be the last segment of a route pattern"));
+			if(!token.text.empty()){
+				tokens.push_back(STD_MOVE(token));
+			}
+			token.kind = ch;
+			token.text.assign(pattern, pos + 1, end - pos - 1);
+			tokens.push_back(STD_MOVE(token));
+			token.kind = 0;
+			token.text.clear();
+			pos = end;
+		}
+		if(!token.text.empty()){
+			tokens.push_back(STD_MOVE(token));
+		}
+	}
+
+	template<typename NodeT>
+	NodeT *insert_static(NodeT *node, const std::string &text){
+		std::size_t pos = 0;
+		while(pos < text.size()){
+			boost::shared_ptr<NodeT> *slot = NULLPTR;
+			for(AUTO(it, node->children.begin()); it != node->children.end(); ++it){
+				if((*it)->label.at(0) == text[pos]){
+					slot = &*it;
+					break;
+				}
+			}
+			if(!slot){
+				const AUTO(child, boost::make_shared<NodeT>());
+				child->label.assign(text, pos, std::string::npos);
+				node->children.push_back(child);
+				return child.get();
+			}
+			const AUTO_REF(label, (*slot)->label);
+			std::size_t common = 1;
+			while((common < label.size()) && (pos + common < text.size()) && (label[common] == text[pos + common])){
+				++common;
+			}
+			if(common < label.size()){
+				// 拆分这个节点，使公共前缀成为一个单独的节点。
+				const AUTO(middle, boost::make_shared<NodeT>());
+				middle->label.assign(label, 0, common);
+				(*slot)->label.erase(0, common);
+				middle->children.push_back(STD_MOVE(*slot));
+				*slot = middle;
+			}
+			node = slot->get();
+			pos += common;
+		}
+		return node;
+	}
+
+	void decode_path_component(std::string &str, const char *begin, const char *end){
+		str.reserve(static_cast<std::size_t>(end - begin));
+		const char *p = begin;
+		while(p != end){
+			if((*p == '%') && (end - p >= 3) && std::isxdigit(p[1]) && std::isxdigit(p[2])){
+				const char hex[3] = { p[1], p[2], 0 };
+				str += static_cast<char>(std::strtoul(hex, NULLPTR, 16));
+				p += 3;
+				continue;
+			}
+			str += *p;
+			++p;
+		}
+	}
+
+	typedef boost::container::vector<std::pair<SharedNts, std::string> > ParamVector;
+
+	template<typename NodeT>
+	const NodeT *match_node(const NodeT &node, const char *p, const char *end, ParamVector &params){
+		if(p == end){
+			if(!node.handlers.empty()){
+				return &node;
+			}
+			if(node.wildcard_child){
+				params.push_back(std::make_pair(node.wildcard_name, std::string()));
+				return node.wildcard_child.get();
+			}
+			return NULLPTR;
+		}
+		for(AUTO(it, node.children.begin()); it != node.children.end(); ++it){
+			const AUTO_REF(child, **it);
+			if(child.label.at(0) != *p){
+				continue;
+			}
+			if((static_cast<std::size_t>(end - p) >= child.label.size()) && (std::memcmp(p, child.label.data(), child.label.size()) == 0)){
+				const AUTO(result, match_node(child, p + child.label.size(), end, params));
+				if(result){
+					return result;
+				}
+			}
+			break;
+		}
+		if(node.param_child && (*p != '/')){
+			AUTO(segment_end, static_cast<const char *>(std::memchr(p, '/', static_cast<std::size_t>(end - p))));
+			if(!segment_end){
+				segment_end = end;
+			}
+			params.push_back(std::make_pair(node.param_name, std::string()));
+			decode_path_component(params.back().second, p, segment_end);
+			const AUTO(result, match_node(*(node.param_child), segment_end, end, params));
+			if(result){
+				return result;
+			}
+			params.pop_back();
+		}
+		if(node.wildcard_child){
+			params.push_back(std::make_pair(node.wildcard_name, std::string()));
+			decode_path_component(params.back().second, p, end);
+			return node.wildcard_child.get();
+		}
+		return NULLPTR;
+	}
+}
+
+boost::shared_ptr<const Router::Node> Router::build_tree(const boost::container::vector<Route> &routes){
+	PROFILE_ME;
+
+	const AUTO(root, boost::make_shared<Node>());
+	boost::container::vector<Token> tokens;
+	for(AUTO(rit, routes.begin()); rit != routes.end(); ++rit){
+		tokens.clear();
+		parse_pattern(tokens, rit->pattern);
+		Node *node = root.get();
+		for(AUTO(it, tokens.begin()); it != tokens.end(); ++it){
+			switch(it->kind){
+			case ':':
+				if(!node->param_child){
+					node->param_name = SharedNts(it->text);
+					node->param_child = boost::make_shared<Node>();
+				}
+				DEBUG_THROW_UNLESS(std::strcmp(node->param_name.get(), it->text.c_str()) == 0, BasicException, sslit("Conflicting route parameter names"));
+				node = node->param_child.get();
+				break;
+			case '*':
+				if(!node->wildcard_child){
+					node->wildcard_name = SharedNts(it->text);
+					node->wildcard_child = boost::make_shared<Node>();
+				}
+				DEBUG_THROW_UNLESS(std::strcmp(node->wildcard_name.get(), it->text.c_str()) == 0, BasicException, sslit("Conflicting route parameter names"));
+				node = node->wildcard_child.get();
+				break;
+			default:
+				node = insert_static(node, it->text);
+				break;
+			}
+		}
+		node->handlers.push_back(std::make_pair(rit->verb, rit->handler));
+	}
+	return root;
+}
+
+Router::Router(){ }
+Router::~Router(){ }
+
+boost::shared_ptr<const Router::Node> Router::get_root() const {
+	return boost::atomic_load(&m_root);
+}
+void Router::set_root(boost::shared_ptr<const Node> root){
+	boost::atomic_store(&m_root, STD_MOVE_IDN(root));
+}
+
+void Router::add(Verb verb, const std::string &pattern, Handler handler){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_routes.begin()); it != m_routes.end(); ++it){
+		DEBUG_THROW_UNLESS((it->verb != verb) || (it->pattern != pattern), BasicException, sslit("Duplicate route"));
+	}
+	Route route = { verb, pattern, boost::make_shared<Handler>(STD_MOVE_IDN(handler)) };
+	AUTO(routes, m_routes);
+	routes.push_back(STD_MOVE(route));
+	// 如果模式不合法，build_tree() 抛出异常，原来的路由保持不变。
+	set_root(build_tree(routes));
+	m_routes.swap(routes);
+	LOG_POSEIDON_DEBUG("Added HTTP route: verb = ", get_string_from_verb(verb), ", pattern = ", pattern);
+}
+bool Router::remove(Verb verb, const std::string &pattern){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_routes.begin()); it != m_routes.end(); ++it){
+		if((it->verb != verb) || (it->pattern != pattern)){
+			continue;
+		}
+		AUTO(routes, m_routes);
+		routes.erase(routes.begin() + (it - m_routes.begin()));
+		set_root(build_tree(routes));
+		m_routes.swap(routes);
+		LOG_POSEIDON_DEBUG("Removed HTTP route: verb = ", get_string_from_verb(verb), ", pattern = ", pattern);
+		return true;
+	}
+	return false;
+}
+void Router::clear(){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	m_routes.clear();
+	set_root(VAL_INIT);
+}
+
+StatusCode Router::find(boost::shared_ptr<const Handler> &handler, OptionalMap &path_params, std::string &allow,
+	Verb verb, const std::string &path) const
+{
+	PROFILE_ME;
+
+	const AUTO(root, get_root());
+	if(!root){
+		return ST_NOT_FOUND;
+	}
+	ParamVector params;
+	const AUTO(node, match_node(*root, path.data(), path.data() + path.size(), params));
+	if(!node){
+		return ST_NOT_FOUND;
+	}
+
+	boost::shared_ptr<const Handler> exact, get, any;
+	for(AUTO(it, node->handlers.begin()); it != node->handlers.end(); ++it){
+		if(it->first == verb){
+			exact = it->second;
+		} else if(it->first == V_GET){
+			get = it->second;
+		} else if(it->first == V_INVALID_VERB){
+			any = it->second;
+		}
+	}
+	if(!exact && (verb == V_HEAD)){
+		exact = get;
+	}
+	if(!exact){
+		exact = any;
+	}
+	if(!exact){
+		allow.clear();
+		for(AUTO(it, node->handlers.begin()); it != node->handlers.end(); ++it){
+			if(!allow.empty()){
+				allow += ", ";
+			}
+			allow += get_string_from_verb(it->first);
+			if(it->first == V_GET){
+				allow += ", HEAD";
+			}
+		}
+		return ST_METHOD_NOT_ALLOWED;
+	}
+
+	handler = STD_MOVE(exact);
+	path_params.clear();
+	for(AUTO(it, params.begin()); it != params.end(); ++it){
+		path_params.append(STD_MOVE(it->first), STD_MOVE(it->second));
+	}
+	return ST_OK;
+}
+void Router::dispatch(const boost::shared_ptr<Session> &session, RequestHeaders request_headers, StreamBuffer entity) const {
+	PROFILE_ME;
+
+	boost::shared_ptr<const Handler> handler;
+	OptionalMap path_params;
+	std::string allow;
+	const AUTO(status_code, find(handler, path_params, allow, request_headers.verb, request_headers.uri));
+	if(status_code == ST_METHOD_NOT_ALLOWED){
+		OptionalMap headers;
+		headers.set(sslit("Allow"), STD_MOVE(allow));
+		DEBUG_THROW(Exception, status_code, STD_MOVE(headers));
+	}
+	DEBUG_THROW_UNLESS(status_code == ST_OK, Exception, status_code);
+	(*handler)(session, STD_MOVE(request_headers), STD_MOVE(entity), STD_MOVE(path_params));
+}
+
+}
+}
@@ -0,0 +1,81 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HTTP_ROUTER_HPP_
+#define POSEIDON_HTTP_ROUTER_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include "../mutex.hpp"
+#include "../optional_map.hpp"
+#include "../stream_buffer.hpp"
+#include "request_headers.hpp"
+#include "verbs.hpp"
+#include "status_codes.hpp"
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+namespace Http {
+
+class Session;
+
+// 按照请求的路径和方法分派请求。
+// 路径模式由以 / 分隔的段组成，每一段可以是：
+//   普通文本，必须完全相同（区分大小写）；
+//   :name，匹配任意一个非空的段，解码之后以 name 为键放入 path_params；
+//   *name，只能是最后一段，匹配剩余的路径（可以为空，也可以包含 /），解码之后以 name 为键放入 path_params。
+// 普通文本优先于 :name，:name 优先于 *name。例如 /users/:id、/users/me 和 /static/*path。
+// 所有路由在注册时被编译为一棵压缩前缀树。查找时不加锁，只读取当前这棵树的快照；注册或者删除路由时构建新的树并原子地替换旧的。
+class Router : NONCOPYABLE {
+public:
+	typedef boost::function<void (const boost::shared_ptr<Session> &session,
+		RequestHeaders request_headers, StreamBuffer entity, OptionalMap path_params)> Handler;
+
+private:
+	struct Route {
+		Verb verb;
+		std::string pattern;
+		boost::shared_ptr<const Handler> handler;
+	};
+
+	struct Node;
+
+private:
+	static boost::shared_ptr<const Node> build_tree(const boost::container::vector<Route> &routes);
+
+private:
+	mutable Mutex m_mutex;
+	boost::container::vector<Route> m_routes;
+	boost::shared_ptr<const Node> m_root;
+
+public:
+	Router();
+	~Router();
+
+private:
+	boost::shared_ptr<const Node> get_root() const;
+	void set_root(boost::shared_ptr<const Node> root);
+
+public:
+	// verb 为 V_INVALID_VERB 时匹配所有的方法。没有 HEAD 的处理函数时使用 GET 的。
+	// 模式不合法，或者相同的方法和模式已经注册过时抛出异常。
+	void add(Verb verb, const std::string &pattern, Handler handler);
+	bool remove(Verb verb, const std::string &pattern);
+	void clear();
+
+	// 查找 path 对应的处理函数。
+	// 返回 ST_OK 表示找到了；返回 ST_NOT_FOUND 表示没有路由匹配这个路径；
+	// 返回 ST_METHOD_NOT_ALLOWED 表示路径匹配但是方法不匹配，此时 allow 中是允许的方法，以逗号分隔。
+	StatusCode find(boost::shared_ptr<const Handler> &handler, OptionalMap &path_params, std::string &allow,
+		Verb verb, const std::string &path) const;
+	// 通常在 Session::on_sync_request() 中调用。找不到处理函数时抛出 Http::Exception，状态码为 404 或者 405。
+	void dispatch(const boost::shared_ptr<Session> &session, RequestHeaders request_headers, StreamBuffer entity) const;
+};
+
+}
+}
+
+#endif
@@ -5,26 +5,253 @@
 #include "server_reader.hpp"
 #include "exception.hpp"
 #include "urlencoded.hpp"
+#include "header_names.hpp"
 #include <sys/types.h>
 #include <unistd.h>
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../string.hpp"
 #include "../singletons/main_config.hpp"
-#include "../buffer_streams.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	ConfigValue<std::size_t> g_max_header_line_length("http_max_header_line_length", 8192);
+	ConfigValue<std::size_t> g_max_headers_per_request("http_max_headers_per_request", 64);
+
+	// 返回第一行的末尾（不包括 CR LF），next 指向下一行的开头。调用者保证 [begin, end) 中有 LF。
+	const char *find_line_end(const char *begin, const char *end, const char *&next) NOEXCEPT {
+		const AUTO(lf, static_cast<const char *>(std::memchr(begin, '\n', static_cast<std::size_t>(end - begin))));
+		next = lf + 1;
+		if((lf != begin) && (lf[-1] == '\r')){
+			return lf - 1;
+		}
+		return lf;
+	}
+
+	// 返回第一个不是可打印 ASCII 字符（0x20 到 0x7E）的位置，没有则返回 end。
+	const char *find_nonprintable(const char *begin, const char *end) NOEXCEPT {
+		const char *pos = begin;
+#ifdef __SSE2__
+		// 有符号比较，0x80 以上的字节是负数，同样不满足大于 0x1F。
+		const __m128i lower = _mm_set1_epi8(0x1F);
+		const __m128i upper = _mm_set1_epi8(0x7F);
+		for(; end - pos >= 16; pos += 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+			const __m128i m = _mm_and_si128(_mm_cmpgt_epi8(v, lower), _mm_cmplt_epi8(v, upper));
+			const int bits = _mm_movemask_epi8(m) ^ 0xFFFF;
+			if(bits != 0){
+				return pos + __builtin_ctz(static_cast<unsigned>(bits));
+			}
+		}
+#endif
+		for(; pos != end; ++pos){
+			const unsigned ch = static_cast<unsigned char>(*pos);
+			if((ch < 0x20) || (0x7E < ch)){
+				break;
+			}
+		}
+		return pos;
+	}
+
+	// 解析 `HTTP/主版本.次版本`，主次版本号各不超过 15 位。失败时返回 false。
+	bool parse_version(boost::uint64_t &version, const char *begin, const char *end) NOEXCEPT {
+		if((end - begin < 5) || (std::memcmp(begin, "HTTP/", 5) != 0)){
+			return false;
+		}
+		const char *pos = begin + 5;
+		boost::uint64_t parts[2];
+		for(unsigned i = 0; i < 2; ++i){
+			if(i != 0){
+				if((pos == end) || (*pos != '.')){
+					return false;
+				}
+				++pos;
+			}
+			const char *const digits = pos;
+			parts[i] = 0;
+			while((pos != end) && ('0' <= *pos) && (*pos <= '9')){
+				parts[i] = parts[i] * 10 + static_cast<unsigned>(*pos - '0');
+				++pos;
+			}
+			if((pos == digits) || (pos - digits > 15)){
+				return false;
+			}
+		}
+		if(pos != end){
+			return false;
+		}
+		version = parts[0] * 10000 + parts[1];
+		return true;
+	}
+
+	bool is_space(char ch) NOEXCEPT {
+		return (ch == ' ') || (ch == '\t');
+	}
+}
+
 ServerReader::ServerReader()
 	: m_size_expecting(EXPECTING_NEW_LINE), m_state(S_FIRST_HEADER)
+	, m_header_scan(0), m_header_line_begin(0), m_header_lines(0)
 { }
 ServerReader::~ServerReader(){
-	if(m_state != S_FIRST_HEADER){
+	if((m_state != S_FIRST_HEADER) || (m_header_lines != 0)){
 		LOG_POSEIDON_DEBUG("Now that this reader is to be destroyed, a premature request has to be discarded.");
 	}
 }
 
+// 只查找换行符，不复制数据。数据不完整时记住已经检查过的位置，下次从那里继续。
+bool ServerReader::find_header_end(std::size_t &header_size, std::size_t &header_count){
+	PROFILE_ME;
+
+	const AUTO(max_line_length, g_max_header_line_length.get());
+	const AUTO(max_headers, g_max_headers_per_request.get());
+	for(;;){
+		const AUTO(lf_offset, m_queue.find('\n', m_header_scan));
+		if(lf_offset < 0){
+			// 没找到换行符。
+			DEBUG_THROW_UNLESS(m_queue.size() - m_header_line_begin <= max_line_length, Exception, ST_BAD_REQUEST); // XXX 用一个别的状态码？
+			m_header_scan = m_queue.size();
+			return false;
+		}
+		const AUTO(lf, static_cast<std::size_t>(lf_offset));
+		DEBUG_THROW_UNLESS(lf - m_header_line_begin <= max_line_length, Exception, ST_BAD_REQUEST); // XXX 用一个别的状态码？
+		m_header_scan = lf + 1;
+
+		// 空行只能是 LF 或者 CR LF。
+		bool empty_line = (lf == m_header_line_begin);
+		if(lf == m_header_line_begin + 1){
+			StreamBuffer::ReadCursor cursor(m_queue);
+			cursor.discard(m_header_line_begin);
+			empty_line = (cursor.get() == '\r');
+		}
+		if(!empty_line){
+			++m_header_lines;
+			DEBUG_THROW_UNLESS(m_header_lines <= max_headers + 1, Exception, ST_BAD_REQUEST); // XXX 用一个别的状态码？
+			m_header_line_begin = m_header_scan;
+			continue;
+		}
+		if(m_header_lines == 0){
+			// 请求之前的空行，忽略之。
+			m_queue.discard(m_header_scan);
+			m_header_scan = 0;
+			m_header_line_begin = 0;
+			continue;
+		}
+		header_size = m_header_scan;
+		header_count = m_header_lines - 1;
+		m_header_scan = 0;
+		m_header_line_begin = 0;
+		m_header_lines = 0;
+		return true;
+	}
+}
+
+// 请求行和报头通常位于同一个数据块中，直接在原地解析。跨越数据块时复制一次。
+void ServerReader::parse_header_block(std::size_t header_size, std::size_t header_count, bool dont_parse_get_params){
+	PROFILE_ME;
+
+	std::string copy;
+	AUTO(block, static_cast<const char *>(m_queue.peek_contiguous(header_size)));
+	if(!block){
+		copy.resize(header_size);
+		m_queue.peek(&copy[0], header_size);
+		block = copy.data();
+	}
+	const char *const block_end = block + header_size;
+
+	m_request_headers = RequestHeaders();
+	m_content_length = 0;
+	m_content_offset = 0;
+
+	const char *next;
+	const char *line = block;
+	const char *eol = find_line_end(line, block_end, next);
+	DEBUG_THROW_UNLESS(find_nonprintable(line, eol) == eol, BasicException, sslit("Invalid HTTP request header"));
+
+	AUTO(pos, static_cast<const char *>(std::memchr(line, ' ', static_cast<std::size_t>(eol - line))));
+	DEBUG_THROW_UNLESS(pos, Exception, ST_BAD_REQUEST);
+	char verb_str[16];
+	const AUTO(verb_len, static_cast<std::size_t>(pos - line));
+	DEBUG_THROW_UNLESS(verb_len < sizeof(verb_str), Exception, ST_NOT_IMPLEMENTED);
+	std::memcpy(verb_str, line, verb_len);
+	verb_str[verb_len] = 0;
+	m_request_headers.verb = get_verb_from_string(verb_str);
+	DEBUG_THROW_UNLESS(m_request_headers.verb != V_INVALID_VERB, Exception, ST_NOT_IMPLEMENTED);
+	line = pos + 1;
+
+	pos = static_cast<const char *>(std::memchr(line, ' ', static_cast<std::size_t>(eol - line)));
+	DEBUG_THROW_UNLESS(pos, Exception, ST_BAD_REQUEST);
+	const char *uri_end = pos;
+	if(!dont_parse_get_params){
+		const AUTO(query, static_cast<const char *>(std::memchr(line, '?', static_cast<std::size_t>(uri_end - line))));
+		if(query){
+			url_decode_params(m_request_headers.get_params, query + 1, static_cast<std::size_t>(uri_end - query - 1));
+			uri_end = query;
+		}
+	}
+	m_request_headers.uri.assign(line, uri_end);
+	line = pos + 1;
+
+	boost::uint64_t version;
+	DEBUG_THROW_UNLESS(parse_version(version, line, eol), Exception, ST_BAD_REQUEST);
+	DEBUG_THROW_UNLESS(version <= 10001, Exception, ST_VERSION_NOT_SUPPORTED);
+	m_request_headers.version = static_cast<unsigned>(version);
+
+	m_request_headers.headers.reserve(header_count);
+	for(;;){
+		line = next;
+		eol = find_line_end(line, block_end, next);
+		if(eol == line){
+			break;
+		}
+		pos = static_cast<const char *>(std::memchr(line, ':', static_cast<std::size_t>(eol - line)));
+		DEBUG_THROW_UNLESS(pos, Exception, ST_BAD_REQUEST);
+		const char *value_begin = pos + 1;
+		const char *value_end = eol;
+		while((value_begin != value_end) && is_space(value_begin[0])){
+			++value_begin;
+		}
+		while((value_begin != value_end) && is_space(value_end[-1])){
+			--value_end;
+		}
+		m_request_headers.headers.append(make_header_name(line, static_cast<std::size_t>(pos - line)), std::string(value_begin, value_end));
+	}
+	m_queue.discard(header_size);
+
+	const AUTO_REF(transfer_encoding, m_request_headers.headers.get("Transfer-Encoding"));
+	if(transfer_encoding.empty() || (::strcasecmp(transfer_encoding.c_str(), "identity") == 0)){
+		const AUTO_REF(content_length, m_request_headers.headers.get("Content-Length"));
+		if(content_length.empty()){
+			m_content_length = 0;
+		} else {
+			char *eptr;
+			m_content_length = ::strtoull(content_length.c_str(), &eptr, 10);
+			DEBUG_THROW_UNLESS(*eptr == 0, Exception, ST_BAD_REQUEST);
+			DEBUG_THROW_UNLESS(m_content_length <= CONTENT_LENGTH_MAX, Exception, ST_PAYLOAD_TOO_LARGE);
+		}
+	} else if(::strcasecmp(transfer_encoding.c_str(), "chunked") == 0){
+		m_content_length = CONTENT_CHUNKED;
+	} else {
+		LOG_POSEIDON_WARNING("Inacceptable Transfer-Encoding: ", transfer_encoding);
+		DEBUG_THROW(BasicException, sslit("Inacceptable Transfer-Encoding"));
+	}
+
+	on_request_headers(STD_MOVE(m_request_headers), m_content_length);
+
+	if(m_content_length == CONTENT_CHUNKED){
+		m_size_expecting = EXPECTING_NEW_LINE;
+		m_state = S_CHUNK_HEADER;
+	} else {
+		m_size_expecting = std::min<boost::uint64_t>(m_content_length, 4096);
+		m_state = S_IDENTITY;
+	}
+}
+
 bool ServerReader::put_encoded_data(StreamBuffer encoded, bool dont_parse_get_params){
 	PROFILE_ME;
 
@@ -32,28 +259,22 @@ bool ServerReader::put_encoded_data(StreamBuffer encoded, bool dont_parse_get_pa
 
 	bool has_next_request = true;
 	do {
+		if(m_state == S_FIRST_HEADER){
+			std::size_t header_size, header_count;
+			if(!find_header_end(header_size, header_count)){
+				break;
+			}
+			parse_header_block(header_size, header_count, dont_parse_get_params);
+			continue;
+		}
+
 		const bool expecting_new_line = (m_size_expecting == EXPECTING_NEW_LINE);
 
 		if(expecting_new_line){
-			std::ptrdiff_t lf_offset = 0;
-			StreamBuffer::EnumerationCookie cookie;
-			for(;;){
-				const void *data, *pos;
-				std::size_t size;
-				if(!m_queue.enumerate_chunk(&data, &size, cookie)){
-					lf_offset = -1;
-					break;
-				}
-				pos = std::memchr(data, '\n', size);
-				if(pos){
-					lf_offset += static_cast<const char *>(pos) - static_cast<const char *>(data);
-					break;
-				}
-				lf_offset += static_cast<std::ptrdiff_t>(size);
-			}
+			const AUTO(lf_offset, m_queue.find('\n'));
 			if(lf_offset < 0){
 				// 没找到换行符。
-				const AUTO(max_line_length, MainConfig::get<std::size_t>("http_max_header_line_length", 8192));
+				const AUTO(max_line_length, g_max_header_line_length.get());
 				DEBUG_THROW_UNLESS(m_queue.size() <= max_line_length, Exception, ST_BAD_REQUEST); // XXX 用一个别的状态码？
 				break;
 			}
@@ -76,101 +297,8 @@ bool ServerReader::put_encoded_data(StreamBuffer encoded, bool dont_parse_get_pa
 			boost::uint64_t temp64;
 
 		case S_FIRST_HEADER:
-			if(!expected.empty()){
-				m_request_headers = RequestHeaders();
-				m_content_length = 0;
-				m_content_offset = 0;
-
-				std::string line = expected.dump_string();
-
-				for(AUTO(it, line.begin()); it != line.end(); ++it){
-					const unsigned ch = static_cast<unsigned char>(*it);
-					DEBUG_THROW_UNLESS((0x20 <= ch) && (ch <= 0x7E), BasicException, sslit("Invalid HTTP request header"));
-				}
-
-				AUTO(pos, line.find(' '));
-				DEBUG_THROW_UNLESS(pos != std::string::npos, Exception, ST_BAD_REQUEST);
-				line.at(pos) = 0;
-				m_request_headers.verb = get_verb_from_string(line.c_str());
-				DEBUG_THROW_UNLESS(m_request_headers.verb != V_INVALID_VERB, Exception, ST_NOT_IMPLEMENTED);
-				line.erase(0, pos + 1);
-
-				pos = line.find(' ');
-				DEBUG_THROW_UNLESS(pos != std::string::npos, Exception, ST_BAD_REQUEST);
-				m_request_headers.uri.assign(line, 0, pos);
-				line.erase(0, pos + 1);
-
-				long ver_end = 0;
-				char ver_major_str[16], ver_minor_str[16];
-				DEBUG_THROW_UNLESS(std::sscanf(line.c_str(), "HTTP/%15[0-9].%15[0-9]%ln", ver_major_str, ver_minor_str, &ver_end) == 2, Exception, ST_BAD_REQUEST);
-				DEBUG_THROW_UNLESS(static_cast<std::size_t>(ver_end) == line.size(), Exception, ST_BAD_REQUEST);
-				m_request_headers.version = boost::numeric_cast<unsigned>(std::strtoul(ver_major_str, NULLPTR, 10) * 10000 + std::strtoul(ver_minor_str, NULLPTR, 10));
-				DEBUG_THROW_UNLESS(m_request_headers.version <= 10001, Exception, ST_VERSION_NOT_SUPPORTED);
-
-				if(!dont_parse_get_params){
-					pos = m_request_headers.uri.find('?');
-					if(pos != std::string::npos){
-						Buffer_istream is;
-						is.set_buffer(StreamBuffer(m_request_headers.uri.data() + pos + 1, m_request_headers.uri.size() - pos - 1));
-						url_decode_params(is, m_request_headers.get_params);
-						m_request_headers.uri.erase(pos);
-					}
-				}
-
-				m_size_expecting = EXPECTING_NEW_LINE;
-				m_state = S_HEADERS;
-			} else {
-				m_size_expecting = EXPECTING_NEW_LINE;
-				// m_state = S_FIRST_HEADER;
-			}
-			break;
-
-		case S_HEADERS:
-			if(!expected.empty()){
-				const AUTO(headers, m_request_headers.headers.size());
-				const AUTO(max_headers, MainConfig::get<std::size_t>("http_max_headers_per_request", 64));
-				DEBUG_THROW_UNLESS(headers <= max_headers, Exception, ST_BAD_REQUEST); // XXX 用一个别的状态码？
-
-				std::string line = expected.dump_string();
-
-				AUTO(pos, line.find(':'));
-				DEBUG_THROW_UNLESS(pos != std::string::npos, Exception, ST_BAD_REQUEST);
-				SharedNts key(line.data(), pos);
-				line.erase(0, pos + 1);
-				std::string value(trim(STD_MOVE(line)));
-				m_request_headers.headers.append(STD_MOVE(key), STD_MOVE(value));
-
-				m_size_expecting = EXPECTING_NEW_LINE;
-				// m_state = S_HEADERS;
-			} else {
-				const AUTO_REF(transfer_encoding, m_request_headers.headers.get("Transfer-Encoding"));
-				if(transfer_encoding.empty() || (::strcasecmp(transfer_encoding.c_str(), "identity") == 0)){
-					const AUTO_REF(content_length, m_request_headers.headers.get("Content-Length"));
-					if(content_length.empty()){
-						m_content_length = 0;
-					} else {
-						char *eptr;
-						m_content_length = ::strtoull(content_length.c_str(), &eptr, 10);
-						DEBUG_THROW_UNLESS(*eptr == 0, Exception, ST_BAD_REQUEST);
-						DEBUG_THROW_UNLESS(m_content_length <= CONTENT_LENGTH_MAX, Exception, ST_PAYLOAD_TOO_LARGE);
-					}
-				} else if(::strcasecmp(transfer_encoding.c_str(), "chunked") == 0){
-					m_content_length = CONTENT_CHUNKED;
-				} else {
-					LOG_POSEIDON_WARNING("Inacceptable Transfer-Encoding: ", transfer_encoding);
-					DEBUG_THROW(BasicException, sslit("Inacceptable Transfer-Encoding"));
-				}
-
-				on_request_headers(STD_MOVE(m_request_headers), m_content_length);
-
-				if(m_content_length == CONTENT_CHUNKED){
-					m_size_expecting = EXPECTING_NEW_LINE;
-					m_state = S_CHUNK_HEADER;
-				} else {
-					m_size_expecting = std::min<boost::uint64_t>(m_content_length, 4096);
-					m_state = S_IDENTITY;
-				}
-			}
+			// 已经在循环的开头处理了。
+			assert(false);
 			break;
 
 		case S_IDENTITY:
@@ -239,7 +367,7 @@ bool ServerReader::put_encoded_data(StreamBuffer encoded, bool dont_parse_get_pa
 
 				AUTO(pos, line.find(':'));
 				DEBUG_THROW_UNLESS(pos != std::string::npos, Exception, ST_BAD_REQUEST);
-				SharedNts key(line.data(), pos);
+				SharedNts key(make_header_name(line.data(), pos));
 				line.erase(0, pos + 1);
 				std::string value(trim(STD_MOVE(line)));
 				m_chunked_trailer.append(STD_MOVE(key), STD_MOVE(value));
@@ -17,12 +17,11 @@ namespace Http {
 class ServerReader {
 private:
 	enum State {
-		S_FIRST_HEADER      = 0,
-		S_HEADERS           = 1,
-		S_IDENTITY          = 2,
-		S_CHUNK_HEADER      = 3,
-		S_CHUNK_DATA        = 4,
-		S_CHUNKED_TRAILER   = 5,
+		S_FIRST_HEADER      = 0, // 请求行和报头作为一个整体解析。
+		S_IDENTITY          = 1,
+		S_CHUNK_HEADER      = 2,
+		S_CHUNK_DATA        = 3,
+		S_CHUNKED_TRAILER   = 4,
 	};
 
 protected:
@@ -43,6 +42,11 @@ private:
 	boost::uint64_t m_size_expecting;
 	State m_state;
 
+	// 查找报头结尾时已经检查过的字节数，以及当前行的起始位置和已经读到的行数，数据不完整时下次从这里继续。
+	std::size_t m_header_scan;
+	std::size_t m_header_line_begin;
+	std::size_t m_header_lines;
+
 	RequestHeaders m_request_headers;
 	boost::uint64_t m_content_length;
 	boost::uint64_t m_content_offset;
@@ -55,6 +59,10 @@ public:
 	ServerReader();
 	virtual ~ServerReader();
 
+private:
+	bool find_header_end(std::size_t &header_size, std::size_t &header_count);
+	void parse_header_block(std::size_t header_size, std::size_t header_count, bool dont_parse_get_params);
+
 protected:
 	// 如果 Transfer-Encoding 为 chunked， content_length 的值为 CONTENT_CHUNKED。
 	virtual void on_request_headers(RequestHeaders request_headers, boost::uint64_t content_length) = 0;
@@ -72,6 +80,10 @@ public:
 	StreamBuffer &get_queue(){
 		return m_queue;
 	}
+	// 没有读到一半的请求时返回 true。
+	bool is_idle() const {
+		return (m_state == S_FIRST_HEADER) && m_queue.empty();
+	}
 
 	bool put_encoded_data(StreamBuffer encoded, bool dont_parse_get_params = false);
 };
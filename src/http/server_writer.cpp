@@ -7,25 +7,139 @@
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../string.hpp"
+#include "../system_exception.hpp"
+#include <unistd.h>
+#include <time.h>
 
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	// 每个线程缓存当前这一秒的 Date 报头，格式为 RFC 7231 中的 IMF-fixdate。
+	struct DateCache {
+		::time_t second;
+		std::size_t len;
+		char str[32];
+	};
+
+	__thread DateCache t_date_cache;
+
+	const DateCache &get_date_cache(){
+		const ::time_t now = ::time(NULLPTR);
+		AUTO_REF(cache, t_date_cache);
+		if((cache.len == 0) || (cache.second != now)){
+			static const char s_days[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+			static const char s_months[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+			::tm tm;
+			::gmtime_r(&now, &tm);
+			cache.len = (unsigned)std::sprintf(cache.str, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+				s_days[tm.tm_wday % 7], (unsigned)tm.tm_mday, s_months[tm.tm_mon % 12], (unsigned)tm.tm_year + 1900, (unsigned)tm.tm_hour, (unsigned)tm.tm_min, (unsigned)tm.tm_sec);
+			cache.second = now;
+		}
+		return cache;
+	}
+
+	void copy_and_advance(char *&write, const void *data, std::size_t size){
+		std::memcpy(write, data, size);
+		write += size;
+	}
+
+	// 把状态行和报头一次性写入 data。如果 headers 中没有 Date，则添加一个。
+	void put_response_head(StreamBuffer &data, const ResponseHeaders &response_headers){
+		const AUTO_REF(reason, response_headers.reason);
+		const AUTO_REF(headers, response_headers.headers);
+
+		char version_str[32];
+		const unsigned ver_major = response_headers.version / 10000, ver_minor = response_headers.version % 10000;
+		const std::size_t version_len = (unsigned)std::sprintf(version_str, "HTTP/%u.%u", ver_major, ver_minor);
+		// 原因短语与标准的相同时使用预先生成的状态行。
+		const AUTO_REF(cached_tail, get_status_line_tail(response_headers.status_code));
+		char code_str[16];
+		std::size_t code_len = 0;
+		std::size_t status_len;
+		if((cached_tail.size() == reason.size() + 7) && (cached_tail.compare(5, reason.size(), reason) == 0)){
+			status_len = version_len + cached_tail.size();
+		} else {
+			code_len = (unsigned)std::sprintf(code_str, " %u ", static_cast<unsigned>(response_headers.status_code));
+			status_len = version_len + code_len + reason.size() + 2;
+		}
+		const DateCache *date = NULLPTR;
+		if(!headers.has("Date")){
+			date = &get_date_cache();
+		}
+
+		std::size_t total = status_len + 2;
+		if(date){
+			total += 6 + date->len + 2;
+		}
+		for(AUTO(it, headers.begin()); it != headers.end(); ++it){
+			total += std::strlen(it->first.get()) + 2 + it->second.size() + 2;
+		}
+
+		char *const begin = static_cast<char *>(data.reserve_tail(total));
+		char *write = begin;
+		copy_and_advance(write, version_str, version_len);
+		if(code_len == 0){
+			copy_and_advance(write, cached_tail.data(), cached_tail.size());
+		} else {
+			copy_and_advance(write, code_str, code_len);
+			copy_and_advance(write, reason.data(), reason.size());
+			copy_and_advance(write, "\r\n", 2);
+		}
+		if(date){
+			copy_and_advance(write, "Date: ", 6);
+			copy_and_advance(write, date->str, date->len);
+			copy_and_advance(write, "\r\n", 2);
+		}
+		for(AUTO(it, headers.begin()); it != headers.end(); ++it){
+			copy_and_advance(write, it->first.get(), std::strlen(it->first.get()));
+			copy_and_advance(write, ": ", 2);
+			copy_and_advance(write, it->second.data(), it->second.size());
+			copy_and_advance(write, "\r\n", 2);
+		}
+		copy_and_advance(write, "\r\n", 2);
+		DEBUG_THROW_ASSERT(static_cast<std::size_t>(write - begin) == total);
+		data.commit_tail(total);
+	}
+}
+
 ServerWriter::ServerWriter(){ }
 ServerWriter::~ServerWriter(){ }
 
-long ServerWriter::put_response(ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length){
+StreamBuffer ServerWriter::load_file_range(int fd, boost::uint64_t offset, boost::uint64_t length){
 	PROFILE_ME;
 
 	StreamBuffer data;
+	boost::uint64_t remaining = length;
+	while(remaining != 0){
+		const std::size_t bytes_to_read = static_cast<std::size_t>(std::min<boost::uint64_t>(remaining, 0x10000));
+		const AUTO(buffer, data.reserve_tail(bytes_to_read));
+		const ::ssize_t result = ::pread(fd, buffer, bytes_to_read, static_cast< ::off_t>(offset));
+		if(result < 0){
+			const int err_code = errno;
+			data.commit_tail(0);
+			DEBUG_THROW(SystemException, err_code);
+		}
+		data.commit_tail(static_cast<std::size_t>(result));
+		DEBUG_THROW_UNLESS(result != 0, SystemException, EIO);
+		offset += static_cast<std::size_t>(result);
+		remaining -= static_cast<std::size_t>(result);
+	}
+	return data;
+}
 
-	const unsigned ver_major = response_headers.version / 10000, ver_minor = response_headers.version % 10000;
-	const unsigned status_code = static_cast<unsigned>(response_headers.status_code);
-	char temp[64];
-	unsigned len = (unsigned)std::sprintf(temp, "HTTP/%u.%u %u ", ver_major, ver_minor, status_code);
-	data.put(temp, len);
-	data.put(response_headers.reason);
-	data.put("\r\n");
+long ServerWriter::on_encoded_file_avail(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length){
+	PROFILE_ME;
+
+	const UniqueFile owned(STD_MOVE(file));
+	return on_encoded_data_avail(load_file_range(owned.get(), offset, length));
+}
+
+long ServerWriter::put_response(ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length){
+	PROFILE_ME;
+
+	StreamBuffer data;
 
 	AUTO_REF(headers, response_headers.headers);
 	if(entity.empty()){
@@ -37,36 +151,43 @@ long ServerWriter::put_response(ResponseHeaders response_headers, StreamBuffer e
 	} else {
 		headers.erase("Transfer-Encoding");
 		if(set_content_length){
-			len = (unsigned)std::sprintf(temp, "%llu", (unsigned long long)entity.size());
+			char temp[64];
+			const unsigned len = (unsigned)std::sprintf(temp, "%llu", (unsigned long long)entity.size());
 			headers.set(sslit("Content-Length"), std::string(temp, len));
 		}
 	}
 
-	for(AUTO(it, headers.begin()); it != headers.end(); ++it){
-		data.put(it->first.get());
-		data.put(": ");
-		data.put(it->second);
-		data.put("\r\n");
-	}
-	data.put("\r\n");
-
+	put_response_head(data, response_headers);
 	data.splice(entity);
 
 	return on_encoded_data_avail(STD_MOVE(data));
 }
 
-long ServerWriter::put_chunked_header(ResponseHeaders response_headers){
+long ServerWriter::put_file_response(ResponseHeaders response_headers, Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length){
 	PROFILE_ME;
 
+	UniqueFile owned(STD_MOVE(file));
 	StreamBuffer data;
 
-	const unsigned ver_major = response_headers.version / 10000, ver_minor = response_headers.version % 10000;
-	const unsigned status_code = static_cast<unsigned>(response_headers.status_code);
+	AUTO_REF(headers, response_headers.headers);
+	headers.erase("Transfer-Encoding");
 	char temp[64];
-	unsigned len = (unsigned)std::sprintf(temp, "HTTP/%u.%u %u ", ver_major, ver_minor, status_code);
-	data.put(temp, len);
-	data.put(response_headers.reason);
-	data.put("\r\n");
+	const unsigned len = (unsigned)std::sprintf(temp, "%llu", (unsigned long long)length);
+	headers.set(sslit("Content-Length"), std::string(temp, len));
+
+	put_response_head(data, response_headers);
+
+	const long result = on_encoded_data_avail(STD_MOVE(data));
+	if(!owned || (length == 0) || !result){
+		return result;
+	}
+	return on_encoded_file_avail(STD_MOVE(owned), offset, length);
+}
+
+long ServerWriter::put_chunked_header(ResponseHeaders response_headers){
+	PROFILE_ME;
+
+	StreamBuffer data;
 
 	AUTO_REF(headers, response_headers.headers);
 	const AUTO_REF(transfer_encoding, headers.get("Transfer-Encoding"));
@@ -74,13 +195,7 @@ long ServerWriter::put_chunked_header(ResponseHeaders response_headers){
 		headers.set(sslit("Transfer-Encoding"), "chunked");
 	}
 
-	for(AUTO(it, headers.begin()); it != headers.end(); ++it){
-		data.put(it->first.get());
-		data.put(": ");
-		data.put(it->second);
-		data.put("\r\n");
-	}
-	data.put("\r\n");
+	put_response_head(data, response_headers);
 
 	return on_encoded_data_avail(STD_MOVE(data));
 }
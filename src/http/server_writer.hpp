@@ -9,6 +9,7 @@
 #include <boost/cstdint.hpp>
 #include "../stream_buffer.hpp"
 #include "../optional_map.hpp"
+#include "../raii.hpp"
 #include "response_headers.hpp"
 
 namespace Poseidon {
@@ -20,10 +21,17 @@ public:
 	virtual ~ServerWriter();
 
 protected:
+	// 把文件中从 offset 开始的 length 字节读入内存。文件比预期的短时抛出异常。
+	static StreamBuffer load_file_range(int fd, boost::uint64_t offset, boost::uint64_t length);
+
 	virtual long on_encoded_data_avail(StreamBuffer encoded) = 0;
+	// 默认实现把文件的这一部分读入内存，然后调用 on_encoded_data_avail()。
+	virtual long on_encoded_file_avail(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length);
 
 public:
 	long put_response(ResponseHeaders response_headers, StreamBuffer entity, bool set_content_length);
+	// 正文是文件中从 offset 开始的 length 字节，Content-Length 总是被设为 length。file 为空则只发送响应头（用于 HEAD 请求）。
+	long put_file_response(ResponseHeaders response_headers, Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length);
 
 	long put_chunked_header(ResponseHeaders response_headers);
 	long put_chunk(StreamBuffer entity);
@@ -4,30 +4,86 @@
 #include "../precompiled.hpp"
 #include "session.hpp"
 #include "exception.hpp"
+#include "http2_session.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
 #include "../singletons/main_config.hpp"
 #include "../singletons/job_dispatcher.hpp"
+#include "../singletons/epoll_daemon.hpp"
 #include "../stream_buffer.hpp"
 #include "../job_base.hpp"
 #include "../atomic.hpp"
+#include "../trace_context.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 namespace Http {
 
+namespace {
+	ConfigValue<std::size_t> g_request_arena_size("http_request_arena_size", 65536);
+	ConfigValue<boost::uint64_t> g_keep_alive_timeout("http_keep_alive_timeout", 5000);
+	ConfigValue<boost::uint64_t> g_max_request_length("http_max_request_length", 16384);
+	ConfigValue<bool> g_parallel_pipelining_enabled("http_parallel_pipelining_enabled", false);
+	ConfigValue<boost::uint64_t> g_request_stream_max_pending("http_request_stream_max_pending", 1048576);
+	ConfigValue<bool> g_cork_jobs("http_cork_jobs", true);
+
+	__thread const Session *t_pipeline_session = 0; // XXX: NULLPTR
+	__thread void *t_pipeline_slot = 0; // XXX: NULLPTR
+
+	class PipelineSlotScope : NONCOPYABLE {
+	private:
+		const Session *const m_prev_session;
+		void *const m_prev_slot;
+
+	public:
+		PipelineSlotScope(const Session *session, void *slot)
+			: m_prev_session(t_pipeline_session), m_prev_slot(t_pipeline_slot)
+		{
+			t_pipeline_session = session;
+			t_pipeline_slot = slot;
+		}
+		~PipelineSlotScope(){
+			t_pipeline_session = m_prev_session;
+			t_pipeline_slot = m_prev_slot;
+		}
+	};
+}
+
+struct Session::PipelineSlot {
+	StreamBuffer data;
+	bool complete;
+	bool close_after;
+
+	PipelineSlot()
+		: data(), complete(false), close_after(false)
+	{ }
+};
+
 class Session::SyncJobBase : public JobBase {
 private:
 	const SocketBase::DelayedShutdownGuard m_guard;
 	const boost::weak_ptr<Session> m_weak_session;
+	const boost::weak_ptr<const void> m_category;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
 
 protected:
 	explicit SyncJobBase(const boost::shared_ptr<Session> &session)
-		: m_guard(session), m_weak_session(session)
+		: m_guard(session), m_weak_session(session), m_category(session), m_priority(session->get_job_priority()), m_thread_hint(session->get_epoll_thread_index())
+	{ }
+	SyncJobBase(const boost::shared_ptr<Session> &session, const boost::weak_ptr<const void> &category)
+		: m_guard(session), m_weak_session(session), m_category(category), m_priority(session->get_job_priority()), m_thread_hint(session->get_epoll_thread_index())
 	{ }
 
 private:
 	boost::weak_ptr<const void> get_category() const FINAL {
-		return m_weak_session;
+		return m_category;
+	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
 	}
 	void perform() FINAL {
 		PROFILE_ME;
@@ -37,6 +93,11 @@ private:
 			return;
 		}
 
+		// 同一个任务中发出的响应头、正文和各个分块合并起来，在任务结束时一次性写入套接字。
+		const bool corked = g_cork_jobs.get();
+		if(corked){
+			session->cork_send();
+		}
 		try {
 			really_perform(session);
 		} catch(Exception &e){
@@ -49,6 +110,9 @@ private:
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown.");
 			session->force_shutdown();
 		}
+		if(corked){
+			session->uncork_send();
+		}
 	}
 
 protected:
@@ -62,6 +126,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
@@ -92,45 +159,345 @@ private:
 	RequestHeaders m_request_headers;
 	StreamBuffer m_entity;
 	bool m_keep_alive;
+	bool m_pipelined;
+	boost::shared_ptr<PipelineSlot> m_slot;
 
 public:
 	RequestJob(const boost::shared_ptr<Session> &session, RequestHeaders request_headers, StreamBuffer entity, bool keep_alive)
 		: SyncJobBase(session)
-		, m_request_headers(STD_MOVE(request_headers)), m_entity(STD_MOVE(entity)), m_keep_alive(keep_alive)
+		, m_request_headers(STD_MOVE(request_headers)), m_entity(STD_MOVE(entity)), m_keep_alive(keep_alive), m_pipelined(false), m_slot()
+	{ }
+	// 并行流水线模式下的请求。slot 非空表示这个请求与其他请求并行处理，任务的类别是这个 slot。
+	RequestJob(const boost::shared_ptr<Session> &session, RequestHeaders request_headers, StreamBuffer entity, bool keep_alive,
+		const boost::shared_ptr<PipelineSlot> &slot)
+		: SyncJobBase(session, slot ? boost::weak_ptr<const void>(slot) : boost::weak_ptr<const void>(session))
+		, m_request_headers(STD_MOVE(request_headers)), m_entity(STD_MOVE(entity)), m_keep_alive(keep_alive), m_pipelined(true), m_slot(slot)
 	{ }
 
 protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
+	bool is_yieldable() const OVERRIDE {
+		// 响应的去向保存在线程局部变量中。
+		return !m_slot;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
-		session->on_sync_request(STD_MOVE(m_request_headers), STD_MOVE(m_entity));
+		// 请求带有 traceparent 时，处理这个请求的 span 属于对端的 trace，否则是这个任务的子节点。
+		TraceContext parent = get_current_trace_context();
+		const AUTO_REF(traceparent, m_request_headers.headers.get("traceparent"));
+		if(!traceparent.empty() && !parse_traceparent(parent, traceparent.c_str())){
+			LOG_POSEIDON_DEBUG("Invalid traceparent: ", traceparent);
+		}
+		TraceSpan trace;
+		{
+			const TraceScope parent_scope(parent);
+			trace = TraceSpan("http.server", TraceSpan::KIND_SERVER);
+		}
+		const char *const method = get_string_from_verb(m_request_headers.verb);
+		std::string target;
+		if(trace.is_sampled()){
+			target = m_request_headers.uri;
+		}
+		const TraceScope trace_scope(trace.get_context());
+		try {
+			handle_request(session);
+		} catch(...){
+			finish_trace(trace, method, target, true);
+			throw;
+		}
+		finish_trace(trace, method, target, false);
+	}
 
-		if(m_keep_alive){
-			const AUTO(keep_alive_timeout, MainConfig::get<boost::uint64_t>("http_keep_alive_timeout", 5000));
+private:
+	static void finish_trace(const TraceSpan &trace, const char *method, const std::string &target, bool error){
+		const char *const attributes[][2] = {
+			{ "http.request.method", method },
+			{ "url.path", target.c_str() },
+			{ NULLPTR },
+		};
+		trace.finish(attributes, error);
+	}
+
+	void handle_request(const boost::shared_ptr<Session> &session){
+		if(!m_pipelined){
+			// 处理请求期间创建的临时缓冲区从同一块内存中分配，请求结束后一次性释放。
+			const StreamBuffer::ScratchArena arena(g_request_arena_size.get());
+			session->on_sync_request(STD_MOVE(m_request_headers), STD_MOVE(m_entity));
+
+			if(m_keep_alive){
+				const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
+				session->set_timeout(keep_alive_timeout);
+			} else {
+				session->shutdown_write();
+			}
+			return;
+		}
+
+		// 在并行流水线模式下，错误响应也要排队，不能立即关闭连接，否则之前的请求的响应会丢失。
+		bool keep_alive = m_keep_alive;
+		{
+			const PipelineSlotScope scope(session.get(), m_slot.get());
+			try {
+				const StreamBuffer::ScratchArena arena(g_request_arena_size.get());
+				session->on_sync_request(STD_MOVE(m_request_headers), STD_MOVE(m_entity));
+			} catch(Exception &e){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Http::Exception thrown: status_code = ", e.get_status_code(), ", what = ", e.what());
+				OptionalMap headers = e.get_headers();
+				headers.set(sslit("Connection"), "Close");
+				session->send_default(e.get_status_code(), STD_MOVE(headers));
+				keep_alive = false;
+			} catch(std::exception &e){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "std::exception thrown: what = ", e.what());
+				OptionalMap headers;
+				headers.set(sslit("Connection"), "Close");
+				session->send_default(ST_INTERNAL_SERVER_ERROR, STD_MOVE(headers));
+				keep_alive = false;
+			}
+		}
+		session->finish_pipelined_request(m_slot, keep_alive);
+
+		if(keep_alive){
+			const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
 			session->set_timeout(keep_alive_timeout);
-		} else {
+		}
+	}
+};
+
+class Session::StreamHeadersJob : public Session::SyncJobBase {
+private:
+	RequestHeaders m_request_headers;
+	bool m_pipelined;
+
+public:
+	StreamHeadersJob(const boost::shared_ptr<Session> &session, RequestHeaders request_headers, bool pipelined)
+		: SyncJobBase(session)
+		, m_request_headers(STD_MOVE(request_headers)), m_pipelined(pipelined)
+	{ }
+
+protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
+	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
+		PROFILE_ME;
+
+		const std::string expect = m_request_headers.headers.get("Expect");
+		if(!expect.empty() && (::strcasecmp(expect.c_str(), "100-continue") != 0)){
+			LOG_POSEIDON_WARNING("Unknown HTTP header Expect: ", expect);
+			DEBUG_THROW(Exception, ST_EXPECTATION_FAILED);
+		}
+		session->on_sync_request_stream_begin(STD_MOVE(m_request_headers));
+		if(!expect.empty()){
+			session->send_default(ST_CONTINUE);
+		}
+
+		if(m_pipelined){
+			session->finish_pipelined_request(boost::shared_ptr<PipelineSlot>(), true);
+		}
+	}
+};
+
+class Session::StreamChunkJob : public Session::SyncJobBase {
+private:
+	boost::uint64_t m_entity_offset;
+	StreamBuffer m_chunk;
+	bool m_pipelined;
+
+public:
+	StreamChunkJob(const boost::shared_ptr<Session> &session, boost::uint64_t entity_offset, StreamBuffer chunk, bool pipelined)
+		: SyncJobBase(session)
+		, m_entity_offset(entity_offset), m_chunk(STD_MOVE(chunk)), m_pipelined(pipelined)
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
+		PROFILE_ME;
+
+		const std::size_t size = m_chunk.size();
+		session->on_sync_request_stream_chunk(m_entity_offset, STD_MOVE(m_chunk));
+		session->release_stream_pending(size);
+
+		if(m_pipelined){
+			session->finish_pipelined_request(boost::shared_ptr<PipelineSlot>(), true);
+		}
+	}
+};
+
+class Session::StreamEndJob : public Session::SyncJobBase {
+private:
+	boost::uint64_t m_content_length;
+	OptionalMap m_trailers;
+	bool m_keep_alive;
+	bool m_pipelined;
+
+public:
+	StreamEndJob(const boost::shared_ptr<Session> &session, boost::uint64_t content_length, OptionalMap trailers, bool keep_alive, bool pipelined)
+		: SyncJobBase(session)
+		, m_content_length(content_length), m_trailers(STD_MOVE(trailers)), m_keep_alive(keep_alive), m_pipelined(pipelined)
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
+		PROFILE_ME;
+
+		const StreamBuffer::ScratchArena arena(g_request_arena_size.get());
+		session->on_sync_request_stream_end(m_content_length, STD_MOVE(m_trailers));
+
+		if(m_pipelined){
+			session->finish_pipelined_request(boost::shared_ptr<PipelineSlot>(), m_keep_alive);
+		} else if(!m_keep_alive){
 			session->shutdown_write();
 		}
+		if(m_keep_alive){
+			const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
+			session->set_timeout(keep_alive_timeout);
+		}
 	}
 };
 
 Session::Session(Move<UniqueFile> socket)
 	: LowLevelSession(STD_MOVE(socket))
-	, m_max_request_length(MainConfig::get<boost::uint64_t>("http_max_request_length", 16384))
-	, m_size_total(0), m_request_headers()
+	, m_max_request_length(g_max_request_length.get())
+	, m_parallel_pipelining_enabled(g_parallel_pipelining_enabled.get())
+	, m_size_total(0), m_request_headers(), m_streaming(false), m_stream_pipelined(false)
+	, m_max_stream_pending(g_request_stream_max_pending.get()), m_stream_pending(0)
+	, m_parallel_running(0), m_serial_running(false)
 { }
 Session::~Session(){ }
 
+void Session::unlocked_dispatch_held_requests(){
+	PROFILE_ME;
+
+	while(!m_held_requests.empty()){
+		AUTO_REF(front, m_held_requests.front());
+		// 并行的请求只需要等待之前的串行请求；串行的请求需要等待之前所有的请求。
+		if(m_serial_running){
+			break;
+		}
+		if(!front.second && (m_parallel_running != 0)){
+			break;
+		}
+		if(front.second){
+			m_pipeline.push_back(front.second);
+		}
+		if(!JobDispatcher::enqueue(front.first, VAL_INIT)){
+			LOG_POSEIDON_WARNING("Job queue is full. Closing HTTP connection: remote = ", get_remote_info());
+			if(front.second){
+				m_pipeline.pop_back();
+			}
+			m_held_requests.clear();
+			force_shutdown();
+			break;
+		}
+		if(front.second){
+			++m_parallel_running;
+		} else {
+			m_serial_running = true;
+		}
+		m_held_requests.pop_front();
+	}
+}
+void Session::unlocked_flush_pipeline(){
+	PROFILE_ME;
+
+	while(!m_pipeline.empty()){
+		const AUTO(slot, m_pipeline.front());
+		if(!slot->data.empty()){
+			LowLevelSession::on_encoded_data_avail(STD_MOVE(slot->data));
+			slot->data.clear();
+		}
+		if(!slot->complete){
+			// 队首的请求还在处理中，它之后产生的数据将直接发出。
+			break;
+		}
+		m_pipeline.pop_front();
+
+		if(slot->close_after){
+			m_pipeline.clear();
+			m_held_requests.clear();
+			shutdown_read();
+			shutdown_write();
+			break;
+		}
+	}
+}
+
+void Session::finish_pipelined_request(const boost::shared_ptr<PipelineSlot> &slot, bool keep_alive){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_pipeline_mutex);
+	if(slot){
+		slot->complete = true;
+		slot->close_after = !keep_alive;
+		--m_parallel_running;
+		unlocked_flush_pipeline();
+	} else {
+		m_serial_running = false;
+		if(!keep_alive){
+			m_held_requests.clear();
+			shutdown_write();
+		}
+	}
+	unlocked_dispatch_held_requests();
+}
+
+bool Session::enqueue_stream_job(const boost::shared_ptr<JobBase> &job){
+	PROFILE_ME;
+
+	if(m_stream_pipelined){
+		const Mutex::UniqueLock lock(m_pipeline_mutex);
+		m_held_requests.push_back(std::make_pair(job, boost::shared_ptr<PipelineSlot>()));
+		unlocked_dispatch_held_requests();
+		return true;
+	}
+	return JobDispatcher::enqueue(job, VAL_INIT);
+}
+void Session::release_stream_pending(std::size_t size){
+	PROFILE_ME;
+
+	const AUTO(old_pending, atomic_sub(m_stream_pending, size, ATOMIC_RELAXED) + size);
+	if((old_pending >= m_max_stream_pending) && (old_pending - size < m_max_stream_pending)){
+		EpollDaemon::mark_socket_readable(this);
+	}
+}
+
 void Session::on_read_hup(){
 	PROFILE_ME;
 
-	JobDispatcher::enqueue(
-		boost::make_shared<ReadHupJob>(virtual_shared_from_this<Session>()),
-		VAL_INIT);
+	if(is_parallel_pipelining_enabled()){
+		// 必须等到之前所有的请求都处理完。
+		const Mutex::UniqueLock lock(m_pipeline_mutex);
+		m_held_requests.push_back(std::make_pair(boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Session>()), boost::shared_ptr<PipelineSlot>()));
+		unlocked_dispatch_held_requests();
+	} else {
+		JobDispatcher::enqueue(
+			boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Session>()),
+			VAL_INIT);
+	}
 
 	LowLevelSession::on_read_hup();
 }
 
+bool Session::can_be_handed_over() const {
+	PROFILE_ME;
+
+	// 在 epoll 线程中，此时不会有新的请求被解析出来。
+	if(m_streaming || !is_low_level_reading_idle()){
+		return false;
+	}
+	{
+		const Mutex::UniqueLock lock(m_pipeline_mutex);
+		if(m_serial_running || (m_parallel_running != 0) || !m_held_requests.empty() || !m_pipeline.empty()){
+			return false;
+		}
+	}
+	// 没有启用并行流水线时，请求任务以这个连接为类别直接投递。
+	return !JobDispatcher::has_pending_jobs(virtual_weak_from_this<const Session>());
+}
+
 void Session::on_low_level_request_headers(RequestHeaders request_headers, boost::uint64_t content_length){
 	PROFILE_ME;
 
@@ -140,17 +507,36 @@ void Session::on_low_level_request_headers(RequestHeaders request_headers, boost
 	m_request_headers = STD_MOVE(request_headers);
 	m_entity.clear();
 
+	m_streaming = is_request_streamed(m_request_headers);
+	if(m_streaming){
+		m_stream_pipelined = is_parallel_pipelining_enabled();
+		const bool queued = enqueue_stream_job(
+			boost::allocate_shared<StreamHeadersJob>(PooledAllocator<StreamHeadersJob>(), virtual_shared_from_this<Session>(), m_request_headers, m_stream_pipelined));
+		if(!queued){
+			// 任务队列已满。
+			send_default_and_shutdown(ST_SERVICE_UNAVAILABLE);
+		}
+		return;
+	}
+
 	const AUTO_REF(expect, m_request_headers.headers.get("Expect"));
 	if(!expect.empty()){
 		JobDispatcher::enqueue(
-			boost::make_shared<ExpectJob>(virtual_shared_from_this<Session>(), m_request_headers),
+			boost::allocate_shared<ExpectJob>(PooledAllocator<ExpectJob>(), virtual_shared_from_this<Session>(), m_request_headers),
 			VAL_INIT);
 	}
 }
 void Session::on_low_level_request_entity(boost::uint64_t entity_offset, StreamBuffer entity){
 	PROFILE_ME;
 
-	(void)entity_offset;
+	if(m_streaming){
+		const std::size_t size = entity.size();
+		atomic_add(m_stream_pending, size, ATOMIC_RELAXED);
+		const bool queued = enqueue_stream_job(
+			boost::allocate_shared<StreamChunkJob>(PooledAllocator<StreamChunkJob>(), virtual_shared_from_this<Session>(), entity_offset, STD_MOVE(entity), m_stream_pipelined));
+		DEBUG_THROW_UNLESS(queued, Exception, ST_SERVICE_UNAVAILABLE);
+		return;
+	}
 
 	m_size_total += entity.size();
 	DEBUG_THROW_UNLESS(m_size_total <= get_max_request_length(), Exception, ST_PAYLOAD_TOO_LARGE);
@@ -159,16 +545,54 @@ void Session::on_low_level_request_entity(boost::uint64_t entity_offset, StreamB
 boost::shared_ptr<UpgradedSessionBase> Session::on_low_level_request_end(boost::uint64_t content_length, OptionalMap headers){
 	PROFILE_ME;
 
-	(void)content_length;
+	if(m_streaming){
+		m_streaming = false;
+		const bool keep_alive = is_keep_alive_enabled(m_request_headers);
+		const bool queued = enqueue_stream_job(
+			boost::allocate_shared<StreamEndJob>(PooledAllocator<StreamEndJob>(), virtual_shared_from_this<Session>(), content_length, STD_MOVE(headers), keep_alive, m_stream_pipelined));
+		if(!queued){
+			// 任务队列已满。
+			send_default_and_shutdown(ST_SERVICE_UNAVAILABLE);
+			return VAL_INIT;
+		}
+		if(!keep_alive){
+			shutdown_read();
+		}
+		return VAL_INIT;
+	}
 
 	for(AUTO(it, headers.begin()); it != headers.end(); ++it){
 		m_request_headers.headers.append(it->first, STD_MOVE(it->second));
 	}
 	const bool keep_alive = is_keep_alive_enabled(m_request_headers);
 
-	JobDispatcher::enqueue(
-		boost::make_shared<RequestJob>(virtual_shared_from_this<Session>(), STD_MOVE(m_request_headers), STD_MOVE(m_entity), keep_alive),
+	if(is_parallel_pipelining_enabled()){
+		const AUTO(verb, m_request_headers.verb);
+		const bool parallel = ((verb == V_GET) || (verb == V_HEAD)) && m_request_headers.headers.get("Expect").empty();
+		boost::shared_ptr<PipelineSlot> slot;
+		if(parallel){
+			slot = boost::make_shared<PipelineSlot>();
+		}
+		AUTO(job, boost::allocate_shared<RequestJob>(PooledAllocator<RequestJob>(), virtual_shared_from_this<Session>(), STD_MOVE(m_request_headers), STD_MOVE(m_entity), keep_alive, slot));
+		{
+			const Mutex::UniqueLock lock(m_pipeline_mutex);
+			m_held_requests.push_back(std::make_pair(STD_MOVE_IDN(job), STD_MOVE_IDN(slot)));
+			unlocked_dispatch_held_requests();
+		}
+		if(!keep_alive){
+			shutdown_read();
+		}
+		return VAL_INIT;
+	}
+
+	const bool queued = JobDispatcher::enqueue(
+		boost::allocate_shared<RequestJob>(PooledAllocator<RequestJob>(), virtual_shared_from_this<Session>(), STD_MOVE(m_request_headers), STD_MOVE(m_entity), keep_alive),
 		VAL_INIT);
+	if(!queued){
+		// 任务队列已满。
+		send_default_and_shutdown(ST_SERVICE_UNAVAILABLE);
+		return VAL_INIT;
+	}
 
 	if(!keep_alive){
 		shutdown_read();
@@ -176,6 +600,46 @@ boost::shared_ptr<UpgradedSessionBase> Session::on_low_level_request_end(boost::
 	return VAL_INIT;
 }
 
+boost::shared_ptr<UpgradedSessionBase> Session::on_low_level_http2_preface(){
+	PROFILE_ME;
+
+	if(!MainConfig::get<bool>("http2_enabled", false)){
+		return VAL_INIT;
+	}
+	return boost::make_shared<Http2Session>(virtual_shared_from_this<Session>());
+}
+
+long Session::on_encoded_data_avail(StreamBuffer encoded){
+	PROFILE_ME;
+
+	if(t_pipeline_session != this){
+		return LowLevelSession::on_encoded_data_avail(STD_MOVE(encoded));
+	}
+	const AUTO(slot, static_cast<PipelineSlot *>(t_pipeline_slot));
+	const Mutex::UniqueLock lock(m_pipeline_mutex);
+	if(!m_pipeline.empty() && (m_pipeline.front().get() != slot)){
+		// 之前的请求还没有处理完，先把响应保存起来。
+		slot->data.splice(encoded);
+		return true;
+	}
+	return LowLevelSession::on_encoded_data_avail(STD_MOVE(encoded));
+}
+
+long Session::on_encoded_file_avail(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length){
+	PROFILE_ME;
+
+	if(t_pipeline_session == this){
+		const AUTO(slot, static_cast<PipelineSlot *>(t_pipeline_slot));
+		Mutex::UniqueLock lock(m_pipeline_mutex);
+		if(!m_pipeline.empty() && (m_pipeline.front().get() != slot)){
+			lock.unlock();
+			// 之前的请求还没有处理完，只能把文件读入内存排队。
+			return ServerWriter::on_encoded_file_avail(STD_MOVE(file), offset, length);
+		}
+	}
+	return LowLevelSession::on_encoded_file_avail(STD_MOVE(file), offset, length);
+}
+
 void Session::on_sync_expect(RequestHeaders request_headers){
 	PROFILE_ME;
 
@@ -194,6 +658,41 @@ void Session::on_sync_expect(RequestHeaders request_headers){
 	}
 }
 
+bool Session::is_request_streamed(const RequestHeaders &request_headers){
+	PROFILE_ME;
+
+	(void)request_headers;
+
+	return false;
+}
+void Session::on_sync_request_stream_begin(RequestHeaders request_headers){
+	PROFILE_ME;
+
+	(void)request_headers;
+}
+void Session::on_sync_request_stream_chunk(boost::uint64_t entity_offset, StreamBuffer chunk){
+	PROFILE_ME;
+
+	(void)entity_offset;
+	(void)chunk;
+}
+void Session::on_sync_request_stream_end(boost::uint64_t content_length, OptionalMap trailers){
+	PROFILE_ME;
+
+	(void)content_length;
+	(void)trailers;
+
+	// 覆写了 is_request_streamed() 的派生类必须覆写这个函数并发出响应。
+	DEBUG_THROW(Exception, ST_NOT_IMPLEMENTED);
+}
+
+bool Session::is_throttled() const {
+	if(atomic_load(m_stream_pending, ATOMIC_RELAXED) >= m_max_stream_pending){
+		return true;
+	}
+	return LowLevelSession::is_throttled();
+}
+
 boost::uint64_t Session::get_max_request_length() const {
 	return atomic_load(m_max_request_length, ATOMIC_CONSUME);
 }
@@ -201,5 +700,12 @@ void Session::set_max_request_length(boost::uint64_t max_request_length){
 	atomic_store(m_max_request_length, max_request_length, ATOMIC_RELEASE);
 }
 
+bool Session::is_parallel_pipelining_enabled() const {
+	return atomic_load(m_parallel_pipelining_enabled, ATOMIC_CONSUME);
+}
+void Session::set_parallel_pipelining_enabled(bool enabled){
+	atomic_store(m_parallel_pipelining_enabled, enabled, ATOMIC_RELEASE);
+}
+
 }
 }
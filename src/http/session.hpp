@@ -5,23 +5,44 @@
 #define POSEIDON_HTTP_SESSION_HPP_
 
 #include "low_level_session.hpp"
+#include <deque>
+#include <utility>
 
 namespace Poseidon {
 namespace Http {
 
 class Session : public LowLevelSession {
+	friend Http2Session;
+
 private:
 	class SyncJobBase;
 	class ReadHupJob;
 	class ExpectJob;
 	class RequestJob;
 	class ErrorJob;
+	class StreamHeadersJob;
+	class StreamChunkJob;
+	class StreamEndJob;
+	struct PipelineSlot;
 
 private:
 	volatile boost::uint64_t m_max_request_length;
+	volatile bool m_parallel_pipelining_enabled;
 	boost::uint64_t m_size_total;
 	RequestHeaders m_request_headers;
 	StreamBuffer m_entity;
+	bool m_streaming;
+	bool m_stream_pipelined;
+
+	const boost::uint64_t m_max_stream_pending;
+	volatile boost::uint64_t m_stream_pending; // 已经收到但是还没有处理的流式正文的字节数。
+
+	// 以下成员用于并行处理流水线化的请求。
+	mutable Mutex m_pipeline_mutex;
+	std::deque<std::pair<boost::shared_ptr<JobBase>, boost::shared_ptr<PipelineSlot> > > m_held_requests; // 尚未投递的请求任务，并行的带有 slot。
+	std::size_t m_parallel_running;
+	bool m_serial_running;
+	std::deque<boost::shared_ptr<PipelineSlot> > m_pipeline; // 已投递的并行请求，按照请求的顺序排列。
 
 public:
 	explicit Session(Move<UniqueFile> socket);
@@ -38,21 +59,57 @@ protected:
 		return m_entity;
 	}
 
+private:
+	// 以下函数都需要在持有 m_pipeline_mutex 时调用。
+	void unlocked_dispatch_held_requests();
+	void unlocked_flush_pipeline();
+
+	void finish_pipelined_request(const boost::shared_ptr<PipelineSlot> &slot, bool keep_alive);
+
+	bool enqueue_stream_job(const boost::shared_ptr<JobBase> &job);
+	void release_stream_pending(std::size_t size);
+
+protected:
 	// TcpSessionBase
 	void on_read_hup() OVERRIDE;
+	bool can_be_handed_over() const OVERRIDE;
 
 	// LowLevelSession
 	void on_low_level_request_headers(RequestHeaders request_headers, boost::uint64_t content_length) OVERRIDE;
 	void on_low_level_request_entity(boost::uint64_t entity_offset, StreamBuffer entity) OVERRIDE;
 	boost::shared_ptr<UpgradedSessionBase> on_low_level_request_end(boost::uint64_t content_length, OptionalMap headers) OVERRIDE;
+	boost::shared_ptr<UpgradedSessionBase> on_low_level_http2_preface() OVERRIDE;
+
+	// ServerWriter
+	long on_encoded_data_avail(StreamBuffer encoded) OVERRIDE;
+	long on_encoded_file_avail(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length) OVERRIDE;
 
 	// 可覆写。
 	virtual void on_sync_expect(RequestHeaders request_headers);
 	virtual void on_sync_request(RequestHeaders request_headers, StreamBuffer entity) = 0;
 
+	// 流式接收请求正文。在 epoll 线程中调用，返回 true 则这个请求的正文不会保存在内存中，
+	// 而是依次调用 on_sync_request_stream_begin()、每收到一块数据调用一次 on_sync_request_stream_chunk()、最后调用 on_sync_request_stream_end()，
+	// 响应在 on_sync_request_stream_end() 中发出。此时不检查 http_max_request_length，长度限制由派生类自行负责。
+	// 这些函数都在以连接为类别的任务中按顺序调用。尚未处理的数据超过 http_request_stream_max_pending 时暂停读取这个连接。
+	// 如果请求包含 Expect: 100-continue，on_sync_request_stream_begin() 返回之后才发出 100 Continue，因此可以在其中抛出异常拒绝请求。
+	// HTTP/2 的请求不会以流的形式交付。
+	virtual bool is_request_streamed(const RequestHeaders &request_headers);
+	virtual void on_sync_request_stream_begin(RequestHeaders request_headers);
+	virtual void on_sync_request_stream_chunk(boost::uint64_t entity_offset, StreamBuffer chunk);
+	virtual void on_sync_request_stream_end(boost::uint64_t content_length, OptionalMap trailers);
+
 public:
+	bool is_throttled() const OVERRIDE;
+
 	boost::uint64_t get_max_request_length() const;
 	void set_max_request_length(boost::uint64_t max_request_length);
+
+	// 启用之后，同一个连接上流水线化的 GET 和 HEAD 请求作为互相独立的任务并行处理，响应仍然按照请求的顺序发出。
+	// 其他请求仍然串行处理：它们在之前的所有请求处理完之后才开始，之后的请求也要等待它们处理完。
+	// 并行处理的请求的响应必须在 on_sync_request() 返回之前发出。
+	bool is_parallel_pipelining_enabled() const;
+	void set_parallel_pipelining_enabled(bool enabled);
 };
 
 }
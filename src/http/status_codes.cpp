@@ -136,6 +136,27 @@ namespace {
 		{ 505, "HTTP Version Not Supported",
 		       "The server does not support, or refuses to support, the major version of  HTTP that was used in the request message." },
 	};
+
+	// 与 DESC_TABLE 一一对应。
+	struct StatusLineTailTable {
+		std::string tails[sizeof(DESC_TABLE) / sizeof(DESC_TABLE[0])];
+
+		StatusLineTailTable(){
+			for(std::size_t i = 0; i < sizeof(DESC_TABLE) / sizeof(DESC_TABLE[0]); ++i){
+				char temp[16];
+				const unsigned len = (unsigned)std::sprintf(temp, " %u ", DESC_TABLE[i].status_code);
+				tails[i].reserve(len + std::strlen(DESC_TABLE[i].desc_short) + 2);
+				tails[i].append(temp, len);
+				tails[i].append(DESC_TABLE[i].desc_short);
+				tails[i].append("\r\n");
+			}
+		}
+	};
+
+	const StatusLineTailTable &get_status_line_tail_table(){
+		static const StatusLineTailTable s_table;
+		return s_table;
+	}
 }
 
 StatusCodeDesc get_status_code_desc(StatusCode status_code){
@@ -150,6 +171,14 @@ StatusCodeDesc get_status_code_desc(StatusCode status_code){
 	}
 	return ret;
 }
+const std::string &get_status_line_tail(StatusCode status_code){
+	static const std::string s_empty;
+	const AUTO(p, std::lower_bound(BEGIN(DESC_TABLE), END(DESC_TABLE), status_code, DescElementComparator()));
+	if((p == END(DESC_TABLE)) || (p->status_code != status_code)){
+		return s_empty;
+	}
+	return get_status_line_tail_table().tails[p - BEGIN(DESC_TABLE)];
+}
 
 }
 }
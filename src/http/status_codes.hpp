@@ -4,6 +4,8 @@
 #ifndef POSEIDON_HTTP_STATUS_CODES_HPP_
 #define POSEIDON_HTTP_STATUS_CODES_HPP_
 
+#include <string>
+
 namespace Poseidon {
 namespace Http {
 
@@ -64,6 +66,8 @@ struct StatusCodeDesc {
 };
 
 extern StatusCodeDesc get_status_code_desc(StatusCode status_code);
+// 返回预先生成的状态行中 HTTP 版本之后的部分，例如 " 200 OK\r\n"。未知的状态码返回空字符串。
+extern const std::string &get_status_line_tail(StatusCode status_code);
 
 }
 }
@@ -18,6 +18,9 @@ UpgradedSessionBase::~UpgradedSessionBase(){ }
 void UpgradedSessionBase::on_shutdown_timer(boost::uint64_t now){
 	(void)now;
 }
+bool UpgradedSessionBase::is_read_throttled() const {
+	return false;
+}
 
 bool UpgradedSessionBase::has_been_shutdown_read() const NOEXCEPT {
 	const AUTO(parent, get_parent());
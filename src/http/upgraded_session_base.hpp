@@ -35,6 +35,9 @@ protected:
 	void on_receive(StreamBuffer data) OVERRIDE = 0;
 
 	virtual void on_shutdown_timer(boost::uint64_t now);
+	// 在 epoll 线程中由父连接调用，返回 true 则暂停读取父连接。
+	// 派生类解除限制时应当调用 EpollDaemon::mark_socket_readable() 唤醒父连接。
+	virtual bool is_read_throttled() const;
 
 public:
 	bool has_been_shutdown_read() const NOEXCEPT OVERRIDE;
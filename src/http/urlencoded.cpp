@@ -5,6 +5,9 @@
 #include "urlencoded.hpp"
 #include "../profiler.hpp"
 #include "../buffer_streams.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 namespace Poseidon {
 namespace Http {
@@ -38,26 +41,140 @@ namespace {
 		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F',
 	};
 
+	// 每个字节作为十六进制数字的值，不是十六进制数字的为 -1。
+	CONSTEXPR const signed char HEX_VALUE_TABLE[256] = {
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+		-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	};
+
 	char to_hex_digit(int byte, bool upper_case = false){
 		return HEX_TABLE[(byte & 0x0F) + upper_case * sizeof(HEX_TABLE) / 2];
 	}
 	int from_hex_digit(char ch){
-		const AUTO(p, static_cast<const char *>(std::memchr(HEX_TABLE, ch, sizeof(HEX_TABLE))));
-		if(!p){
-			return -1;
+		return HEX_VALUE_TABLE[ch & 0xFF];
+	}
+
+	// 返回从 begin 开始第一个需要编码的字符的位置，没有则返回 end。
+	const char *find_unsafe(const char *begin, const char *end) NOEXCEPT {
+		const char *pos = begin;
+#ifdef __SSE2__
+		// 有符号比较，0x80 以上的字节是负数，不在任何一个范围内。
+		const __m128i digit_lo = _mm_set1_epi8('0' - 1), digit_hi = _mm_set1_epi8('9' + 1);
+		const __m128i upper_lo = _mm_set1_epi8('A' - 1), upper_hi = _mm_set1_epi8('Z' + 1);
+		const __m128i lower_lo = _mm_set1_epi8('a' - 1), lower_hi = _mm_set1_epi8('z' + 1);
+		const __m128i hyphen = _mm_set1_epi8('-'), dot = _mm_set1_epi8('.'), underscore = _mm_set1_epi8('_'), tilde = _mm_set1_epi8('~');
+		while(end - pos >= 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+			__m128i safe = _mm_and_si128(_mm_cmpgt_epi8(v, digit_lo), _mm_cmplt_epi8(v, digit_hi));
+			safe = _mm_or_si128(safe, _mm_and_si128(_mm_cmpgt_epi8(v, upper_lo), _mm_cmplt_epi8(v, upper_hi)));
+			safe = _mm_or_si128(safe, _mm_and_si128(_mm_cmpgt_epi8(v, lower_lo), _mm_cmplt_epi8(v, lower_hi)));
+			safe = _mm_or_si128(safe, _mm_or_si128(_mm_cmpeq_epi8(v, hyphen), _mm_cmpeq_epi8(v, dot)));
+			safe = _mm_or_si128(safe, _mm_or_si128(_mm_cmpeq_epi8(v, underscore), _mm_cmpeq_epi8(v, tilde)));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(safe)) ^ 0xFFFFu;
+			if(mask != 0){
+				return pos + __builtin_ctz(mask);
+			}
+			pos += 16;
+		}
+#endif
+		while((pos != end) && !is_char_unsafe(*pos)){
+			++pos;
+		}
+		return pos;
+	}
+	// 返回从 begin 开始第一个 %、+ 或者终止字符的位置，没有则返回 end。
+	const char *find_special(const char *begin, const char *end, bool stops_at_equal, bool stops_at_ampersand) NOEXCEPT {
+		const char *pos = begin;
+#ifdef __SSE2__
+		const __m128i percent = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+		// 不需要停下的终止字符用 % 代替，不影响结果。
+		const __m128i equal = _mm_set1_epi8(stops_at_equal ? '=' : '%'), ampersand = _mm_set1_epi8(stops_at_ampersand ? '&' : '%');
+		while(end - pos >= 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+			const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, plus)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, equal), _mm_cmpeq_epi8(v, ampersand)));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special));
+			if(mask != 0){
+				return pos + __builtin_ctz(mask);
+			}
+			pos += 16;
+		}
+#endif
+		while(pos != end){
+			const char ch = *pos;
+			if((ch == '%') || (ch == '+') || (stops_at_equal && (ch == '=')) || (stops_at_ampersand && (ch == '&'))){
+				break;
+			}
+			++pos;
 		}
-		return (p - HEX_TABLE) & 0x0F;
+		return pos;
 	}
 
-	void url_encode_step(std::ostream &os, const std::string &str){
-		for(AUTO(it, str.begin()); it != str.end(); ++it){
-			const char ch = *it;
+	void url_encode_step(std::string &out, const char *data, std::size_t size){
+		const char *const end = data + size;
+		const char *pos = data;
+		out.reserve(out.size() + size);
+		for(;;){
+			const char *const run_end = find_unsafe(pos, end);
+			out.append(pos, run_end);
+			if(run_end == end){
+				break;
+			}
+			const char ch = *run_end;
 			if(ch == ' '){
-				os <<'+';
-			} else if(is_char_unsafe(ch)){
-				os <<'%' <<to_hex_digit(ch >> 4) <<to_hex_digit(ch);
+				out += '+';
 			} else {
-				os <<ch;
+				const char temp[3] = { '%', to_hex_digit(ch >> 4), to_hex_digit(ch) };
+				out.append(temp, 3);
+			}
+			pos = run_end + 1;
+		}
+	}
+	void url_encode_step(std::ostream &os, const std::string &str){
+		std::string out;
+		url_encode_step(out, str.data(), str.size());
+		os.write(out.data(), static_cast<std::streamsize>(out.size()));
+	}
+	// 解码 [pos, end) 直到终止字符，pos 指向终止字符之后。返回终止字符，到达末尾时返回 0，格式错误时返回 -1。
+	int url_decode_step(std::string &str, const char *&pos, const char *end, bool stops_at_equal, bool stops_at_ampersand){
+		for(;;){
+			const char *const run_end = find_special(pos, end, stops_at_equal, stops_at_ampersand);
+			str.append(pos, run_end);
+			pos = run_end;
+			if(pos == end){
+				return 0;
+			}
+			const char ch = *pos;
+			++pos;
+			if(ch == '+'){
+				str += ' ';
+			} else if(ch == '%'){
+				if(end - pos < 2){
+					return -1;
+				}
+				const int high = from_hex_digit(pos[0]);
+				const int low = from_hex_digit(pos[1]);
+				if((high < 0) || (low < 0)){
+					return -1;
+				}
+				str += static_cast<char>((high << 4) | low);
+				pos += 2;
+			} else {
+				return ch;
 			}
 		}
 	}
@@ -131,23 +248,25 @@ void url_decode(std::istream &is, std::string &str){
 	url_decode_step(is, str, "");
 }
 
-void url_encode_params(std::ostream &os, const OptionalMap &params){
+void url_encode(std::string &out, const char *data, std::size_t size){
 	PROFILE_ME;
 
-	AUTO(it, params.begin());
-	if(it != params.end()){
-		os <<it->first;
-		os <<'=';
-		url_encode_step(os, it->second);
+	url_encode_step(out, data, size);
+}
+bool url_decode(std::string &str, const char *data, std::size_t size){
+	PROFILE_ME;
 
-		while(++it != params.end()){
-			os <<'&';
+	str.clear();
+	const char *pos = data;
+	return url_decode_step(str, pos, data + size, false, false) == 0;
+}
 
-			os <<it->first;
-			os <<'=';
-			url_encode_step(os, it->second);
-		}
-	}
+void url_encode_params(std::ostream &os, const OptionalMap &params){
+	PROFILE_ME;
+
+	std::string out;
+	url_encode_params(out, params);
+	os.write(out.data(), static_cast<std::streamsize>(out.size()));
 }
 void url_decode_params(std::istream &is, OptionalMap &params){
 	PROFILE_ME;
@@ -172,5 +291,51 @@ void url_decode_params(std::istream &is, OptionalMap &params){
 	}
 }
 
+void url_encode_params(std::string &out, const OptionalMap &params){
+	PROFILE_ME;
+
+	AUTO(it, params.begin());
+	if(it != params.end()){
+		out += it->first.get();
+		out += '=';
+		url_encode_step(out, it->second.data(), it->second.size());
+
+		while(++it != params.end()){
+			out += '&';
+
+			out += it->first.get();
+			out += '=';
+			url_encode_step(out, it->second.data(), it->second.size());
+		}
+	}
+}
+bool url_decode_params(OptionalMap &params, const char *data, std::size_t size){
+	PROFILE_ME;
+
+	params.clear();
+	const char *pos = data;
+	const char *const end = data + size;
+	std::string key, val;
+	for(;;){
+		key.clear();
+		val.clear();
+		int term = url_decode_step(key, pos, end, true, true);
+		if(term < 0){
+			return false;
+		}
+		if(term == '='){
+			term = url_decode_step(val, pos, end, false, true);
+			if(term < 0){
+				return false;
+			}
+		}
+		params.append(SharedNts(key), STD_MOVE(val));
+		if(term == 0){
+			break;
+		}
+	}
+	return true;
+}
+
 }
 }
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <iosfwd>
+#include <cstddef>
 #include "../optional_map.hpp"
 
 namespace Poseidon {
@@ -17,6 +18,14 @@ extern void url_decode(std::istream &is, std::string &str);
 extern void url_encode_params(std::ostream &os, const OptionalMap &params);
 extern void url_decode_params(std::istream &is, OptionalMap &params);
 
+// 以下版本直接读写内存，不经过 iostream。编码的结果追加到 out 的末尾。
+// 解码时遇到不完整或者不合法的 % 转义返回 false，此时 params 中保留之前已经解码的参数。
+extern void url_encode(std::string &out, const char *data, std::size_t size);
+extern bool url_decode(std::string &str, const char *data, std::size_t size);
+
+extern void url_encode_params(std::string &out, const OptionalMap &params);
+extern bool url_decode_params(OptionalMap &params, const char *data, std::size_t size);
+
 }
 }
 
@@ -0,0 +1,78 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "huge_pages.hpp"
+#include "checked_arithmetic.hpp"
+#include "log.hpp"
+#include <sys/mman.h>
+
+namespace Poseidon {
+
+void *map_huge_page_region(std::size_t &size, HugePageBacking &backing) NOEXCEPT {
+	size = saturated_add(size, HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	if(size == 0){
+		backing = HPB_NORMAL;
+		return NULLPTR;
+	}
+	void *base;
+#ifdef MAP_HUGETLB
+	base = ::mmap(NULLPTR, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(base != MAP_FAILED){
+		backing = HPB_RESERVED;
+		return base;
+	}
+	const int hugetlb_err_code = errno;
+	LOG_POSEIDON_DEBUG("MAP_HUGETLB is not available: size = ", size, ", err_code = ", hugetlb_err_code);
+#endif
+	// 多映射一个大页，再把首尾不对齐的部分还给内核。
+	const AUTO(map_size, saturated_add(size, HUGE_PAGE_SIZE));
+	base = ::mmap(NULLPTR, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to map memory region: size = ", size, ", err_code = ", err_code);
+		backing = HPB_NORMAL;
+		return NULLPTR;
+	}
+	const AUTO(head, static_cast<char *>(base));
+	const AUTO(aligned, reinterpret_cast<char *>((reinterpret_cast<std::size_t>(head) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE));
+	if(aligned != head){
+		::munmap(head, static_cast<std::size_t>(aligned - head));
+	}
+	const AUTO(tail, aligned + size);
+	if(tail != head + map_size){
+		::munmap(tail, static_cast<std::size_t>(head + map_size - tail));
+	}
+#ifdef MADV_HUGEPAGE
+	if(::madvise(aligned, size, MADV_HUGEPAGE) == 0){
+		backing = HPB_TRANSPARENT;
+		return aligned;
+	}
+	const int thp_err_code = errno;
+	LOG_POSEIDON_DEBUG("MADV_HUGEPAGE is not available: size = ", size, ", err_code = ", thp_err_code);
+#endif
+	backing = HPB_NORMAL;
+	return aligned;
+}
+void unmap_huge_page_region(void *base, std::size_t size) NOEXCEPT {
+	if(!base){
+		return;
+	}
+	if(::munmap(base, size) != 0){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to unmap memory region: size = ", size, ", err_code = ", err_code);
+	}
+}
+
+const char *get_huge_page_backing_name(HugePageBacking backing) NOEXCEPT {
+	switch(backing){
+	case HPB_RESERVED:
+		return "reserved";
+	case HPB_TRANSPARENT:
+		return "transparent";
+	default:
+		return "normal";
+	}
+}
+
+}
@@ -0,0 +1,29 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_HUGE_PAGES_HPP_
+#define POSEIDON_HUGE_PAGES_HPP_
+
+#include "cxx_ver.hpp"
+#include <cstddef>
+
+namespace Poseidon {
+
+enum HugePageBacking {
+	HPB_NORMAL       = 0, // 普通页，两种大页都不可用。
+	HPB_TRANSPARENT  = 1, // 透明大页（MADV_HUGEPAGE），由内核在缺页时尽量使用大页。
+	HPB_RESERVED     = 2, // 预留的大页（MAP_HUGETLB），需要事先配置 vm.nr_hugepages。
+};
+
+CONSTEXPR const std::size_t HUGE_PAGE_SIZE = 0x200000;
+
+// 分配一块按 HUGE_PAGE_SIZE 对齐的可读写匿名内存，size 向上取整到 HUGE_PAGE_SIZE 的整数倍。
+// 依次尝试预留的大页、透明大页和普通页，backing 返回实际使用的方式。普通页也分配失败时返回空指针。
+extern void *map_huge_page_region(std::size_t &size, HugePageBacking &backing) NOEXCEPT;
+extern void unmap_huge_page_region(void *base, std::size_t size) NOEXCEPT;
+
+extern const char *get_huge_page_backing_name(HugePageBacking backing) NOEXCEPT;
+
+}
+
+#endif
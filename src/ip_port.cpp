@@ -7,6 +7,8 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include "sock_addr.hpp"
 #include "endian.hpp"
 #include "system_exception.hpp"
@@ -21,6 +23,9 @@ namespace {
 	inline ::sockaddr_in6 &as_sin6(const void *data) NOEXCEPT {
 		return *static_cast< ::sockaddr_in6 *>(const_cast<void *>(data));
 	}
+	inline ::sockaddr_un &as_sun(const void *data) NOEXCEPT {
+		return *static_cast< ::sockaddr_un *>(const_cast<void *>(data));
+	}
 }
 
 IpPort::IpPort(){
@@ -47,6 +52,24 @@ IpPort::IpPort(const SockAddr &sock_addr){
 		BOOST_STATIC_ASSERT(sizeof(m_ip) >= INET6_ADDRSTRLEN);
 		DEBUG_THROW_UNLESS(::inet_ntop(AF_INET6, &(sin6.sin6_addr), m_ip, sizeof(m_ip)), SystemException);
 		m_port = load_be(sin6.sin6_port);
+	} else if(family == AF_UNIX){
+		// 用路径代替 IP 地址，端口号为零。抽象命名空间的名字写成以 '@' 开头，未绑定的一端写成 <unnamed>。
+		::sockaddr_un &sun = as_sun(sock_addr.data());
+		const std::size_t offset = offsetof(::sockaddr_un, sun_path);
+		BOOST_STATIC_ASSERT(sizeof(m_ip) > sizeof(sun.sun_path));
+		const std::size_t len = (sock_addr.size() > offset) ? std::min(sock_addr.size() - offset, sizeof(sun.sun_path)) : 0;
+		if(len == 0){
+			std::strcpy(m_ip, "<unnamed>");
+		} else if(sun.sun_path[0] == 0){
+			m_ip[0] = '@';
+			std::memcpy(m_ip + 1, sun.sun_path + 1, len - 1);
+			m_ip[len] = 0;
+		} else {
+			const std::size_t path_len = ::strnlen(sun.sun_path, len);
+			std::memcpy(m_ip, sun.sun_path, path_len);
+			m_ip[path_len] = 0;
+		}
+		m_port = 0;
 	} else {
 		LOG_POSEIDON_ERROR("Unknown IP protocol: family = ", family);
 		DEBUG_THROW(Exception, sslit("Unknown IP protocol"));
@@ -83,6 +106,11 @@ bool operator<(const IpPort &lhs, const IpPort &rhs) NOEXCEPT {
 }
 
 std::ostream &operator<<(std::ostream &os, const IpPort &rhs){
+	const char ch = rhs.ip()[0];
+	if((ch == '/') || (ch == '@')){
+		// Unix 域套接字没有端口号。
+		return os <<rhs.ip();
+	}
 	return os <<rhs.ip() <<':' <<rhs.port();
 }
 
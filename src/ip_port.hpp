@@ -19,6 +19,7 @@ private:
 public:
 	IpPort();
 	IpPort(const char *ip_str, boost::uint16_t port_num);
+	// 对于 Unix 域套接字，ip() 返回路径，port() 返回零。
 	IpPort(const SockAddr &sock_addr);
 	IpPort(const IpPort &ip_port) NOEXCEPT;
 	IpPort &operator=(const IpPort &ip_port) NOEXCEPT;
@@ -9,8 +9,11 @@ namespace Poseidon {
 
 JobBase::~JobBase(){ }
 
-void enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn){
-	JobDispatcher::enqueue(STD_MOVE(job), STD_MOVE(withdrawn));
+bool enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn){
+	return JobDispatcher::enqueue(STD_MOVE(job), STD_MOVE(withdrawn));
+}
+std::size_t enqueue_batch(boost::container::vector<boost::shared_ptr<JobBase> > &jobs, const boost::shared_ptr<const bool> &withdrawn){
+	return JobDispatcher::enqueue_batch(jobs, withdrawn);
 }
 
 }
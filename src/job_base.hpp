@@ -7,12 +7,23 @@
 #include "cxx_util.hpp"
 #include <boost/weak_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 
 class Promise;
 
 class JobBase : NONCOPYABLE {
+public:
+	// 数值越小优先级越高。调度器总是先执行高优先级的任务，但是等待太久的低优先级任务会被提前执行。
+	// 优先级只影响不同类别的任务之间的顺序，同一类别的任务始终按投递顺序执行。
+	enum Priority {
+		PRIORITY_REALTIME    = 0,
+		PRIORITY_NORMAL      = 1,
+		PRIORITY_BACKGROUND  = 2,
+	};
+
 public:
 	virtual ~JobBase();
 
@@ -20,10 +31,38 @@ public:
 	// 如果一个任务被推迟执行且 Category 非空，
 	// 则所有具有相同 Category 的后续任务都会被推迟，以维持其相对顺序。
 	virtual boost::weak_ptr<const void> get_category() const = 0;
+	// 返回 false 表示这个任务从不让出，可以直接在调度线程的栈上执行，不需要分配 fiber 的栈。
+	// 这种任务中调用 yield() 等待尚未满足的 Promise 会抛出异常。
+	virtual bool is_yieldable() const {
+		return true;
+	}
+	// 在投递时调用一次。
+	virtual Priority get_priority() const {
+		return PRIORITY_NORMAL;
+	}
+	// 单调时钟的毫秒数，在投递时调用一次。超过这个时间仍未开始执行的任务将被丢弃。返回 0 表示没有期限。
+	virtual boost::uint64_t get_deadline() const {
+		return 0;
+	}
+	// 在投递时调用一次。返回 true 表示队列已满时这个任务可以被丢弃。
+	virtual bool is_insignificant() const {
+		return false;
+	}
+	// 在投递时调用一次。返回 true 表示这个任务是会话收到的请求或消息，队列已满且溢出策略为 reject 时被拒绝，投递者须处理 enqueue() 返回 false 的情况。
+	// 其他任务（框架内部的任务，以及已经接受的请求的后续任务）即使超过上限也总是入队。
+	virtual bool is_rejectable() const {
+		return false;
+	}
+	// 在投递时调用一次。启用类别亲和时，同一个类别的任务固定由一个任务线程执行。
+	// 返回 Category 所在套接字的 epoll 线程序号，这样同一个 epoll 线程上的会话的任务集中在同一组任务线程中；返回 -1 表示只根据 Category 选择线程。
+	virtual std::size_t get_thread_hint() const {
+		return (std::size_t)-1;
+	}
 	virtual void perform() = 0;
 };
 
-extern void enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn = boost::shared_ptr<const bool>());
+extern bool enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn = boost::shared_ptr<const bool>());
+extern std::size_t enqueue_batch(boost::container::vector<boost::shared_ptr<JobBase> > &jobs, const boost::shared_ptr<const bool> &withdrawn = boost::shared_ptr<const bool>());
 
 }
 
@@ -0,0 +1,188 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "journal.hpp"
+#include "crc32.hpp"
+#include "endian.hpp"
+#include "exception.hpp"
+#include "system_exception.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Poseidon {
+
+namespace {
+	// 文件头独占第一页，记录从 HEADER_SIZE 开始，每条记录按 8 字节对齐。
+	CONSTEXPR const std::size_t HEADER_SIZE = 4096;
+	CONSTEXPR const std::size_t INITIAL_SIZE = 65536;
+	CONSTEXPR const boost::uint64_t MAGIC = 0x314C4E524A534F50; // "POSJRNL1"
+
+	struct Header {
+		boost::uint64_t magic;
+		boost::uint64_t head;
+		boost::uint64_t tail;
+		boost::uint64_t count;
+	};
+	struct RecordHeader {
+		boost::uint32_t size;
+		boost::uint32_t crc;
+	};
+
+	boost::uint64_t round_up_record(boost::uint64_t size){
+		return (sizeof(RecordHeader) + size + 7) & static_cast<boost::uint64_t>(-8);
+	}
+}
+
+Journal::Journal(std::string path, boost::uint64_t max_bytes)
+	: m_path(STD_MOVE(path)), m_max_bytes(std::max<boost::uint64_t>(max_bytes, INITIAL_SIZE))
+	, m_base(NULLPTR), m_mapped(0)
+{
+	if(!m_file.reset(::open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644))){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to open journal: path = ", m_path, ", err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	struct ::stat stat_buf;
+	DEBUG_THROW_UNLESS(::fstat(m_file.get(), &stat_buf) == 0, SystemException);
+	const AUTO(file_size, static_cast<boost::uint64_t>(stat_buf.st_size));
+	if(file_size < HEADER_SIZE){
+		remap(INITIAL_SIZE);
+		clear();
+		return;
+	}
+	DEBUG_THROW_UNLESS(file_size <= static_cast<std::size_t>(-1), Exception, sslit("Journal is too large to map"));
+	remap(static_cast<std::size_t>(file_size));
+
+	const AUTO(header, static_cast<const Header *>(m_base));
+	const AUTO(head, load_le(header->head));
+	const AUTO(tail, load_le(header->tail));
+	if((load_le(header->magic) != MAGIC) || (head < HEADER_SIZE) || (head > tail) || (tail > m_mapped)){
+		LOG_POSEIDON_ERROR("Journal header is corrupted: path = ", m_path);
+		DEBUG_THROW(Exception, sslit("Journal header is corrupted"));
+	}
+	LOG_POSEIDON_DEBUG("Opened journal: path = ", m_path, ", records = ", load_le(header->count), ", bytes = ", tail - head);
+}
+Journal::~Journal(){
+	if(m_base){
+		::munmap(m_base, m_mapped);
+	}
+}
+
+void Journal::remap(std::size_t size){
+	PROFILE_ME;
+
+	if(::ftruncate(m_file.get(), static_cast< ::off_t>(size)) != 0){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to resize journal: path = ", m_path, ", size = ", size, ", err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	void *base;
+	if(m_base){
+		base = ::mremap(m_base, m_mapped, size, MREMAP_MAYMOVE);
+	} else {
+		base = ::mmap(NULLPTR, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file.get(), 0);
+	}
+	if(base == MAP_FAILED){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to map journal: path = ", m_path, ", size = ", size, ", err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	m_base = base;
+	m_mapped = size;
+}
+
+bool Journal::empty() const {
+	const AUTO(header, static_cast<const Header *>(m_base));
+	return load_le(header->count) == 0;
+}
+std::size_t Journal::size() const {
+	const AUTO(header, static_cast<const Header *>(m_base));
+	return static_cast<std::size_t>(load_le(header->count));
+}
+boost::uint64_t Journal::get_bytes() const {
+	const AUTO(header, static_cast<const Header *>(m_base));
+	return load_le(header->tail) - load_le(header->head);
+}
+
+bool Journal::append(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	if(size > UINT32_MAX){
+		return false;
+	}
+	AUTO(header, static_cast<Header *>(m_base));
+	const AUTO(tail, load_le(header->tail));
+	const AUTO(new_tail, tail + round_up_record(size));
+	if(new_tail > m_mapped){
+		if(new_tail > m_max_bytes){
+			return false;
+		}
+		std::size_t new_size = m_mapped;
+		while(new_size < new_tail){
+			new_size *= 2;
+		}
+		remap(static_cast<std::size_t>(std::min<boost::uint64_t>(new_size, m_max_bytes)));
+		header = static_cast<Header *>(m_base);
+	}
+	// 先写入记录，再更新文件头，这样崩溃时最多丢失最后一条记录。
+	const AUTO(record, reinterpret_cast<RecordHeader *>(static_cast<char *>(m_base) + tail));
+	store_le(record->size, static_cast<boost::uint32_t>(size));
+	store_le(record->crc, crc32_hash(data, size));
+	std::memcpy(record + 1, data, size);
+	store_le(header->tail, new_tail);
+	store_le(header->count, load_le(header->count) + 1);
+	return true;
+}
+bool Journal::front(std::string &data) const {
+	PROFILE_ME;
+
+	const AUTO(header, static_cast<const Header *>(m_base));
+	if(load_le(header->count) == 0){
+		return false;
+	}
+	const AUTO(head, load_le(header->head));
+	const AUTO(tail, load_le(header->tail));
+	DEBUG_THROW_UNLESS(head + sizeof(RecordHeader) <= tail, Exception, sslit("Journal record is truncated"));
+	const AUTO(record, reinterpret_cast<const RecordHeader *>(static_cast<const char *>(m_base) + head));
+	const AUTO(size, load_le(record->size));
+	DEBUG_THROW_UNLESS(head + round_up_record(size) <= tail, Exception, sslit("Journal record is truncated"));
+	DEBUG_THROW_UNLESS(crc32_hash(record + 1, size) == load_le(record->crc), Exception, sslit("Journal record checksum mismatch"));
+	data.assign(reinterpret_cast<const char *>(record + 1), size);
+	return true;
+}
+void Journal::pop(){
+	PROFILE_ME;
+
+	AUTO(header, static_cast<Header *>(m_base));
+	const AUTO(count, load_le(header->count));
+	DEBUG_THROW_ASSERT(count != 0);
+	if(count == 1){
+		clear();
+		return;
+	}
+	const AUTO(head, load_le(header->head));
+	const AUTO(record, reinterpret_cast<const RecordHeader *>(static_cast<const char *>(m_base) + head));
+	store_le(header->head, head + round_up_record(load_le(record->size)));
+	store_le(header->count, count - 1);
+}
+void Journal::clear(){
+	PROFILE_ME;
+
+	// 日志清空之后释放增长出来的空间。
+	if(m_mapped > INITIAL_SIZE){
+		remap(INITIAL_SIZE);
+	}
+	const AUTO(header, static_cast<Header *>(m_base));
+	store_le(header->magic, MAGIC);
+	store_le(header->head, HEADER_SIZE);
+	store_le(header->tail, HEADER_SIZE);
+	store_le(header->count, 0);
+}
+
+}
@@ -0,0 +1,58 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_JOURNAL_HPP_
+#define POSEIDON_JOURNAL_HPP_
+
+#include "cxx_util.hpp"
+#include "raii.hpp"
+#include <string>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+// 映射到内存中的只追加日志。每条记录是一段不透明的字节，按照写入的顺序读出。
+// 文件的第一页保存读写位置，进程退出或者崩溃之后可以继续读取尚未消费的记录。
+// 这个类不是线程安全的。
+class Journal : NONCOPYABLE {
+private:
+	const std::string m_path;
+	const boost::uint64_t m_max_bytes;
+
+	UniqueFile m_file;
+	void *m_base;
+	std::size_t m_mapped;
+
+public:
+	// 文件不存在时创建之。文件大小不会超过 max_bytes，但是至少能容纳一条记录。
+	Journal(std::string path, boost::uint64_t max_bytes);
+	~Journal();
+
+private:
+	void remap(std::size_t size);
+
+public:
+	const std::string &get_path() const {
+		return m_path;
+	}
+
+	bool empty() const;
+	std::size_t size() const;
+	// 尚未消费的记录占用的字节数，包括记录的头部。
+	boost::uint64_t get_bytes() const;
+
+	// 文件无法继续增长时返回 false。
+	bool append(const void *data, std::size_t size);
+	bool append(const std::string &data){
+		return append(data.data(), data.size());
+	}
+	// 读取第一条记录。没有记录时返回 false。校验失败时抛出异常。
+	bool front(std::string &data) const;
+	void pop();
+	void clear();
+};
+
+}
+
+#endif
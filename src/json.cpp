@@ -3,6 +3,8 @@
 
 #include "precompiled.hpp"
 #include "json.hpp"
+#include "json_parser.hpp"
+#include "stream_buffer.hpp"
 #include "log.hpp"
 #include "profiler.hpp"
 #include "buffer_streams.hpp"
@@ -192,7 +194,7 @@ namespace {
 				is.setstate(std::ios::failbit);
 				return ret;
 			}
-			ret.set(SharedNts(name), accept_element(is));
+			ret.set(SharedNts::intern_existing(name.data(), name.size()), accept_element(is));
 		}
 		return ret;
 	}
@@ -310,6 +312,112 @@ namespace {
 		}
 		return ret;
 	}
+
+	// 在原处构造，容器的元素在插入之后不会移动。
+	class ElementBuilder : public JsonSaxHandler {
+	private:
+		JsonElement m_root;
+		boost::container::vector<JsonElement *> m_open;
+		SharedNts m_key;
+
+	public:
+		ElementBuilder()
+			: m_root(), m_open(), m_key()
+		{ }
+
+	private:
+		JsonElement &new_element(){
+			if(m_open.empty()){
+				return m_root;
+			}
+			const AUTO(parent, m_open.back());
+			if(parent->get_type() == JsonElement::T_OBJECT){
+				return parent->get<JsonObject>().set(STD_MOVE(m_key), JsonElement())->second;
+			}
+			return parent->get<JsonArray>().push_back(JsonElement());
+		}
+
+	public:
+		bool on_null() OVERRIDE {
+			new_element();
+			return true;
+		}
+		bool on_boolean(bool val) OVERRIDE {
+			new_element().set(val);
+			return true;
+		}
+		bool on_number(double val) OVERRIDE {
+			new_element().set(val);
+			return true;
+		}
+		bool on_string(const char *str, std::size_t len) OVERRIDE {
+			new_element().set(std::string(str, len));
+			return true;
+		}
+		bool on_object_begin() OVERRIDE {
+			AUTO_REF(elem, new_element());
+			elem.set(JsonObject());
+			m_open.push_back(&elem);
+			return true;
+		}
+		bool on_object_key(const char *str, std::size_t len) OVERRIDE {
+			m_key = SharedNts::intern_existing(str, len);
+			return true;
+		}
+		bool on_object_end(std::size_t /*count*/) OVERRIDE {
+			m_open.pop_back();
+			return true;
+		}
+		bool on_array_begin() OVERRIDE {
+			AUTO_REF(elem, new_element());
+			elem.set(JsonArray());
+			m_open.push_back(&elem);
+			return true;
+		}
+		bool on_array_end(std::size_t /*count*/) OVERRIDE {
+			m_open.pop_back();
+			return true;
+		}
+
+		JsonElement &get_root(){
+			return m_root;
+		}
+	};
+
+	bool parse_element(JsonElement &elem, const void *data, std::size_t size){
+		JsonParser parser;
+		ElementBuilder builder;
+		if(!parser.parse(builder, data, size)){
+			LOG_POSEIDON_WARNING("JSON parser error: ", parser.get_error(), " (offset ", parser.get_error_offset(), ")");
+			return false;
+		}
+		elem.swap(builder.get_root());
+		return true;
+	}
+	template<typename ValueT>
+	bool parse_container(ValueT &val, JsonElement::Type type, const void *data, std::size_t size){
+		JsonElement elem;
+		if(!parse_element(elem, data, size)){
+			return false;
+		}
+		if(elem.get_type() != type){
+			LOG_POSEIDON_WARNING("JSON ", JsonElement::get_type_string(type), " expected, got ", JsonElement::get_type_string(elem.get_type()));
+			return false;
+		}
+		val.swap(elem.get<ValueT>());
+		return true;
+	}
+	// 数据不连续时先复制一份。
+	template<typename ValueT>
+	bool parse_buffer(ValueT &val, const StreamBuffer &buffer){
+		const std::size_t size = buffer.size();
+		const void *const data = buffer.peek_contiguous(size);
+		if(data){
+			return val.parse(data, size);
+		}
+		const AUTO(str, buffer.dump_string());
+		return val.parse(str.data(), str.size());
+	}
 }
 
 const JsonElement &null_json_element() NOEXCEPT {
@@ -362,6 +470,14 @@ void JsonObject::parse(std::istream &is){
 		obj.swap(*this);
 	}
 }
+bool JsonObject::parse(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	return parse_container(*this, JsonElement::T_OBJECT, data, size);
+}
+bool JsonObject::parse(const StreamBuffer &buffer){
+	return parse_buffer(*this, buffer);
+}
 
 JsonArray::JsonArray(std::istream &is)
 	: m_elements()
@@ -401,6 +517,14 @@ void JsonArray::parse(std::istream &is){
 		arr.swap(*this);
 	}
 }
+bool JsonArray::parse(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	return parse_container(*this, JsonElement::T_ARRAY, data, size);
+}
+bool JsonArray::parse(const StreamBuffer &buffer){
+	return parse_buffer(*this, buffer);
+}
 
 const char *JsonElement::get_type_string(JsonElement::Type type){
 	switch(type){
@@ -499,5 +623,13 @@ void JsonElement::parse(std::istream &is){
 		elem.swap(*this);
 	}
 }
+bool JsonElement::parse(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	return parse_element(*this, data, size);
+}
+bool JsonElement::parse(const StreamBuffer &buffer){
+	return parse_buffer(*this, buffer);
+}
 
 }
@@ -26,6 +26,7 @@ typedef struct JsonNull_ *JsonNull;
 #endif
 
 class JsonElement;
+class StreamBuffer;
 
 extern const JsonElement &null_json_element() NOEXCEPT;
 
@@ -109,6 +110,9 @@ public:
 	std::string dump() const;
 	void dump(std::ostream &os) const;
 	void parse(std::istream &is);
+	// 使用 JsonParser 直接解析连续内存中的数据，之后只允许有空白。失败时返回 false 并且不修改 *this。
+	bool parse(const void *data, std::size_t size);
+	bool parse(const StreamBuffer &buffer);
 };
 
 inline void swap(JsonObject &lhs, JsonObject &rhs) NOEXCEPT {
@@ -196,6 +200,8 @@ public:
 	std::string dump() const;
 	void dump(std::ostream &os) const;
 	void parse(std::istream &is);
+	bool parse(const void *data, std::size_t size);
+	bool parse(const StreamBuffer &buffer);
 };
 
 inline void swap(JsonArray &lhs, JsonArray &rhs) NOEXCEPT {
@@ -278,6 +284,8 @@ public:
 	std::string dump() const;
 	void dump(std::ostream &os) const;
 	void parse(std::istream &is);
+	bool parse(const void *data, std::size_t size);
+	bool parse(const StreamBuffer &buffer);
 };
 
 inline void swap(JsonElement &lhs, JsonElement &rhs) NOEXCEPT {
@@ -541,7 +549,7 @@ inline void JsonArray::pop_front(){
 }
 inline JsonElement &JsonArray::push_back(JsonElement val){
 	m_elements.push_back(STD_MOVE(val));
-	return m_elements.front();
+	return m_elements.back();
 }
 inline void JsonArray::pop_back(){
 	m_elements.pop_back();
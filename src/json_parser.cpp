@@ -0,0 +1,724 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "json_parser.hpp"
+#include "stream_buffer.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace Poseidon {
+
+namespace {
+	inline bool is_space(char ch){
+		return (ch == ' ') || (ch == '\t') || (ch == '\n') || (ch == '\r');
+	}
+	inline bool is_digit(char ch){
+		return static_cast<unsigned char>(ch - '0') < 10;
+	}
+
+	// 紧凑的 JSON 中值之间通常没有空白，因此先检查一个字符。缩进很长时每次检查 16 个字符。
+	const char *skip_spaces(const char *pos, const char *end){
+		if((pos == end) || !is_space(*pos)){
+			return pos;
+		}
+		++pos;
+#ifdef __SSE2__
+		const __m128i space = _mm_set1_epi8(' ');
+		const __m128i tab = _mm_set1_epi8('\t');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		while(end - pos >= 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+			const __m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+			const unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(s)) & 0xFFFFu;
+			if(mask != 0){
+				return pos + __builtin_ctz(mask);
+			}
+			pos += 16;
+		}
+#endif
+		while((pos != end) && is_space(*pos)){
+			++pos;
+		}
+		return pos;
+	}
+
+	// 返回第一个引号或者反斜杠的位置，没有找到则返回 end。
+	const char *find_quote_or_backslash(const char *pos, const char *end){
+#ifdef __SSE2__
+		const __m128i quote = _mm_set1_epi8('\"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		while(end - pos >= 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash))));
+			if(mask != 0){
+				return pos + __builtin_ctz(mask);
+			}
+			pos += 16;
+		}
+#endif
+		while((pos != end) && (*pos != '\"') && (*pos != '\\')){
+			++pos;
+		}
+		return pos;
+	}
+
+	// 失败返回 -1。
+	long decode_hex4(const char *str){
+		long ret = 0;
+		for(unsigned i = 0; i < 4; ++i){
+			const unsigned ch = static_cast<unsigned char>(str[i]);
+			unsigned digit;
+			if(('0' <= ch) && (ch <= '9')){
+				digit = ch - '0';
+			} else if(('A' <= ch) && (ch <= 'F')){
+				digit = ch - 'A' + 0x0A;
+			} else if(('a' <= ch) && (ch <= 'f')){
+				digit = ch - 'a' + 0x0A;
+			} else {
+				return -1;
+			}
+			ret = (ret << 4) | static_cast<long>(digit);
+		}
+		return ret;
+	}
+	void append_utf8(std::string &str, unsigned long code_point){
+		if(code_point < 0x80){
+			str += static_cast<char>(code_point);
+		} else if(code_point < 0x800){
+			str += static_cast<char>((code_point >> 6) | 0xC0);
+			str += static_cast<char>((code_point & 0x3F) | 0x80);
+		} else if(code_point < 0x10000){
+			str += static_cast<char>((code_point >> 12) | 0xE0);
+			str += static_cast<char>(((code_point >> 6) & 0x3F) | 0x80);
+			str += static_cast<char>((code_point & 0x3F) | 0x80);
+		} else {
+			str += static_cast<char>((code_point >> 18) | 0xF0);
+			str += static_cast<char>(((code_point >> 12) & 0x3F) | 0x80);
+			str += static_cast<char>(((code_point >> 6) & 0x3F) | 0x80);
+			str += static_cast<char>((code_point & 0x3F) | 0x80);
+		}
+	}
+
+	// 尾数不超过 2^53 并且这些 10 的幂都可以精确表示时，一次乘法或者除法的结果就是正确舍入的。
+	const double EXACT_POWERS_OF_TEN[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+}
+
+JsonSaxHandler::~JsonSaxHandler(){ }
+
+JsonParser::JsonParser(std::size_t max_depth)
+	: m_max_depth(max_depth)
+	, m_stack(), m_unescaped(), m_error(NULLPTR), m_error_offset(0)
+{ }
+
+const char *JsonParser::accept_key(JsonSaxHandler &handler, const char *begin, const char *pos, const char *end){
+	pos = skip_spaces(pos, end);
+	if((pos == end) || (*pos != '\"')){
+		return fail(begin, pos, "Object key expected");
+	}
+	pos = accept_string(handler, begin, pos, end, true);
+	if(!pos){
+		return NULLPTR;
+	}
+	pos = skip_spaces(pos, end);
+	if((pos == end) || (*pos != ':')){
+		return fail(begin, pos, "Colon expected");
+	}
+	return pos + 1;
+}
+const char *JsonParser::accept_string(JsonSaxHandler &handler, const char *begin, const char *pos, const char *end, bool key){
+	const char *const open = pos;
+	const char *special = find_quote_or_backslash(open + 1, end);
+	if(special == end){
+		return fail(begin, open, "String not closed");
+	}
+	const char *str;
+	std::size_t len;
+	if(*special == '\"'){
+		// 没有转义字符，直接传递原始数据。
+		str = open + 1;
+		len = static_cast<std::size_t>(special - str);
+		pos = special;
+	} else {
+		m_unescaped.assign(open + 1, special);
+		pos = special;
+		for(;;){
+			// pos 指向反斜杠。
+			if(end - pos < 2){
+				return fail(begin, open, "String not closed");
+			}
+			const char ch = pos[1];
+			pos += 2;
+			switch(ch){
+			case '\"':
+			case '\\':
+			case '/':
+				m_unescaped += ch;
+				break;
+			case 'b':
+				m_unescaped += '\b';
+				break;
+			case 'f':
+				m_unescaped += '\f';
+				break;
+			case 'n':
+				m_unescaped += '\n';
+				break;
+			case 'r':
+				m_unescaped += '\r';
+				break;
+			case 't':
+				m_unescaped += '\t';
+				break;
+			case 'u': {
+				const long unit = (end - pos >= 4) ? decode_hex4(pos) : -1;
+				if(unit < 0){
+					return fail(begin, pos - 2, "Invalid \\u escape sequence");
+				}
+				pos += 4;
+				unsigned long code_point = static_cast<unsigned long>(unit);
+				// 代理对合并为一个码点。孤立的代理项按原样编码。
+				if((0xD800 <= unit) && (unit < 0xDC00) && (end - pos >= 6) && (pos[0] == '\\') && (pos[1] == 'u')){
+					const long low = decode_hex4(pos + 2);
+					if((0xDC00 <= low) && (low < 0xE000)){
+						code_point = 0x10000 + (static_cast<unsigned long>(unit - 0xD800) << 10) + static_cast<unsigned long>(low - 0xDC00);
+						pos += 6;
+					}
+				}
+				append_utf8(m_unescaped, code_point);
+				break; }
+			default:
+				return fail(begin, pos - 2, "Unknown escape sequence");
+			}
+			special = find_quote_or_backslash(pos, end);
+			if(special == end){
+				return fail(begin, open, "String not closed");
+			}
+			m_unescaped.append(pos, special);
+			pos = special;
+			if(*pos == '\"'){
+				break;
+			}
+		}
+		str = m_unescaped.data();
+		len = m_unescaped.size();
+	}
+	if(!(key ? handler.on_object_key(str, len) : handler.on_string(str, len))){
+		return fail(begin, open, "Aborted by handler");
+	}
+	return pos + 1;
+}
+const char *JsonParser::accept_number(JsonSaxHandler &handler, const char *begin, const char *pos, const char *end){
+	const char *const open = pos;
+	const bool negative = (*pos == '-');
+	if(negative){
+		++pos;
+	}
+	// 最多保存 19 位有效数字，超出的部分在快速路径中无法精确处理。
+	boost::uint64_t mantissa = 0;
+	unsigned digits = 0;
+	bool truncated = false;
+	long exponent = 0;
+	if((pos == end) || !is_digit(*pos)){
+		return fail(begin, pos, "Digit expected");
+	}
+	if(*pos == '0'){
+		++pos;
+	} else {
+		do {
+			if(digits < 19){
+				mantissa = mantissa * 10 + static_cast<unsigned>(*pos - '0');
+				++digits;
+			} else {
+				truncated |= (*pos != '0');
+				++exponent;
+			}
+			++pos;
+		} while((pos != end) && is_digit(*pos));
+	}
+	if((pos != end) && (*pos == '.')){
+		++pos;
+		if((pos == end) || !is_digit(*pos)){
+			return fail(begin, pos, "Digit expected");
+		}
+		do {
+			if(digits < 19){
+				mantissa = mantissa * 10 + static_cast<unsigned>(*pos - '0');
+				digits += (mantissa != 0);
+				--exponent;
+			} else {
+				truncated |= (*pos != '0');
+			}
+			++pos;
+		} while((pos != end) && is_digit(*pos));
+	}
+	if((pos != end) && ((*pos == 'e') || (*pos == 'E'))){
+		++pos;
+		bool exp_negative = false;
+		if((pos != end) && ((*pos == '+') || (*pos == '-'))){
+			exp_negative = (*pos == '-');
+			++pos;
+		}
+		if((pos == end) || !is_digit(*pos)){
+			return fail(begin, pos, "Digit expected");
+		}
+		long exp_value = 0;
+		do {
+			if(exp_value < 100000){
+				exp_value = exp_value * 10 + (*pos - '0');
+			}
+			++pos;
+		} while((pos != end) && is_digit(*pos));
+		exponent += exp_negative ? -exp_value : exp_value;
+	}
+	double value;
+	if(!truncated && (mantissa <= (1ull << 53)) && (-22 <= exponent) && (exponent <= 22)){
+		value = static_cast<double>(mantissa);
+		if(exponent < 0){
+			value /= EXACT_POWERS_OF_TEN[-exponent];
+		} else {
+			value *= EXACT_POWERS_OF_TEN[exponent];
+		}
+		if(negative){
+			value = -value;
+		}
+	} else {
+		m_unescaped.assign(open, pos);
+		value = std::strtod(m_unescaped.c_str(), NULLPTR);
+	}
+	if(!handler.on_number(value)){
+		return fail(begin, open, "Aborted by handler");
+	}
+	return pos;
+}
+const char *JsonParser::fail(const char *begin, const char *pos, const char *error){
+	m_error = error;
+	m_error_offset = static_cast<std::size_t>(pos - begin);
+	return NULLPTR;
+}
+
+bool JsonParser::parse(JsonSaxHandler &handler, const void *data, std::size_t size){
+	PROFILE_ME;
+
+	const AUTO(begin, static_cast<const char *>(data));
+	const AUTO(end, begin + size);
+	m_stack.clear();
+	m_error = NULLPTR;
+	m_error_offset = 0;
+
+	const char *pos = begin;
+	for(;;){
+		// 读取一个值。
+		pos = skip_spaces(pos, end);
+		if(pos == end){
+			fail(begin, pos, "Value expected");
+			return false;
+		}
+		switch(*pos){
+		case '{':
+		case '[': {
+			const bool object = (*pos == '{');
+			if(m_stack.size() >= m_max_depth){
+				fail(begin, pos, "Too many levels of nesting");
+				return false;
+			}
+			if(!(object ? handler.on_object_begin() : handler.on_array_begin())){
+				fail(begin, pos, "Aborted by handler");
+				return false;
+			}
+			pos = skip_spaces(pos + 1, end);
+			if((pos != end) && (*pos == (object ? '}' : ']'))){
+				++pos;
+				if(!(object ? handler.on_object_end(0) : handler.on_array_end(0))){
+					fail(begin, pos, "Aborted by handler");
+					return false;
+				}
+				break;
+			}
+			const Frame frame = { object, 0 };
+			m_stack.push_back(frame);
+			if(object){
+				pos = accept_key(handler, begin, pos, end);
+				if(!pos){
+					return false;
+				}
+			}
+			continue; }
+		case '\"':
+			pos = accept_string(handler, begin, pos, end, false);
+			if(!pos){
+				return false;
+			}
+			break;
+		case '-':
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			pos = accept_number(handler, begin, pos, end);
+			if(!pos){
+				return false;
+			}
+			break;
+		case 't':
+		case 'f':
+		case 'n': {
+			bool succeeded;
+			if((end - pos >= 4) && (std::memcmp(pos, "true", 4) == 0)){
+				succeeded = handler.on_boolean(true);
+				pos += 4;
+			} else if((end - pos >= 5) && (std::memcmp(pos, "false", 5) == 0)){
+				succeeded = handler.on_boolean(false);
+				pos += 5;
+			} else if((end - pos >= 4) && (std::memcmp(pos, "null", 4) == 0)){
+				succeeded = handler.on_null();
+				pos += 4;
+			} else {
+				fail(begin, pos, "Invalid literal");
+				return false;
+			}
+			if(!succeeded){
+				fail(begin, pos, "Aborted by handler");
+				return false;
+			}
+			break; }
+		default:
+			fail(begin, pos, "Value expected");
+			return false;
+		}
+		// 一个值结束了。处理逗号和右括号，可能连续关闭多层。
+		for(;;){
+			if(m_stack.empty()){
+				pos = skip_spaces(pos, end);
+				if(pos != end){
+					fail(begin, pos, "Trailing characters after value");
+					return false;
+				}
+				return true;
+			}
+			AUTO_REF(top, m_stack.back());
+			++top.count;
+			pos = skip_spaces(pos, end);
+			if(pos == end){
+				fail(begin, pos, top.object ? "Object not closed" : "Array not closed");
+				return false;
+			}
+			if(*pos == ','){
+				++pos;
+				if(top.object){
+					pos = accept_key(handler, begin, pos, end);
+					if(!pos){
+						return false;
+					}
+				}
+				break;
+			}
+			if(*pos != (top.object ? '}' : ']')){
+				fail(begin, pos, top.object ? "Comma or right brace expected" : "Comma or right bracket expected");
+				return false;
+			}
+			++pos;
+			const Frame frame = top;
+			m_stack.pop_back();
+			if(!(frame.object ? handler.on_object_end(frame.count) : handler.on_array_end(frame.count))){
+				fail(begin, pos, "Aborted by handler");
+				return false;
+			}
+		}
+	}
+}
+bool JsonParser::parse(JsonSaxHandler &handler, const StreamBuffer &buffer){
+	const std::size_t size = buffer.size();
+	const void *const data = buffer.peek_contiguous(size);
+	if(data){
+		return parse(handler, data, size);
+	}
+	const AUTO(str, buffer.dump_string());
+	return parse(handler, str.data(), str.size());
+}
+
+class JsonDocument::Builder : public JsonSaxHandler {
+private:
+	JsonDocument &m_doc;
+	boost::container::vector<std::size_t> m_open;
+
+public:
+	explicit Builder(JsonDocument &doc)
+		: m_doc(doc), m_open()
+	{ }
+
+private:
+	Node &push_node(JsonElement::Type type){
+		const Node node = { static_cast<unsigned char>(type), false, m_doc.m_nodes.size() + 1, 0, 0, 0 };
+		m_doc.m_nodes.push_back(node);
+		return m_doc.m_nodes.back();
+	}
+	void push_string(const char *str, std::size_t len, bool key){
+		AUTO_REF(node, push_node(JsonElement::T_STRING));
+		node.key = key;
+		node.count = len;
+		node.offset = m_doc.m_strings.size();
+		m_doc.m_strings.append(str, len);
+		m_doc.m_strings += '\0';
+	}
+	void open(JsonElement::Type type){
+		m_open.push_back(m_doc.m_nodes.size());
+		push_node(type);
+	}
+	void close(std::size_t count){
+		AUTO_REF(node, m_doc.m_nodes.at(m_open.back()));
+		m_open.pop_back();
+		node.end = m_doc.m_nodes.size();
+		node.count = count;
+	}
+
+public:
+	bool on_null() OVERRIDE {
+		push_node(JsonElement::T_NULL);
+		return true;
+	}
+	bool on_boolean(bool val) OVERRIDE {
+		push_node(JsonElement::T_BOOL).number = val;
+		return true;
+	}
+	bool on_number(double val) OVERRIDE {
+		push_node(JsonElement::T_NUMBER).number = val;
+		return true;
+	}
+	bool on_string(const char *str, std::size_t len) OVERRIDE {
+		push_string(str, len, false);
+		return true;
+	}
+	bool on_object_begin() OVERRIDE {
+		open(JsonElement::T_OBJECT);
+		return true;
+	}
+	bool on_object_key(const char *str, std::size_t len) OVERRIDE {
+		push_string(str, len, true);
+		return true;
+	}
+	bool on_object_end(std::size_t count) OVERRIDE {
+		close(count);
+		return true;
+	}
+	bool on_array_begin() OVERRIDE {
+		open(JsonElement::T_ARRAY);
+		return true;
+	}
+	bool on_array_end(std::size_t count) OVERRIDE {
+		close(count);
+		return true;
+	}
+};
+
+JsonDocument::JsonDocument()
+	: m_nodes(), m_strings()
+{ }
+#ifndef POSEIDON_CXX11
+JsonDocument::JsonDocument(const JsonDocument &rhs)
+	: m_nodes(rhs.m_nodes), m_strings(rhs.m_strings)
+{ }
+JsonDocument &JsonDocument::operator=(const JsonDocument &rhs){
+	m_nodes = rhs.m_nodes;
+	m_strings = rhs.m_strings;
+	return *this;
+}
+#endif
+
+void JsonDocument::clear() NOEXCEPT {
+	m_nodes.clear();
+	m_strings.clear();
+}
+
+JsonDocument::Value JsonDocument::get_root() const {
+	if(m_nodes.empty()){
+		return Value();
+	}
+	return Value(this, 0, m_nodes.size());
+}
+
+void JsonDocument::swap(JsonDocument &rhs) NOEXCEPT {
+	using std::swap;
+	swap(m_nodes, rhs.m_nodes);
+	swap(m_strings, rhs.m_strings);
+}
+
+bool JsonDocument::parse(JsonParser &parser, const void *data, std::size_t size){
+	PROFILE_ME;
+
+	clear();
+	Builder builder(*this);
+	if(!parser.parse(builder, data, size)){
+		LOG_POSEIDON_WARNING("JSON parser error: ", parser.get_error(), " (offset ", parser.get_error_offset(), ")");
+		clear();
+		return false;
+	}
+	return true;
+}
+bool JsonDocument::parse(const void *data, std::size_t size){
+	JsonParser parser;
+	return parse(parser, data, size);
+}
+bool JsonDocument::parse(const StreamBuffer &buffer){
+	const std::size_t size = buffer.size();
+	const void *const data = buffer.peek_contiguous(size);
+	if(data){
+		return parse(data, size);
+	}
+	const AUTO(str, buffer.dump_string());
+	return parse(str.data(), str.size());
+}
+
+JsonElement::Type JsonDocument::Value::get_type() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node){
+		return JsonElement::T_NULL;
+	}
+	return static_cast<JsonElement::Type>(node->type);
+}
+
+bool JsonDocument::Value::get_boolean() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || (node->type != JsonElement::T_BOOL)){
+		return false;
+	}
+	return node->number != 0;
+}
+double JsonDocument::Value::get_number() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || (node->type != JsonElement::T_NUMBER)){
+		return 0;
+	}
+	return node->number;
+}
+const char *JsonDocument::Value::get_string_data() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || (node->type != JsonElement::T_STRING)){
+		return "";
+	}
+	return m_doc->m_strings.data() + node->offset;
+}
+std::size_t JsonDocument::Value::get_string_size() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || (node->type != JsonElement::T_STRING)){
+		return 0;
+	}
+	return node->count;
+}
+std::string JsonDocument::Value::get_string() const {
+	return std::string(get_string_data(), get_string_size());
+}
+
+std::size_t JsonDocument::Value::size() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || ((node->type != JsonElement::T_OBJECT) && (node->type != JsonElement::T_ARRAY))){
+		return 0;
+	}
+	return node->count;
+}
+JsonDocument::Value JsonDocument::Value::get(const char *key) const NOEXCEPT {
+	if(get_type() != JsonElement::T_OBJECT){
+		return Value();
+	}
+	const std::size_t key_size = std::strlen(key);
+	Value ret;
+	for(AUTO(child, first_child()); child.valid(); child = child.next_sibling()){
+		if((child.get_key_size() == key_size) && (std::memcmp(child.get_key_data(), key, key_size) == 0)){
+			ret = child;
+		}
+	}
+	return ret;
+}
+JsonDocument::Value JsonDocument::Value::get_at(std::size_t index) const NOEXCEPT {
+	if(index >= size()){
+		return Value();
+	}
+	AUTO(child, first_child());
+	for(std::size_t i = 0; i < index; ++i){
+		child = child.next_sibling();
+	}
+	return child;
+}
+JsonDocument::Value JsonDocument::Value::first_child() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || ((node->type != JsonElement::T_OBJECT) && (node->type != JsonElement::T_ARRAY)) || (node->count == 0)){
+		return Value();
+	}
+	std::size_t index = m_index + 1;
+	if(m_doc->m_nodes[index].key){
+		++index;
+	}
+	return Value(m_doc, index, node->end);
+}
+JsonDocument::Value JsonDocument::Value::next_sibling() const NOEXCEPT {
+	const AUTO(node, get_node());
+	if(!node || (node->end >= m_limit)){
+		return Value();
+	}
+	std::size_t index = node->end;
+	if(m_doc->m_nodes[index].key){
+		++index;
+	}
+	return Value(m_doc, index, m_limit);
+}
+const char *JsonDocument::Value::get_key_data() const NOEXCEPT {
+	if(!m_doc || (m_index == 0)){
+		return NULLPTR;
+	}
+	// 键的后面总是紧跟着它的值。
+	const AUTO_REF(key, m_doc->m_nodes[m_index - 1]);
+	if(!key.key){
+		return NULLPTR;
+	}
+	return m_doc->m_strings.data() + key.offset;
+}
+std::size_t JsonDocument::Value::get_key_size() const NOEXCEPT {
+	if(!m_doc || (m_index == 0)){
+		return 0;
+	}
+	const AUTO_REF(key, m_doc->m_nodes[m_index - 1]);
+	if(!key.key){
+		return 0;
+	}
+	return key.count;
+}
+
+JsonElement JsonDocument::Value::to_element() const {
+	PROFILE_ME;
+
+	const AUTO(type, get_type());
+	switch(type){
+	case JsonElement::T_BOOL:
+		return get_boolean();
+	case JsonElement::T_NUMBER:
+		return get_number();
+	case JsonElement::T_STRING:
+		return get_string();
+	case JsonElement::T_OBJECT: {
+		JsonElement ret = JsonObject();
+		AUTO_REF(obj, ret.get<JsonObject>());
+		for(AUTO(child, first_child()); child.valid(); child = child.next_sibling()){
+			JsonElement elem = child.to_element();
+			obj.set(SharedNts::intern_existing(child.get_key_data(), child.get_key_size()), JsonElement())->second.swap(elem);
+		}
+		return ret; }
+	case JsonElement::T_ARRAY: {
+		JsonElement ret = JsonArray();
+		AUTO_REF(arr, ret.get<JsonArray>());
+		for(AUTO(child, first_child()); child.valid(); child = child.next_sibling()){
+			JsonElement elem = child.to_element();
+			arr.push_back(JsonElement()).swap(elem);
+		}
+		return ret; }
+	default:
+		return JsonElement();
+	}
+}
+
+}
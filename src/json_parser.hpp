@@ -0,0 +1,183 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_JSON_PARSER_HPP_
+#define POSEIDON_JSON_PARSER_HPP_
+
+#include "cxx_ver.hpp"
+#include "json.hpp"
+#include <string>
+#include <cstddef>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+class StreamBuffer;
+
+// JsonParser 的事件回调。任何一个回调返回 false 都会中止解析。
+// 字符串参数只在回调期间有效，不一定以零结尾。计数为容器中元素（对于对象是键值对）的个数。
+class JsonSaxHandler {
+public:
+	virtual ~JsonSaxHandler();
+
+public:
+	virtual bool on_null() = 0;
+	virtual bool on_boolean(bool val) = 0;
+	virtual bool on_number(double val) = 0;
+	virtual bool on_string(const char *str, std::size_t len) = 0;
+	virtual bool on_object_begin() = 0;
+	virtual bool on_object_key(const char *str, std::size_t len) = 0;
+	virtual bool on_object_end(std::size_t count) = 0;
+	virtual bool on_array_begin() = 0;
+	virtual bool on_array_end(std::size_t count) = 0;
+};
+
+// 直接在连续内存上解析 JSON，不经过 std::istream，不使用递归。没有转义字符的字符串不会被复制。
+// 对象可以复用，内部的栈和缓冲区会保留下来。
+class JsonParser : NONCOPYABLE {
+public:
+	enum { DEFAULT_MAX_DEPTH = 256 };
+
+private:
+	struct Frame {
+		bool object;
+		std::size_t count;
+	};
+
+private:
+	const std::size_t m_max_depth;
+
+	boost::container::vector<Frame> m_stack;
+	std::string m_unescaped;
+	const char *m_error;
+	std::size_t m_error_offset;
+
+public:
+	explicit JsonParser(std::size_t max_depth = DEFAULT_MAX_DEPTH);
+
+private:
+	const char *accept_key(JsonSaxHandler &handler, const char *begin, const char *pos, const char *end);
+	const char *accept_string(JsonSaxHandler &handler, const char *begin, const char *pos, const char *end, bool key);
+	const char *accept_number(JsonSaxHandler &handler, const char *begin, const char *pos, const char *end);
+	const char *fail(const char *begin, const char *pos, const char *error);
+
+public:
+	// 解析 [data, data + size) 中的一个 JSON 值，前后可以有空白，但之后不能有其他字符。
+	// 失败时返回 false，之前已经发生的回调不会被撤销。
+	bool parse(JsonSaxHandler &handler, const void *data, std::size_t size);
+	// 如果数据不连续则先复制一份。
+	bool parse(JsonSaxHandler &handler, const StreamBuffer &buffer);
+
+	// 以下两个函数返回最近一次解析的错误。成功时 get_error() 返回空指针。
+	const char *get_error() const {
+		return m_error;
+	}
+	std::size_t get_error_offset() const {
+		return m_error_offset;
+	}
+};
+
+// 只读的 DOM。所有节点按照先序保存在一个数组中，所有字符串保存在一个缓冲区中，因此整个文档只有两次内存分配，
+// 并且可以通过反复调用 parse() 复用。需要修改或者长期保存的数据应当用 to_element() 转换为 JsonElement。
+class JsonDocument {
+public:
+	class Value;
+
+private:
+	class Builder;
+
+	struct Node {
+		unsigned char type; // JsonElement::Type
+		bool key;           // 对象的键，后面紧跟着它的值。
+		std::size_t end;    // 子树之后的第一个节点。
+		std::size_t count;  // 对于字符串是长度，对于对象和数组是元素个数。
+		std::size_t offset; // 字符串在 m_strings 中的偏移量。
+		double number;      // 对于布尔值是 0 或 1。
+	};
+
+private:
+	boost::container::vector<Node> m_nodes;
+	std::string m_strings; // 每个字符串之后都有一个零字符。
+
+public:
+	JsonDocument();
+#ifndef POSEIDON_CXX11
+	JsonDocument(const JsonDocument &rhs);
+	JsonDocument &operator=(const JsonDocument &rhs);
+#endif
+
+public:
+	bool empty() const {
+		return m_nodes.empty();
+	}
+	void clear() NOEXCEPT;
+
+	Value get_root() const;
+
+	void swap(JsonDocument &rhs) NOEXCEPT;
+
+	// 失败时返回 false 并清空 *this。
+	bool parse(JsonParser &parser, const void *data, std::size_t size);
+	bool parse(const void *data, std::size_t size);
+	bool parse(const StreamBuffer &buffer);
+};
+
+inline void swap(JsonDocument &lhs, JsonDocument &rhs) NOEXCEPT {
+	lhs.swap(rhs);
+}
+
+// 指向 JsonDocument 中一个节点的轻量级句柄，在文档被修改或者销毁之后失效。
+// 不存在的元素为空句柄，它的类型为 T_NULL。类型不符时 get_*() 返回 false、零或者空字符串。
+class JsonDocument::Value {
+	friend JsonDocument;
+
+private:
+	const JsonDocument *m_doc;
+	std::size_t m_index;
+	std::size_t m_limit; // 父节点的 end。
+
+private:
+	Value(const JsonDocument *doc, std::size_t index, std::size_t limit) NOEXCEPT
+		: m_doc(doc), m_index(index), m_limit(limit)
+	{ }
+
+public:
+	Value() NOEXCEPT
+		: m_doc(NULLPTR), m_index(0), m_limit(0)
+	{ }
+
+private:
+	const Node *get_node() const NOEXCEPT {
+		return m_doc ? &(m_doc->m_nodes[m_index]) : NULLPTR;
+	}
+
+public:
+	bool valid() const NOEXCEPT {
+		return !!m_doc;
+	}
+	JsonElement::Type get_type() const NOEXCEPT;
+
+	bool get_boolean() const NOEXCEPT;
+	double get_number() const NOEXCEPT;
+	// 返回的字符串以零结尾。
+	const char *get_string_data() const NOEXCEPT;
+	std::size_t get_string_size() const NOEXCEPT;
+	std::string get_string() const;
+
+	// 对象或数组中元素的个数。
+	std::size_t size() const NOEXCEPT;
+	// 以下两个函数按照顺序查找，复杂度是线性的。
+	Value get(const char *key) const NOEXCEPT; // 有重复的键时返回最后一个。
+	Value get_at(std::size_t index) const NOEXCEPT;
+	// 用于遍历。对于对象，get_key_data() 返回当前元素的键，否则返回空指针。
+	Value first_child() const NOEXCEPT;
+	Value next_sibling() const NOEXCEPT;
+	const char *get_key_data() const NOEXCEPT;
+	std::size_t get_key_size() const NOEXCEPT;
+
+	JsonElement to_element() const;
+};
+
+}
+
+#endif
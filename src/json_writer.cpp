@@ -0,0 +1,265 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "json_writer.hpp"
+#include "json.hpp"
+#include "stream_buffer.hpp"
+#include "shared_nts.hpp"
+#include "log.hpp"
+#include <cmath>
+
+namespace Poseidon {
+
+namespace {
+	const char DIGIT_PAIRS[] =
+		"00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839" "40414243444546474849"
+		"50515253545556575859" "60616263646566676869" "70717273747576777879" "80818283848586878889" "90919293949596979899";
+
+	// 从 end 往前写，返回第一个字符的位置。每次处理两位。
+	char *format_decimal(char *end, boost::uint64_t val){
+		char *pos = end;
+		while(val >= 100){
+			const unsigned pair = static_cast<unsigned>(val % 100);
+			val /= 100;
+			pos -= 2;
+			std::memcpy(pos, DIGIT_PAIRS + pair * 2, 2);
+		}
+		if(val >= 10){
+			pos -= 2;
+			std::memcpy(pos, DIGIT_PAIRS + val * 2, 2);
+		} else {
+			*--pos = static_cast<char>('0' + val);
+		}
+		return pos;
+	}
+
+	const double EXACT_POWERS_OF_TEN[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	// 寻找最小的 k，使得 m / 10^k 恰好还原为 val，其中 m 为不超过 2^53 的整数。
+	// 这时 m 和 10^k 都可以精确表示，除法的结果是正确舍入的，所以任何正确的解析器都会得到 val，不需要 strtod() 验证。
+	// 成功返回写入的字节数，失败返回 0。str 至少要有 32 字节。val 为正数。
+	std::size_t format_fixed(char *str, double val){
+		for(unsigned k = 1; k <= 17; ++k){
+			const double scaled = val * EXACT_POWERS_OF_TEN[k];
+			if(scaled > 9007199254740992.0){
+				break;
+			}
+			const AUTO(mantissa, static_cast<boost::uint64_t>(scaled + 0.5));
+			if(static_cast<double>(mantissa) / EXACT_POWERS_OF_TEN[k] != val){
+				continue;
+			}
+			char digits[24];
+			char *const end = digits + sizeof(digits);
+			const char *const begin = format_decimal(end, mantissa);
+			const AUTO(count, static_cast<std::size_t>(end - begin));
+			char *pos = str;
+			if(count <= k){
+				*(pos++) = '0';
+				*(pos++) = '.';
+				std::memset(pos, '0', k - count);
+				pos += k - count;
+				std::memcpy(pos, begin, count);
+				pos += count;
+			} else {
+				std::memcpy(pos, begin, count - k);
+				pos += count - k;
+				*(pos++) = '.';
+				std::memcpy(pos, end - k, k);
+				pos += k;
+			}
+			return static_cast<std::size_t>(pos - str);
+		}
+		return 0;
+	}
+}
+
+void JsonWriter::put_separator(){
+	if(m_comma){
+		m_buffer.put(',');
+	}
+}
+void JsonWriter::put_string(const char *str, std::size_t len){
+	m_buffer.put('\"');
+	std::size_t run = 0;
+	for(std::size_t i = 0; i < len; ++i){
+		const unsigned ch = static_cast<unsigned char>(str[i]);
+		if((ch >= 0x20) && (ch != '\"') && (ch != '\\')){
+			continue;
+		}
+		m_buffer.put(str + run, i - run);
+		run = i + 1;
+		switch(ch){
+		case '\"':
+			m_buffer.put("\\\"", 2);
+			break;
+		case '\\':
+			m_buffer.put("\\\\", 2);
+			break;
+		case '\b':
+			m_buffer.put("\\b", 2);
+			break;
+		case '\f':
+			m_buffer.put("\\f", 2);
+			break;
+		case '\n':
+			m_buffer.put("\\n", 2);
+			break;
+		case '\r':
+			m_buffer.put("\\r", 2);
+			break;
+		case '\t':
+			m_buffer.put("\\t", 2);
+			break;
+		default: {
+			char esc[6] = { '\\', 'u', '0', '0' };
+			esc[4] = "0123456789abcdef"[ch >> 4];
+			esc[5] = "0123456789abcdef"[ch & 0x0F];
+			m_buffer.put(esc, sizeof(esc));
+			break; }
+		}
+	}
+	m_buffer.put(str + run, len - run);
+	m_buffer.put('\"');
+}
+void JsonWriter::put_integer(bool negative, boost::uint64_t magnitude){
+	put_separator();
+	char str[24];
+	char *const end = str + sizeof(str);
+	char *begin = format_decimal(end, magnitude);
+	if(negative){
+		*--begin = '-';
+	}
+	m_buffer.put(begin, static_cast<std::size_t>(end - begin));
+	m_comma = true;
+}
+
+JsonWriter &JsonWriter::begin_object(){
+	put_separator();
+	m_buffer.put('{');
+	m_comma = false;
+	return *this;
+}
+JsonWriter &JsonWriter::end_object(){
+	m_buffer.put('}');
+	m_comma = true;
+	return *this;
+}
+JsonWriter &JsonWriter::begin_array(){
+	put_separator();
+	m_buffer.put('[');
+	m_comma = false;
+	return *this;
+}
+JsonWriter &JsonWriter::end_array(){
+	m_buffer.put(']');
+	m_comma = true;
+	return *this;
+}
+
+JsonWriter &JsonWriter::key(const char *str, std::size_t len){
+	put_separator();
+	put_string(str, len);
+	m_buffer.put(':');
+	m_comma = false;
+	return *this;
+}
+JsonWriter &JsonWriter::key(const char *str){
+	return key(str, std::strlen(str));
+}
+JsonWriter &JsonWriter::key(const SharedNts &str){
+	return key(str.get());
+}
+
+JsonWriter &JsonWriter::null(){
+	put_separator();
+	m_buffer.put("null", 4);
+	m_comma = true;
+	return *this;
+}
+JsonWriter &JsonWriter::value(bool val){
+	put_separator();
+	if(val){
+		m_buffer.put("true", 4);
+	} else {
+		m_buffer.put("false", 5);
+	}
+	m_comma = true;
+	return *this;
+}
+JsonWriter &JsonWriter::value(double val){
+	if(!std::isfinite(val)){
+		return null();
+	}
+	// 计数器之类的值通常是整数，不经过 snprintf()。
+	if((std::fabs(val) <= 9007199254740992.0) && (val == std::floor(val))){
+		put_integer(val < 0, static_cast<boost::uint64_t>(std::fabs(val)));
+		return *this;
+	}
+	put_separator();
+	char str[48];
+	std::size_t len = 0;
+	if(val < 0){
+		str[len++] = '-';
+	}
+	const std::size_t fixed = format_fixed(str + len, std::fabs(val));
+	if(fixed != 0){
+		len += fixed;
+	} else {
+		// 很大或者很小的值按照能够还原的最短精度输出。
+		for(int precision = 15; precision <= 17; ++precision){
+			len = static_cast<std::size_t>(::snprintf(str, sizeof(str), "%.*g", precision, val));
+			if(std::strtod(str, NULLPTR) == val){
+				break;
+			}
+		}
+	}
+	m_buffer.put(str, len);
+	m_comma = true;
+	return *this;
+}
+JsonWriter &JsonWriter::value(const char *str, std::size_t len){
+	put_separator();
+	put_string(str, len);
+	m_comma = true;
+	return *this;
+}
+JsonWriter &JsonWriter::value(const char *str){
+	return value(str, std::strlen(str));
+}
+JsonWriter &JsonWriter::value(const JsonElement &elem){
+	const AUTO(type, elem.get_type());
+	switch(type){
+	case JsonElement::T_BOOL:
+		return value(elem.get<bool>());
+	case JsonElement::T_NUMBER:
+		return value(elem.get<double>());
+	case JsonElement::T_STRING:
+		return value(elem.get<std::string>());
+	case JsonElement::T_OBJECT: {
+		const AUTO_REF(obj, elem.get<JsonObject>());
+		begin_object();
+		for(AUTO(it, obj.begin()); it != obj.end(); ++it){
+			key(it->first);
+			value(it->second);
+		}
+		return end_object(); }
+	case JsonElement::T_ARRAY: {
+		const AUTO_REF(arr, elem.get<JsonArray>());
+		begin_array();
+		for(AUTO(it, arr.begin()); it != arr.end(); ++it){
+			value(*it);
+		}
+		return end_array(); }
+	case JsonElement::T_NULL:
+		return null();
+	default:
+		LOG_POSEIDON_FATAL("Unknown JSON element type: type = ", static_cast<int>(type));
+		std::abort();
+	}
+}
+
+}
@@ -0,0 +1,80 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_JSON_WRITER_HPP_
+#define POSEIDON_JSON_WRITER_HPP_
+
+#include "cxx_ver.hpp"
+#include "cxx_util.hpp"
+#include <string>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_signed.hpp>
+#include <boost/utility/enable_if.hpp>
+
+namespace Poseidon {
+
+class StreamBuffer;
+class SharedNts;
+class JsonElement;
+
+// 把 JSON 直接追加到 StreamBuffer 的末尾，不构造 JsonElement。用于很大的响应。
+// 调用者负责配对 begin_*() 和 end_*()，并且在对象中交替调用 key() 和 value()，这里不做检查。
+// 整数不经过 double，非有限的浮点数输出为 null。
+class JsonWriter : NONCOPYABLE {
+private:
+	StreamBuffer &m_buffer;
+	bool m_comma; // 下一个键或者值前面需要逗号。
+
+public:
+	explicit JsonWriter(StreamBuffer &buffer)
+		: m_buffer(buffer), m_comma(false)
+	{ }
+
+private:
+	void put_separator();
+	void put_string(const char *str, std::size_t len);
+	void put_integer(bool negative, boost::uint64_t magnitude);
+
+public:
+	StreamBuffer &get_buffer() const {
+		return m_buffer;
+	}
+
+	JsonWriter &begin_object();
+	JsonWriter &end_object();
+	JsonWriter &begin_array();
+	JsonWriter &end_array();
+
+	JsonWriter &key(const char *str, std::size_t len);
+	JsonWriter &key(const char *str);
+	JsonWriter &key(const std::string &str){
+		return key(str.data(), str.size());
+	}
+	JsonWriter &key(const SharedNts &str);
+
+	JsonWriter &null();
+	JsonWriter &value(bool val);
+	JsonWriter &value(double val);
+	template<typename T>
+	typename boost::enable_if_c<boost::is_integral<T>::value, JsonWriter &>::type value(T val){
+		if(boost::is_signed<T>::value && (val < 0)){
+			put_integer(true, -static_cast<boost::uint64_t>(val));
+		} else {
+			put_integer(false, static_cast<boost::uint64_t>(val));
+		}
+		return *this;
+	}
+	JsonWriter &value(const char *str, std::size_t len);
+	JsonWriter &value(const char *str);
+	JsonWriter &value(const std::string &str){
+		return value(str.data(), str.size());
+	}
+	// 用于嵌入已经构造好的部分，例如 make_help() 的结果。
+	JsonWriter &value(const JsonElement &elem);
+};
+
+}
+
+#endif
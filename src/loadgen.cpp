@@ -0,0 +1,937 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 压力测试客户端。
+// 用法：poseidon-loadgen [-c <配置文件>] [-o <输出文件>] [<运行目录>]
+//   运行目录与 poseidon 相同，默认为 /usr/etc/poseidon，其中的 main.conf 用于配置 epoll 和定时器等。
+//   配置文件默认为运行目录中的 loadgen.conf，参见 loadgen-template.conf。
+// 请求按照预定的时间发出（开环），不等待前一个请求的响应，延迟从预定的发送时间开始计算，
+// 因此服务端变慢时排队的时间也计入延迟，不会因为少发请求而掩盖延迟（coordinated omission）。
+// 每个连接上的请求按照发送的顺序得到响应，所以被测的服务端对每个请求都必须回复且只回复一条消息。
+// 每行输出一个 JSON 对象：第一行的 type 为 config，此后每隔 loadgen_report_interval 毫秒输出一行 interval，最后一行为 summary。
+
+#include "precompiled.hpp"
+#include "singletons/main_config.hpp"
+#include "singletons/timer_daemon.hpp"
+#include "singletons/epoll_daemon.hpp"
+#include "singletons/dns_daemon.hpp"
+#include "cbpp/low_level_client.hpp"
+#include "http/low_level_client.hpp"
+#include "http/verbs.hpp"
+#include "websocket/low_level_client.hpp"
+#include "websocket/handshake.hpp"
+#include "config_file.hpp"
+#include "stream_buffer.hpp"
+#include "json.hpp"
+#include "hex.hpp"
+#include "string.hpp"
+#include "thread.hpp"
+#include "mutex.hpp"
+#include "random.hpp"
+#include "log.hpp"
+#include "time.hpp"
+#include "atomic.hpp"
+#include "exception.hpp"
+#include <fstream>
+#include <iostream>
+#include <time.h>
+#include <boost/array.hpp>
+
+using namespace Poseidon;
+
+namespace {
+	enum Protocol {
+		PROTO_CBPP       = 1,
+		PROTO_HTTP       = 2,
+		PROTO_WEBSOCKET  = 3,
+	};
+
+	struct LoadConfig {
+		Protocol protocol;
+		std::string protocol_name;
+		std::string host;
+		boost::uint16_t port;
+		bool use_ssl;
+		bool verify_peer;
+		std::string websocket_uri;
+		std::size_t connections;
+		double rate; // 每秒请求数，所有连接合计。
+		bool poisson;
+		double warmup; // 毫秒。
+		double duration;
+		double drain_timeout;
+		double report_interval;
+		std::size_t max_in_flight; // 每个连接。
+	};
+
+	// 一种请求。按照 weight 的比例随机选择。
+	struct MessageTemplate {
+		unsigned weight;
+		// HTTP
+		Http::Verb verb;
+		std::string uri;
+		std::string content_type;
+		// CBPP
+		boost::uint16_t message_id;
+		// WebSocket
+		WebSocket::OpCode opcode;
+		// HTTP 的请求体，或者 CBPP 和 WebSocket 的消息。
+		StreamBuffer payload;
+	};
+
+	// 与 ProfileDepository 相同的对数-线性直方图，单位为微秒，误差不超过 1/16。
+	enum {
+		HISTOGRAM_SUB_BITS  = 4,
+		HISTOGRAM_BUCKETS   = (64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS,
+	};
+
+	std::size_t get_histogram_index(boost::uint64_t val) NOEXCEPT {
+		if(val < (1u << HISTOGRAM_SUB_BITS)){
+			return static_cast<std::size_t>(val);
+		}
+		const unsigned exp = 63 - static_cast<unsigned>(__builtin_clzll(val));
+		const unsigned shift = exp - HISTOGRAM_SUB_BITS;
+		return ((shift + 1) << HISTOGRAM_SUB_BITS) + static_cast<std::size_t>((val >> shift) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+	}
+	boost::uint64_t get_histogram_upper_bound(std::size_t index) NOEXCEPT {
+		if(index < (1u << HISTOGRAM_SUB_BITS)){
+			return index;
+		}
+		const unsigned shift = static_cast<unsigned>(index >> HISTOGRAM_SUB_BITS) - 1;
+		const boost::uint64_t lower = static_cast<boost::uint64_t>((index & ((1u << HISTOGRAM_SUB_BITS) - 1)) | (1u << HISTOGRAM_SUB_BITS)) << shift;
+		return lower + ((boost::uint64_t)1 << shift) - 1;
+	}
+
+	struct LatencyHistogram {
+		boost::array<boost::uint64_t, HISTOGRAM_BUCKETS> counts;
+		boost::uint64_t count;
+		boost::uint64_t sum;
+		boost::uint64_t max;
+
+		LatencyHistogram(){
+			clear();
+		}
+
+		void clear() NOEXCEPT {
+			counts.fill(0);
+			count = 0;
+			sum = 0;
+			max = 0;
+		}
+		void add(boost::uint64_t val) NOEXCEPT {
+			counts.at(get_histogram_index(val)) += 1;
+			count += 1;
+			sum += val;
+			max = std::max(max, val);
+		}
+		// 返回毫秒数。
+		double get_percentile(double ratio) const NOEXCEPT {
+			const AUTO(target, std::max<boost::uint64_t>(static_cast<boost::uint64_t>(std::ceil(static_cast<double>(count) * ratio)), 1));
+			boost::uint64_t seen = 0;
+			for(std::size_t index = 0; index < counts.size(); ++index){
+				seen += counts[index];
+				if(seen >= target){
+					return static_cast<double>(std::min(get_histogram_upper_bound(index), max)) / 1000;
+				}
+			}
+			return static_cast<double>(max) / 1000;
+		}
+		double get_mean() const NOEXCEPT {
+			if(count == 0){
+				return 0;
+			}
+			return static_cast<double>(sum) / static_cast<double>(count) / 1000;
+		}
+	};
+
+	// 以下变量在调度开始之前设置，之后只读。
+	LoadConfig g_config;
+	boost::container::vector<MessageTemplate> g_messages;
+	unsigned g_total_weight = 0;
+	double g_measure_begin = 0; // 预定的发送时间早于这个时刻的请求属于预热阶段，不计入统计。
+	double g_measure_end = 0;
+
+	// 调度线程之外只读取。
+	volatile bool g_scheduling = false;
+	volatile boost::uint64_t g_in_flight = 0;
+
+	struct Counters {
+		boost::uint64_t sent;
+		boost::uint64_t completed;
+		boost::uint64_t errors; // 收到了表示错误的响应。
+		boost::uint64_t failed; // 发送失败，或者在收到响应之前连接断开了。
+		boost::uint64_t dropped; // 连接上等待响应的请求过多，没有发送。
+	};
+
+	Mutex g_stats_mutex;
+	Counters g_total = { };
+	Counters g_interval = { };
+	LatencyHistogram g_total_histogram;
+	LatencyHistogram g_interval_histogram;
+
+	enum CounterField {
+		CF_SENT,
+		CF_FAILED,
+		CF_DROPPED,
+	};
+
+	void record_event(double intended, CounterField field){
+		if(intended < g_measure_begin){
+			return;
+		}
+		const Mutex::UniqueLock lock(g_stats_mutex);
+		switch(field){
+		case CF_SENT:
+			g_total.sent += 1;
+			g_interval.sent += 1;
+			break;
+		case CF_FAILED:
+			g_total.failed += 1;
+			g_interval.failed += 1;
+			break;
+		case CF_DROPPED:
+			g_total.dropped += 1;
+			g_interval.dropped += 1;
+			break;
+		}
+	}
+	void record_completion(double intended, bool error){
+		if(intended < g_measure_begin){
+			return;
+		}
+		const double latency = get_hi_res_mono_clock() - intended;
+		const AUTO(latency_us, static_cast<boost::uint64_t>(std::max(latency, 0.0) * 1000));
+		const Mutex::UniqueLock lock(g_stats_mutex);
+		g_total.completed += 1;
+		g_interval.completed += 1;
+		if(error){
+			g_total.errors += 1;
+			g_interval.errors += 1;
+		}
+		g_total_histogram.add(latency_us);
+		g_interval_histogram.add(latency_us);
+	}
+
+	// 每个连接上等待响应的请求的预定发送时间，按照发送的顺序排列。
+	class LoadConnection : NONCOPYABLE {
+	private:
+		mutable Mutex m_mutex;
+		boost::container::deque<double> m_in_flight;
+
+	public:
+		virtual ~LoadConnection(){ }
+
+	protected:
+		// 在 epoll 线程中调用。
+		void complete_request(bool error){
+			double intended;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				if(m_in_flight.empty()){
+					LOG_POSEIDON_WARNING("Unexpected response from load generation target");
+					return;
+				}
+				intended = m_in_flight.front();
+				m_in_flight.pop_front();
+			}
+			atomic_sub(g_in_flight, 1, ATOMIC_RELAXED);
+			record_completion(intended, error);
+		}
+		void abort_requests(){
+			boost::container::deque<double> in_flight;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				in_flight.swap(m_in_flight);
+			}
+			atomic_sub(g_in_flight, in_flight.size(), ATOMIC_RELAXED);
+			for(AUTO(it, in_flight.begin()); it != in_flight.end(); ++it){
+				record_event(*it, CF_FAILED);
+			}
+		}
+
+		virtual bool really_send(const MessageTemplate &message) = 0;
+
+	public:
+		virtual bool is_usable() const NOEXCEPT = 0;
+		virtual void close() NOEXCEPT = 0;
+
+		// 在调度线程中调用。
+		void issue(const MessageTemplate &message, double intended){
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				if(m_in_flight.size() >= g_config.max_in_flight){
+					record_event(intended, CF_DROPPED);
+					return;
+				}
+				m_in_flight.push_back(intended);
+			}
+			atomic_add(g_in_flight, 1, ATOMIC_RELAXED);
+			record_event(intended, CF_SENT);
+			if(!really_send(message)){
+				// 连接已经断开，on_close() 会处理已经发出的请求。
+				bool removed = false;
+				{
+					const Mutex::UniqueLock lock(m_mutex);
+					if(!m_in_flight.empty() && (m_in_flight.back() == intended)){
+						m_in_flight.pop_back();
+						removed = true;
+					}
+				}
+				if(removed){
+					atomic_sub(g_in_flight, 1, ATOMIC_RELAXED);
+					record_event(intended, CF_FAILED);
+				}
+			}
+		}
+	};
+
+	class CbppConnection : public Cbpp::LowLevelClient, public LoadConnection {
+	public:
+		explicit CbppConnection(const boost::container::vector<SockAddr> &addrs)
+			: Cbpp::LowLevelClient(addrs, g_config.use_ssl, g_config.verify_peer)
+		{ }
+
+	protected:
+		// TcpClientBase
+		void on_close(int err_code) OVERRIDE {
+			Cbpp::LowLevelClient::on_close(err_code);
+
+			abort_requests();
+		}
+
+		// LowLevelClient
+		void on_low_level_data_message_header(boost::uint16_t, boost::uint64_t) OVERRIDE {
+			//
+		}
+		void on_low_level_data_message_payload(boost::uint64_t, StreamBuffer) OVERRIDE {
+			//
+		}
+		bool on_low_level_data_message_end(boost::uint64_t) OVERRIDE {
+			complete_request(false);
+			return true;
+		}
+
+		bool on_low_level_control_message(Cbpp::StatusCode status_code, StreamBuffer param) OVERRIDE {
+			if(status_code < 0){
+				// 服务端用负的状态码回复出错的请求，然后关闭连接。
+				LOG_POSEIDON_DEBUG("Received negative status code from ", get_remote_info(), ": status_code = ", status_code);
+				complete_request(true);
+				shutdown(Cbpp::ST_SHUTDOWN);
+				return false;
+			}
+			switch(status_code){
+			case Cbpp::ST_SHUTDOWN:
+				shutdown(Cbpp::ST_SHUTDOWN);
+				return false;
+			case Cbpp::ST_PING:
+				send_control(Cbpp::ST_PONG, STD_MOVE(param));
+				break;
+			default:
+				break;
+			}
+			return true;
+		}
+
+		// LoadConnection
+		bool really_send(const MessageTemplate &message) OVERRIDE {
+			return send(message.message_id, message.payload);
+		}
+
+	public:
+		bool is_usable() const NOEXCEPT OVERRIDE {
+			return !has_been_shutdown_write();
+		}
+		void close() NOEXCEPT OVERRIDE {
+			force_shutdown();
+		}
+	};
+
+	class HttpConnection : public Http::LowLevelClient, public LoadConnection {
+	private:
+		// 以下成员只在 epoll 线程中访问。
+		Http::StatusCode m_status_code;
+
+	public:
+		explicit HttpConnection(const boost::container::vector<SockAddr> &addrs)
+			: Http::LowLevelClient(addrs, g_config.use_ssl, g_config.verify_peer)
+			, m_status_code(Http::ST_NULL)
+		{ }
+
+	protected:
+		// TcpClientBase
+		void on_close(int err_code) OVERRIDE {
+			Http::LowLevelClient::on_close(err_code);
+
+			abort_requests();
+		}
+
+		// LowLevelClient
+		void on_low_level_response_headers(Http::ResponseHeaders response_headers, boost::uint64_t) OVERRIDE {
+			m_status_code = response_headers.status_code;
+		}
+		void on_low_level_response_entity(boost::uint64_t, StreamBuffer) OVERRIDE {
+			//
+		}
+		boost::shared_ptr<Http::UpgradedSessionBase> on_low_level_response_end(boost::uint64_t, OptionalMap) OVERRIDE {
+			complete_request(m_status_code / 100 >= 4);
+			return VAL_INIT;
+		}
+
+		// LoadConnection
+		bool really_send(const MessageTemplate &message) OVERRIDE {
+			Http::RequestHeaders request_headers = { };
+			request_headers.verb = message.verb;
+			request_headers.uri = message.uri;
+			request_headers.version = 10001;
+			request_headers.headers.set(sslit("Host"), g_config.host);
+			if(!message.content_type.empty()){
+				request_headers.headers.set(sslit("Content-Type"), message.content_type);
+			}
+			return send(STD_MOVE(request_headers), message.payload);
+		}
+
+	public:
+		bool is_usable() const NOEXCEPT OVERRIDE {
+			return !has_been_shutdown_write();
+		}
+		void close() NOEXCEPT OVERRIDE {
+			force_shutdown();
+		}
+	};
+
+	class WebSocketConnection : public WebSocket::LowLevelClient, public LoadConnection {
+	public:
+		explicit WebSocketConnection(const boost::shared_ptr<Http::LowLevelClient> &parent)
+			: WebSocket::LowLevelClient(parent)
+		{ }
+
+	protected:
+		// UpgradedSessionBase
+		void on_close(int err_code) OVERRIDE {
+			WebSocket::LowLevelClient::on_close(err_code);
+
+			abort_requests();
+		}
+
+		// LowLevelClient
+		void on_low_level_message_header(WebSocket::OpCode) OVERRIDE {
+			//
+		}
+		void on_low_level_message_payload(boost::uint64_t, StreamBuffer) OVERRIDE {
+			//
+		}
+		bool on_low_level_message_end(boost::uint64_t) OVERRIDE {
+			complete_request(false);
+			return true;
+		}
+
+		bool on_low_level_control_message(WebSocket::OpCode opcode, StreamBuffer payload) OVERRIDE {
+			switch(opcode){
+			case WebSocket::OP_CLOSE:
+				shutdown(WebSocket::ST_NORMAL_CLOSURE);
+				return false;
+			case WebSocket::OP_PING:
+				send(WebSocket::OP_PONG, STD_MOVE(payload));
+				break;
+			default:
+				break;
+			}
+			return true;
+		}
+
+		// LoadConnection
+		bool really_send(const MessageTemplate &message) OVERRIDE {
+			return send(message.opcode, message.payload);
+		}
+
+	public:
+		bool is_usable() const NOEXCEPT OVERRIDE {
+			return !has_been_shutdown_write();
+		}
+		void close() NOEXCEPT OVERRIDE {
+			force_shutdown();
+		}
+	};
+
+	// 发送握手请求，收到 101 响应之后切换到 WebSocketConnection。
+	class WebSocketHandshakeClient : public Http::LowLevelClient {
+	private:
+		std::string m_sec_websocket_key;
+
+		// 以下成员只在 epoll 线程中访问。
+		Http::ResponseHeaders m_response_headers;
+
+		// 握手完成之后由主线程读取。
+		mutable Mutex m_mutex;
+		boost::shared_ptr<WebSocketConnection> m_connection;
+		bool m_failed;
+
+	public:
+		explicit WebSocketHandshakeClient(const boost::container::vector<SockAddr> &addrs)
+			: Http::LowLevelClient(addrs, g_config.use_ssl, g_config.verify_peer)
+			, m_failed(false)
+		{ }
+
+	private:
+		void mark_failed(){
+			const Mutex::UniqueLock lock(m_mutex);
+			m_failed = true;
+		}
+
+	protected:
+		// TcpClientBase
+		void on_close(int err_code) OVERRIDE {
+			Http::LowLevelClient::on_close(err_code);
+
+			mark_failed();
+		}
+
+		// LowLevelClient
+		void on_low_level_response_headers(Http::ResponseHeaders response_headers, boost::uint64_t) OVERRIDE {
+			m_response_headers = STD_MOVE(response_headers);
+		}
+		void on_low_level_response_entity(boost::uint64_t, StreamBuffer) OVERRIDE {
+			//
+		}
+		boost::shared_ptr<Http::UpgradedSessionBase> on_low_level_response_end(boost::uint64_t, OptionalMap) OVERRIDE {
+			if(!WebSocket::check_handshake_response(m_response_headers, m_sec_websocket_key)){
+				LOG_POSEIDON_ERROR("WebSocket handshake failed: remote = ", get_remote_info(), ", status_code = ", m_response_headers.status_code);
+				mark_failed();
+				force_shutdown();
+				return VAL_INIT;
+			}
+			AUTO(connection, boost::make_shared<WebSocketConnection>(virtual_shared_from_this<WebSocketHandshakeClient>()));
+			WebSocket::DeflateParams params;
+			if(WebSocket::get_deflate_params(params, m_response_headers)){
+				connection->enable_deflate(params);
+			}
+			const Mutex::UniqueLock lock(m_mutex);
+			m_connection = connection;
+			return connection;
+		}
+
+	public:
+		void send_handshake(){
+			AUTO(pair, WebSocket::make_handshake_request(g_config.websocket_uri, OptionalMap(), g_config.host));
+			m_sec_websocket_key = STD_MOVE(pair.second);
+			DEBUG_THROW_UNLESS(send(STD_MOVE(pair.first)), Exception, sslit("Failed to send WebSocket handshake request"));
+		}
+		// 握手还没有完成则返回空指针，失败则抛出异常。
+		boost::shared_ptr<WebSocketConnection> get_connection() const {
+			const Mutex::UniqueLock lock(m_mutex);
+			DEBUG_THROW_UNLESS(!m_failed || m_connection, Exception, sslit("WebSocket handshake failed"));
+			return m_connection;
+		}
+	};
+
+	// 去掉首尾空白之后按照逗号分开，最后一个字段可以包含逗号。
+	boost::container::vector<std::string> split_fields(const std::string &str, std::size_t limit){
+		AUTO(fields, explode<std::string>(',', str, limit));
+		for(AUTO(it, fields.begin()); it != fields.end(); ++it){
+			*it = trim(STD_MOVE(*it));
+		}
+		return fields;
+	}
+	StreamBuffer decode_hex(const std::string &str){
+		HexDecoder dec;
+		dec.put(str);
+		return dec.finalize();
+	}
+
+	// loadgen_http_request        = <权重>,<方法>,<URI>[,<Content-Type>,<请求体>]
+	// loadgen_cbpp_message        = <权重>,<消息号>[,<十六进制的消息体>]
+	// loadgen_websocket_message   = <权重>,text|binary[,<消息>]  （binary 的消息是十六进制的）
+	void load_messages(const ConfigFile &file){
+		const char *key;
+		switch(g_config.protocol){
+		case PROTO_CBPP:
+			key = "loadgen_cbpp_message";
+			break;
+		case PROTO_HTTP:
+			key = "loadgen_http_request";
+			break;
+		default:
+			key = "loadgen_websocket_message";
+			break;
+		}
+		const AUTO(lines, file.get_all_raw(key));
+		DEBUG_THROW_UNLESS(!lines.empty(), Exception, sslit("No message is configured for the load generator"));
+		for(AUTO(it, lines.begin()); it != lines.end(); ++it){
+			MessageTemplate message = { };
+			const AUTO(fields, split_fields(*it, (g_config.protocol == PROTO_HTTP) ? 5 : 3));
+			DEBUG_THROW_UNLESS(fields.size() >= 2, Exception, sslit("Invalid message specification"));
+			message.weight = boost::lexical_cast<unsigned>(fields.at(0));
+			switch(g_config.protocol){
+			case PROTO_CBPP:
+				message.message_id = boost::lexical_cast<boost::uint16_t>(fields.at(1));
+				if(fields.size() >= 3){
+					message.payload = decode_hex(fields.at(2));
+				}
+				break;
+			case PROTO_HTTP:
+				DEBUG_THROW_UNLESS(fields.size() >= 3, Exception, sslit("Invalid HTTP request specification"));
+				message.verb = Http::get_verb_from_string(fields.at(1).c_str());
+				// 服务端对 HEAD 的响应没有响应体，而 ClientReader 只能按照 Content-Length 读取。
+				DEBUG_THROW_UNLESS((message.verb != Http::V_INVALID_VERB) && (message.verb != Http::V_HEAD), Exception, sslit("Unsupported HTTP verb"));
+				message.uri = fields.at(2);
+				if(fields.size() >= 5){
+					message.content_type = fields.at(3);
+					message.payload.put(fields.at(4));
+				}
+				break;
+			default:
+				if(fields.at(1) == "text"){
+					message.opcode = WebSocket::OP_DATA_TEXT;
+					if(fields.size() >= 3){
+						message.payload.put(fields.at(2));
+					}
+				} else if(fields.at(1) == "binary"){
+					message.opcode = WebSocket::OP_DATA_BINARY;
+					if(fields.size() >= 3){
+						message.payload = decode_hex(fields.at(2));
+					}
+				} else {
+					DEBUG_THROW(Exception, sslit("Invalid WebSocket message type"));
+				}
+				break;
+			}
+			if(message.weight == 0){
+				continue;
+			}
+			g_total_weight += message.weight;
+			g_messages.push_back(STD_MOVE(message));
+		}
+		DEBUG_THROW_UNLESS(g_total_weight != 0, Exception, sslit("All messages have zero weight"));
+	}
+
+	void load_config(const ConfigFile &file){
+		g_config.protocol_name = file.get<std::string>("loadgen_protocol", "http");
+		if(g_config.protocol_name == "cbpp"){
+			g_config.protocol = PROTO_CBPP;
+		} else if(g_config.protocol_name == "http"){
+			g_config.protocol = PROTO_HTTP;
+		} else if(g_config.protocol_name == "websocket"){
+			g_config.protocol = PROTO_WEBSOCKET;
+		} else {
+			DEBUG_THROW(Exception, sslit("Invalid loadgen_protocol"));
+		}
+		g_config.host = file.get<std::string>("loadgen_host", "127.0.0.1");
+		g_config.port = file.get<boost::uint16_t>("loadgen_port", 8860);
+		g_config.use_ssl = file.get<bool>("loadgen_use_ssl", false);
+		g_config.verify_peer = file.get<bool>("loadgen_verify_peer", false);
+		g_config.websocket_uri = file.get<std::string>("loadgen_websocket_uri", "/");
+		g_config.connections = std::max<std::size_t>(file.get<std::size_t>("loadgen_connections", 16), 1);
+		g_config.rate = file.get<double>("loadgen_rate", 1000);
+		DEBUG_THROW_UNLESS(g_config.rate > 0, Exception, sslit("loadgen_rate must be positive"));
+		const AUTO(arrival, file.get<std::string>("loadgen_arrival", "uniform"));
+		DEBUG_THROW_UNLESS((arrival == "uniform") || (arrival == "poisson"), Exception, sslit("Invalid loadgen_arrival"));
+		g_config.poisson = (arrival == "poisson");
+		g_config.warmup = file.get<double>("loadgen_warmup", 5000);
+		g_config.duration = file.get<double>("loadgen_duration", 30000);
+		g_config.drain_timeout = file.get<double>("loadgen_drain_timeout", 5000);
+		g_config.report_interval = std::max(file.get<double>("loadgen_report_interval", 1000), 100.0);
+		g_config.max_in_flight = std::max<std::size_t>(file.get<std::size_t>("loadgen_max_in_flight", 10000), 1);
+		load_messages(file);
+	}
+
+	boost::container::vector<boost::shared_ptr<LoadConnection> > g_connections;
+
+	void connect_all(){
+		const AUTO(addrs, DnsDaemon::look_up_all(g_config.host, g_config.port));
+		LOG_POSEIDON_INFO("Connecting to ", g_config.host, ":", g_config.port, ": connections = ", g_config.connections);
+		boost::container::vector<boost::shared_ptr<WebSocketHandshakeClient> > handshakes;
+		for(std::size_t i = 0; i < g_config.connections; ++i){
+			switch(g_config.protocol){
+			case PROTO_CBPP: {
+				AUTO(client, boost::make_shared<CbppConnection>(addrs));
+				EpollDaemon::add_socket(client, true);
+				g_connections.push_back(STD_MOVE_IDN(client));
+				break; }
+			case PROTO_HTTP: {
+				AUTO(client, boost::make_shared<HttpConnection>(addrs));
+				EpollDaemon::add_socket(client, true);
+				g_connections.push_back(STD_MOVE_IDN(client));
+				break; }
+			default: {
+				AUTO(client, boost::make_shared<WebSocketHandshakeClient>(addrs));
+				EpollDaemon::add_socket(client, true);
+				client->send_handshake();
+				handshakes.push_back(STD_MOVE_IDN(client));
+				break; }
+			}
+		}
+		// 等待所有的 WebSocket 握手完成。
+		const double deadline = get_hi_res_mono_clock() + 10000;
+		for(AUTO(it, handshakes.begin()); it != handshakes.end(); ++it){
+			boost::shared_ptr<WebSocketConnection> connection;
+			while(!(connection = (*it)->get_connection())){
+				DEBUG_THROW_UNLESS(get_hi_res_mono_clock() < deadline, Exception, sslit("WebSocket handshake timed out"));
+				::usleep(1000);
+			}
+			g_connections.push_back(STD_MOVE_IDN(connection));
+		}
+	}
+
+	const MessageTemplate &choose_message(){
+		if(g_messages.size() == 1){
+			return g_messages.front();
+		}
+		unsigned point = random_uint32() % g_total_weight;
+		for(AUTO(it, g_messages.begin()); it != g_messages.end(); ++it){
+			if(point < it->weight){
+				return *it;
+			}
+			point -= it->weight;
+		}
+		return g_messages.back();
+	}
+
+	void sleep_for(double ms){
+		::timespec ts;
+		ts.tv_sec = static_cast<std::time_t>(ms / 1000);
+		ts.tv_nsec = static_cast<long>((ms - static_cast<double>(ts.tv_sec) * 1000) * 1000000);
+		::nanosleep(&ts, NULLPTR);
+	}
+
+	// 按照预定的时间依次把请求分配给各个连接。落后于预定时间时立即补发，不会降低请求的速率。
+	void scheduler_proc(double begin){
+		const double mean_interval = 1000 / g_config.rate;
+		double next = begin;
+		std::size_t index = 0;
+		while(atomic_load(g_scheduling, ATOMIC_CONSUME)){
+			const double now = get_hi_res_mono_clock();
+			if(next > now){
+				sleep_for(std::min(next - now, 10.0));
+				continue;
+			}
+			if(next >= g_measure_end){
+				break;
+			}
+			boost::shared_ptr<LoadConnection> connection;
+			for(std::size_t i = 0; i < g_connections.size(); ++i){
+				const AUTO_REF(candidate, g_connections.at(index++ % g_connections.size()));
+				if(candidate->is_usable()){
+					connection = candidate;
+					break;
+				}
+			}
+			if(connection){
+				connection->issue(choose_message(), next);
+			} else {
+				record_event(next, CF_SENT);
+				record_event(next, CF_FAILED);
+			}
+			if(g_config.poisson){
+				next -= std::log(1 - random_double()) * mean_interval;
+			} else {
+				next += mean_interval;
+			}
+		}
+	}
+
+	void set_percentiles(JsonObject &obj, const LatencyHistogram &histogram){
+		obj.set(sslit("mean"), histogram.get_mean());
+		obj.set(sslit("p50"), histogram.get_percentile(0.50));
+		obj.set(sslit("p75"), histogram.get_percentile(0.75));
+		obj.set(sslit("p90"), histogram.get_percentile(0.90));
+		obj.set(sslit("p99"), histogram.get_percentile(0.99));
+		obj.set(sslit("p999"), histogram.get_percentile(0.999));
+		obj.set(sslit("p9999"), histogram.get_percentile(0.9999));
+		obj.set(sslit("max"), static_cast<double>(histogram.max) / 1000);
+	}
+	void set_counters(JsonObject &obj, const Counters &counters){
+		obj.set(sslit("sent"), counters.sent);
+		obj.set(sslit("completed"), counters.completed);
+		obj.set(sslit("errors"), counters.errors);
+		obj.set(sslit("failed"), counters.failed);
+		obj.set(sslit("dropped"), counters.dropped);
+	}
+
+	void print_config(std::ostream &os){
+		JsonObject obj;
+		obj.set(sslit("type"), "config");
+		obj.set(sslit("protocol"), g_config.protocol_name);
+		obj.set(sslit("host"), g_config.host);
+		obj.set(sslit("port"), g_config.port);
+		obj.set(sslit("connections"), g_config.connections);
+		obj.set(sslit("rate"), g_config.rate);
+		obj.set(sslit("arrival"), g_config.poisson ? "poisson" : "uniform");
+		obj.set(sslit("warmup"), g_config.warmup);
+		obj.set(sslit("duration"), g_config.duration);
+		obj.set(sslit("messages"), g_messages.size());
+		os <<obj <<std::endl;
+	}
+	void print_interval(std::ostream &os, double elapsed, double interval){
+		Counters counters;
+		LatencyHistogram histogram;
+		{
+			const Mutex::UniqueLock lock(g_stats_mutex);
+			counters = g_interval;
+			g_interval = Counters();
+			histogram = g_interval_histogram;
+			g_interval_histogram.clear();
+		}
+		const double throughput = static_cast<double>(counters.completed) * 1000 / interval;
+		const AUTO(in_flight, atomic_load(g_in_flight, ATOMIC_RELAXED));
+		LOG_POSEIDON_INFO("Load generator: elapsed = ", elapsed / 1000, "s, throughput = ", throughput, "/s, p50 = ", histogram.get_percentile(0.50),
+			"ms, p99 = ", histogram.get_percentile(0.99), "ms, errors = ", counters.errors, ", failed = ", counters.failed, ", in_flight = ", in_flight);
+
+		JsonObject obj;
+		obj.set(sslit("type"), "interval");
+		obj.set(sslit("elapsed"), elapsed / 1000);
+		obj.set(sslit("throughput"), throughput);
+		obj.set(sslit("in_flight"), in_flight);
+		set_counters(obj, counters);
+		JsonObject latency;
+		set_percentiles(latency, histogram);
+		obj.set(sslit("latency"), latency);
+		os <<obj <<std::endl;
+	}
+	void print_summary(std::ostream &os, double measured){
+		Counters counters;
+		LatencyHistogram histogram;
+		{
+			const Mutex::UniqueLock lock(g_stats_mutex);
+			counters = g_total;
+			histogram = g_total_histogram;
+		}
+		const AUTO(outstanding, atomic_load(g_in_flight, ATOMIC_RELAXED));
+
+		JsonObject obj;
+		obj.set(sslit("type"), "summary");
+		obj.set(sslit("duration"), measured / 1000);
+		obj.set(sslit("target_rate"), g_config.rate);
+		obj.set(sslit("throughput"), static_cast<double>(counters.completed) * 1000 / measured);
+		set_counters(obj, counters);
+		// 超过 loadgen_drain_timeout 仍然没有收到响应的请求。
+		obj.set(sslit("outstanding"), outstanding);
+		JsonObject latency;
+		set_percentiles(latency, histogram);
+		obj.set(sslit("latency"), latency);
+		// 每个元素是 [ 桶的上界（微秒）, 数量 ]，可以合并多个实例的结果。
+		JsonArray buckets;
+		for(std::size_t index = 0; index < histogram.counts.size(); ++index){
+			if(histogram.counts[index] == 0){
+				continue;
+			}
+			JsonArray bucket;
+			bucket.push_back(get_histogram_upper_bound(index));
+			bucket.push_back(histogram.counts[index]);
+			buckets.push_back(bucket);
+		}
+		obj.set(sslit("histogram"), buckets);
+		os <<obj <<std::endl;
+	}
+
+	template<typename T>
+	struct RaiiSingletonRunner : NONCOPYABLE {
+		RaiiSingletonRunner(){
+			T::start();
+		}
+		~RaiiSingletonRunner(){
+			T::stop();
+		}
+	};
+
+#define START(x_)   const RaiiSingletonRunner<x_> UNIQUE_ID
+
+	void run(std::ostream &os){
+		START(TimerDaemon);
+		START(EpollDaemon);
+
+		connect_all();
+		print_config(os);
+
+		const double begin = get_hi_res_mono_clock();
+		g_measure_begin = begin + g_config.warmup;
+		g_measure_end = g_measure_begin + g_config.duration;
+		atomic_store(g_scheduling, true, ATOMIC_RELEASE);
+		Thread scheduler(boost::bind(&scheduler_proc, begin), sslit(" LG "), sslit("Loadgen"));
+
+		double next_report = g_measure_begin + g_config.report_interval;
+		for(;;){
+			const double now = get_hi_res_mono_clock();
+			if(now >= g_measure_end){
+				break;
+			}
+			if(now < g_measure_begin){
+				sleep_for(std::min(g_measure_begin - now, 100.0));
+				continue;
+			}
+			if(now < next_report){
+				sleep_for(std::min(next_report - now, g_measure_end - now));
+				continue;
+			}
+			print_interval(os, now - g_measure_begin, g_config.report_interval);
+			next_report += g_config.report_interval;
+		}
+		atomic_store(g_scheduling, false, ATOMIC_RELEASE);
+		scheduler.join();
+
+		// 等待已经发出的请求的响应。
+		const double drain_deadline = get_hi_res_mono_clock() + g_config.drain_timeout;
+		while((atomic_load(g_in_flight, ATOMIC_RELAXED) != 0) && (get_hi_res_mono_clock() < drain_deadline)){
+			sleep_for(1);
+		}
+		print_summary(os, g_config.duration);
+
+		for(AUTO(it, g_connections.begin()); it != g_connections.end(); ++it){
+			(*it)->close();
+		}
+		g_connections.clear();
+	}
+
+	void print_usage(const char *self){
+		std::cerr <<"Usage: " <<self <<" [-c <config_file>] [-o <output>] [<run_path>]" <<std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+try {
+	Logger::set_thread_tag("L   "); // Load generator
+
+	const char *conf_path = NULLPTR;
+	const char *output = NULLPTR;
+	const char *run_path = "/usr/etc/poseidon";
+	for(int i = 1; i < argc; ++i){
+		const char *const arg = argv[i];
+		if((std::strcmp(arg, "-c") == 0) && (i + 1 < argc)){
+			conf_path = argv[++i];
+		} else if((std::strcmp(arg, "-o") == 0) && (i + 1 < argc)){
+			output = argv[++i];
+		} else if(arg[0] == '-'){
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			run_path = arg;
+		}
+	}
+
+	// 设置运行目录会改变当前工作目录，所以先打开命令行中给出的文件。
+	std::ofstream file;
+	if(output){
+		file.open(output, std::ios::out | std::ios::trunc);
+		DEBUG_THROW_UNLESS(file, Exception, sslit("Could not open output file"));
+	}
+	std::ostream &os = output ? static_cast<std::ostream &>(file) : std::cout;
+	boost::shared_ptr<const ConfigFile> config;
+	if(conf_path){
+		config = boost::make_shared<ConfigFile>(conf_path);
+	}
+
+	MainConfig::set_run_path(run_path);
+	MainConfig::reload();
+	if(!config){
+		config = boost::make_shared<ConfigFile>("loadgen.conf");
+	}
+	load_config(*config);
+
+	run(os);
+	return EXIT_SUCCESS;
+} catch(std::exception &e){
+	LOG_POSEIDON_FATAL("std::exception thrown in main(): what = ", e.what());
+	return EXIT_FAILURE;
+} catch(...){
+	LOG_POSEIDON_FATAL("Unknown exception thrown in main().");
+	return EXIT_FAILURE;
+}
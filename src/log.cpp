@@ -6,8 +6,22 @@
 #include "atomic.hpp"
 #include "time.hpp"
 #include "singletons/main_config.hpp"
+#include "mutex.hpp"
+#include "condition_variable.hpp"
+#include "thread.hpp"
+#include "zlib.hpp"
+#include "random.hpp"
+#include "trace_context.hpp"
+#include <boost/scoped_array.hpp>
+#include <boost/container/deque.hpp>
+#include <cmath>
+#include <sched.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 namespace Poseidon {
 
@@ -77,6 +91,974 @@ namespace {
 
 	volatile boost::uint64_t g_mask = (boost::uint64_t)-1;
 	__thread char t_tag[5] = "----";
+	__thread unsigned long t_tid = 0;
+
+	// 颜色转义序列和终端检测的结果在第一次写日志时生成，此后不再改变。
+	struct ColorString {
+		char str[16];
+		std::size_t len;
+	};
+	boost::array<ColorString, 0100> g_begin_colors;
+	ColorString g_end_color;
+	bool g_is_tty[3];
+
+	void init_output_cache(){
+		for(std::size_t i = 0; i < g_begin_colors.size(); ++i){
+			g_begin_colors[i].len = begin_color(g_begin_colors[i].str, static_cast<int>(i));
+		}
+		g_end_color.len = end_color(g_end_color.str);
+		for(int fd = 0; fd < 3; ++fd){
+			g_is_tty[fd] = ::isatty(fd);
+		}
+	}
+	::pthread_once_t g_output_cache_once = PTHREAD_ONCE_INIT;
+
+	bool is_tty(int output_fd){
+		::pthread_once(&g_output_cache_once, &init_output_cache);
+		return g_is_tty[output_fd];
+	}
+	// 调用之前必须调用过 is_tty()。
+	void put_begin_color(StreamBuffer &buf, int flags){
+		const AUTO_REF(color, g_begin_colors.at(static_cast<unsigned>(flags) & 077));
+		buf.put(color.str, color.len);
+	}
+	void put_end_color(StreamBuffer &buf){
+		buf.put(g_end_color.str, g_end_color.len);
+	}
+
+	// 同一个线程在同一毫秒内写出的多条日志共用格式化之后的时间。线程号同理，日志线程中会随记录变化。
+	__thread boost::uint64_t t_last_time = 0;
+	__thread char t_last_time_str[64];
+	__thread std::size_t t_last_time_len = 0;
+	__thread unsigned long t_last_tid = 0;
+	__thread char t_last_tid_str[32];
+	__thread std::size_t t_last_tid_len = 0;
+
+	void put_time(StreamBuffer &buf, boost::uint64_t local_time){
+		if((t_last_time_len == 0) || (t_last_time != local_time)){
+			t_last_time_len = format_time(t_last_time_str, sizeof(t_last_time_str), local_time, true);
+			t_last_time = local_time;
+		}
+		buf.put(t_last_time_str, t_last_time_len);
+	}
+	void put_tid(StreamBuffer &buf, unsigned long tid){
+		if((t_last_tid_len == 0) || (t_last_tid != tid)){
+			t_last_tid_len = (unsigned)std::sprintf(t_last_tid_str, "%5lu", tid);
+			t_last_tid = tid;
+		}
+		buf.put(t_last_tid_str, t_last_tid_len);
+	}
+
+	void format_line(StreamBuffer &buf, const LevelElement *lc, bool output_color, boost::uint64_t local_time,
+		const char *tag, unsigned long tid, StreamBuffer &text, const char *file, std::size_t line, const TraceContext &trace)
+	{
+		char str[64];
+		std::size_t len;
+		// Append the timestamp in brightred (when outputting to stderr) or green (when outputting to stdout).
+		if(output_color){
+			put_begin_color(buf, lc->to_stderr ? (CFG_RED | CFL_BRIGHT) : CFG_GREEN);
+		}
+		put_time(buf, local_time);
+		if(output_color){
+			put_end_color(buf);
+		}
+		buf.put(' ');
+		// Append the thread tag in reverse brightred (when outputting to stderr) or yellow (when outputting to stdout).
+		if(output_color){
+			put_begin_color(buf, (lc->to_stderr ? (CFG_RED | CFL_BRIGHT) : CFG_YELLOW) ^ CFL_REVERSE);
+		}
+		buf.put(tag, sizeof(t_tag) - 1);
+		if(output_color){
+			put_end_color(buf);
+		}
+		buf.put(' ');
+		// Append the thread id in brightred (when outputting to stderr) or yellow (when outputting to stdout).
+		if(output_color){
+			put_begin_color(buf, lc->to_stderr ? (CFG_RED | CFL_BRIGHT) : CFG_YELLOW);
+		}
+		put_tid(buf, tid);
+		if(output_color){
+			put_end_color(buf);
+		}
+		buf.put(' ');
+		// Append the level name in reverse color.
+		if(output_color){
+			put_begin_color(buf, lc->color ^ CFL_REVERSE);
+		}
+		buf.put(lc->name);
+		if(output_color){
+			put_end_color(buf);
+		}
+		buf.put(' ');
+		// Append the log data.
+		if(output_color){
+			put_begin_color(buf, lc->color);
+		}
+		buf.splice(text);
+		if(output_color){
+			put_end_color(buf);
+		}
+		buf.put(' ');
+		// Append the file name and line number in blue.
+		if(output_color){
+			put_begin_color(buf, CFG_BLUE);
+		}
+		buf.put("### ");
+		buf.put(file);
+		len = (unsigned)std::sprintf(str, ":%lu", (unsigned long)line);
+		buf.put(str, len);
+		// Append the trace id and span id, if any.
+		if(trace.is_valid()){
+			len = (unsigned)std::sprintf(str, " trace=%016llx%016llx/%016llx",
+				(unsigned long long)trace.trace_id_high, (unsigned long long)trace.trace_id_low, (unsigned long long)trace.span_id);
+			buf.put(str, len);
+		}
+		// Restore the color and end this line of log.
+		if(output_color){
+			put_end_color(buf);
+		}
+		buf.put('\n');
+	}
+
+	// 延迟格式化。
+	// 每个参数依次是一个字节的类型和原始值，字符串是 std::size_t 的长度和内容，由 expand_args() 展开为与立即格式化相同的文本。
+	enum {
+		ARG_BOOL    = 'b',
+		ARG_CHAR    = 'c',
+		ARG_INT     = 'i', // boost::int64_t
+		ARG_UINT    = 'u', // boost::uint64_t
+		ARG_DOUBLE  = 'd',
+		ARG_POINTER = 'p', // boost::uintptr_t
+		ARG_STRING  = 's',
+		ARG_TEXT    = 't', // operator<< 的输出
+	};
+
+	template<typename T>
+	void put_arg(StreamBuffer &args, int type, const T &val){
+		args.put(type);
+		args.put(&val, sizeof(val));
+	}
+	void put_arg_string(StreamBuffer &args, int type, const void *data, std::size_t size){
+		args.put(type);
+		args.put(&size, sizeof(size));
+		args.put(data, size);
+	}
+
+	template<typename T>
+	T get_arg(StreamBuffer &args){
+		T val = T();
+		args.get(&val, sizeof(val));
+		return val;
+	}
+
+	void json_put_string(StreamBuffer &buf, const StreamBuffer &str){
+		buf.put('\"');
+		StreamBuffer::EnumerationCookie cookie;
+		const void *data;
+		std::size_t size;
+		while(str.enumerate_chunk(&data, &size, cookie)){
+			for(std::size_t i = 0; i < size; ++i){
+				const unsigned ch = static_cast<const unsigned char *>(data)[i];
+				switch(ch){
+				case '\"':
+					buf.put("\\\"");
+					break;
+				case '\\':
+					buf.put("\\\\");
+					break;
+				case '\n':
+					buf.put("\\n");
+					break;
+				case '\r':
+					buf.put("\\r");
+					break;
+				case '\t':
+					buf.put("\\t");
+					break;
+				default:
+					if((ch < 0x20) || (ch == 0x7F)){
+						char temp[8];
+						const AUTO(len, (unsigned)std::sprintf(temp, "\\u%04X", ch));
+						buf.put(temp, len);
+						break;
+					}
+					buf.put(static_cast<int>(ch));
+					break;
+				}
+			}
+		}
+		buf.put('\"');
+	}
+	void json_put_string(StreamBuffer &buf, const char *str){
+		StreamBuffer temp;
+		temp.put(str);
+		json_put_string(buf, temp);
+	}
+
+	// 把 args 展开为文本。如果 json_args 不为空，同时把每个参数以 JSON 数组元素的形式追加到其中。
+	void expand_args(StreamBuffer &text, StreamBuffer *json_args, StreamBuffer &args){
+		Buffer_ostream os;
+		os <<std::boolalpha;
+		char str[64];
+		std::size_t len;
+		for(;;){
+			const int type = args.get();
+			if(type < 0){
+				break;
+			}
+			if(json_args && !json_args->empty()){
+				json_args->put(',');
+			}
+			switch(type){
+			case ARG_BOOL: {
+				const bool val = get_arg<unsigned char>(args) != 0;
+				os <<val;
+				if(json_args){
+					json_args->put(val ? "true" : "false");
+				}
+				break; }
+			case ARG_CHAR: {
+				const char val = get_arg<char>(args);
+				os <<val;
+				if(json_args){
+					StreamBuffer temp;
+					temp.put(val);
+					json_put_string(*json_args, temp);
+				}
+				break; }
+			case ARG_INT: {
+				const long long val = get_arg<boost::int64_t>(args);
+				os <<val;
+				if(json_args){
+					len = (unsigned)std::sprintf(str, "%lld", val);
+					json_args->put(str, len);
+				}
+				break; }
+			case ARG_UINT: {
+				const unsigned long long val = get_arg<boost::uint64_t>(args);
+				os <<val;
+				if(json_args){
+					len = (unsigned)std::sprintf(str, "%llu", val);
+					json_args->put(str, len);
+				}
+				break; }
+			case ARG_DOUBLE: {
+				const double val = get_arg<double>(args);
+				os <<val;
+				if(json_args){
+					if(std::isfinite(val)){
+						len = (unsigned)std::sprintf(str, "%.17g", val);
+						json_args->put(str, len);
+					} else {
+						json_args->put("null");
+					}
+				}
+				break; }
+			case ARG_POINTER: {
+				const AUTO(val, reinterpret_cast<const void *>(get_arg<boost::uintptr_t>(args)));
+				os <<val;
+				if(json_args){
+					Buffer_ostream temp;
+					temp <<val;
+					json_put_string(*json_args, temp.get_buffer());
+				}
+				break; }
+			case ARG_STRING:
+			case ARG_TEXT: {
+				const AUTO(size, get_arg<std::size_t>(args));
+				AUTO(piece, args.cut_off(size));
+				if(json_args){
+					json_put_string(*json_args, piece);
+				}
+				os.get_buffer().splice(piece);
+				break; }
+			default:
+				// 不应该发生。
+				os <<"<invalid argument type " <<type <<">";
+				args.clear();
+				break;
+			}
+		}
+		text.splice(os.get_buffer());
+	}
+
+	void format_json_line(StreamBuffer &buf, const LevelElement *lc, boost::uint64_t local_time,
+		const char *tag, unsigned long tid, const StreamBuffer &text, const StreamBuffer *json_args, const char *file, std::size_t line, const TraceContext &trace)
+	{
+		char str[256];
+		std::size_t len;
+		buf.put("{\"time\":\"");
+		put_time(buf, local_time);
+		buf.put("\",\"level\":\"");
+		len = std::strlen(lc->name);
+		while((len > 0) && (lc->name[len - 1] == ' ')){
+			--len;
+		}
+		buf.put(lc->name, len);
+		buf.put("\",\"tag\":");
+		std::memcpy(str, tag, sizeof(t_tag) - 1);
+		str[sizeof(t_tag) - 1] = 0;
+		json_put_string(buf, str);
+		len = (unsigned)std::sprintf(str, ",\"tid\":%lu,\"message\":", tid);
+		buf.put(str, len);
+		json_put_string(buf, text);
+		if(json_args){
+			buf.put(",\"args\":[");
+			buf.put(*json_args);
+			buf.put(']');
+		}
+		if(trace.is_valid()){
+			len = (unsigned)std::sprintf(str, ",\"trace_id\":\"%016llx%016llx\",\"span_id\":\"%016llx\"",
+				(unsigned long long)trace.trace_id_high, (unsigned long long)trace.trace_id_low, (unsigned long long)trace.span_id);
+			buf.put(str, len);
+		}
+		buf.put(",\"file\":");
+		json_put_string(buf, file);
+		len = (unsigned)std::sprintf(str, ",\"line\":%lu}\n", (unsigned long)line);
+		buf.put(str, len);
+	}
+
+	// 以下变量只在 async_start() 中设置。
+	bool g_json_output = false;
+	bool g_deferred_format = false;
+
+	// deferred 为 true 时 payload 是参数的类型和原始值，否则是文本。
+	void render_line(StreamBuffer &buf, const LevelElement *lc, bool output_color, boost::uint64_t local_time,
+		const char *tag, unsigned long tid, StreamBuffer &payload, bool deferred, const char *file, std::size_t line, const TraceContext &trace)
+	{
+		StreamBuffer json_args;
+		if(deferred){
+			StreamBuffer text;
+			expand_args(text, g_json_output ? &json_args : NULLPTR, payload);
+			payload.swap(text);
+		}
+		if(g_json_output){
+			format_json_line(buf, lc, local_time, tag, tid, payload, deferred ? &json_args : NULLPTR, file, line, trace);
+		} else {
+			format_line(buf, lc, output_color, local_time, tag, tid, payload, file, line, trace);
+		}
+	}
+
+	// 同步的日志和日志线程都在持有这个锁时写出，一行不会被截断。
+	::pthread_mutex_t g_write_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+	class LockGuard : NONCOPYABLE {
+	public:
+		LockGuard() NOEXCEPT {
+			int err_code = ::pthread_mutex_lock(&g_write_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+		~LockGuard() NOEXCEPT {
+			int err_code = ::pthread_mutex_unlock(&g_write_mutex);
+			(void)err_code;
+			assert(err_code == 0);
+		}
+	};
+
+	// 调用者必须持有 g_write_mutex。每次最多写出 IOV_MAX 个数据块。
+	void write_buffer(int output_fd, StreamBuffer &buf) NOEXCEPT {
+		::iovec vec[IOV_MAX];
+		while(!buf.empty()){
+			std::size_t count = 0;
+			const void *data;
+			std::size_t size;
+			StreamBuffer::EnumerationCookie cookie;
+			while((count < IOV_MAX) && buf.enumerate_chunk(&data, &size, cookie)){
+				vec[count].iov_base = const_cast<void *>(data);
+				vec[count].iov_len = size;
+				++count;
+			}
+			const ::ssize_t written = ::writev(output_fd, vec, static_cast<int>(count));
+			if(written <= 0){
+				if((written < 0) && (errno == EINTR)){
+					continue;
+				}
+				break;
+			}
+			buf.discard(static_cast<std::size_t>(written));
+		}
+	}
+
+	// 文件输出。
+	// 日志写入 log_file_path 之后，按照大小和时间切换到新的文件，旧的文件可以在单独的线程中压缩。
+	// 以下结构只在持有 g_write_mutex 时访问。
+
+	struct FileSink {
+		std::string path;
+		int fd;
+		boost::uint64_t size;
+		boost::uint64_t period;
+		StreamBuffer pending;
+		boost::uint64_t last_flush;
+	};
+
+	// 以下变量只在 open_file_sinks() 中设置。
+	// 下标 0 对应原来写到 stdout 的日志，下标 1 对应原来写到 stderr 的日志（WARN、ERROR、FATAL），两者可以是同一个文件。
+	boost::shared_ptr<FileSink> g_sinks[2];
+	std::size_t g_file_buffer_size = 0;
+	boost::uint64_t g_file_max_size = 0;
+	boost::uint64_t g_file_rotate_interval = 0;
+	bool g_file_copy_to_console = false;
+	bool g_file_compress = false;
+
+	Mutex g_compress_mutex;
+	ConditionVariable g_compress_avail;
+	bool g_compress_running = false;
+	boost::container::deque<std::string> g_compress_queue;
+	Thread g_compress_thread;
+
+	int open_log_file(const std::string &path, boost::uint64_t &size) NOEXCEPT {
+		const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if(fd < 0){
+			size = 0;
+			return -1;
+		}
+		struct ::stat st;
+		if(::fstat(fd, &st) == 0){
+			size = static_cast<boost::uint64_t>(st.st_size);
+		} else {
+			size = 0;
+		}
+		return fd;
+	}
+
+	// 把 path.gz.tmp 写完之后再改名，压缩失败时保留原来的文件。
+	void compress_log_file(const std::string &path){
+		const std::string gz_path = path + ".gz";
+		const std::string tmp_path = gz_path + ".tmp";
+		const int in_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(in_fd < 0){
+			return;
+		}
+		const int out_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if(out_fd < 0){
+			::close(in_fd);
+			return;
+		}
+		bool succeeded = false;
+		try {
+			Deflator deflator(true);
+			boost::scoped_array<char> chunk(new char[65536]);
+			for(;;){
+				const ::ssize_t n_read = ::read(in_fd, chunk.get(), 65536);
+				if(n_read < 0){
+					if(errno == EINTR){
+						continue;
+					}
+					break;
+				}
+				if(n_read == 0){
+					AUTO(compressed, deflator.finalize());
+					write_buffer(out_fd, compressed);
+					succeeded = compressed.empty();
+					break;
+				}
+				deflator.put(chunk.get(), static_cast<std::size_t>(n_read));
+				write_buffer(out_fd, deflator.get_buffer());
+				if(!deflator.get_buffer().empty()){
+					break;
+				}
+			}
+		} catch(...){
+			succeeded = false;
+		}
+		succeeded = (::close(out_fd) == 0) && succeeded;
+		::close(in_fd);
+		if(succeeded && (::rename(tmp_path.c_str(), gz_path.c_str()) == 0)){
+			::unlink(path.c_str());
+		} else {
+			::unlink(tmp_path.c_str());
+		}
+	}
+
+	void compress_thread_proc(){
+		for(;;){
+			std::string path;
+			{
+				Mutex::UniqueLock lock(g_compress_mutex);
+				while(g_compress_running && g_compress_queue.empty()){
+					g_compress_avail.wait(lock);
+				}
+				if(g_compress_queue.empty()){
+					break;
+				}
+				path.swap(g_compress_queue.front());
+				g_compress_queue.pop_front();
+			}
+			compress_log_file(path);
+		}
+	}
+
+	void flush_sink(FileSink &sink){
+		sink.size += sink.pending.size();
+		sink.last_flush = get_coarse_mono_clock();
+		if(sink.fd < 0){
+			sink.pending.clear();
+			return;
+		}
+		write_buffer(sink.fd, sink.pending);
+		sink.pending.clear();
+	}
+
+	// 调用之前 sink.pending 必须是空的。
+	void rotate_sink(FileSink &sink){
+		const AUTO(dt, break_down_time(get_local_time()));
+		char str[64];
+		std::sprintf(str, ".%04u%02u%02u-%02u%02u%02u", dt.yr, dt.mon, dt.day, dt.hr, dt.min, dt.sec);
+		std::string rotated = sink.path + str;
+		// 同一秒内切换多次时加上序号。压缩之后原来的文件名不再存在，因此也要检查 .gz 文件。
+		for(unsigned i = 1; (::access(rotated.c_str(), F_OK) == 0) || (::access((rotated + ".gz").c_str(), F_OK) == 0); ++i){
+			std::sprintf(str, ".%04u%02u%02u-%02u%02u%02u.%u", dt.yr, dt.mon, dt.day, dt.hr, dt.min, dt.sec, i);
+			rotated = sink.path + str;
+		}
+		if(sink.fd >= 0){
+			::close(sink.fd);
+		}
+		const bool renamed = ::rename(sink.path.c_str(), rotated.c_str()) == 0;
+		sink.fd = open_log_file(sink.path, sink.size);
+		if(renamed && g_file_compress){
+			const Mutex::UniqueLock lock(g_compress_mutex);
+			g_compress_queue.push_back(STD_MOVE(rotated));
+			g_compress_avail.signal();
+		}
+	}
+
+	// buffered 为 false 时立即写出。
+	void append_to_sink(FileSink &sink, StreamBuffer &buf, bool buffered){
+		if(g_file_rotate_interval != 0){
+			const AUTO(period, get_local_time() / g_file_rotate_interval);
+			if(sink.period != period){
+				flush_sink(sink);
+				if((sink.period != 0) && (sink.size != 0)){
+					rotate_sink(sink);
+				}
+				sink.period = period;
+			}
+		}
+		if((g_file_max_size != 0) && (sink.size + sink.pending.size() + buf.size() > g_file_max_size)){
+			flush_sink(sink);
+			if(sink.size != 0){
+				rotate_sink(sink);
+			}
+		}
+		sink.pending.splice(buf);
+		if(!buffered || (sink.pending.size() >= g_file_buffer_size) || (get_coarse_mono_clock() - sink.last_flush >= 1000)){
+			flush_sink(sink);
+		}
+	}
+
+	bool use_color(unsigned index){
+		if(g_sinks[index]){
+			return false;
+		}
+		return is_tty(index ? STDERR_FILENO : STDOUT_FILENO);
+	}
+
+	// 调用者必须持有 g_write_mutex。
+	void write_output(unsigned index, StreamBuffer &buf, bool buffered){
+		const int output_fd = index ? STDERR_FILENO : STDOUT_FILENO;
+		const AUTO_REF(sink, g_sinks[index]);
+		if(!sink){
+			write_buffer(output_fd, buf);
+			return;
+		}
+		if(g_file_copy_to_console){
+			StreamBuffer copy(buf);
+			write_buffer(output_fd, copy);
+		}
+		// WARN 以上的日志总是立即写出。
+		append_to_sink(*sink, buf, buffered && (index == 0));
+	}
+
+	// 日志线程空闲时调用，写出超过一秒的缓冲数据。
+	void flush_idle_sinks(){
+		const LockGuard lock;
+		for(unsigned index = 0; index < 2; ++index){
+			const AUTO_REF(sink, g_sinks[index]);
+			if(sink && !sink->pending.empty() && (get_coarse_mono_clock() - sink->last_flush >= 1000)){
+				flush_sink(*sink);
+			}
+		}
+	}
+
+	void open_file_sinks(){
+		const AUTO(path, MainConfig::get<std::string>("log_file_path"));
+		if(path.empty()){
+			return;
+		}
+		const LockGuard lock;
+		if(g_sinks[0]){
+			return;
+		}
+		g_file_buffer_size = MainConfig::get<std::size_t>("log_file_buffer_size", 65536);
+		g_file_max_size = MainConfig::get<boost::uint64_t>("log_file_max_size", 0);
+		g_file_rotate_interval = MainConfig::get<boost::uint64_t>("log_file_rotate_interval", 0) * 1000;
+		g_file_copy_to_console = MainConfig::get<bool>("log_file_copy_to_console", false);
+		g_file_compress = MainConfig::get<bool>("log_file_compress", false);
+
+		const AUTO(error_path, MainConfig::get<std::string>("log_file_error_path"));
+		for(unsigned index = 0; index < 2; ++index){
+			const AUTO_REF(sink_path, ((index == 0) || error_path.empty()) ? path : error_path);
+			if((index == 1) && (sink_path == path)){
+				g_sinks[1] = g_sinks[0];
+				break;
+			}
+			const AUTO(sink, boost::make_shared<FileSink>());
+			sink->path = sink_path;
+			sink->fd = open_log_file(sink_path, sink->size);
+			if(sink->fd < 0){
+				const int err_code = errno;
+				char str[256];
+				const AUTO(len, (unsigned)std::sprintf(str, "Could not open log file, falling back to stdout/stderr: errno = %d\n", err_code));
+				StreamBuffer buf;
+				buf.put(str, len);
+				write_buffer(STDERR_FILENO, buf);
+				g_sinks[0].reset();
+				return;
+			}
+			sink->period = g_file_rotate_interval ? get_local_time() / g_file_rotate_interval : 0;
+			sink->last_flush = get_coarse_mono_clock();
+			g_sinks[index] = sink;
+		}
+
+		if(g_file_compress){
+			g_compress_running = true;
+			Thread(&compress_thread_proc, sslit("  LZ"), sslit("Log compressor")).swap(g_compress_thread);
+		}
+	}
+	// 写出缓冲的数据，等待所有的压缩任务完成。文件保持打开，此后的日志直接写入。
+	void stop_file_sinks() NOEXCEPT {
+		{
+			const LockGuard lock;
+			for(unsigned index = 0; index < 2; ++index){
+				const AUTO_REF(sink, g_sinks[index]);
+				if(sink){
+					flush_sink(*sink);
+				}
+			}
+		}
+		if(!g_compress_thread.joinable()){
+			return;
+		}
+		{
+			const Mutex::UniqueLock lock(g_compress_mutex);
+			g_compress_running = false;
+			g_compress_avail.signal();
+		}
+		try {
+			g_compress_thread.join();
+		} catch(...){
+			std::abort();
+		}
+		Thread().swap(g_compress_thread);
+	}
+
+	// 异步模式。
+	// 每个线程第一次写日志时创建自己的环形缓冲区，只有这个线程写入，只有日志线程读取，因此不需要加锁。
+
+	struct Record {
+		unsigned level;
+		boost::uint64_t local_time;
+		char tag[sizeof(t_tag)];
+		unsigned long tid;
+		StreamBuffer text;
+		bool deferred;
+		const char *file;
+		std::size_t line;
+		TraceContext trace;
+	};
+
+	bool record_time_less(const Record *lhs, const Record *rhs){
+		return lhs->local_time < rhs->local_time;
+	}
+
+	class Ring : NONCOPYABLE {
+	private:
+		const std::size_t m_mask;
+		boost::scoped_array<Record> m_records;
+		volatile std::size_t m_read;
+		volatile std::size_t m_write;
+		volatile bool m_abandoned;
+
+	public:
+		explicit Ring(std::size_t capacity_pow2)
+			: m_mask(capacity_pow2 - 1), m_records(new Record[capacity_pow2]), m_read(0), m_write(0), m_abandoned(false)
+		{ }
+
+	public:
+		bool is_abandoned() const NOEXCEPT {
+			return atomic_load(m_abandoned, ATOMIC_ACQUIRE);
+		}
+		void abandon() NOEXCEPT {
+			atomic_store(m_abandoned, true, ATOMIC_RELEASE);
+		}
+		bool empty() const NOEXCEPT {
+			return atomic_load(m_read, ATOMIC_RELAXED) == atomic_load(m_write, ATOMIC_ACQUIRE);
+		}
+
+		// 只在所属的线程中调用。
+		Record *begin_push() NOEXCEPT {
+			const AUTO(write, atomic_load(m_write, ATOMIC_RELAXED));
+			if(write - atomic_load(m_read, ATOMIC_ACQUIRE) > m_mask){
+				return NULLPTR;
+			}
+			return &m_records.get()[write & m_mask];
+		}
+		void end_push() NOEXCEPT {
+			atomic_add(m_write, 1, ATOMIC_RELEASE);
+		}
+
+		// 只在日志线程中调用。
+		bool pop(Record &rec) NOEXCEPT {
+			const AUTO(read, atomic_load(m_read, ATOMIC_RELAXED));
+			if(read == atomic_load(m_write, ATOMIC_ACQUIRE)){
+				return false;
+			}
+			AUTO_REF(slot, m_records.get()[read & m_mask]);
+			rec.level = slot.level;
+			rec.local_time = slot.local_time;
+			std::memcpy(rec.tag, slot.tag, sizeof(slot.tag));
+			rec.tid = slot.tid;
+			rec.text.swap(slot.text);
+			slot.text.clear();
+			rec.deferred = slot.deferred;
+			rec.file = slot.file;
+			rec.line = slot.line;
+			rec.trace = slot.trace;
+			atomic_store(m_read, read + 1, ATOMIC_RELEASE);
+			return true;
+		}
+	};
+
+	volatile bool g_async_running = false;
+	volatile std::size_t g_async_producers = 0;
+	volatile boost::uint64_t g_dropped = 0;
+
+	// 以下变量只在 async_start() 中设置。
+	std::size_t g_ring_capacity = 0;
+	bool g_block_on_overflow = false;
+	::pthread_key_t g_ring_key;
+
+	Mutex g_async_mutex;
+	ConditionVariable g_async_avail;
+	volatile bool g_async_sleeping = false;
+	boost::container::vector<boost::shared_ptr<Ring> > g_rings;
+	Thread g_async_thread;
+
+	__thread Ring *t_ring = 0; // XXX: NULLPTR
+	__thread bool t_is_log_thread = false;
+
+	void ring_key_destructor(void *ring) NOEXCEPT {
+		// 日志线程在写出剩余的记录之后删除它。此后这个线程如果再写日志，会创建新的缓冲区。
+		t_ring = 0; // XXX: NULLPTR
+		static_cast<Ring *>(ring)->abandon();
+	}
+
+	Ring *require_ring(){
+		if(t_ring){
+			return t_ring;
+		}
+		const AUTO(ring, boost::make_shared<Ring>(g_ring_capacity));
+		{
+			const Mutex::UniqueLock lock(g_async_mutex);
+			g_rings.push_back(ring);
+		}
+		::pthread_setspecific(g_ring_key, ring.get());
+		t_ring = ring.get();
+		return t_ring;
+	}
+
+	void wake_log_thread() NOEXCEPT {
+		if(!atomic_load(g_async_sleeping, ATOMIC_ACQUIRE)){
+			return;
+		}
+		const Mutex::UniqueLock lock(g_async_mutex);
+		g_async_avail.signal();
+	}
+
+	// 以下函数使用 g_async_producers 保证 async_stop() 返回之后不会有记录留在缓冲区中。
+	bool enqueue_async(unsigned level, boost::uint64_t local_time, StreamBuffer &text, bool deferred, const char *file, std::size_t line){
+		if(t_is_log_thread){
+			return false;
+		}
+		atomic_add(g_async_producers, 1, ATOMIC_ACQ_REL);
+		try {
+			bool queued = false;
+			if(atomic_load(g_async_running, ATOMIC_ACQUIRE)){
+				const AUTO(ring, require_ring());
+				Record *rec;
+				for(;;){
+					rec = ring->begin_push();
+					if(rec){
+						break;
+					}
+					if(!g_block_on_overflow){
+						atomic_add(g_dropped, 1, ATOMIC_RELAXED);
+						break;
+					}
+					wake_log_thread();
+					::sched_yield();
+				}
+				if(rec){
+					rec->level = level;
+					rec->local_time = local_time;
+					std::memcpy(rec->tag, t_tag, sizeof(t_tag));
+					rec->tid = t_tid;
+					rec->text.swap(text);
+					rec->deferred = deferred;
+					rec->file = file;
+					rec->line = line;
+					rec->trace = get_current_trace_context();
+					ring->end_push();
+					wake_log_thread();
+				}
+				// 丢弃的记录也算作已经处理了。
+				queued = true;
+			}
+			atomic_sub(g_async_producers, 1, ATOMIC_ACQ_REL);
+			return queued;
+		} catch(...){
+			atomic_sub(g_async_producers, 1, ATOMIC_ACQ_REL);
+			throw;
+		}
+	}
+
+	// 从所有缓冲区中取出记录，按照时间排序之后格式化，每个文件描述符调用一次 writev()。返回写出的记录数。
+	std::size_t flush_rings(boost::uint64_t &dropped_reported){
+		boost::container::vector<boost::shared_ptr<Ring> > rings;
+		{
+			const Mutex::UniqueLock lock(g_async_mutex);
+			// 线程已经退出，并且记录都已经写出的缓冲区可以删除了。
+			AUTO(it, g_rings.begin());
+			while(it != g_rings.end()){
+				if((*it)->is_abandoned() && (*it)->empty()){
+					it = g_rings.erase(it);
+					continue;
+				}
+				++it;
+			}
+			rings = g_rings;
+		}
+
+		boost::container::deque<Record> records;
+		for(AUTO(it, rings.begin()); it != rings.end(); ++it){
+			for(;;){
+				records.push_back(Record());
+				if(!(*it)->pop(records.back())){
+					records.pop_back();
+					break;
+				}
+			}
+		}
+		const AUTO(dropped, atomic_load(g_dropped, ATOMIC_RELAXED));
+		if(dropped != dropped_reported){
+			Record rec = { 2, get_local_time(), { }, t_tid, StreamBuffer(), false, __FILE__, __LINE__, get_current_trace_context() };
+			std::memcpy(rec.tag, t_tag, sizeof(t_tag));
+			char str[64];
+			const AUTO(len, (unsigned)std::sprintf(str, "%llu log record(s) dropped due to overflow", (unsigned long long)(dropped - dropped_reported)));
+			rec.text.put(str, len);
+			records.push_back(STD_MOVE(rec));
+			dropped_reported = dropped;
+		}
+		if(records.empty()){
+			return 0;
+		}
+
+		boost::container::vector<const Record *> sorted;
+		sorted.reserve(records.size());
+		for(AUTO(it, records.begin()); it != records.end(); ++it){
+			sorted.push_back(&*it);
+		}
+		// 同一个线程的记录时间不会倒退，因此稳定排序之后仍然保持原来的顺序。
+		std::stable_sort(sorted.begin(), sorted.end(), &record_time_less);
+
+		const bool output_color[2] = { use_color(0), use_color(1) };
+		StreamBuffer bufs[2];
+		for(AUTO(it, sorted.begin()); it != sorted.end(); ++it){
+			AUTO_REF(rec, const_cast<Record &>(**it));
+			const LevelElement *const lc = &s_levels.at(rec.level);
+			render_line(bufs[lc->to_stderr], lc, output_color[lc->to_stderr], rec.local_time, rec.tag, rec.tid, rec.text, rec.deferred, rec.file, rec.line, rec.trace);
+		}
+		const LockGuard lock;
+		write_output(0, bufs[0], true);
+		write_output(1, bufs[1], true);
+		return records.size();
+	}
+
+	void async_thread_proc(){
+		t_is_log_thread = true;
+		t_tid = static_cast<unsigned long>(::syscall(SYS_gettid));
+
+		boost::uint64_t dropped_reported = atomic_load(g_dropped, ATOMIC_RELAXED);
+		for(;;){
+			while(flush_rings(dropped_reported) != 0){
+				// 继续。
+			}
+			flush_idle_sinks();
+
+			Mutex::UniqueLock lock(g_async_mutex);
+			if(!atomic_load(g_async_running, ATOMIC_CONSUME) && (atomic_load(g_async_producers, ATOMIC_ACQUIRE) == 0)){
+				break;
+			}
+			// 设置 g_async_sleeping 之后再检查一次，否则可能错过唤醒。
+			atomic_store(g_async_sleeping, true, ATOMIC_SEQ_CST);
+			bool empty = true;
+			for(AUTO(it, g_rings.begin()); empty && (it != g_rings.end()); ++it){
+				empty = (*it)->empty();
+			}
+			if(empty){
+				g_async_avail.timed_wait(lock, 100);
+			}
+			atomic_store(g_async_sleeping, false, ATOMIC_RELEASE);
+		}
+		flush_rings(dropped_reported);
+	}
+
+	void create_ring_key(){
+		if(::pthread_key_create(&g_ring_key, &ring_key_destructor) != 0){
+			std::abort();
+		}
+	}
+	::pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+
+	void async_start(){
+		g_json_output = MainConfig::get<bool>("log_json_enabled", false);
+		if(!MainConfig::get<bool>("log_async_enabled", false)){
+			return;
+		}
+		if(atomic_load(g_async_running, ATOMIC_CONSUME)){
+			return;
+		}
+		std::size_t capacity = 1;
+		const AUTO(configured, MainConfig::get<std::size_t>("log_async_buffer_size", 4096));
+		while((capacity < configured) && (capacity < 0x100000)){
+			capacity <<= 1;
+		}
+		g_ring_capacity = capacity;
+		g_block_on_overflow = MainConfig::get<bool>("log_async_block_on_overflow", false);
+		g_deferred_format = MainConfig::get<bool>("log_async_deferred_format", false);
+		::pthread_once(&g_ring_key_once, &create_ring_key);
+
+		atomic_store(g_async_running, true, ATOMIC_RELEASE);
+		Thread(&async_thread_proc, sslit("   L"), sslit("Log")).swap(g_async_thread);
+	}
+	void async_stop() NOEXCEPT {
+		if(!atomic_exchange(g_async_running, false, ATOMIC_ACQ_REL)){
+			return;
+		}
+		{
+			const Mutex::UniqueLock lock(g_async_mutex);
+			g_async_avail.signal();
+		}
+		// 日志线程在没有线程正在写入并且所有的记录都已经写出之后退出。
+		try {
+			g_async_thread.join();
+		} catch(...){
+			std::abort();
+		}
+		Thread().swap(g_async_thread);
+	}
 }
 
 boost::uint64_t Logger::get_mask() NOEXCEPT {
@@ -128,6 +1110,45 @@ void Logger::finalize_mask() NOEXCEPT {
 	set_mask(0, SP_POSEIDON | SP_MAJOR | LV_INFO | LV_WARNING | LV_ERROR | LV_FATAL);
 }
 
+bool Logger::throttle_every_n(Logger::Throttle &throttle, boost::uint64_t n, boost::uint64_t &suppressed) NOEXCEPT {
+	const AUTO(count, atomic_add(throttle.state, 1, ATOMIC_RELAXED));
+	if((n > 1) && ((count - 1) % n != 0)){
+		atomic_add(throttle.suppressed, 1, ATOMIC_RELAXED);
+		return false;
+	}
+	suppressed = atomic_exchange(throttle.suppressed, 0, ATOMIC_RELAXED);
+	return true;
+}
+bool Logger::throttle_rate_limited(Logger::Throttle &throttle, boost::uint64_t per_sec, boost::uint64_t &suppressed) NOEXCEPT {
+	// state 的高 40 位是当前窗口开始的时间，低 24 位是这个窗口中已经写出的条数。
+	const boost::uint64_t now = get_coarse_mono_clock() & 0xFFFFFFFFFFull;
+	const boost::uint64_t limit = std::min<boost::uint64_t>(per_sec, 0xFFFFFF);
+	boost::uint64_t old_state = atomic_load(throttle.state, ATOMIC_RELAXED);
+	boost::uint64_t new_state;
+	do {
+		const boost::uint64_t window_begin = old_state >> 24;
+		const boost::uint64_t count = old_state & 0xFFFFFF;
+		if((now < window_begin) || (now - window_begin >= 1000)){
+			new_state = (now << 24) | 1;
+		} else if(count < limit){
+			new_state = old_state + 1;
+		} else {
+			atomic_add(throttle.suppressed, 1, ATOMIC_RELAXED);
+			return false;
+		}
+	} while(!atomic_compare_exchange(throttle.state, old_state, new_state, ATOMIC_RELAXED, ATOMIC_RELAXED));
+	suppressed = atomic_exchange(throttle.suppressed, 0, ATOMIC_RELAXED);
+	return true;
+}
+bool Logger::throttle_sampled(Logger::Throttle &throttle, double probability, boost::uint64_t &suppressed) NOEXCEPT {
+	if(!(random_double() < probability)){
+		atomic_add(throttle.suppressed, 1, ATOMIC_RELAXED);
+		return false;
+	}
+	suppressed = atomic_exchange(throttle.suppressed, 0, ATOMIC_RELAXED);
+	return true;
+}
+
 const char *Logger::get_thread_tag() NOEXCEPT {
 	return t_tag;
 }
@@ -137,169 +1158,191 @@ void Logger::set_thread_tag(const char *tag) NOEXCEPT {
 
 Logger::Logger(boost::uint64_t mask, const char *file, std::size_t line) NOEXCEPT
 	: m_mask(mask), m_file(file), m_line(line)
+	, m_deferred(g_deferred_format && ((mask & LV_FATAL & ~static_cast<boost::uint64_t>(SP_MAJOR)) == 0) && !t_is_log_thread && atomic_load(g_async_running, ATOMIC_RELAXED))
 {
 	m_stream <<std::boolalpha;
 }
 Logger::~Logger() NOEXCEPT
 try {
 	const unsigned level = static_cast<unsigned>(__builtin_ctzl(m_mask | LV_TRACE));
-	const LevelElement *const lc = &s_levels.at(level);
-	const int output_fd = lc->to_stderr ? STDERR_FILENO : STDOUT_FILENO;
-	const bool output_color = ::isatty(output_fd);
-
-	StreamBuffer buf;
-	int flags;
-	char str[256];
-	std::size_t len;
-	// Append the timestamp in brightred (when outputting to stderr) or green (when outputting to stdout).
-	if(output_color){
-		flags = lc->to_stderr ? (CFG_RED | CFL_BRIGHT) : CFG_GREEN;
-		len = begin_color(str, flags);
-		buf.put(str, len);
+	const boost::uint64_t local_time = get_local_time();
+	if(t_tid == 0){
+		t_tid = static_cast<unsigned long>(::syscall(SYS_gettid));
 	}
-	len = format_time(str, sizeof(str), get_local_time(), true);
-	buf.put(str, len);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the thread tag in reverse brightred (when outputting to stderr) or yellow (when outputting to stdout).
-	if(output_color){
-		flags = lc->to_stderr ? (CFG_RED | CFL_BRIGHT) : CFG_YELLOW;
-		flags ^= CFL_REVERSE;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.put(t_tag, sizeof(t_tag) - 1);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the thread id in brightred (when outputting to stderr) or yellow (when outputting to stdout).
-	if(output_color){
-		flags = lc->to_stderr ? (CFG_RED | CFL_BRIGHT) : CFG_YELLOW;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	len = (unsigned)std::sprintf(str, "%5lu", (unsigned long)::syscall(SYS_gettid));
-	buf.put(str, len);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the level name in reverse color.
-	if(output_color){
-		flags = lc->color;
-		flags ^= CFL_REVERSE;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.put(lc->name);
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
+	// FATAL 之后通常紧接着 std::abort()，所以总是同步写出。
+	if((level != 0) && enqueue_async(level, local_time, m_stream.get_buffer(), m_deferred, m_file, m_line)){
+		return;
 	}
-	buf.put(' ');
-	// Append the log data.
-	if(output_color){
-		flags = lc->color;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.splice(m_stream.get_buffer());
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put(' ');
-	// Append the file name and line number in blue.
-	if(output_color){
-		flags = CFG_BLUE;
-		len = begin_color(str, flags);
-		buf.put(str, len);
-	}
-	buf.put("### ");
-	buf.put(m_file);
-	len = (unsigned)std::sprintf(str, ":%lu", (unsigned long)m_line);
-	buf.put(str, len);
-	// Restore the color and end this line of log.
-	if(output_color){
-		len = end_color(str);
-		buf.put(str, len);
-	}
-	buf.put('\n');
 
-	static ::pthread_mutex_t s_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
-	int err_code = ::pthread_mutex_lock(&s_mutex);
-	(void)err_code;
-	assert(err_code == 0);
-	for(;;){
-		len = buf.peek(str, sizeof(str));
-		if(len == 0){
-			break;
-		}
-		::ssize_t written = ::write(output_fd, str, len);
-		if(written <= 0){
-			break;
-		}
-		buf.discard(static_cast<std::size_t>(written));
-	}
-	err_code = ::pthread_mutex_unlock(&s_mutex);
-	assert(err_code == 0);
+	const LevelElement *const lc = &s_levels.at(level);
+	StreamBuffer buf;
+	render_line(buf, lc, use_color(lc->to_stderr), local_time, t_tag, t_tid, m_stream.get_buffer(), m_deferred, m_file, m_line, get_current_trace_context());
+
+	const LockGuard lock;
+	write_output(lc->to_stderr, buf, false);
 } catch(...){
 	return;
 }
 
+void Logger::start_async(){
+	open_file_sinks();
+	async_start();
+}
+void Logger::stop_async() NOEXCEPT {
+	async_stop();
+	stop_file_sinks();
+}
+boost::uint64_t Logger::get_dropped_count() NOEXCEPT {
+	return atomic_load(g_dropped, ATOMIC_RELAXED);
+}
+
 void Logger::put(bool val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_BOOL, static_cast<unsigned char>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(char val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_CHAR, val);
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(signed char val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_INT, static_cast<boost::int64_t>(val));
+		return;
+	}
 	m_stream <<static_cast<int>(val);
 }
 void Logger::put(unsigned char val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_UINT, static_cast<boost::uint64_t>(val));
+		return;
+	}
 	m_stream <<static_cast<unsigned>(val);
 }
 void Logger::put(short val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_INT, static_cast<boost::int64_t>(val));
+		return;
+	}
 	m_stream <<static_cast<int>(val);
 }
 void Logger::put(unsigned short val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_UINT, static_cast<boost::uint64_t>(val));
+		return;
+	}
 	m_stream <<static_cast<unsigned>(val);
 }
 void Logger::put(int val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_INT, static_cast<boost::int64_t>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(unsigned val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_UINT, static_cast<boost::uint64_t>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(long val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_INT, static_cast<boost::int64_t>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(unsigned long val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_UINT, static_cast<boost::uint64_t>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(long long val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_INT, static_cast<boost::int64_t>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(unsigned long long val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_UINT, static_cast<boost::uint64_t>(val));
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(const char *val){
+	if(m_deferred){
+		put_arg_string(m_stream.get_buffer(), ARG_STRING, val, val ? std::strlen(val) : 0);
+		return;
+	}
 	m_stream <<val;
 }
 void Logger::put(const signed char *val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_POINTER, reinterpret_cast<boost::uintptr_t>(val));
+		return;
+	}
 	m_stream <<static_cast<const void *>(val);
 }
 void Logger::put(const unsigned char *val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_POINTER, reinterpret_cast<boost::uintptr_t>(val));
+		return;
+	}
 	m_stream <<static_cast<const void *>(val);
 }
 void Logger::put(const void *val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_POINTER, reinterpret_cast<boost::uintptr_t>(val));
+		return;
+	}
+	m_stream <<val;
+}
+void Logger::put(float val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_DOUBLE, static_cast<double>(val));
+		return;
+	}
+	m_stream <<val;
+}
+void Logger::put(double val){
+	if(m_deferred){
+		put_arg(m_stream.get_buffer(), ARG_DOUBLE, val);
+		return;
+	}
+	m_stream <<val;
+}
+void Logger::put(const std::string &val){
+	if(m_deferred){
+		put_arg_string(m_stream.get_buffer(), ARG_STRING, val.data(), val.size());
+		return;
+	}
 	m_stream <<val;
 }
+void Logger::put(const Logger::Suppressed &val){
+	if(val.count == 0){
+		return;
+	}
+	put(" (");
+	put(static_cast<unsigned long long>(val.count));
+	put(" similar message(s) suppressed)");
+}
+void Logger::put_deferred_text(StreamBuffer &text){
+	AUTO_REF(args, m_stream.get_buffer());
+	const std::size_t size = text.size();
+	args.put(ARG_TEXT);
+	args.put(&size, sizeof(size));
+	args.splice(text);
+}
 
 }
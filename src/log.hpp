@@ -8,6 +8,7 @@
 #include "cxx_util.hpp"
 #include "buffer_streams.hpp"
 #include <cstddef>
+#include <string>
 #include <boost/cstdint.hpp>
 
 namespace Poseidon {
@@ -36,6 +37,33 @@ public:
 	static bool initialize_mask_from_config();
 	static void finalize_mask() NOEXCEPT;
 
+	// 如果 log_async_enabled 为 1，启动日志线程，此后除 FATAL 以外的日志只放入本线程的环形缓冲区，由日志线程格式化并批量写出。
+	// stop_async() 写出所有剩余的记录之后返回。
+	static void start_async();
+	static void stop_async() NOEXCEPT;
+	// log_async_deferred_format 为 1 时，放入缓冲区的不是格式化之后的文本，而是参数的类型和原始值，由日志线程展开。
+	// log_json_enabled 为 1 时每条日志输出为一行 JSON，这个设置在 start_async() 中读取，与 log_async_enabled 无关。
+	// 缓冲区满时丢弃的记录数（log_async_block_on_overflow 为 0 时）。
+	static boost::uint64_t get_dropped_count() NOEXCEPT;
+
+	// 用于 LOG_*_EVERY_N、LOG_*_RATE_LIMITED 和 LOG_*_SAMPLED，每处调用有一个静态的实例，零初始化即可使用。
+	struct Throttle {
+		volatile boost::uint64_t state;
+		volatile boost::uint64_t suppressed;
+	};
+	// 追加在日志的末尾，表示上一次写出之后同一处被丢弃的日志数，为零时不输出。
+	struct Suppressed {
+		boost::uint64_t count;
+	};
+
+	// 返回 true 表示这一条应该写出，此时 suppressed 返回上一次写出之后被丢弃的条数。
+	// throttle_every_n() 写出第 1、n + 1、2n + 1 …… 条。
+	// throttle_rate_limited() 每秒最多写出 per_sec 条，超出的在下一个窗口的第一条日志中汇总。
+	// throttle_sampled() 以 probability 的概率写出。
+	static bool throttle_every_n(Throttle &throttle, boost::uint64_t n, boost::uint64_t &suppressed) NOEXCEPT;
+	static bool throttle_rate_limited(Throttle &throttle, boost::uint64_t per_sec, boost::uint64_t &suppressed) NOEXCEPT;
+	static bool throttle_sampled(Throttle &throttle, double probability, boost::uint64_t &suppressed) NOEXCEPT;
+
 	static const char *get_thread_tag() NOEXCEPT;
 	static void set_thread_tag(const char *tag) NOEXCEPT;
 
@@ -45,6 +73,8 @@ private:
 	const std::size_t m_line;
 
 	Buffer_ostream m_stream;
+	// 为 true 时 m_stream 中保存的是参数的类型和原始值，而不是文本。
+	bool m_deferred;
 
 public:
 	Logger(boost::uint64_t mask, const char *file, std::size_t line) NOEXCEPT;
@@ -68,10 +98,23 @@ private:
 	void put(const signed char *val);
 	void put(const unsigned char *val);
 	void put(const void *val);
+	void put(float val);
+	void put(double val);
+	void put(const std::string &val);
+	void put(const Suppressed &val);
+
+	// 其他类型的 operator<< 只能在这里调用，延迟格式化时保存它的输出。
+	void put_deferred_text(StreamBuffer &text);
 
 	template<typename T>
 	void put(const T &val){
-		m_stream <<val;
+		if(!m_deferred){
+			m_stream <<val;
+			return;
+		}
+		Buffer_ostream os;
+		os <<std::boolalpha <<val;
+		put_deferred_text(os.get_buffer());
 	}
 
 public:
@@ -90,6 +133,24 @@ public:
 #define LOG_MASK(mask_, ...)	    (::Poseidon::Logger::check_mask(mask_) &&	\
                                       (static_cast<void>(::Poseidon::Logger(mask_, __FILE__, __LINE__), __VA_ARGS__), true))
 
+// 以下宏是语句而不是表达式，因为每处调用需要一个静态的 Logger::Throttle。
+#define LOG_MASK_THROTTLED_(throttle_, param_, mask_, ...)	\
+	do {	\
+		if(!::Poseidon::Logger::check_mask(mask_)){	\
+			break;	\
+		}	\
+		static ::Poseidon::Logger::Throttle s_throttle_ = { 0, 0 };	\
+		::Poseidon::Logger::Suppressed suppressed_;	\
+		if(!::Poseidon::Logger::throttle_(s_throttle_, (param_), suppressed_.count)){	\
+			break;	\
+		}	\
+		static_cast<void>(::Poseidon::Logger(mask_, __FILE__, __LINE__), __VA_ARGS__, suppressed_);	\
+	} while(false)
+
+#define LOG_MASK_EVERY_N(mask_, n_, ...)                 LOG_MASK_THROTTLED_(throttle_every_n, n_, mask_, __VA_ARGS__)
+#define LOG_MASK_RATE_LIMITED(mask_, per_sec_, ...)      LOG_MASK_THROTTLED_(throttle_rate_limited, per_sec_, mask_, __VA_ARGS__)
+#define LOG_MASK_SAMPLED(mask_, probability_, ...)       LOG_MASK_THROTTLED_(throttle_sampled, probability_, mask_, __VA_ARGS__)
+
 #define LOG_POSEIDON(level_, ...)   LOG_MASK(::Poseidon::Logger::SP_POSEIDON | (level_), __VA_ARGS__)
 #define LOG_POSEIDON_FATAL(...)     LOG_POSEIDON(::Poseidon::Logger::LV_FATAL,   __VA_ARGS__)
 #define LOG_POSEIDON_ERROR(...)     LOG_POSEIDON(::Poseidon::Logger::LV_ERROR,   __VA_ARGS__)
@@ -98,4 +159,28 @@ public:
 #define LOG_POSEIDON_DEBUG(...)     LOG_POSEIDON(::Poseidon::Logger::LV_DEBUG,   __VA_ARGS__)
 #define LOG_POSEIDON_TRACE(...)     LOG_POSEIDON(::Poseidon::Logger::LV_TRACE,   __VA_ARGS__)
 
+#define LOG_POSEIDON_EVERY_N(level_, n_, ...)               LOG_MASK_EVERY_N(::Poseidon::Logger::SP_POSEIDON | (level_), n_, __VA_ARGS__)
+#define LOG_POSEIDON_FATAL_EVERY_N(n_, ...)                 LOG_POSEIDON_EVERY_N(::Poseidon::Logger::LV_FATAL,   n_, __VA_ARGS__)
+#define LOG_POSEIDON_ERROR_EVERY_N(n_, ...)                 LOG_POSEIDON_EVERY_N(::Poseidon::Logger::LV_ERROR,   n_, __VA_ARGS__)
+#define LOG_POSEIDON_WARNING_EVERY_N(n_, ...)               LOG_POSEIDON_EVERY_N(::Poseidon::Logger::LV_WARNING, n_, __VA_ARGS__)
+#define LOG_POSEIDON_INFO_EVERY_N(n_, ...)                  LOG_POSEIDON_EVERY_N(::Poseidon::Logger::LV_INFO,    n_, __VA_ARGS__)
+#define LOG_POSEIDON_DEBUG_EVERY_N(n_, ...)                 LOG_POSEIDON_EVERY_N(::Poseidon::Logger::LV_DEBUG,   n_, __VA_ARGS__)
+#define LOG_POSEIDON_TRACE_EVERY_N(n_, ...)                 LOG_POSEIDON_EVERY_N(::Poseidon::Logger::LV_TRACE,   n_, __VA_ARGS__)
+
+#define LOG_POSEIDON_RATE_LIMITED(level_, per_sec_, ...)    LOG_MASK_RATE_LIMITED(::Poseidon::Logger::SP_POSEIDON | (level_), per_sec_, __VA_ARGS__)
+#define LOG_POSEIDON_FATAL_RATE_LIMITED(per_sec_, ...)      LOG_POSEIDON_RATE_LIMITED(::Poseidon::Logger::LV_FATAL,   per_sec_, __VA_ARGS__)
+#define LOG_POSEIDON_ERROR_RATE_LIMITED(per_sec_, ...)      LOG_POSEIDON_RATE_LIMITED(::Poseidon::Logger::LV_ERROR,   per_sec_, __VA_ARGS__)
+#define LOG_POSEIDON_WARNING_RATE_LIMITED(per_sec_, ...)    LOG_POSEIDON_RATE_LIMITED(::Poseidon::Logger::LV_WARNING, per_sec_, __VA_ARGS__)
+#define LOG_POSEIDON_INFO_RATE_LIMITED(per_sec_, ...)       LOG_POSEIDON_RATE_LIMITED(::Poseidon::Logger::LV_INFO,    per_sec_, __VA_ARGS__)
+#define LOG_POSEIDON_DEBUG_RATE_LIMITED(per_sec_, ...)      LOG_POSEIDON_RATE_LIMITED(::Poseidon::Logger::LV_DEBUG,   per_sec_, __VA_ARGS__)
+#define LOG_POSEIDON_TRACE_RATE_LIMITED(per_sec_, ...)      LOG_POSEIDON_RATE_LIMITED(::Poseidon::Logger::LV_TRACE,   per_sec_, __VA_ARGS__)
+
+#define LOG_POSEIDON_SAMPLED(level_, probability_, ...)     LOG_MASK_SAMPLED(::Poseidon::Logger::SP_POSEIDON | (level_), probability_, __VA_ARGS__)
+#define LOG_POSEIDON_FATAL_SAMPLED(probability_, ...)       LOG_POSEIDON_SAMPLED(::Poseidon::Logger::LV_FATAL,   probability_, __VA_ARGS__)
+#define LOG_POSEIDON_ERROR_SAMPLED(probability_, ...)       LOG_POSEIDON_SAMPLED(::Poseidon::Logger::LV_ERROR,   probability_, __VA_ARGS__)
+#define LOG_POSEIDON_WARNING_SAMPLED(probability_, ...)     LOG_POSEIDON_SAMPLED(::Poseidon::Logger::LV_WARNING, probability_, __VA_ARGS__)
+#define LOG_POSEIDON_INFO_SAMPLED(probability_, ...)        LOG_POSEIDON_SAMPLED(::Poseidon::Logger::LV_INFO,    probability_, __VA_ARGS__)
+#define LOG_POSEIDON_DEBUG_SAMPLED(probability_, ...)       LOG_POSEIDON_SAMPLED(::Poseidon::Logger::LV_DEBUG,   probability_, __VA_ARGS__)
+#define LOG_POSEIDON_TRACE_SAMPLED(probability_, ...)       LOG_POSEIDON_SAMPLED(::Poseidon::Logger::LV_TRACE,   probability_, __VA_ARGS__)
+
 #endif
@@ -15,6 +15,11 @@
 #include "singletons/event_dispatcher.hpp"
 #include "singletons/filesystem_daemon.hpp"
 #include "singletons/profile_depository.hpp"
+#include "singletons/metrics_registry.hpp"
+#include "singletons/sampling_profiler.hpp"
+#include "singletons/trace_exporter.hpp"
+#include "singletons/hot_restart_daemon.hpp"
+#include "singletons/snapshot_daemon.hpp"
 #include "log.hpp"
 #include "profiler.hpp"
 #include "time.hpp"
@@ -22,7 +27,14 @@
 #include "atomic.hpp"
 #include "checked_arithmetic.hpp"
 #include "system_servlet_base.hpp"
+#include "ssl_factories.hpp"
+#include "tcp_session_base.hpp"
+#include "tick_scheduler.hpp"
+#include "pooled_allocator.hpp"
+#include "heap_allocator.hpp"
 #include "json.hpp"
+#include "json_writer.hpp"
+#include "thread.hpp"
 #include <signal.h>
 
 namespace Poseidon {
@@ -66,6 +78,13 @@ namespace {
 		}
 		return obj;
 	}
+	// 流式输出的 servlet 在参数有误时使用。
+	bool write_error(JsonWriter &writer, const char *error){
+		writer.begin_object();
+		writer.key("error").value(error);
+		writer.end_object();
+		return true;
+	}
 
 	struct SystemServlet_help : public SystemServletBase {
 		const char *get_uri() const FINAL {
@@ -140,6 +159,8 @@ namespace {
 			resp.set(sslit("mask_old"), mask_old.to_string());
 			// .mask_new = current log mask
 			resp.set(sslit("mask_new"), mask_new.to_string());
+			// .dropped_count = number of records dropped by the asynchronous logger
+			resp.set(sslit("dropped_count"), Logger::get_dropped_count());
 		}
 	};
 
@@ -150,28 +171,175 @@ namespace {
 		void handle_get(JsonObject &resp) const FINAL {
 			resp.set(sslit("description"), "Retreive information about incoming and outgoing connections in this process.");
 			static const char *const PARAM_INFO[][2] = {
+				{ "remote_ip", "If set, only sockets whose remote IP address begins with this string are listed." },
+				{ "local_port", "If set, only sockets bound to this local port are listed." },
+				{ "sort_by", "Sort sockets in descending order of this field, which shall be one of `bytes_read`, `bytes_written`,\n"
+				             "`messages_read`, `messages_written`, `send_buffer_size`, `throttled_time`, `last_read_time`,\n"
+				             "`last_write_time` and `creation_time`.\n"
+				             "If this parameter is absent, sockets are not sorted." },
+				{ "limit", "If set, at most this number of sockets are listed.\n"
+				           "Together with `sort_by`, this lists the top N sockets." },
 				{ NULLPTR }
 			};
 			resp.set(sslit("parameters"), make_help(PARAM_INFO));
 		}
-		void handle_post(JsonObject &resp, JsonObject /*req*/) const FINAL {
+
+		enum {
+			SORT_NONE = -1,
+		};
+		static boost::uint64_t get_sort_key(const EpollDaemon::SnapshotElement &elem, int sort_by){
+			switch(sort_by){
+			case 0:
+				return elem.bytes_read;
+			case 1:
+				return elem.bytes_written;
+			case 2:
+				return elem.messages_read;
+			case 3:
+				return elem.messages_written;
+			case 4:
+				return elem.send_buffer_size;
+			case 5:
+				return elem.throttled_time;
+			case 6:
+				return elem.last_read_time;
+			case 7:
+				return elem.last_write_time;
+			default:
+				return elem.creation_time;
+			}
+		}
+		struct SortComparator {
+			int sort_by;
+
+			bool operator()(const EpollDaemon::SnapshotElement &lhs, const EpollDaemon::SnapshotElement &rhs) const {
+				return get_sort_key(lhs, sort_by) > get_sort_key(rhs, sort_by);
+			}
+		};
+
+		bool handle_post_streaming(JsonWriter &writer, const JsonObject &req) const FINAL {
+			static const char *const SORT_KEYS[] = { "bytes_read", "bytes_written", "messages_read", "messages_written",
+				"send_buffer_size", "throttled_time", "last_read_time", "last_write_time", "creation_time" };
+
+			std::string remote_ip;
+			if(req.has("remote_ip")){
+				try {
+					remote_ip = req.get("remote_ip").get<std::string>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+					return write_error(writer, "Invalid parameter `remote_ip`: It shall be a `String`.");
+				}
+			}
+			double local_port = -1;
+			if(req.has("local_port")){
+				try {
+					local_port = req.get("local_port").get<double>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				}
+				if(!(local_port >= 0) || (local_port != std::floor(local_port)) || (local_port > 65535)){
+					return write_error(writer, "Invalid parameter `local_port`: It shall be an integer between 0 and 65535.");
+				}
+			}
+			int sort_by = SORT_NONE;
+			if(req.has("sort_by")){
+				try {
+					const AUTO_REF(name, req.get("sort_by").get<std::string>());
+					for(std::size_t i = 0; i < COUNT_OF(SORT_KEYS); ++i){
+						if(name == SORT_KEYS[i]){
+							sort_by = static_cast<int>(i);
+						}
+					}
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				}
+				if(sort_by == SORT_NONE){
+					return write_error(writer, "Invalid parameter `sort_by`: It shall be the name of a numeric field of a socket.");
+				}
+			}
+			double limit = -1;
+			if(req.has("limit")){
+				try {
+					limit = req.get("limit").get<double>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				}
+				if(!(limit >= 0) || (limit != std::floor(limit))){
+					return write_error(writer, "Invalid parameter `limit`: It shall be a non-negative integer.");
+				}
+			}
+
 			// .sockets = all sockets managed by epoll.
 			boost::container::vector<EpollDaemon::SnapshotElement> snapshot;
 			EpollDaemon::snapshot(snapshot);
-			JsonArray arr;
+			AUTO(end, snapshot.end());
+			if(!remote_ip.empty() || (local_port >= 0)){
+				end = snapshot.begin();
+				for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+					if(!remote_ip.empty() && (std::strncmp(it->remote_info.ip(), remote_ip.c_str(), remote_ip.size()) != 0)){
+						continue;
+					}
+					if((local_port >= 0) && (it->local_info.port() != local_port)){
+						continue;
+					}
+					*end = *it;
+					++end;
+				}
+			}
+			AUTO(count, static_cast<std::size_t>(end - snapshot.begin()));
+			if((limit >= 0) && (limit < static_cast<double>(count))){
+				count = static_cast<std::size_t>(limit);
+			}
+			if(sort_by != SORT_NONE){
+				const SortComparator comp = { sort_by };
+				std::partial_sort(snapshot.begin(), snapshot.begin() + static_cast<std::ptrdiff_t>(count), end, comp);
+			}
+			// 单调时钟的时刻换算成 UTC 时间输出。
+			const AUTO(mono_now, get_fast_mono_clock());
+			const AUTO(utc_now, get_utc_time());
+			// 套接字可能很多，直接写入响应而不构造 JsonArray。
+			writer.begin_object();
+			writer.key("sockets").begin_array();
 			char str[256];
-			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+			for(AUTO(it, snapshot.begin()); it != snapshot.begin() + static_cast<std::ptrdiff_t>(count); ++it){
 				const AUTO_REF(elem, *it);
-				JsonObject obj;
-				obj.set(sslit("remote_info"), std::string(str, (unsigned)::snprintf(str, sizeof(str), "%s:%u", elem.remote_info.ip(), elem.remote_info.port())));
-				obj.set(sslit("local_info"), std::string(str, (unsigned)::snprintf(str, sizeof(str), "%s:%u", elem.local_info.ip(), elem.local_info.port())));
-				obj.set(sslit("creation_time"), std::string(str, format_time(str, sizeof(str), elem.creation_time, false)));
-				obj.set(sslit("listening"), elem.listening);
-				obj.set(sslit("readable"), elem.readable);
-				obj.set(sslit("writeable"), elem.writeable);
-				arr.push_back(STD_MOVE(obj));
+				writer.begin_object();
+				writer.key("remote_info").value(str, (unsigned)::snprintf(str, sizeof(str), "%s:%u", elem.remote_info.ip(), elem.remote_info.port()));
+				writer.key("local_info").value(str, (unsigned)::snprintf(str, sizeof(str), "%s:%u", elem.local_info.ip(), elem.local_info.port()));
+				writer.key("creation_time").value(str, format_time(str, sizeof(str), elem.creation_time, false));
+				writer.key("listening").value(elem.listening);
+				writer.key("readable").value(elem.readable);
+				writer.key("writeable").value(elem.writeable);
+				writer.key("bytes_read").value(elem.bytes_read);
+				writer.key("bytes_written").value(elem.bytes_written);
+				writer.key("messages_read").value(elem.messages_read);
+				writer.key("messages_written").value(elem.messages_written);
+				writer.key("send_buffer_size").value(elem.send_buffer_size);
+				writer.key("throttled_time").value(elem.throttled_time);
+				if(elem.last_read_time != 0){
+					writer.key("last_read_time").value(str, format_time(str, sizeof(str), saturated_sub(utc_now, saturated_sub(mono_now, elem.last_read_time)), true));
+				}
+				if(elem.last_write_time != 0){
+					writer.key("last_write_time").value(str, format_time(str, sizeof(str), saturated_sub(utc_now, saturated_sub(mono_now, elem.last_write_time)), true));
+				}
+				writer.end_object();
 			}
-			resp.set(sslit("sockets"), STD_MOVE(arr));
+			writer.end_array();
+			writer.key("total_sockets").value(snapshot.size());
+			// .ssl = server-side TLS session resumption statistics.
+			SslServerFactory::SessionCacheStats stats;
+			SslServerFactory::get_session_cache_stats(stats);
+			writer.key("ssl").begin_object();
+			writer.key("handshakes").value(stats.handshakes);
+			writer.key("resumed").value(stats.resumed);
+			writer.key("resumption_rate").value((stats.handshakes != 0) ? static_cast<double>(stats.resumed) / static_cast<double>(stats.handshakes) : 0.0);
+			writer.key("cache_hits").value(stats.cache_hits);
+			writer.key("cache_misses").value(stats.cache_misses);
+			writer.key("cache_entries").value(stats.cache_entries);
+			writer.key("ticket_key_rotations").value(stats.ticket_key_rotations);
+			writer.end_object();
+			writer.end_object();
+			return true;
 		}
 	};
 
@@ -182,20 +350,19 @@ namespace {
 		void handle_get(JsonObject &resp) const FINAL {
 			resp.set(sslit("description"), "View profiling information that has been collected within this process.");
 			static const char *const PARAM_INFO[][2] = {
-				{ "clear", "If set to `true`, all data will be purged." },
+				{ "clear", "If set to `true`, all data will be purged. Lock contention is reported in `.locks` when `profiler_lock_contention` is enabled." },
 				{ NULLPTR }
 			};
 			resp.set(sslit("parameters"), make_help(PARAM_INFO));
 		}
-		void handle_post(JsonObject &resp, JsonObject req) const FINAL {
+		bool handle_post_streaming(JsonWriter &writer, const JsonObject &req) const FINAL {
 			bool clear = false;
 			if(req.has("clear")){
 				try {
 					clear = req.get("clear").get<bool>();
 				} catch(std::exception &e){
 					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
-					resp.set(sslit("error"), "Invalid parameter `clear`: It shall be a `Boolean`.");
-					return;
+					return write_error(writer, "Invalid parameter `clear`: It shall be a `Boolean`.");
 				}
 			}
 
@@ -206,19 +373,465 @@ namespace {
 			// .profile = all profile data.
 			boost::container::vector<ProfileDepository::SnapshotElement> snapshot;
 			ProfileDepository::snapshot(snapshot);
+			writer.begin_object();
+			writer.key("profile").begin_array();
+			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+				const AUTO_REF(elem, *it);
+				writer.begin_object();
+				writer.key("file").value(elem.file);
+				writer.key("line").value(elem.line);
+				writer.key("func").value(elem.func);
+				writer.key("samples").value(elem.samples);
+				writer.key("total").value(elem.total);
+				writer.key("exclusive").value(elem.exclusive);
+				if(elem.has_histogram){
+					writer.key("p50").value(elem.p50);
+					writer.key("p90").value(elem.p90);
+					writer.key("p99").value(elem.p99);
+					writer.key("p999").value(elem.p999);
+					writer.key("max").value(elem.max);
+				}
+				writer.end_object();
+			}
+			writer.end_array();
+
+			// .locks = lock contention by lock site, if enabled.
+			boost::container::vector<ProfileDepository::LockSnapshotElement> locks;
+			ProfileDepository::snapshot_locks(locks);
+			writer.key("locks").begin_array();
+			for(AUTO(it, locks.begin()); it != locks.end(); ++it){
+				const AUTO_REF(elem, *it);
+				writer.begin_object();
+				writer.key("file").value(elem.file);
+				writer.key("line").value(elem.line);
+				writer.key("contentions").value(elem.contentions);
+				writer.key("total_wait").value(elem.total_wait);
+				writer.key("max_wait").value(elem.max_wait);
+				writer.end_object();
+			}
+			writer.end_array();
+			writer.end_object();
+			return true;
+		}
+	};
+
+	struct SystemServlet_flamegraph : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/poseidon/flamegraph";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "View call stacks sampled by the wall-clock sampling profiler in the folded format.\n"
+			                               "A GET request returns the text directly, which can be fed to `flamegraph.pl` or speedscope.\n"
+			                               "Each stack begins with the thread name, followed by `[job <type>]` if a job was running.");
+			static const char *const PARAM_INFO[][2] = {
+				{ "clear", "If set to `true`, all samples will be purged after they are returned." },
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		void handle_post(JsonObject &resp, JsonObject req) const FINAL {
+			bool clear = false;
+			if(req.has("clear")){
+				try {
+					clear = req.get("clear").get<bool>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+					resp.set(sslit("error"), "Invalid parameter `clear`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+
+			// .status = state of the sampling profiler.
+			SamplingProfiler::Status status;
+			SamplingProfiler::get_status(status);
+			JsonObject obj;
+			obj.set(sslit("enabled"), status.enabled);
+			obj.set(sslit("frequency"), status.frequency);
+			obj.set(sslit("threads"), status.threads);
+			obj.set(sslit("samples"), status.samples);
+			obj.set(sslit("dropped"), status.dropped);
+			obj.set(sslit("stacks"), status.stacks);
+			resp.set(sslit("status"), STD_MOVE(obj));
+			// .folded = the same text as a GET request.
+			StreamBuffer entity;
+			SamplingProfiler::write_folded(entity);
+			resp.set(sslit("folded"), entity.dump_string());
+
+			if(clear){
+				SamplingProfiler::clear();
+			}
+		}
+		bool handle_get_raw(StreamBuffer &entity, std::string &content_type) const FINAL {
+			SamplingProfiler::write_folded(entity);
+			content_type = "text/plain; charset=utf-8";
+			return true;
+		}
+	};
+
+	struct SystemServlet_jobs : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/poseidon/jobs";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "View job queue depth, latency of each priority class and the most backlogged categories in this process.");
+			static const char *const PARAM_INFO[][2] = {
+				{ "top_categories", "List at most this number of categories having the most queued jobs.\n"
+				                    "The default value is 10." },
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		void handle_post(JsonObject &resp, JsonObject req) const FINAL {
+			static const char *const PRIORITY_NAMES[] = { "realtime", "normal", "background" };
+
+			double top_categories = 10;
+			if(req.has("top_categories")){
+				try {
+					top_categories = req.get("top_categories").get<double>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				}
+				if(!(top_categories >= 0) || (top_categories != std::floor(top_categories))){
+					resp.set(sslit("error"), "Invalid parameter `top_categories`: It shall be a non-negative integer.");
+					return;
+				}
+			}
+
+			// .priorities = queue statistics of each priority class.
+			boost::container::vector<JobDispatcher::SnapshotElement> snapshot;
+			JobDispatcher::snapshot(snapshot);
 			JsonArray arr;
 			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
 				const AUTO_REF(elem, *it);
 				JsonObject obj;
-				obj.set(sslit("file"), elem.file);
-				obj.set(sslit("line"), elem.line);
-				obj.set(sslit("func"), elem.func);
-				obj.set(sslit("samples"), elem.samples);
-				obj.set(sslit("total"), elem.total);
-				obj.set(sslit("exclusive"), elem.exclusive);
+				obj.set(sslit("priority"), (elem.priority < COUNT_OF(PRIORITY_NAMES)) ? PRIORITY_NAMES[elem.priority] : "unknown");
+				obj.set(sslit("ready_fibers"), elem.ready_fibers);
+				obj.set(sslit("queued_jobs"), elem.queued_jobs);
+				obj.set(sslit("started"), elem.started);
+				obj.set(sslit("dropped"), elem.dropped);
+				obj.set(sslit("rejected"), elem.rejected);
+				obj.set(sslit("shed"), elem.shed);
+				obj.set(sslit("average_wait"), elem.average_wait);
+				obj.set(sslit("max_wait"), elem.max_wait);
+				obj.set(sslit("wait_p50"), elem.wait_p50);
+				obj.set(sslit("wait_p90"), elem.wait_p90);
+				obj.set(sslit("wait_p99"), elem.wait_p99);
+				obj.set(sslit("completed"), elem.completed);
+				obj.set(sslit("run_p50"), elem.run_p50);
+				obj.set(sslit("run_p90"), elem.run_p90);
+				obj.set(sslit("run_p99"), elem.run_p99);
+				obj.set(sslit("max_run"), elem.max_run);
+				obj.set(sslit("yields"), elem.yields);
+				obj.set(sslit("yields_p99"), elem.yields_p99);
+				obj.set(sslit("max_yields"), elem.max_yields);
+				arr.push_back(STD_MOVE(obj));
+			}
+			resp.set(sslit("priorities"), STD_MOVE(arr));
+			// .categories = categories having the most queued jobs.
+			boost::container::vector<JobDispatcher::CategorySnapshotElement> categories;
+			// top_categories 是非负整数。过大的值等同于不限制，在转换为整数之前截断。
+			const std::size_t category_limit = (top_categories < 4294967296.0) ? static_cast<std::size_t>(top_categories) : SIZE_MAX;
+			JobDispatcher::snapshot_categories(categories, category_limit);
+			arr.clear();
+			char str[256];
+			for(AUTO(it, categories.begin()); it != categories.end(); ++it){
+				const AUTO_REF(elem, *it);
+				JsonObject obj;
+				obj.set(sslit("id"), std::string(str, (unsigned)::snprintf(str, sizeof(str), "%p", elem.fiber)));
+				obj.set(sslit("job_type"), elem.job_type);
+				obj.set(sslit("pending"), elem.pending);
+				obj.set(sslit("yielded"), elem.yielded);
+				obj.set(sslit("oldest_wait"), elem.oldest_wait);
+				obj.set(sslit("started"), elem.started);
+				obj.set(sslit("completed"), elem.completed);
+				obj.set(sslit("yields"), elem.yields);
+				obj.set(sslit("average_wait"), elem.average_wait);
+				obj.set(sslit("average_run"), elem.average_run);
+				obj.set(sslit("max_run"), elem.max_run);
+				arr.push_back(STD_MOVE(obj));
+			}
+			resp.set(sslit("categories"), STD_MOVE(arr));
+			// .fiber_stacks = live and pooled fiber stacks.
+			JobDispatcher::FiberStackStatus stacks;
+			JobDispatcher::get_fiber_stack_status(stacks);
+			JsonObject fiber_stacks;
+			fiber_stacks.set(sslit("stack_size"), stacks.stack_size);
+			fiber_stacks.set(sslit("live_stacks"), stacks.live_stacks);
+			fiber_stacks.set(sslit("pooled_stacks"), stacks.pooled_stacks);
+			fiber_stacks.set(sslit("pool_capacity"), stacks.pool_capacity);
+			fiber_stacks.set(sslit("region_stacks"), stacks.region_stacks);
+			fiber_stacks.set(sslit("region_free_stacks"), stacks.region_free_stacks);
+			fiber_stacks.set(sslit("region_backing"), stacks.region_backing);
+			resp.set(sslit("fiber_stacks"), STD_MOVE(fiber_stacks));
+			// .queue = overall queue depth and bounds.
+			JobDispatcher::QueueDepth depth;
+			JobDispatcher::get_queue_depth(depth);
+			JsonObject queue;
+			queue.set(sslit("total_jobs"), depth.total_jobs);
+			queue.set(sslit("max_total_jobs"), depth.max_total_jobs);
+			queue.set(sslit("categories"), depth.categories);
+			queue.set(sslit("max_category_jobs"), depth.max_category_jobs);
+			queue.set(sslit("max_jobs_per_category"), depth.max_jobs_per_category);
+			queue.set(sslit("overflow_action"), depth.overflow_action);
+			queue.set(sslit("backlogged_reads"), depth.backlogged_reads);
+			queue.set(sslit("stolen_fibers"), depth.stolen_fibers);
+			resp.set(sslit("queue"), STD_MOVE(queue));
+		}
+	};
+
+	struct SystemServlet_threads : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/poseidon/threads";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "View or resize the workhorse, MySQL and MongoDB thread pools, and view the load of each MySQL thread.");
+			static const char *const PARAM_INFO[][2] = {
+				{ "pool", "The thread pool to resize, which shall be one of `workhorse`, `mysql` and `mongodb`.\n"
+				          "If this parameter is absent, no thread pool is resized." },
+				{ "min_thread_count", "The new lower bound of the number of threads.\n"
+				                      "Idle threads will not be retired below this number.\n"
+				                      "If this parameter is absent, the current value is kept." },
+				{ "max_thread_count", "The new upper bound of the number of threads.\n"
+				                      "Excess threads will exit after finishing their pending work.\n"
+				                      "If this parameter is absent, the current value is kept." },
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		template<typename DaemonT>
+		static void describe_pool(JsonObject &obj){
+			typename DaemonT::PoolStatus status;
+			DaemonT::get_pool_status(status);
+			obj.set(sslit("enabled"), status.max_thread_count != 0);
+			obj.set(sslit("min_thread_count"), status.min_thread_count);
+			obj.set(sslit("max_thread_count"), status.max_thread_count);
+			obj.set(sslit("live_thread_count"), status.live_thread_count);
+			obj.set(sslit("queue_size"), status.queue_size);
+		}
+		// 参数缺失时保留当前的值。返回空字符串表示成功，否则返回错误信息。
+		template<typename DaemonT>
+		static std::string resize_pool(const JsonObject &req){
+			typename DaemonT::PoolStatus status;
+			DaemonT::get_pool_status(status);
+			std::size_t limits[2] = { status.min_thread_count, status.max_thread_count };
+			static const char *const LIMIT_NAMES[] = { "min_thread_count", "max_thread_count" };
+			for(std::size_t i = 0; i < COUNT_OF(LIMIT_NAMES); ++i){
+				if(!req.has(LIMIT_NAMES[i])){
+					continue;
+				}
+				double val = -1;
+				try {
+					val = req.get(LIMIT_NAMES[i]).get<double>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				}
+				if(!(val >= 0) || (val != std::floor(val)) || (val > 65536)){
+					return std::string("Invalid parameter `") + LIMIT_NAMES[i] + "`: It shall be a non-negative integer.";
+				}
+				limits[i] = static_cast<std::size_t>(val);
+			}
+			try {
+				DaemonT::set_thread_limits(limits[0], limits[1]);
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				return std::string("Failed to resize thread pool: ") + e.what();
+			}
+			return std::string();
+		}
+
+		void handle_post(JsonObject &resp, JsonObject req) const FINAL {
+			static const struct {
+				const char *name;
+				void (*describe)(JsonObject &obj);
+				std::string (*resize)(const JsonObject &req);
+			} POOLS[] = {
+				{ "workhorse", &describe_pool<WorkhorseCamp>, &resize_pool<WorkhorseCamp> },
+				{ "mysql",     &describe_pool<MySqlDaemon>,   &resize_pool<MySqlDaemon>   },
+				{ "mongodb",   &describe_pool<MongoDbDaemon>, &resize_pool<MongoDbDaemon> },
+			};
+
+			if(req.has("pool")){
+				std::size_t index = COUNT_OF(POOLS);
+				try {
+					const AUTO_REF(name, req.get("pool").get<std::string>());
+					for(std::size_t i = 0; i < COUNT_OF(POOLS); ++i){
+						if(name == POOLS[i].name){
+							index = i;
+						}
+					}
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+				}
+				if(index == COUNT_OF(POOLS)){
+					resp.set(sslit("error"), "Invalid parameter `pool`: It shall be one of `workhorse`, `mysql` and `mongodb`.");
+					return;
+				}
+				const AUTO(error, (*POOLS[index].resize)(req));
+				if(!error.empty()){
+					resp.set(sslit("error"), error);
+					return;
+				}
+			}
+
+			// .pools = status of each thread pool.
+			JsonArray arr;
+			for(std::size_t i = 0; i < COUNT_OF(POOLS); ++i){
+				JsonObject obj;
+				obj.set(sslit("pool"), POOLS[i].name);
+				(*POOLS[i].describe)(obj);
 				arr.push_back(STD_MOVE(obj));
 			}
-			resp.set(sslit("profile"), STD_MOVE(arr));
+			resp.set(sslit("pools"), STD_MOVE(arr));
+			// .mysql_threads = load of each MySQL thread.
+			boost::container::vector<MySqlDaemon::ThreadStatus> threads;
+			MySqlDaemon::get_thread_status(threads);
+			JsonArray mysql_arr;
+			for(AUTO(it, threads.begin()); it != threads.end(); ++it){
+				JsonObject obj;
+				obj.set(sslit("index"), it->index);
+				obj.set(sslit("queue_size"), it->queue_size);
+				obj.set(sslit("queue_latency"), it->queue_latency);
+				obj.set(sslit("route_count"), it->route_count);
+				mysql_arr.push_back(STD_MOVE(obj));
+			}
+			resp.set(sslit("mysql_threads"), STD_MOVE(mysql_arr));
+		}
+	};
+
+	struct SystemServlet_mysql_cache : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/poseidon/mysql_cache";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "View hit/miss statistics of the MySQL read-through cache, or clear it.");
+			static const char *const PARAM_INFO[][2] = {
+				{ "clear", "If this parameter is `true`, all cached objects are dropped before statistics are collected." },
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		void handle_post(JsonObject &resp, JsonObject req) const FINAL {
+			if(req.has("clear")){
+				bool clear = false;
+				try {
+					clear = req.get("clear").get<bool>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+					resp.set(sslit("error"), "Invalid parameter `clear`: It shall be a `Boolean`.");
+					return;
+				}
+				if(clear){
+					MySqlDaemon::clear_cache();
+				}
+			}
+
+			// .cache = cache statistics.
+			MySqlDaemon::CacheStatus status;
+			MySqlDaemon::get_cache_status(status);
+			JsonObject cache;
+			cache.set(sslit("enabled"), status.capacity != 0);
+			cache.set(sslit("capacity"), status.capacity);
+			cache.set(sslit("size"), status.size);
+			cache.set(sslit("hits"), status.hits);
+			cache.set(sslit("misses"), status.misses);
+			cache.set(sslit("evictions"), status.evictions);
+			cache.set(sslit("invalidations"), status.invalidations);
+			const AUTO(lookups, status.hits + status.misses);
+			cache.set(sslit("hit_ratio"), (lookups == 0) ? 0.0 : static_cast<double>(status.hits) / static_cast<double>(lookups));
+			resp.set(sslit("cache"), STD_MOVE(cache));
+		}
+	};
+
+	struct SystemServlet_memory_pools : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/poseidon/memory_pools";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "View size classes of the pooled allocator used for jobs and database operations.\n"
+			                               "Counters are updated when blocks move between per-thread caches and the global pool.");
+			static const char *const PARAM_INFO[][2] = {
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		void handle_post(JsonObject &resp, JsonObject /*req*/) const FINAL {
+			// .size_classes = size classes that have ever allocated a block.
+			boost::container::vector<PooledAllocatorSnapshotElement> snapshot;
+			snapshot_pooled_allocator(snapshot);
+			JsonArray arr;
+			for(AUTO(it, snapshot.begin()); it != snapshot.end(); ++it){
+				const AUTO_REF(elem, *it);
+				JsonObject obj;
+				obj.set(sslit("block_size"), elem.block_size);
+				obj.set(sslit("blocks_owned"), elem.blocks_owned);
+				obj.set(sslit("pooled_blocks"), elem.pooled_batches * elem.batch_size);
+				obj.set(sslit("refills"), elem.refills);
+				obj.set(sslit("refill_misses"), elem.refill_misses);
+				obj.set(sslit("spills"), elem.spills);
+				obj.set(sslit("spill_overflows"), elem.spill_overflows);
+				arr.push_back(STD_MOVE(obj));
+			}
+			resp.set(sslit("size_classes"), STD_MOVE(arr));
+		}
+	};
+
+	struct SystemServlet_memory : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/poseidon/memory";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "View statistics of the malloc implementation in use (glibc, jemalloc or tcmalloc) and return free memory to the system.");
+			static const char *const PARAM_INFO[][2] = {
+				{ "trim",   "If set to `true`, free memory will be returned to the system before statistics are collected.\n"
+				            "This calls `malloc_trim(0)` for glibc, purges all arenas for jemalloc and calls `ReleaseFreeMemory()` for tcmalloc." },
+				{ "report", "If set to `true`, the allocator's own report will be returned in `.report`.\n"
+				            "This is the XML from `malloc_info()` for glibc, the JSON from `malloc_stats_print()` for jemalloc and the text from `GetStats()` for tcmalloc." },
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		void handle_post(JsonObject &resp, JsonObject req) const FINAL {
+			bool trim = false;
+			if(req.has("trim")){
+				try {
+					trim = req.get("trim").get<bool>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+					resp.set(sslit("error"), "Invalid parameter `trim`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+			bool report = false;
+			if(req.has("report")){
+				try {
+					report = req.get("report").get<bool>();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown: ", e.what());
+					resp.set(sslit("error"), "Invalid parameter `report`: It shall be a `Boolean`.");
+					return;
+				}
+			}
+
+			if(trim){
+				// .trimmed_bytes = decrease of resident memory caused by trimming.
+				resp.set(sslit("trimmed_bytes"), trim_heap());
+			}
+			HeapStatistics stats;
+			get_heap_statistics(stats);
+			// .allocator = name of the malloc implementation in use.
+			resp.set(sslit("allocator"), get_heap_allocator_name(stats.kind));
+			// .allocated_bytes = bytes in use by the application.
+			resp.set(sslit("allocated_bytes"), stats.allocated_bytes);
+			// .free_bytes = bytes held by the allocator but not in use.
+			resp.set(sslit("free_bytes"), stats.free_bytes);
+			// .mapped_bytes = bytes obtained from the system.
+			resp.set(sslit("mapped_bytes"), stats.mapped_bytes);
+			// .arena_count = number of arenas, zero for tcmalloc.
+			resp.set(sslit("arena_count"), stats.arena_count);
+			if(report){
+				// .report = the allocator's own report.
+				resp.set(sslit("report"), get_heap_report());
+			}
 		}
 	};
 
@@ -324,6 +937,255 @@ namespace {
 		}
 	};
 
+	struct SystemServlet_metrics : public SystemServletBase {
+		const char *get_uri() const FINAL {
+			return "/metrics";
+		}
+		void handle_get(JsonObject &resp) const FINAL {
+			resp.set(sslit("description"), "Export metrics of this process in the OpenMetrics text format.\n"
+			                               "A GET request returns the text directly, which can be scraped by Prometheus.");
+			static const char *const PARAM_INFO[][2] = {
+				{ NULLPTR }
+			};
+			resp.set(sslit("parameters"), make_help(PARAM_INFO));
+		}
+		void handle_post(JsonObject &resp, JsonObject /*req*/) const FINAL {
+			// .text = the same text as a GET request.
+			StreamBuffer entity;
+			write_metrics(entity);
+			resp.set(sslit("text"), entity.dump_string());
+		}
+		bool handle_get_raw(StreamBuffer &entity, std::string &content_type) const FINAL {
+			write_metrics(entity);
+			content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+			return true;
+		}
+
+		template<typename DaemonT>
+		static void write_pool(MetricsWriter &writer, const char *name, bool threads){
+			typename DaemonT::PoolStatus status;
+			DaemonT::get_pool_status(status);
+			const char *const labels[][2] = { { "pool", name }, { NULLPTR } };
+			writer.put(static_cast<unsigned long long>(threads ? status.live_thread_count : status.queue_size), labels);
+		}
+		static void write_metrics(StreamBuffer &entity){
+			MetricsWriter writer(entity);
+			char str[256];
+
+			// 套接字和流量。
+			boost::container::vector<EpollDaemon::SnapshotElement> sockets;
+			EpollDaemon::snapshot(sockets);
+			unsigned long long listening = 0;
+			for(AUTO(it, sockets.begin()); it != sockets.end(); ++it){
+				listening += it->listening;
+			}
+			writer.begin("poseidon_sockets", "gauge", "Number of sockets managed by epoll.");
+			{
+				const char *const labels[][2] = { { "kind", "listening" }, { NULLPTR } };
+				writer.put(listening, labels);
+			}
+			{
+				const char *const labels[][2] = { { "kind", "connection" }, { NULLPTR } };
+				writer.put(sockets.size() - listening, labels);
+			}
+			boost::uint64_t bytes_received, bytes_sent;
+			TcpSessionBase::get_traffic_totals(bytes_received, bytes_sent);
+			writer.begin("poseidon_tcp_received_bytes", "counter", "Bytes received by all TCP sessions, before decryption.");
+			writer.put(static_cast<unsigned long long>(bytes_received));
+			writer.begin("poseidon_tcp_sent_bytes", "counter", "Bytes sent by all TCP sessions, before encryption.");
+			writer.put(static_cast<unsigned long long>(bytes_sent));
+
+			// 任务队列。
+			static const char *const PRIORITY_NAMES[] = { "realtime", "normal", "background" };
+			boost::container::vector<JobDispatcher::SnapshotElement> priorities;
+			JobDispatcher::snapshot(priorities);
+			writer.begin("poseidon_job_queue_jobs", "gauge", "Jobs queued in each priority class, including running and suspended ones.");
+			for(AUTO(it, priorities.begin()); it != priorities.end(); ++it){
+				const char *const labels[][2] = { { "priority", (it->priority < COUNT_OF(PRIORITY_NAMES)) ? PRIORITY_NAMES[it->priority] : "unknown" }, { NULLPTR } };
+				writer.put(it->queued_jobs, labels);
+			}
+			writer.begin("poseidon_job_ready_fibers", "gauge", "Fibers ready to run in each priority class.");
+			for(AUTO(it, priorities.begin()); it != priorities.end(); ++it){
+				const char *const labels[][2] = { { "priority", (it->priority < COUNT_OF(PRIORITY_NAMES)) ? PRIORITY_NAMES[it->priority] : "unknown" }, { NULLPTR } };
+				writer.put(it->ready_fibers, labels);
+			}
+			writer.begin("poseidon_jobs_started", "counter", "Jobs that have started running in each priority class.");
+			for(AUTO(it, priorities.begin()); it != priorities.end(); ++it){
+				const char *const labels[][2] = { { "priority", (it->priority < COUNT_OF(PRIORITY_NAMES)) ? PRIORITY_NAMES[it->priority] : "unknown" }, { NULLPTR } };
+				writer.put(it->started, labels);
+			}
+			writer.begin("poseidon_jobs_discarded", "counter", "Jobs that have been discarded in each priority class.");
+			for(AUTO(it, priorities.begin()); it != priorities.end(); ++it){
+				const char *const priority = (it->priority < COUNT_OF(PRIORITY_NAMES)) ? PRIORITY_NAMES[it->priority] : "unknown";
+				const char *const dropped_labels[][2] = { { "priority", priority }, { "reason", "dropped" }, { NULLPTR } };
+				writer.put(it->dropped, dropped_labels);
+				const char *const rejected_labels[][2] = { { "priority", priority }, { "reason", "rejected" }, { NULLPTR } };
+				writer.put(it->rejected, rejected_labels);
+				const char *const shed_labels[][2] = { { "priority", priority }, { "reason", "shed" }, { NULLPTR } };
+				writer.put(it->shed, shed_labels);
+			}
+			writer.begin("poseidon_job_average_wait_seconds", "gauge", "Average time from enqueueing to running in each priority class.");
+			for(AUTO(it, priorities.begin()); it != priorities.end(); ++it){
+				const char *const labels[][2] = { { "priority", (it->priority < COUNT_OF(PRIORITY_NAMES)) ? PRIORITY_NAMES[it->priority] : "unknown" }, { NULLPTR } };
+				writer.put(it->average_wait / 1000, labels);
+			}
+
+			// 各个线程池和队列。
+			writer.begin("poseidon_thread_pool_queue_size", "gauge", "Requests waiting in each thread pool.");
+			write_pool<WorkhorseCamp>(writer, "workhorse", false);
+			write_pool<MySqlDaemon>(writer, "mysql", false);
+			write_pool<MongoDbDaemon>(writer, "mongodb", false);
+			writer.begin("poseidon_thread_pool_threads", "gauge", "Live threads in each thread pool.");
+			write_pool<WorkhorseCamp>(writer, "workhorse", true);
+			write_pool<MySqlDaemon>(writer, "mysql", true);
+			write_pool<MongoDbDaemon>(writer, "mongodb", true);
+			writer.begin("poseidon_filesystem_queue_size", "gauge", "File system operations waiting to be performed.");
+			writer.put(static_cast<unsigned long long>(FileSystemDaemon::get_queue_size()));
+			writer.begin("poseidon_dns_queue_size", "gauge", "DNS lookups waiting to be performed.");
+			writer.put(static_cast<unsigned long long>(DnsDaemon::get_queue_size()));
+			writer.begin("poseidon_timers", "gauge", "Timers waiting to fire.");
+			writer.put(static_cast<unsigned long long>(TimerDaemon::get_timer_count()));
+
+			// 逻辑帧调度器。
+			boost::container::vector<TickScheduler::SnapshotElement> schedulers;
+			TickScheduler::snapshot(schedulers);
+			writer.begin("poseidon_ticks", "counter", "Ticks that each tick scheduler has run or skipped.");
+			for(AUTO(it, schedulers.begin()); it != schedulers.end(); ++it){
+				const char *const run_labels[][2] = { { "scheduler", it->name.c_str() }, { "state", "run" }, { NULLPTR } };
+				writer.put(static_cast<unsigned long long>(it->stats.ticks_run), run_labels);
+				const char *const skipped_labels[][2] = { { "scheduler", it->name.c_str() }, { "state", "skipped" }, { NULLPTR } };
+				writer.put(static_cast<unsigned long long>(it->stats.ticks_skipped), skipped_labels);
+			}
+			writer.begin("poseidon_tick_overruns", "counter", "Times a tick became due while the previous tick was still queued or running.");
+			for(AUTO(it, schedulers.begin()); it != schedulers.end(); ++it){
+				const char *const labels[][2] = { { "scheduler", it->name.c_str() }, { NULLPTR } };
+				writer.put(static_cast<unsigned long long>(it->stats.overruns), labels);
+			}
+			writer.begin("poseidon_tick_jitter_seconds", "gauge", "Delay from the scheduled time of a tick to the time it started running.");
+			for(AUTO(it, schedulers.begin()); it != schedulers.end(); ++it){
+				const char *const last_labels[][2] = { { "scheduler", it->name.c_str() }, { "stat", "last" }, { NULLPTR } };
+				writer.put(it->stats.last_jitter / 1000, last_labels);
+				const char *const average_labels[][2] = { { "scheduler", it->name.c_str() }, { "stat", "average" }, { NULLPTR } };
+				writer.put(it->stats.average_jitter / 1000, average_labels);
+				const char *const max_labels[][2] = { { "scheduler", it->name.c_str() }, { "stat", "max" }, { NULLPTR } };
+				writer.put(it->stats.max_jitter / 1000, max_labels);
+			}
+			writer.begin("poseidon_tick_duration_seconds", "gauge", "Time spent calling the subscribers of a tick.");
+			for(AUTO(it, schedulers.begin()); it != schedulers.end(); ++it){
+				const char *const last_labels[][2] = { { "scheduler", it->name.c_str() }, { "stat", "last" }, { NULLPTR } };
+				writer.put(it->stats.last_duration / 1000, last_labels);
+				const char *const max_labels[][2] = { { "scheduler", it->name.c_str() }, { "stat", "max" }, { NULLPTR } };
+				writer.put(it->stats.max_duration / 1000, max_labels);
+			}
+
+			// 分布式追踪。
+			TraceExporter::Status trace;
+			TraceExporter::get_status(trace);
+			writer.begin("poseidon_trace_sample_ratio", "gauge", "Probability that a new trace is sampled.");
+			writer.put(trace.sample_rate);
+			writer.begin("poseidon_trace_spans", "counter", "Sampled spans that have finished, by what happened to them.");
+			{
+				const char *const labels[][2] = { { "state", "exported" }, { NULLPTR } };
+				writer.put(trace.exported, labels);
+			}
+			{
+				const char *const labels[][2] = { { "state", "dropped" }, { NULLPTR } };
+				writer.put(trace.dropped, labels);
+			}
+			writer.begin("poseidon_trace_pending_spans", "gauge", "Sampled spans waiting to be exported.");
+			writer.put(static_cast<unsigned long long>(trace.pending));
+
+			// fiber 栈。
+			JobDispatcher::FiberStackStatus stacks;
+			JobDispatcher::get_fiber_stack_status(stacks);
+			writer.begin("poseidon_fiber_stacks", "gauge", "Fiber stacks that have been allocated, and those idle in the shared pool.");
+			{
+				const char *const labels[][2] = { { "state", "allocated" }, { NULLPTR } };
+				writer.put(stacks.live_stacks, labels);
+			}
+			{
+				const char *const labels[][2] = { { "state", "pooled" }, { NULLPTR } };
+				writer.put(stacks.pooled_stacks, labels);
+			}
+			writer.begin("poseidon_fiber_stack_pool_capacity", "gauge", "Maximum number of idle fiber stacks in the shared pool.");
+			writer.put(stacks.pool_capacity);
+			writer.begin("poseidon_fiber_stack_size_bytes", "gauge", "Usable size of each fiber stack.");
+			writer.put(stacks.stack_size);
+			writer.begin("poseidon_fiber_stack_region_stacks", "gauge", "Fiber stacks carved from the huge page region, and those not in use.");
+			{
+				const char *const labels[][2] = { { "state", "total" }, { NULLPTR } };
+				writer.put(stacks.region_stacks, labels);
+			}
+			{
+				const char *const labels[][2] = { { "state", "free" }, { NULLPTR } };
+				writer.put(stacks.region_free_stacks, labels);
+			}
+
+			// profiler。
+			boost::container::vector<ProfileDepository::SnapshotElement> profile;
+			ProfileDepository::snapshot(profile);
+			writer.begin("poseidon_profiler_samples", "counter", "Times each profiled scope has been entered.");
+			for(AUTO(it, profile.begin()); it != profile.end(); ++it){
+				::snprintf(str, sizeof(str), "%lu", it->line);
+				const char *const labels[][2] = { { "file", it->file }, { "line", str }, { "func", it->func }, { NULLPTR } };
+				writer.put(it->samples, labels);
+			}
+			writer.begin("poseidon_profiler_seconds", "counter", "Time spent in each profiled scope.");
+			for(AUTO(it, profile.begin()); it != profile.end(); ++it){
+				::snprintf(str, sizeof(str), "%lu", it->line);
+				const char *const labels[][2] = { { "file", it->file }, { "line", str }, { "func", it->func }, { NULLPTR } };
+				writer.put(it->total / 1000, labels);
+			}
+			writer.begin("poseidon_profiler_exclusive_seconds", "counter", "Time spent in each profiled scope, excluding nested profiled scopes.");
+			for(AUTO(it, profile.begin()); it != profile.end(); ++it){
+				::snprintf(str, sizeof(str), "%lu", it->line);
+				const char *const labels[][2] = { { "file", it->file }, { "line", str }, { "func", it->func }, { NULLPTR } };
+				writer.put(it->exclusive / 1000, labels);
+			}
+			writer.begin("poseidon_profiler_latency_seconds", "gauge", "Quantiles of the duration of each profiled scope with a histogram.");
+			for(AUTO(it, profile.begin()); it != profile.end(); ++it){
+				if(!it->has_histogram){
+					continue;
+				}
+				::snprintf(str, sizeof(str), "%lu", it->line);
+				const struct {
+					const char *quantile;
+					double value;
+				} quantiles[] = {
+					{ "0.5",   it->p50  },
+					{ "0.9",   it->p90  },
+					{ "0.99",  it->p99  },
+					{ "0.999", it->p999 },
+					{ "1",     it->max  },
+				};
+				for(std::size_t i = 0; i < COUNT_OF(quantiles); ++i){
+					const char *const labels[][2] = { { "file", it->file }, { "line", str }, { "func", it->func }, { "quantile", quantiles[i].quantile }, { NULLPTR } };
+					writer.put(quantiles[i].value / 1000, labels);
+				}
+			}
+
+			// 锁竞争。
+			boost::container::vector<ProfileDepository::LockSnapshotElement> locks;
+			ProfileDepository::snapshot_locks(locks);
+			writer.begin("poseidon_lock_contentions", "counter", "Times a lock could not be acquired immediately, by the site where the lock was taken.");
+			for(AUTO(it, locks.begin()); it != locks.end(); ++it){
+				::snprintf(str, sizeof(str), "%lu", it->line);
+				const char *const labels[][2] = { { "file", it->file }, { "line", str }, { NULLPTR } };
+				writer.put(it->contentions, labels);
+			}
+			writer.begin("poseidon_lock_wait_seconds", "counter", "Time spent waiting for contended locks, by the site where the lock was taken.");
+			for(AUTO(it, locks.begin()); it != locks.end(); ++it){
+				::snprintf(str, sizeof(str), "%lu", it->line);
+				const char *const labels[][2] = { { "file", it->file }, { "line", str }, { NULLPTR } };
+				writer.put(it->total_wait / 1000, labels);
+			}
+
+			// 模块注册的指标。
+			MetricsRegistry::collect(writer);
+			writer.finish();
+		}
+	};
+
 	template<typename T>
 	struct RaiiSingletonRunner : NONCOPYABLE {
 		RaiiSingletonRunner(){
@@ -336,20 +1198,107 @@ namespace {
 
 #define START(x_)   const RaiiSingletonRunner<x_> UNIQUE_ID
 
+	struct SingletonProcs {
+		void (*start)();
+		void (*stop)();
+	};
+
+	void start_singleton_nothrow(void (*start)(), STD_EXCEPTION_PTR *except) NOEXCEPT
+	try {
+		(*start)();
+	} catch(...){
+		*except = STD_CURRENT_EXCEPTION();
+	}
+
+	// 同时启动互不依赖的单例，耗时最长的是检查数据库服务器是否可用。构造函数在全部启动之后才返回，
+	// 任何一个抛出异常时，停止已经启动的那些，然后重新抛出第一个异常。析构时按照相反的顺序停止。
+	class ParallelSingletonRunner : NONCOPYABLE {
+	private:
+		const SingletonProcs *m_procs;
+		std::size_t m_count;
+
+	public:
+		ParallelSingletonRunner(const SingletonProcs *procs, std::size_t count)
+			: m_procs(procs), m_count(count)
+		{
+			boost::container::vector<STD_EXCEPTION_PTR> excepts(m_count);
+			const boost::scoped_array<Thread> threads(new Thread[m_count]);
+			// 第一个在当前线程中启动。
+			for(std::size_t i = 1; i < m_count; ++i){
+				try {
+					Thread(boost::bind(&start_singleton_nothrow, m_procs[i].start, &(excepts.at(i))), sslit("  S "), sslit("Startup")).swap(threads.get()[i]);
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("Could not create startup thread: ", e.what());
+					start_singleton_nothrow(m_procs[i].start, &(excepts.at(i)));
+				}
+			}
+			if(m_count != 0){
+				start_singleton_nothrow(m_procs[0].start, &(excepts.at(0)));
+			}
+			for(std::size_t i = 1; i < m_count; ++i){
+				if(threads.get()[i].joinable()){
+					threads.get()[i].join();
+				}
+			}
+			for(std::size_t i = 0; i < m_count; ++i){
+				if(!excepts.at(i)){
+					continue;
+				}
+				for(std::size_t j = m_count; j-- > 0; ){
+					if(!excepts.at(j)){
+						(*(m_procs[j].stop))();
+					}
+				}
+				STD_RETHROW_EXCEPTION(excepts.at(i));
+			}
+		}
+		~ParallelSingletonRunner(){
+			for(std::size_t i = m_count; i-- > 0; ){
+				(*(m_procs[i].stop))();
+			}
+		}
+	};
+
+#define SINGLETON_PROCS(x_)   { &x_::start, &x_::stop }
+
+	struct AsyncLogRunner : NONCOPYABLE {
+		AsyncLogRunner(){
+			Logger::start_async();
+		}
+		~AsyncLogRunner(){
+			Logger::stop_async();
+		}
+	};
+
+	void heap_trim_timer_proc(const boost::shared_ptr<Timer> &, boost::uint64_t, boost::uint64_t){
+		PROFILE_ME;
+
+		const AUTO(released, trim_heap());
+		LOG_POSEIDON_DEBUG("Periodic heap trim released ", released, " bytes.");
+	}
+
 	void run(){
 		PROFILE_ME;
 
-		START(DnsDaemon);
-		START(FileSystemDaemon);
-		START(MySqlDaemon);
-		START(MongoDbDaemon);
+		StreamBuffer::reserve_huge_pages(MainConfig::get<std::size_t>("stream_buffer_huge_page_region", 0));
+
+		static const SingletonProcs s_independent_daemons[] = {
+			SINGLETON_PROCS(DnsDaemon),
+			SINGLETON_PROCS(FileSystemDaemon),
+			SINGLETON_PROCS(MySqlDaemon),
+			SINGLETON_PROCS(MongoDbDaemon),
+		};
+		const ParallelSingletonRunner independent_daemons(s_independent_daemons, COUNT_OF(s_independent_daemons));
 		START(JobDispatcher);
 		START(WorkhorseCamp);
 
 		try {
+			START(SnapshotDaemon);
 			START(ModuleDepository);
 			START(TimerDaemon);
+			START(TraceExporter);
 			START(EpollDaemon);
+			START(HotRestartDaemon);
 			START(EventDispatcher);
 			START(SystemServer);
 
@@ -359,7 +1308,21 @@ namespace {
 			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_logger>()));
 			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_network>()));
 			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_profiler>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_flamegraph>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_jobs>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_threads>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_mysql_cache>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_memory_pools>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_memory>()));
 			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_modules>()));
+			system_servlets.push_back(SystemServer::register_servlet(boost::make_shared<SystemServlet_metrics>()));
+
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Using heap allocator: ", get_heap_allocator_name(get_heap_allocator_kind()));
+			boost::shared_ptr<Timer> heap_trim_timer;
+			const AUTO(heap_trim_interval, MainConfig::get<boost::uint64_t>("heap_trim_interval", 0));
+			if(heap_trim_interval != 0){
+				heap_trim_timer = TimerDaemon::register_timer(heap_trim_interval, heap_trim_interval, &heap_trim_timer_proc, 1000);
+			}
 
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for daemon initialization to complete...");
 			::timespec req;
@@ -381,6 +1344,9 @@ namespace {
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for all asynchronous MongoDB operations to complete...");
 			MongoDbDaemon::wait_for_all_async_operations();
 
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Completing hot restart...");
+			HotRestartDaemon::complete_startup();
+
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Entering modal loop...");
 			JobDispatcher::do_modal(g_running);
 
@@ -418,7 +1384,9 @@ try {
 	MainConfig::set_run_path(run_path);
 	MainConfig::reload();
 
+	const AsyncLogRunner async_log_runner;
 	START(ProfileDepository);
+	START(SamplingProfiler);
 	run();
 
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "------------------ Process exited gracefully ------------------");
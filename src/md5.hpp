@@ -14,6 +14,8 @@
 
 namespace Poseidon {
 
+class StreamBuffer;
+
 typedef boost::array<boost::uint8_t, 16> Md5;
 
 class Md5_streambuf : public std::streambuf {
@@ -35,6 +37,7 @@ private:
 
 protected:
 	int_type overflow(int_type c = traits_type::eof()) OVERRIDE;
+	std::streamsize xsputn(const char *s, std::streamsize n) OVERRIDE;
 
 public:
 	void reset() NOEXCEPT;
@@ -64,6 +67,10 @@ public:
 	}
 };
 
+// 一次性计算整段数据的摘要。完整的 64 字节块直接从输入中处理，不经过 streambuf 的缓冲区。
+extern Md5 md5_hash(const void *data, std::size_t size);
+extern Md5 md5_hash(const StreamBuffer &buffer);
+
 }
 
 #endif
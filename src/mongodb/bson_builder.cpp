@@ -14,6 +14,7 @@
 #include "../profiler.hpp"
 #include "../buffer_streams.hpp"
 #include "../raii.hpp"
+#include "../endian.hpp"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wconversion"
@@ -41,203 +42,249 @@ namespace {
 			::bson_free(str);
 		}
 	};
-}
-
-void BsonBuilder::internal_build(void *impl, bool as_array) const {
-	PROFILE_ME;
 
-	const AUTO(bt, static_cast< ::bson_t *>(impl));
+	void put_int32(std::basic_string<unsigned char> &data, boost::int32_t value){
+		boost::int32_t le;
+		store_le(le, value);
+		data.append(reinterpret_cast<const unsigned char *>(&le), sizeof(le));
+	}
+	void put_int64(std::basic_string<unsigned char> &data, boost::int64_t value){
+		boost::int64_t le;
+		store_le(le, value);
+		data.append(reinterpret_cast<const unsigned char *>(&le), sizeof(le));
+	}
+	void put_cstring(std::basic_string<unsigned char> &data, const char *str){
+		data.append(reinterpret_cast<const unsigned char *>(str), std::strlen(str) + 1);
+	}
+	void put_string(std::basic_string<unsigned char> &data, const char *str, std::size_t len){
+		put_int32(data, boost::numeric_cast<boost::int32_t>(len + 1));
+		data.append(reinterpret_cast<const unsigned char *>(str), len);
+		data.push_back(0);
+	}
+	void patch_int32(std::basic_string<unsigned char> &data, std::size_t offset, std::size_t value){
+		boost::int32_t le;
+		store_le(le, boost::numeric_cast<boost::int32_t>(value));
+		std::memcpy(&data[offset], &le, sizeof(le));
+	}
 
-	for(AUTO(it, m_elements.begin()); it != m_elements.end(); ++it){
-		char key_storage[32];
-		const char *key_str;
-		if(as_array){
-			::bson_uint32_to_string(static_cast<boost::uint32_t>(it - m_elements.begin()), &key_str, key_storage, sizeof(key_storage));
-		} else {
-			key_str = it->name.get();
-		}
-		switch(it->type){
-		case T_BOOLEAN: {
-			bool value;
-			std::memcpy(&value, it->small, sizeof(value));
-			DEBUG_THROW_UNLESS(::bson_append_bool(bt, key_str, -1, value), BasicException, sslit("BSON builder: bson_append_bool() failed"));
-			break; }
-		case T_SIGNED: {
-			boost::int64_t value;
-			std::memcpy(&value, it->small, sizeof(value));
-			DEBUG_THROW_UNLESS(::bson_append_int64(bt, key_str, -1, value), BasicException, sslit("BSON builder: bson_append_int64() failed"));
-			break; }
-		case T_UNSIGNED: {
-			boost::uint64_t value;
-			std::memcpy(&value, it->small, sizeof(value));
-			boost::int64_t shifted = static_cast<boost::int64_t>(value - (1ull << 63));
-			DEBUG_THROW_UNLESS(::bson_append_int64(bt, key_str, -1, shifted), BasicException, sslit("BSON builder: bson_append_int64() failed"));
-			break; }
-		case T_DOUBLE: {
-			double value;
-			std::memcpy(&value, it->small, sizeof(value));
-			DEBUG_THROW_UNLESS(::bson_append_double(bt, key_str, -1, value), BasicException, sslit("BSON builder: bson_append_double() failed"));
-			break; }
-		case T_STRING: {
-			DEBUG_THROW_UNLESS(::bson_append_utf8(bt, key_str, -1, it->large.data(), boost::numeric_cast<int>(it->large.size())), BasicException, sslit("BSON builder: bson_append_utf8() failed"));
-			break; }
-		case T_DATETIME: {
-			boost::uint64_t value;
-			std::memcpy(&value, it->small, sizeof(value));
-			char str[64];
-			std::size_t len = format_time(str, sizeof(str), value, true);
-			DEBUG_THROW_UNLESS(::bson_append_utf8(bt, key_str, -1, str, static_cast<int>(len)), BasicException, sslit("BSON builder: bson_append_utf8() failed"));
-			break; }
-		case T_UUID: {
-			char str[36];
-			Uuid(it->small).to_string(str);
-			DEBUG_THROW_UNLESS(::bson_append_utf8(bt, key_str, -1, str, sizeof(str)), BasicException, sslit("BSON builder: bson_append_utf8() failed"));
-			break; }
-		case T_BLOB: {
-			DEBUG_THROW_UNLESS(::bson_append_binary(bt, key_str, -1, BSON_SUBTYPE_BINARY,
-				reinterpret_cast<const boost::uint8_t *>(it->large.data()), boost::numeric_cast<unsigned>(it->large.size())), BasicException, sslit("BSON builder: bson_append_binary() failed"));
-			break; }
-		case T_JS_CODE: {
-			DEBUG_THROW_UNLESS(::bson_append_code(bt, key_str, -1, it->large.c_str()), BasicException, sslit("BSON builder: bson_append_code() failed"));
-			break; }
-		case T_REGEX: {
-			DEBUG_THROW_UNLESS(::bson_append_regex(bt, key_str, -1, it->large.c_str(), it->small), BasicException, sslit("BSON builder: bson_append_regex() failed"));
-			break; }
-		case T_MINKEY: {
-			DEBUG_THROW_UNLESS(::bson_append_minkey(bt, key_str, -1), BasicException, sslit("BSON builder: bson_append_minkey() failed"));
-			break; }
-		case T_MAXKEY: {
-			DEBUG_THROW_UNLESS(::bson_append_maxkey(bt, key_str, -1), BasicException, sslit("BSON builder: bson_append_maxkey() failed"));
-			break; }
-		case T_NULL: {
-			DEBUG_THROW_UNLESS(::bson_append_null(bt, key_str, -1), BasicException, sslit("BSON builder: bson_append_null() failed"));
-			break; }
-		case T_OBJECT: {
-			::bson_t child_storage;
-			DEBUG_THROW_UNLESS(::bson_init_static(&child_storage, reinterpret_cast<const boost::uint8_t *>(it->large.data()), it->large.size()), BasicException, sslit("BSON builder: bson_init_static() failed"));
-			const UniqueHandle<BsonCloser> child_guard(&child_storage);
-			const AUTO(child_bt, child_guard.get());
-			DEBUG_THROW_UNLESS(::bson_append_document(bt, key_str, -1, child_bt), BasicException, sslit("BSON builder: bson_append_document() failed"));
-			break; }
-		case T_ARRAY: {
-			::bson_t child_storage;
-			DEBUG_THROW_UNLESS(::bson_init_static(&child_storage, reinterpret_cast<const boost::uint8_t *>(it->large.data()), it->large.size()), BasicException, sslit("BSON builder: bson_init_static() failed"));
-			const UniqueHandle<BsonCloser> child_guard(&child_storage);
-			const AUTO(child_bt, child_guard.get());
-			DEBUG_THROW_UNLESS(::bson_append_array(bt, key_str, -1, child_bt), BasicException, sslit("BSON builder: bson_append_array() failed"));
-			break; }
+	// 返回 [begin, end) 开头的 C 风格字符串的长度，包括结尾的空字符。
+	std::size_t get_cstring_size(const unsigned char *begin, const unsigned char *end){
+		const AUTO(pos, static_cast<const unsigned char *>(std::memchr(begin, 0, static_cast<std::size_t>(end - begin))));
+		DEBUG_THROW_UNLESS(pos, BasicException, sslit("BSON builder: Unterminated string"));
+		return static_cast<std::size_t>(pos - begin) + 1;
+	}
+	// 返回 [begin, end) 开头的 type 类型的值的长度。
+	std::size_t get_value_size(unsigned char type, const unsigned char *begin, const unsigned char *end){
+		boost::int32_t len;
+		switch(type){
+		case 0x0A: case 0x7F: case 0xFF: // null, maxkey, minkey
+			return 0;
+		case 0x08: // boolean
+			return 1;
+		case 0x10: // int32
+			return 4;
+		case 0x01: case 0x09: case 0x11: case 0x12: // double, datetime, timestamp, int64
+			return 8;
+		case 0x07: // ObjectId
+			return 12;
+		case 0x13: // decimal128
+			return 16;
+		case 0x02: case 0x0D: case 0x0E: // string, JavaScript code, symbol
+			DEBUG_THROW_UNLESS(end - begin >= 4, BasicException, sslit("BSON builder: Truncated element"));
+			std::memcpy(&len, begin, 4);
+			return 4 + static_cast<std::size_t>(load_le(len));
+		case 0x03: case 0x04: // document, array
+			DEBUG_THROW_UNLESS(end - begin >= 4, BasicException, sslit("BSON builder: Truncated element"));
+			std::memcpy(&len, begin, 4);
+			return static_cast<std::size_t>(load_le(len));
+		case 0x05: // binary
+			DEBUG_THROW_UNLESS(end - begin >= 4, BasicException, sslit("BSON builder: Truncated element"));
+			std::memcpy(&len, begin, 4);
+			return 5 + static_cast<std::size_t>(load_le(len));
+		case 0x0B: { // regex
+			const AUTO(pattern_size, get_cstring_size(begin, end));
+			return pattern_size + get_cstring_size(begin + pattern_size, end); }
 		default:
 			DEBUG_THROW(BasicException, sslit("BSON builder: Unknown element type"));
 		}
 	}
+	// 把 [begin, end) 中的元素复制到 data 末尾，名字按照下标重新生成。
+	void append_renamed_elements(std::basic_string<unsigned char> &data, const unsigned char *begin, const unsigned char *end){
+		std::size_t index = 0;
+		const unsigned char *read = begin;
+		while(read != end){
+			const unsigned char type = *read;
+			const AUTO(key_size, get_cstring_size(read + 1, end));
+			const AUTO(value, read + 1 + key_size);
+			const AUTO(value_size, get_value_size(type, value, end));
+			DEBUG_THROW_UNLESS(static_cast<std::size_t>(end - value) >= value_size, BasicException, sslit("BSON builder: Truncated element"));
+			data.push_back(type);
+			char key_str[32];
+			const int key_len = std::sprintf(key_str, "%lu", static_cast<unsigned long>(index));
+			data.append(reinterpret_cast<const unsigned char *>(key_str), static_cast<std::size_t>(key_len) + 1);
+			data.append(value, value_size);
+			read = value + value_size;
+			++index;
+		}
+	}
+}
+
+void BsonBuilder::append_key(unsigned char type, const SharedNts &name){
+	m_data.push_back(type);
+	if(m_frames.empty()){
+		put_cstring(m_data, name.get());
+		++m_count;
+		return;
+	}
+	AUTO_REF(frame, m_frames.back());
+	if(frame.as_array){
+		char key_str[32];
+		const int key_len = std::sprintf(key_str, "%lu", static_cast<unsigned long>(frame.count));
+		m_data.append(reinterpret_cast<const unsigned char *>(key_str), static_cast<std::size_t>(key_len) + 1);
+	} else {
+		put_cstring(m_data, name.get());
+	}
+	++frame.count;
+}
+void BsonBuilder::append_document(const BsonBuilder &obj, bool as_array){
+	DEBUG_THROW_UNLESS(obj.m_frames.empty(), BasicException, sslit("BSON builder: Unclosed nested document"));
+	const AUTO(offset, m_data.size());
+	put_int32(m_data, 0);
+	if(as_array){
+		append_renamed_elements(m_data, obj.m_data.data(), obj.m_data.data() + obj.m_data.size());
+	} else {
+		m_data.append(obj.m_data);
+	}
+	m_data.push_back(0);
+	patch_int32(m_data, offset, m_data.size() - offset);
+}
+void BsonBuilder::begin_nested(unsigned char type, SharedNts name, bool as_array){
+	append_key(type, name);
+	Frame frame = { m_data.size(), 0, as_array };
+	put_int32(m_data, 0);
+	m_frames.push_back(frame);
+}
+void BsonBuilder::end_nested(bool as_array){
+	DEBUG_THROW_UNLESS(!m_frames.empty() && (m_frames.back().as_array == as_array), BasicException, sslit("BSON builder: Mismatched end of nested document"));
+	const AUTO(offset, m_frames.back().offset);
+	m_frames.pop_back();
+	m_data.push_back(0);
+	patch_int32(m_data, offset, m_data.size() - offset);
+}
+
+bool BsonBuilder::has_element(const char *name) const {
+	PROFILE_ME;
+	DEBUG_THROW_UNLESS(m_frames.empty(), BasicException, sslit("BSON builder: Unclosed nested document"));
+
+	const unsigned char *read = m_data.data();
+	const unsigned char *const end = read + m_data.size();
+	while(read != end){
+		const unsigned char type = *read;
+		const AUTO(key_size, get_cstring_size(read + 1, end));
+		if(std::strcmp(reinterpret_cast<const char *>(read + 1), name) == 0){
+			return true;
+		}
+		const AUTO(value, read + 1 + key_size);
+		read = value + get_value_size(type, value, end);
+	}
+	return false;
 }
 
 void BsonBuilder::append_boolean(SharedNts name, bool value){
-	Element elem = { STD_MOVE(name), T_BOOLEAN };
-	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
-	std::memcpy(elem.small, &value, sizeof(value));
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x08, name);
+	m_data.push_back(value);
 }
 void BsonBuilder::append_signed(SharedNts name, boost::int64_t value){
-	Element elem = { STD_MOVE(name), T_SIGNED };
-	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
-	std::memcpy(elem.small, &value, sizeof(value));
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x12, name);
+	put_int64(m_data, value);
 }
 void BsonBuilder::append_unsigned(SharedNts name, boost::uint64_t value){
-	Element elem = { STD_MOVE(name), T_UNSIGNED };
-	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
-	std::memcpy(elem.small, &value, sizeof(value));
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x12, name);
+	put_int64(m_data, static_cast<boost::int64_t>(value - (1ull << 63)));
 }
 void BsonBuilder::append_double(SharedNts name, double value){
-	Element elem = { STD_MOVE(name), T_DOUBLE };
-	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
-	std::memcpy(elem.small, &value, sizeof(value));
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x01, name);
+	boost::uint64_t bits;
+	BOOST_STATIC_ASSERT(sizeof(bits) == sizeof(value));
+	std::memcpy(&bits, &value, sizeof(value));
+	put_int64(m_data, static_cast<boost::int64_t>(bits));
 }
 void BsonBuilder::append_string(SharedNts name, const std::string &value){
-	Element elem = { STD_MOVE(name), T_STRING };
-	elem.large.append(value.data(), value.size());
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x02, name);
+	put_string(m_data, value.data(), value.size());
 }
 void BsonBuilder::append_datetime(SharedNts name, boost::uint64_t value){
-	Element elem = { STD_MOVE(name), T_DATETIME };
-	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
-	std::memcpy(elem.small, &value, sizeof(value));
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x02, name);
+	char str[64];
+	std::size_t len = format_time(str, sizeof(str), value, true);
+	put_string(m_data, str, len);
 }
 void BsonBuilder::append_uuid(SharedNts name, const Uuid &value){
-	Element elem = { STD_MOVE(name), T_UUID };
-	BOOST_STATIC_ASSERT(sizeof(elem.small) >= sizeof(value));
-	std::memcpy(elem.small, value.data(), value.size());
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x02, name);
+	char str[36];
+	value.to_string(str);
+	put_string(m_data, str, sizeof(str));
 }
 void BsonBuilder::append_blob(SharedNts name, const std::basic_string<unsigned char> &value){
-	Element elem = { STD_MOVE(name), T_BLOB };
-	elem.large.append(reinterpret_cast<const char *>(value.data()), value.size());
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x05, name);
+	put_int32(m_data, boost::numeric_cast<boost::int32_t>(value.size()));
+	m_data.push_back(0x00); // BSON_SUBTYPE_BINARY
+	m_data.append(value);
 }
 
 void BsonBuilder::append_js_code(SharedNts name, const std::string &code){
-	Element elem = { STD_MOVE(name), T_JS_CODE };
-	elem.large.append(code.data(), code.size());
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x0D, name);
+	put_string(m_data, code.c_str(), std::strlen(code.c_str()));
 }
 void BsonBuilder::append_regex(SharedNts name, const std::string &regex, const char *options){
-	Element elem = { STD_MOVE(name), T_REGEX };
-	if(options){
-		::stpncpy(elem.small, options, sizeof(elem.small) - 1)[0] = 0;
-	} else {
-		elem.small[0] = 0;
-	}
-	elem.large.append(regex.data(), regex.size());
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x0B, name);
+	put_cstring(m_data, regex.c_str());
+	// 和 libbson 一样，选项按照字母顺序排列。
+	char sorted[16];
+	::stpncpy(sorted, options ? options : "", sizeof(sorted) - 1)[0] = 0;
+	std::sort(sorted, sorted + std::strlen(sorted));
+	put_cstring(m_data, sorted);
 }
 void BsonBuilder::append_minkey(SharedNts name){
-	Element elem = { STD_MOVE(name), T_MINKEY };
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0xFF, name);
 }
 void BsonBuilder::append_maxkey(SharedNts name){
-	Element elem = { STD_MOVE(name), T_MAXKEY };
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x7F, name);
 }
 void BsonBuilder::append_null(SharedNts name){
-	Element elem = { STD_MOVE(name), T_NULL };
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x0A, name);
 }
 void BsonBuilder::append_object(SharedNts name, const BsonBuilder &obj){
-	Element elem = { STD_MOVE(name), T_OBJECT };
-	Buffer_ostream os;
-	obj.build(os, false);
-	elem.large = os.get_buffer().dump_string();
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x03, name);
+	append_document(obj, false);
 }
 void BsonBuilder::append_array(SharedNts name, const BsonBuilder &arr){
-	Element elem = { STD_MOVE(name), T_ARRAY };
-	Buffer_ostream os;
-	arr.build(os, true);
-	elem.large = os.get_buffer().dump_string();
-	m_elements.push_back(STD_MOVE(elem));
+	append_key(0x04, name);
+	append_document(arr, true);
 }
 
+
 std::basic_string<unsigned char> BsonBuilder::build(bool as_array) const {
 	PROFILE_ME;
+	DEBUG_THROW_UNLESS(m_frames.empty(), BasicException, sslit("BSON builder: Unclosed nested document"));
 
-	Buffer_ostream os;
-	build(os, as_array);
-	return os.get_buffer().dump_byte_string();
+	std::basic_string<unsigned char> data;
+	data.reserve(m_data.size() + 5);
+	put_int32(data, 0);
+	if(as_array){
+		append_renamed_elements(data, m_data.data(), m_data.data() + m_data.size());
+	} else {
+		data.append(m_data);
+	}
+	data.push_back(0);
+	patch_int32(data, 0, data.size());
+	return data;
 }
 void BsonBuilder::build(std::ostream &os, bool as_array) const {
 	PROFILE_ME;
 
-	::bson_t bt_storage = BSON_INITIALIZER;
-	const UniqueHandle<BsonCloser> bt_guard(&bt_storage);
-	const AUTO(bt, bt_guard.get());
-
-	internal_build(bt, as_array);
-
-	os.write(reinterpret_cast<const char *>(::bson_get_data(bt)), boost::numeric_cast<std::streamsize>(bt->len));
+	const AUTO(data, build(as_array));
+	os.write(reinterpret_cast<const char *>(data.data()), boost::numeric_cast<std::streamsize>(data.size()));
 }
 
 std::string BsonBuilder::build_json(bool as_array) const {
@@ -250,12 +297,12 @@ std::string BsonBuilder::build_json(bool as_array) const {
 void BsonBuilder::build_json(std::ostream &os, bool as_array) const {
 	PROFILE_ME;
 
-	::bson_t bt_storage = BSON_INITIALIZER;
+	const AUTO(data, build(as_array));
+	::bson_t bt_storage;
+	DEBUG_THROW_UNLESS(::bson_init_static(&bt_storage, data.data(), data.size()), BasicException, sslit("BSON builder: bson_init_static() failed"));
 	const UniqueHandle<BsonCloser> bt_guard(&bt_storage);
 	const AUTO(bt, bt_guard.get());
 
-	internal_build(bt, as_array);
-
 	const AUTO(json, ::bson_as_json(bt, NULLPTR));
 	DEBUG_THROW_UNLESS(json, BasicException, sslit("BSON builder: Failed to convert BSON to JSON"));
 	const UniqueHandle<BsonStringDeleter> json_guard(json);
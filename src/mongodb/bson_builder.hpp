@@ -7,7 +7,7 @@
 #include "../cxx_ver.hpp"
 #include "../fwd.hpp"
 #include "../shared_nts.hpp"
-#include <boost/container/deque.hpp>
+#include <boost/container/vector.hpp>
 #include <boost/cstdint.hpp>
 #include <string>
 #include <iosfwd>
@@ -16,53 +16,43 @@
 namespace Poseidon {
 namespace MongoDb {
 
+// 每次追加元素时直接编码为 BSON，写入一块连续的缓冲区，生成时只需要补上长度和结尾。
+// 嵌套的对象和数组可以用 begin_object()/begin_array() 就地生成，在对应的 end_object()/end_array() 之前追加的元素都属于它。
+// 数组中的元素的名字被忽略，按照下标重新命名。
 class BsonBuilder {
 private:
-	enum Type {
-		T_BOOLEAN    =  1,
-		T_SIGNED     =  2,
-		T_UNSIGNED   =  3,
-		T_DOUBLE     =  4,
-		T_STRING     =  5,
-		T_DATETIME   =  6,
-		T_UUID       =  7,
-		T_BLOB       =  8,
-
-		T_JS_CODE    = 93,
-		T_REGEX      = 94,
-		T_MINKEY     = 95,
-		T_MAXKEY     = 96,
-		T_NULL       = 97,
-		T_OBJECT     = 98,
-		T_ARRAY      = 99,
-	};
-
-	struct Element {
-		SharedNts name;
-		Type type;
-		std::string large;
-		char small[16];
+	struct Frame {
+		std::size_t offset; // 子文档的长度字段在 m_data 中的位置。
+		std::size_t count;
+		bool as_array;
 	};
 
 private:
-	boost::container::deque<Element> m_elements;
+	std::basic_string<unsigned char> m_data;
+	std::size_t m_count;
+	boost::container::vector<Frame> m_frames;
 
 public:
 	BsonBuilder()
-		: m_elements()
+		: m_data(), m_count(0), m_frames()
 	{ }
 #ifndef POSEIDON_CXX11
 	BsonBuilder(const BsonBuilder &rhs)
-		: m_elements(rhs.m_elements)
+		: m_data(rhs.m_data), m_count(rhs.m_count), m_frames(rhs.m_frames)
 	{ }
 	BsonBuilder &operator=(const BsonBuilder &rhs){
-		m_elements = rhs.m_elements;
+		m_data = rhs.m_data;
+		m_count = rhs.m_count;
+		m_frames = rhs.m_frames;
 		return *this;
 	}
 #endif
 
 private:
-	void internal_build(void *impl, bool as_array) const;
+	void append_key(unsigned char type, const SharedNts &name);
+	void append_document(const BsonBuilder &obj, bool as_array);
+	void begin_nested(unsigned char type, SharedNts name, bool as_array);
+	void end_nested(bool as_array);
 
 public:
 	void append_boolean(SharedNts name, bool value);
@@ -82,19 +72,43 @@ public:
 	void append_object(SharedNts name, const BsonBuilder &obj);
 	void append_array(SharedNts name, const BsonBuilder &arr);
 
+	void begin_object(SharedNts name){
+		begin_nested(0x03, STD_MOVE(name), false);
+	}
+	void end_object(){
+		end_nested(false);
+	}
+	void begin_array(SharedNts name){
+		begin_nested(0x04, STD_MOVE(name), true);
+	}
+	void end_array(){
+		end_nested(true);
+	}
+
 	bool empty() const {
-		return m_elements.empty();
+		return m_count == 0;
 	}
+	// 查找顶层的元素。
+	bool has_element(const char *name) const;
+	// 顶层的元素个数。
 	std::size_t size() const {
-		return m_elements.size();
+		return m_count;
+	}
+	// build() 生成的字节数。
+	std::size_t get_encoded_size() const {
+		return m_data.size() + 5;
 	}
 	void clear() NOEXCEPT {
-		m_elements.clear();
+		m_data.clear();
+		m_count = 0;
+		m_frames.clear();
 	}
 
 	void swap(BsonBuilder &rhs) NOEXCEPT {
 		using std::swap;
-		swap(m_elements, rhs.m_elements);
+		swap(m_data, rhs.m_data);
+		swap(m_count, rhs.m_count);
+		swap(m_frames, rhs.m_frames);
 	}
 
 	std::basic_string<unsigned char> build(bool as_array = false) const;
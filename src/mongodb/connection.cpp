@@ -15,6 +15,7 @@
 #include "../profiler.hpp"
 #include "../time.hpp"
 #include "../uuid.hpp"
+#include "../singletons/main_config.hpp"
 #include <cstdlib>
 
 #pragma GCC diagnostic push
@@ -55,6 +56,23 @@ namespace {
 		}
 	};
 
+	struct DatabaseCloser {
+		CONSTEXPR ::mongoc_database_t *operator()() const NOEXCEPT {
+			return NULLPTR;
+		}
+		void operator()(::mongoc_database_t *database) const NOEXCEPT {
+			::mongoc_database_destroy(database);
+		}
+	};
+	struct ChangeStreamCloser {
+		CONSTEXPR ::mongoc_change_stream_t *operator()() const NOEXCEPT {
+			return NULLPTR;
+		}
+		void operator()(::mongoc_change_stream_t *stream) const NOEXCEPT {
+			::mongoc_change_stream_destroy(stream);
+		}
+	};
+
 	struct BsonCloser {
 		CONSTEXPR ::bson_t *operator()() const NOEXCEPT {
 			return NULLPTR;
@@ -76,11 +94,17 @@ namespace {
 		::bson_iter_t m_batch_it;
 		::bson_t m_element_storage;
 		UniqueHandle<BsonCloser> m_element_guard;
+		mutable ::bson_iter_t m_field_it;
+		mutable bool m_field_it_valid;
+
+		UniqueHandle<DatabaseCloser> m_watched_database;
+		UniqueHandle<ChangeStreamCloser> m_change_stream;
 
 	public:
-		DelegatedConnection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *auth_database, bool use_ssl, const char *database)
+		DelegatedConnection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *auth_database, bool use_ssl, const char *database, const char *compressors)
 			: m_database(database)
 			, m_cursor_id(0), m_cursor_ns()
+			, m_field_it_valid(false)
 		{
 			PROFILE_ME;
 
@@ -90,6 +114,12 @@ namespace {
 			DEBUG_THROW_UNLESS(::mongoc_uri_set_password(m_uri.get(), password), BasicException, sslit("::mongoc_uri_set_password() failed"));
 			DEBUG_THROW_UNLESS(::mongoc_uri_set_database(m_uri.get(), auth_database), BasicException, sslit("::mongoc_uri_set_database() failed"));
 			DEBUG_THROW_UNLESS(::mongoc_uri_set_option_as_bool(m_uri.get(), "ssl", use_ssl), BasicException, sslit("::mongoc_uri_set_option_as_bool() failed"));
+			if(*compressors){
+				// 驱动不支持的算法会被忽略。
+				DEBUG_THROW_UNLESS(::mongoc_uri_set_compressors(m_uri.get(), compressors), BasicException, sslit("::mongoc_uri_set_compressors() failed"));
+				const AUTO(zlib_level, MainConfig::get<int>("mongodb_zlib_compression_level", -1));
+				DEBUG_THROW_UNLESS(::mongoc_uri_set_option_as_int32(m_uri.get(), MONGOC_URI_ZLIBCOMPRESSIONLEVEL, zlib_level), BasicException, sslit("::mongoc_uri_set_option_as_int32() failed"));
+			}
 			DEBUG_THROW_UNLESS(m_client.reset(::mongoc_client_new_from_uri(m_uri.get())), BasicException, sslit("::mongoc_client_new_from_uri() failed"));
 		}
 
@@ -170,6 +200,56 @@ namespace {
 				}
 			}
 		}
+		void execute_bulk_write(const BsonBuilder &bson, boost::container::vector<WriteError> &write_errors) FINAL {
+			PROFILE_ME;
+
+			const AUTO(query_data, bson.build(false));
+			::bson_t query_storage;
+			bool success = ::bson_init_static(&query_storage, reinterpret_cast<const boost::uint8_t *>(query_data.data()), query_data.size());
+			DEBUG_THROW_ASSERT(success);
+			const UniqueHandle<BsonCloser> query_guard(&query_storage);
+			const AUTO(query_bt, query_guard.get());
+
+			discard_result();
+
+			LOG_POSEIDON_DEBUG("Sending bulk write to MongoDB server: ", bson.build_json());
+			::bson_t reply_storage;
+			::bson_error_t err;
+			success = ::mongoc_client_command_simple(m_client.get(), m_database.get(), query_bt, NULLPTR, &reply_storage, &err);
+			// `reply` is always set.
+			const UniqueHandle<BsonCloser> reply_guard(&reply_storage);
+			const AUTO(reply_bt, reply_guard.get());
+			DEBUG_THROW_UNLESS(success, Exception, m_database, err.code, SharedNts(err.message));
+
+			// 命令成功时，失败的写入在 `writeErrors` 中，每个元素包含 `index`、`code` 和 `errmsg`。
+			::bson_iter_t it;
+			if(!::bson_iter_init_find(&it, reply_bt, "writeErrors") || !BSON_ITER_HOLDS_ARRAY(&it)){
+				return;
+			}
+			::bson_iter_t array_it;
+			success = ::bson_iter_recurse(&it, &array_it);
+			DEBUG_THROW_ASSERT(success);
+			while(::bson_iter_next(&array_it)){
+				if(!BSON_ITER_HOLDS_DOCUMENT(&array_it)){
+					continue;
+				}
+				WriteError write_error = { 0, 0, std::string() };
+				::bson_iter_t error_it;
+				success = ::bson_iter_recurse(&array_it, &error_it);
+				DEBUG_THROW_ASSERT(success);
+				while(::bson_iter_next(&error_it)){
+					const char *const key = ::bson_iter_key(&error_it);
+					if(std::strcmp(key, "index") == 0){
+						write_error.index = static_cast<std::size_t>(::bson_iter_as_int64(&error_it));
+					} else if(std::strcmp(key, "code") == 0){
+						write_error.code = ::bson_iter_as_int64(&error_it);
+					} else if((std::strcmp(key, "errmsg") == 0) && BSON_ITER_HOLDS_UTF8(&error_it)){
+						write_error.message = ::bson_iter_utf8(&error_it, NULLPTR);
+					}
+				}
+				write_errors.push_back(STD_MOVE(write_error));
+			}
+		}
 		void discard_result() NOEXCEPT FINAL {
 			PROFILE_ME;
 
@@ -177,6 +257,7 @@ namespace {
 			m_cursor_ns.clear();
 			m_batch_guard.reset();
 			m_element_guard.reset();
+			m_field_it_valid = false;
 		}
 
 		bool fetch_next() FINAL {
@@ -253,6 +334,7 @@ namespace {
 			::bson_iter_document(&m_batch_it, &size, &data);
 			DEBUG_THROW_UNLESS(::bson_init_static(&m_element_storage, data, size), BasicException, sslit("::bson_init_static() failed"));
 			m_element_guard.reset(&m_element_storage);
+			m_field_it_valid = ::bson_iter_init(&m_field_it, &m_element_storage);
 			return true;
 		}
 
@@ -341,11 +423,209 @@ namespace {
 			::bson_iter_binary(&it, NULLPTR, &len, &data);
 			return std::basic_string<unsigned char>(data, len);
 		}
+
+		bool get_string_view(const char *name, const char *&data, std::size_t &size) const FINAL {
+			PROFILE_ME;
+
+			::bson_iter_t it;
+			if(!find_bson_element_and_check_type(it, name, BSON_TYPE_UTF8)){
+				return false;
+			}
+			boost::uint32_t len;
+			data = ::bson_iter_utf8(&it, &len);
+			size = len;
+			return true;
+		}
+		bool get_blob_view(const char *name, const unsigned char *&data, std::size_t &size) const FINAL {
+			PROFILE_ME;
+
+			::bson_iter_t it;
+			if(!find_bson_element_and_check_type(it, name, BSON_TYPE_BINARY)){
+				return false;
+			}
+			boost::uint32_t len;
+			const boost::uint8_t *ptr;
+			::bson_iter_binary(&it, NULLPTR, &len, &ptr);
+			data = ptr;
+			size = len;
+			return true;
+		}
+
+		bool next_field(FieldView &field) const FINAL {
+			if(!m_field_it_valid){
+				return false;
+			}
+			if(!::bson_iter_next(&m_field_it)){
+				m_field_it_valid = false;
+				return false;
+			}
+			field.name = ::bson_iter_key(&m_field_it);
+			field.type = static_cast<unsigned>(::bson_iter_type(&m_field_it));
+			field.boolean = false;
+			field.integer = 0;
+			field.real = 0;
+			field.data = NULLPTR;
+			field.size = 0;
+			switch(field.type){
+			case BSON_TYPE_BOOL:
+				field.boolean = ::bson_iter_bool(&m_field_it);
+				break;
+			case BSON_TYPE_INT64:
+				field.integer = ::bson_iter_int64(&m_field_it);
+				break;
+			case BSON_TYPE_DOUBLE:
+				field.real = ::bson_iter_double(&m_field_it);
+				break;
+			case BSON_TYPE_UTF8: {
+				boost::uint32_t len;
+				field.data = ::bson_iter_utf8(&m_field_it, &len);
+				field.size = len;
+				break; }
+			case BSON_TYPE_BINARY: {
+				boost::uint32_t len;
+				const boost::uint8_t *data;
+				::bson_iter_binary(&m_field_it, NULLPTR, &len, &data);
+				field.data = data;
+				field.size = len;
+				break; }
+			}
+			return true;
+		}
+
+		void watch_changes(const boost::container::vector<std::string> &collections, boost::uint64_t max_await_time) FINAL {
+			PROFILE_ME;
+
+			m_change_stream.reset();
+			m_watched_database.reset();
+
+			BsonBuilder pipeline;
+			if(!collections.empty()){
+				BsonBuilder names;
+				for(AUTO(it, collections.begin()); it != collections.end(); ++it){
+					names.append_string(sslit(""), *it);
+				}
+				BsonBuilder stage;
+				stage.begin_object(sslit("$match"));
+				stage.begin_object(sslit("ns.coll"));
+				stage.append_array(sslit("$in"), names);
+				stage.end_object();
+				stage.end_object();
+				pipeline.append_object(sslit(""), stage);
+			}
+			const AUTO(pipeline_data, pipeline.build(true));
+			::bson_t pipeline_storage;
+			bool success = ::bson_init_static(&pipeline_storage, pipeline_data.data(), pipeline_data.size());
+			DEBUG_THROW_ASSERT(success);
+			const UniqueHandle<BsonCloser> pipeline_guard(&pipeline_storage);
+
+			const AUTO(opts_data, bson_scalar_signed(sslit("maxAwaitTimeMS"), boost::numeric_cast<boost::int64_t>(max_await_time)).build(false));
+			::bson_t opts_storage;
+			success = ::bson_init_static(&opts_storage, opts_data.data(), opts_data.size());
+			DEBUG_THROW_ASSERT(success);
+			const UniqueHandle<BsonCloser> opts_guard(&opts_storage);
+
+			DEBUG_THROW_UNLESS(m_watched_database.reset(::mongoc_client_get_database(m_client.get(), m_database.get())), BasicException, sslit("::mongoc_client_get_database() failed"));
+			DEBUG_THROW_UNLESS(m_change_stream.reset(::mongoc_database_watch(m_watched_database.get(), pipeline_guard.get(), opts_guard.get())), BasicException, sslit("::mongoc_database_watch() failed"));
+			LOG_POSEIDON_DEBUG("Watching MongoDB changes: database = ", m_database, ", pipeline = ", pipeline.build_json(true));
+		}
+		bool fetch_change(ChangeNotification &change) FINAL {
+			PROFILE_ME;
+
+			DEBUG_THROW_UNLESS(m_change_stream, BasicException, sslit("No change stream has been opened"));
+			const ::bson_t *doc;
+			if(!::mongoc_change_stream_next(m_change_stream.get(), &doc)){
+				::bson_error_t err;
+				if(::mongoc_change_stream_error_document(m_change_stream.get(), &err, NULLPTR)){
+					m_change_stream.reset();
+					DEBUG_THROW(Exception, m_database, err.code, SharedNts(err.message));
+				}
+				return false;
+			}
+			change.operation.clear();
+			change.collection.clear();
+			change.document_id.clear();
+			::bson_iter_t it, child_it;
+			if(::bson_iter_init_find(&it, doc, "operationType") && BSON_ITER_HOLDS_UTF8(&it)){
+				change.operation = ::bson_iter_utf8(&it, NULLPTR);
+			}
+			if(::bson_iter_init(&it, doc) && ::bson_iter_find_descendant(&it, "ns.coll", &child_it) && BSON_ITER_HOLDS_UTF8(&child_it)){
+				change.collection = ::bson_iter_utf8(&child_it, NULLPTR);
+			}
+			if(::bson_iter_init(&it, doc) && ::bson_iter_find_descendant(&it, "documentKey._id", &child_it) && BSON_ITER_HOLDS_UTF8(&child_it)){
+				change.document_id = ::bson_iter_utf8(&child_it, NULLPTR);
+			}
+			return true;
+		}
 	};
+
+	// 字段不存在或者为 null 时返回 false。
+	bool check_field_type(const Connection::FieldView &field, ::bson_type_t type_expecting){
+		if((field.type == 0) || (field.type == BSON_TYPE_UNDEFINED) || (field.type == BSON_TYPE_NULL)){
+			return false;
+		}
+		DEBUG_THROW_UNLESS(field.type == static_cast<unsigned>(type_expecting), BasicException, sslit("BSON type mismatch"));
+		return true;
+	}
+}
+
+bool Connection::decode_boolean(const FieldView &field){
+	if(!check_field_type(field, BSON_TYPE_BOOL)){
+		return VAL_INIT;
+	}
+	return field.boolean;
+}
+boost::int64_t Connection::decode_signed(const FieldView &field){
+	if(!check_field_type(field, BSON_TYPE_INT64)){
+		return VAL_INIT;
+	}
+	return field.integer;
+}
+boost::uint64_t Connection::decode_unsigned(const FieldView &field){
+	if(!check_field_type(field, BSON_TYPE_INT64)){
+		return VAL_INIT;
+	}
+	return static_cast<boost::uint64_t>(field.integer) + (1ull << 63);
+}
+double Connection::decode_double(const FieldView &field){
+	if(!check_field_type(field, BSON_TYPE_DOUBLE)){
+		return VAL_INIT;
+	}
+	return field.real;
+}
+void Connection::decode_string_view(const FieldView &field, const char *&data, std::size_t &size){
+	if(!check_field_type(field, BSON_TYPE_UTF8)){
+		data = "";
+		size = 0;
+		return;
+	}
+	data = static_cast<const char *>(field.data);
+	size = field.size;
+}
+boost::uint64_t Connection::decode_datetime(const FieldView &field){
+	if(!check_field_type(field, BSON_TYPE_UTF8)){
+		return VAL_INIT;
+	}
+	return scan_time(static_cast<const char *>(field.data));
+}
+Uuid Connection::decode_uuid(const FieldView &field){
+	if(!check_field_type(field, BSON_TYPE_UTF8)){
+		return VAL_INIT;
+	}
+	DEBUG_THROW_UNLESS(field.size == 36, BasicException, sslit("Unexpected UUID string length"));
+	return Uuid(*static_cast<const char (*)[36]>(field.data));
+}
+void Connection::decode_blob_view(const FieldView &field, const unsigned char *&data, std::size_t &size){
+	if(!check_field_type(field, BSON_TYPE_BINARY)){
+		data = NULLPTR;
+		size = 0;
+		return;
+	}
+	data = static_cast<const unsigned char *>(field.data);
+	size = field.size;
 }
 
-boost::shared_ptr<Connection> Connection::create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *auth_database, bool use_ssl, const char *database){
-	return boost::make_shared<DelegatedConnection>(server_addr, server_port, user_name, password, auth_database, use_ssl, database);
+boost::shared_ptr<Connection> Connection::create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *auth_database, bool use_ssl, const char *database, const char *compressors){
+	return boost::make_shared<DelegatedConnection>(server_addr, server_port, user_name, password, auth_database, use_ssl, database, compressors);
 }
 
 Connection::~Connection(){ }
@@ -11,6 +11,7 @@
 #include <cstring>
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 namespace MongoDb {
@@ -19,7 +20,43 @@ class BsonBuilder;
 
 class Connection : NONCOPYABLE {
 public:
-	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *auth_database, bool use_ssl, const char *database);
+	struct WriteError {
+		std::size_t index;
+		boost::int64_t code;
+		std::string message;
+	};
+
+	// 当前文档中的一个字段。指针指向结果集内部，在下一次调用 fetch_next() 或者 discard_result() 之前有效。
+	struct FieldView {
+		const char *name;
+		unsigned type; // BSON 类型，字段不存在时为 0。
+		bool boolean;
+		boost::int64_t integer;
+		double real;
+		const void *data; // 字符串（以空字符结尾）或者二进制数据。
+		std::size_t size;
+	};
+
+	// 变更流中的一条通知。
+	struct ChangeNotification {
+		std::string operation; // insert、update、replace、delete、drop、rename、dropDatabase 或者 invalidate。
+		std::string collection;
+		std::string document_id; // 只有 _id 是字符串时有效。
+	};
+
+	// 以下函数解码 next_field() 返回的字段。字段不存在或者为 null 时返回零值，类型不符时抛出异常。
+	static bool decode_boolean(const FieldView &field);
+	static boost::int64_t decode_signed(const FieldView &field);
+	static boost::uint64_t decode_unsigned(const FieldView &field);
+	static double decode_double(const FieldView &field);
+	static void decode_string_view(const FieldView &field, const char *&data, std::size_t &size);
+	static boost::uint64_t decode_datetime(const FieldView &field);
+	static Uuid decode_uuid(const FieldView &field);
+	static void decode_blob_view(const FieldView &field, const unsigned char *&data, std::size_t &size);
+
+public:
+	// compressors 是用逗号分隔的压缩算法（zstd、snappy、zlib），按照优先顺序排列，由服务器选择其中之一。空字符串表示不压缩。
+	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *auth_database, bool use_ssl, const char *database, const char *compressors = "");
 
 public:
 	virtual ~Connection();
@@ -27,6 +64,8 @@ public:
 public:
 	virtual void execute_bson(const BsonBuilder &bson) = 0;
 	virtual void discard_result() NOEXCEPT = 0;
+	// 执行 insert、update 或者 delete 命令。命令本身失败时抛出异常，其中某些写入失败时把它们的下标和原因保存在 write_errors 中。
+	virtual void execute_bulk_write(const BsonBuilder &bson, boost::container::vector<WriteError> &write_errors) = 0;
 
 	virtual bool fetch_next() = 0;
 
@@ -38,6 +77,20 @@ public:
 	virtual boost::uint64_t get_datetime(const char *name) const = 0;
 	virtual Uuid get_uuid(const char *name) const = 0;
 	virtual std::basic_string<unsigned char> get_blob(const char *name) const = 0;
+
+	// 不复制数据的版本，指针的有效期同 FieldView。字段不存在或者为 null 时返回 false。
+	virtual bool get_string_view(const char *name, const char *&data, std::size_t &size) const = 0;
+	virtual bool get_blob_view(const char *name, const unsigned char *&data, std::size_t &size) const = 0;
+
+	// 按照文档中的顺序返回当前文档的下一个字段，没有更多字段时返回 false。每次 fetch_next() 之后从第一个字段开始。
+	// 只遍历文档一次，不像上面的函数那样每次按名字从头查找。
+	virtual bool next_field(FieldView &field) const = 0;
+
+	// 打开当前数据库上的变更流，代替之前的变更流。服务器必须是副本集。
+	// 如果 collections 非空，只报告其中的集合的变更。
+	virtual void watch_changes(const boost::container::vector<std::string> &collections, boost::uint64_t max_await_time) = 0;
+	// 等待下一条变更通知，最多等待 watch_changes() 指定的毫秒数。超时返回 false，变更流出错时抛出异常。
+	virtual bool fetch_change(ChangeNotification &change) = 0;
 };
 
 }
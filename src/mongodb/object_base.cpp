@@ -27,6 +27,10 @@ try {
 	if(!is_auto_saving_enabled()){
 		return false;
 	}
+	// 已经有保存操作在等待，它会写入这次修改。为什么这样是安全的见 MySql::ObjectBase::invalidate()。
+	if(get_combined_write_stamp()){
+		return true;
+	}
 	async_save(true, false);
 	return true;
 } catch(std::exception &e){
@@ -37,12 +41,26 @@ try {
 	return false;
 }
 
+void ObjectBase::generate_projection(BsonBuilder & /* projection */) const {
+	// 返回整个文档。
+}
+bool ObjectBase::generate_update(BsonBuilder &update) const {
+	(void)update;
+	return false;
+}
+
 void *ObjectBase::get_combined_write_stamp() const {
 	return atomic_load(m_combined_write_stamp, ATOMIC_CONSUME);
 }
 void ObjectBase::set_combined_write_stamp(void *stamp) const {
 	atomic_store(m_combined_write_stamp, stamp, ATOMIC_RELEASE);
 }
+bool ObjectBase::is_persisted() const {
+	return atomic_load(m_persisted, ATOMIC_CONSUME);
+}
+void ObjectBase::set_persisted(bool persisted) const {
+	atomic_store(m_persisted, persisted, ATOMIC_RELEASE);
+}
 void ObjectBase::async_save(bool to_replace, bool urgent) const {
 	enable_auto_saving();
 	MongoDbDaemon::enqueue_for_saving(virtual_shared_from_this<ObjectBase>(), to_replace, urgent);
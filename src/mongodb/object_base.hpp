@@ -36,13 +36,14 @@ public:
 private:
 	mutable volatile bool m_auto_saves;
 	mutable void *volatile m_combined_write_stamp;
+	mutable volatile bool m_persisted;
 
 protected:
 	mutable RecursiveMutex m_mutex;
 
 public:
 	ObjectBase()
-		: m_auto_saves(false), m_combined_write_stamp(NULLPTR)
+		: m_auto_saves(false), m_combined_write_stamp(NULLPTR), m_persisted(false)
 	{ }
 	// 不要不写析构函数，否则 RTTI 将无法在动态库中使用。
 	~ObjectBase();
@@ -52,14 +53,25 @@ public:
 	void enable_auto_saving() const;
 	void disable_auto_saving() const;
 
+	// 开启了自动保存时投递一个保存操作，在写入延迟之后执行。如果已经有一个在等待就什么也不做，
+	// 所以在一个写入延迟之内无论修改多少次，每个对象只有一个保存操作。
 	bool invalidate() const NOEXCEPT;
 
 	void *get_combined_write_stamp() const;
 	void set_combined_write_stamp(void *stamp) const;
+	// 对象被 fetch() 读取或者保存操作成功完成之后，数据库中就有了这个文档。
+	// 保存操作最终失败时被清除，下次保存时重新写入完整的文档。
+	bool is_persisted() const;
+	void set_persisted(bool persisted = true) const;
 
 	virtual const char *get_collection() const = 0;
 
 	virtual void generate_document(BsonBuilder &doc) const = 0;
+	// 只包含 fetch() 读取的字段，用于 find 命令的 projection。默认实现不生成任何字段，即返回整个文档。
+	virtual void generate_projection(BsonBuilder &projection) const;
+	// 生成只包含修改过的字段的 update 文档（$set 和 $inc），并清除修改标记。文档不存在时以 upsert 写入这些字段。
+	// 如果对象尚未保存过，或者没有修改过的字段，返回 false，此时应当写入完整的文档。默认实现返回 false。
+	virtual bool generate_update(BsonBuilder &update) const;
 	virtual std::string generate_primary_key() const = 0;
 	virtual void fetch(const boost::shared_ptr<const Connection> &conn) = 0;
 	void async_save(bool to_replace, bool urgent = false) const;
@@ -70,16 +82,34 @@ class ObjectBase::Field : NONCOPYABLE {
 private:
 	ObjectBase *const m_parent;
 	ValueT m_value;
+	mutable bool m_dirty;
+	// 自从上次清除修改标记以来只调用过 increment()，m_increment 是增量的总和。
+	mutable bool m_incremented;
+	ValueT m_increment;
 
 public:
 	explicit Field(ObjectBase *parent, ValueT value = ValueT())
-		: m_parent(parent), m_value(STD_MOVE_IDN(value))
+		: m_parent(parent), m_value(STD_MOVE_IDN(value)), m_dirty(false), m_incremented(false), m_increment()
 	{ }
 
 public:
 	const ValueT &unlocked_get() const {
 		return m_value;
 	}
+	// 调用者需要锁定父对象。
+	bool unlocked_is_dirty() const {
+		return m_dirty;
+	}
+	bool unlocked_is_incremented() const {
+		return m_incremented;
+	}
+	const ValueT &unlocked_get_increment() const {
+		return m_increment;
+	}
+	void unlocked_clear_dirty() const {
+		m_dirty = false;
+		m_incremented = false;
+	}
 	ValueT get() const {
 		const RecursiveMutex::UniqueLock lock(m_parent->m_mutex);
 		return m_value;
@@ -89,6 +119,38 @@ public:
 		m_value = STD_MOVE_IDN(value);
 
 		if(invalidates_parent){
+			m_dirty = true;
+			m_incremented = false;
+			m_parent->invalidate();
+		}
+	}
+	// 只适用于数值。保存时使用 $inc 而不是 $set，这样其他进程对同一个字段的增减不会被覆盖。
+	// 如果自从上次保存以来调用过 set()，仍然使用 $set。
+	void increment(ValueT delta, bool invalidates_parent = true){
+		const RecursiveMutex::UniqueLock lock(m_parent->m_mutex);
+		m_value += delta;
+
+		if(invalidates_parent){
+			if(!m_dirty){
+				m_dirty = true;
+				m_incremented = true;
+				m_increment = delta;
+			} else if(m_incremented){
+				m_increment += delta;
+			}
+			m_parent->invalidate();
+		}
+	}
+
+	// 只适用于字符串，复用已经分配的内存。
+	template<typename IteratorT>
+	void assign(IteratorT begin, IteratorT end, bool invalidates_parent = true){
+		const RecursiveMutex::UniqueLock lock(m_parent->m_mutex);
+		m_value.assign(begin, end);
+
+		if(invalidates_parent){
+			m_dirty = true;
+			m_incremented = false;
 			m_parent->invalidate();
 		}
 	}
@@ -102,6 +164,8 @@ public:
 		is >>m_value;
 
 		if(invalidates_parent){
+			m_dirty = true;
+			m_incremented = false;
 			m_parent->invalidate();
 		}
 	}
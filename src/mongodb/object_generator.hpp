@@ -73,6 +73,8 @@ public:
 public:
 	const char *get_collection() const OVERRIDE;
 	void generate_document(::Poseidon::MongoDb::BsonBuilder &doc_) const OVERRIDE;
+	void generate_projection(::Poseidon::MongoDb::BsonBuilder &projection_) const OVERRIDE;
+	bool generate_update(::Poseidon::MongoDb::BsonBuilder &update_) const OVERRIDE;
 	::std::string generate_primary_key() const OVERRIDE;
 	void fetch(const ::boost::shared_ptr<const ::Poseidon::MongoDb::Connection> &conn_) OVERRIDE;
 };
@@ -158,6 +160,7 @@ void OBJECT_NAME::generate_document(::Poseidon::MongoDb::BsonBuilder &doc_) cons
 	PROFILE_ME;
 
 	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	// 完整的文档包含了所有的字段，清除修改标记，之后的 $set 不需要重复写入它们。
 
 	AUTO(pkey_, generate_primary_key());
 	if(!pkey_.empty()){
@@ -173,17 +176,80 @@ void OBJECT_NAME::generate_document(::Poseidon::MongoDb::BsonBuilder &doc_) cons
 #undef FIELD_UUID
 #undef FIELD_BLOB
 
-#define FIELD_BOOLEAN(id_)                doc_.append_boolean  (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_SIGNED(id_)                 doc_.append_signed   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_UNSIGNED(id_)               doc_.append_unsigned (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_DOUBLE(id_)                 doc_.append_double   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_STRING(id_)                 doc_.append_string   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_DATETIME(id_)               doc_.append_datetime (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_UUID(id_)                   doc_.append_uuid     (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
-#define FIELD_BLOB(id_)                   doc_.append_blob     (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);
+#define FIELD_BOOLEAN(id_)                doc_.append_boolean  (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_SIGNED(id_)                 doc_.append_signed   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_UNSIGNED(id_)               doc_.append_unsigned (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_DOUBLE(id_)                 doc_.append_double   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_STRING(id_)                 doc_.append_string   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_DATETIME(id_)               doc_.append_datetime (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_UUID(id_)                   doc_.append_uuid     (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
+#define FIELD_BLOB(id_)                   doc_.append_blob     (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_);	id_.unlocked_clear_dirty();
 
 	OBJECT_FIELDS
 }
+void OBJECT_NAME::generate_projection(::Poseidon::MongoDb::BsonBuilder &projection_) const {
+	PROFILE_ME;
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_SIGNED(id_)                 projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_UNSIGNED(id_)               projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_DOUBLE(id_)                 projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_STRING(id_)                 projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_DATETIME(id_)               projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_UUID(id_)                   projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+#define FIELD_BLOB(id_)                   projection_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), 1);
+
+	OBJECT_FIELDS
+}
+bool OBJECT_NAME::generate_update(::Poseidon::MongoDb::BsonBuilder &update_) const {
+	PROFILE_ME;
+
+	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	if(!is_persisted()){
+		return false;
+	}
+	::Poseidon::MongoDb::BsonBuilder set_, inc_;
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+	// 无符号整数在文档中加上了偏移量，增量按照 64 位补码写入，结果是一样的。
+#define FIELD_BOOLEAN(id_)                if(id_.unlocked_is_dirty()){ set_.append_boolean  (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_SIGNED(id_)                 if(id_.unlocked_is_dirty()){ if(id_.unlocked_is_incremented()){ inc_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get_increment()); } else { set_.append_signed   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get()); }	id_.unlocked_clear_dirty(); }
+#define FIELD_UNSIGNED(id_)               if(id_.unlocked_is_dirty()){ if(id_.unlocked_is_incremented()){ inc_.append_signed(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), static_cast< ::boost::int64_t>(id_.unlocked_get_increment())); } else { set_.append_unsigned (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get()); }	id_.unlocked_clear_dirty(); }
+#define FIELD_DOUBLE(id_)                 if(id_.unlocked_is_dirty()){ if(id_.unlocked_is_incremented()){ inc_.append_double(::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get_increment()); } else { set_.append_double   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get()); }	id_.unlocked_clear_dirty(); }
+#define FIELD_STRING(id_)                 if(id_.unlocked_is_dirty()){ set_.append_string   (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_DATETIME(id_)               if(id_.unlocked_is_dirty()){ set_.append_datetime (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_UUID(id_)                   if(id_.unlocked_is_dirty()){ set_.append_uuid     (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_BLOB(id_)                   if(id_.unlocked_is_dirty()){ set_.append_blob     (::Poseidon::SharedNts::view(TOKEN_TO_STR(id_)), id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+
+	OBJECT_FIELDS
+	if(set_.empty() && inc_.empty()){
+		return false;
+	}
+	if(!set_.empty()){
+		update_.append_object(::Poseidon::SharedNts::view("$set"), STD_MOVE(set_));
+	}
+	if(!inc_.empty()){
+		update_.append_object(::Poseidon::SharedNts::view("$inc"), STD_MOVE(inc_));
+	}
+	return true;
+}
 ::std::string OBJECT_NAME::generate_primary_key() const {
 	PROFILE_ME;
 
@@ -191,10 +257,11 @@ void OBJECT_NAME::generate_document(::Poseidon::MongoDb::BsonBuilder &doc_) cons
 
 	OBJECT_PRIMARY_KEY
 }
-void fetch(const ::boost::shared_ptr<const ::Poseidon::MongoDb::Connection> &conn_){
+void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::MongoDb::Connection> &conn_){
 	PROFILE_ME;
 
 	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	set_persisted();
 
 #undef FIELD_BOOLEAN
 #undef FIELD_SIGNED
@@ -205,16 +272,95 @@ void fetch(const ::boost::shared_ptr<const ::Poseidon::MongoDb::Connection> &con
 #undef FIELD_UUID
 #undef FIELD_BLOB
 
-#define FIELD_BOOLEAN(id_)                id_.set(conn_->get_boolean  ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_SIGNED(id_)                 id_.set(conn_->get_signed   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_UNSIGNED(id_)               id_.set(conn_->get_unsigned ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_DOUBLE(id_)                 id_.set(conn_->get_double   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_STRING(id_)                 id_.set(conn_->get_string   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_DATETIME(id_)               id_.set(conn_->get_datetime ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_UUID(id_)                   id_.set(conn_->get_uuid     ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_BLOB(id_)                   id_.set(conn_->get_blob     ( TOKEN_TO_STR(id_) ), false);
+#define FIELD_BOOLEAN(id_)                fi_##id_,
+#define FIELD_SIGNED(id_)                 fi_##id_,
+#define FIELD_UNSIGNED(id_)               fi_##id_,
+#define FIELD_DOUBLE(id_)                 fi_##id_,
+#define FIELD_STRING(id_)                 fi_##id_,
+#define FIELD_DATETIME(id_)               fi_##id_,
+#define FIELD_UUID(id_)                   fi_##id_,
+#define FIELD_BLOB(id_)                   fi_##id_,
 
-	OBJECT_FIELDS
+	enum { OBJECT_FIELDS fi_end_ };
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                TOKEN_TO_STR(id_),
+#define FIELD_SIGNED(id_)                 TOKEN_TO_STR(id_),
+#define FIELD_UNSIGNED(id_)               TOKEN_TO_STR(id_),
+#define FIELD_DOUBLE(id_)                 TOKEN_TO_STR(id_),
+#define FIELD_STRING(id_)                 TOKEN_TO_STR(id_),
+#define FIELD_DATETIME(id_)               TOKEN_TO_STR(id_),
+#define FIELD_UUID(id_)                   TOKEN_TO_STR(id_),
+#define FIELD_BLOB(id_)                   TOKEN_TO_STR(id_),
+
+	static const char *const names_[] = { OBJECT_FIELDS "" };
+
+	// 只遍历文档一次。字段通常按照 generate_document() 中的顺序排列，因此从上一个匹配的字段之后开始查找。
+	// 文档中没有的字段最后统一置为零值。
+	bool seen_[fi_end_ + 1] = { };
+	::std::size_t hint_ = 0;
+	::std::size_t missing_ = 0;
+	bool exhausted_ = false;
+	::Poseidon::MongoDb::Connection::FieldView field_;
+	for(;;){
+		::std::size_t index_ = fi_end_;
+		if(!exhausted_ && conn_->next_field(field_)){
+			for(::std::size_t i_ = 0; i_ < fi_end_; ++i_){
+				const ::std::size_t probe_ = (hint_ + i_) % fi_end_;
+				if(::std::strcmp(names_[probe_], field_.name) == 0){
+					index_ = probe_;
+					break;
+				}
+			}
+			if(index_ == fi_end_){
+				continue;
+			}
+			hint_ = index_ + 1;
+			seen_[index_] = true;
+		} else {
+			exhausted_ = true;
+			while((missing_ < fi_end_) && seen_[missing_]){
+				++missing_;
+			}
+			if(missing_ == fi_end_){
+				break;
+			}
+			index_ = missing_++;
+			LOG_POSEIDON_WARNING("Field not found: name = ", names_[index_]);
+			const ::Poseidon::MongoDb::Connection::FieldView missing_field_ = { names_[index_], 0, false, 0, 0, NULLPTR, 0 };
+			field_ = missing_field_;
+		}
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                case fi_##id_: id_.set(::Poseidon::MongoDb::Connection::decode_boolean  (field_), false); break;
+#define FIELD_SIGNED(id_)                 case fi_##id_: id_.set(::Poseidon::MongoDb::Connection::decode_signed   (field_), false); break;
+#define FIELD_UNSIGNED(id_)               case fi_##id_: id_.set(::Poseidon::MongoDb::Connection::decode_unsigned (field_), false); break;
+#define FIELD_DOUBLE(id_)                 case fi_##id_: id_.set(::Poseidon::MongoDb::Connection::decode_double   (field_), false); break;
+#define FIELD_STRING(id_)                 case fi_##id_: { const char *data_; ::std::size_t size_; ::Poseidon::MongoDb::Connection::decode_string_view(field_, data_, size_); id_.assign(data_, data_ + size_, false); } break;
+#define FIELD_DATETIME(id_)               case fi_##id_: id_.set(::Poseidon::MongoDb::Connection::decode_datetime (field_), false); break;
+#define FIELD_UUID(id_)                   case fi_##id_: id_.set(::Poseidon::MongoDb::Connection::decode_uuid     (field_), false); break;
+#define FIELD_BLOB(id_)                   case fi_##id_: { const unsigned char *data_; ::std::size_t size_; ::Poseidon::MongoDb::Connection::decode_blob_view(field_, data_, size_); id_.assign(data_, data_ + size_, false); } break;
+
+		switch(index_){
+			OBJECT_FIELDS
+		}
+	}
 }
 
 #pragma GCC diagnostic pop
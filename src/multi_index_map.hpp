@@ -25,6 +25,21 @@ c.insert(Item(2, "def"));
 ::std::cout <<c.find<0>(1)->second <<::std::endl;   // "abc";
 assert(c.upper_bound<1>("zzz") == c.end<1>());  // 通过。
 
+只按键查找、不需要有序遍历时可以使用散列索引，查找的平均复杂度是 O(1)。散列索引没有 lower_bound, upper_bound 和逆序迭代器。
+RANDOM_ACCESS_INDEX 和 SEQUENCED_INDEX 类似，但是可以用 get_index<N>()[i] 按下标访问。这三种索引都不能作为第一个索引。
+
+struct SessionElement {
+	::boost::uint64_t expiry_time;
+	::boost::uint64_t id;
+	::boost::shared_ptr<Session> session;
+};
+
+MULTI_INDEX_MAP(SessionMap, SessionElement,
+	MULTI_MEMBER_INDEX(expiry_time)
+	UNIQUE_HASHED_MEMBER_INDEX(id)
+	RANDOM_ACCESS_INDEX()
+);
+
 */
 
 #include "cxx_ver.hpp"
@@ -34,6 +49,8 @@ assert(c.upper_bound<1>("zzz") == c.end<1>());  // 通过。
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/random_access_index.hpp>
 
 #define MULTI_INDEX_MAP(Class_name_, Value_type_, indices_)	\
 	class Class_name_ {	\
@@ -303,5 +320,10 @@ assert(c.upper_bound<1>("zzz") == c.end<1>());  // 通过。
 #define MULTI_INDEX(...)                    , ::boost::multi_index::ordered_non_unique< ::boost::multi_index::identity<value_type>, ## __VA_ARGS__>
 #define MULTI_MEMBER_INDEX(member_, ...)    , ::boost::multi_index::ordered_non_unique< ::boost::multi_index::member<value_type, CV_VALUE_TYPE(DECLREF(value_type).member_), &value_type::member_>, ## __VA_ARGS__>
 #define SEQUENCED_INDEX()                   , ::boost::multi_index::sequenced<>
+#define UNIQUE_HASHED_INDEX(...)            , ::boost::multi_index::hashed_unique< ::boost::multi_index::identity<value_type>, ## __VA_ARGS__>
+#define UNIQUE_HASHED_MEMBER_INDEX(member_, ...) , ::boost::multi_index::hashed_unique< ::boost::multi_index::member<value_type, CV_VALUE_TYPE(DECLREF(value_type).member_), &value_type::member_>, ## __VA_ARGS__>
+#define MULTI_HASHED_INDEX(...)             , ::boost::multi_index::hashed_non_unique< ::boost::multi_index::identity<value_type>, ## __VA_ARGS__>
+#define MULTI_HASHED_MEMBER_INDEX(member_, ...) , ::boost::multi_index::hashed_non_unique< ::boost::multi_index::member<value_type, CV_VALUE_TYPE(DECLREF(value_type).member_), &value_type::member_>, ## __VA_ARGS__>
+#define RANDOM_ACCESS_INDEX()               , ::boost::multi_index::random_access<>
 
 #endif
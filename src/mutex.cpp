@@ -6,6 +6,7 @@
 #include "log.hpp"
 #include "errno.hpp"
 #include "system_exception.hpp"
+#include "singletons/profile_depository.hpp"
 
 namespace Poseidon {
 
@@ -36,10 +37,10 @@ namespace {
 }
 
 Mutex::UniqueLock::UniqueLock()
-	: m_target(NULLPTR), m_locked(false)
+	: m_target(NULLPTR), m_locked(false), m_file(""), m_line(0)
 { }
-Mutex::UniqueLock::UniqueLock(Mutex &target, bool locks_target)
-	: m_target(&target), m_locked(false)
+Mutex::UniqueLock::UniqueLock(Mutex &target, bool locks_target, const char *file, unsigned long line)
+	: m_target(&target), m_locked(false), m_file(file), m_line(line)
 {
 	if(locks_target){
 		lock();
@@ -58,7 +59,22 @@ void Mutex::UniqueLock::lock() NOEXCEPT {
 	ABORT_UNLESS(m_target, "No mutex has been assigned to this UniqueLock.");
 	ABORT_UNLESS(!m_locked, "The mutex has already been locked by this UniqueLock.");
 
-	int err = ::pthread_mutex_lock(&(m_target->m_mutex));
+	int err;
+#ifndef POSEIDON_NO_LOCK_PROFILING
+	if(ProfileDepository::is_lock_profiling_enabled()){
+		// 先尝试加锁，失败时记录等待的时间。
+		err = ::pthread_mutex_trylock(&(m_target->m_mutex));
+		if(err == EBUSY){
+			const AUTO(begin, ProfileDepository::get_ticks());
+			err = ::pthread_mutex_lock(&(m_target->m_mutex));
+			ProfileDepository::accumulate_lock_wait(m_file, m_line, ProfileDepository::get_ticks() - begin);
+		}
+	} else {
+		err = ::pthread_mutex_lock(&(m_target->m_mutex));
+	}
+#else
+	err = ::pthread_mutex_lock(&(m_target->m_mutex));
+#endif
 	ABORT_UNLESS(err == 0, "::pthread_mutex_lock() failed with ", err, " (", get_error_desc(err), ")");
 	m_locked = true;
 }
@@ -22,6 +22,9 @@ public:
 	private:
 		Mutex *m_target;
 		bool m_locked;
+		// 构造这个锁的位置，用于统计锁竞争。
+		const char *m_file;
+		unsigned long m_line;
 
 	private:
 		UniqueLock(const UniqueLock &rhs);
@@ -29,9 +32,9 @@ public:
 
 	public:
 		UniqueLock();
-		explicit UniqueLock(Mutex &target, bool locks_target = true);
+		explicit UniqueLock(Mutex &target, bool locks_target = true, const char *file = __builtin_FILE(), unsigned long line = __builtin_LINE());
 		UniqueLock(Move<UniqueLock> rhs) NOEXCEPT
-			: m_target(NULLPTR), m_locked(false)
+			: m_target(NULLPTR), m_locked(false), m_file(""), m_line(0)
 		{
 			rhs.swap(*this);
 		}
@@ -50,6 +53,8 @@ public:
 			using std::swap;
 			swap(m_target, rhs.m_target);
 			swap(m_locked, rhs.m_locked);
+			swap(m_file, rhs.m_file);
+			swap(m_line, rhs.m_line);
 		}
 
 	public:
@@ -11,12 +11,16 @@
 #include "../time.hpp"
 #include "../system_exception.hpp"
 #include "../uuid.hpp"
+#include "../atomic.hpp"
+#include "../singletons/main_config.hpp"
 #include <mysql/mysql.h>
 
 namespace Poseidon {
 namespace MySql {
 
 namespace {
+	volatile boost::uint64_t g_result_serial = 0;
+
 	struct Closer {
 		CONSTEXPR ::MYSQL *operator()() const NOEXCEPT {
 			return NULLPTR;
@@ -34,6 +38,15 @@ namespace {
 		}
 	};
 
+	struct StatementCloser {
+		CONSTEXPR ::MYSQL_STMT *operator()() const NOEXCEPT {
+			return NULLPTR;
+		}
+		void operator()(::MYSQL_STMT *stmt) const NOEXCEPT {
+			::mysql_stmt_close(stmt);
+		}
+	};
+
 	struct FieldComparator {
 		bool operator()(const char *lhs, const char *rhs) const NOEXCEPT {
 			return std::strcmp(lhs, rhs) < 0;
@@ -48,18 +61,24 @@ namespace {
 
 		UniqueHandle<ResultDeleter> m_result;
 		boost::container::flat_map<const char *, std::size_t, FieldComparator> m_fields;
+		boost::uint64_t m_result_serial;
 		::MYSQL_ROW m_row;
 		unsigned long *m_lengths;
 
+		// 连接断开重连之后服务器端的语句就失效了，执行失败时从缓存中删除，下次重新准备。
+		const std::size_t m_max_statements;
+		boost::container::map<std::string, ::MYSQL_STMT *> m_statements;
+
 	public:
-		DelegatedConnection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset)
+		DelegatedConnection(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset, const char *compression)
 			: m_schema(schema)
-			, m_row(NULLPTR), m_lengths(NULLPTR)
+			, m_result_serial(0), m_row(NULLPTR), m_lengths(NULLPTR)
+			, m_max_statements(MainConfig::get<std::size_t>("mysql_prepared_statement_cache_size", 256))
 		{
 			PROFILE_ME;
 
 			DEBUG_THROW_UNLESS(m_mysql.reset(::mysql_init(&m_mysql_storage)), BasicException, sslit("::mysql_init() failed"));
-			DEBUG_THROW_UNLESS(::mysql_options(m_mysql.get(), MYSQL_OPT_COMPRESS, NULLPTR) == 0, BasicException, sslit("::mysql_options() failed, trying to set MYSQL_OPT_COMPRESS"));
+			set_compression(compression);
 			static CONSTEXPR const ::my_bool TRUE_VALUE = true;
 			DEBUG_THROW_UNLESS(::mysql_options(m_mysql.get(), MYSQL_OPT_RECONNECT, &TRUE_VALUE) == 0, BasicException, sslit("::mysql_options() failed, trying to set MYSQL_OPT_RECONNECT"));
 			DEBUG_THROW_UNLESS(::mysql_options(m_mysql.get(), MYSQL_SET_CHARSET_NAME, charset) == 0, BasicException, sslit("::mysql_options() failed, trying to set MYSQL_OPT_RECONNECT"));
@@ -67,28 +86,77 @@ namespace {
 			if(use_ssl){
 				flags |= CLIENT_SSL;
 			}
+			if(MainConfig::get<std::size_t>("mysql_pipeline_depth", 1) > 1){
+				flags |= CLIENT_MULTI_STATEMENTS;
+			}
 			DEBUG_THROW_UNLESS(::mysql_real_connect(m_mysql.get(), server_addr, user_name, password, schema, server_port, NULLPTR, flags), Exception, m_schema, ::mysql_errno(m_mysql.get()), SharedNts(::mysql_error(m_mysql.get())));
 		}
+		~DelegatedConnection() OVERRIDE {
+			clear_statements();
+		}
 
 	private:
-		bool find_field_and_check(const char *&data, std::size_t &size, const char *name) const {
+		void set_compression(const char *compression){
+			if(!*compression){
+				return;
+			}
+#if defined(MYSQL_VERSION_ID) && (MYSQL_VERSION_ID >= 80018) && !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_PACKAGE_VERSION_ID)
+			DEBUG_THROW_UNLESS(::mysql_options(m_mysql.get(), MYSQL_OPT_COMPRESSION_ALGORITHMS, compression) == 0, BasicException, sslit("::mysql_options() failed, trying to set MYSQL_OPT_COMPRESSION_ALGORITHMS"));
+			if(std::strstr(compression, "zstd")){
+				const unsigned level = MainConfig::get<unsigned>("mysql_zstd_compression_level", 3);
+				DEBUG_THROW_UNLESS(::mysql_options(m_mysql.get(), MYSQL_OPT_ZSTD_COMPRESSION_LEVEL, &level) == 0, BasicException, sslit("::mysql_options() failed, trying to set MYSQL_OPT_ZSTD_COMPRESSION_LEVEL"));
+			}
+#else
+			// 旧的客户端库只支持 zlib。
+			if(std::strcmp(compression, "uncompressed") == 0){
+				return;
+			}
+			if(!std::strstr(compression, "zlib")){
+				LOG_POSEIDON_WARNING("This MySQL client library supports only zlib compression: compression = ", compression);
+			}
+			DEBUG_THROW_UNLESS(::mysql_options(m_mysql.get(), MYSQL_OPT_COMPRESS, NULLPTR) == 0, BasicException, sslit("::mysql_options() failed, trying to set MYSQL_OPT_COMPRESS"));
+#endif
+		}
+		void clear_statements() NOEXCEPT {
+			for(AUTO(it, m_statements.begin()); it != m_statements.end(); ++it){
+				::mysql_stmt_close(it->second);
+			}
+			m_statements.clear();
+		}
+		::MYSQL_STMT *prepare_statement(const std::string &sql){
 			PROFILE_ME;
 
+			AUTO(it, m_statements.find(sql));
+			if(it != m_statements.end()){
+				return it->second;
+			}
+			if(m_statements.size() >= m_max_statements){
+				LOG_POSEIDON_DEBUG("Too many prepared statements. Dropping all of them: count = ", m_statements.size());
+				clear_statements();
+			}
+			LOG_POSEIDON_DEBUG("Preparing MySQL statement: ", sql);
+			UniqueHandle<StatementCloser> stmt;
+			DEBUG_THROW_UNLESS(stmt.reset(::mysql_stmt_init(m_mysql.get())), BasicException, sslit("::mysql_stmt_init() failed"));
+			DEBUG_THROW_UNLESS(::mysql_stmt_prepare(stmt.get(), sql.data(), sql.size()) == 0, Exception, m_schema, ::mysql_stmt_errno(stmt.get()), SharedNts(::mysql_stmt_error(stmt.get())));
+			m_statements.emplace(sql, stmt.get());
+			return stmt.release();
+		}
+
+		bool check_field_at(const char *&data, std::size_t &size, std::size_t index) const {
 			if(!m_row){
 				LOG_POSEIDON_WARNING("No more results available.");
 				return false;
 			}
-			const AUTO(it, m_fields.find(name));
-			if(it == m_fields.end()){
-				LOG_POSEIDON_WARNING("Field not found: name = ", name);
+			if(index >= m_fields.size()){
+				// find_field() 已经报告过了。
 				return false;
 			}
-			data = m_row[it->second];
+			data = m_row[index];
 			if(!data){
-				LOG_POSEIDON_DEBUG("Field is null: name = ", name);
+				LOG_POSEIDON_DEBUG("Field is null: index = ", index);
 				return false;
 			}
-			size = m_lengths[it->second];
+			size = m_lengths[index];
 			return true;
 		}
 
@@ -105,6 +173,7 @@ namespace {
 				DEBUG_THROW_UNLESS(::mysql_errno(m_mysql.get()) == 0, Exception, m_schema, ::mysql_errno(m_mysql.get()), SharedNts(::mysql_error(m_mysql.get())));
 				LOG_POSEIDON_DEBUG("No result was returned from MySQL server.");
 			} else {
+				m_result_serial = atomic_add(g_result_serial, 1, ATOMIC_RELAXED);
 				const AUTO(fields, ::mysql_fetch_fields(m_result.get()));
 				const AUTO(count, ::mysql_num_fields(m_result.get()));
 				m_fields.reserve(count);
@@ -120,10 +189,119 @@ namespace {
 
 			m_result.reset();
 			m_fields.clear();
+			m_result_serial = 0;
 			m_row = NULLPTR;
 			m_lengths = NULLPTR;
 		}
 
+		void execute_prepared(const std::string &sql, const boost::container::vector<StatementParameter> &params) FINAL {
+			PROFILE_ME;
+
+			discard_result();
+
+			const AUTO(stmt, prepare_statement(sql));
+			DEBUG_THROW_UNLESS(::mysql_stmt_param_count(stmt) == params.size(), BasicException, sslit("Prepared statement parameter count mismatch"));
+			boost::container::vector< ::MYSQL_BIND> binds(params.size());
+			boost::container::vector<unsigned long> lengths(params.size());
+			for(std::size_t i = 0; i < params.size(); ++i){
+				const AUTO_REF(param, params.at(i));
+				AUTO_REF(bind, binds.at(i));
+				std::memset(&bind, 0, sizeof(bind));
+				switch(param.get_type()){
+				case StatementParameter::TYPE_SIGNED:
+					bind.buffer_type = MYSQL_TYPE_LONGLONG;
+					bind.buffer = const_cast<boost::int64_t *>(&param.get_signed());
+					break;
+				case StatementParameter::TYPE_UNSIGNED:
+					bind.buffer_type = MYSQL_TYPE_LONGLONG;
+					bind.buffer = const_cast<boost::uint64_t *>(&param.get_unsigned());
+					bind.is_unsigned = 1;
+					break;
+				case StatementParameter::TYPE_DOUBLE:
+					bind.buffer_type = MYSQL_TYPE_DOUBLE;
+					bind.buffer = const_cast<double *>(&param.get_double());
+					break;
+				case StatementParameter::TYPE_STRING:
+				case StatementParameter::TYPE_BLOB:
+					bind.buffer_type = (param.get_type() == StatementParameter::TYPE_BLOB) ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+					bind.buffer = const_cast<char *>(param.get_bytes().data());
+					bind.buffer_length = param.get_bytes().size();
+					lengths.at(i) = param.get_bytes().size();
+					bind.length = &lengths.at(i);
+					break;
+				default:
+					DEBUG_THROW(BasicException, sslit("Unknown prepared statement parameter type"));
+				}
+			}
+			LOG_POSEIDON_DEBUG("Executing prepared MySQL statement: ", sql);
+			if((::mysql_stmt_bind_param(stmt, binds.data()) != 0) || (::mysql_stmt_execute(stmt) != 0)){
+				const AUTO(err_code, ::mysql_stmt_errno(stmt));
+				const SharedNts err_msg(::mysql_stmt_error(stmt));
+				::mysql_stmt_close(stmt);
+				m_statements.erase(sql);
+				DEBUG_THROW(Exception, m_schema, err_code, err_msg);
+			}
+		}
+
+		void execute_multiple_sql(const std::string &sql, std::size_t &completed) FINAL {
+			PROFILE_ME;
+
+			discard_result();
+
+			completed = 0;
+			LOG_POSEIDON_DEBUG("Sending multiple statements to MySQL server: ", sql);
+			DEBUG_THROW_UNLESS(::mysql_real_query(m_mysql.get(), sql.data(), sql.size()) == 0, Exception, m_schema, ::mysql_errno(m_mysql.get()), SharedNts(::mysql_error(m_mysql.get())));
+			for(;;){
+				// 这些语句不应该返回结果集，即使返回了也直接丢弃。
+				UniqueHandle<ResultDeleter> result;
+				if(!result.reset(::mysql_store_result(m_mysql.get()))){
+					DEBUG_THROW_UNLESS(::mysql_field_count(m_mysql.get()) == 0, Exception, m_schema, ::mysql_errno(m_mysql.get()), SharedNts(::mysql_error(m_mysql.get())));
+				}
+				++completed;
+				const int status = ::mysql_next_result(m_mysql.get());
+				if(status < 0){
+					break;
+				}
+				DEBUG_THROW_UNLESS(status == 0, Exception, m_schema, ::mysql_errno(m_mysql.get()), SharedNts(::mysql_error(m_mysql.get())));
+			}
+		}
+
+		boost::uint64_t get_result_serial() const FINAL {
+			return m_result_serial;
+		}
+		std::size_t find_field(const char *name) const FINAL {
+			PROFILE_ME;
+
+			const AUTO(it, m_fields.find(name));
+			if(it == m_fields.end()){
+				LOG_POSEIDON_WARNING("Field not found: name = ", name);
+				return FIELD_NOT_FOUND;
+			}
+			return it->second;
+		}
+
+		boost::int64_t get_signed(const char *name) const FINAL {
+			return get_signed_at(find_field(name));
+		}
+		boost::uint64_t get_unsigned(const char *name) const FINAL {
+			return get_unsigned_at(find_field(name));
+		}
+		double get_double(const char *name) const FINAL {
+			return get_double_at(find_field(name));
+		}
+		std::string get_string(const char *name) const FINAL {
+			return get_string_at(find_field(name));
+		}
+		boost::uint64_t get_datetime(const char *name) const FINAL {
+			return get_datetime_at(find_field(name));
+		}
+		Uuid get_uuid(const char *name) const FINAL {
+			return get_uuid_at(find_field(name));
+		}
+		std::basic_string<unsigned char> get_blob(const char *name) const FINAL {
+			return get_blob_at(find_field(name));
+		}
+
 		boost::uint64_t get_insert_id() const FINAL {
 			return ::mysql_insert_id(m_mysql.get());
 		}
@@ -147,12 +325,12 @@ namespace {
 			return true;
 		}
 
-		boost::int64_t get_signed(const char *name) const FINAL {
+		boost::int64_t get_signed_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			char *eptr;
@@ -160,12 +338,12 @@ namespace {
 			DEBUG_THROW_UNLESS(*eptr == 0, BasicException, sslit("Could not convert field data to long long"));
 			return val;
 		}
-		boost::uint64_t get_unsigned(const char *name) const FINAL {
+		boost::uint64_t get_unsigned_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			char *eptr;
@@ -173,12 +351,12 @@ namespace {
 			DEBUG_THROW_UNLESS(*eptr == 0, BasicException, sslit("Could not convert field data to unsigned long long"));
 			return val;
 		}
-		double get_double(const char *name) const FINAL {
+		double get_double_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			char *eptr;
@@ -186,43 +364,43 @@ namespace {
 			DEBUG_THROW_UNLESS(*eptr == 0, BasicException, sslit("Could not convert field data to double"));
 			return val;
 		}
-		std::string get_string(const char *name) const FINAL {
+		std::string get_string_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			return std::string(data, size);
 		}
-		boost::uint64_t get_datetime(const char *name) const FINAL {
+		boost::uint64_t get_datetime_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			return scan_time(data);
 		}
-		Uuid get_uuid(const char *name) const FINAL {
+		Uuid get_uuid_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			DEBUG_THROW_UNLESS(size == 36, BasicException, sslit("Invalid UUID string"));
 			return Uuid(reinterpret_cast<const char (&)[36]>(data[0]));
 		}
-		std::basic_string<unsigned char> get_blob(const char *name) const FINAL {
+		std::basic_string<unsigned char> get_blob_at(std::size_t index) const FINAL {
 			PROFILE_ME;
 
 			const char *data;
 			std::size_t size;
-			if(!find_field_and_check(data, size, name)){
+			if(!check_field_at(data, size, index)){
 				return VAL_INIT;
 			}
 			return std::basic_string<unsigned char>(reinterpret_cast<const unsigned char *>(data), size);
@@ -230,8 +408,17 @@ namespace {
 	};
 }
 
-boost::shared_ptr<Connection> Connection::create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset){
-	return boost::make_shared<DelegatedConnection>(server_addr, server_port, user_name, password, schema, use_ssl, charset);
+StatementParameter StatementParameter::make_datetime(boost::uint64_t value){
+	char str[256];
+	const std::size_t len = format_time(str, sizeof(str), value, true);
+	return make_string(std::string(str, len));
+}
+StatementParameter StatementParameter::make_uuid(const Uuid &value){
+	return make_string(value.to_string());
+}
+
+boost::shared_ptr<Connection> Connection::create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset, const char *compression){
+	return boost::make_shared<DelegatedConnection>(server_addr, server_port, user_name, password, schema, use_ssl, charset, compression);
 }
 
 Connection::~Connection(){ }
@@ -11,13 +11,91 @@
 #include <cstring>
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 namespace MySql {
 
+// 预处理语句的参数，以二进制协议发送。日期时间和 UUID 以字符串发送，由服务器转换。
+class StatementParameter {
+public:
+	enum Type {
+		TYPE_SIGNED,
+		TYPE_UNSIGNED,
+		TYPE_DOUBLE,
+		TYPE_STRING,
+		TYPE_BLOB,
+	};
+
+	static StatementParameter make_signed(boost::int64_t value){
+		StatementParameter param(TYPE_SIGNED);
+		param.m_signed = value;
+		return param;
+	}
+	static StatementParameter make_unsigned(boost::uint64_t value){
+		StatementParameter param(TYPE_UNSIGNED);
+		param.m_unsigned = value;
+		return param;
+	}
+	static StatementParameter make_double(double value){
+		StatementParameter param(TYPE_DOUBLE);
+		param.m_double = value;
+		return param;
+	}
+	static StatementParameter make_string(std::string value){
+		StatementParameter param(TYPE_STRING);
+		param.m_bytes.swap(value);
+		return param;
+	}
+	static StatementParameter make_blob(const std::basic_string<unsigned char> &value){
+		StatementParameter param(TYPE_BLOB);
+		param.m_bytes.assign(value.begin(), value.end());
+		return param;
+	}
+	static StatementParameter make_datetime(boost::uint64_t value);
+	static StatementParameter make_uuid(const Uuid &value);
+
+private:
+	Type m_type;
+	union {
+		boost::int64_t m_signed;
+		boost::uint64_t m_unsigned;
+		double m_double;
+	};
+	std::string m_bytes;
+
+private:
+	explicit StatementParameter(Type type)
+		: m_type(type), m_unsigned(0), m_bytes()
+	{ }
+
+public:
+	Type get_type() const {
+		return m_type;
+	}
+	const boost::int64_t &get_signed() const {
+		return m_signed;
+	}
+	const boost::uint64_t &get_unsigned() const {
+		return m_unsigned;
+	}
+	const double &get_double() const {
+		return m_double;
+	}
+	const std::string &get_bytes() const {
+		return m_bytes;
+	}
+};
+
 class Connection : NONCOPYABLE {
 public:
-	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset);
+	enum {
+		FIELD_NOT_FOUND = static_cast<std::size_t>(-1),
+	};
+
+public:
+	// compression 是用逗号分隔的压缩算法（uncompressed、zlib、zstd），由服务器选择其中之一。空字符串表示不压缩。
+	static boost::shared_ptr<Connection> create(const char *server_addr, boost::uint16_t server_port, const char *user_name, const char *password, const char *schema, bool use_ssl, const char *charset, const char *compression = "zlib");
 
 public:
 	virtual ~Connection();
@@ -25,6 +103,11 @@ public:
 public:
 	virtual void execute_sql_explicit(const char *sql, std::size_t len) = 0;
 	virtual void discard_result() NOEXCEPT = 0;
+	// 执行不返回结果集的预处理语句。语句按照 SQL 文本缓存在连接中，只在第一次使用时由服务器解析。
+	virtual void execute_prepared(const std::string &sql, const boost::container::vector<StatementParameter> &params) = 0;
+	// 执行用分号分隔的多条不返回结果集的语句，只需要一次往返。连接必须启用了多语句支持（mysql_pipeline_depth 大于 1）。
+	// completed 返回成功执行的语句数。某条语句失败时抛出异常，服务器不会执行之后的语句。
+	virtual void execute_multiple_sql(const std::string &sql, std::size_t &completed) = 0;
 
 	virtual boost::uint64_t get_insert_id() const = 0;
 	virtual bool fetch_row() = 0;
@@ -37,6 +120,20 @@ public:
 	virtual Uuid get_uuid(const char *name) const = 0;
 	virtual std::basic_string<unsigned char> get_blob(const char *name) const = 0;
 
+	// 每次执行语句都会得到一个新的非零的序号，没有结果集时返回零。
+	// 序号在所有连接之间是唯一的，可以用来缓存 find_field() 的结果，避免逐行按照名字查找字段。
+	virtual boost::uint64_t get_result_serial() const = 0;
+	// 找不到时返回 FIELD_NOT_FOUND。
+	virtual std::size_t find_field(const char *name) const = 0;
+
+	virtual boost::int64_t get_signed_at(std::size_t index) const = 0;
+	virtual boost::uint64_t get_unsigned_at(std::size_t index) const = 0;
+	virtual double get_double_at(std::size_t index) const = 0;
+	virtual std::string get_string_at(std::size_t index) const = 0;
+	virtual boost::uint64_t get_datetime_at(std::size_t index) const = 0;
+	virtual Uuid get_uuid_at(std::size_t index) const = 0;
+	virtual std::basic_string<unsigned char> get_blob_at(std::size_t index) const = 0;
+
 	void execute_sql(const char *sql, std::size_t len){
 		execute_sql_explicit(sql, len);
 	}
@@ -5,41 +5,81 @@
 #include "formatting.hpp"
 #include "../time.hpp"
 #include "../uuid.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 namespace Poseidon {
 namespace MySql {
 
-std::ostream &operator<<(std::ostream &os, const StringEscaper &rhs){
-	const AUTO_REF(ref, rhs.get());
-	os <<'\'';
-	for(AUTO(it, ref.begin()); it != ref.end(); ++it){
-		const char ch = *it;
+namespace {
+	// 需要转义的字符是 0、0x1A、'\r'、'\n'、'\\'、'\'' 和 '\"'，转义之后是反斜杠加上这里对应的字符。
+	char get_escaped_char(char ch) NOEXCEPT {
 		switch(ch){
 		case 0:
-			os <<"\\0";
-			break;
+			return '0';
 		case 0x1A:
-			os <<"\\Z";
-			break;
+			return 'Z';
 		case '\r':
-			os <<"\\r";
-			break;
+			return 'r';
 		case '\n':
-			os <<"\\n";
-			break;
+			return 'n';
 		case '\\':
-			os <<"\\\\";
-			break;
 		case '\'':
-			os <<"\\\'";
-			break;
 		case '\"':
-			os <<"\\\"";
-			break;
+			return ch;
 		default:
-			os <<ch;
+			return 0;
+		}
+	}
+
+	// 返回第一个需要转义的字符的位置，没有则返回 size。
+	std::size_t find_char_to_escape(const char *data, std::size_t size) NOEXCEPT {
+		std::size_t i = 0;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i sub = _mm_set1_epi8(0x1A);
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i bs = _mm_set1_epi8('\\');
+		const __m128i sq = _mm_set1_epi8('\'');
+		const __m128i dq = _mm_set1_epi8('\"');
+		for(; size - i >= 16; i += 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+			__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, sub));
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, bs), _mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, dq))));
+			const int bits = _mm_movemask_epi8(m);
+			if(bits != 0){
+				return i + static_cast<unsigned>(__builtin_ctz(static_cast<unsigned>(bits)));
+			}
+		}
+#endif
+		for(; i < size; ++i){
+			if(get_escaped_char(data[i]) != 0){
+				break;
+			}
+		}
+		return i;
+	}
+}
+
+std::ostream &operator<<(std::ostream &os, const StringEscaper &rhs){
+	const AUTO_REF(ref, rhs.get());
+	os <<'\'';
+	// 不需要转义的部分整段写入。
+	const char *const data = ref.data();
+	const std::size_t size = ref.size();
+	std::size_t pos = 0;
+	for(;;){
+		const std::size_t next = pos + find_char_to_escape(data + pos, size - pos);
+		os.write(data + pos, static_cast<std::streamsize>(next - pos));
+		if(next == size){
 			break;
 		}
+		os.put('\\');
+		os.put(get_escaped_char(data[next]));
+		pos = next + 1;
 	}
 	os <<'\'';
 	return os;
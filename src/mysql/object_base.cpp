@@ -27,6 +27,12 @@ try {
 	if(!is_auto_saving_enabled()){
 		return false;
 	}
+	// 队列中已经有这个对象的保存操作在等待，它会写入这次修改，不需要再投递。
+	// 数据库线程在生成语句之前清除标记，生成语句时需要锁定对象，而调用者在修改字段时锁定了对象，
+	// 因此这里看到标记时，那个操作一定在这次修改之后才生成语句；看不到标记时投递新的操作。
+	if(get_combined_write_stamp()){
+		return true;
+	}
 	async_save(true, false);
 	return true;
 } catch(std::exception &e){
@@ -37,12 +43,39 @@ try {
 	return false;
 }
 
+bool ObjectBase::generate_sql_row(std::ostream &columns_os, std::ostream &values_os) const {
+	(void)columns_os;
+	(void)values_os;
+	return false;
+}
+
+bool ObjectBase::generate_sql_prepared(std::string &set_clause, boost::container::vector<StatementParameter> &params) const {
+	(void)set_clause;
+	(void)params;
+	return false;
+}
+
+bool ObjectBase::generate_sql_update(std::ostream &os) const {
+	(void)os;
+	return false;
+}
+bool ObjectBase::can_generate_sql_update() const {
+	return false;
+}
+
 void *ObjectBase::get_combined_write_stamp() const {
 	return atomic_load(m_combined_write_stamp, ATOMIC_CONSUME);
 }
 void ObjectBase::set_combined_write_stamp(void *stamp) const {
 	atomic_store(m_combined_write_stamp, stamp, ATOMIC_RELEASE);
 }
+bool ObjectBase::is_persisted() const {
+	return atomic_load(m_persisted, ATOMIC_CONSUME);
+}
+void ObjectBase::set_persisted(bool persisted) const {
+	atomic_store(m_persisted, persisted, ATOMIC_RELEASE);
+}
+
 void ObjectBase::async_save(bool to_replace, bool urgent) const {
 	enable_auto_saving();
 	MySqlDaemon::enqueue_for_saving(virtual_shared_from_this<ObjectBase>(), to_replace, urgent);
@@ -37,13 +37,14 @@ public:
 private:
 	mutable volatile bool m_auto_saves;
 	mutable void *volatile m_combined_write_stamp;
+	mutable volatile bool m_persisted;
 
 protected:
 	mutable RecursiveMutex m_mutex;
 
 public:
 	ObjectBase()
-		: m_auto_saves(false), m_combined_write_stamp(NULLPTR)
+		: m_auto_saves(false), m_combined_write_stamp(NULLPTR), m_persisted(false)
 	{ }
 	// 不要不写析构函数，否则 RTTI 将无法在动态库中使用。
 	~ObjectBase();
@@ -53,14 +54,35 @@ public:
 	void enable_auto_saving() const;
 	void disable_auto_saving() const;
 
+	// 开启了自动保存时投递一个保存操作，在写入延迟之后执行。如果已经有一个在等待就什么也不做，
+	// 所以在一个写入延迟之内无论修改多少次，每个对象只有一个保存操作。
 	bool invalidate() const NOEXCEPT;
 
 	void *get_combined_write_stamp() const;
 	void set_combined_write_stamp(void *stamp) const;
 
+	// 对象从数据库中加载过，或者保存操作已经成功完成，之后只更新修改过的字段就可以了。
+	// 保存操作最终失败时被清除，下次保存时重新写入完整的行。
+	bool is_persisted() const;
+	void set_persisted(bool persisted = true) const;
+
 	virtual const char *get_table() const = 0;
 
+	// 输出完整的行的函数都会清除所有字段的修改标记。
 	virtual void generate_sql(std::ostream &os) const = 0;
+	// 分别输出列名和值，用逗号分隔，两者的顺序相同，用于把多个对象合并为一条多行语句。
+	// 默认实现不输出任何内容并返回 false，表示不支持合并。
+	virtual bool generate_sql_row(std::ostream &columns_os, std::ostream &values_os) const;
+	// 输出形如 `a` = ?, `b` = ? 的 SET 子句和对应的参数，用于预处理语句。子句只取决于对象的类型。
+	// 默认实现返回 false，表示不支持。
+	virtual bool generate_sql_prepared(std::string &set_clause, boost::container::vector<StatementParameter> &params) const;
+	// 输出形如 `id` = 3, `a` = 1, `b` = 2 ON DUPLICATE KEY UPDATE `b` = 2 的子句，用于 INSERT 语句，
+	// 其中 ON DUPLICATE KEY UPDATE 之后只包含自上次调用以来修改过的字段，并清除它们的修改标记。
+	// 行不存在（例如被删除了）时插入完整的行，因此和 REPLACE 一样不会丢失数据。
+	// 只有定义了 OBJECT_PRIMARY_KEYS 的对象支持。没有加载或者保存过、没有字段被修改或者主键被修改时不输出任何内容并返回 false。
+	virtual bool generate_sql_update(std::ostream &os) const;
+	// 和上面的条件相同，但是不输出也不清除修改标记。
+	virtual bool can_generate_sql_update() const;
 	virtual void fetch(const boost::shared_ptr<const Connection> &conn) = 0;
 	void async_save(bool to_replace, bool urgent = false) const;
 };
@@ -70,16 +92,24 @@ class ObjectBase::Field : NONCOPYABLE {
 private:
 	ObjectBase *const m_parent;
 	ValueT m_value;
+	mutable bool m_dirty;
 
 public:
 	explicit Field(ObjectBase *parent, ValueT value = ValueT())
-		: m_parent(parent), m_value(STD_MOVE_IDN(value))
+		: m_parent(parent), m_value(STD_MOVE_IDN(value)), m_dirty(false)
 	{ }
 
 public:
 	const ValueT &unlocked_get() const {
 		return m_value;
 	}
+	// 调用者需要锁定父对象。
+	bool unlocked_is_dirty() const {
+		return m_dirty;
+	}
+	void unlocked_clear_dirty() const {
+		m_dirty = false;
+	}
 	ValueT get() const {
 		const RecursiveMutex::UniqueLock lock(m_parent->m_mutex);
 		return m_value;
@@ -89,6 +119,7 @@ public:
 		m_value = STD_MOVE_IDN(value);
 
 		if(invalidates_parent){
+			m_dirty = true;
 			m_parent->invalidate();
 		}
 	}
@@ -102,6 +133,7 @@ public:
 		is >>m_value;
 
 		if(invalidates_parent){
+			m_dirty = true;
 			m_parent->invalidate();
 		}
 	}
@@ -138,7 +170,7 @@ public:
 
 public:
 	void dump(std::ostream &os) const {
-		if(m_count == 0){
+		if(m_count != 0){
 			os <<", ";
 		}
 		++m_count;
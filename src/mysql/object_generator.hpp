@@ -13,6 +13,9 @@
 #  error Please #include <poseidon/mysql/object_base.hpp> first.
 #endif
 
+// 可选的 OBJECT_PRIMARY_KEYS 用和 OBJECT_FIELDS 相同的形式列出主键的字段（这些字段也必须出现在 OBJECT_FIELDS 中），
+// 例如 FIELD_UNSIGNED(account_id) FIELD_SIGNED(slot)。定义之后，已经加载或者保存成功过的对象自动保存时使用 INSERT ... ON DUPLICATE KEY UPDATE，只更新修改过的字段。
+
 class OBJECT_NAME : public ::Poseidon::MySql::ObjectBase {
 public:
 	static ::boost::shared_ptr< ::Poseidon::MySql::ObjectBase> create(){
@@ -69,6 +72,12 @@ public:
 public:
 	const char *get_table() const OVERRIDE;
 	void generate_sql(::std::ostream &os_) const OVERRIDE;
+	bool generate_sql_row(::std::ostream &columns_os_, ::std::ostream &values_os_) const OVERRIDE;
+	bool generate_sql_prepared(::std::string &set_clause_, ::boost::container::vector< ::Poseidon::MySql::StatementParameter> &params_) const OVERRIDE;
+#ifdef OBJECT_PRIMARY_KEYS
+	bool generate_sql_update(::std::ostream &os_) const OVERRIDE;
+	bool can_generate_sql_update() const OVERRIDE;
+#endif
 	void fetch(const ::boost::shared_ptr<const ::Poseidon::MySql::Connection> &conn_) OVERRIDE;
 };
 
@@ -164,21 +173,212 @@ void OBJECT_NAME::generate_sql(::std::ostream &os_) const {
 #undef FIELD_UUID
 #undef FIELD_BLOB
 
-#define FIELD_BOOLEAN(id_)                os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;
-#define FIELD_SIGNED(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;
-#define FIELD_UNSIGNED(id_)               os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;
-#define FIELD_DOUBLE(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;
-#define FIELD_STRING(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_);
-#define FIELD_DATETIME(id_)               os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::DateTimeFormatter(id_);
-#define FIELD_UUID(id_)                   os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::UuidFormatter(id_);
-#define FIELD_BLOB(id_)                   os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_);
+#define FIELD_BOOLEAN(id_)                os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_SIGNED(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_UNSIGNED(id_)               os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_DOUBLE(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_STRING(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_);	id_.unlocked_clear_dirty();
+#define FIELD_DATETIME(id_)               os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::DateTimeFormatter(id_);	id_.unlocked_clear_dirty();
+#define FIELD_UUID(id_)                   os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::UuidFormatter(id_);	id_.unlocked_clear_dirty();
+#define FIELD_BLOB(id_)                   os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_);	id_.unlocked_clear_dirty();
 
 	OBJECT_FIELDS
 }
+bool OBJECT_NAME::generate_sql_row(::std::ostream &columns_os_, ::std::ostream &values_os_) const {
+	PROFILE_ME;
+
+	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	::Poseidon::MySql::ObjectBase::Delimiter columns_delim_, values_delim_;
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_SIGNED(id_)                 columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_UNSIGNED(id_)               columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_DOUBLE(id_)                 columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ <<id_;	id_.unlocked_clear_dirty();
+#define FIELD_STRING(id_)                 columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ << ::Poseidon::MySql::StringEscaper(id_);	id_.unlocked_clear_dirty();
+#define FIELD_DATETIME(id_)               columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ << ::Poseidon::MySql::DateTimeFormatter(id_);	id_.unlocked_clear_dirty();
+#define FIELD_UUID(id_)                   columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ << ::Poseidon::MySql::UuidFormatter(id_);	id_.unlocked_clear_dirty();
+#define FIELD_BLOB(id_)                   columns_os_ <<columns_delim_ <<"`" TOKEN_TO_STR(id_) "`";	values_os_ <<values_delim_ << ::Poseidon::MySql::StringEscaper(id_);	id_.unlocked_clear_dirty();
+
+	OBJECT_FIELDS
+	return true;
+}
+bool OBJECT_NAME::generate_sql_prepared(::std::string &set_clause_, ::boost::container::vector< ::Poseidon::MySql::StatementParameter> &params_) const {
+	PROFILE_ME;
+
+	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_signed(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_SIGNED(id_)                 if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_signed(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_UNSIGNED(id_)               if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_unsigned(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_DOUBLE(id_)                 if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_double(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_STRING(id_)                 if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_string(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_DATETIME(id_)               if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_datetime(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_UUID(id_)                   if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_uuid(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+#define FIELD_BLOB(id_)                   if(!set_clause_.empty()){ set_clause_ += ", "; }	set_clause_ += "`" TOKEN_TO_STR(id_) "` = ?";	params_.push_back(::Poseidon::MySql::StatementParameter::make_blob(id_.unlocked_get()));	id_.unlocked_clear_dirty();
+
+	OBJECT_FIELDS
+	return true;
+}
+#ifdef OBJECT_PRIMARY_KEYS
+bool OBJECT_NAME::can_generate_sql_update() const {
+	PROFILE_ME;
+
+	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	if(!is_persisted()){
+		return false;
+	}
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                || id_.unlocked_is_dirty()
+#define FIELD_SIGNED(id_)                 || id_.unlocked_is_dirty()
+#define FIELD_UNSIGNED(id_)               || id_.unlocked_is_dirty()
+#define FIELD_DOUBLE(id_)                 || id_.unlocked_is_dirty()
+#define FIELD_STRING(id_)                 || id_.unlocked_is_dirty()
+#define FIELD_DATETIME(id_)               || id_.unlocked_is_dirty()
+#define FIELD_UUID(id_)                   || id_.unlocked_is_dirty()
+#define FIELD_BLOB(id_)                   || id_.unlocked_is_dirty()
+
+	// 主键被修改时不知道原来的行在哪里，只能写入完整的行。
+	if(false OBJECT_PRIMARY_KEYS){
+		return false;
+	}
+	return false OBJECT_FIELDS;
+}
+bool OBJECT_NAME::generate_sql_update(::std::ostream &os_) const {
+	PROFILE_ME;
+
+	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	if(!can_generate_sql_update()){
+		return false;
+	}
+	::Poseidon::MySql::ObjectBase::Delimiter delim_;
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();
+#define FIELD_SIGNED(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();
+#define FIELD_UNSIGNED(id_)               os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();
+#define FIELD_DOUBLE(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();
+#define FIELD_STRING(id_)                 os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_.unlocked_get());
+#define FIELD_DATETIME(id_)               os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::DateTimeFormatter(id_.unlocked_get());
+#define FIELD_UUID(id_)                   os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::UuidFormatter(id_.unlocked_get());
+#define FIELD_BLOB(id_)                   os_ <<delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_.unlocked_get());
+
+	OBJECT_FIELDS
+	::Poseidon::MySql::ObjectBase::Delimiter update_delim_;
+	os_ <<" ON DUPLICATE KEY UPDATE ";
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();	id_.unlocked_clear_dirty(); }
+#define FIELD_SIGNED(id_)                 if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();	id_.unlocked_clear_dirty(); }
+#define FIELD_UNSIGNED(id_)               if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();	id_.unlocked_clear_dirty(); }
+#define FIELD_DOUBLE(id_)                 if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " <<id_.unlocked_get();	id_.unlocked_clear_dirty(); }
+#define FIELD_STRING(id_)                 if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_DATETIME(id_)               if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::DateTimeFormatter(id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_UUID(id_)                   if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::UuidFormatter(id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+#define FIELD_BLOB(id_)                   if(id_.unlocked_is_dirty()){ os_ <<update_delim_ <<"`" TOKEN_TO_STR(id_) "` = " << ::Poseidon::MySql::StringEscaper(id_.unlocked_get());	id_.unlocked_clear_dirty(); }
+
+	OBJECT_FIELDS
+	return true;
+}
+#endif
 void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::MySql::Connection> &conn_){
 	PROFILE_ME;
 
 	const ::Poseidon::RecursiveMutex::UniqueLock lock_(m_mutex);
+	set_persisted();
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                + 1
+#define FIELD_SIGNED(id_)                 + 1
+#define FIELD_UNSIGNED(id_)               + 1
+#define FIELD_DOUBLE(id_)                 + 1
+#define FIELD_STRING(id_)                 + 1
+#define FIELD_DATETIME(id_)               + 1
+#define FIELD_UUID(id_)                   + 1
+#define FIELD_BLOB(id_)                   + 1
+
+	enum { field_count_ = 0 OBJECT_FIELDS };
+
+	// 同一个结果集的每一行的字段位置都相同，只在结果集变化时按照名字查找一次。
+	static __thread ::boost::uint64_t s_result_serial_;
+	static __thread ::std::size_t s_indices_[field_count_ + 1];
+	::std::size_t index_ = 0;
+
+	const AUTO(result_serial_, conn_->get_result_serial());
+	if((result_serial_ == 0) || (result_serial_ != s_result_serial_)){
+
+#undef FIELD_BOOLEAN
+#undef FIELD_SIGNED
+#undef FIELD_UNSIGNED
+#undef FIELD_DOUBLE
+#undef FIELD_STRING
+#undef FIELD_DATETIME
+#undef FIELD_UUID
+#undef FIELD_BLOB
+
+#define FIELD_BOOLEAN(id_)                s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_SIGNED(id_)                 s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_UNSIGNED(id_)               s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_DOUBLE(id_)                 s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_STRING(id_)                 s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_DATETIME(id_)               s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_UUID(id_)                   s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+#define FIELD_BLOB(id_)                   s_indices_[index_++] = conn_->find_field( TOKEN_TO_STR(id_) );
+
+		OBJECT_FIELDS
+		s_result_serial_ = result_serial_;
+		index_ = 0;
+	}
 
 #undef FIELD_BOOLEAN
 #undef FIELD_SIGNED
@@ -189,14 +389,14 @@ void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::MySql::Conne
 #undef FIELD_UUID
 #undef FIELD_BLOB
 
-#define FIELD_BOOLEAN(id_)                id_.set(conn_->get_signed   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_SIGNED(id_)                 id_.set(conn_->get_signed   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_UNSIGNED(id_)               id_.set(conn_->get_unsigned ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_DOUBLE(id_)                 id_.set(conn_->get_double   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_STRING(id_)                 id_.set(conn_->get_string   ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_DATETIME(id_)               id_.set(conn_->get_datetime ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_UUID(id_)                   id_.set(conn_->get_uuid     ( TOKEN_TO_STR(id_) ), false);
-#define FIELD_BLOB(id_)                   id_.set(conn_->get_blob     ( TOKEN_TO_STR(id_) ), false);
+#define FIELD_BOOLEAN(id_)                id_.set(conn_->get_signed_at   (s_indices_[index_++]), false);
+#define FIELD_SIGNED(id_)                 id_.set(conn_->get_signed_at   (s_indices_[index_++]), false);
+#define FIELD_UNSIGNED(id_)               id_.set(conn_->get_unsigned_at (s_indices_[index_++]), false);
+#define FIELD_DOUBLE(id_)                 id_.set(conn_->get_double_at   (s_indices_[index_++]), false);
+#define FIELD_STRING(id_)                 id_.set(conn_->get_string_at   (s_indices_[index_++]), false);
+#define FIELD_DATETIME(id_)               id_.set(conn_->get_datetime_at (s_indices_[index_++]), false);
+#define FIELD_UUID(id_)                   id_.set(conn_->get_uuid_at     (s_indices_[index_++]), false);
+#define FIELD_BLOB(id_)                   id_.set(conn_->get_blob_at     (s_indices_[index_++]), false);
 
 	OBJECT_FIELDS
 }
@@ -206,3 +406,4 @@ void OBJECT_NAME::fetch(const ::boost::shared_ptr<const ::Poseidon::MySql::Conne
 
 #undef OBJECT_NAME
 #undef OBJECT_FIELDS
+#undef OBJECT_PRIMARY_KEYS
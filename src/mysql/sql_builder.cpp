@@ -0,0 +1,69 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "sql_builder.hpp"
+
+namespace Poseidon {
+namespace MySql {
+
+namespace {
+	__thread SqlBuilder *t_top = 0; // XXX: NULLPTR
+}
+
+SqlBuilder::Streambuf::Streambuf(){ }
+SqlBuilder::Streambuf::~Streambuf(){ }
+
+SqlBuilder::Streambuf::int_type SqlBuilder::Streambuf::overflow(int_type c){
+	if(traits_type::eq_int_type(c, traits_type::eof())){
+		return traits_type::not_eof(c);
+	}
+	m_str.push_back(traits_type::to_char_type(c));
+	return c;
+}
+std::streamsize SqlBuilder::Streambuf::xsputn(const char *s, std::streamsize n){
+	m_str.append(s, static_cast<std::size_t>(n));
+	return n;
+}
+
+SqlBuilder::SqlBuilder(bool installed)
+	: m_installed(installed), m_prev(NULLPTR), m_busy(false)
+	, m_os(&m_sb)
+{
+	if(m_installed){
+		m_prev = t_top;
+		t_top = this;
+	}
+}
+SqlBuilder::SqlBuilder()
+	: m_installed(true), m_prev(t_top), m_busy(false)
+	, m_os(&m_sb)
+{
+	t_top = this;
+}
+SqlBuilder::~SqlBuilder(){
+	if(m_installed){
+		t_top = m_prev;
+	}
+}
+
+SqlBuilder::Scope::Scope()
+	: m_builder(t_top)
+{
+	while(m_builder && m_builder->m_busy){
+		m_builder = m_builder->m_prev;
+	}
+	if(!m_builder){
+		m_temp.reset(new SqlBuilder(false));
+		m_builder = m_temp.get();
+	}
+	m_builder->m_busy = true;
+	m_builder->m_sb.clear();
+	m_builder->m_os.clear();
+}
+SqlBuilder::Scope::~Scope(){
+	m_builder->m_busy = false;
+}
+
+}
+}
@@ -0,0 +1,82 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_MYSQL_SQL_BUILDER_HPP_
+#define POSEIDON_MYSQL_SQL_BUILDER_HPP_
+
+#include "../cxx_util.hpp"
+#include <string>
+#include <streambuf>
+#include <ostream>
+#include <boost/scoped_ptr.hpp>
+
+namespace Poseidon {
+namespace MySql {
+
+// 生成 SQL 用的输出流，写入一个 std::string，清空时保留已经分配的内存。
+// 在线程中创建之后直到销毁，这个线程中的 SqlBuilder::Scope 都会复用它，而不是每次构造新的 std::ostream。
+class SqlBuilder : NONCOPYABLE {
+public:
+	class Scope;
+
+private:
+	class Streambuf : public std::streambuf {
+	private:
+		std::string m_str;
+
+	public:
+		Streambuf();
+		~Streambuf() OVERRIDE;
+
+	protected:
+		int_type overflow(int_type c = traits_type::eof()) OVERRIDE;
+		std::streamsize xsputn(const char *s, std::streamsize n) OVERRIDE;
+
+	public:
+		const std::string &get_string() const {
+			return m_str;
+		}
+		void clear() NOEXCEPT {
+			m_str.clear();
+		}
+	};
+
+private:
+	const bool m_installed;
+	SqlBuilder *m_prev;
+	bool m_busy;
+
+	Streambuf m_sb;
+	std::ostream m_os;
+
+private:
+	explicit SqlBuilder(bool installed);
+
+public:
+	SqlBuilder();
+	~SqlBuilder();
+};
+
+// 取得当前线程中一个空闲的 SqlBuilder 并清空之。如果没有空闲的，则临时创建一个。
+class SqlBuilder::Scope : NONCOPYABLE {
+private:
+	SqlBuilder *m_builder;
+	boost::scoped_ptr<SqlBuilder> m_temp;
+
+public:
+	Scope();
+	~Scope();
+
+public:
+	std::ostream &get_stream() const {
+		return m_builder->m_os;
+	}
+	const std::string &get_string() const {
+		return m_builder->m_sb.get_string();
+	}
+};
+
+}
+}
+
+#endif
@@ -5,18 +5,21 @@
 #define POSEIDON_OPTIONAL_MAP_HPP_
 
 #include "cxx_ver.hpp"
-#include <boost/container/map.hpp>
+#include <boost/container/small_vector.hpp>
 #include <stdexcept>
 #include <iosfwd>
+#include <utility>
 #include "shared_nts.hpp"
 
 namespace Poseidon {
 
 extern const std::string &empty_string() NOEXCEPT;
 
+// 按照插入顺序保存元素的平坦容器，同一个键的元素相邻，按照插入的顺序排列。
+// 通常只有几个到几十个元素，少量元素直接存放在对象中，查找时先比较每个键的哈希值。
 class OptionalMap {
 public:
-	typedef boost::container::multimap<SharedNts, std::string> base_container;
+	typedef boost::container::small_vector<std::pair<SharedNts, std::string>, 8> base_container;
 
 	typedef base_container::value_type        value_type;
 	typedef base_container::const_reference   const_reference;
@@ -29,23 +32,69 @@ public:
 	typedef base_container::const_reverse_iterator  const_reverse_iterator;
 	typedef base_container::reverse_iterator        reverse_iterator;
 
+private:
+	static std::size_t hash_key(const char *key) NOEXCEPT {
+		return SharedNts::compute_hash(key);
+	}
+	// 驻留的键不需要重新计算哈希值。
+	static std::size_t hash_key(const SharedNts &key) NOEXCEPT {
+		return key.get_hash();
+	}
+
 private:
 	base_container m_elements;
+	// m_hashes[i] 是 m_elements[i].first 的哈希值。
+	boost::container::small_vector<std::size_t, 8> m_hashes;
 
 public:
 	OptionalMap()
-		: m_elements()
+		: m_elements(), m_hashes()
 	{ }
 #ifndef POSEIDON_CXX11
 	OptionalMap(const OptionalMap &rhs)
-		: m_elements(rhs.m_elements)
+		: m_elements(rhs.m_elements), m_hashes(rhs.m_hashes)
 	{ }
 	OptionalMap &operator=(const OptionalMap &rhs){
 		m_elements = rhs.m_elements;
+		m_hashes = rhs.m_hashes;
 		return *this;
 	}
 #endif
 
+private:
+	// 返回第一个键为 key 的元素的下标，没有则返回 size()。
+	size_type find_index(const char *key, std::size_t hash) const NOEXCEPT {
+		const size_type count = m_hashes.size();
+		for(size_type i = 0; i < count; ++i){
+			if((m_hashes[i] == hash) && ((m_elements[i].first.get() == key) || (std::strcmp(m_elements[i].first.get(), key) == 0))){
+				return i;
+			}
+		}
+		return count;
+	}
+	// 返回 [first, 返回值) 中的元素的键都为 key。first 必须是 find_index() 的返回值。
+	size_type find_range_end(const char *key, std::size_t hash, size_type first) const NOEXCEPT {
+		const size_type count = m_hashes.size();
+		size_type last = first;
+		while((last < count) && (m_hashes[last] == hash) && ((m_elements[last].first.get() == key) || (std::strcmp(m_elements[last].first.get(), key) == 0))){
+			++last;
+		}
+		return last;
+	}
+	iterator erase_indices(size_type first, size_type last){
+		m_hashes.erase(m_hashes.begin() + static_cast<difference_type>(first), m_hashes.begin() + static_cast<difference_type>(last));
+		return m_elements.erase(m_elements.begin() + static_cast<difference_type>(first), m_elements.begin() + static_cast<difference_type>(last));
+	}
+	iterator insert_at(size_type index, std::size_t hash, SharedNts &key, std::string &val){
+		m_hashes.insert(m_hashes.begin() + static_cast<difference_type>(index), hash);
+		try {
+			return m_elements.emplace(m_elements.begin() + static_cast<difference_type>(index), STD_MOVE(key), STD_MOVE(val));
+		} catch(...){
+			m_hashes.erase(m_hashes.begin() + static_cast<difference_type>(index));
+			throw;
+		}
+	}
+
 public:
 	bool empty() const {
 		return m_elements.empty();
@@ -55,6 +104,7 @@ public:
 	}
 	void clear(){
 		m_elements.clear();
+		m_hashes.clear();
 	}
 
 	const_iterator begin() const {
@@ -104,35 +154,45 @@ public:
 #endif
 
 	iterator erase(const_iterator pos){
-		return m_elements.erase(pos);
+		const AUTO(index, static_cast<size_type>(pos - m_elements.begin()));
+		return erase_indices(index, index + 1);
 	}
 	iterator erase(const_iterator first, const_iterator last){
-		return m_elements.erase(first, last);
+		return erase_indices(static_cast<size_type>(first - m_elements.begin()), static_cast<size_type>(last - m_elements.begin()));
 	}
 	size_type erase(const char *key){
-		return erase(SharedNts::view(key));
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key, hash));
+		const AUTO(last, find_range_end(key, hash, first));
+		erase_indices(first, last);
+		return last - first;
 	}
 	size_type erase(const SharedNts &key){
-		return m_elements.erase(key);
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key.get(), hash));
+		const AUTO(last, find_range_end(key.get(), hash, first));
+		erase_indices(first, last);
+		return last - first;
 	}
 
 	void swap(OptionalMap &rhs) NOEXCEPT {
 		using std::swap;
 		swap(m_elements, rhs.m_elements);
+		swap(m_hashes, rhs.m_hashes);
 	}
 
 	// 一对一的接口。
 	const_iterator find(const char *key) const {
-		return find(SharedNts::view(key));
+		return m_elements.begin() + static_cast<difference_type>(find_index(key, hash_key(key)));
 	}
 	const_iterator find(const SharedNts &key) const {
-		return m_elements.find(key);
+		return m_elements.begin() + static_cast<difference_type>(find_index(key.get(), hash_key(key)));
 	}
 	iterator find(const char *key){
-		return find(SharedNts::view(key));
+		return m_elements.begin() + static_cast<difference_type>(find_index(key, hash_key(key)));
 	}
 	iterator find(const SharedNts &key){
-		return m_elements.find(key);
+		return m_elements.begin() + static_cast<difference_type>(find_index(key.get(), hash_key(key)));
 	}
 
 	bool has(const char *key) const {
@@ -142,18 +202,24 @@ public:
 		return find(key) != end();
 	}
 	iterator set(SharedNts key, std::string val){
-		AUTO(pair, m_elements.equal_range(key));
-		if(pair.first == pair.second){
-			return m_elements.emplace(STD_MOVE_IDN(key), STD_MOVE_IDN(val));
-		} else {
-			pair.first = m_elements.erase(pair.first, --pair.second);
-			pair.first->second.swap(val);
-			return pair.first;
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key.get(), hash));
+		if(first == size()){
+			return insert_at(first, hash, key, val);
 		}
+		// 保留第一个元素，删除其余的。
+		erase_indices(first + 1, find_range_end(key.get(), hash, first));
+		const AUTO(it, m_elements.begin() + static_cast<difference_type>(first));
+		it->second.swap(val);
+		return it;
 	}
 
 	const std::string &get(const char *key) const { // 若指定的键不存在，则返回空字符串。
-		return get(SharedNts::view(key));
+		const AUTO(it, find(key));
+		if(it == end()){
+			return empty_string();
+		}
+		return it->second;
 	};
 	const std::string &get(const SharedNts &key) const {
 		const AUTO(it, find(key));
@@ -163,7 +229,11 @@ public:
 		return it->second;
 	}
 	const std::string &at(const char *key) const { // 若指定的键不存在，则抛出 std::out_of_range。
-		return at(SharedNts::view(key));
+		const AUTO(it, find(key));
+		if(it == end()){
+			throw std::out_of_range(__PRETTY_FUNCTION__);
+		}
+		return it->second;
 	};
 	const std::string &at(const SharedNts &key) const {
 		const AUTO(it, find(key));
@@ -173,7 +243,11 @@ public:
 		return it->second;
 	}
 	std::string &at(const char *key){ // 若指定的键不存在，则抛出 std::out_of_range。
-		return at(SharedNts::view(key));
+		const AUTO(it, find(key));
+		if(it == end()){
+			throw std::out_of_range(__PRETTY_FUNCTION__);
+		}
+		return it->second;
 	};
 	std::string &at(const SharedNts &key){
 		const AUTO(it, find(key));
@@ -185,26 +259,50 @@ public:
 
 	// 一对多的接口。
 	std::pair<const_iterator, const_iterator> range(const char *key) const {
-		return range(SharedNts::view(key));
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key, hash));
+		const AUTO(last, find_range_end(key, hash, first));
+		return std::make_pair(m_elements.begin() + static_cast<difference_type>(first), m_elements.begin() + static_cast<difference_type>(last));
 	}
 	std::pair<const_iterator, const_iterator> range(const SharedNts &key) const {
-		return m_elements.equal_range(key);
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key.get(), hash));
+		const AUTO(last, find_range_end(key.get(), hash, first));
+		return std::make_pair(m_elements.begin() + static_cast<difference_type>(first), m_elements.begin() + static_cast<difference_type>(last));
 	}
 	std::pair<iterator, iterator> range(const char *key){
-		return range(SharedNts::view(key));
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key, hash));
+		const AUTO(last, find_range_end(key, hash, first));
+		return std::make_pair(m_elements.begin() + static_cast<difference_type>(first), m_elements.begin() + static_cast<difference_type>(last));
 	}
 	std::pair<iterator, iterator> range(const SharedNts &key){
-		return m_elements.equal_range(key);
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key.get(), hash));
+		const AUTO(last, find_range_end(key.get(), hash, first));
+		return std::make_pair(m_elements.begin() + static_cast<difference_type>(first), m_elements.begin() + static_cast<difference_type>(last));
 	}
 	size_type count(const char *key) const {
-		return count(SharedNts::view(key));
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key, hash));
+		return find_range_end(key, hash, first) - first;
 	}
 	size_type count(const SharedNts &key) const {
-		return m_elements.count(key);
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key.get(), hash));
+		return find_range_end(key.get(), hash, first) - first;
 	}
 
+	// 追加到同一个键的最后一个元素之后，没有则追加到末尾。
 	iterator append(SharedNts key, std::string val){
-		return m_elements.emplace(STD_MOVE_IDN(key), STD_MOVE_IDN(val));
+		const AUTO(hash, hash_key(key));
+		const AUTO(first, find_index(key.get(), hash));
+		return insert_at(find_range_end(key.get(), hash, first), hash, key, val);
+	}
+	// 预留空间，避免逐个追加时多次重新分配。
+	void reserve(size_type count){
+		m_elements.reserve(count);
+		m_hashes.reserve(count);
 	}
 };
 
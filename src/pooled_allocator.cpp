@@ -0,0 +1,217 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "pooled_allocator.hpp"
+#include "atomic.hpp"
+#include <pthread.h>
+
+namespace Poseidon {
+
+namespace {
+	CONSTEXPR const std::size_t BLOCK_GRANULARITY = 64;
+	CONSTEXPR const std::size_t SIZE_CLASS_COUNT = MAX_POOLED_BLOCK_SIZE / BLOCK_GRANULARITY;
+
+	// 线程局部的链表达到 LOCAL_MAX 块时把其中 BATCH_SIZE 块作为一批交给全局池。
+	CONSTEXPR const std::size_t LOCAL_MAX = 32;
+	CONSTEXPR const std::size_t BATCH_SIZE = 16;
+	CONSTEXPR const std::size_t GLOBAL_MAX_BATCHES = 64;
+
+	struct FreeBlock {
+		FreeBlock *next;
+		FreeBlock *next_batch;
+	};
+
+	struct LocalCache {
+		FreeBlock *head;
+		std::size_t count;
+	};
+
+	// 全局池只由 POD 构成，静态析构之后仍然可以使用。
+	struct GlobalPool {
+		volatile bool locked;
+		FreeBlock *batches;
+		std::size_t batch_count;
+		boost::uint64_t blocks_owned;
+		boost::uint64_t refills;
+		boost::uint64_t refill_misses;
+		boost::uint64_t spills;
+		boost::uint64_t spill_overflows;
+	};
+
+	__thread LocalCache t_caches[SIZE_CLASS_COUNT];
+	__thread bool t_cache_registered;
+	GlobalPool g_pools[SIZE_CLASS_COUNT];
+
+	::pthread_once_t g_cache_key_once = PTHREAD_ONCE_INIT;
+	::pthread_key_t g_cache_key;
+
+	void lock_pool(GlobalPool &pool) NOEXCEPT {
+		while(atomic_exchange(pool.locked, true, ATOMIC_ACQUIRE)){
+			atomic_pause();
+		}
+	}
+	void unlock_pool(GlobalPool &pool) NOEXCEPT {
+		atomic_store(pool.locked, false, ATOMIC_RELEASE);
+	}
+
+	std::size_t free_list(FreeBlock *head) NOEXCEPT {
+		std::size_t count = 0;
+		while(head){
+			const AUTO(next, head->next);
+			::operator delete(head);
+			head = next;
+			++count;
+		}
+		return count;
+	}
+	// 把一串空闲块作为一批放入全局池，池满时直接释放。
+	void push_batch(std::size_t index, FreeBlock *batch) NOEXCEPT {
+		AUTO_REF(pool, g_pools[index]);
+		lock_pool(pool);
+		++pool.spills;
+		if(pool.batch_count < GLOBAL_MAX_BATCHES){
+			batch->next_batch = pool.batches;
+			pool.batches = batch;
+			++pool.batch_count;
+			batch = NULLPTR;
+		} else {
+			++pool.spill_overflows;
+		}
+		unlock_pool(pool);
+		if(batch){
+			const AUTO(count, free_list(batch));
+			lock_pool(pool);
+			pool.blocks_owned -= count;
+			unlock_pool(pool);
+		}
+	}
+	FreeBlock *pop_batch(std::size_t index) NOEXCEPT {
+		AUTO_REF(pool, g_pools[index]);
+		lock_pool(pool);
+		const AUTO(batch, pool.batches);
+		if(batch){
+			pool.batches = batch->next_batch;
+			--pool.batch_count;
+			++pool.refills;
+		} else {
+			++pool.refill_misses;
+			// 调用者随后会分配一个新块。
+			++pool.blocks_owned;
+		}
+		unlock_pool(pool);
+		return batch;
+	}
+
+	void flush_local_caches(void *) NOEXCEPT {
+		for(std::size_t i = 0; i < SIZE_CLASS_COUNT; ++i){
+			AUTO_REF(cache, t_caches[i]);
+			if(cache.head){
+				push_batch(i, cache.head);
+			}
+			cache.head = NULLPTR;
+			cache.count = 0;
+		}
+		t_cache_registered = false;
+	}
+	void create_cache_key() NOEXCEPT {
+		if(::pthread_key_create(&g_cache_key, &flush_local_caches) != 0){
+			std::abort();
+		}
+	}
+	void register_local_caches() NOEXCEPT {
+		if(t_cache_registered){
+			return;
+		}
+		// 线程退出时把局部空闲链表交还给全局池。键的值只要非空即可。
+		::pthread_once(&g_cache_key_once, &create_cache_key);
+		::pthread_setspecific(g_cache_key, &t_cache_registered);
+		t_cache_registered = true;
+	}
+}
+
+void *allocate_pooled(std::size_t size){
+	if((size == 0) || (size > MAX_POOLED_BLOCK_SIZE)){
+		return ::operator new(size);
+	}
+	const std::size_t index = (size - 1) / BLOCK_GRANULARITY;
+	AUTO_REF(cache, t_caches[index]);
+	if(!cache.head){
+		const AUTO(batch, pop_batch(index));
+		if(!batch){
+			try {
+				return ::operator new((index + 1) * BLOCK_GRANULARITY);
+			} catch(...){
+				AUTO_REF(pool, g_pools[index]);
+				lock_pool(pool);
+				--pool.blocks_owned;
+				unlock_pool(pool);
+				throw;
+			}
+		}
+		std::size_t count = 0;
+		for(AUTO(block, batch); block; block = block->next){
+			++count;
+		}
+		register_local_caches();
+		cache.head = batch;
+		cache.count = count;
+	}
+	const AUTO(block, cache.head);
+	cache.head = block->next;
+	--cache.count;
+	return block;
+}
+void deallocate_pooled(void *ptr, std::size_t size) NOEXCEPT {
+	if(!ptr){
+		return;
+	}
+	if((size == 0) || (size > MAX_POOLED_BLOCK_SIZE)){
+		::operator delete(ptr);
+		return;
+	}
+	const std::size_t index = (size - 1) / BLOCK_GRANULARITY;
+	AUTO_REF(cache, t_caches[index]);
+	register_local_caches();
+	const AUTO(block, static_cast<FreeBlock *>(ptr));
+	block->next = cache.head;
+	cache.head = block;
+	++cache.count;
+	if(cache.count < LOCAL_MAX){
+		return;
+	}
+	// 局部链表满了，把前 BATCH_SIZE 块作为一批交给全局池。
+	AUTO(last, cache.head);
+	for(std::size_t i = 1; i < BATCH_SIZE; ++i){
+		last = last->next;
+	}
+	const AUTO(batch, cache.head);
+	cache.head = last->next;
+	cache.count -= BATCH_SIZE;
+	last->next = NULLPTR;
+	push_batch(index, batch);
+}
+
+void snapshot_pooled_allocator(boost::container::vector<PooledAllocatorSnapshotElement> &ret){
+	ret.reserve(ret.size() + SIZE_CLASS_COUNT);
+	for(std::size_t i = 0; i < SIZE_CLASS_COUNT; ++i){
+		AUTO_REF(pool, g_pools[i]);
+		PooledAllocatorSnapshotElement elem;
+		elem.block_size = (i + 1) * BLOCK_GRANULARITY;
+		elem.batch_size = BATCH_SIZE;
+		lock_pool(pool);
+		elem.blocks_owned = pool.blocks_owned;
+		elem.pooled_batches = pool.batch_count;
+		elem.refills = pool.refills;
+		elem.refill_misses = pool.refill_misses;
+		elem.spills = pool.spills;
+		elem.spill_overflows = pool.spill_overflows;
+		unlock_pool(pool);
+		if(elem.blocks_owned == 0){
+			continue;
+		}
+		ret.push_back(elem);
+	}
+}
+
+}
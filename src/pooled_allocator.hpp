@@ -0,0 +1,103 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_POOLED_ALLOCATOR_HPP_
+#define POSEIDON_POOLED_ALLOCATOR_HPP_
+
+#include "cxx_ver.hpp"
+#include <cstddef>
+#include <new>
+#include <boost/cstdint.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+// 小块内存按 64 字节分级，释放后进入线程局部的空闲链表，满了之后按批转移到全局池中。
+// 框架中生命周期短、在 epoll 线程分配而在任务线程释放的对象（任务、数据库操作等）用它代替 make_shared：
+//   boost::allocate_shared<Job>(PooledAllocator<Job>(), args...)
+// 超过 MAX_POOLED_BLOCK_SIZE 字节的请求直接使用 operator new。
+CONSTEXPR const std::size_t MAX_POOLED_BLOCK_SIZE = 1024;
+
+extern void *allocate_pooled(std::size_t size);
+extern void deallocate_pooled(void *ptr, std::size_t size) NOEXCEPT;
+
+// 计数只在数据块进出全局池时更新，因此不会在每次分配时争用缓存行。
+struct PooledAllocatorSnapshotElement {
+	std::size_t block_size;
+	// 从 operator new 得到的块数减去归还给 operator delete 的块数，包括正在使用的和缓存中的。
+	boost::uint64_t blocks_owned;
+	// 全局池中的批数和每批的块数。
+	std::size_t pooled_batches;
+	std::size_t batch_size;
+	// 线程局部的链表从全局池取得一批的次数，和全局池为空的次数。
+	boost::uint64_t refills;
+	boost::uint64_t refill_misses;
+	// 线程局部的链表把一批交给全局池的次数，和全局池已满、只能直接释放的次数。
+	boost::uint64_t spills;
+	boost::uint64_t spill_overflows;
+};
+
+extern void snapshot_pooled_allocator(boost::container::vector<PooledAllocatorSnapshotElement> &ret);
+
+template<typename T>
+class PooledAllocator {
+public:
+	typedef T value_type;
+	typedef T *pointer;
+	typedef const T *const_pointer;
+	typedef T &reference;
+	typedef const T &const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind {
+		typedef PooledAllocator<U> other;
+	};
+
+public:
+	PooledAllocator() NOEXCEPT { }
+	template<typename U>
+	PooledAllocator(const PooledAllocator<U> &) NOEXCEPT { }
+
+public:
+	pointer address(reference val) const NOEXCEPT {
+		return &val;
+	}
+	const_pointer address(const_reference val) const NOEXCEPT {
+		return &val;
+	}
+	size_type max_size() const NOEXCEPT {
+		return static_cast<size_type>(-1) / sizeof(T);
+	}
+
+	pointer allocate(size_type n, const void * = NULLPTR){
+		if(n > max_size()){
+			throw std::bad_alloc();
+		}
+		return static_cast<pointer>(allocate_pooled(n * sizeof(T)));
+	}
+	void deallocate(pointer p, size_type n) NOEXCEPT {
+		deallocate_pooled(p, n * sizeof(T));
+	}
+
+	void construct(pointer p, const T &val){
+		::new(static_cast<void *>(p)) T(val);
+	}
+	void destroy(pointer p){
+		p->~T();
+	}
+};
+
+template<typename T, typename U>
+inline bool operator==(const PooledAllocator<T> &, const PooledAllocator<U> &) NOEXCEPT {
+	return true;
+}
+template<typename T, typename U>
+inline bool operator!=(const PooledAllocator<T> &, const PooledAllocator<U> &) NOEXCEPT {
+	return false;
+}
+
+}
+
+#endif
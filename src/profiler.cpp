@@ -4,7 +4,6 @@
 #include "precompiled.hpp"
 #include "profiler.hpp"
 #include "singletons/profile_depository.hpp"
-#include "time.hpp"
 #include "log.hpp"
 
 namespace Poseidon {
@@ -21,7 +20,7 @@ void Profiler::accumulate_all_in_thread() NOEXCEPT {
 	if(!cur){
 		return;
 	}
-	const AUTO(now, get_hi_res_mono_clock());
+	const AUTO(now, ProfileDepository::get_ticks());
 	do {
 		cur->accumulate(now, false);
 		cur = cur->m_prev;
@@ -36,7 +35,7 @@ void *Profiler::begin_stack_switch() NOEXCEPT {
 	if(!cur){
 		return NULLPTR;
 	}
-	const AUTO(now, get_hi_res_mono_clock());
+	const AUTO(now, ProfileDepository::get_ticks());
 	cur->accumulate(now, false);
 	cur->m_yielded_since = now;
 	t_top = NULLPTR;
@@ -47,18 +46,18 @@ void Profiler::end_stack_switch(void *opaque) NOEXCEPT {
 	if(!cur){
 		return;
 	}
-	const AUTO(now, get_hi_res_mono_clock());
+	const AUTO(now, ProfileDepository::get_ticks());
 	cur->m_excluded += now - cur->m_yielded_since;
 	cur->accumulate(now, false);
 	t_top = cur;
 }
 
-Profiler::Profiler(const char *file, unsigned long line, const char *func) NOEXCEPT
-	: m_prev(t_top), m_file(file), m_line(line), m_func(func)
-	, m_start(0), m_excluded(0), m_yielded_since(0)
+Profiler::Profiler(const char *file, unsigned long line, const char *func, bool histogram) NOEXCEPT
+	: m_prev(t_top), m_file(file), m_line(line), m_func(func), m_histogram(histogram)
+	, m_start(0), m_excluded(0), m_yielded_since(0), m_duration(0)
 {
 	if(ProfileDepository::is_enabled()){
-		const AUTO(now, get_hi_res_mono_clock());
+		const AUTO(now, ProfileDepository::get_ticks());
 		m_start = now;
 		t_top = this;
 	}
@@ -69,15 +68,15 @@ Profiler::~Profiler() NOEXCEPT {
 	}
 
 	if(t_top == this){
-		const AUTO(now, get_hi_res_mono_clock());
+		const AUTO(now, ProfileDepository::get_ticks());
 		t_top = m_prev;
 		accumulate(now, true);
 	}
 }
 
-void Profiler::accumulate(double now, bool new_sample) NOEXCEPT {
-	const AUTO(total, now - m_start);
-	const AUTO(exclusive, total - m_excluded);
+void Profiler::accumulate(boost::uint64_t now, bool new_sample) NOEXCEPT {
+	const boost::uint64_t total = (now > m_start) ? (now - m_start) : 0;
+	const boost::uint64_t exclusive = (total > m_excluded) ? (total - m_excluded) : 0;
 	m_start = now;
 	m_excluded = 0;
 
@@ -85,7 +84,11 @@ void Profiler::accumulate(double now, bool new_sample) NOEXCEPT {
 		m_prev->m_excluded += total;
 	}
 
-	ProfileDepository::accumulate(m_file, m_line, m_func, new_sample, total, exclusive);
+	m_duration += total;
+	ProfileDepository::accumulate(m_file, m_line, m_func, new_sample, total, exclusive, m_histogram && new_sample, m_duration);
+	if(new_sample){
+		m_duration = 0;
+	}
 }
 
 }
@@ -5,49 +5,187 @@
 #include "promise.hpp"
 #include "exception.hpp"
 #include "log.hpp"
+#include "atomic.hpp"
+#include "profiler.hpp"
 #include "singletons/job_dispatcher.hpp"
 
 namespace Poseidon {
 
+struct Promise::WaiterNode {
+	boost::function<void ()> waiter;
+	WaiterNode *next;
+};
+
+Promise::WaiterNode Promise::s_closed_waiters;
+
 Promise::~Promise(){
-	if(!m_except){
+	if(atomic_load(m_state, ATOMIC_RELAXED) != S_SATISFIED){
 		LOG_POSEIDON_WARNING("Destroying an unsatisfied Promise.");
 	}
+	WaiterNode *node = atomic_load(m_waiters, ATOMIC_ACQUIRE);
+	if(node == &s_closed_waiters){
+		return;
+	}
+	while(node){
+		WaiterNode *const next = node->next;
+		delete node;
+		node = next;
+	}
+}
+
+bool Promise::begin_setting(bool throw_if_already_set){
+	int cmp = S_PENDING;
+	if(!atomic_compare_exchange(m_state, cmp, S_SETTING, ATOMIC_ACQUIRE, ATOMIC_RELAXED)){
+		if(throw_if_already_set){
+			DEBUG_THROW(Exception, sslit("Promise has already been satisfied"));
+		}
+		return false;
+	}
+	return true;
+}
+void Promise::commit(STD_EXCEPTION_PTR except) NOEXCEPT {
+	m_except = STD_MOVE_IDN(except);
+	atomic_store(m_state, S_SATISFIED, ATOMIC_RELEASE);
+
+	// 取走所有的 waiter 并关闭链表，按添加顺序调用。
+	WaiterNode *node = atomic_exchange(m_waiters, &s_closed_waiters, ATOMIC_ACQ_REL);
+	WaiterNode *head = NULLPTR;
+	while(node){
+		WaiterNode *const next = node->next;
+		node->next = head;
+		head = node;
+		node = next;
+	}
+	while(head){
+		WaiterNode *const next = head->next;
+		try {
+			head->waiter();
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown from promise waiter: what = ", e.what());
+		} catch(...){
+			LOG_POSEIDON_ERROR("Unknown exception thrown from promise waiter.");
+		}
+		delete head;
+		head = next;
+	}
 }
 
 bool Promise::is_satisfied() const NOEXCEPT {
-	const RecursiveMutex::UniqueLock lock(m_mutex);
-	const STD_EXCEPTION_PTR *const ptr = m_except.get_ptr();
-	return ptr;
+	return atomic_load(m_state, ATOMIC_ACQUIRE) == S_SATISFIED;
 }
 bool Promise::would_throw() const NOEXCEPT {
-	const RecursiveMutex::UniqueLock lock(m_mutex);
-	const STD_EXCEPTION_PTR *const ptr = m_except.get_ptr();
-	return !ptr || *ptr;
+	if(atomic_load(m_state, ATOMIC_ACQUIRE) != S_SATISFIED){
+		return true;
+	}
+	return !!m_except;
 }
 void Promise::check_and_rethrow() const {
-	const RecursiveMutex::UniqueLock lock(m_mutex);
-	const STD_EXCEPTION_PTR *const ptr = m_except.get_ptr();
-	if(!ptr){
+	if(atomic_load(m_state, ATOMIC_ACQUIRE) != S_SATISFIED){
 		DEBUG_THROW(Exception, sslit("Promise has not been satisfied"));
 	}
-	if(*ptr){
-		STD_RETHROW_EXCEPTION(*ptr);
+	if(m_except){
+		STD_RETHROW_EXCEPTION(m_except);
+	}
+}
+
+void Promise::add_waiter(boost::function<void ()> waiter) const {
+	WaiterNode *head = atomic_load(m_waiters, ATOMIC_ACQUIRE);
+	if(head != &s_closed_waiters){
+		WaiterNode *const node = new WaiterNode;
+		node->waiter.swap(waiter);
+		for(;;){
+			node->next = head;
+			if(atomic_compare_exchange(m_waiters, head, node, ATOMIC_RELEASE, ATOMIC_ACQUIRE)){
+				return;
+			}
+			if(head == &s_closed_waiters){
+				break;
+			}
+		}
+		// 在添加之前 Promise 已经被满足。
+		waiter.swap(node->waiter);
+		delete node;
 	}
+	waiter();
 }
 
 void Promise::set_success(bool throw_if_already_set){
 	set_exception(STD_EXCEPTION_PTR(), throw_if_already_set);
 }
 void Promise::set_exception(STD_EXCEPTION_PTR except, bool throw_if_already_set){
-	const RecursiveMutex::UniqueLock lock(m_mutex);
-	if(m_except){
-		if(throw_if_already_set){
-			DEBUG_THROW(Exception, sslit("Promise has already been satisfied"));
-		}
+	if(!begin_setting(throw_if_already_set)){
 		return;
 	}
-	m_except = STD_MOVE_IDN(except);
+	commit(STD_MOVE_IDN(except));
+}
+
+namespace {
+	struct WhenAllState {
+		boost::shared_ptr<Promise> result;
+		// 每个元素只由对应 promise 的 waiter 写入，最后一个完成的 waiter 在 acquire 之后读取。
+		boost::container::vector<STD_EXCEPTION_PTR> excepts;
+		volatile std::size_t pending;
+	};
+
+	// waiter 只会在 promise 被满足时调用，此时 promise 一定是存活的，因此这里保存裸指针，避免循环引用。
+	void when_all_waiter(const boost::shared_ptr<WhenAllState> &state, const Promise *promise, std::size_t index) NOEXCEPT {
+		if(promise->would_throw()){
+			try {
+				promise->check_and_rethrow();
+			} catch(...){
+				state->excepts.at(index) = STD_CURRENT_EXCEPTION();
+			}
+		}
+		if(atomic_sub(state->pending, 1, ATOMIC_ACQ_REL) != 0){
+			return;
+		}
+		for(AUTO(it, state->excepts.begin()); it != state->excepts.end(); ++it){
+			if(*it){
+				state->result->set_exception(*it, false);
+				return;
+			}
+		}
+		state->result->set_success(false);
+	}
+
+	void when_any_waiter(const boost::shared_ptr<PromiseContainer<std::size_t> > &result, std::size_t index) NOEXCEPT {
+		result->set_success(index, false);
+	}
+}
+
+boost::shared_ptr<const Promise> when_all(const boost::container::vector<boost::shared_ptr<const Promise> > &promises){
+	PROFILE_ME;
+
+	AUTO(result, boost::make_shared<Promise>());
+	if(promises.empty()){
+		result->set_success();
+		return STD_MOVE_IDN(result);
+	}
+	const AUTO(state, boost::make_shared<WhenAllState>());
+	state->result = result;
+	state->excepts.resize(promises.size());
+	state->pending = promises.size();
+	for(std::size_t i = 0; i < promises.size(); ++i){
+		const AUTO_REF(promise, promises.at(i));
+		DEBUG_THROW_ASSERT(promise);
+		promise->add_waiter(boost::bind(&when_all_waiter, state, promise.get(), i));
+	}
+	return STD_MOVE_IDN(result);
+}
+boost::shared_ptr<const PromiseContainer<std::size_t> > when_any(const boost::container::vector<boost::shared_ptr<const Promise> > &promises){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(!promises.empty(), Exception, sslit("No promises to wait for"));
+	AUTO(result, boost::make_shared<PromiseContainer<std::size_t> >());
+	for(std::size_t i = 0; i < promises.size(); ++i){
+		if(result->is_satisfied()){
+			break;
+		}
+		const AUTO_REF(promise, promises.at(i));
+		DEBUG_THROW_ASSERT(promise);
+		promise->add_waiter(boost::bind(&when_any_waiter, result, i));
+	}
+	return STD_MOVE_IDN(result);
 }
 
 void yield(const boost::shared_ptr<const Promise> &promise, bool insignificant){
@@ -6,28 +6,54 @@
 
 #include "cxx_ver.hpp"
 #include "cxx_util.hpp"
-#include "recursive_mutex.hpp"
 #include <boost/shared_ptr.hpp>
 #include <boost/type_traits/remove_const.hpp>
 #include <boost/optional.hpp>
+#include <boost/function.hpp>
+#include <boost/container/vector.hpp>
+#include <cstddef>
 
 namespace Poseidon {
 
+// 只能被满足一次，不使用互斥锁。
+// 状态从 S_PENDING 经过 S_SETTING 变为 S_SATISFIED，只有把状态改为 S_SETTING 的线程可以写入结果，
+// 写入完成之后以 release 语义发布 S_SATISFIED，读取者以 acquire 语义检查状态之后即可不加锁地访问结果。
 class Promise : NONCOPYABLE {
-protected:
-	mutable RecursiveMutex m_mutex;
-	boost::optional<STD_EXCEPTION_PTR> m_except;
+private:
+	enum State {
+		S_PENDING    = 0,
+		S_SETTING    = 1,
+		S_SATISFIED  = 2,
+	};
+
+	struct WaiterNode;
+
+	// 满足之后 waiter 链表的头指针被替换为这个哨兵，之后添加的 waiter 立即调用。
+	static WaiterNode s_closed_waiters;
+
+private:
+	volatile int m_state;
+	STD_EXCEPTION_PTR m_except;
+	// 无锁栈，后添加的在前。
+	mutable WaiterNode *volatile m_waiters;
 
 public:
 	Promise()
-		: m_mutex(), m_except()
+		: m_state(S_PENDING), m_except(), m_waiters(NULLPTR)
 	{ }
 	virtual ~Promise();
 
+protected:
+	// 返回 true 表示当前线程取得了写入结果的权利，之后必须调用 commit()。
+	bool begin_setting(bool throw_if_already_set);
+	void commit(STD_EXCEPTION_PTR except) NOEXCEPT;
+
 public:
 	bool is_satisfied() const NOEXCEPT;
 	bool would_throw() const NOEXCEPT;
 	void check_and_rethrow() const;
+	// Promise 被满足之后调用 waiter，如果已经被满足则立即调用。waiter 可能在任意线程中被调用。
+	void add_waiter(boost::function<void ()> waiter) const;
 
 	void set_success(bool throw_if_already_set = true);
 	void set_exception(STD_EXCEPTION_PTR except, bool throw_if_already_set = true);
@@ -37,43 +63,81 @@ template<typename ResultT>
 class PromiseContainer : public Promise {
 private:
 	mutable boost::optional<typename boost::remove_const<ResultT>::type> m_result;
-	bool m_result_accepted;
 
 public:
 	PromiseContainer()
-		: m_result(), m_result_accepted(false)
+		: m_result()
 	{ }
 	~PromiseContainer() OVERRIDE;
 
 public:
 	ResultT *try_get() const NOEXCEPT {
-		const RecursiveMutex::UniqueLock lock(m_mutex);
 		if(Promise::would_throw()){
 			return NULLPTR;
 		}
-		// `m_result_accepted` will not be false if `Promise::would_throw()` yields true.
+		// `m_result` has been published by `commit()` if `Promise::would_throw()` yields false.
 		return m_result.get_ptr();
 	}
 	ResultT &get() const {
-		const RecursiveMutex::UniqueLock lock(m_mutex);
 		Promise::check_and_rethrow();
 		// Likewise. See comments in `try_get()`.
 		return m_result.get();
 	}
 	void set_success(typename boost::remove_const<ResultT>::type result, bool throw_if_already_set = true){
-		const RecursiveMutex::UniqueLock lock(m_mutex);
-		// If `m_result_accepted` is true, `Promise::set_success()` will throw an exception eventually. Hence we do not set the value here.
-		if(!m_result_accepted){
+		if(!Promise::begin_setting(throw_if_already_set)){
+			return;
+		}
+		try {
 			m_result = STD_MOVE_IDN(result);
+		} catch(...){
+			Promise::commit(STD_CURRENT_EXCEPTION());
+			throw;
 		}
-		Promise::set_success(throw_if_already_set);
-		m_result_accepted = true;
+		Promise::commit(STD_EXCEPTION_PTR());
 	}
 };
 
 template<typename ResultT>
 PromiseContainer<ResultT>::~PromiseContainer(){ }
 
+// 所有 promise 都被满足之后被满足，不轮询，也不占用任何线程。
+// 如果有 promise 抛出异常，结果以其中下标最小的那个异常被满足，否则成功。传入空的列表则立即成功。
+// 等待它返回之后，每个 promise 都已被满足，可以逐个取出结果。
+extern boost::shared_ptr<const Promise> when_all(const boost::container::vector<boost::shared_ptr<const Promise> > &promises);
+// 任何一个 promise 被满足之后被满足，结果是那个 promise 的下标，无论它是否抛出异常。不能传入空的列表。
+extern boost::shared_ptr<const PromiseContainer<std::size_t> > when_any(const boost::container::vector<boost::shared_ptr<const Promise> > &promises);
+
+inline boost::shared_ptr<const Promise> when_all(const boost::shared_ptr<const Promise> &p0, const boost::shared_ptr<const Promise> &p1){
+	boost::container::vector<boost::shared_ptr<const Promise> > promises;
+	promises.reserve(2);
+	promises.push_back(p0);
+	promises.push_back(p1);
+	return when_all(promises);
+}
+inline boost::shared_ptr<const Promise> when_all(const boost::shared_ptr<const Promise> &p0, const boost::shared_ptr<const Promise> &p1, const boost::shared_ptr<const Promise> &p2){
+	boost::container::vector<boost::shared_ptr<const Promise> > promises;
+	promises.reserve(3);
+	promises.push_back(p0);
+	promises.push_back(p1);
+	promises.push_back(p2);
+	return when_all(promises);
+}
+inline boost::shared_ptr<const PromiseContainer<std::size_t> > when_any(const boost::shared_ptr<const Promise> &p0, const boost::shared_ptr<const Promise> &p1){
+	boost::container::vector<boost::shared_ptr<const Promise> > promises;
+	promises.reserve(2);
+	promises.push_back(p0);
+	promises.push_back(p1);
+	return when_any(promises);
+}
+inline boost::shared_ptr<const PromiseContainer<std::size_t> > when_any(const boost::shared_ptr<const Promise> &p0, const boost::shared_ptr<const Promise> &p1, const boost::shared_ptr<const Promise> &p2){
+	boost::container::vector<boost::shared_ptr<const Promise> > promises;
+	promises.reserve(3);
+	promises.push_back(p0);
+	promises.push_back(p1);
+	promises.push_back(p2);
+	return when_any(promises);
+}
+
 extern void yield(const boost::shared_ptr<const Promise> &promise, bool insignificant = true);
 
 template<typename ResultT>
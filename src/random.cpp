@@ -3,33 +3,155 @@
 
 #include "precompiled.hpp"
 #include "random.hpp"
-#include "atomic.hpp"
+#include "raii.hpp"
+#include "exception.hpp"
+#include <climits>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <openssl/rand.h>
 
 namespace Poseidon {
 
 namespace {
-	volatile boost::uint64_t s_seed;
+	// xoshiro256**，见 http://prng.di.unimi.it/。
+	// 每个线程使用自己的状态，第一次使用时从内核获取种子，因此不同线程之间没有任何争用。
+	__thread bool t_seeded = false;
+	__thread boost::uint64_t t_state[4];
+
+	inline boost::uint64_t rotate_left(boost::uint64_t x, unsigned k) NOEXCEPT {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	boost::uint64_t split_mix(boost::uint64_t &x) NOEXCEPT {
+		x += 0x9E3779B97F4A7C15u;
+		boost::uint64_t z = x;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+		return z ^ (z >> 31);
+	}
+
+	// 尽量读取 size 字节的熵，返回实际读取的字节数。这里不能抛出异常。
+	std::size_t read_kernel_entropy(void *data, std::size_t size) NOEXCEPT {
+		std::size_t got = 0;
+#ifdef SYS_getrandom
+		while(got < size){
+			// GRND_NONBLOCK：系统刚启动、熵池还没有初始化时不要阻塞，而是使用下面的后备方案。
+			const long result = ::syscall(SYS_getrandom, static_cast<char *>(data) + got, size - got, 0x0001u);
+			if(result < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				break;
+			}
+			got += static_cast<std::size_t>(result);
+		}
+#endif
+		if(got < size){
+			UniqueFile file;
+			if(file.reset(::open("/dev/urandom", O_RDONLY | O_CLOEXEC))){
+				while(got < size){
+					const ::ssize_t result = ::read(file.get(), static_cast<char *>(data) + got, size - got);
+					if(result <= 0){
+						if((result < 0) && (errno == EINTR)){
+							continue;
+						}
+						break;
+					}
+					got += static_cast<std::size_t>(result);
+				}
+			}
+		}
+		return got;
+	}
+
+	void reset_after_fork() NOEXCEPT {
+		// 子进程中只有调用 fork() 的线程，它的状态与父进程相同，必须重新获取种子。
+		t_seeded = false;
+	}
+
+	__attribute__((__noinline__))
+	void seed_this_thread() NOEXCEPT {
+		static const int s_atfork_result = ::pthread_atfork(NULLPTR, NULLPTR, &reset_after_fork);
+		(void)s_atfork_result;
+
+		boost::uint64_t entropy[4] = { };
+		read_kernel_entropy(entropy, sizeof(entropy));
+		// 即使读取失败，不同线程和不同时间的种子也不相同。
+		::timespec ts;
+		::clock_gettime(CLOCK_REALTIME, &ts);
+		boost::uint64_t x = static_cast<boost::uint64_t>(ts.tv_sec) * 1000000000 + static_cast<boost::uint64_t>(ts.tv_nsec);
+		x ^= static_cast<boost::uint64_t>(::syscall(SYS_gettid)) << 32;
+		x ^= reinterpret_cast<boost::uint64_t>(&x);
+		for(unsigned i = 0; i < 4; ++i){
+			t_state[i] = entropy[i] ^ split_mix(x);
+		}
+		t_seeded = true;
+	}
+
+	boost::uint64_t next_random() NOEXCEPT {
+		if(!t_seeded){
+			seed_this_thread();
+		}
+		boost::uint64_t *const s = t_state;
+		const boost::uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+		const boost::uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotate_left(s[3], 45);
+		return result;
+	}
 }
 
 boost::uint32_t random_uint32(){
-	boost::uint64_t old_seed, new_seed;
-	{
-		old_seed = atomic_load(s_seed, ATOMIC_RELAXED);
-		do {
-			new_seed = old_seed;
-			new_seed ^= __builtin_ia32_rdtsc();
-			// MMIX by Donald Knuth
-			new_seed *= 6364136223846793005u;
-			new_seed += 1442695040888963407u;
-		} while(!atomic_compare_exchange(s_seed, old_seed, new_seed, ATOMIC_RELAXED, ATOMIC_RELAXED));
-	}
-	return static_cast<boost::uint32_t>(new_seed >> 32);
+	// 低位的质量稍差，所以取高 32 位。
+	return static_cast<boost::uint32_t>(next_random() >> 32);
 }
 boost::uint64_t random_uint64(){
-	return (static_cast<boost::uint64_t>(random_uint32()) << 32) + random_uint32();
+	return next_random();
 }
 double random_double(){
-	return static_cast<double>(static_cast<boost::int64_t>(random_uint64() >> 1)) / 0x1p63;
+	return static_cast<double>(next_random() >> 11) / 0x1p53;
+}
+void random_fill(void *data, std::size_t size){
+	unsigned char *write = static_cast<unsigned char *>(data);
+	std::size_t remaining = size;
+	while(remaining >= 8){
+		const boost::uint64_t word = next_random();
+		std::memcpy(write, &word, 8);
+		write += 8;
+		remaining -= 8;
+	}
+	if(remaining != 0){
+		const boost::uint64_t word = next_random();
+		std::memcpy(write, &word, remaining);
+	}
+}
+
+void secure_random_fill(void *data, std::size_t size){
+	unsigned char *write = static_cast<unsigned char *>(data);
+	std::size_t remaining = size;
+	while(remaining != 0){
+		const int n = static_cast<int>(std::min<std::size_t>(remaining, INT_MAX));
+		DEBUG_THROW_UNLESS(::RAND_bytes(write, n) == 1, Exception, sslit("::RAND_bytes() failed"));
+		write += n;
+		remaining -= static_cast<std::size_t>(n);
+	}
+}
+boost::uint32_t secure_random_uint32(){
+	boost::uint32_t val;
+	secure_random_fill(&val, sizeof(val));
+	return val;
+}
+boost::uint64_t secure_random_uint64(){
+	boost::uint64_t val;
+	secure_random_fill(&val, sizeof(val));
+	return val;
 }
 
 }
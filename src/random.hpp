@@ -5,13 +5,21 @@
 #define POSEIDON_RANDOM_HPP_
 
 #include <boost/cstdint.hpp>
+#include <cstddef>
 #include "cxx_ver.hpp"
 
 namespace Poseidon {
 
+// 以下函数使用每个线程自己的 xoshiro256** 状态，速度很快，但是结果可以预测，不能用于密码学用途。
 extern boost::uint32_t random_uint32();
 extern boost::uint64_t random_uint64();
-extern double random_double();
+extern double random_double(); // [0, 1)
+extern void random_fill(void *data, std::size_t size);
+
+// 以下函数使用 OpenSSL 的 CSPRNG，用于密钥、nonce 之类安全相关的场合。失败时抛出异常。
+extern void secure_random_fill(void *data, std::size_t size);
+extern boost::uint32_t secure_random_uint32();
+extern boost::uint64_t secure_random_uint64();
 
 struct RandomBitGenerator_uint32 {
 	typedef boost::uint32_t result_type;
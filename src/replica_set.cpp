@@ -0,0 +1,124 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "replica_set.hpp"
+#include "string.hpp"
+#include "exception.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include "checked_arithmetic.hpp"
+
+namespace Poseidon {
+
+ReplicaSet::ReplicaSet(){ }
+ReplicaSet::~ReplicaSet(){ }
+
+void ReplicaSet::reset(const boost::container::vector<std::string> &specs, boost::uint16_t default_port){
+	PROFILE_ME;
+
+	boost::container::vector<Replica> replicas;
+	replicas.reserve(specs.size());
+	for(AUTO(it, specs.begin()); it != specs.end(); ++it){
+		const AUTO(parts, explode<std::string>(',', *it, 3));
+		Replica replica = { std::string(), default_port, 1 };
+		try {
+			replica.addr = trim(parts.at(0));
+			if((parts.size() > 1) && !trim(parts.at(1)).empty()){
+				replica.port = boost::lexical_cast<boost::uint16_t>(trim(parts.at(1)));
+			}
+			if((parts.size() > 2) && !trim(parts.at(2)).empty()){
+				replica.weight = boost::lexical_cast<unsigned>(trim(parts.at(2)));
+			}
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("Invalid replica: ", *it, ", what = ", e.what());
+			DEBUG_THROW(Exception, sslit("Invalid replica"));
+		}
+		DEBUG_THROW_UNLESS(!replica.addr.empty(), Exception, sslit("Replica address is empty"));
+		DEBUG_THROW_UNLESS(replica.weight != 0, Exception, sslit("Replica weight must be positive"));
+		replicas.push_back(STD_MOVE(replica));
+	}
+
+	const Mutex::UniqueLock lock(m_mutex);
+	m_elements.clear();
+	for(AUTO(it, replicas.begin()); it != replicas.end(); ++it){
+		LOG_POSEIDON_INFO("Added replica: addr = ", it->addr, ", port = ", it->port, ", weight = ", it->weight);
+		Element elem = { STD_MOVE(*it), 0, 0, 0 };
+		m_elements.push_back(STD_MOVE(elem));
+	}
+}
+
+bool ReplicaSet::empty() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	return m_elements.empty();
+}
+bool ReplicaSet::has_available(boost::uint64_t now) const {
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_elements.begin()); it != m_elements.end(); ++it){
+		if(it->down_until <= now){
+			return true;
+		}
+	}
+	return false;
+}
+
+std::size_t ReplicaSet::acquire(Replica &replica, boost::uint64_t now){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t best = INDEX_NONE;
+	for(std::size_t i = 0; i < m_elements.size(); ++i){
+		const AUTO_REF(elem, m_elements.at(i));
+		if(now < elem.down_until){
+			continue;
+		}
+		if(best == INDEX_NONE){
+			best = i;
+			continue;
+		}
+		// 比较 (连接数 + 1) / 权重，避免除法。
+		const AUTO_REF(other, m_elements.at(best));
+		if((elem.connections + 1) * other.replica.weight < (other.connections + 1) * elem.replica.weight){
+			best = i;
+		}
+	}
+	if(best == INDEX_NONE){
+		return INDEX_NONE;
+	}
+	AUTO_REF(elem, m_elements.at(best));
+	++elem.connections;
+	replica = elem.replica;
+	return best;
+}
+void ReplicaSet::release(std::size_t index) NOEXCEPT {
+	const Mutex::UniqueLock lock(m_mutex);
+	if(index >= m_elements.size()){
+		return;
+	}
+	AUTO_REF(elem, m_elements.at(index));
+	if(elem.connections != 0){
+		--elem.connections;
+	}
+}
+void ReplicaSet::mark_down(std::size_t index, boost::uint64_t now, boost::uint64_t retry_delay) NOEXCEPT {
+	const Mutex::UniqueLock lock(m_mutex);
+	if(index >= m_elements.size()){
+		return;
+	}
+	AUTO_REF(elem, m_elements.at(index));
+	const unsigned shift = std::min(elem.failures, 6u);
+	elem.down_until = saturated_add(now, saturated_mul(retry_delay, boost::uint64_t(1) << shift));
+	++elem.failures;
+	LOG_POSEIDON_WARNING("Replica marked down: addr = ", elem.replica.addr, ", port = ", elem.replica.port, ", failures = ", elem.failures);
+}
+void ReplicaSet::mark_up(std::size_t index) NOEXCEPT {
+	const Mutex::UniqueLock lock(m_mutex);
+	if(index >= m_elements.size()){
+		return;
+	}
+	AUTO_REF(elem, m_elements.at(index));
+	elem.down_until = 0;
+	elem.failures = 0;
+}
+
+}
@@ -0,0 +1,61 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_REPLICA_SET_HPP_
+#define POSEIDON_REPLICA_SET_HPP_
+
+#include "cxx_util.hpp"
+#include "mutex.hpp"
+#include <string>
+#include <boost/container/vector.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+// 只读副本的列表。按照权重选择当前连接数最少的可用副本，连接失败或者落后太多的副本暂时不被选择。
+class ReplicaSet : NONCOPYABLE {
+public:
+	enum {
+		INDEX_NONE = static_cast<std::size_t>(-1),
+	};
+
+	struct Replica {
+		std::string addr;
+		boost::uint16_t port;
+		unsigned weight;
+	};
+
+private:
+	struct Element {
+		Replica replica;
+		std::size_t connections;
+		boost::uint64_t down_until;
+		unsigned failures;
+	};
+
+private:
+	mutable Mutex m_mutex;
+	boost::container::vector<Element> m_elements;
+
+public:
+	ReplicaSet();
+	~ReplicaSet();
+
+public:
+	// 每一项的格式为 `地址,端口,权重`，端口和权重可以省略。格式错误时抛出异常。
+	void reset(const boost::container::vector<std::string> &specs, boost::uint16_t default_port);
+
+	bool empty() const;
+	bool has_available(boost::uint64_t now) const;
+
+	// 选择一个副本并增加它的连接数。没有可用的副本时返回 INDEX_NONE。
+	std::size_t acquire(Replica &replica, boost::uint64_t now);
+	void release(std::size_t index) NOEXCEPT;
+	// 在 retry_delay 毫秒之后才会再次被选择。连续失败时延迟时间指数递增，最多 64 倍。
+	void mark_down(std::size_t index, boost::uint64_t now, boost::uint64_t retry_delay) NOEXCEPT;
+	void mark_up(std::size_t index) NOEXCEPT;
+};
+
+}
+
+#endif
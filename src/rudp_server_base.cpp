@@ -0,0 +1,199 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "rudp_server_base.hpp"
+#include "rudp_session_base.hpp"
+#include "singletons/timer_daemon.hpp"
+#include "singletons/main_config.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include "endian.hpp"
+#include "random.hpp"
+#include "time.hpp"
+
+namespace Poseidon {
+
+bool RudpServerBase::AddrComparator::operator()(const SockAddr &lhs, const SockAddr &rhs) const NOEXCEPT {
+	if(lhs.size() != rhs.size()){
+		return lhs.size() < rhs.size();
+	}
+	return std::memcmp(lhs.data(), rhs.data(), lhs.size()) < 0;
+}
+
+RudpServerBase::RudpServerBase(const SockAddr &addr)
+	: UdpServerBase(addr)
+	, m_tick(std::max<boost::uint64_t>(MainConfig::get<boost::uint64_t>("rudp_tick_interval", 10), 1))
+{ }
+RudpServerBase::~RudpServerBase(){
+	SessionMap sessions;
+	{
+		const Mutex::UniqueLock lock(m_session_mutex);
+		sessions.swap(m_sessions);
+	}
+	for(AUTO(it, sessions.begin()); it != sessions.end(); ++it){
+		it->second->abort(ECONNABORTED);
+	}
+}
+
+void RudpServerBase::timer_proc(const boost::weak_ptr<RudpServerBase> &weak, boost::uint64_t now){
+	PROFILE_ME;
+
+	const AUTO(server, weak.lock());
+	if(!server){
+		return;
+	}
+	boost::container::vector<boost::shared_ptr<RudpSessionBase> > sessions;
+	{
+		const Mutex::UniqueLock lock(server->m_session_mutex);
+		sessions.reserve(server->m_sessions.size());
+		for(AUTO(it, server->m_sessions.begin()); it != server->m_sessions.end(); ++it){
+			sessions.push_back(it->second);
+		}
+	}
+	for(AUTO(it, sessions.begin()); it != sessions.end(); ++it){
+		const AUTO_REF(session, *it);
+		try {
+			session->process_tick(now);
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			session->force_shutdown();
+		} catch(...){
+			LOG_POSEIDON_ERROR("Unknown exception thrown.");
+			session->force_shutdown();
+		}
+	}
+}
+
+boost::shared_ptr<RudpSessionBase> RudpServerBase::attach_session(const SockAddr &sock_addr, boost::uint32_t conv, bool active){
+	// 调用时须持有 m_session_mutex。
+	AUTO(session, on_create_session(sock_addr));
+	if(!session){
+		return session;
+	}
+	session->attach(virtual_shared_from_this<RudpServerBase>(), conv, active);
+	m_sessions[sock_addr] = session;
+	if(!m_timer){
+		m_timer = TimerDaemon::register_low_level_timer(m_tick, m_tick, boost::bind(&timer_proc, virtual_weak_from_this<RudpServerBase>(), _2));
+	}
+	return session;
+}
+void RudpServerBase::detach_session(const RudpSessionBase *session) NOEXCEPT {
+	const Mutex::UniqueLock lock(m_session_mutex);
+	const AUTO(it, m_sessions.find(session->get_remote_addr()));
+	if((it != m_sessions.end()) && (it->second.get() == session)){
+		m_sessions.erase(it);
+	}
+}
+void RudpServerBase::send_reset(const SockAddr &sock_addr, boost::uint32_t conv) NOEXCEPT {
+	try {
+		StreamBuffer datagram;
+		RudpSessionBase::put_segment(datagram, conv, RudpSessionBase::CMD_RESET, 0, 0, 0, 0, StreamBuffer());
+		send(sock_addr, STD_MOVE(datagram));
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+	}
+}
+
+void RudpServerBase::on_receive(const SockAddr &sock_addr, StreamBuffer data){
+	PROFILE_ME;
+
+	if(data.size() < sizeof(RudpSessionBase::SegmentHeader)){
+		LOG_POSEIDON_DEBUG("Reliable UDP datagram too short: remote = ", IpPort(sock_addr), ", size = ", data.size());
+		return;
+	}
+	const AUTO(bytes, static_cast<const unsigned char *>(data.squash()));
+	RudpSessionBase::SegmentHeader header;
+	std::memcpy(&header, bytes, sizeof(header));
+	const AUTO(conv, load_be(header.conv));
+	const AUTO(serial, load_be(header.serial));
+
+	boost::shared_ptr<RudpSessionBase> session, replaced;
+	bool created = false;
+	{
+		const Mutex::UniqueLock lock(m_session_mutex);
+		const AUTO(it, m_sessions.find(sock_addr));
+		if((it != m_sessions.end()) && (it->second->get_conv() == conv)){
+			session = it->second;
+		} else if((header.cmd == RudpSessionBase::CMD_PUSH) && (serial == 0)){
+			// 对端开始了一个新的会话。如果这个地址上还有旧的会话，说明对端已经重启，旧的会话作废。
+			if(it != m_sessions.end()){
+				replaced = it->second;
+				m_sessions.erase(it);
+			}
+			session = attach_session(sock_addr, conv, false);
+			created = !!session;
+		}
+	}
+	if(replaced){
+		replaced->abort(ECONNRESET);
+	}
+	if(!session){
+		switch(header.cmd){
+		case RudpSessionBase::CMD_FIN:
+			// 会话已经正常关闭，但是对端没有收到最后的确认。
+			try {
+				StreamBuffer datagram;
+				RudpSessionBase::put_segment(datagram, conv, RudpSessionBase::CMD_ACK, 0, load_be(header.timestamp), serial, serial + 1, StreamBuffer());
+				send(sock_addr, STD_MOVE(datagram));
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			}
+			break;
+		case RudpSessionBase::CMD_ACK:
+		case RudpSessionBase::CMD_PING:
+			send_reset(sock_addr, conv);
+			break;
+		default:
+			// 数据分段可能先于会话的第一个分段到达，丢弃它，等待对端重传。
+			break;
+		}
+		return;
+	}
+
+	const AUTO(now, get_fast_mono_clock());
+	try {
+		if(created){
+			session->open(now);
+		}
+		session->process_datagram(bytes, data.size(), now);
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		session->force_shutdown();
+	} catch(...){
+		LOG_POSEIDON_ERROR("Unknown exception thrown.");
+		session->force_shutdown();
+	}
+}
+
+boost::shared_ptr<RudpSessionBase> RudpServerBase::connect(const SockAddr &sock_addr){
+	PROFILE_ME;
+
+	boost::shared_ptr<RudpSessionBase> session;
+	{
+		const Mutex::UniqueLock lock(m_session_mutex);
+		const AUTO(it, m_sessions.find(sock_addr));
+		if(it != m_sessions.end()){
+			return it->second;
+		}
+		session = attach_session(sock_addr, random_uint32(), true);
+	}
+	if(session){
+		session->open(get_fast_mono_clock());
+	}
+	return session;
+}
+boost::shared_ptr<RudpSessionBase> RudpServerBase::get_session(const SockAddr &sock_addr) const {
+	const Mutex::UniqueLock lock(m_session_mutex);
+	const AUTO(it, m_sessions.find(sock_addr));
+	if(it == m_sessions.end()){
+		return VAL_INIT;
+	}
+	return it->second;
+}
+std::size_t RudpServerBase::get_session_count() const {
+	const Mutex::UniqueLock lock(m_session_mutex);
+	return m_sessions.size();
+}
+
+}
@@ -0,0 +1,65 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_RUDP_SERVER_BASE_HPP_
+#define POSEIDON_RUDP_SERVER_BASE_HPP_
+
+#include "udp_server_base.hpp"
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/map.hpp>
+#include <boost/container/vector.hpp>
+#include "mutex.hpp"
+
+namespace Poseidon {
+
+class RudpSessionBase;
+class Timer;
+
+// 在一个 UDP 套接字上按对端地址复用多个 RudpSessionBase，并用一个定时器驱动所有会话的重传。
+// 同一个类既可以接受对端发起的会话，也可以调用 connect() 主动发起会话，因此客户端也使用这个类（绑定在任意端口上）。
+class RudpServerBase : public UdpServerBase {
+	friend RudpSessionBase;
+
+private:
+	struct AddrComparator {
+		bool operator()(const SockAddr &lhs, const SockAddr &rhs) const NOEXCEPT;
+	};
+
+	typedef boost::container::map<SockAddr, boost::shared_ptr<RudpSessionBase>, AddrComparator> SessionMap;
+
+private:
+	const boost::uint64_t m_tick;
+
+	mutable Mutex m_session_mutex;
+	SessionMap m_sessions;
+	boost::shared_ptr<Timer> m_timer;
+
+public:
+	explicit RudpServerBase(const SockAddr &addr);
+	~RudpServerBase();
+
+private:
+	static void timer_proc(const boost::weak_ptr<RudpServerBase> &weak, boost::uint64_t now);
+
+	boost::shared_ptr<RudpSessionBase> attach_session(const SockAddr &sock_addr, boost::uint32_t conv, bool active);
+	void detach_session(const RudpSessionBase *session) NOEXCEPT;
+	void send_reset(const SockAddr &sock_addr, boost::uint32_t conv) NOEXCEPT;
+
+protected:
+	void on_receive(const SockAddr &sock_addr, StreamBuffer data) OVERRIDE;
+
+	// 收到一个新的会话的第一个分段，或者调用 connect() 时，创建一个会话。返回空指针拒绝这个会话。
+	// 这个函数在持有内部锁的情况下被调用，不要在其中调用 connect()。
+	virtual boost::shared_ptr<RudpSessionBase> on_create_session(const SockAddr &sock_addr) = 0;
+
+public:
+	// 向 sock_addr 发起一个会话。如果已经有一个和这个地址之间的会话，返回它。
+	boost::shared_ptr<RudpSessionBase> connect(const SockAddr &sock_addr);
+	boost::shared_ptr<RudpSessionBase> get_session(const SockAddr &sock_addr) const;
+	std::size_t get_session_count() const;
+};
+
+}
+
+#endif
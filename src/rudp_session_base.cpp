@@ -0,0 +1,474 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "rudp_session_base.hpp"
+#include "rudp_server_base.hpp"
+#include "singletons/main_config.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include "endian.hpp"
+#include "time.hpp"
+
+namespace Poseidon {
+
+namespace {
+	CONSTEXPR const boost::uint32_t MAX_RTO = 60000;
+	CONSTEXPR const boost::uint32_t MAX_WINDOW = 0xFFFF;
+	CONSTEXPR const boost::uint32_t INITIAL_CONGESTION_WINDOW = 4;
+	CONSTEXPR const boost::uint32_t MIN_SLOW_START_THRESHOLD = 2;
+
+	// 序号和时间戳都会回绕，只能比较差值。
+	inline boost::int32_t serial_diff(boost::uint32_t lhs, boost::uint32_t rhs){
+		return static_cast<boost::int32_t>(lhs - rhs);
+	}
+}
+
+RudpSessionBase::RudpSessionBase(const SockAddr &remote_addr)
+	: m_remote_addr(remote_addr), m_remote_info(remote_addr)
+	, m_conv(0)
+	, m_mss(std::max<std::size_t>(MainConfig::get<std::size_t>("rudp_mtu", 1400), 576) - sizeof(SegmentHeader))
+	, m_send_window(std::min(std::max<boost::uint32_t>(MainConfig::get<boost::uint32_t>("rudp_send_window", 128), 1), MAX_WINDOW))
+	, m_receive_window(std::min(std::max<boost::uint32_t>(MainConfig::get<boost::uint32_t>("rudp_receive_window", 128), 1), MAX_WINDOW))
+	, m_fast_resend(MainConfig::get<unsigned>("rudp_fast_resend", 2))
+	, m_min_rto(std::max<boost::uint32_t>(MainConfig::get<boost::uint32_t>("rudp_min_rto", 30), 1))
+	, m_max_transmissions(std::max<unsigned>(MainConfig::get<unsigned>("rudp_max_transmissions", 20), 1))
+	, m_idle_timeout(MainConfig::get<boost::uint64_t>("rudp_idle_timeout", 30000))
+	, m_keepalive_interval(MainConfig::get<boost::uint64_t>("rudp_keepalive_interval", 5000))
+	, m_congestion_control(MainConfig::get<bool>("rudp_congestion_control", true))
+	, m_connected(false), m_shutdown_read(false), m_shutdown_write(false), m_fin_queued(false), m_peer_fin_received(false), m_closed(false)
+	, m_send_unacked(0), m_send_next(0), m_remote_window(m_receive_window)
+	, m_congestion_window(INITIAL_CONGESTION_WINDOW), m_slow_start_threshold(m_send_window), m_congestion_acked(0)
+	, m_receive_next(0)
+	, m_srtt(0), m_rttvar(0), m_rto(200), m_last_received(0), m_last_sent(0)
+{
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "RudpSessionBase constructor: remote = ", m_remote_info);
+}
+RudpSessionBase::~RudpSessionBase(){
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "RudpSessionBase destructor: remote = ", m_remote_info, ", conv = ", m_conv);
+}
+
+void RudpSessionBase::put_segment(StreamBuffer &datagram, boost::uint32_t conv, Command cmd, boost::uint32_t window,
+	boost::uint32_t timestamp, boost::uint32_t serial, boost::uint32_t unacked, const StreamBuffer &payload)
+{
+	SegmentHeader header;
+	store_be(header.conv, conv);
+	header.cmd = static_cast<boost::uint8_t>(cmd);
+	header.reserved = 0;
+	store_be(header.window, static_cast<boost::uint16_t>(std::min(window, MAX_WINDOW)));
+	store_be(header.timestamp, timestamp);
+	store_be(header.serial, serial);
+	store_be(header.unacked, unacked);
+	store_be(header.length, static_cast<boost::uint32_t>(payload.size()));
+	datagram.put(&header, sizeof(header));
+	datagram.put(payload);
+}
+
+void RudpSessionBase::attach(const boost::shared_ptr<RudpServerBase> &server, boost::uint32_t conv, bool active){
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	m_weak_server = server;
+	m_conv = conv;
+	if(active){
+		OutgoingSegment seg = { 0, false, StreamBuffer(), 0, 0, 0, 0, 0 };
+		m_send_segments.push_back(STD_MOVE(seg));
+		m_send_next = 1;
+	}
+}
+void RudpSessionBase::open(boost::uint64_t now){
+	PROFILE_ME;
+
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	if(m_connected){
+		return;
+	}
+	m_connected = true;
+	m_last_received = now;
+	m_last_sent = now;
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Reliable UDP session opened: remote = ", m_remote_info, ", conv = ", m_conv);
+	on_connect();
+	flush(now, false);
+}
+void RudpSessionBase::abort(int err_code) NOEXCEPT {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	close_unlocked(err_code, false);
+}
+
+void RudpSessionBase::process_datagram(const unsigned char *data, std::size_t size, boost::uint64_t now){
+	PROFILE_ME;
+
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	if(m_closed){
+		return;
+	}
+	std::size_t offset = 0;
+	while(size - offset >= sizeof(SegmentHeader)){
+		SegmentHeader header;
+		std::memcpy(&header, data + offset, sizeof(header));
+		offset += sizeof(header);
+		const AUTO(length, load_be(header.length));
+		if((load_be(header.conv) != m_conv) || (length > size - offset)){
+			LOG_POSEIDON_DEBUG("Malformed reliable UDP segment: remote = ", m_remote_info, ", conv = ", m_conv);
+			break;
+		}
+		const AUTO(payload_data, data + offset);
+		offset += length;
+
+		m_last_received = now;
+		m_remote_window = load_be(header.window);
+		process_cumulative_ack(load_be(header.unacked));
+		switch(header.cmd){
+		case CMD_PUSH:
+		case CMD_FIN:
+			process_push(load_be(header.serial), load_be(header.timestamp), header.cmd == CMD_FIN, StreamBuffer(payload_data, length));
+			break;
+		case CMD_ACK:
+			process_ack(load_be(header.serial), load_be(header.timestamp), now);
+			break;
+		case CMD_PING:
+			break;
+		case CMD_RESET:
+			LOG_POSEIDON_DEBUG("Reliable UDP session reset by peer: remote = ", m_remote_info, ", conv = ", m_conv);
+			close_unlocked(ECONNRESET, false);
+			return;
+		default:
+			LOG_POSEIDON_DEBUG("Unknown reliable UDP command: remote = ", m_remote_info, ", cmd = ", static_cast<unsigned>(header.cmd));
+			break;
+		}
+	}
+	deliver_received();
+	if(m_closed){
+		return;
+	}
+	segment_send_queue();
+	flush(now, false);
+	check_graceful_close();
+}
+void RudpSessionBase::process_tick(boost::uint64_t now){
+	PROFILE_ME;
+
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	if(m_closed){
+		return;
+	}
+	if((m_idle_timeout != 0) && (now - m_last_received >= m_idle_timeout)){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Reliable UDP session timed out: remote = ", m_remote_info, ", conv = ", m_conv);
+		close_unlocked(ETIMEDOUT, true);
+		return;
+	}
+	const bool keepalive = (m_keepalive_interval != 0) && (now - m_last_sent >= m_keepalive_interval);
+	segment_send_queue();
+	flush(now, keepalive);
+	check_graceful_close();
+}
+
+void RudpSessionBase::process_ack(boost::uint32_t serial, boost::uint32_t timestamp, boost::uint64_t now){
+	if((serial_diff(serial, m_send_unacked) < 0) || (serial_diff(serial, m_send_next) >= 0)){
+		return;
+	}
+	const AUTO(rtt, serial_diff(static_cast<boost::uint32_t>(now), timestamp));
+	if(rtt >= 0){
+		const AUTO(sample, static_cast<boost::uint32_t>(rtt));
+		if(m_srtt == 0){
+			m_srtt = std::max<boost::uint32_t>(sample, 1);
+			m_rttvar = sample / 2;
+		} else {
+			const AUTO(delta, (sample > m_srtt) ? (sample - m_srtt) : (m_srtt - sample));
+			m_rttvar = (m_rttvar * 3 + delta) / 4;
+			m_srtt = std::max<boost::uint32_t>((m_srtt * 7 + sample) / 8, 1);
+		}
+		m_rto = std::min(std::max(m_srtt + std::max<boost::uint32_t>(m_rttvar * 4, 1), m_min_rto), MAX_RTO);
+	}
+	// 一个分段最后一次发出之后发出的分段每被确认一次，该分段的计数加一，达到 rudp_fast_resend 时不等超时立即重传。
+	// 只计入在它之后发出的分段，因此每个往返至多快速重传一次。
+	for(AUTO(it, m_send_segments.begin()); it != m_send_segments.end(); ++it){
+		const AUTO(diff, serial_diff(it->serial, serial));
+		if(diff == 0){
+			m_send_segments.erase(it);
+			break;
+		}
+		if(diff > 0){
+			break;
+		}
+		if((it->transmissions != 0) && (serial_diff(timestamp, it->timestamp) >= 0)){
+			++(it->fast_acks);
+		}
+	}
+	update_send_unacked();
+}
+void RudpSessionBase::process_cumulative_ack(boost::uint32_t unacked){
+	if(serial_diff(unacked, m_send_next) > 0){
+		return;
+	}
+	while(!m_send_segments.empty() && (serial_diff(m_send_segments.front().serial, unacked) < 0)){
+		m_send_segments.pop_front();
+	}
+	update_send_unacked();
+}
+void RudpSessionBase::update_send_unacked(){
+	const AUTO(unacked, m_send_segments.empty() ? m_send_next : m_send_segments.front().serial);
+	const AUTO(advanced, unacked - m_send_unacked);
+	m_send_unacked = unacked;
+	if(!m_congestion_control || (advanced == 0)){
+		return;
+	}
+	// 慢启动阶段每确认一个分段窗口加一，此后每确认一个窗口的分段窗口加一。
+	for(boost::uint32_t i = 0; (i < advanced) && (m_congestion_window < m_send_window); ++i){
+		if(m_congestion_window < m_slow_start_threshold){
+			++m_congestion_window;
+		} else if(++m_congestion_acked >= m_congestion_window){
+			++m_congestion_window;
+			m_congestion_acked = 0;
+		}
+	}
+}
+void RudpSessionBase::process_push(boost::uint32_t serial, boost::uint32_t timestamp, bool fin, StreamBuffer data){
+	const AUTO(diff, serial_diff(serial, m_receive_next));
+	if(diff >= static_cast<boost::int32_t>(m_receive_window)){
+		// 窗口之外的分段不确认，对端会在窗口移动之后重传。
+		return;
+	}
+	m_acks_pending.push_back(std::make_pair(serial, timestamp));
+	if(diff < 0){
+		// 重复的分段。确认可能丢失了，所以仍然需要确认。
+		return;
+	}
+	AUTO_REF(seg, m_receive_segments[serial]);
+	seg.fin = fin;
+	seg.data.swap(data);
+}
+void RudpSessionBase::deliver_received(){
+	for(;;){
+		const AUTO(it, m_receive_segments.find(m_receive_next));
+		if(it == m_receive_segments.end()){
+			break;
+		}
+		IncomingSegment seg;
+		seg.fin = it->second.fin;
+		seg.data.swap(it->second.data);
+		m_receive_segments.erase(it);
+		++m_receive_next;
+
+		if(m_peer_fin_received){
+			continue;
+		}
+		if(seg.fin){
+			m_peer_fin_received = true;
+			if(!m_shutdown_read){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Reliable UDP session read hung up: remote = ", m_remote_info, ", conv = ", m_conv);
+				m_shutdown_read = true;
+				on_read_hup();
+			}
+		} else if(!seg.data.empty() && !m_shutdown_read){
+			on_receive(STD_MOVE(seg.data));
+		}
+		if(m_closed){
+			break;
+		}
+	}
+}
+void RudpSessionBase::segment_send_queue(){
+	// 对端通告的窗口为零时仍然允许一个分段在途，作为窗口探测。
+	AUTO(window, std::min(m_send_window, std::max<boost::uint32_t>(m_remote_window, 1)));
+	if(m_congestion_control){
+		window = std::min(window, m_congestion_window);
+	}
+	while(m_send_next - m_send_unacked < window){
+		OutgoingSegment seg = { m_send_next, false, StreamBuffer(), 0, 0, 0, 0, 0 };
+		if(!m_send_queue.empty()){
+			seg.data = m_send_queue.cut_off(m_mss);
+		} else if(m_shutdown_write && !m_fin_queued){
+			seg.fin = true;
+			m_fin_queued = true;
+		} else {
+			break;
+		}
+		m_send_segments.push_back(STD_MOVE(seg));
+		++m_send_next;
+	}
+}
+void RudpSessionBase::flush(boost::uint64_t now, bool keepalive){
+	PROFILE_ME;
+
+	const AUTO(server, m_weak_server.lock());
+	if(!server){
+		return;
+	}
+	const AUTO(timestamp, static_cast<boost::uint32_t>(now));
+	const AUTO(window, m_receive_window - std::min<boost::uint32_t>(static_cast<boost::uint32_t>(m_receive_segments.size()), m_receive_window));
+	const AUTO(datagram_limit, m_mss + sizeof(SegmentHeader));
+
+	StreamBuffer datagram;
+	bool sent = false;
+	const StreamBuffer empty;
+#define EMIT_SEGMENT_(cmd_, timestamp_, serial_, payload_)	\
+	do {	\
+		if(datagram.size() + sizeof(SegmentHeader) + (payload_).size() > datagram_limit){	\
+			server->send(m_remote_addr, STD_MOVE(datagram));	\
+			datagram.clear();	\
+		}	\
+		put_segment(datagram, m_conv, (cmd_), window, (timestamp_), (serial_), m_receive_next, (payload_));	\
+		sent = true;	\
+	} while(false)
+
+	for(AUTO(it, m_acks_pending.begin()); it != m_acks_pending.end(); ++it){
+		EMIT_SEGMENT_(CMD_ACK, it->second, it->first, empty);
+	}
+	m_acks_pending.clear();
+
+	bool dead = false, timed_out = false, fast_resent = false;
+	for(AUTO(it, m_send_segments.begin()); it != m_send_segments.end(); ++it){
+		if(it->transmissions == 0){
+			it->rto = m_rto;
+		} else if(now >= it->resend_time){
+			if(it->transmissions >= m_max_transmissions){
+				dead = true;
+				break;
+			}
+			it->rto = std::min(it->rto + it->rto / 2, MAX_RTO);
+			timed_out = true;
+		} else if((m_fast_resend != 0) && (it->fast_acks >= m_fast_resend)){
+			fast_resent = true;
+		} else {
+			continue;
+		}
+		it->fast_acks = 0;
+		++(it->transmissions);
+		it->timestamp = timestamp;
+		it->resend_time = now + it->rto;
+		EMIT_SEGMENT_(it->fin ? CMD_FIN : CMD_PUSH, timestamp, it->serial, it->data);
+	}
+	if(keepalive && !sent){
+		EMIT_SEGMENT_(CMD_PING, timestamp, m_send_next, empty);
+	}
+#undef EMIT_SEGMENT_
+
+	if(!datagram.empty()){
+		server->send(m_remote_addr, STD_MOVE(datagram));
+	}
+	if(sent){
+		m_last_sent = now;
+	}
+	if(m_congestion_control){
+		if(fast_resent){
+			m_slow_start_threshold = std::max((m_send_next - m_send_unacked) / 2, MIN_SLOW_START_THRESHOLD);
+			m_congestion_window = m_slow_start_threshold + m_fast_resend;
+			m_congestion_acked = 0;
+		}
+		if(timed_out){
+			m_slow_start_threshold = std::max(m_congestion_window / 2, MIN_SLOW_START_THRESHOLD);
+			m_congestion_window = 1;
+			m_congestion_acked = 0;
+		}
+	}
+	if(dead){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Reliable UDP session dead: remote = ", m_remote_info, ", conv = ", m_conv);
+		close_unlocked(ETIMEDOUT, true);
+	}
+}
+void RudpSessionBase::check_graceful_close(){
+	if(m_closed || !m_fin_queued || !m_send_segments.empty() || !m_peer_fin_received){
+		return;
+	}
+	// 两个方向的 FIN 都已确认。如果对端没有收到这一端最后的确认，它重传的 FIN 会由 RudpServerBase 无状态地确认。
+	close_unlocked(0, false);
+}
+void RudpSessionBase::close_unlocked(int err_code, bool send_reset) NOEXCEPT {
+	if(m_closed){
+		return;
+	}
+	m_closed = true;
+	m_shutdown_read = true;
+	m_shutdown_write = true;
+	m_send_queue.clear();
+	m_send_segments.clear();
+	m_receive_segments.clear();
+	m_acks_pending.clear();
+
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Reliable UDP session closed: remote = ", m_remote_info, ", conv = ", m_conv, ", err_code = ", err_code);
+	const AUTO(server, m_weak_server.lock());
+	if(server){
+		if(send_reset){
+			server->send_reset(m_remote_addr, m_conv);
+		}
+		server->detach_session(this);
+	}
+	try {
+		on_close(err_code);
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+	} catch(...){
+		LOG_POSEIDON_ERROR("Unknown exception thrown.");
+	}
+}
+
+void RudpSessionBase::set_windows(boost::uint32_t send_window, boost::uint32_t receive_window){
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	m_send_window = std::min(std::max<boost::uint32_t>(send_window, 1), MAX_WINDOW);
+	m_receive_window = std::min(std::max<boost::uint32_t>(receive_window, 1), MAX_WINDOW);
+}
+boost::uint32_t RudpSessionBase::get_round_trip_time() const {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	return m_srtt;
+}
+std::size_t RudpSessionBase::get_send_queue_size() const {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	std::size_t size = m_send_queue.size();
+	for(AUTO(it, m_send_segments.begin()); it != m_send_segments.end(); ++it){
+		size += it->data.size();
+	}
+	return size;
+}
+
+bool RudpSessionBase::has_been_shutdown_read() const NOEXCEPT {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	return m_shutdown_read;
+}
+bool RudpSessionBase::has_been_shutdown_write() const NOEXCEPT {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	return m_shutdown_write;
+}
+bool RudpSessionBase::shutdown_read() NOEXCEPT {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	if(m_shutdown_read){
+		return false;
+	}
+	m_shutdown_read = true;
+	return true;
+}
+bool RudpSessionBase::shutdown_write() NOEXCEPT {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	if(m_shutdown_write){
+		return false;
+	}
+	m_shutdown_write = true;
+	try {
+		const AUTO(now, get_fast_mono_clock());
+		segment_send_queue();
+		flush(now, false);
+		check_graceful_close();
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		close_unlocked(EPIPE, true);
+	}
+	return true;
+}
+void RudpSessionBase::force_shutdown() NOEXCEPT {
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	close_unlocked(0, true);
+}
+
+bool RudpSessionBase::send(StreamBuffer buffer){
+	PROFILE_ME;
+
+	const RecursiveMutex::UniqueLock lock(m_mutex);
+	if(m_shutdown_write){
+		LOG_POSEIDON_DEBUG("Reliable UDP session has been shut down for writing: remote = ", m_remote_info, ", conv = ", m_conv);
+		return false;
+	}
+	m_send_queue.splice(buffer);
+	segment_send_queue();
+	flush(get_fast_mono_clock(), false);
+	return true;
+}
+
+}
@@ -0,0 +1,178 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_RUDP_SESSION_BASE_HPP_
+#define POSEIDON_RUDP_SESSION_BASE_HPP_
+
+#include "session_base.hpp"
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/deque.hpp>
+#include <boost/container/vector.hpp>
+#include <boost/container/flat_map.hpp>
+#include "recursive_mutex.hpp"
+#include "sock_addr.hpp"
+#include "ip_port.hpp"
+#include "stream_buffer.hpp"
+
+namespace Poseidon {
+
+class RudpServerBase;
+
+// 基于 UDP 的可靠有序字节流，协议类似于 KCP：每个分段单独确认（选择确认），累计确认随每个分段捎带，
+// 同一个分段之后发出的分段被确认若干次时立即重传（快速重传），发送窗口取本地窗口、对端通告的接收窗口和拥塞窗口中最小的一个。
+// 和 TcpSessionBase 一样，收到的数据是字节流而不是消息，因此可以在其上使用 Cbpp::Reader 和 Cbpp::Writer 分帧。
+// 会话由 RudpServerBase 创建和驱动，回调可能在 epoll 线程或者 timer 线程中发生，但是同一个会话的回调不会并发。
+class RudpSessionBase : public SessionBase {
+	friend RudpServerBase;
+
+private:
+	enum Command {
+		CMD_PUSH    = 1, // 数据，占用一个序号。主动发起的会话首先发出序号为 0 的空分段，接收方据此创建会话。
+		CMD_FIN     = 2, // 关闭写入，占用一个序号。
+		CMD_ACK     = 3, // 确认序号为 serial 的分段，timestamp 是该分段发出的时刻。
+		CMD_PING    = 4, // 保活，没有其他分段要发送时周期性地发出。
+		CMD_RESET   = 5, // 对端没有这个会话，或者会话被强行关闭。
+	};
+
+	// 每个数据报包含一个或多个分段，每个分段以这个结构开头，所有字段都是大端序。
+	struct SegmentHeader {
+		boost::uint32_t conv;
+		boost::uint8_t cmd;
+		boost::uint8_t reserved;
+		boost::uint16_t window;
+		boost::uint32_t timestamp;
+		boost::uint32_t serial;
+		boost::uint32_t unacked;
+		boost::uint32_t length;
+	};
+
+	struct OutgoingSegment {
+		boost::uint32_t serial;
+		bool fin;
+		StreamBuffer data;
+
+		boost::uint32_t timestamp;
+		boost::uint64_t resend_time;
+		boost::uint32_t rto;
+		unsigned fast_acks;
+		unsigned transmissions;
+	};
+	struct IncomingSegment {
+		bool fin;
+		StreamBuffer data;
+	};
+
+private:
+	const SockAddr m_remote_addr;
+	const IpPort m_remote_info;
+
+	mutable RecursiveMutex m_mutex;
+	boost::weak_ptr<RudpServerBase> m_weak_server;
+	boost::uint32_t m_conv;
+
+	std::size_t m_mss;
+	boost::uint32_t m_send_window;
+	boost::uint32_t m_receive_window;
+	unsigned m_fast_resend;
+	boost::uint32_t m_min_rto;
+	unsigned m_max_transmissions;
+	boost::uint64_t m_idle_timeout;
+	boost::uint64_t m_keepalive_interval;
+	bool m_congestion_control;
+
+	bool m_connected;
+	bool m_shutdown_read;
+	bool m_shutdown_write;
+	bool m_fin_queued;
+	bool m_peer_fin_received;
+	bool m_closed;
+
+	StreamBuffer m_send_queue;
+	boost::container::deque<OutgoingSegment> m_send_segments;
+	boost::uint32_t m_send_unacked;
+	boost::uint32_t m_send_next;
+	boost::uint32_t m_remote_window;
+	boost::uint32_t m_congestion_window;
+	boost::uint32_t m_slow_start_threshold;
+	boost::uint32_t m_congestion_acked;
+
+	boost::uint32_t m_receive_next;
+	boost::container::flat_map<boost::uint32_t, IncomingSegment> m_receive_segments;
+	boost::container::vector<std::pair<boost::uint32_t, boost::uint32_t> > m_acks_pending;
+
+	boost::uint32_t m_srtt;
+	boost::uint32_t m_rttvar;
+	boost::uint32_t m_rto;
+	boost::uint64_t m_last_received;
+	boost::uint64_t m_last_sent;
+
+public:
+	explicit RudpSessionBase(const SockAddr &remote_addr);
+	~RudpSessionBase();
+
+private:
+	static void put_segment(StreamBuffer &datagram, boost::uint32_t conv, Command cmd, boost::uint32_t window,
+		boost::uint32_t timestamp, boost::uint32_t serial, boost::uint32_t unacked, const StreamBuffer &payload);
+
+	// 以下函数由 RudpServerBase 调用。attach() 在会话被其他线程看到之前调用，此后 m_conv 不再改变。
+	void attach(const boost::shared_ptr<RudpServerBase> &server, boost::uint32_t conv, bool active);
+	// 调用 on_connect()。主动发起的会话同时发出第一个分段。
+	void open(boost::uint64_t now);
+	void abort(int err_code) NOEXCEPT;
+	// 处理一个数据报中属于这个会话的所有分段。
+	void process_datagram(const unsigned char *data, std::size_t size, boost::uint64_t now);
+	// 处理超时重传、保活和空闲超时，由 RudpServerBase 的定时器周期性地调用。
+	void process_tick(boost::uint64_t now);
+
+	// 以下函数调用时须持有 m_mutex。
+	void process_ack(boost::uint32_t serial, boost::uint32_t timestamp, boost::uint64_t now);
+	void process_cumulative_ack(boost::uint32_t unacked);
+	void update_send_unacked();
+	void process_push(boost::uint32_t serial, boost::uint32_t timestamp, bool fin, StreamBuffer data);
+	void deliver_received();
+	void segment_send_queue();
+	// 发出所有待发送的确认和到期的分段。keepalive 为 true 时，即使没有其他分段也发送一个保活分段。
+	void flush(boost::uint64_t now, bool keepalive);
+	void check_graceful_close();
+	void close_unlocked(int err_code, bool send_reset) NOEXCEPT;
+
+protected:
+	void on_connect() OVERRIDE = 0;
+	void on_read_hup() OVERRIDE = 0;
+	void on_close(int err_code) OVERRIDE = 0; // 参数就是 errno。
+	void on_receive(StreamBuffer data) OVERRIDE = 0;
+
+public:
+	const SockAddr &get_remote_addr() const {
+		return m_remote_addr;
+	}
+	const IpPort &get_remote_info() const {
+		return m_remote_info;
+	}
+	boost::uint32_t get_conv() const {
+		return m_conv;
+	}
+
+	// 单位都是分段。只影响此后发出的分段和此后通告给对端的窗口。
+	void set_windows(boost::uint32_t send_window, boost::uint32_t receive_window);
+	// 平滑后的往返时间（毫秒）。
+	boost::uint32_t get_round_trip_time() const;
+	// 尚未被对端确认的字节数，包括尚未切分成分段的数据。
+	std::size_t get_send_queue_size() const;
+
+	bool has_been_shutdown_read() const NOEXCEPT OVERRIDE;
+	bool has_been_shutdown_write() const NOEXCEPT OVERRIDE;
+	bool shutdown_read() NOEXCEPT OVERRIDE;
+	// 在已经排队的数据之后发送 FIN。两个方向的 FIN 都被确认之后会话关闭。
+	bool shutdown_write() NOEXCEPT OVERRIDE;
+	// 向对端发送 RST 并立即关闭会话，丢弃尚未发出的数据。
+	void force_shutdown() NOEXCEPT OVERRIDE;
+
+	bool send(StreamBuffer buffer) OVERRIDE;
+};
+
+}
+
+#endif
@@ -3,140 +3,337 @@
 
 #include "precompiled.hpp"
 #include "sha1.hpp"
+#include "stream_buffer.hpp"
 #include "endian.hpp"
 #include <x86intrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
 namespace {
 	CONSTEXPR const boost::array<boost::uint32_t, 5> SHA1_REG_INIT = {{ 0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u, 0xC3D2E1F0u }};
-}
 
-Sha1_streambuf::Sha1_streambuf()
-	: m_reg(SHA1_REG_INIT), m_bytes(0)
-{ }
-Sha1_streambuf::~Sha1_streambuf(){ }
+	typedef boost::array<boost::uint32_t, 5> Registers;
 
-void Sha1_streambuf::eat_chunk(){
-	// https://en.wikipedia.org/wiki/SHA-1
-	boost::array<boost::uint32_t, 80> w;
-	for(std::size_t i = 0; i < 16; ++i){
-		w[i] = load_be(reinterpret_cast<const boost::uint32_t *>(m_chunk.data())[i]);
-	}
-	for(std::size_t i = 16; i < 32; ++i){
-		w[i] = __rold(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
-	}
-	for(std::size_t i = 32; i < 80; ++i){
-		w[i] = __rold(w[i - 6] ^ w[i - 16] ^ w[i - 28] ^ w[i - 32], 2);
-	}
+	void compress_block_generic(Registers &reg, const unsigned char *block) NOEXCEPT {
+		// https://en.wikipedia.org/wiki/SHA-1
+		boost::array<boost::uint32_t, 80> w;
+		for(std::size_t i = 0; i < 16; ++i){
+			boost::uint32_t word;
+			std::memcpy(&word, block + i * 4, 4);
+			w[i] = load_be(word);
+		}
+		for(std::size_t i = 16; i < 32; ++i){
+			w[i] = __rold(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+		for(std::size_t i = 32; i < 80; ++i){
+			w[i] = __rold(w[i - 6] ^ w[i - 16] ^ w[i - 28] ^ w[i - 32], 2);
+		}
 
-	register boost::uint32_t a = m_reg[0];
-	register boost::uint32_t b = m_reg[1];
-	register boost::uint32_t c = m_reg[2];
-	register boost::uint32_t d = m_reg[3];
-	register boost::uint32_t e = m_reg[4];
+		register boost::uint32_t a = reg[0];
+		register boost::uint32_t b = reg[1];
+		register boost::uint32_t c = reg[2];
+		register boost::uint32_t d = reg[3];
+		register boost::uint32_t e = reg[4];
 
-	register boost::uint32_t f, k;
+		register boost::uint32_t f, k;
 
 #define SHA1_STEP(i_, spec_, a_, b_, c_, d_, e_)	\
-	spec_(a_, b_, c_, d_, e_);	\
-	e_ += __rold(a_, 5) + f + k + w[i_];	\
-	b_ = __rold(b_, 30);
+		spec_(a_, b_, c_, d_, e_);	\
+		e_ += __rold(a_, 5) + f + k + w[i_];	\
+		b_ = __rold(b_, 30);
 
 #define SHA1_SPEC_0(a_, b_, c_, d_, e_) (f = d_ ^ (b_ & (c_ ^ d_)), k = 0x5A827999)
 #define SHA1_SPEC_1(a_, b_, c_, d_, e_) (f = b_ ^ c_ ^ d_, k = 0x6ED9EBA1)
 #define SHA1_SPEC_2(a_, b_, c_, d_, e_) (f = (b_ & (c_ | d_)) | (c_ & d_), k = 0x8F1BBCDC)
 #define SHA1_SPEC_3(a_, b_, c_, d_, e_) (f = b_ ^ c_ ^ d_, k = 0xCA62C1D6)
 
-	SHA1_STEP( 0, SHA1_SPEC_0, a, b, c, d, e)
-	SHA1_STEP( 1, SHA1_SPEC_0, e, a, b, c, d)
-	SHA1_STEP( 2, SHA1_SPEC_0, d, e, a, b, c)
-	SHA1_STEP( 3, SHA1_SPEC_0, c, d, e, a, b)
-	SHA1_STEP( 4, SHA1_SPEC_0, b, c, d, e, a)
-	SHA1_STEP( 5, SHA1_SPEC_0, a, b, c, d, e)
-	SHA1_STEP( 6, SHA1_SPEC_0, e, a, b, c, d)
-	SHA1_STEP( 7, SHA1_SPEC_0, d, e, a, b, c)
-	SHA1_STEP( 8, SHA1_SPEC_0, c, d, e, a, b)
-	SHA1_STEP( 9, SHA1_SPEC_0, b, c, d, e, a)
-	SHA1_STEP(10, SHA1_SPEC_0, a, b, c, d, e)
-	SHA1_STEP(11, SHA1_SPEC_0, e, a, b, c, d)
-	SHA1_STEP(12, SHA1_SPEC_0, d, e, a, b, c)
-	SHA1_STEP(13, SHA1_SPEC_0, c, d, e, a, b)
-	SHA1_STEP(14, SHA1_SPEC_0, b, c, d, e, a)
-	SHA1_STEP(15, SHA1_SPEC_0, a, b, c, d, e)
-	SHA1_STEP(16, SHA1_SPEC_0, e, a, b, c, d)
-	SHA1_STEP(17, SHA1_SPEC_0, d, e, a, b, c)
-	SHA1_STEP(18, SHA1_SPEC_0, c, d, e, a, b)
-	SHA1_STEP(19, SHA1_SPEC_0, b, c, d, e, a)
-
-	SHA1_STEP(20, SHA1_SPEC_1, a, b, c, d, e)
-	SHA1_STEP(21, SHA1_SPEC_1, e, a, b, c, d)
-	SHA1_STEP(22, SHA1_SPEC_1, d, e, a, b, c)
-	SHA1_STEP(23, SHA1_SPEC_1, c, d, e, a, b)
-	SHA1_STEP(24, SHA1_SPEC_1, b, c, d, e, a)
-	SHA1_STEP(25, SHA1_SPEC_1, a, b, c, d, e)
-	SHA1_STEP(26, SHA1_SPEC_1, e, a, b, c, d)
-	SHA1_STEP(27, SHA1_SPEC_1, d, e, a, b, c)
-	SHA1_STEP(28, SHA1_SPEC_1, c, d, e, a, b)
-	SHA1_STEP(29, SHA1_SPEC_1, b, c, d, e, a)
-	SHA1_STEP(30, SHA1_SPEC_1, a, b, c, d, e)
-	SHA1_STEP(31, SHA1_SPEC_1, e, a, b, c, d)
-	SHA1_STEP(32, SHA1_SPEC_1, d, e, a, b, c)
-	SHA1_STEP(33, SHA1_SPEC_1, c, d, e, a, b)
-	SHA1_STEP(34, SHA1_SPEC_1, b, c, d, e, a)
-	SHA1_STEP(35, SHA1_SPEC_1, a, b, c, d, e)
-	SHA1_STEP(36, SHA1_SPEC_1, e, a, b, c, d)
-	SHA1_STEP(37, SHA1_SPEC_1, d, e, a, b, c)
-	SHA1_STEP(38, SHA1_SPEC_1, c, d, e, a, b)
-	SHA1_STEP(39, SHA1_SPEC_1, b, c, d, e, a)
-
-	SHA1_STEP(40, SHA1_SPEC_2, a, b, c, d, e)
-	SHA1_STEP(41, SHA1_SPEC_2, e, a, b, c, d)
-	SHA1_STEP(42, SHA1_SPEC_2, d, e, a, b, c)
-	SHA1_STEP(43, SHA1_SPEC_2, c, d, e, a, b)
-	SHA1_STEP(44, SHA1_SPEC_2, b, c, d, e, a)
-	SHA1_STEP(45, SHA1_SPEC_2, a, b, c, d, e)
-	SHA1_STEP(46, SHA1_SPEC_2, e, a, b, c, d)
-	SHA1_STEP(47, SHA1_SPEC_2, d, e, a, b, c)
-	SHA1_STEP(48, SHA1_SPEC_2, c, d, e, a, b)
-	SHA1_STEP(49, SHA1_SPEC_2, b, c, d, e, a)
-	SHA1_STEP(50, SHA1_SPEC_2, a, b, c, d, e)
-	SHA1_STEP(51, SHA1_SPEC_2, e, a, b, c, d)
-	SHA1_STEP(52, SHA1_SPEC_2, d, e, a, b, c)
-	SHA1_STEP(53, SHA1_SPEC_2, c, d, e, a, b)
-	SHA1_STEP(54, SHA1_SPEC_2, b, c, d, e, a)
-	SHA1_STEP(55, SHA1_SPEC_2, a, b, c, d, e)
-	SHA1_STEP(56, SHA1_SPEC_2, e, a, b, c, d)
-	SHA1_STEP(57, SHA1_SPEC_2, d, e, a, b, c)
-	SHA1_STEP(58, SHA1_SPEC_2, c, d, e, a, b)
-	SHA1_STEP(59, SHA1_SPEC_2, b, c, d, e, a)
-
-	SHA1_STEP(60, SHA1_SPEC_3, a, b, c, d, e)
-	SHA1_STEP(61, SHA1_SPEC_3, e, a, b, c, d)
-	SHA1_STEP(62, SHA1_SPEC_3, d, e, a, b, c)
-	SHA1_STEP(63, SHA1_SPEC_3, c, d, e, a, b)
-	SHA1_STEP(64, SHA1_SPEC_3, b, c, d, e, a)
-	SHA1_STEP(65, SHA1_SPEC_3, a, b, c, d, e)
-	SHA1_STEP(66, SHA1_SPEC_3, e, a, b, c, d)
-	SHA1_STEP(67, SHA1_SPEC_3, d, e, a, b, c)
-	SHA1_STEP(68, SHA1_SPEC_3, c, d, e, a, b)
-	SHA1_STEP(69, SHA1_SPEC_3, b, c, d, e, a)
-	SHA1_STEP(70, SHA1_SPEC_3, a, b, c, d, e)
-	SHA1_STEP(71, SHA1_SPEC_3, e, a, b, c, d)
-	SHA1_STEP(72, SHA1_SPEC_3, d, e, a, b, c)
-	SHA1_STEP(73, SHA1_SPEC_3, c, d, e, a, b)
-	SHA1_STEP(74, SHA1_SPEC_3, b, c, d, e, a)
-	SHA1_STEP(75, SHA1_SPEC_3, a, b, c, d, e)
-	SHA1_STEP(76, SHA1_SPEC_3, e, a, b, c, d)
-	SHA1_STEP(77, SHA1_SPEC_3, d, e, a, b, c)
-	SHA1_STEP(78, SHA1_SPEC_3, c, d, e, a, b)
-	SHA1_STEP(79, SHA1_SPEC_3, b, c, d, e, a)
-
-	m_reg[0] += a;
-	m_reg[1] += b;
-	m_reg[2] += c;
-	m_reg[3] += d;
-	m_reg[4] += e;
+		SHA1_STEP( 0, SHA1_SPEC_0, a, b, c, d, e)
+		SHA1_STEP( 1, SHA1_SPEC_0, e, a, b, c, d)
+		SHA1_STEP( 2, SHA1_SPEC_0, d, e, a, b, c)
+		SHA1_STEP( 3, SHA1_SPEC_0, c, d, e, a, b)
+		SHA1_STEP( 4, SHA1_SPEC_0, b, c, d, e, a)
+		SHA1_STEP( 5, SHA1_SPEC_0, a, b, c, d, e)
+		SHA1_STEP( 6, SHA1_SPEC_0, e, a, b, c, d)
+		SHA1_STEP( 7, SHA1_SPEC_0, d, e, a, b, c)
+		SHA1_STEP( 8, SHA1_SPEC_0, c, d, e, a, b)
+		SHA1_STEP( 9, SHA1_SPEC_0, b, c, d, e, a)
+		SHA1_STEP(10, SHA1_SPEC_0, a, b, c, d, e)
+		SHA1_STEP(11, SHA1_SPEC_0, e, a, b, c, d)
+		SHA1_STEP(12, SHA1_SPEC_0, d, e, a, b, c)
+		SHA1_STEP(13, SHA1_SPEC_0, c, d, e, a, b)
+		SHA1_STEP(14, SHA1_SPEC_0, b, c, d, e, a)
+		SHA1_STEP(15, SHA1_SPEC_0, a, b, c, d, e)
+		SHA1_STEP(16, SHA1_SPEC_0, e, a, b, c, d)
+		SHA1_STEP(17, SHA1_SPEC_0, d, e, a, b, c)
+		SHA1_STEP(18, SHA1_SPEC_0, c, d, e, a, b)
+		SHA1_STEP(19, SHA1_SPEC_0, b, c, d, e, a)
+
+		SHA1_STEP(20, SHA1_SPEC_1, a, b, c, d, e)
+		SHA1_STEP(21, SHA1_SPEC_1, e, a, b, c, d)
+		SHA1_STEP(22, SHA1_SPEC_1, d, e, a, b, c)
+		SHA1_STEP(23, SHA1_SPEC_1, c, d, e, a, b)
+		SHA1_STEP(24, SHA1_SPEC_1, b, c, d, e, a)
+		SHA1_STEP(25, SHA1_SPEC_1, a, b, c, d, e)
+		SHA1_STEP(26, SHA1_SPEC_1, e, a, b, c, d)
+		SHA1_STEP(27, SHA1_SPEC_1, d, e, a, b, c)
+		SHA1_STEP(28, SHA1_SPEC_1, c, d, e, a, b)
+		SHA1_STEP(29, SHA1_SPEC_1, b, c, d, e, a)
+		SHA1_STEP(30, SHA1_SPEC_1, a, b, c, d, e)
+		SHA1_STEP(31, SHA1_SPEC_1, e, a, b, c, d)
+		SHA1_STEP(32, SHA1_SPEC_1, d, e, a, b, c)
+		SHA1_STEP(33, SHA1_SPEC_1, c, d, e, a, b)
+		SHA1_STEP(34, SHA1_SPEC_1, b, c, d, e, a)
+		SHA1_STEP(35, SHA1_SPEC_1, a, b, c, d, e)
+		SHA1_STEP(36, SHA1_SPEC_1, e, a, b, c, d)
+		SHA1_STEP(37, SHA1_SPEC_1, d, e, a, b, c)
+		SHA1_STEP(38, SHA1_SPEC_1, c, d, e, a, b)
+		SHA1_STEP(39, SHA1_SPEC_1, b, c, d, e, a)
+
+		SHA1_STEP(40, SHA1_SPEC_2, a, b, c, d, e)
+		SHA1_STEP(41, SHA1_SPEC_2, e, a, b, c, d)
+		SHA1_STEP(42, SHA1_SPEC_2, d, e, a, b, c)
+		SHA1_STEP(43, SHA1_SPEC_2, c, d, e, a, b)
+		SHA1_STEP(44, SHA1_SPEC_2, b, c, d, e, a)
+		SHA1_STEP(45, SHA1_SPEC_2, a, b, c, d, e)
+		SHA1_STEP(46, SHA1_SPEC_2, e, a, b, c, d)
+		SHA1_STEP(47, SHA1_SPEC_2, d, e, a, b, c)
+		SHA1_STEP(48, SHA1_SPEC_2, c, d, e, a, b)
+		SHA1_STEP(49, SHA1_SPEC_2, b, c, d, e, a)
+		SHA1_STEP(50, SHA1_SPEC_2, a, b, c, d, e)
+		SHA1_STEP(51, SHA1_SPEC_2, e, a, b, c, d)
+		SHA1_STEP(52, SHA1_SPEC_2, d, e, a, b, c)
+		SHA1_STEP(53, SHA1_SPEC_2, c, d, e, a, b)
+		SHA1_STEP(54, SHA1_SPEC_2, b, c, d, e, a)
+		SHA1_STEP(55, SHA1_SPEC_2, a, b, c, d, e)
+		SHA1_STEP(56, SHA1_SPEC_2, e, a, b, c, d)
+		SHA1_STEP(57, SHA1_SPEC_2, d, e, a, b, c)
+		SHA1_STEP(58, SHA1_SPEC_2, c, d, e, a, b)
+		SHA1_STEP(59, SHA1_SPEC_2, b, c, d, e, a)
+
+		SHA1_STEP(60, SHA1_SPEC_3, a, b, c, d, e)
+		SHA1_STEP(61, SHA1_SPEC_3, e, a, b, c, d)
+		SHA1_STEP(62, SHA1_SPEC_3, d, e, a, b, c)
+		SHA1_STEP(63, SHA1_SPEC_3, c, d, e, a, b)
+		SHA1_STEP(64, SHA1_SPEC_3, b, c, d, e, a)
+		SHA1_STEP(65, SHA1_SPEC_3, a, b, c, d, e)
+		SHA1_STEP(66, SHA1_SPEC_3, e, a, b, c, d)
+		SHA1_STEP(67, SHA1_SPEC_3, d, e, a, b, c)
+		SHA1_STEP(68, SHA1_SPEC_3, c, d, e, a, b)
+		SHA1_STEP(69, SHA1_SPEC_3, b, c, d, e, a)
+		SHA1_STEP(70, SHA1_SPEC_3, a, b, c, d, e)
+		SHA1_STEP(71, SHA1_SPEC_3, e, a, b, c, d)
+		SHA1_STEP(72, SHA1_SPEC_3, d, e, a, b, c)
+		SHA1_STEP(73, SHA1_SPEC_3, c, d, e, a, b)
+		SHA1_STEP(74, SHA1_SPEC_3, b, c, d, e, a)
+		SHA1_STEP(75, SHA1_SPEC_3, a, b, c, d, e)
+		SHA1_STEP(76, SHA1_SPEC_3, e, a, b, c, d)
+		SHA1_STEP(77, SHA1_SPEC_3, d, e, a, b, c)
+		SHA1_STEP(78, SHA1_SPEC_3, c, d, e, a, b)
+		SHA1_STEP(79, SHA1_SPEC_3, b, c, d, e, a)
+
+		reg[0] += a;
+		reg[1] += b;
+		reg[2] += c;
+		reg[3] += d;
+		reg[4] += e;
+	}
+	void compress_generic(Registers &reg, const unsigned char *data, std::size_t blocks) NOEXCEPT {
+		while(blocks != 0){
+			compress_block_generic(reg, data);
+			data += 64;
+			--blocks;
+		}
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	// 按照 Intel 的白皮书 "Intel SHA Extensions"，每条 SHA1RNDS4 指令计算四轮，E 由 SHA1NEXTE 在下一组中累加。
+	__attribute__((__target__("sha,ssse3,sse4.1")))
+	void compress_shani(Registers &reg, const unsigned char *data, std::size_t blocks) NOEXCEPT {
+		const __m128i mask = _mm_set_epi64x(0x0001020304050607ll, 0x08090A0B0C0D0E0Fll);
+
+		__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(reg.data())), 0x1B);
+		__m128i e0 = _mm_set_epi32(static_cast<int>(reg[4]), 0, 0, 0);
+
+		while(blocks != 0){
+			const __m128i abcd_saved = abcd;
+			const __m128i e0_saved = e0;
+			__m128i e1, msg0, msg1, msg2, msg3;
+
+			// 第 0 到 3 轮。
+			msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0)), mask);
+			e0 = _mm_add_epi32(e0, msg0);
+			e1 = abcd;
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+			// 第 4 到 7 轮。
+			msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)), mask);
+			e1 = _mm_sha1nexte_epu32(e1, msg1);
+			e0 = abcd;
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+			msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+			// 第 8 到 11 轮。
+			msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32)), mask);
+			e0 = _mm_sha1nexte_epu32(e0, msg2);
+			e1 = abcd;
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+			msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+			msg0 = _mm_xor_si128(msg0, msg2);
+			// 第 12 到 15 轮。
+			msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48)), mask);
+			e1 = _mm_sha1nexte_epu32(e1, msg3);
+			e0 = abcd;
+			msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+			msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+			msg1 = _mm_xor_si128(msg1, msg3);
+			// 第 16 到 19 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg0);
+			e1 = abcd;
+			msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+			msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+			msg2 = _mm_xor_si128(msg2, msg0);
+			// 第 20 到 23 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg1);
+			e0 = abcd;
+			msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+			msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+			msg3 = _mm_xor_si128(msg3, msg1);
+			// 第 24 到 27 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg2);
+			e1 = abcd;
+			msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+			msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+			msg0 = _mm_xor_si128(msg0, msg2);
+			// 第 28 到 31 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg3);
+			e0 = abcd;
+			msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+			msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+			msg1 = _mm_xor_si128(msg1, msg3);
+			// 第 32 到 35 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg0);
+			e1 = abcd;
+			msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+			msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+			msg2 = _mm_xor_si128(msg2, msg0);
+			// 第 36 到 39 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg1);
+			e0 = abcd;
+			msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+			msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+			msg3 = _mm_xor_si128(msg3, msg1);
+			// 第 40 到 43 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg2);
+			e1 = abcd;
+			msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+			msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+			msg0 = _mm_xor_si128(msg0, msg2);
+			// 第 44 到 47 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg3);
+			e0 = abcd;
+			msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+			msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+			msg1 = _mm_xor_si128(msg1, msg3);
+			// 第 48 到 51 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg0);
+			e1 = abcd;
+			msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+			msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+			msg2 = _mm_xor_si128(msg2, msg0);
+			// 第 52 到 55 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg1);
+			e0 = abcd;
+			msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+			msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+			msg3 = _mm_xor_si128(msg3, msg1);
+			// 第 56 到 59 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg2);
+			e1 = abcd;
+			msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+			msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+			msg0 = _mm_xor_si128(msg0, msg2);
+			// 第 60 到 63 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg3);
+			e0 = abcd;
+			msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+			msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+			msg1 = _mm_xor_si128(msg1, msg3);
+			// 第 64 到 67 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg0);
+			e1 = abcd;
+			msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+			msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+			msg2 = _mm_xor_si128(msg2, msg0);
+			// 第 68 到 71 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg1);
+			e0 = abcd;
+			msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+			msg3 = _mm_xor_si128(msg3, msg1);
+			// 第 72 到 75 轮。
+			e0 = _mm_sha1nexte_epu32(e0, msg2);
+			e1 = abcd;
+			msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+			abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+			// 第 76 到 79 轮。
+			e1 = _mm_sha1nexte_epu32(e1, msg3);
+			e0 = abcd;
+			abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+			e0 = _mm_sha1nexte_epu32(e0, e0_saved);
+			abcd = _mm_add_epi32(abcd, abcd_saved);
+			data += 64;
+			--blocks;
+		}
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(reg.data()), _mm_shuffle_epi32(abcd, 0x1B));
+		reg[4] = static_cast<boost::uint32_t>(_mm_extract_epi32(e0, 3));
+	}
+#endif
+
+	typedef void (*CompressProc)(Registers &reg, const unsigned char *data, std::size_t blocks);
+
+	CompressProc choose_compress_proc() NOEXCEPT {
+#if defined(__x86_64__) || defined(__i386__)
+		unsigned eax, ebx, ecx, edx;
+		if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+			__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+		{
+			return &compress_shani;
+		}
+#endif
+		return &compress_generic;
+	}
+
+	void compress(Registers &reg, const void *data, std::size_t blocks){
+		static const CompressProc s_proc = choose_compress_proc();
+		(*s_proc)(reg, static_cast<const unsigned char *>(data), blocks);
+	}
+}
+
+Sha1_streambuf::Sha1_streambuf()
+	: m_reg(SHA1_REG_INIT), m_bytes(0)
+{ }
+Sha1_streambuf::~Sha1_streambuf(){ }
+
+void Sha1_streambuf::eat_chunk(){
+	compress(m_reg, m_chunk.data(), 1);
 	m_bytes += 64;
 }
 
@@ -158,6 +355,41 @@ Sha1_streambuf::int_type Sha1_streambuf::overflow(Sha1_streambuf::int_type c){
 	pbump(1);
 	return c;
 }
+std::streamsize Sha1_streambuf::xsputn(const char *s, std::streamsize n){
+	if(n <= 0){
+		return 0;
+	}
+	const char *read = s;
+	std::size_t remaining = static_cast<std::size_t>(n);
+	if(pptr()){
+		// 先把不完整的块填满。
+		const AUTO(avail, static_cast<std::size_t>(m_chunk.end() - pptr()));
+		if(remaining < avail){
+			std::memcpy(pptr(), read, remaining);
+			pbump(static_cast<int>(remaining));
+			return n;
+		}
+		std::memcpy(pptr(), read, avail);
+		read += avail;
+		remaining -= avail;
+		eat_chunk();
+		setp(NULLPTR, NULLPTR);
+	}
+	// 完整的块直接从输入中处理，不经过 m_chunk。
+	const std::size_t blocks = remaining / 64;
+	if(blocks != 0){
+		compress(m_reg, read, blocks);
+		m_bytes += blocks * 64;
+		read += blocks * 64;
+		remaining -= blocks * 64;
+	}
+	if(remaining != 0){
+		setp(m_chunk.begin(), m_chunk.end());
+		std::memcpy(pptr(), read, remaining);
+		pbump(static_cast<int>(remaining));
+	}
+	return n;
+}
 
 Sha1 Sha1_streambuf::finalize(){
 	boost::uint64_t bytes = m_bytes;
@@ -185,4 +417,21 @@ Sha1 Sha1_streambuf::finalize(){
 
 Sha1_ostream::~Sha1_ostream(){ }
 
+
+Sha1 sha1_hash(const void *data, std::size_t size){
+	Sha1_streambuf sb;
+	sb.sputn(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+	return sb.finalize();
+}
+Sha1 sha1_hash(const StreamBuffer &buffer){
+	Sha1_streambuf sb;
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		sb.sputn(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+	}
+	return sb.finalize();
+}
+
 }
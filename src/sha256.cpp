@@ -3,13 +3,297 @@
 
 #include "precompiled.hpp"
 #include "sha256.hpp"
+#include "stream_buffer.hpp"
 #include "endian.hpp"
 #include <x86intrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
 namespace {
 	CONSTEXPR const boost::array<boost::uint32_t, 8> SHA256_REG_INIT = {{ 0x6A09E667u, 0xBB67AE85u, 0x3C6EF372u, 0xA54FF53Au, 0x510E527Fu, 0x9B05688Cu, 0x1F83D9ABu, 0x5BE0CD19u }};
+
+	typedef boost::array<boost::uint32_t, 8> Registers;
+
+	void compress_block_generic(Registers &reg, const unsigned char *block) NOEXCEPT {
+		// https://en.wikipedia.org/wiki/SHA-2
+		boost::array<boost::uint32_t, 64> w;
+		for(std::size_t i = 0; i < 16; ++i){
+			boost::uint32_t word;
+			std::memcpy(&word, block + i * 4, 4);
+			w[i] = load_be(word);
+		}
+		for(std::size_t i = 16; i < 64; ++i){
+			const boost::uint32_t s0 = __rord(__rord(w[i - 15], 11) ^ w[i - 15], 7) ^ (w[i - 15] >> 3);
+			const boost::uint32_t s1 = __rord(__rord(w[i - 2], 2) ^ w[i - 2], 17) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + w[i - 7] + s0 + s1;
+		}
+
+		register boost::uint32_t a = reg[0];
+		register boost::uint32_t b = reg[1];
+		register boost::uint32_t c = reg[2];
+		register boost::uint32_t d = reg[3];
+		register boost::uint32_t e = reg[4];
+		register boost::uint32_t f = reg[5];
+		register boost::uint32_t g = reg[6];
+		register boost::uint32_t h = reg[7];
+
+		register boost::uint32_t S0, maj, t2, S1, ch, t1;
+
+#define SHA256_STEP(i_, a_, b_, c_, d_, e_, f_, g_, h_, k_)	\
+		S0 = __rord(__rord(__rord(a_, 9) ^ a_, 11) ^ a_, 2);	\
+		maj = (a_ & b_) | (c_ & (a_ ^ b_));	\
+		t2 = S0 + maj;	\
+		S1 = __rord(__rord(__rord(e_, 14) ^ e_, 5) ^ e_, 6);	\
+		ch = g_ ^ (e_ & (f_ ^ g_));	\
+		t1 = h_ + S1 + ch + k_ + w[i_];	\
+		d_ += t1;	\
+		h_ = t1 + t2;
+
+		SHA256_STEP( 0, a, b, c, d, e, f, g, h, 0x428A2F98)
+		SHA256_STEP( 1, h, a, b, c, d, e, f, g, 0x71374491)
+		SHA256_STEP( 2, g, h, a, b, c, d, e, f, 0xB5C0FBCF)
+		SHA256_STEP( 3, f, g, h, a, b, c, d, e, 0xE9B5DBA5)
+		SHA256_STEP( 4, e, f, g, h, a, b, c, d, 0x3956C25B)
+		SHA256_STEP( 5, d, e, f, g, h, a, b, c, 0x59F111F1)
+		SHA256_STEP( 6, c, d, e, f, g, h, a, b, 0x923F82A4)
+		SHA256_STEP( 7, b, c, d, e, f, g, h, a, 0xAB1C5ED5)
+
+		SHA256_STEP( 8, a, b, c, d, e, f, g, h, 0xD807AA98)
+		SHA256_STEP( 9, h, a, b, c, d, e, f, g, 0x12835B01)
+		SHA256_STEP(10, g, h, a, b, c, d, e, f, 0x243185BE)
+		SHA256_STEP(11, f, g, h, a, b, c, d, e, 0x550C7DC3)
+		SHA256_STEP(12, e, f, g, h, a, b, c, d, 0x72BE5D74)
+		SHA256_STEP(13, d, e, f, g, h, a, b, c, 0x80DEB1FE)
+		SHA256_STEP(14, c, d, e, f, g, h, a, b, 0x9BDC06A7)
+		SHA256_STEP(15, b, c, d, e, f, g, h, a, 0xC19BF174)
+
+		SHA256_STEP(16, a, b, c, d, e, f, g, h, 0xE49B69C1)
+		SHA256_STEP(17, h, a, b, c, d, e, f, g, 0xEFBE4786)
+		SHA256_STEP(18, g, h, a, b, c, d, e, f, 0x0FC19DC6)
+		SHA256_STEP(19, f, g, h, a, b, c, d, e, 0x240CA1CC)
+		SHA256_STEP(20, e, f, g, h, a, b, c, d, 0x2DE92C6F)
+		SHA256_STEP(21, d, e, f, g, h, a, b, c, 0x4A7484AA)
+		SHA256_STEP(22, c, d, e, f, g, h, a, b, 0x5CB0A9DC)
+		SHA256_STEP(23, b, c, d, e, f, g, h, a, 0x76F988DA)
+
+		SHA256_STEP(24, a, b, c, d, e, f, g, h, 0x983E5152)
+		SHA256_STEP(25, h, a, b, c, d, e, f, g, 0xA831C66D)
+		SHA256_STEP(26, g, h, a, b, c, d, e, f, 0xB00327C8)
+		SHA256_STEP(27, f, g, h, a, b, c, d, e, 0xBF597FC7)
+		SHA256_STEP(28, e, f, g, h, a, b, c, d, 0xC6E00BF3)
+		SHA256_STEP(29, d, e, f, g, h, a, b, c, 0xD5A79147)
+		SHA256_STEP(30, c, d, e, f, g, h, a, b, 0x06CA6351)
+		SHA256_STEP(31, b, c, d, e, f, g, h, a, 0x14292967)
+
+		SHA256_STEP(32, a, b, c, d, e, f, g, h, 0x27B70A85)
+		SHA256_STEP(33, h, a, b, c, d, e, f, g, 0x2E1B2138)
+		SHA256_STEP(34, g, h, a, b, c, d, e, f, 0x4D2C6DFC)
+		SHA256_STEP(35, f, g, h, a, b, c, d, e, 0x53380D13)
+		SHA256_STEP(36, e, f, g, h, a, b, c, d, 0x650A7354)
+		SHA256_STEP(37, d, e, f, g, h, a, b, c, 0x766A0ABB)
+		SHA256_STEP(38, c, d, e, f, g, h, a, b, 0x81C2C92E)
+		SHA256_STEP(39, b, c, d, e, f, g, h, a, 0x92722C85)
+
+		SHA256_STEP(40, a, b, c, d, e, f, g, h, 0xA2BFE8A1)
+		SHA256_STEP(41, h, a, b, c, d, e, f, g, 0xA81A664B)
+		SHA256_STEP(42, g, h, a, b, c, d, e, f, 0xC24B8B70)
+		SHA256_STEP(43, f, g, h, a, b, c, d, e, 0xC76C51A3)
+		SHA256_STEP(44, e, f, g, h, a, b, c, d, 0xD192E819)
+		SHA256_STEP(45, d, e, f, g, h, a, b, c, 0xD6990624)
+		SHA256_STEP(46, c, d, e, f, g, h, a, b, 0xF40E3585)
+		SHA256_STEP(47, b, c, d, e, f, g, h, a, 0x106AA070)
+
+		SHA256_STEP(48, a, b, c, d, e, f, g, h, 0x19A4C116)
+		SHA256_STEP(49, h, a, b, c, d, e, f, g, 0x1E376C08)
+		SHA256_STEP(50, g, h, a, b, c, d, e, f, 0x2748774C)
+		SHA256_STEP(51, f, g, h, a, b, c, d, e, 0x34B0BCB5)
+		SHA256_STEP(52, e, f, g, h, a, b, c, d, 0x391C0CB3)
+		SHA256_STEP(53, d, e, f, g, h, a, b, c, 0x4ED8AA4A)
+		SHA256_STEP(54, c, d, e, f, g, h, a, b, 0x5B9CCA4F)
+		SHA256_STEP(55, b, c, d, e, f, g, h, a, 0x682E6FF3)
+
+		SHA256_STEP(56, a, b, c, d, e, f, g, h, 0x748F82EE)
+		SHA256_STEP(57, h, a, b, c, d, e, f, g, 0x78A5636F)
+		SHA256_STEP(58, g, h, a, b, c, d, e, f, 0x84C87814)
+		SHA256_STEP(59, f, g, h, a, b, c, d, e, 0x8CC70208)
+		SHA256_STEP(60, e, f, g, h, a, b, c, d, 0x90BEFFFA)
+		SHA256_STEP(61, d, e, f, g, h, a, b, c, 0xA4506CEB)
+		SHA256_STEP(62, c, d, e, f, g, h, a, b, 0xBEF9A3F7)
+		SHA256_STEP(63, b, c, d, e, f, g, h, a, 0xC67178F2)
+
+		reg[0] += a;
+		reg[1] += b;
+		reg[2] += c;
+		reg[3] += d;
+		reg[4] += e;
+		reg[5] += f;
+		reg[6] += g;
+		reg[7] += h;
+	}
+	void compress_generic(Registers &reg, const unsigned char *data, std::size_t blocks) NOEXCEPT {
+		while(blocks != 0){
+			compress_block_generic(reg, data);
+			data += 64;
+			--blocks;
+		}
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	const boost::uint32_t SHA256_K[64] = {
+		0x428A2F98u, 0x71374491u, 0xB5C0FBCFu, 0xE9B5DBA5u, 0x3956C25Bu, 0x59F111F1u, 0x923F82A4u, 0xAB1C5ED5u,
+		0xD807AA98u, 0x12835B01u, 0x243185BEu, 0x550C7DC3u, 0x72BE5D74u, 0x80DEB1FEu, 0x9BDC06A7u, 0xC19BF174u,
+		0xE49B69C1u, 0xEFBE4786u, 0x0FC19DC6u, 0x240CA1CCu, 0x2DE92C6Fu, 0x4A7484AAu, 0x5CB0A9DCu, 0x76F988DAu,
+		0x983E5152u, 0xA831C66Du, 0xB00327C8u, 0xBF597FC7u, 0xC6E00BF3u, 0xD5A79147u, 0x06CA6351u, 0x14292967u,
+		0x27B70A85u, 0x2E1B2138u, 0x4D2C6DFCu, 0x53380D13u, 0x650A7354u, 0x766A0ABBu, 0x81C2C92Eu, 0x92722C85u,
+		0xA2BFE8A1u, 0xA81A664Bu, 0xC24B8B70u, 0xC76C51A3u, 0xD192E819u, 0xD6990624u, 0xF40E3585u, 0x106AA070u,
+		0x19A4C116u, 0x1E376C08u, 0x2748774Cu, 0x34B0BCB5u, 0x391C0CB3u, 0x4ED8AA4Au, 0x5B9CCA4Fu, 0x682E6FF3u,
+		0x748F82EEu, 0x78A5636Fu, 0x84C87814u, 0x8CC70208u, 0x90BEFFFAu, 0xA4506CEBu, 0xBEF9A3F7u, 0xC67178F2u,
+	};
+
+	// 按照 Intel 的白皮书 "Intel SHA Extensions"，每条 SHA256RNDS2 指令计算两轮，消息扩展也由专用指令完成。
+	__attribute__((__target__("sha,ssse3,sse4.1")))
+	void compress_shani(Registers &reg, const unsigned char *data, std::size_t blocks) NOEXCEPT {
+		const __m128i mask = _mm_set_epi64x(0x0C0D0E0F08090A0Bll, 0x0405060700010203ll);
+
+		// 指令要求的寄存器排列是 ABEF 和 CDGH。
+		__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(reg.data())), 0xB1);
+		__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(reg.data() + 4)), 0x1B);
+		__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+		state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+		while(blocks != 0){
+			const __m128i state0_saved = state0;
+			const __m128i state1_saved = state1;
+			__m128i msg, msg0, msg1, msg2, msg3;
+
+			// 第 0 到 3 轮。
+			msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 0)), mask);
+			msg = _mm_add_epi32(msg0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 0)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			// 第 4 到 7 轮。
+			msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)), mask);
+			msg = _mm_add_epi32(msg1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 4)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+			// 第 8 到 11 轮。
+			msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32)), mask);
+			msg = _mm_add_epi32(msg2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 8)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+			// 第 12 到 15 轮。
+			msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48)), mask);
+			msg = _mm_add_epi32(msg3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 12)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg0 = _mm_sha256msg2_epu32(_mm_add_epi32(msg0, _mm_alignr_epi8(msg3, msg2, 4)), msg3);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+			// 第 16 到 19 轮。
+			msg = _mm_add_epi32(msg0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 16)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg1 = _mm_sha256msg2_epu32(_mm_add_epi32(msg1, _mm_alignr_epi8(msg0, msg3, 4)), msg0);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+			// 第 20 到 23 轮。
+			msg = _mm_add_epi32(msg1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 20)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg2 = _mm_sha256msg2_epu32(_mm_add_epi32(msg2, _mm_alignr_epi8(msg1, msg0, 4)), msg1);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+			// 第 24 到 27 轮。
+			msg = _mm_add_epi32(msg2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 24)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg3 = _mm_sha256msg2_epu32(_mm_add_epi32(msg3, _mm_alignr_epi8(msg2, msg1, 4)), msg2);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+			// 第 28 到 31 轮。
+			msg = _mm_add_epi32(msg3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 28)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg0 = _mm_sha256msg2_epu32(_mm_add_epi32(msg0, _mm_alignr_epi8(msg3, msg2, 4)), msg3);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+			// 第 32 到 35 轮。
+			msg = _mm_add_epi32(msg0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 32)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg1 = _mm_sha256msg2_epu32(_mm_add_epi32(msg1, _mm_alignr_epi8(msg0, msg3, 4)), msg0);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+			// 第 36 到 39 轮。
+			msg = _mm_add_epi32(msg1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 36)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg2 = _mm_sha256msg2_epu32(_mm_add_epi32(msg2, _mm_alignr_epi8(msg1, msg0, 4)), msg1);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg0 = _mm_sha256msg1_epu32(msg0, msg1);
+			// 第 40 到 43 轮。
+			msg = _mm_add_epi32(msg2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 40)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg3 = _mm_sha256msg2_epu32(_mm_add_epi32(msg3, _mm_alignr_epi8(msg2, msg1, 4)), msg2);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg1 = _mm_sha256msg1_epu32(msg1, msg2);
+			// 第 44 到 47 轮。
+			msg = _mm_add_epi32(msg3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 44)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg0 = _mm_sha256msg2_epu32(_mm_add_epi32(msg0, _mm_alignr_epi8(msg3, msg2, 4)), msg3);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg2 = _mm_sha256msg1_epu32(msg2, msg3);
+			// 第 48 到 51 轮。
+			msg = _mm_add_epi32(msg0, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 48)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg1 = _mm_sha256msg2_epu32(_mm_add_epi32(msg1, _mm_alignr_epi8(msg0, msg3, 4)), msg0);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			msg3 = _mm_sha256msg1_epu32(msg3, msg0);
+			// 第 52 到 55 轮。
+			msg = _mm_add_epi32(msg1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 52)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg2 = _mm_sha256msg2_epu32(_mm_add_epi32(msg2, _mm_alignr_epi8(msg1, msg0, 4)), msg1);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			// 第 56 到 59 轮。
+			msg = _mm_add_epi32(msg2, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 56)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg3 = _mm_sha256msg2_epu32(_mm_add_epi32(msg3, _mm_alignr_epi8(msg2, msg1, 4)), msg2);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+			// 第 60 到 63 轮。
+			msg = _mm_add_epi32(msg3, _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 60)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+
+			state0 = _mm_add_epi32(state0, state0_saved);
+			state1 = _mm_add_epi32(state1, state1_saved);
+			data += 64;
+			--blocks;
+		}
+
+		tmp = _mm_shuffle_epi32(state0, 0x1B);
+		state1 = _mm_shuffle_epi32(state1, 0xB1);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(reg.data()), _mm_blend_epi16(tmp, state1, 0xF0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(reg.data() + 4), _mm_alignr_epi8(state1, tmp, 8));
+	}
+#endif
+
+	typedef void (*CompressProc)(Registers &reg, const unsigned char *data, std::size_t blocks);
+
+	CompressProc choose_compress_proc() NOEXCEPT {
+#if defined(__x86_64__) || defined(__i386__)
+		unsigned eax, ebx, ecx, edx;
+		if(__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+			__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA))
+		{
+			return &compress_shani;
+		}
+#endif
+		return &compress_generic;
+	}
+
+	void compress(Registers &reg, const void *data, std::size_t blocks){
+		static const CompressProc s_proc = choose_compress_proc();
+		(*s_proc)(reg, static_cast<const unsigned char *>(data), blocks);
+	}
 }
 
 Sha256_streambuf::Sha256_streambuf()
@@ -18,118 +302,7 @@ Sha256_streambuf::Sha256_streambuf()
 Sha256_streambuf::~Sha256_streambuf(){ }
 
 void Sha256_streambuf::eat_chunk(){
-	// https://en.wikipedia.org/wiki/SHA-2
-	boost::array<boost::uint32_t, 64> w;
-	for(std::size_t i = 0; i < 16; ++i){
-		w[i] = load_be(reinterpret_cast<const boost::uint32_t *>(m_chunk.data())[i]);
-	}
-	for(std::size_t i = 16; i < 64; ++i){
-		const boost::uint32_t s0 = __rord(__rord(w[i - 15], 11) ^ w[i - 15], 7) ^ (w[i - 15] >> 3);
-		const boost::uint32_t s1 = __rord(__rord(w[i - 2], 2) ^ w[i - 2], 17) ^ (w[i - 2] >> 10);
-		w[i] = w[i - 16] + w[i - 7] + s0 + s1;
-	}
-
-	register boost::uint32_t a = m_reg[0];
-	register boost::uint32_t b = m_reg[1];
-	register boost::uint32_t c = m_reg[2];
-	register boost::uint32_t d = m_reg[3];
-	register boost::uint32_t e = m_reg[4];
-	register boost::uint32_t f = m_reg[5];
-	register boost::uint32_t g = m_reg[6];
-	register boost::uint32_t h = m_reg[7];
-
-	register boost::uint32_t S0, maj, t2, S1, ch, t1;
-
-#define SHA256_STEP(i_, a_, b_, c_, d_, e_, f_, g_, h_, k_)	\
-	S0 = __rord(__rord(__rord(a_, 9) ^ a_, 11) ^ a_, 2);	\
-	maj = (a_ & b_) | (c_ & (a_ ^ b_));	\
-	t2 = S0 + maj;	\
-	S1 = __rord(__rord(__rord(e_, 14) ^ e_, 5) ^ e_, 6);	\
-	ch = g_ ^ (e_ & (f_ ^ g_));	\
-	t1 = h_ + S1 + ch + k_ + w[i_];	\
-	d_ += t1;	\
-	h_ = t1 + t2;
-
-	SHA256_STEP( 0, a, b, c, d, e, f, g, h, 0x428A2F98)
-	SHA256_STEP( 1, h, a, b, c, d, e, f, g, 0x71374491)
-	SHA256_STEP( 2, g, h, a, b, c, d, e, f, 0xB5C0FBCF)
-	SHA256_STEP( 3, f, g, h, a, b, c, d, e, 0xE9B5DBA5)
-	SHA256_STEP( 4, e, f, g, h, a, b, c, d, 0x3956C25B)
-	SHA256_STEP( 5, d, e, f, g, h, a, b, c, 0x59F111F1)
-	SHA256_STEP( 6, c, d, e, f, g, h, a, b, 0x923F82A4)
-	SHA256_STEP( 7, b, c, d, e, f, g, h, a, 0xAB1C5ED5)
-
-	SHA256_STEP( 8, a, b, c, d, e, f, g, h, 0xD807AA98)
-	SHA256_STEP( 9, h, a, b, c, d, e, f, g, 0x12835B01)
-	SHA256_STEP(10, g, h, a, b, c, d, e, f, 0x243185BE)
-	SHA256_STEP(11, f, g, h, a, b, c, d, e, 0x550C7DC3)
-	SHA256_STEP(12, e, f, g, h, a, b, c, d, 0x72BE5D74)
-	SHA256_STEP(13, d, e, f, g, h, a, b, c, 0x80DEB1FE)
-	SHA256_STEP(14, c, d, e, f, g, h, a, b, 0x9BDC06A7)
-	SHA256_STEP(15, b, c, d, e, f, g, h, a, 0xC19BF174)
-
-	SHA256_STEP(16, a, b, c, d, e, f, g, h, 0xE49B69C1)
-	SHA256_STEP(17, h, a, b, c, d, e, f, g, 0xEFBE4786)
-	SHA256_STEP(18, g, h, a, b, c, d, e, f, 0x0FC19DC6)
-	SHA256_STEP(19, f, g, h, a, b, c, d, e, 0x240CA1CC)
-	SHA256_STEP(20, e, f, g, h, a, b, c, d, 0x2DE92C6F)
-	SHA256_STEP(21, d, e, f, g, h, a, b, c, 0x4A7484AA)
-	SHA256_STEP(22, c, d, e, f, g, h, a, b, 0x5CB0A9DC)
-	SHA256_STEP(23, b, c, d, e, f, g, h, a, 0x76F988DA)
-
-	SHA256_STEP(24, a, b, c, d, e, f, g, h, 0x983E5152)
-	SHA256_STEP(25, h, a, b, c, d, e, f, g, 0xA831C66D)
-	SHA256_STEP(26, g, h, a, b, c, d, e, f, 0xB00327C8)
-	SHA256_STEP(27, f, g, h, a, b, c, d, e, 0xBF597FC7)
-	SHA256_STEP(28, e, f, g, h, a, b, c, d, 0xC6E00BF3)
-	SHA256_STEP(29, d, e, f, g, h, a, b, c, 0xD5A79147)
-	SHA256_STEP(30, c, d, e, f, g, h, a, b, 0x06CA6351)
-	SHA256_STEP(31, b, c, d, e, f, g, h, a, 0x14292967)
-
-	SHA256_STEP(32, a, b, c, d, e, f, g, h, 0x27B70A85)
-	SHA256_STEP(33, h, a, b, c, d, e, f, g, 0x2E1B2138)
-	SHA256_STEP(34, g, h, a, b, c, d, e, f, 0x4D2C6DFC)
-	SHA256_STEP(35, f, g, h, a, b, c, d, e, 0x53380D13)
-	SHA256_STEP(36, e, f, g, h, a, b, c, d, 0x650A7354)
-	SHA256_STEP(37, d, e, f, g, h, a, b, c, 0x766A0ABB)
-	SHA256_STEP(38, c, d, e, f, g, h, a, b, 0x81C2C92E)
-	SHA256_STEP(39, b, c, d, e, f, g, h, a, 0x92722C85)
-
-	SHA256_STEP(40, a, b, c, d, e, f, g, h, 0xA2BFE8A1)
-	SHA256_STEP(41, h, a, b, c, d, e, f, g, 0xA81A664B)
-	SHA256_STEP(42, g, h, a, b, c, d, e, f, 0xC24B8B70)
-	SHA256_STEP(43, f, g, h, a, b, c, d, e, 0xC76C51A3)
-	SHA256_STEP(44, e, f, g, h, a, b, c, d, 0xD192E819)
-	SHA256_STEP(45, d, e, f, g, h, a, b, c, 0xD6990624)
-	SHA256_STEP(46, c, d, e, f, g, h, a, b, 0xF40E3585)
-	SHA256_STEP(47, b, c, d, e, f, g, h, a, 0x106AA070)
-
-	SHA256_STEP(48, a, b, c, d, e, f, g, h, 0x19A4C116)
-	SHA256_STEP(49, h, a, b, c, d, e, f, g, 0x1E376C08)
-	SHA256_STEP(50, g, h, a, b, c, d, e, f, 0x2748774C)
-	SHA256_STEP(51, f, g, h, a, b, c, d, e, 0x34B0BCB5)
-	SHA256_STEP(52, e, f, g, h, a, b, c, d, 0x391C0CB3)
-	SHA256_STEP(53, d, e, f, g, h, a, b, c, 0x4ED8AA4A)
-	SHA256_STEP(54, c, d, e, f, g, h, a, b, 0x5B9CCA4F)
-	SHA256_STEP(55, b, c, d, e, f, g, h, a, 0x682E6FF3)
-
-	SHA256_STEP(56, a, b, c, d, e, f, g, h, 0x748F82EE)
-	SHA256_STEP(57, h, a, b, c, d, e, f, g, 0x78A5636F)
-	SHA256_STEP(58, g, h, a, b, c, d, e, f, 0x84C87814)
-	SHA256_STEP(59, f, g, h, a, b, c, d, e, 0x8CC70208)
-	SHA256_STEP(60, e, f, g, h, a, b, c, d, 0x90BEFFFA)
-	SHA256_STEP(61, d, e, f, g, h, a, b, c, 0xA4506CEB)
-	SHA256_STEP(62, c, d, e, f, g, h, a, b, 0xBEF9A3F7)
-	SHA256_STEP(63, b, c, d, e, f, g, h, a, 0xC67178F2)
-
-	m_reg[0] += a;
-	m_reg[1] += b;
-	m_reg[2] += c;
-	m_reg[3] += d;
-	m_reg[4] += e;
-	m_reg[5] += f;
-	m_reg[6] += g;
-	m_reg[7] += h;
+	compress(m_reg, m_chunk.data(), 1);
 	m_bytes += 64;
 }
 
@@ -151,6 +324,41 @@ Sha256_streambuf::int_type Sha256_streambuf::overflow(Sha256_streambuf::int_type
 	pbump(1);
 	return c;
 }
+std::streamsize Sha256_streambuf::xsputn(const char *s, std::streamsize n){
+	if(n <= 0){
+		return 0;
+	}
+	const char *read = s;
+	std::size_t remaining = static_cast<std::size_t>(n);
+	if(pptr()){
+		// 先把不完整的块填满。
+		const AUTO(avail, static_cast<std::size_t>(m_chunk.end() - pptr()));
+		if(remaining < avail){
+			std::memcpy(pptr(), read, remaining);
+			pbump(static_cast<int>(remaining));
+			return n;
+		}
+		std::memcpy(pptr(), read, avail);
+		read += avail;
+		remaining -= avail;
+		eat_chunk();
+		setp(NULLPTR, NULLPTR);
+	}
+	// 完整的块直接从输入中处理，不经过 m_chunk。
+	const std::size_t blocks = remaining / 64;
+	if(blocks != 0){
+		compress(m_reg, read, blocks);
+		m_bytes += blocks * 64;
+		read += blocks * 64;
+		remaining -= blocks * 64;
+	}
+	if(remaining != 0){
+		setp(m_chunk.begin(), m_chunk.end());
+		std::memcpy(pptr(), read, remaining);
+		pbump(static_cast<int>(remaining));
+	}
+	return n;
+}
 
 Sha256 Sha256_streambuf::finalize(){
 	boost::uint64_t bytes = m_bytes;
@@ -178,4 +386,21 @@ Sha256 Sha256_streambuf::finalize(){
 
 Sha256_ostream::~Sha256_ostream(){ }
 
+
+Sha256 sha256_hash(const void *data, std::size_t size){
+	Sha256_streambuf sb;
+	sb.sputn(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+	return sb.finalize();
+}
+Sha256 sha256_hash(const StreamBuffer &buffer){
+	Sha256_streambuf sb;
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		sb.sputn(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+	}
+	return sb.finalize();
+}
+
 }
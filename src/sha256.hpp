@@ -14,6 +14,8 @@
 
 namespace Poseidon {
 
+class StreamBuffer;
+
 typedef boost::array<boost::uint8_t, 32> Sha256;
 
 class Sha256_streambuf : public std::streambuf {
@@ -35,6 +37,7 @@ private:
 
 protected:
 	int_type overflow(int_type c = traits_type::eof()) OVERRIDE;
+	std::streamsize xsputn(const char *s, std::streamsize n) OVERRIDE;
 
 public:
 	void reset() NOEXCEPT;
@@ -64,6 +67,10 @@ public:
 	}
 };
 
+// 一次性计算整段数据的摘要。x86 上如果 CPU 支持 SHA 扩展指令则使用硬件实现，否则使用通用实现。
+extern Sha256 sha256_hash(const void *data, std::size_t size);
+extern Sha256 sha256_hash(const StreamBuffer &buffer);
+
 }
 
 #endif
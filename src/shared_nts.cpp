@@ -4,6 +4,7 @@
 #include "precompiled.hpp"
 #include "shared_nts.hpp"
 #include "checked_arithmetic.hpp"
+#include "atomic.hpp"
 #include <memory>
 #include <iostream>
 #include <boost/make_shared.hpp>
@@ -90,9 +91,162 @@ namespace {
 			p->~T();
 		}
 	};
+
+	struct InternedString {
+		std::size_t hash;
+		std::size_t len;
+		char str[1];
+	};
+
+	// 开放寻址的哈希表，负载因子不超过 1/2。扩容时旧表不释放，因为可能还有线程在读。
+	struct InternTable {
+		std::size_t mask;
+		InternedString *volatile slots[1];
+	};
+
+	// 驻留表只由 POD 构成，可以在静态初始化期间和静态析构之后使用。
+	struct InternShard {
+		volatile bool locked;
+		InternTable *volatile table;
+		std::size_t count;
+	};
+
+	enum {
+		INTERN_SHARD_COUNT = 16,
+		INTERN_MIN_CAPACITY = 64,
+	};
+
+	InternShard g_intern_shards[INTERN_SHARD_COUNT];
+
+	InternShard &get_intern_shard(std::size_t hash) NOEXCEPT {
+		return g_intern_shards[hash % INTERN_SHARD_COUNT];
+	}
+	// 低位用于选择分片，其余的位用于选择槽位。
+	std::size_t get_intern_slot(std::size_t hash) NOEXCEPT {
+		return hash / INTERN_SHARD_COUNT;
+	}
+
+	const InternedString *find_interned(const InternShard &shard, std::size_t hash, const char *str, std::size_t len) NOEXCEPT {
+		const AUTO(table, atomic_load(shard.table, ATOMIC_ACQUIRE));
+		if(!table){
+			return NULLPTR;
+		}
+		std::size_t index = get_intern_slot(hash);
+		for(;;){
+			index &= table->mask;
+			const AUTO(entry, atomic_load(table->slots[index], ATOMIC_ACQUIRE));
+			if(!entry){
+				return NULLPTR;
+			}
+			if((entry->hash == hash) && (entry->len == len) && (std::memcmp(entry->str, str, len) == 0)){
+				return entry;
+			}
+			++index;
+		}
+	}
+	void insert_into_table(InternTable *table, InternedString *entry) NOEXCEPT {
+		std::size_t index = get_intern_slot(entry->hash);
+		for(;;){
+			index &= table->mask;
+			if(!table->slots[index]){
+				atomic_store(table->slots[index], entry, ATOMIC_RELEASE);
+				return;
+			}
+			++index;
+		}
+	}
+	InternTable *create_table(std::size_t capacity){
+		const AUTO(table, static_cast<InternTable *>(::operator new(sizeof(InternTable) + sizeof(InternedString *) * (capacity - 1))));
+		table->mask = capacity - 1;
+		for(std::size_t i = 0; i < capacity; ++i){
+			table->slots[i] = NULLPTR;
+		}
+		return table;
+	}
+
+	void lock_shard(InternShard &shard) NOEXCEPT {
+		while(atomic_exchange(shard.locked, true, ATOMIC_ACQUIRE)){
+			atomic_pause();
+		}
+	}
+	void unlock_shard(InternShard &shard) NOEXCEPT {
+		atomic_store(shard.locked, false, ATOMIC_RELEASE);
+	}
+
+	const InternedString *intern_string(std::size_t hash, const char *str, std::size_t len){
+		AUTO_REF(shard, get_intern_shard(hash));
+		const InternedString *entry = find_interned(shard, hash, str, len);
+		if(entry){
+			return entry;
+		}
+		// 在锁外分配内存。
+		const AUTO(new_entry, static_cast<InternedString *>(::operator new(checked_add(sizeof(InternedString), len))));
+		new_entry->hash = hash;
+		new_entry->len = len;
+		std::memcpy(new_entry->str, str, len);
+		new_entry->str[len] = 0;
+
+		lock_shard(shard);
+		try {
+			// 其他线程可能已经驻留了同一个字符串。
+			entry = find_interned(shard, hash, str, len);
+			if(!entry){
+				InternTable *table = shard.table;
+				const std::size_t capacity = table ? (table->mask + 1) : 0;
+				if((shard.count + 1) * 2 > capacity){
+					const AUTO(new_table, create_table(std::max<std::size_t>(capacity * 2, INTERN_MIN_CAPACITY)));
+					for(std::size_t i = 0; i < capacity; ++i){
+						if(table->slots[i]){
+							insert_into_table(new_table, table->slots[i]);
+						}
+					}
+					atomic_store(shard.table, new_table, ATOMIC_RELEASE);
+					table = new_table;
+				}
+				insert_into_table(table, new_entry);
+				++shard.count;
+				entry = new_entry;
+			}
+		} catch(...){
+			unlock_shard(shard);
+			::operator delete(new_entry);
+			throw;
+		}
+		unlock_shard(shard);
+
+		if(entry != new_entry){
+			::operator delete(new_entry);
+		}
+		return entry;
+	}
+}
+
+SharedNts SharedNts::intern(const char *str, std::size_t len){
+	if(len == 0){
+		return SharedNts();
+	}
+	const AUTO(hash, compute_hash(str, len));
+	const AUTO(entry, intern_string(hash, str, len));
+	SharedNts ret(boost::shared_ptr<void>(), entry->str);
+	ret.m_hash = hash;
+	return ret;
+}
+SharedNts SharedNts::intern_existing(const char *str, std::size_t len){
+	if(len == 0){
+		return SharedNts();
+	}
+	const AUTO(hash, compute_hash(str, len));
+	const AUTO(entry, find_interned(get_intern_shard(hash), hash, str, len));
+	if(!entry){
+		return SharedNts(str, len);
+	}
+	SharedNts ret(boost::shared_ptr<void>(), entry->str);
+	ret.m_hash = hash;
+	return ret;
 }
 
 void SharedNts::assign(const char *str, std::size_t len){
+	m_hash = 0;
 	if(len == 0){
 		m_ptr.reset(boost::shared_ptr<void>(), "");
 	} else {
@@ -19,8 +19,38 @@ public:
 		return SharedNts(boost::shared_ptr<void>(), str);
 	}
 
+	// 返回全局驻留表中的副本。内容相同的字符串总是得到同一个地址，复制时不修改引用计数，哈希值预先计算好，
+	// 两个驻留的字符串只需要比较指针。驻留的字符串永远不会被释放，因此只应当用于数量有限的键，例如表名和字段名。
+	// 查找不加锁，只有第一次驻留某个字符串时才会加锁。
+	static SharedNts intern(const char *str, std::size_t len);
+	static SharedNts intern(const char *str){
+		return intern(str, std::strlen(str));
+	}
+	static SharedNts intern(const std::string &str){
+		return intern(str.data(), str.size());
+	}
+	// 如果已经驻留则返回驻留的副本，否则复制一份，但不加入驻留表。用于来自不可信输入的键。
+	static SharedNts intern_existing(const char *str, std::size_t len);
+
+	// FNV-1a。
+	static std::size_t compute_hash(const char *str) NOEXCEPT {
+		std::size_t hash = static_cast<std::size_t>(2166136261u);
+		for(const char *p = str; *p; ++p){
+			hash = (hash ^ static_cast<unsigned char>(*p)) * 16777619u;
+		}
+		return hash;
+	}
+	static std::size_t compute_hash(const char *str, std::size_t len) NOEXCEPT {
+		std::size_t hash = static_cast<std::size_t>(2166136261u);
+		for(std::size_t i = 0; i < len; ++i){
+			hash = (hash ^ static_cast<unsigned char>(str[i])) * 16777619u;
+		}
+		return hash;
+	}
+
 private:
 	boost::shared_ptr<const char> m_ptr;
+	std::size_t m_hash; // 驻留的字符串的哈希值，其他字符串为零。
 
 public:
 	SharedNts() NOEXCEPT {
@@ -41,10 +71,11 @@ public:
 	}
 
 	SharedNts(const SharedNts &rhs) NOEXCEPT
-		: m_ptr(rhs.m_ptr)
+		: m_ptr(rhs.m_ptr), m_hash(rhs.m_hash)
 	{ }
 	SharedNts &operator=(const SharedNts &rhs) NOEXCEPT {
 		m_ptr = rhs.m_ptr;
+		m_hash = rhs.m_hash;
 		return *this;
 	}
 #ifdef POSEIDON_CXX11
@@ -69,6 +100,7 @@ public:
 	template<typename T>
 	void assign(boost::shared_ptr<T> sp, const char *str){
 		m_ptr.reset(STD_MOVE_IDN(sp), str ? str : "");
+		m_hash = 0;
 	}
 
 	bool empty() const {
@@ -77,10 +109,18 @@ public:
 	const char *get() const {
 		return m_ptr.get();
 	}
+	bool is_interned() const NOEXCEPT {
+		return m_hash != 0;
+	}
+	// 与 compute_hash(get()) 相同，对于驻留的字符串不需要计算。
+	std::size_t get_hash() const NOEXCEPT {
+		return m_hash ? m_hash : compute_hash(get());
+	}
 
 	void swap(SharedNts &rhs) NOEXCEPT {
 		using std::swap;
 		swap(m_ptr, rhs.m_ptr);
+		swap(m_hash, rhs.m_hash);
 	}
 
 public:
@@ -90,6 +130,12 @@ public:
 };
 
 inline bool operator==(const SharedNts &lhs, const SharedNts &rhs){
+	if(lhs.get() == rhs.get()){
+		return true;
+	}
+	if(lhs.is_interned() && rhs.is_interned()){
+		return false;
+	}
 	return std::strcmp(lhs.get(), rhs.get()) == 0;
 }
 inline bool operator==(const SharedNts &lhs, const char *rhs){
@@ -106,7 +152,7 @@ inline bool operator==(const std::string &lhs, const SharedNts &rhs){
 }
 
 inline bool operator!=(const SharedNts &lhs, const SharedNts &rhs){
-	return std::strcmp(lhs.get(), rhs.get()) != 0;
+	return !(lhs == rhs);
 }
 inline bool operator!=(const SharedNts &lhs, const char *rhs){
 	return std::strcmp(lhs.get(), rhs) != 0;
@@ -122,7 +168,7 @@ inline bool operator!=(const std::string &lhs, const SharedNts &rhs){
 }
 
 inline bool operator<(const SharedNts &lhs, const SharedNts &rhs){
-	return std::strcmp(lhs.get(), rhs.get()) < 0;
+	return (lhs.get() != rhs.get()) && (std::strcmp(lhs.get(), rhs.get()) < 0);
 }
 inline bool operator<(const SharedNts &lhs, const char *rhs){
 	return std::strcmp(lhs.get(), rhs) < 0;
@@ -189,6 +235,10 @@ inline void swap(SharedNts &lhs, SharedNts &rhs) NOEXCEPT {
 	lhs.swap(rhs);
 }
 
+inline std::size_t hash_value(const SharedNts &rhs) NOEXCEPT {
+	return rhs.get_hash();
+}
+
 extern std::istream &operator>>(std::istream &is, SharedNts &rhs);
 extern std::ostream &operator<<(std::ostream &os, const SharedNts &rhs);
 
@@ -0,0 +1,302 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "shm_transport.hpp"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "log.hpp"
+#include "atomic.hpp"
+#include "profiler.hpp"
+#include "exception.hpp"
+#include "system_exception.hpp"
+
+namespace Poseidon {
+
+// 位置是单调递增的字节数，下标是位置对容量取模。head 只由读取的一端修改，tail 只由写入的一端修改。
+// 等待标记使用 Dekker 式的检查：一端先设置标记再检查位置，另一端先更新位置再检查标记，都使用顺序一致的内存模型。
+struct ShmTransport::RingControl {
+	volatile boost::uint64_t head;
+	unsigned char padding_head[56];
+	volatile boost::uint64_t tail;
+	unsigned char padding_tail[56];
+	volatile boost::uint32_t reader_waiting;
+	volatile boost::uint32_t writer_waiting;
+	volatile boost::uint32_t closed;
+	unsigned char padding_flags[52];
+};
+
+namespace {
+	CONSTEXPR const boost::uint32_t SHM_MAGIC = 0x4D485350; // "PSHM"
+	CONSTEXPR const boost::uint32_t SHM_VERSION = 1;
+	CONSTEXPR const std::size_t MIN_CAPACITY = 4096;
+	CONSTEXPR const std::size_t MAX_CAPACITY = 0x10000000;
+
+	struct Header {
+		boost::uint32_t magic;
+		boost::uint32_t version;
+		boost::uint64_t capacity;
+		unsigned char reserved[48];
+	};
+
+	struct HandshakeMessage {
+		boost::uint32_t magic;
+		boost::uint32_t version;
+	};
+
+	// 第一个环由发起连接的一端写入，第二个环由接受连接的一端写入。
+	std::size_t get_control_offset(unsigned index){
+		return sizeof(Header) + index * 192;
+	}
+	std::size_t get_data_offset(std::size_t capacity, unsigned index){
+		return get_control_offset(2) + index * capacity;
+	}
+}
+
+ShmTransport::ShmTransport(std::size_t capacity)
+	: m_base(NULLPTR), m_mapped(0), m_capacity(MIN_CAPACITY)
+{
+	BOOST_STATIC_ASSERT(sizeof(RingControl) == 192);
+	BOOST_STATIC_ASSERT(sizeof(Header) == 64);
+
+	while((m_capacity < capacity) && (m_capacity < MAX_CAPACITY)){
+		m_capacity *= 2;
+	}
+	DEBUG_THROW_UNLESS(m_memfd.reset(::memfd_create("poseidon-shm-transport", MFD_CLOEXEC | MFD_ALLOW_SEALING)), SystemException);
+	DEBUG_THROW_UNLESS(::ftruncate(m_memfd.get(), static_cast< ::off_t>(get_data_offset(m_capacity, 2))) == 0, SystemException);
+	// 对端依赖映射的大小不变，否则访问被截断的部分会收到 SIGBUS。
+	DEBUG_THROW_UNLESS(::fcntl(m_memfd.get(), F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0, SystemException);
+	map_and_bind(DIR_TO_CONNECT);
+
+	// ftruncate() 得到的内容全部为零，因此只需要填写头部。
+	Header &header = *static_cast<Header *>(m_base);
+	header.magic = SHM_MAGIC;
+	header.version = SHM_VERSION;
+	header.capacity = m_capacity;
+}
+ShmTransport::ShmTransport(Move<UniqueFile> memfd)
+	: m_memfd(STD_MOVE(memfd)), m_base(NULLPTR), m_mapped(0), m_capacity(0)
+{
+	const int seals = ::fcntl(m_memfd.get(), F_GET_SEALS);
+	DEBUG_THROW_UNLESS(seals != -1, SystemException);
+	DEBUG_THROW_UNLESS((seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) == (F_SEAL_SHRINK | F_SEAL_SEAL), Exception, sslit("Shared memory is not sealed"));
+	Header header;
+	DEBUG_THROW_UNLESS(::pread(m_memfd.get(), &header, sizeof(header), 0) == static_cast< ::ssize_t>(sizeof(header)), Exception, sslit("Shared memory is too small"));
+	DEBUG_THROW_UNLESS((header.magic == SHM_MAGIC) && (header.version == SHM_VERSION), Exception, sslit("Shared memory header mismatch"));
+	DEBUG_THROW_UNLESS((header.capacity >= MIN_CAPACITY) && (header.capacity <= MAX_CAPACITY) && ((header.capacity & (header.capacity - 1)) == 0), Exception, sslit("Invalid shared memory capacity"));
+	m_capacity = static_cast<std::size_t>(header.capacity);
+	struct ::stat stat_buf;
+	DEBUG_THROW_UNLESS(::fstat(m_memfd.get(), &stat_buf) == 0, SystemException);
+	DEBUG_THROW_UNLESS(static_cast<boost::uint64_t>(stat_buf.st_size) >= get_data_offset(m_capacity, 2), Exception, sslit("Shared memory is too small"));
+	map_and_bind(DIR_TO_ACCEPT);
+}
+ShmTransport::~ShmTransport(){
+	if(m_base){
+		::munmap(m_base, m_mapped);
+	}
+}
+
+void ShmTransport::map_and_bind(Direction dir){
+	const std::size_t size = get_data_offset(m_capacity, 2);
+	void *const base = ::mmap(NULLPTR, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd.get(), 0);
+	DEBUG_THROW_UNLESS(base != MAP_FAILED, SystemException);
+	m_base = base;
+	m_mapped = size;
+
+	unsigned char *const bytes = static_cast<unsigned char *>(base);
+	const unsigned tx_index = (dir == DIR_TO_CONNECT) ? 0 : 1;
+	m_tx_control = reinterpret_cast<RingControl *>(bytes + get_control_offset(tx_index));
+	m_tx_data = bytes + get_data_offset(m_capacity, tx_index);
+	m_rx_control = reinterpret_cast<RingControl *>(bytes + get_control_offset(1 - tx_index));
+	m_rx_data = bytes + get_data_offset(m_capacity, 1 - tx_index);
+}
+void ShmTransport::ring_peer_doorbell() NOEXCEPT {
+	const boost::uint64_t one = 1;
+	if(::write(m_peer_doorbell.get(), &one, sizeof(one)) < 0){
+		const int err_code = errno;
+		// 计数器溢出（EAGAIN）说明对端已经有很多次未处理的通知，可以忽略。
+		if(err_code != EAGAIN){
+			LOG_POSEIDON_WARNING("Failed to ring shared memory doorbell: err_code = ", err_code);
+		}
+	}
+}
+
+void ShmTransport::set_peer_doorbell(Move<UniqueFile> doorbell){
+	m_peer_doorbell = STD_MOVE(doorbell);
+	// 对端可能在此之前就开始等待了。
+	if(atomic_load(m_tx_control->reader_waiting, ATOMIC_SEQ_CST) && atomic_exchange(m_tx_control->reader_waiting, 0u, ATOMIC_SEQ_CST)){
+		ring_peer_doorbell();
+	}
+	if(atomic_load(m_rx_control->writer_waiting, ATOMIC_SEQ_CST) && atomic_exchange(m_rx_control->writer_waiting, 0u, ATOMIC_SEQ_CST)){
+		ring_peer_doorbell();
+	}
+}
+
+long ShmTransport::recv(void *data, unsigned long size){
+	PROFILE_ME;
+
+	RingControl &ctl = *m_rx_control;
+	const AUTO(head, ctl.head);
+	bool closed = atomic_load(ctl.closed, ATOMIC_ACQUIRE);
+	AUTO(tail, atomic_load(ctl.tail, ATOMIC_ACQUIRE));
+	if(tail == head){
+		atomic_store(ctl.reader_waiting, 1u, ATOMIC_SEQ_CST);
+		closed = atomic_load(ctl.closed, ATOMIC_SEQ_CST);
+		tail = atomic_load(ctl.tail, ATOMIC_SEQ_CST);
+		if(tail == head){
+			if(closed){
+				return 0;
+			}
+			errno = EAGAIN;
+			return -1;
+		}
+		atomic_store(ctl.reader_waiting, 0u, ATOMIC_RELAXED);
+	}
+	// 对端可以任意修改共享内存，不能信任它写入的位置。
+	if(tail - head > m_capacity){
+		errno = EPROTO;
+		return -1;
+	}
+	const std::size_t count = static_cast<std::size_t>(std::min<boost::uint64_t>(tail - head, size));
+	const std::size_t offset = static_cast<std::size_t>(head & (m_capacity - 1));
+	const std::size_t first = std::min(count, m_capacity - offset);
+	std::memcpy(data, m_rx_data + offset, first);
+	std::memcpy(static_cast<unsigned char *>(data) + first, m_rx_data, count - first);
+	atomic_store(ctl.head, head + count, ATOMIC_SEQ_CST);
+
+	if(m_peer_doorbell && atomic_load(ctl.writer_waiting, ATOMIC_SEQ_CST) && atomic_exchange(ctl.writer_waiting, 0u, ATOMIC_SEQ_CST)){
+		ring_peer_doorbell();
+	}
+	return static_cast<long>(count);
+}
+long ShmTransport::send(const ::iovec *vecs, std::size_t count){
+	PROFILE_ME;
+
+	RingControl &ctl = *m_tx_control;
+	const AUTO(tail, ctl.tail);
+	AUTO(head, atomic_load(ctl.head, ATOMIC_ACQUIRE));
+	if(tail - head > m_capacity){
+		errno = EPROTO;
+		return -1;
+	}
+	if(tail - head == m_capacity){
+		atomic_store(ctl.writer_waiting, 1u, ATOMIC_SEQ_CST);
+		head = atomic_load(ctl.head, ATOMIC_SEQ_CST);
+		if(tail - head == m_capacity){
+			errno = EAGAIN;
+			return -1;
+		}
+		atomic_store(ctl.writer_waiting, 0u, ATOMIC_RELAXED);
+	}
+	std::size_t avail = static_cast<std::size_t>(m_capacity - (tail - head));
+	std::size_t written = 0;
+	for(std::size_t i = 0; (i < count) && (avail != 0); ++i){
+		const unsigned char *src = static_cast<const unsigned char *>(vecs[i].iov_base);
+		std::size_t remaining = std::min(vecs[i].iov_len, avail);
+		avail -= remaining;
+		while(remaining != 0){
+			const std::size_t offset = static_cast<std::size_t>((tail + written) & (m_capacity - 1));
+			const std::size_t chunk = std::min(remaining, m_capacity - offset);
+			std::memcpy(m_tx_data + offset, src, chunk);
+			src += chunk;
+			remaining -= chunk;
+			written += chunk;
+		}
+	}
+	atomic_store(ctl.tail, tail + written, ATOMIC_SEQ_CST);
+
+	if(m_peer_doorbell && atomic_load(ctl.reader_waiting, ATOMIC_SEQ_CST) && atomic_exchange(ctl.reader_waiting, 0u, ATOMIC_SEQ_CST)){
+		ring_peer_doorbell();
+	}
+	return static_cast<long>(written);
+}
+void ShmTransport::send_fin() NOEXCEPT {
+	RingControl &ctl = *m_tx_control;
+	atomic_store(ctl.closed, 1u, ATOMIC_SEQ_CST);
+	if(m_peer_doorbell && atomic_exchange(ctl.reader_waiting, 0u, ATOMIC_SEQ_CST)){
+		ring_peer_doorbell();
+	}
+}
+
+void ShmTransport::send_handshake(int fd, int memfd, int doorbell){
+	PROFILE_ME;
+
+	HandshakeMessage hello = { SHM_MAGIC, SHM_VERSION };
+	::iovec vec;
+	vec.iov_base = &hello;
+	vec.iov_len = sizeof(hello);
+	union {
+		::cmsghdr align;
+		char data[CMSG_SPACE(sizeof(int) * 2)];
+	} control;
+	const int fds[2] = { doorbell, memfd };
+	const std::size_t fd_count = (memfd >= 0) ? 2 : 1;
+	::msghdr msg = { };
+	msg.msg_iov = &vec;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+	::cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+	std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+	// 握手消息很短，而且是套接字上的第一个消息，一定能立即写入。
+	const AUTO(result, ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT));
+	DEBUG_THROW_UNLESS(result >= 0, SystemException);
+	DEBUG_THROW_UNLESS(result == static_cast< ::ssize_t>(sizeof(hello)), Exception, sslit("Shared memory handshake was truncated"));
+}
+int ShmTransport::recv_handshake(int fd, UniqueFile &memfd, UniqueFile &doorbell){
+	PROFILE_ME;
+
+	HandshakeMessage hello;
+	::iovec vec;
+	vec.iov_base = &hello;
+	vec.iov_len = sizeof(hello);
+	union {
+		::cmsghdr align;
+		char data[CMSG_SPACE(sizeof(int) * 2)];
+	} control;
+	::msghdr msg = { };
+	msg.msg_iov = &vec;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+	const AUTO(result, ::recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC));
+	if(result < 0){
+		return errno;
+	}
+	if(result == 0){
+		return ECONNRESET;
+	}
+	// 先接管所有描述符，这样出错时它们也会被关闭。
+	UniqueFile fds[2];
+	std::size_t fd_count = 0;
+	for(::cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+		if((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)){
+			continue;
+		}
+		const std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for(std::size_t i = 0; i < count; ++i){
+			int passed;
+			std::memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if(fd_count < 2){
+				fds[fd_count++].reset(passed);
+			} else {
+				::close(passed);
+			}
+		}
+	}
+	DEBUG_THROW_UNLESS(!(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)), Exception, sslit("Shared memory handshake was truncated"));
+	DEBUG_THROW_UNLESS((result == static_cast< ::ssize_t>(sizeof(hello))) && (hello.magic == SHM_MAGIC) && (hello.version == SHM_VERSION), Exception, sslit("Shared memory handshake mismatch"));
+	DEBUG_THROW_UNLESS(fd_count != 0, Exception, sslit("No doorbell in shared memory handshake"));
+	doorbell.swap(fds[0]);
+	memfd.swap(fds[1]);
+	return 0;
+}
+
+}
@@ -0,0 +1,82 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SHM_TRANSPORT_HPP_
+#define POSEIDON_SHM_TRANSPORT_HPP_
+
+#include "cxx_ver.hpp"
+#include "cxx_util.hpp"
+#include "raii.hpp"
+#include <cstddef>
+#include <sys/uio.h>
+
+namespace Poseidon {
+
+// 同一台机器上两个进程之间的共享内存传输，用来代替 Unix 域套接字的数据通道。
+// 发起连接的一端创建一个 memfd，其中有两个单生产者单消费者的环形缓冲区，每个方向一个；
+// 每一端各有一个 eventfd 门铃，只有对端正在等待数据或者空间时才需要敲响，因此连续收发时没有系统调用。
+// 套接字本身只用于握手时传递描述符（SCM_RIGHTS），以及在对端进程退出时通知 epoll。
+class ShmTransport : NONCOPYABLE {
+public:
+	enum Direction {
+		DIR_UNSPECIFIED = 0,
+		DIR_TO_CONNECT  = 1,
+		DIR_TO_ACCEPT   = 2,
+	};
+
+private:
+	struct RingControl;
+
+private:
+	UniqueFile m_memfd;
+	void *m_base;
+	std::size_t m_mapped;
+	std::size_t m_capacity;
+
+	RingControl *m_rx_control;
+	unsigned char *m_rx_data;
+	RingControl *m_tx_control;
+	unsigned char *m_tx_data;
+
+	UniqueFile m_peer_doorbell;
+
+public:
+	// 发起连接的一端创建共享内存，每个方向的容量向上取整到 2 的幂。
+	explicit ShmTransport(std::size_t capacity);
+	// 接受连接的一端映射对端发来的共享内存。
+	explicit ShmTransport(Move<UniqueFile> memfd);
+	~ShmTransport();
+
+private:
+	void map_and_bind(Direction dir);
+	void ring_peer_doorbell() NOEXCEPT;
+
+public:
+	int get_memfd() const {
+		return m_memfd.get();
+	}
+	std::size_t get_capacity() const {
+		return m_capacity;
+	}
+
+	bool has_peer_doorbell() const {
+		return !!m_peer_doorbell;
+	}
+	// 握手完成时调用。在此之前对端不会因为这一端写入数据而被唤醒。
+	void set_peer_doorbell(Move<UniqueFile> doorbell);
+
+	// 和 ::recv() 一样，没有数据时返回 -1 并设置 errno 为 EAGAIN，对端关闭写入之后返回 0。
+	long recv(void *data, unsigned long size);
+	// 和 ::sendmsg() 一样，可能只写入一部分；缓冲区满时返回 -1 并设置 errno 为 EAGAIN。
+	long send(const ::iovec *vecs, std::size_t count);
+	void send_fin() NOEXCEPT;
+
+	// 握手消息，附带一个或两个描述符：发起连接的一端发送 memfd 和自己的门铃，接受连接的一端只回复自己的门铃。
+	static void send_handshake(int fd, int memfd, int doorbell);
+	// 成功返回 0；握手消息尚未到达返回 EWOULDBLOCK；对端关闭连接返回 ECONNRESET。格式错误抛出异常。
+	static int recv_handshake(int fd, UniqueFile &memfd, UniqueFile &doorbell);
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "../precompiled.hpp"
 #include "dns_daemon.hpp"
+#include "main_config.hpp"
 #include <netdb.h>
 #include <unistd.h>
 #include "../log.hpp"
@@ -14,10 +15,13 @@
 #include "../ip_port.hpp"
 #include "../raii.hpp"
 #include "../profiler.hpp"
+#include "../time.hpp"
+#include "../checked_arithmetic.hpp"
 
 namespace Poseidon {
 
 template class PromiseContainer<SockAddr>;
+template class PromiseContainer<boost::container::vector<SockAddr> >;
 
 namespace {
 	struct AddrinfoFreeer {
@@ -29,7 +33,7 @@ namespace {
 		}
 	};
 
-	SockAddr real_dns_look_up(const std::string &host_raw, boost::uint16_t port_raw){
+	boost::container::vector<SockAddr> real_dns_look_up_all(const std::string &host_raw, boost::uint16_t port_raw){
 		UniqueHandle<AddrinfoFreeer> res;
 		std::string host;
 		if(!host_raw.empty() && (host_raw.begin()[0] == '[') && (host_raw.end()[-1] == ']')){
@@ -39,8 +43,12 @@ namespace {
 		}
 		char port[16];
 		std::sprintf(port, "%u", port_raw);
+		// 不指定套接字类型的话每个地址会按照 SOCK_STREAM、SOCK_DGRAM 和 SOCK_RAW 各返回一次。
+		::addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_STREAM;
 		::addrinfo *tmp_res;
-		const int gai_code = ::getaddrinfo(host.c_str(), port, NULLPTR, &tmp_res);
+		const int gai_code = ::getaddrinfo(host.c_str(), port, &hints, &tmp_res);
 		if(gai_code != 0){
 			const char *const err_msg = ::gai_strerror(gai_code);
 			LOG_POSEIDON_DEBUG("DNS lookup failure: host:port = ", host, ":", port, ", gai_code = ", gai_code, ", err_msg = ", err_msg);
@@ -48,43 +56,109 @@ namespace {
 		}
 		res.reset(tmp_res);
 
-		SockAddr sock_addr(res.get()->ai_addr, res.get()->ai_addrlen);
-		LOG_POSEIDON_DEBUG("DNS lookup success: host:port = ", host, ":", port, ", result = ", IpPort(sock_addr));
-		return sock_addr;
+		// getaddrinfo() 已经按照 RFC 6724 排好了序，这里只是把两个地址族交替排列。
+		boost::container::vector<SockAddr> preferred, others;
+		const int preferred_family = res.get()->ai_family;
+		for(const ::addrinfo *ai = res.get(); ai; ai = ai->ai_next){
+			AUTO_REF(list, (ai->ai_family == preferred_family) ? preferred : others);
+			bool duplicate = false;
+			for(AUTO(it, list.begin()); it != list.end(); ++it){
+				if((it->size() == ai->ai_addrlen) && (std::memcmp(it->data(), ai->ai_addr, ai->ai_addrlen) == 0)){
+					duplicate = true;
+					break;
+				}
+			}
+			if(duplicate){
+				continue;
+			}
+			list.push_back(SockAddr(ai->ai_addr, ai->ai_addrlen));
+		}
+		boost::container::vector<SockAddr> sock_addrs;
+		sock_addrs.reserve(preferred.size() + others.size());
+		for(std::size_t i = 0; i < std::max(preferred.size(), others.size()); ++i){
+			if(i < preferred.size()){
+				sock_addrs.push_back(preferred.at(i));
+			}
+			if(i < others.size()){
+				sock_addrs.push_back(others.at(i));
+			}
+		}
+		LOG_POSEIDON_DEBUG("DNS lookup success: host:port = ", host, ":", port, ", first = ", IpPort(sock_addrs.front()), ", count = ", sock_addrs.size());
+		return sock_addrs;
+	}
+	SockAddr real_dns_look_up(const std::string &host, boost::uint16_t port){
+		return real_dns_look_up_all(host, port).front();
 	}
 
 	volatile bool g_running = false;
-	Thread g_thread;
+	boost::container::vector<boost::shared_ptr<Thread> > g_threads;
+
+	// 只在 DnsDaemon::start() 中设置。
+	boost::uint64_t g_cache_ttl = 0;
+	boost::uint64_t g_negative_cache_ttl = 0;
+	std::size_t g_cache_max_entries = 0;
 
 	struct RequestElement {
-		boost::weak_ptr<PromiseContainer<SockAddr> > weak_promise;
+		boost::shared_ptr<PromiseContainer<SockAddr> > promise;
+		boost::shared_ptr<PromiseContainer<boost::container::vector<SockAddr> > > promise_all;
+		std::string key;
 		std::string host;
 		boost::uint16_t port;
 	};
 
+	// 每个 host:port 对应一个元素。正在解析时 expiry_time 为 UINT64_MAX，相同的请求共享同一个 Promise；
+	// 解析完成之后结果（包括失败）被保留到 expiry_time。两个 Promise 由同一次解析设置，promise 只保存第一个地址。
+	struct CacheElement {
+		boost::shared_ptr<const PromiseContainer<SockAddr> > promise;
+		boost::shared_ptr<const PromiseContainer<boost::container::vector<SockAddr> > > promise_all;
+		boost::uint64_t expiry_time;
+	};
+
 	Mutex g_mutex;
 	ConditionVariable g_new_request;
 	boost::container::deque<RequestElement> g_queue;
+	boost::container::map<std::string, CacheElement> g_cache;
+
+	std::string make_cache_key(const std::string &host, boost::uint16_t port){
+		std::string key;
+		key.reserve(host.size() + 8);
+		key += host;
+		char str[16];
+		key.append(str, (unsigned)std::sprintf(str, ":%u", port));
+		return key;
+	}
+
+	// 调用者必须持有 g_mutex。
+	void shrink_cache(boost::uint64_t now){
+		if(g_cache.size() < g_cache_max_entries){
+			return;
+		}
+		AUTO(it, g_cache.begin());
+		while(it != g_cache.end()){
+			if(now < it->second.expiry_time){
+				++it;
+				continue;
+			}
+			it = g_cache.erase(it);
+		}
+	}
 
 	bool pump_one_element() NOEXCEPT {
 		PROFILE_ME;
 
-		RequestElement *elem;
+		RequestElement elem;
 		{
 			const Mutex::UniqueLock lock(g_mutex);
 			if(g_queue.empty()){
 				return false;
 			}
-			if(g_queue.front().weak_promise.expired()){
-				g_queue.pop_front();
-				return true;
-			}
-			elem = &g_queue.front();
+			elem = STD_MOVE(g_queue.front());
+			g_queue.pop_front();
 		}
-		SockAddr sock_addr;
+		boost::container::vector<SockAddr> sock_addrs;
 		STD_EXCEPTION_PTR except;
 		try {
-			sock_addr = real_dns_look_up(elem->host, elem->port);
+			sock_addrs = real_dns_look_up_all(elem.host, elem.port);
 		} catch(std::exception &e){
 			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
 			except = STD_CURRENT_EXCEPTION();
@@ -92,22 +166,31 @@ namespace {
 			LOG_POSEIDON_WARNING("Unknown exception thrown.");
 			except = STD_CURRENT_EXCEPTION();
 		}
-		const AUTO(promise, elem->weak_promise.lock());
-		if(promise){
-			if(except){
-				promise->set_exception(STD_MOVE(except), false);
+		if(except){
+			elem.promise->set_exception(except, false);
+			elem.promise_all->set_exception(STD_MOVE(except), false);
+		} else {
+			elem.promise->set_success(sock_addrs.front(), false);
+			elem.promise_all->set_success(STD_MOVE(sock_addrs), false);
+		}
+
+		const AUTO(now, get_fast_mono_clock());
+		const AUTO(ttl, elem.promise->would_throw() ? g_negative_cache_ttl : g_cache_ttl);
+		const Mutex::UniqueLock lock(g_mutex);
+		const AUTO(it, g_cache.find(elem.key));
+		if((it != g_cache.end()) && (it->second.promise == elem.promise)){
+			if((ttl == 0) || (g_cache.size() > g_cache_max_entries)){
+				g_cache.erase(it);
 			} else {
-				promise->set_success(STD_MOVE(sock_addr), false);
+				it->second.expiry_time = saturated_add(now, ttl);
 			}
 		}
-		const Mutex::UniqueLock lock(g_mutex);
-		g_queue.pop_front();
 		return true;
 	}
 
 	void thread_proc(){
 		PROFILE_ME;
-		LOG_POSEIDON_INFO("DNS daemon started.");
+		LOG_POSEIDON_INFO("DNS thread started.");
 
 		unsigned timeout = 0;
 		for(;;){
@@ -124,7 +207,7 @@ namespace {
 			g_new_request.timed_wait(lock, timeout);
 		}
 
-		LOG_POSEIDON_INFO("DNS daemon stopped.");
+		LOG_POSEIDON_INFO("DNS thread stopped.");
 	}
 }
 
@@ -135,7 +218,17 @@ void DnsDaemon::start(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting DNS daemon...");
 
-	Thread(&thread_proc, sslit("   D"), sslit("DNS")).swap(g_thread);
+	g_cache_ttl = MainConfig::get<boost::uint64_t>("dns_cache_ttl", 60000);
+	g_negative_cache_ttl = MainConfig::get<boost::uint64_t>("dns_negative_cache_ttl", 5000);
+	g_cache_max_entries = MainConfig::get<std::size_t>("dns_cache_max_entries", 4096);
+	// 一个缓慢的查询只会阻塞一个线程。
+	const AUTO(thread_count, std::max<std::size_t>(MainConfig::get<std::size_t>("dns_thread_count", 4), 1));
+	LOG_POSEIDON_DEBUG("DNS daemon: thread_count = ", thread_count, ", cache_ttl = ", g_cache_ttl, ", negative_cache_ttl = ", g_negative_cache_ttl);
+	for(std::size_t i = 0; i < thread_count; ++i){
+		g_threads.push_back(boost::make_shared<Thread>(&thread_proc, sslit("   D"), sslit("DNS")));
+	}
+
+	LOG_POSEIDON_INFO("DNS daemon started.");
 }
 void DnsDaemon::stop(){
 	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
@@ -143,29 +236,92 @@ void DnsDaemon::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping DNS daemon...");
 
-	if(g_thread.joinable()){
-		g_thread.join();
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		g_new_request.broadcast();
+	}
+	for(AUTO(it, g_threads.begin()); it != g_threads.end(); ++it){
+		if((*it)->joinable()){
+			(*it)->join();
+		}
 	}
+	g_threads.clear();
 	g_queue.clear();
+	g_cache.clear();
+
+	LOG_POSEIDON_INFO("DNS daemon stopped.");
 }
 
 SockAddr DnsDaemon::look_up(const std::string &host, boost::uint16_t port){
 	PROFILE_ME;
 
+	// 只使用已经完成的缓存结果，不等待正在进行的解析。
+	const AUTO(key, make_cache_key(host, port));
+	const AUTO(now, get_fast_mono_clock());
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		const AUTO(it, g_cache.find(key));
+		if((it != g_cache.end()) && (now < it->second.expiry_time) && it->second.promise->is_satisfied()){
+			return it->second.promise->get();
+		}
+	}
 	return real_dns_look_up(host, port);
 }
 
-boost::shared_ptr<const PromiseContainer<SockAddr> > DnsDaemon::enqueue_for_looking_up(std::string host, boost::uint16_t port){
+boost::container::vector<SockAddr> DnsDaemon::look_up_all(const std::string &host, boost::uint16_t port){
 	PROFILE_ME;
 
-	AUTO(promise, boost::make_shared<PromiseContainer<SockAddr> >());
+	const AUTO(key, make_cache_key(host, port));
+	const AUTO(now, get_fast_mono_clock());
 	{
 		const Mutex::UniqueLock lock(g_mutex);
-		RequestElement elem = { promise, STD_MOVE(host), port };
+		const AUTO(it, g_cache.find(key));
+		if((it != g_cache.end()) && (now < it->second.expiry_time) && it->second.promise_all->is_satisfied()){
+			return it->second.promise_all->get();
+		}
+	}
+	return real_dns_look_up_all(host, port);
+}
+
+namespace {
+	// 调用者必须持有 g_mutex。
+	const CacheElement &find_or_enqueue_unlocked(std::string host, boost::uint16_t port){
+		AUTO(key, make_cache_key(host, port));
+		const AUTO(now, get_fast_mono_clock());
+		AUTO(it, g_cache.find(key));
+		if((it != g_cache.end()) && (now < it->second.expiry_time)){
+			LOG_POSEIDON_TRACE("DNS cache hit: key = ", key);
+			return it->second;
+		}
+		shrink_cache(now);
+		AUTO(promise, boost::make_shared<PromiseContainer<SockAddr> >());
+		AUTO(promise_all, boost::make_shared<PromiseContainer<boost::container::vector<SockAddr> > >());
+		CacheElement cache_elem = { promise, promise_all, UINT64_MAX };
+		AUTO_REF(cache_ref, g_cache[key]);
+		cache_ref = STD_MOVE(cache_elem);
+		RequestElement elem = { STD_MOVE(promise), STD_MOVE(promise_all), STD_MOVE(key), STD_MOVE(host), port };
 		g_queue.push_back(STD_MOVE(elem));
 		g_new_request.signal();
+		return cache_ref;
 	}
-	return STD_MOVE_IDN(promise);
+}
+
+boost::shared_ptr<const PromiseContainer<SockAddr> > DnsDaemon::enqueue_for_looking_up(std::string host, boost::uint16_t port){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(g_mutex);
+	return find_or_enqueue_unlocked(STD_MOVE(host), port).promise;
+}
+boost::shared_ptr<const PromiseContainer<boost::container::vector<SockAddr> > > DnsDaemon::enqueue_for_looking_up_all(std::string host, boost::uint16_t port){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(g_mutex);
+	return find_or_enqueue_unlocked(STD_MOVE(host), port).promise_all;
+}
+
+std::size_t DnsDaemon::get_queue_size(){
+	const Mutex::UniqueLock lock(g_mutex);
+	return g_queue.size();
 }
 
 }
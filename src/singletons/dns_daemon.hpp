@@ -5,6 +5,7 @@
 #define POSEIDON_SINGLETONS_DNS_DAEMON_HPP_
 
 #include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
 #include <string>
 #include "../sock_addr.hpp"
 #include "../promise.hpp"
@@ -12,6 +13,7 @@
 namespace Poseidon {
 
 extern template class PromiseContainer<SockAddr>;
+extern template class PromiseContainer<boost::container::vector<SockAddr> >;
 
 class DnsDaemon {
 private:
@@ -23,9 +25,15 @@ public:
 
 	// 同步接口。
 	static SockAddr look_up(const std::string &host, boost::uint16_t port);
+	// 返回所有地址。按照 RFC 8305 交替排列 IPv6 和 IPv4 地址，首选 getaddrinfo() 返回的第一个地址所属的地址族。
+	static boost::container::vector<SockAddr> look_up_all(const std::string &host, boost::uint16_t port);
 
 	// 异步接口。
 	static boost::shared_ptr<const PromiseContainer<SockAddr> > enqueue_for_looking_up(std::string host, boost::uint16_t port);
+	static boost::shared_ptr<const PromiseContainer<boost::container::vector<SockAddr> > > enqueue_for_looking_up_all(std::string host, boost::uint16_t port);
+
+	// 等待解析的请求数。
+	static std::size_t get_queue_size();
 };
 
 }
@@ -4,10 +4,21 @@
 #include "../precompiled.hpp"
 #include "epoll_daemon.hpp"
 #include "main_config.hpp"
+#include "job_dispatcher.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+// 较旧的内核头文件没有 io_uring 或者其中的多发 POLL_ADD 等定义，此时只编译 epoll 的实现。
+#ifdef __has_include
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#  endif
+#else
+#  include <linux/io_uring.h>
+#endif
 #include "../thread.hpp"
 #include "../log.hpp"
 #include "../atomic.hpp"
@@ -16,7 +27,6 @@
 #include "../profiler.hpp"
 #include "../recursive_mutex.hpp"
 #include "../raii.hpp"
-#include "../multi_index_map.hpp"
 #include "../checked_arithmetic.hpp"
 #include "../system_exception.hpp"
 #include "../errno.hpp"
@@ -25,14 +35,12 @@
 namespace Poseidon {
 
 namespace {
-	volatile bool g_running = false;
-	Thread g_thread;
-
+	// 没有所有权的套接字在析构时调用 EpollDaemon::remove_socket() 注销自己，此后描述符被关闭，内核自动将其从 epoll 中删除。
+	// 在此之前已经取出的事件携带的 generation 在表中找不到，因而被忽略，即使新的套接字重用了同一个地址或者描述符。
 	class WeakableSocket {
 	private:
 		boost::shared_ptr<SocketBase> m_strong;
 		boost::weak_ptr<SocketBase> m_weak;
-		UniqueFile m_dup_fd;
 
 	public:
 		WeakableSocket(bool owning, const boost::shared_ptr<SocketBase> &socket){
@@ -40,7 +48,6 @@ namespace {
 				m_strong = socket;
 			} else {
 				m_weak = socket;
-				DEBUG_THROW_ASSERT(m_dup_fd.reset(::dup(socket->get_fd())));
 			}
 		}
 
@@ -50,265 +57,924 @@ namespace {
 		}
 	};
 
-	struct SocketElement {
-		boost::shared_ptr<const WeakableSocket> weakable;
+	struct SocketElement : NONCOPYABLE {
+		const boost::shared_ptr<const WeakableSocket> weakable;
+		const SocketBase *const ptr;
+		const boost::uint64_t generation;
 
-		const SocketBase *ptr;
-		boost::uint64_t read_time;
-		boost::uint64_t write_time;
+		bool erased;
+		bool readable;
+		bool writeable;
 		int err_code;
 
-		mutable bool readable;
-		mutable bool writeable;
+		bool read_queued;
+		bool read_deferred;
+		bool write_queued;
+		bool close_queued;
 
-		SocketElement(bool owning, const boost::shared_ptr<SocketBase> &socket, boost::uint64_t now)
-			: weakable(boost::make_shared<WeakableSocket>(owning, socket))
-			, ptr(socket.get()), read_time(now), write_time(now), err_code(-1)
-			, readable(false), writeable(false)
+		SocketElement(bool owning, const boost::shared_ptr<SocketBase> &socket, boost::uint64_t generation_)
+			: weakable(boost::make_shared<WeakableSocket>(owning, socket)), ptr(socket.get()), generation(generation_)
+			, erased(false), readable(false), writeable(false), err_code(-1)
+			, read_queued(false), read_deferred(false), write_queued(false), close_queued(false)
 		{ }
 	};
-	MULTI_INDEX_MAP(SocketMap, SocketElement,
-		UNIQUE_MEMBER_INDEX(ptr)
-		MULTI_MEMBER_INDEX(read_time)
-		MULTI_MEMBER_INDEX(write_time)
-		MULTI_MEMBER_INDEX(err_code)
-	);
-
-	RecursiveMutex g_mutex;
-	UniqueFile g_epoll;
-	SocketMap g_socket_map;
-
-	bool wait_for_sockets(unsigned timeout) NOEXCEPT {
-		PROFILE_ME;
-
-		boost::array< ::epoll_event, 256> events;
-		const int result = ::epoll_wait(g_epoll.get(), events.data(), static_cast<int>(events.size()), static_cast<int>(std::min<unsigned>(timeout, INT_MAX)));
-		if(result < 0){
-			const int err_code = errno;
-			if(err_code != EINTR){
-				LOG_POSEIDON_ERROR("::epoll_wait() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+
+	// 以 generation 为键，也就是 epoll 事件中的 data.u64。
+	typedef boost::container::map<boost::uint64_t, boost::shared_ptr<SocketElement> > SocketMap;
+	// 就绪队列，每个套接字在同一个队列中最多出现一次。
+	typedef boost::container::deque<boost::shared_ptr<SocketElement> > ReadyQueue;
+	// 被节流的套接字总是推迟相同的时间，因此按入队顺序即按到期时间排序。
+	typedef boost::container::deque<std::pair<boost::uint64_t, boost::shared_ptr<SocketElement> > > DeferredQueue;
+
+	struct PumpElement {
+		boost::shared_ptr<SocketElement> element;
+		boost::shared_ptr<SocketBase> socket;
+		bool flag;
+		bool requeue;
+		bool throttled;
+		bool backlogged;
+	};
+
+#ifdef IORING_FEAT_CQE_SKIP
+	// io_uring 只用于就绪通知：每个套接字挂一个多发（multishot）的 POLL_ADD，
+	// 读写仍由套接字的 poll_read_and_process() 和 poll_write() 自己完成。
+	// 提交队列的访问须由调用者加锁，完成队列只由所属的线程消费。
+	class IoUring : NONCOPYABLE {
+	private:
+		UniqueFile m_fd;
+		void *m_rings;
+		std::size_t m_rings_size;
+		::io_uring_sqe *m_sqes;
+		std::size_t m_sqes_size;
+
+		volatile unsigned *m_sq_head;
+		volatile unsigned *m_sq_tail;
+		volatile unsigned *m_sq_flags;
+		unsigned *m_sq_array;
+		unsigned m_sq_mask;
+		unsigned m_sq_entries;
+		volatile unsigned *m_cq_head;
+		volatile unsigned *m_cq_tail;
+		::io_uring_cqe *m_cqes;
+		unsigned m_cq_mask;
+
+		unsigned m_to_submit;
+
+	public:
+		IoUring()
+			: m_fd(), m_rings(MAP_FAILED), m_rings_size(0), m_sqes(static_cast< ::io_uring_sqe *>(MAP_FAILED)), m_sqes_size(0)
+			, m_sq_head(NULLPTR), m_sq_tail(NULLPTR), m_sq_flags(NULLPTR), m_sq_array(NULLPTR), m_sq_mask(0), m_sq_entries(0)
+			, m_cq_head(NULLPTR), m_cq_tail(NULLPTR), m_cqes(NULLPTR), m_cq_mask(0)
+			, m_to_submit(0)
+		{ }
+		~IoUring(){
+			if(m_sqes != MAP_FAILED){
+				::munmap(m_sqes, m_sqes_size);
+			}
+			if(m_rings != MAP_FAILED){
+				::munmap(m_rings, m_rings_size);
 			}
+		}
+
+	private:
+		::io_uring_sqe *acquire_sqe() NOEXCEPT {
+			const unsigned tail = *m_sq_tail;
+			if(tail - atomic_load(*m_sq_head, ATOMIC_ACQUIRE) >= m_sq_entries){
+				// 提交队列满了，先提交一次。
+				if((submit() < 0) || (tail - atomic_load(*m_sq_head, ATOMIC_ACQUIRE) >= m_sq_entries)){
+					return NULLPTR;
+				}
+			}
+			const unsigned index = tail & m_sq_mask;
+			const AUTO(sqe, m_sqes + index);
+			std::memset(sqe, 0, sizeof(*sqe));
+			m_sq_array[index] = index;
+			return sqe;
+		}
+		void commit_sqe() NOEXCEPT {
+			atomic_store(*m_sq_tail, *m_sq_tail + 1, ATOMIC_RELEASE);
+			++m_to_submit;
+		}
+
+	public:
+		bool open(unsigned entries) NOEXCEPT {
+			::io_uring_params params = { };
+			params.flags = IORING_SETUP_CLAMP;
+			if(!m_fd.reset(static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params)))){
+				const int err_code = errno;
+				LOG_POSEIDON_WARNING("::io_uring_setup() failed: err_code = ", err_code, " (", get_error_desc(err_code), ")");
+				return false;
+			}
+			// 多发 POLL_ADD 需要 5.13 以上的内核，这里以同时期的 IORING_FEAT_CQE_SKIP 作为判断依据。
+			const boost::uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_CQE_SKIP;
+			if((params.features & required) != required){
+				LOG_POSEIDON_WARNING("io_uring lacks required features: features = ", params.features);
+				return false;
+			}
+			m_rings_size = std::max<std::size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned), params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe));
+			m_rings = ::mmap(NULLPTR, m_rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd.get(), static_cast< ::off_t>(IORING_OFF_SQ_RING));
+			if(m_rings == MAP_FAILED){
+				const int err_code = errno;
+				LOG_POSEIDON_WARNING("Failed to map io_uring rings: err_code = ", err_code, " (", get_error_desc(err_code), ")");
+				return false;
+			}
+			m_sqes_size = params.sq_entries * sizeof(::io_uring_sqe);
+			m_sqes = static_cast< ::io_uring_sqe *>(::mmap(NULLPTR, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd.get(), static_cast< ::off_t>(IORING_OFF_SQES)));
+			if(m_sqes == MAP_FAILED){
+				const int err_code = errno;
+				LOG_POSEIDON_WARNING("Failed to map io_uring SQEs: err_code = ", err_code, " (", get_error_desc(err_code), ")");
+				return false;
+			}
+			const AUTO(base, static_cast<char *>(m_rings));
+			m_sq_head = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+			m_sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+			m_sq_flags = reinterpret_cast<unsigned *>(base + params.sq_off.flags);
+			m_sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+			m_sq_mask = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+			m_sq_entries = params.sq_entries;
+			m_cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+			m_cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+			m_cqes = reinterpret_cast< ::io_uring_cqe *>(base + params.cq_off.cqes);
+			m_cq_mask = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+			LOG_POSEIDON_DEBUG("Created io_uring: sq_entries = ", params.sq_entries, ", cq_entries = ", params.cq_entries);
+			return true;
+		}
+
+		bool push_poll_add(int fd, const void *key) NOEXCEPT {
+			const AUTO(sqe, acquire_sqe());
+			if(!sqe){
+				return false;
+			}
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+			sqe->poll32_events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+			sqe->len = IORING_POLL_ADD_MULTI;
+			sqe->user_data = reinterpret_cast<boost::uintptr_t>(key);
+			commit_sqe();
+			return true;
+		}
+		bool push_poll_remove(const void *key) NOEXCEPT {
+			const AUTO(sqe, acquire_sqe());
+			if(!sqe){
+				return false;
+			}
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = reinterpret_cast<boost::uintptr_t>(key);
+			// 删除请求本身的完成事件不需要。
+			sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+			sqe->user_data = 0;
+			commit_sqe();
+			return true;
+		}
+		int submit() NOEXCEPT {
+			while(m_to_submit != 0){
+				const long result = ::syscall(__NR_io_uring_enter, m_fd.get(), m_to_submit, 0u, 0u, NULLPTR, 0ul);
+				if(result < 0){
+					const int err_code = errno;
+					if(err_code == EINTR){
+						continue;
+					}
+					return -err_code;
+				}
+				m_to_submit -= static_cast<unsigned>(result);
+			}
+			return 0;
+		}
+		// 调用 wait() 之前须先在锁内调用 submit()。
+		int wait(unsigned timeout) NOEXCEPT {
+			unsigned enter_flags = 0;
+			if(has_any_flags_of(atomic_load(*m_sq_flags, ATOMIC_ACQUIRE), IORING_SQ_CQ_OVERFLOW)){
+				// 完成队列溢出的事件须通过 io_uring_enter() 取回。
+				enter_flags |= IORING_ENTER_GETEVENTS;
+			}
+			if((timeout == 0) && (enter_flags == 0)){
+				// 完成队列在用户态可见，不需要系统调用。
+				return 0;
+			}
+			::__kernel_timespec ts = { };
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = static_cast<long long>(timeout % 1000) * 1000000;
+			::io_uring_getevents_arg arg = { };
+			arg.ts = reinterpret_cast<boost::uintptr_t>(&ts);
+			enter_flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+			const unsigned min_complete = (timeout != 0) && (atomic_load(*m_cq_tail, ATOMIC_ACQUIRE) == *m_cq_head);
+			const long result = ::syscall(__NR_io_uring_enter, m_fd.get(), 0u, min_complete, enter_flags, &arg, sizeof(arg));
+			if(result < 0){
+				return -errno;
+			}
+			return 0;
+		}
+		bool pop_cqe(::io_uring_cqe &cqe) NOEXCEPT {
+			const unsigned head = *m_cq_head;
+			if(atomic_load(*m_cq_tail, ATOMIC_ACQUIRE) == head){
+				return false;
+			}
+			cqe = m_cqes[head & m_cq_mask];
+			atomic_store(*m_cq_head, head + 1, ATOMIC_RELEASE);
+			return true;
+		}
+	};
+#else
+	// 编译时的内核头文件不支持，open() 总是失败，因此 epoll_backend = io_uring 时退回到 epoll。
+	class IoUring : NONCOPYABLE {
+	public:
+		bool open(unsigned entries) NOEXCEPT {
+			(void)entries;
+			LOG_POSEIDON_WARNING("io_uring support was not compiled in (kernel headers are too old)");
+			return false;
+		}
+		bool push_poll_add(int fd, const void *key) NOEXCEPT {
+			(void)fd;
+			(void)key;
 			return false;
 		}
-		if(result == 0){
+		bool push_poll_remove(const void *key) NOEXCEPT {
+			(void)key;
 			return false;
 		}
-		const AUTO(now, get_fast_mono_clock());
-		const RecursiveMutex::UniqueLock lock(g_mutex);
-		for(unsigned i = 0; i < static_cast<unsigned>(result); ++i){
-			const AUTO(ptr, static_cast<SocketBase *>(events[i].data.ptr));
-			const AUTO(it, g_socket_map.find<0>(ptr));
-			if(it == g_socket_map.end()){
-				LOG_POSEIDON_TRACE("Socket reported by epoll is not registered: ptr = ", static_cast<void *>(ptr));
-				continue;
+		int submit() NOEXCEPT {
+			return 0;
+		}
+	};
+#endif
+
+	typedef boost::container::map<const SocketElement *, boost::shared_ptr<SocketElement> > PollMap;
+
+	// 每个 EpollThread 拥有独立的 epoll（或 io_uring）、套接字表、I/O 缓冲区和互斥锁。
+	class EpollThread : NONCOPYABLE {
+	private:
+		Thread m_thread;
+		volatile bool m_running;
+
+		mutable RecursiveMutex m_mutex;
+		UniqueFile m_epoll;
+		bool m_io_uring_enabled;
+		IoUring m_io_uring;
+		// 在收到最后一个完成事件之前保持 SocketElement 存活，防止地址被重用。
+		PollMap m_io_uring_polls;
+		SocketMap m_socket_map;
+		ReadyQueue m_read_queue;
+		DeferredQueue m_deferred_read_queue;
+		// 因为任务队列已满而推迟的套接字，推迟的时间较短，单独排队。
+		DeferredQueue m_backlogged_read_queue;
+		boost::uint64_t m_backlog_delay;
+		ReadyQueue m_write_queue;
+		ReadyQueue m_close_queue;
+
+	public:
+		EpollThread()
+			: m_running(false), m_io_uring_enabled(false)
+			, m_backlog_delay(std::max<boost::uint64_t>(MainConfig::get<boost::uint64_t>("job_queue_backpressure_delay", 100), 1))
+		{
+			const AUTO(backend, MainConfig::get<std::string>("epoll_backend", "epoll"));
+			if(backend == "io_uring"){
+				const AUTO(entries, MainConfig::get<unsigned>("epoll_io_uring_entries", 4096));
+				m_io_uring_enabled = m_io_uring.open(std::max(entries, 16u));
+				if(m_io_uring_enabled){
+					return;
+				}
+				LOG_POSEIDON_WARNING("io_uring is not available. Falling back to epoll.");
+			} else if(backend != "epoll"){
+				LOG_POSEIDON_WARNING("Unknown epoll backend: ", backend, ". Falling back to epoll.");
+			}
+			if(!m_epoll.reset(::epoll_create(100))){
+				const int err_code = errno;
+				LOG_POSEIDON_FATAL("Failed to create epoll: err_code = ", err_code, " (", get_error_desc(err_code), ")");
+				std::abort();
 			}
-			const AUTO(socket, it->weakable->lock());
+		}
+
+	private:
+		// 以下函数调用时须持有 m_mutex。
+		void enqueue_read(const boost::shared_ptr<SocketElement> &element){
+			if(element->read_queued){
+				return;
+			}
+			m_read_queue.push_back(element);
+			element->read_queued = true;
+		}
+		void defer_read(DeferredQueue &queue, const boost::shared_ptr<SocketElement> &element, boost::uint64_t due_time){
+			if(element->read_deferred){
+				return;
+			}
+			queue.push_back(std::make_pair(due_time, element));
+			element->read_deferred = true;
+		}
+		void requeue_deferred_reads(DeferredQueue &queue, boost::uint64_t now){
+			while(!queue.empty() && (queue.front().first <= now)){
+				boost::shared_ptr<SocketElement> element;
+				element.swap(queue.front().second);
+				queue.pop_front();
+				element->read_deferred = false;
+				if(element->erased){
+					continue;
+				}
+				enqueue_read(element);
+			}
+		}
+		void enqueue_write(const boost::shared_ptr<SocketElement> &element){
+			if(element->write_queued){
+				return;
+			}
+			m_write_queue.push_back(element);
+			element->write_queued = true;
+		}
+		void enqueue_close(const boost::shared_ptr<SocketElement> &element){
+			if(element->close_queued){
+				return;
+			}
+			m_close_queue.push_back(element);
+			element->close_queued = true;
+		}
+		void erase_element(const boost::shared_ptr<SocketElement> &element) NOEXCEPT {
+			if(element->erased){
+				return;
+			}
+			// 队列中残留的引用在出队时被跳过。
+			element->erased = true;
+			m_socket_map.erase(element->generation);
+			if(m_io_uring_enabled && (m_io_uring_polls.find(element.get()) != m_io_uring_polls.end())){
+				// POLL_ADD 持有文件的引用，必须显式取消，否则描述符不会被真正关闭。
+				// 被取消的请求会产生最后一个完成事件，届时再从 m_io_uring_polls 中删除。
+				if(!m_io_uring.push_poll_remove(element.get())){
+					LOG_POSEIDON_ERROR("Failed to cancel io_uring poll: ptr = ", static_cast<const void *>(element->ptr));
+				}
+			}
+		}
+
+		// 调用时须持有 m_mutex。events 使用 EPOLL* 标志，它们和 POLL* 标志的值是相同的。
+		void dispatch_event(const boost::shared_ptr<SocketElement> &element, boost::uint32_t events) NOEXCEPT {
+			const AUTO(socket, element->weakable->lock());
 			if(!socket){
-				g_socket_map.erase<0>(it);
-				continue;
+				erase_element(element);
+				return;
+			}
+			try {
+				if(has_any_flags_of(events, EPOLLIN) && !socket->has_been_shutdown_read()){
+					element->readable += has_none_flags_of(events, EPOLLERR);
+					enqueue_read(element);
+				}
+				if(has_any_flags_of(events, EPOLLOUT) && !socket->has_been_shutdown_write()){
+					element->writeable += has_none_flags_of(events, EPOLLERR);
+					enqueue_write(element);
+				}
+				if(has_any_flags_of(events, EPOLLHUP | EPOLLERR)){
+					int err_code;
+					if(socket->did_time_out()){
+						err_code = ETIMEDOUT;
+					} else if(has_any_flags_of(events, EPOLLERR)){
+						::socklen_t err_len = sizeof(err_code);
+						if(::getsockopt(socket->get_fd(), SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
+							err_code = errno;
+							LOG_POSEIDON_WARNING("::getsockopt() failed: fd = ", socket->get_fd(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+						}
+					} else {
+						err_code = 0;
+					}
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Socket closed: remote = ", socket->get_remote_info(), ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+					element->err_code = err_code;
+					enqueue_close(element);
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			}
-			if(has_any_flags_of(events[i].events, EPOLLIN) && !socket->has_been_shutdown_read()){
-				it->readable += has_none_flags_of(events[i].events, EPOLLERR);
-				g_socket_map.set_key<0, 1>(it, now);
+		}
+
+#ifdef IORING_FEAT_CQE_SKIP
+		bool wait_for_io_uring(unsigned timeout) NOEXCEPT {
+			PROFILE_ME;
+
+			{
+				const RecursiveMutex::UniqueLock lock(m_mutex);
+				const int submit_result = m_io_uring.submit();
+				if(submit_result < 0){
+					LOG_POSEIDON_ERROR("::io_uring_enter() failed! errno was ", -submit_result, " (", get_error_desc(-submit_result), ")");
+				}
 			}
-			if(has_any_flags_of(events[i].events, EPOLLOUT) && !socket->has_been_shutdown_write()){
-				it->writeable += has_none_flags_of(events[i].events, EPOLLERR);
-				g_socket_map.set_key<0, 2>(it, now);
+			const int wait_result = m_io_uring.wait(timeout);
+			if((wait_result < 0) && (wait_result != -EINTR) && (wait_result != -ETIME)){
+				LOG_POSEIDON_ERROR("::io_uring_enter() failed! errno was ", -wait_result, " (", get_error_desc(-wait_result), ")");
 			}
-			if(has_any_flags_of(events[i].events, EPOLLHUP | EPOLLERR)){
-				int err_code;
-				if(socket->did_time_out()){
-					err_code = ETIMEDOUT;
-				} else if(has_any_flags_of(events[i].events, EPOLLERR)){
-					::socklen_t err_len = sizeof(err_code);
-					if(::getsockopt(socket->get_fd(), SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
-						err_code = errno;
-						LOG_POSEIDON_WARNING("::getsockopt() failed: fd = ", socket->get_fd(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+			bool busy = false;
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			::io_uring_cqe cqe;
+			while(m_io_uring.pop_cqe(cqe)){
+				busy = true;
+				const AUTO(key, reinterpret_cast<const SocketElement *>(static_cast<boost::uintptr_t>(cqe.user_data)));
+				if(!key){
+					LOG_POSEIDON_TRACE("io_uring poll removal completed: res = ", cqe.res);
+					continue;
+				}
+				const AUTO(it, m_io_uring_polls.find(key));
+				if(it == m_io_uring_polls.end()){
+					LOG_POSEIDON_TRACE("Socket reported by io_uring is not registered: ptr = ", static_cast<const void *>(key));
+					continue;
+				}
+				const AUTO(element, it->second);
+				const bool more = has_any_flags_of(cqe.flags, IORING_CQE_F_MORE);
+				if(!more){
+					m_io_uring_polls.erase(it);
+				}
+				if(element->erased){
+					continue;
+				}
+				if(cqe.res >= 0){
+					dispatch_event(element, static_cast<boost::uint32_t>(cqe.res));
+				} else if(cqe.res != -ECANCELED){
+					LOG_POSEIDON_WARNING("io_uring poll failed: ptr = ", static_cast<const void *>(element->ptr), ", err_code = ", -cqe.res, " (", get_error_desc(-cqe.res), ")");
+					element->err_code = -cqe.res;
+					enqueue_close(element);
+					continue;
+				}
+				if(!more){
+					// 内核结束了多发请求（例如完成队列溢出），需要重新挂上。
+					const AUTO(socket, element->weakable->lock());
+					if(!socket){
+						erase_element(element);
+						continue;
+					}
+					try {
+						m_io_uring_polls[element.get()] = element;
+					} catch(std::exception &e){
+						LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+						continue;
+					}
+					if(!m_io_uring.push_poll_add(socket->get_fd(), element.get())){
+						LOG_POSEIDON_ERROR("Failed to rearm io_uring poll: ptr = ", static_cast<const void *>(element->ptr));
+						m_io_uring_polls.erase(element.get());
+						element->err_code = ENOBUFS;
+						enqueue_close(element);
 					}
-				} else {
-					err_code = 0;
 				}
-				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Socket closed: remote = ", socket->get_remote_info(), ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-				g_socket_map.set_key<0, 3>(it, err_code);
 			}
+			return busy;
 		}
-		return true;
-	}
+#endif
+		bool wait_for_sockets(unsigned timeout) NOEXCEPT {
+			PROFILE_ME;
 
-	bool pump_one_readable_socket(boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
-		PROFILE_ME;
+#ifdef IORING_FEAT_CQE_SKIP
+			if(m_io_uring_enabled){
+				return wait_for_io_uring(timeout);
+			}
+#endif
 
-		const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<SocketBase> socket;
-		bool readable;
-		{
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.begin<1>());
-			if(it == g_socket_map.end<1>()){
+			boost::array< ::epoll_event, 256> events;
+			const int result = ::epoll_wait(m_epoll.get(), events.data(), static_cast<int>(events.size()), static_cast<int>(std::min<unsigned>(timeout, INT_MAX)));
+			if(result < 0){
+				const int err_code = errno;
+				if(err_code != EINTR){
+					LOG_POSEIDON_ERROR("::epoll_wait() failed! errno was ", err_code, " (", get_error_desc(err_code), ")");
+				}
 				return false;
 			}
-			if(now < it->read_time){
+			if(result == 0){
 				return false;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<1>(it);
-				return true;
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			for(unsigned i = 0; i < static_cast<unsigned>(result); ++i){
+				const AUTO(generation, events[i].data.u64);
+				const AUTO(it, m_socket_map.find(generation));
+				if(it == m_socket_map.end()){
+					LOG_POSEIDON_TRACE("Socket reported by epoll is not registered: generation = ", generation);
+					continue;
+				}
+				const AUTO(element, it->second);
+				dispatch_event(element, events[i].events);
 			}
-			readable = it->readable;
+			return true;
 		}
 
-		if(socket->is_throttled()){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Socket is throttled: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 1>(it, now + 5000);
+		// 每次加锁最多取出 batch_size 个就绪的套接字，解锁后逐个处理，最后再加锁一次写回结果。
+		bool pump_readable_sockets(boost::container::vector<unsigned char> &io_buffer, std::size_t batch_size) NOEXCEPT {
+			PROFILE_ME_WITH_HISTOGRAM;
+
+			const AUTO(now, get_coarse_mono_clock());
+			boost::container::vector<PumpElement> batch;
+			bool busy = false;
+			try {
+				batch.reserve(batch_size);
+
+				const RecursiveMutex::UniqueLock lock(m_mutex);
+				requeue_deferred_reads(m_deferred_read_queue, now);
+				requeue_deferred_reads(m_backlogged_read_queue, now);
+				while((batch.size() < batch_size) && !m_read_queue.empty()){
+					boost::shared_ptr<SocketElement> element;
+					element.swap(m_read_queue.front());
+					m_read_queue.pop_front();
+					element->read_queued = false;
+					if(element->erased){
+						continue;
+					}
+					AUTO(socket, element->weakable->lock());
+					if(!socket){
+						erase_element(element);
+						busy = true;
+						continue;
+					}
+					PumpElement elem = { element, STD_MOVE(socket), element->readable, false, false, false };
+					batch.push_back(STD_MOVE(elem));
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			}
+			if(batch.empty()){
+				return busy;
+			}
+
+			for(AUTO(bit, batch.begin()); bit != batch.end(); ++bit){
+				const AUTO_REF(socket, bit->socket);
+
+				if(socket->is_throttled()){
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Socket is throttled: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					bit->throttled = true;
+					continue;
+				}
+				if(JobDispatcher::is_backlogged(socket)){
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Job queue is full, deferring read: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					bit->backlogged = true;
+					continue;
+				}
+
+				int err_code;
+				try {
+					err_code = socket->poll_read_and_process(io_buffer.data(), io_buffer.size(), bit->flag);
+					if((err_code != 0) && (err_code != EINTR) && (err_code != EWOULDBLOCK) && (err_code != EAGAIN)){
+						LOG_POSEIDON_DEBUG("Socket read error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+						socket->force_shutdown();
+					}
+				} catch(std::exception &e){
+					LOG_POSEIDON_RATE_LIMITED(Logger::SP_MAJOR | Logger::LV_INFO, 10, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+					socket->force_shutdown();
+				} catch(...){
+					LOG_POSEIDON_RATE_LIMITED(Logger::SP_MAJOR | Logger::LV_INFO, 10, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+					socket->force_shutdown();
+				}
+				// 读到 EAGAIN 之前保持就绪，下一轮继续读。
+				bit->requeue = (err_code != EWOULDBLOCK) && (err_code != EAGAIN);
+			}
+
+			try {
+				const RecursiveMutex::UniqueLock lock(m_mutex);
+				for(AUTO(bit, batch.begin()); bit != batch.end(); ++bit){
+					if(bit->element->erased){
+						continue;
+					}
+					if(bit->throttled){
+						defer_read(m_deferred_read_queue, bit->element, now + 5000);
+					} else if(bit->backlogged){
+						defer_read(m_backlogged_read_queue, bit->element, now + m_backlog_delay);
+					} else if(bit->requeue){
+						enqueue_read(bit->element);
+					}
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			}
 			return true;
 		}
 
-		int err_code;
-		try {
-			err_code = socket->poll_read_and_process(io_buffer.data(), io_buffer.size(), readable);
-			if((err_code != 0) && (err_code != EINTR) && (err_code != EWOULDBLOCK) && (err_code != EAGAIN)){
-				LOG_POSEIDON_DEBUG("Socket read error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-				socket->force_shutdown();
-			}
-		} catch(std::exception &e){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-			socket->force_shutdown();
-		} catch(...){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-			socket->force_shutdown();
-		}
-		if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 1>(it, (boost::uint64_t)-1);
-			}
-		}
-		return true;
-	}
+		bool pump_writeable_sockets(boost::container::vector<unsigned char> &io_buffer, std::size_t batch_size) NOEXCEPT {
+			PROFILE_ME_WITH_HISTOGRAM;
 
-	bool pump_one_writeable_socket(boost::container::vector<unsigned char> &io_buffer) NOEXCEPT {
-		PROFILE_ME;
+			boost::container::vector<PumpElement> batch;
+			bool busy = false;
+			try {
+				batch.reserve(batch_size);
 
-		const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<SocketBase> socket;
-		bool writeable;
-		{
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.begin<2>());
-			if(it == g_socket_map.end<2>()){
-				return false;
+				const RecursiveMutex::UniqueLock lock(m_mutex);
+				while((batch.size() < batch_size) && !m_write_queue.empty()){
+					boost::shared_ptr<SocketElement> element;
+					element.swap(m_write_queue.front());
+					m_write_queue.pop_front();
+					element->write_queued = false;
+					if(element->erased){
+						continue;
+					}
+					AUTO(socket, element->weakable->lock());
+					if(!socket){
+						erase_element(element);
+						busy = true;
+						continue;
+					}
+					PumpElement elem = { element, STD_MOVE(socket), element->writeable, false, false, false };
+					batch.push_back(STD_MOVE(elem));
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			}
-			if(now < it->write_time){
-				return false;
+			if(batch.empty()){
+				return busy;
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<2>(it);
-				return true;
+
+			for(AUTO(bit, batch.begin()); bit != batch.end(); ++bit){
+				const AUTO_REF(socket, bit->socket);
+
+				Mutex::UniqueLock write_lock;
+				int err_code;
+				try {
+					err_code = socket->poll_write(write_lock, io_buffer.data(), io_buffer.size(), bit->flag);
+					if((err_code != 0) && (err_code != EINTR) && (err_code != EWOULDBLOCK) && (err_code != EAGAIN)){
+						LOG_POSEIDON_DEBUG("Socket write error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+						socket->force_shutdown();
+					}
+				} catch(std::exception &e){
+					LOG_POSEIDON_RATE_LIMITED(Logger::SP_MAJOR | Logger::LV_INFO, 10, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+					socket->force_shutdown();
+				} catch(...){
+					LOG_POSEIDON_RATE_LIMITED(Logger::SP_MAJOR | Logger::LV_INFO, 10, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+					err_code = ECONNRESET;
+					socket->force_shutdown();
+				}
+				bit->requeue = (err_code != EWOULDBLOCK) && (err_code != EAGAIN);
+			}
+
+			try {
+				const RecursiveMutex::UniqueLock lock(m_mutex);
+				for(AUTO(bit, batch.begin()); bit != batch.end(); ++bit){
+					if(bit->element->erased){
+						continue;
+					}
+					if(bit->requeue){
+						enqueue_write(bit->element);
+					}
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			}
-			writeable = it->writeable;
+			return true;
 		}
 
-		Mutex::UniqueLock write_lock;
-		int err_code;
-		try {
-			err_code = socket->poll_write(write_lock, io_buffer.data(), io_buffer.size(), writeable);
-			if((err_code != 0) && (err_code != EINTR) && (err_code != EWOULDBLOCK) && (err_code != EAGAIN)){
-				LOG_POSEIDON_DEBUG("Socket write error: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-				socket->force_shutdown();
-			}
-		} catch(std::exception &e){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-			socket->force_shutdown();
-		} catch(...){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
-			err_code = ECONNRESET;
-			socket->force_shutdown();
-		}
-		if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.set_key<0, 2>(it, (boost::uint64_t)-1);
-			}
-		}
-		return true;
-	}
+		bool pump_closed_sockets(std::size_t batch_size) NOEXCEPT {
+			PROFILE_ME;
 
-	bool pump_one_closed_socket() NOEXCEPT {
-		PROFILE_ME;
+			boost::container::vector<PumpElement> batch;
+			bool busy = false;
+			try {
+				batch.reserve(batch_size);
 
-		// const AUTO(now, get_fast_mono_clock());
-		boost::shared_ptr<SocketBase> socket;
-		int err_code;
-		{
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.lower_bound<3>(0));
-			if(it == g_socket_map.end<3>()){
-				return false;
+				const RecursiveMutex::UniqueLock lock(m_mutex);
+				while((batch.size() < batch_size) && !m_close_queue.empty()){
+					boost::shared_ptr<SocketElement> element;
+					element.swap(m_close_queue.front());
+					m_close_queue.pop_front();
+					element->close_queued = false;
+					if(element->erased){
+						continue;
+					}
+					AUTO(socket, element->weakable->lock());
+					if(!socket){
+						erase_element(element);
+						busy = true;
+						continue;
+					}
+					PumpElement elem = { element, STD_MOVE(socket), false, false, false, false };
+					batch.push_back(STD_MOVE(elem));
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			}
-			socket = it->weakable->lock();
-			if(!socket){
-				g_socket_map.erase<3>(it);
-				return true;
+			if(batch.empty()){
+				return busy;
 			}
-			err_code = it->err_code;
+
+			for(AUTO(bit, batch.begin()); bit != batch.end(); ++bit){
+				const AUTO_REF(socket, bit->socket);
+				const int err_code = bit->element->err_code;
+
+				socket->mark_shutdown();
+				try {
+					socket->on_close(err_code);
+				} catch(std::exception &e){
+					LOG_POSEIDON_RATE_LIMITED(Logger::SP_MAJOR | Logger::LV_INFO, 10, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
+				} catch(...){
+					LOG_POSEIDON_RATE_LIMITED(Logger::SP_MAJOR | Logger::LV_INFO, 10, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+				}
+				LOG_POSEIDON_DEBUG("Socket closed: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
+			}
+
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			for(AUTO(bit, batch.begin()); bit != batch.end(); ++bit){
+				erase_element(bit->element);
+			}
+			return true;
 		}
 
-		socket->mark_shutdown();
-		try {
-			socket->on_close(err_code);
-		} catch(std::exception &e){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "std::exception thrown: what = ", e.what(), ", socket = ", socket, ", typeid = ", typeid(*socket).name());
-		} catch(...){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown: socket = ", socket, ", typeid = ", typeid(*socket).name());
+		bool pump_all_sockets(boost::container::vector<unsigned char> &io_buffer, std::size_t batch_size) NOEXCEPT {
+			bool busy = wait_for_sockets(0);
+			busy += pump_readable_sockets(io_buffer, batch_size);
+			busy += pump_writeable_sockets(io_buffer, batch_size);
+			busy += pump_closed_sockets(batch_size);
+			return busy;
 		}
-		{
-			LOG_POSEIDON_DEBUG("Socket closed: socket = ", socket, ", typeid = ", typeid(*socket).name(), ", err_code = ", err_code, " (", get_error_desc(err_code), ")");
-			const RecursiveMutex::UniqueLock lock(g_mutex);
-			const AUTO(it, g_socket_map.find<0>(socket.get()));
-			if(it != g_socket_map.end<0>()){
-				g_socket_map.erase<0>(it);
+
+		void thread_proc(){
+			PROFILE_ME;
+			LOG_POSEIDON_INFO("Epoll thread started.");
+
+			boost::container::vector<unsigned char> io_buffer;
+			const AUTO(io_buffer_size, MainConfig::get<std::size_t>("epoll_io_buffer_size", 4096));
+			io_buffer.resize(std::max<std::size_t>(io_buffer_size, 508)); // 508 is the maximum size of UDP packets guaranteed to be transmitted.
+			const AUTO(batch_size, std::max<std::size_t>(MainConfig::get<std::size_t>("epoll_pump_batch_size", 16), 1));
+			const AUTO(spin_duration, MainConfig::get<unsigned>("epoll_spin_duration", 0));
+
+			unsigned timeout = 0;
+			for(;;){
+				bool busy;
+				do {
+					busy = pump_all_sockets(io_buffer, batch_size);
+					timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+				} while(busy);
+
+				if(!atomic_load(m_running, ATOMIC_CONSUME)){
+					break;
+				}
+				if(spin_duration != 0){
+					// 空闲之后先自旋一段时间，期间到达的事件不需要等待线程被唤醒。
+					const double spin_deadline = get_hi_res_mono_clock() + spin_duration / 1000.0;
+					do {
+						busy = pump_all_sockets(io_buffer, batch_size);
+					} while(!busy && (get_hi_res_mono_clock() < spin_deadline));
+					if(busy){
+						timeout = 0;
+						continue;
+					}
+				}
+				wait_for_sockets(timeout);
 			}
+
+			LOG_POSEIDON_INFO("Epoll thread stopped.");
 		}
-		return true;
-	}
 
-	void thread_proc(){
-		PROFILE_ME;
-		LOG_POSEIDON_INFO("Epoll daemon started.");
+	public:
+		void start(){
+			atomic_store(m_running, true, ATOMIC_RELEASE);
+			Thread(boost::bind(&EpollThread::thread_proc, this), sslit("   N"), sslit("Network")).swap(m_thread);
+		}
+		void stop(){
+			atomic_store(m_running, false, ATOMIC_RELEASE);
+		}
+		void safe_join(){
+			if(m_thread.joinable()){
+				m_thread.join();
+			}
+			m_read_queue.clear();
+			m_deferred_read_queue.clear();
+			m_backlogged_read_queue.clear();
+			m_write_queue.clear();
+			m_close_queue.clear();
+			m_socket_map.clear();
+			m_io_uring_polls.clear();
+		}
+
+		std::size_t get_socket_count() const {
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			return m_socket_map.size();
+		}
+
+		void add_socket(const boost::shared_ptr<SocketBase> &socket, bool take_ownership, boost::uint64_t generation){
+			PROFILE_ME;
+
+			const AUTO(element, boost::make_shared<SocketElement>(take_ownership, socket, generation));
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			const AUTO(result, m_socket_map.insert(std::make_pair(generation, element)));
+			DEBUG_THROW_UNLESS(result.second, Exception, sslit("Socket is already in epoll"));
+			try {
+				if(m_io_uring_enabled){
+					DEBUG_THROW_UNLESS(m_io_uring.push_poll_add(socket->get_fd(), element.get()), Exception, sslit("io_uring submission queue is full"));
+					m_io_uring_polls[element.get()] = element;
+					// 立即提交，网络线程可能正阻塞在 io_uring_enter() 中。
+					const int submit_result = m_io_uring.submit();
+					DEBUG_THROW_UNLESS(submit_result == 0, SystemException, -submit_result);
+				} else {
+					::epoll_event event = { };
+					event.events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLET);
+					event.data.u64 = generation;
+					DEBUG_THROW_UNLESS(::epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, socket->get_fd(), &event) == 0, SystemException);
+				}
+				// 新的套接字立即尝试读写一次。
+				enqueue_read(element);
+				enqueue_write(element);
+			} catch(...){
+				erase_element(element);
+				throw;
+			}
+		}
+		bool mark_socket_writeable(boost::uint64_t generation) NOEXCEPT {
+			PROFILE_ME;
+
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			const AUTO(it, m_socket_map.find(generation));
+			if(it == m_socket_map.end()){
+				LOG_POSEIDON_TRACE("Socket not found in epoll: generation = ", generation);
+				return false;
+			}
+			try {
+				enqueue_write(it->second);
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+				return false;
+			}
+			return true;
+		}
+
+		bool mark_socket_readable(boost::uint64_t generation) NOEXCEPT {
+			PROFILE_ME;
+
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			const AUTO(it, m_socket_map.find(generation));
+			if(it == m_socket_map.end()){
+				LOG_POSEIDON_TRACE("Socket not found in epoll: generation = ", generation);
+				return false;
+			}
+			try {
+				// 推迟队列中残留的项在到期时只会导致一次多余的读取。
+				enqueue_read(it->second);
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+				return false;
+			}
+			return true;
+		}
+
+		void remove_socket(boost::uint64_t generation) NOEXCEPT {
+			PROFILE_ME;
+
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			const AUTO(it, m_socket_map.find(generation));
+			if(it == m_socket_map.end()){
+				return;
+			}
+			const AUTO(element, it->second);
+			erase_element(element);
+		}
 
-		boost::container::vector<unsigned char> io_buffer;
-		const AUTO(io_buffer_size, MainConfig::get<std::size_t>("epoll_io_buffer_size", 4096));
-		io_buffer.resize(std::max<std::size_t>(io_buffer_size, 508)); // 508 is the maximum size of UDP packets guaranteed to be transmitted.
+		void snapshot(boost::container::vector<EpollDaemon::SnapshotElement> &ret) const {
+			PROFILE_ME;
 
-		unsigned timeout = 0;
-		for(;;){
-			bool busy;
-			do {
-				busy = wait_for_sockets(0);
-				busy += pump_one_readable_socket(io_buffer);
-				busy += pump_one_writeable_socket(io_buffer);
-				busy += pump_one_closed_socket();
-				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-			} while(busy);
+			// 最后一个引用可能在这里释放，析构函数会从 m_socket_map 中删除这个套接字，因此在解锁之后释放。
+			boost::container::vector<boost::shared_ptr<SocketBase> > sockets;
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			sockets.reserve(m_socket_map.size());
+			ret.reserve(ret.size() + m_socket_map.size());
+			for(AUTO(it, m_socket_map.begin()); it != m_socket_map.end(); ++it){
+				AUTO(socket, it->second->weakable->lock());
+				if(!socket){
+					continue;
+				}
+				sockets.push_back(socket);
+				EpollDaemon::SnapshotElement elem = { };
+				elem.remote_info = socket->get_remote_info();
+				elem.local_info = socket->get_local_info();
+				elem.creation_time = socket->get_creation_time();
+				elem.listening = socket->is_listening();
+				elem.readable = it->second->readable;
+				elem.writeable = it->second->writeable;
+				SocketBase::TrafficStatistics stats;
+				socket->get_traffic_statistics(stats);
+				elem.bytes_read = stats.bytes_read;
+				elem.bytes_written = stats.bytes_written;
+				elem.messages_read = stats.messages_read;
+				elem.messages_written = stats.messages_written;
+				elem.send_buffer_size = stats.send_buffer_size;
+				elem.throttled_time = stats.throttled_time;
+				elem.last_read_time = stats.last_read_time;
+				elem.last_write_time = stats.last_write_time;
+				ret.push_back(STD_MOVE(elem));
+			}
+		}
+		void get_all_sockets(boost::container::vector<boost::shared_ptr<SocketBase> > &ret) const {
+			PROFILE_ME;
 
-			if(!atomic_load(g_running, ATOMIC_CONSUME)){
-				break;
+			const RecursiveMutex::UniqueLock lock(m_mutex);
+			ret.reserve(ret.size() + m_socket_map.size());
+			for(AUTO(it, m_socket_map.begin()); it != m_socket_map.end(); ++it){
+				AUTO(socket, it->second->weakable->lock());
+				if(!socket){
+					continue;
+				}
+				ret.push_back(STD_MOVE(socket));
 			}
-			wait_for_sockets(timeout);
 		}
+	};
+
+	volatile bool g_running = false;
+	volatile boost::uint64_t g_generation = 0;
+
+	// 启动后只读，因此访问时无需加锁。
+	boost::container::vector<boost::shared_ptr<EpollThread> > g_threads;
 
-		LOG_POSEIDON_INFO("Epoll daemon stopped.");
+	// 套接字被添加时选定线程，此后总是由同一个线程处理。
+	EpollThread *get_thread_for(const SocketBase *ptr) NOEXCEPT {
+		const AUTO(index, ptr->get_epoll_thread_index());
+		if(index >= g_threads.size()){
+			return NULLPTR;
+		}
+		return g_threads[index].get();
 	}
 }
 
@@ -319,12 +985,20 @@ void EpollDaemon::start(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting epoll daemon...");
 
-	if(!g_epoll.reset(::epoll_create(100))){
-		const int err_code = errno;
-		LOG_POSEIDON_FATAL("Failed to create epoll: err_code = ", err_code, " (", get_error_desc(err_code), ")");
+	const AUTO(thread_count, MainConfig::get<std::size_t>("epoll_thread_count", 1));
+	if(thread_count == 0){
+		LOG_POSEIDON_FATAL("You shall not set `epoll_thread_count` in `main.conf` to zero.");
 		std::abort();
 	}
-	Thread(&thread_proc, sslit("   N"), sslit("Network")).swap(g_thread);
+	g_threads.reserve(thread_count);
+	for(std::size_t i = 0; i < thread_count; ++i){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Creating epoll thread ", i);
+		const AUTO(thread, boost::make_shared<EpollThread>());
+		thread->start();
+		g_threads.push_back(thread);
+	}
+
+	LOG_POSEIDON_INFO("Epoll daemon started.");
 }
 void EpollDaemon::stop(){
 	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
@@ -332,62 +1006,89 @@ void EpollDaemon::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping epoll daemon...");
 
-	if(g_thread.joinable()){
-		g_thread.join();
+	for(std::size_t i = 0; i < g_threads.size(); ++i){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping epoll thread ", i);
+		g_threads.at(i)->stop();
+	}
+	for(std::size_t i = 0; i < g_threads.size(); ++i){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for epoll thread ", i, " to terminate...");
+		g_threads.at(i)->safe_join();
 	}
-	g_socket_map.clear();
-	g_epoll.reset();
+	g_threads.clear();
+
+	LOG_POSEIDON_INFO("Epoll daemon stopped.");
+}
+
+std::size_t EpollDaemon::get_thread_count() NOEXCEPT {
+	return g_threads.size();
 }
 
-void EpollDaemon::add_socket(const boost::shared_ptr<SocketBase> &socket, bool take_ownership){
+void EpollDaemon::add_socket(const boost::shared_ptr<SocketBase> &socket, bool take_ownership, std::size_t thread_hint){
 	PROFILE_ME;
+	DEBUG_THROW_UNLESS(!g_threads.empty(), Exception, sslit("Epoll daemon is not running"));
 
-	const AUTO(now, get_fast_mono_clock());
-	const RecursiveMutex::UniqueLock lock(g_mutex);
-	const AUTO(result, g_socket_map.insert(SocketElement(take_ownership, socket, now)));
-	DEBUG_THROW_UNLESS(result.second, Exception, sslit("Socket is already in epoll"));
+	std::size_t index;
+	if(thread_hint == (std::size_t)-1){
+		const AUTO(seed, reinterpret_cast<boost::uint64_t>(socket.get()) / sizeof(void *));
+		index = static_cast<std::size_t>(seed * 134775813 / 65539 % g_threads.size());
+	} else {
+		index = thread_hint % g_threads.size();
+	}
+	std::size_t old_index = (std::size_t)-1;
+	DEBUG_THROW_UNLESS(atomic_compare_exchange(socket->m_epoll_thread_index, old_index, index, ATOMIC_ACQ_REL, ATOMIC_CONSUME), Exception, sslit("Socket is already in epoll"));
+	const AUTO(generation, atomic_add(g_generation, 1, ATOMIC_RELAXED));
+	atomic_store(socket->m_epoll_generation, generation, ATOMIC_RELEASE);
+	atomic_store(socket->m_epoll_weak, !take_ownership, ATOMIC_RELEASE);
 	try {
-		::epoll_event event = { };
-		event.events = static_cast<boost::uint32_t>(EPOLLIN | EPOLLOUT | EPOLLET);
-		event.data.ptr = socket.get();
-		DEBUG_THROW_UNLESS(::epoll_ctl(g_epoll.get(), EPOLL_CTL_ADD, socket->get_fd(), &event) == 0, SystemException);
+		g_threads.at(index)->add_socket(socket, take_ownership, generation);
 	} catch(...){
-		g_socket_map.erase(result.first);
+		atomic_store(socket->m_epoll_weak, false, ATOMIC_RELEASE);
+		atomic_store(socket->m_epoll_generation, 0, ATOMIC_RELEASE);
+		atomic_store(socket->m_epoll_thread_index, (std::size_t)-1, ATOMIC_RELEASE);
 		throw;
 	}
 }
 bool EpollDaemon::mark_socket_writeable(const SocketBase *ptr) NOEXCEPT {
 	PROFILE_ME;
 
-	const RecursiveMutex::UniqueLock lock(g_mutex);
-	const AUTO(it, g_socket_map.find<0>(ptr));
-	if(it == g_socket_map.end()){
-		LOG_POSEIDON_TRACE("Socket not found in epoll: ptr = ", ptr);
+	const AUTO(thread, get_thread_for(ptr));
+	if(!thread){
 		return false;
 	}
-	const AUTO(now, get_fast_mono_clock());
-	g_socket_map.set_key<0, 2>(it, now);
-	return true;
+	return thread->mark_socket_writeable(atomic_load(ptr->m_epoll_generation, ATOMIC_CONSUME));
+}
+bool EpollDaemon::mark_socket_readable(const SocketBase *ptr) NOEXCEPT {
+	PROFILE_ME;
+
+	const AUTO(thread, get_thread_for(ptr));
+	if(!thread){
+		return false;
+	}
+	return thread->mark_socket_readable(atomic_load(ptr->m_epoll_generation, ATOMIC_CONSUME));
+}
+void EpollDaemon::remove_socket(const SocketBase *ptr) NOEXCEPT {
+	PROFILE_ME;
+
+	const AUTO(thread, get_thread_for(ptr));
+	if(!thread){
+		return;
+	}
+	thread->remove_socket(atomic_load(ptr->m_epoll_generation, ATOMIC_CONSUME));
 }
 
 void EpollDaemon::snapshot(boost::container::vector<EpollDaemon::SnapshotElement> &ret){
 	PROFILE_ME;
 
-	const RecursiveMutex::UniqueLock lock(g_mutex);
-	ret.reserve(ret.size() + g_socket_map.size());
-	for(AUTO(it, g_socket_map.begin()); it != g_socket_map.end(); ++it){
-		const AUTO(socket, it->weakable->lock());
-		if(!socket){
-			continue;
-		}
-		SnapshotElement elem = { };
-		elem.remote_info = socket->get_remote_info();
-		elem.local_info = socket->get_local_info();
-		elem.creation_time = socket->get_creation_time();
-		elem.listening = socket->is_listening();
-		elem.readable = it->readable;
-		elem.writeable = it->writeable;
-		ret.push_back(STD_MOVE(elem));
+	for(std::size_t i = 0; i < g_threads.size(); ++i){
+		g_threads.at(i)->snapshot(ret);
+	}
+}
+
+void EpollDaemon::get_all_sockets(boost::container::vector<boost::shared_ptr<SocketBase> > &ret){
+	PROFILE_ME;
+
+	for(std::size_t i = 0; i < g_threads.size(); ++i){
+		g_threads.at(i)->get_all_sockets(ret);
 	}
 }
 
@@ -22,6 +22,15 @@ public:
 		bool listening;
 		bool readable;
 		bool writeable;
+		// 以下字段只对 TCP 会话有效，其他套接字为零。含义见 SocketBase::TrafficStatistics。
+		unsigned long long bytes_read;
+		unsigned long long bytes_written;
+		unsigned long long messages_read;
+		unsigned long long messages_written;
+		unsigned long long send_buffer_size;
+		unsigned long long throttled_time;
+		boost::uint64_t last_read_time;
+		boost::uint64_t last_write_time;
 	};
 
 private:
@@ -31,10 +40,19 @@ public:
 	static void start();
 	static void stop();
 
-	static void add_socket(const boost::shared_ptr<SocketBase> &socket, bool take_ownership = false);
+	static std::size_t get_thread_count() NOEXCEPT;
+
+	// 如果 thread_hint 为 -1，根据套接字的地址选择线程；否则使用序号为 thread_hint 除以线程数的余数的线程。
+	static void add_socket(const boost::shared_ptr<SocketBase> &socket, bool take_ownership = false, std::size_t thread_hint = (std::size_t)-1);
 	static bool mark_socket_writeable(const SocketBase *ptr) NOEXCEPT;
+	// 用于节流解除后立即恢复读取，而不必等待推迟的时间到期。
+	static bool mark_socket_readable(const SocketBase *ptr) NOEXCEPT;
+	// 由 SocketBase 的析构函数调用，注销没有所有权的套接字。有所有权的套接字在关闭时已经被注销。
+	static void remove_socket(const SocketBase *ptr) NOEXCEPT;
 
 	static void snapshot(boost::container::vector<SnapshotElement> &ret);
+	// 返回所有尚未销毁的套接字，用于热重启时交接描述符。
+	static void get_all_sockets(boost::container::vector<boost::shared_ptr<SocketBase> > &ret);
 };
 
 }
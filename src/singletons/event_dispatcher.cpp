@@ -7,8 +7,10 @@
 #include "../event_base.hpp"
 #include "../log.hpp"
 #include "../mutex.hpp"
+#include "../atomic.hpp"
 #include "../job_base.hpp"
 #include "../profiler.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 
@@ -30,15 +32,105 @@ public:
 };
 
 namespace {
-	struct TypeInfoComparator {
-		bool operator()(const std::type_info *lhs, const std::type_info *rhs) const NOEXCEPT {
-			return (*lhs).before(*rhs);
-		}
+	typedef boost::container::vector<boost::shared_ptr<const EventListener> > ListenerVector;
+
+	// 每个事件类型一个，创建之后不再释放。
+	struct ListenerSlot {
+		// 写时复制。读取和替换都通过 boost::atomic_load() 和 boost::atomic_store()，触发事件时不需要加锁，也不需要分配内存。
+		boost::shared_ptr<const ListenerVector> listeners;
 	};
-	typedef boost::container::flat_multimap<const std::type_info *, boost::weak_ptr<const EventListener>, TypeInfoComparator> ListenerMap;
 
-	Mutex g_mutex;
-	ListenerMap g_listeners;
+	// 同一个类型在不同的模块中可能有不同的 type_info 对象，它们各有一个节点，指向同一个 ListenerSlot。
+	// 节点只会被插入到链表头部，创建之后不再释放，因此读取时不需要加锁。
+	struct TypeNode {
+		const std::type_info *type;
+		ListenerSlot *slot;
+		TypeNode *next;
+	};
+
+	Mutex g_mutex; // 保护对 ListenerSlot::listeners 的修改和 TypeNode 的插入。
+	TypeNode *volatile g_type_head;
+
+	ListenerSlot *find_slot_by_address(const std::type_info &type_info) NOEXCEPT {
+		for(const TypeNode *node = atomic_load(g_type_head, ATOMIC_ACQUIRE); node; node = node->next){
+			if(node->type == &type_info){
+				return node->slot;
+			}
+		}
+		return NULLPTR;
+	}
+	// 每个 type_info 对象只有第一次会到这里。
+	ListenerSlot *require_slot_unlocked(const std::type_info &type_info){
+		AUTO(slot, find_slot_by_address(type_info));
+		if(slot){
+			return slot;
+		}
+		for(const TypeNode *node = g_type_head; node; node = node->next){
+			if(*(node->type) == type_info){
+				slot = node->slot;
+				break;
+			}
+		}
+		const AUTO(node, new TypeNode);
+		if(!slot){
+			try {
+				slot = new ListenerSlot;
+			} catch(...){
+				delete node;
+				throw;
+			}
+		}
+		node->type = &type_info;
+		node->slot = slot;
+		node->next = g_type_head;
+		atomic_store(g_type_head, node, ATOMIC_RELEASE);
+		return slot;
+	}
+	boost::shared_ptr<const ListenerVector> get_listener_vector(const std::type_info &type_info){
+		AUTO(slot, find_slot_by_address(type_info));
+		if(!slot){
+			const Mutex::UniqueLock lock(g_mutex);
+			slot = require_slot_unlocked(type_info);
+		}
+		return boost::atomic_load(&(slot->listeners));
+	}
+
+	// 返回给调用者的 shared_ptr 使用这个删除器，最后一个副本被销毁时注销响应器。
+	// ListenerVector 中保存的是另外一组强引用，所以正在进行中的 sync_raise() 不受影响。
+	class ListenerRemover {
+	private:
+		ListenerSlot *m_slot;
+		boost::shared_ptr<const EventListener> m_listener;
+
+	public:
+		ListenerRemover(ListenerSlot *slot, boost::shared_ptr<const EventListener> listener)
+			: m_slot(slot), m_listener(STD_MOVE(listener))
+		{ }
+
+	public:
+		void operator()(const EventListener *) NOEXCEPT {
+			try {
+				const Mutex::UniqueLock lock(g_mutex);
+				const AUTO(old_listeners, m_slot->listeners);
+				if(old_listeners){
+					AUTO(new_listeners, boost::make_shared<ListenerVector>());
+					new_listeners->reserve(old_listeners->size());
+					for(AUTO(it, old_listeners->begin()); it != old_listeners->end(); ++it){
+						if(*it != m_listener){
+							new_listeners->push_back(*it);
+						}
+					}
+					if(new_listeners->empty()){
+						new_listeners.reset();
+					}
+					boost::atomic_store(&(m_slot->listeners), boost::shared_ptr<const ListenerVector>(STD_MOVE_IDN(new_listeners)));
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			}
+			m_listener.reset();
+		}
+	};
 
 	class EventJob : public JobBase {
 	private:
@@ -74,42 +166,49 @@ void EventDispatcher::start(){
 void EventDispatcher::stop(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping event dispatcher...");
 
-	g_listeners.clear();
+	const Mutex::UniqueLock lock(g_mutex);
+	for(const TypeNode *node = g_type_head; node; node = node->next){
+		boost::atomic_store(&(node->slot->listeners), boost::shared_ptr<const ListenerVector>());
+	}
 }
 
 void EventDispatcher::get_listeners(boost::container::vector<boost::shared_ptr<const EventListener> > &ret, const std::type_info &type_info){
 	PROFILE_ME;
 
-	const Mutex::UniqueLock lock(g_mutex);
-	const AUTO(range, g_listeners.equal_range(&type_info));
-	ret.reserve(ret.size() + static_cast<std::size_t>(std::distance(range.first, range.second)));
-	bool expired;
-	for(AUTO(it, range.first); it != range.second; expired ? (it = g_listeners.erase(it)) : ++it){
-		AUTO(listener, it->second.lock());
-		expired = !listener;
-		if(listener){
-			ret.push_back(STD_MOVE_IDN(listener));
-		}
+	const AUTO(listeners, get_listener_vector(type_info));
+	if(!listeners){
+		return;
 	}
+	ret.insert(ret.end(), listeners->begin(), listeners->end());
 }
 
 boost::shared_ptr<const EventListener> EventDispatcher::register_listener_explicit(const std::type_info &type_info, EventListenerCallback callback){
 	PROFILE_ME;
 
 	AUTO(listener, boost::make_shared<EventListener>(STD_MOVE_IDN(callback)));
-	{
-		const Mutex::UniqueLock lock(g_mutex);
-		g_listeners.emplace(&type_info, listener);
+	const Mutex::UniqueLock lock(g_mutex);
+	const AUTO(slot, require_slot_unlocked(type_info));
+	// 先构造返回值，这样如果分配内存失败，这个响应器不会被注册。
+	boost::shared_ptr<const EventListener> handle(listener.get(), ListenerRemover(slot, listener));
+	const AUTO(old_listeners, slot->listeners);
+	AUTO(new_listeners, boost::make_shared<ListenerVector>());
+	if(old_listeners){
+		new_listeners->reserve(old_listeners->size() + 1);
+		new_listeners->insert(new_listeners->end(), old_listeners->begin(), old_listeners->end());
 	}
-	return STD_MOVE_IDN(listener);
+	new_listeners->push_back(STD_MOVE_IDN(listener));
+	boost::atomic_store(&(slot->listeners), boost::shared_ptr<const ListenerVector>(STD_MOVE_IDN(new_listeners)));
+	return handle;
 }
 
 void EventDispatcher::sync_raise(const boost::shared_ptr<EventBase> &event){
 	PROFILE_ME;
 
-	boost::container::vector<boost::shared_ptr<const EventListener> > listeners;
-	get_listeners(listeners, typeid(*event));
-	for(AUTO(it, listeners.begin()); it != listeners.end(); ++it){
+	const AUTO(listeners, get_listener_vector(typeid(*event)));
+	if(!listeners){
+		return;
+	}
+	for(AUTO(it, listeners->begin()); it != listeners->end(); ++it){
 		AUTO_REF(listener, *it);
 		listener->get_callback()(event);
 	}
@@ -117,12 +216,17 @@ void EventDispatcher::sync_raise(const boost::shared_ptr<EventBase> &event){
 void EventDispatcher::async_raise(const boost::shared_ptr<EventBase> &event, const boost::shared_ptr<const bool> &withdrawn){
 	PROFILE_ME;
 
-	boost::container::vector<boost::shared_ptr<const EventListener> > listeners;
-	get_listeners(listeners, typeid(*event));
-	for(AUTO(it, listeners.begin()); it != listeners.end(); ++it){
+	const AUTO(listeners, get_listener_vector(typeid(*event)));
+	if(!listeners){
+		return;
+	}
+	boost::container::vector<boost::shared_ptr<JobBase> > jobs;
+	jobs.reserve(listeners->size());
+	for(AUTO(it, listeners->begin()); it != listeners->end(); ++it){
 		AUTO_REF(listener, *it);
-		JobDispatcher::enqueue(boost::make_shared<EventJob>(STD_MOVE_IDN(listener), event), withdrawn);
+		jobs.push_back(boost::allocate_shared<EventJob>(PooledAllocator<EventJob>(), listener, event));
 	}
+	JobDispatcher::enqueue_batch(jobs, withdrawn);
 }
 
 }
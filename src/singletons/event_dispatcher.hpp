@@ -29,7 +29,8 @@ public:
 
 	static void get_listeners(boost::container::vector<boost::shared_ptr<const EventListener> > &ret, const std::type_info &type_inf);
 
-	// 返回的 shared_ptr 是该响应器的唯一持有者。
+	// 返回的 shared_ptr 的最后一个副本被销毁时注销该响应器。
+	// 每个事件类型的响应器保存在一个写时复制的数组中，注册和注销时替换，触发事件时不加锁，sync_raise() 也不分配内存。
 	static boost::shared_ptr<const EventListener> register_listener_explicit(const std::type_info &type_info, EventListenerCallback callback);
 
 	template<typename EventT>
@@ -3,6 +3,7 @@
 
 #include "../precompiled.hpp"
 #include "filesystem_daemon.hpp"
+#include "main_config.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -16,12 +17,18 @@
 #include "../raii.hpp"
 #include "../promise.hpp"
 #include "../profiler.hpp"
+#include "../time.hpp"
+#include "../checked_arithmetic.hpp"
 
 namespace Poseidon {
 
 template class PromiseContainer<FileBlockRead>;
 
 namespace {
+	// 在 start() 中设置。load() 在加载主配置文件时就会被调用，这时还不能读取配置。
+	// 默认不使用 mmap：映射的文件被截断时读取缓冲区会收到 SIGBUS，之后对文件的修改也会出现在已经加载的数据中。
+	volatile boost::uint64_t g_mmap_threshold = 0;
+
 	FileBlockRead real_load(const std::string &path, boost::uint64_t begin, boost::uint64_t limit, bool throws_if_does_not_exist){
 		FileBlockRead block = { };
 
@@ -41,86 +48,179 @@ namespace {
 			LOG_POSEIDON_ERROR("Failed to retrieve file information: path = ", path, ", err_code = ", err_code);
 			DEBUG_THROW(SystemException, err_code);
 		}
-		if(begin != 0){
-			if(::lseek(file.get(), static_cast< ::off_t>(begin), SEEK_SET) == (::off_t)-1){
-				const int err_code = errno;
-				LOG_POSEIDON_ERROR("Failed to seek file: path = ", path, ", err_code = ", err_code);
-				DEBUG_THROW(SystemException, err_code);
-			}
-		}
-
 		block.size_total = static_cast<boost::uint64_t>(stat_buf.st_size);
 		block.begin = begin;
 
-		std::size_t bytes_read = 0;
+		// 如果启用了，较大的普通文件直接映射到内存中，发送时由内核从页缓存中读取，不经过用户态的复制。
+		const AUTO(mmap_threshold, atomic_load(g_mmap_threshold, ATOMIC_RELAXED));
+		if((mmap_threshold != 0) && S_ISREG(stat_buf.st_mode) && (begin < block.size_total)){
+			boost::uint64_t count = block.size_total - begin;
+			if(limit != FileSystemDaemon::LIMIT_EOF){
+				count = std::min(count, limit);
+			}
+			if((count >= mmap_threshold) && (count <= static_cast<std::size_t>(-1)) && block.data.put_file_region(file.get(), begin, static_cast<std::size_t>(count))){
+				LOG_POSEIDON_DEBUG("Finished mapping file: path = ", path, ", bytes_mapped = ", count);
+				return block;
+			}
+		}
+
+		// 直接读入缓冲区末尾的空闲空间，不经过临时缓冲区。使用 pread() 因此不需要移动文件指针。
+		boost::uint64_t bytes_read = 0;
 		for(;;){
-			char temp[16384];
 			std::size_t avail;
-			if(limit == FileSystemDaemon::LIMIT_EOF){
-				avail = sizeof(temp);
-			} else {
-				avail = std::min<boost::uint64_t>(limit - bytes_read, sizeof(temp));
+			void *const dst = block.data.reserve_tail(1, avail);
+			if(limit != FileSystemDaemon::LIMIT_EOF){
+				avail = static_cast<std::size_t>(std::min<boost::uint64_t>(limit - bytes_read, avail));
 			}
 			if(avail == 0){
 				break;
 			}
-			const ::ssize_t result = ::read(file.get(), temp, avail);
+			const ::ssize_t result = ::pread(file.get(), dst, avail, static_cast< ::off_t>(begin + bytes_read));
 			if(result == 0){
 				break;
 			}
 			if(result < 0){
 				const int err_code = errno;
+				if(err_code == EINTR){
+					continue;
+				}
 				LOG_POSEIDON_ERROR("Error loading file: path = ", path, ", err_code = ", err_code);
 				DEBUG_THROW(SystemException, err_code);
 			}
-			avail = static_cast<std::size_t>(result);
-			block.data.put(temp, avail);
-			bytes_read += avail;
+			block.data.commit_tail(static_cast<std::size_t>(result));
+			bytes_read += static_cast<std::size_t>(result);
 		}
 		LOG_POSEIDON_DEBUG("Finished loading file: path = ", path, ", bytes_read = ", bytes_read);
 		return block;
 	}
-	void real_save(const std::string &path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists){
+	void real_save(UniqueFile &file, const std::string &path, const StreamBuffer &data, boost::uint64_t begin, bool throws_if_exists){
 		int flags = O_CREAT | O_WRONLY;
+		boost::uint64_t offset = begin;
 		if(begin == FileSystemDaemon::OFFSET_APPEND){
 			flags |= O_APPEND;
 		} else if(begin == FileSystemDaemon::OFFSET_TRUNCATE){
 			flags |= O_TRUNC;
+			offset = 0;
 		}
 		if(throws_if_exists){
 			flags |= O_EXCL;
 		}
-		UniqueFile file;
 		if(!file.reset(::open(path.c_str(), flags, static_cast< ::mode_t>(0666)))){
 			const int err_code = errno;
 			LOG_POSEIDON_ERROR("Failed to save file: path = ", path, ", err_code = ", err_code);
 			DEBUG_THROW(SystemException, err_code);
 		}
-		if(!(flags & (O_APPEND | O_TRUNC)) && (begin != 0)){
-			if(::lseek(file.get(), static_cast< ::off_t>(begin), SEEK_SET) == (::off_t)-1){
-				const int err_code = errno;
-				LOG_POSEIDON_ERROR("Failed to seek file: path = ", path, ", err_code = ", err_code);
-				DEBUG_THROW(SystemException, err_code);
-			}
-		}
 
-		std::size_t bytes_written = 0;
-		for(;;){
-			char temp[16384];
-			std::size_t avail = data.get(temp, sizeof(temp));
-			if(avail == 0){
-				break;
-			}
-			::ssize_t result = ::write(file.get(), temp, avail);
-			if(result < 0){
-				const int err_code = errno;
-				LOG_POSEIDON_ERROR("Error saving file: path = ", path, ", err_code = ", err_code);
-				DEBUG_THROW(SystemException, err_code);
+		// 直接写出每个数据块，不复制到临时缓冲区。除了追加模式以外都使用 pwrite()。
+		boost::uint64_t bytes_written = 0;
+		StreamBuffer::EnumerationCookie cookie;
+		const void *chunk_data;
+		std::size_t chunk_size;
+		while(data.enumerate_chunk(&chunk_data, &chunk_size, cookie)){
+			std::size_t chunk_written = 0;
+			while(chunk_written < chunk_size){
+				const AUTO(src, static_cast<const char *>(chunk_data) + chunk_written);
+				const AUTO(avail, chunk_size - chunk_written);
+				::ssize_t result;
+				if(flags & O_APPEND){
+					result = ::write(file.get(), src, avail);
+				} else {
+					result = ::pwrite(file.get(), src, avail, static_cast< ::off_t>(offset + bytes_written));
+				}
+				if(result < 0){
+					const int err_code = errno;
+					if(err_code == EINTR){
+						continue;
+					}
+					LOG_POSEIDON_ERROR("Error saving file: path = ", path, ", err_code = ", err_code);
+					DEBUG_THROW(SystemException, err_code);
+				}
+				chunk_written += static_cast<std::size_t>(result);
+				bytes_written += static_cast<std::size_t>(result);
 			}
-			bytes_written += avail;
 		}
 		LOG_POSEIDON_DEBUG("Finished saving file: path = ", path, ", bytes_written = ", bytes_written);
 	}
+
+	// 原子保存先写入这个临时文件，同步之后再重命名为目标文件。
+	std::string make_temp_path(const std::string &path){
+		return path + ".tmp";
+	}
+	std::string get_parent_directory(const std::string &path){
+		const AUTO(pos, path.rfind('/'));
+		if(pos == std::string::npos){
+			return ".";
+		}
+		if(pos == 0){
+			return "/";
+		}
+		return path.substr(0, pos);
+	}
+	// 重命名之后必须同步所在目录，否则崩溃之后目录项可能仍然指向旧文件。成功返回 0，否则返回错误码。
+	int sync_directory(const std::string &dir){
+		UniqueFile file;
+		if(!file.reset(::open(dir.c_str(), O_RDONLY | O_DIRECTORY))){
+			return errno;
+		}
+		if(::fsync(file.get()) != 0){
+			return errno;
+		}
+		return 0;
+	}
+
+	void real_save_durably(const std::string &path, const StreamBuffer &data, boost::uint64_t begin, bool throws_if_exists){
+		UniqueFile file;
+		real_save(file, path, data, begin, throws_if_exists);
+		if(::fdatasync(file.get()) != 0){
+			const int err_code = errno;
+			LOG_POSEIDON_ERROR("Failed to synchronize file: path = ", path, ", err_code = ", err_code);
+			DEBUG_THROW(SystemException, err_code);
+		}
+	}
+	void real_rename(const std::string &path, const std::string &new_path);
+	void real_save_atomically(const std::string &path, const StreamBuffer &data){
+		const AUTO(temp_path, make_temp_path(path));
+		try {
+			real_save_durably(temp_path, data, FileSystemDaemon::OFFSET_TRUNCATE, false);
+		} catch(...){
+			::unlink(temp_path.c_str());
+			throw;
+		}
+		real_rename(temp_path, path);
+		const int err_code = sync_directory(get_parent_directory(path));
+		if(err_code != 0){
+			LOG_POSEIDON_ERROR("Failed to synchronize directory: path = ", path, ", err_code = ", err_code);
+			DEBUG_THROW(SystemException, err_code);
+		}
+	}
+
+	// 持久保存的文件在写入之后交给组提交线程，一段时间内的文件一起同步，然后才完成 Promise。
+	struct SyncElement {
+		boost::shared_ptr<UniqueFile> file;
+		::dev_t dev;
+		boost::shared_ptr<Promise> promise;
+		// 目标路径，同步完成之后才释放。
+		std::string path;
+		// 如果非空，则同步之后把这个文件重命名为 path。
+		std::string temp_path;
+	};
+
+	volatile bool g_sync_running = false;
+	Thread g_sync_thread;
+
+	// 只在 FileSystemDaemon::start() 中设置。
+	boost::uint64_t g_group_commit_window = 0;
+	std::size_t g_group_commit_max_batch = 0;
+
+	Mutex g_sync_mutex;
+	ConditionVariable g_new_sync;
+	boost::container::vector<SyncElement> g_sync_queue;
+
+	void submit_sync(SyncElement elem){
+		const Mutex::UniqueLock lock(g_sync_mutex);
+		g_sync_queue.push_back(STD_MOVE(elem));
+		g_new_sync.signal();
+	}
 	void real_remove(const std::string &path, bool throws_if_does_not_exist){
 		if(::unlink(path.c_str()) != 0){
 			const int err_code = errno;
@@ -177,10 +277,18 @@ namespace {
 		const std::string &get_path() const {
 			return m_path;
 		}
+		// 除 get_path() 以外还会修改的路径。
+		virtual const std::string *get_other_path() const {
+			return NULLPTR;
+		}
 
 		virtual boost::shared_ptr<Promise> get_promise() const {
 			return m_weak_promise.lock();
 		}
+		// 如果返回 true，那么 execute() 成功返回之后由组提交线程完成 Promise 并释放路径。
+		virtual bool is_deferred() const {
+			return false;
+		}
 		virtual void execute() = 0;
 	};
 
@@ -215,18 +323,50 @@ namespace {
 		StreamBuffer m_data;
 		boost::uint64_t m_begin;
 		bool m_throws_if_exists;
+		bool m_durable;
+		bool m_atomic;
 
 	public:
-		SaveOperation(const boost::shared_ptr<Promise> &promise, std::string path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists)
+		SaveOperation(const boost::shared_ptr<Promise> &promise, std::string path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists, bool durable, bool atomic)
 			: OperationBase(promise, STD_MOVE(path))
-			, m_data(STD_MOVE(data)), m_begin(begin), m_throws_if_exists(throws_if_exists)
+			, m_data(STD_MOVE(data)), m_begin(begin), m_throws_if_exists(throws_if_exists), m_durable(durable || atomic), m_atomic(atomic)
 		{ }
 
 	public:
+		bool is_deferred() const OVERRIDE {
+			return m_durable;
+		}
 		void execute() OVERRIDE {
 			PROFILE_ME;
 
-			real_save(get_path(), m_data, m_begin, m_throws_if_exists);
+			if(!m_durable){
+				UniqueFile file;
+				real_save(file, get_path(), m_data, m_begin, m_throws_if_exists);
+				return;
+			}
+			SyncElement elem;
+			elem.file = boost::make_shared<UniqueFile>();
+			elem.path = get_path();
+			if(m_atomic){
+				elem.temp_path = make_temp_path(get_path());
+				try {
+					real_save(*elem.file, elem.temp_path, m_data, FileSystemDaemon::OFFSET_TRUNCATE, false);
+				} catch(...){
+					::unlink(elem.temp_path.c_str());
+					throw;
+				}
+			} else {
+				real_save(*elem.file, get_path(), m_data, m_begin, m_throws_if_exists);
+			}
+			struct ::stat stat_buf;
+			if(::fstat(elem.file->get(), &stat_buf) != 0){
+				const int err_code = errno;
+				LOG_POSEIDON_ERROR("Failed to retrieve file information: path = ", get_path(), ", err_code = ", err_code);
+				DEBUG_THROW(SystemException, err_code);
+			}
+			elem.dev = stat_buf.st_dev;
+			elem.promise = get_promise();
+			submit_sync(STD_MOVE(elem));
 		}
 	};
 
@@ -259,6 +399,9 @@ namespace {
 		{ }
 
 	public:
+		const std::string *get_other_path() const OVERRIDE {
+			return &m_new_path;
+		}
 		void execute() OVERRIDE {
 			PROFILE_ME;
 
@@ -303,7 +446,7 @@ namespace {
 	};
 
 	volatile bool g_running = false;
-	Thread g_thread;
+	boost::container::vector<boost::shared_ptr<Thread> > g_threads;
 
 	struct OperationQueueElement {
 		boost::shared_ptr<OperationBase> operation;
@@ -312,21 +455,59 @@ namespace {
 	Mutex g_mutex;
 	ConditionVariable g_new_operation;
 	boost::container::deque<OperationQueueElement> g_operations;
+	// 正在执行的操作涉及的路径。路径按字符串比较，不做规范化。
+	boost::container::flat_multiset<std::string> g_busy_paths;
+
+	bool is_path_blocked(const std::string &path, const boost::container::flat_set<std::string> &skipped_paths){
+		return (g_busy_paths.find(path) != g_busy_paths.end()) || (skipped_paths.find(path) != skipped_paths.end());
+	}
+
+	// 调用者必须持有 g_mutex。
+	// 取出第一个可以执行的操作：它涉及的路径没有正在执行的操作，并且队列中排在它前面的操作都不涉及这些路径。
+	// 这样同一路径上的操作按照提交的顺序执行，不同路径上的操作可以并行执行。
+	bool pick_operation_unlocked(boost::shared_ptr<OperationBase> &operation){
+		boost::container::flat_set<std::string> skipped_paths;
+		for(AUTO(it, g_operations.begin()); it != g_operations.end(); ++it){
+			const AUTO_REF(path, it->operation->get_path());
+			const AUTO(other_path, it->operation->get_other_path());
+			if(is_path_blocked(path, skipped_paths) || (other_path && is_path_blocked(*other_path, skipped_paths))){
+				skipped_paths.insert(path);
+				if(other_path){
+					skipped_paths.insert(*other_path);
+				}
+				continue;
+			}
+			g_busy_paths.insert(path);
+			if(other_path){
+				g_busy_paths.insert(*other_path);
+			}
+			operation = STD_MOVE(it->operation);
+			g_operations.erase(it);
+			return true;
+		}
+		return false;
+	}
+	void release_paths_unlocked(const OperationBase &operation){
+		g_busy_paths.erase(g_busy_paths.find(operation.get_path()));
+		const AUTO(other_path, operation.get_other_path());
+		if(other_path){
+			g_busy_paths.erase(g_busy_paths.find(*other_path));
+		}
+	}
 
 	bool pump_one_element() NOEXCEPT {
 		PROFILE_ME;
 
-		OperationQueueElement *elem;
+		boost::shared_ptr<OperationBase> operation;
 		{
 			const Mutex::UniqueLock lock(g_mutex);
-			if(g_operations.empty()){
+			if(!pick_operation_unlocked(operation)){
 				return false;
 			}
-			elem = &g_operations.front();
 		}
 		STD_EXCEPTION_PTR except;
 		try {
-			elem->operation->execute();
+			operation->execute();
 		} catch(std::exception &e){
 			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
 			except = STD_CURRENT_EXCEPTION();
@@ -334,7 +515,10 @@ namespace {
 			LOG_POSEIDON_WARNING("Unknown exception thrown.");
 			except = STD_CURRENT_EXCEPTION();
 		}
-		const AUTO(promise, elem->operation->get_promise());
+		if(!except && operation->is_deferred()){
+			return true;
+		}
+		const AUTO(promise, operation->get_promise());
 		if(promise){
 			if(except){
 				promise->set_exception(STD_MOVE(except), false);
@@ -343,13 +527,17 @@ namespace {
 			}
 		}
 		const Mutex::UniqueLock lock(g_mutex);
-		g_operations.pop_front();
+		release_paths_unlocked(*operation);
+		if(!g_operations.empty()){
+			// 可能有别的线程在等待这个路径。
+			g_new_operation.signal();
+		}
 		return true;
 	}
 
 	void thread_proc(){
 		PROFILE_ME;
-		LOG_POSEIDON_INFO("FileSystem daemon started.");
+		LOG_POSEIDON_INFO("FileSystem thread started.");
 
 		unsigned timeout = 0;
 		for(;;){
@@ -366,7 +554,121 @@ namespace {
 			g_new_operation.timed_wait(lock, timeout);
 		}
 
-		LOG_POSEIDON_INFO("FileSystem daemon stopped.");
+		LOG_POSEIDON_INFO("FileSystem thread stopped.");
+	}
+
+	STD_EXCEPTION_PTR make_system_exception(int err_code){
+		try {
+			DEBUG_THROW(SystemException, err_code);
+		} catch(...){
+			return STD_CURRENT_EXCEPTION();
+		}
+	}
+
+	void commit_batch(boost::container::vector<SyncElement> &batch){
+		PROFILE_ME;
+
+		// 只有一个文件时使用 fdatasync()，否则每个文件系统调用一次 syncfs()。
+		boost::container::vector<int> err_codes(batch.size(), 0);
+		if(batch.size() == 1){
+			if(::fdatasync(batch.front().file->get()) != 0){
+				err_codes.front() = errno;
+			}
+		} else {
+			boost::container::flat_map< ::dev_t, int> dev_results;
+			for(std::size_t i = 0; i < batch.size(); ++i){
+				const AUTO_REF(elem, batch.at(i));
+				AUTO(it, dev_results.find(elem.dev));
+				if(it == dev_results.end()){
+					const int err_code = (::syncfs(elem.file->get()) == 0) ? 0 : errno;
+					it = dev_results.emplace(elem.dev, err_code).first;
+				}
+				err_codes.at(i) = it->second;
+			}
+		}
+		// 原子保存的文件在数据同步之后才能重命名，然后同步所在的目录。
+		boost::container::flat_map<std::string, int> dir_results;
+		for(std::size_t i = 0; i < batch.size(); ++i){
+			AUTO_REF(elem, batch.at(i));
+			elem.file->reset();
+			if(elem.temp_path.empty()){
+				continue;
+			}
+			AUTO_REF(err_code, err_codes.at(i));
+			if((err_code == 0) && (::rename(elem.temp_path.c_str(), elem.path.c_str()) != 0)){
+				err_code = errno;
+			}
+			if(err_code != 0){
+				::unlink(elem.temp_path.c_str());
+				continue;
+			}
+			AUTO(dir, get_parent_directory(elem.path));
+			AUTO(it, dir_results.find(dir));
+			if(it == dir_results.end()){
+				const int dir_err_code = sync_directory(dir);
+				it = dir_results.emplace(STD_MOVE(dir), dir_err_code).first;
+			}
+			err_code = it->second;
+		}
+		LOG_POSEIDON_DEBUG("Group commit finished: file_count = ", batch.size(), ", directory_count = ", dir_results.size());
+
+		for(std::size_t i = 0; i < batch.size(); ++i){
+			const AUTO_REF(elem, batch.at(i));
+			const int err_code = err_codes.at(i);
+			if(err_code != 0){
+				LOG_POSEIDON_ERROR("Failed to synchronize file: path = ", elem.path, ", err_code = ", err_code);
+			}
+			if(!elem.promise){
+				continue;
+			}
+			if(err_code != 0){
+				elem.promise->set_exception(make_system_exception(err_code), false);
+			} else {
+				elem.promise->set_success(false);
+			}
+		}
+		const Mutex::UniqueLock lock(g_mutex);
+		for(AUTO(it, batch.begin()); it != batch.end(); ++it){
+			g_busy_paths.erase(g_busy_paths.find(it->path));
+		}
+		g_new_operation.broadcast();
+	}
+
+	void sync_thread_proc(){
+		PROFILE_ME;
+		LOG_POSEIDON_INFO("FileSystem sync thread started.");
+
+		for(;;){
+			boost::container::vector<SyncElement> batch;
+			{
+				Mutex::UniqueLock lock(g_sync_mutex);
+				while(g_sync_queue.empty()){
+					if(!atomic_load(g_sync_running, ATOMIC_CONSUME)){
+						goto done;
+					}
+					g_new_sync.timed_wait(lock, 100);
+				}
+				// 等待一小段时间，让更多的文件加入这一批。
+				const AUTO(deadline, saturated_add(get_fast_mono_clock(), g_group_commit_window));
+				for(;;){
+					if(g_sync_queue.size() >= g_group_commit_max_batch){
+						break;
+					}
+					if(!atomic_load(g_sync_running, ATOMIC_CONSUME)){
+						break;
+					}
+					const AUTO(now, get_fast_mono_clock());
+					if(now >= deadline){
+						break;
+					}
+					g_new_sync.timed_wait(lock, deadline - now);
+				}
+				batch.swap(g_sync_queue);
+			}
+			commit_batch(batch);
+		}
+	done:
+		LOG_POSEIDON_INFO("FileSystem sync thread stopped.");
 	}
 
 	void submit_operation(boost::shared_ptr<OperationBase> operation){
@@ -386,7 +688,20 @@ void FileSystemDaemon::start(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting FileSystem daemon...");
 
-	Thread(&thread_proc, sslit(" F  "), sslit("Filesystem")).swap(g_thread);
+	atomic_store(g_mmap_threshold, MainConfig::get<boost::uint64_t>("filesystem_mmap_threshold", 0), ATOMIC_RELAXED);
+	g_group_commit_window = MainConfig::get<boost::uint64_t>("filesystem_group_commit_window", 5);
+	g_group_commit_max_batch = std::max<std::size_t>(MainConfig::get<std::size_t>("filesystem_group_commit_max_batch", 256), 1);
+	atomic_store(g_sync_running, true, ATOMIC_RELEASE);
+	Thread(&sync_thread_proc, sslit(" F  "), sslit("Filesystem")).swap(g_sync_thread);
+
+	// 不同路径上的操作之间不保证顺序，例如先创建目录再在其中保存文件，需要等待前一个操作完成之后再提交后一个。
+	const AUTO(thread_count, std::max<std::size_t>(MainConfig::get<std::size_t>("filesystem_thread_count", 1), 1));
+	LOG_POSEIDON_DEBUG("FileSystem daemon: thread_count = ", thread_count);
+	for(std::size_t i = 0; i < thread_count; ++i){
+		g_threads.push_back(boost::make_shared<Thread>(&thread_proc, sslit(" F  "), sslit("Filesystem")));
+	}
+
+	LOG_POSEIDON_INFO("FileSystem daemon started.");
 }
 void FileSystemDaemon::stop(){
 	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
@@ -394,10 +709,31 @@ void FileSystemDaemon::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping FileSystem daemon...");
 
-	if(g_thread.joinable()){
-		g_thread.join();
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		g_new_operation.broadcast();
 	}
+	for(AUTO(it, g_threads.begin()); it != g_threads.end(); ++it){
+		if((*it)->joinable()){
+			(*it)->join();
+		}
+	}
+	g_threads.clear();
 	g_operations.clear();
+
+	// 工作线程已经退出，不会再有新的文件需要同步。
+	atomic_store(g_sync_running, false, ATOMIC_RELEASE);
+	{
+		const Mutex::UniqueLock lock(g_sync_mutex);
+		g_new_sync.broadcast();
+	}
+	if(g_sync_thread.joinable()){
+		g_sync_thread.join();
+	}
+	g_sync_queue.clear();
+	g_busy_paths.clear();
+
+	LOG_POSEIDON_INFO("FileSystem daemon stopped.");
 }
 
 FileBlockRead FileSystemDaemon::load(const std::string &path, boost::uint64_t begin, boost::uint64_t limit, bool throws_if_does_not_exist){
@@ -405,10 +741,20 @@ FileBlockRead FileSystemDaemon::load(const std::string &path, boost::uint64_t be
 
 	return real_load(path, begin, limit, throws_if_does_not_exist);
 }
-void FileSystemDaemon::save(const std::string &path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists){
+void FileSystemDaemon::save(const std::string &path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists, bool durable){
 	PROFILE_ME;
 
-	real_save(path, STD_MOVE(data), begin, throws_if_exists);
+	if(durable){
+		real_save_durably(path, data, begin, throws_if_exists);
+		return;
+	}
+	UniqueFile file;
+	real_save(file, path, data, begin, throws_if_exists);
+}
+void FileSystemDaemon::save_atomically(const std::string &path, StreamBuffer data){
+	PROFILE_ME;
+
+	real_save_atomically(path, data);
 }
 void FileSystemDaemon::remove(const std::string &path, bool throws_if_does_not_exist){
 	PROFILE_ME;
@@ -439,11 +785,19 @@ boost::shared_ptr<const PromiseContainer<FileBlockRead> > FileSystemDaemon::enqu
 	submit_operation(STD_MOVE(operation));
 	return promise;
 }
-boost::shared_ptr<const Promise> FileSystemDaemon::enqueue_for_saving(std::string path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists){
+boost::shared_ptr<const Promise> FileSystemDaemon::enqueue_for_saving(std::string path, StreamBuffer data, boost::uint64_t begin, bool throws_if_exists, bool durable){
 	PROFILE_ME;
 
 	AUTO(promise, boost::make_shared<Promise>());
-	AUTO(operation, boost::make_shared<SaveOperation>(promise, STD_MOVE(path), STD_MOVE(data), begin, throws_if_exists));
+	AUTO(operation, boost::make_shared<SaveOperation>(promise, STD_MOVE(path), STD_MOVE(data), begin, throws_if_exists, durable, false));
+	submit_operation(STD_MOVE(operation));
+	return promise;
+}
+boost::shared_ptr<const Promise> FileSystemDaemon::enqueue_for_saving_atomically(std::string path, StreamBuffer data){
+	PROFILE_ME;
+
+	AUTO(promise, boost::make_shared<Promise>());
+	AUTO(operation, boost::make_shared<SaveOperation>(promise, STD_MOVE(path), STD_MOVE(data), OFFSET_TRUNCATE, false, true, true));
 	submit_operation(STD_MOVE(operation));
 	return promise;
 }
@@ -480,4 +834,17 @@ boost::shared_ptr<const Promise> FileSystemDaemon::enqueue_for_rmdir(std::string
 	return promise;
 }
 
+std::size_t FileSystemDaemon::get_queue_size(){
+	std::size_t count;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		count = g_operations.size();
+	}
+	{
+		const Mutex::UniqueLock lock(g_sync_mutex);
+		count += g_sync_queue.size();
+	}
+	return count;
+}
+
 }
@@ -35,8 +35,12 @@ public:
 	static void stop();
 
 	// 同步接口。
+	// 如果设置了 filesystem_mmap_threshold，较大的文件被映射而不是复制到 data 中，在 data 被释放之前文件不得被修改或截断。
 	static FileBlockRead load(const std::string &path, boost::uint64_t begin = 0, boost::uint64_t limit = LIMIT_EOF, bool throws_if_does_not_exist = true);
-	static void save(const std::string &path, StreamBuffer data, boost::uint64_t begin = OFFSET_TRUNCATE, bool throws_if_exists = false);
+	// durable 为 true 时数据在返回之前被同步到磁盘。
+	static void save(const std::string &path, StreamBuffer data, boost::uint64_t begin = OFFSET_TRUNCATE, bool throws_if_exists = false, bool durable = false);
+	// 先写入 path + ".tmp" 并同步，然后重命名为 path 并同步所在目录。崩溃之后 path 要么是旧文件，要么是完整的新文件。
+	static void save_atomically(const std::string &path, StreamBuffer data);
 	static void remove(const std::string &path, bool throws_if_does_not_exist = true);
 	static void rename(const std::string &path, const std::string &new_path);
 	static void mkdir(const std::string &path, bool throws_if_exists = false);
@@ -44,11 +48,16 @@ public:
 
 	// 异步接口。
 	static boost::shared_ptr<const PromiseContainer<FileBlockRead> > enqueue_for_loading(std::string path, boost::uint64_t begin = 0, boost::uint64_t limit = LIMIT_EOF, bool throws_if_does_not_exist = true);
-	static boost::shared_ptr<const Promise> enqueue_for_saving(std::string path, StreamBuffer data, boost::uint64_t begin = OFFSET_TRUNCATE, bool throws_if_exists = false);
+	// durable 为 true 时 Promise 在数据同步到磁盘之后才完成。一段时间内的持久保存会合并为一次同步（组提交）。
+	static boost::shared_ptr<const Promise> enqueue_for_saving(std::string path, StreamBuffer data, boost::uint64_t begin = OFFSET_TRUNCATE, bool throws_if_exists = false, bool durable = false);
+	static boost::shared_ptr<const Promise> enqueue_for_saving_atomically(std::string path, StreamBuffer data);
 	static boost::shared_ptr<const Promise> enqueue_for_removing(std::string path, bool throws_if_does_not_exist = true);
 	static boost::shared_ptr<const Promise> enqueue_for_renaming(std::string path, std::string new_path);
 	static boost::shared_ptr<const Promise> enqueue_for_mkdir(std::string path, bool throws_if_exists = false);
 	static boost::shared_ptr<const Promise> enqueue_for_rmdir(std::string path, bool throws_if_does_not_exist = true);
+
+	// 等待执行的操作数，包括等待合并提交 fsync() 的写入。
+	static std::size_t get_queue_size();
 };
 
 }
@@ -0,0 +1,487 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "hot_restart_daemon.hpp"
+#include "main_config.hpp"
+#include "epoll_daemon.hpp"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "../log.hpp"
+#include "../atomic.hpp"
+#include "../exception.hpp"
+#include "../system_exception.hpp"
+#include "../thread.hpp"
+#include "../mutex.hpp"
+#include "../sock_addr.hpp"
+#include "../ip_port.hpp"
+#include "../tcp_server_base.hpp"
+#include "../tcp_session_base.hpp"
+#include "../udp_server_base.hpp"
+#include "../profiler.hpp"
+#include "../time.hpp"
+#include "../checked_arithmetic.hpp"
+
+namespace Poseidon {
+
+namespace {
+	// 每条消息是一个 32 位的类型，最多附带一个描述符。
+	enum {
+		HM_END          = 0, // 一组描述符结束。
+		HM_LISTENER     = 1, // 旧进程 -> 新进程：TCP 监听套接字或者 UDP 套接字。
+		HM_SESSION      = 2, // 旧进程 -> 新进程：空闲的 TCP 连接。
+		HM_READY        = 3, // 新进程 -> 旧进程：已经开始接受连接，旧进程可以停止了。
+	};
+
+	// 旧进程最多等待这么多毫秒让 epoll 线程检查各个连接是否空闲。
+	CONSTEXPR const boost::uint64_t SESSION_CHECK_TIMEOUT = 1000;
+
+	volatile bool g_running = false;
+
+	std::string g_socket_path;
+	boost::uint64_t g_timeout;
+	bool g_hand_over_sessions;
+
+	Mutex g_inherited_mutex;
+	boost::container::vector<boost::shared_ptr<UniqueFile> > g_inherited_sockets;
+	// 和旧进程的连接，在 complete_startup() 中用来通知旧进程停止。
+	UniqueFile g_predecessor;
+
+	UniqueFile g_listener;
+	::ino_t g_listener_inode;
+	Thread g_thread;
+	volatile bool g_handed_over = false;
+
+	::sockaddr_un make_unix_addr(const std::string &path){
+		::sockaddr_un sa;
+		std::memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		DEBUG_THROW_UNLESS(path.size() < sizeof(sa.sun_path), Exception, sslit("hot_restart_socket_path is too long"));
+		std::memcpy(sa.sun_path, path.c_str(), path.size() + 1);
+		return sa;
+	}
+	void set_io_timeout(int fd, boost::uint64_t timeout){
+		::timeval tv;
+		tv.tv_sec = static_cast< ::time_t>(std::min<boost::uint64_t>(timeout / 1000, INT_MAX));
+		tv.tv_usec = static_cast< ::suseconds_t>(timeout % 1000 * 1000);
+		DEBUG_THROW_UNLESS(::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0, SystemException);
+		DEBUG_THROW_UNLESS(::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0, SystemException);
+	}
+
+	int get_socket_type(int fd){
+		int type;
+		::socklen_t len = sizeof(type);
+		if(::getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) != 0){
+			return -1;
+		}
+		return type;
+	}
+	bool get_local_sock_addr(SockAddr &ret, int fd){
+		::sockaddr_storage sa;
+		::socklen_t salen = sizeof(sa);
+		if(::getsockname(fd, static_cast< ::sockaddr *>(static_cast<void *>(&sa)), &salen) != 0){
+			return false;
+		}
+		if((sa.ss_family != AF_INET) && (sa.ss_family != AF_INET6) && (sa.ss_family != AF_UNIX)){
+			return false;
+		}
+		ret = SockAddr(&sa, salen);
+		return true;
+	}
+	bool is_wildcard_ip(const char *ip){
+		return (std::strcmp(ip, "0.0.0.0") == 0) || (std::strcmp(ip, "::") == 0);
+	}
+
+	void send_message(int fd, boost::uint32_t kind, int passed_fd){
+		boost::uint32_t header = kind;
+		::iovec vec;
+		vec.iov_base = &header;
+		vec.iov_len = sizeof(header);
+		union {
+			::cmsghdr align;
+			char data[CMSG_SPACE(sizeof(int))];
+		} control;
+		::msghdr msg = { };
+		msg.msg_iov = &vec;
+		msg.msg_iovlen = 1;
+		if(passed_fd >= 0){
+			msg.msg_control = control.data;
+			msg.msg_controllen = sizeof(control.data);
+			const AUTO(cmsg, CMSG_FIRSTHDR(&msg));
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+		}
+		DEBUG_THROW_UNLESS(::sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(header), SystemException);
+	}
+	boost::uint32_t recv_message(int fd, UniqueFile &passed){
+		boost::uint32_t header;
+		::iovec vec;
+		vec.iov_base = &header;
+		vec.iov_len = sizeof(header);
+		union {
+			::cmsghdr align;
+			char data[CMSG_SPACE(sizeof(int))];
+		} control;
+		::msghdr msg = { };
+		msg.msg_iov = &vec;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+		const ::ssize_t result = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		DEBUG_THROW_UNLESS(result >= 0, SystemException);
+		for(AUTO(cmsg, CMSG_FIRSTHDR(&msg)); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+			if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) && (cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))){
+				int passed_fd;
+				std::memcpy(&passed_fd, CMSG_DATA(cmsg), sizeof(int));
+				passed.reset(passed_fd);
+			}
+		}
+		DEBUG_THROW_UNLESS(result != 0, Exception, sslit("Hot restart peer closed the connection"));
+		DEBUG_THROW_UNLESS((result == sizeof(header)) && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)), Exception, sslit("Invalid hot restart message"));
+		return header;
+	}
+
+	// 新进程。
+	void receive_listeners(){
+		PROFILE_ME;
+
+		UniqueFile conn;
+		DEBUG_THROW_UNLESS(conn.reset(::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)), SystemException);
+		const AUTO(sa, make_unix_addr(g_socket_path));
+		if(::connect(conn.get(), static_cast<const ::sockaddr *>(static_cast<const void *>(&sa)), sizeof(sa)) != 0){
+			const int err_code = errno;
+			if((err_code == ENOENT) || (err_code == ECONNREFUSED)){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "No previous process to take over from: path = ", g_socket_path);
+				return;
+			}
+			DEBUG_THROW(SystemException, err_code);
+		}
+		set_io_timeout(conn.get(), g_timeout);
+
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Taking over listening sockets from previous process: path = ", g_socket_path);
+		boost::container::vector<boost::shared_ptr<UniqueFile> > sockets;
+		for(;;){
+			UniqueFile passed;
+			const AUTO(kind, recv_message(conn.get(), passed));
+			if(kind == HM_END){
+				break;
+			}
+			DEBUG_THROW_UNLESS((kind == HM_LISTENER) && passed, Exception, sslit("Unexpected hot restart message"));
+			const AUTO(owned, boost::make_shared<UniqueFile>());
+			owned->reset(STD_MOVE(passed));
+			sockets.push_back(owned);
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Inherited ", sockets.size(), " socket(s) from previous process.");
+
+		const Mutex::UniqueLock lock(g_inherited_mutex);
+		g_inherited_sockets.swap(sockets);
+		g_predecessor.swap(conn);
+	}
+
+	boost::shared_ptr<TcpServerBase> find_server(const boost::container::vector<boost::shared_ptr<SocketBase> > &sockets, const SockAddr &local_addr){
+		const IpPort local(local_addr);
+		for(AUTO(it, sockets.begin()); it != sockets.end(); ++it){
+			AUTO(server, boost::dynamic_pointer_cast<TcpServerBase>(*it));
+			if(!server || server->is_using_ssl() || server->has_been_handed_over()){
+				continue;
+			}
+			SockAddr server_addr;
+			if(!get_local_sock_addr(server_addr, server->get_fd()) || (server_addr.get_family() != local_addr.get_family())){
+				continue;
+			}
+			const IpPort bound(server_addr);
+			if((bound.port() != local.port()) || (!is_wildcard_ip(bound.ip()) && (std::strcmp(bound.ip(), local.ip()) != 0))){
+				continue;
+			}
+			return server;
+		}
+		return VAL_INIT;
+	}
+	void receive_sessions(){
+		PROFILE_ME;
+
+		send_message(g_predecessor.get(), HM_READY, -1);
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Told previous process to stop accepting connections.");
+
+		boost::container::vector<boost::shared_ptr<SocketBase> > sockets;
+		EpollDaemon::get_all_sockets(sockets);
+		std::size_t adopted = 0, dropped = 0;
+		for(;;){
+			UniqueFile passed;
+			const AUTO(kind, recv_message(g_predecessor.get(), passed));
+			if(kind == HM_END){
+				break;
+			}
+			DEBUG_THROW_UNLESS((kind == HM_SESSION) && passed, Exception, sslit("Unexpected hot restart message"));
+			SockAddr local_addr;
+			boost::shared_ptr<TcpServerBase> server;
+			if(get_local_sock_addr(local_addr, passed.get())){
+				server = find_server(sockets, local_addr);
+			}
+			if(!server){
+				LOG_POSEIDON_WARNING("No TCP server for inherited connection: fd = ", passed.get());
+				++dropped;
+				continue;
+			}
+			server->adopt_client(STD_MOVE(passed));
+			++adopted;
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Took over idle connections from previous process: adopted = ", adopted, ", dropped = ", dropped);
+	}
+
+	// 旧进程。
+	std::size_t hand_over_sessions(int conn, const boost::container::vector<boost::shared_ptr<SocketBase> > &sockets){
+		PROFILE_ME;
+
+		boost::container::vector<boost::shared_ptr<TcpSessionBase> > sessions;
+		for(AUTO(it, sockets.begin()); it != sockets.end(); ++it){
+			AUTO(session, boost::dynamic_pointer_cast<TcpSessionBase>(*it));
+			if(!session){
+				continue;
+			}
+			session->request_handover();
+			sessions.push_back(STD_MOVE(session));
+		}
+		// 检查在各个 epoll 线程中进行，通常只需要一轮。
+		const AUTO(deadline, saturated_add(get_fast_mono_clock(), SESSION_CHECK_TIMEOUT));
+		for(;;){
+			const bool expired = get_fast_mono_clock() >= deadline;
+			bool pending = false;
+			for(AUTO(it, sessions.begin()); it != sessions.end(); ++it){
+				const AUTO(state, (*it)->get_handover_state());
+				if((state != TcpSessionBase::HS_REQUESTED) && (state != TcpSessionBase::HS_DECIDING)){
+					continue;
+				}
+				if(expired && (*it)->cancel_handover()){
+					continue;
+				}
+				pending = true;
+			}
+			if(!pending){
+				break;
+			}
+			::timespec req;
+			req.tv_sec = 0;
+			req.tv_nsec = 1000000;
+			::nanosleep(&req, NULLPTR);
+		}
+
+		std::size_t count = 0;
+		for(AUTO(it, sessions.begin()); it != sessions.end(); ++it){
+			if((*it)->get_handover_state() != TcpSessionBase::HS_ACCEPTED){
+				continue;
+			}
+			send_message(conn, HM_SESSION, (*it)->get_fd());
+			++count;
+		}
+		return count;
+	}
+	void hand_over(int conn){
+		PROFILE_ME;
+
+		set_io_timeout(conn, g_timeout);
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_WARNING, "A new process is taking over...");
+
+		boost::container::vector<boost::shared_ptr<SocketBase> > sockets;
+		EpollDaemon::get_all_sockets(sockets);
+		boost::container::vector<boost::shared_ptr<SocketBase> > listeners;
+		for(AUTO(it, sockets.begin()); it != sockets.end(); ++it){
+			const AUTO_REF(socket, *it);
+			if(socket->has_been_handed_over()){
+				continue;
+			}
+			if(!boost::dynamic_pointer_cast<UdpServerBase>(socket) && !socket->is_listening()){
+				continue;
+			}
+			send_message(conn, HM_LISTENER, socket->get_fd());
+			listeners.push_back(socket);
+		}
+		send_message(conn, HM_END, -1);
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Sent ", listeners.size(), " socket(s) to new process. Waiting for it to start up...");
+
+		UniqueFile unused;
+		DEBUG_THROW_UNLESS(recv_message(conn, unused) == HM_READY, Exception, sslit("Unexpected hot restart message"));
+
+		// 新进程已经在接受连接了。从现在开始无论如何都要退出。
+		for(AUTO(it, listeners.begin()); it != listeners.end(); ++it){
+			(*it)->mark_handed_over();
+		}
+		atomic_store(g_handed_over, true, ATOMIC_RELEASE);
+		try {
+			std::size_t count = 0;
+			if(g_hand_over_sessions){
+				count = hand_over_sessions(conn, sockets);
+			}
+			send_message(conn, HM_END, -1);
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Handed over ", count, " idle connection(s) to new process.");
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_WARNING, "Hot restart handover completed, will now exit...");
+		::raise(SIGTERM);
+	}
+
+	void thread_proc(){
+		PROFILE_ME;
+		LOG_POSEIDON_INFO("Hot restart thread started.");
+
+		// stop() 关闭监听套接字的读端来唤醒这个线程。
+		while(atomic_load(g_running, ATOMIC_CONSUME) && !atomic_load(g_handed_over, ATOMIC_CONSUME)){
+			::pollfd pfd = { g_listener.get(), static_cast<short>(POLLIN), 0 };
+			if(::poll(&pfd, 1, -1) <= 0){
+				continue;
+			}
+			UniqueFile conn;
+			if(!conn.reset(::accept4(g_listener.get(), NULLPTR, NULLPTR, SOCK_CLOEXEC))){
+				const int err_code = errno;
+				if(err_code == EINVAL){
+					break;
+				}
+				continue;
+			}
+			try {
+				hand_over(conn.get());
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("Hot restart handover failed: what = ", e.what());
+			}
+		}
+
+		LOG_POSEIDON_INFO("Hot restart thread stopped.");
+	}
+
+	void listen_for_successor(){
+		PROFILE_ME;
+
+		UniqueFile listener;
+		DEBUG_THROW_UNLESS(listener.reset(::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)), SystemException);
+		const AUTO(sa, make_unix_addr(g_socket_path));
+		// 旧进程此时已经不再接受热重启请求。
+		::unlink(g_socket_path.c_str());
+		DEBUG_THROW_UNLESS(::bind(listener.get(), static_cast<const ::sockaddr *>(static_cast<const void *>(&sa)), sizeof(sa)) == 0, SystemException);
+		DEBUG_THROW_UNLESS(::listen(listener.get(), 1) == 0, SystemException);
+		struct ::stat stat_buf;
+		DEBUG_THROW_UNLESS(::stat(g_socket_path.c_str(), &stat_buf) == 0, SystemException);
+
+		g_listener.swap(listener);
+		g_listener_inode = stat_buf.st_ino;
+		Thread(&thread_proc, sslit("  H "), sslit("Hot restart")).swap(g_thread);
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Listening for hot restart requests: path = ", g_socket_path);
+	}
+}
+
+void HotRestartDaemon::start(){
+	if(atomic_exchange(g_running, true, ATOMIC_ACQ_REL) != false){
+		LOG_POSEIDON_FATAL("Only one daemon is allowed at the same time.");
+		std::abort();
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting hot restart daemon...");
+
+	g_socket_path = MainConfig::get<std::string>("hot_restart_socket_path");
+	g_timeout = MainConfig::get<boost::uint64_t>("hot_restart_timeout", 30000);
+	g_hand_over_sessions = MainConfig::get<bool>("hot_restart_hand_over_sessions", false);
+	if(!g_socket_path.empty()){
+		try {
+			receive_listeners();
+		} catch(std::exception &e){
+			// 旧进程收不到 HM_READY，会继续运行。
+			LOG_POSEIDON_WARNING("Could not take over from previous process: what = ", e.what());
+			const Mutex::UniqueLock lock(g_inherited_mutex);
+			g_inherited_sockets.clear();
+			g_predecessor.reset();
+		}
+	}
+
+	LOG_POSEIDON_INFO("Hot restart daemon started.");
+}
+void HotRestartDaemon::stop(){
+	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
+		return;
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping hot restart daemon...");
+
+	if(g_listener){
+		::shutdown(g_listener.get(), SHUT_RDWR);
+	}
+	if(g_thread.joinable()){
+		g_thread.join();
+	}
+	if(g_listener){
+		// 如果路径已经被新进程重新绑定，不要删除它。
+		struct ::stat stat_buf;
+		if((::stat(g_socket_path.c_str(), &stat_buf) == 0) && (stat_buf.st_ino == g_listener_inode)){
+			::unlink(g_socket_path.c_str());
+		}
+		g_listener.reset();
+	}
+	{
+		const Mutex::UniqueLock lock(g_inherited_mutex);
+		g_inherited_sockets.clear();
+		g_predecessor.reset();
+	}
+
+	LOG_POSEIDON_INFO("Hot restart daemon stopped.");
+}
+
+bool HotRestartDaemon::take_inherited_socket(UniqueFile &socket, int type, const SockAddr &addr){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(g_inherited_mutex);
+	if(g_inherited_sockets.empty()){
+		return false;
+	}
+	const IpPort wanted(addr);
+	for(AUTO(it, g_inherited_sockets.begin()); it != g_inherited_sockets.end(); ++it){
+		const int fd = (*it)->get();
+		SockAddr local_addr;
+		if((get_socket_type(fd) != type) || !get_local_sock_addr(local_addr, fd) || (local_addr.get_family() != addr.get_family())){
+			continue;
+		}
+		const IpPort local(local_addr);
+		if((local.port() != wanted.port()) || (std::strcmp(local.ip(), wanted.ip()) != 0)){
+			continue;
+		}
+		socket.reset(STD_MOVE(**it));
+		g_inherited_sockets.erase(it);
+		return true;
+	}
+	return false;
+}
+
+void HotRestartDaemon::complete_startup(){
+	PROFILE_ME;
+
+	if(g_socket_path.empty()){
+		return;
+	}
+	if(g_predecessor){
+		// 是否交出连接由旧进程的配置决定，没有的话只会收到 HM_END。
+		try {
+			receive_sessions();
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("Could not take over connections from previous process: what = ", e.what());
+		}
+		g_predecessor.reset();
+	}
+	{
+		const Mutex::UniqueLock lock(g_inherited_mutex);
+		if(!g_inherited_sockets.empty()){
+			// 例如新的配置去掉了某个服务器，或者减少了 epoll 线程数导致分片变少。
+			LOG_POSEIDON_WARNING("Closing ", g_inherited_sockets.size(), " inherited socket(s) that no server has claimed.");
+			g_inherited_sockets.clear();
+		}
+	}
+	try {
+		listen_for_successor();
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("Could not listen for hot restart requests: what = ", e.what());
+	}
+}
+
+}
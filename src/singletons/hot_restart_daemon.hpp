@@ -0,0 +1,38 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SINGLETONS_HOT_RESTART_DAEMON_HPP_
+#define POSEIDON_SINGLETONS_HOT_RESTART_DAEMON_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../raii.hpp"
+
+namespace Poseidon {
+
+class SockAddr;
+
+// 热重启：新进程通过 hot_restart_socket_path 指定的 Unix 套接字从旧进程取得监听套接字（SCM_RIGHTS），
+// 旧进程和新进程共享同一个监听队列，因此新的连接不会被拒绝。
+// 1. 新进程在 start() 中连接旧进程，收到所有 TCP 监听套接字和 UDP 套接字，此时两个进程都在接受连接。
+// 2. TcpServerBase 和 UdpServerBase 在构造时优先使用地址相同的继承来的套接字。
+// 3. 新进程加载完 init_module 之后调用 complete_startup()，通知旧进程停止接受连接。
+//    如果启用了 hot_restart_hand_over_sessions，旧进程随后交出空闲的 TCP 连接，新进程把它们交给监听同一地址的 TcpServerBase。
+// 4. 旧进程像收到 SIGTERM 一样退出，照常处理完其他连接上的请求。新进程开始等待下一次热重启。
+class HotRestartDaemon {
+private:
+	HotRestartDaemon();
+
+public:
+	static void start();
+	static void stop();
+
+	// 如果从旧进程继承了类型为 type（SOCK_STREAM 或 SOCK_DGRAM）、绑定在 addr 上的套接字，取走它并返回 true。
+	static bool take_inherited_socket(UniqueFile &socket, int type, const SockAddr &addr);
+
+	// 关闭没有被取走的继承来的套接字，然后开始接受下一个进程的热重启请求。
+	static void complete_startup();
+};
+
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include "../precompiled.hpp"
 #include "job_dispatcher.hpp"
 #include "main_config.hpp"
+#include "epoll_daemon.hpp"
+#include "sampling_profiler.hpp"
 #include <ucontext.h>
 #include <sys/mman.h>
 #include "../job_base.hpp"
@@ -17,120 +19,686 @@
 #include "../condition_variable.hpp"
 #include "../time.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../thread.hpp"
+#include "../trace_context.hpp"
+#include "../huge_pages.hpp"
+
+// glibc 的 swapcontext() 每次切换都要调用 rt_sigprocmask 保存和恢复信号掩码，
+// 而 fiber 之间切换时信号掩码从来不会改变，所以在常见的平台上只保存被调用者保存的寄存器。
+// 定义 POSEIDON_FIBER_USE_UCONTEXT 可以强制使用 ucontext。
+#if !defined(POSEIDON_FIBER_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#	define POSEIDON_FIBER_USE_UCONTEXT   1
+#endif
+
+#ifndef POSEIDON_FIBER_USE_UCONTEXT
+
+// 把当前的栈指针保存到 *save_sp，然后切换到 load_sp 所指向的栈。
+extern "C" void poseidon_fiber_switch_context(void **save_sp, void *load_sp);
+// 新 fiber 的入口。参数和入口函数由 switch 恢复到寄存器中。
+extern "C" void poseidon_fiber_trampoline();
+
+#	if defined(__x86_64__)
+// 栈上依次为 MXCSR 和 x87 控制字、r15、r14、r13、r12、rbx、rbp、返回地址。
+__asm__(
+	".text \n"
+	".p2align 4 \n"
+	".globl poseidon_fiber_switch_context \n"
+	".hidden poseidon_fiber_switch_context \n"
+	".type poseidon_fiber_switch_context, @function \n"
+	"poseidon_fiber_switch_context: \n"
+	"	pushq %rbp \n"
+	"	pushq %rbx \n"
+	"	pushq %r12 \n"
+	"	pushq %r13 \n"
+	"	pushq %r14 \n"
+	"	pushq %r15 \n"
+	"	subq $8, %rsp \n"
+	"	stmxcsr (%rsp) \n"
+	"	fnstcw 4(%rsp) \n"
+	"	movq %rsp, (%rdi) \n"
+	"	movq %rsi, %rsp \n"
+	"	ldmxcsr (%rsp) \n"
+	"	fldcw 4(%rsp) \n"
+	"	addq $8, %rsp \n"
+	"	popq %r15 \n"
+	"	popq %r14 \n"
+	"	popq %r13 \n"
+	"	popq %r12 \n"
+	"	popq %rbx \n"
+	"	popq %rbp \n"
+	"	ret \n"
+	".size poseidon_fiber_switch_context, .-poseidon_fiber_switch_context \n"
+	".p2align 4 \n"
+	".globl poseidon_fiber_trampoline \n"
+	".hidden poseidon_fiber_trampoline \n"
+	".type poseidon_fiber_trampoline, @function \n"
+	"poseidon_fiber_trampoline: \n"
+	"	.cfi_startproc \n"
+	"	.cfi_undefined rip \n"
+	"	movq %r12, %rdi \n"
+	"	callq *%r13 \n"
+	"	ud2 \n"
+	"	.cfi_endproc \n"
+	".size poseidon_fiber_trampoline, .-poseidon_fiber_trampoline \n"
+);
+#	elif defined(__aarch64__)
+// 栈上依次为 x19 至 x30、d8 至 d15。
+__asm__(
+	".text \n"
+	".p2align 4 \n"
+	".globl poseidon_fiber_switch_context \n"
+	".hidden poseidon_fiber_switch_context \n"
+	".type poseidon_fiber_switch_context, %function \n"
+	"poseidon_fiber_switch_context: \n"
+	"	sub sp, sp, #160 \n"
+	"	stp x19, x20, [sp, #0] \n"
+	"	stp x21, x22, [sp, #16] \n"
+	"	stp x23, x24, [sp, #32] \n"
+	"	stp x25, x26, [sp, #48] \n"
+	"	stp x27, x28, [sp, #64] \n"
+	"	stp x29, x30, [sp, #80] \n"
+	"	stp d8, d9, [sp, #96] \n"
+	"	stp d10, d11, [sp, #112] \n"
+	"	stp d12, d13, [sp, #128] \n"
+	"	stp d14, d15, [sp, #144] \n"
+	"	mov x9, sp \n"
+	"	str x9, [x0] \n"
+	"	mov sp, x1 \n"
+	"	ldp x19, x20, [sp, #0] \n"
+	"	ldp x21, x22, [sp, #16] \n"
+	"	ldp x23, x24, [sp, #32] \n"
+	"	ldp x25, x26, [sp, #48] \n"
+	"	ldp x27, x28, [sp, #64] \n"
+	"	ldp x29, x30, [sp, #80] \n"
+	"	ldp d8, d9, [sp, #96] \n"
+	"	ldp d10, d11, [sp, #112] \n"
+	"	ldp d12, d13, [sp, #128] \n"
+	"	ldp d14, d15, [sp, #144] \n"
+	"	add sp, sp, #160 \n"
+	"	ret \n"
+	".size poseidon_fiber_switch_context, .-poseidon_fiber_switch_context \n"
+	".p2align 4 \n"
+	".globl poseidon_fiber_trampoline \n"
+	".hidden poseidon_fiber_trampoline \n"
+	".type poseidon_fiber_trampoline, %function \n"
+	"poseidon_fiber_trampoline: \n"
+	"	.cfi_startproc \n"
+	"	.cfi_undefined x30 \n"
+	"	mov x0, x19 \n"
+	"	blr x20 \n"
+	"	brk #0 \n"
+	"	.cfi_endproc \n"
+	".size poseidon_fiber_trampoline, .-poseidon_fiber_trampoline \n"
+);
+#	endif
+
+#endif
 
 namespace Poseidon {
 
 namespace {
+	ConfigValue<boost::uint64_t> g_job_timeout("job_timeout", 60000);
+
 	enum FiberState {
 		FS_READY   = 0,
 		FS_RUNNING = 1,
 		FS_YIELDED = 2,
 	};
 
+	CONSTEXPR const unsigned PRIORITY_COUNT = 3;
+
+	enum OverflowAction {
+		OA_REJECT         = 0,
+		OA_DROP_OLDEST    = 1,
+		OA_BACKPRESSURE   = 2,
+	};
+
+	// 被丢弃的任务只释放 job，元素留在队列中，由执行线程按顺序弹出。
+	// deque 中间的删除会使所有元素的指针失效，而执行线程会在锁外持有队首元素的指针。
 	struct JobElement {
 		boost::shared_ptr<JobBase> job;
 		boost::shared_ptr<const bool> withdrawn;
 
+		unsigned priority;
+		boost::uint64_t deadline;
+		double enqueue_time;
+		bool droppable;
+		bool rejectable;
+		// 只在创建 FiberControl 时用于选择亲和的线程。affinity_key 为零表示没有亲和。
+		boost::uint64_t affinity_key;
+		std::size_t thread_hint;
+
 		boost::shared_ptr<const Promise> promise;
 		boost::uint64_t expiry_time;
 		bool insignificant;
+
+		// 在投递任务的线程中创建，是投递者当前上下文的子节点。
+		TraceSpan trace;
+		// 任务挂起时线程的当前上下文，恢复时还原。任务可能在其中嵌套了自己的 TraceScope。
+		TraceContext trace_current;
+
+		// 只由执行这个任务的线程访问。
+		double run_time;
+		unsigned yields;
 	};
 
-	struct StackStorage FINAL {
-		static void *operator new(std::size_t cb){
-			assert(cb == sizeof(StackStorage));
-			(void)cb;
+	// 以 2 的幂为边界的直方图。第 0 个桶统计小于 1 的值，第 i 个桶统计 [2^(i-1), 2^i) 之间的值。
+	// 分位数在桶内线性插值。
+	struct Log2Histogram {
+		boost::array<unsigned long long, 48> buckets;
+		unsigned long long count;
+		double max;
+
+		void add(double value) NOEXCEPT {
+			std::size_t index = 0;
+			if(value >= 1){
+				int exp;
+				std::frexp(value, &exp);
+				index = std::min<std::size_t>(static_cast<std::size_t>(exp), buckets.size() - 1);
+			}
+			buckets.at(index) += 1;
+			count += 1;
+			max = std::max(max, value);
+		}
+		double get_percentile(double fraction) const NOEXCEPT {
+			if(count == 0){
+				return 0;
+			}
+			const double rank = fraction * static_cast<double>(count);
+			double seen = 0;
+			for(std::size_t i = 0; i < buckets.size(); ++i){
+				const AUTO(n, static_cast<double>(buckets.at(i)));
+				if((n == 0) || (seen + n < rank)){
+					seen += n;
+					continue;
+				}
+				const double lower = (i == 0) ? 0.0 : std::ldexp(1.0, static_cast<int>(i) - 1);
+				const double upper = (i == 0) ? 1.0 : std::ldexp(1.0, static_cast<int>(i));
+				return std::min(lower + (upper - lower) * (rank - seen) / n, max);
+			}
+			return max;
+		}
+	};
 
-			void *const ptr = mmap(NULLPTR, sizeof(StackStorage), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-			if(ptr == MAP_FAILED){
+	// 栈的最低一页设为 PROT_NONE，栈溢出时立即收到 SIGSEGV，而不是悄悄破坏相邻的内存。
+	// 从大页区域切分出来的栈没有保护页（大页不能部分设为 PROT_NONE），guard_size 为 0。
+	struct StackStorage {
+		void *map_base;
+		std::size_t map_size;
+		std::size_t guard_size;
+		bool in_region;
+		StackStorage *next;
+
+		void *get_bottom() const NOEXCEPT {
+			return static_cast<char *>(map_base) + guard_size;
+		}
+		std::size_t get_size() const NOEXCEPT {
+			return map_size - guard_size;
+		}
+	};
+
+	// 每个任务线程都有自己的缓存，同一个线程中连续执行的任务不需要加锁。
+	__thread StackStorage *t_stack_cache_head = 0; // XXX: NULLPTR
+	__thread std::size_t t_stack_cache_size = 0;
+
+	class FiberStackAllocator : NONCOPYABLE {
+	private:
+		StackStorage *create_stack(std::size_t stack_size){
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				if((stack_size == m_region_stack_size) && !m_region_free.empty()){
+					StackStorage *const stack = new StackStorage;
+					stack->map_base = m_region_free.back();
+					stack->map_size = stack_size;
+					stack->guard_size = 0;
+					stack->in_region = true;
+					stack->next = NULLPTR;
+					m_region_free.pop_back();
+					atomic_add(m_live_count, 1, ATOMIC_RELAXED);
+					return stack;
+				}
+			}
+			const AUTO(page_size, static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)));
+			const AUTO(map_size, saturated_add(stack_size, page_size));
+			void *const base = ::mmap(NULLPTR, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+			if(base == MAP_FAILED){
 				const int err_code = errno;
 				LOG_POSEIDON_ERROR("Failed to allocate stack: err_code = ", err_code);
 				throw std::bad_alloc();
 			}
-			return ptr;
+			if(::mprotect(base, page_size, PROT_NONE) != 0){
+				const int err_code = errno;
+				LOG_POSEIDON_ERROR("Failed to protect stack guard page: err_code = ", err_code);
+				::munmap(base, map_size);
+				throw std::bad_alloc();
+			}
+			StackStorage *const stack = new StackStorage;
+			stack->map_base = base;
+			stack->map_size = map_size;
+			stack->guard_size = page_size;
+			stack->in_region = false;
+			stack->next = NULLPTR;
+			atomic_add(m_live_count, 1, ATOMIC_RELAXED);
+			return stack;
 		}
-		static void operator delete(void *ptr) NOEXCEPT {
-			if(::munmap(ptr, sizeof(StackStorage)) != 0){
+		void destroy_stack(StackStorage *stack) NOEXCEPT {
+			if(stack->in_region){
+				// 区域中的栈不释放，留给下一次 create_stack()。
+				const Mutex::UniqueLock lock(m_mutex);
+				m_region_free.push_back(stack->map_base);
+			} else if(::munmap(stack->map_base, stack->map_size) != 0){
 				const int err_code = errno;
 				LOG_POSEIDON_ERROR("Failed to deallocate stack: err_code = ", err_code);
 				std::abort();
 			}
+			delete stack;
+			atomic_sub(m_live_count, 1, ATOMIC_RELAXED);
 		}
 
-		char bytes[0x40000];
-	};
-
-	class FiberStackAllocator : NONCOPYABLE {
 	private:
+		// 以下参数只在 JobDispatcher::start() 中设置，之后只读。
+		std::size_t m_stack_size;
+		std::size_t m_pool_capacity;
+		std::size_t m_cache_capacity;
+		bool m_decommit;
+
+		// 已经分配的栈数，包括正在使用的和缓存的。
+		volatile std::size_t m_live_count;
+
 		mutable Mutex m_mutex;
-		boost::array<boost::scoped_ptr<StackStorage>, 64> m_pool;
-		std::size_t m_size;
+		boost::container::vector<StackStorage *> m_pool;
+
+		// 启动时一次性映射的大页区域，按 m_stack_size 切分，空闲的栈的地址保存在 m_region_free 中。
+		void *m_region_base;
+		std::size_t m_region_size;
+		std::size_t m_region_stack_size;
+		std::size_t m_region_stacks;
+		HugePageBacking m_region_backing;
+		boost::container::vector<void *> m_region_free;
 
 	public:
 		FiberStackAllocator()
-			: m_mutex(), m_pool(), m_size(0)
+			: m_stack_size(0x40000), m_pool_capacity(1024), m_cache_capacity(16), m_decommit(false)
+			, m_live_count(0)
+			, m_mutex(), m_pool()
+			, m_region_base(NULLPTR), m_region_size(0), m_region_stack_size(0), m_region_stacks(0), m_region_backing(HPB_NORMAL), m_region_free()
 		{ }
+		~FiberStackAllocator(){
+			clear();
+			// 进程退出时仍然可能有 fiber 在使用区域中的栈，此时不能释放。
+			if(atomic_load(m_live_count, ATOMIC_RELAXED) == 0){
+				unmap_huge_page_region(m_region_base, m_region_size);
+			}
+		}
 
 	public:
-		void allocate(boost::scoped_ptr<StackStorage> &ptr){
+		void configure(std::size_t stack_size, std::size_t pool_capacity, std::size_t cache_capacity, bool decommit, std::size_t region_size){
+			const AUTO(page_size, static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)));
+			clear();
 			const Mutex::UniqueLock lock(m_mutex);
-			if(m_size == 0){
-				ptr.reset(new StackStorage);
-			} else {
-				ptr.swap(m_pool.at(--m_size));
+			m_stack_size = saturated_add(std::max<std::size_t>(stack_size, 0x4000), page_size - 1) / page_size * page_size;
+			m_pool_capacity = pool_capacity;
+			m_cache_capacity = cache_capacity;
+			m_decommit = decommit;
+			m_pool.reserve(std::min<std::size_t>(pool_capacity, 4096));
+
+			// 区域只在第一次启动时映射。此后栈的大小改变的话，已经切分的区域不再使用。
+			if((region_size == 0) || m_region_base){
+				return;
+			}
+			m_region_base = map_huge_page_region(region_size, m_region_backing);
+			if(!m_region_base){
+				LOG_POSEIDON_WARNING("Failed to map fiber stack region, falling back to ordinary stacks: region_size = ", region_size);
+				return;
 			}
+			m_region_size = region_size;
+			m_region_stack_size = m_stack_size;
+			m_region_stacks = region_size / m_stack_size;
+			m_region_free.reserve(m_region_stacks);
+			// 按地址从高到低压入，先分配的栈位于区域的开头。
+			for(std::size_t i = m_region_stacks; i-- > 0; ){
+				m_region_free.push_back(static_cast<char *>(m_region_base) + i * m_stack_size);
+			}
+			LOG_POSEIDON_INFO("Mapped fiber stack region: region_size = ", m_region_size, ", stacks = ", m_region_stacks,
+				", backing = ", get_huge_page_backing_name(m_region_backing));
 		}
-		void deallocate(boost::scoped_ptr<StackStorage> &ptr) NOEXCEPT {
+
+		StackStorage *allocate(){
+			if(t_stack_cache_head){
+				StackStorage *const stack = t_stack_cache_head;
+				t_stack_cache_head = stack->next;
+				--t_stack_cache_size;
+				stack->next = NULLPTR;
+				return stack;
+			}
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				if(!m_pool.empty()){
+					StackStorage *const stack = m_pool.back();
+					m_pool.pop_back();
+					return stack;
+				}
+			}
+			return create_stack(m_stack_size);
+		}
+		void deallocate(StackStorage *stack) NOEXCEPT {
+			if(!stack){
+				return;
+			}
+			if(t_stack_cache_size < m_cache_capacity){
+				stack->next = t_stack_cache_head;
+				t_stack_cache_head = stack;
+				++t_stack_cache_size;
+				return;
+			}
+			release_to_pool(stack);
+		}
+		void release_to_pool(StackStorage *stack) NOEXCEPT {
+			stack->next = NULLPTR;
+			// 对大页调用 MADV_DONTNEED 会拆分透明大页或者直接失败，因此区域中的栈不释放物理内存。
+			if(m_decommit && !stack->in_region){
+				// 保留地址空间，把物理页还给内核。再次使用时按需重新分配零页。
+				::madvise(stack->get_bottom(), stack->get_size(), MADV_DONTNEED);
+			}
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				if(m_pool.size() < m_pool_capacity){
+					m_pool.push_back(stack);
+					return;
+				}
+			}
+			destroy_stack(stack);
+		}
+
+		void get_status(JobDispatcher::FiberStackStatus &ret) const {
+			ret.stack_size = m_stack_size;
+			ret.live_stacks = atomic_load(m_live_count, ATOMIC_RELAXED);
+			ret.pool_capacity = m_pool_capacity;
+			ret.region_backing = get_huge_page_backing_name(m_region_backing);
 			const Mutex::UniqueLock lock(m_mutex);
-			if(m_size == m_pool.size()){
-				ptr.reset();
-			} else {
-				ptr.swap(m_pool.at(m_size++));
+			ret.pooled_stacks = m_pool.size();
+			ret.region_stacks = m_region_stacks;
+			ret.region_free_stacks = m_region_free.size();
+		}
+
+		// 线程退出之前把缓存中的栈归还到公共的池中。
+		void flush_thread_cache() NOEXCEPT {
+			while(t_stack_cache_head){
+				StackStorage *const stack = t_stack_cache_head;
+				t_stack_cache_head = stack->next;
+				--t_stack_cache_size;
+				release_to_pool(stack);
+			}
+		}
+		void clear() NOEXCEPT {
+			boost::container::vector<StackStorage *> pool;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				pool.swap(m_pool);
+			}
+			for(AUTO(it, pool.begin()); it != pool.end(); ++it){
+				destroy_stack(*it);
 			}
 		}
 	} g_stack_allocator;
 
+#ifdef POSEIDON_FIBER_USE_UCONTEXT
+	typedef ::ucontext_t FiberContext;
+#else
+	struct FiberContext {
+		void *sp;
+	};
+#endif
+
 	struct FiberControl : NONCOPYABLE {
 		struct Initializer { };
 
 		RecursiveMutex queue_mutex;
 		boost::container::deque<JobElement> queue;
+		// 受 queue_mutex 保护。不包含已经被丢弃的任务。
+		std::size_t pending;
+		// 受 queue_mutex 保护。这个类别最近一次进入队列以来的统计，队列为空时 FiberControl 被删除，统计随之清零。
+		unsigned long long started;
+		unsigned long long completed;
+		unsigned long long yields;
+		double total_wait;
+		double total_run;
+		double max_run;
+
+		// 以下成员受 g_fiber_map_mutex 保护。
+		boost::weak_ptr<const void> category;
+		bool claimed;
+		bool queued;
+		bool wakeup;
+		unsigned home;
+		// 未挂起的 fiber 进入这个线程的队列，-1 表示进入公共队列。
+		unsigned affinity;
+		unsigned priority;
+		boost::uint64_t ready_time;
 
 		FiberState state;
-		boost::scoped_ptr<StackStorage> stack;
-		::ucontext_t inner;
-		::ucontext_t outer;
+		// 只有执行中或者挂起的 fiber 才持有栈。
+		StackStorage *stack;
+		FiberContext inner;
+		FiberContext outer;
 
 		explicit FiberControl(Initializer){
+			pending = 0;
+			started = 0;
+			completed = 0;
+			yields = 0;
+			total_wait = 0;
+			total_run = 0;
+			max_run = 0;
+			claimed = false;
+			queued = false;
+			wakeup = false;
+			home = 0;
+			affinity = (unsigned)-1;
+			priority = JobBase::PRIORITY_NORMAL;
+			ready_time = 0;
 			state = FS_READY;
-			g_stack_allocator.allocate(stack);
+			stack = NULLPTR;
 #ifndef NDEBUG
-			std::memset(&inner, 0xCC, sizeof(outer));
+			std::memset(&inner, 0xCC, sizeof(inner));
 			std::memset(&outer, 0xCC, sizeof(outer));
 #endif
 		}
 		~FiberControl(){
 			assert(state == FS_READY);
 			g_stack_allocator.deallocate(stack);
+			stack = NULLPTR;
 #ifndef NDEBUG
-			std::memset(&inner, 0xCC, sizeof(outer));
+			std::memset(&inner, 0xCC, sizeof(inner));
 			std::memset(&outer, 0xCC, sizeof(outer));
 #endif
 		}
 	};
 
 	__thread FiberControl *volatile t_current_fiber = 0; // XXX: NULLPTR
+	// 主线程为 0，任务线程从 1 开始编号。
+	__thread unsigned t_thread_index = 0;
 
 	Mutex g_fiber_map_mutex;
-	ConditionVariable g_new_job;
+	// 每个线程一个条件变量，这样可以只唤醒就绪的 fiber 所在队列的线程。
+	boost::container::vector<boost::shared_ptr<ConditionVariable> > g_wakeups(1, boost::make_shared<ConditionVariable>());
+	// 正在等待的线程，最后开始等待的在最后。
+	boost::container::vector<unsigned> g_idle_threads;
 	boost::container::map<boost::weak_ptr<const void>, FiberControl> g_fiber_map;
+	// 只有可能继续执行的 fiber 才会进入就绪队列：投递了新任务，或者等待的 Promise 被满足。
+	// 挂起的 fiber 只能在挂起它的线程中恢复，因此进入该线程自己的队列。
+	// 每个优先级一个队列，fiber 的优先级取决于它的队列中的第一个任务。
+	typedef boost::array<boost::container::deque<FiberControl *>, PRIORITY_COUNT> ReadyQueues;
+	ReadyQueues g_ready_fibers;
+	boost::container::vector<ReadyQueues> g_pinned_fibers(1);
+	// 启用类别亲和时，每个线程一组队列，同一个类别的 fiber 总是进入同一个线程的队列，以便复用该线程的缓存。
+	// 只有在其他线程的队列积压时，空闲的线程才会从中窃取。
+	boost::container::vector<ReadyQueues> g_affine_fibers;
+	std::size_t g_steal_threshold = 4;
+	boost::uint64_t g_steal_delay = 20;
+	unsigned long long g_stolen_fibers = 0;
+	boost::uint64_t g_last_sweep_time = 0;
+	boost::uint64_t g_priority_aging_time = 1000;
 
-	void fiber_proc(int low, int high) NOEXCEPT {
-		PROFILE_ME;
+	struct PriorityStats {
+		unsigned long long started;
+		unsigned long long dropped;
+		unsigned long long rejected;
+		unsigned long long shed;
+		double total_wait;
+		double max_wait;
+		// 以下直方图中的时间以微秒为单位。
+		unsigned long long completed;
+		unsigned long long yields;
+		Log2Histogram wait_histogram;
+		Log2Histogram run_histogram;
+		Log2Histogram yield_histogram;
+	};
 
-		FiberControl *fiber;
-		const int params[2] = { low, high };
-		std::memcpy(&fiber, params, sizeof(fiber));
+	Mutex g_stats_mutex;
+	boost::array<PriorityStats, PRIORITY_COUNT> g_priority_stats;
+
+	// 以下参数只在 JobDispatcher::start() 中设置，之后只读。
+	std::size_t g_max_jobs_per_category = 0;
+	std::size_t g_max_jobs_total = 0;
+	OverflowAction g_overflow_action = OA_REJECT;
+
+	// 入队时在 g_fiber_map_mutex 中增加，出队时在锁外减少。
+	boost::array<volatile std::size_t, PRIORITY_COUNT> g_queued_jobs;
+	volatile unsigned long long g_backlogged_reads = 0;
+
+	std::size_t count_queued_jobs() NOEXCEPT {
+		std::size_t count = 0;
+		for(unsigned i = 0; i < PRIORITY_COUNT; ++i){
+			count += atomic_load(g_queued_jobs.at(i), ATOMIC_RELAXED);
+		}
+		return count;
+	}
+
+	volatile bool g_workers_running = false;
+	boost::container::vector<boost::shared_ptr<Thread> > g_workers;
+
+	// 以下函数调用者必须持有 g_fiber_map_mutex。
+	std::size_t count_fibers(const ReadyQueues &queues) NOEXCEPT {
+		std::size_t count = 0;
+		for(unsigned i = 0; i < PRIORITY_COUNT; ++i){
+			count += queues.at(i).size();
+		}
+		return count;
+	}
+	void wake_thread(unsigned index) NOEXCEPT {
+		const AUTO(it, std::find(g_idle_threads.begin(), g_idle_threads.end(), index));
+		if(it == g_idle_threads.end()){
+			// 这个线程没有在等待，它在等待之前会重新检查自己的队列。
+			return;
+		}
+		g_idle_threads.erase(it);
+		g_wakeups.at(index)->signal();
+	}
+	void wake_idle_thread() NOEXCEPT {
+		if(g_idle_threads.empty()){
+			return;
+		}
+		const AUTO(index, g_idle_threads.back());
+		g_idle_threads.pop_back();
+		g_wakeups.at(index)->signal();
+	}
+	// 任务线程按照 epoll 线程平均分组，会话只在它的套接字所在的 epoll 线程对应的一组中选择。
+	// 组内使用跳跃一致性哈希（Lamping & Veach），线程数改变时只有少数类别需要换到其他线程。
+	unsigned select_affine_thread(boost::uint64_t key, std::size_t thread_hint) NOEXCEPT {
+		const std::size_t thread_count = g_affine_fibers.size();
+		if((key == 0) || (thread_count == 0)){
+			return (unsigned)-1;
+		}
+		std::size_t begin = 0, end = thread_count;
+		const std::size_t epoll_thread_count = EpollDaemon::get_thread_count();
+		if((thread_hint != (std::size_t)-1) && (epoll_thread_count != 0)){
+			const std::size_t group = thread_hint % epoll_thread_count;
+			begin = group * thread_count / epoll_thread_count;
+			end = std::max((group + 1) * thread_count / epoll_thread_count, begin + 1);
+		}
+		// 对象的地址的低位总是零，先打散。
+		key *= 0x9E3779B97F4A7C15ull;
+		boost::int64_t bucket = -1, next = 0;
+		while(next < static_cast<boost::int64_t>(end - begin)){
+			bucket = next;
+			key = key * 2862933555777941757ull + 1;
+			next = static_cast<boost::int64_t>(static_cast<double>(bucket + 1) * (2147483648.0 / static_cast<double>((key >> 33) + 1)));
+		}
+		return static_cast<unsigned>(begin + static_cast<std::size_t>(bucket));
+	}
+	void make_fiber_ready(FiberControl *fiber) NOEXCEPT {
+		if(fiber->claimed){
+			// 正在执行的线程会在结束之后重新检查。
+			fiber->wakeup = true;
+			return;
+		}
+		if(fiber->queued){
+			return;
+		}
+		fiber->queued = true;
+		{
+			const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+			fiber->priority = fiber->queue.empty() ? static_cast<unsigned>(JobBase::PRIORITY_NORMAL) : fiber->queue.front().priority;
+		}
+		fiber->ready_time = get_coarse_mono_clock();
+		if((fiber->state == FS_YIELDED) && (fiber->home < g_pinned_fibers.size())){
+			g_pinned_fibers.at(fiber->home).at(fiber->priority).push_back(fiber);
+			wake_thread(fiber->home);
+		} else if(fiber->affinity < g_affine_fibers.size()){
+			AUTO_REF(queues, g_affine_fibers.at(fiber->affinity));
+			queues.at(fiber->priority).push_back(fiber);
+			wake_thread(fiber->affinity);
+			// 积压达到阈值时再唤醒一个空闲的线程来分担。
+			if(count_fibers(queues) >= g_steal_threshold){
+				wake_idle_thread();
+			}
+		} else {
+			g_ready_fibers.at(fiber->priority).push_back(fiber);
+			wake_idle_thread();
+		}
+	}
+	void wake_category(const boost::weak_ptr<const void> &category) NOEXCEPT {
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		const AUTO(it, g_fiber_map.find(category));
+		if(it == g_fiber_map.end()){
+			return;
+		}
+		make_fiber_ready(&(it->second));
+	}
+	// 调用者必须持有 g_fiber_map_mutex。
+	bool has_wait_expired(FiberControl *fiber, boost::uint64_t now) NOEXCEPT {
+		// 被认领的 fiber 正在执行，它的状态和 Promise 由执行线程修改。
+		if(fiber->claimed || (fiber->state != FS_YIELDED)){
+			return false;
+		}
+		const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+		if(fiber->queue.empty()){
+			return false;
+		}
+		const AUTO_REF(elem, fiber->queue.front());
+		return elem.promise && (now >= elem.expiry_time);
+	}
+	// Promise 被满足时由 waiter 唤醒 fiber，只有等待超时的 fiber 需要定期检查。
+	// 停止时 force 为 true，把所有的 fiber 放入就绪队列，以便丢弃不重要的等待。
+	void sweep_fibers(bool force) NOEXCEPT {
+		const AUTO(now, get_coarse_mono_clock());
+
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		if(!force && (now < saturated_add<boost::uint64_t>(g_last_sweep_time, 1000))){
+			return;
+		}
+		g_last_sweep_time = now;
+		for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); ++it){
+			if(!force && !has_wait_expired(&(it->second), now)){
+				continue;
+			}
+			make_fiber_ready(&(it->second));
+		}
+	}
+
+	void fiber_proc(FiberControl *fiber) NOEXCEPT {
+		PROFILE_ME;
 
 		LOG_POSEIDON_TRACE("Entering fiber ", static_cast<void *>(fiber));
 		try {
@@ -145,26 +713,96 @@ namespace {
 		fiber->state = FS_READY;
 	}
 
+#ifdef POSEIDON_FIBER_USE_UCONTEXT
+	void fiber_entry(int low, int high) NOEXCEPT {
+		FiberControl *fiber;
+		const int params[2] = { low, high };
+		std::memcpy(&fiber, params, sizeof(fiber));
+
+		fiber_proc(fiber);
+		// 返回之后由 uc_link 切换回 outer。
+	}
+
+	void init_fiber_context(FiberControl *fiber) NOEXCEPT {
+		if(::getcontext(&(fiber->inner)) != 0){
+			const int err_code = errno;
+			LOG_POSEIDON_FATAL("::getcontext() failed: err_code = ", err_code);
+			std::abort();
+		}
+		fiber->inner.uc_stack.ss_sp = fiber->stack->get_bottom();
+		fiber->inner.uc_stack.ss_size = fiber->stack->get_size();
+		fiber->inner.uc_link = &(fiber->outer);
+
+		int params[2] = { };
+		BOOST_STATIC_ASSERT(sizeof(fiber) <= sizeof(params));
+		std::memcpy(params, &fiber, sizeof(fiber));
+		::makecontext(&(fiber->inner), reinterpret_cast<void (*)()>(&fiber_entry), 2, params[0], params[1]);
+	}
+	void switch_fiber_context(FiberContext &from, FiberContext &to) NOEXCEPT {
+		if(::swapcontext(&from, &to) != 0){
+			const int err_code = errno;
+			LOG_POSEIDON_FATAL("::swapcontext() failed: err_code = ", err_code);
+			std::abort();
+		}
+	}
+#else
+	void fiber_entry(void *param) NOEXCEPT {
+		const AUTO(fiber, static_cast<FiberControl *>(param));
+
+		fiber_proc(fiber);
+		// trampoline 之上没有调用者，不能返回，直接切换回 outer。
+		::poseidon_fiber_switch_context(&(fiber->inner.sp), fiber->outer.sp);
+		std::abort();
+	}
+
+	void init_fiber_context(FiberControl *fiber) NOEXCEPT {
+		// 伪造一个 poseidon_fiber_switch_context() 保存的现场，恢复之后返回到 trampoline。
+		const AUTO(top, (reinterpret_cast<boost::uintptr_t>(fiber->stack->get_bottom()) + fiber->stack->get_size()) & ~static_cast<boost::uintptr_t>(15));
+		const AUTO(param, reinterpret_cast<boost::uintptr_t>(fiber));
+		const AUTO(entry, reinterpret_cast<boost::uintptr_t>(&fiber_entry));
+		const AUTO(trampoline, reinterpret_cast<boost::uintptr_t>(&::poseidon_fiber_trampoline));
+#	if defined(__x86_64__)
+		const AUTO(frame, reinterpret_cast<boost::uintptr_t *>(top) - 8);
+		frame[0] = 0x037F00001F80; // MXCSR 和 x87 控制字的默认值。
+		frame[1] = 0; // r15
+		frame[2] = 0; // r14
+		frame[3] = entry; // r13
+		frame[4] = param; // r12
+		frame[5] = 0; // rbx
+		frame[6] = 0; // rbp
+		frame[7] = trampoline;
+#	elif defined(__aarch64__)
+		const AUTO(frame, reinterpret_cast<boost::uintptr_t *>(top) - 20);
+		std::memset(frame, 0, 20 * sizeof(*frame));
+		frame[0] = param; // x19
+		frame[1] = entry; // x20
+		frame[11] = trampoline; // x30
+#	endif
+		fiber->inner.sp = frame;
+	}
+	void switch_fiber_context(FiberContext &from, FiberContext &to) NOEXCEPT {
+		::poseidon_fiber_switch_context(&(from.sp), to.sp);
+	}
+#endif
+
 	void schedule_fiber(FiberControl *fiber) NOEXCEPT {
 		PROFILE_ME;
 
 		if(fiber->state == FS_READY){
-			if(::getcontext(&(fiber->inner)) != 0){
-				const int err_code = errno;
-				LOG_POSEIDON_FATAL("::getcontext() failed: err_code = ", err_code);
-				std::abort();
+			if(!fiber->stack){
+				try {
+					fiber->stack = g_stack_allocator.allocate();
+				} catch(std::exception &e){
+					LOG_POSEIDON_FATAL("Failed to allocate fiber stack: what = ", e.what());
+					std::abort();
+				}
 			}
-			fiber->inner.uc_stack.ss_sp = fiber->stack.get();
-			fiber->inner.uc_stack.ss_size = sizeof(*(fiber->stack));
-			fiber->inner.uc_link = &(fiber->outer);
-
-			int params[2] = { };
-			BOOST_STATIC_ASSERT(sizeof(fiber) <= sizeof(params));
-			std::memcpy(params, &fiber, sizeof(fiber));
-			::makecontext(&(fiber->inner), reinterpret_cast<void (*)()>(&fiber_proc), 2, params[0], params[1]);
+			init_fiber_context(fiber);
 		}
 
 		t_current_fiber = fiber;
+		// 挂起的 fiber 只能在同一个线程中恢复，否则其中缓存的线程局部变量的地址会失效。
+		fiber->home = t_thread_index;
 		const AUTO(profiler_hook, Profiler::begin_stack_switch());
 		{
 			if((fiber->state != FS_READY) && (fiber->state != FS_YIELDED)){
@@ -172,82 +810,559 @@ namespace {
 				std::abort();
 			}
 			fiber->state = FS_RUNNING;
-			if(::swapcontext(&(fiber->outer), &(fiber->inner)) != 0){
-				const int err_code = errno;
-				LOG_POSEIDON_FATAL("::swapcontext() failed: err_code = ", err_code);
-				std::abort();
-			}
+			switch_fiber_context(fiber->outer, fiber->inner);
 		}
 		Profiler::end_stack_switch(profiler_hook);
 		t_current_fiber = NULLPTR;
 	}
 
+	// 不会让出的任务直接在当前线程的栈上执行，没有栈的分配和切换。
+	void run_stackless(FiberControl *fiber) NOEXCEPT {
+		PROFILE_ME;
+
+		assert(!fiber->stack);
+
+		t_current_fiber = fiber;
+		fiber->home = t_thread_index;
+		fiber->state = FS_RUNNING;
+		fiber_proc(fiber);
+		t_current_fiber = NULLPTR;
+	}
+
 	bool pump_one_fiber(FiberControl *fiber, bool force_expiry) NOEXCEPT {
 		PROFILE_ME;
 
-		const AUTO(now, get_fast_mono_clock());
+		const AUTO(now, get_coarse_mono_clock());
 
+		// 不在持有 queue_mutex 时访问 Promise，它的 waiter 会锁定 g_fiber_map_mutex。
+		// deque 的 push_back() 不会使指向其他元素的指针失效。
 		JobElement *elem;
+		boost::shared_ptr<const Promise> promise;
 		{
 			const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
 			if(fiber->queue.empty()){
 				return false;
 			}
 			elem = &(fiber->queue.front());
-			if(elem->promise && !elem->promise->is_satisfied()){
-				if((now < elem->expiry_time) && !(elem->insignificant && force_expiry)){
-					return false;
-				}
-				LOG_POSEIDON_WARNING("Job timed out");
+			promise = elem->promise;
+		}
+		if(promise && !promise->is_satisfied()){
+			if((now < elem->expiry_time) && !(elem->insignificant && force_expiry)){
+				return false;
 			}
+			LOG_POSEIDON_WARNING("Job timed out");
+		}
+		{
+			const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
 			elem->promise.reset();
 		}
-		if((fiber->state == FS_READY) && elem->withdrawn && *(elem->withdrawn)){
+		if(!elem->job){
+			LOG_POSEIDON_DEBUG("Job was shed due to queue overflow");
+		} else if((fiber->state == FS_READY) && elem->withdrawn && *(elem->withdrawn)){
 			LOG_POSEIDON_DEBUG("Job is withdrawn");
+		} else if((fiber->state == FS_READY) && (elem->deadline != 0) && (now > elem->deadline)){
+			LOG_POSEIDON_WARNING("Job missed its deadline: priority = ", elem->priority, ", deadline = ", elem->deadline, ", now = ", now);
+			const Mutex::UniqueLock stats_lock(g_stats_mutex);
+			g_priority_stats.at(elem->priority).dropped += 1;
 		} else {
-			schedule_fiber(fiber);
+			if(fiber->state == FS_READY){
+				// 只统计从投递到开始执行的等待时间，挂起之后的等待由 Promise 决定。
+				const double wait = std::max(get_hi_res_mono_clock() - elem->enqueue_time, 0.0);
+				{
+					const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+					fiber->started += 1;
+					fiber->total_wait += wait;
+				}
+				const Mutex::UniqueLock stats_lock(g_stats_mutex);
+				AUTO_REF(stats, g_priority_stats.at(elem->priority));
+				stats.started += 1;
+				stats.total_wait += wait;
+				stats.max_wait = std::max(stats.max_wait, wait);
+				stats.wait_histogram.add(wait * 1000);
+			}
+			// 只统计在 fiber 中执行的时间，不包括挂起的时间。
+			const double run_begin = get_hi_res_mono_clock();
+			SamplingProfiler::set_current_job(typeid(*(elem->job)).name());
+			{
+				// 每次恢复 fiber 时重新激活，任务挂起期间这个线程可能执行其他任务。
+				const TraceScope trace_scope(elem->trace_current);
+				if((fiber->state == FS_READY) && !elem->job->is_yieldable()){
+					run_stackless(fiber);
+				} else {
+					schedule_fiber(fiber);
+				}
+				elem->trace_current = get_current_trace_context();
+			}
+			SamplingProfiler::set_current_job(NULLPTR);
+			elem->run_time += std::max(get_hi_res_mono_clock() - run_begin, 0.0);
+			if(fiber->state == FS_READY){
+				if(elem->trace.is_sampled()){
+					char priority[16], run_ms[64], yields[16];
+					std::sprintf(priority, "%u", elem->priority);
+					std::sprintf(run_ms, "%.3f", elem->run_time * 1000);
+					std::sprintf(yields, "%u", elem->yields);
+					const char *const attributes[][2] = {
+						{ "poseidon.job.type", typeid(*(elem->job)).name() },
+						{ "poseidon.job.priority", priority },
+						{ "poseidon.job.run_ms", run_ms },
+						{ "poseidon.job.yields", yields },
+						{ NULLPTR },
+					};
+					elem->trace.finish(attributes);
+				}
+				{
+					const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+					fiber->completed += 1;
+					fiber->yields += elem->yields;
+					fiber->total_run += elem->run_time;
+					fiber->max_run = std::max(fiber->max_run, elem->run_time);
+				}
+				const Mutex::UniqueLock stats_lock(g_stats_mutex);
+				AUTO_REF(stats, g_priority_stats.at(elem->priority));
+				stats.completed += 1;
+				stats.yields += elem->yields;
+				stats.run_histogram.add(elem->run_time * 1000);
+				stats.yield_histogram.add(elem->yields);
+			}
 		}
 		if(fiber->state == FS_READY){
-			const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
-			fiber->queue.pop_front();
+			// 任务的析构函数可能会满足其他 Promise，因此在锁外销毁。
+			boost::shared_ptr<JobBase> job;
+			boost::shared_ptr<const bool> withdrawn;
+			{
+				const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+				job.swap(fiber->queue.front().job);
+				withdrawn.swap(fiber->queue.front().withdrawn);
+				if(job){
+					fiber->pending -= 1;
+					atomic_sub(g_queued_jobs.at(fiber->queue.front().priority), 1, ATOMIC_RELAXED);
+				}
+				fiber->queue.pop_front();
+			}
+			// 任务执行完毕之后栈就不再需要了，还给当前线程的缓存。
+			g_stack_allocator.deallocate(fiber->stack);
+			fiber->stack = NULLPTR;
 		}
 		return true;
 	}
+	// 本线程可以执行的 fiber 数，不包括可以窃取的。
+	std::size_t count_ready_fibers() NOEXCEPT {
+		std::size_t count = count_fibers(g_ready_fibers) + count_fibers(g_pinned_fibers.at(t_thread_index));
+		if(t_thread_index < g_affine_fibers.size()){
+			count += count_fibers(g_affine_fibers.at(t_thread_index));
+		}
+		return count;
+	}
+	// 只在本线程没有就绪的 fiber 时调用。被窃取的 fiber 的亲和不变，它的下一个任务仍然回到原来的线程。
+	FiberControl *steal_ready_fiber(boost::uint64_t now) NOEXCEPT {
+		ReadyQueues *victim = NULLPTR;
+		std::size_t victim_count = 0;
+		for(std::size_t index = 0; index < g_affine_fibers.size(); ++index){
+			if(index == t_thread_index){
+				continue;
+			}
+			AUTO_REF(queues, g_affine_fibers.at(index));
+			const AUTO(count, count_fibers(queues));
+			if(count <= victim_count){
+				continue;
+			}
+			// 积压达到阈值，或者那个线程忙于执行一个长任务，就绪的 fiber 已经等待太久。
+			bool imbalanced = count >= g_steal_threshold;
+			for(unsigned i = 0; !imbalanced && (i < PRIORITY_COUNT); ++i){
+				imbalanced = !queues.at(i).empty() && (now >= saturated_add(queues.at(i).front()->ready_time, g_steal_delay));
+			}
+			if(!imbalanced){
+				continue;
+			}
+			victim = &queues;
+			victim_count = count;
+		}
+		if(!victim){
+			return NULLPTR;
+		}
+		for(unsigned i = 0; i < PRIORITY_COUNT; ++i){
+			AUTO_REF(queue, victim->at(i));
+			if(queue.empty()){
+				continue;
+			}
+			const AUTO(fiber, queue.front());
+			queue.pop_front();
+			fiber->queued = false;
+			++g_stolen_fibers;
+			return fiber;
+		}
+		return NULLPTR;
+	}
+	FiberControl *pop_ready_fiber(boost::uint64_t now) NOEXCEPT {
+		// 依次是在本线程中挂起的、亲和于本线程的和公共的 fiber。
+		ReadyQueues *const sources[] = {
+			&(g_pinned_fibers.at(t_thread_index)),
+			(t_thread_index < g_affine_fibers.size()) ? &(g_affine_fibers.at(t_thread_index)) : NULLPTR,
+			&g_ready_fibers,
+		};
+		boost::container::deque<FiberControl *> *queue = NULLPTR;
+		unsigned priority = 0;
+		while(priority < PRIORITY_COUNT){
+			for(unsigned j = 0; !queue && (j < COUNT_OF(sources)); ++j){
+				if(sources[j] && !sources[j]->at(priority).empty()){
+					queue = &(sources[j]->at(priority));
+				}
+			}
+			if(queue){
+				break;
+			}
+			++priority;
+		}
+		if(!queue){
+			return steal_ready_fiber(now);
+		}
+		// 等待太久的低优先级 fiber 提前执行，以免被饿死。
+		for(unsigned i = PRIORITY_COUNT - 1; i > priority; --i){
+			for(unsigned j = 0; j < COUNT_OF(sources); ++j){
+				if(sources[j] && !sources[j]->at(i).empty() && (now >= saturated_add(sources[j]->at(i).front()->ready_time, g_priority_aging_time))){
+					queue = &(sources[j]->at(i));
+					goto _found;
+				}
+			}
+		}
+	_found:
+		const AUTO(fiber, queue->front());
+		queue->pop_front();
+		fiber->queued = false;
+		return fiber;
+	}
 	bool pump_one_round(bool force_expiry) NOEXCEPT {
 		PROFILE_ME;
 
 		bool busy = false;
 		Mutex::UniqueLock lock(g_fiber_map_mutex);
-		AUTO(it, g_fiber_map.begin());
-		for(;;){
-			if(it == g_fiber_map.end()){
+		// 只处理开始时就绪的 fiber，新就绪的留到下一轮。没有就绪的 fiber 时尝试窃取一次。
+		std::size_t count = std::max<std::size_t>(count_ready_fibers(), !g_affine_fibers.empty());
+		while(count != 0){
+			--count;
+			const AUTO(fiber, pop_ready_fiber(get_coarse_mono_clock()));
+			if(!fiber){
 				break;
 			}
-			AUTO(fiber, &(it->second));
+			// 同一类别的任务同时只能由一个线程执行，这样可以保证它们的顺序。
+			// 被认领的 fiber 不会从表中删除，也不会进入就绪队列。
+			fiber->claimed = true;
+			fiber->wakeup = false;
 			lock.unlock();
 			{
 				busy += pump_one_fiber(fiber, force_expiry);
 			}
 			lock.lock();
+			fiber->claimed = false;
 			if(fiber->queue.empty()){
-				it = g_fiber_map.erase(it);
-			} else {
-				++it;
+				const AUTO(category, fiber->category);
+				g_fiber_map.erase(category);
+				continue;
+			}
+			// 下一个任务可以立即执行，或者在执行期间等待的 Promise 已经被满足。
+			if(fiber->wakeup || (fiber->state == FS_READY)){
+				make_fiber_ready(fiber);
 			}
 		}
 		return busy;
 	}
+
+	// 调用者必须持有 g_fiber_map_mutex。
+	void wait_for_fibers(Mutex::UniqueLock &lock, unsigned timeout){
+		if(count_ready_fibers() != 0){
+			return;
+		}
+		const unsigned index = t_thread_index;
+		g_idle_threads.push_back(index);
+		g_wakeups.at(index)->timed_wait(lock, timeout);
+		// 超时或者被 stop() 唤醒时仍然在表中。
+		const AUTO(it, std::find(g_idle_threads.begin(), g_idle_threads.end(), index));
+		if(it != g_idle_threads.end()){
+			g_idle_threads.erase(it);
+		}
+	}
+
+	void run_loop(const volatile bool &running){
+		const AUTO(spin_duration, MainConfig::get<unsigned>("job_spin_duration", 0));
+
+		unsigned timeout = 0;
+		for(;;){
+			sweep_fibers(false);
+
+			bool busy;
+			do {
+				busy = pump_one_round(!atomic_load(running, ATOMIC_CONSUME));
+				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+			} while(busy);
+
+			if((spin_duration != 0) && atomic_load(running, ATOMIC_CONSUME)){
+				// 空闲之后先自旋一段时间，期间投递的任务不需要等待条件变量唤醒。
+				const double spin_deadline = get_hi_res_mono_clock() + spin_duration / 1000.0;
+				do {
+					busy = pump_one_round(false);
+				} while(!busy && (get_hi_res_mono_clock() < spin_deadline));
+				if(busy){
+					timeout = 0;
+					continue;
+				}
+			}
+
+			Mutex::UniqueLock lock(g_fiber_map_mutex);
+			if(!atomic_load(running, ATOMIC_CONSUME)){
+				break;
+			}
+			wait_for_fibers(lock, timeout);
+		}
+	}
+
+	bool has_fibers_yielded_here(){
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); ++it){
+			if(it->second.claimed){
+				continue;
+			}
+			if((it->second.state == FS_YIELDED) && (it->second.home == t_thread_index)){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void worker_proc(unsigned index){
+		PROFILE_ME;
+		LOG_POSEIDON_INFO("Job thread ", index, " started.");
+
+		t_thread_index = index;
+		run_loop(g_workers_running);
+		// 在本线程中挂起的 fiber 不能交给其他线程恢复，退出之前必须处理完。
+		while(has_fibers_yielded_here()){
+			sweep_fibers(true);
+			pump_one_round(true);
+		}
+		g_stack_allocator.flush_thread_cache();
+
+		LOG_POSEIDON_INFO("Job thread ", index, " stopped.");
+	}
+
+	void prepare_job_element(boost::weak_ptr<const void> &category, JobElement &elem, boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn){
+		DEBUG_THROW_ASSERT(job);
+
+		const boost::weak_ptr<const void> null_weak_ptr;
+		category = job->get_category();
+		// 没有类别的任务每个都是单独的类别，不需要亲和。类别已经销毁的任务也不需要。
+		elem.affinity_key = reinterpret_cast<boost::uintptr_t>(category.lock().get());
+		if(!(category < null_weak_ptr) && !(null_weak_ptr < category)){
+			category = job;
+		}
+		elem.thread_hint = job->get_thread_hint();
+		elem.priority = std::min<unsigned>(static_cast<unsigned>(job->get_priority()), PRIORITY_COUNT - 1);
+		elem.deadline = job->get_deadline();
+		elem.enqueue_time = get_hi_res_mono_clock();
+		elem.droppable = job->is_insignificant();
+		elem.rejectable = job->is_rejectable();
+		elem.trace = TraceSpan("job");
+		elem.trace_current = elem.trace.get_context();
+		elem.run_time = 0;
+		elem.yields = 0;
+		elem.job.swap(job);
+		elem.withdrawn.swap(withdrawn);
+	}
+	// 以下函数调用时须持有 g_fiber_map_mutex。
+	// 返回这个类别中最早的可以丢弃的任务。队首的任务如果已经开始执行则不能丢弃。
+	JobElement *find_droppable_job_element(FiberControl *fiber){
+		const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+		AUTO(it, fiber->queue.begin());
+		if((it != fiber->queue.end()) && (fiber->claimed || (fiber->state != FS_READY))){
+			++it;
+		}
+		for(; it != fiber->queue.end(); ++it){
+			if(it->job && it->droppable){
+				return &*it;
+			}
+		}
+		return NULLPTR;
+	}
+	// 被丢弃的任务放入 shed_jobs，由调用者在锁外销毁。
+	bool shed_oldest_job_element(FiberControl *fiber, boost::container::vector<boost::shared_ptr<JobBase> > &shed_jobs){
+		JobElement *oldest = NULLPTR;
+		FiberControl *oldest_fiber = NULLPTR;
+		if(fiber){
+			oldest = find_droppable_job_element(fiber);
+			oldest_fiber = fiber;
+		} else {
+			// 同一类别中的任务按投递顺序排列，因此只需要比较每个类别中的第一个。
+			for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); ++it){
+				const AUTO(elem, find_droppable_job_element(&(it->second)));
+				if(elem && (!oldest || (elem->enqueue_time < oldest->enqueue_time))){
+					oldest = elem;
+					oldest_fiber = &(it->second);
+				}
+			}
+		}
+		if(!oldest){
+			return false;
+		}
+		const RecursiveMutex::UniqueLock queue_lock(oldest_fiber->queue_mutex);
+		shed_jobs.emplace_back();
+		shed_jobs.back().swap(oldest->job);
+		oldest->withdrawn.reset();
+		oldest_fiber->pending -= 1;
+		atomic_sub(g_queued_jobs.at(oldest->priority), 1, ATOMIC_RELAXED);
+		const Mutex::UniqueLock stats_lock(g_stats_mutex);
+		g_priority_stats.at(oldest->priority).shed += 1;
+		return true;
+	}
+	bool is_category_full(FiberControl *fiber){
+		if((g_max_jobs_per_category == 0) || !fiber){
+			return false;
+		}
+		const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+		return fiber->pending >= g_max_jobs_per_category;
+	}
+	bool is_total_full(){
+		if(g_max_jobs_total == 0){
+			return false;
+		}
+		return count_queued_jobs() >= g_max_jobs_total;
+	}
+	// 返回 false 表示任务不能入队，elem 保持不变。
+	bool admit_job_element(FiberControl *fiber, const JobElement &elem, boost::container::vector<boost::shared_ptr<JobBase> > &shed_jobs){
+		const bool category_full = is_category_full(fiber);
+		const bool total_full = is_total_full();
+		if(!category_full && !total_full){
+			return true;
+		}
+		if(g_overflow_action == OA_BACKPRESSURE){
+			// 由 EpollDaemon 暂停读取，已经收到的数据仍然处理。
+			return true;
+		}
+		if(g_overflow_action == OA_DROP_OLDEST){
+			if((!category_full || shed_oldest_job_element(fiber, shed_jobs)) && (!total_full || shed_oldest_job_element(NULLPTR, shed_jobs))){
+				return true;
+			}
+			if(!elem.droppable){
+				// 重要的任务不会被丢弃，即使超过上限。
+				return true;
+			}
+			LOG_POSEIDON_DEBUG("Job queue is full, shedding insignificant job: priority = ", elem.priority);
+			const Mutex::UniqueLock stats_lock(g_stats_mutex);
+			g_priority_stats.at(elem.priority).shed += 1;
+			return false;
+		}
+		if(!elem.rejectable && !elem.droppable){
+			// 只拒绝新的请求和消息，其他重要的任务即使超过上限也必须执行。
+			return true;
+		}
+		LOG_POSEIDON_WARNING("Job queue is full, rejecting job: priority = ", elem.priority, ", category_full = ", category_full, ", total_full = ", total_full);
+		const Mutex::UniqueLock stats_lock(g_stats_mutex);
+		g_priority_stats.at(elem.priority).rejected += 1;
+		return false;
+	}
+	bool push_job_element(const boost::weak_ptr<const void> &category, JobElement &elem, boost::container::vector<boost::shared_ptr<JobBase> > &shed_jobs){
+		AUTO(it, g_fiber_map.find(category));
+		if(!admit_job_element((it != g_fiber_map.end()) ? &(it->second) : NULLPTR, elem, shed_jobs)){
+			return false;
+		}
+		if(it == g_fiber_map.end()){
+			it = g_fiber_map.emplace(category, FiberControl::Initializer()).first;
+			it->second.category = category;
+			it->second.affinity = select_affine_thread(elem.affinity_key, elem.thread_hint);
+		}
+		const AUTO(fiber, &(it->second));
+		atomic_add(g_queued_jobs.at(elem.priority), 1, ATOMIC_RELAXED);
+		{
+			const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
+			fiber->queue.push_back(STD_MOVE(elem));
+			fiber->pending += 1;
+		}
+		make_fiber_ready(fiber);
+		return true;
+	}
 }
 
 void JobDispatcher::start(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting job dispatcher...");
 
-	//
+	const AUTO(stack_size, MainConfig::get<std::size_t>("fiber_stack_size", 0x40000));
+	const AUTO(stack_pool_size, MainConfig::get<std::size_t>("fiber_stack_pool_size", 1024));
+	const AUTO(stack_cache_size, MainConfig::get<std::size_t>("fiber_stack_thread_cache_size", 16));
+	const AUTO(stack_decommit, MainConfig::get<bool>("fiber_stack_decommit", false));
+	const AUTO(stack_region_size, MainConfig::get<std::size_t>("fiber_stack_huge_page_region", 0));
+	LOG_POSEIDON_DEBUG("Fiber stacks: stack_size = ", stack_size, ", pool_size = ", stack_pool_size,
+		", thread_cache_size = ", stack_cache_size, ", decommit = ", stack_decommit, ", huge_page_region = ", stack_region_size);
+	g_stack_allocator.configure(stack_size, stack_pool_size, stack_cache_size, stack_decommit, stack_region_size);
+
+	g_priority_aging_time = MainConfig::get<boost::uint64_t>("job_priority_aging_time", 1000);
+
+	g_max_jobs_per_category = MainConfig::get<std::size_t>("job_queue_max_per_category", 0);
+	g_max_jobs_total = MainConfig::get<std::size_t>("job_queue_max_total", 0);
+	const AUTO(overflow_action, MainConfig::get<std::string>("job_queue_overflow_action", "reject"));
+	if(overflow_action == "drop_oldest"){
+		g_overflow_action = OA_DROP_OLDEST;
+	} else if(overflow_action == "backpressure"){
+		g_overflow_action = OA_BACKPRESSURE;
+	} else {
+		if(overflow_action != "reject"){
+			LOG_POSEIDON_WARNING("Unknown job queue overflow action: ", overflow_action, ". Falling back to reject.");
+		}
+		g_overflow_action = OA_REJECT;
+	}
+	LOG_POSEIDON_DEBUG("Job queue bounds: max_per_category = ", g_max_jobs_per_category, ", max_total = ", g_max_jobs_total,
+		", overflow_action = ", static_cast<int>(g_overflow_action));
+
+	// 主线程之外的任务线程。不同类别的任务可以并行执行。
+	const AUTO(thread_count, MainConfig::get<std::size_t>("job_thread_count", 0));
+	const AUTO(category_affinity, MainConfig::get<bool>("job_category_affinity", true));
+	g_steal_threshold = std::max<std::size_t>(MainConfig::get<std::size_t>("job_steal_threshold", 4), 1);
+	g_steal_delay = MainConfig::get<boost::uint64_t>("job_steal_delay", 20);
+	LOG_POSEIDON_DEBUG("Job threads: thread_count = ", thread_count, ", category_affinity = ", category_affinity,
+		", steal_threshold = ", g_steal_threshold, ", steal_delay = ", g_steal_delay);
+	atomic_store(g_workers_running, true, ATOMIC_RELEASE);
+	{
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		g_pinned_fibers.resize(thread_count + 1);
+		while(g_wakeups.size() < thread_count + 1){
+			g_wakeups.push_back(boost::make_shared<ConditionVariable>());
+		}
+		if(category_affinity && (thread_count != 0)){
+			g_affine_fibers.resize(thread_count + 1);
+		}
+	}
+	g_workers.reserve(thread_count);
+	for(std::size_t i = 0; i < thread_count; ++i){
+		AUTO(thread, boost::make_shared<Thread>(boost::bind(&worker_proc, static_cast<unsigned>(i + 1)), sslit("   J"), sslit("Job")));
+		g_workers.push_back(STD_MOVE(thread));
+	}
 }
 void JobDispatcher::stop(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping job dispatcher...");
 
+	atomic_store(g_workers_running, false, ATOMIC_RELEASE);
+	{
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		for(AUTO(it, g_wakeups.begin()); it != g_wakeups.end(); ++it){
+			(*it)->signal();
+		}
+	}
+	for(AUTO(it, g_workers.begin()); it != g_workers.end(); ++it){
+		(*it)->join();
+	}
+	g_workers.clear();
+	{
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		// 任务线程都已经退出，剩余的 fiber 都由当前线程执行。
+		for(AUTO(it, g_affine_fibers.begin()); it != g_affine_fibers.end(); ++it){
+			for(unsigned i = 0; i < PRIORITY_COUNT; ++i){
+				g_ready_fibers.at(i).insert(g_ready_fibers.at(i).end(), it->at(i).begin(), it->at(i).end());
+			}
+		}
+		g_affine_fibers.clear();
+	}
+
+	const AUTO(drain_begin, get_fast_mono_clock());
+	std::size_t initial_fibers = 0;
 	boost::uint64_t last_info_time = 0;
+	unsigned timeout = 0;
 	for(;;){
 		std::size_t pending_fibers;
 		{
@@ -257,6 +1372,9 @@ void JobDispatcher::stop(){
 		if(pending_fibers == 0){
 			break;
 		}
+		if(initial_fibers == 0){
+			initial_fibers = pending_fibers;
+		}
 
 		const AUTO(now, get_fast_mono_clock());
 		if(last_info_time + 500 < now){
@@ -264,48 +1382,58 @@ void JobDispatcher::stop(){
 			last_info_time = now;
 		}
 
-		pump_one_round(true);
+		sweep_fibers(true);
+		const bool busy = pump_one_round(true);
+		timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+		if(busy){
+			continue;
+		}
+		// 剩下的 fiber 都在等待其他线程，例如数据库线程完成 Promise。它们就绪时会通知条件变量。
+		Mutex::UniqueLock lock(g_fiber_map_mutex);
+		wait_for_fibers(lock, timeout);
 	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Job dispatcher drained: pending_fibers = ", initial_fibers, ", elapsed = ", get_fast_mono_clock() - drain_begin, " ms");
+	g_stack_allocator.flush_thread_cache();
+	g_stack_allocator.clear();
 }
 
 void JobDispatcher::do_modal(const volatile bool &running){
-	unsigned timeout = 0;
-	for(;;){
-		bool busy;
-		do {
-			busy = pump_one_round(!atomic_load(running, ATOMIC_CONSUME));
-			timeout = std::min(timeout * 2u + 1u, !busy * 100u);
-		} while(busy);
-
-		Mutex::UniqueLock lock(g_fiber_map_mutex);
-		if(!atomic_load(running, ATOMIC_CONSUME)){
-			break;
-		}
-		g_new_job.timed_wait(lock, timeout);
-	}
+	run_loop(running);
 }
 
-void JobDispatcher::enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn){
+bool JobDispatcher::enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn){
 	PROFILE_ME;
 
-	const boost::weak_ptr<const void> null_weak_ptr;
-	AUTO(category, job->get_category());
-	if(!(category < null_weak_ptr) && !(null_weak_ptr < category)){
-		category = job;
-	}
+	// 被拒绝和丢弃的任务在锁外销毁。
+	boost::container::vector<boost::shared_ptr<JobBase> > shed_jobs;
+	boost::weak_ptr<const void> category;
+	JobElement elem = VAL_INIT;
+	prepare_job_element(category, elem, STD_MOVE(job), STD_MOVE(withdrawn));
 
 	const Mutex::UniqueLock lock(g_fiber_map_mutex);
-	AUTO(it, g_fiber_map.find(category));
-	if(it == g_fiber_map.end()){
-		it = g_fiber_map.emplace(category, FiberControl::Initializer()).first;
+	return push_job_element(category, elem, shed_jobs);
+}
+std::size_t JobDispatcher::enqueue_batch(boost::container::vector<boost::shared_ptr<JobBase> > &jobs, const boost::shared_ptr<const bool> &withdrawn){
+	PROFILE_ME;
+
+	if(jobs.empty()){
+		return 0;
 	}
-	const AUTO(fiber, &(it->second));
-	{
-		const RecursiveMutex::UniqueLock queue_lock(fiber->queue_mutex);
-		JobElement elem = { STD_MOVE(job), STD_MOVE(withdrawn) };
-		fiber->queue.push_back(STD_MOVE(elem));
+	// 在锁外调用任务的虚函数，然后只加锁一次。
+	boost::container::vector<std::pair<boost::weak_ptr<const void>, JobElement> > elems;
+	elems.resize(jobs.size());
+	for(std::size_t i = 0; i < jobs.size(); ++i){
+		prepare_job_element(elems.at(i).first, elems.at(i).second, STD_MOVE(jobs.at(i)), withdrawn);
+	}
+	jobs.clear();
+
+	boost::container::vector<boost::shared_ptr<JobBase> > shed_jobs;
+	std::size_t count = 0;
+	const Mutex::UniqueLock lock(g_fiber_map_mutex);
+	for(AUTO(it, elems.begin()); it != elems.end(); ++it){
+		count += push_job_element(it->first, it->second, shed_jobs);
 	}
-	g_new_job.signal();
+	return count;
 }
 void JobDispatcher::yield(boost::shared_ptr<const Promise> promise, bool insignificant){
 	PROFILE_ME;
@@ -319,20 +1447,25 @@ void JobDispatcher::yield(boost::shared_ptr<const Promise> promise, bool insigni
 	if(promise && promise->is_satisfied()){
 		LOG_POSEIDON_TRACE("Skipped yielding from fiber ", static_cast<void *>(fiber));
 	} else {
+		// 没有栈的任务运行在调度线程的栈上，无法挂起。
+		DEBUG_THROW_UNLESS(fiber->stack, Exception, sslit("Non-yieldable job attempted to yield"));
 		LOG_POSEIDON_TRACE("Yielding from fiber ", static_cast<void *>(fiber));
-		const AUTO(job_timeout, MainConfig::get<boost::uint64_t>("job_timeout", 60000));
+		const AUTO(job_timeout, g_job_timeout.get());
 		AUTO_REF(elem, fiber->queue.front());
 		elem.promise = promise;
-		elem.expiry_time = saturated_add(get_fast_mono_clock(), job_timeout);
+		elem.expiry_time = saturated_add(get_coarse_mono_clock(), job_timeout);
 		elem.insignificant = insignificant;
+		elem.yields += 1;
+		// Promise 被满足时把这个 fiber 放入就绪队列。没有 Promise 时只是让出，下一轮就可以继续。
+		if(promise){
+			promise->add_waiter(boost::bind(&wake_category, fiber->category));
+		} else {
+			wake_category(fiber->category);
+		}
 		const AUTO(profiler_hook, Profiler::begin_stack_switch());
 		{
 			fiber->state = FS_YIELDED;
-			if(::swapcontext(&(fiber->inner), &(fiber->outer)) != 0){
-				const int err_code = errno;
-				LOG_POSEIDON_FATAL("::swapcontext() failed: err_code = ", err_code);
-				std::abort();
-			}
+			switch_fiber_context(fiber->inner, fiber->outer);
 		}
 		Profiler::end_stack_switch(profiler_hook);
 		LOG_POSEIDON_TRACE("Resumed to fiber ", static_cast<void *>(fiber));
@@ -343,4 +1476,144 @@ void JobDispatcher::yield(boost::shared_ptr<const Promise> promise, bool insigni
 	}
 }
 
+
+void JobDispatcher::snapshot(boost::container::vector<SnapshotElement> &ret){
+	PROFILE_ME;
+
+	boost::array<unsigned long long, PRIORITY_COUNT> ready_fibers = { };
+	{
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		for(unsigned i = 0; i < PRIORITY_COUNT; ++i){
+			ready_fibers.at(i) += g_ready_fibers.at(i).size();
+			for(AUTO(it, g_pinned_fibers.begin()); it != g_pinned_fibers.end(); ++it){
+				ready_fibers.at(i) += it->at(i).size();
+			}
+			for(AUTO(it, g_affine_fibers.begin()); it != g_affine_fibers.end(); ++it){
+				ready_fibers.at(i) += it->at(i).size();
+			}
+		}
+	}
+	boost::array<PriorityStats, PRIORITY_COUNT> stats;
+	{
+		const Mutex::UniqueLock stats_lock(g_stats_mutex);
+		stats = g_priority_stats;
+	}
+	ret.reserve(ret.size() + PRIORITY_COUNT);
+	for(unsigned i = 0; i < PRIORITY_COUNT; ++i){
+		SnapshotElement elem = { };
+		elem.priority = i;
+		elem.ready_fibers = ready_fibers.at(i);
+		elem.queued_jobs = atomic_load(g_queued_jobs.at(i), ATOMIC_RELAXED);
+		elem.started = stats.at(i).started;
+		elem.dropped = stats.at(i).dropped;
+		elem.rejected = stats.at(i).rejected;
+		elem.shed = stats.at(i).shed;
+		elem.average_wait = (stats.at(i).started != 0) ? stats.at(i).total_wait / static_cast<double>(stats.at(i).started) : 0.0;
+		elem.max_wait = stats.at(i).max_wait;
+		elem.wait_p50 = stats.at(i).wait_histogram.get_percentile(0.50) / 1000;
+		elem.wait_p90 = stats.at(i).wait_histogram.get_percentile(0.90) / 1000;
+		elem.wait_p99 = stats.at(i).wait_histogram.get_percentile(0.99) / 1000;
+		elem.completed = stats.at(i).completed;
+		elem.run_p50 = stats.at(i).run_histogram.get_percentile(0.50) / 1000;
+		elem.run_p90 = stats.at(i).run_histogram.get_percentile(0.90) / 1000;
+		elem.run_p99 = stats.at(i).run_histogram.get_percentile(0.99) / 1000;
+		elem.max_run = stats.at(i).run_histogram.max / 1000;
+		elem.yields = stats.at(i).yields;
+		elem.yields_p99 = stats.at(i).yield_histogram.get_percentile(0.99);
+		elem.max_yields = stats.at(i).yield_histogram.max;
+		ret.push_back(elem);
+	}
+}
+namespace {
+	// 按照积压的任务数从多到少排列，相同时等待最久的在前。
+	bool category_comparator(const JobDispatcher::CategorySnapshotElement &lhs, const JobDispatcher::CategorySnapshotElement &rhs){
+		if(lhs.pending != rhs.pending){
+			return lhs.pending > rhs.pending;
+		}
+		return lhs.oldest_wait > rhs.oldest_wait;
+	}
+}
+void JobDispatcher::snapshot_categories(boost::container::vector<CategorySnapshotElement> &ret, std::size_t limit){
+	PROFILE_ME;
+
+	const AUTO(now, get_hi_res_mono_clock());
+	boost::container::vector<CategorySnapshotElement> categories;
+	{
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		categories.reserve(g_fiber_map.size());
+		for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); ++it){
+			AUTO_REF(fiber, it->second);
+			const RecursiveMutex::UniqueLock queue_lock(fiber.queue_mutex);
+			CategorySnapshotElement elem = { };
+			elem.fiber = &fiber;
+			elem.pending = fiber.pending;
+			elem.yielded = (fiber.state == FS_YIELDED);
+			if(!fiber.queue.empty()){
+				const AUTO_REF(front, fiber.queue.front());
+				elem.oldest_wait = std::max(now - front.enqueue_time, 0.0);
+				if(front.job){
+					elem.job_type = typeid(*front.job).name();
+				}
+			}
+			elem.started = fiber.started;
+			elem.completed = fiber.completed;
+			elem.yields = fiber.yields;
+			elem.average_wait = (fiber.started != 0) ? fiber.total_wait / static_cast<double>(fiber.started) : 0.0;
+			elem.average_run = (fiber.completed != 0) ? fiber.total_run / static_cast<double>(fiber.completed) : 0.0;
+			elem.max_run = fiber.max_run;
+			categories.push_back(STD_MOVE(elem));
+		}
+	}
+	const AUTO(count, std::min(limit, categories.size()));
+	std::partial_sort(categories.begin(), categories.begin() + static_cast<std::ptrdiff_t>(count), categories.end(), &category_comparator);
+	ret.reserve(ret.size() + count);
+	for(std::size_t i = 0; i < count; ++i){
+		ret.push_back(STD_MOVE(categories.at(i)));
+	}
+}
+void JobDispatcher::get_queue_depth(QueueDepth &ret){
+	PROFILE_ME;
+
+	static const char *const OVERFLOW_ACTION_NAMES[] = { "reject", "drop_oldest", "backpressure" };
+
+	ret.total_jobs = count_queued_jobs();
+	ret.max_total_jobs = g_max_jobs_total;
+	ret.categories = 0;
+	ret.max_category_jobs = 0;
+	ret.max_jobs_per_category = g_max_jobs_per_category;
+	ret.overflow_action = OVERFLOW_ACTION_NAMES[g_overflow_action];
+	ret.backlogged_reads = atomic_load(g_backlogged_reads, ATOMIC_RELAXED);
+
+	const Mutex::UniqueLock lock(g_fiber_map_mutex);
+	ret.stolen_fibers = g_stolen_fibers;
+	ret.categories = g_fiber_map.size();
+	for(AUTO(it, g_fiber_map.begin()); it != g_fiber_map.end(); ++it){
+		const RecursiveMutex::UniqueLock queue_lock(it->second.queue_mutex);
+		ret.max_category_jobs = std::max<unsigned long long>(ret.max_category_jobs, it->second.pending);
+	}
+}
+void JobDispatcher::get_fiber_stack_status(FiberStackStatus &ret){
+	g_stack_allocator.get_status(ret);
+}
+bool JobDispatcher::is_backlogged(const boost::weak_ptr<const void> &category){
+	if(g_overflow_action != OA_BACKPRESSURE){
+		return false;
+	}
+	bool backlogged = is_total_full();
+	if(!backlogged && (g_max_jobs_per_category != 0)){
+		const Mutex::UniqueLock lock(g_fiber_map_mutex);
+		const AUTO(it, g_fiber_map.find(category));
+		backlogged = (it != g_fiber_map.end()) && is_category_full(&(it->second));
+	}
+	if(backlogged){
+		atomic_add(g_backlogged_reads, 1, ATOMIC_RELAXED);
+	}
+	return backlogged;
+}
+
+bool JobDispatcher::has_pending_jobs(const boost::weak_ptr<const void> &category){
+	const Mutex::UniqueLock lock(g_fiber_map_mutex);
+	return g_fiber_map.find(category) != g_fiber_map.end();
+}
+
 }
@@ -5,7 +5,10 @@
 #define POSEIDON_SINGLETONS_JOB_DISPATCHER_HPP_
 
 #include "../cxx_ver.hpp"
+#include <string>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 
@@ -13,6 +16,64 @@ class JobBase;
 class Promise;
 
 class JobDispatcher {
+public:
+	struct SnapshotElement {
+		unsigned priority; // JobBase::Priority。
+		unsigned long long ready_fibers; // 当前等待执行的 fiber 数。
+		unsigned long long queued_jobs; // 当前排队的任务数，包括正在执行和挂起的任务。
+		unsigned long long started; // 开始执行的任务数。
+		unsigned long long dropped; // 因为超过期限而被丢弃的任务数。
+		unsigned long long rejected; // 因为队列已满而被拒绝的任务数。
+		unsigned long long shed; // 因为队列已满而被丢弃的不重要的任务数。
+		double average_wait; // 从投递到开始执行的平均毫秒数。
+		double max_wait; // 从投递到开始执行的最大毫秒数。
+		// 以下分位数来自以 2 的幂为边界的直方图，在桶内线性插值。
+		double wait_p50;
+		double wait_p90;
+		double wait_p99;
+		unsigned long long completed; // 执行完毕的任务数。
+		double run_p50; // 每个任务在 fiber 中执行的毫秒数，不包括挂起的时间。
+		double run_p90;
+		double run_p99;
+		double max_run;
+		unsigned long long yields; // 执行完毕的任务挂起的总次数。
+		double yields_p99; // 每个任务挂起的次数。
+		double max_yields;
+	};
+	struct CategorySnapshotElement {
+		const void *fiber; // 只用于区分不同的类别。
+		std::string job_type; // 队首任务的 typeid。
+		unsigned long long pending; // 排队的任务数。
+		bool yielded; // 队首任务是否挂起。
+		double oldest_wait; // 队首任务投递至今的毫秒数。
+		// 以下统计从这个类别最近一次进入队列开始。
+		unsigned long long started;
+		unsigned long long completed;
+		unsigned long long yields;
+		double average_wait;
+		double average_run;
+		double max_run;
+	};
+	struct QueueDepth {
+		unsigned long long total_jobs;
+		unsigned long long max_total_jobs; // 0 表示不限制。
+		unsigned long long categories;
+		unsigned long long max_category_jobs; // 最长的类别中的任务数。
+		unsigned long long max_jobs_per_category; // 0 表示不限制。
+		const char *overflow_action;
+		unsigned long long backlogged_reads; // 因为任务队列已满而推迟读取套接字的次数。
+		unsigned long long stolen_fibers; // 因为负载不均衡而由亲和的线程之外的线程执行的次数。
+	};
+	struct FiberStackStatus {
+		unsigned long long stack_size; // 每个栈的字节数，不包括保护页。
+		unsigned long long live_stacks; // 已经分配的栈数，包括正在使用的、公共池中的和各个线程缓存的。
+		unsigned long long pooled_stacks; // 公共池中空闲的栈数。
+		unsigned long long pool_capacity;
+		unsigned long long region_stacks; // 大页区域切分出的栈数，没有启用时为 0。
+		unsigned long long region_free_stacks;
+		const char *region_backing; // 参见 HugePageBacking。
+	};
+
 private:
 	JobDispatcher();
 
@@ -22,9 +83,23 @@ public:
 
 	static void do_modal(const volatile bool &running);
 
-	static void enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn);
+	// 返回 false 表示队列已满，任务被拒绝或者丢弃。只有 is_rejectable() 或 is_insignificant() 返回 true 的任务会被拒绝或者丢弃。
+	static bool enqueue(boost::shared_ptr<JobBase> job, boost::shared_ptr<const bool> withdrawn);
+	// 一次投递多个任务，只加锁一次。jobs 中的任务被取走，返回时 jobs 为空。返回入队的任务数。
+	static std::size_t enqueue_batch(boost::container::vector<boost::shared_ptr<JobBase> > &jobs, const boost::shared_ptr<const bool> &withdrawn);
 	// Pass `promise` by value to avoid false aliasing.
 	static void yield(boost::shared_ptr<const Promise> promise, bool insignificant);
+
+	// 每个优先级一个元素。
+	static void snapshot(boost::container::vector<SnapshotElement> &ret);
+	// 返回积压最多的 limit 个类别。
+	static void snapshot_categories(boost::container::vector<CategorySnapshotElement> &ret, std::size_t limit);
+	static void get_queue_depth(QueueDepth &ret);
+	static void get_fiber_stack_status(FiberStackStatus &ret);
+	// 溢出策略为 backpressure 且队列已满时返回 true，EpollDaemon 据此暂停读取对应的套接字。
+	static bool is_backlogged(const boost::weak_ptr<const void> &category);
+	// 这个类别中有排队、正在执行或者挂起的任务时返回 true。
+	static bool has_pending_jobs(const boost::weak_ptr<const void> &category);
 };
 
 }
@@ -27,6 +27,58 @@ namespace {
 
 	Mutex g_mutex;
 	boost::shared_ptr<ConfigFile> g_config;
+
+	// ConfigValue 可能在其他翻译单元的静态初始化期间构造，所以这些数据在第一次使用时才构造。
+	struct ConfigValueRegistry {
+		Mutex mutex;
+		boost::shared_ptr<const ConfigFile> config;
+		ConfigValueBase *head;
+
+		ConfigValueRegistry()
+			: head(NULLPTR)
+		{ }
+	};
+
+	ConfigValueRegistry &get_config_value_registry(){
+		static ConfigValueRegistry s_registry;
+		return s_registry;
+	}
+}
+
+void ConfigValueBase::register_self(){
+	AUTO_REF(registry, get_config_value_registry());
+	const Mutex::UniqueLock lock(registry.mutex);
+	m_prev = NULLPTR;
+	m_next = registry.head;
+	if(m_next){
+		m_next->m_prev = this;
+	}
+	registry.head = this;
+	if(registry.config){
+		MainConfig::refresh_value(*this, *registry.config);
+	}
+}
+void ConfigValueBase::unregister_self() NOEXCEPT {
+	AUTO_REF(registry, get_config_value_registry());
+	const Mutex::UniqueLock lock(registry.mutex);
+	if(m_prev){
+		m_prev->m_next = m_next;
+	} else {
+		registry.head = m_next;
+	}
+	if(m_next){
+		m_next->m_prev = m_prev;
+	}
+	m_prev = NULLPTR;
+	m_next = NULLPTR;
+}
+
+void MainConfig::refresh_value(ConfigValueBase &value, const ConfigFile &file) NOEXCEPT {
+	try {
+		value.refresh(file);
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("Invalid value for `", value.get_key(), "` in main config file, using the default value: what = ", e.what());
+	}
 }
 
 void MainConfig::set_run_path(const char *path){
@@ -39,8 +91,18 @@ void MainConfig::reload(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Loading main config file: ", g_main_conf_name);
 	AUTO(config, boost::make_shared<ConfigFile>(g_main_conf_name));
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Done loading main config file: ", g_main_conf_name);
-	const Mutex::UniqueLock lock(g_mutex);
-	g_config.swap(config);
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		g_config.swap(config);
+		config = g_config;
+	}
+
+	AUTO_REF(registry, get_config_value_registry());
+	const Mutex::UniqueLock lock(registry.mutex);
+	registry.config = config;
+	for(AUTO(value, registry.head); value; value = value->m_next){
+		refresh_value(*value, *config);
+	}
 }
 
 boost::shared_ptr<const ConfigFile> MainConfig::get_file(){
@@ -5,14 +5,24 @@
 #define POSEIDON_SINGLETONS_MAIN_CONFIG_HPP_
 
 #include "../config_file.hpp"
+#include "../atomic.hpp"
+#include <cstring>
 #include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_arithmetic.hpp>
 
 namespace Poseidon {
 
+class ConfigValueBase;
+
 class MainConfig {
+	friend ConfigValueBase;
+
 private:
 	MainConfig();
 
+	static void refresh_value(ConfigValueBase &value, const ConfigFile &file) NOEXCEPT;
+
 public:
 	static void set_run_path(const char *path);
 	static void reload();
@@ -61,6 +71,85 @@ public:
 	}
 };
 
+// 预先解析的配置项。构造时和每次 MainConfig::reload() 之后重新解析，get() 只是一次原子读取，不加锁也不查找字符串。
+// 用于热路径上按操作读取的配置，应当定义为命名空间作用域或者函数内的静态对象。解析失败时使用默认值。
+class ConfigValueBase : NONCOPYABLE {
+	friend MainConfig;
+
+private:
+	const char *const m_key;
+	ConfigValueBase *m_prev;
+	ConfigValueBase *m_next;
+
+protected:
+	explicit ConfigValueBase(const char *key) NOEXCEPT
+		: m_key(key), m_prev(NULLPTR), m_next(NULLPTR)
+	{ }
+	~ConfigValueBase(){ }
+
+protected:
+	// 派生类在构造函数的末尾和析构函数的开头调用。
+	void register_self();
+	void unregister_self() NOEXCEPT;
+
+	virtual void refresh(const ConfigFile &file) = 0;
+
+public:
+	const char *get_key() const NOEXCEPT {
+		return m_key;
+	}
+};
+
+// 只支持算术类型，按位存放在一个 64 位的原子变量中。
+template<typename T>
+class ConfigValue : public ConfigValueBase {
+	BOOST_STATIC_ASSERT((boost::is_arithmetic<T>::value && (sizeof(T) <= sizeof(boost::uint64_t))));
+
+private:
+	static boost::uint64_t to_bits(T val) NOEXCEPT {
+		boost::uint64_t bits = 0;
+		std::memcpy(&bits, &val, sizeof(val));
+		return bits;
+	}
+	static T from_bits(boost::uint64_t bits) NOEXCEPT {
+		T val;
+		std::memcpy(&val, &bits, sizeof(val));
+		return val;
+	}
+
+private:
+	const T m_def_val;
+	volatile boost::uint64_t m_bits;
+
+public:
+	template<typename DefValT>
+	ConfigValue(const char *key, const DefValT &def_val)
+		: ConfigValueBase(key), m_def_val(static_cast<T>(def_val)), m_bits(to_bits(m_def_val))
+	{
+		register_self();
+	}
+	~ConfigValue(){
+		unregister_self();
+	}
+
+protected:
+	void refresh(const ConfigFile &file) OVERRIDE {
+		T val;
+		try {
+			file.get<T>(val, get_key(), m_def_val);
+		} catch(...){
+			atomic_store(m_bits, to_bits(m_def_val), ATOMIC_RELAXED);
+			throw;
+		}
+		atomic_store(m_bits, to_bits(val), ATOMIC_RELAXED);
+	}
+
+public:
+	T get() const NOEXCEPT {
+		return from_bits(atomic_load(m_bits, ATOMIC_RELAXED));
+	}
+};
+
 }
 
 #endif
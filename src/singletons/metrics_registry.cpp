@@ -0,0 +1,265 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "metrics_registry.hpp"
+#include "../stream_buffer.hpp"
+#include "../mutex.hpp"
+#include "../atomic.hpp"
+#include "../log.hpp"
+#include "../exception.hpp"
+#include "../profiler.hpp"
+
+namespace Poseidon {
+
+typedef MetricsRegistry::MetricsCallback MetricsCallback;
+
+class MetricsCollector : NONCOPYABLE {
+private:
+	MetricsCallback m_callback;
+
+public:
+	explicit MetricsCollector(MetricsCallback callback)
+		: m_callback(STD_MOVE_IDN(callback))
+	{ }
+
+public:
+	const MetricsCallback &get_callback() const {
+		return m_callback;
+	}
+};
+
+namespace {
+	bool is_valid_name(const char *name){
+		if(!name || !*name || std::isdigit(static_cast<unsigned char>(*name))){
+			return false;
+		}
+		for(const char *read = name; *read; ++read){
+			const char ch = *read;
+			if(!std::isalnum(static_cast<unsigned char>(ch)) && (ch != '_') && (ch != ':')){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// HELP 和标签值中的反斜杠、换行符要转义，标签值中的双引号也要转义。
+	void put_escaped(StreamBuffer &buffer, const char *str, bool quoted){
+		for(const char *read = str; *read; ++read){
+			const char ch = *read;
+			if(ch == '\\'){
+				buffer.put("\\\\");
+			} else if(ch == '\n'){
+				buffer.put("\\n");
+			} else if(quoted && (ch == '"')){
+				buffer.put("\\\"");
+			} else {
+				buffer.put(ch);
+			}
+		}
+	}
+
+	struct MetricElement {
+		std::string name;
+		std::string help;
+		boost::weak_ptr<MetricsCounter> counter;
+		boost::weak_ptr<MetricsGauge> gauge;
+		boost::weak_ptr<const MetricsCollector> collector;
+	};
+
+	Mutex g_mutex;
+	boost::container::vector<MetricElement> g_metrics;
+
+	// 调用者必须持有 g_mutex。
+	void prune_expired_unlocked(){
+		AUTO(write, g_metrics.begin());
+		for(AUTO(read, g_metrics.begin()); read != g_metrics.end(); ++read){
+			if(read->counter.expired() && read->gauge.expired() && read->collector.expired()){
+				continue;
+			}
+			if(write != read){
+				*write = STD_MOVE(*read);
+			}
+			++write;
+		}
+		g_metrics.erase(write, g_metrics.end());
+	}
+	void add_metric_unlocked(MetricElement &elem){
+		prune_expired_unlocked();
+		if(!elem.name.empty()){
+			for(AUTO(it, g_metrics.begin()); it != g_metrics.end(); ++it){
+				DEBUG_THROW_UNLESS(it->name != elem.name, Exception, sslit("Duplicate metric name"));
+			}
+		}
+		g_metrics.push_back(STD_MOVE(elem));
+	}
+}
+
+MetricsWriter::MetricsWriter(StreamBuffer &buffer)
+	: m_buffer(buffer), m_name(), m_counter(false)
+{ }
+
+void MetricsWriter::begin(const char *name, const char *type, const char *help){
+	DEBUG_THROW_UNLESS(is_valid_name(name), Exception, sslit("Invalid metric name"));
+
+	m_name = name;
+	m_counter = (std::strcmp(type, "counter") == 0);
+
+	m_buffer.put("# TYPE ");
+	m_buffer.put(name);
+	m_buffer.put(' ');
+	m_buffer.put(type);
+	m_buffer.put('\n');
+	if(help && *help){
+		m_buffer.put("# HELP ");
+		m_buffer.put(name);
+		m_buffer.put(' ');
+		put_escaped(m_buffer, help, false);
+		m_buffer.put('\n');
+	}
+}
+void MetricsWriter::put(double value, const char *const (*labels)[2]){
+	char str[64];
+	if(value != value){
+		std::strcpy(str, "NaN");
+	} else if(value > DBL_MAX){
+		std::strcpy(str, "+Inf");
+	} else if(value < -DBL_MAX){
+		std::strcpy(str, "-Inf");
+	} else {
+		::snprintf(str, sizeof(str), "%.17g", value);
+	}
+
+	DEBUG_THROW_ASSERT(!m_name.empty());
+	m_buffer.put(m_name);
+	if(m_counter){
+		m_buffer.put("_total");
+	}
+	if(labels && (*labels)[0]){
+		m_buffer.put('{');
+		for(AUTO(ptr, labels); (*ptr)[0]; ++ptr){
+			if(ptr != labels){
+				m_buffer.put(',');
+			}
+			m_buffer.put((*ptr)[0]);
+			m_buffer.put("=\"");
+			put_escaped(m_buffer, (*ptr)[1], true);
+			m_buffer.put('"');
+		}
+		m_buffer.put('}');
+	}
+	m_buffer.put(' ');
+	m_buffer.put(str);
+	m_buffer.put('\n');
+}
+void MetricsWriter::put(unsigned long long value, const char *const (*labels)[2]){
+	put(static_cast<double>(value), labels);
+}
+void MetricsWriter::put(long long value, const char *const (*labels)[2]){
+	put(static_cast<double>(value), labels);
+}
+void MetricsWriter::finish(){
+	m_buffer.put("# EOF\n");
+	m_name.clear();
+}
+
+boost::uint64_t MetricsCounter::get() const NOEXCEPT {
+	return atomic_load(m_value, ATOMIC_RELAXED);
+}
+void MetricsCounter::increment(boost::uint64_t delta) NOEXCEPT {
+	atomic_add(m_value, delta, ATOMIC_RELAXED);
+}
+
+boost::int64_t MetricsGauge::get() const NOEXCEPT {
+	return atomic_load(m_value, ATOMIC_RELAXED);
+}
+void MetricsGauge::set(boost::int64_t value) NOEXCEPT {
+	atomic_store(m_value, value, ATOMIC_RELAXED);
+}
+void MetricsGauge::add(boost::int64_t delta) NOEXCEPT {
+	atomic_add(m_value, delta, ATOMIC_RELAXED);
+}
+
+boost::shared_ptr<MetricsCounter> MetricsRegistry::register_counter(const char *name, const char *help){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(is_valid_name(name), Exception, sslit("Invalid metric name"));
+	AUTO(counter, boost::make_shared<MetricsCounter>());
+	MetricElement elem;
+	elem.name = name;
+	elem.help = help ? help : "";
+	elem.counter = counter;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		add_metric_unlocked(elem);
+	}
+	LOG_POSEIDON_DEBUG("Registered metrics counter: name = ", name);
+	return counter;
+}
+boost::shared_ptr<MetricsGauge> MetricsRegistry::register_gauge(const char *name, const char *help){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(is_valid_name(name), Exception, sslit("Invalid metric name"));
+	AUTO(gauge, boost::make_shared<MetricsGauge>());
+	MetricElement elem;
+	elem.name = name;
+	elem.help = help ? help : "";
+	elem.gauge = gauge;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		add_metric_unlocked(elem);
+	}
+	LOG_POSEIDON_DEBUG("Registered metrics gauge: name = ", name);
+	return gauge;
+}
+boost::shared_ptr<const MetricsCollector> MetricsRegistry::register_collector(MetricsCallback callback){
+	PROFILE_ME;
+
+	AUTO(collector, boost::make_shared<MetricsCollector>(STD_MOVE_IDN(callback)));
+	MetricElement elem;
+	elem.collector = collector;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		add_metric_unlocked(elem);
+	}
+	return STD_MOVE_IDN(collector);
+}
+
+void MetricsRegistry::collect(MetricsWriter &writer){
+	PROFILE_ME;
+
+	// 在锁外读取指标和调用回调函数，以免一个较慢的回调函数阻塞注册。
+	boost::container::vector<MetricElement> metrics;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		prune_expired_unlocked();
+		metrics = g_metrics;
+	}
+	for(AUTO(it, metrics.begin()); it != metrics.end(); ++it){
+		const AUTO(counter, it->counter.lock());
+		if(counter){
+			writer.begin(it->name.c_str(), "counter", it->help.c_str());
+			writer.put(static_cast<unsigned long long>(counter->get()));
+			continue;
+		}
+		const AUTO(gauge, it->gauge.lock());
+		if(gauge){
+			writer.begin(it->name.c_str(), "gauge", it->help.c_str());
+			writer.put(static_cast<long long>(gauge->get()));
+			continue;
+		}
+		const AUTO(collector, it->collector.lock());
+		if(collector){
+			try {
+				collector->get_callback()(writer);
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown in metrics collector: what = ", e.what());
+			} catch(...){
+				LOG_POSEIDON_ERROR("Unknown exception thrown in metrics collector.");
+			}
+			continue;
+		}
+	}
+}
+
+}
@@ -0,0 +1,90 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SINGLETONS_METRICS_REGISTRY_HPP_
+#define POSEIDON_SINGLETONS_METRICS_REGISTRY_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+class StreamBuffer;
+
+// 以 OpenMetrics 文本格式输出指标。
+// 每个指标族先调用 begin()，然后调用若干次 put() 输出样本，全部输出之后调用 finish()。
+class MetricsWriter : NONCOPYABLE {
+private:
+	StreamBuffer &m_buffer;
+	std::string m_name;
+	bool m_counter;
+
+public:
+	explicit MetricsWriter(StreamBuffer &buffer);
+
+public:
+	// type 为 "counter" 或 "gauge"。计数器的名字不带 _total 后缀，输出样本时自动添加。
+	void begin(const char *name, const char *type, const char *help);
+	// labels 是以 { NULLPTR } 结尾的 { 标签名, 标签值 } 数组，标签值会被转义。
+	void put(double value, const char *const (*labels)[2] = NULLPTR);
+	void put(unsigned long long value, const char *const (*labels)[2] = NULLPTR);
+	void put(long long value, const char *const (*labels)[2] = NULLPTR);
+	void finish();
+};
+
+class MetricsCounter : NONCOPYABLE {
+private:
+	volatile boost::uint64_t m_value;
+
+public:
+	MetricsCounter()
+		: m_value(0)
+	{ }
+
+public:
+	boost::uint64_t get() const NOEXCEPT;
+	void increment(boost::uint64_t delta = 1) NOEXCEPT;
+};
+
+class MetricsGauge : NONCOPYABLE {
+private:
+	volatile boost::int64_t m_value;
+
+public:
+	MetricsGauge()
+		: m_value(0)
+	{ }
+
+public:
+	boost::int64_t get() const NOEXCEPT;
+	void set(boost::int64_t value) NOEXCEPT;
+	void add(boost::int64_t delta) NOEXCEPT;
+};
+
+class MetricsCollector; // 没有定义的类，当作句柄使用。
+
+// 模块通过这里向 /metrics 添加自己的指标。以 poseidon_ 开头的名字保留给框架自身使用。
+class MetricsRegistry {
+private:
+	MetricsRegistry();
+
+public:
+	// 每次输出 /metrics 时调用，可以输出任意多个指标族，但是不得调用 finish()。
+	typedef boost::function<void (MetricsWriter &writer)> MetricsCallback;
+
+	// 返回的 shared_ptr 是该指标的唯一持有者。名字不得重复。
+	static boost::shared_ptr<MetricsCounter> register_counter(const char *name, const char *help);
+	static boost::shared_ptr<MetricsGauge> register_gauge(const char *name, const char *help);
+	static boost::shared_ptr<const MetricsCollector> register_collector(MetricsCallback callback);
+
+	// 按照注册的顺序输出所有仍然有效的指标。
+	static void collect(MetricsWriter &writer);
+};
+
+}
+
+#endif
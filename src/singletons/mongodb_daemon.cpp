@@ -21,6 +21,9 @@
 #include "../errno.hpp"
 #include "../buffer_streams.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../replica_set.hpp"
+#include "../trace_context.hpp"
+#include "../pooled_allocator.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -35,30 +38,81 @@
 
 namespace Poseidon {
 
+template class PromiseContainer<boost::shared_ptr<MongoDb::ObjectBase> >;
+
 typedef MongoDbDaemon::QueryCallback QueryCallback;
+typedef MongoDbDaemon::ObjectFactory ObjectFactory;
 
 namespace {
-	boost::shared_ptr<MongoDb::Connection> real_create_connection(bool from_slave, const boost::shared_ptr<MongoDb::Connection> &master_conn){
-		std::string server_addr;
-		boost::uint16_t server_port = 0;
-		if(from_slave){
-			server_addr = MainConfig::get<std::string>("mongodb_slave_addr");
-			server_port = MainConfig::get<boost::uint16_t>("mongodb_slave_port");
-		}
-		if(server_addr.empty()){
-			if(master_conn){
-				LOG_POSEIDON_DEBUG("MongoDB slave is not configured. Reuse the master connection as a slave.");
-				return master_conn;
-			}
-			server_addr = MainConfig::get<std::string>("mongodb_server_addr", "localhost");
-			server_port = MainConfig::get<boost::uint16_t>("mongodb_server_port", 27017);
-		}
+	ConfigValue<std::size_t> g_max_retry_count("mongodb_max_retry_count", 3);
+	ConfigValue<boost::uint64_t> g_retry_init_delay("mongodb_retry_init_delay", 1000);
+	ConfigValue<std::size_t> g_save_batch_max_docs("mongodb_save_batch_max_docs", 1000);
+	ConfigValue<std::size_t> g_save_batch_max_bytes("mongodb_save_batch_max_bytes", 15728640);
+	ConfigValue<std::size_t> g_key_batch_max_keys("mongodb_key_batch_max_keys", 100);
+
+	// 只读副本。由 mongodb_replica 指定，如果没有指定就使用 mongodb_slave_addr。
+	ReplicaSet g_replicas;
+
+	boost::shared_ptr<MongoDb::Connection> create_connection_to(const std::string &server_addr, boost::uint16_t server_port, bool replica){
 		std::string username = MainConfig::get<std::string>("mongodb_username", "root");
 		std::string password = MainConfig::get<std::string>("mongodb_password");
 		std::string auth_db = MainConfig::get<std::string>("mongodb_auth_database", "admin");
 		bool use_ssl = MainConfig::get<bool>("mongodb_use_ssl", false);
 		std::string database = MainConfig::get<std::string>("mongodb_database", "poseidon");
-		return MongoDb::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), auth_db.c_str(), use_ssl, database.c_str());
+		std::string compressors = MainConfig::get<std::string>("mongodb_compressors");
+		if(replica){
+			compressors = MainConfig::get<std::string>("mongodb_replica_compressors", compressors);
+		}
+		return MongoDb::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), auth_db.c_str(), use_ssl, database.c_str(), compressors.c_str());
+	}
+
+	// 如果 from_slave 为 true，选择一个可用的副本。没有可用的副本时，回退到 master_conn 或者主服务器。
+	// replica_index 非空时，被选择的副本的索引存放于此（没有使用副本时为 ReplicaSet::INDEX_NONE），调用者负责调用 g_replicas.release()。
+	boost::shared_ptr<MongoDb::Connection> real_create_connection(bool from_slave, const boost::shared_ptr<MongoDb::Connection> &master_conn, std::size_t *replica_index = NULLPTR){
+		if(replica_index){
+			*replica_index = ReplicaSet::INDEX_NONE;
+		}
+		if(from_slave){
+			const AUTO(retry_delay, MainConfig::get<boost::uint64_t>("mongodb_replica_retry_delay", 5000));
+			for(;;){
+				const AUTO(now, get_fast_mono_clock());
+				ReplicaSet::Replica replica;
+				const AUTO(index, g_replicas.acquire(replica, now));
+				if(index == ReplicaSet::INDEX_NONE){
+					break;
+				}
+				try {
+					AUTO(conn, create_connection_to(replica.addr, replica.port, true));
+					conn->execute_bson(MongoDb::bson_scalar_signed(sslit("ping"), 1));
+					conn->discard_result();
+					g_replicas.mark_up(index);
+					if(replica_index){
+						*replica_index = index;
+					} else {
+						g_replicas.release(index);
+					}
+					return conn;
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("Could not use MongoDB replica: addr = ", replica.addr, ", port = ", replica.port, ", what = ", e.what());
+					g_replicas.mark_down(index, now, retry_delay);
+					g_replicas.release(index);
+				}
+			}
+			if(master_conn){
+				LOG_POSEIDON_DEBUG("No MongoDB replica is available. Reuse the master connection as a slave.");
+				return master_conn;
+			}
+		}
+		return create_connection_to(MainConfig::get<std::string>("mongodb_server_addr", "localhost"), MainConfig::get<boost::uint16_t>("mongodb_server_port", 27017), false);
+	}
+
+	// 启动时与主服务器同时检查副本，在另一个线程中执行。
+	void check_slave_server_nothrow(STD_EXCEPTION_PTR *except) NOEXCEPT
+	try {
+		const AUTO(conn, real_create_connection(true, VAL_INIT));
+		conn->execute_bson(MongoDb::bson_scalar_signed(sslit("ping"), 1));
+	} catch(...){
+		*except = STD_CURRENT_EXCEPTION();
 	}
 
 	// 对于日志文件的写操作应当互斥。
@@ -121,16 +175,35 @@ namespace {
 	class OperationBase : NONCOPYABLE {
 	private:
 		const boost::weak_ptr<Promise> m_weak_promise;
+		// 在投递操作的线程中创建，是投递者当前上下文的子节点。
+		const TraceSpan m_trace;
 
 		boost::shared_ptr<const void> m_probe;
 
 	public:
 		explicit OperationBase(const boost::shared_ptr<Promise> &promise)
-			: m_weak_promise(promise)
+			: m_weak_promise(promise), m_trace("mongodb", TraceSpan::KIND_CLIENT)
 		{ }
 		virtual ~OperationBase(){ }
 
 	public:
+		const TraceContext &get_trace_context() const {
+			return m_trace.get_context();
+		}
+		// 在完成 promise 的地方调用。
+		void finish(bool error) const {
+			on_finished(error);
+			if(!m_trace.is_sampled()){
+				return;
+			}
+			const char *const collection = get_collection();
+			const char *const attributes[][2] = {
+				{ "db.system", "mongodb" },
+				{ "db.mongodb.collection", collection ? collection : "" },
+				{ NULLPTR },
+			};
+			m_trace.finish(attributes, error);
+		}
 		void set_probe(boost::shared_ptr<const void> probe){
 			m_probe = STD_MOVE(probe);
 		}
@@ -138,24 +211,69 @@ namespace {
 		virtual boost::shared_ptr<Promise> get_promise() const {
 			return m_weak_promise.lock();
 		}
+		// 屏障操作要等待之前的所有操作完成才能执行，之后的操作也要等待它完成才能执行。
+		virtual bool is_barrier() const {
+			return false;
+		}
 		virtual bool should_use_slave() const = 0;
 		virtual boost::shared_ptr<const MongoDb::ObjectBase> get_combinable_object() const = 0;
 		virtual const char *get_collection() const = 0;
 		virtual void generate_bson(MongoDb::BsonBuilder &query) const = 0;
 		virtual void execute(const boost::shared_ptr<MongoDb::Connection> &conn, const MongoDb::BsonBuilder &query) = 0;
+		// 操作成功执行，或者最终失败时调用。
+		virtual void on_finished(bool error) const {
+			(void)error;
+		}
 	};
 
 	class SaveOperation : public OperationBase {
 	private:
 		boost::shared_ptr<const MongoDb::ObjectBase> m_object;
 		bool m_to_replace;
+		// 修改标记在生成 $set 时就被清除了。如果这次生成的命令没有执行成功，之后只能写入完整的文档。
+		mutable bool m_update_generated;
 
 	public:
 		SaveOperation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<const MongoDb::ObjectBase> object, bool to_replace)
 			: OperationBase(promise)
-			, m_object(STD_MOVE(object)), m_to_replace(to_replace)
+			, m_object(STD_MOVE(object)), m_to_replace(to_replace), m_update_generated(false)
 		{ }
 
+	public:
+		// 生成 update 命令的 `updates` 中的一个元素时返回 true，生成 insert 命令的 `documents` 中的一个元素时返回 false。
+		bool generate_entry(MongoDb::BsonBuilder &entry) const {
+			AUTO(pkey, m_object->generate_primary_key());
+			if(m_to_replace && !pkey.empty() && !m_update_generated){
+				MongoDb::BsonBuilder update;
+				if(m_object->generate_update(update)){
+					m_update_generated = true;
+					MongoDb::BsonBuilder upd;
+					upd.append_object(sslit("q"), MongoDb::bson_scalar_string(sslit("_id"), pkey));
+					upd.append_object(sslit("u"), STD_MOVE(update));
+					// 文档可能已经被删除了，此时至少写入修改过的字段，而不是什么也不做。
+					upd.append_boolean(sslit("upsert"), true);
+					LOG_POSEIDON_DEBUG("Updating: pkey = ", pkey, ", upd = ", upd);
+					entry.swap(upd);
+					return true;
+				}
+			}
+			MongoDb::BsonBuilder doc;
+			m_object->generate_document(doc);
+			if(m_to_replace && !pkey.empty()){
+				MongoDb::BsonBuilder upd;
+				upd.append_object(sslit("q"), MongoDb::bson_scalar_string(sslit("_id"), STD_MOVE(pkey)));
+				upd.append_object(sslit("u"), STD_MOVE(doc));
+				upd.append_boolean(sslit("upsert"), true);
+				LOG_POSEIDON_DEBUG("Upserting: pkey = ", pkey, ", upd = ", upd);
+				entry.swap(upd);
+				return true;
+			} else {
+				LOG_POSEIDON_DEBUG("Inserting: pkey = ", pkey, ", doc = ", doc);
+				entry.swap(doc);
+				return false;
+			}
+		}
+
 	protected:
 		bool should_use_slave() const OVERRIDE {
 			return false;
@@ -166,24 +284,20 @@ namespace {
 		const char *get_collection() const OVERRIDE {
 			return m_object->get_collection();
 		}
+		void on_finished(bool error) const OVERRIDE {
+			// 只有写入成功之后才能只 $set 修改过的字段。失败时修改标记可能已经丢失，下次保存时写入完整的文档。
+			m_object->set_persisted(!error);
+		}
 		void generate_bson(MongoDb::BsonBuilder &query) const OVERRIDE {
 			MongoDb::BsonBuilder q;
 			{
-				MongoDb::BsonBuilder doc;
-				m_object->generate_document(doc);
-				AUTO(pkey, m_object->generate_primary_key());
-				if(m_to_replace && !pkey.empty()){
-					MongoDb::BsonBuilder upd;
-					upd.append_object(sslit("q"), MongoDb::bson_scalar_string(sslit("_id"), STD_MOVE(pkey)));
-					upd.append_object(sslit("u"), STD_MOVE(doc));
-					upd.append_boolean(sslit("upsert"), true);
-					LOG_POSEIDON_DEBUG("Upserting: pkey = ", pkey, ", upd = ", upd);
+				MongoDb::BsonBuilder entry;
+				if(generate_entry(entry)){
 					q.append_string(sslit("update"), get_collection());
-					q.append_array(sslit("updates"), MongoDb::bson_scalar_object(sslit("0"), STD_MOVE(upd)));
+					q.append_array(sslit("updates"), MongoDb::bson_scalar_object(sslit("0"), STD_MOVE(entry)));
 				} else {
-					LOG_POSEIDON_DEBUG("Inserting: pkey = ", pkey, ", doc = ", doc);
 					q.append_string(sslit("insert"), get_collection());
-					q.append_array(sslit("documents"), MongoDb::bson_scalar_object(sslit("0"), STD_MOVE(doc)));
+					q.append_array(sslit("documents"), MongoDb::bson_scalar_object(sslit("0"), STD_MOVE(entry)));
 				}
 			}
 			query = q;
@@ -191,7 +305,12 @@ namespace {
 		void execute(const boost::shared_ptr<MongoDb::Connection> &conn, const MongoDb::BsonBuilder &query) OVERRIDE {
 			PROFILE_ME;
 
-			conn->execute_bson(query);
+			boost::container::vector<MongoDb::Connection::WriteError> write_errors;
+			conn->execute_bulk_write(query, write_errors);
+			if(!write_errors.empty()){
+				const AUTO_REF(write_error, write_errors.front());
+				DEBUG_THROW(MongoDb::Exception, SharedNts::view(get_collection()), static_cast<unsigned long>(write_error.code), SharedNts(write_error.message));
+			}
 		}
 	};
 
@@ -218,6 +337,14 @@ namespace {
 		}
 		void generate_bson(MongoDb::BsonBuilder &query) const OVERRIDE {
 			query = m_query;
+			// 对于 find 命令，如果调用者没有指定 projection，只取回对象中定义的字段。
+			if(query.has_element("find") && !query.has_element("projection")){
+				MongoDb::BsonBuilder projection;
+				m_object->generate_projection(projection);
+				if(!projection.empty()){
+					query.append_object(sslit("projection"), projection);
+				}
+			}
 		}
 		void execute(const boost::shared_ptr<MongoDb::Connection> &conn, const MongoDb::BsonBuilder &query) OVERRIDE {
 			PROFILE_ME;
@@ -232,6 +359,138 @@ namespace {
 		}
 	};
 
+	// 按 _id 加载的一个批次。操作开始执行之前，enqueue_for_loading_by_key() 可以向其中添加请求；
+	// 数据库线程生成命令时将其封闭，之后的请求进入新的批次，已封闭的 requests 不再改变。
+	struct KeyedLoadBatch {
+		Mutex mutex;
+		bool sealed;
+		boost::container::vector<std::pair<std::string, boost::weak_ptr<MongoDbDaemon::ObjectPromise> > > requests;
+
+		KeyedLoadBatch()
+			: sealed(false)
+		{ }
+	};
+
+	// 键是集合名，值是尚未封闭的批次。
+	Mutex g_keyed_load_mutex;
+	boost::container::flat_map<std::string, boost::weak_ptr<KeyedLoadBatch> > g_keyed_loads;
+
+	// 批次的操作完成（包括重试之后仍然失败）时调用，把结果转给还没有得到结果的请求。
+	// 操作成功时，没有得到结果的请求对应的文档不存在。
+	void finish_keyed_load_batch(const boost::shared_ptr<KeyedLoadBatch> &batch, const Promise *batch_promise, const char *collection) NOEXCEPT
+	try {
+		STD_EXCEPTION_PTR except;
+		if(batch_promise->would_throw()){
+			try {
+				batch_promise->check_and_rethrow();
+			} catch(...){
+				except = STD_CURRENT_EXCEPTION();
+			}
+		} else {
+			except = STD_MAKE_EXCEPTION_PTR(MongoDb::Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, SharedNts(collection), MONGOC_ERROR_QUERY_FAILURE, sslit("No documents returned")));
+		}
+		for(AUTO(it, batch->requests.begin()); it != batch->requests.end(); ++it){
+			const AUTO(promise, it->second.lock());
+			if(promise && !promise->is_satisfied()){
+				promise->set_exception(except, false);
+			}
+		}
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+	}
+
+	class KeyedLoadOperation : public OperationBase {
+	private:
+		// 操作本身的 promise 由这里持有，它被满足时把结果转给批次中的请求。
+		const boost::shared_ptr<Promise> m_batch_promise;
+		const ObjectFactory m_factory;
+		const char *const m_collection;
+		const boost::shared_ptr<KeyedLoadBatch> m_batch;
+
+	public:
+		KeyedLoadOperation(const boost::shared_ptr<Promise> &batch_promise, ObjectFactory factory, const char *collection, boost::shared_ptr<KeyedLoadBatch> batch)
+			: OperationBase(batch_promise)
+			, m_batch_promise(batch_promise), m_factory(factory), m_collection(collection), m_batch(STD_MOVE(batch))
+		{
+			m_batch_promise->add_waiter(boost::bind(&finish_keyed_load_batch, m_batch, m_batch_promise.get(), m_collection));
+		}
+
+	private:
+		bool has_live_requests() const {
+			for(AUTO(it, m_batch->requests.begin()); it != m_batch->requests.end(); ++it){
+				if(!it->second.expired()){
+					return true;
+				}
+			}
+			return false;
+		}
+
+	protected:
+		bool should_use_slave() const OVERRIDE {
+			return true;
+		}
+		boost::shared_ptr<const MongoDb::ObjectBase> get_combinable_object() const OVERRIDE {
+			return VAL_INIT; // 不能合并。
+		}
+		const char *get_collection() const OVERRIDE {
+			return m_collection;
+		}
+		void generate_bson(MongoDb::BsonBuilder &query) const OVERRIDE {
+			{
+				const Mutex::UniqueLock lock(m_batch->mutex);
+				m_batch->sealed = true;
+			}
+			// 同一个键可能被请求多次，命令中只出现一次。
+			boost::container::vector<std::string> keys;
+			keys.reserve(m_batch->requests.size());
+			for(AUTO(it, m_batch->requests.begin()); it != m_batch->requests.end(); ++it){
+				keys.push_back(it->first);
+			}
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+			MongoDb::BsonBuilder in;
+			char name[32];
+			for(std::size_t i = 0; i < keys.size(); ++i){
+				::snprintf(name, sizeof(name), "%lu", static_cast<unsigned long>(i));
+				in.append_string(SharedNts(name), keys.at(i));
+			}
+			MongoDb::BsonBuilder q;
+			q.append_string(sslit("find"), m_collection);
+			q.append_object(sslit("filter"), MongoDb::bson_scalar_object(sslit("_id"), MongoDb::bson_scalar_array(sslit("$in"), STD_MOVE(in))));
+			MongoDb::BsonBuilder projection;
+			(*m_factory)()->generate_projection(projection);
+			if(!projection.empty()){
+				q.append_object(sslit("projection"), projection);
+			}
+			query.swap(q);
+		}
+		void execute(const boost::shared_ptr<MongoDb::Connection> &conn, const MongoDb::BsonBuilder &query) OVERRIDE {
+			PROFILE_ME;
+
+			if(!has_live_requests()){
+				LOG_POSEIDON_DEBUG("Discarding isolated MongoDB query: collection = ", get_collection(), ", query = ", query);
+				return;
+			}
+			conn->execute_bson(query);
+			std::string key;
+			while(conn->fetch_next()){
+				key = conn->get_string("_id");
+				AUTO(object, (*m_factory)());
+				object->fetch(conn);
+				for(AUTO(it, m_batch->requests.begin()); it != m_batch->requests.end(); ++it){
+					if(it->first != key){
+						continue;
+					}
+					const AUTO(promise, it->second.lock());
+					if(promise){
+						promise->set_success(object, false);
+					}
+				}
+			}
+		}
+	};
+
 	class DeleteOperation : public OperationBase {
 	private:
 		const char *m_collection;
@@ -354,6 +613,9 @@ namespace {
 		boost::shared_ptr<Promise> get_promise() const OVERRIDE {
 			return VAL_INIT;
 		}
+		bool is_barrier() const OVERRIDE {
+			return true;
+		}
 		bool should_use_slave() const OVERRIDE {
 			return false;
 		}
@@ -373,30 +635,83 @@ namespace {
 		}
 	};
 
+	class MongoDbThread;
+
+	// 线程空闲了 idle_duration 毫秒。如果线程被回收则返回 true，此时线程应当退出。
+	bool retire_if_idle(MongoDbThread *thread, std::size_t index, boost::uint64_t idle_duration);
+
 	class MongoDbThread : NONCOPYABLE {
 	private:
 		struct OperationQueueElement {
 			boost::shared_ptr<OperationBase> operation;
 			boost::uint64_t due_time;
 			std::size_t retry_count;
+			boost::uint64_t enqueued_time;
+			bool done; // 已经作为批量写入的成员完成，到达队首时直接移除。
+			bool no_batch; // 批量写入失败过，之后单独执行。
+			bool busy; // 正在某个连接上执行。
 		};
 
 	private:
+		const std::size_t m_index;
+
 		Thread m_thread;
+		// 除 m_thread 之外的其他连接的线程。所有线程共享同一个队列，同一个集合的操作按照顺序执行。
+		boost::container::vector<boost::shared_ptr<Thread> > m_lane_threads;
 		volatile bool m_running;
 
 		mutable Mutex m_mutex;
 		mutable ConditionVariable m_new_operation;
+		mutable ConditionVariable m_drained;
 		volatile bool m_urgent; // 无视延迟写入，一次性处理队列中所有操作。
 		boost::container::deque<OperationQueueElement> m_queue;
+		volatile bool m_abandoned;
 
 	public:
-		MongoDbThread()
-			: m_running(false)
-			, m_urgent(false)
+		explicit MongoDbThread(std::size_t index)
+			: m_index(index)
+			, m_running(false)
+			, m_urgent(false), m_abandoned(false)
 		{ }
 
 	private:
+		// 选出下一个可以执行的操作。同一个集合中只有最早的未完成的操作可以执行，这样多个连接并发执行时每个集合的写入顺序不变。
+		OperationQueueElement *pick_operation_unlocked(boost::uint64_t now){
+			const bool urgent = atomic_load(m_urgent, ATOMIC_CONSUME);
+			boost::container::vector<const char *> blocked_collections;
+			for(AUTO(it, m_queue.begin()); it != m_queue.end(); ++it){
+				if(it->done){
+					continue;
+				}
+				const AUTO(is_barrier, it->operation->is_barrier());
+				if(is_barrier && ((it != m_queue.begin()) || it->busy)){
+					break;
+				}
+				const char *const collection = it->operation->get_collection();
+				bool blocked = false;
+				for(AUTO(bit, blocked_collections.begin()); bit != blocked_collections.end(); ++bit){
+					if(std::strcmp(*bit, collection) == 0){
+						blocked = true;
+						break;
+					}
+				}
+				if(!blocked && !it->busy && (urgent || (now >= it->due_time))){
+					return &*it;
+				}
+				if(is_barrier){
+					break;
+				}
+				if(!it->busy && !urgent && (now < it->due_time) && (it->retry_count == 0)){
+					// 之后的操作都不会更早到期。
+					break;
+				}
+				if(!blocked){
+					blocked_collections.push_back(collection);
+				}
+			}
+			return NULLPTR;
+		}
+
 		bool pump_one_operation(boost::shared_ptr<MongoDb::Connection> &master_conn, boost::shared_ptr<MongoDb::Connection> &slave_conn) NOEXCEPT {
 			PROFILE_ME;
 
@@ -404,18 +719,26 @@ namespace {
 			OperationQueueElement *elem;
 			{
 				const Mutex::UniqueLock lock(m_mutex);
+				while(!m_queue.empty() && m_queue.front().done){
+					m_queue.pop_front();
+				}
 				if(m_queue.empty()){
 					atomic_store(m_urgent, false, ATOMIC_RELAXED);
+					m_drained.broadcast();
 					return false;
 				}
-				if(!atomic_load(m_urgent, ATOMIC_CONSUME) && (now < m_queue.front().due_time)){
+				elem = pick_operation_unlocked(now);
+				if(!elem){
 					return false;
 				}
-				elem = &m_queue.front();
+				elem->busy = true;
 			}
 			const AUTO_REF(operation, elem->operation);
 			AUTO_REF(conn, elem->operation->should_use_slave() ? slave_conn : master_conn);
 
+			// 这个操作产生的日志和嵌套的 span 都属于投递它的 trace。
+			const TraceScope trace_scope(operation->get_trace_context());
+
 			MongoDb::BsonBuilder query;
 			STD_EXCEPTION_PTR except;
 			unsigned long err_code = 0;
@@ -435,6 +758,9 @@ namespace {
 					execute_it = true;
 				}
 			}
+			if(execute_it && try_execute_batch(elem, conn, now)){
+				execute_it = false;
+			}
 			if(execute_it){
 				try {
 					operation->generate_bson(query);
@@ -459,41 +785,283 @@ namespace {
 				conn->discard_result();
 			}
 			if(except){
-				const AUTO(max_retry_count, MainConfig::get<std::size_t>("mongodb_max_retry_count", 3));
-				const AUTO(retry_count, ++(elem->retry_count));
+				const AUTO(max_retry_count, g_max_retry_count.get());
+				const AUTO(retry_count, elem->retry_count + 1);
 				if(retry_count < max_retry_count){
 					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Going to retry MongoDB operation: retry_count = ", retry_count);
-					const AUTO(retry_init_delay, MainConfig::get<boost::uint64_t>("mongodb_retry_init_delay", 1000));
-					elem->due_time = now + (retry_init_delay << retry_count);
+					const AUTO(retry_init_delay, g_retry_init_delay.get());
 					conn.reset();
+					const Mutex::UniqueLock lock(m_mutex);
+					elem->retry_count = retry_count;
+					elem->due_time = now + (retry_init_delay << retry_count);
+					elem->busy = false;
 					return true;
 				}
 				LOG_POSEIDON_ERROR("Max retry count exceeded.");
 				dump_bson_to_file(query, err_code, err_msg);
 			}
+			elem->operation->finish(!!except);
 			const AUTO(promise, elem->operation->get_promise());
 			if(promise){
 				if(except){
-					promise->set_success(false);
-				} else {
 					promise->set_exception(STD_MOVE(except), false);
+				} else {
+					promise->set_success(false);
 				}
 			}
 			const Mutex::UniqueLock lock(m_mutex);
-			m_queue.pop_front();
+			elem->busy = false;
+			elem->done = true;
+			while(!m_queue.empty() && m_queue.front().done){
+				m_queue.pop_front();
+			}
+			// 这个集合的下一个操作可能可以在其他连接上执行了。
+			m_new_operation.signal();
 			return true;
 		}
 
-		void thread_proc(){
+		// 把队首的保存操作和队列中已经到期的、同一个集合的其他保存操作合并为一条 ordered 为 false 的 update 或 insert 命令。
+		// 成员都是不同的文档，互相之间没有顺序要求，因此某些写入失败时服务器仍然会执行其他的写入。
+		// 队首成功写入时返回 true，其他成功写入的成员到达队首时被直接移除；写入失败的成员之后单独执行，这样每个 Promise 都能得到自己的错误。
+		bool try_execute_batch(OperationQueueElement *front, const boost::shared_ptr<MongoDb::Connection> &conn, boost::uint64_t now) NOEXCEPT
+		try {
 			PROFILE_ME;
-			LOG_POSEIDON_INFO("MongoDB thread started.");
+
+			const AUTO(max_docs, g_save_batch_max_docs.get());
+			const AUTO(max_bytes, g_save_batch_max_bytes.get());
+			if((max_docs < 2) || front->no_batch){
+				return false;
+			}
+			const AUTO(front_save, dynamic_cast<const SaveOperation *>(front->operation.get()));
+			if(!front_save){
+				return false;
+			}
+			const char *const collection = front->operation->get_collection();
+
+			// 队列中的元素只会被这个线程移除，因此释放锁之后指针仍然有效。
+			// 遇到其他类型的操作时停止，以免越过同一个集合的删除之类的操作。
+			boost::container::vector<OperationQueueElement *> candidates;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				const bool urgent = atomic_load(m_urgent, ATOMIC_CONSUME);
+				AUTO(it, m_queue.begin());
+				while(&*it != front){
+					++it;
+				}
+				for(++it; (it != m_queue.end()) && (candidates.size() + 1 < max_docs); ++it){
+					if(it->done || it->busy){
+						continue;
+					}
+					if(!urgent && (now < it->due_time)){
+						break;
+					}
+					if(!dynamic_cast<const SaveOperation *>(it->operation.get()) || it->no_batch){
+						break;
+					}
+					if(std::strcmp(it->operation->get_collection(), collection) != 0){
+						continue;
+					}
+					candidates.push_back(&*it);
+				}
+			}
+			if(candidates.empty()){
+				return false;
+			}
+			// 有可以合并的操作时才生成队首的元素，否则单独执行时只能写入完整的文档。
+			MongoDb::BsonBuilder entry;
+			const bool to_update = front_save->generate_entry(entry);
+
+			// 数组元素在生成时按下标重新命名，writeErrors 中的 index 就是 members 中的下标。
+			MongoDb::BsonBuilder entries;
+			std::size_t bytes = entry.get_encoded_size() + 64;
+			entries.append_object(sslit("0"), entry);
+			boost::container::vector<OperationQueueElement *> members;
+			members.reserve(candidates.size() + 1);
+			members.push_back(front);
+			boost::container::flat_set<const MongoDb::ObjectBase *> objects;
+			objects.reserve(candidates.size() + 1);
+			objects.insert(front->operation->get_combinable_object().get());
+			for(AUTO(it, candidates.begin()); it != candidates.end(); ++it){
+				OperationQueueElement *const elem = *it;
+				const AUTO(combinable_object, elem->operation->get_combinable_object());
+				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
+				if(old_write_stamp && (old_write_stamp != elem)){
+					// 这个对象的写入由另一个元素负责。
+					continue;
+				}
+				if(!objects.insert(combinable_object.get()).second){
+					continue;
+				}
+				// 必须在生成命令之前清除标记，见 MongoDb::ObjectBase::invalidate()。
+				// 如果这个元素最后没有被合并，它到达队首时没有标记，仍然会被执行。
+				if(old_write_stamp){
+					combinable_object->set_combined_write_stamp(NULLPTR);
+				}
+				if(static_cast<const SaveOperation *>(elem->operation.get())->generate_entry(entry) != to_update){
+					continue;
+				}
+				const AUTO(entry_bytes, entry.get_encoded_size() + 16);
+				if(bytes + entry_bytes > max_bytes){
+					break;
+				}
+				bytes += entry_bytes;
+				entries.append_object(sslit("0"), entry);
+				members.push_back(elem);
+			}
+			if(members.size() < 2){
+				return false;
+			}
+			MongoDb::BsonBuilder query;
+			if(to_update){
+				query.append_string(sslit("update"), collection);
+				query.append_array(sslit("updates"), entries);
+			} else {
+				query.append_string(sslit("insert"), collection);
+				query.append_array(sslit("documents"), entries);
+			}
+			query.append_boolean(sslit("ordered"), false);
+			LOG_POSEIDON_DEBUG("Executing MongoDB bulk write: collection = ", collection, ", docs = ", members.size(), ", bytes = ", bytes);
+			boost::container::vector<MongoDb::Connection::WriteError> write_errors;
+			try {
+				conn->execute_bulk_write(query, write_errors);
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("MongoDB bulk write failed, falling back to individual writes: collection = ", collection, ", what = ", e.what());
+				conn->discard_result();
+				for(AUTO(it, members.begin()); it != members.end(); ++it){
+					(*it)->no_batch = true;
+				}
+				return false;
+			}
+			conn->discard_result();
+			for(AUTO(it, write_errors.begin()); it != write_errors.end(); ++it){
+				if(it->index >= members.size()){
+					continue;
+				}
+				LOG_POSEIDON_DEBUG("MongoDB bulk write error: collection = ", collection, ", index = ", it->index, ", code = ", it->code, ", message = ", it->message);
+				members.at(it->index)->no_batch = true;
+			}
+			for(std::size_t i = 1; i < members.size(); ++i){
+				OperationQueueElement *const elem = members.at(i);
+				if(elem->no_batch){
+					continue;
+				}
+				elem->operation->finish(false);
+				const AUTO(promise, elem->operation->get_promise());
+				if(promise){
+					promise->set_success(false);
+				}
+			}
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				for(std::size_t i = 1; i < members.size(); ++i){
+					OperationQueueElement *const elem = members.at(i);
+					if(!elem->no_batch){
+						elem->done = true;
+					}
+				}
+			}
+			return !front->no_batch;
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+			return false;
+		}
+
+		// 定期检查正在使用的副本是否可用。如果回退到了主服务器，检查是否有副本恢复了。需要换连接时重置 slave_conn。
+		void check_replica(const boost::shared_ptr<MongoDb::Connection> &master_conn, boost::shared_ptr<MongoDb::Connection> &slave_conn, std::size_t replica_index, boost::uint64_t &next_check) NOEXCEPT
+		try {
+			PROFILE_ME;
+
+			const AUTO(now, get_fast_mono_clock());
+			if(now < next_check){
+				return;
+			}
+			next_check = saturated_add(now, MainConfig::get<boost::uint64_t>("mongodb_replica_check_interval", 10000));
+			if(!slave_conn){
+				return;
+			}
+			if(replica_index != ReplicaSet::INDEX_NONE){
+				try {
+					slave_conn->execute_bson(MongoDb::bson_scalar_signed(sslit("ping"), 1));
+					slave_conn->discard_result();
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("MongoDB replica is unhealthy: ", e.what());
+					g_replicas.mark_down(replica_index, now, MainConfig::get<boost::uint64_t>("mongodb_replica_retry_delay", 5000));
+					slave_conn.reset();
+				}
+			} else if((slave_conn == master_conn) && g_replicas.has_available(now)){
+				LOG_POSEIDON_INFO("MongoDB replicas may have recovered. Reconnecting...");
+				slave_conn.reset();
+			}
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+			slave_conn.reset();
+		}
+
+		// 停止时超过了 mongodb_drain_timeout。正在其他连接上执行的操作不受影响，其余的写入操作被转储，所有的 Promise 以异常结束。
+		// 没有日志可用，这些写入需要根据转储手工恢复。
+		void abandon_queue() NOEXCEPT {
+			PROFILE_ME;
+
+			boost::container::vector<boost::shared_ptr<OperationBase> > operations;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				for(AUTO(it, m_queue.begin()); it != m_queue.end(); ++it){
+					if(it->done || it->busy){
+						continue;
+					}
+					const AUTO(combinable_object, it->operation->get_combinable_object());
+					if(combinable_object && (combinable_object->get_combined_write_stamp() == &*it)){
+						combinable_object->set_combined_write_stamp(NULLPTR);
+					}
+					operations.push_back(it->operation);
+					it->done = true;
+				}
+				while(!m_queue.empty() && m_queue.front().done){
+					m_queue.pop_front();
+				}
+			}
+			if(operations.empty()){
+				return;
+			}
+			LOG_POSEIDON_ERROR("Abandoning MongoDB operations: count = ", operations.size());
+			for(AUTO(it, operations.begin()); it != operations.end(); ++it){
+				const AUTO_REF(operation, *it);
+				if(!operation->should_use_slave()){
+					try {
+						MongoDb::BsonBuilder query;
+						operation->generate_bson(query);
+						dump_bson_to_file(query, 0, "Abandoned on shutdown");
+					} catch(std::exception &e){
+						LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+					}
+				}
+				operation->finish(true);
+				const AUTO(promise, operation->get_promise());
+				if(promise){
+					promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("MongoDB operation was abandoned on shutdown"))), false);
+				}
+			}
+		}
+
+		// 每个连接一个线程。只有第一个线程负责回收空闲的 MongoDbThread，其他线程在队列为空并且停止之后退出。
+		void thread_proc(std::size_t lane){
+			PROFILE_ME;
+			LOG_POSEIDON_INFO("MongoDB thread started: lane = ", lane);
 
 			boost::shared_ptr<MongoDb::Connection> master_conn, slave_conn;
+			std::size_t replica_index = ReplicaSet::INDEX_NONE;
+			boost::uint64_t next_replica_check = 0;
 			unsigned timeout = 0;
+			boost::uint64_t idle_since = 0;
+			bool abandoned = false;
 			for(;;){
 				const AUTO(reconnect_delay, MainConfig::get<boost::uint64_t>("mongodb_reconn_delay", 5000));
 				bool busy;
 				do {
+					if(atomic_load(m_abandoned, ATOMIC_CONSUME)){
+						abandon_queue();
+					}
+					check_replica(master_conn, slave_conn, replica_index, next_replica_check);
 					while(!master_conn){
 						LOG_POSEIDON_INFO("Connecting to MongoDB master server...");
 						try {
@@ -501,16 +1069,29 @@ namespace {
 							LOG_POSEIDON_INFO("Successfully connected to MongoDB master server.");
 						} catch(std::exception &e){
 							LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+							// 服务器不可用并且超过了期限时，放弃所有操作然后退出。
+							if(atomic_load(m_abandoned, ATOMIC_CONSUME)){
+								abandon_queue();
+								if(get_queue_size() == 0){
+									abandoned = true;
+									break;
+								}
+							}
 							::timespec req;
 							req.tv_sec = (::time_t)(reconnect_delay / 1000);
 							req.tv_nsec = (long)(reconnect_delay % 1000) * 1000 * 1000;
 							::nanosleep(&req, NULLPTR);
 						}
 					}
+					if(abandoned){
+						break;
+					}
 					while(!slave_conn){
 						LOG_POSEIDON_INFO("Connecting to MongoDB slave server...");
+						g_replicas.release(replica_index);
+						replica_index = ReplicaSet::INDEX_NONE;
 						try {
-							slave_conn = real_create_connection(true, master_conn);
+							slave_conn = real_create_connection(true, master_conn, &replica_index);
 							LOG_POSEIDON_INFO("Successfully connected to MongoDB slave server.");
 						} catch(std::exception &e){
 							LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
@@ -523,54 +1104,110 @@ namespace {
 					busy = pump_one_operation(master_conn, slave_conn);
 					timeout = std::min<unsigned>(timeout * 2u + 1u, !busy * 100u);
 				} while(busy);
+				if(abandoned){
+					break;
+				}
+
+				{
+					Mutex::UniqueLock lock(m_mutex);
+					if(m_queue.empty() && !atomic_load(m_running, ATOMIC_CONSUME)){
+						break;
+					}
+					m_new_operation.timed_wait(lock, timeout);
+					if(!m_queue.empty()){
+						idle_since = 0;
+						continue;
+					}
+				}
 
-				Mutex::UniqueLock lock(m_mutex);
-				if(m_queue.empty() && !atomic_load(m_running, ATOMIC_CONSUME)){
+				if(lane != 0){
+					continue;
+				}
+				const AUTO(now, get_fast_mono_clock());
+				if(idle_since == 0){
+					idle_since = now;
+				}
+				if(retire_if_idle(this, m_index, now - idle_since)){
 					break;
 				}
-				m_new_operation.timed_wait(lock, timeout);
 			}
+			g_replicas.release(replica_index);
 
-			LOG_POSEIDON_INFO("MongoDB thread stopped.");
+			LOG_POSEIDON_INFO("MongoDB thread stopped: lane = ", lane);
 		}
 
 	public:
 		void start(){
+			const AUTO(lane_count, std::max<std::size_t>(MainConfig::get<std::size_t>("mongodb_connections_per_thread", 1), 1));
+
 			const Mutex::UniqueLock lock(m_mutex);
-			Thread(boost::bind(&MongoDbThread::thread_proc, this), sslit(" G  "), sslit("MongoDB")).swap(m_thread);
+			Thread(boost::bind(&MongoDbThread::thread_proc, this, 0), sslit(" G  "), sslit("MongoDB")).swap(m_thread);
+			for(std::size_t lane = 1; lane < lane_count; ++lane){
+				m_lane_threads.push_back(boost::make_shared<Thread>(boost::bind(&MongoDbThread::thread_proc, this, lane), sslit(" G  "), sslit("MongoDB")));
+			}
 			atomic_store(m_running, true, ATOMIC_RELEASE);
 		}
 		void stop(){
 			atomic_store(m_running, false, ATOMIC_RELEASE);
 		}
+		// 如果没有待处理的操作，停止接受操作并返回 true。
+		bool retire(){
+			const Mutex::UniqueLock lock(m_mutex);
+			if(!m_queue.empty()){
+				return false;
+			}
+			atomic_store(m_running, false, ATOMIC_RELEASE);
+			return true;
+		}
+		void make_urgent(){
+			const Mutex::UniqueLock lock(m_mutex);
+			atomic_store(m_urgent, true, ATOMIC_RELEASE);
+			m_new_operation.broadcast();
+		}
+		// 放弃队列中没有在执行的操作，见 abandon_queue()。
+		void abandon(){
+			const Mutex::UniqueLock lock(m_mutex);
+			atomic_store(m_abandoned, true, ATOMIC_RELEASE);
+			m_new_operation.broadcast();
+		}
 		void safe_join(){
-			wait_till_idle();
+			wait_till_idle(0);
 
 			if(m_thread.joinable()){
 				m_thread.join();
 			}
+			for(AUTO(it, m_lane_threads.begin()); it != m_lane_threads.end(); ++it){
+				if((*it)->joinable()){
+					(*it)->join();
+				}
+			}
 		}
 
-		void wait_till_idle(){
+		// deadline 为零时一直等待，否则到期时返回剩余的操作数。
+		std::size_t wait_till_idle(boost::uint64_t deadline){
+			boost::uint64_t next_report = 0;
+			Mutex::UniqueLock lock(m_mutex);
 			for(;;){
-				std::size_t pending_objects;
-				MongoDb::BsonBuilder current_bson;
-				{
-					const Mutex::UniqueLock lock(m_mutex);
-					pending_objects = m_queue.size();
-					if(pending_objects == 0){
-						break;
-					}
+				const std::size_t pending_objects = m_queue.size();
+				if(pending_objects == 0){
+					return 0;
+				}
+				const AUTO(now, get_fast_mono_clock());
+				if((deadline != 0) && (now >= deadline)){
+					return pending_objects;
+				}
+				atomic_store(m_urgent, true, ATOMIC_RELEASE);
+				m_new_operation.broadcast();
+				if(now >= next_report){
+					MongoDb::BsonBuilder current_bson;
 					m_queue.front().operation->generate_bson(current_bson);
-					atomic_store(m_urgent, true, ATOMIC_RELEASE);
-					m_new_operation.signal();
+					lock.unlock();
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for BSON queries to complete: pending_objects = ", pending_objects, ", current_bson = ", current_bson);
+					next_report = now + 1000;
+					lock.lock();
+					continue;
 				}
-				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for BSON queries to complete: pending_objects = ", pending_objects, ", current_bson = ", current_bson);
-
-				::timespec req;
-				req.tv_sec = 0;
-				req.tv_nsec = 500 * 1000 * 1000;
-				::nanosleep(&req, NULLPTR);
+				m_drained.timed_wait(lock, ((deadline != 0) ? std::min(deadline, next_report) : next_report) - now);
 			}
 		}
 
@@ -578,6 +1215,15 @@ namespace {
 			const Mutex::UniqueLock lock(m_mutex);
 			return m_queue.size();
 		}
+		// 队列中最早的操作超过预定时刻的毫秒数。紧急操作的预定时刻就是其入队的时刻。
+		boost::uint64_t get_queue_latency(boost::uint64_t now) const {
+			const Mutex::UniqueLock lock(m_mutex);
+			if(m_queue.empty()){
+				return 0;
+			}
+			const AUTO_REF(front, m_queue.front());
+			return saturated_sub(now, atomic_load(m_urgent, ATOMIC_CONSUME) ? front.enqueued_time : front.due_time);
+		}
 		void add_operation(boost::shared_ptr<OperationBase> operation, bool urgent){
 			PROFILE_ME;
 
@@ -590,7 +1236,7 @@ namespace {
 
 			const Mutex::UniqueLock lock(m_mutex);
 			DEBUG_THROW_UNLESS(atomic_load(m_running, ATOMIC_CONSUME), Exception, sslit("MongoDB thread is being shut down"));
-			OperationQueueElement elem = { STD_MOVE(operation), due_time };
+			OperationQueueElement elem = { STD_MOVE(operation), due_time, 0, now, false, false, false };
 			m_queue.push_back(STD_MOVE(elem));
 			if(combinable_object){
 				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
@@ -600,77 +1246,206 @@ namespace {
 			}
 			if(urgent){
 				atomic_store(m_urgent, true, ATOMIC_RELEASE);
+				m_new_operation.broadcast();
+			} else {
+				m_new_operation.signal();
 			}
-			m_new_operation.signal();
 		}
 	};
 
 	volatile bool g_running = false;
 
+	// 变更流监听线程，只使用主服务器。
+	Thread g_change_stream_thread;
+
+	void change_stream_proc(){
+		PROFILE_ME;
+		LOG_POSEIDON_INFO("MongoDB change stream listener started.");
+
+		const AUTO(collections, MainConfig::get_all_raw("mongodb_change_stream_collection"));
+		const AUTO(max_await_time, MainConfig::get<boost::uint64_t>("mongodb_change_stream_max_await_time", 1000));
+		boost::shared_ptr<MongoDb::Connection> conn;
+		bool lost = false;
+		while(atomic_load(g_running, ATOMIC_CONSUME)){
+			try {
+				if(!conn){
+					LOG_POSEIDON_INFO("Opening MongoDB change stream...");
+					conn = real_create_connection(false, VAL_INIT);
+					conn->watch_changes(collections, max_await_time);
+					if(lost){
+						// 变更流重新打开之前的变更无从得知，通知所有人重新加载。
+						LOG_POSEIDON_WARNING("MongoDB change stream was interrupted. Some changes may have been lost.");
+						async_raise_event(boost::make_shared<MongoDbDocumentChangedEvent>(std::string(), std::string(), std::string()));
+						lost = false;
+					}
+				}
+				MongoDb::Connection::ChangeNotification change;
+				if(!conn->fetch_change(change)){
+					continue;
+				}
+				LOG_POSEIDON_TRACE("MongoDB document changed: operation = ", change.operation, ", collection = ", change.collection, ", document_id = ", change.document_id);
+				async_raise_event(boost::make_shared<MongoDbDocumentChangedEvent>(STD_MOVE(change.operation), STD_MOVE(change.collection), STD_MOVE(change.document_id)));
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+				conn.reset();
+				lost = true;
+
+				// 分段等待，以便及时响应退出。
+				const AUTO(reconnect_delay, MainConfig::get<boost::uint64_t>("mongodb_reconn_delay", 5000));
+				for(boost::uint64_t waited = 0; (waited < reconnect_delay) && atomic_load(g_running, ATOMIC_CONSUME); waited += 100){
+					::timespec req;
+					req.tv_sec = 0;
+					req.tv_nsec = 100 * 1000 * 1000;
+					::nanosleep(&req, NULLPTR);
+				}
+			}
+		}
+
+		LOG_POSEIDON_INFO("MongoDB change stream listener stopped.");
+	}
+
+	// 线程池的上下限可以在运行时修改。
+	// 下标不小于 g_max_thread_count 的线程不再被分配新的 collection，在处理完已有的操作之后被回收；
+	// 其余的线程空闲超过 g_idle_timeout 毫秒之后被回收，但不少于 g_min_thread_count 个。
+	volatile std::size_t g_min_thread_count = 0;
+	volatile std::size_t g_max_thread_count = 0;
+	volatile boost::uint64_t g_grow_latency = 0;
+	volatile boost::uint64_t g_idle_timeout = 0;
+
 	Mutex g_router_mutex;
 	struct Route {
 		boost::shared_ptr<const void> probe;
 		boost::shared_ptr<MongoDbThread> thread;
 	};
 	boost::container::flat_map<SharedNts, Route> g_router;
-	boost::container::flat_multimap<std::size_t, std::size_t> g_routing_map;
+	// 长度只增不减，空的元素表示对应的线程尚未创建或已被回收。
 	boost::container::vector<boost::shared_ptr<MongoDbThread> > g_threads;
+	// 已被回收但尚未 join 的线程。
+	boost::container::vector<boost::shared_ptr<MongoDbThread> > g_retired_threads;
+	volatile bool g_has_retired_threads = false;
+
+	std::size_t count_live_threads_unlocked(std::size_t max_count){
+		std::size_t count = 0;
+		for(std::size_t i = 0; i < std::min(max_count, g_threads.size()); ++i){
+			count += !!g_threads.at(i);
+		}
+		return count;
+	}
 
-	void add_operation_by_collection(const char *collection, boost::shared_ptr<OperationBase> operation, bool urgent){
-		PROFILE_ME;
-		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MongoDB support is not enabled"));
+	bool retire_if_idle(MongoDbThread *thread, std::size_t index, boost::uint64_t idle_duration){
+		const AUTO(max_count, atomic_load(g_max_thread_count, ATOMIC_CONSUME));
+		if(index < max_count){
+			const AUTO(idle_timeout, atomic_load(g_idle_timeout, ATOMIC_CONSUME));
+			if((idle_timeout == 0) || (idle_duration < idle_timeout)){
+				return false;
+			}
+		}
 
-		boost::shared_ptr<const void> probe;
-		boost::shared_ptr<MongoDbThread> thread;
+		const Mutex::UniqueLock lock(g_router_mutex);
+		if((index >= g_threads.size()) || (g_threads.at(index).get() != thread)){
+			return false;
+		}
+		if((index < max_count) && (count_live_threads_unlocked(max_count) <= atomic_load(g_min_thread_count, ATOMIC_CONSUME))){
+			return false;
+		}
+		if(!thread->retire()){
+			return false;
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Retiring MongoDB thread ", index);
+		// 队列为空，因此没有 collection 正在使用这个线程。
+		for(AUTO(it, g_router.begin()); it != g_router.end(); ++it){
+			if(it->second.thread.get() == thread){
+				it->second.thread.reset();
+			}
+		}
+		g_retired_threads.push_back(STD_MOVE(g_threads.at(index)));
+		g_threads.at(index).reset();
+		atomic_store(g_has_retired_threads, true, ATOMIC_RELEASE);
+		return true;
+	}
+	void reap_retired_threads(){
+		if(!atomic_load(g_has_retired_threads, ATOMIC_CONSUME)){
+			return;
+		}
+		boost::container::vector<boost::shared_ptr<MongoDbThread> > threads;
 		{
 			const Mutex::UniqueLock lock(g_router_mutex);
+			threads.swap(g_retired_threads);
+			atomic_store(g_has_retired_threads, false, ATOMIC_RELAXED);
+		}
+		for(AUTO(it, threads.begin()); it != threads.end(); ++it){
+			(*it)->safe_join();
+		}
+	}
 
-			AUTO_REF(route, g_router[SharedNts::view(collection)]);
-			if(route.probe.use_count() > 1){
-				probe = route.probe;
-				thread = route.thread;
-				goto _use_thread;
-			}
-			if(!route.probe){
-				route.probe = boost::make_shared<int>();
-			}
-			probe = route.probe;
-
-			g_routing_map.clear();
-			g_routing_map.reserve(g_threads.size());
-			for(std::size_t i = 0; i < g_threads.size(); ++i){
-				AUTO_REF(test_thread, g_threads.at(i));
-				if(!test_thread){
-					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Creating new MongoDB thread ", i, " for collection ", collection);
-					thread = boost::make_shared<MongoDbThread>();
-					thread->start();
-					test_thread = thread;
-					route.thread = thread;
-					goto _use_thread;
-				}
-				const AUTO(queue_size, test_thread->get_queue_size());
-				LOG_POSEIDON_DEBUG("> MongoDB thread ", i, "'s queue size: ", queue_size);
-				g_routing_map.emplace(queue_size, i);
-			}
-			if(g_routing_map.empty()){
-				LOG_POSEIDON_FATAL("No available MongoDB thread?!");
-				std::abort();
+	// 选择队列最短的线程。如果线程数低于下限，或者最短的队列中最早的操作已经延迟过久，则创建一个新的线程。
+	boost::shared_ptr<MongoDbThread> pick_thread_unlocked(const char *collection, boost::uint64_t now){
+		const AUTO(max_count, atomic_load(g_max_thread_count, ATOMIC_CONSUME));
+		std::size_t vacant = max_count;
+		std::size_t live_count = 0;
+		std::size_t best_index = max_count;
+		std::size_t best_queue_size = 0;
+		for(std::size_t i = 0; i < max_count; ++i){
+			const AUTO_REF(test_thread, g_threads.at(i));
+			if(!test_thread){
+				vacant = std::min(vacant, i);
+				continue;
+			}
+			++live_count;
+			const AUTO(queue_size, test_thread->get_queue_size());
+			LOG_POSEIDON_DEBUG("> MongoDB thread ", i, "'s queue size: ", queue_size);
+			if((best_index == max_count) || (queue_size < best_queue_size)){
+				best_index = i;
+				best_queue_size = queue_size;
 			}
-			const AUTO(index, g_routing_map.begin()->second);
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Picking thread ", index, " for collection ", collection);
-			thread = g_threads.at(index);
-			route.thread = thread;
 		}
-	_use_thread:
-		assert(probe);
-		assert(thread);
-		operation->set_probe(STD_MOVE(probe));
-		thread->add_operation(STD_MOVE(operation), urgent);
+		if(vacant < max_count){
+			bool to_grow = (best_index == max_count) || (live_count < atomic_load(g_min_thread_count, ATOMIC_CONSUME));
+			if(!to_grow){
+				to_grow = g_threads.at(best_index)->get_queue_latency(now) >= atomic_load(g_grow_latency, ATOMIC_CONSUME);
+			}
+			if(to_grow){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Creating new MongoDB thread ", vacant, " for collection ", collection);
+				AUTO(thread, boost::make_shared<MongoDbThread>(vacant));
+				thread->start();
+				g_threads.at(vacant) = thread;
+				return thread;
+			}
+		}
+		if(best_index == max_count){
+			LOG_POSEIDON_FATAL("No available MongoDB thread?!");
+			std::abort();
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Picking thread ", best_index, " for collection ", collection);
+		return g_threads.at(best_index);
+	}
+
+	void add_operation_by_collection(const char *collection, boost::shared_ptr<OperationBase> operation, bool urgent){
+		PROFILE_ME;
+		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MongoDB support is not enabled"));
+
+		reap_retired_threads();
+
+		const AUTO(now, get_fast_mono_clock());
+		// 在锁内添加操作，这样线程不会在此期间被回收。
+		const Mutex::UniqueLock lock(g_router_mutex);
+		AUTO_REF(route, g_router[SharedNts::view(collection)]);
+		if(!route.probe){
+			route.probe = boost::make_shared<int>();
+		}
+		// 如果还有使用这个路由的操作没有完成，必须使用同一个线程，以保证操作的顺序。
+		if((route.probe.use_count() == 1) || !route.thread){
+			route.thread = pick_thread_unlocked(collection, now);
+		}
+		operation->set_probe(route.probe);
+		route.thread->add_operation(STD_MOVE(operation), urgent);
 	}
 	void add_operation_all(boost::shared_ptr<OperationBase> operation, bool urgent){
 		PROFILE_ME;
 		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MongoDB support is not enabled"));
 
+		reap_retired_threads();
+
 		const Mutex::UniqueLock lock(g_router_mutex);
 		for(AUTO(it, g_threads.begin()); it != g_threads.end(); ++it){
 			const AUTO_REF(thread, *it);
@@ -693,7 +1468,24 @@ void MongoDbDaemon::start(){
 	if(max_thread_count == 0){
 		LOG_POSEIDON_WARNING("MongoDB support has been disabled. To enable MongoDB support, set `mongodb_max_thread_count` in `main.conf` to a value greater than zero.");
 	} else {
-		boost::shared_ptr<MongoDb::Connection> master_conn, slave_conn;
+		AUTO(replica_specs, MainConfig::get_all_raw("mongodb_replica"));
+		if(replica_specs.empty()){
+			const AUTO(slave_addr, MainConfig::get<std::string>("mongodb_slave_addr"));
+			if(!slave_addr.empty()){
+				replica_specs.push_back(slave_addr + "," + boost::lexical_cast<std::string>(MainConfig::get<boost::uint16_t>("mongodb_slave_port", 27017)));
+			}
+		}
+		g_replicas.reset(replica_specs, 27017);
+
+		// 与 MySqlDaemon 相同，只有配置了副本时才需要单独检查。
+		STD_EXCEPTION_PTR slave_except;
+		Thread slave_checker;
+		if(!g_replicas.empty()){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Checking whether MongoDB slave server is up...");
+			Thread(boost::bind(&check_slave_server_nothrow, &slave_except), sslit("  S "), sslit("Startup")).swap(slave_checker);
+		}
+
+		boost::shared_ptr<MongoDb::Connection> master_conn;
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Checking whether MongoDB master server is up...");
 		try {
 			master_conn = real_create_connection(false, VAL_INIT);
@@ -704,11 +1496,12 @@ void MongoDbDaemon::start(){
 			std::abort();
 		}
 
-		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Checking whether MongoDB slave server is up...");
 		try {
-			slave_conn = real_create_connection(true, master_conn);
-			if(slave_conn != master_conn){
-				slave_conn->execute_bson(MongoDb::bson_scalar_signed(sslit("ping"), 1));
+			if(slave_checker.joinable()){
+				slave_checker.join();
+				if(slave_except){
+					STD_RETHROW_EXCEPTION(slave_except);
+				}
 			}
 		} catch(std::exception &e){
 			LOG_POSEIDON_FATAL("Could not connect to MongoDB slave server: ", e.what());
@@ -731,7 +1524,17 @@ void MongoDbDaemon::start(){
 			}
 		}
 	}
+	const AUTO(min_thread_count, MainConfig::get<std::size_t>("mongodb_min_thread_count", max_thread_count));
 	g_threads.resize(max_thread_count);
+	atomic_store(g_min_thread_count, std::min(min_thread_count, max_thread_count), ATOMIC_RELAXED);
+	atomic_store(g_max_thread_count, max_thread_count, ATOMIC_RELAXED);
+	atomic_store(g_grow_latency, MainConfig::get<boost::uint64_t>("mongodb_thread_grow_latency", 0), ATOMIC_RELAXED);
+	atomic_store(g_idle_timeout, MainConfig::get<boost::uint64_t>("mongodb_thread_idle_timeout", 60000), ATOMIC_RELAXED);
+
+	if((max_thread_count != 0) && MainConfig::get<bool>("mongodb_change_stream_enabled", false)){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting MongoDB change stream listener...");
+		Thread(&change_stream_proc, sslit(" G  "), sslit("MongoDB Watch")).swap(g_change_stream_thread);
+	}
 
 	LOG_POSEIDON_INFO("MongoDB daemon started.");
 }
@@ -741,24 +1544,53 @@ void MongoDbDaemon::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping MongoDB daemon...");
 
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	if(g_change_stream_thread.joinable()){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for MongoDB change stream listener to terminate...");
+		g_change_stream_thread.join();
+	}
+
+	const AUTO(drain_begin, get_fast_mono_clock());
+	const AUTO(drain_timeout, MainConfig::get<boost::uint64_t>("mongodb_drain_timeout", 0));
+	const AUTO(deadline, (drain_timeout == 0) ? 0 : saturated_add(drain_begin, drain_timeout));
+
+	// 在锁内取出所有线程，这样它们不会再被回收。
+	boost::container::vector<boost::shared_ptr<MongoDbThread> > threads;
+	std::size_t pending_operations = 0;
+	{
+		const Mutex::UniqueLock lock(g_router_mutex);
+		threads.swap(g_retired_threads);
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			AUTO_REF(thread, g_threads.at(i));
+			if(!thread){
+				continue;
+			}
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping MongoDB thread ", i);
+			thread->stop();
+			thread->make_urgent();
+			pending_operations += thread->get_queue_size();
+			threads.push_back(STD_MOVE(thread));
+			thread.reset();
 		}
-		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping MongoDB thread ", i);
-		thread->stop();
 	}
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	std::size_t overdue_operations = 0;
+	for(std::size_t i = 0; i < threads.size(); ++i){
+		const AUTO(remaining, threads.at(i)->wait_till_idle(deadline));
+		if(remaining != 0){
+			LOG_POSEIDON_ERROR("MongoDB drain deadline exceeded: thread = ", i, ", pending_operations = ", remaining);
+			threads.at(i)->abandon();
+			overdue_operations += remaining;
 		}
+	}
+	for(std::size_t i = 0; i < threads.size(); ++i){
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for MongoDB thread ", i, " to terminate...");
-		thread->safe_join();
+		threads.at(i)->safe_join();
 	}
+	const Mutex::UniqueLock lock(g_router_mutex);
+	g_router.clear();
 	g_threads.clear();
 
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "MongoDB daemon drained: pending_operations = ", pending_operations, ", overdue_operations = ", overdue_operations,
+		", elapsed = ", get_fast_mono_clock() - drain_begin, " ms");
 	LOG_POSEIDON_INFO("MongoDB daemon stopped.");
 }
 
@@ -767,19 +1599,57 @@ boost::shared_ptr<MongoDb::Connection> MongoDbDaemon::create_connection(bool fro
 }
 
 void MongoDbDaemon::wait_for_all_async_operations(){
+	boost::container::vector<boost::shared_ptr<MongoDbThread> > threads;
+	{
+		const Mutex::UniqueLock lock(g_router_mutex);
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			const AUTO_REF(thread, g_threads.at(i));
+			if(!thread){
+				continue;
+			}
+			threads.push_back(thread);
+		}
+	}
+	for(AUTO(it, threads.begin()); it != threads.end(); ++it){
+		(*it)->wait_till_idle(0);
+	}
+}
+
+void MongoDbDaemon::get_pool_status(PoolStatus &status){
+	reap_retired_threads();
+
+	const Mutex::UniqueLock lock(g_router_mutex);
+	status.min_thread_count = atomic_load(g_min_thread_count, ATOMIC_CONSUME);
+	status.max_thread_count = atomic_load(g_max_thread_count, ATOMIC_CONSUME);
+	status.live_thread_count = 0;
+	status.queue_size = 0;
 	for(std::size_t i = 0; i < g_threads.size(); ++i){
 		const AUTO_REF(thread, g_threads.at(i));
 		if(!thread){
 			continue;
 		}
-		thread->wait_till_idle();
+		status.live_thread_count += 1;
+		status.queue_size += thread->get_queue_size();
 	}
 }
+void MongoDbDaemon::set_thread_limits(std::size_t min_thread_count, std::size_t max_thread_count){
+	DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MongoDB support is not enabled"));
+	DEBUG_THROW_UNLESS(max_thread_count != 0, Exception, sslit("The maximum thread count shall not be zero"));
+	DEBUG_THROW_UNLESS(min_thread_count <= max_thread_count, Exception, sslit("The minimum thread count shall not exceed the maximum thread count"));
+
+	const Mutex::UniqueLock lock(g_router_mutex);
+	if(g_threads.size() < max_thread_count){
+		g_threads.resize(max_thread_count);
+	}
+	atomic_store(g_min_thread_count, min_thread_count, ATOMIC_RELEASE);
+	atomic_store(g_max_thread_count, max_thread_count, ATOMIC_RELEASE);
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "MongoDB thread limits changed: min_thread_count = ", min_thread_count, ", max_thread_count = ", max_thread_count);
+}
 
 boost::shared_ptr<const Promise> MongoDbDaemon::enqueue_for_saving(boost::shared_ptr<const MongoDb::ObjectBase> object, bool to_replace, bool urgent){
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const collection = object->get_collection();
-	AUTO(operation, boost::make_shared<SaveOperation>(promise, STD_MOVE(object), to_replace));
+	AUTO(operation, boost::allocate_shared<SaveOperation>(PooledAllocator<SaveOperation>(), promise, STD_MOVE(object), to_replace));
 	add_operation_by_collection(collection, STD_MOVE_IDN(operation), urgent);
 	return STD_MOVE_IDN(promise);
 }
@@ -788,16 +1658,41 @@ boost::shared_ptr<const Promise> MongoDbDaemon::enqueue_for_loading(boost::share
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const collection = object->get_collection();
-	AUTO(operation, boost::make_shared<LoadOperation>(promise, STD_MOVE(object), STD_MOVE(query)));
+	AUTO(operation, boost::allocate_shared<LoadOperation>(PooledAllocator<LoadOperation>(), promise, STD_MOVE(object), STD_MOVE(query)));
 	add_operation_by_collection(collection, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
+boost::shared_ptr<const MongoDbDaemon::ObjectPromise> MongoDbDaemon::enqueue_for_loading_by_key(ObjectFactory factory, std::string key){
+	DEBUG_THROW_ASSERT(factory);
+
+	const char *const collection = (*factory)()->get_collection();
+	AUTO(promise, boost::make_shared<ObjectPromise>());
+
+	const AUTO(max_keys, g_key_batch_max_keys.get());
+	const Mutex::UniqueLock lock(g_keyed_load_mutex);
+	AUTO_REF(weak_batch, g_keyed_loads[collection]);
+	const AUTO(batch, weak_batch.lock());
+	if(batch){
+		const Mutex::UniqueLock batch_lock(batch->mutex);
+		if(!batch->sealed && (batch->requests.size() < max_keys)){
+			batch->requests.push_back(std::make_pair(STD_MOVE(key), boost::weak_ptr<ObjectPromise>(promise)));
+			return STD_MOVE_IDN(promise);
+		}
+	}
+	// 没有尚未封闭的批次，新建一个并投递。它在队列中等待的期间，同一个集合的其他请求都会加入进来。
+	AUTO(new_batch, boost::make_shared<KeyedLoadBatch>());
+	new_batch->requests.push_back(std::make_pair(STD_MOVE(key), boost::weak_ptr<ObjectPromise>(promise)));
+	AUTO(operation, boost::allocate_shared<KeyedLoadOperation>(PooledAllocator<KeyedLoadOperation>(), boost::make_shared<Promise>(), factory, collection, new_batch));
+	add_operation_by_collection(collection, STD_MOVE_IDN(operation), true);
+	weak_batch = new_batch;
+	return STD_MOVE_IDN(promise);
+}
 boost::shared_ptr<const Promise> MongoDbDaemon::enqueue_for_deleting(const char *collection_hint, MongoDb::BsonBuilder query){
 	DEBUG_THROW_ASSERT(!query.empty());
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const collection = collection_hint;
-	AUTO(operation, boost::make_shared<DeleteOperation>(promise, collection_hint, STD_MOVE(query)));
+	AUTO(operation, boost::allocate_shared<DeleteOperation>(PooledAllocator<DeleteOperation>(), promise, collection_hint, STD_MOVE(query)));
 	add_operation_by_collection(collection, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
@@ -806,22 +1701,24 @@ boost::shared_ptr<const Promise> MongoDbDaemon::enqueue_for_batch_loading(QueryC
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const collection = collection_hint;
-	AUTO(operation, boost::make_shared<BatchLoadOperation>(promise, STD_MOVE(callback), collection_hint, STD_MOVE(query)));
+	AUTO(operation, boost::allocate_shared<BatchLoadOperation>(PooledAllocator<BatchLoadOperation>(), promise, STD_MOVE(callback), collection_hint, STD_MOVE(query)));
 	add_operation_by_collection(collection, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
 
 void MongoDbDaemon::enqueue_for_low_level_access(const boost::shared_ptr<Promise> &promise, QueryCallback callback, const char *collection_hint, bool from_slave){
 	const char *const collection = collection_hint;
-	AUTO(operation, boost::make_shared<LowLevelAccessOperation>(promise, STD_MOVE(callback), collection_hint, from_slave));
+	AUTO(operation, boost::allocate_shared<LowLevelAccessOperation>(PooledAllocator<LowLevelAccessOperation>(), promise, STD_MOVE(callback), collection_hint, from_slave));
 	add_operation_by_collection(collection, STD_MOVE_IDN(operation), true);
 }
 
 boost::shared_ptr<const Promise> MongoDbDaemon::enqueue_for_waiting_for_all_async_operations(){
 	AUTO(promise, boost::make_shared<Promise>());
-	AUTO(operation, boost::make_shared<WaitOperation>(promise));
+	AUTO(operation, boost::allocate_shared<WaitOperation>(PooledAllocator<WaitOperation>(), promise));
 	add_operation_all(STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
 
+MongoDbDocumentChangedEvent::~MongoDbDocumentChangedEvent(){ }
+
 }
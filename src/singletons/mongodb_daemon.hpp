@@ -6,12 +6,15 @@
 
 #include "../cxx_ver.hpp"
 #include "../mongodb/fwd.hpp"
+#include "../event_base.hpp"
+#include "../promise.hpp"
+#include <string>
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 
 namespace Poseidon {
 
-class Promise;
+extern template class PromiseContainer<boost::shared_ptr<MongoDb::ObjectBase> >;
 
 class MongoDbDaemon {
 private:
@@ -19,6 +22,15 @@ private:
 
 public:
 	typedef boost::function<void (const boost::shared_ptr<MongoDb::Connection> &)> QueryCallback;
+	typedef boost::shared_ptr<MongoDb::ObjectBase> (*ObjectFactory)();
+	typedef PromiseContainer<boost::shared_ptr<MongoDb::ObjectBase> > ObjectPromise;
+
+	struct PoolStatus {
+		std::size_t min_thread_count;
+		std::size_t max_thread_count;
+		std::size_t live_thread_count;
+		std::size_t queue_size;
+	};
 
 	static void start();
 	static void stop();
@@ -28,9 +40,17 @@ public:
 
 	static void wait_for_all_async_operations();
 
+	static void get_pool_status(PoolStatus &status);
+	// 调低上限时，多余的线程在处理完已有的操作之后退出。
+	static void set_thread_limits(std::size_t min_thread_count, std::size_t max_thread_count);
+
 	// 异步接口。
 	static boost::shared_ptr<const Promise> enqueue_for_saving(boost::shared_ptr<const MongoDb::ObjectBase> object, bool to_replace, bool urgent);
 	static boost::shared_ptr<const Promise> enqueue_for_loading(boost::shared_ptr<MongoDb::ObjectBase> object, MongoDb::BsonBuilder query);
+	// 按 _id 加载一个文档，key 是 _id 的字符串值。
+	// 同一个集合的请求在操作等待执行期间被合并为一条带 {_id: {$in: [...]}} 的 find 命令，
+	// 每批最多 mongodb_key_batch_max_keys 个键，结果按键分发给各个请求。没有对应的文档时以 MONGOC_ERROR_QUERY_FAILURE 失败。
+	static boost::shared_ptr<const ObjectPromise> enqueue_for_loading_by_key(ObjectFactory factory, std::string key);
 	static boost::shared_ptr<const Promise> enqueue_for_deleting(const char *collection, MongoDb::BsonBuilder query);
 	static boost::shared_ptr<const Promise> enqueue_for_batch_loading(QueryCallback callback, const char *collection_hint, MongoDb::BsonBuilder query);
 
@@ -39,6 +59,34 @@ public:
 	static boost::shared_ptr<const Promise> enqueue_for_waiting_for_all_async_operations();
 };
 
+// 打开 mongodb_change_stream_enabled 之后，数据库中的文档每次发生变化都会异步触发这个事件，包括这个进程自己的写入。
+// 变更流断开之后可能丢失了一些变更，此时触发一个 collection 为空的事件，应当重新加载所有缓存的文档。
+class MongoDbDocumentChangedEvent : public EventBase {
+private:
+	const std::string m_operation;
+	const std::string m_collection;
+	const std::string m_document_id;
+
+public:
+	MongoDbDocumentChangedEvent(std::string operation, std::string collection, std::string document_id)
+		: m_operation(STD_MOVE(operation)), m_collection(STD_MOVE(collection)), m_document_id(STD_MOVE(document_id))
+	{ }
+	~MongoDbDocumentChangedEvent();
+
+public:
+	// insert、update、replace、delete、drop、rename、dropDatabase 或者 invalidate。
+	const std::string &get_operation() const {
+		return m_operation;
+	}
+	const std::string &get_collection() const {
+		return m_collection;
+	}
+	// 只有 _id 是字符串时有效。对于 drop 等针对整个集合的操作，这一项为空。
+	const std::string &get_document_id() const {
+		return m_document_id;
+	}
+};
+
 }
 
 #endif
@@ -4,55 +4,151 @@
 #include "../precompiled.hpp"
 #include "mysql_daemon.hpp"
 #include "main_config.hpp"
+#include "job_dispatcher.hpp"
 #include "../mysql/object_base.hpp"
 #include "../mysql/exception.hpp"
 #include "../mysql/connection.hpp"
+#include "../mysql/sql_builder.hpp"
+#include "../mysql/formatting.hpp"
 #include "../thread.hpp"
 #include "../mutex.hpp"
 #include "../condition_variable.hpp"
 #include "../atomic.hpp"
 #include "../exception.hpp"
+#include "../system_exception.hpp"
 #include "../log.hpp"
 #include "../raii.hpp"
 #include "../promise.hpp"
+#include "../job_base.hpp"
 #include "../profiler.hpp"
 #include "../time.hpp"
 #include "../errno.hpp"
 #include "../buffer_streams.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../multi_index_map.hpp"
+#include "../replica_set.hpp"
+#include "../journal.hpp"
+#include "../trace_context.hpp"
+#include "../pooled_allocator.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <mysql/mysqld_error.h>
 #include <mysql/errmsg.h>
 
 namespace Poseidon {
 
+template class PromiseContainer<boost::shared_ptr<MySql::ObjectBase> >;
+
 typedef MySqlDaemon::QueryCallback QueryCallback;
+typedef MySqlDaemon::ObjectFactory ObjectFactory;
+typedef MySqlDaemon::StreamCallback StreamCallback;
 
 namespace {
-	boost::shared_ptr<MySql::Connection> real_create_connection(bool from_slave, const boost::shared_ptr<MySql::Connection> &master_conn){
-		std::string server_addr;
-		boost::uint16_t server_port = 0;
-		if(from_slave){
-			server_addr = MainConfig::get<std::string>("mysql_slave_addr");
-			server_port = MainConfig::get<boost::uint16_t>("mysql_slave_port");
-		}
-		if(server_addr.empty()){
-			if(master_conn){
-				LOG_POSEIDON_DEBUG("MySQL slave is not configured. Reuse the master connection as a slave.");
-				return master_conn;
-			}
-			server_addr = MainConfig::get<std::string>("mysql_server_addr", "localhost");
-			server_port = MainConfig::get<boost::uint16_t>("mysql_server_port", 3306);
-		}
+	ConfigValue<bool> g_prepared_statements("mysql_prepared_statements", true);
+	ConfigValue<std::size_t> g_max_retry_count("mysql_max_retry_count", 3);
+	ConfigValue<boost::uint64_t> g_retry_init_delay("mysql_retry_init_delay", 1000);
+	ConfigValue<std::size_t> g_save_batch_max_rows("mysql_save_batch_max_rows", 100);
+	ConfigValue<std::size_t> g_save_batch_max_bytes("mysql_save_batch_max_bytes", 1048576);
+	ConfigValue<std::size_t> g_pipeline_depth("mysql_pipeline_depth", 1);
+	ConfigValue<std::size_t> g_key_batch_max_keys("mysql_key_batch_max_keys", 100);
+
+	// 只读副本。由 mysql_replica 指定，如果没有指定就使用 mysql_slave_addr。
+	ReplicaSet g_replicas;
+
+	boost::shared_ptr<MySql::Connection> create_connection_to(const std::string &server_addr, boost::uint16_t server_port, bool replica){
 		std::string username = MainConfig::get<std::string>("mysql_username", "root");
 		std::string password = MainConfig::get<std::string>("mysql_password");
 		std::string schema = MainConfig::get<std::string>("mysql_schema", "poseidon");
 		bool use_ssl = MainConfig::get<bool>("mysql_use_ssl", false);
 		std::string charset = MainConfig::get<std::string>("mysql_charset", "utf8");
-		return MySql::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), schema.c_str(), use_ssl, charset.c_str());
+		// 副本可以使用不同的压缩算法，例如跨地域的副本使用压缩比更高的。
+		std::string compression = MainConfig::get<std::string>("mysql_compression", "zlib");
+		if(replica){
+			compression = MainConfig::get<std::string>("mysql_replica_compression", compression);
+		}
+		return MySql::Connection::create(server_addr.c_str(), server_port, username.c_str(), password.c_str(), schema.c_str(), use_ssl, charset.c_str(), compression.c_str());
+	}
+
+	// 返回 false 表示这个副本不应该再被使用，原因写入 reason。mysql_replica_max_lag 为零时不检查。
+	bool check_replica_lag(const boost::shared_ptr<MySql::Connection> &conn, std::string &reason){
+		PROFILE_ME;
+
+		const AUTO(max_lag, MainConfig::get<boost::uint64_t>("mysql_replica_max_lag", 0));
+		if(max_lag == 0){
+			return true;
+		}
+		conn->execute_sql("SHOW SLAVE STATUS");
+		if(!conn->fetch_row()){
+			// 不是从服务器，没有延迟。
+			conn->discard_result();
+			return true;
+		}
+		const AUTO(lag_str, conn->get_string("Seconds_Behind_Master"));
+		conn->discard_result();
+		if(lag_str.empty()){
+			reason = "Replication is not running";
+			return false;
+		}
+		const AUTO(lag, boost::lexical_cast<boost::uint64_t>(lag_str));
+		if(lag > max_lag){
+			reason = "Replication lag is " + lag_str + " second(s)";
+			return false;
+		}
+		return true;
+	}
+
+	// 如果 from_slave 为 true，选择一个可用的副本。没有可用的副本时，回退到 master_conn 或者主服务器。
+	// replica_index 非空时，被选择的副本的索引存放于此（没有使用副本时为 ReplicaSet::INDEX_NONE），调用者负责调用 g_replicas.release()。
+	boost::shared_ptr<MySql::Connection> real_create_connection(bool from_slave, const boost::shared_ptr<MySql::Connection> &master_conn, std::size_t *replica_index = NULLPTR){
+		if(replica_index){
+			*replica_index = ReplicaSet::INDEX_NONE;
+		}
+		if(from_slave){
+			const AUTO(retry_delay, MainConfig::get<boost::uint64_t>("mysql_replica_retry_delay", 5000));
+			for(;;){
+				const AUTO(now, get_fast_mono_clock());
+				ReplicaSet::Replica replica;
+				const AUTO(index, g_replicas.acquire(replica, now));
+				if(index == ReplicaSet::INDEX_NONE){
+					break;
+				}
+				try {
+					AUTO(conn, create_connection_to(replica.addr, replica.port, true));
+					std::string reason;
+					if(!check_replica_lag(conn, reason)){
+						DEBUG_THROW(Exception, SharedNts(reason));
+					}
+					g_replicas.mark_up(index);
+					if(replica_index){
+						*replica_index = index;
+					} else {
+						g_replicas.release(index);
+					}
+					return conn;
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("Could not use MySQL replica: addr = ", replica.addr, ", port = ", replica.port, ", what = ", e.what());
+					g_replicas.mark_down(index, now, retry_delay);
+					g_replicas.release(index);
+				}
+			}
+			if(master_conn){
+				LOG_POSEIDON_DEBUG("No MySQL replica is available. Reuse the master connection as a slave.");
+				return master_conn;
+			}
+		}
+		return create_connection_to(MainConfig::get<std::string>("mysql_server_addr", "localhost"), MainConfig::get<boost::uint16_t>("mysql_server_port", 3306), false);
+	}
+
+	// 启动时在另一个线程中检查副本，异常被保存下来，由启动的线程重新抛出。
+	void check_slave_server_nothrow(STD_EXCEPTION_PTR *except) NOEXCEPT
+	try {
+		const AUTO(conn, real_create_connection(true, VAL_INIT));
+		conn->execute_sql("DO 0");
+	} catch(...){
+		*except = STD_CURRENT_EXCEPTION();
 	}
 
 	// 对于日志文件的写操作应当互斥。
@@ -111,23 +207,211 @@ namespace {
 		LOG_POSEIDON_ERROR("Error writing SQL dump: what = ", e.what());
 	}
 
+	// 数据库不可用时，写入操作被转存到每个线程各自的日志中，重新连接之后按顺序重放。
+	std::string get_journal_path(const std::string &journal_dir, std::size_t index){
+		Buffer_ostream os;
+		os <<journal_dir <<"/thread_" <<index <<".journal";
+		return os.get_buffer().dump_string();
+	}
+
+	struct DirectoryCloser {
+		CONSTEXPR ::DIR *operator()() const NOEXCEPT {
+			return NULLPTR;
+		}
+		void operator()(::DIR *dir) const NOEXCEPT {
+			::closedir(dir);
+		}
+	};
+
+	// 在启动时重放上次退出时遗留的日志，然后删除它们。
+	// 服务器拒绝的语句被转储；连接错误时抛出异常，没有重放的记录留在日志中。
+	void replay_leftover_journals(const std::string &journal_dir, const boost::shared_ptr<MySql::Connection> &conn){
+		PROFILE_ME;
+
+		boost::container::vector<std::string> paths;
+		{
+			const UniqueHandle<DirectoryCloser> dir(::opendir(journal_dir.c_str()));
+			DEBUG_THROW_UNLESS(dir, SystemException);
+			for(;;){
+				const AUTO(entry, ::readdir(dir.get()));
+				if(!entry){
+					break;
+				}
+				const std::string name = entry->d_name;
+				if((name.compare(0, 7, "thread_") != 0) || (name.size() < 15) || (name.compare(name.size() - 8, 8, ".journal") != 0)){
+					continue;
+				}
+				paths.push_back(journal_dir + '/' + name);
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+		for(AUTO(it, paths.begin()); it != paths.end(); ++it){
+			Journal journal(*it, UINT64_MAX);
+			if(!journal.empty()){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Replaying MySQL journal: path = ", *it, ", records = ", journal.size());
+			}
+			std::string query;
+			while(journal.front(query)){
+				try {
+					conn->execute_sql(query);
+					conn->discard_result();
+				} catch(MySql::Exception &e){
+					if((e.get_code() >= CR_MIN_ERROR) && (e.get_code() <= CR_MAX_ERROR)){
+						throw;
+					}
+					LOG_POSEIDON_ERROR("MySql::Exception thrown: code = ", e.get_code(), ", what = ", e.what());
+					conn->discard_result();
+					char err_msg[4096];
+					::snprintf(err_msg, sizeof(err_msg), "MySql::Exception: %s", e.what());
+					dump_sql_to_file(query, e.get_code(), err_msg);
+				}
+				journal.pop();
+			}
+			::unlink(it->c_str());
+		}
+	}
+
+	// 读缓存。键是表名、一个零字节和调用者提供的键，这样同一个表的元素是相邻的。
+	struct CacheElement {
+		std::string key;
+		boost::shared_ptr<MySql::ObjectBase> object;
+		boost::uint64_t expiry_time;
+	};
+	MULTI_INDEX_MAP(CacheMap, CacheElement,
+		UNIQUE_MEMBER_INDEX(key)
+		SEQUENCED_INDEX()
+	);
+
+	Mutex g_cache_mutex;
+	CacheMap g_cache;
+	boost::uint64_t g_cache_hits = 0;
+	boost::uint64_t g_cache_misses = 0;
+	boost::uint64_t g_cache_evictions = 0;
+	boost::uint64_t g_cache_invalidations = 0;
+
+	std::string make_cache_key(const char *table, const std::string &key){
+		std::string ret;
+		ret.reserve(std::strlen(table) + 1 + key.size());
+		ret.append(table);
+		ret.push_back(0);
+		ret.append(key);
+		return ret;
+	}
+
+	boost::shared_ptr<MySql::ObjectBase> find_cached_object(const std::string &cache_key, boost::uint64_t now){
+		PROFILE_ME;
+
+		const Mutex::UniqueLock lock(g_cache_mutex);
+		const AUTO(it, g_cache.find<0>(cache_key));
+		if(it == g_cache.end<0>()){
+			++g_cache_misses;
+			return VAL_INIT;
+		}
+		if(it->expiry_time <= now){
+			g_cache.erase<0>(it);
+			++g_cache_misses;
+			return VAL_INIT;
+		}
+		// 移到最近使用的一端。
+		g_cache.get_index<1>().relocate(g_cache.end<1>(), g_cache.project<1>(it));
+		++g_cache_hits;
+		return it->object;
+	}
+	// 如果已经有相同键的对象就返回它，否则插入 object 并返回之。
+	boost::shared_ptr<MySql::ObjectBase> insert_cached_object(std::string cache_key, boost::shared_ptr<MySql::ObjectBase> object, bool overwrite, boost::uint64_t now){
+		PROFILE_ME;
+
+		const AUTO(capacity, MainConfig::get<std::size_t>("mysql_cache_capacity", 0));
+		const AUTO(ttl, MainConfig::get<boost::uint64_t>("mysql_cache_ttl", 60000));
+		if(capacity == 0){
+			return STD_MOVE_IDN(object);
+		}
+		const AUTO(expiry_time, (ttl == 0) ? UINT64_MAX : saturated_add(now, ttl));
+
+		const Mutex::UniqueLock lock(g_cache_mutex);
+		AUTO(it, g_cache.find<0>(cache_key));
+		if(it != g_cache.end<0>()){
+			if(!overwrite && (now < it->expiry_time)){
+				g_cache.get_index<1>().relocate(g_cache.end<1>(), g_cache.project<1>(it));
+				return it->object;
+			}
+			g_cache.erase<0>(it);
+		}
+		while(g_cache.size() >= capacity){
+			g_cache.erase<1>(g_cache.begin<1>());
+			++g_cache_evictions;
+		}
+		CacheElement elem = { STD_MOVE(cache_key), object, expiry_time };
+		g_cache.insert(STD_MOVE(elem));
+		return STD_MOVE_IDN(object);
+	}
+	void invalidate_cached_objects(const std::string &from, const std::string &to){
+		PROFILE_ME;
+
+		const Mutex::UniqueLock lock(g_cache_mutex);
+		const AUTO(lower, g_cache.lower_bound<0>(from));
+		const AUTO(upper, g_cache.lower_bound<0>(to));
+		std::size_t count = 0;
+		for(AUTO(it, lower); it != upper; ++it){
+			++count;
+		}
+		g_cache.erase<0>(lower, upper);
+		g_cache_invalidations += count;
+	}
+
 	// 数据库线程操作。
 	class OperationBase : NONCOPYABLE {
 	private:
 		const boost::weak_ptr<Promise> m_weak_promise;
+		// 在投递操作的线程中创建，是投递者当前上下文的子节点。
+		const TraceSpan m_trace;
 
 		boost::shared_ptr<const void> m_probe;
+		// 其他线程上必须先完成的操作的探针。
+		boost::container::vector<boost::weak_ptr<const void> > m_dependencies;
 
 	public:
 		explicit OperationBase(const boost::shared_ptr<Promise> &promise)
-			: m_weak_promise(promise)
+			: m_weak_promise(promise), m_trace("mysql", TraceSpan::KIND_CLIENT)
 		{ }
 		virtual ~OperationBase(){ }
 
 	public:
+		const TraceContext &get_trace_context() const {
+			return m_trace.get_context();
+		}
+		// 在完成 promise 的地方调用。
+		void finish(bool error) const {
+			on_finished(error);
+			if(!m_trace.is_sampled()){
+				return;
+			}
+			const char *const table = get_table();
+			const char *const attributes[][2] = {
+				{ "db.system", "mysql" },
+				{ "db.sql.table", table ? table : "" },
+				{ NULLPTR },
+			};
+			m_trace.finish(attributes, error);
+		}
+		const boost::shared_ptr<const void> &get_probe() const {
+			return m_probe;
+		}
 		void set_probe(boost::shared_ptr<const void> probe){
 			m_probe = STD_MOVE(probe);
 		}
+		// 只能在添加到队列之前调用。
+		void add_dependency(boost::weak_ptr<const void> dependency){
+			m_dependencies.push_back(STD_MOVE(dependency));
+		}
+		bool is_blocked() const {
+			for(AUTO(it, m_dependencies.begin()); it != m_dependencies.end(); ++it){
+				if(!it->expired()){
+					return true;
+				}
+			}
+			return false;
+		}
 
 		virtual boost::shared_ptr<Promise> get_promise() const {
 			return m_weak_promise.lock();
@@ -137,19 +421,71 @@ namespace {
 		virtual const char *get_table() const = 0;
 		virtual void generate_sql(std::string &query) const = 0;
 		virtual void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string &query) = 0;
+		// 如果支持预处理语句则执行之并返回 true，否则返回 false，由调用者生成文本 SQL 并调用 execute()。
+		virtual bool execute_prepared(const boost::shared_ptr<MySql::Connection> &conn){
+			(void)conn;
+			return false;
+		}
+		// 如果 generate_sql() 生成的语句可以写入日志稍后重放，不需要返回结果，则返回 true。
+		virtual bool is_journalable() const {
+			return false;
+		}
+		// 操作成功执行（或者写入了日志），或者最终失败时调用。
+		virtual void on_finished(bool error) const {
+			(void)error;
+		}
 	};
 
 	class SaveOperation : public OperationBase {
 	private:
 		boost::shared_ptr<const MySql::ObjectBase> m_object;
 		bool m_to_replace;
+		// 修改标记在生成语句时就被清除了。如果执行失败，重试时只能写入完整的行。
+		mutable bool m_update_generated;
 
 	public:
 		SaveOperation(const boost::shared_ptr<Promise> &promise, boost::shared_ptr<const MySql::ObjectBase> object, bool to_replace)
 			: OperationBase(promise)
-			, m_object(STD_MOVE(object)), m_to_replace(to_replace)
+			, m_object(STD_MOVE(object)), m_to_replace(to_replace), m_update_generated(false)
 		{ }
 
+	private:
+		bool should_update() const {
+			return m_to_replace && !m_update_generated && m_object->can_generate_sql_update();
+		}
+		bool generate_update(std::string &query) const {
+			if(!m_to_replace || m_update_generated){
+				return false;
+			}
+			const MySql::SqlBuilder::Scope builder;
+			AUTO_REF(os, builder.get_stream());
+			os <<"INSERT INTO `" <<get_table() <<"` SET ";
+			if(!m_object->generate_sql_update(os)){
+				return false;
+			}
+			m_update_generated = true;
+			query = builder.get_string();
+			return true;
+		}
+
+	public:
+		bool is_to_replace() const {
+			return m_to_replace;
+		}
+		// 如果对象不支持合并为多行语句，或者只需要更新部分字段，则返回 false。
+		bool generate_row(std::string &columns, std::string &values) const {
+			if(should_update()){
+				return false;
+			}
+			const MySql::SqlBuilder::Scope columns_builder, values_builder;
+			if(!m_object->generate_sql_row(columns_builder.get_stream(), values_builder.get_stream())){
+				return false;
+			}
+			columns = columns_builder.get_string();
+			values = values_builder.get_string();
+			return true;
+		}
+
 	protected:
 		bool should_use_slave() const OVERRIDE {
 			return false;
@@ -157,11 +493,22 @@ namespace {
 		boost::shared_ptr<const MySql::ObjectBase> get_combinable_object() const OVERRIDE {
 			return m_object;
 		}
+		bool is_journalable() const OVERRIDE {
+			return true;
+		}
+		void on_finished(bool error) const OVERRIDE {
+			// 只有写入成功之后才能只更新修改过的字段。失败时修改标记可能已经丢失，下次保存时写入完整的行。
+			m_object->set_persisted(!error);
+		}
 		const char *get_table() const OVERRIDE {
 			return m_object->get_table();
 		}
 		void generate_sql(std::string &query) const OVERRIDE {
-			Buffer_ostream os;
+			if(generate_update(query)){
+				return;
+			}
+			const MySql::SqlBuilder::Scope builder;
+			AUTO_REF(os, builder.get_stream());
 			if(m_to_replace){
 				os <<"REPLACE";
 			} else {
@@ -169,13 +516,36 @@ namespace {
 			}
 			os <<" INTO `" <<get_table() <<"` SET ";
 			m_object->generate_sql(os);
-			query = os.get_buffer().dump_string();
+			query = builder.get_string();
 		}
 		void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string &query) OVERRIDE {
 			PROFILE_ME;
 
 			conn->execute_sql(query);
 		}
+		bool execute_prepared(const boost::shared_ptr<MySql::Connection> &conn) OVERRIDE {
+			PROFILE_ME;
+
+			if(should_update()){
+				// 由调用者生成 INSERT ... ON DUPLICATE KEY UPDATE 语句。
+				return false;
+			}
+			// SET 子句只取决于对象的类型，因此每种对象的 INSERT 和 REPLACE 在每个连接上各只准备一次。
+			std::string set_clause;
+			boost::container::vector<MySql::StatementParameter> params;
+			if(!m_object->generate_sql_prepared(set_clause, params)){
+				return false;
+			}
+			std::string sql;
+			sql.reserve(set_clause.size() + 64);
+			sql += m_to_replace ? "REPLACE" : "INSERT";
+			sql += " INTO `";
+			sql += get_table();
+			sql += "` SET ";
+			sql += set_clause;
+			conn->execute_prepared(sql, params);
+			return true;
+		}
 	};
 
 	class LoadOperation : public OperationBase {
@@ -213,6 +583,182 @@ namespace {
 			DEBUG_THROW_UNLESS(conn->fetch_row(), MySql::Exception, SharedNts::view(get_table()), ER_SP_FETCH_NO_DATA, sslit("No rows returned"));
 			m_object->fetch(conn);
 		}
+
+	public:
+		const boost::shared_ptr<MySql::ObjectBase> &get_object() const {
+			return m_object;
+		}
+	};
+
+	class CachedLoadOperation : public LoadOperation {
+	private:
+		const boost::weak_ptr<PromiseContainer<boost::shared_ptr<MySql::ObjectBase> > > m_weak_promise;
+		std::string m_cache_key;
+
+	public:
+		CachedLoadOperation(const boost::shared_ptr<PromiseContainer<boost::shared_ptr<MySql::ObjectBase> > > &promise, boost::shared_ptr<MySql::ObjectBase> object, std::string query, std::string cache_key)
+			: LoadOperation(promise, STD_MOVE(object), STD_MOVE(query))
+			, m_weak_promise(promise), m_cache_key(STD_MOVE(cache_key))
+		{ }
+
+	protected:
+		void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string &query) OVERRIDE {
+			PROFILE_ME;
+
+			const AUTO(promise, m_weak_promise.lock());
+			if(!promise){
+				LOG_POSEIDON_DEBUG("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				return;
+			}
+			LoadOperation::execute(conn, query);
+			// 同时加载同一个对象时，先放入缓存的那个胜出，保证大家拿到的是同一个对象。
+			AUTO(object, insert_cached_object(m_cache_key, get_object(), false, get_fast_mono_clock()));
+			promise->set_success(STD_MOVE(object), false);
+		}
+	};
+
+	// 按键加载的一个批次。操作开始执行之前，enqueue_for_loading_by_key() 可以向其中添加请求；
+	// 数据库线程生成语句时将其封闭，之后的请求进入新的批次，已封闭的 requests 不再改变。
+	struct KeyedLoadBatch {
+		Mutex mutex;
+		bool sealed;
+		boost::container::vector<std::pair<std::string, boost::weak_ptr<MySqlDaemon::CachedLoadPromise> > > requests;
+
+		KeyedLoadBatch()
+			: sealed(false)
+		{ }
+	};
+
+	// 键是表名、一个零字节和列名，值是尚未封闭的批次。
+	Mutex g_keyed_load_mutex;
+	boost::container::flat_map<std::string, boost::weak_ptr<KeyedLoadBatch> > g_keyed_loads;
+
+	// 批次的操作完成（包括重试之后仍然失败）时调用，把结果转给还没有得到结果的请求。
+	// 操作成功时，没有得到结果的请求对应的行不存在。
+	void finish_keyed_load_batch(const boost::shared_ptr<KeyedLoadBatch> &batch, const Promise *batch_promise, const char *table) NOEXCEPT
+	try {
+		STD_EXCEPTION_PTR except;
+		if(batch_promise->would_throw()){
+			try {
+				batch_promise->check_and_rethrow();
+			} catch(...){
+				except = STD_CURRENT_EXCEPTION();
+			}
+		} else {
+			except = STD_MAKE_EXCEPTION_PTR(MySql::Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, SharedNts(table), ER_SP_FETCH_NO_DATA, sslit("No rows returned")));
+		}
+		for(AUTO(it, batch->requests.begin()); it != batch->requests.end(); ++it){
+			const AUTO(promise, it->second.lock());
+			if(promise && !promise->is_satisfied()){
+				promise->set_exception(except, false);
+			}
+		}
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+	}
+
+	class KeyedLoadOperation : public OperationBase {
+	private:
+		// 操作本身的 promise 由这里持有，它被满足时把结果转给批次中的请求。
+		const boost::shared_ptr<Promise> m_batch_promise;
+		const ObjectFactory m_factory;
+		const char *const m_table;
+		const std::string m_column;
+		const std::string m_cache_key_prefix;
+		const boost::shared_ptr<KeyedLoadBatch> m_batch;
+
+	public:
+		KeyedLoadOperation(const boost::shared_ptr<Promise> &batch_promise, ObjectFactory factory, const char *table, std::string column, boost::shared_ptr<KeyedLoadBatch> batch)
+			: OperationBase(batch_promise)
+			, m_batch_promise(batch_promise), m_factory(factory), m_table(table), m_column(STD_MOVE(column)), m_cache_key_prefix(make_cache_key(table, std::string()))
+			, m_batch(STD_MOVE(batch))
+		{
+			m_batch_promise->add_waiter(boost::bind(&finish_keyed_load_batch, m_batch, m_batch_promise.get(), m_table));
+		}
+
+	private:
+		bool has_live_requests() const {
+			for(AUTO(it, m_batch->requests.begin()); it != m_batch->requests.end(); ++it){
+				if(!it->second.expired()){
+					return true;
+				}
+			}
+			return false;
+		}
+
+	protected:
+		bool should_use_slave() const OVERRIDE {
+			return true;
+		}
+		boost::shared_ptr<const MySql::ObjectBase> get_combinable_object() const OVERRIDE {
+			return VAL_INIT; // 不能合并。
+		}
+		const char *get_table() const OVERRIDE {
+			return m_table;
+		}
+		void generate_sql(std::string &query) const OVERRIDE {
+			{
+				const Mutex::UniqueLock lock(m_batch->mutex);
+				m_batch->sealed = true;
+			}
+			// 同一个键可能被请求多次，语句中只出现一次。
+			boost::container::vector<const std::string *> keys;
+			keys.reserve(m_batch->requests.size());
+			for(AUTO(it, m_batch->requests.begin()); it != m_batch->requests.end(); ++it){
+				keys.push_back(&(it->first));
+			}
+			std::sort(keys.begin(), keys.end(), &less_by_value);
+			keys.erase(std::unique(keys.begin(), keys.end(), &equal_by_value), keys.end());
+
+			const MySql::SqlBuilder::Scope builder;
+			AUTO_REF(os, builder.get_stream());
+			os <<"SELECT * FROM `" <<m_table <<"` WHERE `" <<m_column <<"` IN (";
+			for(AUTO(it, keys.begin()); it != keys.end(); ++it){
+				if(it != keys.begin()){
+					os <<", ";
+				}
+				os <<"'" <<MySql::StringEscaper(**it) <<"'";
+			}
+			os <<")";
+			query = builder.get_string();
+		}
+		void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string &query) OVERRIDE {
+			PROFILE_ME;
+
+			if(!has_live_requests()){
+				LOG_POSEIDON_DEBUG("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				return;
+			}
+			conn->execute_sql(query);
+			const AUTO(now, get_fast_mono_clock());
+			std::string key, cache_key;
+			while(conn->fetch_row()){
+				key = conn->get_string(m_column.c_str());
+				AUTO(object, (*m_factory)());
+				object->fetch(conn);
+				cache_key = m_cache_key_prefix;
+				cache_key += key;
+				// 与 enqueue_for_cached_loading() 相同，先放入缓存的那个胜出。
+				object = insert_cached_object(STD_MOVE(cache_key), STD_MOVE(object), false, now);
+				for(AUTO(it, m_batch->requests.begin()); it != m_batch->requests.end(); ++it){
+					if(it->first != key){
+						continue;
+					}
+					const AUTO(promise, it->second.lock());
+					if(promise){
+						promise->set_success(object, false);
+					}
+				}
+			}
+		}
+
+	private:
+		static bool less_by_value(const std::string *lhs, const std::string *rhs){
+			return *lhs < *rhs;
+		}
+		static bool equal_by_value(const std::string *lhs, const std::string *rhs){
+			return *lhs == *rhs;
+		}
 	};
 
 	class DeleteOperation : public OperationBase {
@@ -244,6 +790,9 @@ namespace {
 
 			conn->execute_sql(query);
 		}
+		bool is_journalable() const OVERRIDE {
+			return true;
+		}
 	};
 
 	class BatchLoadOperation : public OperationBase {
@@ -289,44 +838,215 @@ namespace {
 		}
 	};
 
-	class LowLevelAccessOperation : public OperationBase {
-	private:
-		QueryCallback m_callback;
-		const char *m_table_hint;
-		bool m_from_slave;
+	// 流式批量加载时数据库线程和任务线程之间共享的状态。
+	struct StreamState {
+		Mutex mutex;
+		ConditionVariable new_avail;
+		std::size_t pending;
+		STD_EXCEPTION_PTR except;
 
-	public:
-		LowLevelAccessOperation(const boost::shared_ptr<Promise> &promise, QueryCallback callback, const char *table_hint, bool from_slave)
-			: OperationBase(promise)
-			, m_callback(STD_MOVE_IDN(callback)), m_table_hint(table_hint), m_from_slave(from_slave)
+		StreamState()
+			: pending(0)
 		{ }
+	};
 
-	protected:
-		bool should_use_slave() const OVERRIDE {
-			return m_from_slave;
+	class StreamJob : public JobBase {
+	private:
+		const boost::shared_ptr<StreamState> m_state;
+		const StreamCallback m_callback;
+		boost::container::vector<boost::shared_ptr<MySql::ObjectBase> > m_objects;
+		bool m_performed;
+
+	public:
+		StreamJob(boost::shared_ptr<StreamState> state, StreamCallback callback, boost::container::vector<boost::shared_ptr<MySql::ObjectBase> > objects)
+			: m_state(STD_MOVE(state)), m_callback(STD_MOVE_IDN(callback)), m_objects(STD_MOVE(objects)), m_performed(false)
+		{
+			const Mutex::UniqueLock lock(m_state->mutex);
+			++(m_state->pending);
 		}
-		boost::shared_ptr<const MySql::ObjectBase> get_combinable_object() const OVERRIDE {
-			return VAL_INIT; // 不能合并。
+		~StreamJob() OVERRIDE {
+			// 任务被拒绝或者丢弃时也要唤醒数据库线程，否则它会一直等待。
+			const Mutex::UniqueLock lock(m_state->mutex);
+			if(!m_performed && !m_state->except){
+				LOG_POSEIDON_WARNING("Streaming batch discarded: object_count = ", m_objects.size());
+				m_state->except = STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("Streaming batch discarded")));
+			}
+			--(m_state->pending);
+			m_state->new_avail.signal();
 		}
-		const char *get_table() const OVERRIDE {
-			return m_table_hint;
+
+	protected:
+		boost::weak_ptr<const void> get_category() const FINAL {
+			// 同一次加载的各批按顺序执行。
+			return m_state;
 		}
-		void generate_sql(std::string & /* query */) const OVERRIDE {
-			// no query
+		bool is_yieldable() const FINAL {
+			// 数据库线程可能正在等待这个任务，如果在这里等待数据库操作就会死锁。
+			return false;
 		}
-		void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string & /* query */) OVERRIDE {
+		void perform() FINAL {
 			PROFILE_ME;
 
-			m_callback(conn);
+			STD_EXCEPTION_PTR except;
+			try {
+				m_callback(m_objects);
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+				except = STD_CURRENT_EXCEPTION();
+			} catch(...){
+				LOG_POSEIDON_WARNING("Unknown exception thrown.");
+				except = STD_CURRENT_EXCEPTION();
+			}
+			m_objects.clear();
+
+			const Mutex::UniqueLock lock(m_state->mutex);
+			if(except && !m_state->except){
+				m_state->except = STD_MOVE(except);
+			}
+			m_performed = true;
 		}
 	};
 
-	class WaitOperation : public OperationBase {
+	class StreamLoadOperation : public OperationBase {
+	private:
+		ObjectFactory m_factory;
+		StreamCallback m_callback;
+		const char *m_table_hint;
+		std::string m_query;
+
 	public:
-		explicit WaitOperation(const boost::shared_ptr<Promise> &promise)
+		StreamLoadOperation(const boost::shared_ptr<Promise> &promise, ObjectFactory factory, StreamCallback callback, const char *table_hint, std::string query)
 			: OperationBase(promise)
+			, m_factory(factory), m_callback(STD_MOVE_IDN(callback)), m_table_hint(table_hint), m_query(STD_MOVE(query))
 		{ }
-		~WaitOperation() OVERRIDE {
+
+	private:
+		// 等待任务线程处理完，直到尚未处理的批数小于 max_pending。任务线程中抛出异常时返回 false。
+		static bool wait_for_pending(const boost::shared_ptr<StreamState> &state, std::size_t max_pending){
+			PROFILE_ME;
+
+			Mutex::UniqueLock lock(state->mutex);
+			while(!state->except && (state->pending != 0) && (state->pending >= max_pending)){
+				state->new_avail.timed_wait(lock, 1000);
+			}
+			return !state->except;
+		}
+		bool flush(const boost::shared_ptr<StreamState> &state, boost::container::vector<boost::shared_ptr<MySql::ObjectBase> > &objects, std::size_t max_pending){
+			PROFILE_ME;
+
+			if(!wait_for_pending(state, max_pending)){
+				return false;
+			}
+			// 计数由任务的构造函数和析构函数维护。
+			JobDispatcher::enqueue(boost::allocate_shared<StreamJob>(PooledAllocator<StreamJob>(), state, m_callback, STD_MOVE(objects)), VAL_INIT);
+			objects.clear();
+			return true;
+		}
+
+	protected:
+		bool should_use_slave() const OVERRIDE {
+			return true;
+		}
+		boost::shared_ptr<const MySql::ObjectBase> get_combinable_object() const OVERRIDE {
+			return VAL_INIT; // 不能合并。
+		}
+		const char *get_table() const OVERRIDE {
+			return m_table_hint;
+		}
+		void generate_sql(std::string &query) const OVERRIDE {
+			query = m_query;
+		}
+		void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string &query) OVERRIDE {
+			PROFILE_ME;
+
+			const AUTO(promise, get_promise());
+			if(!promise){
+				LOG_POSEIDON_DEBUG("Discarding isolated MySQL query: table = ", get_table(), ", query = ", query);
+				return;
+			}
+			const AUTO(batch_size, std::max<std::size_t>(MainConfig::get<std::size_t>("mysql_stream_batch_size", 1000), 1));
+			const AUTO(max_pending, MainConfig::get<std::size_t>("mysql_stream_max_pending_batches", 4));
+
+			const AUTO(state, boost::make_shared<StreamState>());
+			boost::container::vector<boost::shared_ptr<MySql::ObjectBase> > objects;
+			std::size_t batches_delivered = 0;
+			try {
+				conn->execute_sql(query);
+				bool more = true;
+				while(more){
+					more = conn->fetch_row();
+					if(more){
+						AUTO(object, (*m_factory)());
+						object->fetch(conn);
+						objects.push_back(STD_MOVE_IDN(object));
+						if(objects.size() < batch_size){
+							continue;
+						}
+					} else if(objects.empty()){
+						break;
+					}
+					if(!flush(state, objects, max_pending)){
+						break;
+					}
+					++batches_delivered;
+				}
+			} catch(std::exception &e){
+				if(batches_delivered == 0){
+					// 还没有交出任何数据，可以重试。
+					throw;
+				}
+				LOG_POSEIDON_ERROR("Streaming batch load failed after some rows had been delivered: batches_delivered = ", batches_delivered, ", what = ", e.what());
+				wait_for_pending(state, 1);
+				// 已经交出的数据不能撤回，不再重试。
+				promise->set_exception(STD_CURRENT_EXCEPTION(), false);
+				return;
+			}
+			// 所有的批都处理完之后才完成 Promise。
+			if(!wait_for_pending(state, 1)){
+				const Mutex::UniqueLock lock(state->mutex);
+				promise->set_exception(state->except, false);
+			}
+		}
+	};
+
+	class LowLevelAccessOperation : public OperationBase {
+	private:
+		QueryCallback m_callback;
+		const char *m_table_hint;
+		bool m_from_slave;
+
+	public:
+		LowLevelAccessOperation(const boost::shared_ptr<Promise> &promise, QueryCallback callback, const char *table_hint, bool from_slave)
+			: OperationBase(promise)
+			, m_callback(STD_MOVE_IDN(callback)), m_table_hint(table_hint), m_from_slave(from_slave)
+		{ }
+
+	protected:
+		bool should_use_slave() const OVERRIDE {
+			return m_from_slave;
+		}
+		boost::shared_ptr<const MySql::ObjectBase> get_combinable_object() const OVERRIDE {
+			return VAL_INIT; // 不能合并。
+		}
+		const char *get_table() const OVERRIDE {
+			return m_table_hint;
+		}
+		void generate_sql(std::string & /* query */) const OVERRIDE {
+			// no query
+		}
+		void execute(const boost::shared_ptr<MySql::Connection> &conn, const std::string & /* query */) OVERRIDE {
+			PROFILE_ME;
+
+			m_callback(conn);
+		}
+	};
+
+	class WaitOperation : public OperationBase {
+	public:
+		explicit WaitOperation(const boost::shared_ptr<Promise> &promise)
+			: OperationBase(promise)
+		{ }
+		~WaitOperation() OVERRIDE {
 			const AUTO(promise, OperationBase::get_promise());
 			if(promise){
 				promise->set_success(false);
@@ -356,27 +1076,52 @@ namespace {
 		}
 	};
 
+	class MySqlThread;
+
+	// 线程空闲了 idle_duration 毫秒。如果线程被回收则返回 true，此时线程应当退出。
+	bool retire_if_idle(MySqlThread *thread, std::size_t index, boost::uint64_t idle_duration);
+
 	class MySqlThread : NONCOPYABLE {
 	private:
 		struct OperationQueueElement {
 			boost::shared_ptr<OperationBase> operation;
 			boost::uint64_t due_time;
 			std::size_t retry_count;
+			boost::uint64_t enqueued_time;
+			// 已经和队首的操作一起执行，到达队首时直接移除。
+			bool done;
+			// 所在的多行语句或者流水线执行失败，之后只单独执行。
+			bool no_batch;
 		};
 
 	private:
+		const std::size_t m_index;
+
 		Thread m_thread;
 		volatile bool m_running;
 
 		mutable Mutex m_mutex;
 		mutable ConditionVariable m_new_operation;
+		mutable ConditionVariable m_drained; // 本线程发现队列为空时通知。
 		volatile bool m_urgent; // 无视延迟写入，一次性处理队列中所有操作。
 		boost::container::deque<OperationQueueElement> m_queue;
+		volatile bool m_abandoned;
+
+		// 以下成员只在这个线程中访问。
+		boost::scoped_ptr<Journal> m_journal;
+		// 已经转存的操作的探针在日志重放完之前保持有效，这样其他线程上依赖它们的操作会继续等待。
+		boost::container::vector<boost::shared_ptr<const void> > m_journal_probes;
+		std::size_t m_journal_retry_count;
+		boost::uint64_t m_journal_due_time;
+		// 执行操作时复用，保留已经分配的内存。
+		std::string m_query;
 
 	public:
-		MySqlThread()
-			: m_running(false)
-			, m_urgent(false)
+		explicit MySqlThread(std::size_t index)
+			: m_index(index)
+			, m_running(false)
+			, m_urgent(false), m_abandoned(false)
+			, m_journal_retry_count(0), m_journal_due_time(0)
 		{ }
 
 	private:
@@ -384,22 +1129,38 @@ namespace {
 			PROFILE_ME;
 
 			const AUTO(now, get_fast_mono_clock());
+			// 日志中的记录早于队列中所有尚未完成的写入操作。
+			if(m_journal && !m_journal->empty()){
+				return replay_journal(master_conn, now);
+			}
 			OperationQueueElement *elem;
 			{
 				const Mutex::UniqueLock lock(m_mutex);
 				if(m_queue.empty()){
 					atomic_store(m_urgent, false, ATOMIC_RELAXED);
+					m_drained.broadcast();
 					return false;
 				}
+				if(m_queue.front().done){
+					m_queue.pop_front();
+					return true;
+				}
 				if(!atomic_load(m_urgent, ATOMIC_CONSUME) && (now < m_queue.front().due_time)){
 					return false;
 				}
+				if(m_queue.front().operation->is_blocked()){
+					return false;
+				}
 				elem = &m_queue.front();
 			}
 			const AUTO_REF(operation, elem->operation);
 			AUTO_REF(conn, elem->operation->should_use_slave() ? slave_conn : master_conn);
 
-			std::string query;
+			// 这个操作产生的日志和嵌套的 span 都属于投递它的 trace。
+			const TraceScope trace_scope(operation->get_trace_context());
+
+			AUTO_REF(query, m_query);
+			query.clear();
 			STD_EXCEPTION_PTR except;
 			unsigned long err_code = 0;
 			char err_msg[4096];
@@ -418,11 +1179,17 @@ namespace {
 					execute_it = true;
 				}
 			}
+			if(execute_it && (try_execute_batch(elem, conn, now) || try_execute_pipeline(elem, conn, now))){
+				execute_it = false;
+			}
 			if(execute_it){
 				try {
-					operation->generate_sql(query);
-					LOG_POSEIDON_DEBUG("Executing SQL: table = ", operation->get_table(), ", query = ", query);
-					operation->execute(conn, query);
+					const AUTO(use_prepared, g_prepared_statements.get());
+					if(!use_prepared || !operation->execute_prepared(conn)){
+						operation->generate_sql(query);
+						LOG_POSEIDON_DEBUG("Executing SQL: table = ", operation->get_table(), ", query = ", query);
+						operation->execute(conn, query);
+					}
 				} catch(MySql::Exception &e){
 					LOG_POSEIDON_WARNING("MySql::Exception thrown: code = ", e.get_code(), ", what = ", e.what());
 					except = STD_CURRENT_EXCEPTION();
@@ -442,24 +1209,33 @@ namespace {
 				conn->discard_result();
 			}
 			if(except){
-				const AUTO(max_retry_count, MainConfig::get<std::size_t>("mysql_max_retry_count", 3));
+				const AUTO(max_retry_count, g_max_retry_count.get());
 				const AUTO(retry_count, ++(elem->retry_count));
 				if(retry_count < max_retry_count){
 					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Going to retry MySQL operation: retry_count = ", retry_count);
-					const AUTO(retry_init_delay, MainConfig::get<boost::uint64_t>("mysql_retry_init_delay", 1000));
+					const AUTO(retry_init_delay, g_retry_init_delay.get());
 					elem->due_time = now + (retry_init_delay << retry_count);
 					conn.reset();
 					return true;
 				}
 				LOG_POSEIDON_ERROR("Max retry count exceeded.");
+				if(query.empty()){
+					// 预处理语句没有生成文本 SQL，这里补上以便转储。
+					try {
+						operation->generate_sql(query);
+					} catch(std::exception &e){
+						LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+					}
+				}
 				dump_sql_to_file(query, err_code, err_msg);
 			}
+			elem->operation->finish(!!except);
 			const AUTO(promise, elem->operation->get_promise());
 			if(promise){
 				if(except){
-					promise->set_success(false);
-				} else {
 					promise->set_exception(STD_MOVE(except), false);
+				} else {
+					promise->set_success(false);
 				}
 			}
 			const Mutex::UniqueLock lock(m_mutex);
@@ -467,16 +1243,459 @@ namespace {
 			return true;
 		}
 
+		// 把队首的保存操作和队列中已经到期的、同一个表的其他保存操作合并为一条多行 INSERT 或 REPLACE 语句。
+		// 成功返回 true，此时其他成员的 Promise 已经完成，它们到达队首时被直接移除；队首由调用者处理。
+		// 合并的语句执行失败时返回 false，所有成员改为单独执行，这样每个 Promise 都能得到自己的错误。
+		bool try_execute_batch(OperationQueueElement *front, const boost::shared_ptr<MySql::Connection> &conn, boost::uint64_t now) NOEXCEPT
+		try {
+			PROFILE_ME;
+
+			const AUTO(max_rows, g_save_batch_max_rows.get());
+			const AUTO(max_bytes, g_save_batch_max_bytes.get());
+			if((max_rows < 2) || front->no_batch){
+				return false;
+			}
+			const AUTO(front_save, dynamic_cast<const SaveOperation *>(front->operation.get()));
+			if(!front_save){
+				return false;
+			}
+			const char *const table = front->operation->get_table();
+			std::string columns, values;
+			if(!front_save->generate_row(columns, values)){
+				return false;
+			}
+
+			// 队列中的元素只会被这个线程移除，因此释放锁之后指针仍然有效。
+			// 遇到其他类型的操作时停止，以免越过同一个表的删除之类的操作。
+			boost::container::vector<OperationQueueElement *> candidates;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				const bool urgent = atomic_load(m_urgent, ATOMIC_CONSUME);
+				for(AUTO(it, m_queue.begin() + 1); (it != m_queue.end()) && (candidates.size() + 1 < max_rows); ++it){
+					if(it->done){
+						continue;
+					}
+					if(!urgent && (now < it->due_time)){
+						break;
+					}
+					const AUTO(save, dynamic_cast<const SaveOperation *>(it->operation.get()));
+					if(!save || it->operation->is_blocked()){
+						break;
+					}
+					if(std::strcmp(it->operation->get_table(), table) != 0){
+						continue;
+					}
+					if((save->is_to_replace() != front_save->is_to_replace()) || it->no_batch){
+						break;
+					}
+					candidates.push_back(&*it);
+				}
+			}
+			if(candidates.empty()){
+				return false;
+			}
+
+			const MySql::SqlBuilder::Scope builder;
+			AUTO_REF(os, builder.get_stream());
+			os <<(front_save->is_to_replace() ? "REPLACE" : "INSERT") <<" INTO `" <<table <<"` (" <<columns <<") VALUES (" <<values <<")";
+			std::size_t bytes = columns.size() + values.size() + 32;
+			boost::container::vector<OperationQueueElement *> members;
+			members.reserve(candidates.size());
+			std::string elem_columns, elem_values;
+			for(AUTO(it, candidates.begin()); it != candidates.end(); ++it){
+				OperationQueueElement *const elem = *it;
+				const AUTO(combinable_object, elem->operation->get_combinable_object());
+				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
+				if(old_write_stamp && (old_write_stamp != elem)){
+					// 同一个对象有更早的写入尚未完成，这个元素到达队首时再处理。
+					continue;
+				}
+				// 必须在生成语句之前清除标记，见 MySql::ObjectBase::invalidate()。
+				// 如果这个元素最后没有被合并，它到达队首时没有标记，仍然会被执行。
+				if(old_write_stamp){
+					combinable_object->set_combined_write_stamp(NULLPTR);
+				}
+				if(!static_cast<const SaveOperation *>(elem->operation.get())->generate_row(elem_columns, elem_values) || (elem_columns != columns)){
+					continue;
+				}
+				if(bytes + elem_values.size() + 4 > max_bytes){
+					break;
+				}
+				bytes += elem_values.size() + 4;
+				os <<", (" <<elem_values <<")";
+				members.push_back(elem);
+			}
+			if(members.empty()){
+				return false;
+			}
+			const AUTO_REF(query, builder.get_string());
+			LOG_POSEIDON_DEBUG("Executing batched SQL: table = ", table, ", rows = ", members.size() + 1, ", bytes = ", query.size());
+			try {
+				conn->execute_sql(query);
+				conn->discard_result();
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("Batched SQL failed, falling back to individual queries: table = ", table, ", what = ", e.what());
+				conn->discard_result();
+				front->no_batch = true;
+				for(AUTO(it, members.begin()); it != members.end(); ++it){
+					(*it)->no_batch = true;
+				}
+				return false;
+			}
+			for(AUTO(it, members.begin()); it != members.end(); ++it){
+				OperationQueueElement *const elem = *it;
+				elem->operation->finish(false);
+				const AUTO(promise, elem->operation->get_promise());
+				if(promise){
+					promise->set_success(false);
+				}
+				elem->done = true;
+			}
+			return true;
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+			return false;
+		}
+
+		// 把队首开始的连续若干个已经到期的保存操作用分号连接起来，在一次往返中发送（需要 CLIENT_MULTI_STATEMENTS）。
+		// 服务器按顺序执行这些语句，因此每个表的写入顺序不变。遇到其他类型的操作时停止。
+		// 队首成功执行时返回 true，其他成功执行的成员到达队首时被直接移除；
+		// 某条语句失败时服务器不再执行后面的语句，失败的和未执行的成员之后单独执行。
+		bool try_execute_pipeline(OperationQueueElement *front, const boost::shared_ptr<MySql::Connection> &conn, boost::uint64_t now) NOEXCEPT
+		try {
+			PROFILE_ME;
+
+			const AUTO(depth, g_pipeline_depth.get());
+			const AUTO(max_bytes, g_save_batch_max_bytes.get());
+			if((depth < 2) || front->no_batch || !dynamic_cast<const SaveOperation *>(front->operation.get())){
+				return false;
+			}
+
+			boost::container::vector<OperationQueueElement *> candidates;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				const bool urgent = atomic_load(m_urgent, ATOMIC_CONSUME);
+				for(AUTO(it, m_queue.begin() + 1); (it != m_queue.end()) && (candidates.size() + 1 < depth); ++it){
+					if(it->done){
+						continue;
+					}
+					if(!urgent && (now < it->due_time)){
+						break;
+					}
+					if(!dynamic_cast<const SaveOperation *>(it->operation.get()) || it->no_batch || it->operation->is_blocked()){
+						break;
+					}
+					candidates.push_back(&*it);
+				}
+			}
+			if(candidates.empty()){
+				return false;
+			}
+
+			std::string sql;
+			front->operation->generate_sql(sql);
+			boost::container::vector<OperationQueueElement *> members;
+			members.reserve(candidates.size() + 1);
+			members.push_back(front);
+			std::string query;
+			for(AUTO(it, candidates.begin()); it != candidates.end(); ++it){
+				OperationQueueElement *const elem = *it;
+				const AUTO(combinable_object, elem->operation->get_combinable_object());
+				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
+				if(old_write_stamp && (old_write_stamp != elem)){
+					continue;
+				}
+				if(old_write_stamp){
+					combinable_object->set_combined_write_stamp(NULLPTR);
+				}
+				elem->operation->generate_sql(query);
+				if(sql.size() + query.size() + 1 > max_bytes){
+					break;
+				}
+				sql += ';';
+				sql += query;
+				members.push_back(elem);
+			}
+			if(members.size() < 2){
+				return false;
+			}
+			LOG_POSEIDON_DEBUG("Executing pipelined SQL: statements = ", members.size(), ", bytes = ", sql.size());
+			std::size_t completed = 0;
+			try {
+				conn->execute_multiple_sql(sql, completed);
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("Pipelined SQL failed, falling back to individual queries: completed = ", completed, ", what = ", e.what());
+				for(std::size_t i = completed; i < members.size(); ++i){
+					members.at(i)->no_batch = true;
+				}
+			}
+			conn->discard_result();
+			for(std::size_t i = 1; i < completed; ++i){
+				OperationQueueElement *const elem = members.at(i);
+				elem->operation->finish(false);
+				const AUTO(promise, elem->operation->get_promise());
+				if(promise){
+					promise->set_success(false);
+				}
+				elem->done = true;
+			}
+			return completed != 0;
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+			return false;
+		}
+
+		// 重放日志中的第一条记录。失败时和其他操作一样重试，超过重试次数之后转储并丢弃。
+		bool replay_journal(boost::shared_ptr<MySql::Connection> &conn, boost::uint64_t now) NOEXCEPT
+		try {
+			PROFILE_ME;
+
+			if(now < m_journal_due_time){
+				return false;
+			}
+			std::string query;
+			try {
+				m_journal->front(query);
+			} catch(std::exception &e){
+				LOG_POSEIDON_ERROR("Discarding corrupted MySQL journal: path = ", m_journal->get_path(), ", records = ", m_journal->size(), ", what = ", e.what());
+				m_journal->clear();
+				m_journal_probes.clear();
+				return true;
+			}
+
+			STD_EXCEPTION_PTR except;
+			unsigned long err_code = 0;
+			char err_msg[4096];
+			err_msg[0] = 0;
+			try {
+				LOG_POSEIDON_DEBUG("Replaying journaled SQL: query = ", query);
+				conn->execute_sql(query);
+			} catch(MySql::Exception &e){
+				LOG_POSEIDON_WARNING("MySql::Exception thrown: code = ", e.get_code(), ", what = ", e.what());
+				except = STD_CURRENT_EXCEPTION();
+				err_code = e.get_code();
+				::snprintf(err_msg, sizeof(err_msg), "MySql::Exception: %s", e.what());
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+				except = STD_CURRENT_EXCEPTION();
+				err_code = ER_UNKNOWN_ERROR;
+				::snprintf(err_msg, sizeof(err_msg), "std::exception: %s", e.what());
+			}
+			conn->discard_result();
+			if(except){
+				const AUTO(max_retry_count, g_max_retry_count.get());
+				const AUTO(retry_count, ++m_journal_retry_count);
+				if(retry_count < max_retry_count){
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Going to retry journaled SQL: retry_count = ", retry_count);
+					const AUTO(retry_init_delay, g_retry_init_delay.get());
+					m_journal_due_time = now + (retry_init_delay << retry_count);
+					conn.reset();
+					return true;
+				}
+				LOG_POSEIDON_ERROR("Max retry count exceeded.");
+				dump_sql_to_file(query, err_code, err_msg);
+			}
+			m_journal_retry_count = 0;
+			m_journal_due_time = 0;
+			m_journal->pop();
+			if(m_journal->empty()){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "MySQL journal has been replayed: path = ", m_journal->get_path());
+				m_journal_probes.clear();
+			}
+			return true;
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			return false;
+		}
+
+		// 数据库不可用时，把队列中不需要等待结果的写入操作转存到日志中并释放它们，这样队列占用的内存不会无限增长。
+		// 读取操作留在队列中，之后会读到转存的写入的结果；遇到其他操作时停止，以免改变写入的顺序。
+		// 如果 all 为 false，只在队列长度超过 mysql_journal_queue_limit 时转存。
+		void spill_to_journal(bool all) NOEXCEPT
+		try {
+			PROFILE_ME;
+
+			const AUTO(journal_dir, MainConfig::get<std::string>("mysql_journal_dir"));
+			if(journal_dir.empty()){
+				return;
+			}
+			if(!all && (get_queue_size() <= MainConfig::get<std::size_t>("mysql_journal_queue_limit", 10000))){
+				return;
+			}
+
+			// 队列中的元素只会被这个线程移除，因此释放锁之后指针仍然有效。
+			boost::container::vector<OperationQueueElement *> candidates;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				for(AUTO(it, m_queue.begin()); it != m_queue.end(); ++it){
+					if(it->done){
+						continue;
+					}
+					if(it->operation->is_blocked()){
+						break;
+					}
+					if(!it->operation->is_journalable()){
+						if(it->operation->should_use_slave()){
+							continue;
+						}
+						break;
+					}
+					candidates.push_back(&*it);
+				}
+			}
+			if(candidates.empty()){
+				return;
+			}
+			if(!m_journal){
+				m_journal.reset(new Journal(get_journal_path(journal_dir, m_index), MainConfig::get<boost::uint64_t>("mysql_journal_max_bytes", 1073741824)));
+			}
+
+			std::size_t count = 0;
+			for(AUTO(it, candidates.begin()); it != candidates.end(); ++it){
+				OperationQueueElement *const elem = *it;
+				const AUTO(combinable_object, elem->operation->get_combinable_object());
+				const void *old_write_stamp = NULLPTR;
+				if(combinable_object){
+					old_write_stamp = combinable_object->get_combined_write_stamp();
+					if(old_write_stamp && (old_write_stamp != elem)){
+						break;
+					}
+				}
+				if(old_write_stamp){
+					combinable_object->set_combined_write_stamp(NULLPTR);
+				}
+				std::string query;
+				elem->operation->generate_sql(query);
+				if(!m_journal->append(query)){
+					LOG_POSEIDON_WARNING("MySQL journal is full: path = ", m_journal->get_path(), ", bytes = ", m_journal->get_bytes());
+					break;
+				}
+				// 写入日志即视为完成。
+				elem->operation->finish(false);
+				const AUTO(promise, elem->operation->get_promise());
+				if(promise){
+					promise->set_success(false);
+				}
+				m_journal_probes.push_back(elem->operation->get_probe());
+				boost::shared_ptr<OperationBase> operation;
+				{
+					const Mutex::UniqueLock lock(m_mutex);
+					operation.swap(elem->operation);
+					elem->done = true;
+				}
+				++count;
+			}
+			LOG_POSEIDON_WARNING("Spilled MySQL operations to journal: count = ", count, ", records = ", m_journal->size(), ", bytes = ", m_journal->get_bytes());
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		}
+		// 停止时超过了 mysql_drain_timeout。写入操作尽量转存到日志中，其余的操作被转储并以异常结束，之后队列中只剩下已经完成的操作。
+		void abandon_queue() NOEXCEPT {
+			PROFILE_ME;
+
+			spill_to_journal(true);
+
+			boost::container::vector<boost::shared_ptr<OperationBase> > operations;
+			{
+				const Mutex::UniqueLock lock(m_mutex);
+				for(AUTO(it, m_queue.begin()); it != m_queue.end(); ++it){
+					if(it->done){
+						continue;
+					}
+					const AUTO(combinable_object, it->operation->get_combinable_object());
+					if(combinable_object && (combinable_object->get_combined_write_stamp() == &*it)){
+						combinable_object->set_combined_write_stamp(NULLPTR);
+					}
+					operations.push_back(VAL_INIT);
+					operations.back().swap(it->operation);
+					it->done = true;
+				}
+			}
+			if(operations.empty()){
+				return;
+			}
+			LOG_POSEIDON_ERROR("Abandoning MySQL operations: count = ", operations.size());
+			for(AUTO(it, operations.begin()); it != operations.end(); ++it){
+				const AUTO_REF(operation, *it);
+				if(!operation->should_use_slave()){
+					try {
+						std::string query;
+						operation->generate_sql(query);
+						dump_sql_to_file(query, 0, "Abandoned on shutdown");
+					} catch(std::exception &e){
+						LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+					}
+				}
+				operation->finish(true);
+				const AUTO(promise, operation->get_promise());
+				if(promise){
+					promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("MySQL operation was abandoned on shutdown"))), false);
+				}
+			}
+		}
+		// 队列中只剩下已经转存的操作。
+		bool is_queue_settled() const {
+			const Mutex::UniqueLock lock(m_mutex);
+			for(AUTO(it, m_queue.begin()); it != m_queue.end(); ++it){
+				if(!it->done){
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// 定期检查正在使用的副本的延迟。如果回退到了主服务器，检查是否有副本恢复了。需要换连接时重置 slave_conn。
+		void check_replica(const boost::shared_ptr<MySql::Connection> &master_conn, boost::shared_ptr<MySql::Connection> &slave_conn, std::size_t replica_index, boost::uint64_t &next_check) NOEXCEPT
+		try {
+			PROFILE_ME;
+
+			const AUTO(now, get_fast_mono_clock());
+			if(now < next_check){
+				return;
+			}
+			next_check = saturated_add(now, MainConfig::get<boost::uint64_t>("mysql_replica_check_interval", 10000));
+			if(!slave_conn){
+				return;
+			}
+			if(replica_index != ReplicaSet::INDEX_NONE){
+				std::string reason;
+				if(!check_replica_lag(slave_conn, reason)){
+					LOG_POSEIDON_WARNING("MySQL replica is unhealthy: ", reason);
+					g_replicas.mark_down(replica_index, now, MainConfig::get<boost::uint64_t>("mysql_replica_retry_delay", 5000));
+					slave_conn.reset();
+				}
+			} else if((slave_conn == master_conn) && g_replicas.has_available(now)){
+				LOG_POSEIDON_INFO("MySQL replicas may have recovered. Reconnecting...");
+				slave_conn.reset();
+			}
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+			slave_conn.reset();
+		}
+
 		void thread_proc(){
 			PROFILE_ME;
 			LOG_POSEIDON_INFO("MySQL thread started.");
 
+			// 合并保存操作时最多同时使用三个：合并后的语句，以及每个成员的列名和值。
+			const MySql::SqlBuilder sql_builders[3];
+
 			boost::shared_ptr<MySql::Connection> master_conn, slave_conn;
+			std::size_t replica_index = ReplicaSet::INDEX_NONE;
+			boost::uint64_t next_replica_check = 0;
 			unsigned timeout = 0;
+			boost::uint64_t idle_since = 0;
+			bool abandoned = false;
 			for(;;){
 				const AUTO(reconnect_delay, MainConfig::get<boost::uint64_t>("mysql_reconn_delay", 5000));
 				bool busy;
 				do {
+					if(atomic_load(m_abandoned, ATOMIC_CONSUME)){
+						abandon_queue();
+						abandoned = true;
+						break;
+					}
+					check_replica(master_conn, slave_conn, replica_index, next_replica_check);
 					while(!master_conn){
 						LOG_POSEIDON_INFO("Connecting to MySQL master server...");
 						try {
@@ -484,16 +1703,31 @@ namespace {
 							LOG_POSEIDON_INFO("Successfully connected to MySQL master server.");
 						} catch(std::exception &e){
 							LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+							// 正在关闭时转存所有的写入操作。如果队列中只剩下已经转存的操作就直接退出，日志在下次启动时重放。
+							const bool running = atomic_load(m_running, ATOMIC_CONSUME);
+							spill_to_journal(!running);
+							if(!running && atomic_load(m_abandoned, ATOMIC_CONSUME)){
+								abandon_queue();
+							}
+							if(!running && is_queue_settled()){
+								abandoned = true;
+								break;
+							}
 							::timespec req;
 							req.tv_sec = (::time_t)(reconnect_delay / 1000);
 							req.tv_nsec = (long)(reconnect_delay % 1000) * 1000 * 1000;
 							::nanosleep(&req, NULLPTR);
 						}
 					}
+					if(abandoned){
+						break;
+					}
 					while(!slave_conn){
 						LOG_POSEIDON_INFO("Connecting to MySQL slave server...");
+						g_replicas.release(replica_index);
+						replica_index = ReplicaSet::INDEX_NONE;
 						try {
-							slave_conn = real_create_connection(true, master_conn);
+							slave_conn = real_create_connection(true, master_conn, &replica_index);
 							LOG_POSEIDON_INFO("Successfully connected to MySQL slave server.");
 						} catch(std::exception &e){
 							LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
@@ -506,12 +1740,39 @@ namespace {
 					busy = pump_one_operation(master_conn, slave_conn);
 					timeout = std::min<unsigned>(timeout * 2u + 1u, !busy * 100u);
 				} while(busy);
+				if(abandoned){
+					break;
+				}
 
-				Mutex::UniqueLock lock(m_mutex);
-				if(m_queue.empty() && !atomic_load(m_running, ATOMIC_CONSUME)){
+				const bool journal_empty = !m_journal || m_journal->empty();
+				{
+					Mutex::UniqueLock lock(m_mutex);
+					if(m_queue.empty() && journal_empty && !atomic_load(m_running, ATOMIC_CONSUME)){
+						break;
+					}
+					m_new_operation.timed_wait(lock, timeout);
+					if(!m_queue.empty() || !journal_empty){
+						idle_since = 0;
+						continue;
+					}
+				}
+
+				const AUTO(now, get_fast_mono_clock());
+				if(idle_since == 0){
+					idle_since = now;
+				}
+				if(retire_if_idle(this, m_index, now - idle_since)){
 					break;
 				}
-				m_new_operation.timed_wait(lock, timeout);
+			}
+			g_replicas.release(replica_index);
+			if(abandoned){
+				if(m_journal && !m_journal->empty()){
+					LOG_POSEIDON_WARNING("MySQL thread stopped with journaled operations: path = ", m_journal->get_path(), ", records = ", m_journal->size());
+				}
+				const Mutex::UniqueLock lock(m_mutex);
+				m_queue.clear();
+				m_drained.broadcast();
 			}
 
 			LOG_POSEIDON_INFO("MySQL thread stopped.");
@@ -526,34 +1787,59 @@ namespace {
 		void stop(){
 			atomic_store(m_running, false, ATOMIC_RELEASE);
 		}
+		// 如果没有待处理的操作，停止接受操作并返回 true。
+		bool retire(){
+			if(m_journal && !m_journal->empty()){
+				return false;
+			}
+			const Mutex::UniqueLock lock(m_mutex);
+			if(!m_queue.empty()){
+				return false;
+			}
+			atomic_store(m_running, false, ATOMIC_RELEASE);
+			return true;
+		}
+		// 放弃队列中剩余的操作。本线程在执行完当前的操作之后处理它们并退出。
+		void abandon(){
+			const Mutex::UniqueLock lock(m_mutex);
+			atomic_store(m_abandoned, true, ATOMIC_RELEASE);
+			m_new_operation.signal();
+		}
 		void safe_join(){
-			wait_till_idle();
+			wait_till_idle(0);
 
 			if(m_thread.joinable()){
 				m_thread.join();
 			}
 		}
 
-		void wait_till_idle(){
+		// 等待队列清空。deadline 为零时一直等待，否则到期时返回剩余的操作数。
+		std::size_t wait_till_idle(boost::uint64_t deadline){
+			boost::uint64_t next_report = 0;
+			Mutex::UniqueLock lock(m_mutex);
 			for(;;){
-				std::size_t pending_objects;
-				std::string current_sql;
-				{
-					const Mutex::UniqueLock lock(m_mutex);
-					pending_objects = m_queue.size();
-					if(pending_objects == 0){
-						break;
+				const std::size_t pending_objects = m_queue.size();
+				if(pending_objects == 0){
+					return 0;
+				}
+				const AUTO(now, get_fast_mono_clock());
+				if((deadline != 0) && (now >= deadline)){
+					return pending_objects;
+				}
+				atomic_store(m_urgent, true, ATOMIC_RELEASE);
+				m_new_operation.signal();
+				if(now >= next_report){
+					std::string current_sql;
+					if(m_queue.front().operation){
+						m_queue.front().operation->generate_sql(current_sql);
 					}
-					m_queue.front().operation->generate_sql(current_sql);
-					atomic_store(m_urgent, true, ATOMIC_RELEASE);
-					m_new_operation.signal();
+					lock.unlock();
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for SQL queries to complete: pending_objects = ", pending_objects, ", current_sql = ", current_sql);
+					next_report = now + 1000;
+					lock.lock();
+					continue;
 				}
-				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for SQL queries to complete: pending_objects = ", pending_objects, ", current_sql = ", current_sql);
-
-				::timespec req;
-				req.tv_sec = 0;
-				req.tv_nsec = 500 * 1000 * 1000;
-				::nanosleep(&req, NULLPTR);
+				m_drained.timed_wait(lock, ((deadline != 0) ? std::min(deadline, next_report) : next_report) - now);
 			}
 		}
 
@@ -561,6 +1847,20 @@ namespace {
 			const Mutex::UniqueLock lock(m_mutex);
 			return m_queue.size();
 		}
+		// 队列中最早的操作超过预定时刻的毫秒数。紧急操作的预定时刻就是其入队的时刻。
+		boost::uint64_t get_queue_latency(boost::uint64_t now) const {
+			const Mutex::UniqueLock lock(m_mutex);
+			if(m_queue.empty()){
+				return 0;
+			}
+			const AUTO_REF(front, m_queue.front());
+			return saturated_sub(now, atomic_load(m_urgent, ATOMIC_CONSUME) ? front.enqueued_time : front.due_time);
+		}
+		void make_urgent(){
+			const Mutex::UniqueLock lock(m_mutex);
+			atomic_store(m_urgent, true, ATOMIC_RELEASE);
+			m_new_operation.signal();
+		}
 		void add_operation(boost::shared_ptr<OperationBase> operation, bool urgent){
 			PROFILE_ME;
 
@@ -573,7 +1873,7 @@ namespace {
 
 			const Mutex::UniqueLock lock(m_mutex);
 			DEBUG_THROW_UNLESS(atomic_load(m_running, ATOMIC_CONSUME), Exception, sslit("MySQL thread is being shut down"));
-			OperationQueueElement elem = { STD_MOVE(operation), due_time };
+			OperationQueueElement elem = { STD_MOVE(operation), due_time, 0, now, false, false };
 			m_queue.push_back(STD_MOVE(elem));
 			if(combinable_object){
 				const AUTO(old_write_stamp, combinable_object->get_combined_write_stamp());
@@ -590,70 +1890,235 @@ namespace {
 
 	volatile bool g_running = false;
 
+	// 线程池的上下限可以在运行时修改。
+	// 下标不小于 g_max_thread_count 的线程不再被分配新的 table，在处理完已有的操作之后被回收；
+	// 其余的线程空闲超过 g_idle_timeout 毫秒之后被回收，但不少于 g_min_thread_count 个。
+	volatile std::size_t g_min_thread_count = 0;
+	volatile std::size_t g_max_thread_count = 0;
+	volatile boost::uint64_t g_grow_latency = 0;
+	volatile boost::uint64_t g_idle_timeout = 0;
+
+	// 写入操作可以按照对象分片，分散到多个线程；其他操作使用整个表的路由，即 SHARD_NONE。
+	enum {
+		SHARD_NONE = static_cast<std::size_t>(-1),
+	};
+
 	Mutex g_router_mutex;
 	struct Route {
-		boost::shared_ptr<const void> probe;
+		// 这个路由上最后一个操作持有的探针。探针失效意味着这个路由上所有的操作都已完成。
+		boost::weak_ptr<const void> last;
 		boost::shared_ptr<MySqlThread> thread;
+		// 所在线程的队列开始持续失衡的时刻，零表示没有失衡。
+		boost::uint64_t imbalanced_since;
 	};
-	boost::container::flat_map<SharedNts, Route> g_router;
-	boost::container::flat_multimap<std::size_t, std::size_t> g_routing_map;
+	typedef std::pair<SharedNts, std::size_t> RouteKey;
+	boost::container::flat_map<RouteKey, Route> g_router;
+	// 长度只增不减，空的元素表示对应的线程尚未创建或已被回收。
 	boost::container::vector<boost::shared_ptr<MySqlThread> > g_threads;
+	// 已被回收但尚未 join 的线程。
+	boost::container::vector<boost::shared_ptr<MySqlThread> > g_retired_threads;
+	volatile bool g_has_retired_threads = false;
+
+	std::size_t count_live_threads_unlocked(std::size_t max_count){
+		std::size_t count = 0;
+		for(std::size_t i = 0; i < std::min(max_count, g_threads.size()); ++i){
+			count += !!g_threads.at(i);
+		}
+		return count;
+	}
+
+	bool retire_if_idle(MySqlThread *thread, std::size_t index, boost::uint64_t idle_duration){
+		const AUTO(max_count, atomic_load(g_max_thread_count, ATOMIC_CONSUME));
+		if(index < max_count){
+			const AUTO(idle_timeout, atomic_load(g_idle_timeout, ATOMIC_CONSUME));
+			if((idle_timeout == 0) || (idle_duration < idle_timeout)){
+				return false;
+			}
+		}
+
+		const Mutex::UniqueLock lock(g_router_mutex);
+		if((index >= g_threads.size()) || (g_threads.at(index).get() != thread)){
+			return false;
+		}
+		if((index < max_count) && (count_live_threads_unlocked(max_count) <= atomic_load(g_min_thread_count, ATOMIC_CONSUME))){
+			return false;
+		}
+		if(!thread->retire()){
+			return false;
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Retiring MySQL thread ", index);
+		// 队列为空，因此没有 table 正在使用这个线程。
+		for(AUTO(it, g_router.begin()); it != g_router.end(); ++it){
+			if(it->second.thread.get() == thread){
+				it->second.thread.reset();
+			}
+		}
+		g_retired_threads.push_back(STD_MOVE(g_threads.at(index)));
+		g_threads.at(index).reset();
+		atomic_store(g_has_retired_threads, true, ATOMIC_RELEASE);
+		return true;
+	}
+	void reap_retired_threads(){
+		if(!atomic_load(g_has_retired_threads, ATOMIC_CONSUME)){
+			return;
+		}
+		boost::container::vector<boost::shared_ptr<MySqlThread> > threads;
+		{
+			const Mutex::UniqueLock lock(g_router_mutex);
+			threads.swap(g_retired_threads);
+			atomic_store(g_has_retired_threads, false, ATOMIC_RELAXED);
+		}
+		for(AUTO(it, threads.begin()); it != threads.end(); ++it){
+			(*it)->safe_join();
+		}
+	}
+
+	// 选择队列最短的线程。如果线程数低于下限，或者最短的队列中最早的操作已经延迟过久，则创建一个新的线程。
+	boost::shared_ptr<MySqlThread> pick_thread_unlocked(const char *table, boost::uint64_t now){
+		const AUTO(max_count, atomic_load(g_max_thread_count, ATOMIC_CONSUME));
+		std::size_t vacant = max_count;
+		std::size_t live_count = 0;
+		std::size_t best_index = max_count;
+		std::size_t best_queue_size = 0;
+		for(std::size_t i = 0; i < max_count; ++i){
+			const AUTO_REF(test_thread, g_threads.at(i));
+			if(!test_thread){
+				vacant = std::min(vacant, i);
+				continue;
+			}
+			++live_count;
+			const AUTO(queue_size, test_thread->get_queue_size());
+			LOG_POSEIDON_DEBUG("> MySQL thread ", i, "'s queue size: ", queue_size);
+			if((best_index == max_count) || (queue_size < best_queue_size)){
+				best_index = i;
+				best_queue_size = queue_size;
+			}
+		}
+		if(vacant < max_count){
+			bool to_grow = (best_index == max_count) || (live_count < atomic_load(g_min_thread_count, ATOMIC_CONSUME));
+			if(!to_grow){
+				to_grow = g_threads.at(best_index)->get_queue_latency(now) >= atomic_load(g_grow_latency, ATOMIC_CONSUME);
+			}
+			if(to_grow){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Creating new MySQL thread ", vacant, " for table ", table);
+				AUTO(thread, boost::make_shared<MySqlThread>(vacant));
+				thread->start();
+				g_threads.at(vacant) = thread;
+				return thread;
+			}
+		}
+		if(best_index == max_count){
+			LOG_POSEIDON_FATAL("No available MySQL thread?!");
+			std::abort();
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Picking thread ", best_index, " for table ", table);
+		return g_threads.at(best_index);
+	}
+
+	// 如果路由所在线程的队列长度持续超过其他线程中最短的队列的若干倍，返回那个线程，否则返回空指针。
+	boost::shared_ptr<MySqlThread> check_rebalance_unlocked(const char *table, std::size_t shard, Route &route, boost::uint64_t now){
+		const AUTO(rebalance_delay, MainConfig::get<boost::uint64_t>("mysql_route_rebalance_delay", 0));
+		if(rebalance_delay == 0){
+			return VAL_INIT;
+		}
+		const AUTO(rebalance_ratio, MainConfig::get<std::size_t>("mysql_route_rebalance_ratio", 4));
+
+		const AUTO(max_count, std::min(atomic_load(g_max_thread_count, ATOMIC_CONSUME), g_threads.size()));
+		boost::shared_ptr<MySqlThread> best;
+		std::size_t best_queue_size = 0;
+		for(std::size_t i = 0; i < max_count; ++i){
+			const AUTO_REF(test_thread, g_threads.at(i));
+			if(!test_thread || (test_thread == route.thread)){
+				continue;
+			}
+			const AUTO(queue_size, test_thread->get_queue_size());
+			if(!best || (queue_size < best_queue_size)){
+				best = test_thread;
+				best_queue_size = queue_size;
+			}
+		}
+		if(!best || (route.thread->get_queue_size() <= saturated_mul(best_queue_size + 1, rebalance_ratio))){
+			route.imbalanced_since = 0;
+			return VAL_INIT;
+		}
+		if(route.imbalanced_since == 0){
+			route.imbalanced_since = now;
+			return VAL_INIT;
+		}
+		if(saturated_sub(now, route.imbalanced_since) < rebalance_delay){
+			return VAL_INIT;
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Rebalancing MySQL route: table = ", table, ", shard = ", static_cast<std::ptrdiff_t>(shard));
+		route.imbalanced_since = 0;
+		return best;
+	}
+	// 如果路由上还有未完成的操作，并且不在 thread 上，则 operation 必须等待它们完成。
+	// 同一个线程上的操作按照入队的顺序执行，不需要等待。
+	void depend_on_route_unlocked(OperationBase &operation, const Route &route, const boost::shared_ptr<MySqlThread> &thread, bool urgent){
+		if(route.last.expired() || !route.thread || (route.thread == thread)){
+			return;
+		}
+		operation.add_dependency(route.last);
+		if(urgent){
+			route.thread->make_urgent();
+		}
+	}
 
 	void add_operation_by_table(const char *table, boost::shared_ptr<OperationBase> operation, bool urgent){
 		PROFILE_ME;
 		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MySQL support is not enabled"));
 
-		boost::shared_ptr<const void> probe;
-		boost::shared_ptr<MySqlThread> thread;
-		{
-			const Mutex::UniqueLock lock(g_router_mutex);
+		reap_retired_threads();
+
+		// 同一个对象总是位于同一个分片中，因此对同一个对象的写入顺序不变。
+		std::size_t shard = SHARD_NONE;
+		const AUTO(shard_count, MainConfig::get<std::size_t>("mysql_table_shards", 1));
+		if(shard_count > 1){
+			const AUTO(combinable_object, operation->get_combinable_object());
+			if(combinable_object){
+				shard = reinterpret_cast<boost::uintptr_t>(combinable_object.get()) / sizeof(void *) % shard_count;
+			}
+		}
+		AUTO(probe, boost::make_shared<int>());
 
-			AUTO_REF(route, g_router[SharedNts::view(table)]);
-			if(route.probe.use_count() > 1){
-				probe = route.probe;
+		const AUTO(now, get_fast_mono_clock());
+		// 在锁内添加操作，这样线程不会在此期间被回收。
+		// 表名来自对象或者调用者，不一定是静态的字符串，作为路由的键必须保存一份。驻留之后键的比较只需要比较指针。
+		const AUTO(table_key, SharedNts::intern(table));
+		const Mutex::UniqueLock lock(g_router_mutex);
+		AUTO_REF(route, g_router[RouteKey(table_key, shard)]);
+		boost::shared_ptr<MySqlThread> thread;
+		if(route.last.expired() || !route.thread){
+			thread = pick_thread_unlocked(table, now);
+		} else {
+			// 如果还有使用这个路由的操作没有完成，通常必须使用同一个线程，以保证操作的顺序。
+			// 长期失衡的路由被迁移到其他线程，迁移之后的第一个操作等待原来的线程上的操作完成。
+			thread = check_rebalance_unlocked(table, shard, route, now);
+			if(thread){
+				depend_on_route_unlocked(*operation, route, thread, urgent);
+			} else {
 				thread = route.thread;
-				goto _use_thread;
-			}
-			if(!route.probe){
-				route.probe = boost::make_shared<int>();
-			}
-			probe = route.probe;
-
-			g_routing_map.clear();
-			g_routing_map.reserve(g_threads.size());
-			for(std::size_t i = 0; i < g_threads.size(); ++i){
-				AUTO_REF(test_thread, g_threads.at(i));
-				if(!test_thread){
-					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Creating new MySQL thread ", i, " for table ", table);
-					thread = boost::make_shared<MySqlThread>();
-					thread->start();
-					test_thread = thread;
-					route.thread = thread;
-					goto _use_thread;
-				}
-				const AUTO(queue_size, test_thread->get_queue_size());
-				LOG_POSEIDON_DEBUG("> MySQL thread ", i, "'s queue size: ", queue_size);
-				g_routing_map.emplace(queue_size, i);
-			}
-			if(g_routing_map.empty()){
-				LOG_POSEIDON_FATAL("No available MySQL thread?!");
-				std::abort();
 			}
-			const AUTO(index, g_routing_map.begin()->second);
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Picking thread ", index, " for table ", table);
-			thread = g_threads.at(index);
-			route.thread = thread;
 		}
-	_use_thread:
-		assert(probe);
-		assert(thread);
-		operation->set_probe(STD_MOVE(probe));
+		// 分片的写入操作在同一个表的其他操作之后执行，其他操作在所有分片的写入操作之后执行。
+		const AUTO(range_end, g_router.upper_bound(RouteKey(table_key, SHARD_NONE)));
+		for(AUTO(it, g_router.lower_bound(RouteKey(table_key, 0))); it != range_end; ++it){
+			if((it->first.second == shard) || ((shard != SHARD_NONE) && (it->first.second != SHARD_NONE))){
+				continue;
+			}
+			depend_on_route_unlocked(*operation, it->second, thread, urgent);
+		}
+		operation->set_probe(probe);
+		route.last = probe;
+		route.thread = thread;
 		thread->add_operation(STD_MOVE(operation), urgent);
 	}
 	void add_operation_all(boost::shared_ptr<OperationBase> operation, bool urgent){
 		PROFILE_ME;
 		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MySQL support is not enabled"));
 
+		reap_retired_threads();
+
 		const Mutex::UniqueLock lock(g_router_mutex);
 		for(AUTO(it, g_threads.begin()); it != g_threads.end(); ++it){
 			const AUTO_REF(thread, *it);
@@ -676,7 +2141,24 @@ void MySqlDaemon::start(){
 	if(max_thread_count == 0){
 		LOG_POSEIDON_WARNING("MySQL support has been disabled. To enable MySQL support, set `mysql_max_thread_count` in `main.conf` to a value greater than zero.");
 	} else {
-		boost::shared_ptr<MySql::Connection> master_conn, slave_conn;
+		AUTO(replica_specs, MainConfig::get_all_raw("mysql_replica"));
+		if(replica_specs.empty()){
+			const AUTO(slave_addr, MainConfig::get<std::string>("mysql_slave_addr"));
+			if(!slave_addr.empty()){
+				replica_specs.push_back(slave_addr + "," + boost::lexical_cast<std::string>(MainConfig::get<boost::uint16_t>("mysql_slave_port", 3306)));
+			}
+		}
+		g_replicas.reset(replica_specs, 3306);
+
+		// 没有配置副本时从服务器就是主服务器。否则副本和主服务器同时检查，副本不可用时也会连接主服务器。
+		STD_EXCEPTION_PTR slave_except;
+		Thread slave_checker;
+		if(!g_replicas.empty()){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Checking whether MySQL slave server is up...");
+			Thread(boost::bind(&check_slave_server_nothrow, &slave_except), sslit("  S "), sslit("Startup")).swap(slave_checker);
+		}
+
+		boost::shared_ptr<MySql::Connection> master_conn;
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Checking whether MySQL master server is up...");
 		try {
 			master_conn = real_create_connection(false, VAL_INIT);
@@ -687,11 +2169,12 @@ void MySqlDaemon::start(){
 			std::abort();
 		}
 
-		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Checking whether MySQL slave server is up...");
 		try {
-			slave_conn = real_create_connection(true, master_conn);
-			if(slave_conn != master_conn){
-				slave_conn->execute_sql("DO 0");
+			if(slave_checker.joinable()){
+				slave_checker.join();
+				if(slave_except){
+					STD_RETHROW_EXCEPTION(slave_except);
+				}
 			}
 		} catch(std::exception &e){
 			LOG_POSEIDON_FATAL("Could not connect to MySQL slave server: ", e.what());
@@ -713,8 +2196,27 @@ void MySqlDaemon::start(){
 				std::abort();
 			}
 		}
+
+		const AUTO(journal_dir, MainConfig::get<std::string>("mysql_journal_dir"));
+		if(journal_dir.empty()){
+			LOG_POSEIDON_WARNING("MySQL journal has been disabled. Pending operations will be kept in memory while the MySQL server is unavailable.");
+		} else {
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Replaying leftover MySQL journals...");
+			try {
+				replay_leftover_journals(journal_dir, master_conn);
+			} catch(std::exception &e){
+				LOG_POSEIDON_FATAL("Could not replay MySQL journals: ", e.what());
+				LOG_POSEIDON_WARNING("To disable MySQL journal, set `mysql_journal_dir` in `main.conf` to an empty string.");
+				std::abort();
+			}
+		}
 	}
+	const AUTO(min_thread_count, MainConfig::get<std::size_t>("mysql_min_thread_count", max_thread_count));
 	g_threads.resize(max_thread_count);
+	atomic_store(g_min_thread_count, std::min(min_thread_count, max_thread_count), ATOMIC_RELAXED);
+	atomic_store(g_max_thread_count, max_thread_count, ATOMIC_RELAXED);
+	atomic_store(g_grow_latency, MainConfig::get<boost::uint64_t>("mysql_thread_grow_latency", 0), ATOMIC_RELAXED);
+	atomic_store(g_idle_timeout, MainConfig::get<boost::uint64_t>("mysql_thread_idle_timeout", 60000), ATOMIC_RELAXED);
 
 	LOG_POSEIDON_INFO("MySQL daemon started.");
 }
@@ -724,24 +2226,49 @@ void MySqlDaemon::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping MySQL daemon...");
 
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	const AUTO(drain_begin, get_fast_mono_clock());
+	const AUTO(drain_timeout, MainConfig::get<boost::uint64_t>("mysql_drain_timeout", 0));
+	const AUTO(deadline, (drain_timeout == 0) ? 0 : saturated_add(drain_begin, drain_timeout));
+
+	// 在锁内取出所有线程，这样它们不会再被回收。
+	boost::container::vector<boost::shared_ptr<MySqlThread> > threads;
+	std::size_t pending_operations = 0;
+	{
+		const Mutex::UniqueLock lock(g_router_mutex);
+		threads.swap(g_retired_threads);
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			AUTO_REF(thread, g_threads.at(i));
+			if(!thread){
+				continue;
+			}
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping MySQL thread ", i);
+			thread->stop();
+			thread->make_urgent();
+			pending_operations += thread->get_queue_size();
+			threads.push_back(STD_MOVE(thread));
+			thread.reset();
 		}
-		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping MySQL thread ", i);
-		thread->stop();
 	}
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	// 所有线程同时清空队列，所以总的等待时间取决于最慢的那个。
+	std::size_t overdue_operations = 0;
+	for(std::size_t i = 0; i < threads.size(); ++i){
+		const AUTO(remaining, threads.at(i)->wait_till_idle(deadline));
+		if(remaining != 0){
+			LOG_POSEIDON_ERROR("MySQL drain deadline exceeded: thread = ", i, ", pending_operations = ", remaining);
+			threads.at(i)->abandon();
+			overdue_operations += remaining;
 		}
+	}
+	for(std::size_t i = 0; i < threads.size(); ++i){
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for MySQL thread ", i, " to terminate...");
-		thread->safe_join();
+		threads.at(i)->safe_join();
 	}
+	const Mutex::UniqueLock lock(g_router_mutex);
+	g_router.clear();
 	g_threads.clear();
 
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "MySQL daemon drained: pending_operations = ", pending_operations, ", overdue_operations = ", overdue_operations,
+		", elapsed = ", get_fast_mono_clock() - drain_begin, " ms");
 	LOG_POSEIDON_INFO("MySQL daemon stopped.");
 }
 
@@ -750,19 +2277,78 @@ boost::shared_ptr<MySql::Connection> MySqlDaemon::create_connection(bool from_sl
 }
 
 void MySqlDaemon::wait_for_all_async_operations(){
+	boost::container::vector<boost::shared_ptr<MySqlThread> > threads;
+	{
+		const Mutex::UniqueLock lock(g_router_mutex);
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			const AUTO_REF(thread, g_threads.at(i));
+			if(!thread){
+				continue;
+			}
+			threads.push_back(thread);
+		}
+	}
+	for(AUTO(it, threads.begin()); it != threads.end(); ++it){
+		(*it)->wait_till_idle(0);
+	}
+}
+
+void MySqlDaemon::get_pool_status(PoolStatus &status){
+	reap_retired_threads();
+
+	const Mutex::UniqueLock lock(g_router_mutex);
+	status.min_thread_count = atomic_load(g_min_thread_count, ATOMIC_CONSUME);
+	status.max_thread_count = atomic_load(g_max_thread_count, ATOMIC_CONSUME);
+	status.live_thread_count = 0;
+	status.queue_size = 0;
 	for(std::size_t i = 0; i < g_threads.size(); ++i){
 		const AUTO_REF(thread, g_threads.at(i));
 		if(!thread){
 			continue;
 		}
-		thread->wait_till_idle();
+		status.live_thread_count += 1;
+		status.queue_size += thread->get_queue_size();
 	}
 }
+void MySqlDaemon::get_thread_status(boost::container::vector<ThreadStatus> &ret){
+	reap_retired_threads();
+
+	const AUTO(now, get_fast_mono_clock());
+	const Mutex::UniqueLock lock(g_router_mutex);
+	for(std::size_t i = 0; i < g_threads.size(); ++i){
+		const AUTO_REF(thread, g_threads.at(i));
+		if(!thread){
+			continue;
+		}
+		ThreadStatus status;
+		status.index = i;
+		status.queue_size = thread->get_queue_size();
+		status.queue_latency = thread->get_queue_latency(now);
+		status.route_count = 0;
+		for(AUTO(it, g_router.begin()); it != g_router.end(); ++it){
+			status.route_count += (it->second.thread == thread) && !it->second.last.expired();
+		}
+		ret.push_back(STD_MOVE(status));
+	}
+}
+void MySqlDaemon::set_thread_limits(std::size_t min_thread_count, std::size_t max_thread_count){
+	DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("MySQL support is not enabled"));
+	DEBUG_THROW_UNLESS(max_thread_count != 0, Exception, sslit("The maximum thread count shall not be zero"));
+	DEBUG_THROW_UNLESS(min_thread_count <= max_thread_count, Exception, sslit("The minimum thread count shall not exceed the maximum thread count"));
+
+	const Mutex::UniqueLock lock(g_router_mutex);
+	if(g_threads.size() < max_thread_count){
+		g_threads.resize(max_thread_count);
+	}
+	atomic_store(g_min_thread_count, min_thread_count, ATOMIC_RELEASE);
+	atomic_store(g_max_thread_count, max_thread_count, ATOMIC_RELEASE);
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "MySQL thread limits changed: min_thread_count = ", min_thread_count, ", max_thread_count = ", max_thread_count);
+}
 
 boost::shared_ptr<const Promise> MySqlDaemon::enqueue_for_saving(boost::shared_ptr<const MySql::ObjectBase> object, bool to_replace, bool urgent){
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = object->get_table();
-	AUTO(operation, boost::make_shared<SaveOperation>(promise, STD_MOVE(object), to_replace));
+	AUTO(operation, boost::allocate_shared<SaveOperation>(PooledAllocator<SaveOperation>(), promise, STD_MOVE(object), to_replace));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), urgent);
 	return STD_MOVE_IDN(promise);
 }
@@ -771,16 +2357,104 @@ boost::shared_ptr<const Promise> MySqlDaemon::enqueue_for_loading(boost::shared_
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = object->get_table();
-	AUTO(operation, boost::make_shared<LoadOperation>(promise, STD_MOVE(object), STD_MOVE(query)));
+	AUTO(operation, boost::allocate_shared<LoadOperation>(PooledAllocator<LoadOperation>(), promise, STD_MOVE(object), STD_MOVE(query)));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
+boost::shared_ptr<const MySqlDaemon::CachedLoadPromise> MySqlDaemon::enqueue_for_cached_loading(ObjectFactory factory, std::string key, std::string query){
+	DEBUG_THROW_ASSERT(factory);
+	DEBUG_THROW_ASSERT(!query.empty());
+
+	AUTO(object, (*factory)());
+	const char *const table = object->get_table();
+	AUTO(cache_key, make_cache_key(table, key));
+	AUTO(promise, boost::make_shared<CachedLoadPromise>());
+	AUTO(cached, find_cached_object(cache_key, get_fast_mono_clock()));
+	if(cached){
+		LOG_POSEIDON_TRACE("MySQL cache hit: table = ", table, ", key = ", key);
+		promise->set_success(STD_MOVE(cached));
+		return STD_MOVE_IDN(promise);
+	}
+	AUTO(operation, boost::allocate_shared<CachedLoadOperation>(PooledAllocator<CachedLoadOperation>(), promise, STD_MOVE(object), STD_MOVE(query), STD_MOVE(cache_key)));
+	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	return STD_MOVE_IDN(promise);
+}
+boost::shared_ptr<const MySqlDaemon::CachedLoadPromise> MySqlDaemon::enqueue_for_loading_by_key(ObjectFactory factory, const char *column, std::string key){
+	DEBUG_THROW_ASSERT(factory);
+	DEBUG_THROW_ASSERT(column && *column);
+
+	AUTO(object, (*factory)());
+	const char *const table = object->get_table();
+	AUTO(promise, boost::make_shared<CachedLoadPromise>());
+	AUTO(cached, find_cached_object(make_cache_key(table, key), get_fast_mono_clock()));
+	if(cached){
+		LOG_POSEIDON_TRACE("MySQL cache hit: table = ", table, ", key = ", key);
+		promise->set_success(STD_MOVE(cached));
+		return STD_MOVE_IDN(promise);
+	}
+
+	const AUTO(max_keys, g_key_batch_max_keys.get());
+	const Mutex::UniqueLock lock(g_keyed_load_mutex);
+	AUTO_REF(weak_batch, g_keyed_loads[make_cache_key(table, column)]);
+	const AUTO(batch, weak_batch.lock());
+	if(batch){
+		const Mutex::UniqueLock batch_lock(batch->mutex);
+		if(!batch->sealed && (batch->requests.size() < max_keys)){
+			batch->requests.push_back(std::make_pair(STD_MOVE(key), boost::weak_ptr<CachedLoadPromise>(promise)));
+			return STD_MOVE_IDN(promise);
+		}
+	}
+	// 没有尚未封闭的批次，新建一个并投递。它在队列中等待的期间，同一个列的其他请求都会加入进来。
+	AUTO(new_batch, boost::make_shared<KeyedLoadBatch>());
+	new_batch->requests.push_back(std::make_pair(STD_MOVE(key), boost::weak_ptr<CachedLoadPromise>(promise)));
+	AUTO(operation, boost::allocate_shared<KeyedLoadOperation>(PooledAllocator<KeyedLoadOperation>(), boost::make_shared<Promise>(), factory, table, std::string(column), new_batch));
+	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	weak_batch = new_batch;
+	return STD_MOVE_IDN(promise);
+}
+void MySqlDaemon::put_cached_object(boost::shared_ptr<MySql::ObjectBase> object, const std::string &key){
+	DEBUG_THROW_ASSERT(object);
+
+	AUTO(cache_key, make_cache_key(object->get_table(), key));
+	insert_cached_object(STD_MOVE(cache_key), STD_MOVE(object), true, get_fast_mono_clock());
+}
+void MySqlDaemon::invalidate_cached_object(const char *table, const std::string &key){
+	const AUTO(cache_key, make_cache_key(table, key));
+	std::string upper = cache_key;
+	upper.push_back(0);
+	invalidate_cached_objects(cache_key, upper);
+}
+void MySqlDaemon::invalidate_cached_table(const char *table){
+	std::string lower = table;
+	lower.push_back(0);
+	std::string upper = table;
+	upper.push_back(1);
+	invalidate_cached_objects(lower, upper);
+}
+void MySqlDaemon::clear_cache(){
+	const Mutex::UniqueLock lock(g_cache_mutex);
+	g_cache_invalidations += g_cache.size();
+	g_cache.clear();
+}
+void MySqlDaemon::get_cache_status(CacheStatus &status){
+	status.capacity = MainConfig::get<std::size_t>("mysql_cache_capacity", 0);
+	const Mutex::UniqueLock lock(g_cache_mutex);
+	status.size = g_cache.size();
+	status.hits = g_cache_hits;
+	status.misses = g_cache_misses;
+	status.evictions = g_cache_evictions;
+	status.invalidations = g_cache_invalidations;
+}
+
 boost::shared_ptr<const Promise> MySqlDaemon::enqueue_for_deleting(const char *table_hint, std::string query){
 	DEBUG_THROW_ASSERT(!query.empty());
 
+	// 不知道删除了哪些行，所以整个表的缓存都失效。
+	invalidate_cached_table(table_hint);
+
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = table_hint;
-	AUTO(operation, boost::make_shared<DeleteOperation>(promise, table_hint, STD_MOVE(query)));
+	AUTO(operation, boost::allocate_shared<DeleteOperation>(PooledAllocator<DeleteOperation>(), promise, table_hint, STD_MOVE(query)));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
@@ -789,20 +2463,32 @@ boost::shared_ptr<const Promise> MySqlDaemon::enqueue_for_batch_loading(QueryCal
 
 	AUTO(promise, boost::make_shared<Promise>());
 	const char *const table = table_hint;
-	AUTO(operation, boost::make_shared<BatchLoadOperation>(promise, STD_MOVE(callback), table_hint, STD_MOVE(query)));
+	AUTO(operation, boost::allocate_shared<BatchLoadOperation>(PooledAllocator<BatchLoadOperation>(), promise, STD_MOVE(callback), table_hint, STD_MOVE(query)));
+	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
+	return STD_MOVE_IDN(promise);
+}
+
+boost::shared_ptr<const Promise> MySqlDaemon::enqueue_for_streaming_batch_loading(ObjectFactory factory, StreamCallback callback, const char *table_hint, std::string query){
+	DEBUG_THROW_ASSERT(factory);
+	DEBUG_THROW_ASSERT(callback);
+	DEBUG_THROW_ASSERT(!query.empty());
+
+	AUTO(promise, boost::make_shared<Promise>());
+	const char *const table = table_hint;
+	AUTO(operation, boost::allocate_shared<StreamLoadOperation>(PooledAllocator<StreamLoadOperation>(), promise, factory, STD_MOVE(callback), table_hint, STD_MOVE(query)));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
 
 void MySqlDaemon::enqueue_for_low_level_access(const boost::shared_ptr<Promise> &promise, QueryCallback callback, const char *table_hint, bool from_slave){
 	const char *const table = table_hint;
-	AUTO(operation, boost::make_shared<LowLevelAccessOperation>(promise, STD_MOVE(callback), table_hint, from_slave));
+	AUTO(operation, boost::allocate_shared<LowLevelAccessOperation>(PooledAllocator<LowLevelAccessOperation>(), promise, STD_MOVE(callback), table_hint, from_slave));
 	add_operation_by_table(table, STD_MOVE_IDN(operation), true);
 }
 
 boost::shared_ptr<const Promise> MySqlDaemon::enqueue_for_waiting_for_all_async_operations(){
 	AUTO(promise, boost::make_shared<Promise>());
-	AUTO(operation, boost::make_shared<WaitOperation>(promise));
+	AUTO(operation, boost::allocate_shared<WaitOperation>(PooledAllocator<WaitOperation>(), promise));
 	add_operation_all(STD_MOVE_IDN(operation), true);
 	return STD_MOVE_IDN(promise);
 }
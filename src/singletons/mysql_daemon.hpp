@@ -6,13 +6,15 @@
 
 #include "../cxx_ver.hpp"
 #include "../mysql/fwd.hpp"
+#include "../promise.hpp"
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/container/vector.hpp>
 #include <string>
 
 namespace Poseidon {
 
-class Promise;
+extern template class PromiseContainer<boost::shared_ptr<MySql::ObjectBase> >;
 
 class MySqlDaemon {
 private:
@@ -20,6 +22,32 @@ private:
 
 public:
 	typedef boost::function<void (const boost::shared_ptr<MySql::Connection> &)> QueryCallback;
+	typedef boost::shared_ptr<MySql::ObjectBase> (*ObjectFactory)();
+	typedef boost::function<void (boost::container::vector<boost::shared_ptr<MySql::ObjectBase> > &objects)> StreamCallback;
+
+	struct PoolStatus {
+		std::size_t min_thread_count;
+		std::size_t max_thread_count;
+		std::size_t live_thread_count;
+		std::size_t queue_size;
+	};
+	struct ThreadStatus {
+		std::size_t index;
+		std::size_t queue_size;
+		boost::uint64_t queue_latency;
+		std::size_t route_count;
+	};
+
+	typedef PromiseContainer<boost::shared_ptr<MySql::ObjectBase> > CachedLoadPromise;
+
+	struct CacheStatus {
+		std::size_t capacity;
+		std::size_t size;
+		boost::uint64_t hits;
+		boost::uint64_t misses;
+		boost::uint64_t evictions;
+		boost::uint64_t invalidations;
+	};
 
 	static void start();
 	static void stop();
@@ -29,11 +57,36 @@ public:
 
 	static void wait_for_all_async_operations();
 
+	static void get_pool_status(PoolStatus &status);
+	static void get_thread_status(boost::container::vector<ThreadStatus> &ret);
+	// 调低上限时，多余的线程在处理完已有的操作之后退出。
+	static void set_thread_limits(std::size_t min_thread_count, std::size_t max_thread_count);
+
 	// 异步接口。
 	static boost::shared_ptr<const Promise> enqueue_for_saving(boost::shared_ptr<const MySql::ObjectBase> object, bool to_replace, bool urgent);
 	static boost::shared_ptr<const Promise> enqueue_for_loading(boost::shared_ptr<MySql::ObjectBase> object, std::string query);
 	static boost::shared_ptr<const Promise> enqueue_for_deleting(const char *table_hint, std::string query);
 	static boost::shared_ptr<const Promise> enqueue_for_batch_loading(QueryCallback callback, const char *table_hint, std::string query);
+	// 流式批量加载。每一行在数据库线程中用 factory 创建对象并 fetch()，每 mysql_stream_batch_size 个对象为一批，
+	// 在任务线程中按顺序调用 callback。尚未处理的批达到 mysql_stream_max_pending_batches 时数据库线程暂停读取结果。
+	// 所有的批都处理完之后 Promise 才完成。callback 中不能等待数据库操作，否则会死锁。
+	static boost::shared_ptr<const Promise> enqueue_for_streaming_batch_loading(ObjectFactory factory, StreamCallback callback, const char *table_hint, std::string query);
+
+	// 带读缓存的加载，缓存大小由 mysql_cache_capacity 指定，为零时不缓存。缓存以表名和 key 为键，key 通常是主键的文本形式。
+	// 命中时直接返回缓存中的对象，否则用 factory 创建对象，执行 query 加载之后放入缓存。
+	// 返回的对象是共享的。通过它修改字段会自动保存，缓存中的也就是最新的；
+	// 如果通过其他对象保存或者用 enqueue_for_low_level_access() 修改了同一行，应当调用 put_cached_object() 或者 invalidate_cached_object()。
+	// enqueue_for_deleting() 会使整个表的缓存失效。
+	static boost::shared_ptr<const CachedLoadPromise> enqueue_for_cached_loading(ObjectFactory factory, std::string key, std::string query);
+	// 按键加载一行，key 是 column 列的值的文本形式（与服务器返回的文本相同）。先查找读缓存，加载的对象也放入缓存。
+	// 同一个表、同一个列的请求在操作等待执行期间被合并为一条 SELECT * FROM `table` WHERE `column` IN (...) 语句，
+	// 每批最多 mysql_key_batch_max_keys 个键，结果按键分发给各个请求。没有对应的行时以 ER_SP_FETCH_NO_DATA 失败。
+	static boost::shared_ptr<const CachedLoadPromise> enqueue_for_loading_by_key(ObjectFactory factory, const char *column, std::string key);
+	static void put_cached_object(boost::shared_ptr<MySql::ObjectBase> object, const std::string &key);
+	static void invalidate_cached_object(const char *table, const std::string &key);
+	static void invalidate_cached_table(const char *table);
+	static void clear_cache();
+	static void get_cache_status(CacheStatus &status);
 
 	static void enqueue_for_low_level_access(const boost::shared_ptr<Promise> &promise, QueryCallback callback, const char *table_hint, bool from_slave = false);
 
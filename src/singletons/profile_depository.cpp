@@ -7,6 +7,13 @@
 #include "../mutex.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
+#include "../atomic.hpp"
+#include <boost/scoped_array.hpp>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  include <cpuid.h>
+#endif
 
 namespace Poseidon {
 
@@ -16,11 +23,54 @@ namespace {
 		unsigned long line;
 		const char *func;
 	};
+	// 对数线性的直方图：小于 16 的值各占一个桶，此后每个 2 的幂的区间分为 16 个桶。
+	enum {
+		HISTOGRAM_SUB_BITS = 4,
+		HISTOGRAM_BUCKETS  = (64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS,
+	};
+
+	std::size_t get_histogram_index(boost::uint64_t val) NOEXCEPT {
+		if(val < (1u << HISTOGRAM_SUB_BITS)){
+			return static_cast<std::size_t>(val);
+		}
+		const unsigned exp = 63 - static_cast<unsigned>(__builtin_clzll(val));
+		const unsigned shift = exp - HISTOGRAM_SUB_BITS;
+		return ((shift + 1) << HISTOGRAM_SUB_BITS) + static_cast<std::size_t>((val >> shift) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+	}
+	boost::uint64_t get_histogram_upper_bound(std::size_t index) NOEXCEPT {
+		if(index < (1u << HISTOGRAM_SUB_BITS)){
+			return index;
+		}
+		const unsigned shift = static_cast<unsigned>(index >> HISTOGRAM_SUB_BITS) - 1;
+		const boost::uint64_t lower = static_cast<boost::uint64_t>((index & ((1u << HISTOGRAM_SUB_BITS) - 1)) | (1u << HISTOGRAM_SUB_BITS)) << shift;
+		return lower + ((boost::uint64_t)1 << shift) - 1;
+	}
+
+	struct ThreadHistogram {
+		volatile boost::uint64_t counts[HISTOGRAM_BUCKETS];
+		volatile boost::uint64_t max;
+	};
+
 	struct ProfileCounters {
 		unsigned long long samples;
 		double total;
 		double exclusive;
+		// 为空表示这一处没有直方图。
+		boost::container::vector<boost::uint64_t> histogram;
+		boost::uint64_t max;
 	};
+
+	double get_percentile(const ProfileCounters &counters, boost::uint64_t count, double ratio){
+		const AUTO(target, std::max<boost::uint64_t>(static_cast<boost::uint64_t>(std::ceil(static_cast<double>(count) * ratio)), 1));
+		boost::uint64_t seen = 0;
+		for(std::size_t index = 0; index < counters.histogram.size(); ++index){
+			seen += counters.histogram[index];
+			if(seen >= target){
+				return static_cast<double>(std::min(get_histogram_upper_bound(index), counters.max));
+			}
+		}
+		return static_cast<double>(counters.max);
+	}
 	struct ProfileKeyComparator {
 		bool operator()(const ProfileKey &lhs, const ProfileKey &rhs) const NOEXCEPT {
 			int cmp = std::strcmp(lhs.file, rhs.file);
@@ -33,15 +83,298 @@ namespace {
 	typedef boost::container::flat_map<ProfileKey, ProfileCounters, ProfileKeyComparator> ProfileMap;
 
 	bool g_enabled = false;
+	bool g_lock_profiling = false;
+
+	// 以下变量只在 start() 中设置。
+	bool g_use_cycle_counter = false;
+	double g_ticks_per_ms = 1.0e6;
+
+	boost::uint64_t get_mono_clock_ns() NOEXCEPT {
+		::timespec ts;
+		if(::clock_gettime(CLOCK_MONOTONIC, &ts) != 0){
+			std::abort();
+		}
+		return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000000 + static_cast<boost::uint64_t>(ts.tv_nsec);
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	boost::uint64_t read_cycle_counter() NOEXCEPT {
+		return __rdtsc();
+	}
+	// 只有 invariant TSC 的频率与 CPU 的频率和状态无关，并且在所有核心上同步。
+	bool probe_cycle_counter(double &ticks_per_ms){
+		unsigned eax, ebx, ecx, edx;
+		if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))){
+			return false;
+		}
+		const AUTO(ns_begin, get_mono_clock_ns());
+		const AUTO(tsc_begin, read_cycle_counter());
+		::timespec req;
+		req.tv_sec = 0;
+		req.tv_nsec = 20000000;
+		::nanosleep(&req, NULLPTR);
+		const AUTO(ns_end, get_mono_clock_ns());
+		const AUTO(tsc_end, read_cycle_counter());
+		if((ns_end <= ns_begin) || (tsc_end <= tsc_begin)){
+			return false;
+		}
+		ticks_per_ms = static_cast<double>(tsc_end - tsc_begin) / static_cast<double>(ns_end - ns_begin) * 1.0e6;
+		return true;
+	}
+#elif defined(__aarch64__)
+	boost::uint64_t read_cycle_counter() NOEXCEPT {
+		boost::uint64_t val;
+		__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(val));
+		return val;
+	}
+	// 通用计时器的频率由 cntfrq_el0 给出，不需要校准。
+	bool probe_cycle_counter(double &ticks_per_ms){
+		boost::uint64_t freq;
+		__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+		if(freq == 0){
+			return false;
+		}
+		ticks_per_ms = static_cast<double>(freq) / 1.0e3;
+		return true;
+	}
+#else
+	boost::uint64_t read_cycle_counter() NOEXCEPT {
+		return get_mono_clock_ns();
+	}
+	bool probe_cycle_counter(double &ticks_per_ms){
+		(void)ticks_per_ms;
+		return false;
+	}
+#endif
+
+	// 每个线程的计数器表。
+	// 只有所属的线程写入，因此累加时不需要加锁；snapshot() 和 clear() 持有 g_mutex 读取其他线程的表。
+	// 键是 __FILE__ 的指针和行号，不同编译单元中同一个文件的计数器在 snapshot() 中按照文件名合并。
+	// 时间以 get_ticks() 的计数保存，以便原子地读写。
+	struct ThreadSlot {
+		const char *volatile file; // 最后写入，不为空表示这个槽已经被占用。
+		unsigned long line;
+		const char *func;
+		volatile boost::uint64_t samples;
+		volatile boost::uint64_t total_ticks;
+		volatile boost::uint64_t exclusive_ticks;
+		ThreadHistogram *volatile histogram; // 第一次记录时由所属的线程创建。
+		// 以下字段只在持有 g_mutex 时访问，clear() 时记录当前的值，此后读取时减去它们。
+		boost::uint64_t samples_cleared;
+		boost::uint64_t total_ticks_cleared;
+		boost::uint64_t exclusive_ticks_cleared;
+		boost::uint64_t *histogram_cleared;
+	};
+
+	class ThreadTable : NONCOPYABLE {
+	public:
+		enum {
+			CAPACITY = 1024,
+		};
+
+	private:
+		boost::scoped_array<ThreadSlot> m_slots;
+		std::size_t m_size;
+
+	public:
+		ThreadTable()
+			: m_slots(new ThreadSlot[CAPACITY]()), m_size(0)
+		{ }
+		~ThreadTable(){
+			for(std::size_t index = 0; index < CAPACITY; ++index){
+				delete m_slots.get()[index].histogram;
+				delete[] m_slots.get()[index].histogram_cleared;
+			}
+		}
+
+	public:
+		const ThreadSlot &get(std::size_t index) const NOEXCEPT {
+			return m_slots.get()[index];
+		}
+		ThreadSlot &get(std::size_t index) NOEXCEPT {
+			return m_slots.get()[index];
+		}
+
+		// 只在所属的线程中调用。表满时返回空指针。
+		ThreadSlot *require(const char *file, unsigned long line, const char *func) NOEXCEPT {
+			std::size_t index = ((reinterpret_cast<boost::uintptr_t>(file) >> 3) ^ (line * 0x9E3779B1u)) % CAPACITY;
+			for(std::size_t probes = 0; probes < CAPACITY; ++probes){
+				AUTO_REF(slot, m_slots.get()[index]);
+				const char *const slot_file = atomic_load(slot.file, ATOMIC_RELAXED);
+				if(!slot_file){
+					if(m_size >= CAPACITY / 2){
+						return NULLPTR;
+					}
+					slot.line = line;
+					slot.func = func;
+					atomic_store(slot.file, file, ATOMIC_RELEASE);
+					++m_size;
+					return &slot;
+				}
+				if((slot_file == file) && (slot.line == line)){
+					return &slot;
+				}
+				index = (index + 1) % CAPACITY;
+			}
+			return NULLPTR;
+		}
+	};
+
+	void add_to_histogram(ProfileCounters &counters, boost::uint64_t duration){
+		counters.histogram.resize(HISTOGRAM_BUCKETS);
+		counters.histogram.at(get_histogram_index(duration)) += 1;
+		counters.max = std::max(counters.max, duration);
+	}
+
+	void accumulate_locked(ProfileMap &profile, const ThreadSlot &slot){
+		const AUTO(samples, atomic_load(slot.samples, ATOMIC_RELAXED) - slot.samples_cleared);
+		const AUTO(total_ticks, atomic_load(slot.total_ticks, ATOMIC_RELAXED) - slot.total_ticks_cleared);
+		const AUTO(exclusive_ticks, atomic_load(slot.exclusive_ticks, ATOMIC_RELAXED) - slot.exclusive_ticks_cleared);
+		if((samples == 0) && (total_ticks == 0) && (exclusive_ticks == 0)){
+			// clear() 之后没有新的数据。
+			return;
+		}
+		const ProfileKey key = { slot.file, slot.line, slot.func };
+		AUTO_REF(counters, profile[key]);
+		counters.samples += samples;
+		counters.total += static_cast<double>(total_ticks) / g_ticks_per_ms;
+		counters.exclusive += static_cast<double>(exclusive_ticks) / g_ticks_per_ms;
+		const AUTO(histogram, atomic_load(slot.histogram, ATOMIC_ACQUIRE));
+		if(histogram){
+			counters.histogram.resize(HISTOGRAM_BUCKETS);
+			for(std::size_t index = 0; index < HISTOGRAM_BUCKETS; ++index){
+				AUTO(count, atomic_load(histogram->counts[index], ATOMIC_RELAXED));
+				if(slot.histogram_cleared){
+					count -= slot.histogram_cleared[index];
+				}
+				counters.histogram[index] += count;
+			}
+			// clear() 之后的最大值无法精确得到，读取时用最高的非空桶的上界限制它。
+			counters.max = std::max<boost::uint64_t>(counters.max, atomic_load(histogram->max, ATOMIC_RELAXED));
+		}
+	}
 
 	Mutex g_mutex;
 	ProfileMap g_profile;
+	// 所有线程的表。线程退出时它的计数器合并到 g_profile 中。
+	boost::container::vector<ThreadTable *> g_tables;
+
+	__thread ThreadTable *t_table = 0; // XXX: NULLPTR
+
+	void table_key_destructor(void *ptr) NOEXCEPT {
+		const AUTO(table, static_cast<ThreadTable *>(ptr));
+		t_table = 0; // XXX: NULLPTR
+		try {
+			const Mutex::UniqueLock lock(g_mutex);
+			for(std::size_t index = 0; index < ThreadTable::CAPACITY; ++index){
+				const AUTO_REF(slot, table->get(index));
+				if(!atomic_load(slot.file, ATOMIC_ACQUIRE)){
+					continue;
+				}
+				accumulate_locked(g_profile, slot);
+			}
+			g_tables.erase(std::remove(g_tables.begin(), g_tables.end(), table), g_tables.end());
+		} catch(...){
+			//
+		}
+		delete table;
+	}
+
+	// 锁竞争的计数器表。
+	// 加锁的代码不能再加锁，因此所有线程共享一张无锁的表。槽一旦被占用就不再释放，clear() 只清零计数器。
+	struct LockSlot {
+		volatile int state; // 0 为空，1 为正在写入键，2 为键已经写入。
+		const char *file;
+		unsigned long line;
+		volatile boost::uint64_t contentions;
+		volatile boost::uint64_t wait_ticks;
+		volatile boost::uint64_t max_wait_ticks;
+	};
+
+	enum {
+		LOCK_TABLE_CAPACITY = 4096,
+	};
+
+	LockSlot g_lock_slots[LOCK_TABLE_CAPACITY];
+
+	// 表满时返回空指针。
+	LockSlot *require_lock_slot(const char *file, unsigned long line) NOEXCEPT {
+		std::size_t index = ((reinterpret_cast<boost::uintptr_t>(file) >> 3) ^ (line * 0x9E3779B1u)) % LOCK_TABLE_CAPACITY;
+		for(std::size_t probes = 0; probes < LOCK_TABLE_CAPACITY; ++probes){
+			AUTO_REF(slot, g_lock_slots[index]);
+			int state = atomic_load(slot.state, ATOMIC_ACQUIRE);
+			if(state == 0){
+				int cmp = 0;
+				if(atomic_compare_exchange(slot.state, cmp, 1, ATOMIC_ACQ_REL, ATOMIC_ACQUIRE)){
+					slot.file = file;
+					slot.line = line;
+					atomic_store(slot.state, 2, ATOMIC_RELEASE);
+					return &slot;
+				}
+				state = cmp;
+			}
+			while(state == 1){
+				atomic_pause();
+				state = atomic_load(slot.state, ATOMIC_ACQUIRE);
+			}
+			if((slot.file == file) && (slot.line == line)){
+				return &slot;
+			}
+			index = (index + 1) % LOCK_TABLE_CAPACITY;
+		}
+		return NULLPTR;
+	}
+
+	::pthread_key_t g_table_key;
+	::pthread_once_t g_table_key_once = PTHREAD_ONCE_INIT;
+
+	void create_table_key(){
+		if(::pthread_key_create(&g_table_key, &table_key_destructor) != 0){
+			std::abort();
+		}
+	}
+
+	ThreadTable *require_table(){
+		if(t_table){
+			return t_table;
+		}
+		::pthread_once(&g_table_key_once, &create_table_key);
+		const AUTO(table, new ThreadTable);
+		try {
+			const Mutex::UniqueLock lock(g_mutex);
+			g_tables.push_back(table);
+		} catch(...){
+			delete table;
+			throw;
+		}
+		::pthread_setspecific(g_table_key, table);
+		t_table = table;
+		return t_table;
+	}
 }
 
 void ProfileDepository::start(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting profile depository...");
 
-	g_enabled = MainConfig::get<bool>("profiler_enabled", false);
+	const bool enabled = MainConfig::get<bool>("profiler_enabled", false);
+	if(enabled && MainConfig::get<bool>("profiler_use_cycle_counter", true)){
+		double ticks_per_ms;
+		if(probe_cycle_counter(ticks_per_ms)){
+			LOG_POSEIDON_INFO("Profiler is using the CPU cycle counter: ticks_per_ms = ", ticks_per_ms);
+			g_ticks_per_ms = ticks_per_ms;
+			g_use_cycle_counter = true;
+		} else {
+			LOG_POSEIDON_WARNING("No invariant CPU cycle counter is available. Profiler is falling back to the monotonic clock.");
+		}
+	}
+	g_enabled = enabled;
+#ifndef POSEIDON_NO_LOCK_PROFILING
+	g_lock_profiling = MainConfig::get<bool>("profiler_lock_contention", false);
+#else
+	if(MainConfig::get<bool>("profiler_lock_contention", false)){
+		LOG_POSEIDON_WARNING("Lock contention profiling has been disabled at compile time.");
+	}
+#endif
 }
 void ProfileDepository::stop(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping profile depository...");
@@ -52,25 +385,85 @@ void ProfileDepository::stop(){
 bool ProfileDepository::is_enabled() NOEXCEPT {
 	return g_enabled;
 }
+boost::uint64_t ProfileDepository::get_ticks() NOEXCEPT {
+	if(g_use_cycle_counter){
+		return read_cycle_counter();
+	}
+	return get_mono_clock_ns();
+}
+double ProfileDepository::get_ticks_per_ms() NOEXCEPT {
+	return g_ticks_per_ms;
+}
 
-void ProfileDepository::accumulate(const char *file, unsigned long line, const char *func, bool new_sample, double total, double exclusive) NOEXCEPT
+void ProfileDepository::accumulate(const char *file, unsigned long line, const char *func, bool new_sample, boost::uint64_t total, boost::uint64_t exclusive,
+	bool histogram, boost::uint64_t duration) NOEXCEPT
 try {
+	const AUTO(slot, require_table()->require(file, line, func));
+	if(slot){
+		// 只有这个线程写入，读出再写回即可。
+		atomic_store(slot->samples, atomic_load(slot->samples, ATOMIC_RELAXED) + new_sample, ATOMIC_RELAXED);
+		atomic_store(slot->total_ticks, atomic_load(slot->total_ticks, ATOMIC_RELAXED) + total, ATOMIC_RELAXED);
+		atomic_store(slot->exclusive_ticks, atomic_load(slot->exclusive_ticks, ATOMIC_RELAXED) + exclusive, ATOMIC_RELAXED);
+		if(histogram){
+			ThreadHistogram *hist = atomic_load(slot->histogram, ATOMIC_RELAXED);
+			if(!hist){
+				hist = new ThreadHistogram();
+				atomic_store(slot->histogram, hist, ATOMIC_RELEASE);
+			}
+			AUTO_REF(count, hist->counts[get_histogram_index(duration)]);
+			atomic_store(count, atomic_load(count, ATOMIC_RELAXED) + 1, ATOMIC_RELAXED);
+			if(atomic_load(hist->max, ATOMIC_RELAXED) < duration){
+				atomic_store(hist->max, duration, ATOMIC_RELAXED);
+			}
+		}
+		return;
+	}
+	// 这个线程的表满了。
 	const Mutex::UniqueLock lock(g_mutex);
 	const ProfileKey key = { file, line, func };
 	AUTO_REF(counters, g_profile[key]);
 	counters.samples += new_sample;
-	counters.total += total;
-	counters.exclusive += exclusive;
+	counters.total += static_cast<double>(total) / g_ticks_per_ms;
+	counters.exclusive += static_cast<double>(exclusive) / g_ticks_per_ms;
+	if(histogram){
+		add_to_histogram(counters, duration);
+	}
 } catch(...){
 	//
 }
 
+bool ProfileDepository::is_lock_profiling_enabled() NOEXCEPT {
+	return g_lock_profiling;
+}
+void ProfileDepository::accumulate_lock_wait(const char *file, unsigned long line, boost::uint64_t wait) NOEXCEPT {
+	const AUTO(slot, require_lock_slot(file, line));
+	if(!slot){
+		return;
+	}
+	atomic_add(slot->contentions, 1, ATOMIC_RELAXED);
+	atomic_add(slot->wait_ticks, wait, ATOMIC_RELAXED);
+	AUTO(max, atomic_load(slot->max_wait_ticks, ATOMIC_RELAXED));
+	while((max < wait) && !atomic_compare_exchange(slot->max_wait_ticks, max, wait, ATOMIC_RELAXED, ATOMIC_RELAXED)){
+		//
+	}
+}
+
 void ProfileDepository::snapshot(boost::container::vector<ProfileDepository::SnapshotElement> &ret){
 	Profiler::accumulate_all_in_thread();
 
 	const Mutex::UniqueLock lock(g_mutex);
-	ret.reserve(ret.size() + g_profile.size());
-	for(AUTO(it, g_profile.begin()); it != g_profile.end(); ++it){
+	ProfileMap profile(g_profile);
+	for(AUTO(it, g_tables.begin()); it != g_tables.end(); ++it){
+		for(std::size_t index = 0; index < ThreadTable::CAPACITY; ++index){
+			const AUTO_REF(slot, (*it)->get(index));
+			if(!atomic_load(slot.file, ATOMIC_ACQUIRE)){
+				continue;
+			}
+			accumulate_locked(profile, slot);
+		}
+	}
+	ret.reserve(ret.size() + profile.size());
+	for(AUTO(it, profile.begin()); it != profile.end(); ++it){
 		SnapshotElement elem = { };
 		elem.file = it->first.file;
 		elem.line = it->first.line;
@@ -78,12 +471,87 @@ void ProfileDepository::snapshot(boost::container::vector<ProfileDepository::Sna
 		elem.samples = it->second.samples;
 		elem.total = it->second.total;
 		elem.exclusive = it->second.exclusive;
+		const AUTO_REF(hist, it->second.histogram);
+		boost::uint64_t count = 0;
+		std::size_t highest = 0;
+		for(std::size_t index = 0; index < hist.size(); ++index){
+			if(hist[index] != 0){
+				count += hist[index];
+				highest = index;
+			}
+		}
+		if(count != 0){
+			ProfileCounters counters = it->second;
+			counters.max = std::min(counters.max, get_histogram_upper_bound(highest));
+			elem.has_histogram = true;
+			elem.p50 = get_percentile(counters, count, 0.50) / g_ticks_per_ms;
+			elem.p90 = get_percentile(counters, count, 0.90) / g_ticks_per_ms;
+			elem.p99 = get_percentile(counters, count, 0.99) / g_ticks_per_ms;
+			elem.p999 = get_percentile(counters, count, 0.999) / g_ticks_per_ms;
+			elem.max = static_cast<double>(counters.max) / g_ticks_per_ms;
+		}
 		ret.push_back(STD_MOVE(elem));
 	}
 }
+void ProfileDepository::snapshot_locks(boost::container::vector<ProfileDepository::LockSnapshotElement> &ret){
+	// 不同编译单元中同一个文件的计数器按照文件名合并。
+	boost::container::flat_map<ProfileKey, LockSnapshotElement, ProfileKeyComparator> locks;
+	for(std::size_t index = 0; index < LOCK_TABLE_CAPACITY; ++index){
+		const AUTO_REF(slot, g_lock_slots[index]);
+		if(atomic_load(slot.state, ATOMIC_ACQUIRE) != 2){
+			continue;
+		}
+		const AUTO(contentions, atomic_load(slot.contentions, ATOMIC_RELAXED));
+		if(contentions == 0){
+			continue;
+		}
+		const ProfileKey key = { slot.file, slot.line, "" };
+		AUTO_REF(elem, locks[key]);
+		elem.file = slot.file;
+		elem.line = slot.line;
+		elem.contentions += contentions;
+		elem.total_wait += static_cast<double>(atomic_load(slot.wait_ticks, ATOMIC_RELAXED)) / g_ticks_per_ms;
+		elem.max_wait = std::max(elem.max_wait, static_cast<double>(atomic_load(slot.max_wait_ticks, ATOMIC_RELAXED)) / g_ticks_per_ms);
+	}
+	ret.reserve(ret.size() + locks.size());
+	for(AUTO(it, locks.begin()); it != locks.end(); ++it){
+		ret.push_back(it->second);
+	}
+}
 void ProfileDepository::clear() NOEXCEPT {
+	for(std::size_t index = 0; index < LOCK_TABLE_CAPACITY; ++index){
+		AUTO_REF(slot, g_lock_slots[index]);
+		atomic_store(slot.contentions, 0, ATOMIC_RELAXED);
+		atomic_store(slot.wait_ticks, 0, ATOMIC_RELAXED);
+		atomic_store(slot.max_wait_ticks, 0, ATOMIC_RELAXED);
+	}
+
 	const Mutex::UniqueLock lock(g_mutex);
 	g_profile.clear();
+	for(AUTO(it, g_tables.begin()); it != g_tables.end(); ++it){
+		for(std::size_t index = 0; index < ThreadTable::CAPACITY; ++index){
+			AUTO_REF(slot, (*it)->get(index));
+			if(!atomic_load(slot.file, ATOMIC_ACQUIRE)){
+				continue;
+			}
+			slot.samples_cleared = atomic_load(slot.samples, ATOMIC_RELAXED);
+			slot.total_ticks_cleared = atomic_load(slot.total_ticks, ATOMIC_RELAXED);
+			slot.exclusive_ticks_cleared = atomic_load(slot.exclusive_ticks, ATOMIC_RELAXED);
+			const AUTO(histogram, atomic_load(slot.histogram, ATOMIC_ACQUIRE));
+			if(!histogram){
+				continue;
+			}
+			if(!slot.histogram_cleared){
+				slot.histogram_cleared = new(std::nothrow) boost::uint64_t[HISTOGRAM_BUCKETS];
+				if(!slot.histogram_cleared){
+					continue;
+				}
+			}
+			for(std::size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket){
+				slot.histogram_cleared[bucket] = atomic_load(histogram->counts[bucket], ATOMIC_RELAXED);
+			}
+		}
+	}
 }
 
 }
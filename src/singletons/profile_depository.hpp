@@ -5,6 +5,7 @@
 #define POSEIDON_PROFILE_DEPOSITORY_HPP_
 
 #include "../cxx_ver.hpp"
+#include <boost/cstdint.hpp>
 
 namespace Poseidon {
 
@@ -17,6 +18,21 @@ public:
 		unsigned long long samples; // 采样数。
 		double total; // 控制流进入函数，直到退出函数（正常返回或异常被抛出），经历的总毫秒数。
 		double exclusive; // ms_total 扣除执行点位于其他 profiler 之中的毫秒数。
+		// 以下字段只对 PROFILE_ME_WITH_HISTOGRAM 有效，是每次执行的毫秒数的分位数，误差不超过 1/16。
+		bool has_histogram;
+		double p50;
+		double p90;
+		double p99;
+		double p999;
+		double max;
+	};
+	// 加锁时发生竞争的位置，即构造 Mutex::UniqueLock 或 RecursiveMutex::UniqueLock 的位置。
+	struct LockSnapshotElement {
+		const char *file;
+		unsigned long line;
+		unsigned long long contentions; // 尝试加锁失败、需要等待的次数。
+		double total_wait; // 等待的总毫秒数。
+		double max_wait;
 	};
 
 private:
@@ -27,9 +43,21 @@ public:
 	static void stop();
 
 	static bool is_enabled() NOEXCEPT;
-	static void accumulate(const char *file, unsigned long line, const char *func, bool new_sample, double total, double exclusive) NOEXCEPT;
+	// Profiler 计时使用的时钟。profiler_use_cycle_counter 为 1 并且 CPU 的周期计数器频率恒定时读取周期计数器，否则是以纳秒为单位的单调时钟。
+	// 计数只在 snapshot() 中换算成毫秒。
+	static boost::uint64_t get_ticks() NOEXCEPT;
+	static double get_ticks_per_ms() NOEXCEPT;
+	// histogram 为 true 时把 duration 记录到直方图中。
+	static void accumulate(const char *file, unsigned long line, const char *func, bool new_sample, boost::uint64_t total, boost::uint64_t exclusive,
+		bool histogram, boost::uint64_t duration) NOEXCEPT;
+
+	// 由 profiler_lock_contention 开启。定义 POSEIDON_NO_LOCK_PROFILING 编译时，互斥锁不会调用以下函数。
+	static bool is_lock_profiling_enabled() NOEXCEPT;
+	// wait 是 get_ticks() 的计数。不加锁，可以在任何互斥锁中调用。
+	static void accumulate_lock_wait(const char *file, unsigned long line, boost::uint64_t wait) NOEXCEPT;
 
 	static void snapshot(boost::container::vector<SnapshotElement> &ret);
+	static void snapshot_locks(boost::container::vector<LockSnapshotElement> &ret);
 	static void clear() NOEXCEPT;
 };
 
@@ -0,0 +1,363 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "sampling_profiler.hpp"
+#include "main_config.hpp"
+#include "../stream_buffer.hpp"
+#include "../thread.hpp"
+#include "../mutex.hpp"
+#include "../atomic.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+#include "../system_exception.hpp"
+#include <signal.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <boost/container/map.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+namespace {
+	enum {
+		MAX_DEPTH       = 64,
+		// 信号处理函数自身和内核设置的 __restore_rt。
+		SKIPPED_FRAMES  = 2,
+		// 采样线程每次发送信号之前都会取走上一次的采样，因此不需要很大。
+		RING_SIZE       = 16,
+	};
+
+	struct Sample {
+		const char *job_type;
+		unsigned depth;
+		void *frames[MAX_DEPTH];
+	};
+
+	// 单生产者单消费者的环形缓冲区：只有所属线程的信号处理函数写入，只有采样线程持有 g_mutex 时读取。
+	struct ThreadRing {
+		::pthread_t handle;
+		char name[16];
+		volatile std::size_t write;
+		volatile std::size_t read;
+		volatile unsigned long long dropped;
+		Sample samples[RING_SIZE];
+	};
+
+	struct StackKey {
+		std::string thread;
+		std::string job_type;
+		boost::container::vector<void *> frames; // 栈顶在前。
+	};
+	struct StackKeyComparator {
+		bool operator()(const StackKey &lhs, const StackKey &rhs) const NOEXCEPT {
+			int cmp = lhs.thread.compare(rhs.thread);
+			if(cmp != 0){
+				return cmp < 0;
+			}
+			cmp = lhs.job_type.compare(rhs.job_type);
+			if(cmp != 0){
+				return cmp < 0;
+			}
+			return std::lexicographical_compare(lhs.frames.begin(), lhs.frames.end(), rhs.frames.begin(), rhs.frames.end(), std::less<void *>());
+		}
+	};
+
+	volatile bool g_running = false;
+	unsigned g_frequency = 99;
+	std::size_t g_max_stacks = 65536;
+	Thread g_thread;
+
+	__thread ThreadRing *volatile t_ring = 0; // XXX: NULLPTR
+	__thread const char *volatile t_job_type = 0; // XXX: NULLPTR
+
+	Mutex g_mutex;
+	boost::container::vector<ThreadRing *> g_rings;
+	boost::container::map<StackKey, unsigned long long, StackKeyComparator> g_stacks;
+	unsigned long long g_samples = 0;
+	unsigned long long g_dropped = 0;
+
+	// 只能调用异步信号安全的函数。backtrace() 在 start() 中预先调用过一次，此时不会再加载 libgcc_s。
+	void signal_proc(int /*sig*/, ::siginfo_t * /*info*/, void * /*context*/){
+		const int saved_errno = errno;
+		ThreadRing *const ring = t_ring;
+		if(ring){
+			const AUTO(write, atomic_load(ring->write, ATOMIC_RELAXED));
+			const AUTO(read, atomic_load(ring->read, ATOMIC_ACQUIRE));
+			if(write - read >= RING_SIZE){
+				atomic_add(ring->dropped, 1, ATOMIC_RELAXED);
+			} else {
+				AUTO_REF(sample, ring->samples[write % RING_SIZE]);
+				void *frames[MAX_DEPTH + SKIPPED_FRAMES];
+				const int count = ::backtrace(frames, MAX_DEPTH + SKIPPED_FRAMES);
+				const unsigned depth = (count > SKIPPED_FRAMES) ? static_cast<unsigned>(count - SKIPPED_FRAMES) : 0u;
+				std::memcpy(sample.frames, frames + SKIPPED_FRAMES, depth * sizeof(void *));
+				sample.depth = depth;
+				sample.job_type = t_job_type;
+				atomic_store(ring->write, write + 1, ATOMIC_RELEASE);
+			}
+		}
+		errno = saved_errno;
+	}
+
+	std::string demangle(const char *name){
+		int status;
+		const AUTO(str, abi::__cxa_demangle(name, NULLPTR, NULLPTR, &status));
+		if(!str){
+			return name;
+		}
+		std::string ret(str);
+		::free(str);
+		return ret;
+	}
+	// 任务所在的模块可能已经被卸载，所以先确认名字所在的内存仍然有效。
+	std::string get_job_type_name(const char *job_type){
+		if(!job_type){
+			return VAL_INIT;
+		}
+		::Dl_info info;
+		if(::dladdr(job_type, &info) == 0){
+			return "?";
+		}
+		return demangle(job_type);
+	}
+
+	// 调用者必须持有 g_mutex。
+	void drain_unlocked(){
+		for(AUTO(it, g_rings.begin()); it != g_rings.end(); ++it){
+			ThreadRing *const ring = *it;
+			g_dropped += atomic_exchange(ring->dropped, 0, ATOMIC_RELAXED);
+			const AUTO(write, atomic_load(ring->write, ATOMIC_ACQUIRE));
+			AUTO(read, atomic_load(ring->read, ATOMIC_RELAXED));
+			while(read != write){
+				const AUTO_REF(sample, ring->samples[read % RING_SIZE]);
+				StackKey key;
+				key.thread = ring->name;
+				key.job_type = get_job_type_name(sample.job_type);
+				key.frames.assign(sample.frames, sample.frames + sample.depth);
+				const AUTO(stack_it, g_stacks.find(key));
+				if(stack_it != g_stacks.end()){
+					stack_it->second += 1;
+					g_samples += 1;
+				} else if(g_stacks.size() < g_max_stacks){
+					g_stacks.emplace(STD_MOVE(key), 1);
+					g_samples += 1;
+				} else {
+					g_dropped += 1;
+				}
+				++read;
+			}
+			atomic_store(ring->read, read, ATOMIC_RELEASE);
+		}
+	}
+	// 调用者必须持有 g_mutex。丢弃缓冲区中尚未取走的采样，不分配内存。
+	void discard_unlocked(ThreadRing *ring) NOEXCEPT {
+		g_dropped += atomic_exchange(ring->dropped, 0, ATOMIC_RELAXED);
+		atomic_store(ring->read, atomic_load(ring->write, ATOMIC_ACQUIRE), ATOMIC_RELEASE);
+	}
+
+	void thread_proc(){
+		PROFILE_ME;
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Sampling profiler thread started.");
+
+		// 采样线程自身不被采样。
+		SamplingProfiler::unregister_thread();
+
+		const AUTO(interval, static_cast<boost::uint64_t>(1000000000 / g_frequency));
+		while(atomic_load(g_running, ATOMIC_CONSUME)){
+			{
+				const Mutex::UniqueLock lock(g_mutex);
+				drain_unlocked();
+				for(AUTO(it, g_rings.begin()); it != g_rings.end(); ++it){
+					::pthread_kill((*it)->handle, SIGPROF);
+				}
+			}
+			::timespec req;
+			req.tv_sec = static_cast< ::time_t>(interval / 1000000000);
+			req.tv_nsec = static_cast<long>(interval % 1000000000);
+			::nanosleep(&req, NULLPTR);
+		}
+
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Sampling profiler thread stopped.");
+	}
+
+	void append_frame(std::string &line, boost::container::map<void *, std::string> &symbols, void *addr, bool is_return_address){
+		AUTO(it, symbols.find(addr));
+		if(it == symbols.end()){
+			// 返回地址可能已经越过了调用指令所在的函数的末尾，所以用前一个字节查找符号。
+			const AUTO(lookup, static_cast<char *>(addr) - (is_return_address ? 1 : 0));
+			std::string name;
+			::Dl_info info;
+			if(::dladdr(lookup, &info) == 0){
+				char str[64];
+				name.assign(str, (unsigned)::snprintf(str, sizeof(str), "%p", addr));
+			} else if(info.dli_sname){
+				name = demangle(info.dli_sname);
+			} else {
+				const char *file = info.dli_fname ? info.dli_fname : "?";
+				const char *slash = std::strrchr(file, '/');
+				if(slash){
+					file = slash + 1;
+				}
+				char str[64];
+				name.assign(file);
+				name.append(str, (unsigned)::snprintf(str, sizeof(str), "+0x%lx", (unsigned long)(lookup - static_cast<char *>(info.dli_fbase))));
+			}
+			// folded 格式用分号分隔各帧，用最后一个空格分隔采样数。
+			std::replace(name.begin(), name.end(), ';', ':');
+			it = symbols.emplace(addr, STD_MOVE(name)).first;
+		}
+		line += ';';
+		line += it->second;
+	}
+}
+
+void SamplingProfiler::start(){
+	if(!MainConfig::get<bool>("sampling_profiler_enabled", false)){
+		LOG_POSEIDON_DEBUG("Sampling profiler is disabled.");
+		return;
+	}
+	if(atomic_exchange(g_running, true, ATOMIC_ACQ_REL) != false){
+		LOG_POSEIDON_FATAL("Only one daemon is allowed at the same time.");
+		std::abort();
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting sampling profiler...");
+
+	g_frequency = std::min(std::max(MainConfig::get<unsigned>("sampling_profiler_frequency", 99), 1u), 10000u);
+	g_max_stacks = MainConfig::get<std::size_t>("sampling_profiler_max_stacks", 65536);
+
+	// glibc 的 backtrace() 在第一次调用时加载 libgcc_s，这不是异步信号安全的。
+	void *frames[1];
+	::backtrace(frames, 1);
+
+	struct ::sigaction sa;
+	std::memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	// 被打断的系统调用尽量自动重新开始。
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sa.sa_sigaction = &signal_proc;
+	DEBUG_THROW_UNLESS(::sigaction(SIGPROF, &sa, NULLPTR) == 0, SystemException);
+
+	register_thread();
+	Thread(&thread_proc, sslit("  SP"), sslit("Sampler")).swap(g_thread);
+
+	LOG_POSEIDON_INFO("Sampling profiler started: frequency = ", g_frequency);
+}
+void SamplingProfiler::stop(){
+	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
+		return;
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping sampling profiler...");
+
+	if(g_thread.joinable()){
+		g_thread.join();
+	}
+	unregister_thread();
+	// 可能还有信号没有送达。
+	::signal(SIGPROF, SIG_IGN);
+
+	LOG_POSEIDON_INFO("Sampling profiler stopped.");
+}
+
+bool SamplingProfiler::is_enabled() NOEXCEPT {
+	return atomic_load(g_running, ATOMIC_CONSUME);
+}
+
+void SamplingProfiler::register_thread() NOEXCEPT {
+	if(!is_enabled() || t_ring){
+		return;
+	}
+	ThreadRing *const ring = new(std::nothrow) ThreadRing();
+	if(!ring){
+		LOG_POSEIDON_WARNING("Failed to allocate sampling ring buffer.");
+		return;
+	}
+	ring->handle = ::pthread_self();
+	::pthread_getname_np(ring->handle, ring->name, sizeof(ring->name));
+	try {
+		const Mutex::UniqueLock lock(g_mutex);
+		g_rings.push_back(ring);
+	} catch(std::exception &e){
+		LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+		delete ring;
+		return;
+	}
+	t_ring = ring;
+}
+void SamplingProfiler::unregister_thread() NOEXCEPT {
+	ThreadRing *const ring = t_ring;
+	if(!ring){
+		return;
+	}
+	{
+		// 持有 g_mutex 时采样线程不会向这个线程发送信号，也不会访问这个缓冲区。
+		const Mutex::UniqueLock lock(g_mutex);
+		discard_unlocked(ring);
+		g_rings.erase(std::find(g_rings.begin(), g_rings.end(), ring));
+	}
+	// 已经发出的信号可能在这之后送达，这时信号处理函数什么也不做。
+	t_ring = NULLPTR;
+	delete ring;
+}
+void SamplingProfiler::set_current_job(const char *job_type) NOEXCEPT {
+	t_job_type = job_type;
+}
+
+void SamplingProfiler::get_status(SamplingProfiler::Status &ret){
+	const Mutex::UniqueLock lock(g_mutex);
+	ret.enabled = is_enabled();
+	ret.frequency = g_frequency;
+	ret.threads = g_rings.size();
+	ret.samples = g_samples;
+	ret.dropped = g_dropped;
+	ret.stacks = g_stacks.size();
+}
+void SamplingProfiler::write_folded(StreamBuffer &buffer){
+	PROFILE_ME;
+
+	// 在锁外解析符号，dladdr() 和 __cxa_demangle() 都比较慢。
+	boost::container::vector<std::pair<StackKey, unsigned long long> > stacks;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		drain_unlocked();
+		stacks.reserve(g_stacks.size());
+		for(AUTO(it, g_stacks.begin()); it != g_stacks.end(); ++it){
+			stacks.push_back(*it);
+		}
+	}
+	// 同一个函数中不同的指令地址解析为同一行，需要合并。
+	boost::container::map<void *, std::string> symbols;
+	boost::container::map<std::string, unsigned long long> lines;
+	std::string line;
+	for(AUTO(it, stacks.begin()); it != stacks.end(); ++it){
+		const AUTO_REF(key, it->first);
+		line = key.thread.empty() ? "?" : key.thread;
+		if(!key.job_type.empty()){
+			line += ";[job ";
+			line += key.job_type;
+			line += ']';
+		}
+		// 栈底在前。只有栈顶的一帧是被打断的指令的地址，其余都是返回地址。
+		for(std::size_t i = key.frames.size(); i != 0; --i){
+			append_frame(line, symbols, key.frames.at(i - 1), i != 1);
+		}
+		lines[line] += it->second;
+	}
+	for(AUTO(it, lines.begin()); it != lines.end(); ++it){
+		char str[64];
+		buffer.put(it->first);
+		buffer.put(str, (unsigned)::snprintf(str, sizeof(str), " %llu\n", it->second));
+	}
+}
+void SamplingProfiler::clear() NOEXCEPT {
+	const Mutex::UniqueLock lock(g_mutex);
+	for(AUTO(it, g_rings.begin()); it != g_rings.end(); ++it){
+		discard_unlocked(*it);
+	}
+	g_stacks.clear();
+	g_samples = 0;
+	g_dropped = 0;
+}
+
+}
@@ -0,0 +1,52 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SINGLETONS_SAMPLING_PROFILER_HPP_
+#define POSEIDON_SINGLETONS_SAMPLING_PROFILER_HPP_
+
+#include "../cxx_ver.hpp"
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+class StreamBuffer;
+
+// 按照墙上时间采样的性能分析器，不需要 PROFILE_ME。
+// 采样线程按照固定的频率向每个注册过的线程发送 SIGPROF，信号处理函数用 backtrace() 记录当时的调用栈。
+// 正在执行的任务（包括 fiber 中的任务）的类型作为栈底的一帧，因此同一个任务在不同的线程中执行时会被归并在一起。
+class SamplingProfiler {
+public:
+	struct Status {
+		bool enabled;
+		unsigned frequency; // 每秒每个线程的采样次数。
+		std::size_t threads; // 正在被采样的线程数。
+		unsigned long long samples; // 已经归并的采样数。
+		unsigned long long dropped; // 由于环形缓冲区或调用栈表已满而丢弃的采样数。
+		std::size_t stacks; // 不同的调用栈的数量。
+	};
+
+private:
+	SamplingProfiler();
+
+public:
+	static void start();
+	static void stop();
+
+	static bool is_enabled() NOEXCEPT;
+
+	// 由 Thread 在线程函数的开始和结束处调用。主线程在 start() 和 stop() 中注册和注销。
+	// 只有在 start() 之后创建的线程才会被采样。
+	static void register_thread() NOEXCEPT;
+	static void unregister_thread() NOEXCEPT;
+	// 由 JobDispatcher 在开始和结束（或者挂起）一个任务时调用，job_type 为 typeid(job).name()，NULLPTR 表示没有任务。
+	static void set_current_job(const char *job_type) NOEXCEPT;
+
+	static void get_status(Status &ret);
+	// 以 flamegraph.pl 和 speedscope 等工具接受的 folded 格式输出，每行为 `线程;[job 任务类型];栈底函数;...;栈顶函数 采样数`。
+	static void write_folded(StreamBuffer &buffer);
+	static void clear() NOEXCEPT;
+};
+
+}
+
+#endif
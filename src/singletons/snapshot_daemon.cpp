@@ -0,0 +1,395 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "snapshot_daemon.hpp"
+#include "main_config.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include "../thread.hpp"
+#include "../mutex.hpp"
+#include "../condition_variable.hpp"
+#include "../atomic.hpp"
+#include "../exception.hpp"
+#include "../system_exception.hpp"
+#include "../log.hpp"
+#include "../raii.hpp"
+#include "../promise.hpp"
+#include "../profiler.hpp"
+#include "../time.hpp"
+#include "../checked_arithmetic.hpp"
+
+namespace Poseidon {
+
+class SnapshotProvider : NONCOPYABLE {
+private:
+	const std::string m_name;
+	const SnapshotDaemon::SnapshotCallback m_callback;
+
+public:
+	SnapshotProvider(std::string name, SnapshotDaemon::SnapshotCallback callback)
+		: m_name(STD_MOVE(name)), m_callback(STD_MOVE_IDN(callback))
+	{ }
+
+public:
+	const std::string &get_name() const {
+		return m_name;
+	}
+	const SnapshotDaemon::SnapshotCallback &get_callback() const {
+		return m_callback;
+	}
+};
+
+void SnapshotWriter::put(const void *data, std::size_t size){
+	std::size_t offset = 0;
+	while(offset < size){
+		if(m_size == m_capacity){
+			flush();
+		}
+		const AUTO(count, std::min(size - offset, m_capacity - m_size));
+		std::memcpy(m_buffer + m_size, static_cast<const char *>(data) + offset, count);
+		m_size += count;
+		offset += count;
+	}
+}
+void SnapshotWriter::put(const char *str){
+	put(str, std::strlen(str));
+}
+void SnapshotWriter::put(const std::string &str){
+	put(str.data(), str.size());
+}
+void SnapshotWriter::flush(){
+	std::size_t offset = 0;
+	while(offset < m_size){
+		const ::ssize_t result = ::write(m_fd, m_buffer + offset, m_size - offset);
+		if(result < 0){
+			const int err_code = errno;
+			if(err_code == EINTR){
+				continue;
+			}
+			DEBUG_THROW(SystemException, err_code);
+		}
+		offset += static_cast<std::size_t>(result);
+	}
+	m_bytes_written += m_size;
+	m_size = 0;
+}
+
+namespace {
+	CONSTEXPR const std::size_t WRITER_BUFFER_SIZE = 65536;
+	CONSTEXPR const std::size_t MAX_NAME_LENGTH = 64;
+
+	// 子进程退出之前通过管道发给父进程。子进程异常终止时父进程读到 EOF。
+	struct ChildResult {
+		int err_code;
+		boost::uint64_t bytes_written;
+		std::size_t providers_written;
+		char failed_provider[MAX_NAME_LENGTH + 1];
+		char what[256];
+	};
+
+	struct ChildElement {
+		::pid_t pid;
+		int result_fd;
+		boost::shared_ptr<Promise> promise;
+		std::string directory;
+		boost::uint64_t timestamp;
+	};
+
+	volatile bool g_running = false;
+	Thread g_thread;
+
+	// 只在 SnapshotDaemon::start() 中设置。
+	int g_child_nice = 0;
+
+	Mutex g_mutex;
+	ConditionVariable g_new_child;
+	boost::container::map<std::string, boost::weak_ptr<SnapshotProvider> > g_providers;
+	// 同一时刻只有一个快照子进程。
+	volatile bool g_in_progress = false;
+	boost::container::vector<ChildElement> g_children;
+
+	void copy_string(char (&dst)[MAX_NAME_LENGTH + 1], const std::string &src) NOEXCEPT {
+		const AUTO(len, std::min(src.size(), MAX_NAME_LENGTH));
+		std::memcpy(dst, src.data(), len);
+		dst[len] = 0;
+	}
+	void copy_string(char (&dst)[256], const char *src) NOEXCEPT {
+		::strncpy(dst, src, sizeof(dst) - 1);
+		dst[sizeof(dst) - 1] = 0;
+	}
+
+	// 父进程打开的套接字和文件在子进程中都有副本，如果不关闭，父进程关闭套接字之后对端要等到子进程退出才能收到 FIN。
+	void close_inherited_files(int keep_fd) NOEXCEPT {
+#ifdef SYS_close_range
+		if((::syscall(SYS_close_range, 3u, static_cast<unsigned>(keep_fd - 1), 0u) == 0) &&
+			(::syscall(SYS_close_range, static_cast<unsigned>(keep_fd + 1), ~0u, 0u) == 0))
+		{
+			return;
+		}
+#endif
+		const AUTO(max_fd, ::sysconf(_SC_OPEN_MAX));
+		for(long fd = 3; fd < max_fd; ++fd){
+			if(fd != keep_fd){
+				::close(static_cast<int>(fd));
+			}
+		}
+	}
+	void write_provider(const std::string &directory, const SnapshotProvider &provider, char *buffer, ChildResult &result){
+		const AUTO(path, directory + '/' + provider.get_name());
+		const AUTO(temp_path, path + ".tmp");
+		UniqueFile file;
+		if(!file.reset(::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, static_cast< ::mode_t>(0666)))){
+			DEBUG_THROW(SystemException, errno);
+		}
+		try {
+			SnapshotWriter writer(file.get(), buffer, WRITER_BUFFER_SIZE);
+			(provider.get_callback())(writer);
+			writer.flush();
+			if(::fdatasync(file.get()) != 0){
+				DEBUG_THROW(SystemException, errno);
+			}
+			result.bytes_written += writer.get_bytes_written();
+		} catch(...){
+			::unlink(temp_path.c_str());
+			throw;
+		}
+		file.reset();
+		if(::rename(temp_path.c_str(), path.c_str()) != 0){
+			DEBUG_THROW(SystemException, errno);
+		}
+	}
+	void child_proc(const boost::container::vector<boost::shared_ptr<SnapshotProvider> > &providers, const std::string &directory, int result_fd) NOEXCEPT {
+		// 日志的互斥锁可能被其他线程持有，关闭所有日志，包括 Exception 构造函数中的。
+		Logger::set_mask((boost::uint64_t)-1, 0);
+		::signal(SIGINT, SIG_IGN);
+		::signal(SIGHUP, SIG_IGN);
+		::signal(SIGTERM, SIG_DFL);
+		::prctl(PR_SET_PDEATHSIG, SIGKILL);
+		close_inherited_files(result_fd);
+		if(g_child_nice != 0){
+			::setpriority(PRIO_PROCESS, 0, g_child_nice);
+		}
+
+		ChildResult result = { };
+		try {
+			boost::container::vector<char> buffer(WRITER_BUFFER_SIZE);
+			for(AUTO(it, providers.begin()); it != providers.end(); ++it){
+				copy_string(result.failed_provider, (*it)->get_name());
+				write_provider(directory, **it, buffer.data(), result);
+				++result.providers_written;
+			}
+			result.failed_provider[0] = 0;
+			UniqueFile dir;
+			if(!dir.reset(::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) || (::fsync(dir.get()) != 0)){
+				DEBUG_THROW(SystemException, errno);
+			}
+		} catch(SystemException &e){
+			result.err_code = e.get_code();
+			copy_string(result.what, e.what());
+		} catch(std::exception &e){
+			result.err_code = -1;
+			copy_string(result.what, e.what());
+		} catch(...){
+			result.err_code = -1;
+			copy_string(result.what, "Unknown exception");
+		}
+		// 小于 PIPE_BUF 的写入是原子的。
+		const int err_code = (::write(result_fd, &result, sizeof(result)) == static_cast< ::ssize_t>(sizeof(result))) ? 0 : errno;
+		::_exit(err_code);
+	}
+
+	void complete_child(ChildElement &child){
+		PROFILE_ME;
+
+		ChildResult result;
+		std::size_t bytes_read = 0;
+		while(bytes_read < sizeof(result)){
+			const ::ssize_t count = ::read(child.result_fd, reinterpret_cast<char *>(&result) + bytes_read, sizeof(result) - bytes_read);
+			if(count < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				break;
+			}
+			if(count == 0){
+				break;
+			}
+			bytes_read += static_cast<std::size_t>(count);
+		}
+		::close(child.result_fd);
+
+		const AUTO(duration, saturated_sub(get_fast_mono_clock(), child.timestamp));
+		if(bytes_read < sizeof(result)){
+			LOG_POSEIDON_ERROR("Snapshot process terminated abnormally: pid = ", child.pid, ", directory = ", child.directory);
+			child.promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("Snapshot process terminated abnormally"))), false);
+		} else if(result.err_code != 0){
+			result.failed_provider[MAX_NAME_LENGTH] = 0;
+			result.what[sizeof(result.what) - 1] = 0;
+			LOG_POSEIDON_ERROR("Snapshot failed: pid = ", child.pid, ", directory = ", child.directory, ", provider = ", result.failed_provider,
+				", err_code = ", result.err_code, ", what = ", result.what);
+			if(result.err_code > 0){
+				child.promise->set_exception(STD_MAKE_EXCEPTION_PTR(SystemException(__FILE__, __LINE__, __PRETTY_FUNCTION__, result.err_code)), false);
+			} else {
+				child.promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, SharedNts(result.what))), false);
+			}
+		} else {
+			LOG_POSEIDON_INFO("Snapshot completed: pid = ", child.pid, ", directory = ", child.directory,
+				", providers_written = ", result.providers_written, ", bytes_written = ", result.bytes_written, ", duration = ", duration);
+			child.promise->set_success(false);
+		}
+		atomic_store(g_in_progress, false, ATOMIC_RELEASE);
+	}
+
+	void thread_proc(){
+		PROFILE_ME;
+		LOG_POSEIDON_INFO("Snapshot thread started.");
+
+		for(;;){
+			ChildElement child;
+			{
+				Mutex::UniqueLock lock(g_mutex);
+				while(g_children.empty()){
+					if(!atomic_load(g_running, ATOMIC_CONSUME)){
+						goto done;
+					}
+					g_new_child.timed_wait(lock, 100);
+				}
+				child = STD_MOVE(g_children.front());
+				g_children.erase(g_children.begin());
+			}
+			// 阻塞直到子进程写出结果或者退出。
+			complete_child(child);
+		}
+	done:
+		LOG_POSEIDON_INFO("Snapshot thread stopped.");
+	}
+
+	bool is_valid_name(const char *name) NOEXCEPT {
+		const AUTO(len, std::strlen(name));
+		if((len == 0) || (len > MAX_NAME_LENGTH)){
+			return false;
+		}
+		if(name[0] == '.'){
+			return false;
+		}
+		return std::strchr(name, '/') == NULLPTR;
+	}
+}
+
+void SnapshotDaemon::start(){
+	if(atomic_exchange(g_running, true, ATOMIC_ACQ_REL) != false){
+		LOG_POSEIDON_FATAL("Only one daemon is allowed at the same time.");
+		std::abort();
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting snapshot daemon...");
+
+	g_child_nice = MainConfig::get<int>("snapshot_child_nice", 10);
+	LOG_POSEIDON_DEBUG("Snapshot daemon: child_nice = ", g_child_nice);
+
+	Thread(&thread_proc, sslit("  SN"), sslit("Snapshot")).swap(g_thread);
+
+	LOG_POSEIDON_INFO("Snapshot daemon started.");
+}
+void SnapshotDaemon::stop(){
+	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
+		return;
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping snapshot daemon...");
+
+	// 守护线程先等待正在运行的子进程退出。
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		g_new_child.broadcast();
+	}
+	if(g_thread.joinable()){
+		g_thread.join();
+	}
+	g_providers.clear();
+
+	LOG_POSEIDON_INFO("Snapshot daemon stopped.");
+}
+
+boost::shared_ptr<const SnapshotProvider> SnapshotDaemon::register_provider(const char *name, SnapshotCallback callback){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(is_valid_name(name), Exception, sslit("Invalid snapshot provider name"));
+	AUTO(provider, boost::make_shared<SnapshotProvider>(std::string(name), STD_MOVE_IDN(callback)));
+	const Mutex::UniqueLock lock(g_mutex);
+	AUTO_REF(weak_provider, g_providers[name]);
+	DEBUG_THROW_UNLESS(weak_provider.expired(), Exception, sslit("Duplicate snapshot provider name"));
+	weak_provider = provider;
+	LOG_POSEIDON_DEBUG("Registered snapshot provider: name = ", name);
+	return STD_MOVE_IDN(provider);
+}
+
+boost::shared_ptr<const Promise> SnapshotDaemon::take_snapshot(const std::string &directory){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(atomic_load(g_running, ATOMIC_CONSUME), Exception, sslit("Snapshot daemon is not running"));
+
+	// 在父进程中复制提供者的列表，子进程中不需要加锁。
+	boost::container::vector<boost::shared_ptr<SnapshotProvider> > providers;
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		AUTO(it, g_providers.begin());
+		while(it != g_providers.end()){
+			AUTO(provider, it->second.lock());
+			if(!provider){
+				it = g_providers.erase(it);
+				continue;
+			}
+			providers.push_back(STD_MOVE(provider));
+			++it;
+		}
+	}
+	AUTO(promise, boost::make_shared<Promise>());
+	int fds[2];
+	if(::pipe2(fds, O_CLOEXEC) != 0){
+		const int err_code = errno;
+		LOG_POSEIDON_ERROR("Failed to create pipe: err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	UniqueFile read_end(fds[0]), write_end(fds[1]);
+	ChildElement child = { 0, -1, promise, directory, get_fast_mono_clock() };
+
+	DEBUG_THROW_UNLESS(atomic_exchange(g_in_progress, true, ATOMIC_ACQ_REL) == false, Exception, sslit("Another snapshot is in progress"));
+	const AUTO(fork_begin, get_hi_res_mono_clock());
+	child.pid = ::fork();
+	if(child.pid == 0){
+		child_proc(providers, directory, write_end.get());
+	}
+	const AUTO(fork_duration, get_hi_res_mono_clock() - fork_begin);
+	if(child.pid < 0){
+		const int err_code = errno;
+		atomic_store(g_in_progress, false, ATOMIC_RELEASE);
+		LOG_POSEIDON_ERROR("Failed to fork snapshot process: err_code = ", err_code);
+		DEBUG_THROW(SystemException, err_code);
+	}
+	LOG_POSEIDON_INFO("Forked snapshot process: pid = ", child.pid, ", directory = ", directory, ", providers = ", providers.size(), ", fork_duration = ", fork_duration, " ms");
+	write_end.reset();
+	child.result_fd = read_end.release();
+
+	try {
+		const Mutex::UniqueLock lock(g_mutex);
+		g_children.push_back(child);
+		g_new_child.signal();
+	} catch(...){
+		// 关闭管道之后子进程写出结果时收到 SIGPIPE，不影响已经写入的文件。
+		::close(child.result_fd);
+		atomic_store(g_in_progress, false, ATOMIC_RELEASE);
+		throw;
+	}
+	return STD_MOVE_IDN(promise);
+}
+bool SnapshotDaemon::is_snapshot_in_progress() NOEXCEPT {
+	return atomic_load(g_in_progress, ATOMIC_CONSUME);
+}
+
+}
@@ -0,0 +1,75 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SINGLETONS_SNAPSHOT_DAEMON_HPP_
+#define POSEIDON_SINGLETONS_SNAPSHOT_DAEMON_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include <string>
+#include <cstddef>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+class Promise;
+class SnapshotProvider; // 没有定义的类，当作句柄使用。
+
+// 在快照子进程中把数据写入文件。数据先放入固定大小的缓冲区，满了之后直接调用 write()，不经过 StreamBuffer。
+class SnapshotWriter : NONCOPYABLE {
+private:
+	int m_fd;
+	char *m_buffer;
+	std::size_t m_capacity;
+	std::size_t m_size;
+	boost::uint64_t m_bytes_written;
+
+public:
+	SnapshotWriter(int fd, char *buffer, std::size_t capacity) NOEXCEPT
+		: m_fd(fd), m_buffer(buffer), m_capacity(capacity), m_size(0), m_bytes_written(0)
+	{ }
+
+public:
+	boost::uint64_t get_bytes_written() const NOEXCEPT {
+		return m_bytes_written + m_size;
+	}
+
+	void put(const void *data, std::size_t size);
+	void put(const char *str);
+	void put(const std::string &str);
+	// 写出缓冲区中的数据。出错时抛出 SystemException。
+	void flush();
+};
+
+class SnapshotDaemon {
+private:
+	SnapshotDaemon();
+
+public:
+	typedef boost::function<void (SnapshotWriter &writer)> SnapshotCallback;
+
+	static void start();
+	// 如果快照子进程正在运行，等待它退出。
+	static void stop();
+
+	// 每个提供者的数据保存为快照目录中以 name 命名的文件，name 中不得含有斜杠。
+	// 返回的 shared_ptr 的最后一个副本被销毁时注销该提供者。
+	static boost::shared_ptr<const SnapshotProvider> register_provider(const char *name, SnapshotCallback callback);
+
+	// 在调用线程中 fork() 一个子进程，子进程依次调用所有提供者，把数据写入 directory 中，然后退出。
+	// 父进程只在 fork() 时暂停（复制页表），此后两个进程共享物理页，父进程修改的页在缺页时才被复制。
+	// 子进程中只有调用线程，其他线程（网络、任务、数据库等）都不存在，它们持有的锁也永远不会被释放。因此回调中：
+	//   不得访问其他线程维护的状态，也不得调用框架中的单例、StreamBuffer、PooledAllocator 或者加锁；
+	//   可以使用 malloc/new 和标准库容器，日志被关闭。
+	// 子进程关闭了除标准输入输出以外的所有文件描述符，回调中不得使用已有的套接字或文件。
+	// 每个文件先写入 <name>.tmp，同步之后再重命名，因此失败的快照不会覆盖上一次成功的快照。
+	// 返回的 Promise 在子进程退出时被满足。同一时刻只能有一个快照子进程，否则抛出异常。
+	static boost::shared_ptr<const Promise> take_snapshot(const std::string &directory);
+	static bool is_snapshot_in_progress() NOEXCEPT;
+};
+
+}
+
+#endif
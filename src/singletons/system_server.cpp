@@ -23,8 +23,8 @@ namespace {
 		const boost::shared_ptr<const Http::AuthenticationContext> m_auth_ctx;
 
 	public:
-		SystemSocketServer(const std::string &bind, boost::uint16_t port, const std::string &cert, const std::string &pkey, boost::shared_ptr<const Http::AuthenticationContext> auth_ctx)
-			: TcpServerBase(IpPort(bind.c_str(), port), cert.c_str(), pkey.c_str())
+		SystemSocketServer(const SockAddr &addr, const std::string &cert, const std::string &pkey, boost::shared_ptr<const Http::AuthenticationContext> auth_ctx)
+			: TcpServerBase(addr, cert.c_str(), pkey.c_str())
 			, m_auth_ctx(STD_MOVE(auth_ctx))
 		{ }
 
@@ -65,7 +65,10 @@ void SystemServer::start(){
 		LOG_POSEIDON_INFO("System server is disabled.");
 	} else {
 		const AUTO(auth_ctx, Http::create_authentication_context(relm, auth));
-		const AUTO(server, boost::make_shared<SystemSocketServer>(bind, port, cert, pkey, auth_ctx));
+		// 以 '/' 或 '@' 开头的是 Unix 域套接字，此时忽略端口号。
+		const bool is_unix = (bind[0] == '/') || (bind[0] == '@');
+		const AUTO(addr, is_unix ? SockAddr(bind.c_str()) : SockAddr(IpPort(bind.c_str(), port)));
+		const AUTO(server, boost::make_shared<SystemSocketServer>(addr, cert, pkey, auth_ctx));
 		EpollDaemon::add_socket(server, false);
 		g_server = server;
 	}
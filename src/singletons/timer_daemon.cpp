@@ -4,6 +4,11 @@
 #include "../precompiled.hpp"
 #include "timer_daemon.hpp"
 #include "job_dispatcher.hpp"
+#include "main_config.hpp"
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include "../thread.hpp"
 #include "../log.hpp"
 #include "../atomic.hpp"
@@ -14,22 +19,48 @@
 #include "../job_base.hpp"
 #include "../profiler.hpp"
 #include "../checked_arithmetic.hpp"
+#include "../raii.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 
 typedef TimerDaemon::TimerCallback TimerCallback;
 
 class Timer : NONCOPYABLE {
+public:
+	// 以下成员只用于时间轮，受 g_mutex 保护。
+	struct WheelLink {
+		Timer *prev;
+		Timer *next;
+		Timer **head; // 所在链表的头指针。为空表示不在时间轮中。
+		boost::uint64_t due;
+	};
+
 private:
 	boost::uint64_t m_period;
 	unsigned long m_stamp;
 	TimerCallback m_callback;
 	bool m_low_level;
+	boost::weak_ptr<const void> m_group;
+	boost::uint64_t m_slack;
+
+public:
+	WheelLink link;
+	boost::weak_ptr<Timer> weak_self;
+	// 受 g_mutex 保护。未对齐的下次到期时刻，周期性的定时器以此为基准累加，这样对齐不会造成漂移。
+	boost::uint64_t nominal_due;
 
 public:
-	Timer(boost::uint64_t period, TimerCallback callback, bool low_level)
-		: m_period(period), m_stamp(0), m_callback(STD_MOVE_IDN(callback)), m_low_level(low_level)
-	{ }
+	Timer(boost::uint64_t period, TimerCallback callback, bool low_level, boost::uint64_t slack, boost::weak_ptr<const void> group = boost::weak_ptr<const void>())
+		: m_period(period), m_stamp(0), m_callback(STD_MOVE_IDN(callback)), m_low_level(low_level), m_group(STD_MOVE(group)), m_slack(slack)
+		, nominal_due(0)
+	{
+		link.prev = NULLPTR;
+		link.next = NULLPTR;
+		link.head = NULLPTR;
+		link.due = 0;
+	}
+	~Timer();
 
 public:
 	boost::uint64_t get_period() const {
@@ -44,6 +75,25 @@ public:
 	bool is_low_level() const {
 		return m_low_level;
 	}
+	const boost::weak_ptr<const void> &get_group() const {
+		return m_group;
+	}
+	boost::uint64_t get_slack() const {
+		return m_slack;
+	}
+
+	// 设定未对齐的到期时刻，返回实际的到期时刻，即不早于 nominal 的 slack 的最小整数倍。
+	boost::uint64_t schedule(boost::uint64_t nominal){
+		nominal_due = nominal;
+		if(m_slack <= 1){
+			return nominal;
+		}
+		const AUTO(rem, nominal % m_slack);
+		if(rem == 0){
+			return nominal;
+		}
+		return saturated_add(nominal, m_slack - rem);
+	}
 
 	unsigned long set_period(boost::uint64_t period){
 		if(period != TimerDaemon::PERIOD_NOT_MODIFIED){
@@ -84,6 +134,53 @@ namespace {
 		}
 	};
 
+	// 同一批次中到期的、属于同一个分组的定时器合并为一个任务，按照到期的顺序依次调用。
+	class TimerGroupJob : public JobBase {
+	private:
+		struct Element {
+			boost::weak_ptr<Timer> weak_timer;
+			boost::uint64_t period;
+		};
+
+	private:
+		const boost::weak_ptr<const void> m_group;
+		const boost::uint64_t m_now;
+		boost::container::vector<Element> m_elements;
+
+	public:
+		TimerGroupJob(boost::weak_ptr<const void> group, boost::uint64_t now)
+			: m_group(STD_MOVE(group)), m_now(now)
+		{ }
+
+	public:
+		boost::weak_ptr<const void> get_category() const OVERRIDE {
+			return m_group;
+		}
+		void perform() OVERRIDE {
+			PROFILE_ME;
+
+			for(AUTO(it, m_elements.begin()); it != m_elements.end(); ++it){
+				const AUTO(timer, it->weak_timer.lock());
+				if(!timer){
+					continue;
+				}
+				// 一个定时器抛出的异常不应影响同组的其他定时器。
+				try {
+					timer->get_callback()(timer, m_now, it->period);
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown in grouped timer: what = ", e.what());
+				} catch(...){
+					LOG_POSEIDON_WARNING("Unknown exception thrown in grouped timer.");
+				}
+			}
+		}
+
+		void push(boost::weak_ptr<Timer> weak_timer, boost::uint64_t period){
+			Element elem = { STD_MOVE(weak_timer), period };
+			m_elements.push_back(STD_MOVE(elem));
+		}
+	};
+
 	struct TimerQueueElement {
 		boost::weak_ptr<Timer> timer;
 		boost::uint64_t next;
@@ -94,56 +191,354 @@ namespace {
 		return lhs.next > rhs.next;
 	}
 
-	volatile bool g_running = false;
-	Thread g_thread;
+	struct DueTimer {
+		boost::shared_ptr<Timer> timer;
+		boost::uint64_t period;
+	};
 
-	Mutex g_mutex;
-	ConditionVariable g_new_timer;
-	boost::container::vector<TimerQueueElement> g_timers;
+	// 每次加锁最多取出的到期定时器数。
+	CONSTEXPR const std::size_t PUMP_BATCH_SIZE = 64;
 
-	bool pump_one_element() NOEXCEPT {
-		PROFILE_ME;
+	// 分层时间轮，依次为毫秒、秒、分钟和小时四级。每个槽是一个侵入式的双向链表，插入和删除都是 O(1) 的。
+	// 超出最高一级范围的定时器放在溢出链表中，最高一级每转一圈重新放置一次。
+	// 高一级的槽在其起始时刻被逐个下放到低一级中，因此定时器总是在它的到期时刻从毫秒级的槽中取出。
+	// 调用所有成员函数时须持有 g_mutex。
+	class TimerWheel : NONCOPYABLE {
+	private:
+		enum {
+			LEVEL_COUNT = 4,
+		};
 
-		const AUTO(now, get_fast_mono_clock());
+		static const boost::uint64_t s_units[LEVEL_COUNT];
+		static const std::size_t s_slot_counts[LEVEL_COUNT];
 
-		boost::shared_ptr<Timer> timer;
-		boost::uint64_t period;
+	private:
+		boost::uint64_t m_cursor; // 下一个要处理的毫秒。
+		Timer *m_ms_slots[1000];
+		Timer *m_second_slots[60];
+		Timer *m_minute_slots[60];
+		Timer *m_hour_slots[192];
+		Timer *m_overflow;
+		std::size_t m_size;
+
+	public:
+		TimerWheel()
+			: m_cursor(0), m_overflow(NULLPTR), m_size(0)
 		{
-			const Mutex::UniqueLock lock(g_mutex);
-		_pick_next:
-			if(g_timers.empty()){
-				return false;
+			std::fill(m_ms_slots, m_ms_slots + COUNT_OF(m_ms_slots), static_cast<Timer *>(NULLPTR));
+			std::fill(m_second_slots, m_second_slots + COUNT_OF(m_second_slots), static_cast<Timer *>(NULLPTR));
+			std::fill(m_minute_slots, m_minute_slots + COUNT_OF(m_minute_slots), static_cast<Timer *>(NULLPTR));
+			std::fill(m_hour_slots, m_hour_slots + COUNT_OF(m_hour_slots), static_cast<Timer *>(NULLPTR));
+		}
+
+	private:
+		Timer **get_slots(unsigned level){
+			switch(level){
+			case 0:
+				return m_ms_slots;
+			case 1:
+				return m_second_slots;
+			case 2:
+				return m_minute_slots;
+			default:
+				return m_hour_slots;
+			}
+		}
+
+		static void push_front(Timer **head, Timer *timer) NOEXCEPT {
+			timer->link.prev = NULLPTR;
+			timer->link.next = *head;
+			timer->link.head = head;
+			if(*head){
+				(*head)->link.prev = timer;
+			}
+			*head = timer;
+		}
+		void place(Timer *timer) NOEXCEPT {
+			const AUTO(due, std::max(timer->link.due, m_cursor));
+			const AUTO(delta, due - m_cursor);
+			for(unsigned level = 0; level < LEVEL_COUNT; ++level){
+				const AUTO(unit, s_units[level]);
+				const AUTO(slot_count, s_slot_counts[level]);
+				// 较高的级别只接收不会落在下一个单位之内的定时器，以免错过本级槽的起始时刻。
+				if(delta < unit * slot_count){
+					push_front(get_slots(level) + (due / unit) % slot_count, timer);
+					return;
+				}
+			}
+			push_front(&m_overflow, timer);
+		}
+		// 把一条链表中的定时器重新放置到较低的级别中。
+		void cascade(Timer **head) NOEXCEPT {
+			Timer *timer = *head;
+			*head = NULLPTR;
+			while(timer){
+				Timer *const next = timer->link.next;
+				place(timer);
+				timer = next;
+			}
+		}
+
+	public:
+		std::size_t size() const NOEXCEPT {
+			return m_size;
+		}
+
+		void reset(boost::uint64_t now) NOEXCEPT {
+			assert(m_size == 0);
+			m_cursor = now;
+		}
+		void insert(Timer *timer, boost::uint64_t due) NOEXCEPT {
+			if(timer->link.head){
+				erase(timer);
+			}
+			timer->link.due = due;
+			place(timer);
+			++m_size;
+		}
+		void erase(Timer *timer) NOEXCEPT {
+			if(!timer->link.head){
+				return;
+			}
+			if(timer->link.prev){
+				timer->link.prev->link.next = timer->link.next;
+			} else {
+				*(timer->link.head) = timer->link.next;
+			}
+			if(timer->link.next){
+				timer->link.next->link.prev = timer->link.prev;
+			}
+			timer->link.prev = NULLPTR;
+			timer->link.next = NULLPTR;
+			timer->link.head = NULLPTR;
+			--m_size;
+		}
+		void clear() NOEXCEPT {
+			for(unsigned level = 0; level < LEVEL_COUNT; ++level){
+				for(std::size_t i = 0; i < s_slot_counts[level]; ++i){
+					while(get_slots(level)[i]){
+						erase(get_slots(level)[i]);
+					}
+				}
+			}
+			while(m_overflow){
+				erase(m_overflow);
+			}
+		}
+
+		// 处理到 now 为止的所有毫秒，取出到期的定时器。周期性的定时器被重新放入时间轮。
+		// 一个毫秒中的定时器总是一次取完，因此返回的数量可能超过 max_count。
+		void collect_expired(boost::container::vector<DueTimer> &due_timers, boost::uint64_t now, std::size_t max_count){
+			if(m_size == 0){
+				m_cursor = std::max(m_cursor, now + 1);
+				return;
+			}
+			while((m_cursor <= now) && (due_timers.size() < max_count)){
+				// 从高到低下放，这样一个定时器可以在同一个毫秒中连续下放多级。
+				if(m_cursor % (s_units[LEVEL_COUNT - 1] * s_slot_counts[LEVEL_COUNT - 1]) == 0){
+					cascade(&m_overflow);
+				}
+				for(unsigned level = LEVEL_COUNT - 1; level > 0; --level){
+					if(m_cursor % s_units[level] == 0){
+						cascade(get_slots(level) + (m_cursor / s_units[level]) % s_slot_counts[level]);
+					}
+				}
+				AUTO_REF(head, m_ms_slots[m_cursor % COUNT_OF(m_ms_slots)]);
+				while(head){
+					Timer *const timer = head;
+					erase(timer);
+					AUTO(shared, timer->weak_self.lock());
+					if(!shared){
+						// 析构函数正在等待 g_mutex，什么都不需要做。
+						continue;
+					}
+					const AUTO(period, shared->get_period());
+					if(period != 0){
+						insert(timer, timer->schedule(saturated_add(timer->nominal_due, period)));
+					}
+					DueTimer elem = { STD_MOVE(shared), period };
+					due_timers.push_back(STD_MOVE(elem));
+				}
+				++m_cursor;
+			}
+		}
+		// 返回下一次需要处理时间轮的时刻：毫秒级的槽中最早的定时器，或者较高级别中最早的非空槽的下放时刻。
+		// 时间轮为空时返回 UINT64_MAX。
+		boost::uint64_t get_next_due() const NOEXCEPT {
+			boost::uint64_t next = UINT64_MAX;
+			if(m_size == 0){
+				return next;
+			}
+			for(unsigned level = 0; level < LEVEL_COUNT; ++level){
+				const AUTO(unit, s_units[level]);
+				const AUTO(slot_count, s_slot_counts[level]);
+				const AUTO(slots, const_cast<TimerWheel *>(this)->get_slots(level));
+				// 按照下一次被处理的先后顺序检查每个槽。
+				const boost::uint64_t first = (m_cursor + unit - 1) / unit;
+				for(std::size_t i = 0; i < slot_count; ++i){
+					if(slots[(first + i) % slot_count]){
+						next = std::min(next, (first + i) * unit);
+						break;
+					}
+				}
 			}
-			if(now < g_timers.front().next){
-				return false;
+			if(m_overflow){
+				const AUTO(span, s_units[LEVEL_COUNT - 1] * s_slot_counts[LEVEL_COUNT - 1]);
+				next = std::min(next, (m_cursor + span - 1) / span * span);
 			}
+			return next;
+		}
+	};
+
+	const boost::uint64_t TimerWheel::s_units[LEVEL_COUNT] = { 1, 1000, 60000, MS_PER_HOUR };
+	const std::size_t TimerWheel::s_slot_counts[LEVEL_COUNT] = { 1000, 60, 60, 192 };
+
+	volatile bool g_running = false;
+	Thread g_thread;
+
+	Mutex g_mutex;
+	ConditionVariable g_new_timer;
+	// 只在 TimerDaemon::start() 中设置。有效时定时器线程阻塞在这两个文件上，空闲时不会被唤醒。
+	UniqueFile g_timer_fd;
+	UniqueFile g_event_fd;
+	// 受 g_mutex 保护。timerfd 被设定的到期时刻，更早的定时器需要唤醒定时器线程。
+	boost::uint64_t g_armed_time = UINT64_MAX;
+	// 只在 TimerDaemon::start() 中设置。为 false 时使用二叉堆，唤醒时间精确到下一个到期的定时器。
+	bool g_wheel_enabled = true;
+	boost::container::vector<TimerQueueElement> g_timers;
+	TimerWheel g_wheel;
+
+	// 调用者必须持有 g_mutex。
+	void collect_expired_from_heap(boost::container::vector<DueTimer> &due_timers, boost::uint64_t now){
+		while((due_timers.size() < PUMP_BATCH_SIZE) && !g_timers.empty() && (g_timers.front().next <= now)){
 			std::pop_heap(g_timers.begin(), g_timers.end());
-			timer = g_timers.back().timer.lock();
+			AUTO(timer, g_timers.back().timer.lock());
 			if(!timer || (timer->get_stamp() != g_timers.back().stamp)){
 				g_timers.pop_back();
-				goto _pick_next;
+				continue;
 			}
-			period = timer->get_period();
+			const AUTO(period, timer->get_period());
 			if(period == 0){
 				g_timers.pop_back();
 			} else {
-				g_timers.back().next = saturated_add(g_timers.back().next, period);
+				g_timers.back().next = timer->schedule(saturated_add(timer->nominal_due, period));
 				std::push_heap(g_timers.begin(), g_timers.end());
 			}
+			DueTimer elem = { STD_MOVE(timer), period };
+			due_timers.push_back(STD_MOVE(elem));
+		}
+	}
+	// 以下函数调用时须持有 g_mutex。
+	boost::uint64_t get_next_due(){
+		if(g_wheel_enabled){
+			return g_wheel.get_next_due();
 		}
+		if(g_timers.empty()){
+			return UINT64_MAX;
+		}
+		// 可能是已经失效的元素，那样只会多唤醒一次。
+		return g_timers.front().next;
+	}
+	void wake_timer_thread(boost::uint64_t first){
+		if(!g_event_fd){
+			g_new_timer.signal();
+			return;
+		}
+		if(first >= g_armed_time){
+			return;
+		}
+		g_armed_time = first;
+		const boost::uint64_t one = 1;
+		if(::write(g_event_fd.get(), &one, sizeof(one)) < 0){
+			const int err_code = errno;
+			if(err_code != EAGAIN){
+				LOG_POSEIDON_ERROR("Failed to write eventfd: err_code = ", err_code);
+			}
+		}
+	}
+	void arm_timer_fd(boost::uint64_t due){
+		g_armed_time = due;
+		::itimerspec spec = { };
+		if(due != UINT64_MAX){
+			// 到期时刻为零会解除定时，而过去的时刻会立即触发。
+			due = std::max<boost::uint64_t>(due, 1);
+			spec.it_value.tv_sec = static_cast< ::time_t>(due / 1000);
+			spec.it_value.tv_nsec = static_cast<long>(due % 1000 * 1000000);
+		}
+		if(::timerfd_settime(g_timer_fd.get(), TFD_TIMER_ABSTIME, &spec, NULLPTR) != 0){
+			const int err_code = errno;
+			LOG_POSEIDON_FATAL("::timerfd_settime() failed: err_code = ", err_code);
+			std::abort();
+		}
+	}
+
+	// 返回按照 slack 对齐之后的到期时刻。
+	boost::uint64_t insert_timer(const boost::shared_ptr<Timer> &timer, boost::uint64_t first){
+		if(g_wheel_enabled){
+			if(g_wheel.size() == 0){
+				g_wheel.reset(get_fast_mono_clock());
+			}
+			timer->weak_self = timer;
+			const AUTO(due, timer->schedule(first));
+			g_wheel.insert(timer.get(), due);
+			return due;
+		}
+		g_timers.emplace_back(); // This may throw std::bad_alloc.
+		const AUTO(due, timer->schedule(first));
+		TimerQueueElement elem = { timer, due, timer->get_stamp() };
+		g_timers.back() = STD_MOVE_IDN(elem); // This does not throw an exception.
+		std::push_heap(g_timers.begin(), g_timers.end());
+		return due;
+	}
+
+	// 到期的定时器任务先收集起来，然后一次投递。
+	bool pump_expired_timers(boost::container::vector<boost::shared_ptr<JobBase> > &jobs) NOEXCEPT {
+		PROFILE_ME;
+
+		const AUTO(now, get_fast_mono_clock());
 
+		// Timer 的析构函数会锁定 g_mutex，因此这里的 shared_ptr 须在锁外释放。
+		boost::container::vector<DueTimer> due_timers;
 		try {
-			if(timer->is_low_level()){
-				LOG_POSEIDON_TRACE("Dispatching low level timer: timer = ", timer);
-				timer->get_callback()(timer, now, timer->get_period());
+			const Mutex::UniqueLock lock(g_mutex);
+			if(g_wheel_enabled){
+				g_wheel.collect_expired(due_timers, now, PUMP_BATCH_SIZE);
 			} else {
-				LOG_POSEIDON_TRACE("Preparing a timer job for dispatching: timer = ", timer);
-				JobDispatcher::enqueue(boost::make_shared<TimerJob>(timer, now, period), VAL_INIT);
+				collect_expired_from_heap(due_timers, now);
 			}
 		} catch(std::exception &e){
-			LOG_POSEIDON_WARNING("std::exception thrown while dispatching timer job, what = ", e.what());
-		} catch(...){
-			LOG_POSEIDON_WARNING("Unknown exception thrown while dispatching timer job.");
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		}
+		if(due_timers.empty()){
+			return false;
+		}
+
+		// 每个分组在本批次中只生成一个任务。
+		boost::container::flat_map<boost::weak_ptr<const void>, boost::shared_ptr<TimerGroupJob> > group_jobs;
+		for(AUTO(it, due_timers.begin()); it != due_timers.end(); ++it){
+			const AUTO_REF(timer, it->timer);
+			try {
+				const AUTO_REF(group, timer->get_group());
+				if(timer->is_low_level()){
+					LOG_POSEIDON_TRACE("Dispatching low level timer: timer = ", timer);
+					timer->get_callback()(timer, now, timer->get_period());
+				} else if(!group.expired()){
+					AUTO_REF(job, group_jobs[group]);
+					if(!job){
+						LOG_POSEIDON_TRACE("Preparing a timer group job for dispatching: group = ", group.lock());
+						job = boost::allocate_shared<TimerGroupJob>(PooledAllocator<TimerGroupJob>(), group, now);
+						jobs.push_back(job);
+					}
+					job->push(timer, it->period);
+				} else {
+					LOG_POSEIDON_TRACE("Preparing a timer job for dispatching: timer = ", timer);
+					jobs.push_back(boost::allocate_shared<TimerJob>(PooledAllocator<TimerJob>(), timer, now, it->period));
+				}
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("std::exception thrown while dispatching timer job, what = ", e.what());
+			} catch(...){
+				LOG_POSEIDON_WARNING("Unknown exception thrown while dispatching timer job.");
+			}
 		}
 		return true;
 	}
@@ -152,18 +547,62 @@ namespace {
 		PROFILE_ME;
 		LOG_POSEIDON_INFO("Timer daemon started.");
 
+		boost::container::vector<boost::shared_ptr<JobBase> > jobs;
 		unsigned timeout = 0;
 		for(;;){
 			bool busy;
 			do {
-				busy = pump_one_element();
+				busy = pump_expired_timers(jobs);
 				timeout = std::min(timeout * 2u + 1u, !busy * 100u);
+				if(jobs.empty() || (busy && (jobs.size() < PUMP_BATCH_SIZE))){
+					continue;
+				}
+				try {
+					JobDispatcher::enqueue_batch(jobs, VAL_INIT);
+				} catch(std::exception &e){
+					LOG_POSEIDON_WARNING("std::exception thrown while dispatching timer jobs, what = ", e.what());
+				} catch(...){
+					LOG_POSEIDON_WARNING("Unknown exception thrown while dispatching timer jobs.");
+				}
+				jobs.clear();
 			} while(busy);
 
+			if(g_timer_fd){
+				{
+					const Mutex::UniqueLock lock(g_mutex);
+					if(!atomic_load(g_running, ATOMIC_CONSUME)){
+						break;
+					}
+					arm_timer_fd(get_next_due());
+				}
+				// 在这之后注册的更早的定时器会写入 eventfd。
+				::pollfd fds[2] = { };
+				fds[0].fd = g_timer_fd.get();
+				fds[0].events = POLLIN;
+				fds[1].fd = g_event_fd.get();
+				fds[1].events = POLLIN;
+				if(::poll(fds, 2, -1) < 0){
+					const int err_code = errno;
+					if(err_code != EINTR){
+						LOG_POSEIDON_ERROR("::poll() failed: err_code = ", err_code);
+					}
+				}
+				boost::uint64_t count;
+				for(unsigned i = 0; i < 2; ++i){
+					if(fds[i].revents & POLLIN){
+						::read(fds[i].fd, &count, sizeof(count));
+					}
+				}
+				continue;
+			}
+
 			Mutex::UniqueLock lock(g_mutex);
 			if(!atomic_load(g_running, ATOMIC_CONSUME)){
 				break;
 			}
+			// 不要睡过下一个到期的定时器。
+			const AUTO(now, get_fast_mono_clock());
+			timeout = static_cast<unsigned>(std::min<boost::uint64_t>(saturated_sub(get_next_due(), now), timeout));
 			g_new_timer.timed_wait(lock, timeout);
 		}
 
@@ -171,6 +610,15 @@ namespace {
 	}
 }
 
+Timer::~Timer(){
+	if(!g_wheel_enabled){
+		return;
+	}
+	// 立即从时间轮中删除，而不是等到到期时才发现已经失效。
+	const Mutex::UniqueLock lock(g_mutex);
+	g_wheel.erase(this);
+}
+
 void TimerDaemon::start(){
 	if(atomic_exchange(g_running, true, ATOMIC_ACQ_REL) != false){
 		LOG_POSEIDON_FATAL("Only one daemon is allowed at the same time.");
@@ -178,6 +626,30 @@ void TimerDaemon::start(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting timer daemon...");
 
+	const AUTO(queue, MainConfig::get<std::string>("timer_queue", "wheel"));
+	if(queue == "heap"){
+		g_wheel_enabled = false;
+	} else {
+		if(queue != "wheel"){
+			LOG_POSEIDON_WARNING("Unknown timer queue: ", queue, ". Falling back to wheel.");
+		}
+		g_wheel_enabled = true;
+	}
+	LOG_POSEIDON_DEBUG("Timer queue: ", g_wheel_enabled ? "wheel" : "heap");
+
+	const AUTO(wakeup, MainConfig::get<std::string>("timer_wakeup", "timerfd"));
+	if(wakeup == "timerfd"){
+		if(!g_timer_fd.reset(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) || !g_event_fd.reset(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))){
+			const int err_code = errno;
+			LOG_POSEIDON_WARNING("Failed to create timerfd or eventfd: err_code = ", err_code, ". Falling back to condvar.");
+			g_timer_fd.reset();
+			g_event_fd.reset();
+		}
+	} else if(wakeup != "condvar"){
+		LOG_POSEIDON_WARNING("Unknown timer wakeup: ", wakeup, ". Falling back to condvar.");
+	}
+	LOG_POSEIDON_DEBUG("Timer wakeup: ", g_timer_fd ? "timerfd" : "condvar");
+
 	Thread(&thread_proc, sslit("  T "), sslit("Timer")).swap(g_thread);
 }
 void TimerDaemon::stop(){
@@ -186,29 +658,52 @@ void TimerDaemon::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping timer daemon...");
 
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		g_armed_time = UINT64_MAX;
+		wake_timer_thread(0);
+	}
 	if(g_thread.joinable()){
 		g_thread.join();
 	}
+	const Mutex::UniqueLock lock(g_mutex);
 	g_timers.clear();
+	g_wheel.clear();
+	g_timer_fd.reset();
+	g_event_fd.reset();
+	g_armed_time = UINT64_MAX;
 }
 
-boost::shared_ptr<Timer> TimerDaemon::register_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback){
+boost::shared_ptr<Timer> TimerDaemon::register_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack){
 	PROFILE_ME;
 
-	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), false));
+	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), false, slack));
 	{
 		const Mutex::UniqueLock lock(g_mutex);
-		TimerQueueElement elem = { timer, first, timer->get_stamp() };
-		g_timers.push_back(STD_MOVE(elem));
-		std::push_heap(g_timers.begin(), g_timers.end());
-		g_new_timer.signal();
+		wake_timer_thread(insert_timer(timer, first));
 	}
 	LOG_POSEIDON_DEBUG("Created a timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
 	return timer;
 }
-boost::shared_ptr<Timer> TimerDaemon::register_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback){
+boost::shared_ptr<Timer> TimerDaemon::register_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack){
 	const AUTO(now, get_fast_mono_clock());
-	return register_absolute_timer(saturated_add(now, delta_first), period, STD_MOVE(callback));
+	return register_absolute_timer(saturated_add(now, delta_first), period, STD_MOVE(callback), slack);
+}
+
+boost::shared_ptr<Timer> TimerDaemon::register_grouped_absolute_timer(const boost::weak_ptr<const void> &group, boost::uint64_t first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack){
+	PROFILE_ME;
+
+	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), false, slack, group));
+	{
+		const Mutex::UniqueLock lock(g_mutex);
+		wake_timer_thread(insert_timer(timer, first));
+	}
+	LOG_POSEIDON_DEBUG("Created a grouped timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
+	return timer;
+}
+boost::shared_ptr<Timer> TimerDaemon::register_grouped_timer(const boost::weak_ptr<const void> &group, boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack){
+	const AUTO(now, get_fast_mono_clock());
+	return register_grouped_absolute_timer(group, saturated_add(now, delta_first), period, STD_MOVE(callback), slack);
 }
 
 boost::shared_ptr<Timer> TimerDaemon::register_hourly_timer(unsigned minute, unsigned second, TimerCallback callback, bool utc){
@@ -228,38 +723,44 @@ boost::shared_ptr<Timer> TimerDaemon::register_weekly_timer(unsigned day_of_week
 	return register_timer(MS_PER_WEEK - delta % MS_PER_WEEK, MS_PER_WEEK, STD_MOVE(callback));
 }
 
-boost::shared_ptr<Timer> TimerDaemon::register_low_level_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback){
+boost::shared_ptr<Timer> TimerDaemon::register_low_level_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack){
 	PROFILE_ME;
 
-	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), true));
+	AUTO(timer, boost::make_shared<Timer>(period, STD_MOVE_IDN(callback), true, slack));
 	{
 		const Mutex::UniqueLock lock(g_mutex);
-		TimerQueueElement elem = { timer, first, timer->get_stamp() };
-		g_timers.push_back(STD_MOVE(elem));
-		std::push_heap(g_timers.begin(), g_timers.end());
-		g_new_timer.signal();
+		wake_timer_thread(insert_timer(timer, first));
 	}
 	LOG_POSEIDON_DEBUG("Created a low level timer which will be triggered ", saturated_sub(first, get_fast_mono_clock()), " microsecond(s) later and has a period of ", timer->get_period(), " microsecond(s).");
 	return timer;
 }
-boost::shared_ptr<Timer> TimerDaemon::register_low_level_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback){
+boost::shared_ptr<Timer> TimerDaemon::register_low_level_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack){
 	const AUTO(now, get_fast_mono_clock());
-	return register_low_level_absolute_timer(saturated_add(now, delta_first), period, STD_MOVE(callback));
+	return register_low_level_absolute_timer(saturated_add(now, delta_first), period, STD_MOVE(callback), slack);
 }
 
 void TimerDaemon::set_absolute_time(const boost::shared_ptr<Timer> &timer, boost::uint64_t first, boost::uint64_t period){
 	PROFILE_ME;
 
 	const Mutex::UniqueLock lock(g_mutex);
-	g_timers.emplace_back(); // This may throw std::bad_alloc.
-	TimerQueueElement elem = { timer, first, timer->set_period(period) }; // This throws no exception.
-	g_timers.back() = STD_MOVE_IDN(elem); // This does not throw an exception, either.
-	std::push_heap(g_timers.begin(), g_timers.end());
-	g_new_timer.signal();
+	if(!g_wheel_enabled){
+		g_timers.reserve(g_timers.size() + 1); // This may throw std::bad_alloc.
+	}
+	// 在二叉堆中，旧的元素因为 stamp 不匹配而被忽略；在时间轮中，定时器被直接移动。
+	timer->set_period(period);
+	wake_timer_thread(insert_timer(timer, first));
 }
 void TimerDaemon::set_time(const boost::shared_ptr<Timer> &timer, boost::uint64_t delta_first, boost::uint64_t period){
 	const AUTO(now, get_fast_mono_clock());
 	return set_absolute_time(timer, saturated_add(now, delta_first), period);
 }
 
+std::size_t TimerDaemon::get_timer_count(){
+	const Mutex::UniqueLock lock(g_mutex);
+	if(g_wheel_enabled){
+		return g_wheel.size();
+	}
+	return g_timers.size();
+}
+
 }
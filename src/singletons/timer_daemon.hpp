@@ -5,6 +5,7 @@
 #define POSEIDON_SINGLETONS_TIMER_DAEMON_HPP_
 
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/cstdint.hpp>
 
@@ -30,19 +31,28 @@ public:
 	// 返回的 shared_ptr 是该计时器的唯一持有者。
 
 	// first 用 get_fast_mono_clock() 作参考，period 填零表示只触发一次。
-	static boost::shared_ptr<Timer> register_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback);
-	static boost::shared_ptr<Timer> register_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback);
+	// slack 非零时，每次到期的时刻被推迟到 slack 的整数倍，即至多晚 slack - 1 毫秒触发。slack 相同的定时器会在同一时刻触发。
+	static boost::shared_ptr<Timer> register_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack = 0);
+	static boost::shared_ptr<Timer> register_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack = 0);
+
+	// 同一时刻到期的、group 相同的定时器被合并为一个任务，以 group 作为任务的类别依次调用。
+	// group 失效之后这些定时器按普通定时器处理。
+	static boost::shared_ptr<Timer> register_grouped_absolute_timer(const boost::weak_ptr<const void> &group, boost::uint64_t first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack = 0);
+	static boost::shared_ptr<Timer> register_grouped_timer(const boost::weak_ptr<const void> &group, boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack = 0);
 
 	static boost::shared_ptr<Timer> register_hourly_timer(unsigned minute, unsigned second, TimerCallback callback, bool utc);
 	static boost::shared_ptr<Timer> register_daily_timer(unsigned hour, unsigned minute, unsigned second, TimerCallback callback, bool utc);
 	// 0 = 星期日
 	static boost::shared_ptr<Timer> register_weekly_timer(unsigned day_of_week, unsigned hour, unsigned minute, unsigned second, TimerCallback callback, bool utc);
 
-	static boost::shared_ptr<Timer> register_low_level_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback);
-	static boost::shared_ptr<Timer> register_low_level_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback);
+	static boost::shared_ptr<Timer> register_low_level_absolute_timer(boost::uint64_t first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack = 0);
+	static boost::shared_ptr<Timer> register_low_level_timer(boost::uint64_t delta_first, boost::uint64_t period, TimerCallback callback, boost::uint64_t slack = 0);
 
 	static void set_absolute_time(const boost::shared_ptr<Timer> &item, boost::uint64_t first, boost::uint64_t period = PERIOD_NOT_MODIFIED);
 	static void set_time(const boost::shared_ptr<Timer> &item, boost::uint64_t delta_first, boost::uint64_t period = PERIOD_NOT_MODIFIED);
+
+	// 等待触发的定时器数。不使用时间轮时可能包含已经失效的元素。
+	static std::size_t get_timer_count();
 };
 
 }
@@ -0,0 +1,191 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "trace_exporter.hpp"
+#include "main_config.hpp"
+#include "timer_daemon.hpp"
+#include "filesystem_daemon.hpp"
+#include "../stream_buffer.hpp"
+#include "../mutex.hpp"
+#include "../atomic.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+
+namespace Poseidon {
+
+typedef TraceExporter::SpanElement SpanElement;
+
+namespace {
+	volatile bool g_running = false;
+
+	// 以下参数只在 start() 中设置，之后只读。
+	// 采样率乘以 2^53，与 trace id 的低 53 位比较。
+	volatile boost::uint64_t g_sample_threshold = 0;
+	std::string g_export_path;
+	std::string g_service_name;
+	std::size_t g_max_pending = 0;
+
+	boost::shared_ptr<Timer> g_timer;
+
+	Mutex g_mutex;
+	boost::container::vector<SpanElement> g_pending;
+	unsigned long long g_recorded = 0;
+	unsigned long long g_dropped = 0;
+	unsigned long long g_exported = 0;
+
+	void put_json_string(StreamBuffer &buffer, const char *str, std::size_t len){
+		buffer.put('\"');
+		for(std::size_t i = 0; i < len; ++i){
+			const unsigned ch = static_cast<unsigned char>(str[i]);
+			if((ch == '\"') || (ch == '\\')){
+				buffer.put('\\');
+				buffer.put(static_cast<int>(ch));
+			} else if((ch < 0x20) || (ch == 0x7F)){
+				char temp[8];
+				buffer.put(temp, (unsigned)std::sprintf(temp, "\\u%04X", ch));
+			} else {
+				buffer.put(static_cast<int>(ch));
+			}
+		}
+		buffer.put('\"');
+	}
+	void put_json_string(StreamBuffer &buffer, const std::string &str){
+		put_json_string(buffer, str.data(), str.size());
+	}
+	void put_attribute(StreamBuffer &buffer, const std::string &key, const std::string &value){
+		buffer.put("{\"key\":");
+		put_json_string(buffer, key);
+		buffer.put(",\"value\":{\"stringValue\":");
+		put_json_string(buffer, value);
+		buffer.put("}}");
+	}
+
+	// 输出一个 ExportTraceServiceRequest。
+	// 按照 proto3 的 JSON 映射，id 是十六进制字符串，64 位整数写成字符串，否则会被当作 double 丢失精度。
+	void write_request(StreamBuffer &buffer, const boost::container::vector<SpanElement> &spans){
+		char str[256];
+		buffer.put("{\"resourceSpans\":[{\"resource\":{\"attributes\":[");
+		put_attribute(buffer, "service.name", g_service_name);
+		buffer.put("]},\"scopeSpans\":[{\"scope\":{\"name\":\"poseidon\"},\"spans\":[");
+		for(AUTO(it, spans.begin()); it != spans.end(); ++it){
+			if(it != spans.begin()){
+				buffer.put(',');
+			}
+			buffer.put(str, (unsigned)::snprintf(str, sizeof(str), "{\"traceId\":\"%016llx%016llx\",\"spanId\":\"%016llx\"",
+				(unsigned long long)it->context.trace_id_high, (unsigned long long)it->context.trace_id_low, (unsigned long long)it->context.span_id));
+			if(it->parent_span_id != 0){
+				buffer.put(str, (unsigned)::snprintf(str, sizeof(str), ",\"parentSpanId\":\"%016llx\"", (unsigned long long)it->parent_span_id));
+			}
+			buffer.put(",\"name\":");
+			put_json_string(buffer, it->name, std::strlen(it->name));
+			buffer.put(str, (unsigned)::snprintf(str, sizeof(str), ",\"kind\":%d,\"startTimeUnixNano\":\"%llu\",\"endTimeUnixNano\":\"%llu\",\"attributes\":[",
+				it->kind, (unsigned long long)it->start_time, (unsigned long long)it->end_time));
+			for(AUTO(attr_it, it->attributes.begin()); attr_it != it->attributes.end(); ++attr_it){
+				if(attr_it != it->attributes.begin()){
+					buffer.put(',');
+				}
+				put_attribute(buffer, attr_it->first, attr_it->second);
+			}
+			buffer.put(']');
+			if(it->error){
+				buffer.put(",\"status\":{\"code\":2}"); // STATUS_CODE_ERROR
+			}
+			buffer.put('}');
+		}
+		buffer.put("]}]}]}\n");
+	}
+
+	// 取出所有等待写出的 span，在锁外序列化。
+	bool take_pending(StreamBuffer &buffer){
+		boost::container::vector<SpanElement> spans;
+		{
+			const Mutex::UniqueLock lock(g_mutex);
+			if(g_pending.empty()){
+				return false;
+			}
+			spans.swap(g_pending);
+			g_exported += spans.size();
+		}
+		write_request(buffer, spans);
+		return true;
+	}
+
+	void timer_proc(){
+		PROFILE_ME;
+
+		StreamBuffer buffer;
+		if(!take_pending(buffer)){
+			return;
+		}
+		FileSystemDaemon::enqueue_for_saving(g_export_path, STD_MOVE(buffer), FileSystemDaemon::OFFSET_APPEND);
+	}
+}
+
+void TraceExporter::start(){
+	if(atomic_exchange(g_running, true, ATOMIC_ACQ_REL) != false){
+		LOG_POSEIDON_FATAL("Only one daemon is allowed at the same time.");
+		std::abort();
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Starting trace exporter...");
+
+	g_export_path = MainConfig::get<std::string>("trace_export_path");
+	g_service_name = MainConfig::get<std::string>("trace_service_name", "poseidon");
+	g_max_pending = MainConfig::get<std::size_t>("trace_export_max_pending", 65536);
+	if(g_export_path.empty()){
+		LOG_POSEIDON_INFO("Trace exporter is disabled because `trace_export_path` is not set.");
+		return;
+	}
+	const AUTO(interval, std::max<boost::uint64_t>(MainConfig::get<boost::uint64_t>("trace_export_interval", 1000), 1));
+	g_timer = TimerDaemon::register_low_level_timer(interval, interval, boost::bind(&timer_proc));
+	const AUTO(sample_rate, std::min(std::max(MainConfig::get<double>("trace_sample_rate", 0.01), 0.0), 1.0));
+	atomic_store(g_sample_threshold, static_cast<boost::uint64_t>(sample_rate * 9007199254740992.0), ATOMIC_RELEASE);
+
+	LOG_POSEIDON_INFO("Trace exporter started: export_path = ", g_export_path, ", sample_rate = ", sample_rate);
+}
+void TraceExporter::stop(){
+	if(atomic_exchange(g_running, false, ATOMIC_ACQ_REL) == false){
+		return;
+	}
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping trace exporter...");
+
+	atomic_store(g_sample_threshold, 0, ATOMIC_RELEASE);
+	g_timer.reset();
+	StreamBuffer buffer;
+	if(take_pending(buffer)){
+		try {
+			FileSystemDaemon::save(g_export_path, STD_MOVE(buffer), FileSystemDaemon::OFFSET_APPEND);
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+		}
+	}
+
+	LOG_POSEIDON_INFO("Trace exporter stopped.");
+}
+
+double TraceExporter::get_sample_rate() NOEXCEPT {
+	return static_cast<double>(get_sample_threshold()) / 9007199254740992.0;
+}
+boost::uint64_t TraceExporter::get_sample_threshold() NOEXCEPT {
+	return atomic_load(g_sample_threshold, ATOMIC_CONSUME);
+}
+
+void TraceExporter::record(SpanElement &span){
+	const Mutex::UniqueLock lock(g_mutex);
+	g_recorded += 1;
+	if(g_export_path.empty() || (g_pending.size() >= g_max_pending)){
+		g_dropped += 1;
+		return;
+	}
+	g_pending.push_back(STD_MOVE(span));
+}
+void TraceExporter::get_status(TraceExporter::Status &ret){
+	const Mutex::UniqueLock lock(g_mutex);
+	ret.sample_rate = get_sample_rate();
+	ret.recorded = g_recorded;
+	ret.dropped = g_dropped;
+	ret.exported = g_exported;
+	ret.pending = g_pending.size();
+}
+
+}
@@ -0,0 +1,55 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_SINGLETONS_TRACE_EXPORTER_HPP_
+#define POSEIDON_SINGLETONS_TRACE_EXPORTER_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../trace_context.hpp"
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+// 把被采样的 span 以 OpenTelemetry 的 OTLP/JSON 格式追加到 trace_export_path 中，每行是一个 ExportTraceServiceRequest，
+// 可以由 OpenTelemetry Collector 的 otlpjsonfile 接收器读取。没有设置 trace_export_path 时不采样任何 trace。
+class TraceExporter {
+public:
+	struct SpanElement {
+		TraceContext context;
+		boost::uint64_t parent_span_id;
+		const char *name;
+		int kind;
+		boost::uint64_t start_time; // UNIX 纳秒。
+		boost::uint64_t end_time;
+		bool error;
+		boost::container::vector<std::pair<std::string, std::string> > attributes;
+	};
+	struct Status {
+		double sample_rate;
+		unsigned long long recorded; // 已经记录的 span 数。
+		unsigned long long dropped; // 由于等待写出的 span 太多而丢弃的 span 数。
+		unsigned long long exported; // 已经交给 FileSystemDaemon 写出的 span 数。
+		std::size_t pending;
+	};
+
+private:
+	TraceExporter();
+
+public:
+	static void start();
+	static void stop();
+
+	// 新的 trace 被采样的概率。
+	static double get_sample_rate() NOEXCEPT;
+	// 采样率乘以 2^53。make_child_trace_context() 用 trace id 的低 53 位与之比较，决定是否采样。
+	static boost::uint64_t get_sample_threshold() NOEXCEPT;
+
+	static void record(SpanElement &span);
+	static void get_status(Status &ret);
+};
+
+}
+
+#endif
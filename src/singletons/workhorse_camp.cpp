@@ -14,65 +14,172 @@
 #include "../promise.hpp"
 #include "../profiler.hpp"
 #include "../random.hpp"
+#include "../time.hpp"
+#include "../checked_arithmetic.hpp"
+#include "../trace_context.hpp"
 
 namespace Poseidon {
 
 typedef WorkhorseCamp::JobProcedure JobProcedure;
 
 namespace {
+	struct JobQueueElement {
+		boost::weak_ptr<Promise> weak_promise;
+		JobProcedure procedure;
+		boost::uint64_t enqueued_time;
+		// 在投递任务的线程中创建，是投递者当前上下文的子节点。
+		TraceSpan trace;
+	};
+
+	void run_job(JobQueueElement &elem) NOEXCEPT {
+		PROFILE_ME;
+
+		STD_EXCEPTION_PTR except;
+		{
+			const TraceScope trace_scope(elem.trace.get_context());
+			try {
+				elem.procedure();
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+				except = STD_CURRENT_EXCEPTION();
+			} catch(...){
+				LOG_POSEIDON_WARNING("Unknown exception thrown");
+				except = STD_CURRENT_EXCEPTION();
+			}
+		}
+		elem.trace.finish(NULLPTR, !!except);
+		const AUTO(promise, elem.weak_promise.lock());
+		if(promise){
+			if(except){
+				promise->set_exception(STD_MOVE(except), false);
+			} else {
+				promise->set_success(false);
+			}
+		}
+	}
+
+	volatile std::size_t g_abandoned_job_count = 0;
+
+	// 停止时超过了 workhorse_drain_timeout，这些任务不再执行，它们的 Promise 以异常结束。
+	void abandon_jobs(boost::container::deque<JobQueueElement> &queue) NOEXCEPT {
+		atomic_add(g_abandoned_job_count, queue.size(), ATOMIC_RELAXED);
+		for(AUTO(it, queue.begin()); it != queue.end(); ++it){
+			it->trace.finish(NULLPTR, true);
+			const AUTO(promise, it->weak_promise.lock());
+			if(promise){
+				promise->set_exception(STD_MAKE_EXCEPTION_PTR(Exception(__FILE__, __LINE__, __PRETTY_FUNCTION__, sslit("Workhorse job was abandoned on shutdown"))), false);
+			}
+		}
+		queue.clear();
+	}
+
+	// 没有线程亲和性的任务放在这个共享队列中，由任意一个空闲的线程取走执行。
+	// 如果同时需要 g_shared_mutex 和线程的 m_mutex，必须先锁定后者。
+	Mutex g_shared_mutex;
+	ConditionVariable g_shared_drained;
+	boost::container::deque<JobQueueElement> g_shared_queue;
+
+	bool is_shared_queue_empty(){
+		const Mutex::UniqueLock lock(g_shared_mutex);
+		return g_shared_queue.empty();
+	}
+	std::size_t get_shared_queue_size(){
+		const Mutex::UniqueLock lock(g_shared_mutex);
+		return g_shared_queue.size();
+	}
+	// 等待共享队列清空。deadline 为零时一直等待，否则到期时放弃剩余的任务并返回其个数。
+	std::size_t drain_shared_queue(boost::uint64_t deadline){
+		boost::container::deque<JobQueueElement> queue;
+		{
+			Mutex::UniqueLock lock(g_shared_mutex);
+			for(;;){
+				if(g_shared_queue.empty()){
+					return 0;
+				}
+				const AUTO(now, get_fast_mono_clock());
+				if((deadline != 0) && (now >= deadline)){
+					break;
+				}
+				g_shared_drained.timed_wait(lock, (deadline != 0) ? (deadline - now) : 1000);
+			}
+			queue.swap(g_shared_queue);
+		}
+		const std::size_t count = queue.size();
+		abandon_jobs(queue);
+		return count;
+	}
+
+	class WorkhorseThread;
+
+	// 线程空闲了 idle_duration 毫秒。如果线程被回收则返回 true，此时线程应当退出。
+	bool retire_if_idle(WorkhorseThread *thread, std::size_t index, boost::uint64_t idle_duration);
+
 	class WorkhorseThread : NONCOPYABLE {
 	private:
-		struct JobQueueElement {
-			boost::weak_ptr<Promise> weak_promise;
-			JobProcedure procedure;
-		};
+		const std::size_t m_index;
 
-	private:
 		Thread m_thread;
 		volatile bool m_running;
 
 		mutable Mutex m_mutex;
 		mutable ConditionVariable m_new_job;
+		mutable ConditionVariable m_drained; // m_queue 变为空时通知。
 		boost::container::deque<JobQueueElement> m_queue;
+		bool m_idle;
+		volatile bool m_abandoned;
 
 	public:
-		WorkhorseThread()
-			: m_running(false)
+		explicit WorkhorseThread(std::size_t index)
+			: m_index(index)
+			, m_running(false), m_idle(false), m_abandoned(false)
 		{ }
 
 	private:
 		bool pump_one_job() NOEXCEPT {
 			PROFILE_ME;
 
+			if(atomic_load(m_abandoned, ATOMIC_CONSUME)){
+				// 队首的任务可能正在执行，所以只能在本线程中清空队列。
+				boost::container::deque<JobQueueElement> queue;
+				{
+					const Mutex::UniqueLock lock(m_mutex);
+					queue.swap(m_queue);
+					m_drained.broadcast();
+				}
+				abandon_jobs(queue);
+				return false;
+			}
+
+			// 先执行本线程的任务，以保证同一个 thread_hint 的任务的顺序。
 			JobQueueElement *elem;
 			{
 				const Mutex::UniqueLock lock(m_mutex);
+				elem = m_queue.empty() ? NULLPTR : &m_queue.front();
+			}
+			if(elem){
+				run_job(*elem);
+				const Mutex::UniqueLock lock(m_mutex);
+				m_queue.pop_front();
 				if(m_queue.empty()){
-					return false;
+					m_drained.broadcast();
 				}
-				elem = &m_queue.front();
+				return true;
 			}
 
-			STD_EXCEPTION_PTR except;
-			try {
-				elem->procedure();
-			} catch(std::exception &e){
-				LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
-				except = STD_CURRENT_EXCEPTION();
-			} catch(...){
-				LOG_POSEIDON_WARNING("Unknown exception thrown");
-				except = STD_CURRENT_EXCEPTION();
-			}
-			const AUTO(promise, elem->weak_promise.lock());
-			if(promise){
-				if(except){
-					promise->set_exception(STD_MOVE(except), false);
-				} else {
-					promise->set_success(false);
+			// 本线程空闲，从共享队列中取一个任务。
+			JobQueueElement shared_elem;
+			{
+				const Mutex::UniqueLock lock(g_shared_mutex);
+				if(g_shared_queue.empty()){
+					return false;
+				}
+				shared_elem = STD_MOVE(g_shared_queue.front());
+				g_shared_queue.pop_front();
+				if(g_shared_queue.empty()){
+					g_shared_drained.broadcast();
 				}
 			}
-			const Mutex::UniqueLock lock(m_mutex);
-			m_queue.pop_front();
+			run_job(shared_elem);
 			return true;
 		}
 
@@ -81,18 +188,37 @@ namespace {
 			LOG_POSEIDON_INFO("Workhorse thread started.");
 
 			unsigned timeout = 0;
+			boost::uint64_t idle_since = 0;
 			for(;;){
 				bool busy;
 				do {
 					busy = pump_one_job();
 					timeout = std::min<unsigned>(timeout * 2u + 1u, !busy * 100u);
+					if(busy){
+						idle_since = 0;
+					}
 				} while(busy);
 
-				Mutex::UniqueLock lock(m_mutex);
-				if(m_queue.empty() && !atomic_load(m_running, ATOMIC_CONSUME)){
+				{
+					Mutex::UniqueLock lock(m_mutex);
+					if(!m_queue.empty() || !is_shared_queue_empty()){
+						continue;
+					}
+					if(!atomic_load(m_running, ATOMIC_CONSUME)){
+						break;
+					}
+					m_idle = true;
+					m_new_job.timed_wait(lock, timeout);
+					m_idle = false;
+				}
+
+				const AUTO(now, get_fast_mono_clock());
+				if(idle_since == 0){
+					idle_since = now;
+				}
+				if(retire_if_idle(this, m_index, now - idle_since)){
 					break;
 				}
-				m_new_job.timed_wait(lock, timeout);
 			}
 
 			LOG_POSEIDON_INFO("Workhorse thread stopped.");
@@ -107,31 +233,51 @@ namespace {
 		void stop(){
 			atomic_store(m_running, false, ATOMIC_RELEASE);
 		}
+		// 如果没有待处理的任务，停止接受任务并返回 true。
+		bool retire(){
+			const Mutex::UniqueLock lock(m_mutex);
+			if(!m_queue.empty() || !is_shared_queue_empty()){
+				return false;
+			}
+			atomic_store(m_running, false, ATOMIC_RELEASE);
+			return true;
+		}
+		// 放弃队列中剩余的任务。本线程在执行完当前的任务之后清空队列并退出。
+		void abandon(){
+			const Mutex::UniqueLock lock(m_mutex);
+			atomic_store(m_abandoned, true, ATOMIC_RELEASE);
+			m_new_job.signal();
+		}
 		void safe_join(){
-			wait_till_idle();
+			wait_till_idle(0);
 
 			if(m_thread.joinable()){
 				m_thread.join();
 			}
 		}
 
-		void wait_till_idle(){
+		// 等待本线程的队列清空。deadline 为零时一直等待，否则到期时返回剩余的任务数。
+		std::size_t wait_till_idle(boost::uint64_t deadline){
+			boost::uint64_t next_report = 0;
+			Mutex::UniqueLock lock(m_mutex);
 			for(;;){
-				std::size_t pending_objects;
-				{
-					const Mutex::UniqueLock lock(m_mutex);
-					pending_objects = m_queue.size();
-					if(pending_objects == 0){
-						break;
-					}
-					m_new_job.signal();
+				const std::size_t pending_objects = m_queue.size();
+				if(pending_objects == 0){
+					return 0;
 				}
-				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for jobs to complete: pending_objects = ", pending_objects);
-
-				::timespec req;
-				req.tv_sec = 0;
-				req.tv_nsec = 500 * 1000 * 1000;
-				::nanosleep(&req, NULLPTR);
+				const AUTO(now, get_fast_mono_clock());
+				if((deadline != 0) && (now >= deadline)){
+					return pending_objects;
+				}
+				m_new_job.signal();
+				if(now >= next_report){
+					lock.unlock();
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for jobs to complete: pending_objects = ", pending_objects);
+					next_report = now + 1000;
+					lock.lock();
+					continue;
+				}
+				m_drained.timed_wait(lock, ((deadline != 0) ? std::min(deadline, next_report) : next_report) - now);
 			}
 		}
 
@@ -139,40 +285,198 @@ namespace {
 			const Mutex::UniqueLock lock(m_mutex);
 			return m_queue.size();
 		}
+		// 如果本线程正在等待任务，将其标记为忙碌并返回 true。调用者随后应当调用 wake()。
+		// 标记之后其他调用者不会再选中这个线程，这样连续添加的任务会分散到不同的线程。
+		bool try_claim(){
+			const Mutex::UniqueLock lock(m_mutex);
+			if(!m_idle){
+				return false;
+			}
+			m_idle = false;
+			return true;
+		}
+		void wake(){
+			const Mutex::UniqueLock lock(m_mutex);
+			m_new_job.signal();
+		}
 		void add_job(const boost::shared_ptr<Promise> &promise, JobProcedure procedure){
 			PROFILE_ME;
 
 			const Mutex::UniqueLock lock(m_mutex);
 			DEBUG_THROW_UNLESS(atomic_load(m_running, ATOMIC_CONSUME), Exception, sslit("Workhorse thread is being shut down"));
-			JobQueueElement elem = { promise, STD_MOVE_IDN(procedure) };
+			JobQueueElement elem = { promise, STD_MOVE_IDN(procedure), get_fast_mono_clock(), TraceSpan("workhorse") };
 			m_queue.push_back(STD_MOVE(elem));
 			m_new_job.signal();
 		}
 	};
 
 	volatile bool g_running = false;
+	// 只在 WorkhorseCamp::start() 中设置。
+	bool g_shared_queue_enabled = true;
+
+	// 线程池的上下限可以在运行时修改。
+	// 下标不小于 g_max_thread_count 的线程不再接受新的任务，在处理完已有的任务之后被回收；
+	// 其余的线程空闲超过 g_idle_timeout 毫秒之后被回收，但不少于 g_min_thread_count 个。
+	volatile std::size_t g_min_thread_count = 0;
+	volatile std::size_t g_max_thread_count = 0;
+	volatile boost::uint64_t g_grow_latency = 0;
+	volatile boost::uint64_t g_idle_timeout = 0;
 
 	Mutex g_router_mutex;
+	// 长度只增不减，空的元素表示对应的线程尚未创建或已被回收。
 	boost::container::vector<boost::shared_ptr<WorkhorseThread> > g_threads;
+	// 已被回收但尚未 join 的线程。
+	boost::container::vector<boost::shared_ptr<WorkhorseThread> > g_retired_threads;
+	volatile bool g_has_retired_threads = false;
+
+	boost::shared_ptr<WorkhorseThread> create_thread_unlocked(std::size_t i){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Creating new workhorse thread ", i);
+		AUTO(thread, boost::make_shared<WorkhorseThread>(i));
+		thread->start();
+		g_threads.at(i) = thread;
+		return thread;
+	}
+	std::size_t count_live_threads_unlocked(std::size_t max_count){
+		std::size_t count = 0;
+		for(std::size_t i = 0; i < std::min(max_count, g_threads.size()); ++i){
+			count += !!g_threads.at(i);
+		}
+		return count;
+	}
+
+	bool retire_if_idle(WorkhorseThread *thread, std::size_t index, boost::uint64_t idle_duration){
+		const AUTO(max_count, atomic_load(g_max_thread_count, ATOMIC_CONSUME));
+		if(index < max_count){
+			const AUTO(idle_timeout, atomic_load(g_idle_timeout, ATOMIC_CONSUME));
+			if((idle_timeout == 0) || (idle_duration < idle_timeout)){
+				return false;
+			}
+		}
+
+		const Mutex::UniqueLock lock(g_router_mutex);
+		if((index >= g_threads.size()) || (g_threads.at(index).get() != thread)){
+			return false;
+		}
+		if((index < max_count) && (count_live_threads_unlocked(max_count) <= atomic_load(g_min_thread_count, ATOMIC_CONSUME))){
+			return false;
+		}
+		if(!thread->retire()){
+			return false;
+		}
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Retiring workhorse thread ", index);
+		g_retired_threads.push_back(STD_MOVE(g_threads.at(index)));
+		g_threads.at(index).reset();
+		atomic_store(g_has_retired_threads, true, ATOMIC_RELEASE);
+		return true;
+	}
+	void reap_retired_threads(){
+		if(!atomic_load(g_has_retired_threads, ATOMIC_CONSUME)){
+			return;
+		}
+		boost::container::vector<boost::shared_ptr<WorkhorseThread> > threads;
+		{
+			const Mutex::UniqueLock lock(g_router_mutex);
+			threads.swap(g_retired_threads);
+			atomic_store(g_has_retired_threads, false, ATOMIC_RELAXED);
+		}
+		for(AUTO(it, threads.begin()); it != threads.end(); ++it){
+			(*it)->safe_join();
+		}
+	}
 
 	void add_job_using_seed(const boost::shared_ptr<Promise> &promise, JobProcedure procedure, std::size_t seed){
 		PROFILE_ME;
 		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("Workhorse support is not enabled"));
+		DEBUG_THROW_UNLESS(atomic_load(g_running, ATOMIC_CONSUME), Exception, sslit("Workhorse daemon is being shut down"));
 
-		boost::shared_ptr<WorkhorseThread> thread;
-		{
-			const Mutex::UniqueLock lock(g_router_mutex);
-			std::size_t i = seed % g_threads.size();
-			thread = g_threads.at(i);
+		reap_retired_threads();
+
+		// 在锁内添加任务，这样线程不会在此期间被回收。
+		const Mutex::UniqueLock lock(g_router_mutex);
+		std::size_t i = seed % atomic_load(g_max_thread_count, ATOMIC_CONSUME);
+		AUTO(thread, g_threads.at(i));
+		if(!thread){
+			thread = create_thread_unlocked(i);
+		}
+		thread->add_job(STD_MOVE(promise), STD_MOVE_IDN(procedure));
+	}
+
+	// 唤醒一个空闲的线程。如果没有，在线程数低于下限或者共享队列中最早的任务等待过久时创建一个新的线程；
+	// 否则由最先完成手头任务的线程取走。
+	// 如果 only_if_idle 为 true 并且既没有空闲的线程也不能创建新的线程，任务不会被放入队列，返回 false。
+	bool add_shared_job(const boost::shared_ptr<Promise> &promise, JobProcedure procedure, bool only_if_idle){
+		PROFILE_ME;
+		DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("Workhorse support is not enabled"));
+		DEBUG_THROW_UNLESS(atomic_load(g_running, ATOMIC_CONSUME), Exception, sslit("Workhorse daemon is being shut down"));
+
+		reap_retired_threads();
+
+		const AUTO(now, get_fast_mono_clock());
+		const Mutex::UniqueLock lock(g_router_mutex);
+		const AUTO(max_count, atomic_load(g_max_thread_count, ATOMIC_CONSUME));
+		boost::shared_ptr<WorkhorseThread> idle_thread;
+		std::size_t vacant = max_count;
+		std::size_t live_count = 0;
+		for(std::size_t i = 0; i < max_count; ++i){
+			const AUTO_REF(thread, g_threads.at(i));
 			if(!thread){
-				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Creating new workhorse thread ", i);
-				thread = boost::make_shared<WorkhorseThread>();
-				thread->start();
-				g_threads.at(i) = thread;
+				vacant = std::min(vacant, i);
+				continue;
+			}
+			++live_count;
+			if(thread->try_claim()){
+				idle_thread = thread;
+				break;
 			}
 		}
-		assert(thread);
-		thread->add_job(STD_MOVE(promise), STD_MOVE_IDN(procedure));
+		bool to_grow = false;
+		if(!idle_thread && (vacant < max_count)){
+			if(live_count < atomic_load(g_min_thread_count, ATOMIC_CONSUME)){
+				to_grow = true;
+			} else {
+				const Mutex::UniqueLock shared_lock(g_shared_mutex);
+				const AUTO(oldest, g_shared_queue.empty() ? now : g_shared_queue.front().enqueued_time);
+				to_grow = saturated_sub(now, oldest) >= atomic_load(g_grow_latency, ATOMIC_CONSUME);
+			}
+		}
+		if(!idle_thread && !to_grow && only_if_idle){
+			return false;
+		}
+		{
+			const Mutex::UniqueLock shared_lock(g_shared_mutex);
+			JobQueueElement elem = { promise, STD_MOVE_IDN(procedure), now, TraceSpan("workhorse") };
+			g_shared_queue.push_back(STD_MOVE(elem));
+		}
+		if(idle_thread){
+			idle_thread->wake();
+		} else if(to_grow){
+			create_thread_unlocked(vacant);
+		}
+		return true;
+	}
+
+	struct ParallelForState {
+		volatile std::size_t remaining;
+		boost::shared_ptr<Promise> promise;
+		WorkhorseCamp::RangeProcedure procedure;
+	};
+
+	void run_range(const boost::shared_ptr<ParallelForState> &state, std::size_t chunk_begin, std::size_t chunk_end) NOEXCEPT {
+		PROFILE_ME;
+
+		// 第一个异常被保存到 promise 中，其余的分块仍然执行。
+		try {
+			state->procedure(chunk_begin, chunk_end);
+		} catch(std::exception &e){
+			LOG_POSEIDON_WARNING("std::exception thrown in parallel_for: what = ", e.what());
+			state->promise->set_exception(STD_CURRENT_EXCEPTION(), false);
+		} catch(...){
+			LOG_POSEIDON_WARNING("Unknown exception thrown in parallel_for.");
+			state->promise->set_exception(STD_CURRENT_EXCEPTION(), false);
+		}
+		if(atomic_sub(state->remaining, 1, ATOMIC_ACQ_REL) == 0){
+			state->promise->set_success(false);
+		}
 	}
 }
 
@@ -188,7 +492,14 @@ void WorkhorseCamp::start(){
 		LOG_POSEIDON_FATAL("You shall not set `workhorse_max_thread_count` in `main.conf` to zero.");
 		std::abort();
 	}
+	const AUTO(min_thread_count, MainConfig::get<std::size_t>("workhorse_min_thread_count", max_thread_count));
 	g_threads.resize(max_thread_count);
+	atomic_store(g_min_thread_count, std::min(min_thread_count, max_thread_count), ATOMIC_RELAXED);
+	atomic_store(g_max_thread_count, max_thread_count, ATOMIC_RELAXED);
+	atomic_store(g_grow_latency, MainConfig::get<boost::uint64_t>("workhorse_thread_grow_latency", 0), ATOMIC_RELAXED);
+	atomic_store(g_idle_timeout, MainConfig::get<boost::uint64_t>("workhorse_thread_idle_timeout", 60000), ATOMIC_RELAXED);
+	g_shared_queue_enabled = MainConfig::get<bool>("workhorse_shared_queue", true);
+	LOG_POSEIDON_DEBUG("Workhorse shared queue: ", g_shared_queue_enabled ? "enabled" : "disabled");
 
 	LOG_POSEIDON_INFO("Workhorse daemon started.");
 }
@@ -198,32 +509,136 @@ void WorkhorseCamp::stop(){
 	}
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping workhorse daemon...");
 
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	const AUTO(drain_begin, get_fast_mono_clock());
+	const AUTO(drain_timeout, MainConfig::get<boost::uint64_t>("workhorse_drain_timeout", 0));
+	const AUTO(deadline, (drain_timeout == 0) ? 0 : saturated_add(drain_begin, drain_timeout));
+
+	// 在锁内取出所有线程，这样它们不会再被回收。
+	boost::container::vector<boost::shared_ptr<WorkhorseThread> > threads;
+	std::size_t pending_jobs = get_shared_queue_size();
+	{
+		const Mutex::UniqueLock lock(g_router_mutex);
+		threads.swap(g_retired_threads);
+		for(std::size_t i = 0; i < g_threads.size(); ++i){
+			AUTO_REF(thread, g_threads.at(i));
+			if(!thread){
+				continue;
+			}
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping workhorse thread ", i);
+			thread->stop();
+			pending_jobs += thread->get_queue_size();
+			threads.push_back(STD_MOVE(thread));
+			thread.reset();
 		}
-		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Stopping workhorse thread ", i);
-		thread->stop();
 	}
-	for(std::size_t i = 0; i < g_threads.size(); ++i){
-		const AUTO_REF(thread, g_threads.at(i));
-		if(!thread){
-			continue;
+	atomic_store(g_abandoned_job_count, 0, ATOMIC_RELAXED);
+	for(std::size_t i = 0; i < threads.size(); ++i){
+		const AUTO(remaining, threads.at(i)->wait_till_idle(deadline));
+		if(remaining != 0){
+			LOG_POSEIDON_ERROR("Workhorse drain deadline exceeded: thread = ", i, ", pending_jobs = ", remaining);
+			threads.at(i)->abandon();
 		}
+	}
+	// 线程在共享队列为空之后才退出。
+	const AUTO(remaining, drain_shared_queue(deadline));
+	if(remaining != 0){
+		LOG_POSEIDON_ERROR("Workhorse drain deadline exceeded: shared queue, pending_jobs = ", remaining);
+	}
+	for(std::size_t i = 0; i < threads.size(); ++i){
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Waiting for workhorse thread ", i, " to terminate...");
-		thread->safe_join();
+		threads.at(i)->safe_join();
 	}
+	const Mutex::UniqueLock lock(g_router_mutex);
 	g_threads.clear();
+	assert(is_shared_queue_empty());
 
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Workhorse daemon drained: pending_jobs = ", pending_jobs, ", abandoned_jobs = ", atomic_load(g_abandoned_job_count, ATOMIC_RELAXED),
+		", elapsed = ", get_fast_mono_clock() - drain_begin, " ms");
 	LOG_POSEIDON_INFO("Workhorse daemon stopped.");
 }
 
 void WorkhorseCamp::enqueue_isolated(const boost::shared_ptr<Promise> &promise, JobProcedure procedure){
+	if(g_shared_queue_enabled){
+		add_shared_job(promise, STD_MOVE_IDN(procedure), false);
+		return;
+	}
 	add_job_using_seed(promise, STD_MOVE_IDN(procedure), random_uint32());
 }
 void WorkhorseCamp::enqueue(const boost::shared_ptr<Promise> &promise, JobProcedure procedure, std::size_t thread_hint){
 	add_job_using_seed(promise, STD_MOVE_IDN(procedure), (boost::uint64_t)thread_hint * 134775813 / 65539);
 }
 
+void WorkhorseCamp::get_pool_status(PoolStatus &status){
+	reap_retired_threads();
+
+	const Mutex::UniqueLock lock(g_router_mutex);
+	status.min_thread_count = atomic_load(g_min_thread_count, ATOMIC_CONSUME);
+	status.max_thread_count = atomic_load(g_max_thread_count, ATOMIC_CONSUME);
+	status.live_thread_count = 0;
+	status.queue_size = 0;
+	for(std::size_t i = 0; i < g_threads.size(); ++i){
+		const AUTO_REF(thread, g_threads.at(i));
+		if(!thread){
+			continue;
+		}
+		status.live_thread_count += 1;
+		status.queue_size += thread->get_queue_size();
+	}
+	const Mutex::UniqueLock shared_lock(g_shared_mutex);
+	status.queue_size += g_shared_queue.size();
+}
+void WorkhorseCamp::set_thread_limits(std::size_t min_thread_count, std::size_t max_thread_count){
+	DEBUG_THROW_UNLESS(!g_threads.empty(), BasicException, sslit("Workhorse support is not enabled"));
+	DEBUG_THROW_UNLESS(max_thread_count != 0, Exception, sslit("The maximum thread count shall not be zero"));
+	DEBUG_THROW_UNLESS(min_thread_count <= max_thread_count, Exception, sslit("The minimum thread count shall not exceed the maximum thread count"));
+
+	const Mutex::UniqueLock lock(g_router_mutex);
+	if(g_threads.size() < max_thread_count){
+		g_threads.resize(max_thread_count);
+	}
+	atomic_store(g_min_thread_count, min_thread_count, ATOMIC_RELEASE);
+	atomic_store(g_max_thread_count, max_thread_count, ATOMIC_RELEASE);
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Workhorse thread limits changed: min_thread_count = ", min_thread_count, ", max_thread_count = ", max_thread_count);
+}
+
+std::size_t WorkhorseCamp::get_parallel_grain(std::size_t count, std::size_t grain){
+	if(grain != 0){
+		return grain;
+	}
+	// 默认每个线程一块。
+	const std::size_t thread_count = std::max<std::size_t>(atomic_load(g_max_thread_count, ATOMIC_CONSUME), 1);
+	return std::max<std::size_t>((count + thread_count - 1) / thread_count, 1);
+}
+boost::shared_ptr<const Promise> WorkhorseCamp::parallel_for(std::size_t begin, std::size_t end, std::size_t grain, RangeProcedure procedure){
+	PROFILE_ME;
+
+	AUTO(promise, boost::make_shared<Promise>());
+	if(begin >= end){
+		promise->set_success();
+		return promise;
+	}
+	grain = get_parallel_grain(end - begin, grain);
+	const std::size_t chunk_count = (end - begin - 1) / grain + 1;
+
+	const AUTO(state, boost::make_shared<ParallelForState>());
+	state->remaining = chunk_count;
+	state->promise = promise;
+	state->procedure = STD_MOVE_IDN(procedure);
+
+	// 没有空闲的线程时在当前线程中执行，最后一块总是在当前线程中执行。
+	std::size_t chunk_begin = begin;
+	for(std::size_t i = 0; i < chunk_count; ++i){
+		const std::size_t chunk_end = (end - chunk_begin <= grain) ? end : (chunk_begin + grain);
+		bool queued = false;
+		if((i + 1 < chunk_count) && !g_threads.empty()){
+			queued = add_shared_job(boost::shared_ptr<Promise>(), boost::bind(&run_range, state, chunk_begin, chunk_end), true);
+		}
+		if(!queued){
+			run_range(state, chunk_begin, chunk_end);
+		}
+		chunk_begin = chunk_end;
+	}
+	return promise;
+}
+
 }
@@ -6,19 +6,30 @@
 
 #include "../cxx_ver.hpp"
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/optional.hpp>
+#include <boost/container/vector.hpp>
 #include <string>
+#include "../promise.hpp"
 
 namespace Poseidon {
 
-class Promise;
-
 class WorkhorseCamp {
 private:
 	WorkhorseCamp();
 
 public:
 	typedef boost::function<void ()> JobProcedure;
+	typedef boost::function<void (std::size_t begin, std::size_t end)> RangeProcedure;
+
+	struct PoolStatus {
+		std::size_t min_thread_count;
+		std::size_t max_thread_count;
+		std::size_t live_thread_count;
+		std::size_t queue_size;
+	};
 
 	static void start();
 	static void stop();
@@ -26,6 +37,53 @@ public:
 	static void enqueue_isolated(const boost::shared_ptr<Promise> &promise, JobProcedure procedure);
 	// 具有相同 thread_hint 的任务保证由同一个线程执行。
 	static void enqueue(const boost::shared_ptr<Promise> &promise, JobProcedure procedure, std::size_t thread_hint);
+
+	static void get_pool_status(PoolStatus &status);
+	// 调低上限时，多余的线程在处理完已有的任务之后退出。
+	// 上限改变之后，相同 thread_hint 的任务可能被分配到另一个线程，此前已经排队的任务不保证先于之后的任务执行。
+	static void set_thread_limits(std::size_t min_thread_count, std::size_t max_thread_count);
+
+	// grain 为零时按照线程数平均分块。
+	static std::size_t get_parallel_grain(std::size_t count, std::size_t grain);
+	// 把 [begin, end) 分为长度为 grain 的块，交给空闲的工作者线程执行；没有空闲的线程时在当前线程中执行。
+	// 返回的 Promise 在所有块执行完毕之后被满足。如果有块抛出异常，Promise 以第一个异常被满足。
+	static boost::shared_ptr<const Promise> parallel_for(std::size_t begin, std::size_t end, std::size_t grain, RangeProcedure procedure);
+
+	// 对每个块调用 map，然后按照块的顺序用 reduce 把结果依次合并到 init 上。
+	template<typename ResultT>
+	static boost::shared_ptr<const PromiseContainer<ResultT> > parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain,
+		boost::function<ResultT (std::size_t begin, std::size_t end)> map, boost::function<ResultT (const ResultT &lhs, const ResultT &rhs)> reduce, ResultT init)
+	{
+		typedef boost::container::vector<boost::optional<ResultT> > Partials;
+		struct Helper {
+			static void map_chunk(const boost::shared_ptr<Partials> &partials, std::size_t begin, std::size_t grain,
+				const boost::function<ResultT (std::size_t, std::size_t)> &map, std::size_t chunk_begin, std::size_t chunk_end)
+			{
+				partials->at((chunk_begin - begin) / grain) = map(chunk_begin, chunk_end);
+			}
+			static void finish(const boost::shared_ptr<PromiseContainer<ResultT> > &ret, const boost::shared_ptr<const Promise> &mapped, const boost::shared_ptr<Partials> &partials,
+				const boost::function<ResultT (const ResultT &, const ResultT &)> &reduce, const ResultT &init)
+			{
+				try {
+					mapped->check_and_rethrow();
+					ResultT result = init;
+					for(AUTO(it, partials->begin()); it != partials->end(); ++it){
+						result = reduce(result, it->get());
+					}
+					ret->set_success(STD_MOVE(result), false);
+				} catch(...){
+					ret->set_exception(STD_CURRENT_EXCEPTION(), false);
+				}
+			}
+		};
+
+		grain = get_parallel_grain(end - begin, grain);
+		const AUTO(partials, boost::make_shared<Partials>((begin < end) ? ((end - begin - 1) / grain + 1) : 0));
+		const AUTO(mapped, parallel_for(begin, end, grain, boost::bind(&Helper::map_chunk, partials, begin, grain, STD_MOVE_IDN(map), _1, _2)));
+		const AUTO(ret, boost::make_shared<PromiseContainer<ResultT> >());
+		mapped->add_waiter(boost::bind(&Helper::finish, ret, mapped, partials, STD_MOVE_IDN(reduce), STD_MOVE_IDN(init)));
+		return ret;
+	}
 };
 
 }
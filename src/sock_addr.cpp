@@ -6,10 +6,16 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stddef.h>
 #include "ip_port.hpp"
+#include "raii.hpp"
 #include "endian.hpp"
 #include "system_exception.hpp"
 #include "log.hpp"
+#include "profiler.hpp"
 
 namespace Poseidon {
 
@@ -51,6 +57,9 @@ namespace {
 	inline ::sockaddr_in6 &as_sin6(const void *data) NOEXCEPT {
 		return *static_cast< ::sockaddr_in6 *>(const_cast<void *>(data));
 	}
+	inline ::sockaddr_un &as_sun(const void *data) NOEXCEPT {
+		return *static_cast< ::sockaddr_un *>(const_cast<void *>(data));
+	}
 }
 
 SockAddr::SockAddr(){
@@ -80,6 +89,22 @@ SockAddr::SockAddr(const IpPort &ip_port){
 		DEBUG_THROW(Exception, sslit("Unknown IP address format"));
 	}
 }
+SockAddr::SockAddr(const char *unix_path){
+	::sockaddr_un &sun = as_sun(m_data);
+	BOOST_STATIC_ASSERT(sizeof(m_data) >= sizeof(sun));
+	const std::size_t len = std::strlen(unix_path);
+	DEBUG_THROW_UNLESS((len > 0) && (len < sizeof(sun.sun_path)), Exception, sslit("Invalid Unix socket path"));
+	sun.sun_family = AF_UNIX;
+	if(unix_path[0] == '@'){
+		// 抽象命名空间的名字以一个零字节开头，长度由地址长度决定，不以零结尾。
+		sun.sun_path[0] = 0;
+		std::memcpy(sun.sun_path + 1, unix_path + 1, len - 1);
+		m_size = offsetof(::sockaddr_un, sun_path) + len;
+	} else {
+		std::memcpy(sun.sun_path, unix_path, len + 1);
+		m_size = offsetof(::sockaddr_un, sun_path) + len + 1;
+	}
+}
 SockAddr::SockAddr(const SockAddr &rhs) NOEXCEPT {
 	const std::size_t addr_size = rhs.m_size;
 	std::memcpy(m_data, rhs.m_data, addr_size);
@@ -97,6 +122,22 @@ int SockAddr::get_family() const {
 	DEBUG_THROW_UNLESS(m_size >= sizeof(sa.sa_family), Exception, sslit("Empty SockAddr"));
 	return sa.sa_family;
 }
+bool SockAddr::is_unix() const {
+	return get_family() == AF_UNIX;
+}
+std::string SockAddr::get_unix_path() const {
+	std::string path;
+	if(get_family() != AF_UNIX){
+		return path;
+	}
+	const ::sockaddr_un &sun = as_sun(m_data);
+	const std::size_t offset = offsetof(::sockaddr_un, sun_path);
+	if((m_size <= offset) || (sun.sun_path[0] == 0)){
+		return path;
+	}
+	path.assign(sun.sun_path, ::strnlen(sun.sun_path, m_size - offset));
+	return path;
+}
 bool SockAddr::is_ipv6() const {
 	const int family = get_family();
 	if(family == AF_INET){
@@ -136,10 +177,36 @@ bool SockAddr::is_private() const {
 		} else {
 			return false;
 		}
+	} else if(family == AF_UNIX){ // 只能在本机上连接
+		return true;
 	} else {
 		LOG_POSEIDON_ERROR("Unknown IP protocol: family = ", family);
 		DEBUG_THROW(Exception, sslit("Unknown IP protocol"));
 	}
 }
 
+void remove_stale_unix_socket(const SockAddr &addr, int type){
+	PROFILE_ME;
+
+	const AUTO(path, addr.get_unix_path());
+	if(path.empty()){
+		return;
+	}
+	struct ::stat stat_buf;
+	if((::lstat(path.c_str(), &stat_buf) != 0) || !S_ISSOCK(stat_buf.st_mode)){
+		return;
+	}
+	// 只有确认没有进程在监听时才删除，否则 bind() 会照常失败。
+	UniqueFile probe;
+	DEBUG_THROW_UNLESS(probe.reset(::socket(AF_UNIX, type | SOCK_CLOEXEC, 0)), SystemException);
+	if((::connect(probe.get(), static_cast<const ::sockaddr *>(addr.data()), static_cast<unsigned>(addr.size())) == 0) || (errno != ECONNREFUSED)){
+		return;
+	}
+	LOG_POSEIDON_WARNING("Removing stale Unix socket: path = ", path);
+	if(::unlink(path.c_str()) != 0){
+		const int err_code = errno;
+		LOG_POSEIDON_WARNING("::unlink() failed, errno was ", err_code);
+	}
+}
+
 }
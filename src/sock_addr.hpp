@@ -6,6 +6,7 @@
 
 #include "cxx_ver.hpp"
 #include <cstddef>
+#include <string>
 
 namespace Poseidon {
 
@@ -20,6 +21,8 @@ public:
 	SockAddr();
 	SockAddr(const void *addr_data, std::size_t addr_size);
 	SockAddr(const IpPort &ip_port);
+	// Unix 域套接字地址。以 '@' 开头的名字属于抽象命名空间，不在文件系统中创建文件。
+	explicit SockAddr(const char *unix_path);
 	SockAddr(const SockAddr &rhs) NOEXCEPT;
 	SockAddr &operator=(const SockAddr &rhs) NOEXCEPT;
 
@@ -32,11 +35,18 @@ public:
 	}
 
 	int get_family() const;
+	bool is_unix() const;
+	// 如果是文件系统中的 Unix 域套接字返回其路径，否则（包括抽象命名空间）返回空串。
+	std::string get_unix_path() const;
 	// 如果是 IPv4 地址返回 false，如果是 IPv6 地址返回 true，否则抛出一个异常。
 	bool is_ipv6() const;
 	bool is_private() const;
 };
 
+// 绑定文件系统中的 Unix 域套接字之前调用。如果路径上是一个没有进程在使用的套接字文件，删除它。
+// type 是 SOCK_STREAM 或 SOCK_DGRAM。
+extern void remove_stale_unix_socket(const SockAddr &addr, int type);
+
 }
 
 #endif
@@ -15,7 +15,9 @@
 #include "system_exception.hpp"
 #include "ip_port.hpp"
 #include "sock_addr.hpp"
+#include "flags.hpp"
 #include "singletons/epoll_daemon.hpp"
+#include "singletons/main_config.hpp"
 
 namespace Poseidon {
 
@@ -34,7 +36,7 @@ SocketBase::DelayedShutdownGuard::~DelayedShutdownGuard(){
 		return;
 	}
 	if(atomic_sub(socket->m_delayed_shutdown_guard_count, 1, ATOMIC_RELAXED) == 0){
-		if(atomic_load(socket->m_shutdown_write, ATOMIC_ACQUIRE)){
+		if(atomic_load(socket->m_shutdown_write, ATOMIC_ACQUIRE) && !socket->has_been_handed_over()){
 			atomic_store(socket->m_really_shutdown_write, true, ATOMIC_RELEASE);
 			const bool pending = EpollDaemon::mark_socket_writeable(socket.get());
 			if(!pending){
@@ -47,15 +49,32 @@ SocketBase::DelayedShutdownGuard::~DelayedShutdownGuard(){
 SocketBase::SocketBase(Move<UniqueFile> socket)
 	: m_socket(STD_MOVE(socket)), m_creation_time(get_utc_time())
 	, m_shutdown_read(false), m_shutdown_write(false), m_really_shutdown_write(false)
-	, m_throttled(false), m_timed_out(false), m_delayed_shutdown_guard_count(0)
+	, m_throttled(false), m_timed_out(false), m_handed_over(false), m_delayed_shutdown_guard_count(0), m_epoll_thread_index((std::size_t)-1)
+	, m_epoll_generation(0), m_epoll_weak(false)
+	, m_remote_info_cached(false), m_local_info_cached(false)
 {
 	const int flags = ::fcntl(m_socket.get(), F_GETFL);
 	DEBUG_THROW_UNLESS(flags != -1, SystemException);
-	DEBUG_THROW_UNLESS(::fcntl(m_socket.get(), F_SETFL, flags | O_NONBLOCK) == 0, SystemException);
+	if(has_none_flags_of(flags, O_NONBLOCK)){
+		DEBUG_THROW_UNLESS(::fcntl(m_socket.get(), F_SETFL, flags | O_NONBLOCK) == 0, SystemException);
+	}
+	const AUTO(busy_poll, MainConfig::get<int>("socket_busy_poll", 0));
+	if(busy_poll != 0){
+		// 超过 net.core.busy_poll 的值需要 CAP_NET_ADMIN，失败时只给出警告。
+		if(::setsockopt(m_socket.get(), SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) != 0){
+			const int err_code = errno;
+			LOG_POSEIDON_WARNING("::setsockopt() failed, errno was ", err_code);
+		}
+	}
 }
 SocketBase::~SocketBase(){
-	// This FD may have been dup()'d.
-	::shutdown(get_fd(), SHUT_RDWR);
+	if(atomic_load(m_epoll_weak, ATOMIC_CONSUME)){
+		EpollDaemon::remove_socket(this);
+	}
+	// 描述符可能被子进程继承，close() 不一定会关闭连接。
+	if(!has_been_handed_over()){
+		::shutdown(get_fd(), SHUT_RDWR);
+	}
 }
 
 bool SocketBase::should_really_shutdown_write() const NOEXCEPT {
@@ -65,12 +84,20 @@ void SocketBase::set_timed_out() NOEXCEPT {
 	atomic_store(m_timed_out, true, ATOMIC_RELEASE);
 }
 
+std::size_t SocketBase::get_epoll_thread_index() const NOEXCEPT {
+	return atomic_load(m_epoll_thread_index, ATOMIC_CONSUME);
+}
+
 bool SocketBase::is_listening() const {
 	PROFILE_ME;
 
 	int val;
 	::socklen_t len = sizeof(val);
-	DEBUG_THROW_UNLESS(::getsockopt(get_fd(), SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0, SystemException);
+	if(::getsockopt(get_fd(), SOL_SOCKET, SO_ACCEPTCONN, &val, &len) != 0){
+		// 例如 FileWatcher 使用的 inotify 描述符。
+		DEBUG_THROW_UNLESS(errno == ENOTSOCK, SystemException);
+		return false;
+	}
 	return (len >= sizeof(int)) && (val != 0);
 }
 
@@ -138,6 +165,16 @@ void SocketBase::force_shutdown() NOEXCEPT {
 	::shutdown(get_fd(), SHUT_RDWR);
 }
 
+bool SocketBase::has_been_handed_over() const NOEXCEPT {
+	return atomic_load(m_handed_over, ATOMIC_CONSUME);
+}
+void SocketBase::mark_handed_over() NOEXCEPT {
+	PROFILE_ME;
+
+	atomic_store(m_handed_over, true, ATOMIC_RELEASE);
+	mark_shutdown();
+}
+
 bool SocketBase::is_throttled() const {
 	return atomic_load(m_throttled, ATOMIC_ACQUIRE);
 }
@@ -149,12 +186,16 @@ bool SocketBase::did_time_out() const NOEXCEPT {
 	return atomic_load(m_timed_out, ATOMIC_ACQUIRE);
 }
 
+void SocketBase::get_traffic_statistics(TrafficStatistics &ret) const {
+	ret = TrafficStatistics();
+}
+
 const IpPort &SocketBase::get_remote_info() const NOEXCEPT
 try {
 	PROFILE_ME;
 
 	const Mutex::UniqueLock lock(m_info_mutex);
-	if(m_remote_info.port() != 0){
+	if(m_remote_info_cached){
 		return m_remote_info;
 	}
 	if(is_listening()){
@@ -165,7 +206,10 @@ try {
 	if(::getpeername(get_fd(), static_cast< ::sockaddr *>(static_cast<void *>(&sa)), &salen) != 0){
 		return unknown_ip_port();
 	}
-	return m_remote_info = SockAddr(&sa, salen);
+	m_remote_info = SockAddr(&sa, salen);
+	// 连接尚未建立时端口号是零，下次再取。Unix 域套接字总是没有端口号。
+	m_remote_info_cached = (m_remote_info.port() != 0) || (sa.ss_family == AF_UNIX);
+	return m_remote_info;
 } catch(std::exception &e){
 	LOG_POSEIDON_DEBUG("std::exception thrown: what = ", e.what());
 	return unknown_ip_port();
@@ -175,7 +219,7 @@ try {
 	PROFILE_ME;
 
 	const Mutex::UniqueLock lock(m_info_mutex);
-	if(m_local_info.port() != 0){
+	if(m_local_info_cached){
 		return m_local_info;
 	}
 	::sockaddr_storage sa;
@@ -183,11 +227,32 @@ try {
 	if(::getsockname(get_fd(), static_cast< ::sockaddr *>(static_cast<void *>(&sa)), &salen) != 0){
 		return unknown_ip_port();
 	}
-	return m_local_info = SockAddr(&sa, salen);
+	m_local_info = SockAddr(&sa, salen);
+	m_local_info_cached = (m_local_info.port() != 0) || (sa.ss_family == AF_UNIX);
+	return m_local_info;
 } catch(std::exception &e){
 	LOG_POSEIDON_DEBUG("std::exception thrown: what = ", e.what());
 	return unknown_ip_port();
 }
+bool SocketBase::get_peer_credentials(PeerCredentials &ret) const NOEXCEPT {
+	PROFILE_ME;
+
+	// 对于 TCP 套接字 SO_PEERCRED 不会失败，而是返回无效的凭据，所以先检查协议族。
+	int family;
+	::socklen_t len = sizeof(family);
+	if((::getsockopt(get_fd(), SOL_SOCKET, SO_DOMAIN, &family, &len) != 0) || (family != AF_UNIX)){
+		return false;
+	}
+	::ucred cred;
+	len = sizeof(cred);
+	if(::getsockopt(get_fd(), SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0){
+		return false;
+	}
+	ret.pid = cred.pid;
+	ret.uid = cred.uid;
+	ret.gid = cred.gid;
+	return true;
+}
 
 int SocketBase::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable){
 	(void)hint_buffer;
@@ -15,9 +15,30 @@
 namespace Poseidon {
 
 class IpPort;
+class EpollDaemon;
 
 class SocketBase : public virtual VirtualSharedFromThis {
+	friend class EpollDaemon;
+
 public:
+	struct TrafficStatistics {
+		unsigned long long bytes_read;
+		unsigned long long bytes_written;
+		unsigned long long messages_read; // 由协议层统计，例如 CBPP 消息和 HTTP 请求。
+		unsigned long long messages_written;
+		unsigned long long send_buffer_size;
+		unsigned long long throttled_time; // 因为发送缓冲区超过高水位而暂停读取的总毫秒数，包括正在进行的一次。
+		boost::uint64_t last_read_time; // 以 get_fast_mono_clock() 为参考，零表示从未读写过。
+		boost::uint64_t last_write_time;
+	};
+
+	// 对端进程在 connect() 或 socketpair() 时的凭据。
+	struct PeerCredentials {
+		boost::int32_t pid;
+		boost::uint32_t uid;
+		boost::uint32_t gid;
+	};
+
 	// 至少一个此对象存活的条件下连接不会由于 RDHUP 而被关掉。
 	class DelayedShutdownGuard : NONCOPYABLE {
 	private:
@@ -37,10 +58,18 @@ private:
 	volatile bool m_really_shutdown_write;
 	volatile bool m_throttled;
 	volatile bool m_timed_out;
+	volatile bool m_handed_over;
 	volatile std::size_t m_delayed_shutdown_guard_count;
+	volatile std::size_t m_epoll_thread_index;
+	// 以下由 EpollDaemon 在添加套接字时设置。每次添加的 generation 都不相同，零表示尚未添加。
+	// epoll 没有这个套接字的所有权时 m_epoll_weak 为 true，析构时须将其注销。
+	volatile boost::uint64_t m_epoll_generation;
+	volatile bool m_epoll_weak;
 
 	mutable Mutex m_info_mutex;
+	mutable bool m_remote_info_cached;
 	mutable IpPort m_remote_info;
+	mutable bool m_local_info_cached;
 	mutable IpPort m_local_info;
 
 public:
@@ -58,6 +87,8 @@ public:
 	boost::uint64_t get_creation_time() const {
 		return m_creation_time;
 	}
+	// 返回处理该套接字的 epoll 线程的序号。如果尚未添加到 epoll 中则返回 -1。
+	std::size_t get_epoll_thread_index() const NOEXCEPT;
 
 	bool is_listening() const;
 
@@ -68,13 +99,23 @@ public:
 	virtual void mark_shutdown() NOEXCEPT;
 	virtual void force_shutdown() NOEXCEPT;
 
+	// 热重启时描述符交给新进程之后调用。此后这个进程不再读写这个套接字，
+	// 析构时也不调用 shutdown()，因为新进程仍在使用同一个打开的文件。
+	bool has_been_handed_over() const NOEXCEPT;
+	void mark_handed_over() NOEXCEPT;
+
 	virtual bool is_throttled() const;
 	void set_throttled(bool throttled);
 
 	bool did_time_out() const NOEXCEPT;
 
+	// 默认全部为零，TcpSessionBase 提供实际的数据。
+	virtual void get_traffic_statistics(TrafficStatistics &ret) const;
+
 	const IpPort &get_remote_info() const NOEXCEPT;
 	const IpPort &get_local_info() const NOEXCEPT;
+	// 仅适用于 Unix 域套接字（SO_PEERCRED），其他套接字返回 false。
+	bool get_peer_credentials(PeerCredentials &ret) const NOEXCEPT;
 
 	// 返回一个 errno 告诉 epoll 如何处理。
 	virtual int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable);
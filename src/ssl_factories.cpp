@@ -7,8 +7,21 @@
 #include "exception.hpp"
 #include "log.hpp"
 #include "profiler.hpp"
+#include "checked_arithmetic.hpp"
 #include "singletons/main_config.hpp"
+#include "mutex.hpp"
+#include "atomic.hpp"
+#include "time.hpp"
+#include <boost/container/map.hpp>
+#include <boost/container/deque.hpp>
 #include <openssl/ssl.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/core_names.h>
+#else
+#  include <openssl/hmac.h>
+#endif
 
 namespace Poseidon {
 
@@ -33,6 +46,316 @@ namespace {
 
 	::pthread_once_t g_ssl_once = PTHREAD_ONCE_INIT;
 
+	volatile boost::uint64_t g_handshakes = 0;
+	volatile boost::uint64_t g_resumed = 0;
+	volatile boost::uint64_t g_cache_hits = 0;
+	volatile boost::uint64_t g_cache_misses = 0;
+	volatile boost::uint64_t g_cache_entries = 0;
+	volatile boost::uint64_t g_ticket_key_rotations = 0;
+
+	// 服务端会话缓存，按会话 ID 分片以减少锁竞争。保存的是序列化之后的会话。
+	class SessionCacheShard : NONCOPYABLE {
+	private:
+		struct Element {
+			std::basic_string<unsigned char> data;
+			boost::uint64_t expiry_time;
+		};
+
+	private:
+		mutable Mutex m_mutex;
+		boost::container::map<std::basic_string<unsigned char>, Element> m_map;
+		// 按插入顺序记录会话 ID，超出容量时淘汰最早的。
+		boost::container::deque<std::basic_string<unsigned char> > m_order;
+
+	public:
+		void insert(const std::basic_string<unsigned char> &id, std::basic_string<unsigned char> data, boost::uint64_t expiry_time, std::size_t capacity){
+			const Mutex::UniqueLock lock(m_mutex);
+			AUTO(result, m_map.emplace(id, Element()));
+			if(result.second){
+				m_order.push_back(id);
+				atomic_add(g_cache_entries, 1, ATOMIC_RELAXED);
+			}
+			result.first->second.data.swap(data);
+			result.first->second.expiry_time = expiry_time;
+			while(m_map.size() > capacity){
+				if(m_map.erase(m_order.front()) != 0){
+					atomic_sub(g_cache_entries, 1, ATOMIC_RELAXED);
+				}
+				m_order.pop_front();
+			}
+			// 被显式删除的 ID 可能残留在 m_order 中，定期清理。
+			if(m_order.size() > m_map.size() * 2 + 16){
+				boost::container::deque<std::basic_string<unsigned char> > order;
+				for(AUTO(it, m_order.begin()); it != m_order.end(); ++it){
+					if(m_map.find(*it) != m_map.end()){
+						order.push_back(*it);
+					}
+				}
+				m_order.swap(order);
+			}
+		}
+		bool find(std::basic_string<unsigned char> &data, const std::basic_string<unsigned char> &id, boost::uint64_t now){
+			const Mutex::UniqueLock lock(m_mutex);
+			const AUTO(it, m_map.find(id));
+			if(it == m_map.end()){
+				return false;
+			}
+			if(it->second.expiry_time < now){
+				m_map.erase(it);
+				atomic_sub(g_cache_entries, 1, ATOMIC_RELAXED);
+				return false;
+			}
+			data = it->second.data;
+			return true;
+		}
+		void erase(const std::basic_string<unsigned char> &id){
+			const Mutex::UniqueLock lock(m_mutex);
+			if(m_map.erase(id) != 0){
+				atomic_sub(g_cache_entries, 1, ATOMIC_RELAXED);
+			}
+		}
+	};
+
+	CONSTEXPR const std::size_t SESSION_CACHE_SHARD_COUNT = 16;
+
+	SessionCacheShard g_session_cache[SESSION_CACHE_SHARD_COUNT];
+
+	SessionCacheShard &get_session_cache_shard(const std::basic_string<unsigned char> &id){
+		// 会话 ID 是随机生成的，直接使用其中的字节即可。
+		std::size_t seed = 0;
+		for(std::size_t i = 0; i < std::min<std::size_t>(id.size(), 4); ++i){
+			seed = (seed << 8) | id[i];
+		}
+		return g_session_cache[seed % SESSION_CACHE_SHARD_COUNT];
+	}
+
+	int new_session_callback(::SSL *ssl, ::SSL_SESSION *session){
+		PROFILE_ME;
+
+		(void)ssl;
+		try {
+			unsigned id_len;
+			const unsigned char *const id_data = ::SSL_SESSION_get_id(session, &id_len);
+			const std::basic_string<unsigned char> id(id_data, id_len);
+			const int size = ::i2d_SSL_SESSION(session, NULLPTR);
+			if(size <= 0){
+				return 0;
+			}
+			std::basic_string<unsigned char> data(static_cast<unsigned>(size), 0);
+			unsigned char *write_ptr = &data[0];
+			::i2d_SSL_SESSION(session, &write_ptr);
+			const AUTO(timeout, MainConfig::get<boost::uint64_t>("ssl_session_timeout", 300000));
+			const AUTO(capacity, MainConfig::get<std::size_t>("ssl_session_cache_size", 20480));
+			get_session_cache_shard(id).insert(id, STD_MOVE(data), saturated_add(get_fast_mono_clock(), timeout), capacity / SESSION_CACHE_SHARD_COUNT + 1);
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		}
+		// 我们保存的是副本，不持有 session 的引用。
+		return 0;
+	}
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	::SSL_SESSION *get_session_callback(::SSL *ssl, const unsigned char *id_data, int id_len, int *copy){
+#else
+	::SSL_SESSION *get_session_callback(::SSL *ssl, unsigned char *id_data, int id_len, int *copy){
+#endif
+		PROFILE_ME;
+
+		(void)ssl;
+		*copy = 0;
+		try {
+			const std::basic_string<unsigned char> id(id_data, static_cast<unsigned>(id_len));
+			std::basic_string<unsigned char> data;
+			if(!get_session_cache_shard(id).find(data, id, get_fast_mono_clock())){
+				atomic_add(g_cache_misses, 1, ATOMIC_RELAXED);
+				return NULLPTR;
+			}
+			atomic_add(g_cache_hits, 1, ATOMIC_RELAXED);
+			const unsigned char *read_ptr = data.data();
+			return ::d2i_SSL_SESSION(NULLPTR, &read_ptr, static_cast<long>(data.size()));
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			return NULLPTR;
+		}
+	}
+	void remove_session_callback(::SSL_CTX *ssl_ctx, ::SSL_SESSION *session){
+		PROFILE_ME;
+
+		(void)ssl_ctx;
+		try {
+			unsigned id_len;
+			const unsigned char *const id_data = ::SSL_SESSION_get_id(session, &id_len);
+			const std::basic_string<unsigned char> id(id_data, id_len);
+			get_session_cache_shard(id).erase(id);
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		}
+	}
+
+	void info_callback(const ::SSL *ssl, int where, int ret){
+		(void)ret;
+		if(!(where & SSL_CB_HANDSHAKE_DONE)){
+			return;
+		}
+		atomic_add(g_handshakes, 1, ATOMIC_RELAXED);
+		if(::SSL_session_reused(const_cast< ::SSL *>(ssl))){
+			atomic_add(g_resumed, 1, ATOMIC_RELAXED);
+		}
+	}
+
+	// 会话票据密钥。当前密钥用于加密新的票据，旧的密钥在轮换之后仍可用于解密，直到被挤出。
+	struct TicketKey {
+		unsigned char name[16];
+		unsigned char aes_key[32];
+		unsigned char hmac_key[32];
+	};
+
+	CONSTEXPR const std::size_t TICKET_KEY_COUNT = 3;
+
+	Mutex g_ticket_key_mutex;
+	TicketKey g_ticket_keys[TICKET_KEY_COUNT];
+	std::size_t g_ticket_key_count = 0;
+	boost::uint64_t g_ticket_key_rotation_time = 0;
+
+	// 调用时须持有 g_ticket_key_mutex。
+	void rotate_ticket_keys_if_needed(boost::uint64_t now){
+		if((g_ticket_key_count != 0) && (now < g_ticket_key_rotation_time)){
+			return;
+		}
+		TicketKey key;
+		DEBUG_THROW_UNLESS(::RAND_bytes(reinterpret_cast<unsigned char *>(&key), sizeof(key)) == 1, Exception, sslit("::RAND_bytes() failed"));
+		std::memmove(g_ticket_keys + 1, g_ticket_keys, sizeof(TicketKey) * (TICKET_KEY_COUNT - 1));
+		g_ticket_keys[0] = key;
+		g_ticket_key_count = std::min(g_ticket_key_count + 1, TICKET_KEY_COUNT);
+		const AUTO(period, MainConfig::get<boost::uint64_t>("ssl_ticket_key_rotation_period", 3600000));
+		g_ticket_key_rotation_time = saturated_add(now, period);
+		atomic_add(g_ticket_key_rotations, 1, ATOMIC_RELAXED);
+		LOG_POSEIDON_INFO("Rotated SSL session ticket keys: key_count = ", g_ticket_key_count);
+	}
+
+	// 返回 1 表示成功，2 表示成功但是票据应当用新的密钥重新签发，0 表示找不到密钥，-1 表示出错。
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	int ticket_key_callback(::SSL *ssl, unsigned char *key_name, unsigned char *iv, ::EVP_CIPHER_CTX *cipher_ctx, ::EVP_MAC_CTX *mac_ctx, int enc){
+#else
+	int ticket_key_callback(::SSL *ssl, unsigned char *key_name, unsigned char *iv, ::EVP_CIPHER_CTX *cipher_ctx, ::HMAC_CTX *mac_ctx, int enc){
+#endif
+		PROFILE_ME;
+
+		(void)ssl;
+		try {
+			TicketKey key;
+			int status = 1;
+			{
+				const Mutex::UniqueLock lock(g_ticket_key_mutex);
+				rotate_ticket_keys_if_needed(get_fast_mono_clock());
+				if(enc){
+					key = g_ticket_keys[0];
+					std::memcpy(key_name, key.name, sizeof(key.name));
+				} else {
+					std::size_t index = 0;
+					while((index < g_ticket_key_count) && (std::memcmp(g_ticket_keys[index].name, key_name, sizeof(key.name)) != 0)){
+						++index;
+					}
+					if(index >= g_ticket_key_count){
+						return 0;
+					}
+					key = g_ticket_keys[index];
+					status = (index == 0) ? 1 : 2;
+				}
+			}
+			if(enc){
+				if(::RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1){
+					return -1;
+				}
+				if(::EVP_EncryptInit_ex(cipher_ctx, ::EVP_aes_256_cbc(), NULLPTR, key.aes_key, iv) != 1){
+					return -1;
+				}
+			} else {
+				if(::EVP_DecryptInit_ex(cipher_ctx, ::EVP_aes_256_cbc(), NULLPTR, key.aes_key, iv) != 1){
+					return -1;
+				}
+			}
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			char digest[] = "SHA256";
+			::OSSL_PARAM params[] = {
+				::OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+				::OSSL_PARAM_construct_end(),
+			};
+			if(::EVP_MAC_init(mac_ctx, key.hmac_key, sizeof(key.hmac_key), params) != 1){
+				return -1;
+			}
+#else
+			if(::HMAC_Init_ex(mac_ctx, key.hmac_key, sizeof(key.hmac_key), ::EVP_sha256(), NULLPTR) != 1){
+				return -1;
+			}
+#endif
+			return status;
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+			return -1;
+		}
+	}
+
+	void set_session_resumption(::SSL_CTX *ssl_ctx){
+		const AUTO(timeout, MainConfig::get<boost::uint64_t>("ssl_session_timeout", 300000));
+		::SSL_CTX_set_timeout(ssl_ctx, static_cast<long>(std::min<boost::uint64_t>(timeout / 1000, LONG_MAX)));
+		::SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+		::SSL_CTX_sess_set_new_cb(ssl_ctx, &new_session_callback);
+		::SSL_CTX_sess_set_get_cb(ssl_ctx, &get_session_callback);
+		::SSL_CTX_sess_set_remove_cb(ssl_ctx, &remove_session_callback);
+		::SSL_CTX_set_info_callback(ssl_ctx, &info_callback);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		::SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, &ticket_key_callback);
+#else
+		::SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx, &ticket_key_callback);
+#endif
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	int alpn_select_callback(::SSL *ssl, const unsigned char **out, unsigned char *out_len, const unsigned char *in, unsigned in_len, void *arg){
+		(void)ssl;
+		(void)arg;
+
+		// 按照我们的优先级排列。只有启用 HTTP/2 时才提供 h2，否则对方会以为可以使用 HTTP/2。
+		static CONSTEXPR const unsigned char s_protocols[] = { 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+		const unsigned char *protocols = s_protocols;
+		unsigned protocols_len = sizeof(s_protocols);
+		if(!MainConfig::get<bool>("http2_enabled", false)){
+			protocols += 3;
+			protocols_len -= 3;
+		}
+		unsigned char *selected;
+		if(::SSL_select_next_proto(&selected, out_len, protocols, protocols_len, in, in_len) != OPENSSL_NPN_NEGOTIATED){
+			// 对方没有提供我们认识的协议，不使用 ALPN。
+			return SSL_TLSEXT_ERR_NOACK;
+		}
+		*out = selected;
+		return SSL_TLSEXT_ERR_OK;
+	}
+#endif
+
+	void set_alpn_selection(::SSL_CTX *ssl_ctx){
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+		::SSL_CTX_set_alpn_select_cb(ssl_ctx, &alpn_select_callback, NULLPTR);
+#else
+		(void)ssl_ctx;
+		if(MainConfig::get<bool>("http2_enabled", false)){
+			LOG_POSEIDON_WARNING("ALPN is not supported by this OpenSSL version. HTTP/2 over TLS will not be negotiated.");
+		}
+#endif
+	}
+
+	void set_ktls_option(::SSL_CTX *ssl_ctx){
+		if(!MainConfig::get<bool>("ssl_ktls_enabled", false)){
+			return;
+		}
+#ifdef SSL_OP_ENABLE_KTLS
+		LOG_POSEIDON_INFO("Enabling kernel TLS offload...");
+		::SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+#else
+		LOG_POSEIDON_WARNING("Kernel TLS is not supported by this OpenSSL version.");
+#endif
+	}
+
 #ifdef POSEIDON_CXX11
 	UniqueSslCtx
 #else
@@ -51,6 +374,8 @@ namespace {
 		DEBUG_THROW_UNLESS(ssl_ctx.reset(::SSL_CTX_new(::SSLv23_server_method())), Exception, sslit("::SSLv23_server_method() failed"));
 		::SSL_CTX_set_options(ssl_ctx.get(), SSL_OP_NO_SSLv2);
 		::SSL_CTX_set_options(ssl_ctx.get(), SSL_OP_NO_SSLv3);
+		set_ktls_option(ssl_ctx.get());
+		set_alpn_selection(ssl_ctx.get());
 		if(certificate && *certificate){
 			LOG_POSEIDON_INFO("Loading server certificate: ", certificate);
 			DEBUG_THROW_UNLESS(::SSL_CTX_use_certificate_chain_file(ssl_ctx.get(), certificate) == 1, Exception, sslit("::SSL_CTX_use_certificate_file() failed"));
@@ -61,6 +386,8 @@ namespace {
 			LOG_POSEIDON_INFO("Setting session ID context...");
 			static CONSTEXPR const unsigned char ssl_session_id[SSL_MAX_SSL_SESSION_ID_LENGTH] = { __DATE__ __TIME__ };
 			DEBUG_THROW_UNLESS(::SSL_CTX_set_session_id_context(ssl_ctx.get(), ssl_session_id, sizeof(ssl_session_id)) == 1, Exception, sslit("::SSL_CTX_set_session_id_context() failed"));
+			LOG_POSEIDON_INFO("Setting up session resumption...");
+			set_session_resumption(ssl_ctx.get());
 			::SSL_CTX_set_verify(ssl_ctx.get(), SSL_VERIFY_PEER, NULLPTR);
 		} else {
 			::SSL_CTX_set_verify(ssl_ctx.get(), SSL_VERIFY_NONE, NULLPTR);
@@ -86,6 +413,7 @@ namespace {
 		DEBUG_THROW_UNLESS(ssl_ctx.reset(::SSL_CTX_new(::SSLv23_client_method())), Exception, sslit("::SSLv23_client_method() failed"));
 		::SSL_CTX_set_options(ssl_ctx.get(), SSL_OP_NO_SSLv2);
 		::SSL_CTX_set_options(ssl_ctx.get(), SSL_OP_NO_SSLv3);
+		set_ktls_option(ssl_ctx.get());
 		if(verify_peer){
 			const AUTO(ssl_cert_directory, MainConfig::get<std::string>("ssl_cert_directory", "/etc/ssl/certs"));
 			LOG_POSEIDON_INFO("Loading trusted CA certificates: ", ssl_cert_directory);
@@ -98,6 +426,15 @@ namespace {
 	}
 }
 
+void SslServerFactory::get_session_cache_stats(SslServerFactory::SessionCacheStats &stats){
+	stats.handshakes           = atomic_load(g_handshakes, ATOMIC_RELAXED);
+	stats.resumed              = atomic_load(g_resumed, ATOMIC_RELAXED);
+	stats.cache_hits           = atomic_load(g_cache_hits, ATOMIC_RELAXED);
+	stats.cache_misses         = atomic_load(g_cache_misses, ATOMIC_RELAXED);
+	stats.cache_entries        = atomic_load(g_cache_entries, ATOMIC_RELAXED);
+	stats.ticket_key_rotations = atomic_load(g_ticket_key_rotations, ATOMIC_RELAXED);
+}
+
 SslServerFactory::SslServerFactory(const char *certificate, const char *private_key)
 	: m_ssl_ctx(create_server_ssl_ctx(certificate, private_key))
 { }
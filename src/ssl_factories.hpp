@@ -8,12 +8,26 @@
 #include "cxx_util.hpp"
 #include "ssl_raii.hpp"
 #include <boost/scoped_ptr.hpp>
+#include <boost/cstdint.hpp>
 
 namespace Poseidon {
 
 class SslFilter;
 
 class SslServerFactory : NONCOPYABLE {
+public:
+	struct SessionCacheStats {
+		boost::uint64_t handshakes;
+		boost::uint64_t resumed;
+		boost::uint64_t cache_hits;
+		boost::uint64_t cache_misses;
+		boost::uint64_t cache_entries;
+		boost::uint64_t ticket_key_rotations;
+	};
+
+	// 所有 SslServerFactory 共享同一个会话缓存和会话票据密钥。
+	static void get_session_cache_stats(SessionCacheStats &stats);
+
 private:
 	const UniqueSslCtx m_ssl_ctx;
 
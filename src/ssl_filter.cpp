@@ -6,6 +6,7 @@
 #include "exception.hpp"
 #include "log.hpp"
 #include "profiler.hpp"
+#include "atomic.hpp"
 #include <sys/socket.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -48,6 +49,7 @@ namespace {
 
 SslFilter::SslFilter(Move<UniqueSsl> ssl, SslFilter::Direction dir, int fd)
 	: m_ssl(STD_MOVE(ssl))
+	, m_handshake_finished(false), m_kernel_send_checked(false), m_kernel_send(false)
 {
 	if(dir == DIR_TO_CONNECT){
 		::SSL_set_connect_state(m_ssl.get());
@@ -116,4 +118,52 @@ void SslFilter::send_fin() NOEXCEPT {
 	}
 }
 
+bool SslFilter::is_handshake_finished() NOEXCEPT {
+	if(atomic_load(m_handshake_finished, ATOMIC_ACQUIRE)){
+		return true;
+	}
+	const Mutex::UniqueLock lock(m_mutex);
+	if(!::SSL_is_init_finished(m_ssl.get())){
+		return false;
+	}
+	atomic_store(m_handshake_finished, true, ATOMIC_RELEASE);
+	return true;
+}
+int SslFilter::do_handshake(bool &want_write){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	const int status = ::SSL_do_handshake(m_ssl.get());
+	if(status == 1){
+		atomic_store(m_handshake_finished, true, ATOMIC_RELEASE);
+		return 0;
+	}
+	want_write = (::SSL_get_error(m_ssl.get(), status) == SSL_ERROR_WANT_WRITE);
+	const int err = get_errno_from_ssl_ret(m_ssl.get(), status);
+	if(err == 0){
+		// 对方在握手完成之前关闭了连接。
+		return EPIPE;
+	}
+	return err;
+}
+
+bool SslFilter::is_kernel_send_active() NOEXCEPT {
+	if(atomic_load(m_kernel_send_checked, ATOMIC_ACQUIRE)){
+		return atomic_load(m_kernel_send, ATOMIC_RELAXED);
+	}
+	const Mutex::UniqueLock lock(m_mutex);
+	if(!::SSL_is_init_finished(m_ssl.get())){
+		return false;
+	}
+	// 握手完成之后结果不会再改变，只需要检查一次。
+	bool active = false;
+#ifdef BIO_get_ktls_send
+	active = BIO_get_ktls_send(::SSL_get_wbio(m_ssl.get()));
+#endif
+	LOG_POSEIDON_DEBUG("SSL handshake finished: kernel_send_active = ", active);
+	atomic_store(m_kernel_send, active, ATOMIC_RELAXED);
+	atomic_store(m_kernel_send_checked, true, ATOMIC_RELEASE);
+	return active;
+}
+
 }
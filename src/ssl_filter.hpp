@@ -23,6 +23,9 @@ private:
 	const UniqueSsl m_ssl;
 
 	mutable Mutex m_mutex;
+	volatile bool m_handshake_finished;
+	volatile bool m_kernel_send_checked;
+	volatile bool m_kernel_send;
 
 public:
 	SslFilter(Move<UniqueSsl> ssl, Direction dir, int fd);
@@ -32,6 +35,15 @@ public:
 	long recv(void *data, unsigned long size);
 	long send(const void *data, unsigned long size);
 	void send_fin() NOEXCEPT;
+
+	bool is_handshake_finished() NOEXCEPT;
+	// 推进一步握手。握手完成返回 0，需要等待套接字时返回 EWOULDBLOCK，
+	// 此时 want_write 指示等待的是可写（true）还是可读（false）；出错返回其他 errno。
+	int do_handshake(bool &want_write);
+
+	// 如果握手完成后 OpenSSL 已经把发送密钥安装到了内核（kTLS），返回 true。
+	// 此时明文可以直接写入套接字，由内核或网卡加密。
+	bool is_kernel_send_active() NOEXCEPT;
 };
 
 }
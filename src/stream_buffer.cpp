@@ -4,7 +4,22 @@
 #include "precompiled.hpp"
 #include "stream_buffer.hpp"
 #include "checked_arithmetic.hpp"
+#include "atomic.hpp"
+#include "endian.hpp"
+#include "vint64.hpp"
+#include "huge_pages.hpp"
+#include "log.hpp"
+#include <new>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <boost/type_traits/common_type.hpp>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
@@ -12,26 +27,476 @@ namespace {
 	// XXX: Emulate C++14 `std::exchange()`.
 	template<typename T>
 	inline T exchange(T &t, typename boost::common_type<T>::type u){
-		AUTO(v, STD_MOVE(t));
+		// C++98 中 AUTO(v, STD_MOVE(t)) 得到的是引用 t 的 Move<T>，必须显式构造一个副本。
+		T v(STD_MOVE_IDN(t));
 		t = STD_MOVE(u);
 		return v;
 	}
+
+	// 常见大小的数据块在释放后进入线程局部的空闲链表，满了之后按批转移到全局池中。
+	// epoll 线程分配、任务线程释放时，全局池使得每一批只需要加锁一次。
+	struct SizeClass {
+		std::size_t min_capacity;
+		std::size_t capacity;
+		std::size_t local_max;
+		std::size_t batch_size;
+		std::size_t global_max_batches;
+	};
+
+	const SizeClass g_size_classes[] = {
+		{     0,  1024, 64, 32, 64 },
+		{  1025,  4096, 32, 16, 64 },
+		{ 16385, 65536,  8,  4, 16 },
+	};
+	const std::size_t SIZE_CLASS_COUNT = sizeof(g_size_classes) / sizeof(g_size_classes[0]);
+
+	// 复制或切分不少于这么多字节时共享数据块，否则直接复制。
+	const std::size_t SHARING_THRESHOLD = 256;
+
+	struct FreeBlock {
+		FreeBlock *next;
+		FreeBlock *next_batch;
+	};
+
+	struct LocalCache {
+		FreeBlock *head;
+		std::size_t count;
+	};
+
+	// 全局池只由 POD 构成，静态析构之后仍然可以使用。
+	struct GlobalPool {
+		volatile bool locked;
+		FreeBlock *batches;
+		std::size_t batch_count;
+	};
+
+	// 启用大页区域之后，最大一级的数据块从中切分。区域中的块从不交给 operator delete，全局池满时放回区域的空闲链表。
+	struct HugeRegion {
+		volatile bool locked;
+		char *base;
+		std::size_t size;
+		std::size_t used;
+		FreeBlock *free_head;
+	};
+
+	__thread LocalCache t_caches[SIZE_CLASS_COUNT];
+	__thread bool t_cache_registered;
+	GlobalPool g_pools[SIZE_CLASS_COUNT];
+	HugeRegion g_huge_region;
+
+	::pthread_once_t g_cache_key_once = PTHREAD_ONCE_INIT;
+	::pthread_key_t g_cache_key;
+
+	// 介于两个类别之间且离上一个类别较远的请求不取整，避免浪费太多内存。
+	std::size_t find_size_class(std::size_t capacity) NOEXCEPT {
+		for(std::size_t i = 0; i < SIZE_CLASS_COUNT; ++i){
+			if((g_size_classes[i].min_capacity <= capacity) && (capacity <= g_size_classes[i].capacity)){
+				return i;
+			}
+		}
+		return SIZE_CLASS_COUNT;
+	}
+
+	void lock_pool(GlobalPool &pool) NOEXCEPT {
+		while(atomic_exchange(pool.locked, true, ATOMIC_ACQUIRE)){
+			atomic_pause();
+		}
+	}
+	void unlock_pool(GlobalPool &pool) NOEXCEPT {
+		atomic_store(pool.locked, false, ATOMIC_RELEASE);
+	}
+
+	// base 和 size 只在 reserve_huge_pages() 中设置一次，此后只读，不需要加锁。
+	bool is_in_huge_region(const void *ptr) NOEXCEPT {
+		const AUTO(p, static_cast<const char *>(ptr));
+		return (g_huge_region.base <= p) && (p < g_huge_region.base + g_huge_region.size);
+	}
+	void lock_huge_region() NOEXCEPT {
+		while(atomic_exchange(g_huge_region.locked, true, ATOMIC_ACQUIRE)){
+			atomic_pause();
+		}
+	}
+	void unlock_huge_region() NOEXCEPT {
+		atomic_store(g_huge_region.locked, false, ATOMIC_RELEASE);
+	}
+	void *allocate_from_huge_region(std::size_t block_size) NOEXCEPT {
+		block_size = (block_size + 63) / 64 * 64;
+		void *block = NULLPTR;
+		lock_huge_region();
+		if(g_huge_region.free_head){
+			block = g_huge_region.free_head;
+			g_huge_region.free_head = g_huge_region.free_head->next;
+		} else if(g_huge_region.size - g_huge_region.used >= block_size){
+			block = g_huge_region.base + g_huge_region.used;
+			g_huge_region.used += block_size;
+		}
+		unlock_huge_region();
+		return block;
+	}
+
+	void free_list(FreeBlock *head) NOEXCEPT {
+		while(head){
+			const AUTO(next, head->next);
+			if(is_in_huge_region(head)){
+				lock_huge_region();
+				head->next = g_huge_region.free_head;
+				g_huge_region.free_head = head;
+				unlock_huge_region();
+			} else {
+				::operator delete(head);
+			}
+			head = next;
+		}
+	}
+	// 把一串空闲块作为一批放入全局池，池满时直接释放。
+	void push_batch(std::size_t index, FreeBlock *batch) NOEXCEPT {
+		AUTO_REF(pool, g_pools[index]);
+		lock_pool(pool);
+		if(pool.batch_count < g_size_classes[index].global_max_batches){
+			batch->next_batch = pool.batches;
+			pool.batches = batch;
+			++pool.batch_count;
+			batch = NULLPTR;
+		}
+		unlock_pool(pool);
+		free_list(batch);
+	}
+	FreeBlock *pop_batch(std::size_t index) NOEXCEPT {
+		AUTO_REF(pool, g_pools[index]);
+		lock_pool(pool);
+		const AUTO(batch, pool.batches);
+		if(batch){
+			pool.batches = batch->next_batch;
+			--pool.batch_count;
+		}
+		unlock_pool(pool);
+		return batch;
+	}
+
+	void flush_local_caches(void *) NOEXCEPT {
+		for(std::size_t i = 0; i < SIZE_CLASS_COUNT; ++i){
+			AUTO_REF(cache, t_caches[i]);
+			if(cache.head){
+				push_batch(i, cache.head);
+			}
+			cache.head = NULLPTR;
+			cache.count = 0;
+		}
+		t_cache_registered = false;
+	}
+	void create_cache_key() NOEXCEPT {
+		if(::pthread_key_create(&g_cache_key, &flush_local_caches) != 0){
+			std::abort();
+		}
+	}
+	void register_local_caches() NOEXCEPT {
+		if(t_cache_registered){
+			return;
+		}
+		// 线程退出时把局部空闲链表交还给全局池。键的值只要非空即可。
+		::pthread_once(&g_cache_key_once, &create_cache_key);
+		::pthread_setspecific(g_cache_key, &t_cache_registered);
+		t_cache_registered = true;
+	}
+
+	void *allocate_chunk(std::size_t &capacity, std::size_t header_size){
+		const std::size_t index = find_size_class(capacity);
+		if(index == SIZE_CLASS_COUNT){
+			capacity |= 1024;
+			return ::operator new(checked_add(header_size, capacity));
+		}
+		capacity = g_size_classes[index].capacity;
+		AUTO_REF(cache, t_caches[index]);
+		if(!cache.head){
+			const AUTO(batch, pop_batch(index));
+			if(!batch){
+				if(index == SIZE_CLASS_COUNT - 1){
+					const AUTO(block, allocate_from_huge_region(header_size + capacity));
+					if(block){
+						return block;
+					}
+				}
+				return ::operator new(header_size + capacity);
+			}
+			std::size_t count = 0;
+			for(AUTO(block, batch); block; block = block->next){
+				++count;
+			}
+			register_local_caches();
+			cache.head = batch;
+			cache.count = count;
+		}
+		const AUTO(block, cache.head);
+		cache.head = block->next;
+		--cache.count;
+		return block;
+	}
+	void deallocate_chunk(void *ptr, std::size_t capacity) NOEXCEPT {
+		const std::size_t index = find_size_class(capacity);
+		if((index == SIZE_CLASS_COUNT) || (capacity != g_size_classes[index].capacity)){
+			::operator delete(ptr);
+			return;
+		}
+		const AUTO_REF(size_class, g_size_classes[index]);
+		AUTO_REF(cache, t_caches[index]);
+		register_local_caches();
+		const AUTO(block, static_cast<FreeBlock *>(ptr));
+		block->next = cache.head;
+		cache.head = block;
+		++cache.count;
+		if(cache.count < size_class.local_max){
+			return;
+		}
+		// 局部链表满了，把前 batch_size 块作为一批交给全局池。
+		AUTO(last, cache.head);
+		for(std::size_t i = 1; i < size_class.batch_size; ++i){
+			last = last->next;
+		}
+		const AUTO(batch, cache.head);
+		cache.head = last->next;
+		cache.count -= size_class.batch_size;
+		last->next = NULLPTR;
+		push_batch(index, batch);
+	}
+}
+
+void StreamBuffer::reserve_huge_pages(std::size_t region_size){
+	if((region_size == 0) || g_huge_region.base){
+		return;
+	}
+	HugePageBacking backing;
+	const AUTO(base, map_huge_page_region(region_size, backing));
+	if(!base){
+		LOG_POSEIDON_WARNING("Failed to map stream buffer region, falling back to operator new: region_size = ", region_size);
+		return;
+	}
+	g_huge_region.base = static_cast<char *>(base);
+	g_huge_region.size = region_size;
+	LOG_POSEIDON_INFO("Mapped stream buffer region: region_size = ", region_size, ", backing = ", get_huge_page_backing_name(backing));
+}
+
+namespace {
+	// dst 和 src 可以相同。mask 的低 8 位对应第一个字节。
+	void xor_mask_bytes(unsigned char *dst, const unsigned char *src, std::size_t count, boost::uint32_t &mask) NOEXCEPT {
+		unsigned char pattern[8];
+		for(unsigned i = 0; i < 8; ++i){
+			pattern[i] = static_cast<unsigned char>(mask >> (i % 4 * 8));
+		}
+		boost::uint32_t word32;
+		std::memcpy(&word32, pattern, 4);
+		boost::uint64_t word64;
+		std::memcpy(&word64, pattern, 8);
+
+		std::size_t i = 0;
+		// 每一步处理的字节数都是 4 的倍数，因此 pattern 的相位保持不变。
+#ifdef __AVX2__
+		const __m256i mask256 = _mm256_set1_epi32(static_cast<int>(word32));
+		for(; count - i >= 32; i += 32){
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(v, mask256));
+		}
+#endif
+#ifdef __SSE2__
+		const __m128i mask128 = _mm_set1_epi32(static_cast<int>(word32));
+		for(; count - i >= 16; i += 16){
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(v, mask128));
+		}
+#endif
+		for(; count - i >= 8; i += 8){
+			boost::uint64_t v;
+			std::memcpy(&v, src + i, 8);
+			v ^= word64;
+			std::memcpy(dst + i, &v, 8);
+		}
+		for(; i < count; ++i){
+			dst[i] = src[i] ^ pattern[i % 4];
+		}
+		const unsigned shift = static_cast<unsigned>(count % 4) * 8;
+		if(shift != 0){
+			mask = (mask >> shift) | (mask << (32 - shift));
+		}
+	}
+
+	// glibc 的 memchr() 已经是向量化的，这里只用它来定位首字节。
+	std::ptrdiff_t find_in_contiguous(const unsigned char *data, std::size_t size, std::size_t from, const unsigned char *pattern, std::size_t count) NOEXCEPT {
+		std::size_t pos = from;
+		while(size - pos >= count){
+			const AUTO(hit, static_cast<const unsigned char *>(std::memchr(data + pos, pattern[0], size - pos - count + 1)));
+			if(!hit){
+				break;
+			}
+			pos = static_cast<std::size_t>(hit - data);
+			if(std::memcmp(hit + 1, pattern + 1, count - 1) == 0){
+				return static_cast<std::ptrdiff_t>(pos);
+			}
+			++pos;
+		}
+		return -1;
+	}
 }
 
+namespace {
+	struct ArenaBlock {
+		volatile std::size_t refs;
+		std::size_t capacity;
+		std::size_t used;
+		__extension__ unsigned char storage[];
+	};
+
+	__thread StreamBuffer::ScratchArena *t_current_arena;
+
+	void release_arena_block(void *ptr) NOEXCEPT {
+		const AUTO(block, static_cast<ArenaBlock *>(ptr));
+		if(atomic_sub(block->refs, 1, ATOMIC_ACQ_REL) == 0){
+			::operator delete(block);
+		}
+	}
+}
+
+StreamBuffer::ScratchArena::ScratchArena(std::size_t block_size)
+	: m_block_size(block_size), m_prev(t_current_arena), m_block(NULLPTR)
+{
+	t_current_arena = this;
+}
+StreamBuffer::ScratchArena::~ScratchArena(){
+	assert(t_current_arena == this);
+	t_current_arena = m_prev;
+	if(m_block){
+		release_arena_block(m_block);
+	}
+}
+
+void *StreamBuffer::ScratchArena::allocate_current(std::size_t &capacity, std::size_t header_size, void *&block) NOEXCEPT {
+	const AUTO(arena, t_current_arena);
+	if(!arena){
+		return NULLPTR;
+	}
+	// 整块没有空闲链表，因此不按大小类别取整，只保证一定的余量用于追加。大块仍然单独分配。
+	const std::size_t rounded = (std::max<std::size_t>(capacity, 256) + 15) / 16 * 16;
+	const std::size_t size = (header_size + 15) / 16 * 16 + rounded;
+	if(size > arena->m_block_size / 4){
+		return NULLPTR;
+	}
+	AUTO(current, static_cast<ArenaBlock *>(arena->m_block));
+	if(!current || (current->capacity - current->used < size)){
+		const AUTO(fresh, static_cast<ArenaBlock *>(::operator new(sizeof(ArenaBlock) + 15 + arena->m_block_size, std::nothrow)));
+		if(!fresh){
+			return NULLPTR;
+		}
+		fresh->refs = 1;
+		fresh->capacity = arena->m_block_size;
+		// 让切分出来的地址按 16 字节对齐。
+		fresh->used = (16 - reinterpret_cast<std::size_t>(fresh->storage) % 16) % 16;
+		if(current){
+			release_arena_block(current);
+		}
+		arena->m_block = fresh;
+		current = fresh;
+	}
+	void *const ptr = current->storage + current->used;
+	current->used += size;
+	atomic_add(current->refs, 1, ATOMIC_RELAXED);
+	capacity = rounded;
+	block = current;
+	return ptr;
+}
+
+// 数据块可以被多个 StreamBuffer 共享。拥有存储的块（owner）和数据位于同一次分配中，
+// 共享的块只有头部，指向 owner 的存储并增加其引用计数。
+// 只有引用计数为 1 时才允许写入存储，否则追加的数据写到新的块中。
+// 文件映射的 owner 只有头部，data 指向 mmap 得到的只读区域，capacity 为映射的长度。
+// 从 ScratchArena 分配的 owner 的 arena 指向所在的整块。
 struct StreamBuffer::ChunkHeader {
 	static ChunkHeader *create(std::size_t min_capacity, ChunkHeader *prev, ChunkHeader *next, bool backward){
-		const std::size_t capacity = min_capacity | 1024;
+		std::size_t capacity = min_capacity;
+		void *arena = NULLPTR;
+		AUTO(chunk, static_cast<ChunkHeader *>(ScratchArena::allocate_current(capacity, sizeof(ChunkHeader), arena)));
+		if(!chunk){
+			// 常见大小向上取整到空闲链表的大小类别，其余的仍然按 `min_capacity | 1024` 分配。
+			capacity = min_capacity;
+			chunk = static_cast<ChunkHeader *>(allocate_chunk(capacity, sizeof(ChunkHeader)));
+		}
 		const std::size_t origin = backward ? capacity : 0;
-		const AUTO(chunk, static_cast<ChunkHeader *>(::operator new(checked_add(sizeof(ChunkHeader), capacity))));
 		chunk->capacity = capacity;
 		chunk->prev = prev;
 		chunk->next = next;
 		chunk->begin = origin;
 		chunk->end = origin;
+		chunk->data = chunk->storage;
+		chunk->owner = chunk;
+		chunk->arena = arena;
+		chunk->refs = 1;
+		return chunk;
+	}
+	static ChunkHeader *create_shared(const ChunkHeader *src, std::size_t begin, std::size_t end, ChunkHeader *prev, ChunkHeader *next){
+		const AUTO(chunk, static_cast<ChunkHeader *>(::operator new(sizeof(ChunkHeader))));
+		chunk->capacity = src->capacity;
+		chunk->prev = prev;
+		chunk->next = next;
+		chunk->begin = begin;
+		chunk->end = end;
+		chunk->data = src->data;
+		chunk->owner = src->owner;
+		chunk->arena = NULLPTR;
+		chunk->refs = 0;
+		atomic_add(chunk->owner->refs, 1, ATOMIC_RELAXED);
+		return chunk;
+	}
+	static ChunkHeader *create_mapped(void *base, std::size_t length, std::size_t begin, ChunkHeader *prev){
+		const AUTO(chunk, static_cast<ChunkHeader *>(::operator new(sizeof(ChunkHeader))));
+		chunk->capacity = length;
+		chunk->prev = prev;
+		chunk->next = NULLPTR;
+		chunk->begin = begin;
+		chunk->end = length;
+		chunk->data = static_cast<unsigned char *>(base);
+		chunk->owner = chunk;
+		chunk->arena = NULLPTR;
+		chunk->refs = 1;
 		return chunk;
 	}
 	static void destroy(ChunkHeader *chunk) NOEXCEPT {
-		::operator delete(chunk);
+		const AUTO(owner, chunk->owner);
+		if(chunk != owner){
+			::operator delete(chunk);
+		}
+		// owner 所在的链表可能早已销毁了它，此时它的头部只用于保存引用计数。
+		if(atomic_sub(owner->refs, 1, ATOMIC_ACQ_REL) == 0){
+			if(is_mapped(owner)){
+				::munmap(owner->data, owner->capacity);
+				::operator delete(owner);
+			} else if(owner->arena){
+				release_arena_block(owner->arena);
+			} else {
+				deallocate_chunk(owner, owner->capacity);
+			}
+		}
+	}
+	// 判断从 chunk 的第 pos 个字节开始是否为 pattern，可以跨越数据块。
+	static bool matches(const ChunkHeader *chunk, std::size_t pos, const unsigned char *pattern, std::size_t count) NOEXCEPT {
+		std::size_t matched = 0;
+		while(matched < count){
+			if(!chunk){
+				return false;
+			}
+			const std::size_t avail = std::min(chunk->end - chunk->begin - pos, count - matched);
+			if(std::memcmp(chunk->data + chunk->begin + pos, pattern + matched, avail) != 0){
+				return false;
+			}
+			matched += avail;
+			chunk = chunk->next;
+			pos = 0;
+		}
+		return true;
+	}
+	static bool is_mapped(const ChunkHeader *owner) NOEXCEPT {
+		return owner->data != owner->storage;
+	}
+	static bool is_exclusive(const ChunkHeader *chunk) NOEXCEPT {
+		// 映射的区域是只读的，总是视为共享。
+		const AUTO(owner, chunk->owner);
+		return !is_mapped(owner) && (atomic_load(owner->refs, ATOMIC_ACQUIRE) == 1);
 	}
 
 	std::size_t capacity;
@@ -40,7 +505,12 @@ struct StreamBuffer::ChunkHeader {
 
 	std::size_t begin;
 	std::size_t end;
-	__extension__ unsigned char data[];
+	unsigned char *data;
+
+	ChunkHeader *owner;
+	void *arena;
+	volatile std::size_t refs;
+	__extension__ unsigned char storage[];
 };
 
 StreamBuffer::StreamBuffer(const void *data, std::size_t count)
@@ -82,17 +552,47 @@ StreamBuffer::~StreamBuffer(){
 #endif
 }
 
+void StreamBuffer::spill(){
+	if(m_first || (m_size == 0)){
+		return;
+	}
+	const AUTO(chunk, ChunkHeader::create(m_size, NULLPTR, NULLPTR, false));
+	std::memcpy(chunk->data, m_inline, m_size);
+	chunk->end = m_size;
+	m_first = chunk;
+	m_last = chunk;
+}
+
 void StreamBuffer::clear() NOEXCEPT {
+	// 只保留最后一个独占的数据块以便复用。写入只会追加到最后一个数据块，
+	// 如果保留所有的数据块，反复 clear() 再写入会使链表越来越长。
+	AUTO(last, m_last);
+	if(last && !ChunkHeader::is_exclusive(last)){
+		last = NULLPTR;
+	}
 	AUTO(chunk, m_first);
 	while(chunk){
-		chunk->begin = chunk->end;
 		const AUTO(next, chunk->next);
+		if(chunk != last){
+			ChunkHeader::destroy(chunk);
+		}
 		chunk = next;
 	}
+	if(last){
+		last->prev = NULLPTR;
+		last->next = NULLPTR;
+		last->begin = 0;
+		last->end = 0;
+	}
+	m_first = last;
+	m_last = last;
 	m_size = 0;
 }
 
 int StreamBuffer::front() const NOEXCEPT {
+	if(is_inline()){
+		return (m_size != 0) ? m_inline[0] : -1;
+	}
 	int read = -1;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -106,6 +606,15 @@ int StreamBuffer::front() const NOEXCEPT {
 	return read;
 }
 int StreamBuffer::get() NOEXCEPT {
+	if(is_inline()){
+		if(m_size == 0){
+			return -1;
+		}
+		const int read = m_inline[0];
+		m_size -= 1;
+		std::memmove(m_inline, m_inline + 1, m_size);
+		return read;
+	}
 	int read = -1;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -124,6 +633,14 @@ int StreamBuffer::get() NOEXCEPT {
 	return read;
 }
 bool StreamBuffer::discard() NOEXCEPT {
+	if(is_inline()){
+		if(m_size == 0){
+			return false;
+		}
+		m_size -= 1;
+		std::memmove(m_inline, m_inline + 1, m_size);
+		return true;
+	}
 	bool discarded = false;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -142,8 +659,19 @@ bool StreamBuffer::discard() NOEXCEPT {
 	return discarded;
 }
 void StreamBuffer::put(int data){
+	if(is_inline()){
+		if(m_size < INLINE_CAPACITY){
+			m_inline[m_size] = static_cast<unsigned char>(data);
+			m_size += 1;
+			return;
+		}
+		spill();
+	}
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && !ChunkHeader::is_exclusive(chunk)){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity == chunk->end)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity > avail){
@@ -165,6 +693,9 @@ void StreamBuffer::put(int data){
 	m_size += 1;
 }
 int StreamBuffer::back() const NOEXCEPT {
+	if(is_inline()){
+		return (m_size != 0) ? m_inline[m_size - 1] : -1;
+	}
 	int read = -1;
 	AUTO(chunk, m_last);
 	while(chunk){
@@ -178,6 +709,13 @@ int StreamBuffer::back() const NOEXCEPT {
 	return read;
 }
 int StreamBuffer::unput() NOEXCEPT {
+	if(is_inline()){
+		if(m_size == 0){
+			return -1;
+		}
+		m_size -= 1;
+		return m_inline[m_size];
+	}
 	int read = -1;
 	AUTO(chunk, m_last);
 	while(chunk){
@@ -196,8 +734,20 @@ int StreamBuffer::unput() NOEXCEPT {
 	return read;
 }
 void StreamBuffer::unget(int data){
+	if(is_inline()){
+		if(m_size < INLINE_CAPACITY){
+			std::memmove(m_inline + 1, m_inline, m_size);
+			m_inline[0] = static_cast<unsigned char>(data);
+			m_size += 1;
+			return;
+		}
+		spill();
+	}
 	AUTO(chunk, m_first);
 	AUTO(next, chunk);
+	if(chunk && !ChunkHeader::is_exclusive(chunk)){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->begin == 0)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity > avail){
@@ -220,6 +770,11 @@ void StreamBuffer::unget(int data){
 }
 
 std::size_t StreamBuffer::peek(void *data, std::size_t count) const NOEXCEPT {
+	if(is_inline()){
+		const std::size_t total = std::min(count, m_size);
+		std::memcpy(data, m_inline, total);
+		return total;
+	}
 	std::size_t total = 0;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -240,7 +795,30 @@ std::size_t StreamBuffer::peek(void *data, std::size_t count) const NOEXCEPT {
 	}
 	return total;
 }
+const void *StreamBuffer::peek_contiguous(std::size_t count) const NOEXCEPT {
+	if(is_inline()){
+		if(m_size < count){
+			return NULLPTR;
+		}
+		return m_inline;
+	}
+	AUTO(chunk, m_first);
+	while(chunk && (chunk->end == chunk->begin)){
+		chunk = chunk->next;
+	}
+	if(!chunk || (chunk->end - chunk->begin < count)){
+		return NULLPTR;
+	}
+	return chunk->data + chunk->begin;
+}
 std::size_t StreamBuffer::get(void *data, std::size_t count) NOEXCEPT {
+	if(is_inline()){
+		const std::size_t total = std::min(count, m_size);
+		std::memcpy(data, m_inline, total);
+		m_size -= total;
+		std::memmove(m_inline, m_inline + total, m_size);
+		return total;
+	}
 	std::size_t total = 0;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -269,6 +847,12 @@ std::size_t StreamBuffer::get(void *data, std::size_t count) NOEXCEPT {
 	return total;
 }
 std::size_t StreamBuffer::discard(std::size_t count) NOEXCEPT {
+	if(is_inline()){
+		const std::size_t total = std::min(count, m_size);
+		m_size -= total;
+		std::memmove(m_inline, m_inline + total, m_size);
+		return total;
+	}
 	std::size_t total = 0;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -294,9 +878,52 @@ std::size_t StreamBuffer::discard(std::size_t count) NOEXCEPT {
 	}
 	return total;
 }
+void StreamBuffer::unget(const void *data, std::size_t count){
+	if(is_inline()){
+		if(INLINE_CAPACITY - m_size >= count){
+			std::memmove(m_inline + count, m_inline, m_size);
+			std::memcpy(m_inline, data, count);
+			m_size += count;
+			return;
+		}
+		if(m_size != 0){
+			// 把内联的数据复制到新的数据块的末尾，前面留出 count 字节。
+			const AUTO(chunk, ChunkHeader::create(m_size + count, NULLPTR, NULLPTR, true));
+			chunk->begin -= m_size;
+			std::memcpy(chunk->data + chunk->begin, m_inline, m_size);
+			m_first = chunk;
+			m_last = chunk;
+		}
+	}
+	AUTO(chunk, m_first);
+	const AUTO(next, chunk);
+	if(chunk && (!ChunkHeader::is_exclusive(chunk) || (chunk->begin < count))){
+		chunk = NULLPTR;
+	}
+	if(!chunk){
+		const AUTO(prev, ChunkHeader::create(count, NULLPTR, next, true));
+		(next ? next->prev : m_last) = prev;
+		m_first = prev;
+		chunk = prev;
+	}
+	std::memcpy(chunk->data + chunk->begin - count, data, count);
+	chunk->begin -= count;
+	m_size += count;
+}
 void StreamBuffer::put(int data, std::size_t count){
+	if(is_inline()){
+		if(INLINE_CAPACITY - m_size >= count){
+			std::memset(m_inline + m_size, data, count);
+			m_size += count;
+			return;
+		}
+		spill();
+	}
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && !ChunkHeader::is_exclusive(chunk)){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity - chunk->end < count)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity - avail >= count){
@@ -318,8 +945,19 @@ void StreamBuffer::put(int data, std::size_t count){
 	m_size += count;
 }
 void StreamBuffer::put(const void *data, std::size_t count){
+	if(is_inline()){
+		if(INLINE_CAPACITY - m_size >= count){
+			std::memcpy(m_inline + m_size, data, count);
+			m_size += count;
+			return;
+		}
+		spill();
+	}
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && !ChunkHeader::is_exclusive(chunk)){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity - chunk->end < count)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity - avail >= count){
@@ -341,9 +979,33 @@ void StreamBuffer::put(const void *data, std::size_t count){
 	m_size += count;
 }
 void StreamBuffer::put(const StreamBuffer &data){
+	if(data.is_inline()){
+		// data 可能就是 *this，而 spill() 不会修改 m_inline，因此可以直接复制。
+		put(data.m_inline, data.m_size);
+		return;
+	}
+	spill();
 	const AUTO(count, data.size());
+	if(count >= SHARING_THRESHOLD){
+		StreamBuffer temp;
+		for(AUTO(src, data.m_first); src; src = src->next){
+			if(src->end == src->begin){
+				continue;
+			}
+			const AUTO(prev, temp.m_last);
+			const AUTO(next, ChunkHeader::create_shared(src, src->begin, src->end, prev, NULLPTR));
+			(prev ? prev->next : temp.m_first) = next;
+			temp.m_last = next;
+			temp.m_size += src->end - src->begin;
+		}
+		splice(temp);
+		return;
+	}
 	AUTO(chunk, m_last);
 	AUTO(prev, chunk);
+	if(chunk && !ChunkHeader::is_exclusive(chunk)){
+		chunk = NULLPTR;
+	}
 	if(chunk && (chunk->capacity - chunk->end < count)){
 		const std::size_t avail = chunk->end - chunk->begin;
 		if(chunk->capacity - avail >= count){
@@ -368,19 +1030,195 @@ void StreamBuffer::put(const StreamBuffer &data){
 	m_size += count;
 }
 
+bool StreamBuffer::put_file_region(int fd, boost::uint64_t offset, std::size_t count){
+	if(count == 0){
+		return true;
+	}
+	// mmap() 要求偏移量按页对齐，多映射的部分被 begin 跳过。
+	const AUTO(page_size, static_cast<boost::uint64_t>(::sysconf(_SC_PAGESIZE)));
+	const AUTO(page_offset, static_cast<std::size_t>(offset % page_size));
+	if(count > static_cast<std::size_t>(-1) - page_offset){
+		return false;
+	}
+	const std::size_t length = page_offset + count;
+	spill();
+	void *const base = ::mmap(NULLPTR, length, PROT_READ, MAP_SHARED, fd, static_cast< ::off_t>(offset - page_offset));
+	if(base == MAP_FAILED){
+		return false;
+	}
+	ChunkHeader *chunk;
+	try {
+		chunk = ChunkHeader::create_mapped(base, length, page_offset, m_last);
+	} catch(...){
+		::munmap(base, length);
+		throw;
+	}
+	if(m_last){
+		m_last->next = chunk;
+	} else {
+		m_first = chunk;
+	}
+	m_last = chunk;
+	m_size += count;
+	return true;
+}
+
 void *StreamBuffer::squash(){
-	AUTO(chunk, m_first);
-	if(!chunk){
-		return NULLPTR;
+	if(is_inline()){
+		if(m_size == 0){
+			return NULLPTR;
+		}
+		return m_inline;
 	}
-	if(chunk != m_last){
-		StreamBuffer(*this).swap(*this);
+	AUTO(chunk, m_first);
+	if((chunk != m_last) || !ChunkHeader::is_exclusive(chunk)){
+		// 复制构造函数会共享数据块，因此这里要复制到一个独占的块中。
+		StreamBuffer temp;
+		const AUTO(size, m_size);
+		peek(temp.reserve_tail(size), size);
+		temp.commit_tail(size);
+		temp.swap(*this);
+		// 较短的数据会被放在内联存储中。
+		if(is_inline()){
+			return m_inline;
+		}
 		chunk = m_first;
 	}
 	return chunk->data + chunk->begin;
 }
 
+void *StreamBuffer::reserve_tail(std::size_t count){
+	std::size_t avail;
+	return reserve_tail(count, avail);
+}
+void *StreamBuffer::reserve_tail(std::size_t count, std::size_t &avail){
+	if(is_inline()){
+		if(INLINE_CAPACITY - m_size >= count){
+			avail = INLINE_CAPACITY - m_size;
+			return m_inline + m_size;
+		}
+		spill();
+	}
+	AUTO(chunk, m_last);
+	AUTO(prev, chunk);
+	if(chunk && !ChunkHeader::is_exclusive(chunk)){
+		chunk = NULLPTR;
+	}
+	if(chunk && (chunk->capacity - chunk->end < count)){
+		const std::size_t used = chunk->end - chunk->begin;
+		if(chunk->capacity - used >= count){
+			std::memmove(chunk->data, chunk->data + chunk->begin, used);
+			chunk->begin = 0;
+			chunk->end = used;
+		} else {
+			chunk = NULLPTR;
+		}
+	}
+	if(!chunk){
+		const AUTO(next, ChunkHeader::create(count, prev, NULLPTR, false));
+		(prev ? prev->next : m_first) = next;
+		chunk = next;
+		m_last = next;
+	}
+	avail = chunk->capacity - chunk->end;
+	return chunk->data + chunk->end;
+}
+void StreamBuffer::commit_tail(std::size_t count) NOEXCEPT {
+	const AUTO(chunk, m_last);
+	if(!chunk){
+		assert(INLINE_CAPACITY - m_size >= count);
+		m_size += count;
+		return;
+	}
+	assert(chunk->capacity - chunk->end >= count);
+	chunk->end += count;
+	m_size += count;
+}
+
+std::ptrdiff_t StreamBuffer::find(const void *pattern, std::size_t count, std::size_t from) const NOEXCEPT {
+	if(count == 0){
+		return (from <= m_size) ? static_cast<std::ptrdiff_t>(from) : -1;
+	}
+	if((from > m_size) || (m_size - from < count)){
+		return -1;
+	}
+	const AUTO(bytes, static_cast<const unsigned char *>(pattern));
+	if(is_inline()){
+		return find_in_contiguous(m_inline, m_size, from, bytes, count);
+	}
+	std::size_t chunk_offset = 0;
+	for(AUTO(chunk, m_first); chunk; chunk = chunk->next){
+		const AUTO(data, chunk->data + chunk->begin);
+		const std::size_t avail = chunk->end - chunk->begin;
+		if(chunk_offset + avail <= from){
+			chunk_offset += avail;
+			continue;
+		}
+		std::size_t pos = (from > chunk_offset) ? (from - chunk_offset) : 0;
+		while(pos < avail){
+			const AUTO(hit, static_cast<const unsigned char *>(std::memchr(data + pos, bytes[0], avail - pos)));
+			if(!hit){
+				break;
+			}
+			pos = static_cast<std::size_t>(hit - data);
+			if(m_size - (chunk_offset + pos) < count){
+				return -1;
+			}
+			if(ChunkHeader::matches(chunk, pos, bytes, count)){
+				return static_cast<std::ptrdiff_t>(chunk_offset + pos);
+			}
+			++pos;
+		}
+		chunk_offset += avail;
+	}
+	return -1;
+}
+void StreamBuffer::xor_mask(boost::uint32_t &mask){
+	if(is_inline()){
+		xor_mask_bytes(m_inline, m_inline, m_size, mask);
+		return;
+	}
+	AUTO(chunk, m_first);
+	while(chunk){
+		const std::size_t avail = chunk->end - chunk->begin;
+		if(avail == 0){
+			chunk = chunk->next;
+			continue;
+		}
+		if(ChunkHeader::is_exclusive(chunk)){
+			xor_mask_bytes(chunk->data + chunk->begin, chunk->data + chunk->begin, avail, mask);
+			chunk = chunk->next;
+			continue;
+		}
+		// 共享的数据块不能原地修改，复制到一个新的块中。
+		const AUTO(copy, ChunkHeader::create(avail, chunk->prev, chunk->next, false));
+		xor_mask_bytes(copy->data, chunk->data + chunk->begin, avail, mask);
+		copy->end = avail;
+		if(chunk->prev){
+			chunk->prev->next = copy;
+		} else {
+			m_first = copy;
+		}
+		if(chunk->next){
+			chunk->next->prev = copy;
+		} else {
+			m_last = copy;
+		}
+		ChunkHeader::destroy(chunk);
+		chunk = copy->next;
+	}
+}
+
 StreamBuffer StreamBuffer::cut_off(std::size_t count){
+	if(is_inline()){
+		const std::size_t total = std::min(count, m_size);
+		StreamBuffer head;
+		std::memcpy(head.m_inline, m_inline, total);
+		head.m_size = total;
+		m_size -= total;
+		std::memmove(m_inline, m_inline + total, m_size);
+		return head;
+	}
 	std::size_t total = 0;
 	AUTO(chunk, m_first);
 	while(chunk){
@@ -393,9 +1231,13 @@ StreamBuffer StreamBuffer::cut_off(std::size_t count){
 			if(avail > remaining){
 				const AUTO(prev, chunk->prev);
 				const AUTO(next, chunk);
-				chunk = ChunkHeader::create(remaining, prev, next, false);
-				std::memcpy(chunk->data, next->data + next->begin, remaining);
-				chunk->end = remaining;
+				if(remaining >= SHARING_THRESHOLD){
+					chunk = ChunkHeader::create_shared(next, next->begin, next->begin + remaining, prev, next);
+				} else {
+					chunk = ChunkHeader::create(remaining, prev, next, false);
+					std::memcpy(chunk->data, next->data + next->begin, remaining);
+					chunk->end = remaining;
+				}
 				next->begin += remaining;
 				(prev ? prev->next : m_first) = chunk;
 				next->prev = chunk;
@@ -423,6 +1265,16 @@ StreamBuffer StreamBuffer::cut_off(std::size_t count){
 void StreamBuffer::splice(StreamBuffer &rhs) NOEXCEPT {
 	assert(&rhs != this);
 
+	if(rhs.is_inline()){
+		// 内联的数据只能复制。这里多数情况下不会分配内存，分配失败则无法恢复。
+		put(rhs.m_inline, rhs.m_size);
+		rhs.m_size = 0;
+		return;
+	}
+	if(is_inline() && (m_size != 0)){
+		spill();
+	}
+
 	const AUTO(first_add, exchange(rhs.m_first, NULLPTR));
 	if(!first_add){
 		return;
@@ -434,6 +1286,22 @@ void StreamBuffer::splice(StreamBuffer &rhs) NOEXCEPT {
 }
 
 bool StreamBuffer::enumerate_chunk(const void **data, std::size_t *count, StreamBuffer::EnumerationCookie &cookie) const NOEXCEPT {
+	if(is_inline()){
+		// 内联的数据作为唯一的数据块，枚举之后 cookie 指向一个不会被解引用的哨兵。
+		const AUTO(sentinel, reinterpret_cast<ChunkHeader *>(const_cast<unsigned char *>(m_inline)));
+		if((m_size == 0) || (cookie.prev == sentinel)){
+			cookie.prev = sentinel;
+			return false;
+		}
+		cookie.prev = sentinel;
+		if(data){
+			*data = m_inline;
+		}
+		if(count){
+			*count = m_size;
+		}
+		return true;
+	}
 	const AUTO(chunk, cookie.prev ? cookie.prev->next : m_first);
 	cookie.prev = chunk;
 	if(!chunk){
@@ -448,6 +1316,22 @@ bool StreamBuffer::enumerate_chunk(const void **data, std::size_t *count, Stream
 	return true;
 }
 bool StreamBuffer::enumerate_chunk(void **data, std::size_t *count, StreamBuffer::EnumerationCookie &cookie) NOEXCEPT {
+	if(is_inline()){
+		// 内联的数据作为唯一的数据块，枚举之后 cookie 指向一个不会被解引用的哨兵。
+		const AUTO(sentinel, reinterpret_cast<ChunkHeader *>(const_cast<unsigned char *>(m_inline)));
+		if((m_size == 0) || (cookie.prev == sentinel)){
+			cookie.prev = sentinel;
+			return false;
+		}
+		cookie.prev = sentinel;
+		if(data){
+			*data = m_inline;
+		}
+		if(count){
+			*count = m_size;
+		}
+		return true;
+	}
 	const AUTO(chunk, cookie.prev ? cookie.prev->next : m_first);
 	cookie.prev = chunk;
 	if(!chunk){
@@ -463,6 +1347,9 @@ bool StreamBuffer::enumerate_chunk(void **data, std::size_t *count, StreamBuffer
 }
 
 std::string StreamBuffer::dump_string() const {
+	if(is_inline()){
+		return std::string(reinterpret_cast<const char *>(m_inline), m_size);
+	}
 	std::string str;
 	str.reserve(m_size);
 	AUTO(chunk, m_first);
@@ -474,6 +1361,9 @@ std::string StreamBuffer::dump_string() const {
 	return str;
 }
 std::basic_string<unsigned char> StreamBuffer::dump_byte_string() const {
+	if(is_inline()){
+		return std::basic_string<unsigned char>(m_inline, m_size);
+	}
 	std::basic_string<unsigned char> str;
 	str.reserve(m_size);
 	AUTO(chunk, m_first);
@@ -485,6 +1375,10 @@ std::basic_string<unsigned char> StreamBuffer::dump_byte_string() const {
 	return str;
 }
 void StreamBuffer::dump(std::ostream &os) const {
+	if(is_inline()){
+		os.write(reinterpret_cast<const char *>(m_inline), static_cast<std::streamsize>(m_size));
+		return;
+	}
 	AUTO(chunk, m_first);
 	while(chunk){
 		const std::size_t avail = chunk->end - chunk->begin;
@@ -493,6 +1387,125 @@ void StreamBuffer::dump(std::ostream &os) const {
 	}
 }
 
+StreamBuffer::ReadCursor::ReadCursor(const StreamBuffer &parent) NOEXCEPT
+	: m_parent(&parent), m_chunk(NULLPTR), m_pos(NULLPTR), m_end(NULLPTR), m_offset(0)
+{
+	if(parent.is_inline()){
+		m_pos = parent.m_inline;
+		m_end = parent.m_inline + parent.m_size;
+		return;
+	}
+	m_chunk = parent.m_first;
+	m_pos = m_chunk->data + m_chunk->begin;
+	m_end = m_chunk->data + m_chunk->end;
+}
+
+bool StreamBuffer::ReadCursor::next_chunk() NOEXCEPT {
+	while(m_chunk && m_chunk->next){
+		m_chunk = m_chunk->next;
+		m_pos = m_chunk->data + m_chunk->begin;
+		m_end = m_chunk->data + m_chunk->end;
+		if(m_pos != m_end){
+			return true;
+		}
+	}
+	return false;
+}
+
+int StreamBuffer::ReadCursor::get() NOEXCEPT {
+	if((m_pos == m_end) && !next_chunk()){
+		return -1;
+	}
+	m_offset += 1;
+	return *(m_pos++);
+}
+std::size_t StreamBuffer::ReadCursor::get(void *data, std::size_t count) NOEXCEPT {
+	std::size_t total = 0;
+	while(total < count){
+		if((m_pos == m_end) && !next_chunk()){
+			break;
+		}
+		const std::size_t avail = std::min(static_cast<std::size_t>(m_end - m_pos), count - total);
+		std::memcpy(static_cast<unsigned char *>(data) + total, m_pos, avail);
+		m_pos += avail;
+		total += avail;
+	}
+	m_offset += total;
+	return total;
+}
+std::size_t StreamBuffer::ReadCursor::discard(std::size_t count) NOEXCEPT {
+	std::size_t total = 0;
+	while(total < count){
+		if((m_pos == m_end) && !next_chunk()){
+			break;
+		}
+		const std::size_t avail = std::min(static_cast<std::size_t>(m_end - m_pos), count - total);
+		m_pos += avail;
+		total += avail;
+	}
+	m_offset += total;
+	return total;
+}
+
+bool StreamBuffer::ReadCursor::get_be(boost::uint16_t &val) NOEXCEPT {
+	boost::uint16_t temp;
+	if(get(&temp, 2) < 2){
+		return false;
+	}
+	val = load_be(temp);
+	return true;
+}
+bool StreamBuffer::ReadCursor::get_be(boost::uint32_t &val) NOEXCEPT {
+	boost::uint32_t temp;
+	if(get(&temp, 4) < 4){
+		return false;
+	}
+	val = load_be(temp);
+	return true;
+}
+bool StreamBuffer::ReadCursor::get_be(boost::uint64_t &val) NOEXCEPT {
+	boost::uint64_t temp;
+	if(get(&temp, 8) < 8){
+		return false;
+	}
+	val = load_be(temp);
+	return true;
+}
+bool StreamBuffer::ReadCursor::get_le(boost::uint32_t &val) NOEXCEPT {
+	boost::uint32_t temp;
+	if(get(&temp, 4) < 4){
+		return false;
+	}
+	val = load_le(temp);
+	return true;
+}
+bool StreamBuffer::ReadCursor::get_vuint64(boost::uint64_t &val) NOEXCEPT {
+	// vuint64 最多占用 9 个字节。数据块剩余的字节足够时直接在原处解码。
+	unsigned char temp[9];
+	const unsigned char *begin = m_pos;
+	std::size_t avail = static_cast<std::size_t>(m_end - m_pos);
+	if(avail < sizeof(temp)){
+		ReadCursor copy(*this);
+		avail = copy.get(temp, sizeof(temp));
+		begin = temp;
+	}
+	const unsigned char *read = begin;
+	if(!vuint64_from_binary(val, read, avail)){
+		return false;
+	}
+	discard(static_cast<std::size_t>(read - begin));
+	return true;
+}
+bool StreamBuffer::ReadCursor::get_vint64(boost::int64_t &val) NOEXCEPT {
+	boost::uint64_t encoded;
+	if(!get_vuint64(encoded)){
+		return false;
+	}
+	encoded = (encoded >> 1) ^ -(encoded & 1);
+	val = static_cast<boost::int64_t>(encoded);
+	return true;
+}
+
 std::ostream &operator<<(std::ostream &os, const StreamBuffer &rhs){
 	rhs.dump(os);
 	return os;
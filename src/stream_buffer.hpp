@@ -11,6 +11,7 @@
 #include <iosfwd>
 #include <cstring>
 #include <cstddef>
+#include <boost/cstdint.hpp>
 
 namespace Poseidon {
 
@@ -35,14 +36,21 @@ public:
 
 	class ReadIterator;
 	class WriteIterator;
+	class ReadCursor;
+	class ScratchArena;
 
 private:
+	// 没有数据块时，不超过 INLINE_CAPACITY 字节的数据直接保存在对象内部，不分配内存。
+	// 此时 m_first 为空指针，数据位于 m_inline 的前 m_size 字节。
+	enum { INLINE_CAPACITY = 48 };
+
 	ChunkHeader *m_first;
 	ChunkHeader *m_last;
 	std::size_t m_size;
+	unsigned char m_inline[INLINE_CAPACITY];
 
 public:
-	CONSTEXPR StreamBuffer() NOEXCEPT
+	StreamBuffer() NOEXCEPT
 		: m_first(NULLPTR), m_last(NULLPTR), m_size(0)
 	{ }
 	StreamBuffer(const void *data, std::size_t count);
@@ -88,8 +96,12 @@ public:
 	void unget(int data);
 
 	std::size_t peek(void *data, std::size_t count) const NOEXCEPT;
+	// 如果开头的 count 字节位于同一个数据块中则返回指向它们的指针，否则返回空指针。
+	const void *peek_contiguous(std::size_t count) const NOEXCEPT;
 	std::size_t get(void *data, std::size_t count) NOEXCEPT;
 	std::size_t discard(std::size_t count) NOEXCEPT;
+	// 把 count 字节放到开头。第一个数据块前面的空间不够时在前面插入一个新的数据块，不移动已有的数据。
+	void unget(const void *data, std::size_t count);
 	void put(int data, std::size_t count);
 	void put(const void *data, std::size_t count);
 	void put(const StreamBuffer &data);
@@ -102,9 +114,30 @@ public:
 	void put(const std::basic_string<unsigned char> &str){
 		put(str.data(), str.size());
 	}
+	// 把文件 fd 中从 offset 开始的 count 字节以只读方式映射到内存中并追加到末尾，数据不会被复制。
+	// 映射失败时返回 false 且不修改缓冲区。在映射被释放之前截断文件会导致读取时收到 SIGBUS。
+	bool put_file_region(int fd, boost::uint64_t offset, std::size_t count);
 
+	// 返回的指针指向独占的连续存储，可以修改。
 	void *squash();
 
+	// 在末尾预留至少 count 字节的可写空间并返回其地址，但不改变 size()。
+	// 在写入数据之后调用 commit_tail() 将其计入缓冲区。其间不得调用其他会修改缓冲区的函数。
+	void *reserve_tail(std::size_t count);
+	// 同上，另外在 avail 中返回实际可写的字节数，不小于 count。
+	void *reserve_tail(std::size_t count, std::size_t &avail);
+	void commit_tail(std::size_t count) NOEXCEPT;
+
+	// 返回 pattern 从 from 开始第一次出现的位置，可以跨越数据块。没有找到返回 -1。
+	std::ptrdiff_t find(const void *pattern, std::size_t count, std::size_t from = 0) const NOEXCEPT;
+	std::ptrdiff_t find(int ch, std::size_t from = 0) const NOEXCEPT {
+		const unsigned char by = static_cast<unsigned char>(ch);
+		return find(&by, 1, from);
+	}
+	// 按 WebSocket 的规则把每个字节与 mask 的低 8 位异或，然后把 mask 循环右移 8 位。
+	// 共享的数据块会被复制，复制和异或在同一遍中完成。
+	void xor_mask(boost::uint32_t &mask);
+
 	StreamBuffer cut_off(std::size_t count);
 	void splice(StreamBuffer &rhs) NOEXCEPT;
 #ifdef POSEIDON_CXX11
@@ -113,7 +146,21 @@ public:
 	}
 #endif
 
+private:
+	// 把内联的数据移动到数据块中。
+	void spill();
+	bool is_inline() const NOEXCEPT {
+		return !m_first;
+	}
+
+public:
+	// 预留一块大页内存（参见 map_huge_page_region()），此后 64 KiB 的数据块从中切分，减少大量缓冲区造成的 TLB 缺失。
+	// 只能在启动其他线程之前调用，只有第一次调用有效。区域直到进程退出才释放。
+	static void reserve_huge_pages(std::size_t region_size);
+
+public:
 	bool enumerate_chunk(const void **data, std::size_t *count, EnumerationCookie &cookie) const NOEXCEPT;
+	// 数据块可能与其他 StreamBuffer 共享，不得通过这里得到的指针修改数据。
 	bool enumerate_chunk(void **data, std::size_t *count, EnumerationCookie &cookie) NOEXCEPT;
 
 	void swap(StreamBuffer &rhs) NOEXCEPT {
@@ -121,6 +168,10 @@ public:
 		swap(m_first, rhs.m_first);
 		swap(m_last, rhs.m_last);
 		swap(m_size, rhs.m_size);
+		unsigned char temp[INLINE_CAPACITY];
+		std::memcpy(temp, m_inline, sizeof(temp));
+		std::memcpy(m_inline, rhs.m_inline, sizeof(temp));
+		std::memcpy(rhs.m_inline, temp, sizeof(temp));
 	}
 
 	std::string dump_string() const;
@@ -170,6 +221,68 @@ public:
 	}
 };
 
+// 在其生存期内，当前线程新建的数据块从整块的内存中顺序切分，释放时只减少所在整块的引用计数，
+// 整块内存在 ScratchArena 析构并且其中的数据块全部释放之后一次性归还。用于请求处理中大量的临时缓冲区。
+// 数据块可以在 ScratchArena 析构之后继续使用，也可以在其他线程中释放，但会使整块内存一直保留。
+// 可以嵌套，此时使用最内层的。必须在创建它的线程中析构。
+class StreamBuffer::ScratchArena {
+	friend struct StreamBuffer::ChunkHeader;
+
+private:
+	const std::size_t m_block_size;
+	ScratchArena *const m_prev;
+	void *m_block;
+
+private:
+	ScratchArena(const ScratchArena &);
+	ScratchArena &operator=(const ScratchArena &);
+
+public:
+	// block_size 为零时不从这里分配。
+	explicit ScratchArena(std::size_t block_size = 65536);
+	~ScratchArena();
+
+private:
+	static void *allocate_current(std::size_t &capacity, std::size_t header_size, void *&block) NOEXCEPT;
+};
+
+// 从头开始顺序读取 StreamBuffer 而不修改它，读完之后调用 discard(get_offset()) 一次性丢弃。
+// 在游标的生存期内不得修改被读取的 StreamBuffer。
+class StreamBuffer::ReadCursor {
+private:
+	const StreamBuffer *m_parent;
+	const ChunkHeader *m_chunk;
+	const unsigned char *m_pos;
+	const unsigned char *m_end;
+	std::size_t m_offset;
+
+public:
+	explicit ReadCursor(const StreamBuffer &parent) NOEXCEPT;
+
+private:
+	bool next_chunk() NOEXCEPT;
+
+public:
+	std::size_t get_offset() const NOEXCEPT {
+		return m_offset;
+	}
+	std::size_t get_remaining() const NOEXCEPT {
+		return m_parent->size() - m_offset;
+	}
+
+	int get() NOEXCEPT;
+	std::size_t get(void *data, std::size_t count) NOEXCEPT;
+	std::size_t discard(std::size_t count) NOEXCEPT;
+
+	// 以下函数在数据不足时返回 false，此时游标的位置不确定。
+	bool get_be(boost::uint16_t &val) NOEXCEPT;
+	bool get_be(boost::uint32_t &val) NOEXCEPT;
+	bool get_be(boost::uint64_t &val) NOEXCEPT;
+	bool get_le(boost::uint32_t &val) NOEXCEPT;
+	bool get_vuint64(boost::uint64_t &val) NOEXCEPT;
+	bool get_vint64(boost::int64_t &val) NOEXCEPT;
+};
+
 class StreamBuffer::WriteIterator : public std::iterator<std::output_iterator_tag, unsigned char> {
 private:
 	StreamBuffer *m_parent;
@@ -3,9 +3,19 @@
 
 #include "precompiled.hpp"
 #include "system_servlet_base.hpp"
+#include "json.hpp"
 
 namespace Poseidon {
 
 SystemServletBase::~SystemServletBase(){ }
 
+void SystemServletBase::handle_post(JsonObject & /*response*/, JsonObject /*request*/) const {
+}
+bool SystemServletBase::handle_post_streaming(JsonWriter & /*writer*/, const JsonObject & /*request*/) const {
+	return false;
+}
+bool SystemServletBase::handle_get_raw(StreamBuffer & /*entity*/, std::string & /*content_type*/) const {
+	return false;
+}
+
 }
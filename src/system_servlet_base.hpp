@@ -5,12 +5,15 @@
 #define POSEIDON_SYSTEM_SERVLET_BASE_HPP_
 
 #include "cxx_util.hpp"
+#include <string>
 #include <boost/weak_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
 namespace Poseidon {
 
 class JsonObject;
+class JsonWriter;
+class StreamBuffer;
 
 class SystemServletBase : NONCOPYABLE {
 public:
@@ -19,7 +22,15 @@ public:
 public:
 	virtual const char *get_uri() const = 0;
 	virtual void handle_get(JsonObject &response) const = 0;
-	virtual void handle_post(JsonObject &response, JsonObject request) const = 0;
+	// 默认不做任何事，响应为空对象。
+	virtual void handle_post(JsonObject &response, JsonObject request) const;
+	// 对于 POST 请求，如果这个函数返回 true，则 writer 中写入的对象作为响应，而不调用 handle_post()。
+	// 用于结果很大的 servlet，不必先构造 JsonObject。返回 false 时不得写入任何内容。默认返回 false。
+	virtual bool handle_post_streaming(JsonWriter &writer, const JsonObject &request) const;
+
+	// 对于 GET 和 HEAD 请求，如果这个函数返回 true，则把 entity 按原样作为响应，而不调用 handle_get()。
+	// 用于 Prometheus 等不解析 JSON 的客户端。默认返回 false。
+	virtual bool handle_get_raw(StreamBuffer &entity, std::string &content_type) const;
 };
 
 }
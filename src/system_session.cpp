@@ -9,6 +9,7 @@
 #include "profiler.hpp"
 #include "log.hpp"
 #include "json.hpp"
+#include "json_writer.hpp"
 #include "http/authentication.hpp"
 #include "http/urlencoded.hpp"
 #include "http/exception.hpp"
@@ -36,9 +37,7 @@ void SystemSession::initialize_once(const Http::RequestHeaders &request_headers)
 	const AUTO(user, Http::check_authentication_simple(m_auth_ctx, false, get_remote_info(), request_headers));
 	LOG_POSEIDON_INFO("SystemSession authentication succeeded: remote = ", get_remote_info(), ", user = ", user, ", URI = ", request_headers.uri, ", headers = ", request_headers.headers);
 
-	Buffer_istream bis;
-	bis.set_buffer(StreamBuffer(request_headers.uri));
-	Http::url_decode(bis, m_decoded_uri);
+	Http::url_decode(m_decoded_uri, request_headers.uri.data(), request_headers.uri.size());
 	DEBUG_THROW_UNLESS(!m_decoded_uri.empty(), Http::Exception, Http::ST_BAD_REQUEST);
 	DEBUG_THROW_UNLESS(m_decoded_uri[0] == '/', Http::Exception, Http::ST_BAD_REQUEST);
 	LOG_POSEIDON_DEBUG("Decoded request URI: ", m_decoded_uri);
@@ -93,9 +92,10 @@ void SystemSession::on_sync_request(Http::RequestHeaders request_headers, Stream
 	response_headers.headers.set(sslit("Access-Control-Allow-Methods"), "OPTIONS, GET, HEAD, POST");
 
 	JsonObject request;
-	Buffer_istream bis;
 	JsonObject response;
 	Buffer_ostream bos;
+	bool raw = false;
+	std::string content_type;
 
 	switch(request_headers.verb){
 	case Http::V_OPTIONS:
@@ -109,19 +109,29 @@ void SystemSession::on_sync_request(Http::RequestHeaders request_headers, Stream
 			// no parameters
 		} else {
 			LOG_POSEIDON_DEBUG("Parsing POST entity as JSON Object: ", request_entity);
-			bis.set_buffer(STD_MOVE(request_entity));
-			request.parse(bis);
-			DEBUG_THROW_UNLESS(bis, Http::Exception, Http::ST_BAD_REQUEST);
+			DEBUG_THROW_UNLESS(request.parse(request_entity), Http::Exception, Http::ST_BAD_REQUEST);
 		}
 		LOG_POSEIDON_DEBUG("SystemSession request: ", request);
 		if(request_headers.verb != Http::V_POST){
-			m_servlet->handle_get(response);
+			raw = m_servlet->handle_get_raw(bos.get_buffer(), content_type);
+			if(!raw){
+				m_servlet->handle_get(response);
+			}
 		} else {
-			m_servlet->handle_post(response, STD_MOVE(request));
+			JsonWriter writer(bos.get_buffer());
+			raw = m_servlet->handle_post_streaming(writer, request);
+			if(raw){
+				content_type = "application/json";
+			} else {
+				m_servlet->handle_post(response, STD_MOVE(request));
+			}
+		}
+		if(!raw){
+			LOG_POSEIDON_DEBUG("SystemSession response: ", response);
+			response.dump(bos);
+			content_type = "application/json";
 		}
-		LOG_POSEIDON_DEBUG("SystemSession response: ", response);
-		response.dump(bos);
-		response_headers.headers.set(sslit("Content-Type"), "application/json");
+		response_headers.headers.set(sslit("Content-Type"), STD_MOVE(content_type));
 		Http::Session::send_chunked_header(STD_MOVE(response_headers));
 		if(request_headers.verb == Http::V_HEAD){
 			LOG_POSEIDON_DEBUG("The response entity for a HEAD request will be discarded.");
@@ -10,11 +10,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <openssl/ssl.h>
 #include "singletons/epoll_daemon.hpp"
+#include "singletons/main_config.hpp"
 #include "log.hpp"
 #include "system_exception.hpp"
 #include "profiler.hpp"
+#include "mutex.hpp"
+#include "time.hpp"
+#include "checked_arithmetic.hpp"
 
 namespace Poseidon {
 
@@ -31,23 +36,140 @@ namespace {
 #else
 		static __thread UniqueFile tcp;
 #endif
-		DEBUG_THROW_UNLESS(tcp.reset(::socket(family, SOCK_STREAM, IPPROTO_TCP)), SystemException);
+		DEBUG_THROW_UNLESS(tcp.reset(::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, (family == AF_UNIX) ? 0 : IPPROTO_TCP)), SystemException);
 		return STD_MOVE(tcp);
 	}
+
+#ifdef POSEIDON_CXX11
+	UniqueFile
+#else
+	Move<UniqueFile>
+#endif
+		race_tcp_sockets(const boost::container::vector<SockAddr> &addrs)
+	{
+		PROFILE_ME;
+
+#ifdef POSEIDON_CXX11
+		UniqueFile tcp;
+#else
+		static __thread UniqueFile tcp;
+#endif
+		DEBUG_THROW_UNLESS(!addrs.empty(), Exception, sslit("No address to connect to"));
+		const AUTO(attempt_delay, MainConfig::get<boost::uint64_t>("tcp_client_connect_attempt_delay", 250));
+		const AUTO(timeout, MainConfig::get<boost::uint64_t>("tcp_client_connect_timeout", 10000));
+
+		const std::size_t count = addrs.size();
+		boost::scoped_array<UniqueFile> attempts(new UniqueFile[count]);
+		boost::scoped_array< ::pollfd> pollfds(new ::pollfd[count]);
+		std::size_t started = 0, failed = 0;
+		int last_err_code = ECONNREFUSED;
+		const AUTO(deadline, saturated_add(get_fast_mono_clock(), timeout));
+		boost::uint64_t next_attempt_time = 0;
+		for(;;){
+			const AUTO(now, get_fast_mono_clock());
+			if((started < count) && ((now >= next_attempt_time) || (failed == started))){
+				const AUTO_REF(addr, addrs.at(started));
+				AUTO_REF(pfd, pollfds.get()[started]);
+				pfd.fd = -1;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				UniqueFile attempt;
+				if(attempt.reset(::socket(addr.get_family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, addr.is_unix() ? 0 : IPPROTO_TCP)) &&
+					((::connect(attempt.get(), static_cast<const ::sockaddr *>(addr.data()), static_cast<unsigned>(addr.size())) == 0) || (errno == EINPROGRESS)))
+				{
+					LOG_POSEIDON_DEBUG("Connection attempt started: remote = ", IpPort(addr));
+					pfd.fd = attempt.get();
+					attempts.get()[started] = STD_MOVE(attempt);
+				} else {
+					last_err_code = errno;
+					LOG_POSEIDON_DEBUG("Connection attempt failed: remote = ", IpPort(addr), ", err_code = ", last_err_code);
+					++failed;
+				}
+				++started;
+				next_attempt_time = saturated_add(now, attempt_delay);
+				continue;
+			}
+			if(failed == count){
+				DEBUG_THROW(SystemException, last_err_code);
+			}
+			if(now >= deadline){
+				DEBUG_THROW(SystemException, ETIMEDOUT);
+			}
+			boost::uint64_t wait_time = deadline - now;
+			if(started < count){
+				wait_time = std::min(wait_time, saturated_sub(next_attempt_time, now));
+			}
+			if(::poll(pollfds.get(), started, static_cast<int>(std::min<boost::uint64_t>(wait_time, INT_MAX))) < 0){
+				DEBUG_THROW_UNLESS(errno == EINTR, SystemException);
+				continue;
+			}
+			for(std::size_t i = 0; i < started; ++i){
+				AUTO_REF(pfd, pollfds.get()[i]);
+				if((pfd.fd < 0) || (pfd.revents == 0)){
+					continue;
+				}
+				int err_code;
+				::socklen_t err_len = sizeof(err_code);
+				if(::getsockopt(pfd.fd, SOL_SOCKET, SO_ERROR, &err_code, &err_len) != 0){
+					err_code = errno;
+				}
+				if(err_code == 0){
+					LOG_POSEIDON_DEBUG("Connection established: remote = ", IpPort(addrs.at(i)));
+					tcp = STD_MOVE(attempts.get()[i]);
+					return STD_MOVE(tcp);
+				}
+				last_err_code = err_code;
+				LOG_POSEIDON_DEBUG("Connection attempt failed: remote = ", IpPort(addrs.at(i)), ", err_code = ", last_err_code);
+				attempts.get()[i].reset();
+				pfd.fd = -1;
+				++failed;
+			}
+		}
+	}
+
+	Mutex g_ssl_factory_mutex;
+	boost::shared_ptr<SslClientFactory> g_ssl_factories[2];
+
+	boost::shared_ptr<SslClientFactory> get_ssl_factory(bool verify_peer){
+		const Mutex::UniqueLock lock(g_ssl_factory_mutex);
+		AUTO_REF(factory, g_ssl_factories[verify_peer]);
+		if(!factory){
+			factory = boost::make_shared<SslClientFactory>(verify_peer);
+		}
+		return factory;
+	}
 }
 
 TcpClientBase::TcpClientBase(const SockAddr &addr, bool use_ssl, bool verify_peer)
 	: TcpSessionBase(create_tcp_socket(addr.get_family()))
 {
 	DEBUG_THROW_UNLESS((::connect(get_fd(), static_cast<const ::sockaddr *>(addr.data()), static_cast<unsigned>(addr.size())) == 0) || (errno == EINPROGRESS), SystemException);
+	init_client_ssl(use_ssl, verify_peer);
+}
+TcpClientBase::TcpClientBase(const boost::container::vector<SockAddr> &addrs, bool use_ssl, bool verify_peer)
+	: TcpSessionBase(race_tcp_sockets(addrs))
+{
+	init_client_ssl(use_ssl, verify_peer);
+}
+TcpClientBase::~TcpClientBase(){ }
+
+void TcpClientBase::init_client_ssl(bool use_ssl, bool verify_peer){
 	if(use_ssl){
 		LOG_POSEIDON_INFO("Initiating SSL handshake...");
-		m_ssl_factory.reset(new SslClientFactory(verify_peer));
+		m_ssl_factory = get_ssl_factory(verify_peer);
 		boost::scoped_ptr<SslFilter> ssl_filter;
 		m_ssl_factory->create_ssl_filter(ssl_filter, get_fd());
 		TcpSessionBase::init_ssl(ssl_filter);
 	}
 }
-TcpClientBase::~TcpClientBase(){ }
+
+void TcpClientBase::request_shm_transport(std::size_t capacity){
+	PROFILE_ME;
+
+	if(capacity == 0){
+		capacity = MainConfig::get<std::size_t>("shm_transport_ring_size", 1048576);
+	}
+	TcpSessionBase::init_shm_transport(capacity);
+}
 
 }
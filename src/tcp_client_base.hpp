@@ -12,11 +12,24 @@ class SslClientFactory;
 
 class TcpClientBase : public TcpSessionBase {
 private:
-	boost::scoped_ptr<SslClientFactory> m_ssl_factory;
+	// 所有客户端共享 SSL_CTX，避免每个连接都重新加载 CA 证书。
+	boost::shared_ptr<SslClientFactory> m_ssl_factory;
 
 public:
 	explicit TcpClientBase(const SockAddr &addr, bool use_ssl = false, bool verify_peer = true);
+	// 按照 RFC 8305 依次向每个地址发起连接（通常来自 DnsDaemon::look_up_all()），
+	// 前一个连接在 tcp_client_connect_attempt_delay 毫秒内没有建立或者已经失败时就开始下一个，使用最先建立的连接。
+	// 构造函数阻塞直到有一个连接建立为止，所有地址都失败或者超时则抛出异常。
+	explicit TcpClientBase(const boost::container::vector<SockAddr> &addrs, bool use_ssl = false, bool verify_peer = true);
 	~TcpClientBase();
+
+private:
+	void init_client_ssl(bool use_ssl, bool verify_peer);
+
+public:
+	// 和对端约定改用共享内存收发数据，对端须调用 TcpSessionBase::accept_shm_transport()。
+	// 只能用于连接到本机 Unix 域套接字的明文连接，须在添加到 epoll 之前调用。capacity 为零时使用 shm_transport_ring_size。
+	void request_shm_transport(std::size_t capacity = 0);
 };
 
 }
@@ -0,0 +1,202 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "tcp_client_pool.hpp"
+#include "tcp_client_base.hpp"
+#include "singletons/dns_daemon.hpp"
+#include "singletons/main_config.hpp"
+#include "log.hpp"
+#include "exception.hpp"
+#include "time.hpp"
+#include "checked_arithmetic.hpp"
+
+namespace Poseidon {
+
+namespace {
+	std::string make_host_key(const std::string &host, boost::uint16_t port, bool use_ssl){
+		std::string key;
+		key.reserve(host.size() + 16);
+		key += host;
+		key += ':';
+		key += boost::lexical_cast<std::string>(port);
+		if(use_ssl){
+			key += "/ssl";
+		}
+		return key;
+	}
+}
+
+TcpClientPool::TcpClientPool(ClientFactory factory)
+	: m_factory(STD_MOVE_IDN(factory))
+	, m_max_per_host(std::max<std::size_t>(MainConfig::get<std::size_t>("tcp_client_pool_max_per_host", 16), 1))
+	, m_max_idle_per_host(MainConfig::get<std::size_t>("tcp_client_pool_max_idle_per_host", 4))
+	, m_idle_timeout(MainConfig::get<boost::uint64_t>("tcp_client_pool_idle_timeout", 60000))
+	, m_dns_ttl(MainConfig::get<boost::uint64_t>("tcp_client_pool_dns_ttl", 60000))
+{
+	LOG_POSEIDON_DEBUG("TcpClientPool: max_per_host = ", m_max_per_host, ", max_idle_per_host = ", m_max_idle_per_host,
+		", idle_timeout = ", m_idle_timeout, ", dns_ttl = ", m_dns_ttl);
+}
+TcpClientPool::~TcpClientPool(){
+	clear();
+}
+
+bool TcpClientPool::is_client_healthy(const TcpClientBase &client) NOEXCEPT {
+	// 对端关闭连接时 epoll 线程会读到 EOF 并关闭读端，因此这里不需要再去探测套接字。
+	return !client.has_been_shutdown_read() && !client.has_been_shutdown_write();
+}
+std::size_t TcpClientPool::prune_host(HostEntry &entry, boost::uint64_t now){
+	std::size_t count_closed = 0;
+	AUTO(it, entry.idle.begin());
+	while(it != entry.idle.end()){
+		if(is_client_healthy(*(it->client)) && (now < it->expiry_time)){
+			++it;
+			continue;
+		}
+		LOG_POSEIDON_DEBUG("Dropping idle pooled client: remote = ", it->client->get_remote_info());
+		it->client->shutdown_write();
+		it = entry.idle.erase(it);
+		++count_closed;
+	}
+	AUTO(lit, entry.leased.begin());
+	while(lit != entry.leased.end()){
+		if(!lit->second.expired()){
+			++lit;
+			continue;
+		}
+		// 调用者没有归还就丢弃了连接。
+		lit = entry.leased.erase(lit);
+	}
+	return count_closed;
+}
+
+boost::shared_ptr<TcpClientBase> TcpClientPool::acquire(const std::string &host, boost::uint16_t port, bool use_ssl){
+	const AUTO(key, make_host_key(host, port, use_ssl));
+	const AUTO(now, get_fast_mono_clock());
+
+	Mutex::UniqueLock lock(m_mutex);
+	AUTO_REF(entry, m_hosts[key]);
+	prune_host(entry, now);
+	while(!entry.idle.empty()){
+		// 后进先出，最近使用过的连接最不容易被对端关闭。
+		boost::shared_ptr<TcpClientBase> client;
+		client.swap(entry.idle.back().client);
+		entry.idle.pop_back();
+		if(!is_client_healthy(*client)){
+			client->shutdown_write();
+			continue;
+		}
+		entry.leased[client.get()] = client;
+		LOG_POSEIDON_TRACE("Reusing pooled client: key = ", key, ", remote = ", client->get_remote_info());
+		return client;
+	}
+	DEBUG_THROW_UNLESS(entry.leased.size() + entry.connecting < m_max_per_host, Exception, sslit("Too many connections to this host"));
+	// 先占住名额，然后在锁外进行 DNS 解析和建立连接。
+	++entry.connecting;
+	SockAddr sock_addr = entry.sock_addr;
+	const bool sock_addr_valid = (entry.sock_addr_expiry_time != 0) && (now < entry.sock_addr_expiry_time);
+	lock.unlock();
+
+	boost::shared_ptr<TcpClientBase> client;
+	try {
+		if(!sock_addr_valid){
+			LOG_POSEIDON_DEBUG("Resolving pooled host: key = ", key);
+			sock_addr = DnsDaemon::look_up(host, port);
+		}
+		client = m_factory(sock_addr, use_ssl);
+		DEBUG_THROW_ASSERT(client);
+	} catch(...){
+		lock.lock();
+		AUTO_REF(failed_entry, m_hosts[key]);
+		--failed_entry.connecting;
+		// 连接失败时也许地址已经变了，下次重新解析。
+		failed_entry.sock_addr_expiry_time = 0;
+		throw;
+	}
+
+	lock.lock();
+	AUTO_REF(new_entry, m_hosts[key]);
+	--new_entry.connecting;
+	if(!sock_addr_valid){
+		new_entry.sock_addr = sock_addr;
+		new_entry.sock_addr_expiry_time = saturated_add(now, m_dns_ttl);
+	}
+	new_entry.leased[client.get()] = client;
+	LOG_POSEIDON_DEBUG("Created pooled client: key = ", key, ", remote = ", client->get_remote_info());
+	return client;
+}
+void TcpClientPool::release(const boost::shared_ptr<TcpClientBase> &client){
+	DEBUG_THROW_ASSERT(client);
+
+	const AUTO(now, get_fast_mono_clock());
+
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_hosts.begin()); it != m_hosts.end(); ++it){
+		AUTO_REF(entry, it->second);
+		const AUTO(lit, entry.leased.find(client.get()));
+		if(lit == entry.leased.end()){
+			continue;
+		}
+		entry.leased.erase(lit);
+		prune_host(entry, now);
+		if(!is_client_healthy(*client)){
+			LOG_POSEIDON_DEBUG("Pooled client is no longer healthy: key = ", it->first);
+			return;
+		}
+		if(entry.idle.size() >= m_max_idle_per_host){
+			LOG_POSEIDON_DEBUG("Too many idle clients: key = ", it->first, ", max_idle_per_host = ", m_max_idle_per_host);
+			client->shutdown_write();
+			return;
+		}
+		IdleClient idle = { client, saturated_add(now, m_idle_timeout) };
+		entry.idle.push_back(STD_MOVE(idle));
+		return;
+	}
+	LOG_POSEIDON_WARNING("Client was not acquired from this pool: remote = ", client->get_remote_info());
+}
+
+std::size_t TcpClientPool::purge(){
+	const AUTO(now, get_fast_mono_clock());
+
+	std::size_t count_closed = 0;
+	const Mutex::UniqueLock lock(m_mutex);
+	AUTO(it, m_hosts.begin());
+	while(it != m_hosts.end()){
+		count_closed += prune_host(it->second, now);
+		if(it->second.idle.empty() && it->second.leased.empty() && (it->second.connecting == 0) && (now >= it->second.sock_addr_expiry_time)){
+			it = m_hosts.erase(it);
+		} else {
+			++it;
+		}
+	}
+	return count_closed;
+}
+void TcpClientPool::clear() NOEXCEPT {
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_hosts.begin()); it != m_hosts.end(); ++it){
+		AUTO_REF(entry, it->second);
+		for(AUTO(iit, entry.idle.begin()); iit != entry.idle.end(); ++iit){
+			iit->client->shutdown_write();
+		}
+		entry.idle.clear();
+	}
+}
+
+std::size_t TcpClientPool::get_idle_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_hosts.begin()); it != m_hosts.end(); ++it){
+		count += it->second.idle.size();
+	}
+	return count;
+}
+std::size_t TcpClientPool::get_leased_count() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	std::size_t count = 0;
+	for(AUTO(it, m_hosts.begin()); it != m_hosts.end(); ++it){
+		count += it->second.leased.size();
+	}
+	return count;
+}
+
+}
@@ -0,0 +1,84 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_TCP_CLIENT_POOL_HPP_
+#define POSEIDON_TCP_CLIENT_POOL_HPP_
+
+#include "cxx_ver.hpp"
+#include "cxx_util.hpp"
+#include "mutex.hpp"
+#include "sock_addr.hpp"
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/map.hpp>
+#include <boost/container/flat_map.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+class TcpClientBase;
+
+// 按 host:port 保存长连接，用于服务之间的 HTTP 或 CBPP 调用，
+// 热路径上的请求可以跳过 DNS 解析、TCP 握手和 SSL 握手。
+class TcpClientPool : NONCOPYABLE {
+public:
+	// 工厂函数负责创建客户端并加入 EpollDaemon。
+	typedef boost::function<boost::shared_ptr<TcpClientBase> (const SockAddr &sock_addr, bool use_ssl)> ClientFactory;
+
+private:
+	struct IdleClient {
+		boost::shared_ptr<TcpClientBase> client;
+		boost::uint64_t expiry_time;
+	};
+
+	struct HostEntry {
+		SockAddr sock_addr;
+		boost::uint64_t sock_addr_expiry_time;
+		boost::container::vector<IdleClient> idle;
+		boost::container::flat_map<const TcpClientBase *, boost::weak_ptr<TcpClientBase> > leased;
+		std::size_t connecting;
+
+		HostEntry()
+			: sock_addr(), sock_addr_expiry_time(0), idle(), leased(), connecting(0)
+		{ }
+	};
+
+private:
+	const ClientFactory m_factory;
+	const std::size_t m_max_per_host;
+	const std::size_t m_max_idle_per_host;
+	const boost::uint64_t m_idle_timeout;
+	const boost::uint64_t m_dns_ttl;
+
+	mutable Mutex m_mutex;
+	boost::container::map<std::string, HostEntry> m_hosts;
+
+public:
+	explicit TcpClientPool(ClientFactory factory);
+	~TcpClientPool();
+
+private:
+	static bool is_client_healthy(const TcpClientBase &client) NOEXCEPT;
+	static std::size_t prune_host(HostEntry &entry, boost::uint64_t now);
+
+public:
+	// 优先取出最近归还的空闲连接，否则新建一个。
+	// 如果该 host:port 的连接数已经达到上限则抛出异常。
+	boost::shared_ptr<TcpClientBase> acquire(const std::string &host, boost::uint16_t port, bool use_ssl = false);
+	// 归还连接。不健康的连接和超出空闲上限的连接会被关闭并丢弃。
+	void release(const boost::shared_ptr<TcpClientBase> &client);
+
+	// 关闭所有过期的空闲连接，返回关闭的连接数。
+	std::size_t purge();
+	void clear() NOEXCEPT;
+
+	std::size_t get_idle_count() const;
+	std::size_t get_leased_count() const;
+};
+
+}
+
+#endif
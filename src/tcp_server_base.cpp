@@ -11,48 +11,418 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <unistd.h>
 #include <openssl/ssl.h>
 #include "singletons/main_config.hpp"
 #include "singletons/epoll_daemon.hpp"
+#include "singletons/hot_restart_daemon.hpp"
 #include "log.hpp"
 #include "system_exception.hpp"
 #include "profiler.hpp"
+#include "checked_arithmetic.hpp"
+#include "pooled_allocator.hpp"
+#include "atomic.hpp"
+#include "time.hpp"
 
 namespace Poseidon {
 
 namespace {
+	ConfigValue<boost::uint64_t> g_request_timeout("tcp_request_timeout", 5000);
+
 #ifdef POSEIDON_CXX11
 	UniqueFile
 #else
 	Move<UniqueFile>
 #endif
-		create_tcp_socket(const SockAddr &addr)
+		create_tcp_socket(const SockAddr &addr, bool reuse_port)
 	{
 #ifdef POSEIDON_CXX11
 		UniqueFile tcp;
 #else
 		static __thread UniqueFile tcp;
 #endif
-		DEBUG_THROW_UNLESS(tcp.reset(::socket(addr.get_family(), SOCK_STREAM, IPPROTO_TCP)), SystemException);
-		static CONSTEXPR const int TRUE_VALUE = true;
-		DEBUG_THROW_UNLESS(::setsockopt(tcp.get(), SOL_SOCKET, SO_REUSEADDR, &TRUE_VALUE, sizeof(TRUE_VALUE)) == 0, SystemException);
+		if(HotRestartDaemon::take_inherited_socket(tcp, SOCK_STREAM, addr)){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Inherited TCP listener from previous process: addr = ", IpPort(addr));
+			return STD_MOVE(tcp);
+		}
+		if(addr.is_unix()){
+			DEBUG_THROW_UNLESS(tcp.reset(::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)), SystemException);
+			remove_stale_unix_socket(addr, SOCK_STREAM);
+		} else {
+			DEBUG_THROW_UNLESS(tcp.reset(::socket(addr.get_family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)), SystemException);
+			static CONSTEXPR const int TRUE_VALUE = true;
+			DEBUG_THROW_UNLESS(::setsockopt(tcp.get(), SOL_SOCKET, SO_REUSEADDR, &TRUE_VALUE, sizeof(TRUE_VALUE)) == 0, SystemException);
+			if(reuse_port){
+				DEBUG_THROW_UNLESS(::setsockopt(tcp.get(), SOL_SOCKET, SO_REUSEPORT, &TRUE_VALUE, sizeof(TRUE_VALUE)) == 0, SystemException);
+			}
+		}
 		DEBUG_THROW_UNLESS(::bind(tcp.get(), static_cast<const ::sockaddr *>(addr.data()), static_cast<unsigned>(addr.size())) == 0, SystemException);
 		DEBUG_THROW_UNLESS(::listen(tcp.get(), SOMAXCONN) == 0, SystemException);
 		return STD_MOVE(tcp);
 	}
+
+	std::size_t get_shard_count(const SockAddr &addr){
+		if(!MainConfig::get<bool>("tcp_listener_sharding", false)){
+			return 0;
+		}
+		if(addr.is_unix()){
+			// Unix 域套接字不支持 SO_REUSEPORT，同一路径只能绑定一次。
+			return 0;
+		}
+		return saturated_sub<std::size_t>(EpollDaemon::get_thread_count(), 1);
+	}
+
+	// IPv4 地址按 IPv4 映射的 IPv6 地址（::ffff:a.b.c.d）保存，这样双栈套接字上接受的 IPv4 连接与之相同。
+	// 一个用户通常拥有整个 /64 的 IPv6 地址，因此其他 IPv6 地址只按前 64 位统计。Unix 域套接字返回 false。
+	bool get_admission_key(boost::uint64_t (&key)[2], const ::sockaddr_storage &sa) NOEXCEPT {
+		unsigned char bytes[16];
+		if(sa.ss_family == AF_INET){
+			const AUTO(sin, reinterpret_cast<const ::sockaddr_in *>(&sa));
+			std::memset(bytes, 0, 10);
+			bytes[10] = 0xFF;
+			bytes[11] = 0xFF;
+			std::memcpy(bytes + 12, &(sin->sin_addr), 4);
+		} else if(sa.ss_family == AF_INET6){
+			const AUTO(sin6, reinterpret_cast<const ::sockaddr_in6 *>(&sa));
+			std::memcpy(bytes, &(sin6->sin6_addr), 16);
+			if(!IN6_IS_ADDR_V4MAPPED(&(sin6->sin6_addr))){
+				std::memset(bytes + 8, 0, 8);
+			}
+		} else {
+			return false;
+		}
+		std::memcpy(key, bytes, sizeof(key));
+		return true;
+	}
+	// 被拒绝的连接直接发送 RST，服务器一侧不进入 TIME_WAIT。
+	void reject_client(UniqueFile &client) NOEXCEPT {
+		::linger lng;
+		lng.l_onoff = 1;
+		lng.l_linger = 0;
+		::setsockopt(client.get(), SOL_SOCKET, SO_LINGER, &lng, sizeof(lng));
+		client.reset();
+	}
 }
 
+class TcpServerBase::ShardListener : public SocketBase {
+private:
+	boost::weak_ptr<TcpServerBase> m_weak_parent;
+
+public:
+	explicit ShardListener(Move<UniqueFile> socket)
+		: SocketBase(STD_MOVE(socket))
+	{ }
+
+public:
+	void set_parent(const boost::weak_ptr<TcpServerBase> &weak_parent){
+		m_weak_parent = weak_parent;
+	}
+
+	int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable) OVERRIDE {
+		(void)hint_buffer;
+		(void)hint_capacity;
+		(void)readable;
+
+		const AUTO(parent, m_weak_parent.lock());
+		if(!parent){
+			return EWOULDBLOCK;
+		}
+		return parent->accept_clients(*this);
+	}
+};
+
+// 按 IP 统计并发连接数和令牌桶。每 8 个元素为一组，一个 IP 只会出现在它的哈希值对应的组中，
+// 组满时覆盖其中没有连接、最久没有更新的元素，它的令牌桶在这段时间内已经（或者接近）回满，相当于自然衰减。
+// 组中的元素都有连接时不记录这个 IP，直接接受。
+class TcpServerBase::AdmissionTable : NONCOPYABLE, public boost::enable_shared_from_this<AdmissionTable> {
+private:
+	enum {
+		GROUP_SIZE = 8,
+	};
+
+	struct Element {
+		boost::uint64_t key[2]; // 全零表示空闲。
+		boost::uint64_t updated; // 令牌上次补充的时间。
+		boost::uint32_t tokens; // 以千分之一个连接为单位。
+		boost::uint32_t connections;
+	};
+
+	class Ticket : NONCOPYABLE {
+	private:
+		const boost::shared_ptr<AdmissionTable> m_table;
+		boost::uint64_t m_key[2];
+
+	public:
+		Ticket(boost::shared_ptr<AdmissionTable> table, const boost::uint64_t (&key)[2])
+			: m_table(STD_MOVE(table))
+		{
+			m_key[0] = key[0];
+			m_key[1] = key[1];
+		}
+		~Ticket(){
+			m_table->release(m_key);
+		}
+	};
+
+private:
+	const boost::uint32_t m_max_connections;
+	const boost::uint32_t m_rate;
+	const boost::uint32_t m_burst;
+
+	mutable Mutex m_mutex;
+	boost::container::vector<Element> m_elements;
+	volatile boost::uint64_t m_rejected;
+
+public:
+	AdmissionTable(boost::uint32_t max_connections, boost::uint32_t rate, boost::uint32_t burst, std::size_t size)
+		: m_max_connections(max_connections), m_rate(rate), m_burst(std::max<boost::uint32_t>(burst, 1))
+		, m_rejected(0)
+	{
+		std::size_t capacity = GROUP_SIZE;
+		while(capacity < size){
+			capacity *= 2;
+		}
+		m_elements.resize(capacity);
+	}
+
+private:
+	Element *get_group(const boost::uint64_t (&key)[2]){
+		const AUTO(hash, (key[0] ^ (key[1] * 0x9E3779B97F4A7C15ull)) * 0xC2B2AE3D27D4EB4Full);
+		const AUTO(group_count, m_elements.size() / GROUP_SIZE);
+		return m_elements.data() + static_cast<std::size_t>((hash >> 32) & (group_count - 1)) * GROUP_SIZE;
+	}
+	void refill(Element &elem, boost::uint64_t now) const {
+		const AUTO(capacity, static_cast<boost::uint64_t>(m_burst) * 1000);
+		// m_rate 个每秒即 m_rate 个千分之一每毫秒。
+		const AUTO(tokens, saturated_add<boost::uint64_t>(elem.tokens, saturated_mul<boost::uint64_t>(saturated_sub(now, elem.updated), m_rate)));
+		elem.tokens = static_cast<boost::uint32_t>(std::min(tokens, capacity));
+		elem.updated = now;
+	}
+	void release(const boost::uint64_t (&key)[2]){
+		const Mutex::UniqueLock lock(m_mutex);
+		const AUTO(group, get_group(key));
+		for(std::size_t i = 0; i < GROUP_SIZE; ++i){
+			AUTO_REF(elem, group[i]);
+			if((elem.key[0] == key[0]) && (elem.key[1] == key[1])){
+				if(elem.connections != 0){
+					--elem.connections;
+				}
+				return;
+			}
+		}
+	}
+
+public:
+	boost::uint64_t get_rejected_count() const {
+		return atomic_load(m_rejected, ATOMIC_RELAXED);
+	}
+
+	// 返回 false 表示应当拒绝这个连接。否则如果这个 IP 被记录，ticket 被设置为非空，它被销毁时归还并发连接数。
+	bool admit(boost::shared_ptr<const void> &ticket, const ::sockaddr_storage &sa){
+		boost::uint64_t key[2];
+		if(!get_admission_key(key, sa)){
+			return true;
+		}
+		const AUTO(now, get_fast_mono_clock());
+		{
+			const Mutex::UniqueLock lock(m_mutex);
+			const AUTO(group, get_group(key));
+			Element *found = NULLPTR;
+			Element *victim = NULLPTR;
+			for(std::size_t i = 0; i < GROUP_SIZE; ++i){
+				AUTO_REF(elem, group[i]);
+				if((elem.key[0] == key[0]) && (elem.key[1] == key[1])){
+					found = &elem;
+					break;
+				}
+				if(elem.connections != 0){
+					continue;
+				}
+				if(!victim || (elem.updated < victim->updated)){
+					victim = &elem;
+				}
+			}
+			if(!found){
+				if(!victim){
+					LOG_POSEIDON_WARNING_RATE_LIMITED(1, "TCP admission table group is full, accepting without tracking.");
+					return true;
+				}
+				found = victim;
+				found->key[0] = key[0];
+				found->key[1] = key[1];
+				found->updated = now;
+				found->tokens = m_burst * 1000;
+				found->connections = 0;
+			}
+			bool accepted = true;
+			if((m_max_connections != 0) && (found->connections >= m_max_connections)){
+				accepted = false;
+			}
+			if(accepted && (m_rate != 0)){
+				refill(*found, now);
+				if(found->tokens < 1000){
+					accepted = false;
+				} else {
+					found->tokens -= 1000;
+				}
+			}
+			if(!accepted){
+				atomic_add(m_rejected, 1, ATOMIC_RELAXED);
+				return false;
+			}
+			++(found->connections);
+		}
+		try {
+			ticket = boost::allocate_shared<Ticket>(PooledAllocator<Ticket>(), shared_from_this(), key);
+		} catch(...){
+			release(key);
+			throw;
+		}
+		return true;
+	}
+};
+
 TcpServerBase::TcpServerBase(const SockAddr &addr, const char *certificate, const char *private_key)
-	: SocketBase(create_tcp_socket(addr))
+	: SocketBase(create_tcp_socket(addr, get_shard_count(addr) != 0))
+	, m_shards_registered(false)
 {
 	if(certificate && *certificate){
 		m_ssl_factory.reset(new SslServerFactory(certificate, private_key));
 	}
+	const AUTO(max_connections, MainConfig::get<boost::uint32_t>("tcp_admission_max_connections_per_ip", 0));
+	const AUTO(rate, MainConfig::get<boost::uint32_t>("tcp_admission_rate_per_ip", 0));
+	if(!addr.is_unix() && ((max_connections != 0) || (rate != 0))){
+		const AUTO(burst, MainConfig::get<boost::uint32_t>("tcp_admission_burst_per_ip", 10));
+		const AUTO(table_size, MainConfig::get<std::size_t>("tcp_admission_table_size", 65536));
+		m_admission = boost::make_shared<AdmissionTable>(max_connections, rate, burst, table_size);
+		LOG_POSEIDON_DEBUG("TCP admission control: max_connections_per_ip = ", max_connections, ", rate_per_ip = ", rate, ", burst_per_ip = ", burst, ", table_size = ", table_size);
+	}
+	const AUTO(shard_count, get_shard_count(addr));
+	m_shards.reserve(shard_count);
+	for(std::size_t i = 0; i < shard_count; ++i){
+		m_shards.push_back(boost::make_shared<ShardListener>(create_tcp_socket(addr, true)));
+	}
 
-	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Created TCP server on ", get_local_info(), ", SSL = ", !!m_ssl_factory);
+	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Created TCP server on ", get_local_info(), ", SSL = ", !!m_ssl_factory, ", shards = ", m_shards.size());
 }
 TcpServerBase::~TcpServerBase(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Destroyed TCP server on ", get_local_info(), ", SSL = ", !!m_ssl_factory);
+
+	// 热重启之后新进程还在这个路径上监听，不能删除。
+	const char *const path = get_local_info().ip();
+	if((path[0] == '/') && !has_been_handed_over()){
+		::unlink(path);
+	}
+}
+
+void TcpServerBase::register_shards(){
+	PROFILE_ME;
+
+	// 分片监听套接字放在除自身所在线程以外的每一个 epoll 线程上，由内核负责负载均衡。
+	const AUTO(own_index, get_epoll_thread_index());
+	const AUTO(weak_parent, virtual_weak_from_this<TcpServerBase>());
+	for(std::size_t i = 0; i < m_shards.size(); ++i){
+		const AUTO_REF(shard, m_shards.at(i));
+		shard->set_parent(weak_parent);
+		EpollDaemon::add_socket(shard, false, own_index + 1 + i);
+		LOG_POSEIDON_DEBUG("Registered TCP server shard: local = ", shard->get_local_info(), ", epoll_thread_index = ", shard->get_epoll_thread_index());
+	}
+}
+int TcpServerBase::accept_clients(const SocketBase &listener){
+	PROFILE_ME;
+
+	if(listener.has_been_shutdown_read()){
+		// 监听套接字已经交给了新进程。
+		return EWOULDBLOCK;
+	}
+	// 分片模式下，新连接留在接受它的 epoll 线程上，避免跨线程交接。
+	const std::size_t thread_hint = m_shards.empty() ? (std::size_t)-1 : listener.get_epoll_thread_index();
+	for(unsigned i = 0; i < 16; ++i){
+		UniqueFile client;
+		::sockaddr_storage sa;
+		::socklen_t sa_len = sizeof(sa);
+		if(!client.reset(::accept4(listener.get_fd(), reinterpret_cast< ::sockaddr *>(&sa), &sa_len, SOCK_NONBLOCK | SOCK_CLOEXEC))){
+			return errno;
+		}
+		// 在创建会话之前检查，被拒绝的连接不会分配会话、SSL 上下文、定时器或者任务。
+		boost::shared_ptr<const void> admission_ticket;
+		if(m_admission && !m_admission->admit(admission_ticket, sa)){
+			LOG_POSEIDON_DEBUG_RATE_LIMITED(10, "Rejected TCP connection from ", IpPort(SockAddr(&sa, sa_len)));
+			reject_client(client);
+			continue;
+		}
+		const int err_code = add_client(STD_MOVE(client), thread_hint, STD_MOVE(admission_ticket));
+		if(err_code != 0){
+			return err_code;
+		}
+	}
+	return 0;
+}
+int TcpServerBase::add_client(Move<UniqueFile> client, std::size_t thread_hint, boost::shared_ptr<const void> admission_ticket){
+	PROFILE_ME;
+
+	boost::shared_ptr<TcpSessionBase> session;
+	try {
+		session = on_client_connect(STD_MOVE(client));
+		if(!session){
+			LOG_POSEIDON_WARNING("on_client_connect() returns a null pointer.");
+			return EWOULDBLOCK;
+		}
+		session->m_admission_ticket = STD_MOVE(admission_ticket);
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		return EINTR;
+	} catch(...){
+		LOG_POSEIDON_ERROR("Unknown exception thrown.");
+		return EINTR;
+	}
+	try {
+		if(m_ssl_factory){
+			boost::scoped_ptr<SslFilter> ssl_filter;
+			m_ssl_factory->create_ssl_filter(ssl_filter, session->get_fd());
+			session->init_ssl(ssl_filter);
+		}
+		const AUTO(tcp_request_timeout, g_request_timeout.get());
+		session->set_timeout(tcp_request_timeout);
+		EpollDaemon::add_socket(session, true, thread_hint);
+		LOG_POSEIDON_INFO("Accepted TCP connection from ", session->get_remote_info());
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		session->force_shutdown();
+	}
+	return 0;
+}
+void TcpServerBase::add_adopted_clients(){
+	PROFILE_ME;
+
+	boost::container::vector<boost::shared_ptr<UniqueFile> > clients;
+	{
+		const Mutex::UniqueLock lock(m_adoption_mutex);
+		clients.swap(m_adopted_clients);
+	}
+	const std::size_t thread_hint = m_shards.empty() ? (std::size_t)-1 : get_epoll_thread_index();
+	for(AUTO(it, clients.begin()); it != clients.end(); ++it){
+		add_client(STD_MOVE(**it), thread_hint, boost::shared_ptr<const void>());
+	}
+}
+
+boost::uint64_t TcpServerBase::get_rejected_count() const {
+	if(!m_admission){
+		return 0;
+	}
+	return m_admission->get_rejected_count();
+}
+
+void TcpServerBase::adopt_client(Move<UniqueFile> client){
+	PROFILE_ME;
+
+	const AUTO(owned, boost::make_shared<UniqueFile>());
+	owned->reset(STD_MOVE(client));
+	{
+		const Mutex::UniqueLock lock(m_adoption_mutex);
+		m_adopted_clients.push_back(owned);
+	}
+	EpollDaemon::mark_socket_readable(this);
 }
 
 int TcpServerBase::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable){
@@ -62,42 +432,16 @@ int TcpServerBase::poll_read_and_process(unsigned char *hint_buffer, std::size_t
 	(void)hint_capacity;
 	(void)readable;
 
-	for(unsigned i = 0; i < 16; ++i){
-		boost::shared_ptr<TcpSessionBase> session;
+	if(!m_shards_registered){
+		m_shards_registered = true;
 		try {
-			UniqueFile client;
-			if(!client.reset(::accept(get_fd(), NULLPTR, NULLPTR))){
-				return errno;
-			}
-			session = on_client_connect(STD_MOVE(client));
-			if(!session){
-				LOG_POSEIDON_WARNING("on_client_connect() returns a null pointer.");
-				return EWOULDBLOCK;
-			}
+			register_shards();
 		} catch(std::exception &e){
 			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
-			return EINTR;
-		} catch(...){
-			LOG_POSEIDON_ERROR("Unknown exception thrown.");
-			return EINTR;
-		}
-		try {
-			if(m_ssl_factory){
-				boost::scoped_ptr<SslFilter> ssl_filter;
-				m_ssl_factory->create_ssl_filter(ssl_filter, session->get_fd());
-				session->init_ssl(ssl_filter);
-			}
-			const AUTO(tcp_request_timeout, MainConfig::get<boost::uint64_t>("tcp_request_timeout", 5000));
-			session->set_timeout(tcp_request_timeout);
-			EpollDaemon::add_socket(session, true);
-			LOG_POSEIDON_INFO("Accepted TCP connection from ", session->get_remote_info());
-		} catch(std::exception &e){
-			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
-			session->force_shutdown();
-			continue;
 		}
 	}
-	return 0;
+	add_adopted_clients();
+	return accept_clients(*this);
 }
 
 }
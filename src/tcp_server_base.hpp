@@ -6,7 +6,9 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/container/vector.hpp>
 #include "socket_base.hpp"
+#include "mutex.hpp"
 #include "sock_addr.hpp"
 #include "ip_port.hpp"
 
@@ -17,18 +19,49 @@ class TcpSessionBase;
 
 // 抽象工厂模式
 class TcpServerBase : public SocketBase {
+private:
+	class ShardListener;
+	class AdmissionTable;
+
 private:
 	boost::scoped_ptr<SslServerFactory> m_ssl_factory;
 
+	// 如果启用了 tcp_listener_sharding，每个其他的 epoll 线程上各有一个监听同一地址的套接字。
+	boost::container::vector<boost::shared_ptr<ShardListener> > m_shards;
+	bool m_shards_registered;
+
+	// 如果启用了按 IP 的准入控制，在创建会话之前检查并发连接数和新建连接的速率。
+	boost::shared_ptr<AdmissionTable> m_admission;
+
+	// 热重启时从旧进程接过来的连接，由 epoll 线程取出。
+	mutable Mutex m_adoption_mutex;
+	boost::container::vector<boost::shared_ptr<UniqueFile> > m_adopted_clients;
+
 public:
 	explicit TcpServerBase(const SockAddr &addr, const char *certificate = "", const char *private_key = "");
 	~TcpServerBase();
 
+private:
+	void register_shards();
+	int accept_clients(const SocketBase &listener);
+	// 返回非零值表示停止接受连接，和 poll_read_and_process() 的返回值含义相同。
+	int add_client(Move<UniqueFile> client, std::size_t thread_hint, boost::shared_ptr<const void> admission_ticket);
+	void add_adopted_clients();
+
 protected:
 	// 工厂函数。返回空指针导致抛出一个异常。
 	virtual boost::shared_ptr<TcpSessionBase> on_client_connect(Move<UniqueFile> client) = 0;
 
 public:
+	bool is_using_ssl() const {
+		return !!m_ssl_factory;
+	}
+	// 因为超过 tcp_admission_* 的限制而在创建会话之前被拒绝的连接数。
+	boost::uint64_t get_rejected_count() const;
+
+	// 把一个已经建立的连接当作刚刚接受的连接处理，用于热重启。这些连接不经过准入控制。
+	void adopt_client(Move<UniqueFile> client);
+
 	int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable) OVERRIDE;
 };
 
@@ -4,10 +4,16 @@
 #include "precompiled.hpp"
 #include "tcp_session_base.hpp"
 #include "ssl_filter.hpp"
+#include "shm_transport.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <poll.h>
 #include "singletons/epoll_daemon.hpp"
 #include "singletons/main_config.hpp"
 #include "log.hpp"
@@ -16,10 +22,118 @@
 #include "atomic.hpp"
 #include "checked_arithmetic.hpp"
 #include "singletons/timer_daemon.hpp"
+#include "singletons/workhorse_camp.hpp"
+#include <boost/container/map.hpp>
 #include "time.hpp"
 
 namespace Poseidon {
 
+namespace {
+	ConfigValue<boost::uint64_t> g_shutdown_timer_period("tcp_shutdown_timer_period", 15000);
+	ConfigValue<boost::uint64_t> g_response_timeout("tcp_response_timeout", 30000);
+	ConfigValue<bool> g_ssl_handshake_offload("ssl_handshake_offload", false);
+	ConfigValue<std::size_t> g_read_budget("tcp_read_budget", 262144);
+	ConfigValue<std::size_t> g_send_high_watermark("tcp_send_high_watermark", 65536);
+	ConfigValue<std::size_t> g_send_low_watermark("tcp_send_low_watermark", 16384);
+
+	// cork_send() 期间积累的数据达到这个大小时不再等待。
+	CONSTEXPR const std::size_t s_max_corked_size = 65536;
+
+	volatile boost::uint64_t g_total_bytes_received = 0;
+	volatile boost::uint64_t g_total_bytes_sent = 0;
+
+	// 两级时间轮。第一级有 SLOT_COUNT 个槽，每个槽跨越 m_tick 毫秒；
+	// 超出第一级范围的项放在第二级中，每转一圈时把即将到期的项移入第一级。
+	// 会话只在到期时被处理一次，刷新 m_last_use_time 不需要访问时间轮。
+	class IdleWheel : NONCOPYABLE {
+	public:
+		typedef boost::container::vector<boost::weak_ptr<TcpSessionBase> > Slot;
+
+	private:
+		enum {
+			SLOT_COUNT = 1024,
+		};
+
+	private:
+		mutable Mutex m_mutex;
+		boost::uint64_t m_tick;
+		boost::uint64_t m_cursor; // 下一个要处理的槽的序号，即时间除以 m_tick。
+		Slot m_slots[SLOT_COUNT];
+		boost::container::multimap<boost::uint64_t, boost::weak_ptr<TcpSessionBase> > m_overflow;
+		boost::shared_ptr<Timer> m_timer;
+
+	public:
+		IdleWheel()
+			: m_tick(0), m_cursor(0)
+		{ }
+
+	private:
+		// 调用时须持有 m_mutex。
+		void place(boost::uint64_t index, const boost::weak_ptr<TcpSessionBase> &weak){
+			if(index < m_cursor){
+				index = m_cursor;
+			}
+			if(index - m_cursor >= SLOT_COUNT){
+				m_overflow.emplace(index, weak);
+				return;
+			}
+			m_slots[index % SLOT_COUNT].push_back(weak);
+		}
+
+	public:
+		// 第一次插入时注册驱动时间轮的 Timer，其回调为 proc。
+		void insert(const boost::weak_ptr<TcpSessionBase> &weak, boost::uint64_t due_time, void (*proc)(boost::uint64_t)){
+			const Mutex::UniqueLock lock(m_mutex);
+			if(!m_timer){
+				m_tick = std::max<boost::uint64_t>(MainConfig::get<boost::uint64_t>("tcp_idle_wheel_tick", 1000), 1);
+				m_cursor = get_fast_mono_clock() / m_tick;
+				m_timer = TimerDaemon::register_low_level_timer(m_tick, m_tick, boost::bind(proc, _2));
+			}
+			// 向上取整，保证不会提前触发。
+			place((due_time + m_tick - 1) / m_tick, weak);
+		}
+
+		void collect_expired(Slot &expired, boost::uint64_t now){
+			PROFILE_ME;
+
+			const Mutex::UniqueLock lock(m_mutex);
+			if(m_tick == 0){
+				return;
+			}
+			const boost::uint64_t end = now / m_tick + 1;
+			while(m_cursor < end){
+				AUTO_REF(slot, m_slots[m_cursor % SLOT_COUNT]);
+				if(expired.empty()){
+					expired.swap(slot);
+				} else {
+					expired.insert(expired.end(), slot.begin(), slot.end());
+					slot.clear();
+				}
+				++m_cursor;
+				if(m_cursor % SLOT_COUNT == 0){
+					// 转完一圈，把第二级中落入新一圈范围的项下放到第一级。
+					while(!m_overflow.empty() && (m_overflow.begin()->first - m_cursor < SLOT_COUNT)){
+						place(m_overflow.begin()->first, m_overflow.begin()->second);
+						m_overflow.erase(m_overflow.begin());
+					}
+				}
+			}
+		}
+	};
+
+	IdleWheel g_idle_wheel;
+}
+
+void TcpSessionBase::idle_wheel_proc(boost::uint64_t now){
+	PROFILE_ME;
+
+	IdleWheel::Slot expired;
+	g_idle_wheel.collect_expired(expired, now);
+	for(AUTO(it, expired.begin()); it != expired.end(); ++it){
+		shutdown_timer_proc(*it, now);
+	}
+}
+
 void TcpSessionBase::shutdown_timer_proc(const boost::weak_ptr<TcpSessionBase> &weak, boost::uint64_t now){
 	PROFILE_ME;
 
@@ -34,63 +148,329 @@ void TcpSessionBase::shutdown_timer_proc(const boost::weak_ptr<TcpSessionBase> &
 		LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
 		session->force_shutdown();
 	}
+	// 周期性地重新放入时间轮，直到会话被销毁。
+	try {
+		const AUTO(period, g_shutdown_timer_period.get());
+		g_idle_wheel.insert(weak, saturated_add(now, period), &idle_wheel_proc);
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		atomic_store(session->m_shutdown_timer_armed, false, ATOMIC_RELEASE);
+	}
+}
+
+struct TcpSessionBase::SendNode {
+	SendNode *next;
+	StreamBuffer data;
+	boost::shared_ptr<const StreamBuffer> shared;
+	boost::shared_ptr<const UniqueFile> file;
+	boost::uint64_t file_offset;
+	boost::uint64_t file_length;
+};
+
+// 共享内存传输的门铃。对端写入数据或者腾出空间时敲响，这里把会话重新放入 epoll 的读写队列。
+class TcpSessionBase::ShmDoorbell : public SocketBase {
+private:
+	boost::weak_ptr<TcpSessionBase> m_weak_parent;
+
+public:
+	explicit ShmDoorbell(Move<UniqueFile> event_fd)
+		: SocketBase(STD_MOVE(event_fd))
+	{ }
+
+public:
+	void set_parent(const boost::weak_ptr<TcpSessionBase> &weak_parent){
+		m_weak_parent = weak_parent;
+	}
+
+	int poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable) OVERRIDE {
+		(void)hint_buffer;
+		(void)hint_capacity;
+		(void)readable;
+
+		boost::uint64_t count;
+		if(::read(get_fd(), &count, sizeof(count)) < 0){
+			return errno;
+		}
+		const AUTO(parent, m_weak_parent.lock());
+		if(parent){
+			EpollDaemon::mark_socket_readable(parent.get());
+			EpollDaemon::mark_socket_writeable(parent.get());
+		}
+		// 读取清零了计数器，下一次敲响会产生新的边沿。
+		return EWOULDBLOCK;
+	}
+};
+
+void TcpSessionBase::ssl_handshake_proc(const boost::weak_ptr<TcpSessionBase> &weak){
+	PROFILE_ME;
+
+	const AUTO(session, weak.lock());
+	if(!session){
+		return;
+	}
+
+	try {
+		session->run_ssl_handshake();
+	} catch(std::exception &e){
+		LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+		atomic_store(session->m_ssl_handshaking, false, ATOMIC_RELEASE);
+		session->force_shutdown();
+	}
 }
 
 TcpSessionBase::TcpSessionBase(Move<UniqueFile> socket)
 	: SocketBase(STD_MOVE(socket)), SessionBase()
+	, m_ssl_handshake_offload(g_ssl_handshake_offload.get()), m_ssl_handshaking(false)
+	, m_shm_accepting(false)
 	, m_connected_notified(false), m_read_hup_notified(false)
-	, m_shutdown_time((boost::uint64_t)-1), m_last_use_time((boost::uint64_t)-1)
+	, m_read_budget(std::max<std::size_t>(g_read_budget.get(), 1))
+	, m_send_queue_head(NULLPTR), m_send_queue_size(0), m_write_scheduled(false), m_send_cork_count(0)
+	, m_send_size(0)
+	, m_send_high_watermark(g_send_high_watermark.get())
+	, m_send_low_watermark(std::min(g_send_low_watermark.get(), m_send_high_watermark))
+	, m_send_throttled(false), m_throttled_since(0), m_throttled_time(0)
+	, m_shutdown_time((boost::uint64_t)-1), m_last_use_time((boost::uint64_t)-1), m_shutdown_timer_armed(false)
+	, m_job_priority(JobBase::PRIORITY_NORMAL), m_handover_state(HS_NONE)
+	, m_bytes_read(0), m_bytes_written(0), m_messages_read(0), m_messages_written(0), m_last_read_time(0), m_last_write_time(0)
 { }
-TcpSessionBase::~TcpSessionBase(){ }
+TcpSessionBase::~TcpSessionBase(){
+	AUTO(node, m_send_queue_head);
+	while(node){
+		const AUTO(next, node->next);
+		delete node;
+		node = next;
+	}
+}
 
 void TcpSessionBase::init_ssl(boost::scoped_ptr<SslFilter> &ssl_filter){
 	DEBUG_THROW_ASSERT(!m_ssl_filter);
 	swap(m_ssl_filter, ssl_filter);
 }
+void TcpSessionBase::init_shm_transport(std::size_t capacity){
+	DEBUG_THROW_ASSERT(!m_ssl_filter && !m_shm_transport && !m_shm_accepting);
+	boost::scoped_ptr<ShmTransport> transport(new ShmTransport(capacity));
+	UniqueFile event_fd;
+	DEBUG_THROW_UNLESS(event_fd.reset(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), SystemException);
+	const AUTO(doorbell, boost::make_shared<ShmDoorbell>(STD_MOVE(event_fd)));
+	ShmTransport::send_handshake(get_fd(), transport->get_memfd(), doorbell->get_fd());
+	LOG_POSEIDON_DEBUG("Requested shared memory transport: remote = ", get_remote_info(), ", capacity = ", transport->get_capacity());
+	swap(m_shm_transport, transport);
+	m_shm_doorbell = doorbell;
+}
+bool TcpSessionBase::check_shm_handshake_pending(){
+	PROFILE_ME;
+
+	if(!m_shm_accepting && (!m_shm_transport || m_shm_transport->has_peer_doorbell())){
+		return false;
+	}
+	UniqueFile memfd, peer_doorbell;
+	const int err_code = ShmTransport::recv_handshake(get_fd(), memfd, peer_doorbell);
+	if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
+		return true;
+	}
+	DEBUG_THROW_UNLESS(err_code == 0, SystemException, err_code);
+	if(m_shm_accepting){
+		DEBUG_THROW_UNLESS(memfd, Exception, sslit("No shared memory in handshake"));
+		boost::scoped_ptr<ShmTransport> transport(new ShmTransport(STD_MOVE(memfd)));
+		UniqueFile event_fd;
+		DEBUG_THROW_UNLESS(event_fd.reset(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), SystemException);
+		const AUTO(doorbell, boost::make_shared<ShmDoorbell>(STD_MOVE(event_fd)));
+		ShmTransport::send_handshake(get_fd(), -1, doorbell->get_fd());
+		transport->set_peer_doorbell(STD_MOVE(peer_doorbell));
+		swap(m_shm_transport, transport);
+		m_shm_doorbell = doorbell;
+		m_shm_accepting = false;
+		// 握手期间调用 send() 的数据还在发送队列中。
+		EpollDaemon::mark_socket_writeable(this);
+	} else {
+		DEBUG_THROW_UNLESS(!memfd, Exception, sslit("Unexpected shared memory in handshake"));
+		m_shm_transport->set_peer_doorbell(STD_MOVE(peer_doorbell));
+	}
+	m_shm_doorbell->set_parent(virtual_weak_from_this<TcpSessionBase>());
+	EpollDaemon::add_socket(m_shm_doorbell, false, get_epoll_thread_index());
+	LOG_POSEIDON_DEBUG("Shared memory transport established: remote = ", get_remote_info(), ", capacity = ", m_shm_transport->get_capacity());
+	return false;
+}
 void TcpSessionBase::create_shutdown_timer(){
 	PROFILE_ME;
 
-	const Mutex::UniqueLock lock(m_shutdown_mutex);
-	if(m_shutdown_timer){
+	if(atomic_load(m_shutdown_timer_armed, ATOMIC_CONSUME)){
 		return;
 	}
-	const AUTO(period, MainConfig::get<boost::uint64_t>("tcp_shutdown_timer_period", 15000));
-	m_shutdown_timer = TimerDaemon::register_low_level_timer(period, period, boost::bind(&shutdown_timer_proc, virtual_weak_from_this<TcpSessionBase>(), _2));
+	if(atomic_exchange(m_shutdown_timer_armed, true, ATOMIC_ACQ_REL)){
+		return;
+	}
+	try {
+		const AUTO(period, g_shutdown_timer_period.get());
+		g_idle_wheel.insert(virtual_weak_from_this<TcpSessionBase>(), saturated_add(get_fast_mono_clock(), period), &idle_wheel_proc);
+	} catch(...){
+		atomic_store(m_shutdown_timer_armed, false, ATOMIC_RELEASE);
+		throw;
+	}
+}
+
+bool TcpSessionBase::check_ssl_handshake_pending(){
+	PROFILE_ME;
+
+	if(!m_ssl_filter || !m_ssl_handshake_offload || m_ssl_filter->is_handshake_finished()){
+		return false;
+	}
+	bool expected = false;
+	if(!atomic_compare_exchange(m_ssl_handshaking, expected, true, ATOMIC_ACQ_REL, ATOMIC_ACQUIRE)){
+		// 已经有一个握手任务在进行了。
+		return true;
+	}
+	try {
+		WorkhorseCamp::enqueue_isolated(boost::shared_ptr<Promise>(), boost::bind(&ssl_handshake_proc, virtual_weak_from_this<TcpSessionBase>()));
+	} catch(...){
+		atomic_store(m_ssl_handshaking, false, ATOMIC_RELEASE);
+		throw;
+	}
+	return true;
+}
+void TcpSessionBase::run_ssl_handshake(){
+	PROFILE_ME;
+
+	for(;;){
+		bool want_write = false;
+		const int err_code = m_ssl_filter->do_handshake(want_write);
+		if(err_code == 0){
+			LOG_POSEIDON_DEBUG("SSL handshake finished: remote = ", get_remote_info());
+			atomic_store(m_ssl_handshaking, false, ATOMIC_RELEASE);
+			EpollDaemon::mark_socket_readable(this);
+			EpollDaemon::mark_socket_writeable(this);
+			return;
+		}
+		if(err_code != EWOULDBLOCK){
+			LOG_POSEIDON_DEBUG("SSL handshake failed: remote = ", get_remote_info(), ", err_code = ", err_code);
+			atomic_store(m_ssl_handshaking, false, ATOMIC_RELEASE);
+			force_shutdown();
+			return;
+		}
+		atomic_store(m_ssl_handshaking, false, ATOMIC_SEQ_CST);
+		// epoll 是边沿触发的，握手期间到达的事件被 epoll 线程忽略了，因此在清除标记之后还要检查一次。
+		::pollfd pfd = { get_fd(), static_cast<short>(want_write ? POLLOUT : POLLIN), 0 };
+		if(::poll(&pfd, 1, 0) <= 0){
+			return;
+		}
+		bool expected = false;
+		if(!atomic_compare_exchange(m_ssl_handshaking, expected, true, ATOMIC_ACQ_REL, ATOMIC_ACQUIRE)){
+			return;
+		}
+	}
+}
+
+bool TcpSessionBase::decide_handover() NOEXCEPT {
+	PROFILE_ME;
+
+	unsigned state = HS_REQUESTED;
+	if(!atomic_compare_exchange(m_handover_state, state, HS_DECIDING, ATOMIC_ACQ_REL, ATOMIC_ACQUIRE)){
+		return false;
+	}
+	bool idle = false;
+	try {
+		if(!m_ssl_filter && !m_shm_transport && !m_shm_accepting && !has_been_shutdown_read() && !has_been_shutdown_write()){
+			{
+				const Mutex::UniqueLock lock(m_send_mutex);
+				idle = (m_send_size == 0) && !atomic_load(m_send_queue_head, ATOMIC_CONSUME);
+			}
+			idle = idle && can_be_handed_over();
+		}
+	} catch(std::exception &e){
+		LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+		idle = false;
+	}
+	if(!idle){
+		atomic_store(m_handover_state, HS_DECLINED, ATOMIC_RELEASE);
+		return false;
+	}
+	// 先停止读写，再通知 HotRestartDaemon 交出描述符。
+	mark_handed_over();
+	atomic_store(m_handover_state, HS_ACCEPTED, ATOMIC_RELEASE);
+	LOG_POSEIDON_DEBUG("TCP connection handed over: local = ", get_local_info(), ", remote = ", get_remote_info());
+	return true;
 }
 
 int TcpSessionBase::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable){
 	PROFILE_ME;
 
+	(void)hint_buffer;
 	(void)readable;
 
+	if((atomic_load(m_handover_state, ATOMIC_CONSUME) == HS_REQUESTED) && decide_handover()){
+		return EWOULDBLOCK;
+	}
+
 	StreamBuffer data;
+	int err_code = 0;
+	bool hung_up = false;
 	try {
-		::ssize_t result;
-		if(m_ssl_filter){
-			result = m_ssl_filter->recv(hint_buffer, hint_capacity);
-		} else {
-			result = ::recv(get_fd(), hint_buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(check_ssl_handshake_pending()){
+			return EWOULDBLOCK;
 		}
-		if(result < 0){
-			return errno;
+		if(check_shm_handshake_pending()){
+			return EWOULDBLOCK;
+		}
+
+		// 直接读入缓冲区自己的内存，省去一次复制。
+		// 由于使用边沿触发，一直读到 EAGAIN 为止；但是每次最多读取 m_read_budget 字节，以免饿死其他套接字。
+		for(;;){
+			const AUTO(buffer, data.reserve_tail(hint_capacity));
+			::ssize_t result;
+			if(m_shm_transport){
+				result = m_shm_transport->recv(buffer, hint_capacity);
+			} else if(m_ssl_filter){
+				result = m_ssl_filter->recv(buffer, hint_capacity);
+			} else {
+				result = ::recv(get_fd(), buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT);
+			}
+			if(result < 0){
+				err_code = errno;
+				break;
+			}
+			data.commit_tail(static_cast<std::size_t>(result));
+			LOG_POSEIDON_TRACE("Read ", result, " byte(s) from ", get_remote_info());
+			if(result == 0){
+				hung_up = true;
+				break;
+			}
+			if(data.size() >= m_read_budget){
+				break;
+			}
+		}
+		if(data.empty() && !hung_up){
+			return err_code;
+		}
+		atomic_add(g_total_bytes_received, data.size(), ATOMIC_RELAXED);
+		atomic_add(m_bytes_read, data.size(), ATOMIC_RELAXED);
+		if(data.size() < hint_capacity / 4){
+			// 数据很少时复制到一个较小的块中，以免长期占用整个 I/O 缓冲区大小的内存。
+			// 不能使用复制构造函数，它会共享超过 SHARING_THRESHOLD 的块，仍然占用原来的块。
+			const AUTO(size, data.size());
+			StreamBuffer compact;
+			const AUTO(dst, compact.reserve_tail(size));
+			data.peek(dst, size);
+			compact.commit_tail(size);
+			compact.swap(data);
 		}
-		data.put(hint_buffer, static_cast<std::size_t>(result));
-		LOG_POSEIDON_TRACE("Read ", result, " byte(s) from ", get_remote_info());
 
-		const AUTO(now, get_fast_mono_clock());
+		const AUTO(now, get_coarse_mono_clock());
 		atomic_store(m_last_use_time, now, ATOMIC_RELEASE);
+		atomic_store(m_last_read_time, now, ATOMIC_RELAXED);
 		create_shutdown_timer();
 
-		if(data.empty() && !m_read_hup_notified){
-			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "TCP connection read hung up: local = ", get_local_info(), ", remote = ", get_remote_info());
-			shutdown_read();
-			on_read_hup();
-			m_read_hup_notified = true;
+		if(!data.empty()){
+			on_receive(STD_MOVE(data));
 		}
-		if(data.empty()){
+		if(hung_up){
+			if(!m_read_hup_notified){
+				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "TCP connection read hung up: local = ", get_local_info(), ", remote = ", get_remote_info());
+				shutdown_read();
+				on_read_hup();
+				m_read_hup_notified = true;
+			}
 			return EWOULDBLOCK;
 		}
-		on_receive(STD_MOVE(data));
 	} catch(std::exception &e){
 		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 		force_shutdown();
@@ -100,13 +480,178 @@ int TcpSessionBase::poll_read_and_process(unsigned char *hint_buffer, std::size_
 		force_shutdown();
 		return EPIPE;
 	}
-	return 0;
+	// 如果因为用完预算而返回零，epoll 会将其重新排队。
+	return err_code;
+}
+
+void TcpSessionBase::set_send_throttled(bool throttled) const NOEXCEPT {
+	if(m_send_throttled == throttled){
+		return;
+	}
+	const AUTO(now, get_coarse_mono_clock());
+	if(throttled){
+		m_throttled_since = now;
+	} else {
+		m_throttled_time += saturated_sub(now, m_throttled_since);
+	}
+	m_send_throttled = throttled;
+}
+void TcpSessionBase::drain_send_queue() NOEXCEPT {
+	AUTO(node, atomic_exchange(m_send_queue_head, NULLPTR, ATOMIC_ACQUIRE));
+	if(!node){
+		return;
+	}
+	// 栈中的顺序与 send() 的调用顺序相反，先翻转过来。
+	SendNode *fifo = NULLPTR;
+	while(node){
+		const AUTO(next, node->next);
+		node->next = fifo;
+		fifo = node;
+		node = next;
+	}
+	while(fifo){
+		const AUTO(next, fifo->next);
+		std::size_t size;
+		if(fifo->shared){
+			size = fifo->shared->size();
+			m_send_segments.emplace_back();
+			m_send_segments.back().shared.swap(fifo->shared);
+			m_send_segments.back().shared_offset = 0;
+		} else if(fifo->file){
+			size = static_cast<std::size_t>(fifo->file_length);
+			m_send_segments.emplace_back();
+			m_send_segments.back().shared_offset = 0;
+			m_send_segments.back().file.swap(fifo->file);
+			m_send_segments.back().file_offset = fifo->file_offset;
+			m_send_segments.back().file_remaining = fifo->file_length;
+		} else {
+			size = fifo->data.size();
+			// 相邻的普通数据合并到同一个分段中。
+			if(m_send_segments.empty() || m_send_segments.back().shared || m_send_segments.back().file){
+				m_send_segments.emplace_back();
+				m_send_segments.back().shared_offset = 0;
+			}
+			m_send_segments.back().owned.splice(fifo->data);
+		}
+		m_send_size += size;
+		atomic_sub(m_send_queue_size, size, ATOMIC_RELAXED);
+		delete fifo;
+		fifo = next;
+	}
+}
+std::size_t TcpSessionBase::gather_send_chunks(::iovec *vecs, std::size_t max_count, bool &file_follows) const NOEXCEPT {
+	std::size_t count = 0;
+	file_follows = false;
+	for(AUTO(it, m_send_segments.begin()); (it != m_send_segments.end()) && (count < max_count); ++it){
+		if(it->file){
+			// 文件分段单独发送。
+			file_follows = true;
+			break;
+		}
+		const StreamBuffer &buffer = it->shared ? *(it->shared) : it->owned;
+		std::size_t to_skip = it->shared ? it->shared_offset : 0;
+		StreamBuffer::EnumerationCookie cookie;
+		const void *chunk_data;
+		std::size_t chunk_size;
+		while((count < max_count) && buffer.enumerate_chunk(&chunk_data, &chunk_size, cookie)){
+			if(chunk_size <= to_skip){
+				to_skip -= chunk_size;
+				continue;
+			}
+			::iovec &vec = vecs[count++];
+			vec.iov_base = const_cast<unsigned char *>(static_cast<const unsigned char *>(chunk_data) + to_skip);
+			vec.iov_len = chunk_size - to_skip;
+			to_skip = 0;
+		}
+	}
+	return count;
+}
+void TcpSessionBase::discard_sent(std::size_t count) NOEXCEPT {
+	assert(count <= m_send_size);
+	m_send_size -= count;
+	std::size_t remaining = count;
+	while((remaining != 0) && !m_send_segments.empty()){
+		AUTO_REF(segment, m_send_segments.front());
+		if(segment.shared){
+			const std::size_t avail = segment.shared->size() - segment.shared_offset;
+			if(avail > remaining){
+				segment.shared_offset += remaining;
+				break;
+			}
+			remaining -= avail;
+		} else if(segment.file){
+			if(segment.file_remaining > remaining){
+				segment.file_offset += remaining;
+				segment.file_remaining -= remaining;
+				break;
+			}
+			remaining -= static_cast<std::size_t>(segment.file_remaining);
+		} else {
+			remaining -= segment.owned.discard(remaining);
+			if(!segment.owned.empty()){
+				break;
+			}
+		}
+		m_send_segments.pop_front();
+	}
+}
+void TcpSessionBase::push_send_node(TcpSessionBase::SendNode *node) NOEXCEPT {
+	AUTO(head, atomic_load(m_send_queue_head, ATOMIC_RELAXED));
+	do {
+		node->next = head;
+	} while(!atomic_compare_exchange(m_send_queue_head, head, node, ATOMIC_RELEASE, ATOMIC_RELAXED));
+
+	if((atomic_load(m_send_cork_count, ATOMIC_SEQ_CST) != 0) && (atomic_load(m_send_queue_size, ATOMIC_RELAXED) < s_max_corked_size)){
+		// 由 uncork_send() 通知 epoll。
+		return;
+	}
+	// 同一时刻最多只需要通知 epoll 一次。
+	if(!atomic_exchange(m_write_scheduled, true, ATOMIC_SEQ_CST)){
+		EpollDaemon::mark_socket_writeable(this);
+	}
 }
+
+::ssize_t TcpSessionBase::send_file_segment(unsigned char *hint_buffer, std::size_t hint_capacity, int file_fd, boost::uint64_t file_offset, boost::uint64_t file_remaining){
+	PROFILE_ME;
+
+	::ssize_t result;
+	if(m_shm_transport || (m_ssl_filter && !m_ssl_filter->is_kernel_send_active())){
+		const std::size_t bytes_to_read = static_cast<std::size_t>(std::min<boost::uint64_t>(file_remaining, hint_capacity));
+		result = ::pread(file_fd, hint_buffer, bytes_to_read, static_cast< ::off_t>(file_offset));
+		if(result <= 0){
+			if(result == 0){
+				errno = EIO;
+			}
+			return -1;
+		}
+		if(m_shm_transport){
+			::iovec vec;
+			vec.iov_base = hint_buffer;
+			vec.iov_len = static_cast<std::size_t>(result);
+			return m_shm_transport->send(&vec, 1);
+		}
+		return m_ssl_filter->send(hint_buffer, static_cast<std::size_t>(result));
+	}
+	// 一次最多发送 1 MiB，以免一个大文件长期占用 epoll 线程。
+	const std::size_t bytes_to_send = static_cast<std::size_t>(std::min<boost::uint64_t>(file_remaining, 0x100000));
+	::off_t offset = static_cast< ::off_t>(file_offset);
+	result = ::sendfile(get_fd(), file_fd, &offset, bytes_to_send);
+	if(result == 0){
+		// 文件被截断了。
+		errno = EIO;
+		return -1;
+	}
+	return result;
+}
+
 int TcpSessionBase::poll_write(Mutex::UniqueLock &write_lock, unsigned char *hint_buffer, std::size_t hint_capacity, bool writeable){
 	PROFILE_ME;
 
 	assert(!write_lock);
 
+	// 先清除标记再取出数据，这样之后调用 send() 的线程总会再次通知 epoll。
+	atomic_store(m_write_scheduled, false, ATOMIC_SEQ_CST);
+
 	StreamBuffer data;
 	try {
 		if(writeable && !m_connected_notified){
@@ -114,13 +659,21 @@ int TcpSessionBase::poll_write(Mutex::UniqueLock &write_lock, unsigned char *hin
 			on_connect();
 			m_connected_notified = true;
 		}
+		if(check_ssl_handshake_pending() || m_shm_accepting){
+			// 握手完成之后会重新通知 epoll。
+			return EWOULDBLOCK;
+		}
 
 		Mutex::UniqueLock lock(m_send_mutex);
-		const std::size_t avail = m_send_buffer.peek(hint_buffer, hint_capacity);
-		if(avail == 0){
+		drain_send_queue();
+		if(m_send_size == 0){
 _check_shutdown:
 			if(should_really_shutdown_write()){
-				if(m_ssl_filter){
+				if(m_shm_transport){
+					// 两端都关闭写入之后套接字上会出现 EPOLLHUP，由 epoll 关闭会话。
+					m_shm_transport->send_fin();
+					::shutdown(get_fd(), SHUT_WR);
+				} else if(m_ssl_filter){
 					m_ssl_filter->send_fin();
 				} else {
 					::shutdown(get_fd(), SHUT_WR);
@@ -128,27 +681,73 @@ _check_shutdown:
 			}
 			return EWOULDBLOCK;
 		}
+		const bool corked = (atomic_load(m_send_cork_count, ATOMIC_SEQ_CST) != 0) && !has_been_shutdown_write();
+		if(corked && (m_send_size < s_max_corked_size)){
+			// 等待 uncork_send() 再次通知 epoll。
+			return EWOULDBLOCK;
+		}
+
+		// 直接从发送缓冲区（包括共享的广播负载）的各个块中发送，避免复制到 hint_buffer。
+		// 只有 epoll 线程会从队首移除数据，因此解锁以后这些块中的数据仍然有效。
+		boost::array< ::iovec, 64> vecs;
+		bool file_follows;
+		const std::size_t vec_count = gather_send_chunks(vecs.data(), vecs.size(), file_follows);
+		int file_fd = -1;
+		boost::uint64_t file_offset = 0, file_remaining = 0;
+		if(vec_count == 0){
+			// 队首（跳过空的分段之后）是一个文件分段。
+			AUTO(it, m_send_segments.begin());
+			while(!it->file){
+				++it;
+			}
+			file_fd = it->file->get();
+			file_offset = it->file_offset;
+			file_remaining = it->file_remaining;
+		}
 		lock.unlock();
 
 		::ssize_t result;
-		if(m_ssl_filter){
+		if(file_fd >= 0){
+			result = send_file_segment(hint_buffer, hint_capacity, file_fd, file_offset, file_remaining);
+		} else if(m_shm_transport){
+			result = m_shm_transport->send(vecs.data(), vec_count);
+		} else if(m_ssl_filter && !m_ssl_filter->is_kernel_send_active()){
+			std::size_t avail = 0;
+			for(std::size_t i = 0; (i < vec_count) && (avail < hint_capacity); ++i){
+				const std::size_t bytes_to_copy = std::min(vecs[i].iov_len, hint_capacity - avail);
+				std::memcpy(hint_buffer + avail, vecs[i].iov_base, bytes_to_copy);
+				avail += bytes_to_copy;
+			}
 			result = m_ssl_filter->send(hint_buffer, avail);
 		} else {
-			result = ::send(get_fd(), hint_buffer, avail, MSG_NOSIGNAL | MSG_DONTWAIT);
+			// 如果启用了 kTLS，内核负责加密，这里和明文连接一样直接写入套接字。
+			// 后面还有数据（仍然处于 cork 状态，或者紧跟着一个文件分段）时使用 MSG_MORE，让内核把尾部和后续数据合并为完整的报文段。
+			::msghdr msg = { };
+			msg.msg_iov = vecs.data();
+			msg.msg_iovlen = vec_count;
+			result = ::sendmsg(get_fd(), &msg, MSG_NOSIGNAL | MSG_DONTWAIT | ((corked || file_follows) ? MSG_MORE : 0));
 		}
 		if(result < 0){
 			return errno;
 		}
 		LOG_POSEIDON_TRACE("Wrote ", result, " byte(s) to ", get_remote_info());
+		atomic_add(g_total_bytes_sent, static_cast<boost::uint64_t>(result), ATOMIC_RELAXED);
+		atomic_add(m_bytes_written, static_cast<boost::uint64_t>(result), ATOMIC_RELAXED);
 
-		const AUTO(now, get_fast_mono_clock());
+		const AUTO(now, get_coarse_mono_clock());
 		atomic_store(m_last_use_time, now, ATOMIC_RELEASE);
+		atomic_store(m_last_write_time, now, ATOMIC_RELAXED);
 		create_shutdown_timer();
 
 		lock.lock();
-		m_send_buffer.discard(static_cast<std::size_t>(result));
+		discard_sent(static_cast<std::size_t>(result));
+		if(m_send_throttled && (m_send_size < m_send_low_watermark)){
+			LOG_POSEIDON_TRACE("Send buffer drained below low watermark: remote = ", get_remote_info(), ", size = ", m_send_size);
+			set_send_throttled(false);
+			EpollDaemon::mark_socket_readable(this);
+		}
 		swap(write_lock, lock);
-		if(m_send_buffer.empty()){
+		if(m_send_size == 0){
 			goto _check_shutdown;
 		}
 	} catch(std::exception &e){
@@ -171,7 +770,7 @@ void TcpSessionBase::on_shutdown_timer(boost::uint64_t now){
 		std::size_t send_buffer_size;
 		{
 			const Mutex::UniqueLock lock(m_send_mutex);
-			send_buffer_size = m_send_buffer.size();
+			send_buffer_size = m_send_size + atomic_load(m_send_queue_size, ATOMIC_RELAXED);
 		}
 		if(send_buffer_size == 0){
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Connection closed due to inactivity: remote = ", get_remote_info());
@@ -184,7 +783,7 @@ force_time_out:
 	}
 
 	const AUTO(last_use_time, atomic_load(m_last_use_time, ATOMIC_CONSUME));
-	const AUTO(tcp_response_timeout, MainConfig::get<boost::uint64_t>("tcp_response_timeout", 30000));
+	const AUTO(tcp_response_timeout, g_response_timeout.get());
 	if(saturated_sub(now, last_use_time) > tcp_response_timeout){
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "The connection seems dead: remote = ", get_remote_info());
 		goto force_time_out;
@@ -209,19 +808,71 @@ void TcpSessionBase::force_shutdown() NOEXCEPT {
 
 bool TcpSessionBase::is_throttled() const {
 	const Mutex::UniqueLock lock(m_send_mutex);
-	if(m_send_buffer.size() >= 65536){
+	if(m_send_size + atomic_load(m_send_queue_size, ATOMIC_RELAXED) >= m_send_high_watermark){
+		set_send_throttled(true);
+	}
+	if(m_send_throttled){
 		return true;
 	}
 	return SocketBase::is_throttled();
 }
+void TcpSessionBase::set_send_watermarks(std::size_t high, std::size_t low){
+	PROFILE_ME;
+	DEBUG_THROW_UNLESS(low <= high, Exception, sslit("Low watermark must not be greater than high watermark"));
+
+	const Mutex::UniqueLock lock(m_send_mutex);
+	m_send_high_watermark = high;
+	m_send_low_watermark = low;
+	if(m_send_throttled && (m_send_size < m_send_low_watermark)){
+		set_send_throttled(false);
+		EpollDaemon::mark_socket_readable(this);
+	}
+}
 
 bool TcpSessionBase::is_using_ssl() const {
 	return !!m_ssl_filter;
 }
 
+void TcpSessionBase::accept_shm_transport(){
+	DEBUG_THROW_ASSERT(!m_ssl_filter && !m_shm_transport && !m_shm_accepting);
+	m_shm_accepting = true;
+}
+bool TcpSessionBase::is_using_shm_transport() const {
+	return m_shm_accepting || m_shm_transport;
+}
+
+void TcpSessionBase::account_message_read() NOEXCEPT {
+	atomic_add(m_messages_read, 1, ATOMIC_RELAXED);
+}
+void TcpSessionBase::account_message_written() NOEXCEPT {
+	atomic_add(m_messages_written, 1, ATOMIC_RELAXED);
+}
+
+void TcpSessionBase::get_traffic_statistics(TrafficStatistics &ret) const {
+	ret.bytes_read = atomic_load(m_bytes_read, ATOMIC_RELAXED);
+	ret.bytes_written = atomic_load(m_bytes_written, ATOMIC_RELAXED);
+	ret.messages_read = atomic_load(m_messages_read, ATOMIC_RELAXED);
+	ret.messages_written = atomic_load(m_messages_written, ATOMIC_RELAXED);
+	ret.last_read_time = atomic_load(m_last_read_time, ATOMIC_RELAXED);
+	ret.last_write_time = atomic_load(m_last_write_time, ATOMIC_RELAXED);
+
+	const Mutex::UniqueLock lock(m_send_mutex);
+	ret.send_buffer_size = m_send_size + atomic_load(m_send_queue_size, ATOMIC_RELAXED);
+	ret.throttled_time = m_throttled_time;
+	if(m_send_throttled){
+		ret.throttled_time += saturated_sub(get_coarse_mono_clock(), m_throttled_since);
+	}
+}
+
 void TcpSessionBase::set_no_delay(bool enabled){
 	PROFILE_ME;
 
+	int family;
+	::socklen_t len = sizeof(family);
+	if((::getsockopt(get_fd(), SOL_SOCKET, SO_DOMAIN, &family, &len) == 0) && (family == AF_UNIX)){
+		// Unix 域套接字没有 Nagle 算法，数据总是立即送达。
+		return;
+	}
 	const int val = enabled;
 	DEBUG_THROW_UNLESS(::setsockopt(get_fd(), IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) == 0, SystemException);
 }
@@ -233,6 +884,50 @@ void TcpSessionBase::set_timeout(boost::uint64_t timeout){
 	create_shutdown_timer();
 }
 
+JobBase::Priority TcpSessionBase::get_job_priority() const NOEXCEPT {
+	return static_cast<JobBase::Priority>(atomic_load(m_job_priority, ATOMIC_CONSUME));
+}
+void TcpSessionBase::set_job_priority(JobBase::Priority priority) NOEXCEPT {
+	atomic_store(m_job_priority, static_cast<unsigned>(priority), ATOMIC_RELEASE);
+}
+
+bool TcpSessionBase::can_be_handed_over() const {
+	return false;
+}
+
+void TcpSessionBase::request_handover(){
+	PROFILE_ME;
+
+	unsigned state = HS_NONE;
+	if(!atomic_compare_exchange(m_handover_state, state, HS_REQUESTED, ATOMIC_ACQ_REL, ATOMIC_ACQUIRE)){
+		return;
+	}
+	// 空闲的连接不会有读事件，这里让 epoll 线程主动处理一次。
+	EpollDaemon::mark_socket_readable(this);
+}
+TcpSessionBase::HandoverState TcpSessionBase::get_handover_state() const NOEXCEPT {
+	return static_cast<HandoverState>(atomic_load(m_handover_state, ATOMIC_ACQUIRE));
+}
+bool TcpSessionBase::cancel_handover() NOEXCEPT {
+	unsigned state = HS_REQUESTED;
+	return atomic_compare_exchange(m_handover_state, state, HS_DECLINED, ATOMIC_ACQ_REL, ATOMIC_ACQUIRE);
+}
+
+void TcpSessionBase::cork_send() NOEXCEPT {
+	atomic_add(m_send_cork_count, 1u, ATOMIC_SEQ_CST);
+}
+void TcpSessionBase::uncork_send() NOEXCEPT {
+	const AUTO(old_count, atomic_sub(m_send_cork_count, 1u, ATOMIC_SEQ_CST) + 1);
+	assert(old_count != 0);
+	if(old_count != 1){
+		return;
+	}
+	// poll_write() 先清除 m_write_scheduled 再检查 cork 计数，因此这里不会漏掉通知。
+	if(!atomic_exchange(m_write_scheduled, true, ATOMIC_SEQ_CST)){
+		EpollDaemon::mark_socket_writeable(this);
+	}
+}
+
 bool TcpSessionBase::send(StreamBuffer buffer){
 	PROFILE_ME;
 
@@ -241,10 +936,70 @@ bool TcpSessionBase::send(StreamBuffer buffer){
 		return false;
 	}
 
-	const Mutex::UniqueLock lock(m_send_mutex);
-	m_send_buffer.splice(buffer);
-	EpollDaemon::mark_socket_writeable(this);
+	const AUTO(node, new SendNode);
+	node->data.swap(buffer);
+	atomic_add(m_send_queue_size, node->data.size(), ATOMIC_RELAXED);
+	push_send_node(node);
 	return true;
 }
+bool TcpSessionBase::send_shared(const boost::shared_ptr<const StreamBuffer> &payload){
+	PROFILE_ME;
+	DEBUG_THROW_ASSERT(payload);
+
+	if(has_been_shutdown_write()){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "TCP socket has been shut down for writing: local = ", get_local_info(), ", remote = ", get_remote_info());
+		return false;
+	}
+
+	const AUTO(node, new SendNode);
+	node->shared = payload;
+	atomic_add(m_send_queue_size, payload->size(), ATOMIC_RELAXED);
+	push_send_node(node);
+	return true;
+}
+
+bool TcpSessionBase::send_file(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length){
+	PROFILE_ME;
+
+	const AUTO(owned, boost::make_shared<UniqueFile>());
+	owned->reset(STD_MOVE(file));
+	DEBUG_THROW_ASSERT(*owned);
+
+	if(has_been_shutdown_write()){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "TCP socket has been shut down for writing: local = ", get_local_info(), ", remote = ", get_remote_info());
+		return false;
+	}
+	if(length == 0){
+		return true;
+	}
+
+	const AUTO(node, new SendNode);
+	node->file = owned;
+	node->file_offset = offset;
+	node->file_length = length;
+	atomic_add(m_send_queue_size, static_cast<std::size_t>(length), ATOMIC_RELAXED);
+	push_send_node(node);
+	return true;
+}
+
+std::size_t TcpSessionBase::broadcast(const boost::container::vector<boost::shared_ptr<TcpSessionBase> > &sessions, const boost::shared_ptr<const StreamBuffer> &payload){
+	PROFILE_ME;
+	DEBUG_THROW_ASSERT(payload);
+
+	std::size_t count = 0;
+	for(AUTO(it, sessions.begin()); it != sessions.end(); ++it){
+		const AUTO_REF(session, *it);
+		if(!session){
+			continue;
+		}
+		count += session->send_shared(payload);
+	}
+	return count;
+}
+
+void TcpSessionBase::get_traffic_totals(boost::uint64_t &bytes_received, boost::uint64_t &bytes_sent) NOEXCEPT {
+	bytes_received = atomic_load(g_total_bytes_received, ATOMIC_RELAXED);
+	bytes_sent = atomic_load(g_total_bytes_sent, ATOMIC_RELAXED);
+}
 
 }
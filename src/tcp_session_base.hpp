@@ -8,35 +8,120 @@
 #include "cxx_util.hpp"
 #include "socket_base.hpp"
 #include "session_base.hpp"
+#include "job_base.hpp"
+#include "raii.hpp"
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/container/deque.hpp>
+#include <boost/container/vector.hpp>
+#include <sys/uio.h>
 
 namespace Poseidon {
 
 class TcpServerBase;
 class TcpClientBase;
 class SslFilter;
-class Timer;
+class ShmTransport;
 
 class TcpSessionBase : public SocketBase, public SessionBase {
 	friend TcpServerBase;
 	friend TcpClientBase;
 
+public:
+	// 热重启时把空闲的连接交给新进程。
+	enum HandoverState {
+		HS_NONE         = 0,
+		HS_REQUESTED    = 1, // 等待 epoll 线程检查。
+		HS_DECIDING     = 2, // epoll 线程正在检查，不能取消。
+		HS_ACCEPTED     = 3, // 这个进程不再读写这个连接，描述符可以交给新进程。
+		HS_DECLINED     = 4, // 连接不空闲，或者请求已经被取消，照常使用。
+	};
+
+	// 在其生存期内排队的数据被合并起来，析构时一次性写入套接字。可以嵌套。
+	class SendCorkGuard : NONCOPYABLE {
+	private:
+		TcpSessionBase &m_session;
+
+	public:
+		explicit SendCorkGuard(TcpSessionBase &session)
+			: m_session(session)
+		{
+			m_session.cork_send();
+		}
+		~SendCorkGuard(){
+			m_session.uncork_send();
+		}
+	};
+
+private:
+	struct SendNode;
+	class ShmDoorbell;
+
+	struct SendSegment {
+		StreamBuffer owned;
+		// 广播的负载由多个会话共享且不可修改，每个会话只记录自己已经发送到的位置。
+		boost::shared_ptr<const StreamBuffer> shared;
+		std::size_t shared_offset;
+		// 文件的一部分，由 epoll 线程直接从页缓存发送。
+		boost::shared_ptr<const UniqueFile> file;
+		boost::uint64_t file_offset;
+		boost::uint64_t file_remaining;
+	};
+
 private:
 	static void shutdown_timer_proc(const boost::weak_ptr<TcpSessionBase> &weak, boost::uint64_t now);
+	static void idle_wheel_proc(boost::uint64_t now);
+	static void ssl_handshake_proc(const boost::weak_ptr<TcpSessionBase> &weak);
 
 private:
 	boost::scoped_ptr<SslFilter> m_ssl_filter;
+	// 如果启用，SSL 握手在 WorkhorseCamp 中进行，握手完成之前 epoll 线程不会处理这个连接的数据。
+	const bool m_ssl_handshake_offload;
+	volatile bool m_ssl_handshaking;
+
+	// 如果启用了共享内存传输，数据不再经过套接字。只能在添加到 epoll 之前设置，或者在 epoll 线程中设置。
+	boost::scoped_ptr<ShmTransport> m_shm_transport;
+	boost::shared_ptr<ShmDoorbell> m_shm_doorbell;
+	bool m_shm_accepting; // 等待发起连接的一端发来共享内存。
 
 	bool m_connected_notified;
 	bool m_read_hup_notified;
+	const std::size_t m_read_budget;
+
+	// send() 不加锁，把数据压入这个无锁栈（多生产者单消费者），由 epoll 线程在 poll_write() 中取出。
+	SendNode *volatile m_send_queue_head;
+	volatile std::size_t m_send_queue_size;
+	volatile bool m_write_scheduled;
+	volatile unsigned m_send_cork_count;
 
 	mutable Mutex m_send_mutex;
-	StreamBuffer m_send_buffer;
+	boost::container::deque<SendSegment> m_send_segments;
+	std::size_t m_send_size;
+	// 发送缓冲区超过高水位时暂停读取，回落到低水位以下时由 poll_write() 恢复。
+	std::size_t m_send_high_watermark;
+	std::size_t m_send_low_watermark;
+	mutable bool m_send_throttled;
+	mutable boost::uint64_t m_throttled_since;
+	mutable boost::uint64_t m_throttled_time;
 
 	volatile boost::uint64_t m_shutdown_time;
 	volatile boost::uint64_t m_last_use_time;
-	mutable Mutex m_shutdown_mutex;
-	boost::shared_ptr<Timer> m_shutdown_timer;
+	// 所有会话共享一个时间轮，而不是每个会话各注册一个 Timer。
+	volatile bool m_shutdown_timer_armed;
+
+	volatile unsigned m_job_priority;
+	volatile unsigned m_handover_state;
+
+	// 以下统计在 I/O 路径上以松散的原子操作更新，供 EpollDaemon::snapshot() 读取。
+	volatile boost::uint64_t m_bytes_read;
+	volatile boost::uint64_t m_bytes_written;
+	volatile boost::uint64_t m_messages_read;
+	volatile boost::uint64_t m_messages_written;
+	volatile boost::uint64_t m_last_read_time;
+	volatile boost::uint64_t m_last_write_time;
+
+	// 由 TcpServerBase 在接受连接时设置，会话销毁时归还这个 IP 的并发连接数。
+	boost::shared_ptr<const void> m_admission_ticket;
 
 public:
 	explicit TcpSessionBase(Move<UniqueFile> socket);
@@ -44,7 +129,23 @@ public:
 
 private:
 	void init_ssl(boost::scoped_ptr<SslFilter> &ssl_filter);
+	void init_shm_transport(std::size_t capacity);
+	// 如果握手尚未完成返回 true。
+	bool check_shm_handshake_pending();
 	void create_shutdown_timer();
+	// 如果握手已经完成返回 false；否则确保有一个握手任务在进行中并返回 true。
+	bool check_ssl_handshake_pending();
+	void run_ssl_handshake();
+	// 调用时须持有 m_send_mutex。
+	void drain_send_queue() NOEXCEPT;
+	void set_send_throttled(bool throttled) const NOEXCEPT;
+	// 如果这些数据之后紧跟着一个文件分段，file_follows 被设为 true。
+	std::size_t gather_send_chunks(::iovec *vecs, std::size_t max_count, bool &file_follows) const NOEXCEPT;
+	void discard_sent(std::size_t count) NOEXCEPT;
+	void push_send_node(SendNode *node) NOEXCEPT;
+	::ssize_t send_file_segment(unsigned char *hint_buffer, std::size_t hint_capacity, int file_fd, boost::uint64_t file_offset, boost::uint64_t file_remaining);
+	// 如果连接被交出返回 true。
+	bool decide_handover() NOEXCEPT;
 
 protected:
 	// 注意，只能在 epoll 线程中调用这些函数。
@@ -59,6 +160,14 @@ protected:
 	// 注意，只能在 timer 线程中调用这些函数。
 	virtual void on_shutdown_timer(boost::uint64_t now);
 
+	// 热重启时判断这个连接能否交给新进程，只在 epoll 线程中调用。调用时发送缓冲区为空，并且没有使用 SSL。
+	// 派生类须确认没有读到一半的请求，也没有正在处理、尚未发出响应的请求。默认返回 false。
+	virtual bool can_be_handed_over() const;
+
+	// 由协议层在收到或者发出一个完整的消息时调用，只用于统计。
+	void account_message_read() NOEXCEPT;
+	void account_message_written() NOEXCEPT;
+
 public:
 	bool has_been_shutdown_read() const NOEXCEPT OVERRIDE;
 	bool has_been_shutdown_write() const NOEXCEPT OVERRIDE;
@@ -67,13 +176,51 @@ public:
 	void force_shutdown() NOEXCEPT OVERRIDE;
 
 	bool is_throttled() const OVERRIDE;
+	void set_send_watermarks(std::size_t high, std::size_t low);
 
 	bool is_using_ssl() const;
 
+	// 改用共享内存收发数据，只能用于 Unix 域套接字，须在添加到 epoll 之前调用。
+	// 接受连接的一端（例如在 TcpServerBase::on_client_connect() 中）调用这个函数，发起连接的一端调用 TcpClientBase::request_shm_transport()。
+	void accept_shm_transport();
+	bool is_using_shm_transport() const;
+
+	void get_traffic_statistics(TrafficStatistics &ret) const OVERRIDE;
+
 	void set_no_delay(bool enabled = true);
 	void set_timeout(boost::uint64_t timeout);
 
+	// 这个会话投递的同步任务的优先级。例如可以把管理后台的连接设为 PRIORITY_BACKGROUND，以免影响玩家的请求。
+	JobBase::Priority get_job_priority() const NOEXCEPT;
+	void set_job_priority(JobBase::Priority priority) NOEXCEPT;
+
+	// 由 HotRestartDaemon 调用。检查在 epoll 线程下一次读取这个连接之前进行。
+	void request_handover();
+	HandoverState get_handover_state() const NOEXCEPT;
+	// 如果 epoll 线程尚未开始检查，放弃请求并返回 true。
+	bool cancel_handover() NOEXCEPT;
+
+	// 类似于 TCP_CORK：cork_send() 之后排队的数据暂不写入套接字，最后一次 uncork_send() 时合并为一次 sendmsg() 写出，
+	// 例如响应头、正文和 chunked 编码的各个分块不会各自成为一个 TCP 报文段。
+	// 积累的数据达到 64 KiB 或者连接被关闭写入时仍然会写出，此时使用 MSG_MORE，不足一个报文段的尾部留在内核中等待后续数据。
+	// 每次 cork_send() 必须对应一次 uncork_send()，通常使用 SendCorkGuard。
+	void cork_send() NOEXCEPT;
+	void uncork_send() NOEXCEPT;
+
 	bool send(StreamBuffer buffer) OVERRIDE;
+	// 发送一个共享的只读负载。排队时只增加引用计数，不复制数据。
+	// 负载按原样写入套接字，不经过派生类 send() 的任何封装，因此调用者须自行编码（例如 Cbpp::LowLevelSession::broadcast()）。
+	bool send_shared(const boost::shared_ptr<const StreamBuffer> &payload);
+	// 发送文件中从 offset 开始的 length 字节，文件描述符的所有权转移给这个会话。
+	// 明文连接和启用了 kTLS 的连接使用 sendfile()，数据不经过用户态；其他 SSL 连接每次读入 I/O 缓冲区再加密。
+	// 和 send_shared() 一样，数据按原样写入套接字。发送的过程中文件被截断会导致连接被关闭。
+	bool send_file(Move<UniqueFile> file, boost::uint64_t offset, boost::uint64_t length);
+
+	// 把同一个负载发送给多个会话，无论会话数量多少，负载只存在一份。返回成功排队的会话数。
+	static std::size_t broadcast(const boost::container::vector<boost::shared_ptr<TcpSessionBase> > &sessions, const boost::shared_ptr<const StreamBuffer> &payload);
+
+	// 进程启动以来所有 TCP 会话收发的字节数。对于 SSL 连接，统计的是明文的字节数。
+	static void get_traffic_totals(boost::uint64_t &bytes_received, boost::uint64_t &bytes_sent) NOEXCEPT;
 };
 
 }
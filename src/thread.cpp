@@ -5,6 +5,12 @@
 #include "thread.hpp"
 #include "log.hpp"
 #include "system_exception.hpp"
+#include "string.hpp"
+#include "mutex.hpp"
+#include "singletons/main_config.hpp"
+#include "singletons/sampling_profiler.hpp"
+#include <sched.h>
+#include <boost/container/map.hpp>
 
 namespace Poseidon {
 
@@ -16,8 +22,82 @@ namespace {
 
 		boost::shared_ptr<ThreadControlBlock> ref;
 		::pthread_t handle;
+		std::size_t index;
 	};
 
+	// 同名线程按创建顺序编号，用于把每个线程绑定到 CPU 列表中的不同 CPU 上。
+	Mutex g_index_mutex;
+	boost::container::map<std::string, std::size_t> g_next_index_by_name;
+
+	std::size_t allocate_thread_index(const char *name){
+		const Mutex::UniqueLock lock(g_index_mutex);
+		return g_next_index_by_name[name]++;
+	}
+
+	// 解析形如 `0-3,8,10-11` 的 CPU 列表。
+	bool parse_cpu_list(boost::container::vector<unsigned> &cpus, const std::string &str){
+		std::size_t pos = 0;
+		while(pos < str.size()){
+			std::size_t end = str.find(',', pos);
+			if(end == std::string::npos){
+				end = str.size();
+			}
+			const AUTO(range, trim(str.substr(pos, end - pos)));
+			pos = end + 1;
+			if(range.empty()){
+				continue;
+			}
+			char *eptr;
+			const unsigned long first = std::strtoul(range.c_str(), &eptr, 10);
+			unsigned long last = first;
+			if(*eptr == '-'){
+				last = std::strtoul(eptr + 1, &eptr, 10);
+			}
+			if((*eptr != 0) || (first > last) || (last >= CPU_SETSIZE)){
+				return false;
+			}
+			for(unsigned long cpu = first; cpu <= last; ++cpu){
+				cpus.push_back(static_cast<unsigned>(cpu));
+			}
+		}
+		return true;
+	}
+
+	void set_thread_affinity(const char *name, std::size_t index) NOEXCEPT
+	try {
+		std::string key = "cpu_affinity_";
+		for(const char *p = name; *p; ++p){
+			key += static_cast<char>(std::tolower(static_cast<unsigned char>(*p)));
+		}
+		std::string str;
+		if(!MainConfig::get_raw(str, key.c_str()) || str.empty()){
+			return;
+		}
+		boost::container::vector<unsigned> cpus;
+		if(!parse_cpu_list(cpus, str) || cpus.empty()){
+			LOG_POSEIDON_WARNING("Invalid CPU list: ", key, " = ", str);
+			return;
+		}
+		::cpu_set_t set;
+		CPU_ZERO(&set);
+		if(MainConfig::get<bool>("cpu_affinity_per_thread", false)){
+			// 每个线程只绑定到一个 CPU 上。线程多于 CPU 时循环使用。
+			CPU_SET(cpus.at(index % cpus.size()), &set);
+		} else {
+			for(AUTO(it, cpus.begin()); it != cpus.end(); ++it){
+				CPU_SET(*it, &set);
+			}
+		}
+		const int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+		if(err != 0){
+			LOG_POSEIDON_WARNING("::pthread_setaffinity_np() failed: ", key, " = ", str, ", index = ", index, ", err = ", err);
+			return;
+		}
+		LOG_POSEIDON_DEBUG("Set CPU affinity: ", key, " = ", str, ", index = ", index);
+	} catch(std::exception &e){
+		LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+	}
+
 	void *thread_proc(void *param)
 	try {
 		boost::shared_ptr<ThreadControlBlock> tcb;
@@ -27,9 +107,16 @@ namespace {
 		// Ignore any errors.
 		Logger::set_thread_tag(tcb->tag);
 		::pthread_setname_np(::pthread_self(), tcb->name);
+		// 在执行线程函数之前绑定 CPU，这样线程函数中首次访问的内存（例如 epoll 线程的 I/O 缓冲区）
+		// 按照 Linux 默认的首次访问策略会被分配在本地 NUMA 节点上。
+		set_thread_affinity(tcb->name, tcb->index);
+
+		SamplingProfiler::register_thread();
 
 		// Do something.
 		tcb->proc();
+
+		SamplingProfiler::unregister_thread();
 		return NULLPTR;
 	} catch(...){
 		std::terminate();
@@ -37,7 +124,8 @@ namespace {
 }
 
 Thread::Thread(boost::function<void ()> proc, SharedNts tag, SharedNts name){
-	ThreadControlBlock temp = { STD_MOVE_IDN(proc), STD_MOVE(tag), STD_MOVE(name) };
+	const std::size_t index = allocate_thread_index(name);
+	ThreadControlBlock temp = { STD_MOVE_IDN(proc), STD_MOVE(tag), STD_MOVE(name), boost::shared_ptr<ThreadControlBlock>(), ::pthread_t(), index };
 	const AUTO(tcb, boost::make_shared<ThreadControlBlock>(STD_MOVE(temp)));
 	try {
 		// Create a circular reference. This prevents `*tcb` from being deleted before it is consumed by the new thread.
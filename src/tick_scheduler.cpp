@@ -0,0 +1,252 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "tick_scheduler.hpp"
+#include "singletons/timer_daemon.hpp"
+#include "job_base.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include "exception.hpp"
+#include "time.hpp"
+#include "pooled_allocator.hpp"
+#include <cmath>
+
+namespace Poseidon {
+
+class TickSubscriber : NONCOPYABLE {
+};
+
+namespace {
+	// 平均抖动是指数加权移动平均，每一帧的权重为 1/16。
+	CONSTEXPR const double JITTER_SMOOTHING = 1.0 / 16;
+
+	Mutex g_registry_mutex;
+	boost::container::vector<TickScheduler *> g_registry;
+}
+
+class TickScheduler::TickJob : public JobBase {
+private:
+	const boost::weak_ptr<TickScheduler> m_weak_scheduler;
+	const boost::uint64_t m_first_tick;
+	const boost::uint64_t m_last_tick;
+
+public:
+	TickJob(boost::weak_ptr<TickScheduler> weak_scheduler, boost::uint64_t first_tick, boost::uint64_t last_tick)
+		: m_weak_scheduler(STD_MOVE(weak_scheduler)), m_first_tick(first_tick), m_last_tick(last_tick)
+	{ }
+
+public:
+	boost::weak_ptr<const void> get_category() const OVERRIDE {
+		return m_weak_scheduler;
+	}
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
+	Priority get_priority() const OVERRIDE {
+		return PRIORITY_REALTIME;
+	}
+	void perform() OVERRIDE {
+		PROFILE_ME;
+
+		const AUTO(scheduler, m_weak_scheduler.lock());
+		if(!scheduler){
+			return;
+		}
+		scheduler->run_ticks(m_first_tick, m_last_tick);
+	}
+};
+
+TickScheduler::TickScheduler(std::string name, double period, OverrunPolicy policy, unsigned max_catch_up)
+	: m_name(STD_MOVE(name)), m_period(period), m_policy(policy), m_max_catch_up(std::max(max_catch_up, 1u))
+	, m_epoch(0), m_next_tick(0), m_last_run_tick(0), m_has_run(false), m_jobs_in_flight(0)
+{
+	DEBUG_THROW_UNLESS(m_period >= 1, Exception, sslit("Tick period must be at least one millisecond"));
+
+	std::memset(&m_stats, 0, sizeof(m_stats));
+	LOG_POSEIDON_DEBUG("Created tick scheduler: name = ", m_name, ", period = ", m_period, ", policy = ", static_cast<int>(m_policy));
+
+	const Mutex::UniqueLock lock(g_registry_mutex);
+	g_registry.push_back(this);
+}
+TickScheduler::~TickScheduler(){
+	LOG_POSEIDON_DEBUG("Destroyed tick scheduler: name = ", m_name, ", ticks_run = ", m_stats.ticks_run, ", ticks_skipped = ", m_stats.ticks_skipped);
+
+	const Mutex::UniqueLock lock(g_registry_mutex);
+	const AUTO(it, std::find(g_registry.begin(), g_registry.end(), this));
+	if(it != g_registry.end()){
+		g_registry.erase(it);
+	}
+}
+
+void TickScheduler::timer_proc(const boost::weak_ptr<TickScheduler> &weak){
+	PROFILE_ME;
+
+	const AUTO(scheduler, weak.lock());
+	if(!scheduler){
+		return;
+	}
+	boost::uint64_t first_tick, last_tick;
+	{
+		const Mutex::UniqueLock lock(scheduler->m_mutex);
+		if(!scheduler->m_timer){
+			return;
+		}
+		const AUTO(now, get_hi_res_mono_clock());
+		if(now < scheduler->m_epoch){
+			scheduler->arm_timer();
+			return;
+		}
+		last_tick = static_cast<boost::uint64_t>((now - scheduler->m_epoch) / scheduler->m_period);
+		if(last_tick < scheduler->m_next_tick){
+			// 定时器的精度是毫秒，可能在计划时刻之前的一毫秒之内触发。
+			scheduler->arm_timer();
+			return;
+		}
+		first_tick = scheduler->m_next_tick;
+		scheduler->m_next_tick = last_tick + 1;
+		scheduler->arm_timer();
+
+		const bool overrun = scheduler->m_jobs_in_flight != 0;
+		if(overrun){
+			++(scheduler->m_stats.overruns);
+		}
+		if(scheduler->m_policy == OVERRUN_SKIP){
+			if(overrun){
+				scheduler->m_stats.ticks_skipped += last_tick - first_tick + 1;
+				return;
+			}
+			scheduler->m_stats.ticks_skipped += last_tick - first_tick;
+			first_tick = last_tick;
+		} else if(last_tick - first_tick >= scheduler->m_max_catch_up){
+			// 跳过最早的帧，执行最近的 max_catch_up 帧。
+			scheduler->m_stats.ticks_skipped += last_tick - first_tick + 1 - scheduler->m_max_catch_up;
+			first_tick = last_tick + 1 - scheduler->m_max_catch_up;
+		}
+		++(scheduler->m_jobs_in_flight);
+	}
+	try {
+		Poseidon::enqueue(boost::allocate_shared<TickJob>(PooledAllocator<TickJob>(), scheduler, first_tick, last_tick));
+	} catch(...){
+		const Mutex::UniqueLock lock(scheduler->m_mutex);
+		--(scheduler->m_jobs_in_flight);
+		throw;
+	}
+}
+
+boost::uint64_t TickScheduler::get_next_due() const {
+	// 向上取整到毫秒，保证不会早于计划时刻。
+	return static_cast<boost::uint64_t>(std::ceil(m_epoch + static_cast<double>(m_next_tick) * m_period));
+}
+void TickScheduler::arm_timer(){
+	TimerDaemon::set_absolute_time(m_timer, get_next_due(), 0);
+}
+void TickScheduler::run_ticks(boost::uint64_t first_tick, boost::uint64_t last_tick){
+	PROFILE_ME;
+
+	boost::container::vector<TickCallback> callbacks;
+	for(AUTO(tick, first_tick); tick <= last_tick; ++tick){
+		const AUTO(start, get_hi_res_mono_clock());
+		double delta;
+		{
+			const Mutex::UniqueLock lock(m_mutex);
+			const AUTO(jitter, start - (m_epoch + static_cast<double>(tick) * m_period));
+			m_stats.last_jitter = jitter;
+			m_stats.average_jitter += (jitter - m_stats.average_jitter) * JITTER_SMOOTHING;
+			m_stats.max_jitter = std::max(m_stats.max_jitter, jitter);
+			delta = m_has_run ? static_cast<double>(tick - m_last_run_tick) * m_period : m_period;
+			m_last_run_tick = tick;
+			m_has_run = true;
+
+			callbacks.clear();
+			AUTO(it, m_subscriptions.begin());
+			while(it != m_subscriptions.end()){
+				if(it->weak.expired()){
+					it = m_subscriptions.erase(it);
+					continue;
+				}
+				callbacks.push_back(it->callback);
+				++it;
+			}
+		}
+		// 一个订阅者抛出的异常不应影响其他订阅者。
+		for(AUTO(it, callbacks.begin()); it != callbacks.end(); ++it){
+			try {
+				(*it)(tick, delta);
+			} catch(std::exception &e){
+				LOG_POSEIDON_WARNING("std::exception thrown in tick callback: name = ", m_name, ", what = ", e.what());
+			} catch(...){
+				LOG_POSEIDON_WARNING("Unknown exception thrown in tick callback: name = ", m_name);
+			}
+		}
+		const AUTO(duration, get_hi_res_mono_clock() - start);
+		{
+			const Mutex::UniqueLock lock(m_mutex);
+			++(m_stats.ticks_run);
+			m_stats.last_duration = duration;
+			m_stats.max_duration = std::max(m_stats.max_duration, duration);
+		}
+	}
+	const Mutex::UniqueLock lock(m_mutex);
+	--m_jobs_in_flight;
+}
+
+boost::shared_ptr<const TickSubscriber> TickScheduler::subscribe(TickCallback callback){
+	PROFILE_ME;
+
+	AUTO(subscriber, boost::make_shared<TickSubscriber>());
+	Subscription subscription = { subscriber, STD_MOVE_IDN(callback) };
+	const Mutex::UniqueLock lock(m_mutex);
+	m_subscriptions.push_back(STD_MOVE(subscription));
+	return STD_MOVE_IDN(subscriber);
+}
+
+void TickScheduler::start(){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	m_epoch = get_hi_res_mono_clock() + m_period - static_cast<double>(m_next_tick) * m_period;
+	if(!m_timer){
+		m_timer = TimerDaemon::register_low_level_absolute_timer(get_next_due(), 0, boost::bind(&timer_proc, virtual_weak_from_this<TickScheduler>()));
+	} else {
+		arm_timer();
+	}
+	LOG_POSEIDON_DEBUG("Started tick scheduler: name = ", m_name, ", next_tick = ", m_next_tick);
+}
+void TickScheduler::stop(){
+	PROFILE_ME;
+
+	boost::shared_ptr<Timer> timer;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		timer.swap(m_timer);
+	}
+	// Timer 的析构函数会锁定 TimerDaemon 的互斥锁，因此在锁外释放。
+	timer.reset();
+	LOG_POSEIDON_DEBUG("Stopped tick scheduler: name = ", m_name);
+}
+bool TickScheduler::is_running() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	return !!m_timer;
+}
+
+void TickScheduler::get_statistics(Statistics &ret) const {
+	const Mutex::UniqueLock lock(m_mutex);
+	ret = m_stats;
+}
+
+void TickScheduler::snapshot(boost::container::vector<SnapshotElement> &ret){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(g_registry_mutex);
+	ret.reserve(ret.size() + g_registry.size());
+	for(AUTO(it, g_registry.begin()); it != g_registry.end(); ++it){
+		SnapshotElement elem;
+		elem.name = (*it)->m_name;
+		elem.period = (*it)->m_period;
+		(*it)->get_statistics(elem.stats);
+		ret.push_back(STD_MOVE(elem));
+	}
+}
+
+}
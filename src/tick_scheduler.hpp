@@ -0,0 +1,124 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_TICK_SCHEDULER_HPP_
+#define POSEIDON_TICK_SCHEDULER_HPP_
+
+#include "cxx_ver.hpp"
+#include "cxx_util.hpp"
+#include "virtual_shared_from_this.hpp"
+#include "mutex.hpp"
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/vector.hpp>
+
+namespace Poseidon {
+
+class Timer;
+class TickSubscriber; // 没有定义的类，当作句柄使用。
+
+// 固定频率的逻辑帧调度器，用于 AOI、物理等需要稳定节奏的更新。
+// 第 n 帧的计划时刻是 start() 时刻加上 n 倍的周期，周期可以不是整数毫秒，因此不会因为每次触发的误差而累积漂移。
+// 每一帧投递一个 PRIORITY_REALTIME 的任务，依次调用所有订阅者，每个订阅者处理一组实体。
+// 任务不能让出（参见 JobBase::is_yieldable()），回调中不要等待 Promise。
+class TickScheduler : NONCOPYABLE, public virtual VirtualSharedFromThis {
+public:
+	// 落后超过一帧时的处理方式。
+	enum OverrunPolicy {
+		// 依次补上错过的帧，但是每次至多补 max_catch_up 帧，其余的跳过。上一帧尚未执行完时，新的帧排在它之后。
+		OVERRUN_CATCH_UP  = 0,
+		// 只执行最新的一帧，错过的帧全部跳过。上一帧尚未执行完时，这一帧也被跳过。
+		OVERRUN_SKIP      = 1,
+	};
+
+	// tick 是帧号，从零开始。delta 是距离上一次执行的帧经过的计划时间（毫秒），跳过帧时是周期的整数倍。
+	typedef boost::function<void (boost::uint64_t tick, double delta)> TickCallback;
+
+	// 时间单位都是毫秒。
+	struct Statistics {
+		boost::uint64_t ticks_run;
+		boost::uint64_t ticks_skipped;
+		// 一帧到期时上一帧的任务尚未执行完的次数。
+		boost::uint64_t overruns;
+		// 抖动是任务实际开始执行的时刻减去计划时刻。
+		double last_jitter;
+		double average_jitter;
+		double max_jitter;
+		double last_duration;
+		double max_duration;
+	};
+
+	struct SnapshotElement {
+		std::string name;
+		double period;
+		Statistics stats;
+	};
+
+private:
+	class TickJob;
+
+	struct Subscription {
+		boost::weak_ptr<TickSubscriber> weak;
+		TickCallback callback;
+	};
+
+private:
+	const std::string m_name;
+	const double m_period;
+	const OverrunPolicy m_policy;
+	const unsigned m_max_catch_up;
+
+	mutable Mutex m_mutex;
+	boost::shared_ptr<Timer> m_timer;
+	double m_epoch;
+	boost::uint64_t m_next_tick;
+	boost::uint64_t m_last_run_tick;
+	bool m_has_run;
+	std::size_t m_jobs_in_flight;
+	boost::container::vector<Subscription> m_subscriptions;
+	Statistics m_stats;
+
+public:
+	// name 用于日志和 /metrics。
+	TickScheduler(std::string name, double period, OverrunPolicy policy = OVERRUN_CATCH_UP, unsigned max_catch_up = 5);
+	~TickScheduler();
+
+private:
+	static void timer_proc(const boost::weak_ptr<TickScheduler> &weak);
+
+	// 调用时须持有 m_mutex。
+	boost::uint64_t get_next_due() const;
+	void arm_timer();
+	void run_ticks(boost::uint64_t first_tick, boost::uint64_t last_tick);
+
+public:
+	const std::string &get_name() const {
+		return m_name;
+	}
+	double get_period() const {
+		return m_period;
+	}
+	OverrunPolicy get_policy() const {
+		return m_policy;
+	}
+
+	// 返回的 shared_ptr 是该订阅的唯一持有者。同一帧中订阅者按照订阅的顺序调用。
+	boost::shared_ptr<const TickSubscriber> subscribe(TickCallback callback);
+
+	// 第 0 帧的计划时刻是调用 start() 的时刻再加一个周期。重复调用从当前时刻重新开始，帧号继续累加。
+	void start();
+	void stop();
+	bool is_running() const;
+
+	void get_statistics(Statistics &ret) const;
+
+	// 所有仍然存在的调度器，用于 /metrics。
+	static void snapshot(boost::container::vector<SnapshotElement> &ret);
+};
+
+}
+
+#endif
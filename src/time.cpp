@@ -20,6 +20,19 @@ boost::uint64_t get_utc_time(){
 	}
 	return (boost::uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
+boost::uint64_t get_coarse_utc_time() NOEXCEPT {
+	::timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+	if(::clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0){
+		return (boost::uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	}
+#endif
+	if(::clock_gettime(CLOCK_REALTIME, &ts) != 0){
+		LOG_POSEIDON_FATAL("Realtime clock is not supported.");
+		std::abort();
+	}
+	return (boost::uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
 boost::uint64_t get_local_time(){
 	return get_local_time_from_utc(get_utc_time());
 }
@@ -47,6 +60,19 @@ boost::uint64_t get_fast_mono_clock() NOEXCEPT {
 	}
 	return (boost::uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
+boost::uint64_t get_coarse_mono_clock() NOEXCEPT {
+	::timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	if(::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == 0){
+		return (boost::uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+	}
+#endif
+	if(::clock_gettime(CLOCK_MONOTONIC, &ts) != 0){
+		LOG_POSEIDON_FATAL("Monotonic clock is not supported.");
+		std::abort();
+	}
+	return (boost::uint64_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
 // 在 Windows 上 get_hi_res_mono_clock() 是 QueryPerformanceCounter() 实现的。
 double get_hi_res_mono_clock() NOEXCEPT {
 	::timespec ts;
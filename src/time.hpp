@@ -12,11 +12,15 @@ namespace Poseidon {
 // 时间单位是毫秒。
 
 extern boost::uint64_t get_utc_time();
+// 精度为一个时钟节拍（通常是 1 到 4 毫秒），读取内核缓存的时间，比 get_utc_time() 快得多。
+extern boost::uint64_t get_coarse_utc_time() NOEXCEPT;
 extern boost::uint64_t get_local_time();
 extern boost::uint64_t get_utc_time_from_local(boost::uint64_t local);
 extern boost::uint64_t get_local_time_from_utc(boost::uint64_t utc);
 
 extern boost::uint64_t get_fast_mono_clock() NOEXCEPT;
+// 精度为一个时钟节拍，适合在每个事件、每次读写中调用。计时器等需要精确时间的地方应当使用 get_fast_mono_clock()。
+extern boost::uint64_t get_coarse_mono_clock() NOEXCEPT;
 extern double get_hi_res_mono_clock() NOEXCEPT;
 
 struct DateTime {
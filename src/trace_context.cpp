@@ -0,0 +1,133 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "trace_context.hpp"
+#include "singletons/trace_exporter.hpp"
+#include "random.hpp"
+#include "log.hpp"
+#include <time.h>
+
+namespace Poseidon {
+
+namespace {
+	__thread TraceContext t_current = { 0, 0, 0, false };
+
+	boost::uint64_t generate_id() NOEXCEPT {
+		boost::uint64_t id;
+		do {
+			id = random_uint64();
+		} while(id == 0);
+		return id;
+	}
+
+	boost::uint64_t get_unix_nanos() NOEXCEPT {
+		::timespec ts;
+		::clock_gettime(CLOCK_REALTIME, &ts);
+		return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000000 + static_cast<boost::uint64_t>(ts.tv_nsec);
+	}
+
+	bool parse_hex(boost::uint64_t &ret, const char *str, std::size_t len) NOEXCEPT {
+		boost::uint64_t val = 0;
+		for(std::size_t i = 0; i < len; ++i){
+			const char ch = str[i];
+			unsigned digit;
+			if((ch >= '0') && (ch <= '9')){
+				digit = static_cast<unsigned>(ch - '0');
+			} else if((ch >= 'a') && (ch <= 'f')){
+				digit = static_cast<unsigned>(ch - 'a' + 10);
+			} else {
+				return false;
+			}
+			val = (val << 4) | digit;
+		}
+		ret = val;
+		return true;
+	}
+}
+
+const TraceContext &get_current_trace_context() NOEXCEPT {
+	return t_current;
+}
+void set_current_trace_context(const TraceContext &context) NOEXCEPT {
+	t_current = context;
+}
+
+TraceContext make_child_trace_context(const TraceContext &parent) NOEXCEPT {
+	TraceContext context;
+	if(parent.is_valid()){
+		context.trace_id_high = parent.trace_id_high;
+		context.trace_id_low = parent.trace_id_low;
+		context.sampled = parent.sampled;
+	} else {
+		context.trace_id_high = generate_id();
+		context.trace_id_low = generate_id();
+		// 与 OpenTelemetry 的 TraceIdRatioBased 相同，由 trace id 的低位决定，同一个 trace 在各处的决定是一致的。
+		context.sampled = (context.trace_id_low >> 11) < TraceExporter::get_sample_threshold();
+	}
+	context.span_id = generate_id();
+	return context;
+}
+
+std::size_t format_traceparent(char (&str)[56], const TraceContext &context) NOEXCEPT {
+	return (unsigned)::snprintf(str, sizeof(str), "00-%016llx%016llx-%016llx-%02x",
+		(unsigned long long)context.trace_id_high, (unsigned long long)context.trace_id_low, (unsigned long long)context.span_id, context.sampled ? 1u : 0u);
+}
+bool parse_traceparent(TraceContext &context, const char *str) NOEXCEPT {
+	if(std::strlen(str) < 55){
+		return false;
+	}
+	if((str[0] != '0') || (str[1] != '0') || (str[2] != '-') || (str[35] != '-') || (str[52] != '-') || ((str[55] != 0) && (str[55] != '-'))){
+		return false;
+	}
+	TraceContext temp;
+	boost::uint64_t flags;
+	if(!parse_hex(temp.trace_id_high, str + 3, 16) || !parse_hex(temp.trace_id_low, str + 19, 16) || !parse_hex(temp.span_id, str + 36, 16) || !parse_hex(flags, str + 53, 2)){
+		return false;
+	}
+	temp.sampled = flags & 1;
+	if(!temp.is_valid()){
+		return false;
+	}
+	context = temp;
+	return true;
+}
+
+TraceSpan::TraceSpan() NOEXCEPT
+	: m_parent_span_id(0), m_name(""), m_kind(KIND_INTERNAL), m_start_time(0)
+{
+	m_context.trace_id_high = 0;
+	m_context.trace_id_low = 0;
+	m_context.span_id = 0;
+	m_context.sampled = false;
+}
+TraceSpan::TraceSpan(const char *name, Kind kind) NOEXCEPT
+	: m_context(make_child_trace_context(t_current)), m_parent_span_id(t_current.span_id), m_name(name), m_kind(kind)
+	, m_start_time(m_context.sampled ? get_unix_nanos() : 0)
+{ }
+
+void TraceSpan::finish(const char *const (*attributes)[2], bool error) const {
+	if(!m_context.sampled){
+		return;
+	}
+	try {
+		TraceExporter::SpanElement span;
+		span.context = m_context;
+		span.parent_span_id = m_parent_span_id;
+		span.name = m_name;
+		span.kind = m_kind;
+		span.start_time = m_start_time;
+		span.end_time = get_unix_nanos();
+		span.error = error;
+		if(attributes){
+			for(AUTO(ptr, attributes); (*ptr)[0]; ++ptr){
+				span.attributes.push_back(std::make_pair(std::string((*ptr)[0]), std::string((*ptr)[1])));
+			}
+		}
+		TraceExporter::record(span);
+	} catch(std::exception &e){
+		LOG_POSEIDON_WARNING("std::exception thrown: what = ", e.what());
+	}
+}
+
+}
@@ -0,0 +1,93 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_TRACE_CONTEXT_HPP_
+#define POSEIDON_TRACE_CONTEXT_HPP_
+
+#include "cxx_ver.hpp"
+#include "cxx_util.hpp"
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+namespace Poseidon {
+
+// W3C Trace Context 中的 trace id 和 span id。全零表示无效。
+struct TraceContext {
+	boost::uint64_t trace_id_high;
+	boost::uint64_t trace_id_low;
+	boost::uint64_t span_id;
+	bool sampled;
+
+	bool is_valid() const NOEXCEPT {
+		return (trace_id_high | trace_id_low) && span_id;
+	}
+};
+
+// 当前线程（在 fiber 中则是当前任务）正在处理的上下文。日志中带有它的 trace id 和 span id。
+extern const TraceContext &get_current_trace_context() NOEXCEPT;
+extern void set_current_trace_context(const TraceContext &context) NOEXCEPT;
+
+// 继承 parent 的 trace id 并生成新的 span id。parent 无效时开始一个新的 trace，按照 trace_sample_rate 决定是否采样。
+extern TraceContext make_child_trace_context(const TraceContext &parent) NOEXCEPT;
+
+// 格式为 `00-<32 位 trace id>-<16 位 span id>-<2 位标志>`，共 55 个字符。
+extern std::size_t format_traceparent(char (&str)[56], const TraceContext &context) NOEXCEPT;
+extern bool parse_traceparent(TraceContext &context, const char *str) NOEXCEPT;
+
+// 在作用域内替换当前的上下文，退出时恢复。
+class TraceScope : NONCOPYABLE {
+private:
+	const TraceContext m_prev;
+
+public:
+	explicit TraceScope(const TraceContext &context) NOEXCEPT
+		: m_prev(get_current_trace_context())
+	{
+		set_current_trace_context(context);
+	}
+	~TraceScope() NOEXCEPT {
+		set_current_trace_context(m_prev);
+	}
+};
+
+// 一次异步操作对应的 span。在投递操作的线程中创建，成为当前上下文的子节点，开始计时；
+// 执行操作的线程用 TraceScope 激活 get_context()，操作完成之后调用 finish()，被采样的 span 交给 TraceExporter 导出。
+// 可以复制，但是 finish() 只应调用一次。
+class TraceSpan {
+public:
+	// 与 OpenTelemetry 的 SpanKind 相同。
+	enum Kind {
+		KIND_INTERNAL  = 1,
+		KIND_SERVER    = 2,
+		KIND_CLIENT    = 3,
+		KIND_PRODUCER  = 4,
+		KIND_CONSUMER  = 5,
+	};
+
+private:
+	TraceContext m_context;
+	boost::uint64_t m_parent_span_id;
+	const char *m_name;
+	Kind m_kind;
+	boost::uint64_t m_start_time; // UNIX 纳秒。
+
+public:
+	TraceSpan() NOEXCEPT;
+	// name 必须是字符串字面量或者其他静态存储期的字符串。
+	explicit TraceSpan(const char *name, Kind kind = KIND_INTERNAL) NOEXCEPT;
+
+public:
+	const TraceContext &get_context() const NOEXCEPT {
+		return m_context;
+	}
+	bool is_sampled() const NOEXCEPT {
+		return m_context.sampled;
+	}
+
+	// attributes 是以 { NULLPTR } 结尾的 { 属性名, 属性值 } 数组。没有被采样时什么也不做。
+	void finish(const char *const (*attributes)[2] = NULLPTR, bool error = false) const;
+};
+
+}
+
+#endif
@@ -6,11 +6,17 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
 #include <openssl/ssl.h>
 #include "singletons/epoll_daemon.hpp"
+#include "singletons/main_config.hpp"
+#include "singletons/hot_restart_daemon.hpp"
 #include "log.hpp"
 #include "system_exception.hpp"
 #include "profiler.hpp"
+#include "atomic.hpp"
+#include "exception.hpp"
 
 namespace Poseidon {
 
@@ -27,47 +33,172 @@ namespace {
 #else
 		static __thread UniqueFile udp;
 #endif
-		DEBUG_THROW_UNLESS(udp.reset(::socket(addr.get_family(), SOCK_DGRAM, IPPROTO_UDP)), SystemException);
-		static CONSTEXPR const int TRUE_VALUE = true;
-		DEBUG_THROW_UNLESS(::setsockopt(udp.get(), SOL_SOCKET, SO_REUSEADDR, &TRUE_VALUE, sizeof(TRUE_VALUE)) == 0, SystemException);
+		if(HotRestartDaemon::take_inherited_socket(udp, SOCK_DGRAM, addr)){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Inherited UDP socket from previous process: addr = ", IpPort(addr));
+			return STD_MOVE(udp);
+		}
+		if(addr.is_unix()){
+			DEBUG_THROW_UNLESS(udp.reset(::socket(AF_UNIX, SOCK_DGRAM, 0)), SystemException);
+			remove_stale_unix_socket(addr, SOCK_DGRAM);
+		} else {
+			DEBUG_THROW_UNLESS(udp.reset(::socket(addr.get_family(), SOCK_DGRAM, IPPROTO_UDP)), SystemException);
+			static CONSTEXPR const int TRUE_VALUE = true;
+			DEBUG_THROW_UNLESS(::setsockopt(udp.get(), SOL_SOCKET, SO_REUSEADDR, &TRUE_VALUE, sizeof(TRUE_VALUE)) == 0, SystemException);
+		}
 		DEBUG_THROW_UNLESS(::bind(udp.get(), static_cast<const ::sockaddr *>(addr.data()), static_cast<unsigned>(addr.size())) == 0, SystemException);
 		return STD_MOVE(udp);
 	}
+
+#ifdef UDP_SEGMENT
+	// 内核一次最多接受 64 个 GSO 分段，总长度不能超过一个 IP 数据报。
+	CONSTEXPR const std::size_t GSO_MAX_SEGMENTS = 64;
+	CONSTEXPR const std::size_t GSO_MAX_PAYLOAD = 65000;
+#endif
 }
 
 UdpServerBase::UdpServerBase(const SockAddr &addr)
 	: SocketBase(create_udp_socket(addr))
+	, m_gso_enabled(false)
+	, m_batch_size(std::max<std::size_t>(MainConfig::get<std::size_t>("udp_batch_size", 16), 1))
+	, m_max_datagram_size(std::max<std::size_t>(MainConfig::get<std::size_t>("udp_max_datagram_size", 65536), 508))
+	, m_gro_enabled(false)
+	, m_send_offset(0)
 {
+#ifdef UDP_SEGMENT
+	if(!addr.is_unix() && MainConfig::get<bool>("udp_gso_enabled", false)){
+		int value;
+		::socklen_t len = sizeof(value);
+		if(::getsockopt(get_fd(), SOL_UDP, UDP_SEGMENT, &value, &len) == 0){
+			m_gso_enabled = true;
+		} else {
+			const int err_code = errno;
+			LOG_POSEIDON_WARNING("UDP GSO is not supported: err_code = ", err_code);
+		}
+	}
+#endif
+#ifdef UDP_GRO
+	if(!addr.is_unix() && MainConfig::get<bool>("udp_gro_enabled", false)){
+		// 合并后的数据报可能接近 64KiB，接收缓冲区放不下时会被截断并丢弃。
+		static CONSTEXPR const int TRUE_VALUE = true;
+		if(m_max_datagram_size < 65536){
+			LOG_POSEIDON_WARNING("UDP GRO requires udp_max_datagram_size to be at least 65536; GRO is disabled.");
+		} else if(::setsockopt(get_fd(), SOL_UDP, UDP_GRO, &TRUE_VALUE, sizeof(TRUE_VALUE)) == 0){
+			m_gro_enabled = true;
+		} else {
+			const int err_code = errno;
+			LOG_POSEIDON_WARNING("UDP GRO is not supported: err_code = ", err_code);
+		}
+	}
+#endif
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Created UDP server on ", get_local_info());
 }
 UdpServerBase::~UdpServerBase(){
 	LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Destroyed UDP server on ", get_local_info());
+
+	// 交给了新进程的套接字文件仍然在使用。
+	const char *const path = get_local_info().ip();
+	if((path[0] == '/') && !has_been_handed_over()){
+		::unlink(path);
+	}
 }
 
 int UdpServerBase::poll_read_and_process(unsigned char *hint_buffer, std::size_t hint_capacity, bool readable){
 	PROFILE_ME;
 
+	(void)hint_buffer;
+	(void)hint_capacity;
 	(void)readable;
 
-	for(unsigned i = 0; i < 256; ++i){
-		SockAddr sock_addr;
-		StreamBuffer data;
+	if(has_been_shutdown_read()){
+		// 套接字已经交给了新进程，数据报留给它读取。
+		return EWOULDBLOCK;
+	}
+
+	DatagramVector datagrams;
+	try {
+		if(m_recv_headers.empty()){
+			// 第一次读取时分配接收缓冲区，以后一直复用。
+			m_recv_buffer.resize(m_batch_size * m_max_datagram_size);
+			m_recv_addrs.resize(m_batch_size);
+			m_recv_vecs.resize(m_batch_size);
+			if(m_gro_enabled){
+				m_recv_controls.resize(m_batch_size * CMSG_SPACE(sizeof(int)));
+			}
+			m_recv_headers.resize(m_batch_size);
+			for(std::size_t i = 0; i < m_batch_size; ++i){
+				m_recv_vecs[i].iov_base = m_recv_buffer.data() + i * m_max_datagram_size;
+				m_recv_vecs[i].iov_len = m_max_datagram_size;
+			}
+		}
+		datagrams.reserve(m_batch_size);
+	} catch(std::exception &e){
+		LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		return EINTR;
+	}
+
+	std::size_t total = 0;
+	while(total < 256){
 		try {
-			::sockaddr_storage sa;
-			::socklen_t sa_len = sizeof(sa);
-			::ssize_t result = ::recvfrom(get_fd(), hint_buffer, hint_capacity, MSG_NOSIGNAL | MSG_DONTWAIT, static_cast< ::sockaddr *>(static_cast<void *>(&sa)), &sa_len);
+			for(std::size_t i = 0; i < m_batch_size; ++i){
+				::msghdr &msg = m_recv_headers[i].msg_hdr;
+				msg.msg_name = &m_recv_addrs[i];
+				msg.msg_namelen = sizeof(m_recv_addrs[i]);
+				msg.msg_iov = &m_recv_vecs[i];
+				msg.msg_iovlen = 1;
+				if(m_gro_enabled){
+					msg.msg_control = m_recv_controls.data() + i * CMSG_SPACE(sizeof(int));
+					msg.msg_controllen = CMSG_SPACE(sizeof(int));
+				}
+				msg.msg_flags = 0;
+			}
+			const int result = ::recvmmsg(get_fd(), m_recv_headers.data(), static_cast<unsigned>(m_batch_size), MSG_DONTWAIT, NULLPTR);
 			if(result < 0){
 				return errno;
 			}
-			sock_addr = SockAddr(&sa, sa_len);
-			data.put(hint_buffer, static_cast<std::size_t>(result));
-			LOG_POSEIDON_TRACE("Read ", result, " byte(s) from ", IpPort(sock_addr));
+			total += static_cast<unsigned>(result);
+			datagrams.clear();
+			for(int i = 0; i < result; ++i){
+				const ::mmsghdr &hdr = m_recv_headers[static_cast<unsigned>(i)];
+				const SockAddr sock_addr(hdr.msg_hdr.msg_name, hdr.msg_hdr.msg_namelen);
+				if(hdr.msg_hdr.msg_flags & MSG_TRUNC){
+					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "UDP packet was truncated: remote = ", IpPort(sock_addr), ", max_datagram_size = ", m_max_datagram_size);
+					continue;
+				}
+				LOG_POSEIDON_TRACE("Read ", hdr.msg_len, " byte(s) from ", IpPort(sock_addr));
+				std::size_t segment_size = hdr.msg_len;
+#ifdef UDP_GRO
+				if(m_gro_enabled){
+					for(AUTO(cmsg, CMSG_FIRSTHDR(&hdr.msg_hdr)); cmsg; cmsg = CMSG_NXTHDR(const_cast< ::msghdr *>(&hdr.msg_hdr), cmsg)){
+						if((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)){
+							int gso_size;
+							std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+							if(gso_size > 0){
+								segment_size = static_cast<unsigned>(gso_size);
+							}
+						}
+					}
+				}
+#endif
+				// 被 GRO 合并的数据报在这里拆开，对上层来说每个数据报仍然是独立的。
+				const unsigned char *read_ptr = static_cast<const unsigned char *>(hdr.msg_hdr.msg_iov->iov_base);
+				std::size_t bytes_remaining = hdr.msg_len;
+				do {
+					const std::size_t bytes_to_copy = std::min(bytes_remaining, segment_size);
+					datagrams.emplace_back(sock_addr, StreamBuffer());
+					datagrams.back().second.put(read_ptr, bytes_to_copy);
+					read_ptr += bytes_to_copy;
+					bytes_remaining -= bytes_to_copy;
+				} while(bytes_remaining != 0);
+			}
 		} catch(std::exception &e){
 			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			return EINTR;
 		}
+		if(datagrams.empty()){
+			continue;
+		}
 		try {
-			on_receive(sock_addr, STD_MOVE(data));
+			on_receive(datagrams);
 		} catch(std::exception &e){
 			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
 			continue;
@@ -84,49 +215,173 @@ int UdpServerBase::poll_write(Mutex::UniqueLock &write_lock, unsigned char *hint
 	(void)write_lock;
 	(void)writeable;
 
-	for(unsigned i = 0; i < 256; ++i){
-		SockAddr sock_addr;
-		StreamBuffer data;
+	// 每个数据报最多使用这么多个 iovec，超过的数据报先复制到 hint_buffer 中。
+	static CONSTEXPR const std::size_t MAX_VECS_PER_DATAGRAM = 8;
+
+	boost::container::vector< ::iovec> vecs;
+	boost::container::vector<unsigned char> controls;
+	boost::container::vector< ::mmsghdr> headers;
+	std::size_t total = 0;
+	while(total < 256){
 		try {
-			const Mutex::UniqueLock lock(m_send_mutex);
-			if(m_send_queue.empty()){
-				return EWOULDBLOCK;
+			if(m_send_offset >= m_send_pending.size()){
+				m_send_pending.clear();
+				m_send_offset = 0;
+
+				const Mutex::UniqueLock lock(m_send_mutex);
+				if(m_send_queue.empty()){
+					return EWOULDBLOCK;
+				}
+				while((m_send_pending.size() < m_batch_size) && !m_send_queue.empty()){
+					m_send_pending.emplace_back(m_send_queue.front().sock_addr, m_send_queue.front().segment_size);
+					m_send_pending.back().data.swap(m_send_queue.front().data);
+					m_send_queue.pop_front();
+				}
 			}
-			sock_addr = m_send_queue.front().first;
-			data.swap(m_send_queue.front().second);
-			m_send_queue.pop_front();
-		} catch(std::exception &e){
-			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
-			return EINTR;
-		}
-		try {
-			::sockaddr_storage sa;
-			DEBUG_THROW_ASSERT(sock_addr.size() <= sizeof(sa));
-			::socklen_t sa_len = static_cast<unsigned>(sock_addr.size());
-			const std::size_t avail = data.peek(hint_buffer, hint_capacity);
-			if(avail < data.size()){
-				LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "UDP packet is too large: size = ", data.size());
-		_too_large:
-				on_message_too_large(sock_addr, STD_MOVE(data));
+
+			// 上次因为 EAGAIN 没有发完的数据报保留在 m_send_pending 中，从 m_send_offset 处继续。
+			const std::size_t count = m_send_pending.size() - m_send_offset;
+			vecs.resize(count * MAX_VECS_PER_DATAGRAM);
+			controls.resize(count * CMSG_SPACE(sizeof(boost::uint16_t)));
+			headers.resize(count);
+			bool hint_buffer_used = false;
+			std::size_t prepared = 0;
+			while(prepared < count){
+				AUTO_REF(datagram, m_send_pending[m_send_offset + prepared]);
+				::msghdr &msg = headers[prepared].msg_hdr;
+				msg = ::msghdr();
+				msg.msg_name = const_cast<void *>(datagram.sock_addr.data());
+				msg.msg_namelen = static_cast<unsigned>(datagram.sock_addr.size());
+				msg.msg_iov = vecs.data() + prepared * MAX_VECS_PER_DATAGRAM;
+#ifdef UDP_SEGMENT
+				if(datagram.segment_size != 0){
+					msg.msg_control = controls.data() + prepared * CMSG_SPACE(sizeof(boost::uint16_t));
+					msg.msg_controllen = CMSG_SPACE(sizeof(boost::uint16_t));
+					const AUTO(cmsg, CMSG_FIRSTHDR(&msg));
+					cmsg->cmsg_level = SOL_UDP;
+					cmsg->cmsg_type = UDP_SEGMENT;
+					cmsg->cmsg_len = CMSG_LEN(sizeof(boost::uint16_t));
+					const boost::uint16_t gso_size = static_cast<boost::uint16_t>(datagram.segment_size);
+					std::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+				}
+#endif
+				StreamBuffer::EnumerationCookie cookie;
+				const void *chunk_data;
+				std::size_t chunk_size;
+				while(datagram.data.enumerate_chunk(&chunk_data, &chunk_size, cookie)){
+					if(chunk_size == 0){
+						continue;
+					}
+					if(msg.msg_iovlen >= MAX_VECS_PER_DATAGRAM){
+						goto _flatten;
+					}
+					::iovec &vec = msg.msg_iov[msg.msg_iovlen++];
+					vec.iov_base = const_cast<void *>(chunk_data);
+					vec.iov_len = chunk_size;
+				}
+				++prepared;
 				continue;
+
+			_flatten:
+				if(hint_buffer_used || (datagram.data.size() > hint_capacity)){
+					// 当前批次到此为止，这个数据报留到下一批次。
+					if(prepared == 0){
+						LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "UDP packet is too large: size = ", datagram.data.size());
+						const SockAddr sock_addr = datagram.sock_addr;
+						StreamBuffer data;
+						data.swap(datagram.data);
+						++m_send_offset;
+						on_message_too_large(sock_addr, STD_MOVE(data));
+						goto _next_batch;
+					}
+					break;
+				}
+				msg.msg_iovlen = 1;
+				msg.msg_iov[0].iov_base = hint_buffer;
+				msg.msg_iov[0].iov_len = datagram.data.peek(hint_buffer, hint_capacity);
+				hint_buffer_used = true;
+				++prepared;
 			}
-			::ssize_t result = ::sendto(get_fd(), hint_buffer, avail, MSG_NOSIGNAL | MSG_DONTWAIT, static_cast< ::sockaddr *>(static_cast<void *>(&sa)), sa_len);
-			if(result < 0){
-				if(errno == EMSGSIZE){
-					LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "UDP packet is too large: size = ", data.size());
-					goto _too_large;
+
+			std::size_t sent = 0;
+			while(sent < prepared){
+				const int result = ::sendmmsg(get_fd(), headers.data() + sent, static_cast<unsigned>(prepared - sent), MSG_NOSIGNAL | MSG_DONTWAIT);
+				if(result < 0){
+					const int err_code = errno;
+					if((err_code == EWOULDBLOCK) || (err_code == EAGAIN)){
+						m_send_offset += sent;
+						return err_code;
+					}
+					AUTO_REF(datagram, m_send_pending[m_send_offset + sent]);
+					if(datagram.segment_size != 0){
+						// 网卡或者驱动不支持 GSO（典型的是 EIO），以后改为在用户态切分。
+						LOG_POSEIDON_WARNING("UDP GSO send failed; falling back to user-space segmentation: err_code = ", err_code);
+						atomic_store(m_gso_enabled, false, ATOMIC_RELAXED);
+						m_send_offset += sent;
+						split_pending_segments(m_send_offset);
+						goto _next_batch;
+					}
+					if(err_code == EMSGSIZE){
+						LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "UDP packet is too large: size = ", datagram.data.size());
+						const SockAddr sock_addr = datagram.sock_addr;
+						StreamBuffer data;
+						data.swap(datagram.data);
+						on_message_too_large(sock_addr, STD_MOVE(data));
+					} else {
+						LOG_POSEIDON_DEBUG("Failed to send UDP packet: err_code = ", err_code, ", remote = ", IpPort(datagram.sock_addr));
+					}
+					++sent;
+					continue;
 				}
-				continue;
+				for(int i = 0; i < result; ++i){
+					LOG_POSEIDON_TRACE("Wrote ", headers[sent + static_cast<unsigned>(i)].msg_len, " byte(s) to ", IpPort(m_send_pending[m_send_offset + sent + static_cast<unsigned>(i)].sock_addr));
+				}
+				sent += static_cast<unsigned>(result);
 			}
-			LOG_POSEIDON_TRACE("Wrote ", result, " byte(s) to ", IpPort(sock_addr));
+			m_send_offset += sent;
+			total += sent;
 		} catch(std::exception &e){
 			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
-			continue;
+			m_send_pending.clear();
+			m_send_offset = 0;
+			return EINTR;
 		}
+	_next_batch:
+		;
 	}
 	return 0;
 }
 
+void UdpServerBase::split_pending_segments(std::size_t index){
+	PROFILE_ME;
+
+	AUTO_REF(datagram, m_send_pending[index]);
+	const std::size_t segment_size = datagram.segment_size;
+	datagram.segment_size = 0;
+	boost::container::vector<OutgoingDatagram> segments;
+	while(datagram.data.size() > segment_size){
+		segments.emplace_back(datagram.sock_addr, 0);
+		StreamBuffer data = datagram.data.cut_off(segment_size);
+		segments.back().data.swap(data);
+	}
+	if(segments.empty()){
+		return;
+	}
+	// 最后剩下的部分留在原处，前面切出来的依次插到它前面。
+	m_send_pending.insert(m_send_pending.begin() + static_cast<std::ptrdiff_t>(index), boost::make_move_iterator(segments.begin()), boost::make_move_iterator(segments.end()));
+}
+
+void UdpServerBase::on_receive(DatagramVector &datagrams){
+	for(AUTO(it, datagrams.begin()); it != datagrams.end(); ++it){
+		try {
+			on_receive(it->first, STD_MOVE(it->second));
+		} catch(std::exception &e){
+			LOG_POSEIDON_ERROR("std::exception thrown: what = ", e.what());
+		} catch(...){
+			LOG_POSEIDON_ERROR("Unknown exception thrown.");
+		}
+	}
+}
 void UdpServerBase::on_message_too_large(const SockAddr &sock_addr, StreamBuffer data){
 	(void)sock_addr;
 	(void)data;
@@ -141,7 +396,39 @@ bool UdpServerBase::send(const SockAddr &sock_addr, StreamBuffer buffer){
 	}
 
 	const Mutex::UniqueLock lock(m_send_mutex);
-	m_send_queue.emplace_back(sock_addr, STD_MOVE(buffer));
+	m_send_queue.emplace_back(sock_addr, 0);
+	m_send_queue.back().data.swap(buffer);
+	EpollDaemon::mark_socket_writeable(this);
+	return true;
+}
+bool UdpServerBase::send_segmented(const SockAddr &sock_addr, StreamBuffer payload, std::size_t segment_size){
+	PROFILE_ME;
+	DEBUG_THROW_UNLESS(segment_size != 0, Exception, sslit("segment_size must not be zero"));
+
+	if(has_been_shutdown_write()){
+		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "UDP socket has been shut down for writing: local = ", get_local_info(), ", remote = ", IpPort(sock_addr));
+		return false;
+	}
+
+	std::size_t gso_bytes = 0;
+#ifdef UDP_SEGMENT
+	if(atomic_load(m_gso_enabled, ATOMIC_RELAXED) && (segment_size <= GSO_MAX_PAYLOAD / 2)){
+		gso_bytes = std::min(GSO_MAX_SEGMENTS, GSO_MAX_PAYLOAD / segment_size) * segment_size;
+	}
+#endif
+
+	const Mutex::UniqueLock lock(m_send_mutex);
+	while(!payload.empty()){
+		if(gso_bytes != 0){
+			m_send_queue.emplace_back(sock_addr, (payload.size() > segment_size) ? segment_size : 0);
+			StreamBuffer data = payload.cut_off(gso_bytes);
+			m_send_queue.back().data.swap(data);
+		} else {
+			m_send_queue.emplace_back(sock_addr, 0);
+			StreamBuffer data = payload.cut_off(segment_size);
+			m_send_queue.back().data.swap(data);
+		}
+	}
 	EpollDaemon::mark_socket_writeable(this);
 	return true;
 }
@@ -6,6 +6,9 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/container/deque.hpp>
+#include <boost/container/vector.hpp>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "socket_base.hpp"
 #include "sock_addr.hpp"
 #include "ip_port.hpp"
@@ -14,10 +17,40 @@
 namespace Poseidon {
 
 class UdpServerBase : public SocketBase {
+public:
+	typedef boost::container::vector<std::pair<SockAddr, StreamBuffer> > DatagramVector;
+
+private:
+	struct OutgoingDatagram {
+		SockAddr sock_addr;
+		StreamBuffer data;
+		// 非零表示这是一个由内核（UDP_SEGMENT）按此长度切分的 GSO 数据报。
+		std::size_t segment_size;
+
+		OutgoingDatagram(const SockAddr &sock_addr_, std::size_t segment_size_)
+			: sock_addr(sock_addr_), data(), segment_size(segment_size_)
+		{ }
+	};
 
 private:
 	mutable Mutex m_send_mutex;
-	mutable boost::container::deque<std::pair<SockAddr, StreamBuffer> > m_send_queue;
+	mutable boost::container::deque<OutgoingDatagram> m_send_queue;
+	volatile bool m_gso_enabled;
+
+	// 以下成员只在 epoll 线程中访问。
+	const std::size_t m_batch_size;
+	const std::size_t m_max_datagram_size;
+	bool m_gro_enabled;
+	boost::container::vector<unsigned char> m_recv_buffer;
+	boost::container::vector< ::sockaddr_storage> m_recv_addrs;
+	boost::container::vector< ::iovec> m_recv_vecs;
+	boost::container::vector<unsigned char> m_recv_controls;
+	boost::container::vector< ::mmsghdr> m_recv_headers;
+	boost::container::vector<OutgoingDatagram> m_send_pending;
+	std::size_t m_send_offset;
+
+private:
+	void split_pending_segments(std::size_t index);
 
 public:
 	explicit UdpServerBase(const SockAddr &addr);
@@ -29,6 +62,8 @@ protected:
 	int poll_write(Mutex::UniqueLock &write_lock, unsigned char *hint_buffer, std::size_t hint_capacity, bool writeable) OVERRIDE;
 
 	virtual void on_receive(const SockAddr &sock_addr, StreamBuffer data) = 0;
+	// 一次系统调用收到的所有数据报。默认实现对每个数据报调用上面的 on_receive()。
+	virtual void on_receive(DatagramVector &datagrams);
 	virtual void on_message_too_large(const SockAddr &sock_addr, StreamBuffer data);
 
 public:
@@ -49,6 +84,9 @@ public:
 	}
 
 	bool send(const SockAddr &sock_addr, StreamBuffer buffer);
+	// 把 payload 按 segment_size 切分成多个数据报发往同一个地址。
+	// 如果启用了 GSO，切分由内核或网卡完成，每个系统调用可以发送最多 64 个数据报。
+	bool send_segmented(const SockAddr &sock_addr, StreamBuffer payload, std::size_t segment_size);
 };
 
 }
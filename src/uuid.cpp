@@ -22,6 +22,48 @@ namespace {
 
 	const unsigned g_pid = static_cast<boost::uint16_t>(::getpid());
 	volatile boost::uint32_t g_auto_inc = 0;
+
+	// 每个线程每次从 g_auto_inc 中预留一块序号，UUID 中只保存序号的低 14 位。
+	// 0x4000 是块大小的倍数，因此一个块之内的序号不会回绕。
+	CONSTEXPR const boost::uint32_t SEQUENCE_BLOCK_SIZE = 256;
+
+	struct ThreadGenerator {
+		boost::uint64_t last_key; // (时间戳 << 14) | 序号，用于保证单调性。
+		boost::uint32_t seq_next;
+		boost::uint32_t seq_end;
+	};
+
+	__thread ThreadGenerator t_generator = { 0, 0, 0 };
+
+	void generate(unsigned char (&bytes)[16], ThreadGenerator &gen, boost::uint64_t utc_now) NOEXCEPT {
+		if(gen.seq_next == gen.seq_end){
+			gen.seq_end = atomic_add(g_auto_inc, SEQUENCE_BLOCK_SIZE, ATOMIC_RELAXED);
+			gen.seq_next = gen.seq_end - SEQUENCE_BLOCK_SIZE;
+		}
+		const boost::uint32_t seq = gen.seq_next++ & 0x3FFF;
+		// 时钟回拨，或者序号在同一毫秒之内回绕时，借用下一毫秒。
+		boost::uint64_t key = (std::max(utc_now, gen.last_key >> 14) << 14) | seq;
+		if(key <= gen.last_key){
+			key += 1u << 14;
+		}
+		gen.last_key = key;
+
+		const boost::uint64_t time = key >> 14;
+		const boost::uint32_t unique = (seq << 16) | g_pid;
+		const boost::uint64_t rand = random_uint64();
+		union {
+			unsigned char bytes[16];
+			boost::uint16_t u16[8];
+			boost::uint32_t u32[4];
+		} un;
+		store_be(un.u32[0], static_cast<boost::uint32_t>(time >> 12));
+		store_be(un.u16[2], static_cast<boost::uint16_t>((time << 4) | ((unique >> 26) & 0x000F)));
+		store_be(un.u16[3], static_cast<boost::uint16_t>(0xE000 | ((unique >> 14) & 0x0FFFu))); // 版本 = 14
+		store_be(un.u16[4], static_cast<boost::uint16_t>(0xC000 | (unique & 0x3FFF))); // 变种 = 3
+		store_be(un.u16[5], static_cast<boost::uint16_t>(rand >> 32));
+		store_be(un.u32[3], static_cast<boost::uint32_t>(rand));
+		std::memcpy(bytes, un.bytes, 16);
+	}
 }
 
 const Uuid &Uuid::min() NOEXCEPT {
@@ -32,20 +74,18 @@ const Uuid &Uuid::max() NOEXCEPT {
 }
 
 Uuid Uuid::random() NOEXCEPT {
-	const AUTO(utc_now, get_utc_time());
-	const AUTO(unique, (atomic_add(g_auto_inc, 1, ATOMIC_RELAXED) << 16) | g_pid);
-	union {
+	unsigned char bytes[16];
+	generate(bytes, t_generator, get_coarse_utc_time());
+	return Uuid(bytes);
+}
+void Uuid::random_n(Uuid *uuids, std::size_t count) NOEXCEPT {
+	const AUTO(utc_now, get_coarse_utc_time());
+	AUTO_REF(gen, t_generator);
+	for(std::size_t i = 0; i < count; ++i){
 		unsigned char bytes[16];
-		boost::uint16_t u16[8];
-		boost::uint32_t u32[4];
-	} un;
-	store_be(un.u32[0], static_cast<boost::uint32_t>(utc_now >> 12));
-	store_be(un.u16[2], static_cast<boost::uint16_t>((utc_now << 4) | ((unique >> 26) & 0x000F)));
-	store_be(un.u16[3], static_cast<boost::uint16_t>(0xE000 | ((unique >> 14) & 0x0FFFu))); // 版本 = 14
-	store_be(un.u16[4], static_cast<boost::uint16_t>(0xC000 | (unique & 0x3FFF))); // 变种 = 3
-	store_be(un.u16[5], static_cast<boost::uint16_t>(random_uint32()));
-	store_be(un.u32[3], static_cast<boost::uint32_t>(random_uint32()));
-	return Uuid(un.bytes);
+		generate(bytes, gen, utc_now);
+		std::memcpy(uuids[i].data(), bytes, 16);
+	}
 }
 
 Uuid::Uuid(const char (&str)[36]){
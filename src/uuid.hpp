@@ -18,7 +18,9 @@ public:
 	static const Uuid &min() NOEXCEPT;
 	static const Uuid &max() NOEXCEPT;
 
+	// 同一个线程生成的 UUID 严格递增。
 	static Uuid random() NOEXCEPT;
+	static void random_n(Uuid *uuids, std::size_t count) NOEXCEPT;
 
 private:
 	boost::array<unsigned char, 16> m_bytes;
@@ -4,8 +4,13 @@
 #ifndef POSEIDON_VINT64_HPP_
 #define POSEIDON_VINT64_HPP_
 
+#include "endian.hpp"
 #include <cstddef>
+#include <cstring>
 #include <boost/cstdint.hpp>
+#ifdef __BMI2__
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 
@@ -36,6 +41,21 @@ void vint64_to_binary(boost::int64_t val, OutputIterT &write){
 	vuint64_to_binary(encoded, write);
 }
 
+// 返回 vuint64_to_binary() 和 vint64_to_binary() 输出的字节数。
+inline std::size_t get_vuint64_size(boost::uint64_t val){
+	std::size_t size = 1;
+	while((size < 9) && (val >= 0x80)){
+		val >>= 7;
+		++size;
+	}
+	return size;
+}
+inline std::size_t get_vint64_size(boost::int64_t val){
+	boost::uint64_t encoded = static_cast<boost::uint64_t>(val);
+	encoded = (encoded << 1) ^ -(encoded >> 63);
+	return get_vuint64_size(encoded);
+}
+
 // 返回值指向编码数据的结尾。成功返回 true，出错返回 false。
 template<typename InputIterT>
 bool vuint64_from_binary(boost::uint64_t &val, InputIterT &read, std::size_t count){
@@ -69,6 +89,56 @@ bool vuint64_from_binary(boost::uint64_t &val, InputIterT &read, std::size_t cou
 	val |= static_cast<boost::uint64_t>(byte) << (8 * 7);
 	return true;
 }
+
+namespace Impl_Vint64 {
+	// 把 word 中每个字节的低 7 位按从低到高的顺序拼接起来。
+	inline boost::uint64_t gather_septets(boost::uint64_t word){
+#ifdef __BMI2__
+		return _pext_u64(word, 0x7F7F7F7F7F7F7F7Full);
+#else
+		word &= 0x7F7F7F7F7F7F7F7Full;
+		word = ((word & 0x7F007F007F007F00ull) >> 1) | (word & 0x007F007F007F007Full);
+		word = ((word & 0x3FFF00003FFF0000ull) >> 2) | (word & 0x00003FFF00003FFFull);
+		word = ((word & 0x0FFFFFFF00000000ull) >> 4) | (word & 0x000000000FFFFFFFull);
+		return word;
+#endif
+	}
+
+	// 一次读取 8 个字节，由第一个最高位为零的字节的位置直接得到长度，不逐个字节地判断。调用者保证 count >= 8。
+	inline bool decode_vuint64_word(boost::uint64_t &val, const unsigned char *&read, std::size_t count){
+		boost::uint64_t word;
+		std::memcpy(&word, read, 8);
+		word = load_le(word);
+		const boost::uint64_t stops = ~word & 0x8080808080808080ull;
+		if(stops == 0){
+			if(count < 9){
+				return false;
+			}
+			val = gather_septets(word) | (static_cast<boost::uint64_t>(read[8]) << 56);
+			read += 9;
+			return true;
+		}
+		const unsigned len = static_cast<unsigned>(__builtin_ctzll(stops)) / 8 + 1;
+		val = gather_septets(word & (~0ull >> (64 - len * 8)));
+		read += len;
+		return true;
+	}
+}
+
+// 连续的内存中剩余的数据不少于 8 个字节时使用上面的快速路径。
+inline bool vuint64_from_binary(boost::uint64_t &val, const unsigned char *&read, std::size_t count){
+	if(count >= 8){
+		return Impl_Vint64::decode_vuint64_word(val, read, count);
+	}
+	return vuint64_from_binary<const unsigned char *>(val, read, count);
+}
+inline bool vuint64_from_binary(boost::uint64_t &val, unsigned char *&read, std::size_t count){
+	const unsigned char *cread = read;
+	const bool ret = vuint64_from_binary(val, cread, count);
+	read += cread - read;
+	return ret;
+}
+
 template<typename InputIterT>
 bool vint64_from_binary(boost::int64_t &val, InputIterT &read, std::size_t count){
 	val = 0;
@@ -81,6 +151,45 @@ bool vint64_from_binary(boost::int64_t &val, InputIterT &read, std::size_t count
 	return true;
 }
 
+// 依次编码 vals 中的 n 个数。
+template<typename OutputIterT>
+void vuint64_to_binary_n(const boost::uint64_t *vals, std::size_t n, OutputIterT &write){
+	for(std::size_t i = 0; i < n; ++i){
+		vuint64_to_binary(vals[i], write);
+	}
+}
+template<typename OutputIterT>
+void vint64_to_binary_n(const boost::int64_t *vals, std::size_t n, OutputIterT &write){
+	for(std::size_t i = 0; i < n; ++i){
+		vint64_to_binary(vals[i], write);
+	}
+}
+// 依次解码最多 n 个数，返回成功解码的个数。read 指向最后一个成功解码的数的后面。
+inline std::size_t vuint64_from_binary_n(boost::uint64_t *vals, std::size_t n, const unsigned char *&read, std::size_t count){
+	const unsigned char *const end = read + count;
+	std::size_t i = 0;
+	// 剩余的数据不少于 9 个字节时每个数都一定可以从一个字中解码出来，不必检查错误。
+	while((i < n) && (end - read >= 9)){
+		Impl_Vint64::decode_vuint64_word(vals[i], read, 9);
+		++i;
+	}
+	while((i < n) && vuint64_from_binary(vals[i], read, static_cast<std::size_t>(end - read))){
+		++i;
+	}
+	return i;
+}
+inline std::size_t vint64_from_binary_n(boost::int64_t *vals, std::size_t n, const unsigned char *&read, std::size_t count){
+	const unsigned char *const end = read + count;
+	std::size_t i = 0;
+	boost::uint64_t encoded;
+	while((i < n) && vuint64_from_binary(encoded, read, static_cast<std::size_t>(end - read))){
+		encoded = (encoded >> 1) ^ -(encoded & 1);
+		vals[i] = static_cast<boost::int64_t>(encoded);
+		++i;
+	}
+	return i;
+}
+
 }
 
 #endif
@@ -0,0 +1,74 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "../precompiled.hpp"
+#include "broadcast_group.hpp"
+#include "low_level_session.hpp"
+#include "../exception.hpp"
+#include "../profiler.hpp"
+
+namespace Poseidon {
+namespace WebSocket {
+
+BroadcastGroup::BroadcastGroup(){ }
+BroadcastGroup::~BroadcastGroup(){ }
+
+std::size_t BroadcastGroup::size() const {
+	const Mutex::UniqueLock lock(m_mutex);
+	return m_members.size();
+}
+void BroadcastGroup::clear(){
+	const Mutex::UniqueLock lock(m_mutex);
+	m_members.clear();
+}
+
+bool BroadcastGroup::insert(const boost::shared_ptr<LowLevelSession> &session){
+	PROFILE_ME;
+	DEBUG_THROW_ASSERT(session);
+
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_members.begin()); it != m_members.end(); ++it){
+		if(it->lock() == session){
+			return false;
+		}
+	}
+	m_members.push_back(session);
+	return true;
+}
+bool BroadcastGroup::erase(const boost::shared_ptr<LowLevelSession> &session){
+	PROFILE_ME;
+
+	const Mutex::UniqueLock lock(m_mutex);
+	for(AUTO(it, m_members.begin()); it != m_members.end(); ++it){
+		if(it->lock() == session){
+			m_members.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+std::size_t BroadcastGroup::broadcast(OpCode opcode, StreamBuffer payload){
+	PROFILE_ME;
+
+	boost::container::vector<boost::shared_ptr<LowLevelSession> > sessions;
+	{
+		const Mutex::UniqueLock lock(m_mutex);
+		sessions.reserve(m_members.size());
+		AUTO(it, m_members.begin());
+		while(it != m_members.end()){
+			AUTO(session, it->lock());
+			if(!session){
+				it = m_members.erase(it);
+				continue;
+			}
+			sessions.push_back(STD_MOVE(session));
+			++it;
+		}
+	}
+	// 发送时不持有锁。
+	return LowLevelSession::broadcast(sessions, opcode, STD_MOVE(payload));
+}
+
+}
+}
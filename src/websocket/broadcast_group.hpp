@@ -0,0 +1,52 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_WEBSOCKET_BROADCAST_GROUP_HPP_
+#define POSEIDON_WEBSOCKET_BROADCAST_GROUP_HPP_
+
+#include "../cxx_ver.hpp"
+#include "../cxx_util.hpp"
+#include "../mutex.hpp"
+#include "../stream_buffer.hpp"
+#include "opcodes.hpp"
+#include <boost/container/vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace Poseidon {
+namespace WebSocket {
+
+class LowLevelSession;
+
+// 一组会话，例如一个聊天室或者一个房间。成员以弱指针保存，已经销毁的会话在广播时被移除。
+// 广播时帧只生成一次（需要时只压缩一次），所有成员共享同一个只读的帧，参见 LowLevelSession::broadcast()。
+// 所有成员函数都是线程安全的。
+class BroadcastGroup : NONCOPYABLE {
+private:
+	mutable Mutex m_mutex;
+	boost::container::vector<boost::weak_ptr<LowLevelSession> > m_members;
+
+public:
+	BroadcastGroup();
+	~BroadcastGroup();
+
+public:
+	std::size_t size() const;
+	bool empty() const {
+		return size() == 0;
+	}
+	void clear();
+
+	// 如果会话已经是成员，返回 false。
+	bool insert(const boost::shared_ptr<LowLevelSession> &session);
+	// 如果会话不是成员，返回 false。
+	bool erase(const boost::shared_ptr<LowLevelSession> &session);
+
+	// 返回成功排队的会话数。
+	std::size_t broadcast(OpCode opcode, StreamBuffer payload);
+};
+
+}
+}
+
+#endif
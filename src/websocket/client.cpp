@@ -10,6 +10,7 @@
 #include "../log.hpp"
 #include "../job_base.hpp"
 #include "../profiler.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
@@ -19,16 +20,26 @@ private:
 	const SocketBase::DelayedShutdownGuard m_guard;
 	const boost::weak_ptr<TcpSessionBase> m_weak_parent;
 	const boost::weak_ptr<Client> m_weak_client;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
 
 protected:
 	explicit SyncJobBase(const boost::shared_ptr<Client> &client)
 		: m_guard(boost::shared_ptr<SocketBase>(client->get_weak_parent())), m_weak_parent(client->get_weak_parent()), m_weak_client(client)
+		, m_priority(boost::shared_ptr<TcpSessionBase>(client->get_weak_parent())->get_job_priority())
+		, m_thread_hint(boost::shared_ptr<TcpSessionBase>(client->get_weak_parent())->get_epoll_thread_index())
 	{ }
 
 private:
 	boost::weak_ptr<const void> get_category() const FINAL {
 		return m_weak_parent;
 	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
+	}
 	void perform() FINAL {
 		PROFILE_ME;
 
@@ -76,6 +87,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Client> &client) OVERRIDE {
 		PROFILE_ME;
 
@@ -134,14 +148,14 @@ void Client::on_connect(){
 	LowLevelClient::on_connect();
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ConnectJob>(virtual_shared_from_this<Client>()),
+		boost::allocate_shared<ConnectJob>(PooledAllocator<ConnectJob>(), virtual_shared_from_this<Client>()),
 		VAL_INIT);
 }
 void Client::on_read_hup(){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ReadHupJob>(virtual_shared_from_this<Client>()),
+		boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Client>()),
 		VAL_INIT);
 
 	LowLevelClient::on_read_hup();
@@ -166,7 +180,7 @@ bool Client::on_low_level_message_end(boost::uint64_t whole_size){
 	(void)whole_size;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<DataMessageJob>(virtual_shared_from_this<Client>(), m_opcode, STD_MOVE(m_payload)),
+		boost::allocate_shared<DataMessageJob>(PooledAllocator<DataMessageJob>(), virtual_shared_from_this<Client>(), m_opcode, STD_MOVE(m_payload)),
 		VAL_INIT);
 
 	return true;
@@ -175,7 +189,7 @@ bool Client::on_low_level_control_message(OpCode opcode, StreamBuffer payload){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ControlMessageJob>(virtual_shared_from_this<Client>(), opcode, STD_MOVE(payload)),
+		boost::allocate_shared<ControlMessageJob>(PooledAllocator<ControlMessageJob>(), virtual_shared_from_this<Client>(), opcode, STD_MOVE(payload)),
 		VAL_INIT);
 
 	return true;
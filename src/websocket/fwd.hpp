@@ -13,9 +13,12 @@ class Reader;
 class Writer;
 class LowLevelSession;
 class Session;
+class BroadcastGroup;
 class LowLevelClient;
 class Client;
 
+struct DeflateParams;
+
 }
 }
 
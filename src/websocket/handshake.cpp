@@ -8,10 +8,140 @@
 #include "../random.hpp"
 #include "../profiler.hpp"
 #include "../base64.hpp"
+#include "../string.hpp"
+#include "../singletons/main_config.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
 
+namespace {
+	struct DeflateOffer {
+		DeflateParams params;
+		bool server_max_window_bits_set;
+		bool client_max_window_bits_set;
+	};
+
+	unsigned get_local_window_bits(){
+		const AUTO(bits, MainConfig::get<unsigned>("websocket_deflate_window_bits", 15));
+		return std::min(std::max(bits, 9u), 15u);
+	}
+
+	bool parse_window_bits(unsigned &bits, std::string str){
+		if((str.size() >= 2) && (*str.begin() == '"') && (*str.rbegin() == '"')){
+			str = str.substr(1, str.size() - 2);
+		}
+		if(str.empty()){
+			return false;
+		}
+		char *endptr;
+		const AUTO(num, std::strtoul(str.c_str(), &endptr, 10));
+		if(*endptr || (num < 8) || (num > 15)){
+			return false;
+		}
+		bits = static_cast<unsigned>(num);
+		return true;
+	}
+
+	// 解析 Sec-WebSocket-Extensions 中的一项。如果不是 permessage-deflate 或者参数无效，返回 false。
+	// 没有指定的窗口大小为 15。
+	bool parse_deflate_offer(DeflateOffer &offer, const std::string &str){
+		const AUTO(segments, explode<std::string>(';', str));
+		if(segments.empty() || (::strcasecmp(trim(segments.at(0)).c_str(), "permessage-deflate") != 0)){
+			return false;
+		}
+		offer.params.server_no_context_takeover = false;
+		offer.params.client_no_context_takeover = false;
+		offer.params.server_max_window_bits = 15;
+		offer.params.client_max_window_bits = 15;
+		offer.server_max_window_bits_set = false;
+		offer.client_max_window_bits_set = false;
+		unsigned seen = 0;
+		for(std::size_t i = 1; i < segments.size(); ++i){
+			const AUTO_REF(segment, segments.at(i));
+			const AUTO(equ, segment.find('='));
+			const AUTO(key, trim(segment.substr(0, equ)));
+			const bool has_value = equ != std::string::npos;
+			std::string value;
+			if(has_value){
+				value = trim(segment.substr(equ + 1));
+			}
+			unsigned flag;
+			if(::strcasecmp(key.c_str(), "server_no_context_takeover") == 0){
+				if(has_value){
+					return false;
+				}
+				offer.params.server_no_context_takeover = true;
+				flag = 1;
+			} else if(::strcasecmp(key.c_str(), "client_no_context_takeover") == 0){
+				if(has_value){
+					return false;
+				}
+				offer.params.client_no_context_takeover = true;
+				flag = 2;
+			} else if(::strcasecmp(key.c_str(), "server_max_window_bits") == 0){
+				if(!has_value || !parse_window_bits(offer.params.server_max_window_bits, STD_MOVE(value))){
+					return false;
+				}
+				offer.server_max_window_bits_set = true;
+				flag = 4;
+			} else if(::strcasecmp(key.c_str(), "client_max_window_bits") == 0){
+				// 在请求中这个参数可以没有值，表示客户端支持限制窗口大小。
+				if(has_value && !parse_window_bits(offer.params.client_max_window_bits, STD_MOVE(value))){
+					return false;
+				}
+				offer.client_max_window_bits_set = true;
+				flag = 8;
+			} else {
+				return false;
+			}
+			if(seen & flag){
+				return false;
+			}
+			seen |= flag;
+		}
+		return true;
+	}
+
+	// 依次检查请求中的每一项提议，接受第一个可以接受的 permessage-deflate。
+	bool accept_deflate_offer(std::string &accepted, const std::string &extensions){
+		const AUTO(local_bits, get_local_window_bits());
+		const AUTO(local_no_context_takeover, MainConfig::get<bool>("websocket_deflate_no_context_takeover", false));
+
+		const AUTO(offers, explode<std::string>(',', extensions));
+		for(AUTO(it, offers.begin()); it != offers.end(); ++it){
+			DeflateOffer offer;
+			if(!parse_deflate_offer(offer, *it)){
+				continue;
+			}
+			// zlib 无法以 8 位的窗口生成原始 deflate 数据。
+			const AUTO(server_bits, std::min(offer.params.server_max_window_bits, local_bits));
+			if(server_bits < 9){
+				continue;
+			}
+			const AUTO(client_bits, std::min(offer.params.client_max_window_bits, local_bits));
+			accepted = "permessage-deflate";
+			if(offer.params.server_no_context_takeover || local_no_context_takeover){
+				accepted += "; server_no_context_takeover";
+			}
+			if(offer.params.client_no_context_takeover){
+				accepted += "; client_no_context_takeover";
+			}
+			char str[64];
+			if(offer.server_max_window_bits_set){
+				std::sprintf(str, "; server_max_window_bits=%u", server_bits);
+				accepted += str;
+			}
+			// 请求中没有这个参数时响应中不能有这个参数。
+			if(offer.client_max_window_bits_set && (client_bits < 15)){
+				std::sprintf(str, "; client_max_window_bits=%u", client_bits);
+				accepted += str;
+			}
+			return true;
+		}
+		return false;
+	}
+}
+
 Http::ResponseHeaders make_handshake_response(const Http::RequestHeaders &request){
 	PROFILE_ME;
 
@@ -56,6 +186,13 @@ Http::ResponseHeaders make_handshake_response(const Http::RequestHeaders &reques
 		response.headers.set(sslit("Upgrade"), "websocket");
 		response.headers.set(sslit("Connection"), "Upgrade");
 		response.headers.set(sslit("Sec-WebSocket-Accept"), STD_MOVE(sec_websocket_accept));
+		if(MainConfig::get<bool>("websocket_deflate_enabled", false)){
+			std::string accepted;
+			if(accept_deflate_offer(accepted, request.headers.get("Sec-WebSocket-Extensions"))){
+				LOG_POSEIDON_DEBUG("Accepted WebSocket extension: ", accepted);
+				response.headers.set(sslit("Sec-WebSocket-Extensions"), STD_MOVE(accepted));
+			}
+		}
 		response.status_code = Http::ST_SWITCHING_PROTOCOLS;
 	}
 _done:
@@ -78,13 +215,24 @@ std::pair<Http::RequestHeaders, std::string> make_handshake_request(std::string
 	request.headers.set(sslit("Pragma"), "no-cache");
 	request.headers.set(sslit("Cache-Control"), "no-cache");
 	boost::uint32_t key[4];
-	for(unsigned i = 0; i < 4; ++i){
-		key[i] = random_uint32();
-	}
+	secure_random_fill(key, sizeof(key));
 	Base64Encoder enc;
 	enc.put(key, sizeof(key));
 	AUTO(sec_websocket_key, enc.finalize().dump_string());
 	request.headers.set(sslit("Sec-WebSocket-Key"), sec_websocket_key);
+	if(MainConfig::get<bool>("websocket_deflate_enabled", false)){
+		std::string offer = "permessage-deflate; client_max_window_bits";
+		const AUTO(local_bits, get_local_window_bits());
+		if(local_bits < 15){
+			char str[64];
+			std::sprintf(str, "; server_max_window_bits=%u", local_bits);
+			offer += str;
+		}
+		if(MainConfig::get<bool>("websocket_deflate_no_context_takeover", false)){
+			offer += "; client_no_context_takeover";
+		}
+		request.headers.set(sslit("Sec-WebSocket-Extensions"), STD_MOVE(offer));
+	}
 	return std::make_pair(STD_MOVE_IDN(request), STD_MOVE_IDN(sec_websocket_key));
 }
 bool check_handshake_response(const Http::ResponseHeaders &response, const std::string &sec_websocket_key){
@@ -123,8 +271,32 @@ bool check_handshake_response(const Http::ResponseHeaders &response, const std::
 		LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Bad Sec-WebSocket-Accept: got ", sec_websocket_accept, ", expecting ", sec_websocket_accept_expecting);
 		return false;
 	}
+	const AUTO_REF(sec_websocket_extensions, response.headers.get("Sec-WebSocket-Extensions"));
+	if(!sec_websocket_extensions.empty()){
+		// 我们只会提出 permessage-deflate。
+		DeflateOffer offer;
+		if(!MainConfig::get<bool>("websocket_deflate_enabled", false) || !parse_deflate_offer(offer, sec_websocket_extensions)){
+			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_DEBUG, "Unexpected Sec-WebSocket-Extensions: ", sec_websocket_extensions);
+			return false;
+		}
+	}
 	return true;
 }
 
+bool get_deflate_params(DeflateParams &params, const Http::ResponseHeaders &response){
+	PROFILE_ME;
+
+	const AUTO(extensions, explode<std::string>(',', response.headers.get("Sec-WebSocket-Extensions")));
+	for(AUTO(it, extensions.begin()); it != extensions.end(); ++it){
+		DeflateOffer offer;
+		if(!parse_deflate_offer(offer, *it)){
+			continue;
+		}
+		params = offer.params;
+		return true;
+	}
+	return false;
+}
+
 }
 }
@@ -10,11 +10,24 @@
 namespace Poseidon {
 namespace WebSocket {
 
+// RFC 7692 permessage-deflate 扩展的协商结果。窗口大小是以 2 为底的对数。
+struct DeflateParams {
+	bool server_no_context_takeover;
+	bool client_no_context_takeover;
+	unsigned server_max_window_bits;
+	unsigned client_max_window_bits;
+};
+
+// 如果配置文件中启用了 websocket_deflate_enabled，服务端在响应中接受请求提出的 permessage-deflate，客户端在请求中提出 permessage-deflate。
 extern Http::ResponseHeaders make_handshake_response(const Http::RequestHeaders &request);
 
 extern std::pair<Http::RequestHeaders, std::string> make_handshake_request(std::string uri, OptionalMap get_params, std::string host);
 extern bool check_handshake_response(const Http::ResponseHeaders &response, const std::string &sec_websocket_key);
 
+// 从握手响应中取得协商的 permessage-deflate 参数，用于 LowLevelSession::enable_deflate() 或 LowLevelClient::enable_deflate()。
+// 如果没有协商 permessage-deflate，返回 false。
+extern bool get_deflate_params(DeflateParams &params, const Http::ResponseHeaders &response);
+
 }
 }
 
@@ -4,9 +4,11 @@
 #include "../precompiled.hpp"
 #include "low_level_client.hpp"
 #include "exception.hpp"
+#include "handshake.hpp"
 #include "../http/low_level_client.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
+#include "../singletons/main_config.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
@@ -65,6 +67,17 @@ long LowLevelClient::on_encoded_data_avail(StreamBuffer encoded){
 	return UpgradedSessionBase::send(STD_MOVE(encoded));
 }
 
+void LowLevelClient::enable_deflate(const DeflateParams &params){
+	PROFILE_ME;
+
+	const AUTO(level, MainConfig::get<int>("websocket_deflate_level", 6));
+	const AUTO(min_size, MainConfig::get<std::size_t>("websocket_deflate_min_size", 256));
+	const AUTO(local_bits, MainConfig::get<unsigned>("websocket_deflate_window_bits", 15));
+	const AUTO(local_no_context_takeover, MainConfig::get<bool>("websocket_deflate_no_context_takeover", false));
+	Writer::enable_deflation(std::min(params.client_max_window_bits, local_bits), level, params.client_no_context_takeover || local_no_context_takeover, min_size);
+	Reader::enable_inflation(params.server_max_window_bits, params.server_no_context_takeover);
+}
+
 bool LowLevelClient::send(OpCode opcode, StreamBuffer payload, bool masked){
 	PROFILE_ME;
 
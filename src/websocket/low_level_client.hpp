@@ -6,6 +6,7 @@
 
 #include "../http/upgraded_session_base.hpp"
 #include "../mutex.hpp"
+#include "fwd.hpp"
 #include "opcodes.hpp"
 #include "status_codes.hpp"
 #include "reader.hpp"
@@ -51,6 +52,9 @@ public:
 		return shutdown(ST_NORMAL_CLOSURE);
 	}
 
+	// 使用握手时协商的 permessage-deflate 参数，参见 get_deflate_params()。应当在收发第一条消息之前调用。
+	void enable_deflate(const DeflateParams &params);
+
 	virtual bool send(OpCode opcode, StreamBuffer payload, bool masked = true);
 	virtual bool shutdown(StatusCode status_code, const char *reason = "") NOEXCEPT;
 };
@@ -4,9 +4,11 @@
 #include "../precompiled.hpp"
 #include "low_level_session.hpp"
 #include "exception.hpp"
+#include "handshake.hpp"
 #include "../http/low_level_session.hpp"
 #include "../log.hpp"
 #include "../profiler.hpp"
+#include "../singletons/main_config.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
@@ -56,6 +58,20 @@ bool LowLevelSession::on_data_message_end(boost::uint64_t whole_size){
 bool LowLevelSession::on_control_message(OpCode opcode, StreamBuffer payload){
 	PROFILE_ME;
 
+	// PING 和 CLOSE 直接在 epoll 线程中应答，不在任务队列中排队，否则繁忙时心跳会超时。
+	switch(opcode){
+	case OP_PING:
+		LOG_POSEIDON_TRACE("Answering ping frame: payload_size = ", payload.size());
+		Writer::put_message(OP_PONG, false, payload);
+		break;
+	case OP_CLOSE:
+		LOG_POSEIDON_DEBUG("Received close frame: payload_size = ", payload.size());
+		on_low_level_control_message(opcode, STD_MOVE(payload));
+		shutdown(ST_NORMAL_CLOSURE, "");
+		return false;
+	default:
+		break;
+	}
 	return on_low_level_control_message(opcode, STD_MOVE(payload));
 }
 
@@ -65,12 +81,71 @@ long LowLevelSession::on_encoded_data_avail(StreamBuffer encoded){
 	return UpgradedSessionBase::send(STD_MOVE(encoded));
 }
 
+void LowLevelSession::enable_deflate(const DeflateParams &params){
+	PROFILE_ME;
+
+	const AUTO(level, MainConfig::get<int>("websocket_deflate_level", 6));
+	const AUTO(min_size, MainConfig::get<std::size_t>("websocket_deflate_min_size", 256));
+	const AUTO(local_bits, MainConfig::get<unsigned>("websocket_deflate_window_bits", 15));
+	const AUTO(local_no_context_takeover, MainConfig::get<bool>("websocket_deflate_no_context_takeover", false));
+	Writer::enable_deflation(std::min(params.server_max_window_bits, local_bits), level, params.server_no_context_takeover || local_no_context_takeover, min_size);
+	Reader::enable_inflation(params.client_max_window_bits, params.client_no_context_takeover);
+}
+
 bool LowLevelSession::send(OpCode opcode, StreamBuffer payload, bool masked){
 	PROFILE_ME;
 
 	return Writer::put_message(opcode, masked, STD_MOVE(payload));
 }
 
+std::size_t LowLevelSession::broadcast(const boost::container::vector<boost::shared_ptr<LowLevelSession> > &sessions, OpCode opcode, StreamBuffer payload){
+	PROFILE_ME;
+
+	const AUTO(opcode_ch, boost::numeric_cast<unsigned>(opcode));
+	// 不同的会话可能协商了不同的窗口大小，压缩时使用其中最小的一个。
+	int window_bits = 0;
+	int level = 0;
+	boost::container::vector<bool> deflated;
+	deflated.reserve(sessions.size());
+	for(AUTO(it, sessions.begin()); it != sessions.end(); ++it){
+		const AUTO_REF(session, *it);
+		int session_window_bits, session_level;
+		const bool shared = session && ((opcode_ch & OP_FL_CONTROL) == 0) && session->get_shared_deflation(session_window_bits, session_level, payload.size());
+		if(shared){
+			window_bits = (window_bits == 0) ? session_window_bits : std::min(window_bits, session_window_bits);
+			level = session_level;
+		}
+		deflated.push_back(shared);
+	}
+
+	boost::shared_ptr<const StreamBuffer> deflated_frame, plain_frame;
+	std::size_t count = 0;
+	for(std::size_t i = 0; i < sessions.size(); ++i){
+		const AUTO_REF(session, sessions.at(i));
+		if(!session){
+			continue;
+		}
+		const AUTO(parent, session->get_parent());
+		if(!parent){
+			continue;
+		}
+		AUTO_REF(frame, deflated.at(i) ? deflated_frame : plain_frame);
+		if(!frame){
+			AUTO(encoded, boost::make_shared<StreamBuffer>());
+			if(deflated.at(i)){
+				*encoded = deflate_message(payload, window_bits, level);
+				encode_frame(*encoded, opcode_ch | OP_FL_RSV1, false);
+			} else {
+				*encoded = payload;
+				encode_frame(*encoded, opcode_ch, false);
+			}
+			frame = STD_MOVE_IDN(encoded);
+		}
+		count += parent->send_shared(frame);
+	}
+	return count;
+}
+
 bool LowLevelSession::shutdown(StatusCode status_code, const char *reason) NOEXCEPT
 try {
 	PROFILE_ME;
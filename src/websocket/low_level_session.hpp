@@ -5,10 +5,12 @@
 #define POSEIDON_WEBSOCKET_LOW_LEVEL_SESSION_HPP_
 
 #include "../http/upgraded_session_base.hpp"
+#include "fwd.hpp"
 #include "opcodes.hpp"
 #include "status_codes.hpp"
 #include "reader.hpp"
 #include "writer.hpp"
+#include <boost/container/vector.hpp>
 
 namespace Poseidon {
 namespace WebSocket {
@@ -40,11 +42,19 @@ protected:
 	virtual void on_low_level_message_payload(boost::uint64_t whole_offset, StreamBuffer payload) = 0;
 	virtual bool on_low_level_message_end(boost::uint64_t whole_size) = 0;
 
+	// 在 epoll 线程中调用。PING 和 CLOSE 在调用之前已经应答，这里只是通知。
 	virtual bool on_low_level_control_message(OpCode opcode, StreamBuffer payload) = 0;
 
 public:
+	// 使用握手时协商的 permessage-deflate 参数，参见 get_deflate_params()。应当在收发第一条消息之前调用。
+	void enable_deflate(const DeflateParams &params);
+
 	virtual bool send(OpCode opcode, StreamBuffer payload, bool masked = false);
 	virtual bool shutdown(StatusCode status_code, const char *reason = "") NOEXCEPT;
+
+	// 把同一条数据消息发送给多个会话。帧只生成一次，所有会话共享同一个只读的帧，参见 TcpSessionBase::send_shared()。
+	// 不保留压缩上下文的会话共享一个压缩之后的帧，其余的会话共享一个不压缩的帧。返回成功排队的会话数。
+	static std::size_t broadcast(const boost::container::vector<boost::shared_ptr<LowLevelSession> > &sessions, OpCode opcode, StreamBuffer payload);
 };
 
 }
@@ -9,14 +9,110 @@
 #include "../endian.hpp"
 #include "../profiler.hpp"
 #include "../flags.hpp"
+#include "../zlib.hpp"
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
 
 namespace Poseidon {
 namespace WebSocket {
 
+namespace {
+	// 每次交给解压器的输入长度。Deflate 的压缩比不超过约 1032:1，所以每段的输出不超过约 1 MiB。
+	const std::size_t g_inflation_slice_size = 1024;
+
+	// UTF-8 校验的状态：低 8 位是还需要的后续字节数，其上依次是下一个字节允许的最小值和最大值。
+	// 状态为零表示位于字符边界上。
+	CONSTEXPR boost::uint32_t make_utf8_state(unsigned remaining, unsigned min, unsigned max){
+		return remaining | (min << 8) | (max << 16);
+	}
+
+	// 返回第一个非 ASCII 字节的位置，没有则返回 end。
+	const unsigned char *skip_ascii(const unsigned char *begin, const unsigned char *end) NOEXCEPT {
+		const unsigned char *p = begin;
+#ifdef __AVX2__
+		for(; end - p >= 32; p += 32){
+			const unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))));
+			if(bits != 0){
+				return p + __builtin_ctz(bits);
+			}
+		}
+#endif
+#ifdef __SSE2__
+		for(; end - p >= 16; p += 16){
+			const unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))));
+			if(bits != 0){
+				return p + __builtin_ctz(bits);
+			}
+		}
+#endif
+		for(; end - p >= 8; p += 8){
+			boost::uint64_t word;
+			std::memcpy(&word, p, 8);
+			if((word & 0x8080808080808080ull) != 0){
+				break;
+			}
+		}
+		while((p != end) && (*p < 0x80)){
+			++p;
+		}
+		return p;
+	}
+
+	// 字符可以在任意位置被截断，剩余的部分在下一次调用时继续校验。遇到无效的序列返回 false。
+	bool validate_utf8(boost::uint32_t &state, const unsigned char *begin, const unsigned char *end) NOEXCEPT {
+		boost::uint32_t s = state;
+		const unsigned char *p = begin;
+		while(p != end){
+			if(s == 0){
+				p = skip_ascii(p, end);
+				if(p == end){
+					break;
+				}
+				// 排除过长的编码、代理对和超过 U+10FFFF 的码点（RFC 3629 4）。
+				const unsigned lead = *(p++);
+				if(lead < 0xC2){
+					return false;
+				} else if(lead < 0xE0){
+					s = make_utf8_state(1, 0x80, 0xBF);
+				} else if(lead == 0xE0){
+					s = make_utf8_state(2, 0xA0, 0xBF);
+				} else if(lead == 0xED){
+					s = make_utf8_state(2, 0x80, 0x9F);
+				} else if(lead < 0xF0){
+					s = make_utf8_state(2, 0x80, 0xBF);
+				} else if(lead == 0xF0){
+					s = make_utf8_state(3, 0x90, 0xBF);
+				} else if(lead < 0xF4){
+					s = make_utf8_state(3, 0x80, 0xBF);
+				} else if(lead == 0xF4){
+					s = make_utf8_state(3, 0x80, 0x8F);
+				} else {
+					return false;
+				}
+				continue;
+			}
+			const unsigned trailing = *(p++);
+			if((trailing < ((s >> 8) & 0xFF)) || (trailing > (s >> 16))){
+				return false;
+			}
+			const unsigned remaining = (s & 0xFF) - 1;
+			s = (remaining == 0) ? 0 : make_utf8_state(remaining, 0x80, 0xBF);
+		}
+		state = s;
+		return true;
+	}
+}
+
 Reader::Reader(bool force_masked_frames)
 	: m_force_masked_frames(force_masked_frames)
 	, m_size_expecting(1), m_state(S_OPCODE)
 	, m_whole_offset(0), m_prev_fin(true)
+	, m_inflator_no_context_takeover(false), m_compressed(false)
+	, m_text(false), m_utf8_state(0)
 { }
 Reader::~Reader(){
 	if(m_state != S_OPCODE){
@@ -24,6 +120,135 @@ Reader::~Reader(){
 	}
 }
 
+void Reader::decode_opcode(int ch){
+	DEBUG_THROW_UNLESS(has_none_flags_of(ch, OP_FL_RSV2 | OP_FL_RSV3), Exception, ST_PROTOCOL_ERROR, sslit("Reserved bits set"));
+	m_opcode = ch & OP_FL_OPCODE;
+	m_fin = ch & OP_FL_FIN;
+	DEBUG_THROW_UNLESS(!((m_opcode & OP_FL_CONTROL) && !m_fin), Exception, ST_PROTOCOL_ERROR, sslit("Control frame fragemented"));
+	DEBUG_THROW_UNLESS(!((m_opcode == OP_CONTINUATION) && m_prev_fin), Exception, ST_PROTOCOL_ERROR, sslit("Dangling frame continuation"));
+	DEBUG_THROW_UNLESS(!((m_opcode != OP_CONTINUATION) && !m_prev_fin), Exception, ST_PROTOCOL_ERROR, sslit("Final frame following a frame that needs continuation"));
+	// RSV1 只能出现在数据消息的第一帧中（RFC 7692 6.1）。
+	const bool compressed = has_any_flags_of(ch, OP_FL_RSV1);
+	if(compressed){
+		DEBUG_THROW_UNLESS(m_inflator && (m_opcode != OP_CONTINUATION) && !(m_opcode & OP_FL_CONTROL), Exception, ST_PROTOCOL_ERROR, sslit("Reserved bits set"));
+	}
+	if(m_opcode != OP_CONTINUATION){
+		m_compressed = compressed;
+	}
+	if((m_opcode != OP_CONTINUATION) && !(m_opcode & OP_FL_CONTROL)){
+		m_text = m_opcode == OP_DATA_TEXT;
+		m_utf8_state = 0;
+	}
+}
+void Reader::decode_frame_size(int ch){
+	m_masked = ch & 0x80;
+	DEBUG_THROW_UNLESS(!(m_force_masked_frames && !m_masked), Exception, ST_PROTOCOL_ERROR, sslit("Non-masked frames not allowed"));
+	m_frame_size = ch & 0x7F;
+	if(m_frame_size >= 0x7E){
+		DEBUG_THROW_UNLESS(has_none_flags_of(m_opcode, OP_FL_CONTROL), Exception, ST_PROTOCOL_ERROR, sslit("Control frame too large"));
+	}
+}
+bool Reader::decode_header_at_once(){
+	// 如果整个帧头都已经收到，就一次解析完毕，避免逐个状态地读取。
+	StreamBuffer::ReadCursor cursor(m_queue);
+	const int opcode_ch = cursor.get();
+	const int size_ch = cursor.get();
+	if(size_ch < 0){
+		return false;
+	}
+	std::size_t size_len = 0;
+	if((size_ch & 0x7F) == 0x7E){
+		size_len = 2;
+	} else if((size_ch & 0x7F) == 0x7F){
+		size_len = 8;
+	}
+	const std::size_t mask_len = (size_ch & 0x80) ? 4 : 0;
+	if(cursor.get_remaining() < size_len + mask_len){
+		return false;
+	}
+
+	decode_opcode(opcode_ch);
+	decode_frame_size(size_ch);
+	if(size_len == 2){
+		boost::uint16_t temp16;
+		cursor.get_be(temp16);
+		m_frame_size = temp16;
+	} else if(size_len == 8){
+		boost::uint64_t temp64;
+		cursor.get_be(temp64);
+		m_frame_size = temp64;
+	}
+	LOG_POSEIDON_DEBUG("Frame size = ", m_frame_size);
+	if(m_masked){
+		boost::uint32_t temp32;
+		cursor.get_le(temp32);
+		m_mask = temp32;
+	}
+	m_queue.discard(cursor.get_offset());
+	return true;
+}
+StreamBuffer Reader::unmask_payload(boost::uint64_t size){
+	AUTO(payload, m_queue.cut_off(boost::numeric_cast<std::size_t>(size)));
+	if(m_mask != 0){
+		payload.xor_mask(m_mask);
+	}
+	return payload;
+}
+void Reader::check_utf8(const StreamBuffer &payload){
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(payload.enumerate_chunk(&data, &size, cookie)){
+		const AUTO(begin, static_cast<const unsigned char *>(data));
+		DEBUG_THROW_UNLESS(validate_utf8(m_utf8_state, begin, begin + size), Exception, ST_INCONSISTENT, sslit("Invalid UTF-8 sequence in text message"));
+	}
+}
+void Reader::check_inflated_size(boost::uint64_t size) const {
+	const AUTO(max_size, get_max_inflated_size());
+	DEBUG_THROW_UNLESS((m_whole_offset <= max_size) && (size <= max_size - m_whole_offset), Exception, ST_MESSAGE_TOO_LARGE, sslit("Message too large"));
+}
+StreamBuffer Reader::inflate_payload(const StreamBuffer &payload){
+	m_inflator->put(payload);
+	StreamBuffer inflated;
+	inflated.swap(m_inflator->get_buffer());
+	check_inflated_size(inflated.size());
+	return inflated;
+}
+StreamBuffer Reader::inflate_tail(){
+	// 发送方去掉了每条消息末尾的 00 00 FF FF，在这里补上（RFC 7692 7.2.2）。
+	static const unsigned char s_tail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+	m_inflator->put(s_tail, sizeof(s_tail));
+	m_inflator->flush();
+	StreamBuffer inflated;
+	inflated.swap(m_inflator->get_buffer());
+	if(m_inflator_no_context_takeover){
+		m_inflator->clear();
+	}
+	check_inflated_size(inflated.size());
+	return inflated;
+}
+void Reader::deliver_payload(StreamBuffer payload){
+	if(m_text){
+		check_utf8(payload);
+	}
+	const AUTO(payload_size, payload.size());
+	on_data_message_payload(m_whole_offset, STD_MOVE(payload));
+	m_whole_offset += payload_size;
+}
+
+boost::uint64_t Reader::get_max_inflated_size() const {
+	return UINT64_MAX;
+}
+
+void Reader::enable_inflation(unsigned window_bits, bool no_context_takeover){
+	PROFILE_ME;
+
+	// 较大的窗口总是可以解压较小的窗口生成的数据。
+	const int bits = static_cast<int>(std::min(std::max(window_bits, 9u), 15u));
+	m_inflator.reset(new Inflator(false, -bits));
+	m_inflator_no_context_takeover = no_context_takeover;
+}
+
 bool Reader::put_encoded_data(StreamBuffer encoded){
 	PROFILE_ME;
 
@@ -49,13 +274,14 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 			m_mask = 0;
 			m_frame_offset = 0;
 
+			if(decode_header_at_once()){
+				m_size_expecting = 0;
+				m_state = S_HEADER_END;
+				break;
+			}
+
 			ch = m_queue.get();
-			DEBUG_THROW_UNLESS(has_none_flags_of(ch, OP_FL_RSV1 | OP_FL_RSV2 | OP_FL_RSV3), Exception, ST_PROTOCOL_ERROR, sslit("Reserved bits set"));
-			m_opcode = ch & OP_FL_OPCODE;
-			m_fin = ch & OP_FL_FIN;
-			DEBUG_THROW_UNLESS(!((m_opcode & OP_FL_CONTROL) && !m_fin), Exception, ST_PROTOCOL_ERROR, sslit("Control frame fragemented"));
-			DEBUG_THROW_UNLESS(!((m_opcode == OP_CONTINUATION) && m_prev_fin), Exception, ST_PROTOCOL_ERROR, sslit("Dangling frame continuation"));
-			DEBUG_THROW_UNLESS(!((m_opcode != OP_CONTINUATION) && !m_prev_fin), Exception, ST_PROTOCOL_ERROR, sslit("Final frame following a frame that needs continuation"));
+			decode_opcode(ch);
 
 			m_size_expecting = 1;
 			m_state = S_FRAME_SIZE;
@@ -63,11 +289,8 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 
 		case S_FRAME_SIZE:
 			ch = m_queue.get();
-			m_masked = ch & 0x80;
-			DEBUG_THROW_UNLESS(!(m_force_masked_frames && !m_masked), Exception, ST_PROTOCOL_ERROR, sslit("Non-masked frames not allowed"));
-			m_frame_size = ch & 0x7F;
+			decode_frame_size(ch);
 			if(m_frame_size >= 0x7E){
-				DEBUG_THROW_UNLESS(has_none_flags_of(m_opcode, OP_FL_CONTROL), Exception, ST_PROTOCOL_ERROR, sslit("Control frame too large"));
 				if(m_frame_size == 0x7E){
 					m_size_expecting = 2;
 					m_state = S_FRAME_SIZE_16;
@@ -131,24 +354,35 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 			}
 			break;
 
-		case S_DATA_FRAME:
+		case S_DATA_FRAME: {
 			temp64 = std::min<boost::uint64_t>(m_queue.size(), m_frame_size - m_frame_offset);
-			{
-				StreamBuffer payload;
-				for(std::size_t i = 0; i < temp64; ++i){
-					payload.put(m_queue.get() ^ (int)m_mask);
-					m_mask = (m_mask << 24) | (m_mask >> 8);
+			AUTO(payload, unmask_payload(temp64));
+			m_frame_offset += temp64;
+			if(m_compressed){
+				// 逐段解压并交付，不要一次解压整块数据。
+				while(!payload.empty()){
+					AUTO(inflated, inflate_payload(payload.cut_off(g_inflation_slice_size)));
+					if(!inflated.empty()){
+						deliver_payload(STD_MOVE(inflated));
+					}
 				}
-				on_data_message_payload(m_whole_offset, STD_MOVE(payload));
+			} else {
+				deliver_payload(STD_MOVE(payload));
 			}
-			m_frame_offset += temp64;
-			m_whole_offset += temp64;
 
 			if(m_frame_offset < m_frame_size){
 				m_size_expecting = std::min<boost::uint64_t>(m_frame_size - m_frame_offset, 4096);
 				// m_state = S_DATA_FRAME;
 			} else {
 				if(m_fin){
+					if(m_compressed){
+						AUTO(tail, inflate_tail());
+						if(!tail.empty()){
+							deliver_payload(STD_MOVE(tail));
+						}
+						m_compressed = false;
+					}
+					DEBUG_THROW_UNLESS(m_utf8_state == 0, Exception, ST_INCONSISTENT, sslit("Truncated UTF-8 sequence in text message"));
 					has_next_request = on_data_message_end(m_whole_offset);
 					m_whole_offset = 0;
 					m_prev_fin = true;
@@ -159,17 +393,10 @@ bool Reader::put_encoded_data(StreamBuffer encoded){
 				m_size_expecting = 1;
 				m_state = S_OPCODE;
 			}
-			break;
+			break; }
 
 		case S_CONTROL_FRAME:
-			{
-				StreamBuffer payload;
-				for(std::size_t i = 0; i < m_frame_size; ++i){
-					payload.put(m_queue.get() ^ (int)m_mask);
-					m_mask = (m_mask << 24) | (m_mask >> 8);
-				}
-				has_next_request = on_control_message(m_opcode, STD_MOVE(payload));
-			}
+			has_next_request = on_control_message(m_opcode, unmask_payload(m_frame_size));
 			m_frame_offset = m_frame_size;
 			m_whole_offset = 0;
 			m_prev_fin = true;
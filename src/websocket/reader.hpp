@@ -6,6 +6,8 @@
 
 #include <string>
 #include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "../fwd.hpp"
 #include "../stream_buffer.hpp"
 #include "opcodes.hpp"
 
@@ -44,18 +46,43 @@ private:
 	boost::uint32_t m_mask;
 	boost::uint64_t m_frame_offset;
 
+	// permessage-deflate。当前消息的第一帧设置了 RSV1 时 m_compressed 为 true。
+	boost::scoped_ptr<Inflator> m_inflator;
+	bool m_inflator_no_context_takeover;
+	bool m_compressed;
+
+	// 文本消息在解压之后逐块校验 UTF-8，字符可以跨越帧和数据块。
+	bool m_text;
+	boost::uint32_t m_utf8_state;
+
 public:
 	explicit Reader(bool force_masked_frames);
 	virtual ~Reader();
 
+private:
+	void decode_opcode(int ch);
+	void decode_frame_size(int ch);
+	bool decode_header_at_once();
+	StreamBuffer unmask_payload(boost::uint64_t size);
+	void check_utf8(const StreamBuffer &payload);
+	void check_inflated_size(boost::uint64_t size) const;
+	StreamBuffer inflate_payload(const StreamBuffer &payload);
+	StreamBuffer inflate_tail();
+	void deliver_payload(StreamBuffer payload);
+
 protected:
 	virtual void on_data_message_header(OpCode opcode) = 0;
 	virtual void on_data_message_payload(boost::uint64_t whole_offset, StreamBuffer payload) = 0;
+	// 压缩的消息在解压之后交给 on_data_message_payload()，whole_offset 和 whole_size 都是解压之后的大小。
 	// 以下两个回调返回 false 导致于当前消息终止后退出循环。
 	virtual bool on_data_message_end(boost::uint64_t whole_size) = 0;
 
 	virtual bool on_control_message(OpCode opcode, StreamBuffer payload) = 0;
 
+	// 压缩的数据消息解压之后的长度上限，超过时抛出 ST_MESSAGE_TOO_LARGE。默认不限制。
+	// 输入被切成小段逐段解压，每段的输出在交付之前检查，因此压缩炸弹不会在检查之前耗尽内存。
+	virtual boost::uint64_t get_max_inflated_size() const;
+
 public:
 	const StreamBuffer &get_queue() const {
 		return m_queue;
@@ -64,6 +91,9 @@ public:
 		return m_queue;
 	}
 
+	// 允许对端发送 permessage-deflate 压缩的消息。window_bits 是对端压缩所用的窗口大小。
+	void enable_inflation(unsigned window_bits, bool no_context_takeover);
+
 	bool put_encoded_data(StreamBuffer encoded);
 };
 
@@ -8,30 +8,49 @@
 #include "../optional_map.hpp"
 #include "../singletons/main_config.hpp"
 #include "../singletons/job_dispatcher.hpp"
+#include "../singletons/epoll_daemon.hpp"
 #include "../log.hpp"
 #include "../job_base.hpp"
 #include "../profiler.hpp"
 #include "../time.hpp"
 #include "../atomic.hpp"
+#include "../pooled_allocator.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
 
+namespace {
+	ConfigValue<boost::uint64_t> g_keep_alive_timeout("websocket_keep_alive_timeout", 30000);
+	ConfigValue<boost::uint64_t> g_max_request_length("websocket_max_request_length", 16384);
+	ConfigValue<boost::uint64_t> g_stream_max_pending("websocket_stream_max_pending", 1048576);
+	ConfigValue<bool> g_cork_jobs("websocket_cork_jobs", true);
+}
+
 class Session::SyncJobBase : public JobBase {
 private:
 	const SocketBase::DelayedShutdownGuard m_guard;
 	const boost::weak_ptr<TcpSessionBase> m_weak_parent;
 	const boost::weak_ptr<Session> m_weak_session;
+	const JobBase::Priority m_priority;
+	const std::size_t m_thread_hint;
 
 protected:
 	explicit SyncJobBase(const boost::shared_ptr<Session> &session)
 		: m_guard(boost::shared_ptr<SocketBase>(session->get_weak_parent())), m_weak_parent(session->get_weak_parent()), m_weak_session(session)
+		, m_priority(boost::shared_ptr<TcpSessionBase>(session->get_weak_parent())->get_job_priority())
+		, m_thread_hint(boost::shared_ptr<TcpSessionBase>(session->get_weak_parent())->get_epoll_thread_index())
 	{ }
 
 private:
 	boost::weak_ptr<const void> get_category() const FINAL {
 		return m_weak_parent;
 	}
+	Priority get_priority() const FINAL {
+		return m_priority;
+	}
+	std::size_t get_thread_hint() const FINAL {
+		return m_thread_hint;
+	}
 	void perform() FINAL {
 		PROFILE_ME;
 
@@ -40,6 +59,11 @@ private:
 			return;
 		}
 
+		// 同一个任务中发送的消息合并起来，在任务结束时一次性写入父连接的套接字。
+		const AUTO(corked_parent, g_cork_jobs.get() ? session->get_parent() : boost::shared_ptr<TcpSessionBase>());
+		if(corked_parent){
+			corked_parent->cork_send();
+		}
 		try {
 			really_perform(session);
 		} catch(Exception &e){
@@ -52,6 +76,9 @@ private:
 			LOG_POSEIDON(Logger::SP_MAJOR | Logger::LV_INFO, "Unknown exception thrown.");
 			session->force_shutdown();
 		}
+		if(corked_parent){
+			corked_parent->uncork_send();
+		}
 	}
 
 protected:
@@ -65,6 +92,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
@@ -79,6 +109,9 @@ public:
 	{ }
 
 protected:
+	bool is_yieldable() const OVERRIDE {
+		return false;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
@@ -101,13 +134,16 @@ public:
 	{ }
 
 protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
 		LOG_POSEIDON_DEBUG("Dispatching data message: opcode = ", m_opcode, ", payload_size = ", m_payload.size());
 		session->on_sync_data_message(m_opcode, STD_MOVE(m_payload));
 
-		const AUTO(keep_alive_timeout, MainConfig::get<boost::uint64_t>("websocket_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
 		session->set_timeout(keep_alive_timeout);
 	}
 };
@@ -124,42 +160,152 @@ public:
 	{ }
 
 protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
 	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
 		PROFILE_ME;
 
 		LOG_POSEIDON_DEBUG("Dispatching control message: opcode = ", m_opcode, ", payload_size = ", m_payload.size());
 		session->on_sync_control_message(m_opcode, STD_MOVE(m_payload));
 
-		const AUTO(keep_alive_timeout, MainConfig::get<boost::uint64_t>("websocket_keep_alive_timeout", 30000));
+		const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
+		session->set_timeout(keep_alive_timeout);
+	}
+};
+
+class Session::StreamBeginJob : public Session::SyncJobBase {
+private:
+	OpCode m_opcode;
+
+public:
+	StreamBeginJob(const boost::shared_ptr<Session> &session, OpCode opcode)
+		: SyncJobBase(session)
+		, m_opcode(opcode)
+	{ }
+
+protected:
+	bool is_rejectable() const OVERRIDE {
+		return true;
+	}
+	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
+		PROFILE_ME;
+
+		LOG_POSEIDON_DEBUG("Dispatching data message stream begin: opcode = ", m_opcode);
+		session->on_sync_data_message_stream_begin(m_opcode);
+	}
+};
+
+class Session::StreamChunkJob : public Session::SyncJobBase {
+private:
+	boost::uint64_t m_whole_offset;
+	StreamBuffer m_chunk;
+
+public:
+	StreamChunkJob(const boost::shared_ptr<Session> &session, boost::uint64_t whole_offset, StreamBuffer chunk)
+		: SyncJobBase(session)
+		, m_whole_offset(whole_offset), m_chunk(STD_MOVE(chunk))
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
+		PROFILE_ME;
+
+		const std::size_t size = m_chunk.size();
+		session->on_sync_data_message_stream_chunk(m_whole_offset, STD_MOVE(m_chunk));
+		session->release_stream_pending(size);
+	}
+};
+
+class Session::StreamEndJob : public Session::SyncJobBase {
+private:
+	boost::uint64_t m_whole_size;
+
+public:
+	StreamEndJob(const boost::shared_ptr<Session> &session, boost::uint64_t whole_size)
+		: SyncJobBase(session)
+		, m_whole_size(whole_size)
+	{ }
+
+protected:
+	void really_perform(const boost::shared_ptr<Session> &session) OVERRIDE {
+		PROFILE_ME;
+
+		LOG_POSEIDON_DEBUG("Dispatching data message stream end: whole_size = ", m_whole_size);
+		session->on_sync_data_message_stream_end(m_whole_size);
+
+		const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
 		session->set_timeout(keep_alive_timeout);
 	}
 };
 
 Session::Session(const boost::shared_ptr<Http::LowLevelSession> &parent)
 	: LowLevelSession(parent)
-	, m_max_request_length(MainConfig::get<boost::uint64_t>("websocket_max_request_length", 16384))
+	, m_max_request_length(g_max_request_length.get())
 	, m_size_total(0), m_opcode(OP_INVALID)
+	, m_streaming(false), m_stream_offset(0)
+	, m_max_stream_pending(g_stream_max_pending.get()), m_stream_pending(0)
 { }
 Session::~Session(){ }
 
+void Session::flush_stream_chunk(){
+	PROFILE_ME;
+
+	if(m_payload.empty()){
+		return;
+	}
+	const std::size_t size = m_payload.size();
+	atomic_add(m_stream_pending, size, ATOMIC_RELAXED);
+	const bool queued = JobDispatcher::enqueue(
+		boost::allocate_shared<StreamChunkJob>(PooledAllocator<StreamChunkJob>(), virtual_shared_from_this<Session>(), m_stream_offset, STD_MOVE(m_payload)),
+		VAL_INIT);
+	DEBUG_THROW_UNLESS(queued, Exception, ST_TRY_AGAIN_LATER, sslit("Server is busy"));
+	m_stream_offset += size;
+	m_payload.clear();
+}
+void Session::release_stream_pending(std::size_t size){
+	PROFILE_ME;
+
+	const AUTO(old_pending, atomic_sub(m_stream_pending, size, ATOMIC_RELAXED) + size);
+	if((old_pending >= m_max_stream_pending) && (old_pending - size < m_max_stream_pending)){
+		const AUTO(parent, get_parent());
+		if(parent){
+			EpollDaemon::mark_socket_readable(parent.get());
+		}
+	}
+}
+
 void Session::on_read_hup(){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<ReadHupJob>(virtual_shared_from_this<Session>()),
+		boost::allocate_shared<ReadHupJob>(PooledAllocator<ReadHupJob>(), virtual_shared_from_this<Session>()),
 		VAL_INIT);
 
 	LowLevelSession::on_read_hup();
 }
+void Session::on_receive(StreamBuffer data){
+	PROFILE_ME;
+
+	LowLevelSession::on_receive(STD_MOVE(data));
+
+	// 一次读取的数据合并为一块，避免为每一帧或者每 4 KiB 创建一个任务。
+	if(m_streaming){
+		flush_stream_chunk();
+	}
+}
 void Session::on_shutdown_timer(boost::uint64_t now){
 	PROFILE_ME;
 
 	JobDispatcher::enqueue(
-		boost::make_shared<PingJob>(virtual_shared_from_this<Session>()),
+		boost::allocate_shared<PingJob>(PooledAllocator<PingJob>(), virtual_shared_from_this<Session>()),
 		VAL_INIT);
 
 	LowLevelSession::on_shutdown_timer(now);
 }
+bool Session::is_read_throttled() const {
+	return atomic_load(m_stream_pending, ATOMIC_RELAXED) >= m_max_stream_pending;
+}
 
 void Session::on_low_level_message_header(OpCode opcode){
 	PROFILE_ME;
@@ -167,12 +313,26 @@ void Session::on_low_level_message_header(OpCode opcode){
 	m_size_total = 0;
 	m_opcode = opcode;
 	m_payload.clear();
+
+	m_streaming = is_message_streamed(opcode);
+	if(m_streaming){
+		m_stream_offset = 0;
+		const bool queued = JobDispatcher::enqueue(
+			boost::allocate_shared<StreamBeginJob>(PooledAllocator<StreamBeginJob>(), virtual_shared_from_this<Session>(), opcode),
+			VAL_INIT);
+		DEBUG_THROW_UNLESS(queued, Exception, ST_TRY_AGAIN_LATER, sslit("Server is busy"));
+	}
 }
 void Session::on_low_level_message_payload(boost::uint64_t whole_offset, StreamBuffer payload){
 	PROFILE_ME;
 
 	(void)whole_offset;
 
+	if(m_streaming){
+		m_payload.splice(payload);
+		return;
+	}
+
 	m_size_total += payload.size();
 	DEBUG_THROW_UNLESS(m_size_total <= get_max_request_length(), Exception, ST_MESSAGE_TOO_LARGE, sslit("Message too large"));
 	m_payload.splice(payload);
@@ -180,20 +340,46 @@ void Session::on_low_level_message_payload(boost::uint64_t whole_offset, StreamB
 bool Session::on_low_level_message_end(boost::uint64_t whole_size){
 	PROFILE_ME;
 
-	(void)whole_size;
+	if(m_streaming){
+		flush_stream_chunk();
+		m_streaming = false;
+		const bool queued = JobDispatcher::enqueue(
+			boost::allocate_shared<StreamEndJob>(PooledAllocator<StreamEndJob>(), virtual_shared_from_this<Session>(), whole_size),
+			VAL_INIT);
+		if(!queued){
+			shutdown(ST_TRY_AGAIN_LATER, "Server is busy");
+			return false;
+		}
+		return true;
+	}
 
-	JobDispatcher::enqueue(
-		boost::make_shared<DataMessageJob>(virtual_shared_from_this<Session>(), m_opcode, STD_MOVE(m_payload)),
+	const bool queued = JobDispatcher::enqueue(
+		boost::allocate_shared<DataMessageJob>(PooledAllocator<DataMessageJob>(), virtual_shared_from_this<Session>(), m_opcode, STD_MOVE(m_payload)),
 		VAL_INIT);
+	if(!queued){
+		// 任务队列已满。
+		shutdown(ST_TRY_AGAIN_LATER, "Server is busy");
+		return false;
+	}
 
 	return true;
 }
 bool Session::on_low_level_control_message(OpCode opcode, StreamBuffer payload){
 	PROFILE_ME;
 
-	JobDispatcher::enqueue(
-		boost::make_shared<ControlMessageJob>(virtual_shared_from_this<Session>(), opcode, STD_MOVE(payload)),
+	const AUTO(keep_alive_timeout, g_keep_alive_timeout.get());
+	set_timeout(keep_alive_timeout);
+
+	if((opcode == OP_CLOSE) || !is_control_message_dispatched(opcode)){
+		return true;
+	}
+	const bool queued = JobDispatcher::enqueue(
+		boost::allocate_shared<ControlMessageJob>(PooledAllocator<ControlMessageJob>(), virtual_shared_from_this<Session>(), opcode, STD_MOVE(payload)),
 		VAL_INIT);
+	if(!queued){
+		shutdown(ST_TRY_AGAIN_LATER, "Server is busy");
+		return false;
+	}
 
 	return true;
 }
@@ -208,13 +394,8 @@ void Session::on_sync_control_message(OpCode opcode, StreamBuffer payload){
 	}
 
 	switch(opcode){
-	case OP_CLOSE:
-		LOG_POSEIDON_INFO("Received close frame from ", parent->get_remote_info());
-		shutdown(ST_NORMAL_CLOSURE, "");
-		break;
 	case OP_PING:
 		LOG_POSEIDON_DEBUG("Received ping frame from ", parent->get_remote_info());
-		send(OP_PONG, STD_MOVE(payload));
 		break;
 	case OP_PONG:
 		LOG_POSEIDON_DEBUG("Received pong frame from ", parent->get_remote_info());
@@ -222,6 +403,47 @@ void Session::on_sync_control_message(OpCode opcode, StreamBuffer payload){
 	default:
 		DEBUG_THROW(Exception, ST_PROTOCOL_ERROR, sslit("Invalid opcode"));
 	}
+	(void)payload;
+}
+
+bool Session::is_control_message_dispatched(OpCode opcode){
+	PROFILE_ME;
+
+	(void)opcode;
+
+	return true;
+}
+
+bool Session::is_message_streamed(OpCode opcode){
+	PROFILE_ME;
+
+	(void)opcode;
+
+	return false;
+}
+void Session::on_sync_data_message_stream_begin(OpCode opcode){
+	PROFILE_ME;
+
+	(void)opcode;
+}
+void Session::on_sync_data_message_stream_chunk(boost::uint64_t whole_offset, StreamBuffer chunk){
+	PROFILE_ME;
+
+	(void)whole_offset;
+	(void)chunk;
+}
+void Session::on_sync_data_message_stream_end(boost::uint64_t whole_size){
+	PROFILE_ME;
+
+	(void)whole_size;
+}
+
+boost::uint64_t Session::get_max_inflated_size() const {
+	// 流式接收的消息不检查总长度，但仍然逐段解压，每次交付的数据有限。
+	if(m_streaming){
+		return UINT64_MAX;
+	}
+	return get_max_request_length();
 }
 
 boost::uint64_t Session::get_max_request_length() const {
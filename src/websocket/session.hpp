@@ -16,6 +16,9 @@ private:
 	class PingJob;
 	class DataMessageJob;
 	class ControlMessageJob;
+	class StreamBeginJob;
+	class StreamChunkJob;
+	class StreamEndJob;
 
 private:
 	volatile boost::uint64_t m_max_request_length;
@@ -23,6 +26,11 @@ private:
 	OpCode m_opcode;
 	StreamBuffer m_payload;
 
+	bool m_streaming;
+	boost::uint64_t m_stream_offset; // m_payload 中第一个字节在整条消息中的偏移量。
+	const boost::uint64_t m_max_stream_pending;
+	volatile boost::uint64_t m_stream_pending; // 已经收到但是还没有处理的流式消息的字节数。
+
 public:
 	explicit Session(const boost::shared_ptr<Http::LowLevelSession> &parent);
 	~Session();
@@ -38,9 +46,16 @@ protected:
 		return m_payload;
 	}
 
+private:
+	void flush_stream_chunk();
+	void release_stream_pending(std::size_t size);
+
+protected:
 	// UpgradedSessionBase
 	void on_read_hup() OVERRIDE;
+	void on_receive(StreamBuffer data) OVERRIDE;
 	void on_shutdown_timer(boost::uint64_t now) OVERRIDE;
+	bool is_read_throttled() const OVERRIDE;
 
 	// LowLevelSession
 	void on_low_level_message_header(OpCode opcode) OVERRIDE;
@@ -49,9 +64,24 @@ protected:
 
 	bool on_low_level_control_message(OpCode opcode, StreamBuffer payload) OVERRIDE;
 
+	// Reader
+	boost::uint64_t get_max_inflated_size() const OVERRIDE;
+
 	// 可覆写。
 	virtual void on_sync_data_message(OpCode opcode, StreamBuffer payload) = 0;
+	// PING 和 CLOSE 已经在 epoll 线程中应答过了，这里只是通知。收到 CLOSE 之后连接随即关闭，不会分派 CLOSE。
+	// is_control_message_dispatched() 在 epoll 线程中调用，返回 false 则这个控制帧不会分派，省去一个任务。
 	virtual void on_sync_control_message(OpCode opcode, StreamBuffer payload);
+	virtual bool is_control_message_dispatched(OpCode opcode);
+
+	// 流式接收数据消息。在 epoll 线程中调用，返回 true 则这条消息不会保存在内存中，
+	// 而是依次调用 on_sync_data_message_stream_begin()、若干次 on_sync_data_message_stream_chunk()、最后调用 on_sync_data_message_stream_end()。
+	// 每次从连接上读取的数据合并为一块交付。此时不检查 websocket_max_request_length，长度限制由派生类自行负责。
+	// 这些函数都在以连接为类别的任务中按顺序调用。尚未处理的数据超过 websocket_stream_max_pending 时暂停读取这个连接。
+	virtual bool is_message_streamed(OpCode opcode);
+	virtual void on_sync_data_message_stream_begin(OpCode opcode);
+	virtual void on_sync_data_message_stream_chunk(boost::uint64_t whole_offset, StreamBuffer chunk);
+	virtual void on_sync_data_message_stream_end(boost::uint64_t whole_size);
 
 public:
 	boost::uint64_t get_max_request_length() const;
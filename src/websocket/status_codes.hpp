@@ -23,6 +23,7 @@ namespace StatusCodes {
 		ST_MESSAGE_TOO_LARGE    = 1009,
 		ST_EXTENSION_NOT_AVAIL  = 1010,
 		ST_INTERNAL_ERROR       = 1011,
+		ST_TRY_AGAIN_LATER      = 1013,
 		ST_RESERVED_TLS         = 1015,
 	};
 }
@@ -8,53 +8,119 @@
 #include "../profiler.hpp"
 #include "../endian.hpp"
 #include "../random.hpp"
+#include "../zlib.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
 
-Writer::Writer(){ }
+namespace {
+	StreamBuffer deflate_payload(Deflator &deflator, const StreamBuffer &payload){
+		deflator.put(payload);
+		deflator.flush();
+		StreamBuffer compressed;
+		compressed.swap(deflator.get_buffer());
+		// 去掉 Z_SYNC_FLUSH 生成的末尾的 00 00 FF FF（RFC 7692 7.2.1）。
+		for(unsigned i = 0; i < 4; ++i){
+			compressed.unput();
+		}
+		return compressed;
+	}
+}
+
+Writer::Writer()
+	: m_deflate_window_bits(0), m_deflate_level(0), m_deflate_no_context_takeover(false), m_deflate_min_size(0)
+{ }
 Writer::~Writer(){ }
 
-long Writer::put_message(int opcode, bool masked, StreamBuffer payload){
+void Writer::encode_frame(StreamBuffer &payload, unsigned opcode_ch, bool masked){
 	PROFILE_ME;
 
-	StreamBuffer frame;
-	unsigned ch = boost::numeric_cast<unsigned>(opcode) | OP_FL_FIN;
-	frame.put(ch & 0xFF);
+	// 帧头最多 14 字节，在栈上生成之后插入到载荷前面，载荷本身不复制。
+	unsigned char header[14];
+	std::size_t header_len = 0;
+	header[header_len++] = static_cast<unsigned char>(opcode_ch | OP_FL_FIN);
 	const std::size_t size = payload.size();
-	ch = masked ? 0x80 : 0;
+	const unsigned masked_bit = masked ? 0x80 : 0;
 	if(size < 0x7E){
-		ch |= static_cast<unsigned>(size);
-		frame.put(ch & 0xFF);
+		header[header_len++] = static_cast<unsigned char>(masked_bit | size);
 	} else if(size < 0x10000){
-		ch |= 0x7E;
-		frame.put(ch & 0xFF);
+		header[header_len++] = static_cast<unsigned char>(masked_bit | 0x7E);
 		boost::uint16_t temp16;
 		store_be(temp16, static_cast<boost::uint16_t>(size));
-		frame.put(&temp16, 2);
+		std::memcpy(header + header_len, &temp16, 2);
+		header_len += 2;
 	} else {
-		ch |= 0x7F;
-		frame.put(ch & 0xFF);
+		header[header_len++] = static_cast<unsigned char>(masked_bit | 0x7F);
 		boost::uint64_t temp64;
 		store_be(temp64, size);
-		frame.put(&temp64, 8);
+		std::memcpy(header + header_len, &temp64, 8);
+		header_len += 8;
 	}
 	if(masked){
+		// 掩码原地按字（或者 SIMD 寄存器）异或到载荷的每一个数据块上，共享的数据块才会被复制。
 		boost::uint32_t mask = random_uint32() | 0x80808080;
-		frame.put(&mask, 4);
-		for(;;){
-			int mb = payload.get();
-			if(mb == -1){
-				break;
+		std::memcpy(header + header_len, &mask, 4);
+		header_len += 4;
+		payload.xor_mask(mask);
+	}
+	payload.unget(header, header_len);
+}
+StreamBuffer Writer::deflate_message(const StreamBuffer &payload, int window_bits, int level){
+	PROFILE_ME;
+
+	// zlib 的状态在 Deflator 析构时放回线程局部的池中，这里不需要另外缓存。
+	Deflator deflator(false, level, -window_bits);
+	return deflate_payload(deflator, payload);
+}
+
+void Writer::enable_deflation(unsigned window_bits, int level, bool no_context_takeover, std::size_t min_size){
+	PROFILE_ME;
+
+	// zlib 无法以 8 位的窗口生成原始 deflate 数据。
+	const int bits = static_cast<int>(std::min(std::max(window_bits, 9u), 15u));
+	const Mutex::UniqueLock lock(m_deflator_mutex);
+	if(no_context_takeover){
+		m_deflator.reset();
+	} else {
+		m_deflator.reset(new Deflator(false, level, -bits));
+	}
+	m_deflate_window_bits = bits;
+	m_deflate_level = level;
+	m_deflate_no_context_takeover = no_context_takeover;
+	m_deflate_min_size = min_size;
+}
+bool Writer::get_shared_deflation(int &window_bits, int &level, std::size_t size) const {
+	const Mutex::UniqueLock lock(m_deflator_mutex);
+	if((m_deflate_window_bits == 0) || !m_deflate_no_context_takeover || (size < m_deflate_min_size)){
+		return false;
+	}
+	window_bits = m_deflate_window_bits;
+	level = m_deflate_level;
+	return true;
+}
+
+long Writer::put_message(int opcode, bool masked, StreamBuffer payload){
+	PROFILE_ME;
+
+	const AUTO(opcode_ch, boost::numeric_cast<unsigned>(opcode));
+	if((opcode_ch & OP_FL_CONTROL) == 0){
+		Mutex::UniqueLock lock(m_deflator_mutex);
+		if((m_deflate_window_bits != 0) && (payload.size() >= m_deflate_min_size)){
+			if(m_deflate_no_context_takeover){
+				const int window_bits = m_deflate_window_bits;
+				const int level = m_deflate_level;
+				lock.unlock();
+				payload = deflate_message(payload, window_bits, level);
+				encode_frame(payload, opcode_ch | OP_FL_RSV1, masked);
+				return on_encoded_data_avail(STD_MOVE(payload));
 			}
-			mb ^= (int)mask;
-			frame.put(mb);
-			mask = (mask << 24) | (mask >> 8);
+			payload = deflate_payload(*m_deflator, payload);
+			encode_frame(payload, opcode_ch | OP_FL_RSV1, masked);
+			return on_encoded_data_avail(STD_MOVE(payload));
 		}
-	} else {
-		frame.splice(payload);
 	}
-	return on_encoded_data_avail(STD_MOVE(frame));
+	encode_frame(payload, opcode_ch, masked);
+	return on_encoded_data_avail(STD_MOVE(payload));
 }
 long Writer::put_close_message(StatusCode status_code, bool masked, StreamBuffer addition){
 	PROFILE_ME;
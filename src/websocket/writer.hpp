@@ -6,13 +6,27 @@
 
 #include <string>
 #include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
 #include "status_codes.hpp"
+#include "../fwd.hpp"
 #include "../stream_buffer.hpp"
+#include "../mutex.hpp"
 
 namespace Poseidon {
 namespace WebSocket {
 
 class Writer {
+private:
+	// permessage-deflate。m_deflate_window_bits 为 0 表示不压缩。
+	// 保留上下文时每个连接使用自己的压缩器，压缩和发送必须按照相同的顺序进行，因此整个过程都要加锁。
+	// 不保留上下文时压缩器从一个共享的池中借用，连接本身不保留滑动窗口。
+	mutable Mutex m_deflator_mutex;
+	boost::scoped_ptr<Deflator> m_deflator;
+	int m_deflate_window_bits;
+	int m_deflate_level;
+	bool m_deflate_no_context_takeover;
+	std::size_t m_deflate_min_size;
+
 public:
 	Writer();
 	virtual ~Writer();
@@ -21,6 +35,18 @@ protected:
 	virtual long on_encoded_data_avail(StreamBuffer encoded) = 0;
 
 public:
+	// 把 payload 就地封装成一个完整的帧。opcode_ch 可以包含 OP_FL_RSV1。
+	static void encode_frame(StreamBuffer &payload, unsigned opcode_ch, bool masked);
+	// 从共享的池中借用一个压缩器压缩一条消息。结果可以发送给任何不保留压缩上下文的连接。
+	static StreamBuffer deflate_message(const StreamBuffer &payload, int window_bits, int level);
+
+	// 使用 permessage-deflate 压缩数据消息。window_bits 是本端压缩所用的窗口大小。
+	// 短于 min_size 字节的消息不压缩。
+	void enable_deflation(unsigned window_bits, int level, bool no_context_takeover, std::size_t min_size);
+	// 如果这个连接不保留压缩上下文并且 size 字节的消息需要压缩，返回 true 并给出压缩所用的参数。
+	// 此时可以把 deflate_message() 的结果发送给这个连接，例如广播。
+	bool get_shared_deflation(int &window_bits, int &level, std::size_t size) const;
+
 	long put_message(int opcode, bool masked, StreamBuffer payload);
 	long put_close_message(StatusCode status_code, bool masked, StreamBuffer addition);
 };
@@ -8,26 +8,113 @@
 
 namespace Poseidon {
 
-Deflator::Deflator(bool gzip, int level){
-	m_stream.zalloc = NULLPTR;
-	m_stream.zfree = NULLPTR;
-	m_stream.opaque = NULLPTR;
-	m_stream.next_in = NULLPTR;
-	m_stream.avail_in = 0;
-	int err_code = ::deflateInit2(&m_stream, level, Z_DEFLATED, 15 + gzip * 16, 9, Z_DEFAULT_STRATEGY);
-	DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::deflateInit2()"));
+struct ZlibContext {
+	ZlibContext *next;
+	bool inflating;
+	int window_bits;
+	int level;
+	::z_stream stream;
+};
+
+namespace {
+	// 每个线程至多保留这么多个空闲的上下文，超出的直接释放。
+	CONSTEXPR const std::size_t MAX_POOLED_CONTEXTS = 4;
+
+	__thread ZlibContext *t_pool;
+	__thread std::size_t t_pool_size;
+
+	::pthread_once_t g_pool_key_once = PTHREAD_ONCE_INIT;
+	::pthread_key_t g_pool_key;
+
+	int make_window_bits(bool gzip, int window_bits){
+		if(window_bits < 0){
+			return window_bits;
+		}
+		return window_bits + gzip * 16;
+	}
+
+	void destroy_context(ZlibContext *context) NOEXCEPT {
+		const int err_code = context->inflating ? ::inflateEnd(&(context->stream)) : ::deflateEnd(&(context->stream));
+		if(err_code < 0){
+			LOG_POSEIDON_WARNING("::inflateEnd() or ::deflateEnd() error: err_code = ", err_code);
+		}
+		delete context;
+	}
+
+	void free_pool(void *) NOEXCEPT {
+		while(t_pool){
+			const AUTO(context, t_pool);
+			t_pool = context->next;
+			destroy_context(context);
+		}
+		t_pool_size = 0;
+	}
+	void create_pool_key() NOEXCEPT {
+		if(::pthread_key_create(&g_pool_key, &free_pool) != 0){
+			std::abort();
+		}
+	}
+
+	ZlibContext *acquire_context(bool inflating, int window_bits, int level){
+		for(AUTO(link, &t_pool); *link; link = &((*link)->next)){
+			const AUTO(context, *link);
+			if((context->inflating != inflating) || (context->window_bits != window_bits) || (context->level != level)){
+				continue;
+			}
+			*link = context->next;
+			--t_pool_size;
+			return context;
+		}
+		const AUTO(context, new ZlibContext);
+		context->next = NULLPTR;
+		context->inflating = inflating;
+		context->window_bits = window_bits;
+		context->level = level;
+		context->stream.zalloc = NULLPTR;
+		context->stream.zfree = NULLPTR;
+		context->stream.opaque = NULLPTR;
+		context->stream.next_in = NULLPTR;
+		context->stream.avail_in = 0;
+		int err_code;
+		if(inflating){
+			err_code = ::inflateInit2(&(context->stream), window_bits);
+		} else {
+			err_code = ::deflateInit2(&(context->stream), level, Z_DEFLATED, window_bits, 9, Z_DEFAULT_STRATEGY);
+		}
+		if(err_code < 0){
+			delete context;
+			DEBUG_THROW(Exception, sslit(inflating ? "::inflateInit2()" : "::deflateInit2()"));
+		}
+		return context;
+	}
+	void release_context(ZlibContext *context) NOEXCEPT {
+		const int err_code = context->inflating ? ::inflateReset(&(context->stream)) : ::deflateReset(&(context->stream));
+		if((err_code < 0) || (t_pool_size >= MAX_POOLED_CONTEXTS)){
+			destroy_context(context);
+			return;
+		}
+		if(t_pool_size == 0){
+			// 线程退出时释放池中的上下文。键的值只要非空即可。
+			::pthread_once(&g_pool_key_once, &create_pool_key);
+			::pthread_setspecific(g_pool_key, &t_pool_size);
+		}
+		context->next = t_pool;
+		t_pool = context;
+		++t_pool_size;
+	}
 }
+
+Deflator::Deflator(bool gzip, int level, int window_bits)
+	: m_context(acquire_context(false, make_window_bits(gzip, window_bits), level))
+{ }
 Deflator::~Deflator(){
-	int err_code = ::deflateEnd(&m_stream);
-	if(err_code < 0){
-		LOG_POSEIDON_WARNING("::deflateEnd() error: err_code = ", err_code);
-	}
+	release_context(m_context);
 }
 
 void Deflator::clear(){
 	PROFILE_ME;
 
-	int err_code = ::deflateReset(&m_stream);
+	int err_code = ::deflateReset(&(m_context->stream));
 	if(err_code < 0){
 		LOG_POSEIDON_FATAL("::deflateReset() error: err_code = ", err_code);
 		std::abort();
@@ -38,26 +125,26 @@ void Deflator::put(const void *data, std::size_t size){
 	PROFILE_ME;
 
 	const AUTO(begin, static_cast<const unsigned char *>(data));
-	m_stream.next_in = begin;
-	m_stream.avail_in = 0;
+	m_context->stream.next_in = begin;
+	m_context->stream.avail_in = 0;
 	int err_code;
 	for(;;){
-		if(m_stream.avail_in == 0){
-			std::size_t remaining = static_cast<std::size_t>(begin + size - m_stream.next_in);
+		if(m_context->stream.avail_in == 0){
+			std::size_t remaining = static_cast<std::size_t>(begin + size - m_context->stream.next_in);
 			if(remaining > UINT_MAX){
 				remaining = UINT_MAX;
 			}
-			m_stream.avail_in = static_cast<unsigned>(remaining);
+			m_context->stream.avail_in = static_cast<unsigned>(remaining);
 		}
-		if(m_stream.avail_in == 0){
+		if(m_context->stream.avail_in == 0){
 			break;
 		}
 		unsigned char temp[4096];
-		m_stream.next_out = temp;
-		m_stream.avail_out = sizeof(temp);
-		err_code = ::deflate(&m_stream, Z_NO_FLUSH);
+		m_context->stream.next_out = temp;
+		m_context->stream.avail_out = sizeof(temp);
+		err_code = ::deflate(&(m_context->stream), Z_NO_FLUSH);
 		DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::deflate()"));
-		m_buffer.put(temp, static_cast<unsigned>(m_stream.next_out - temp));
+		m_buffer.put(temp, static_cast<unsigned>(m_context->stream.next_out - temp));
 		DEBUG_THROW_ASSERT(err_code == 0);
 	}
 }
@@ -74,35 +161,35 @@ void Deflator::put(const StreamBuffer &buffer){
 void Deflator::flush(){
 	PROFILE_ME;
 
-	m_stream.next_in = NULLPTR;
-	m_stream.avail_in = 0;
+	m_context->stream.next_in = NULLPTR;
+	m_context->stream.avail_in = 0;
 	int err_code;
 	for(;;){
 		unsigned char temp[4096];
-		m_stream.next_out = temp;
-		m_stream.avail_out = sizeof(temp);
-		err_code = ::deflate(&m_stream, Z_SYNC_FLUSH);
+		m_context->stream.next_out = temp;
+		m_context->stream.avail_out = sizeof(temp);
+		err_code = ::deflate(&(m_context->stream), Z_SYNC_FLUSH);
 		if(err_code == Z_BUF_ERROR){
 			break;
 		}
 		DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::deflate()"));
-		m_buffer.put(temp, static_cast<unsigned>(m_stream.next_out - temp));
+		m_buffer.put(temp, static_cast<unsigned>(m_context->stream.next_out - temp));
 		DEBUG_THROW_ASSERT(err_code == 0);
 	}
 }
 StreamBuffer Deflator::finalize(){
 	PROFILE_ME;
 
-	m_stream.next_in = NULLPTR;
-	m_stream.avail_in = 0;
+	m_context->stream.next_in = NULLPTR;
+	m_context->stream.avail_in = 0;
 	int err_code;
 	for(;;){
 		unsigned char temp[4096];
-		m_stream.next_out = temp;
-		m_stream.avail_out = sizeof(temp);
-		err_code = ::deflate(&m_stream, Z_FINISH);
+		m_context->stream.next_out = temp;
+		m_context->stream.avail_out = sizeof(temp);
+		err_code = ::deflate(&(m_context->stream), Z_FINISH);
 		DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::deflate()"));
-		m_buffer.put(temp, static_cast<unsigned>(m_stream.next_out - temp));
+		m_buffer.put(temp, static_cast<unsigned>(m_context->stream.next_out - temp));
 		if(err_code == Z_STREAM_END){
 			break;
 		}
@@ -114,26 +201,17 @@ StreamBuffer Deflator::finalize(){
 	return ret;
 }
 
-Inflator::Inflator(bool gzip){
-	m_stream.zalloc = NULLPTR;
-	m_stream.zfree = NULLPTR;
-	m_stream.opaque = NULLPTR;
-	m_stream.next_in = NULLPTR;
-	m_stream.avail_in = 0;
-	int err_code = ::inflateInit2(&m_stream, 15 + gzip * 16);
-	DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::deflateInit2()"));
-}
+Inflator::Inflator(bool gzip, int window_bits)
+	: m_context(acquire_context(true, make_window_bits(gzip, window_bits), 0))
+{ }
 Inflator::~Inflator(){
-	int err_code = ::inflateEnd(&m_stream);
-	if(err_code < 0){
-		LOG_POSEIDON_WARNING("::inflateEnd() error: err_code = ", err_code);
-	}
+	release_context(m_context);
 }
 
 void Inflator::clear(){
 	PROFILE_ME;
 
-	int err_code = ::inflateReset(&m_stream);
+	int err_code = ::inflateReset(&(m_context->stream));
 	if(err_code < 0){
 		LOG_POSEIDON_FATAL("::inflateReset() error: err_code = ", err_code);
 		std::abort();
@@ -144,26 +222,26 @@ void Inflator::put(const void *data, std::size_t size){
 	PROFILE_ME;
 
 	const AUTO(begin, static_cast<const unsigned char *>(data));
-	m_stream.next_in = begin;
-	m_stream.avail_in = 0;
+	m_context->stream.next_in = begin;
+	m_context->stream.avail_in = 0;
 	int err_code;
 	for(;;){
-		if(m_stream.avail_in == 0){
-			std::size_t remaining = static_cast<std::size_t>(begin + size - m_stream.next_in);
+		if(m_context->stream.avail_in == 0){
+			std::size_t remaining = static_cast<std::size_t>(begin + size - m_context->stream.next_in);
 			if(remaining > UINT_MAX){
 				remaining = UINT_MAX;
 			}
-			m_stream.avail_in = static_cast<unsigned>(remaining);
+			m_context->stream.avail_in = static_cast<unsigned>(remaining);
 		}
-		if(m_stream.avail_in == 0){
+		if(m_context->stream.avail_in == 0){
 			break;
 		}
 		unsigned char temp[4096];
-		m_stream.next_out = temp;
-		m_stream.avail_out = sizeof(temp);
-		err_code = ::inflate(&m_stream, Z_NO_FLUSH);
+		m_context->stream.next_out = temp;
+		m_context->stream.avail_out = sizeof(temp);
+		err_code = ::inflate(&(m_context->stream), Z_NO_FLUSH);
 		DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::inflate()"));
-		m_buffer.put(temp, static_cast<unsigned>(m_stream.next_out - temp));
+		m_buffer.put(temp, static_cast<unsigned>(m_context->stream.next_out - temp));
 		if(err_code == Z_STREAM_END){
 			break;
 		}
@@ -183,35 +261,35 @@ void Inflator::put(const StreamBuffer &buffer){
 void Inflator::flush(){
 	PROFILE_ME;
 
-	m_stream.next_in = NULLPTR;
-	m_stream.avail_in = 0;
+	m_context->stream.next_in = NULLPTR;
+	m_context->stream.avail_in = 0;
 	int err_code;
 	for(;;){
 		unsigned char temp[4096];
-		m_stream.next_out = temp;
-		m_stream.avail_out = sizeof(temp);
-		err_code = ::inflate(&m_stream, Z_SYNC_FLUSH);
+		m_context->stream.next_out = temp;
+		m_context->stream.avail_out = sizeof(temp);
+		err_code = ::inflate(&(m_context->stream), Z_SYNC_FLUSH);
 		if(err_code == Z_BUF_ERROR){
 			break;
 		}
 		DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::inflate()"));
-		m_buffer.put(temp, static_cast<unsigned>(m_stream.next_out - temp));
+		m_buffer.put(temp, static_cast<unsigned>(m_context->stream.next_out - temp));
 		DEBUG_THROW_ASSERT(err_code == 0);
 	}
 }
 StreamBuffer Inflator::finalize(){
 	PROFILE_ME;
 
-	m_stream.next_in = NULLPTR;
-	m_stream.avail_in = 0;
+	m_context->stream.next_in = NULLPTR;
+	m_context->stream.avail_in = 0;
 	int err_code;
 	for(;;){
 		unsigned char temp[4096];
-		m_stream.next_out = temp;
-		m_stream.avail_out = sizeof(temp);
-		err_code = ::inflate(&m_stream, Z_FINISH);
+		m_context->stream.next_out = temp;
+		m_context->stream.avail_out = sizeof(temp);
+		err_code = ::inflate(&(m_context->stream), Z_FINISH);
 		DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::inflate()"));
-		m_buffer.put(temp, static_cast<unsigned>(m_stream.next_out - temp));
+		m_buffer.put(temp, static_cast<unsigned>(m_context->stream.next_out - temp));
 		if(err_code == Z_STREAM_END){
 			break;
 		}
@@ -223,4 +301,39 @@ StreamBuffer Inflator::finalize(){
 	return ret;
 }
 
+StreamBuffer deflate_buffer(const StreamBuffer &data, bool gzip, int level, int window_bits){
+	PROFILE_ME;
+
+	const AUTO(context, acquire_context(false, make_window_bits(gzip, window_bits), level));
+	StreamBuffer ret;
+	try {
+		AUTO_REF(stream, context->stream);
+		std::size_t avail;
+		const AUTO(out, static_cast<unsigned char *>(ret.reserve_tail(::deflateBound(&stream, boost::numeric_cast< ::uLong>(data.size())), avail)));
+		stream.next_out = out;
+		stream.avail_out = boost::numeric_cast<unsigned>(avail);
+		const void *chunk_data;
+		std::size_t chunk_size;
+		StreamBuffer::EnumerationCookie cookie;
+		while(data.enumerate_chunk(&chunk_data, &chunk_size, cookie)){
+			stream.next_in = static_cast<const unsigned char *>(chunk_data);
+			stream.avail_in = boost::numeric_cast<unsigned>(chunk_size);
+			const int err_code = ::deflate(&stream, Z_NO_FLUSH);
+			DEBUG_THROW_UNLESS(err_code >= 0, Exception, sslit("::deflate()"));
+			DEBUG_THROW_ASSERT(stream.avail_in == 0);
+		}
+		stream.next_in = NULLPTR;
+		stream.avail_in = 0;
+		// 输出空间不小于 deflateBound() 的返回值，一次就能完成。
+		const int err_code = ::deflate(&stream, Z_FINISH);
+		DEBUG_THROW_UNLESS(err_code == Z_STREAM_END, Exception, sslit("::deflate()"));
+		ret.commit_tail(static_cast<std::size_t>(stream.next_out - out));
+	} catch(...){
+		release_context(context);
+		throw;
+	}
+	release_context(context);
+	return ret;
+}
+
 }
@@ -17,13 +17,18 @@
 
 namespace Poseidon {
 
+struct ZlibContext; // 定义在 zlib.cpp 中。
+
+// zlib 的状态（压缩时约 256 KiB）在析构时重置并放回当前线程的池中，下次构造参数相同的对象时直接复用。
+// window_bits 是滑动窗口大小的以 2 为底的对数，9 到 15。
+// window_bits 为负数时读写不带 zlib 头部和校验和的原始 deflate 数据（RFC 1951），此时忽略 gzip。
 class Deflator : NONCOPYABLE {
 private:
-	::z_stream m_stream;
+	ZlibContext *const m_context;
 	StreamBuffer m_buffer;
 
 public:
-	explicit Deflator(bool gzip = false, int level = 8);
+	explicit Deflator(bool gzip = false, int level = 8, int window_bits = 15);
 	~Deflator();
 
 public:
@@ -55,11 +60,11 @@ public:
 
 class Inflator : NONCOPYABLE {
 private:
-	::z_stream m_stream;
+	ZlibContext *const m_context;
 	StreamBuffer m_buffer;
 
 public:
-	explicit Inflator(bool gzip = false);
+	explicit Inflator(bool gzip = false, int window_bits = 15);
 	~Inflator();
 
 public:
@@ -89,6 +94,9 @@ public:
 	void put(const StreamBuffer &buffer);
 };
 
+// 一次性压缩整个缓冲区，输出直接写到按 deflateBound() 预留的连续空间中，不经过临时缓冲区。
+extern StreamBuffer deflate_buffer(const StreamBuffer &data, bool gzip = false, int level = 8, int window_bits = 15);
+
 }
 
 #endif
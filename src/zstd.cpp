@@ -0,0 +1,164 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#include "precompiled.hpp"
+#include "zstd.hpp"
+#include "profiler.hpp"
+#include "exception.hpp"
+
+namespace Poseidon {
+
+namespace {
+	// 处理所有输入，并且在 op 不是 ZSTD_e_continue 时取出所有输出。
+	void compress(StreamBuffer &buffer, ::ZSTD_CCtx *cctx, ::ZSTD_EndDirective op, const void *data, std::size_t size){
+		::ZSTD_inBuffer in = { data, size, 0 };
+		for(;;){
+			unsigned char temp[4096];
+			::ZSTD_outBuffer out = { temp, sizeof(temp), 0 };
+			const std::size_t remaining = ::ZSTD_compressStream2(cctx, &out, &in, op);
+			DEBUG_THROW_UNLESS(!::ZSTD_isError(remaining), Exception, SharedNts(::ZSTD_getErrorName(remaining)));
+			buffer.put(temp, out.pos);
+			if(op == ZSTD_e_continue){
+				if(in.pos == in.size){
+					break;
+				}
+			} else {
+				if(remaining == 0){
+					break;
+				}
+			}
+		}
+	}
+}
+
+ZstdCompressor::ZstdCompressor(int level)
+	: m_cctx(::ZSTD_createCCtx())
+{
+	DEBUG_THROW_UNLESS(m_cctx, Exception, sslit("::ZSTD_createCCtx()"));
+	::ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, level);
+}
+ZstdCompressor::~ZstdCompressor(){
+	::ZSTD_freeCCtx(m_cctx);
+}
+
+void ZstdCompressor::clear(){
+	PROFILE_ME;
+
+	const std::size_t err_code = ::ZSTD_CCtx_reset(m_cctx, ZSTD_reset_session_only);
+	if(::ZSTD_isError(err_code)){
+		LOG_POSEIDON_FATAL("::ZSTD_CCtx_reset() error: ", ::ZSTD_getErrorName(err_code));
+		std::abort();
+	}
+	m_buffer.clear();
+}
+void ZstdCompressor::load_dictionary(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	const std::size_t err_code = ::ZSTD_CCtx_loadDictionary(m_cctx, data, size);
+	DEBUG_THROW_UNLESS(!::ZSTD_isError(err_code), Exception, SharedNts(::ZSTD_getErrorName(err_code)));
+}
+void ZstdCompressor::put(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	compress(m_buffer, m_cctx, ZSTD_e_continue, data, size);
+}
+void ZstdCompressor::put(const StreamBuffer &buffer){
+	PROFILE_ME;
+
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		put(data, size);
+	}
+}
+void ZstdCompressor::flush(){
+	PROFILE_ME;
+
+	compress(m_buffer, m_cctx, ZSTD_e_flush, NULLPTR, 0);
+}
+StreamBuffer ZstdCompressor::finalize(){
+	PROFILE_ME;
+
+	compress(m_buffer, m_cctx, ZSTD_e_end, NULLPTR, 0);
+	StreamBuffer ret;
+	ret.swap(m_buffer);
+	clear();
+	return ret;
+}
+
+ZstdDecompressor::ZstdDecompressor()
+	: m_dctx(::ZSTD_createDCtx()), m_frame_complete(true), m_output_limit(static_cast<boost::uint64_t>(-1)), m_output_total(0)
+{
+	DEBUG_THROW_UNLESS(m_dctx, Exception, sslit("::ZSTD_createDCtx()"));
+}
+ZstdDecompressor::~ZstdDecompressor(){
+	::ZSTD_freeDCtx(m_dctx);
+}
+
+void ZstdDecompressor::clear(){
+	PROFILE_ME;
+
+	const std::size_t err_code = ::ZSTD_DCtx_reset(m_dctx, ZSTD_reset_session_only);
+	if(::ZSTD_isError(err_code)){
+		LOG_POSEIDON_FATAL("::ZSTD_DCtx_reset() error: ", ::ZSTD_getErrorName(err_code));
+		std::abort();
+	}
+	m_frame_complete = true;
+	m_output_limit = static_cast<boost::uint64_t>(-1);
+	m_output_total = 0;
+	m_buffer.clear();
+}
+void ZstdDecompressor::load_dictionary(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	const std::size_t err_code = ::ZSTD_DCtx_loadDictionary(m_dctx, data, size);
+	DEBUG_THROW_UNLESS(!::ZSTD_isError(err_code), Exception, SharedNts(::ZSTD_getErrorName(err_code)));
+}
+void ZstdDecompressor::put(const void *data, std::size_t size){
+	PROFILE_ME;
+
+	::ZSTD_inBuffer in = { data, size, 0 };
+	for(;;){
+		unsigned char temp[4096];
+		::ZSTD_outBuffer out = { temp, sizeof(temp), 0 };
+		const std::size_t hint = ::ZSTD_decompressStream(m_dctx, &out, &in);
+		DEBUG_THROW_UNLESS(!::ZSTD_isError(hint), Exception, SharedNts(::ZSTD_getErrorName(hint)));
+		m_output_total += out.pos;
+		DEBUG_THROW_UNLESS(m_output_total <= m_output_limit, Exception, sslit("Decompressed data exceeds the output limit"));
+		m_buffer.put(temp, out.pos);
+		if(size != 0){
+			m_frame_complete = (hint == 0);
+		}
+		// 输出缓冲区被填满时解码器中可能还有数据。
+		if((in.pos == in.size) && (out.pos < out.size)){
+			break;
+		}
+	}
+}
+void ZstdDecompressor::put(const StreamBuffer &buffer){
+	PROFILE_ME;
+
+	const void *data;
+	std::size_t size;
+	StreamBuffer::EnumerationCookie cookie;
+	while(buffer.enumerate_chunk(&data, &size, cookie)){
+		put(data, size);
+	}
+}
+void ZstdDecompressor::flush(){
+	PROFILE_ME;
+
+	// put() 总是取出所有能够解码的数据。
+}
+StreamBuffer ZstdDecompressor::finalize(){
+	PROFILE_ME;
+
+	DEBUG_THROW_UNLESS(m_frame_complete, Exception, sslit("Zstandard frame is truncated"));
+	StreamBuffer ret;
+	ret.swap(m_buffer);
+	clear();
+	return ret;
+}
+
+}
@@ -0,0 +1,103 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+#ifndef POSEIDON_ZSTD_HPP_
+#define POSEIDON_ZSTD_HPP_
+
+#include "cxx_util.hpp"
+#include "stream_buffer.hpp"
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <zstd.h>
+
+namespace Poseidon {
+
+// 接口与 Deflator 和 Inflator 相同。level 的范围是 1 到 22。
+// flush() 之后缓冲区中的数据可以被单独解压，适合配合分块传输逐块发送。
+class ZstdCompressor : NONCOPYABLE {
+private:
+	::ZSTD_CCtx *m_cctx;
+	StreamBuffer m_buffer;
+
+public:
+	explicit ZstdCompressor(int level = 3);
+	~ZstdCompressor();
+
+public:
+	const StreamBuffer &get_buffer() const {
+		return m_buffer;
+	}
+	StreamBuffer &get_buffer(){
+		return m_buffer;
+	}
+
+	void clear();
+	// 字典被复制，clear() 之后仍然有效。size 为零时不使用字典。
+	void load_dictionary(const void *data, std::size_t size);
+	void put(const void *data, std::size_t size);
+	void put(char ch){
+		put(&ch, 1);
+	}
+	void put(int ch){
+		put(static_cast<char>(ch));
+	}
+	void put(const char *str){
+		put(str, std::strlen(str));
+	}
+	void put(const std::string &str){
+		put(str.data(), str.size());
+	}
+	void put(const StreamBuffer &buffer);
+	void flush();
+	StreamBuffer finalize();
+};
+
+class ZstdDecompressor : NONCOPYABLE {
+private:
+	::ZSTD_DCtx *m_dctx;
+	bool m_frame_complete;
+	boost::uint64_t m_output_limit;
+	boost::uint64_t m_output_total;
+	StreamBuffer m_buffer;
+
+public:
+	ZstdDecompressor();
+	~ZstdDecompressor();
+
+public:
+	const StreamBuffer &get_buffer() const {
+		return m_buffer;
+	}
+	StreamBuffer &get_buffer(){
+		return m_buffer;
+	}
+
+	void clear();
+	void load_dictionary(const void *data, std::size_t size);
+	// 从上次 clear() 开始解压出来的数据超过 limit 字节时 put() 抛出异常，用于防止压缩炸弹。clear() 会解除限制。
+	void set_output_limit(boost::uint64_t limit){
+		m_output_limit = limit;
+	}
+	void put(const void *data, std::size_t size);
+	void put(char ch){
+		put(&ch, 1);
+	}
+	void put(int ch){
+		put(static_cast<char>(ch));
+	}
+	void put(const char *str){
+		put(str, std::strlen(str));
+	}
+	void put(const std::string &str){
+		put(str.data(), str.size());
+	}
+	void put(const StreamBuffer &buffer);
+	void flush();
+	StreamBuffer finalize();
+};
+
+}
+
+#endif
@@ -0,0 +1,588 @@
+// 这个文件是 Poseidon 服务器应用程序框架的一部分。
+// Copyleft 2014 - 2018, LH_Mouse. All wrongs reserved.
+
+// 这个文件被置于公有领域（public domain）。
+
+// CBPP 消息的离线编译器：读取消息定义文件，生成 C++ 头文件和 JavaScript 编解码函数。
+// 用法：cbpp_schema <定义文件> <C++ 头文件> [JavaScript 文件]
+//
+// 定义文件的格式如下，# 或者 // 之后直到行末的内容是注释：
+//
+//   namespace Game::Protocol;           // 可选，生成的类所在的命名空间。
+//
+//   message LoginRequest 0x1001 {
+//     string  account;
+//     fixed   nonce 16;                 // fixed 必须指定字节数。
+//     vuint   flags;
+//     array   items {                   // array 和 list 的元素由花括号中的字段组成。
+//       vint  value;
+//       blob  data;
+//     }
+//     list    extensions {
+//       vuint   type;
+//       flexible  body;                 // flexible 只能是消息或者 list 元素的最后一个字段。
+//     }
+//   }
+//
+// 生成的 C++ 头文件使用 poseidon/cbpp/message_generator.hpp 定义每个消息，与手写的定义完全相同。
+// 在恰好一个 .cpp 文件中，于第一次包含该头文件之前定义 CBPP_MESSAGE_EMIT_EXTERNAL_DEFINITIONS 以生成成员函数的定义。
+// 生成的 JavaScript 依赖 cbpp.js，每个消息生成 encode<消息名>(msg) 和 decode<消息名>(buffer) 两个函数，以及 <消息名>.ID。
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <stdexcept>
+#include <cstdlib>
+#include <cctype>
+
+namespace {
+
+enum FieldType {
+	FT_VINT,
+	FT_VUINT,
+	FT_FIXED,
+	FT_STRING,
+	FT_BLOB,
+	FT_FLEXIBLE,
+	FT_ARRAY,
+	FT_LIST,
+};
+
+struct Field {
+	FieldType type;
+	std::string name;
+	unsigned long size; // 只用于 FT_FIXED。
+	std::vector<Field> children; // 只用于 FT_ARRAY 和 FT_LIST。
+	unsigned line;
+};
+
+struct Message {
+	std::string name;
+	unsigned long id;
+	std::vector<Field> fields;
+	unsigned line;
+};
+
+struct Schema {
+	std::vector<std::string> namespaces;
+	std::vector<Message> messages;
+};
+
+class ParseError : public std::runtime_error {
+public:
+	ParseError(unsigned line, const std::string &what)
+		: std::runtime_error(make_what(line, what))
+	{ }
+
+private:
+	static std::string make_what(unsigned line, const std::string &what){
+		std::ostringstream oss;
+		oss <<"line " <<line <<": " <<what;
+		return oss.str();
+	}
+};
+
+class Lexer {
+private:
+	std::string m_text;
+	std::size_t m_pos;
+	unsigned m_line;
+
+public:
+	explicit Lexer(const std::string &text)
+		: m_text(text), m_pos(0), m_line(1)
+	{ }
+
+private:
+	void skip_blanks(){
+		for(;;){
+			if(m_pos >= m_text.size()){
+				return;
+			}
+			const char ch = m_text[m_pos];
+			if(ch == '\n'){
+				++m_line;
+				++m_pos;
+			} else if(std::isspace(static_cast<unsigned char>(ch))){
+				++m_pos;
+			} else if((ch == '#') || (m_text.compare(m_pos, 2, "//") == 0)){
+				while((m_pos < m_text.size()) && (m_text[m_pos] != '\n')){
+					++m_pos;
+				}
+			} else {
+				return;
+			}
+		}
+	}
+
+public:
+	unsigned get_line() const {
+		return m_line;
+	}
+
+	// 返回空字符串表示文件结束。标识符中可以包含 ::，用于命名空间。
+	std::string next(){
+		skip_blanks();
+		if(m_pos >= m_text.size()){
+			return std::string();
+		}
+		const std::size_t begin = m_pos;
+		const char ch = m_text[m_pos];
+		if((ch == '{') || (ch == '}') || (ch == ';')){
+			++m_pos;
+			return m_text.substr(begin, 1);
+		}
+		while(m_pos < m_text.size()){
+			const char cur = m_text[m_pos];
+			if(std::isalnum(static_cast<unsigned char>(cur)) || (cur == '_') || (cur == ':')){
+				++m_pos;
+				continue;
+			}
+			break;
+		}
+		if(m_pos == begin){
+			throw ParseError(m_line, std::string("Unexpected character '") + ch + "'");
+		}
+		return m_text.substr(begin, m_pos - begin);
+	}
+	std::string expect_token(){
+		const std::string token = next();
+		if(token.empty()){
+			throw ParseError(m_line, "Unexpected end of file");
+		}
+		return token;
+	}
+	void expect(const char *what){
+		const std::string token = expect_token();
+		if(token != what){
+			throw ParseError(m_line, "Expecting '" + std::string(what) + "' but got '" + token + "'");
+		}
+	}
+};
+
+bool is_identifier(const std::string &str){
+	if(str.empty() || std::isdigit(static_cast<unsigned char>(str[0]))){
+		return false;
+	}
+	for(std::size_t i = 0; i < str.size(); ++i){
+		if(!std::isalnum(static_cast<unsigned char>(str[i])) && (str[i] != '_')){
+			return false;
+		}
+	}
+	// 生成的代码中以下划线结尾的名字是保留的。
+	return str[str.size() - 1] != '_';
+}
+std::string expect_identifier(Lexer &lexer){
+	const std::string token = lexer.expect_token();
+	if(!is_identifier(token)){
+		throw ParseError(lexer.get_line(), "Invalid identifier '" + token + "'");
+	}
+	return token;
+}
+unsigned long expect_number(Lexer &lexer){
+	const std::string token = lexer.expect_token();
+	char *eptr;
+	const unsigned long val = std::strtoul(token.c_str(), &eptr, 0);
+	if((*eptr != 0) || !std::isdigit(static_cast<unsigned char>(token[0]))){
+		throw ParseError(lexer.get_line(), "Invalid number '" + token + "'");
+	}
+	return val;
+}
+
+void parse_fields(Lexer &lexer, std::vector<Field> &fields, bool in_array){
+	std::set<std::string> names;
+	for(;;){
+		const std::string type = lexer.expect_token();
+		if(type == "}"){
+			break;
+		}
+		if(!fields.empty() && (fields.back().type == FT_FLEXIBLE)){
+			throw ParseError(lexer.get_line(), "Field '" + fields.back().name + "' of type flexible must be the last one");
+		}
+		Field field;
+		field.line = lexer.get_line();
+		field.size = 0;
+		if(type == "vint"){
+			field.type = FT_VINT;
+		} else if(type == "vuint"){
+			field.type = FT_VUINT;
+		} else if(type == "fixed"){
+			field.type = FT_FIXED;
+		} else if(type == "string"){
+			field.type = FT_STRING;
+		} else if(type == "blob"){
+			field.type = FT_BLOB;
+		} else if(type == "flexible"){
+			if(in_array){
+				throw ParseError(field.line, "Fields of type flexible are not allowed in array elements");
+			}
+			field.type = FT_FLEXIBLE;
+		} else if(type == "array"){
+			field.type = FT_ARRAY;
+		} else if(type == "list"){
+			field.type = FT_LIST;
+		} else {
+			throw ParseError(field.line, "Unknown field type '" + type + "'");
+		}
+		field.name = expect_identifier(lexer);
+		if(!names.insert(field.name).second){
+			throw ParseError(field.line, "Duplicate field '" + field.name + "'");
+		}
+		if(field.type == FT_FIXED){
+			field.size = expect_number(lexer);
+			if(field.size == 0){
+				throw ParseError(field.line, "Field '" + field.name + "' of type fixed must have a non-zero size");
+			}
+		}
+		if((field.type == FT_ARRAY) || (field.type == FT_LIST)){
+			lexer.expect("{");
+			// 一个 list 元素的长度由前缀确定，其中可以有 flexible 字段；array 元素则不可以。
+			parse_fields(lexer, field.children, field.type == FT_ARRAY);
+			if(field.children.empty()){
+				throw ParseError(field.line, "Field '" + field.name + "' has no element fields");
+			}
+		} else {
+			lexer.expect(";");
+		}
+		fields.push_back(field);
+	}
+}
+
+Schema parse_schema(const std::string &text){
+	Schema schema;
+	Lexer lexer(text);
+	std::set<std::string> names;
+	std::map<unsigned long, std::string> ids;
+	for(;;){
+		const std::string keyword = lexer.next();
+		if(keyword.empty()){
+			break;
+		}
+		if(keyword == "namespace"){
+			if(!schema.namespaces.empty() || !schema.messages.empty()){
+				throw ParseError(lexer.get_line(), "The namespace must be specified once before all messages");
+			}
+			const std::string path = lexer.expect_token();
+			std::size_t begin = 0;
+			for(;;){
+				const std::size_t end = path.find("::", begin);
+				const std::string segment = path.substr(begin, end - begin);
+				if(!is_identifier(segment)){
+					throw ParseError(lexer.get_line(), "Invalid namespace '" + path + "'");
+				}
+				schema.namespaces.push_back(segment);
+				if(end == std::string::npos){
+					break;
+				}
+				begin = end + 2;
+			}
+			lexer.expect(";");
+			continue;
+		}
+		if(keyword != "message"){
+			throw ParseError(lexer.get_line(), "Expecting 'message' but got '" + keyword + "'");
+		}
+		Message message;
+		message.line = lexer.get_line();
+		message.name = expect_identifier(lexer);
+		if(!names.insert(message.name).second){
+			throw ParseError(message.line, "Duplicate message '" + message.name + "'");
+		}
+		message.id = expect_number(lexer);
+		// 0 是控制消息，0xFFFE 和 0xFFFF 保留给 RPC（参见 rpc.hpp）。
+		if((message.id == 0) || (message.id >= 0xFFFE)){
+			throw ParseError(message.line, "Message ID of '" + message.name + "' is out of range or reserved");
+		}
+		const std::map<unsigned long, std::string>::const_iterator it = ids.find(message.id);
+		if(it != ids.end()){
+			throw ParseError(message.line, "Message ID of '" + message.name + "' conflicts with '" + it->second + "'");
+		}
+		ids[message.id] = message.name;
+		lexer.expect("{");
+		parse_fields(lexer, message.fields, false);
+		schema.messages.push_back(message);
+	}
+	return schema;
+}
+
+std::string make_hex(unsigned long val){
+	std::ostringstream oss;
+	oss <<"0x" <<std::hex <<std::uppercase;
+	oss.width(4);
+	oss.fill('0');
+	oss <<val;
+	return oss.str();
+}
+std::string make_indent(unsigned depth){
+	return std::string(depth, '\t');
+}
+
+// C++ 头文件。
+
+void emit_cpp_fields(std::ostream &os, const std::vector<Field> &fields, unsigned depth){
+	for(std::size_t i = 0; i < fields.size(); ++i){
+		const Field &field = fields[i];
+		os <<make_indent(depth);
+		switch(field.type){
+		case FT_VINT:
+			os <<"FIELD_VINT(" <<field.name <<")";
+			break;
+		case FT_VUINT:
+			os <<"FIELD_VUINT(" <<field.name <<")";
+			break;
+		case FT_FIXED:
+			os <<"FIELD_FIXED(" <<field.name <<", " <<field.size <<")";
+			break;
+		case FT_STRING:
+			os <<"FIELD_STRING(" <<field.name <<")";
+			break;
+		case FT_BLOB:
+			os <<"FIELD_BLOB(" <<field.name <<")";
+			break;
+		case FT_FLEXIBLE:
+			os <<"FIELD_FLEXIBLE(" <<field.name <<")";
+			break;
+		case FT_ARRAY:
+		case FT_LIST:
+			os <<((field.type == FT_ARRAY) ? "FIELD_ARRAY(" : "FIELD_LIST(") <<field.name <<",\t\\\n";
+			emit_cpp_fields(os, field.children, depth + 1);
+			os <<make_indent(depth) <<")";
+			break;
+		}
+		os <<"\t\\\n";
+	}
+}
+
+std::string make_guard(const std::string &path){
+	std::string::size_type slash = path.rfind('/');
+	std::string guard = "CBPP_SCHEMA_";
+	for(std::size_t i = (slash == std::string::npos) ? 0 : slash + 1; i < path.size(); ++i){
+		const unsigned char ch = static_cast<unsigned char>(path[i]);
+		guard += std::isalnum(ch) ? static_cast<char>(std::toupper(ch)) : '_';
+	}
+	guard += '_';
+	return guard;
+}
+
+void emit_cpp(std::ostream &os, const Schema &schema, const std::string &source, const std::string &output){
+	const std::string guard = make_guard(output);
+	os <<"// 这个文件由 cbpp_schema 从 " <<source <<" 生成，不要手动修改。\n"
+	   <<"\n"
+	   <<"#ifndef " <<guard <<"\n"
+	   <<"#define " <<guard <<"\n"
+	   <<"\n"
+	   <<"#include <poseidon/cbpp/message_base.hpp>\n"
+	   <<"\n";
+	for(std::size_t i = 0; i < schema.namespaces.size(); ++i){
+		os <<"namespace " <<schema.namespaces[i] <<" {\n";
+	}
+	if(!schema.namespaces.empty()){
+		os <<"\n";
+	}
+	for(std::size_t i = 0; i < schema.messages.size(); ++i){
+		const Message &message = schema.messages[i];
+		os <<"#define MESSAGE_NAME        " <<message.name <<"\n"
+		   <<"#define MESSAGE_ID          " <<make_hex(message.id) <<"\n"
+		   <<"#define MESSAGE_FIELDS";
+		if(!message.fields.empty()){
+			// 去掉最后一个字段之后的续行符。
+			std::ostringstream fields;
+			emit_cpp_fields(fields, message.fields, 1);
+			std::string str = fields.str();
+			str.erase(str.size() - 3);
+			os <<"      \\\n" <<str;
+		}
+		os <<"\n"
+		   <<"#include <poseidon/cbpp/message_generator.hpp>\n"
+		   <<"\n";
+	}
+	for(std::size_t i = schema.namespaces.size(); i > 0; --i){
+		os <<"}\n";
+	}
+	if(!schema.namespaces.empty()){
+		os <<"\n";
+	}
+	os <<"#endif\n";
+}
+
+// JavaScript。
+// 对象的字段名与 C++ 相同，vint 和 vuint 是 Number，fixed、blob 和 flexible 是字节的 Array，string 是 String，array 和 list 是对象的 Array。
+
+void emit_js_encoder(std::ostream &os, const std::vector<Field> &fields, const std::string &obj, const std::string &buffer, unsigned depth){
+	const std::string indent = make_indent(depth);
+	std::ostringstream suffix;
+	suffix <<depth;
+	for(std::size_t i = 0; i < fields.size(); ++i){
+		const Field &field = fields[i];
+		const std::string val = obj + "." + field.name;
+		switch(field.type){
+		case FT_VINT:
+			os <<indent <<"pushVint(" <<buffer <<", " <<val <<");\n";
+			break;
+		case FT_VUINT:
+			os <<indent <<"pushVuint(" <<buffer <<", " <<val <<");\n";
+			break;
+		case FT_FIXED:
+			os <<indent <<"pushFixed(" <<buffer <<", " <<val <<", " <<field.size <<");\n";
+			break;
+		case FT_STRING:
+			os <<indent <<"pushString(" <<buffer <<", " <<val <<");\n";
+			break;
+		case FT_BLOB:
+			os <<indent <<"pushVuint(" <<buffer <<", " <<val <<".length);\n"
+			   <<indent <<"pushFixed(" <<buffer <<", " <<val <<", " <<val <<".length);\n";
+			break;
+		case FT_FLEXIBLE:
+			os <<indent <<"pushFlexible(" <<buffer <<", " <<val <<");\n";
+			break;
+		case FT_ARRAY:
+			os <<indent <<"pushVuint(" <<buffer <<", " <<val <<".length);\n"
+			   <<indent <<"for(var i" <<suffix.str() <<" = 0; i" <<suffix.str() <<" < " <<val <<".length; ++i" <<suffix.str() <<"){\n"
+			   <<indent <<"\tvar elem" <<suffix.str() <<" = " <<val <<"[i" <<suffix.str() <<"];\n";
+			emit_js_encoder(os, field.children, "elem" + suffix.str(), buffer, depth + 1);
+			os <<indent <<"}\n";
+			break;
+		case FT_LIST:
+			// 每个元素之前是其长度，最后以 0 结束。
+			os <<indent <<"for(var i" <<suffix.str() <<" = 0; i" <<suffix.str() <<" < " <<val <<".length; ++i" <<suffix.str() <<"){\n"
+			   <<indent <<"\tvar elem" <<suffix.str() <<" = " <<val <<"[i" <<suffix.str() <<"];\n"
+			   <<indent <<"\tvar chunk" <<suffix.str() <<" = [];\n";
+			emit_js_encoder(os, field.children, "elem" + suffix.str(), "chunk" + suffix.str(), depth + 1);
+			os <<indent <<"\tpushVuint(" <<buffer <<", chunk" <<suffix.str() <<".length);\n"
+			   <<indent <<"\tpushFlexible(" <<buffer <<", chunk" <<suffix.str() <<");\n"
+			   <<indent <<"}\n"
+			   <<indent <<buffer <<".push(0);\n";
+			break;
+		}
+	}
+}
+
+void emit_js_decoder(std::ostream &os, const std::vector<Field> &fields, const std::string &obj, const std::string &buffer, unsigned depth){
+	const std::string indent = make_indent(depth);
+	std::ostringstream suffix;
+	suffix <<depth;
+	for(std::size_t i = 0; i < fields.size(); ++i){
+		const Field &field = fields[i];
+		const std::string val = obj + "." + field.name;
+		switch(field.type){
+		case FT_VINT:
+			os <<indent <<val <<" = shiftVint(" <<buffer <<");\n";
+			break;
+		case FT_VUINT:
+			os <<indent <<val <<" = shiftVuint(" <<buffer <<");\n";
+			break;
+		case FT_FIXED:
+			os <<indent <<val <<" = shiftFixed(" <<buffer <<", " <<field.size <<");\n";
+			break;
+		case FT_STRING:
+			os <<indent <<val <<" = shiftString(" <<buffer <<");\n";
+			break;
+		case FT_BLOB:
+			os <<indent <<val <<" = shiftFixed(" <<buffer <<", shiftVuint(" <<buffer <<"));\n";
+			break;
+		case FT_FLEXIBLE:
+			os <<indent <<val <<" = shiftFlexible(" <<buffer <<");\n";
+			break;
+		case FT_ARRAY:
+			os <<indent <<val <<" = [];\n"
+			   <<indent <<"var count" <<suffix.str() <<" = shiftVuint(" <<buffer <<");\n"
+			   <<indent <<"for(var i" <<suffix.str() <<" = 0; i" <<suffix.str() <<" < count" <<suffix.str() <<"; ++i" <<suffix.str() <<"){\n"
+			   <<indent <<"\tvar elem" <<suffix.str() <<" = {};\n";
+			emit_js_decoder(os, field.children, "elem" + suffix.str(), buffer, depth + 1);
+			os <<indent <<"\t" <<val <<".push(elem" <<suffix.str() <<");\n"
+			   <<indent <<"}\n";
+			break;
+		case FT_LIST:
+			os <<indent <<val <<" = [];\n"
+			   <<indent <<"for(;;){\n"
+			   <<indent <<"\tvar length" <<suffix.str() <<" = shiftVuint(" <<buffer <<");\n"
+			   <<indent <<"\tif(length" <<suffix.str() <<" == 0){\n"
+			   <<indent <<"\t\tbreak;\n"
+			   <<indent <<"\t}\n"
+			   <<indent <<"\tvar chunk" <<suffix.str() <<" = shiftFixed(" <<buffer <<", length" <<suffix.str() <<");\n"
+			   <<indent <<"\tvar elem" <<suffix.str() <<" = {};\n";
+			emit_js_decoder(os, field.children, "elem" + suffix.str(), "chunk" + suffix.str(), depth + 1);
+			os <<indent <<"\t" <<val <<".push(elem" <<suffix.str() <<");\n"
+			   <<indent <<"}\n";
+			break;
+		}
+	}
+}
+
+void emit_js(std::ostream &os, const Schema &schema, const std::string &source){
+	os <<"// 这个文件由 cbpp_schema 从 " <<source <<" 生成，不要手动修改。\n"
+	   <<"// 需要先加载 cbpp.js。\n";
+	for(std::size_t i = 0; i < schema.messages.size(); ++i){
+		const Message &message = schema.messages[i];
+		os <<"\n"
+		   <<"var " <<message.name <<" = { ID: " <<make_hex(message.id) <<" };\n"
+		   <<"function encode" <<message.name <<"(msg){\n"
+		   <<"\tvar buffer = [];\n";
+		emit_js_encoder(os, message.fields, "msg", "buffer", 1);
+		os <<"\treturn buffer;\n"
+		   <<"}\n"
+		   <<"function decode" <<message.name <<"(buffer){\n"
+		   <<"\tvar msg = {};\n";
+		emit_js_decoder(os, message.fields, "msg", "buffer", 1);
+		os <<"\tif(buffer.length != 0){\n"
+		   <<"\t\t// TODO\n"
+		   <<"\t\tthrow \"Junk after message " <<message.name <<"\";\n"
+		   <<"\t}\n"
+		   <<"\treturn msg;\n"
+		   <<"}\n";
+	}
+}
+
+bool write_file(const std::string &path, const std::string &contents){
+	std::ofstream ofs(path.c_str(), std::ios::binary | std::ios::trunc);
+	ofs <<contents;
+	ofs.close();
+	if(!ofs){
+		std::cerr <<"Failed to write file: " <<path <<std::endl;
+		return false;
+	}
+	return true;
+}
+
+}
+
+int main(int argc, char **argv){
+	if((argc != 3) && (argc != 4)){
+		std::cerr <<"Usage: " <<argv[0] <<" <schema> <C++ header> [JavaScript file]" <<std::endl;
+		return 2;
+	}
+	const std::string source = argv[1];
+	std::ifstream ifs(source.c_str(), std::ios::binary);
+	if(!ifs){
+		std::cerr <<"Failed to open file: " <<source <<std::endl;
+		return 1;
+	}
+	std::ostringstream text;
+	text <<ifs.rdbuf();
+
+	Schema schema;
+	try {
+		schema = parse_schema(text.str());
+	} catch(std::exception &e){
+		std::cerr <<source <<": " <<e.what() <<std::endl;
+		return 1;
+	}
+
+	std::ostringstream cpp;
+	emit_cpp(cpp, schema, source, argv[2]);
+	if(!write_file(argv[2], cpp.str())){
+		return 1;
+	}
+	if(argc == 4){
+		std::ostringstream js;
+		emit_js(js, schema, source);
+		if(!write_file(argv[3], js.str())){
+			return 1;
+		}
+	}
+	return 0;
+}